@@ -0,0 +1,186 @@
+#!/bin/bash
+
+# Builds the project produced by generate.sh once per sandbox backend and reports the end-to-end overhead of each
+# backend against an unsandboxed build of the same pip graph: wall time, CPU time of the whole BuildXL process tree,
+# number of access reports and, for the Linux interposer, the bytes sent on the report pipe.
+#
+# Every run is a clean build (fresh object directory, no incremental scheduling, no server) so that each pip is
+# executed; the best of --runs is kept to take the noise of the first, cold run out of the comparison.
+
+readonly MY_DIR=$(cd `dirname ${BASH_SOURCE[0]}` && pwd)
+
+source "${MY_DIR}/env.sh"
+
+declare arg_Runs=3
+declare arg_Backends=""
+declare arg_Generate=""
+declare arg_BxlArgs=()
+
+declare -A g_wallMs
+declare -A g_cpuMs
+declare -A g_reports
+declare -A g_pipBytes
+
+function printUsage {
+    echo "Usage: $0 [--runs R] [--backends b1,b2,...] [--generate \"<generate.sh args>\"] [<additional bxl args>]"
+    echo "Backends: none, linux-interpose, linux-ptrace, macos-es, macos-kext"
+}
+
+function parseArgs {
+    while [[ $# -gt 0 ]]; do
+        case "$1" in
+            --runs)     arg_Runs="$2";     shift 2 ;;
+            --backends) arg_Backends="$2"; shift 2 ;;
+            --generate) arg_Generate="$2"; shift 2 ;;
+            -h|--help)  printUsage; exit 0 ;;
+            *)          arg_BxlArgs+=("$1"); shift ;;
+        esac
+    done
+
+    if [[ -z "$arg_Backends" ]]; then
+        if [[ "$(uname)" == "Darwin" ]]; then
+            arg_Backends="none,macos-es,macos-kext"
+        else
+            arg_Backends="none,linux-interpose,linux-ptrace"
+        fi
+    fi
+}
+
+function backendArgs { # (backend)
+    case "$1" in
+        none)            echo "/sandboxKind:None" ;;
+        linux-interpose) echo "/sandboxKind:LinuxDetours" ;;
+        linux-ptrace)    echo "/sandboxKind:LinuxDetours /enableLinuxPTraceSandbox+ /unconditionallyEnableLinuxPTraceSandbox+" ;;
+        macos-es)        echo "/sandboxKind:MacOsEndpointSecurity" ;;
+        macos-kext)      echo "/sandboxKind:MacOsKext" ;;
+        *)               return 1 ;;
+    esac
+}
+
+# 'date +%s%N' is not available on macOS
+function nowMs {
+    perl -MTime::HiRes=time -e 'printf "%d", time() * 1000'
+}
+
+# Sums the user and system time of all reaped children, as printed by 'times' ("0m1.250s 0m0.310s")
+function childrenCpuMs {
+    times | tail -n 1 | awk '{
+        total = 0;
+        for (i = 1; i <= 2; i++) {
+            split($i, parts, "m");
+            sub("s", "", parts[2]);
+            total += parts[1] * 60000 + parts[2] * 1000;
+        }
+        printf "%d", total;
+    }'
+}
+
+function readStat { # (statsFile, name)
+    local value=$(grep -m 1 "^$2=" "$1" 2>/dev/null | cut -d= -f2)
+    echo "${value:-0}"
+}
+
+function runBuild { # (backend, runDir, extraArgs...)
+    local backend=$1
+    local runDir=$2
+    shift 2
+
+    rm -rf "$runDir"
+    mkdir -p "$runDir"
+
+    /bin/bash "${MacOsScriptsDir}/bxl.sh"  \
+      --config "$MY_DIR/config.dsc"        \
+      --symlink-sdks-into "$MY_DIR/sdk"    \
+      --buildxl-bin "$BUILDXL_BIN"         \
+      $(backendArgs $backend)              \
+      /o:"$runDir/Out"                     \
+      /logsDirectory:"$runDir/Logs"        \
+      /incremental-                        \
+      /server-                             \
+      /disableProcessRetryOnResourceExhaustion+ \
+      "$@"                                 \
+      "${arg_BxlArgs[@]}" > "$runDir/console.txt" 2>&1
+}
+
+function measureBackend { # (backend)
+    local backend=$1
+    local bestWall=""
+
+    for (( run=1; run<=arg_Runs; run++ )); do
+        local runDir="$MY_DIR/Out/$backend/run$run"
+        local start=$(nowMs)
+        local cpu=$(runBuild $backend "$runDir" && childrenCpuMs)
+        local wall=$(( $(nowMs) - start ))
+
+        if [[ -z "$cpu" ]]; then
+            print_error "Build with backend '$backend' failed, see $runDir/console.txt"
+            return 1
+        fi
+
+        print_info "  $backend run $run: ${wall}ms wall, ${cpu}ms cpu"
+
+        if [[ -z "$bestWall" || $wall -lt $bestWall ]]; then
+            bestWall=$wall
+            g_wallMs[$backend]=$wall
+            g_cpuMs[$backend]=$cpu
+            g_reports[$backend]=$(readStat "$runDir/Logs/BuildXL.stats" "SandboxedProcess.AccessReportCount")
+        fi
+    done
+
+    # The interposer only accounts for the pipe traffic when asked to, and that accounting is reported as debug
+    # messages, so it is collected from an extra build that is not part of the timing
+    g_pipBytes[$backend]="n/a"
+    if [[ "$backend" == "linux-interpose" ]]; then
+        local statsDir="$MY_DIR/Out/$backend/pipestats"
+        if runBuild $backend "$statsDir" /enableLinuxSandboxStatistics+ /logObservedFileAccesses+; then
+            g_pipBytes[$backend]=$(grep -o "SentBytes=[0-9]*" "$statsDir/Logs/BuildXL.log" | cut -d= -f2 | awk '{ s += $1 } END { printf "%d", s }')
+        fi
+    fi
+}
+
+function overhead { # (value, baseline)
+    if [[ -z "$2" || "$2" -eq 0 ]]; then
+        echo "n/a"
+    else
+        awk -v v="$1" -v b="$2" 'BEGIN { printf "%+.1f%%", (v - b) * 100 / b }'
+    fi
+}
+
+function printResults {
+    local baseWall=${g_wallMs[none]}
+    local baseCpu=${g_cpuMs[none]}
+
+    echo
+    printf "%-16s %10s %10s %10s %10s %12s %14s\n" "backend" "wall ms" "overhead" "cpu ms" "overhead" "reports" "pipe bytes"
+    for backend in ${arg_Backends//,/ }; do
+        [[ -n "${g_wallMs[$backend]}" ]] || continue
+        printf "%-16s %10s %10s %10s %10s %12s %14s\n" \
+            "$backend" \
+            "${g_wallMs[$backend]}" "$(overhead ${g_wallMs[$backend]} $baseWall)" \
+            "${g_cpuMs[$backend]}" "$(overhead ${g_cpuMs[$backend]} $baseCpu)" \
+            "${g_reports[$backend]}" "${g_pipBytes[$backend]}"
+    done
+}
+
+parseArgs "$@"
+
+for backend in ${arg_Backends//,/ }; do
+    if ! backendArgs $backend > /dev/null; then
+        print_error "Unknown backend: $backend"
+        printUsage
+        exit 1
+    fi
+done
+
+if [[ -n "$arg_Generate" || ! -d "$MY_DIR/generated" ]]; then
+    /bin/bash "$MY_DIR/generate.sh" $arg_Generate || exit 1
+fi
+
+mkdir -p "$MY_DIR/sdk"
+
+for backend in ${arg_Backends//,/ }; do
+    print_info "Measuring backend: $backend"
+    measureBackend $backend
+done
+
+printResults
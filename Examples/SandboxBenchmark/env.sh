@@ -0,0 +1,5 @@
+#!/bin/bash
+
+export MacOsScriptsDir="$(cd `dirname ${BASH_SOURCE[0]}` && pwd)/../../Public/Src/Sandbox/MacOs/scripts"
+
+source "${MacOsScriptsDir}/env.sh"
@@ -0,0 +1,106 @@
+#!/bin/bash
+
+# Generates the synthetic project built by benchmark.sh: N libraries of M C sources each, K data files per library
+# for the process tree pips, and a main program linking every library.
+
+readonly MY_DIR=$(cd `dirname ${BASH_SOURCE[0]}` && pwd)
+
+source "${MY_DIR}/env.sh"
+
+declare arg_Libraries=10
+declare arg_Sources=20
+declare arg_Processes=8
+declare arg_OutDir="$MY_DIR/generated"
+
+function printUsage {
+    echo "Usage: $0 [--libraries N] [--sources M] [--processes K] [--out DIR]"
+}
+
+function parseArgs {
+    while [[ $# -gt 0 ]]; do
+        case "$1" in
+            --libraries) arg_Libraries="$2"; shift 2 ;;
+            --sources)   arg_Sources="$2";   shift 2 ;;
+            --processes) arg_Processes="$2"; shift 2 ;;
+            --out)       arg_OutDir="$2";    shift 2 ;;
+            -h|--help)   printUsage; exit 0 ;;
+            *)           print_error "Unknown argument: $1"; printUsage; exit 1 ;;
+        esac
+    done
+}
+
+function generateLibrary { # (libIndex)
+    local lib=$1
+    local libDir="$arg_OutDir/lib$lib"
+    mkdir -p "$libDir/data"
+
+    {
+        echo "#pragma once"
+        for (( src=0; src<arg_Sources; src++ )); do
+            echo "int lib${lib}_src${src}(int seed);"
+        done
+        echo "int lib${lib}_entry(int seed);"
+    } > "$libDir/lib.h"
+
+    for (( src=0; src<arg_Sources; src++ )); do
+        cat > "$libDir/src$src.c" <<EOC
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lib.h"
+
+int lib${lib}_src${src}(int seed)
+{
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "lib${lib}_src${src}:%d", seed);
+    return (int)strlen(buffer) + abs(seed % $((lib * 31 + src + 7)));
+}
+EOC
+    done
+
+    {
+        echo "#include \"lib.h\""
+        echo "int lib${lib}_entry(int seed)"
+        echo "{"
+        echo "    int sum = 0;"
+        for (( src=0; src<arg_Sources; src++ )); do
+            echo "    sum += lib${lib}_src${src}(seed + ${src});"
+        done
+        echo "    return sum;"
+        echo "}"
+    } > "$libDir/entry.c"
+
+    for (( proc=0; proc<arg_Processes; proc++ )); do
+        echo "lib$lib data file $proc" > "$libDir/data/$proc.txt"
+    done
+}
+
+function generateMain {
+    {
+        echo "#include <stdio.h>"
+        for (( lib=0; lib<arg_Libraries; lib++ )); do
+            echo "int lib${lib}_entry(int seed);"
+        done
+        echo "int main(void)"
+        echo "{"
+        echo "    int sum = 0;"
+        for (( lib=0; lib<arg_Libraries; lib++ )); do
+            echo "    sum += lib${lib}_entry(${lib});"
+        done
+        echo "    printf(\"%d\\n\", sum);"
+        echo "    return 0;"
+        echo "}"
+    } > "$arg_OutDir/main.c"
+}
+
+parseArgs "$@"
+
+rm -rf "$arg_OutDir"
+mkdir -p "$arg_OutDir"
+
+for (( lib=0; lib<arg_Libraries; lib++ )); do
+    generateLibrary $lib
+done
+generateMain
+
+print_info "Generated $arg_Libraries libraries x $arg_Sources sources ($arg_Processes process tree children each) into $arg_OutDir"
@@ -384,6 +384,60 @@ namespace BuildXL
                         OptionHandlerFactory.CreateBoolOption(
                             "enableLinuxPTraceSandbox",
                             sign => sandboxConfiguration.EnableLinuxPTraceSandbox = PtraceSandboxProcessChecker.AreRequiredToolsInstalled(out _) && sign),
+                        OptionHandlerFactory.CreateBoolOption(
+                            "enableLinuxSeccompNotifySandbox",
+                            sign => sandboxConfiguration.EnableLinuxSeccompNotifySandbox = sign),
+                        OptionHandlerFactory.CreateBoolOption(
+                            "enableLinuxSharedAccessCache",
+                            sign => sandboxConfiguration.EnableLinuxSharedAccessCache = sign),
+                        OptionHandlerFactory.CreateBoolOption(
+                            "enableLinuxSandboxStatistics",
+                            sign => sandboxConfiguration.EnableLinuxSandboxStatistics = sign),
+                        OptionHandlerFactory.CreateBoolOption(
+                            "enableSharedMemoryReports",
+                            sign => sandboxConfiguration.EnableSharedMemoryReports = sign),
+                        OptionHandlerFactory.CreateBoolOption(
+                            "enableCompactFileAccessReports",
+                            sign => sandboxConfiguration.EnableCompactFileAccessReports = sign),
+                        OptionHandlerFactory.CreateBoolOption(
+                            "enableReportBatching",
+                            sign => sandboxConfiguration.EnableReportBatching = sign),
+                        OptionHandlerFactory.CreateBoolOption(
+                            "enableSharedReparsePointCache",
+                            sign => sandboxConfiguration.EnableSharedReparsePointCache = sign),
+                        OptionHandlerFactory.CreateBoolOption(
+                            "enableManifestRecordIndex",
+                            sign => sandboxConfiguration.EnableManifestRecordIndex = sign),
+                        OptionHandlerFactory.CreateBoolOption(
+                            "enableSharedPayloadSection",
+                            sign => sandboxConfiguration.EnableSharedPayloadSection = sign),
+                        OptionHandlerFactory.CreateBoolOption(
+                            "enableDetoursProfile",
+                            sign => sandboxConfiguration.EnableDetoursProfile = sign),
+                        OptionHandlerFactory.CreateBoolOption(
+                            "enableLinuxLightweightObservation",
+                            sign => sandboxConfiguration.EnableLinuxLightweightObservation = sign),
+                        OptionHandlerFactory.CreateBoolOption(
+                            "enableLinuxPTraceFdTable",
+                            sign => sandboxConfiguration.EnableLinuxPTraceFdTable = sign),
+                        OptionHandlerFactory.CreateBoolOption(
+                            "enableBlockCloneCopies",
+                            sign => sandboxConfiguration.EnableBlockCloneCopies = sign),
+                        OptionHandlerFactory.CreateBoolOption(
+                            "enableReportDeduplication",
+                            sign => sandboxConfiguration.EnableReportDeduplication = sign),
+                        OptionHandlerFactory.CreateBoolOption(
+                            "enableLinuxCgroupAccounting",
+                            sign => sandboxConfiguration.EnableLinuxCgroupAccounting = sign),
+                        OptionHandlerFactory.CreateBoolOption(
+                            "enableLinuxCompressedReports",
+                            sign => sandboxConfiguration.EnableLinuxCompressedReports = sign),
+                        OptionHandlerFactory.CreateBoolOption(
+                            "enableLinuxPTraceHandBack",
+                            sign => sandboxConfiguration.EnableLinuxPTraceHandBack = sign),
+                        OptionHandlerFactory.CreateBoolOption(
+                            "enableLinuxSampledObservation",
+                            sign => sandboxConfiguration.EnableLinuxSampledObservation = sign),
                         OptionHandlerFactory.CreateBoolOption(
                             "enableMemoryMappedBasedFileHashing",
                             sign => {
@@ -1119,6 +1173,9 @@ namespace BuildXL
                         OptionHandlerFactory.CreateOption(
                             "enforceFullReparsePointsUnderPath",
                             opt => sandboxConfiguration.DirectoriesToEnableFullReparsePointParsing.Add(CommandLineUtilities.ParsePathOption(opt, pathTable))),
+                        OptionHandlerFactory.CreateOption(
+                            "noReparsePointsUnderPath",
+                            opt => sandboxConfiguration.DirectoriesWithoutReparsePoints.Add(CommandLineUtilities.ParsePathOption(opt, pathTable))),
                         OptionHandlerFactory.CreateBoolOption(
                             "treatAbsentDirectoryAsExistentUnderOpaque",
                             sign => schedulingConfiguration.TreatAbsentDirectoryAsExistentUnderOpaque = sign),
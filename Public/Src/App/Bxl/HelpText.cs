@@ -740,6 +740,11 @@ namespace BuildXL
                 Strings.HelpText_DisplayHelp_EnforceFullReparsePointsUnderPath,
                 HelpLevel.Verbose);
 
+            hw.WriteOption(
+                "/noReparsePointsUnderPath:<path>",
+                Strings.HelpText_DisplayHelp_NoReparsePointsUnderPath,
+                HelpLevel.Verbose);
+
             hw.WriteOption(
                 "/analyzeDependencyViolations[+|-]",
                 Strings.HelpText_DisplayHelp_AnalyzeDependencyViolations,
@@ -911,6 +916,114 @@ namespace BuildXL
                 HelpLevel.Verbose
                 );
 
+            hw.WriteOption(
+                "/enableLinuxSeccompNotifySandbox[+|-]",
+                Strings.HelpText_DisplayHelp_EnableLinuxSeccompNotifySandbox,
+                HelpLevel.Verbose
+                );
+
+            hw.WriteOption(
+                "/enableLinuxSharedAccessCache[+|-]",
+                Strings.HelpText_DisplayHelp_EnableLinuxSharedAccessCache,
+                HelpLevel.Verbose
+                );
+
+            hw.WriteOption(
+                "/enableLinuxSandboxStatistics[+|-]",
+                Strings.HelpText_DisplayHelp_EnableLinuxSandboxStatistics,
+                HelpLevel.Verbose
+                );
+
+            hw.WriteOption(
+                "/enableSharedMemoryReports[+|-]",
+                Strings.HelpText_DisplayHelp_EnableSharedMemoryReports,
+                HelpLevel.Verbose
+                );
+
+            hw.WriteOption(
+                "/enableCompactFileAccessReports[+|-]",
+                Strings.HelpText_DisplayHelp_EnableCompactFileAccessReports,
+                HelpLevel.Verbose
+                );
+
+            hw.WriteOption(
+                "/enableReportBatching[+|-]",
+                Strings.HelpText_DisplayHelp_EnableReportBatching,
+                HelpLevel.Verbose
+                );
+
+            hw.WriteOption(
+                "/enableSharedReparsePointCache[+|-]",
+                Strings.HelpText_DisplayHelp_EnableSharedReparsePointCache,
+                HelpLevel.Verbose
+                );
+
+            hw.WriteOption(
+                "/enableManifestRecordIndex[+|-]",
+                Strings.HelpText_DisplayHelp_EnableManifestRecordIndex,
+                HelpLevel.Verbose
+                );
+
+            hw.WriteOption(
+                "/enableSharedPayloadSection[+|-]",
+                Strings.HelpText_DisplayHelp_EnableSharedPayloadSection,
+                HelpLevel.Verbose
+                );
+
+            hw.WriteOption(
+                "/enableDetoursProfile[+|-]",
+                Strings.HelpText_DisplayHelp_EnableDetoursProfile,
+                HelpLevel.Verbose
+                );
+
+            hw.WriteOption(
+                "/enableLinuxLightweightObservation[+|-]",
+                Strings.HelpText_DisplayHelp_EnableLinuxLightweightObservation,
+                HelpLevel.Verbose
+                );
+
+            hw.WriteOption(
+                "/enableLinuxPTraceFdTable[+|-]",
+                Strings.HelpText_DisplayHelp_EnableLinuxPTraceFdTable,
+                HelpLevel.Verbose
+                );
+
+            hw.WriteOption(
+                "/enableBlockCloneCopies[+|-]",
+                Strings.HelpText_DisplayHelp_EnableBlockCloneCopies,
+                HelpLevel.Verbose
+                );
+
+            hw.WriteOption(
+                "/enableReportDeduplication[+|-]",
+                Strings.HelpText_DisplayHelp_EnableReportDeduplication,
+                HelpLevel.Verbose
+                );
+
+            hw.WriteOption(
+                "/enableLinuxCgroupAccounting[+|-]",
+                Strings.HelpText_DisplayHelp_EnableLinuxCgroupAccounting,
+                HelpLevel.Verbose
+                );
+
+            hw.WriteOption(
+                "/enableLinuxCompressedReports[+|-]",
+                Strings.HelpText_DisplayHelp_EnableLinuxCompressedReports,
+                HelpLevel.Verbose
+                );
+
+            hw.WriteOption(
+                "/enableLinuxPTraceHandBack[+|-]",
+                Strings.HelpText_DisplayHelp_EnableLinuxPTraceHandBack,
+                HelpLevel.Verbose
+                );
+
+            hw.WriteOption(
+                "/enableLinuxSampledObservation[+|-]",
+                Strings.HelpText_DisplayHelp_EnableLinuxSampledObservation,
+                HelpLevel.Verbose
+                );
+
             hw.WriteOption(
                 "/alwaysRemoteInjectDetoursFrom32BitProcess[+|-]",
                 Strings.HelpText_DisplayHelp_AlwaysRemoteInjectDetoursFrom32BitProcess,
@@ -21,7 +21,6 @@
 #define MIN_SUBST_LENGTH 3
 #define SUBST_START_OFFSET 2
 #define SUBST_SOURCE_LENGTH 65536
-#define GET_PATH_TARGET_OFFSET  8
 #define RUN_IN_SUBST_VERBOSE L"RUN_IN_SUBST_VERBOSE"
 #define RUN_IN_SUBST_VERBOSE_BUFF_SIZE 2
 #define MAPPED_PATH_STRING L"\\??\\"
@@ -270,297 +269,95 @@ static bool ParseSubstSourcesAndTargets(int argc, _TCHAR* argv[], PSUBST_LIST_NO
 #pragma warning( pop )
 
 #pragma warning( push )
-// warning C6386: Buffer overrun while writing to 'chBuf'.
 // warning C26446: Prefer to use gsl::at() instead of unchecked subscript operator (bounds.4).
 // warning C26401: Do not delete a raw pointer that is not an owner<T> (i.11).
-// warning C26414: Move, copy, reassign or reset a local smart pointer 'chBuf' / 'mappedPath' (r.5).
 // warning C26481: Don't use pointer arithmetic. Use span instead (bounds.1).
-// warning C26485: Expression 'dl': No array to pointer decay (bounds.3).
 // warning C26472: Don't use a static_cast for arithmetic conversions. Use brace initialization, gsl::narrow_cast or gsl::narrow (type.1).
 // warning C26409: Avoid calling new and delete explicitly, use std::make_unique<T> instead (r.11).
-#pragma warning( disable : 6386 26446 26401 26414 26481 26485 26472 26409 )
+#pragma warning( disable : 26446 26401 26481 26472 26409 )
 
-// Gets the mapped path for each mapped drive.
-// Returns 0 if successful and non-zero if failed.
-static int GetMappedPaths(PSUBST_NODE* pOrderedSubstList)
+// Gets the path the drive of the node is mapped to, or nullptr when the drive is not a subst drive.
+// This queries the DOS device namespace directly instead of listing the substs with subst.exe, which
+// takes a process creation per query.
+static void GetMappedPath(PSUBST_NODE pSubstNode)
 {
-    assert(pOrderedSubstList != nullptr);
-
-    SECURITY_ATTRIBUTES saAttr{};
-    HANDLE g_hChildStd_IN_Rd = NULL;
-    HANDLE g_hChildStd_OUT_Rd = NULL;
-    HANDLE g_hChildStd_OUT_Wr = NULL;
-
-    // Set the bInheritHandle flag so pipe handles are inherited. 
-    saAttr.nLength = sizeof(SECURITY_ATTRIBUTES);
-    saAttr.bInheritHandle = TRUE;
-    saAttr.lpSecurityDescriptor = NULL;
-
-    // Create a pipe for the child process's STDOUT. 
+    assert(pSubstNode != nullptr);
 
-    if (!CreatePipe(&g_hChildStd_OUT_Rd, &g_hChildStd_OUT_Wr, &saAttr, 0))
+    if (pSubstNode->szMappedPath != nullptr)
     {
-        wprintf(L"Error: Could not get MappedDrives: CreatePipe.\r\n");
-        return 1;
+        delete[] pSubstNode->szMappedPath;
+        pSubstNode->szMappedPath = nullptr;
     }
 
-    // Ensure the read handle to the pipe for STDOUT is not inherited
-    if (!SetHandleInformation(g_hChildStd_OUT_Rd, HANDLE_FLAG_INHERIT, 0))
-    {
-        wprintf(L"Error: Could not get MappedDrives: SetHandleInformation.\r\n");
-        return 1;
-    }
+    const TCHAR drive[3] = { pSubstNode->szDriveLetter, L':', L'\0' };
+    auto target = std::vector<wchar_t>(SUBST_SOURCE_LENGTH, 0);
 
-    BOOL bSuccess = FALSE;
-    std::wstring substCommand(L"subst.exe");
-
-    // Set up members of the PROCESS_INFORMATION structure
-    PROCESS_INFORMATION piProcInfo;
-    ZeroMemory(&piProcInfo, sizeof(PROCESS_INFORMATION));
-
-    // Declare process info
-    STARTUPINFO siStartInfo;
-
-    // Set up members of the STARTUPINFO structure. 
-    // This structure specifies the STDIN and STDOUT handles for redirection.
-    ZeroMemory(&siStartInfo, sizeof(STARTUPINFO));
-    siStartInfo.cb = sizeof(STARTUPINFO);
-    siStartInfo.hStdError = g_hChildStd_OUT_Wr;
-    siStartInfo.hStdOutput = g_hChildStd_OUT_Wr;
-    siStartInfo.hStdInput = g_hChildStd_IN_Rd;
-    siStartInfo.dwFlags |= STARTF_USESTDHANDLES;
-
-    // Create the child process. 
-    bSuccess = CreateProcess(NULL,
-        (LPWSTR)substCommand.c_str(), // command line 
-        NULL,     // process security attributes 
-        NULL,     // primary thread security attributes 
-        TRUE,     // handles are inherited 
-        0,       // creation flags 
-        NULL,     // use parent's environment 
-        NULL,     // use parent's current directory 
-        &siStartInfo, // STARTUPINFO pointer 
-        &piProcInfo); // receives PROCESS_INFORMATION
-
-    // If an error occurs...
-    if (!bSuccess)
+    // A subst drive is a link to "\??\<path>". The first string of the result is the current target of the drive,
+    // other devices (volumes, network drives) are not substs.
+    if (QueryDosDevice(drive, target.data(), SUBST_SOURCE_LENGTH) == 0 || wcsstr(target.data(), MAPPED_PATH_STRING) != target.data())
     {
-        wprintf(L"Error: Could not get MappedDrives: CreateProcess.\r\n");
-        return 1;
+        printVerbose(L"Drive {}: is not a subst drive.", static_cast<char>(pSubstNode->szDriveLetter));
+        return;
     }
 
-    printVerbose(L"{}", L"Start waiting for subst process in GetMappedPath to complete.");
-    WaitForSingleObject(piProcInfo.hProcess, INFINITE);
-    printVerbose(L"{}", L"Done waiting for subst process in GetMappedPath to complete.");
-
-    // Close handles to the child process and its primary thread
-    CloseHandle(piProcInfo.hProcess);
-    CloseHandle(piProcInfo.hThread);
-
-    // Read output from the child process's pipe for STDOUT
-    // Stop when there is no more data. 
-    bSuccess = FALSE;
-
-    // Close the write end of the pipe before reading from the 
-    // read end of the pipe, to control child process execution.
-    // The pipe is assumed to have enough buffer space to hold the
-    // data the child process has already written to it.
-    if (!CloseHandle(g_hChildStd_OUT_Wr))
-    {
-        wprintf(L"Error: Could not get MappedDrives: CloseChildHandle.\r\n");
-        return 1;
-    }
+    std::basic_string<TCHAR> mappedPath(target.data() + wcslen(MAPPED_PATH_STRING)); // Skip leading "\\??\\".
 
-    DWORD dwRead = 0;
-    auto chBuf = std::vector<char>(SUBST_SOURCE_LENGTH, 0);
-    std::basic_string<TCHAR> mappedPath;
-
-    while (true)
-    {
-        bSuccess = ReadFile(g_hChildStd_OUT_Rd, chBuf.data(), SUBST_SOURCE_LENGTH, &dwRead, NULL);
-
-        // When using CreateProcess everything is fine here
-        // When using CreateProcessWithLogonW bSuccess is FALSE and the pipe seems to be closed
-
-        if (!bSuccess || dwRead == 0)
-        {
-            break;
-        }
-
-        if (dwRead == 0) break;
-        chBuf[dwRead] = L'\0';
-
-        unsigned i = 0;
-
-        while (true)
+    std::transform(mappedPath.begin(), mappedPath.end(), mappedPath.begin(),
+        [](TCHAR c) noexcept
         {
-            if (chBuf[i] == L'\0')
-            {
-                break;
-            }
-
-            // Find the drive we are trying to map
-            TCHAR driveLetter = (TCHAR)chBuf[i];
-
-            i += GET_PATH_TARGET_OFFSET;
-            mappedPath.clear();
-
-            while (chBuf[i] != L'\r' && chBuf[i] != L'\0')
-            {
-                mappedPath.push_back(static_cast<TCHAR>(::tolower(chBuf[i])));
-                i++;
-            }
-
-            const wchar_t* ptr = wcsstr(mappedPath.c_str(), MAPPED_PATH_STRING);
-            unsigned mappedPathOffset = 0;
-            if (ptr == mappedPath.c_str())
-            {
-                mappedPathOffset = 4;
-            }
-
-            // Make drive letter uppercase.
-            driveLetter = static_cast<TCHAR>(::_totupper(driveLetter));
-            int substTargetValue = static_cast<int>(driveLetter);
-
-            // The drive letter can be A-Z only.
-            if (substTargetValue < 65 || substTargetValue > 90)
-            {
-                TCHAR dl[2];
-                dl[0] = driveLetter;
-                dl[1] = L'\0';
-                wprintf(L"Error: Invalid target drive letter - %s. Allowed drive letters A-Z.\r\n", dl);
-                return 1;
-            }
-
-            // make sure there is a trailing '\\'.
-            const size_t srcLen = wcslen(mappedPath.c_str());
-            if (mappedPath.back() != L'\\')
-            {
-                mappedPath.push_back(L'\\');
-            }
-
-            if (pOrderedSubstList[substTargetValue - 65] != nullptr)
-            {
-                if (pOrderedSubstList[substTargetValue - 65]->szMappedPath != nullptr)
-                {
-                    delete[] pOrderedSubstList[substTargetValue - 65]->szMappedPath;
-                }
-
-                pOrderedSubstList[substTargetValue - 65]->szMappedPath = new TCHAR[srcLen + 2];
-                wcscpy_s(pOrderedSubstList[substTargetValue - 65]->szMappedPath, srcLen + 2, mappedPath.c_str() + mappedPathOffset); // Skip leading "\\??\\".
-            }
-
-            if (chBuf[i] == L'\0')
-            {
-                break;
-            }
-            else
-            {
-                // Skip the \r char
-                i++;
-                // Skip the \n char
-                i++;
-            }
-        }
+            return static_cast<TCHAR>(::_totlower(c));
+        });
 
-        if (chBuf[i])
-        {
-            break;
-        }
+    // make sure there is a trailing '\\'.
+    if (mappedPath.empty() || mappedPath.back() != L'\\')
+    {
+        mappedPath.push_back(L'\\');
     }
 
-    CloseHandle(g_hChildStd_OUT_Rd);
+    pSubstNode->szMappedPath = new TCHAR[mappedPath.length() + 1];
+    wcscpy_s(pSubstNode->szMappedPath, mappedPath.length() + 1, mappedPath.c_str());
+}
 
-    return 0;
+// Whether the drive of the node is currently mapped to its source location.
+static bool IsMappedToSource(PSUBST_NODE pSubstNode) noexcept
+{
+    return pSubstNode->szSourceDirectory != nullptr &&
+        pSubstNode->szMappedPath != nullptr &&
+        wcscmp(pSubstNode->szSourceDirectory, pSubstNode->szMappedPath) == 0;
 }
 #pragma warning( pop )
 
 #pragma warning( push )
-// warning C6386: Buffer overrun while writing to 'chBuf'.
-// warning C26446: Prefer to use gsl::at() instead of unchecked subscript operator (bounds.4).
-// warning C26401: Do not delete a raw pointer that is not an owner<T> (i.11).
-// warning C26414: Move, copy, reassign or reset a local smart pointer 'chBuf' / 'mappedPath' (r.5).
+// warning C26461: The pointer argument 'pSubstNode' for function 'UnmapDrive' can be marked as a pointer to const (con.3).
 // warning C26481: Don't use pointer arithmetic. Use span instead (bounds.1).
-// warning C26485: Expression 'dl': No array to pointer decay (bounds.3).
-// warning C26409: Avoid calling new and delete explicitly, use std::make_unique<T> instead (r.11).
-// warning C26472: Don't use a static_cast for arithmetic conversions. Use brace initialization, gsl::narrow_cast or gsl::narrow (type.1).
-#pragma warning( disable : 6386 26446 26401 26414 26481 26485 26409 26472 )
-
-// Start a process and returns if it had error (1) or not (0).
-static int MapUnmapSubstExecute(std::wstring substCommand)
+#pragma warning( disable : 26461 26481 )
+// The drives are defined with DefineDosDevice, which is what subst.exe does, without starting a subst.exe for each of them.
+// Like subst.exe, no WM_DEVICECHANGE is broadcast: the consumers of the drives are the processes started here, which go
+// to the object manager for them, not GUI applications listening for device arrivals.
+// Returns 0 on success and non-zero on failure.
+static int UnmapDrive(PSUBST_NODE pSubstNode)
 {
-    STARTUPINFO si{};
-    PROCESS_INFORMATION pi{};
-
-    ZeroMemory(&si, sizeof(si));
-    si.cb = sizeof(si);
-    ZeroMemory(&pi, sizeof(pi));
-
-    // CreateProcessW may modify the command line
-    auto mutableCommandLine = std::make_unique<TCHAR[]>(substCommand.size() + 1);
-    ZeroMemory(mutableCommandLine.get(), sizeof(TCHAR) * (substCommand.size() + 1));
-    _tcscpy_s(mutableCommandLine.get(), substCommand.size() + 1, substCommand.c_str());
-
-    if (!CreateProcess(nullptr, mutableCommandLine.get(), nullptr, nullptr, false, NORMAL_PRIORITY_CLASS, nullptr, nullptr, &si, &pi))
-    {
-        // Release the mutex
-        return 1;
-    }
-
-    printVerbose(L"{}", L"Start waiting for process Map/Unmap to complete.");
-    WaitForSingleObject(pi.hProcess, INFINITE);
-    printVerbose(L"{}", L"Done waiting for process Map/Unmap to complete.");
+    const TCHAR drive[3] = { pSubstNode->szDriveLetter, L':', L'\0' };
 
-    DWORD exitCode = 0;
-    if (!GetExitCodeProcess(pi.hProcess, &exitCode))
+    if (!DefineDosDevice(DDD_REMOVE_DEFINITION, drive, nullptr))
     {
-        CloseHandle(pi.hProcess);
-        CloseHandle(pi.hThread);
-        return 1;
-    }
-
-    CloseHandle(pi.hProcess);
-    CloseHandle(pi.hThread);
-
-    if (exitCode != 0)
-    {
-        // Release the mutex
+        printVerbose(L"Failed removing drive {}:. Error: {}", static_cast<char>(pSubstNode->szDriveLetter), GetLastError());
         return 1;
     }
 
     return 0;
 }
-#pragma warning( pop )
-
-#pragma warning( push )
-// warning C26461: The pointer argument 'pSubstNode' for function 'UnmapDrive' can be marked as a pointer to const (con.3).
-#pragma warning( disable : 26461 )
-static int UnmapDrive(PSUBST_NODE pSubstNode)
-{
-    int ret = 0;
-
-    std::wstring substCommand(L"subst /D \"");
-    substCommand.push_back(pSubstNode->szDriveLetter);
-    substCommand.push_back(L':');
-    substCommand.append(L"\"");
-
-    ret = MapUnmapSubstExecute(substCommand.c_str());
-
-    return ret;
-}
 
 static int MapDrive(PSUBST_NODE pSubstNode)
 {
-    int ret = 0;
+    const TCHAR drive[3] = { pSubstNode->szDriveLetter, L':', L'\0' };
+    std::basic_string<TCHAR> source(pSubstNode->szSourceDirectory, wcslen(pSubstNode->szSourceDirectory) - 1); // Skip the trailing '\\'.
 
-    std::wstring substCommand(L"subst \"");
-    substCommand.push_back(pSubstNode->szDriveLetter);
-    substCommand.push_back(L':');
-    substCommand.append(L"\" \"");
-    substCommand.append(pSubstNode->szSourceDirectory, wcslen(pSubstNode->szSourceDirectory) - 1); // Skip the trailing '\\'.
-    substCommand.append(L"\"");
-
-    ret = MapUnmapSubstExecute(substCommand);
+    if (!DefineDosDevice(0, drive, source.c_str()))
+    {
+        printVerbose(L"Failed defining drive {}: for {}. Error: {}", static_cast<char>(pSubstNode->szDriveLetter), source, GetLastError());
+        return 1;
+    }
 
     return 0;
 }
@@ -850,13 +647,16 @@ static int SubstDrivesAndExecute(int argc, _TCHAR* argv[], PSUBST_LIST_NODE pSub
                 continue;
             };
 
-            MapDrive(pListNode);
-
-            GetMappedPaths(pOrderedSubstList);
+            // A mapping to the same location (e.g., left behind by a process that was killed) is reused as is.
+            // The lock file it points at is the one of the source location, which this process holds already.
+            GetMappedPath(pListNode);
+            if (!IsMappedToSource(pListNode))
+            {
+                MapDrive(pListNode);
+                GetMappedPath(pListNode);
+            }
 
-            if (pListNode->szSourceDirectory != nullptr &&
-                pListNode->szMappedPath != nullptr &&
-                wcscmp(pListNode->szSourceDirectory, pListNode->szMappedPath) == 0)
+            if (IsMappedToSource(pListNode))
             {
                 i++;
                 continue;
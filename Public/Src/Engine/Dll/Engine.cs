@@ -770,6 +770,12 @@ namespace BuildXL.Engine
             mutableConfig.Sandbox.TimeoutDumpDirectory = logging.LogsDirectory.Combine(pathTable, "TimeoutDumps");
             mutableConfig.Sandbox.SurvivingPipProcessChildrenDumpDirectory = logging.LogsDirectory.Combine(pathTable, LogFileExtensions.SurvivingPipProcessChildrenDumpDirectory);
 
+            // CODESYNC: Public/Src/Sandbox/Linux/bxl_observer.cpp (persist_ptrace_classification). The suffix is the version of the format of the entries.
+            if (!mutableConfig.Sandbox.LinuxPTraceClassificationDirectory.IsValid)
+            {
+                mutableConfig.Sandbox.LinuxPTraceClassificationDirectory = layout.EngineCacheDirectory.Combine(pathTable, "PTraceClassifications.v1");
+            }
+
             logging.Log = logging.LogsDirectory.Combine(pathTable, logging.LogPrefix + LogFileExtensions.Log);
             logging.ErrorLog = logging.LogsDirectory.Combine(pathTable, logging.LogPrefix + LogFileExtensions.Errors);
             logging.WarningLog = logging.LogsDirectory.Combine(pathTable, logging.LogPrefix + LogFileExtensions.Warnings);
@@ -334,6 +334,26 @@ namespace BuildXL.ProcessPipExecutor
                     EnableLinuxSandboxLogging = m_verboseProcessLoggingEnabled,
                     AlwaysRemoteInjectDetoursFrom32BitProcess = m_sandboxConfig.AlwaysRemoteInjectDetoursFrom32BitProcess,
                     UnconditionallyEnableLinuxPTraceSandbox = m_sandboxConfig.UnconditionallyEnableLinuxPTraceSandbox,
+                    EnableLinuxSeccompNotifySandbox = m_sandboxConfig.EnableLinuxSeccompNotifySandbox,
+                    EnableLinuxSharedAccessCache = m_sandboxConfig.EnableLinuxSharedAccessCache,
+                    EnableLinuxSandboxStatistics = m_sandboxConfig.EnableLinuxSandboxStatistics,
+                    EnableSharedMemoryReports = m_sandboxConfig.EnableSharedMemoryReports,
+                    EnableCompactFileAccessReports = m_sandboxConfig.EnableCompactFileAccessReports,
+                    EnableReportBatching = m_sandboxConfig.EnableReportBatching,
+                    EnableSharedReparsePointCache = m_sandboxConfig.EnableSharedReparsePointCache,
+                    EnableManifestRecordIndex = m_sandboxConfig.EnableManifestRecordIndex,
+                    EnableSharedPayloadSection = m_sandboxConfig.EnableSharedPayloadSection,
+                    EnableDetoursProfile = m_sandboxConfig.EnableDetoursProfile,
+                    EnableLinuxLightweightObservation = m_sandboxConfig.EnableLinuxLightweightObservation,
+                    EnableLinuxPTraceFdTable = m_sandboxConfig.EnableLinuxPTraceFdTable,
+                    EnableBlockCloneCopies = m_sandboxConfig.EnableBlockCloneCopies,
+                    EnableReportDeduplication = m_sandboxConfig.EnableReportDeduplication,
+                    EnableLinuxCgroupAccounting = m_sandboxConfig.EnableLinuxCgroupAccounting,
+                    EnableLinuxCompressedReports = m_sandboxConfig.EnableLinuxCompressedReports,
+                    EnableLinuxPTraceHandBack = m_sandboxConfig.EnableLinuxPTraceHandBack,
+                    EnableLinuxSampledObservation = m_sandboxConfig.EnableLinuxSampledObservation,
+                    // Service pips outlive the pips they serve, so their scopes may change while they run
+                    EnableLinuxManifestUpdates = m_pip.IsService,
                     IgnoreDeviceIoControlGetReparsePoint = m_sandboxConfig.IgnoreDeviceIoControlGetReparsePoint,
                 };
 
@@ -851,6 +871,9 @@ namespace BuildXL.ProcessPipExecutor
                         PipDescription = m_pipDescription,
                         TimeoutDumpDirectory = PreparePipTimeoutDumpDirectory(m_sandboxConfig, m_pip, m_pathTable),
                         SurvivingPipProcessChildrenDumpDirectory = m_sandboxConfig.SurvivingPipProcessChildrenDumpDirectory.ToString(m_pathTable),
+                        PTraceClassificationDirectory = m_sandboxConfig.LinuxPTraceClassificationDirectory.IsValid
+                            ? m_sandboxConfig.LinuxPTraceClassificationDirectory.ToString(m_pathTable)
+                            : null,
                         SandboxKind = m_pip.DisableSandboxing ? SandboxKind.None : m_sandboxConfig.UnsafeSandboxConfiguration.SandboxKind,
                         AllowedSurvivingChildProcessNames = m_pip.AllowedSurvivingChildProcessNames.Select(n => n.ToString(m_pathTable.StringTable)).ToArray(),
                         NestedProcessTerminationTimeout = m_pip.NestedProcessTerminationTimeout ?? SandboxedProcessInfo.DefaultNestedProcessTerminationTimeout,
@@ -1491,9 +1514,11 @@ namespace BuildXL.ProcessPipExecutor
                 // a pip running longer than the timeout (5 hours). The pip gets killed and in such cases the message count mismatch
                 // is legitimate.
                 // Report a counter mismatch only if there are no other errors.
+                // More reports than counted can be received when a process is killed before it releases the semaphore by the count of the
+                // reports it sent through the shared-memory ring, so only missing reports are a mismatch.
                 if (result.Status == SandboxedProcessPipExecutionStatus.Succeeded && isMessageSemaphoreCountCreated)
                 {
-                    if (lastMessageCount != 0)
+                    if (lastMessageCount > 0)
                     {
                         Logger.Log.LogMismatchedDetoursVerboseCount(
                             m_loggingContext,
@@ -2218,6 +2243,17 @@ namespace BuildXL.ProcessPipExecutor
                 }
             }
 
+            if (m_sandboxConfig.DirectoriesWithoutReparsePoints != null)
+            {
+                foreach (var directoryWithoutReparsePoints in m_sandboxConfig.DirectoriesWithoutReparsePoints)
+                {
+                    m_fileAccessManifest.AddScope(
+                        directoryWithoutReparsePoints,
+                        mask: FileAccessPolicy.MaskNothing,
+                        values: FileAccessPolicy.ContainsNoReparsePoints);
+                }
+            }
+
             if (!OperatingSystemHelper.IsUnixOS)
             {
                 var binaryPaths = new BinaryPaths();
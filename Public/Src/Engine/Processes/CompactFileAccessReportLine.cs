@@ -0,0 +1,386 @@
+﻿// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+using System;
+using System.Collections.Generic;
+using System.Text;
+using BuildXL.Native.IO;
+using BuildXL.Utilities.Core;
+using static BuildXL.Utilities.Core.FormattableStringEx;
+
+#nullable enable
+
+namespace BuildXL.Processes
+{
+    /// <summary>
+    /// Parser for file access reports in the compact format (<see cref="ReportType.CompactFileAccess"/>)
+    /// </summary>
+    /// <remarks>
+    /// Compact reports still travel as report lines, so they can share the transports (and the line reader) of every other report type.
+    /// Instead of hex fields separated by '|', a compact line is made of 15-bit units, each one stored as a char in [0x100, 0x80ff]: such
+    /// chars are never line terminators nor surrogates, so any value can be written without escaping. Integer fields are stored least
+    /// significant unit first, at fixed offsets:
+    ///
+    ///     version(1) processId(3) id(3) correlationId(3) requestedAccess(1) status(1) explicitlyReported(1) error(3) usn(5)
+    ///     desiredAccess(3) shareMode(3) creationDisposition(3) flagsAndAttributes(3) openedFileOrDirectoryAttributes(3) manifestPath(3)
+    ///     pathId(3) directoryId(3) operationLength(2) directoryLength(2) pathLength(2) enumeratePatternLength(2) processArgsLength(2)
+    ///
+    /// followed by the operation name, the directory, the path, the enumerate pattern and the process arguments as plain chars, with the given lengths.
+    ///
+    /// A process may intern the paths it reports: the first report of a path carries a non-zero path id together with the path, and later
+    /// reports of the same process carry just the id (and a path length of 0). A path id of 0 means the path is not interned.
+    ///
+    /// A path that is not interned yet may also be sent relative to an interned directory, i.e. a prefix of the path that ends with a
+    /// separator: a non-zero directory id stands for that prefix, and the path chars only hold the rest of the path. The first report that
+    /// uses a directory defines it (the directory chars hold the prefix), later reports of the same process carry just its id (and a directory
+    /// length of 0). Directory and path ids are drawn from the same ids of the process. Processes of deep trees report many files of the same
+    /// directories, whose paths then travel once per directory instead of once per file.
+    ///
+    /// CODESYNC: Public/Src/Sandbox/Windows/DetoursServices/SendReport.cpp
+    ///
+    /// Instance members of this class are not thread-safe.
+    /// </remarks>
+    internal sealed class CompactFileAccessReportLine
+    {
+        /// <summary>
+        /// Version of the format, must be bumped whenever the layout changes
+        /// </summary>
+        public const int Version = 2;
+
+        private const char UnitBase = (char)0x100;
+        private const int UnitBits = 15;
+        private const uint UnitMask = (1 << UnitBits) - 1;
+
+        private const int VersionOffset = 0;
+        private const int ProcessIdOffset = VersionOffset + 1;
+        private const int IdOffset = ProcessIdOffset + 3;
+        private const int CorrelationIdOffset = IdOffset + 3;
+        private const int RequestedAccessOffset = CorrelationIdOffset + 3;
+        private const int StatusOffset = RequestedAccessOffset + 1;
+        private const int ExplicitlyReportedOffset = StatusOffset + 1;
+        private const int ErrorOffset = ExplicitlyReportedOffset + 1;
+        private const int UsnOffset = ErrorOffset + 3;
+        private const int DesiredAccessOffset = UsnOffset + 5;
+        private const int ShareModeOffset = DesiredAccessOffset + 3;
+        private const int CreationDispositionOffset = ShareModeOffset + 3;
+        private const int FlagsAndAttributesOffset = CreationDispositionOffset + 3;
+        private const int OpenedFileOrDirectoryAttributesOffset = FlagsAndAttributesOffset + 3;
+        private const int ManifestPathOffset = OpenedFileOrDirectoryAttributesOffset + 3;
+        private const int PathIdOffset = ManifestPathOffset + 3;
+        private const int DirectoryIdOffset = PathIdOffset + 3;
+        private const int OperationLengthOffset = DirectoryIdOffset + 3;
+        private const int DirectoryLengthOffset = OperationLengthOffset + 2;
+        private const int PathLengthOffset = DirectoryLengthOffset + 2;
+        private const int EnumeratePatternLengthOffset = PathLengthOffset + 2;
+        private const int ProcessArgsLengthOffset = EnumeratePatternLengthOffset + 2;
+
+        /// <summary>
+        /// Number of units before the variable-length fields
+        /// </summary>
+        public const int HeaderLength = ProcessArgsLengthOffset + 2;
+
+        /// <summary>
+        /// Interned paths and directories of every process, by process id. Definitions always win, so a process id that gets reused
+        /// just redefines the ids it sends before referring to them.
+        /// </summary>
+        private readonly Dictionary<uint, Dictionary<uint, string>> m_internedPaths = new Dictionary<uint, Dictionary<uint, string>>();
+
+        /// <summary>
+        /// Parses a compact file access report (the part that follows the report type)
+        /// </summary>
+        /// <remarks>
+        /// Has the same signature as <see cref="FileAccessReportLine.TryParse"/>, so it can be used as a <see cref="SandboxedProcessReports.FileAccessReportProvider{T}"/>.
+        /// </remarks>
+        public bool TryParse(
+            ref string line,
+            out uint processId,
+            out uint id,
+            out uint correlationId,
+            out ReportedFileOperation operation,
+            out RequestedAccess requestedAccess,
+            out FileAccessStatus status,
+            out bool explicitlyReported,
+            out uint error,
+            out Usn usn,
+            out DesiredAccess desiredAccess,
+            out ShareMode shareMode,
+            out CreationDisposition creationDisposition,
+            out FlagsAndAttributes flagsAndAttributes,
+            out FlagsAndAttributes openedFileOrDirectoryAttributes,
+            out AbsolutePath absolutePath,
+            out string? path,
+            out string? enumeratePattern,
+            out string? processArgs,
+            out string? errorMessage)
+        {
+            operation = ReportedFileOperation.Unknown;
+            requestedAccess = RequestedAccess.None;
+            status = FileAccessStatus.None;
+            processId = id = correlationId = error = 0;
+            usn = default;
+            explicitlyReported = false;
+            desiredAccess = 0;
+            shareMode = ShareMode.FILE_SHARE_NONE;
+            creationDisposition = 0;
+            flagsAndAttributes = 0;
+            openedFileOrDirectoryAttributes = 0;
+            absolutePath = AbsolutePath.Invalid;
+            path = null;
+            enumeratePattern = null;
+            processArgs = null;
+            errorMessage = string.Empty;
+
+            if (line.Length < HeaderLength)
+            {
+                errorMessage = I($"Unexpected compact report length {line.Length}, the header alone takes {HeaderLength} units");
+                return false;
+            }
+
+            if (!TryReadUnits(line, VersionOffset, 1, out var version) || version != Version)
+            {
+                errorMessage = I($"Unexpected compact report version '{(int)line[VersionOffset]:x}', expected {Version}");
+                return false;
+            }
+
+            if (!(TryReadUInt32(line, ProcessIdOffset, out processId)
+                && TryReadUInt32(line, IdOffset, out id)
+                && TryReadUInt32(line, CorrelationIdOffset, out correlationId)
+                && TryReadUnits(line, RequestedAccessOffset, 1, out var requestedAccessValue)
+                && TryReadUnits(line, StatusOffset, 1, out var statusValue)
+                && TryReadUnits(line, ExplicitlyReportedOffset, 1, out var explicitlyReportedValue)
+                && TryReadUInt32(line, ErrorOffset, out error)
+                && TryReadUnits(line, UsnOffset, 5, out var usnValue)
+                && TryReadUInt32(line, DesiredAccessOffset, out var desiredAccessValue)
+                && TryReadUInt32(line, ShareModeOffset, out var shareModeValue)
+                && TryReadUInt32(line, CreationDispositionOffset, out var creationDispositionValue)
+                && TryReadUInt32(line, FlagsAndAttributesOffset, out var flagsAndAttributesValue)
+                && TryReadUInt32(line, OpenedFileOrDirectoryAttributesOffset, out var openedFileOrDirectoryAttributesValue)
+                && TryReadUInt32(line, ManifestPathOffset, out var absolutePathValue)
+                && TryReadUInt32(line, PathIdOffset, out var pathId)
+                && TryReadUInt32(line, DirectoryIdOffset, out var directoryId)
+                && TryReadUnits(line, OperationLengthOffset, 2, out var operationLength)
+                && TryReadUnits(line, DirectoryLengthOffset, 2, out var directoryLength)
+                && TryReadUnits(line, PathLengthOffset, 2, out var pathLength)
+                && TryReadUnits(line, EnumeratePatternLengthOffset, 2, out var enumeratePatternLength)
+                && TryReadUnits(line, ProcessArgsLengthOffset, 2, out var processArgsLength)))
+            {
+                errorMessage = "Unexpected compact report content. The header contains chars that are not units.";
+                return false;
+            }
+
+            if (statusValue > (uint)FileAccessStatus.CannotDeterminePolicy)
+            {
+                errorMessage = I($"Unknown file access status '{statusValue}'");
+                return false;
+            }
+
+            if (requestedAccessValue > (uint)RequestedAccess.All)
+            {
+                errorMessage = I($"Unknown requested access '{requestedAccessValue}'");
+                return false;
+            }
+
+            // Lengths take 30 bits at most, so this can't overflow
+            long expectedLength = HeaderLength + (long)operationLength + (long)directoryLength + (long)pathLength + (long)enumeratePatternLength + (long)processArgsLength;
+            if (line.Length != expectedLength)
+            {
+                errorMessage = I($"Unexpected compact report length {line.Length} (potentially due to pipe corruption), expected {expectedLength}");
+                return false;
+            }
+
+            int offset = HeaderLength;
+            if (!FileAccessReportLine.TryGetOperation(line.AsMemory(offset, (int)operationLength), out operation))
+            {
+                // Like the text format, don't throw the line out just because the parser was not updated after adding a new call
+                operation = ReportedFileOperation.Unknown;
+            }
+
+            offset += (int)operationLength;
+
+            string? directory = null;
+            if (directoryId != 0)
+            {
+                if (directoryLength != 0)
+                {
+                    directory = line.Substring(offset, (int)directoryLength);
+                    GetInternedPaths(processId)[directoryId] = directory;
+                }
+                else if (!m_internedPaths.TryGetValue(processId, out var definedDirectories) || !definedDirectories.TryGetValue(directoryId, out directory))
+                {
+                    errorMessage = I($"Compact report of process {processId} refers to directory id {directoryId}, which it never defined");
+                    return false;
+                }
+            }
+
+            offset += (int)directoryLength;
+
+            if (pathId != 0 && pathLength == 0 && directoryId == 0)
+            {
+                if (!m_internedPaths.TryGetValue(processId, out var definedPaths) || !definedPaths.TryGetValue(pathId, out path))
+                {
+                    errorMessage = I($"Compact report of process {processId} refers to path id {pathId}, which it never defined");
+                    return false;
+                }
+            }
+            else
+            {
+                if (directory == null)
+                {
+                    path = line.Substring(offset, (int)pathLength);
+                }
+                else
+                {
+#if NET5_0_OR_GREATER
+                    path = string.Concat(directory.AsSpan(), line.AsSpan(offset, (int)pathLength));
+#else
+                    path = directory + line.Substring(offset, (int)pathLength);
+#endif
+                }
+
+                if (pathId != 0)
+                {
+                    GetInternedPaths(processId)[pathId] = path;
+                }
+            }
+
+            offset += (int)pathLength;
+
+            requestedAccess = (RequestedAccess)requestedAccessValue;
+            status = (FileAccessStatus)statusValue;
+            explicitlyReported = explicitlyReportedValue != 0;
+            usn = new Usn(usnValue);
+            desiredAccess = (DesiredAccess)desiredAccessValue;
+            shareMode = (ShareMode)shareModeValue;
+            creationDisposition = (CreationDisposition)creationDispositionValue;
+            flagsAndAttributes = (FlagsAndAttributes)flagsAndAttributesValue;
+            openedFileOrDirectoryAttributes = (FlagsAndAttributes)openedFileOrDirectoryAttributesValue;
+            absolutePath = new AbsolutePath(unchecked((int)absolutePathValue));
+
+            // If the requested access is not enumeration, enumeratePattern does not matter.
+            enumeratePattern = requestedAccess == RequestedAccess.Enumerate && enumeratePatternLength != 0
+                ? line.Substring(offset, (int)enumeratePatternLength)
+                : null;
+            offset += (int)enumeratePatternLength;
+
+            processArgs = operation == ReportedFileOperation.Process && processArgsLength != 0
+                ? line.Substring(offset, (int)processArgsLength)
+                : string.Empty;
+
+            return true;
+        }
+
+        /// <summary>
+        /// Returns a compact report line (including the report type) for the given file access.
+        /// </summary>
+        /// <remarks>
+        /// Detours builds these lines natively; this is the managed equivalent, so both ends of the format can be tested.
+        /// </remarks>
+        public static string GetReportLine(
+            string operation,
+            uint processId,
+            uint id,
+            uint correlationId,
+            RequestedAccess requestedAccess,
+            FileAccessStatus status,
+            bool explicitlyReported,
+            uint error,
+            Usn usn,
+            DesiredAccess desiredAccess,
+            ShareMode shareMode,
+            CreationDisposition creationDisposition,
+            FlagsAndAttributes flagsAndAttributes,
+            FlagsAndAttributes openedFileOrDirectoryAttributes,
+            AbsolutePath manifestPath,
+            uint pathId,
+            uint directoryId,
+            string? directory,
+            string? path,
+            string? enumeratePattern,
+            string? processArgs)
+        {
+            directory ??= string.Empty;
+            path ??= string.Empty;
+            enumeratePattern ??= string.Empty;
+            processArgs ??= string.Empty;
+
+            var result = new StringBuilder(HeaderLength + operation.Length + directory.Length + path.Length + enumeratePattern.Length + processArgs.Length + 8);
+            result.Append($"{(int)ReportType.CompactFileAccess},");
+
+            AppendUnits(result, Version, 1);
+            AppendUnits(result, processId, 3);
+            AppendUnits(result, id, 3);
+            AppendUnits(result, correlationId, 3);
+            AppendUnits(result, (ulong)requestedAccess, 1);
+            AppendUnits(result, (ulong)status, 1);
+            AppendUnits(result, explicitlyReported ? 1UL : 0UL, 1);
+            AppendUnits(result, error, 3);
+            AppendUnits(result, usn.Value, 5);
+            AppendUnits(result, (uint)desiredAccess, 3);
+            AppendUnits(result, (uint)shareMode, 3);
+            AppendUnits(result, (uint)creationDisposition, 3);
+            AppendUnits(result, (uint)flagsAndAttributes, 3);
+            AppendUnits(result, (uint)openedFileOrDirectoryAttributes, 3);
+            AppendUnits(result, unchecked((uint)manifestPath.Value.Value), 3);
+            AppendUnits(result, pathId, 3);
+            AppendUnits(result, directoryId, 3);
+            AppendUnits(result, (ulong)operation.Length, 2);
+            AppendUnits(result, (ulong)directory.Length, 2);
+            AppendUnits(result, (ulong)path.Length, 2);
+            AppendUnits(result, (ulong)enumeratePattern.Length, 2);
+            AppendUnits(result, (ulong)processArgs.Length, 2);
+
+            return result
+                .Append(operation)
+                .Append(directory)
+                .Append(path)
+                .Append(enumeratePattern)
+                .Append(processArgs)
+                .Append("\r\n")
+                .ToString();
+        }
+
+        private Dictionary<uint, string> GetInternedPaths(uint processId)
+        {
+            if (!m_internedPaths.TryGetValue(processId, out var paths))
+            {
+                paths = new Dictionary<uint, string>();
+                m_internedPaths.Add(processId, paths);
+            }
+
+            return paths;
+        }
+
+        private static void AppendUnits(StringBuilder builder, ulong value, int count)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                builder.Append((char)(UnitBase + (value & UnitMask)));
+                value >>= UnitBits;
+            }
+        }
+
+        private static bool TryReadUInt32(string line, int offset, out uint value)
+        {
+            bool result = TryReadUnits(line, offset, 3, out var longValue) && longValue <= uint.MaxValue;
+            value = unchecked((uint)longValue);
+            return result;
+        }
+
+        private static bool TryReadUnits(string line, int offset, int count, out ulong value)
+        {
+            value = 0;
+            for (int i = count - 1; i >= 0; i--)
+            {
+                uint unit = (uint)(line[offset + i] - UnitBase);
+                if (unit > UnitMask)
+                {
+                    return false;
+                }
+
+                value = (value << UnitBits) | unit;
+            }
+
+            return true;
+        }
+    }
+}
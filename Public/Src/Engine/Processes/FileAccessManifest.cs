@@ -101,6 +101,25 @@ namespace BuildXL.Processes
             EnableLinuxSandboxLogging = false;
             AlwaysRemoteInjectDetoursFrom32BitProcess = false;
             UnconditionallyEnableLinuxPTraceSandbox = false;
+            EnableLinuxSeccompNotifySandbox = false;
+            EnableLinuxSharedAccessCache = false;
+            EnableLinuxSandboxStatistics = false;
+            EnableSharedMemoryReports = false;
+            EnableCompactFileAccessReports = false;
+            EnableReportBatching = false;
+            EnableSharedReparsePointCache = false;
+            EnableManifestRecordIndex = false;
+            EnableSharedPayloadSection = false;
+            EnableDetoursProfile = false;
+            EnableLinuxLightweightObservation = false;
+            EnableLinuxPTraceFdTable = false;
+            EnableBlockCloneCopies = false;
+            EnableReportDeduplication = false;
+            EnableLinuxCgroupAccounting = false;
+            EnableLinuxCompressedReports = false;
+            EnableLinuxPTraceHandBack = false;
+            EnableLinuxSampledObservation = false;
+            EnableLinuxManifestUpdates = false;
             IgnoreDeviceIoControlGetReparsePoint = true; // TODO: Change this when customers onboard the feature.
         }
 
@@ -376,6 +395,9 @@ namespace BuildXL.Processes
         /// <summary>
         /// Whether BuildXL will use larger NtClose preallocated list.
         /// </summary>
+        /// <remarks>
+        /// Has no effect: the Windows sandbox removes handle overlays directly in NtClose, without a closed handle list.
+        /// </remarks>
         public bool UseLargeNtClosePreallocatedList
         {
             get => GetFlag(FileAccessManifestFlag.UseLargeNtClosePreallocatedList);
@@ -385,6 +407,9 @@ namespace BuildXL.Processes
         /// <summary>
         /// Whether BuildXL will use extra thread to drain NtClose handle List or clean the cache directly.
         /// </summary>
+        /// <remarks>
+        /// Has no effect: the Windows sandbox removes handle overlays directly in NtClose, without a closed handle list.
+        /// </remarks>
         public bool UseExtraThreadToDrainNtClose
         {
             get => GetFlag(FileAccessManifestFlag.UseExtraThreadToDrainNtClose);
@@ -527,6 +552,192 @@ namespace BuildXL.Processes
             }
         }
 
+        /// <summary>
+        /// When enabled, the Linux PTrace sandbox is driven by seccomp user notifications instead of ptrace stops (if the kernel supports it)
+        /// </summary>
+        public bool EnableLinuxSeccompNotifySandbox
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxSeccompNotifySandbox);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxSeccompNotifySandbox, value);
+        }
+
+        /// <summary>
+        /// When enabled, the processes of a pip share a dedup cache of the accesses already reported by the Linux sandbox
+        /// </summary>
+        public bool EnableLinuxSharedAccessCache
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxSharedAccessCache);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxSharedAccessCache, value);
+        }
+
+        /// <summary>
+        /// When enabled, each process observed by the Linux sandbox collects counters and latency histograms of the interposed functions and logs them on exit
+        /// </summary>
+        public bool EnableLinuxSandboxStatistics
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxSandboxStatistics);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxSandboxStatistics, value);
+        }
+
+        /// <summary>
+        /// When enabled, detoured processes send their reports through a shared-memory ring created by the host (see <see cref="Internal.SharedMemoryReportRing"/>),
+        /// falling back to the report pipe when the ring is full. Windows only.
+        /// </summary>
+        public bool EnableSharedMemoryReports
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableSharedMemoryReports);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableSharedMemoryReports, value);
+        }
+
+        /// <summary>
+        /// When enabled, detoured processes send file accesses as compact reports (see <see cref="CompactFileAccessReportLine"/>) instead of
+        /// hex-formatted text lines. Windows only.
+        /// </summary>
+        public bool EnableCompactFileAccessReports
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableCompactFileAccessReports);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableCompactFileAccessReports, value);
+        }
+
+        /// <summary>
+        /// When enabled, each detoured thread accumulates its file access reports and writes them to the report pipe in batches, which are flushed
+        /// when full, before a child process is created, and when the thread or the process exits. Windows only.
+        /// </summary>
+        public bool EnableReportBatching
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableReportBatching);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableReportBatching, value);
+        }
+
+        /// <summary>
+        /// When enabled, the detoured processes of a pip share the reparse point targets they resolve through a cache in shared memory created by the host
+        /// (see <see cref="Internal.SharedReparsePointCache"/>), so child processes don't query the same reparse points again. Windows only.
+        /// </summary>
+        public bool EnableSharedReparsePointCache
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableSharedReparsePointCache);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableSharedReparsePointCache, value);
+        }
+
+        /// <summary>
+        /// When enabled, the payload sent to the detoured processes also holds a flat table of the records of the manifest tree keyed by the hash of their full path,
+        /// so a policy search finds the deepest record matching a path with a few probes instead of one lookup per path atom. Windows only.
+        /// </summary>
+        public bool EnableManifestRecordIndex
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableManifestRecordIndex);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableManifestRecordIndex, value);
+        }
+
+        /// <summary>
+        /// When enabled, a detoured process that starts a child process places the payload (including this manifest) in a read-only section once,
+        /// and every child maps that section instead of receiving a copy of the payload. Windows only.
+        /// </summary>
+        public bool EnableSharedPayloadSection
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableSharedPayloadSection);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableSharedPayloadSection, value);
+        }
+
+        /// <summary>
+        /// Whether the detours record the call count and the time spent in each detoured function, and report them when the process exits.
+        /// </summary>
+        public bool EnableDetoursProfile
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableDetoursProfile);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableDetoursProfile, value);
+        }
+
+        /// <summary>
+        /// Whether the Linux sandbox only observes the accesses of a pip that does not fail on unexpected file accesses through the calls that name paths
+        /// (e.g. open, exec, rename, stat) and through LD_AUDIT, letting the calls on already open descriptors (e.g. write, fwrite, readdir) run uninterposed.
+        /// </summary>
+        public bool EnableLinuxLightweightObservation
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxLightweightObservation);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxLightweightObservation, value);
+        }
+
+        /// <summary>
+        /// When enabled, the Linux PTrace sandbox keeps a table of the paths behind the file descriptors of every tracee, so that
+        /// fd-based syscalls (e.g. write, fstat, fchmod) don't need to resolve their descriptor through /proc. Tracees then also stop on close, close_range, dup2 and dup3.
+        /// </summary>
+        public bool EnableLinuxPTraceFdTable
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxPTraceFdTable);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxPTraceFdTable, value);
+        }
+
+        /// <summary>
+        /// When enabled, CopyFileExW calls of detoured processes clone the blocks of the source file into the destination (FSCTL_DUPLICATE_EXTENTS_TO_FILE)
+        /// when both are on a volume that supports block cloning (e.g. ReFS), instead of copying their content. Other copies go through CopyFileExW as usual.
+        /// </summary>
+        public bool EnableBlockCloneCopies
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableBlockCloneCopies);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableBlockCloneCopies, value);
+        }
+
+        /// <summary>
+        /// When enabled, detoured processes send a file access report only the first time they make that access (same path, operation,
+        /// requested access, status, error, ...), since the later identical reports carry no new information.
+        /// </summary>
+        public bool EnableReportDeduplication
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableReportDeduplication);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableReportDeduplication, value);
+        }
+
+        /// <summary>
+        /// When enabled, the root process of a Linux pip moves itself to the cgroup v2 leaf created for the pip (see SandboxedProcessUnix),
+        /// so all the processes of the pip are accounted for by that cgroup.
+        /// </summary>
+        public bool EnableLinuxCgroupAccounting
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxCgroupAccounting);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxCgroupAccounting, value);
+        }
+
+        /// <summary>
+        /// When enabled, the manifest of a running Linux pip can be replaced (see ISandboxConnection.NotifyPipManifestUpdated):
+        /// its processes watch a generation counter next to the manifest and apply every update before their next access check.
+        /// </summary>
+        public bool EnableLinuxManifestUpdates
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxManifestUpdates);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxManifestUpdates, value);
+        }
+
+        /// <summary>
+        /// When enabled, the processes of a Linux pip write the batches of reports they send as compressed frames
+        /// (see SandboxConnectionLinuxDetours), which the report reader decompresses.
+        /// </summary>
+        public bool EnableLinuxCompressedReports
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxCompressedReports);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxCompressedReports, value);
+        }
+
+        /// <summary>
+        /// When enabled, the ptrace sandbox of a Linux pip hands its tracees back to the interposer when they exec a dynamically linked program
+        /// (see PTraceSandbox::HandleExec), and takes them over again when they exec a statically linked one.
+        /// </summary>
+        public bool EnableLinuxPTraceHandBack
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxPTraceHandBack);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxPTraceHandBack, value);
+        }
+
+        /// <summary>
+        /// When enabled, the sandboxed processes of a Linux pip report only a sample of the allowed accesses that don't write, and send per-directory
+        /// counts of the ones they left out as debug messages (see BxlObserver::IsSampledOut).
+        /// </summary>
+        public bool EnableLinuxSampledObservation
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxSampledObservation);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxSampledObservation, value);
+        }
+
         /// <summary>
         /// When enabled, DeviceIoControl (case FSCTL_GET_REPARSE_POINT) is detoured 
         /// </summary>
@@ -964,10 +1175,23 @@ namespace BuildXL.Processes
                             "Win64 file handles are supposed to be signed 32-bit integers; if they were not, we'd have a problem monitoring 32-bit processes from 64-bit.");
                     }
 
+                    // The shared-memory name of the pip, if any, follows the handle (see ManifestReport::GetSharedMemoryName in DataTypes.h)
+                    var ringName = string.IsNullOrEmpty(setup.SharedMemoryName)
+                        ? PaddedByteString.Invalid
+                        : new PaddedByteString(Encoding.Unicode, setup.SharedMemoryName);
+                    if (ringName.IsValid)
+                    {
+                        size += (uint)ringName.Length;
+                    }
+
                     size |= 0x01; // set bottom bit to indicate that the value is an integer
 
                     writer.Write(size);
                     writer.Write(handleValue32bit);
+                    if (ringName.IsValid)
+                    {
+                        ringName.Serialize(writer);
+                    }
                 }
                 else
                 {
@@ -1060,14 +1284,121 @@ namespace BuildXL.Processes
         {
             if (m_sealedManifestTreeBlock is not null)
             {
+                // A sealed block already holds the record index, if it was written with one
                 writer.Write(m_sealedManifestTreeBlock);
             }
+            else if (EnableManifestRecordIndex)
+            {
+                WriteIndexedManifestTree(writer);
+            }
             else
             {
                 m_rootNode.InternalSerialize(default(NormalizedPathString), writer);
             }
         }
 
+        private void WriteIndexedManifestTree(BinaryWriter writer)
+        {
+            var records = new List<ManifestRecordIndexEntry>();
+            m_rootNode.InternalSerialize(default(NormalizedPathString), writer, records, writer.BaseStream.Position, parent: -1, prefixHash: ManifestRecordIndexPrefixHashSeed);
+            WriteManifestRecordIndex(writer, records);
+        }
+
+        // CODESYNC: DataTypes.h :: ManifestRecordIndex
+        private const uint ManifestRecordIndexTag = 0xD1C7F00D;
+        private const uint ManifestRecordIndexNoParent = 0xFFFFFFFF;
+        private const ulong ManifestRecordIndexPrefixHashSeed = 0xCBF29CE484222325UL;
+        private const int ManifestRecordIndexSlotSize = 16;
+        private const int ManifestRecordIndexFooterSize = 16;
+        private const int ManifestRecordIndexAlignment = 64;
+
+        /// <summary>
+        /// A record of the manifest tree, as collected while serializing the tree
+        /// </summary>
+        private readonly struct ManifestRecordIndexEntry
+        {
+            public readonly ulong PrefixHash;
+            public readonly uint RecordOffset;
+            public readonly int Parent;
+
+            public ManifestRecordIndexEntry(ulong prefixHash, uint recordOffset, int parent)
+            {
+                PrefixHash = prefixHash;
+                RecordOffset = recordOffset;
+                Parent = parent;
+            }
+        }
+
+        /// <summary>
+        /// Full path hash of a record, given the one of its parent and the hash of its partial path
+        /// </summary>
+        /// <remarks>
+        /// CODESYNC: DataTypes.h :: CombineManifestPrefixHash
+        /// </remarks>
+        private static ulong CombineManifestPrefixHash(ulong parentPrefixHash, uint recordHash)
+        {
+            unchecked
+            {
+                ulong hash = (parentPrefixHash ^ recordHash) * 0x100000001B3UL;
+                hash ^= hash >> 29;
+                return hash == 0 ? 1 : hash;
+            }
+        }
+
+        /// <summary>
+        /// Writes the flat table of the records of the tree that was just written, which ends the payload (see ManifestRecordIndex in DataTypes.h).
+        /// </summary>
+        /// <remarks>
+        /// Records are added in pre-order, so the slot of the parent of a record is always known when the record is placed.
+        /// </remarks>
+        private static void WriteManifestRecordIndex(BinaryWriter writer, List<ManifestRecordIndexEntry> records)
+        {
+            // Keep the load factor at 0.5 at most, so probes stay short
+            int slotCount = 4;
+            while (slotCount < records.Count * 2)
+            {
+                slotCount = checked(slotCount * 2);
+            }
+
+            var mask = (uint)(slotCount - 1);
+            var prefixHashes = new ulong[slotCount];
+            var recordOffsets = new uint[slotCount];
+            var parents = new uint[slotCount];
+            var slotOfRecord = new uint[records.Count];
+
+            for (int i = 0; i < records.Count; i++)
+            {
+                var record = records[i];
+                var slot = unchecked((uint)record.PrefixHash) & mask;
+                while (prefixHashes[slot] != 0)
+                {
+                    slot = (slot + 1) & mask;
+                }
+
+                prefixHashes[slot] = record.PrefixHash;
+                recordOffsets[slot] = record.RecordOffset;
+                parents[slot] = record.Parent < 0 ? ManifestRecordIndexNoParent : slotOfRecord[record.Parent];
+                slotOfRecord[i] = slot;
+            }
+
+            while (writer.BaseStream.Position % ManifestRecordIndexAlignment != 0)
+            {
+                writer.Write((byte)0);
+            }
+
+            for (int slot = 0; slot < slotCount; slot++)
+            {
+                writer.Write(prefixHashes[slot]);
+                writer.Write(recordOffsets[slot]);
+                writer.Write(parents[slot]);
+            }
+
+            writer.Write((uint)slotCount);
+            writer.Write((uint)records.Count);
+            writer.Write(checked((uint)((slotCount * ManifestRecordIndexSlotSize) + ManifestRecordIndexFooterSize)));
+            writer.Write(ManifestRecordIndexTag);
+        }
+
         /// <summary>
         /// Creates, as an Unicode encoded byte array, an expanded textual representation of the manifest, as consumed by the
         /// native detour implementation
@@ -1223,6 +1554,22 @@ namespace BuildXL.Processes
             return bytes;
         }
 
+        /// <summary>
+        /// Return the raw byte array encoding of the tree-structured FileAccessManifest, followed by its record index.
+        /// </summary>
+        /// <remarks>
+        /// This method is only used for testing.
+        /// </remarks>
+        public byte[] GetIndexedManifestTreeBytes()
+        {
+            HydrateTreeNodeIfNeeded();
+
+            using var stream = new MemoryStream(4096);
+            using var writer = new BinaryWriter(stream, Encoding.Unicode, true);
+            WriteIndexedManifestTree(writer);
+            return stream.ToArray();
+        }
+
         /// <summary>
         /// Get an enumeration of lines representing the manifest tree.
         /// </summary>
@@ -1282,6 +1629,25 @@ namespace BuildXL.Processes
             AlwaysRemoteInjectDetoursFrom32BitProcess = 0x10,
             UnconditionallyEnableLinuxPTraceSandbox = 0x20,
             IgnoreDeviceIoControlGetReparsePoint = 0x40,
+            EnableLinuxSeccompNotifySandbox = 0x80,
+            EnableLinuxSharedAccessCache = 0x100,
+            EnableLinuxSandboxStatistics = 0x200,
+            EnableSharedMemoryReports = 0x400,
+            EnableCompactFileAccessReports = 0x800,
+            EnableReportBatching = 0x1000,
+            EnableSharedReparsePointCache = 0x2000,
+            EnableManifestRecordIndex = 0x4000,
+            EnableSharedPayloadSection = 0x8000,
+            EnableDetoursProfile = 0x10000,
+            EnableLinuxLightweightObservation = 0x20000,
+            EnableLinuxPTraceFdTable = 0x40000,
+            EnableBlockCloneCopies = 0x80000,
+            EnableReportDeduplication = 0x100000,
+            EnableLinuxCgroupAccounting = 0x200000,
+            EnableLinuxManifestUpdates = 0x400000,
+            EnableLinuxCompressedReports = 0x800000,
+            EnableLinuxPTraceHandBack = 0x1000000,
+            EnableLinuxSampledObservation = 0x2000000,
         }
 
         private readonly struct FileAccessScope
@@ -1770,6 +2136,21 @@ namespace BuildXL.Processes
             }
 
             public void InternalSerialize(NormalizedPathString normalizedFragment, BinaryWriter writer)
+            {
+                InternalSerialize(normalizedFragment, writer, records: null, treeStart: 0, parent: -1, prefixHash: 0);
+            }
+
+            /// <summary>
+            /// Serializes the node and its descendants, adding them to <paramref name="records"/> (when it is not null) to build the record index,
+            /// with their offset from <paramref name="treeStart"/> and the full path hash of their parent combined with their own.
+            /// </summary>
+            public void InternalSerialize(
+                NormalizedPathString normalizedFragment,
+                BinaryWriter writer,
+                List<ManifestRecordIndexEntry>? records,
+                long treeStart,
+                int parent,
+                ulong prefixHash)
             {
                 // always finalize when serializing -- note that this prevents adding additional scopes as before
                 if (!IsPolicyFinalized)
@@ -1780,6 +2161,13 @@ namespace BuildXL.Processes
                 unchecked
                 {
                     long start = writer.BaseStream.Position;
+                    int recordIndex = -1;
+                    if (records is not null)
+                    {
+                        recordIndex = records.Count;
+                        records.Add(new ManifestRecordIndexEntry(prefixHash, checked((uint)(start - treeStart)), parent));
+                    }
+
 #if DEBUG
                     writer.Write((uint)0xF00DCAFE); // "food cafe"
 #endif
@@ -1845,7 +2233,13 @@ namespace BuildXL.Processes
                             var offset = checked((uint)(writer.BaseStream.Position - start));
                             Contract.Assume((offset & (uint)FileAccessBucketOffsetFlag.ChainMask) == 0);
                             offsets[index] = offset;
-                            child.Value.InternalSerialize(child.Key, writer);
+                            child.Value.InternalSerialize(
+                                child.Key,
+                                writer,
+                                records,
+                                treeStart,
+                                recordIndex,
+                                records is null ? 0 : CombineManifestPrefixHash(prefixHash, hash));
                         }
 
                         long endPosition = writer.BaseStream.Position;
@@ -2058,6 +2452,7 @@ namespace BuildXL.Processes
                     Tuple.Create((short)FileAccessPolicy.OverrideAllowWriteForExistingFiles, "OverrideAllowWriteForExistingFiles"),
                     Tuple.Create((short)FileAccessPolicy.TreatDirectorySymlinkAsDirectory, "DirectorySymlinkAsDirectory"),
                     Tuple.Create((short)FileAccessPolicy.EnableFullReparsePointParsing, "EnableFullReparsePointParsing"),
+                    Tuple.Create((short)FileAccessPolicy.ContainsNoReparsePoints, "ContainsNoReparsePoints"),
                     Tuple.Create((short)FileAccessPolicy.ReportAccess, "ReportAccess"),
                     // Note that composite values must appear before their parts.
                     Tuple.Create((short)FileAccessPolicy.ReportAccessIfExistent, "ReportAccessIfExistent"),
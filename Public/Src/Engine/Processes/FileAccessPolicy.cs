@@ -104,6 +104,12 @@ namespace BuildXL.Processes
         /// </summary>
         EnableFullReparsePointParsing = 0x1000,
 
+        /// <summary>
+        /// If set, neither the paths under here nor the path to this scope contain reparse points, so the sandbox does not have to
+        /// look for any when resolving them.
+        /// </summary>
+        ContainsNoReparsePoints = 0x2000,
+
         /// <summary>
         /// If set, then we will report attempts to access files under this scope, whether they exist or not (combination of <see cref="ReportAccessIfExistent"/>
         /// and <see cref="ReportAccessIfNonexistent"/>).
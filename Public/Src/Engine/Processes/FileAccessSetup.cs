@@ -13,6 +13,15 @@ namespace BuildXL.Processes
         /// </summary>
         public string ReportPath { get; set; }
 
+        /// <summary>
+        /// Name of the shared memory the host created for the pip, or null if there is none. The shared-memory report ring the processes send their
+        /// reports through has this name, and the shared reparse point cache this name with a suffix.
+        /// </summary>
+        /// <remarks>
+        /// Only valid when <see cref="ReportPath"/> denotes a handle
+        /// </remarks>
+        public string SharedMemoryName { get; set; }
+
         /// <summary>
         /// Path to X64 .dll that contains detours instrumentation code
         /// </summary>
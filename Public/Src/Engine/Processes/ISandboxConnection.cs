@@ -61,6 +61,13 @@ namespace BuildXL.Processes
         /// </summary>
         bool NotifyPipStarted(LoggingContext loggingContext, FileAccessManifest fam, SandboxedProcessUnix process);
 
+        /// <summary>
+        /// Replaces the manifest of a running pip with <paramref name="fam"/>, e.g., when the scopes a service pip may access change between
+        /// work items. Only the accesses under <paramref name="changedScopes"/> are checked again afterwards (all of them when it is null).
+        /// Returns false if the manifest of the pip can't be replaced, in which case the pip keeps the one it has.
+        /// </summary>
+        bool NotifyPipManifestUpdated(LoggingContext loggingContext, FileAccessManifest fam, SandboxedProcessUnix process, IReadOnlyCollection<string> changedScopes);
+
         /// <summary>
         /// A concrete sandbox connection can override this method to specify additional environment variables
         /// that should be set before executing the process.
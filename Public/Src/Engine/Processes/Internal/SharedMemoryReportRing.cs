@@ -0,0 +1,226 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+using System;
+using System.Diagnostics.ContractsLight;
+using System.IO.MemoryMappedFiles;
+using System.Threading;
+using System.Threading.Tasks;
+
+#nullable enable
+
+namespace BuildXL.Processes.Internal
+{
+    /// <summary>
+    /// Ring in shared memory the detoured processes of a pip send their reports through when <see cref="FileAccessManifest.EnableSharedMemoryReports"/> is set.
+    /// </summary>
+    /// <remarks>
+    /// CODESYNC: Public/Src/Sandbox/Windows/DetoursServices/ReportRing.h
+    ///
+    /// Every detoured thread of every process of the pip appends report lines to the ring, and this class is its only consumer. Producers reserve
+    /// space by advancing the write position with a compare-and-swap, copy the line, and publish the record by writing its length last. A dedicated
+    /// thread reads the records in order, hands the lines to the callback, and then clears them and advances the read position.
+    ///
+    /// Producers only signal the doorbell event when they append to an empty ring, so a busy ring costs no kernel transitions. When the ring is full
+    /// they fall back to the report pipe, so lines may come through both channels: the callback is never called concurrently by this class, but
+    /// callers must serialize it with the pipe reader.
+    /// </remarks>
+    internal sealed unsafe class SharedMemoryReportRing : IDisposable
+    {
+        private const uint Magic = 0x474E4952; // 'RING'
+        private const int HeaderSize = 192;
+        private const int MagicOffset = 0;
+        private const int CapacityOffset = 4;
+        private const int WritePositionOffset = 64;
+        private const int ReadPositionOffset = 128;
+        private const int RecordHeaderSize = sizeof(int);
+        private const int RecordAlignment = 8;
+
+        // The doorbell is only a wake up hint, so poll once in a while regardless
+        private const int PollIntervalMs = 100;
+
+        /// <summary>
+        /// Default size of the ring buffer (must be a power of 2)
+        /// </summary>
+        public const int DefaultCapacity = 1 << 20;
+
+        private readonly MemoryMappedFile m_mapping;
+        private readonly MemoryMappedViewAccessor m_view;
+        private readonly EventWaitHandle m_doorbell;
+        private readonly StreamDataReceived m_callback;
+        private readonly byte* m_basePointer;
+        private readonly byte* m_buffer;
+        private readonly long m_mask;
+
+        private Task? m_readerTask;
+        private volatile bool m_stopping;
+        private bool m_callbackFailed;
+        private byte[] m_recordBuffer = new byte[4096];
+
+        /// <summary>
+        /// Name of the ring. Processes open the mapping with this name, and the doorbell event with this name and the "_Doorbell" suffix.
+        /// </summary>
+        public string Name { get; }
+
+        /// <summary>
+        /// Creates the ring of a pip, named after the shared-memory name the pip's processes get in the file access manifest
+        /// </summary>
+        public SharedMemoryReportRing(string sharedMemoryName, StreamDataReceived callback, int capacity = DefaultCapacity)
+        {
+            Contract.Requires(!string.IsNullOrEmpty(sharedMemoryName));
+            Contract.Requires(capacity > 0 && (capacity & (capacity - 1)) == 0);
+
+            m_callback = callback;
+            Name = sharedMemoryName;
+
+            // The mapping is backed by the page file, so it comes zeroed: all positions are 0 and no record is published
+            m_mapping = MemoryMappedFile.CreateNew(Name, HeaderSize + capacity);
+            m_view = m_mapping.CreateViewAccessor();
+            m_doorbell = new EventWaitHandle(initialState: false, EventResetMode.AutoReset, Name + "_Doorbell");
+
+            byte* pointer = null;
+            m_view.SafeMemoryMappedViewHandle.AcquirePointer(ref pointer);
+            m_basePointer = pointer + m_view.PointerOffset;
+            m_buffer = m_basePointer + HeaderSize;
+            m_mask = capacity - 1;
+
+            *(uint*)(m_basePointer + CapacityOffset) = (uint)capacity;
+            // The magic goes last: producers don't use a ring without it
+            Volatile.Write(ref *(uint*)(m_basePointer + MagicOffset), Magic);
+        }
+
+        private ref long WritePosition => ref *(long*)(m_basePointer + WritePositionOffset);
+
+        private ref long ReadPosition => ref *(long*)(m_basePointer + ReadPositionOffset);
+
+        /// <summary>
+        /// Starts delivering the lines appended to the ring
+        /// </summary>
+        public void Start()
+        {
+            Contract.Assert(m_readerTask == null);
+            m_readerTask = Task.Factory.StartNew(ReadLoop, TaskCreationOptions.LongRunning);
+        }
+
+        /// <summary>
+        /// Delivers what is left in the ring and stops reading. Must only be called once no process can append to the ring anymore.
+        /// </summary>
+        public Task StopAsync()
+        {
+            m_stopping = true;
+            m_doorbell.Set();
+
+            return m_readerTask ?? Task.CompletedTask;
+        }
+
+        private void ReadLoop()
+        {
+            while (true)
+            {
+                // Read the flag before draining, so everything published before the stop request gets delivered
+                bool stopping = m_stopping;
+
+                while (TryReadRecord(out string? line))
+                {
+                    if (!m_callbackFailed && !m_callback(line!))
+                    {
+                        // Same as the pipe readers: stop delivering after a failure (but keep freeing the ring so producers don't fall back to the pipe)
+                        m_callbackFailed = true;
+                    }
+                }
+
+                if (stopping)
+                {
+                    // A record that is still not published at this point belongs to a process that died while appending it
+                    return;
+                }
+
+                m_doorbell.WaitOne(PollIntervalMs);
+            }
+        }
+
+        /// <summary>
+        /// Reads and frees the record at the read position. Returns false if the ring is empty or the record is not published yet.
+        /// </summary>
+        private bool TryReadRecord(out string? line)
+        {
+            line = null;
+
+            long read = Volatile.Read(ref ReadPosition);
+            if (read == Volatile.Read(ref WritePosition))
+            {
+                return false;
+            }
+
+            int length = Volatile.Read(ref *(int*)(m_buffer + (read & m_mask)));
+            if (length == 0)
+            {
+                return false;
+            }
+
+            long recordSize = (RecordHeaderSize + length + RecordAlignment - 1) & ~(long)(RecordAlignment - 1);
+            long payloadOffset = (read + RecordHeaderSize) & m_mask;
+            long capacity = m_mask + 1;
+
+            if (payloadOffset + length <= capacity)
+            {
+                line = GetLine(m_buffer + payloadOffset, length);
+            }
+            else
+            {
+                // The record wraps around the end of the buffer
+                if (m_recordBuffer.Length < length)
+                {
+                    m_recordBuffer = new byte[Math.Max(length, m_recordBuffer.Length * 2)];
+                }
+
+                fixed (byte* record = m_recordBuffer)
+                {
+                    int firstPart = (int)(capacity - payloadOffset);
+                    Buffer.MemoryCopy(m_buffer + payloadOffset, record, length, firstPart);
+                    Buffer.MemoryCopy(m_buffer, record + firstPart, length - firstPart, length - firstPart);
+                    line = GetLine(record, length);
+                }
+            }
+
+            // Clear the record before handing its space back: producers rely on unpublished records having a 0 length
+            Clear(read & m_mask, recordSize);
+            Interlocked.Exchange(ref ReadPosition, read + recordSize);
+
+            return true;
+        }
+
+        private static string GetLine(byte* bytes, int length)
+        {
+            // Lines come with their \r\n terminator, like the ones written to the pipe (which the pipe readers strip)
+            int chars = length / sizeof(char);
+            char* text = (char*)bytes;
+            if (chars >= 2 && text[chars - 2] == '\r' && text[chars - 1] == '\n')
+            {
+                chars -= 2;
+            }
+
+            return new string(text, 0, chars);
+        }
+
+        private void Clear(long offset, long size)
+        {
+            long capacity = m_mask + 1;
+            long firstPart = Math.Min(size, capacity - offset);
+            new Span<byte>(m_buffer + offset, (int)firstPart).Clear();
+            if (firstPart < size)
+            {
+                new Span<byte>(m_buffer, (int)(size - firstPart)).Clear();
+            }
+        }
+
+        /// <inheritdoc />
+        public void Dispose()
+        {
+            m_view.SafeMemoryMappedViewHandle.ReleasePointer();
+            m_view.Dispose();
+            m_mapping.Dispose();
+            m_doorbell.Dispose();
+        }
+    }
+}
@@ -0,0 +1,93 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+using System;
+using System.Diagnostics.ContractsLight;
+using System.IO.MemoryMappedFiles;
+using System.Threading;
+
+#nullable enable
+
+namespace BuildXL.Processes.Internal
+{
+    /// <summary>
+    /// Cache in shared memory where the detoured processes of a pip publish the reparse point targets they resolve, when
+    /// <see cref="FileAccessManifest.EnableSharedReparsePointCache"/> is set.
+    /// </summary>
+    /// <remarks>
+    /// CODESYNC: Public/Src/Sandbox/Windows/DetoursServices/SharedReparsePointCache.h
+    ///
+    /// The host only creates and initializes the mapping, and keeps it alive while the processes of the pip run: the detoured processes
+    /// are the only ones reading and writing the table, so child processes don't query again the reparse points their parent or siblings resolved.
+    /// </remarks>
+    internal sealed unsafe class SharedReparsePointCache : IDisposable
+    {
+        private const uint Magic = 0x48435052; // 'RPCH'
+        private const int HeaderSize = 32;
+        private const int SlotSize = 16;
+        private const int MagicOffset = 0;
+        private const int SlotCountOffset = 4;
+        private const int DataCapacityOffset = 8;
+
+        /// <summary>
+        /// Suffix appended to the shared-memory name of the pip to get the name of the cache
+        /// </summary>
+        public const string NameSuffix = "_ReparsePoints";
+
+        /// <summary>
+        /// Default number of slots of the table (must be a power of 2)
+        /// </summary>
+        public const int DefaultSlotCount = 1 << 14;
+
+        /// <summary>
+        /// Default size of the area holding the paths and their targets
+        /// </summary>
+        public const int DefaultDataCapacity = 4 << 20;
+
+        private readonly MemoryMappedFile m_mapping;
+        private readonly MemoryMappedViewAccessor m_view;
+
+        /// <summary>
+        /// Name of the mapping
+        /// </summary>
+        public string Name { get; }
+
+        /// <summary>
+        /// Creates the cache of a pip, given the shared-memory name the pip's processes get in the file access manifest
+        /// </summary>
+        public SharedReparsePointCache(string sharedMemoryName, int slotCount = DefaultSlotCount, int dataCapacity = DefaultDataCapacity)
+        {
+            Contract.Requires(!string.IsNullOrEmpty(sharedMemoryName));
+            Contract.Requires(slotCount > 0 && (slotCount & (slotCount - 1)) == 0);
+            Contract.Requires(dataCapacity > 0);
+
+            Name = sharedMemoryName + NameSuffix;
+
+            // The mapping is backed by the page file, so it comes zeroed: no slot is claimed and no record is allocated
+            m_mapping = MemoryMappedFile.CreateNew(Name, HeaderSize + ((long)slotCount * SlotSize) + dataCapacity);
+            m_view = m_mapping.CreateViewAccessor();
+
+            byte* pointer = null;
+            m_view.SafeMemoryMappedViewHandle.AcquirePointer(ref pointer);
+            try
+            {
+                byte* header = pointer + m_view.PointerOffset;
+                *(uint*)(header + SlotCountOffset) = (uint)slotCount;
+                *(uint*)(header + DataCapacityOffset) = (uint)dataCapacity;
+                // The magic goes last: processes don't use a cache without it
+                Volatile.Write(ref *(uint*)(header + MagicOffset), Magic);
+            }
+            finally
+            {
+                m_view.SafeMemoryMappedViewHandle.ReleasePointer();
+            }
+        }
+
+        /// <inheritdoc />
+        public void Dispose()
+        {
+            m_view.Dispose();
+            m_mapping.Dispose();
+        }
+    }
+}
@@ -0,0 +1,101 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+using System;
+
+namespace BuildXL.Processes
+{
+    /// <summary>
+    /// Decoder of the LZ4 blocks the Linux sandbox writes to the report FIFO when reports are compressed.
+    /// </summary>
+    /// <remarks>
+    /// CODESYNC: Public/Src/Sandbox/Linux/report_compression.cpp
+    /// </remarks>
+    internal static class Lz4BlockDecoder
+    {
+        private const int MinMatch = 4;
+
+        /// <summary>
+        /// Decodes the block in <paramref name="source"/>[0, <paramref name="sourceLength"/>) into <paramref name="destination"/>.
+        /// </summary>
+        /// <returns>The number of bytes decoded, or -1 if the block is malformed or does not fit in <paramref name="destination"/>.</returns>
+        public static int Decode(byte[] source, int sourceLength, byte[] destination)
+        {
+            int input = 0;
+            int output = 0;
+
+            while (input < sourceLength)
+            {
+                int token = source[input++];
+
+                if (!TryReadLength(source, sourceLength, ref input, token >> 4, out int literalLength)
+                    || sourceLength - input < literalLength
+                    || destination.Length - output < literalLength)
+                {
+                    return -1;
+                }
+
+                Buffer.BlockCopy(source, input, destination, output, literalLength);
+                input += literalLength;
+                output += literalLength;
+
+                // The last sequence has no match
+                if (input == sourceLength)
+                {
+                    break;
+                }
+
+                if (sourceLength - input < 2)
+                {
+                    return -1;
+                }
+
+                int offset = source[input] | (source[input + 1] << 8);
+                input += 2;
+
+                if (offset == 0
+                    || offset > output
+                    || !TryReadLength(source, sourceLength, ref input, token & 15, out int matchLength)
+                    || destination.Length - output < matchLength + MinMatch)
+                {
+                    return -1;
+                }
+
+                // Matches may overlap with what they produce, so this copies byte by byte
+                for (int i = 0; i < matchLength + MinMatch; i++)
+                {
+                    destination[output + i] = destination[output - offset + i];
+                }
+
+                output += matchLength + MinMatch;
+            }
+
+            return output;
+        }
+
+        private static bool TryReadLength(byte[] source, int sourceLength, ref int input, int length, out int result)
+        {
+            result = length;
+            if (length != 15)
+            {
+                return true;
+            }
+
+            int next;
+            do
+            {
+                // Lengths are bounded by the destination, so anything that large is malformed anyway
+                if (input == sourceLength || result > ushort.MaxValue)
+                {
+                    return false;
+                }
+
+                next = source[input++];
+                result += next;
+            }
+            while (next == 255);
+
+            return true;
+        }
+    }
+}
@@ -52,9 +52,17 @@ namespace BuildXL.Processes
         /// </remarks>
         AugmentedFileAccess = 6,
 
+        /// <summary>
+        /// Report file access in the compact format (see <see cref="CompactFileAccessReportLine"/>)
+        /// </summary>
+        /// <remarks>
+        /// Sent instead of <see cref="FileAccess"/> when <see cref="FileAccessManifest.EnableCompactFileAccessReports"/> is set
+        /// </remarks>
+        CompactFileAccess = 7,
+
         /// <summary>
         /// This is a non-value, but places an upper-bound on the range of the enum
         /// </summary>
-        Max = 7,
+        Max = 8,
     }
 }
@@ -12,9 +12,9 @@ namespace BuildXL.Processes
         /// Returns true if the report type should be counted for Detours message validation.
         /// </summary>
         /// <remarks>
-        /// Currently on Detours side, the semaphore is only release for <see cref="ReportType.FileAccess"/>, <see cref="ReportType.ProcessData"/>, and
-        /// <see cref="ReportType.ProcessDetouringStatus"/> (see all uses of `SendReportString` in \Public\Src\Sandbox\Windows\DetoursServices\SendReport.cpp).
-        /// So, only those three <see cref="ReportType"/>s are included currently.
+        /// Currently on Detours side, reports are only counted (and the semaphore released by their count) for <see cref="ReportType.FileAccess"/>, <see cref="ReportType.CompactFileAccess"/>,
+        /// <see cref="ReportType.ProcessData"/>, and <see cref="ReportType.ProcessDetouringStatus"/> (see all uses of `SendReportString` in
+        /// \Public\Src\Sandbox\Windows\DetoursServices\SendReport.cpp). So, only those four <see cref="ReportType"/>s are included currently.
         /// 
         /// <see cref="ReportType.WindowsCall"/> is not included because the report type is currently not supported (see <seealso cref="SandboxedProcessReports"/>).
         /// 
@@ -38,6 +38,7 @@ namespace BuildXL.Processes
         /// </remarks>
         public static bool ShouldCountReportType(this ReportType reportType) =>
             reportType == ReportType.FileAccess
+            || reportType == ReportType.CompactFileAccess
             || reportType == ReportType.ProcessData
             || reportType == ReportType.ProcessDetouringStatus;
             // TODO: || reportType == ReportType.AugmentedFileAccess;
@@ -66,6 +66,11 @@ namespace BuildXL.Processes
         /// </summary>
         public uint ParentProcessId;
 
+        /// <summary>
+        /// Whether the last chunk of arguments passed to <see cref="AppendArgs"/> is followed by more chunks.
+        /// </summary>
+        private bool m_moreArgsExpected;
+
         /// <summary>
         /// Creates an instance of this class.
         /// </summary>
@@ -94,11 +99,21 @@ namespace BuildXL.Processes
         /// <summary>
         /// Set process args only if it wasn't set to a non-empty string in the constructor.
         /// </summary>
-        public void AppendArgs(string args)
+        /// <remarks>
+        /// Long command lines may be reported in several chunks. When <paramref name="moreArgsFollow"/> is set, the next call
+        /// appends its chunk to the arguments set so far.
+        /// </remarks>
+        public void AppendArgs(string args, bool moreArgsFollow = false)
         {
             if (string.IsNullOrEmpty(ProcessArgs))
             {
                 ProcessArgs = args;
+                m_moreArgsExpected = moreArgsFollow;
+            }
+            else if (m_moreArgsExpected)
+            {
+                ProcessArgs += args;
+                m_moreArgsExpected = moreArgsFollow;
             }
         }
 
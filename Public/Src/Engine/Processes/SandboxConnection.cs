@@ -5,11 +5,13 @@ using System;
 using System.Collections.Concurrent;
 using System.Collections.Generic;
 using System.Diagnostics.ContractsLight;
+using System.IO;
 using System.Linq;
 using System.Runtime.InteropServices;
 using System.Threading;
 using System.Threading.Tasks;
 using BuildXL.Interop.Unix;
+using BuildXL.Native.IO;
 using BuildXL.Native.Processes;
 using BuildXL.Utilities.Core;
 using BuildXL.Utilities.Instrumentation.Common;
@@ -59,6 +61,17 @@ namespace BuildXL.Processes
 
         private Sandbox.AccessReportCallback m_AccessReportCallback;
 
+        /// <summary>
+        /// Whether the processes of the pips are interposed, in which case they evaluate the file access manifest of their pip
+        /// themselves (only the accesses that have to be reported are sent to the sandbox)
+        /// </summary>
+        private bool IsInterposing => Kind == SandboxKind.MacOsDetours || Kind == SandboxKind.MacOsHybrid;
+
+        /// <summary>
+        /// Where the file access manifest of a pip is saved for its interposed processes
+        /// </summary>
+        private static string GetFamPath(string uniqueName) => Path.Combine(Path.GetTempPath(), $"bxl_{uniqueName}.fam");
+
         static private Sandbox.Configuration ConfigurationForSandboxKind(SandboxKind kind)
         {
             switch (kind)
@@ -169,23 +182,30 @@ namespace BuildXL.Processes
         /// <inheritdoc />
         public IEnumerable<(string, string)> AdditionalEnvVarsToSet(SandboxedProcessInfo info, string uniqueName)
         {
-            return Enumerable.Empty<(string, string)>();
+            // CODESYNC: Public/Src/Sandbox/MacOs/Detours/Detours.hpp
+            return IsInterposing
+                ? new[] { (SandboxConnectionLinuxDetours.BuildXLFamPathEnvVarName, GetFamPath(uniqueName)) }
+                : Enumerable.Empty<(string, string)>();
         }
 
         /// <inheritdoc />
-        public void NotifyPipReady(LoggingContext loggingContext, FileAccessManifest fam, SandboxedProcessUnix process, Task reportCompletion) {}
-
-        /// <inheritdoc />
-        public bool NotifyPipStarted(LoggingContext loggingContext, FileAccessManifest fam, SandboxedProcessUnix process)
+        public void NotifyPipReady(LoggingContext loggingContext, FileAccessManifest fam, SandboxedProcessUnix process, Task reportCompletion)
         {
-            Contract.Requires(process.Started);
-            Contract.Requires(process.PipId != 0);
+            if (!IsInterposing)
+            {
+                return;
+            }
 
-            if (!m_pipProcesses.TryAdd(fam.PipId, process))
+            // The manifest has to be there before the process starts, the sandbox itself only gets it once the process started
+            using (var wrapper = Pools.MemoryStreamPool.GetInstance())
             {
-                throw new BuildXLException($"Process with PidId {process.PipId} already exists");
+                ArraySegment<byte> manifestBytes = GetManifestBytes(loggingContext, fam, process, wrapper.Instance);
+                File.WriteAllBytes(GetFamPath(process.UniqueName), manifestBytes.ToArray());
             }
+        }
 
+        private static ArraySegment<byte> GetManifestBytes(LoggingContext loggingContext, FileAccessManifest fam, SandboxedProcessUnix process, MemoryStream stream)
+        {
             var setup = new FileAccessSetup()
             {
                 DllNameX64 = string.Empty,
@@ -193,17 +213,32 @@ namespace BuildXL.Processes
                 ReportPath = process.ExecutableAbsolutePath, // piggybacking on ReportPath to pass full executable path
             };
 
-            using (var wrapper = Pools.MemoryStreamPool.GetInstance())
+            var debugFlags = true;
+            ArraySegment<byte> manifestBytes = fam.GetPayloadBytes(
+                loggingContext,
+                setup,
+                stream,
+                timeoutMins: 10, // don't care because on Mac we don't kill the process from the sandbox once it times out
+                debugFlagsMatch: ref debugFlags);
+
+            Contract.Assert(manifestBytes.Offset == 0);
+            return manifestBytes;
+        }
+
+        /// <inheritdoc />
+        public bool NotifyPipStarted(LoggingContext loggingContext, FileAccessManifest fam, SandboxedProcessUnix process)
+        {
+            Contract.Requires(process.Started);
+            Contract.Requires(process.PipId != 0);
+
+            if (!m_pipProcesses.TryAdd(fam.PipId, process))
             {
-                var debugFlags = true;
-                ArraySegment<byte> manifestBytes = fam.GetPayloadBytes(
-                    loggingContext,
-                    setup,
-                    wrapper.Instance,
-                    timeoutMins: 10, // don't care because on Mac we don't kill the process from the sandbox once it times out
-                    debugFlagsMatch: ref debugFlags);
+                throw new BuildXLException($"Process with PidId {process.PipId} already exists");
+            }
 
-                Contract.Assert(manifestBytes.Offset == 0);
+            using (var wrapper = Pools.MemoryStreamPool.GetInstance())
+            {
+                ArraySegment<byte> manifestBytes = GetManifestBytes(loggingContext, fam, process, wrapper.Instance);
 
                 var result = Sandbox.SendPipStarted(
                     processId: process.ProcessId,
@@ -217,6 +252,12 @@ namespace BuildXL.Processes
             }
         }
 
+        /// <inheritdoc />
+        /// <remarks>
+        /// The manifest is sent once, when the pip starts, and the sandbox has no message to replace it.
+        /// </remarks>
+        public bool NotifyPipManifestUpdated(LoggingContext loggingContext, FileAccessManifest fam, SandboxedProcessUnix process, IReadOnlyCollection<string> changedScopes) => false;
+
         /// <inheritdoc />
         public void NotifyPipProcessTerminated(long pipId, int processId)
         {
@@ -236,6 +277,11 @@ namespace BuildXL.Processes
             if (m_pipProcesses.TryRemove(pipId, out var proc))
             {
                 Contract.Assert(process == proc);
+                if (IsInterposing)
+                {
+                    Analysis.IgnoreResult(FileUtilities.TryDeleteFile(GetFamPath(process.UniqueName), retryOnFailure: false));
+                }
+
                 return true;
             }
             else
@@ -208,7 +208,7 @@ Use the the following command to load/reload the sandbox kernel extension and fi
         /// </summary>
         private void StartReceivingAccessReports(ulong address, uint port)
         {
-            Sandbox.AccessReportCallback callback = (Sandbox.AccessReport report, int code) =>
+            Sandbox.AccessReportBatchCallback callback = (Sandbox.AccessReport[] reports, int count, int code) =>
             {
                 if (code != Sandbox.ReportQueueSuccessCode)
                 {
@@ -219,26 +219,35 @@ Use the the following command to load/reload the sandbox kernel extension and fi
                 // Update last received timestamp
                 Volatile.Write(ref m_lastReportReceivedTimestampTicks, DateTime.UtcNow.Ticks);
 
-                // Remember the latest enqueue time
-                Volatile.Write(ref m_reportQueueLastEnqueueTime, report.Statistics.EnqueueTime);
-
-                // The only way it can happen that no process is found for 'report.PipId' is when that pip is
-                // explicitly terminated (e.g., because it timed out or Ctrl-c was pressed)
-                if (m_pipProcesses.TryGetValue(report.PipId, out var process))
+                for (int i = 0; i < count; i++)
                 {
-                    // if the process is found, its ProcessId must match the RootPid of the report.
-                    if (process.ProcessId != report.RootPid)
-                    {
-                        m_failureCallback?.Invoke(-1, $"Unexpected PID for Pip {report.PipId:X}: Expected {process.ProcessId}, Reported {report.RootPid}");
-                    }
-                    else
-                    {
-                        process.PostAccessReport(report);
-                    }
+                    ProcessAccessReport(reports[i]);
                 }
             };
 
-            Sandbox.ListenForFileAccessReports(callback, Marshal.SizeOf<Sandbox.AccessReport>(), address, port);
+            Sandbox.ListenForFileAccessReportBatches(callback, Marshal.SizeOf<Sandbox.AccessReport>(), address, port);
+            GC.KeepAlive(callback);
+        }
+
+        private void ProcessAccessReport(Sandbox.AccessReport report)
+        {
+            // Remember the latest enqueue time
+            Volatile.Write(ref m_reportQueueLastEnqueueTime, report.Statistics.EnqueueTime);
+
+            // The only way it can happen that no process is found for 'report.PipId' is when that pip is
+            // explicitly terminated (e.g., because it timed out or Ctrl-c was pressed)
+            if (m_pipProcesses.TryGetValue(report.PipId, out var process))
+            {
+                // if the process is found, its ProcessId must match the RootPid of the report.
+                if (process.ProcessId != report.RootPid)
+                {
+                    m_failureCallback?.Invoke(-1, $"Unexpected PID for Pip {report.PipId:X}: Expected {process.ProcessId}, Reported {report.RootPid}");
+                }
+                else
+                {
+                    process.PostAccessReport(report);
+                }
+            }
         }
 
         /// <inheritdoc />
@@ -298,6 +307,12 @@ Use the the following command to load/reload the sandbox kernel extension and fi
             return Enumerable.Empty<(string, string)>();
         }
 
+        /// <inheritdoc />
+        /// <remarks>
+        /// The kernel extension keeps the manifest it got when the pip started, it has no message to replace it.
+        /// </remarks>
+        public bool NotifyPipManifestUpdated(LoggingContext loggingContext, FileAccessManifest fam, SandboxedProcessUnix process, IReadOnlyCollection<string> changedScopes) => false;
+
         /// <inheritdoc />
         public void NotifyPipProcessTerminated(long pipId, int processId)
         {
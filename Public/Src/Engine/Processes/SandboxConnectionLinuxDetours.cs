@@ -44,6 +44,16 @@ namespace BuildXL.Processes
         // 0 active processes
         private const int EndOfReportsSentinel = -22;
 
+        // Size of the fixed part of a report message (the 7 fields that precede the path)
+        // CODESYNC: Public/Src/Sandbox/Linux/bxl_observer.hpp (ReportRecordHeader)
+        private const int ReportHeaderSize = 7 * sizeof(int);
+
+        // Set in the length of a message when what follows is a compressed frame holding a batch of messages
+        // (see EnableLinuxCompressedReports). The sentinels above are negative, so they never carry this bit.
+        // CODESYNC: Public/Src/Sandbox/Linux/report_compression.hpp
+        private const int CompressedFrameFlag = 0x40000000;
+        private const int MaxCompressedFrameSize = ushort.MaxValue;
+
         /// <summary>
         /// Location of the Linux sandbox shared library binary.
         /// </summary>
@@ -164,6 +174,71 @@ namespace BuildXL.Processes
                     return totalRead;
                 }
 
+                /// <summary>
+                /// Reads the rest of a compressed frame (see <see cref="CompressedFrameFlag"/>) and posts each of the messages it holds
+                /// to the processing block, in order. Returns false if the frame could not be read or is malformed.
+                /// </summary>
+                private bool ReceiveCompressedFrame(string fifoName, SafeFileHandle readHandle, int compressedLength, byte[] lengthBytes)
+                {
+                    if (Read(readHandle, lengthBytes, 0, lengthBytes.Length) < lengthBytes.Length)
+                    {
+                        LogError($"Read from FIFO {fifoName} failed: could not read the size of a compressed frame.");
+                        return false;
+                    }
+
+                    int uncompressedLength = BitConverter.ToInt32(lengthBytes, startIndex: 0);
+                    if (compressedLength > MaxCompressedFrameSize || uncompressedLength < 0 || uncompressedLength > MaxCompressedFrameSize)
+                    {
+                        LogError($"Malformed compressed frame on FIFO {fifoName} ({compressedLength} bytes, {uncompressedLength} bytes uncompressed).");
+                        return false;
+                    }
+
+                    using PooledObjectWrapper<byte[]> compressed = ByteArrayPool.GetInstance(compressedLength);
+                    using PooledObjectWrapper<byte[]> uncompressed = ByteArrayPool.GetInstance(uncompressedLength);
+
+                    int numRead = Read(readHandle, compressed.Instance, 0, compressedLength);
+                    if (numRead < compressedLength)
+                    {
+                        LogError($"Read from FIFO {fifoName} failed: read only {numRead} out of {compressedLength} bytes of a compressed frame.");
+                        return false;
+                    }
+
+                    if (Lz4BlockDecoder.Decode(compressed.Instance, compressedLength, uncompressed.Instance) != uncompressedLength)
+                    {
+                        LogError($"Malformed compressed frame on FIFO {fifoName} ({compressedLength} bytes, {uncompressedLength} bytes uncompressed).");
+                        return false;
+                    }
+
+                    byte[] frame = uncompressed.Instance;
+                    for (int offset = 0; offset < uncompressedLength;)
+                    {
+                        int messageLength = uncompressedLength - offset >= sizeof(int) ? BitConverter.ToInt32(frame, offset) : -1;
+                        offset += sizeof(int);
+                        if (messageLength < 0 || messageLength > uncompressedLength - offset)
+                        {
+                            LogError($"Malformed compressed frame on FIFO {fifoName}: a message overruns the frame.");
+                            return false;
+                        }
+
+                        PooledObjectWrapper<byte[]> messageBytes = ByteArrayPool.GetInstance(messageLength);
+                        Buffer.BlockCopy(frame, offset, messageBytes.Instance, 0, messageLength);
+                        offset += messageLength;
+
+                        try
+                        {
+                            m_processingBlock.Post((this, messageBytes, messageLength), throwOnFullOrComplete: true);
+                        }
+                        catch (Exception e)
+                        {
+                            Analysis.IgnoreException("Will error and exit on LogError");
+                            LogError($"Could not post message to the processing block for {fifoName}. Exception details: {e}");
+                            return false;
+                        }
+                    }
+
+                    return true;
+                }
+
                 private void LogDebug(string s) => Info.Process.LogDebug(s);
 
                 private void LogError(string s) => Info.LogError(s);
@@ -255,6 +330,16 @@ namespace BuildXL.Processes
                                 break;
                             }
 
+                            if (messageLength > 0 && (messageLength & CompressedFrameFlag) != 0)
+                            {
+                                if (!ReceiveCompressedFrame(fifoName, readHandle, messageLength & ~CompressedFrameFlag, messageLengthBytes))
+                                {
+                                    break;
+                                }
+
+                                continue;
+                            }
+
                             // read a message of that length
                             PooledObjectWrapper<byte[]> messageBytes = ByteArrayPool.GetInstance(messageLength);
                             numRead = Read(readHandle, messageBytes.Instance, 0, messageLength);
@@ -305,6 +390,19 @@ namespace BuildXL.Processes
             internal string SecondaryFifoPath { get; }
             internal string FamPath { get; }
 
+            /// <summary>
+            /// Whether the processes of the pip watch for manifest updates (see <see cref="NotifyPipManifestUpdated"/>)
+            /// </summary>
+            internal bool ManifestUpdatesEnabled { get; set; }
+
+            /// <summary>
+            /// Generation of the last manifest update, and the generation of the last change of every scope updated so far.
+            /// Guarded by <see cref="ManifestUpdateLock"/>.
+            /// </summary>
+            internal ulong ManifestGeneration { get; set; }
+            internal Dictionary<string, ulong> ChangedScopes { get; } = new Dictionary<string, ulong>();
+            internal object ManifestUpdateLock { get; } = new object();
+
             private readonly ManagedFailureCallback m_failureCallback;
             private readonly bool m_isInTestMode;
 
@@ -588,6 +686,13 @@ namespace BuildXL.Processes
                 m_activeProcesses.Clear();
                 Analysis.IgnoreResult(FileUtilities.TryDeleteFile(ReportsFifoPath, retryOnFailure: false));
                 Analysis.IgnoreResult(FileUtilities.TryDeleteFile(FamPath, retryOnFailure: false));
+                // CODESYNC: Public/Src/Sandbox/Linux/bxl_observer.cpp (the shared access cache is created by the root process next to the FAM)
+                Analysis.IgnoreResult(FileUtilities.TryDeleteFile(Path.ChangeExtension(FamPath, ".dedup"), retryOnFailure: false));
+                if (ManifestUpdatesEnabled)
+                {
+                    Analysis.IgnoreResult(FileUtilities.TryDeleteFile(Path.ChangeExtension(FamPath, ".gen"), retryOnFailure: false));
+                    Analysis.IgnoreResult(FileUtilities.TryDeleteFile(Path.ChangeExtension(FamPath, ".scopes"), retryOnFailure: false));
+                }
                 if (m_isInTestMode)
                 {
                     // The worker thread should complete in all but most extreme cases.  One such extreme case
@@ -630,33 +735,34 @@ namespace BuildXL.Processes
 
                     Contract.Assert(item.length > 0, "No other sentinel but the one above should be posted");
 
-                    var messageStr = s_encoding.GetString(item.wrapper.Instance, index: 0, count: item.length);
-                    var message = messageStr.AsSpan().TrimEnd('\n');
-
-                    // parse the message, consuming the span field by field. The format is:
-                    //  "%s|%d|%d|%d|%d|%d|%d|%d|%s\n", __progname, getpid(), access, status, explicitLogging, err, opcode, isDirectory, reportPath
-                    var restOfMessage = message;
-                    _ = nextField(restOfMessage, out restOfMessage);  // ignore progname
-                    var pid = AssertInt(nextField(restOfMessage, out restOfMessage));
-                    var access = (RequestedAccess)AssertInt(nextField(restOfMessage, out restOfMessage));
-                    var status = AssertInt(nextField(restOfMessage, out restOfMessage));
-                    var explicitlogging = AssertInt(nextField(restOfMessage, out restOfMessage));
-                    var err = AssertInt(nextField(restOfMessage, out restOfMessage));
-                    var opCode = AssertInt(nextField(restOfMessage, out restOfMessage));
-                    var isDirectory = AssertInt(nextField(restOfMessage, out restOfMessage));
-                    var path = nextField(restOfMessage, out restOfMessage);
-                    Contract.Assert(restOfMessage.IsEmpty);  // We should have reached the end of the message
+                    // parse the message. The format is a fixed-size header followed by the path (not null-terminated),
+                    // which takes the rest of the message:
+                    //  int32 pid, uint32 access, uint32 status, uint32 explicitLogging, uint32 err, uint32 opcode, uint32 isDirectory, byte[] reportPath
+                    // CODESYNC: Public/Src/Sandbox/Linux/bxl_observer.hpp (ReportRecordHeader)
+                    Contract.Assert(item.length >= ReportHeaderSize, "The message should at least contain the report header");
+
+                    var bytes = item.wrapper.Instance;
+                    var pid = BitConverter.ToInt32(bytes, startIndex: 0);
+                    var access = (RequestedAccess)BitConverter.ToUInt32(bytes, startIndex: 4);
+                    var status = BitConverter.ToUInt32(bytes, startIndex: 8);
+                    var explicitlogging = BitConverter.ToUInt32(bytes, startIndex: 12);
+                    var err = BitConverter.ToUInt32(bytes, startIndex: 16);
+                    var opCode = BitConverter.ToUInt32(bytes, startIndex: 20);
+                    var isDirectory = BitConverter.ToUInt32(bytes, startIndex: 24);
+
+                    var path = new byte[item.length - ReportHeaderSize];
+                    Array.Copy(bytes, ReportHeaderSize, path, 0, path.Length);
 
                     var report = new AccessReport
                     {
-                        Pid = (int)pid,
+                        Pid = pid,
                         PipId = Process.PipId,
                         RequestedAccess = (uint)access,
                         Status = status,
                         ExplicitLogging = explicitlogging,
                         Error = err,
                         Operation = (FileOperation)opCode,
-                        PathOrPipStats = s_encoding.GetBytes(path.ToArray()),
+                        PathOrPipStats = path,
                         IsDirectory = isDirectory,
                     };
 
@@ -679,39 +785,6 @@ namespace BuildXL.Processes
                     // post the AccessReport
                     Process.PostAccessReport(report);
                 }
-
-                // Reads next field of the serialized message, i.e. split on the first | and return both parts
-                static ReadOnlySpan<char> nextField(ReadOnlySpan<char> message, out ReadOnlySpan<char> rest)
-                {
-                    for (int i = 0; i < message.Length; i++)
-                    {
-                        if (message[i] == '|')
-                        {
-                            rest = i + 1 == message.Length ? ReadOnlySpan<char>.Empty : message.Slice(i+1); // Defend against | being the last character, although we don't expect this
-                            return message.Slice(0, i);
-                        }
-                    }
-
-                    rest = ReadOnlySpan<char>.Empty;
-                    return message;
-                }
-            }
-
-            private uint AssertInt(ReadOnlySpan<char> str)
-            {
-#if NETCOREAPP
-                if (uint.TryParse(str, out uint result))
-#else // .NET 472 - no ReadOnlySpan<char> overloads. We don't really care about perf for .NET472 here
-                if (uint.TryParse(str.ToString(), out uint result))
-#endif
-                {
-                    return result;
-                }
-                else
-                {
-                    LogError($"Could not parse int from '{str.ToString()}'");
-                    return 0;
-                }
             }
         }
 
@@ -734,8 +807,6 @@ namespace BuildXL.Processes
 
         private readonly ManagedFailureCallback m_failureCallback;
 
-        private static readonly Encoding s_encoding = Encoding.UTF8;
-
         /// <inheritdoc />
         /// <remarks>Unimportant</remarks>
         public TimeSpan CurrentDrought => TimeSpan.FromSeconds(0);
@@ -777,6 +848,12 @@ namespace BuildXL.Processes
             yield return (BuildXLFamPathEnvVarName, info.RootJailInfo.ToPathInsideRootJail(famPath));
             yield return ("__BUILDXL_DETOURS_PATH", detoursLibPath);
 
+            // A root jail doesn't see the engine cache, so its pips keep their classifications in their temp directory
+            if (!string.IsNullOrEmpty(info.PTraceClassificationDirectory) && info.RootJailInfo == null)
+            {
+                yield return ("__BUILDXL_PTRACE_CLASSIFICATION_DIRECTORY", info.PTraceClassificationDirectory); // CODESYNC: Public/Src/Sandbox/Linux/common.h
+            }
+
             if (info.RootJailInfo?.DisableSandboxing != true)
             {
                 yield return ("LD_PRELOAD", detoursLibPath + ":" + info.EnvironmentVariables.TryGetValue("LD_PRELOAD", string.Empty));
@@ -788,12 +865,22 @@ namespace BuildXL.Processes
             // be problematic since any change in the sandbox version will imply a cache miss.
             // In addition to that, LD_AUDIT is known to be expensive from a perf standpoint (perf analysis on some JS customers showed a 2X degradation in sandboxing overhead
             // on e2e builds when LD_AUDIT is on).
-            if (info.RootJailInfo?.DisableAuditing == false)
+            // Pips observed in the lightweight mode (see FileAccessManifest.EnableLinuxLightweightObservation) always get it: the interposer lets more calls through
+            // for them, so library loads are observed by the dynamic linker instead.
+            if (info.RootJailInfo?.DisableAuditing == false || IsLightweightObservation(info.FileAccessManifest))
             {
                 yield return ("LD_AUDIT", info.RootJailInfo.CopyToRootJailIfNeeded(s_auditLibFile) + ":" + info.EnvironmentVariables.TryGetValue("LD_AUDIT", string.Empty));
             }
         }
 
+        /// <summary>
+        /// Whether the interposer observes the pip with the given manifest in the lightweight mode.
+        /// </summary>
+        /// <remarks>
+        /// CODESYNC: Public/Src/Sandbox/Linux/bxl_observer.cpp (InitFam)
+        /// </remarks>
+        private static bool IsLightweightObservation(FileAccessManifest fam) => fam.EnableLinuxLightweightObservation && !fam.FailUnexpectedFileAccesses;
+
         /// <summary>
         /// Returns the paths for the FIFO and FAM based on the unique name for a pip.
         /// </summary>
@@ -824,23 +911,16 @@ namespace BuildXL.Processes
                 fam.EnableLinuxSandboxLogging = true;
             }
 
-            // serialize FAM
-            using (var wrapper = Pools.MemoryStreamPool.GetInstance())
-            {
-                var debugFlags = true;
-                ArraySegment<byte> manifestBytes = fam.GetPayloadBytes(
-                    loggingContext,
-                    new FileAccessSetup { DllNameX64 = string.Empty, DllNameX86 = string.Empty, ReportPath = process.ToPathInsideRootJail(fifoPath) },
-                    wrapper.Instance,
-                    timeoutMins: 10, // don't care
-                    debugFlagsMatch: ref debugFlags);
+            WriteManifest(loggingContext, fam, process, fifoPath, famPath);
+            process.LogDebug($"Saved FAM to '{famPath}'");
 
-                Contract.Assert(manifestBytes.Offset == 0);
-                File.WriteAllBytes(famPath, manifestBytes.ToArray());
+            // CODESYNC: Public/Src/Sandbox/Linux/bxl_observer.cpp (InitManifestUpdates)
+            // The generation counter must exist before the pip starts: its processes map it when they initialize
+            if (fam.EnableLinuxManifestUpdates)
+            {
+                File.WriteAllBytes(Path.ChangeExtension(famPath, ".gen"), new byte[sizeof(ulong)]);
             }
 
-            process.LogDebug($"Saved FAM to '{famPath}'");
-
             // create a FIFO (named pipe)
             createNewFifo(fifoPath);
 
@@ -855,7 +935,10 @@ namespace BuildXL.Processes
             }
 
             // create and save info for this pip
-            var info = new Info(m_failureCallback, process, fifoPath, secondaryFifoPath, famPath, IsInTestMode);
+            var info = new Info(m_failureCallback, process, fifoPath, secondaryFifoPath, famPath, IsInTestMode)
+            {
+                ManifestUpdatesEnabled = fam.EnableLinuxManifestUpdates,
+            };
             if (!m_pipProcesses.TryAdd(process.PipId, info))
             {
                 throw new BuildXLException($"Process with PidId {process.PipId} already exists");
@@ -878,6 +961,97 @@ namespace BuildXL.Processes
             }
         }
 
+        /// <inheritdoc />
+        public bool NotifyPipManifestUpdated(LoggingContext loggingContext, FileAccessManifest fam, SandboxedProcessUnix process, IReadOnlyCollection<string> changedScopes)
+        {
+            // Only the processes of pips that started with updates enabled watch the generation counter
+            if (!m_pipProcesses.TryGetValue(process.PipId, out var info) || !info.ManifestUpdatesEnabled)
+            {
+                return false;
+            }
+
+            fam.EnableLinuxManifestUpdates = true;
+            if (IsInTestMode)
+            {
+                fam.EnableLinuxSandboxLogging = true;
+            }
+
+            // CODESYNC: Public/Src/Sandbox/Linux/bxl_observer.cpp (SyncManifest, ReadChangedScopes)
+            // The manifest and the list of changed scopes are replaced with a rename, so processes never see them partially written.
+            // The counter goes last: a process that sees a new generation finds a manifest and a list at least as recent.
+            lock (info.ManifestUpdateLock)
+            {
+                ulong generation = info.ManifestGeneration + 1;
+                string famPath = info.FamPath;
+                string scopesPath = Path.ChangeExtension(famPath, ".scopes");
+
+                try
+                {
+                    WriteManifest(loggingContext, fam, process, info.ReportsFifoPath, famPath + ".tmp");
+                    ReplaceFile(famPath + ".tmp", famPath);
+
+                    // An empty scope stands for the whole manifest
+                    foreach (string scope in changedScopes ?? new[] { string.Empty })
+                    {
+                        info.ChangedScopes[scope.Length == 0 ? scope : process.ToPathInsideRootJail(scope)] = generation;
+                    }
+
+                    var scopes = new StringBuilder().Append(generation).Append('\n');
+                    foreach (var changedScope in info.ChangedScopes)
+                    {
+                        scopes.Append(changedScope.Value).Append('\t').Append(changedScope.Key).Append('\n');
+                    }
+
+                    File.WriteAllText(scopesPath + ".tmp", scopes.ToString());
+                    ReplaceFile(scopesPath + ".tmp", scopesPath);
+
+                    using (var counter = new FileStream(Path.ChangeExtension(famPath, ".gen"), FileMode.Open, FileAccess.Write, FileShare.ReadWrite))
+                    {
+                        counter.Write(BitConverter.GetBytes(generation), 0, sizeof(ulong));
+                    }
+                }
+                catch (Exception ex) when (ex is IOException || ex is UnauthorizedAccessException)
+                {
+                    // Processes keep applying the previous generation until the counter moves
+                    process.LogDebug($"Could not update the manifest of the pip: {ex.Message}");
+                    return false;
+                }
+
+                info.ManifestGeneration = generation;
+                process.LogDebug($"Updated FAM at '{famPath}' to generation {generation} ({changedScopes?.Count.ToString() ?? "all"} changed scopes)");
+            }
+
+            return true;
+        }
+
+        private static void WriteManifest(LoggingContext loggingContext, FileAccessManifest fam, SandboxedProcessUnix process, string fifoPath, string path)
+        {
+            using (var wrapper = Pools.MemoryStreamPool.GetInstance())
+            {
+                var debugFlags = true;
+                ArraySegment<byte> manifestBytes = fam.GetPayloadBytes(
+                    loggingContext,
+                    new FileAccessSetup { DllNameX64 = string.Empty, DllNameX86 = string.Empty, ReportPath = process.ToPathInsideRootJail(fifoPath) },
+                    wrapper.Instance,
+                    timeoutMins: 10, // don't care
+                    debugFlagsMatch: ref debugFlags);
+
+                Contract.Assert(manifestBytes.Offset == 0);
+                File.WriteAllBytes(path, manifestBytes.ToArray());
+            }
+        }
+
+        private static void ReplaceFile(string source, string destination)
+        {
+#if NETCOREAPP
+            // A rename(2) on Unix, so readers see one file or the other in full
+            File.Move(source, destination, overwrite: true);
+#else
+            File.Delete(destination);
+            File.Move(source, destination);
+#endif
+        }
+
         /// <inheritdoc />
         public void NotifyPipProcessTerminated(long pipId, int processId)
         {
@@ -64,6 +64,9 @@ namespace BuildXL.Processes
         private readonly SandboxedProcessTraceBuilder? m_traceBuilder;
         private readonly SandboxedProcessReports m_reports;
         private IAsyncPipeReader? m_reportReader;
+        private SharedMemoryReportRing? m_reportRing;
+        private SharedReparsePointCache? m_reparsePointCache;
+        private readonly object m_reportLineLock = new object();
         private readonly SemaphoreSlim m_reportReaderSemaphore = TaskUtilities.CreateMutex();
         private Dictionary<uint, ReportedProcess>? m_survivingChildProcesses;
         private readonly uint m_timeoutMins;
@@ -405,6 +408,12 @@ namespace BuildXL.Processes
             m_detouredProcess?.Dispose();
             m_detouredProcess = null;
 
+            m_reportRing?.Dispose();
+            m_reportRing = null;
+
+            m_reparsePointCache?.Dispose();
+            m_reparsePointCache = null;
+
             m_output.Dispose();
             m_error.Dispose();
 
@@ -476,9 +485,25 @@ namespace BuildXL.Processes
                             writeHandle: out childHandle);
                     }
 
+                    string? sharedMemoryName = m_fileAccessManifest.EnableSharedMemoryReports || m_fileAccessManifest.EnableSharedReparsePointCache
+                        ? $@"Local\BuildXL_{Guid.NewGuid():N}"
+                        : null;
+
+                    if (m_fileAccessManifest.EnableSharedMemoryReports)
+                    {
+                        // Reports come through both the ring and the pipe (when the ring is full), so lines need to be handled one at a time
+                        m_reportRing = new SharedMemoryReportRing(sharedMemoryName!, SerializedReportLineReceived);
+                    }
+
+                    if (m_fileAccessManifest.EnableSharedReparsePointCache)
+                    {
+                        m_reparsePointCache = new SharedReparsePointCache(sharedMemoryName!);
+                    }
+
                     var setup = new FileAccessSetup
                     {
                         ReportPath = "#" + childHandle.DangerousGetHandle().ToInt64(),
+                        SharedMemoryName = sharedMemoryName,
                         DllNameX64 = s_binaryPaths!.DllNameX64,
                         DllNameX86 = s_binaryPaths!.DllNameX86,
                     };
@@ -532,7 +557,7 @@ namespace BuildXL.Processes
                     }
                 }
 
-                StreamDataReceived reportLineReceivedCallback = ReportLineReceived;
+                StreamDataReceived reportLineReceivedCallback = m_reportRing != null ? SerializedReportLineReceived : ReportLineReceived;
 
                 if (useManagedPipeReader)
                 {
@@ -559,6 +584,7 @@ namespace BuildXL.Processes
                 }
 
                 m_reportReader.BeginReadLine();
+                m_reportRing?.Start();
             }
 
             // don't wait, we want feeding in of standard input to happen asynchronously
@@ -574,6 +600,14 @@ namespace BuildXL.Processes
             }
         }
 
+        private bool SerializedReportLineReceived(string data)
+        {
+            lock (m_reportLineLock)
+            {
+                return ReportLineReceived(data);
+            }
+        }
+
         private void DebugPipeConnection(string data) => m_reports.ReportLineReceived($"{(int)ReportType.DebugMessage},{data}");
 
         private static async Task FeedStandardInputAsync(DetouredProcess detouredProcess, TextReader? reader, TaskSourceSlim<bool> stdInTcs)
@@ -615,6 +649,19 @@ namespace BuildXL.Processes
                     m_reportReader.Dispose();
                     m_reportReader = null;
                 }
+
+                if (m_reportRing != null)
+                {
+                    // The pipe is only closed once every process of the pip is gone, so nothing else can be appended to the ring
+                    await m_reportRing.StopAsync();
+
+                    m_reportRing.Dispose();
+                    m_reportRing = null;
+                }
+
+                // Same for the reparse point cache, nothing can use it anymore
+                m_reparsePointCache?.Dispose();
+                m_reparsePointCache = null;
             }
         }
 
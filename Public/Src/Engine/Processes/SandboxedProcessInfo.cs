@@ -474,6 +474,11 @@ namespace BuildXL.Processes
         /// </summary>
         public string? SurvivingPipProcessChildrenDumpDirectory { get; set; }
 
+        /// <summary>
+        /// Directory where the Linux sandbox keeps the ptrace classifications of executables from build to build
+        /// </summary>
+        public string? PTraceClassificationDirectory { get; set; }
+
         /// <summary>
         /// The kind of sandboxing to use.
         /// </summary>
@@ -575,6 +580,7 @@ namespace BuildXL.Processes
                 writer.Write(PipSemiStableHash);
                 writer.WriteNullableString(TimeoutDumpDirectory);
                 writer.WriteNullableString(SurvivingPipProcessChildrenDumpDirectory);
+                writer.WriteNullableString(PTraceClassificationDirectory);
                 writer.Write((byte)SandboxKind);
                 writer.WriteNullableString(PipDescription);
 
@@ -641,6 +647,7 @@ namespace BuildXL.Processes
                 long pipSemiStableHash = reader.ReadInt64();
                 string? timeoutDumpDirectory = reader.ReadNullableString();
                 string? survivingPipProcessChildrenDumpDirectory = reader.ReadNullableString();
+                string? ptraceClassificationDirectory = reader.ReadNullableString();
                 SandboxKind sandboxKind = (SandboxKind)reader.ReadByte();
                 string? pipDescription = reader.ReadNullableString();
                 SandboxedProcessStandardFiles sandboxedProcessStandardFiles = SandboxedProcessStandardFiles.Deserialize(reader);
@@ -685,6 +692,7 @@ namespace BuildXL.Processes
                     PipSemiStableHash = pipSemiStableHash,
                     TimeoutDumpDirectory = timeoutDumpDirectory,
                     SurvivingPipProcessChildrenDumpDirectory = survivingPipProcessChildrenDumpDirectory,
+                    PTraceClassificationDirectory = ptraceClassificationDirectory,
                     SandboxKind = sandboxKind,
                     PipDescription = pipDescription,
                     SandboxedProcessStandardFiles = sandboxedProcessStandardFiles,
@@ -30,12 +30,17 @@ namespace BuildXL.Processes
         // CODESYNC: Public\Src\Sandbox\Windows\DetoursServices\FileAccessHelpers.h
         public const uint FileAccessNoId = 0;
 
+        // Error (E2BIG) of the Linux command line reports that are followed by more chunks of the same command line
+        // CODESYNC: Public/Src/Sandbox/Linux/bxl_observer.cpp (report_exec_args)
+        private const uint CommandLineChunkFollowsError = 7;
+
         private static readonly Dictionary<string, ReportType> s_reportTypes = Enum
             .GetValues(typeof(ReportType))
             .Cast<ReportType>()
             .ToDictionary(reportType => ((int)reportType).ToString(), reportType => reportType);
 
         private readonly PathTable m_pathTable;
+        private readonly CompactFileAccessReportLine m_compactFileAccessReportLine = new CompactFileAccessReportLine();
         private readonly ConcurrentDictionary<uint, ReportedProcess> m_activeProcesses = new ConcurrentDictionary<uint, ReportedProcess>();
         private readonly ConcurrentDictionary<uint, ReportedProcess> m_processesExits = new ConcurrentDictionary<uint, ReportedProcess>();
 
@@ -55,14 +60,26 @@ namespace BuildXL.Processes
 
         public readonly List<ProcessDetouringStatusData> ProcessDetoursStatuses = new List<ProcessDetouringStatusData>();
         
+        private int m_receivedMessageCount;
+
         /// <summary>
-        /// The last message count in the semaphore.
+        /// The number of counted reports that were sent but not received.
         /// </summary>
+        /// <remarks>
+        /// Sandboxed processes count the reports they send and release the message-count semaphore by that count in bulk, so the semaphore ends
+        /// up holding the number of reports sent. Received reports are counted in memory (see <see cref="CountReceivedMessage"/>).
+        /// </remarks>
         public int GetLastMessageCount()
         {
-            return m_manifest.MessageCountSemaphore?.Release() ?? 0;
+            var semaphore = m_manifest.MessageCountSemaphore;
+            return semaphore == null ? 0 : semaphore.Release() - Volatile.Read(ref m_receivedMessageCount);
         }
 
+        /// <summary>
+        /// Counts a received report of a type that is counted for Detours message validation (see <see cref="ReportTypeExtensions.ShouldCountReportType"/>).
+        /// </summary>
+        public void CountReceivedMessage() => Interlocked.Increment(ref m_receivedMessageCount);
+
         public INamedSemaphore GetMessageCountSemaphore()
         {
             return m_manifest.MessageCountSemaphore;
@@ -275,15 +292,7 @@ namespace BuildXL.Processes
 
             if (m_manifest.MessageCountSemaphore != null && reportType.ShouldCountReportType())
             {
-                try
-                {
-                    m_manifest.MessageCountSemaphore.WaitOne(0);
-                }
-                catch (Exception ex)
-                {
-                    MessageProcessingFailure = CreateMessageProcessingFailure(data, I($"Wait error on semaphore for counting Detours messages: {ex.GetLogEventMessage()}."));
-                    return false;
-                }
+                CountReceivedMessage();
             }
 
             string errorMessage = string.Empty;
@@ -299,6 +308,15 @@ namespace BuildXL.Processes
 
                     break;
 
+                case ReportType.CompactFileAccess:
+                    if (!FileAccessReportLineReceived(ref data, m_compactFileAccessReportLine.TryParse, isAnAugmentedFileAccess: false, out errorMessage))
+                    {
+                        MessageProcessingFailure = CreateMessageProcessingFailure(data, errorMessage);
+                        return false;
+                    }
+
+                    break;
+
                 case ReportType.DebugMessage:
                     if (m_detoursEventListener != null && (m_detoursEventListener.GetMessageHandlingFlags() & MessageHandlingFlags.DebugMessageNotify) != 0)
                     {
@@ -770,8 +788,9 @@ namespace BuildXL.Processes
                     return true;
                 }
 
-                matchingProcess.AppendArgs(path);
-                m_traceBuilder?.UpdateProcessArgs(matchingProcess, path);
+                // Command lines that don't fit in a single report are chunked, every chunk but the last one comes with E2BIG.
+                // The trace builder holds the same instance (see ReportProcess), so it sees the appended arguments as well
+                matchingProcess.AppendArgs(path, error == CommandLineChunkFollowsError);
 
                 return true;
             }
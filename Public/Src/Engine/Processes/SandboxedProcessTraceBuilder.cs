@@ -128,18 +128,6 @@ namespace BuildXL.Processes
             m_reportedProcesses.Add(process);
         }
 
-        /// <summary>
-        /// Updates the arguments of a process that was already reported.
-        /// </summary>
-        public void UpdateProcessArgs(ReportedProcess process, string args)
-        {
-            var matchingProcess = m_reportedProcesses.FirstOrDefault(p => p.ProcessId == process.ProcessId);
-            if (matchingProcess != default)
-            {
-                matchingProcess.AppendArgs(args);
-            }
-        }
-
         private bool SkipOperation(ReportedFileOperation operation)
         {
             switch (operation)
@@ -45,6 +45,14 @@ namespace BuildXL.Processes
         private readonly ReadWriteLock m_snapshotRwl = ReadWriteLock.Create();
         private readonly Dictionary<string, Process.ProcessResourceUsage>? m_processResourceUsage;
 
+        /// <summary>
+        /// The cgroup v2 leaf the processes of the pip run in, when <see cref="FileAccessManifest.EnableLinuxCgroupAccounting"/> is set and it could be created.
+        /// </summary>
+        /// <remarks>
+        /// Set by <see cref="CreateProcess"/>, which runs from the base constructor, since the environment of the root process must name the leaf.
+        /// </remarks>
+        private string? m_cgroupPath;
+
         private IEnumerable<ReportedProcess>? m_survivingChildProcesses;
 
         private PipKextStats? m_pipKextStats;
@@ -62,6 +70,13 @@ namespace BuildXL.Processes
         private readonly IList<Task<AsyncProcessExecutor>> m_ptraceRunners;
         private readonly TaskSourceSlim<bool> m_ptraceRunnersCancellation = TaskSourceSlim.Create<bool>();
 
+        /// <summary>
+        /// Whether a single ptrace runner traces every process of this pip that requires ptrace (the runner is then asked
+        /// to trace further processes through its stdin). Not supported by the seccomp notification based tracer.
+        /// </summary>
+        private readonly bool m_reusePTraceRunner;
+        private AsyncProcessExecutor? m_persistentPTraceRunner;
+
         /// <summary>
         /// Id of the underlying pip.
         /// </summary>
@@ -118,6 +133,8 @@ namespace BuildXL.Processes
 
         /// <summary>
         /// Full path to "bxl-env" executable to use instead of '/usr/bin/env' (because some old versions of 'env' do not support the '-C' option).
+        /// "bxl-env" applies the working directory and the environment itself and then executes the program directly, so no 'env' process
+        /// (with its own initialization of the interposer) is started in between.
         /// </summary>
         internal static readonly string EnvExecutable = OperatingSystemHelper.IsLinuxOS ? EnsureDeploymentFile("bxl-env", setExecuteBit: true) : "/usr/bin/env";
 
@@ -188,9 +205,12 @@ namespace BuildXL.Processes
             RootJailInfo = info.RootJailInfo;
             m_loggingContext = info.LoggingContext;
             m_ptraceRunners = new List<Task<AsyncProcessExecutor>>();
+            m_reusePTraceRunner = info.FileAccessManifest.EnableLinuxPTraceSandbox && !info.FileAccessManifest.EnableLinuxSeccompNotifySandbox;
             m_pathCache = new Dictionary<string, PathCacheRecord>();
 
-            if (info.MonitoringConfig is not null && info.MonitoringConfig.MonitoringEnabled)
+            // The root process moves itself to the cgroup of the pip as soon as the sandbox initializes in it, so everything the pip spawns
+            // is accounted for by the cgroup and there is nothing to sample
+            if (info.MonitoringConfig is not null && info.MonitoringConfig.MonitoringEnabled && m_cgroupPath is null)
             {
                 m_processResourceUsage = new(capacity: 20);
 
@@ -265,6 +285,13 @@ namespace BuildXL.Processes
         /// <inheritdoc />
         protected override System.Diagnostics.Process CreateProcess(SandboxedProcessInfo info)
         {
+            // CODESYNC: Public/Src/Sandbox/Linux/bxl_observer.cpp (EnterPipCgroup)
+            // Cgroups are not reachable from inside a root jail, so those pips are still sampled
+            if (OperatingSystemHelper.IsLinuxOS && info.FileAccessManifest.EnableLinuxCgroupAccounting && info.RootJailInfo == null)
+            {
+                m_cgroupPath = Interop.Unix.Process.TryCreateCgroup($"bxl.{UniqueName}");
+            }
+
             var process = base.CreateProcess(info);
             process.StartInfo.RedirectStandardInput = true;
             if (info.RootJailInfo?.RootJail != null)
@@ -423,6 +450,7 @@ namespace BuildXL.Processes
 
         private string DetoursFile => Path.Combine(Path.GetDirectoryName(AssemblyHelper.GetThisProgramExeLocation()) ?? string.Empty, "libBuildXLDetours.dylib");
         private const string DetoursEnvVar = "DYLD_INSERT_LIBRARIES";
+        private const string CgroupPathEnvVar = "__BUILDXL_CGROUP_PATH"; // CODESYNC: Public/Src/Sandbox/Linux/common.h
 
         /// <inheritdoc />
         protected override IEnumerable<ReportedProcess>? GetSurvivingChildProcesses()
@@ -461,6 +489,23 @@ namespace BuildXL.Processes
             }
         }
 
+        /// <summary>
+        /// Replaces the manifest of this (running) pip, e.g., when the scopes a service pip may access change between work items, so the pip
+        /// doesn't have to be restarted. Only the accesses under <paramref name="changedScopes"/> are checked again (all of them when it is null).
+        /// Returns false if the sandbox can't do that, in which case the pip keeps its current manifest.
+        /// </summary>
+        /// <remarks>
+        /// Linux only, for pips started with <see cref="FileAccessManifest.EnableLinuxManifestUpdates"/>. The processes of the pip apply the
+        /// update before their next access check, so the caller should only hand the pip new work once this returns.
+        /// </remarks>
+        public bool TryUpdateFileAccessManifest(FileAccessManifest fam, IReadOnlyCollection<string>? changedScopes)
+        {
+            Contract.Requires(fam != null);
+            Contract.Requires(fam.PipId == PipId);
+
+            return Started && SandboxConnection.NotifyPipManifestUpdated(m_loggingContext, fam, this, changedScopes);
+        }
+
         /// <summary>
         /// Waits for all child processes to finish within a timeout limit and then terminates all still running children after that point.
         /// After all the children have been taken care of, the method waits for pending report processing to finish, then returns the
@@ -534,6 +579,12 @@ namespace BuildXL.Processes
             m_pathCache.Clear();
 
             base.Dispose();
+
+            // Best effort: this fails if some process of the pip is still alive
+            if (m_cgroupPath is not null && !Interop.Unix.Process.TryRemoveCgroup(m_cgroupPath))
+            {
+                LogDebug($"Could not remove cgroup '{m_cgroupPath}'");
+            }
         }
 
         /// <summary>
@@ -700,9 +751,23 @@ namespace BuildXL.Processes
                 .AdditionalEnvVarsToSet(info, UniqueName)
                 .Concat(info.SandboxConnection.Kind == SandboxKind.MacOsHybrid || info.SandboxConnection.Kind == SandboxKind.MacOsDetours
                     ? new (string, string?)[] { (DetoursEnvVar, DetoursFile) }
+                    : Array.Empty<(string, string?)>())
+                .Concat(m_cgroupPath is not null
+                    ? new (string, string?)[] { (CgroupPathEnvVar, m_cgroupPath) }
                     : Array.Empty<(string, string?)>());
         }
 
+        /// <summary>
+        /// Reads the usage of the pip from its cgroup, if it has one. A leaf the root process did not manage to move to has no CPU time accounted for.
+        /// </summary>
+        private bool TryGetCgroupResourceUsage(out Process.ProcessResourceUsage usage)
+        {
+            usage = default;
+            return m_cgroupPath is not null
+                && Interop.Unix.Process.GetCgroupResourceUsage(m_cgroupPath, ref usage) == 0
+                && usage.UserTimeMs + usage.SystemTimeMs > 0;
+        }
+
         internal override void FeedStdErr(SandboxedProcessOutputBuilder builder, string line)
         {
             FeedOutputBuilder(builder, line);
@@ -712,6 +777,11 @@ namespace BuildXL.Processes
         [return: NotNull]
         internal override CpuTimes GetCpuTimes()
         {
+            if (TryGetCgroupResourceUsage(out var cgroupUsage))
+            {
+                return new CpuTimes(user: TimeSpan.FromMilliseconds(cgroupUsage.UserTimeMs), system: TimeSpan.FromMilliseconds(cgroupUsage.SystemTimeMs));
+            }
+
             if (m_processResourceUsage is null)
             {
                 return base.GetCpuTimes();
@@ -728,6 +798,25 @@ namespace BuildXL.Processes
         // <inheritdoc />
         internal override JobObject.AccountingInformation GetJobAccountingInfo()
         {
+            if (TryGetCgroupResourceUsage(out var cgroupUsage))
+            {
+                return new JobObject.AccountingInformation
+                {
+                    IO = new IOCounters(new IO_COUNTERS()
+                    {
+                        ReadOperationCount = cgroupUsage.DiskReadOps,
+                        ReadTransferCount = cgroupUsage.DiskBytesRead,
+                        WriteOperationCount = cgroupUsage.DiskWriteOps,
+                        WriteTransferCount = cgroupUsage.DiskBytesWritten,
+                    }),
+                    MemoryCounters = ProcessMemoryCounters.CreateFromBytes(cgroupUsage.PeakWorkingSetSize, cgroupUsage.WorkingSetSize, 0, 0),
+                    KernelTime = TimeSpan.FromMilliseconds(cgroupUsage.SystemTimeMs),
+                    UserTime = TimeSpan.FromMilliseconds(cgroupUsage.UserTimeMs),
+                    // The reports are frozen by the time the pip completes. Exclude the root process from the child count.
+                    NumberOfProcesses = m_reports.Processes.Count > 0 ? (uint)(m_reports.Processes.Count - 1) : 0,
+                };
+            }
+
             if (m_processResourceUsage is null)
             {
                 return base.GetJobAccountingInfo();
@@ -895,18 +984,7 @@ namespace BuildXL.Processes
 
                 if (m_reports.GetMessageCountSemaphore() != null && ShouldCountReportType(report.Operation))
                 {
-                    try
-                    {
-                        m_reports.GetMessageCountSemaphore().WaitOne(0);
-                    }
-                    catch (Exception e)
-                    {
-                        // Semaphore was zero.
-                        // We should not have to wait to be unblocked because the native side should have incremented
-                        // the semaphore as soon as it sent a message.
-                        // For now we don't consider this a failure, but in the future this should become a failure
-                        LogDebug($"[Pip{PipId}] Message counting semaphore mismatch for pid '{report.Pid}' with reported path '{reportPath}' with exception {e}");
-                    }
+                    m_reports.CountReceivedMessage();
                 }
 
                 // ignore accesses to libDetours.so, because we injected that library
@@ -1161,8 +1239,13 @@ namespace BuildXL.Processes
 
         private void StartPTraceRunner(int pid, string path, bool forceAddExecutionPermission)
         {
+            if (m_persistentPTraceRunner != null && TryRequestPTrace(m_persistentPTraceRunner, pid, path))
+            {
+                return;
+            }
+
             var paths = SandboxConnectionLinuxDetours.GetPaths(RootJailInfo, UniqueName);
-            var args = $"-c {pid} -x {path}";
+            var args = $"-c {pid} -x {path}" + (m_reusePTraceRunner ? " -p" : string.Empty);
             var process = new System.Diagnostics.Process
             {
                 StartInfo = new System.Diagnostics.ProcessStartInfo(PTraceRunnerExecutable.Value, args)
@@ -1171,6 +1254,7 @@ namespace BuildXL.Processes
                     UseShellExecute = false,
                     RedirectStandardError = true,
                     RedirectStandardOutput = true,
+                    RedirectStandardInput = m_reusePTraceRunner,
                     WorkingDirectory = Path.GetDirectoryName(PTraceRunnerExecutable.Value)
                 },
                 EnableRaisingEvents = true
@@ -1193,6 +1277,11 @@ namespace BuildXL.Processes
             ptraceRunner.Start();
             m_ptraceRunners.Add(runnerTask(ptraceRunner));
 
+            if (m_reusePTraceRunner)
+            {
+                m_persistentPTraceRunner = ptraceRunner;
+            }
+
             async Task<AsyncProcessExecutor> runnerTask(AsyncProcessExecutor runner) 
             {
                 var runnersCancellation = m_ptraceRunnersCancellation.Task;
@@ -1222,8 +1311,33 @@ namespace BuildXL.Processes
             }
         }
 
+        /// <summary>
+        /// Asks a runner started with '-p' to trace the given process as well. Returns false if the runner can't take the request anymore.
+        /// </summary>
+        private bool TryRequestPTrace(AsyncProcessExecutor runner, int pid, string path)
+        {
+            try
+            {
+                if (runner.Process.HasExited)
+                {
+                    return false;
+                }
+
+                // CODESYNC: PTraceSandbox.cpp (WaitForTraceeOrRequests)
+                runner.Process.StandardInput.Write($"{pid} {path}\n");
+                runner.Process.StandardInput.Flush();
+                return true;
+            }
+            catch (Exception e) when (e is IOException || e is InvalidOperationException)
+            {
+                LogDebug($"Could not request ptrace runner {runner.Process.Id} to trace process {pid}: {e.Message}");
+                return false;
+            }
+        }
+
         private void KillActivePTraceRunners()
         {
+            m_persistentPTraceRunner = null;
             var ptraceRunners = m_ptraceRunners.ToArray();
             m_ptraceRunners.Clear();
 
@@ -41,7 +41,9 @@ namespace BuildXL.Processes
         /// </summary>
         /// <remarks>
         /// This DLL must implement a <code>CommandMatches</code> method; see <code>SubstituteProcessExecutionPluginFunc</code>
-        /// in Public\Src\Sandbox\Windows\DetoursServices\globals.h.
+        /// in Public\Src\Sandbox\Windows\DetoursServices\globals.h. It can implement <code>CommandMatchesCacheable</code> instead
+        /// (see <code>SubstituteProcessExecutionCacheablePluginFunc</code>) to let the decisions it makes be cached. It can implement <code>CommandMatchesCacheable</code> instead
+        /// (see <code>SubstituteProcessExecutionCacheablePluginFunc</code>) to let the decisions it makes be cached.
         /// </remarks>
         public AbsolutePath SubstituteProcessExecutionPluginDll32Path { get; set; }
 
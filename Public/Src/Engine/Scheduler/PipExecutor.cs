@@ -1678,6 +1678,11 @@ namespace BuildXL.Scheduler
                     {
                         Logger.Log.ScheduleProcessNotStoredToCacheDueToInherentUncacheability(operationContext, processDescription);
                     }
+                    else if (configuration.Sandbox.EnableLinuxSampledObservation)
+                    {
+                        // Only a sample of the reads was observed, so the observed inputs can't be trusted for a cache entry
+                        Logger.Log.ScheduleProcessNotStoredToCacheDueToInherentUncacheability(operationContext, processDescription);
+                    }
                     else
                     {
                         Contract.Assume(
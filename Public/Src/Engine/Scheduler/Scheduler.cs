@@ -2945,6 +2945,39 @@ namespace BuildXL.Scheduler
             return 0;
         }
 
+        /// <summary>
+        /// Reacts to a memory pressure transition pushed by the OS right away, instead of waiting for the next status update to sample it:
+        /// the kext throttler (when <paramref name="throttlingConnection"/> is given) gets the current available RAM, and the resource
+        /// availability of the local worker is re-evaluated.
+        /// </summary>
+        private void OnMemoryPressureChanged(Memory.PressureLevel level, ISandboxConnection throttlingConnection)
+        {
+            // Called on a thread of the OS which must not be blocked
+            Task.Run(() =>
+            {
+                if (throttlingConnection != null)
+                {
+                    var ramUsage = new Memory.RamUsageInfo();
+                    double cpuUsage = m_performanceAggregator.MachineCpu.Latest;
+                    if (Memory.GetRamUsageInfo(ref ramUsage) == Dispatch.MACOS_INTEROP_SUCCESS && !double.IsNaN(cpuUsage) && !double.IsInfinity(cpuUsage))
+                    {
+                        throttlingConnection.NotifyUsage(Convert.ToUInt32(Math.Round(cpuUsage * 100)), (uint)(ramUsage.FreeBytes / (1024 * 1024)));
+                    }
+                }
+
+                // Resource availability is only managed once the scheduler has started
+                lock (m_statusLock)
+                {
+                    if (m_isDisposed || m_executePhaseLoggingContext == null)
+                    {
+                        return;
+                    }
+                }
+
+                UpdateStatus();
+            });
+        }
+
         private void UpdateResourceAvailability(PerformanceCollector.MachinePerfInfo perfInfo)
         {
             var resourceManager = State.ResourceManager;
@@ -6333,6 +6366,14 @@ namespace BuildXL.Scheduler
                                 sandboxConnection.NotifyUsage(cpuUsageBasisPoints, availableRamMB);
                             };
                         }
+
+                        if (OperatingSystemHelper.IsMacOS)
+                        {
+                            var throttlingConnection = m_performanceAggregator != null && config.KextConfig.Value.ResourceThresholds.IsProcessThrottlingEnabled()
+                                ? sandboxConnection
+                                : null;
+                            Memory.StartMemoryPressureNotifications(level => OnMemoryPressureChanged(level, throttlingConnection));
+                        }
                     }
 
                     SandboxConnection = sandboxConnection;
@@ -8188,6 +8229,7 @@ namespace BuildXL.Scheduler
 
             m_cancellationTokenRegistration.Dispose();
 
+            Memory.StopMemoryPressureNotifications();
             ExecutionLog?.Dispose();
             SandboxConnection?.Dispose();
             RemoteProcessManager?.Dispose();
@@ -83,6 +83,7 @@ namespace Test.BuildXL.Processes.Detours
                 PipSemiStableHash = 0x12345678,
                 PipDescription = nameof(SerializeSandboxedProcessInfo),
                 TimeoutDumpDirectory = A("C", "Timeout"),
+                PTraceClassificationDirectory = A("C", "PTraceClassifications"),
                 SandboxKind = SandboxKind.Default,
                 AllowedSurvivingChildProcessNames = new[] { "conhost.exe", "mspdbsrv.exe" },
                 NestedProcessTerminationTimeout = SandboxedProcessInfo.DefaultNestedProcessTerminationTimeout,
@@ -127,6 +128,7 @@ namespace Test.BuildXL.Processes.Detours
                 XAssert.AreEqual(info.PipSemiStableHash, readInfo.PipSemiStableHash);
                 XAssert.AreEqual(info.PipDescription, readInfo.PipDescription);
                 XAssert.AreEqual(info.TimeoutDumpDirectory, readInfo.TimeoutDumpDirectory);
+                XAssert.AreEqual(info.PTraceClassificationDirectory, readInfo.PTraceClassificationDirectory);
                 XAssert.AreEqual(info.SandboxKind, readInfo.SandboxKind);
 
                 XAssert.AreEqual(info.AllowedSurvivingChildProcessNames.Length, readInfo.AllowedSurvivingChildProcessNames.Length);
@@ -137,6 +137,7 @@ namespace Test.BuildXL.Processes.Detours
             }
 
             byte[] manifestTreeBytes = fam.GetManifestTreeBytes();
+            byte[] indexedManifestTreeBytes = fam.GetIndexedManifestTreeBytes();
 
             foreach (ValidationData dataItem in validationData)
             {
@@ -181,6 +182,23 @@ namespace Test.BuildXL.Processes.Detours
                     dataItem.ExpectedUsn,
                     expectedUsn,
                     "Usn for '{0}' did not match", dataItem.Path);
+
+                // The record index must lead to the same record as the tree walk
+                success =
+                    global::BuildXL.Native.Processes.Windows.ProcessUtilitiesWin.FindFileAccessPolicyInIndexedTree(
+                        indexedManifestTreeBytes,
+                        dataItem.Path,
+                        new UIntPtr((uint)dataItem.Path.Length),
+                        out uint indexedConePolicy,
+                        out uint indexedNodePolicy,
+                        out uint indexedPathId,
+                        out Usn indexedExpectedUsn);
+
+                XAssert.IsTrue(success, "Unable to find path in indexed manifest");
+                XAssert.AreEqual(pathId, indexedPathId, "Indexed PathId for '{0}' did not match", dataItem.Path);
+                XAssert.AreEqual(nodePolicy, indexedNodePolicy, "Indexed policy for '{0}' did not match", dataItem.Path);
+                XAssert.AreEqual(conePolicy, indexedConePolicy, "Indexed policy for '{0}' did not match", dataItem.Path);
+                XAssert.AreEqual(expectedUsn, indexedExpectedUsn, "Indexed Usn for '{0}' did not match", dataItem.Path);
             }
         }
 
@@ -0,0 +1,259 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+#include "LoadGenerator.h"
+
+#include <chrono>
+#include <thread>
+
+// warning C26493: Don't use C-style casts (type.4).
+// warning C26446: Prefer to use gsl::at() instead of unchecked subscript operator (bounds.4).
+// warning C26481: Don't use pointer arithmetic. Use span instead (bounds.1).
+#pragma warning( disable : 4711 26493 26446 26481 )
+
+enum class LoadOperation { Open, Stat, Enumerate, Write, Rename, Spawn };
+
+// Files every thread cycles through
+constexpr int FilesPerThread = 16;
+constexpr DWORD WriteSize = 4096;
+
+static bool ParseMix(std::wstring const& mix, std::vector<LoadOperation>& schedule) {
+    static const std::pair<wchar_t const*, LoadOperation> names[] = {
+        { L"open", LoadOperation::Open },
+        { L"stat", LoadOperation::Stat },
+        { L"enumerate", LoadOperation::Enumerate },
+        { L"write", LoadOperation::Write },
+        { L"rename", LoadOperation::Rename },
+        { L"spawn", LoadOperation::Spawn },
+    };
+
+    size_t start = 0;
+    while (start < mix.length()) {
+        const size_t end = mix.find(L';', start);
+        const std::wstring entry = mix.substr(start, end == std::wstring::npos ? std::wstring::npos : end - start);
+        start = end == std::wstring::npos ? mix.length() : end + 1;
+
+        const size_t colon = entry.find(L':');
+        if (colon == std::wstring::npos) {
+            return false;
+        }
+
+        const std::wstring name = entry.substr(0, colon);
+        const int weight = _wtoi(entry.c_str() + colon + 1);
+
+        bool found = false;
+        for (auto const& known : names) {
+            if (name == known.first) {
+                schedule.insert(schedule.end(), weight, known.second);
+                found = true;
+            }
+        }
+
+        if (!found) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static std::wstring FilePath(std::wstring const& directory, int thread, long index) {
+    return directory + L"\\lg_" + std::to_wstring(GetCurrentProcessId()) + L"_" + std::to_wstring(thread) + L"_" + std::to_wstring(index);
+}
+
+// Starts this program with 'command' sent over its stdin (and its stdout discarded), returning its handle.
+static HANDLE SpawnSelf(std::wstring const& command) {
+    wchar_t exe[MAX_PATH]{};
+    if (GetModuleFileNameW(NULL, exe, MAX_PATH) == 0) {
+        return NULL;
+    }
+
+    SECURITY_ATTRIBUTES inheritable{ sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE };
+    HANDLE readPipe = NULL;
+    HANDLE writePipe = NULL;
+    if (!CreatePipe(&readPipe, &writePipe, &inheritable, 0)) {
+        return NULL;
+    }
+
+    SetHandleInformation(writePipe, HANDLE_FLAG_INHERIT, 0);
+    const HANDLE nul = CreateFileW(L"NUL", GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, &inheritable, OPEN_EXISTING, 0, NULL);
+
+    STARTUPINFOW startupInfo{};
+    startupInfo.cb = sizeof(startupInfo);
+    startupInfo.dwFlags = STARTF_USESTDHANDLES;
+    startupInfo.hStdInput = readPipe;
+    startupInfo.hStdOutput = nul;
+    startupInfo.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+
+    PROCESS_INFORMATION processInfo{};
+    std::wstring commandLine = L"\"" + std::wstring(exe) + L"\"";
+    const BOOL created = CreateProcessW(exe, &commandLine[0], nullptr, nullptr, TRUE, 0, nullptr, nullptr, &startupInfo, &processInfo);
+
+    CloseHandle(readPipe);
+    if (nul != INVALID_HANDLE_VALUE) {
+        CloseHandle(nul);
+    }
+
+    if (!created) {
+        CloseHandle(writePipe);
+        return NULL;
+    }
+
+    if (!command.empty()) {
+        const std::string line(command.begin(), command.end());
+        DWORD written = 0;
+        WriteFile(writePipe, (line + "\n").c_str(), (DWORD)line.length() + 1, &written, nullptr);
+    }
+
+    CloseHandle(writePipe);
+    CloseHandle(processInfo.hThread);
+    return processInfo.hProcess;
+}
+
+static bool WaitForChild(HANDLE process) {
+    if (process == NULL) {
+        return false;
+    }
+
+    DWORD exitCode = 1;
+    const bool exited = WaitForSingleObject(process, INFINITE) == WAIT_OBJECT_0 && GetExitCodeProcess(process, &exitCode);
+    CloseHandle(process);
+    return exited && exitCode == 0;
+}
+
+static bool RunOperation(LoadOperation operation, std::wstring const& directory, int thread, long i) {
+    const std::wstring path = FilePath(directory, thread, i % FilesPerThread);
+    switch (operation) {
+    case LoadOperation::Open: {
+        const HANDLE handle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        return handle != INVALID_HANDLE_VALUE && CloseHandle(handle);
+    }
+    case LoadOperation::Stat: {
+        WIN32_FILE_ATTRIBUTE_DATA data{};
+        return GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &data) == TRUE;
+    }
+    case LoadOperation::Enumerate: {
+        WIN32_FIND_DATAW findData{};
+        const HANDLE findHandle = FindFirstFileExW((directory + L"\\*").c_str(), FindExInfoBasic, &findData, FindExSearchNameMatch, NULL, 0);
+        if (findHandle == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+
+        while (FindNextFileW(findHandle, &findData)) {}
+        return FindClose(findHandle) == TRUE;
+    }
+    case LoadOperation::Write: {
+        static const char buffer[WriteSize]{};
+        const HANDLE handle = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, TRUNCATE_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (handle == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+
+        DWORD written = 0;
+        const bool success = WriteFile(handle, buffer, WriteSize, &written, nullptr) && written == WriteSize;
+        return CloseHandle(handle) && success;
+    }
+    case LoadOperation::Rename: {
+        const std::wstring renamed = path + L".renamed";
+        return MoveFileW(path.c_str(), renamed.c_str()) && MoveFileW(renamed.c_str(), path.c_str());
+    }
+    case LoadOperation::Spawn:
+        // with nothing sent over its stdin, the spawned process exits right away
+        return WaitForChild(SpawnSelf(L""));
+    }
+
+    return false;
+}
+
+static bool RunThread(std::vector<LoadOperation> const& schedule, std::wstring const& directory, int thread, long ops) {
+    bool success = true;
+    for (int i = 0; i < FilesPerThread; i++) {
+        const HANDLE handle = CreateFileW(FilePath(directory, thread, i).c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        success &= handle != INVALID_HANDLE_VALUE && CloseHandle(handle);
+    }
+
+    for (long i = 0; i < ops; i++) {
+        success &= RunOperation(schedule[i % schedule.size()], directory, thread, i);
+    }
+
+    for (int i = 0; i < FilesPerThread; i++) {
+        DeleteFileW(FilePath(directory, thread, i).c_str());
+    }
+
+    return success;
+}
+
+static bool RunLoad(
+    std::wstring const& directory,
+    std::wstring const& threadsParameter,
+    std::wstring const& childrenParameter,
+    std::wstring const& opsPerThreadParameter,
+    std::wstring const& mix,
+    bool report)
+{
+    const int threads = _wtoi(threadsParameter.c_str());
+    const int children = _wtoi(childrenParameter.c_str());
+    const long opsPerThread = _wtol(opsPerThreadParameter.c_str());
+
+    std::vector<LoadOperation> schedule;
+    if (!ParseMix(mix, schedule) || (schedule.empty() && threads > 0 && opsPerThread > 0)) {
+        std::wcerr << L"Invalid operation mix '" << mix << L"'" << std::endl;
+        return false;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<HANDLE> childProcesses;
+    for (int i = 0; i < children; i++) {
+        childProcesses.push_back(SpawnSelf(
+            L"GenerateLoadChild," + directory + L"," + threadsParameter + L",0," + opsPerThreadParameter + L"," + mix));
+    }
+
+    std::vector<std::thread> workers;
+    std::vector<char> succeeded(threads, 0);
+    for (int i = 0; i < threads; i++) {
+        workers.emplace_back([&, i]() { succeeded[i] = RunThread(schedule, directory, i, opsPerThread); });
+    }
+
+    bool success = true;
+    for (int i = 0; i < threads; i++) {
+        workers[i].join();
+        success &= succeeded[i] != 0;
+    }
+
+    for (const HANDLE process : childProcesses) {
+        success &= WaitForChild(process);
+    }
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    // children only do their share of the work: the parent reports for all of them
+    if (report) {
+        const long long totalOps = (children + 1LL) * threads * opsPerThread;
+        std::wcerr << L"GenerateLoad: " << totalOps << L" ops in " << elapsed.count() << L"s ("
+                   << (long long)(totalOps / elapsed.count()) << L" ops/sec)" << std::endl;
+    }
+
+    return success;
+}
+
+bool GenerateLoad(
+    std::wstring const& directory,
+    std::wstring const& threads,
+    std::wstring const& children,
+    std::wstring const& opsPerThread,
+    std::wstring const& mix)
+{
+    return RunLoad(directory, threads, children, opsPerThread, mix, /* report */ true);
+}
+
+bool GenerateLoadChild(
+    std::wstring const& directory,
+    std::wstring const& threads,
+    std::wstring const& children,
+    std::wstring const& opsPerThread,
+    std::wstring const& mix)
+{
+    return RunLoad(directory, threads, children, opsPerThread, mix, /* report */ false);
+}
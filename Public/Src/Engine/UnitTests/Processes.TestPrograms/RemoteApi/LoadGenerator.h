@@ -0,0 +1,30 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Generates file system load for benchmarking the sandbox end-to-end (see GenerateLoad in Main.cpp).
+//
+// Every one of the <children> + 1 processes (the children run GenerateLoadChild, without children of their own) runs
+// <threads> threads, each issuing <opsPerThread> operations on files of its own under <directory>.
+//
+// <mix> gives the weight of every kind of operation as semicolon separated name:weight pairs, with names among
+// open, stat, enumerate, write, rename and spawn (e.g. "open:4;stat:4;enumerate:1;write:2;rename:1;spawn:1").
+// Operations are issued in a fixed round-robin order honoring the weights, so runs are reproducible.
+//
+// GenerateLoad prints the number of operations issued by all the processes and the achieved number of operations
+// per second to stderr (stdout carries the command protocol).
+
+#pragma once
+
+bool GenerateLoad(
+    std::wstring const& directory,
+    std::wstring const& threads,
+    std::wstring const& children,
+    std::wstring const& opsPerThread,
+    std::wstring const& mix);
+
+bool GenerateLoadChild(
+    std::wstring const& directory,
+    std::wstring const& threads,
+    std::wstring const& children,
+    std::wstring const& opsPerThread,
+    std::wstring const& mix);
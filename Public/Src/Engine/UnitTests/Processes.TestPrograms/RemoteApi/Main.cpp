@@ -22,10 +22,14 @@
 //  EnumerateFileOrDirectoryByHandle: Takes a path parameter to open (e.g. C:\directory\) and enumerates members via NtQueryDirectoryFile.
 //                             Returns 0 on success or 1 on failure (note that success is returned if enumeration proceeded, even if no matches were found or if
 //                             the search path turned out to be a file rather than a directory).
+//  GenerateLoad: Takes a directory, a number of threads, a number of child processes, a number of operations per thread and an
+//                operation mix, and issues that load against the directory to benchmark the sandbox (see LoadGenerator.h).
+//                Returns 0 if every operation succeeded or 1 otherwise; the achieved ops/sec are printed to stderr.
 // TODO: These functions should be exposed as a Bond service. For now, we're starting with a trivial text format.
 
 #include "stdafx.h"
 #include "Command.h"
+#include "LoadGenerator.h"
 
 // warning C6387: 'buffer' could be '0'.
 // warning C26493: Don't use C-style casts (type.4).
@@ -149,6 +153,8 @@ static CommandBase const* Commands[] = {
     new Command<SingleParam>(L"EnumerateFileOrDirectoryByHandle", EnumerateFileOrDirectoryByHandle),
     new Command<SingleParam>(L"DeleteViaNtCreateFile", DeleteViaNtCreateFile),
     new Command<DualParam>(L"CreateHardLink", CreateHardLink),
+    new Command<QuintupleParam>(L"GenerateLoad", GenerateLoad),
+    new Command<QuintupleParam>(L"GenerateLoadChild", GenerateLoadChild),
     nullptr
 };
 
@@ -208,7 +214,7 @@ int main(int argc, char **argv)
         for (CommandBase const** c = Commands; ; c++) {
             CommandBase const* cmd = *c;
             if (cmd == nullptr) {
-                std::wcerr << L"Unknown command name. Supported: [EnumerateWithFindFirstFileEx, DeleteViaNtCreateFile, CreateHardLink]. Actual: '" << commandName << "'" << std::endl;
+                std::wcerr << L"Unknown command name. Supported: [EnumerateWithFindFirstFileEx, DeleteViaNtCreateFile, CreateHardLink, GenerateLoad]. Actual: '" << commandName << "'" << std::endl;
                 return 3;
             } 
 
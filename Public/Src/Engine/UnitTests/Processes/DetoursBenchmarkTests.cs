@@ -0,0 +1,163 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+using System.Collections.Generic;
+using System.Diagnostics.ContractsLight;
+using System.Globalization;
+using System.IO;
+using System.Linq;
+using System.Reflection;
+using System.Text.RegularExpressions;
+using System.Threading.Tasks;
+using BuildXL.Processes;
+using BuildXL.Utilities.Core;
+using Test.BuildXL.TestUtilities.Xunit;
+using Xunit;
+using Xunit.Abstractions;
+
+#nullable enable
+
+namespace Test.BuildXL.Processes
+{
+    /// <summary>
+    /// Runs the Detours microbenchmarks of <c>DetoursTests.exe</c> (see Benchmark.cpp) without and with the sandbox.
+    /// </summary>
+    [TestClassIfSupported(requiresWindowsBasedOperatingSystem: true)]
+    public sealed class DetoursBenchmarkTests : TemporaryStorageTestBase, ISandboxedProcessFileStorage
+    {
+        private static readonly string s_detoursTestsExecutablePath = Path.Combine(
+            Path.GetDirectoryName(AssemblyHelper.GetAssemblyLocation(Assembly.GetExecutingAssembly()))!,
+            "DetoursCrossBitTests",
+            "x64",
+            "DetoursTests.exe");
+
+        private ITestOutputHelper TestOutput { get; }
+
+        public DetoursBenchmarkTests(ITestOutputHelper output) : base(output)
+        {
+            TestOutput = output;
+        }
+
+        /// <summary>
+        /// Writes the cost of each benchmark in both modes to the test output, one JSON object per line (so regressions can be
+        /// tracked across drops of DetoursServices).
+        /// </summary>
+        [Fact]
+        [Trait("Category", "Performance")]
+        public async Task RunDetoursBenchmark()
+        {
+            XAssert.IsTrue(File.Exists(s_detoursTestsExecutablePath), "Expected to find DetoursTests.exe at " + s_detoursTestsExecutablePath);
+
+            var baseline = ParseBenchmarkResults(RunWithoutSandbox(CreateWorkingDirectory("baseline"), "Benchmark"));
+            var sandboxed = ParseBenchmarkResults(await RunInSandboxAsync(CreateWorkingDirectory("sandboxed"), "Benchmark"));
+
+            XAssert.AreNotEqual(0, baseline.Count, "The benchmark did not produce any result");
+            XAssert.SetEqual(baseline.Keys, sandboxed.Keys);
+
+            foreach (var benchmark in baseline.Keys)
+            {
+                var baselineNs = baseline[benchmark];
+                var sandboxedNs = sandboxed[benchmark];
+                TestOutput.WriteLine(string.Format(
+                    CultureInfo.InvariantCulture,
+                    "{{\"benchmark\":\"{0}\",\"baselineNsPerOp\":{1:F1},\"sandboxedNsPerOp\":{2:F1},\"overheadNsPerOp\":{3:F1},\"ratio\":{4:F2}}}",
+                    benchmark,
+                    baselineNs,
+                    sandboxedNs,
+                    sandboxedNs - baselineNs,
+                    baselineNs > 0 ? sandboxedNs / baselineNs : 0));
+            }
+        }
+
+        /// <summary>
+        /// Runs the report scaling benchmark (1 up to 64 processes reporting at once, see BenchmarkReportScaling) without and with
+        /// the sandbox, and writes every round of both runs to the test output, one JSON object per line tagged with its mode.
+        /// </summary>
+        [Fact]
+        [Trait("Category", "Performance")]
+        public async Task RunReportScalingBenchmark()
+        {
+            XAssert.IsTrue(File.Exists(s_detoursTestsExecutablePath), "Expected to find DetoursTests.exe at " + s_detoursTestsExecutablePath);
+
+            var baseline = RunWithoutSandbox(CreateWorkingDirectory("scalingBaseline"), "BenchmarkReportScaling");
+            var sandboxed = await RunInSandboxAsync(CreateWorkingDirectory("scalingSandboxed"), "BenchmarkReportScaling");
+
+            XAssert.IsTrue(sandboxed.Contains("report_scaling_saturation"), "The benchmark did not complete: " + sandboxed);
+
+            foreach (var (mode, output) in new[] { ("baseline", baseline), ("sandboxed", sandboxed) })
+            {
+                foreach (var line in output.Split('\n').Where(line => line.StartsWith("{", System.StringComparison.Ordinal)))
+                {
+                    TestOutput.WriteLine("{\"mode\":\"" + mode + "\"," + line.Substring(1).TrimEnd('\r'));
+                }
+            }
+        }
+
+        private static Dictionary<string, double> ParseBenchmarkResults(string output)
+        {
+            // Lines look like {"benchmark":"create_file","iterations":20000,"nsPerOp":2412.7,"minNsPerOp":2398.2}
+            var regex = new Regex("\"benchmark\":\"(?<name>[^\"]+)\".*\"nsPerOp\":(?<ns>[0-9.]+)");
+            return output
+                .Split('\n')
+                .Select(line => regex.Match(line))
+                .Where(match => match.Success)
+                .ToDictionary(match => match.Groups["name"].Value, match => double.Parse(match.Groups["ns"].Value, CultureInfo.InvariantCulture));
+        }
+
+        private string CreateWorkingDirectory(string name)
+        {
+            string workingDirectory = GetFullPath(name);
+            Directory.CreateDirectory(workingDirectory);
+            return workingDirectory;
+        }
+
+        private static string RunWithoutSandbox(string workingDirectory, string verb)
+        {
+            var startInfo = new System.Diagnostics.ProcessStartInfo(s_detoursTestsExecutablePath, verb)
+            {
+                WorkingDirectory = workingDirectory,
+                RedirectStandardOutput = true,
+                UseShellExecute = false,
+            };
+
+            using var process = System.Diagnostics.Process.Start(startInfo)!;
+            var output = process.StandardOutput.ReadToEnd();
+            process.WaitForExit();
+            XAssert.AreEqual(0, process.ExitCode);
+
+            return output;
+        }
+
+        private async Task<string> RunInSandboxAsync(string workingDirectory, string verb)
+        {
+            var pathTable = new PathTable();
+            var info = new SandboxedProcessInfo(pathTable, this, s_detoursTestsExecutablePath, disableConHostSharing: false, loggingContext: LoggingContext)
+            {
+                PipSemiStableHash = 0,
+                PipDescription = "DetoursTests " + verb,
+                Arguments = verb,
+                WorkingDirectory = workingDirectory,
+            };
+
+            info.FileAccessManifest.ReportFileAccesses = false;
+            info.FileAccessManifest.ReportUnexpectedFileAccesses = true;
+            info.FileAccessManifest.FailUnexpectedFileAccesses = false;
+
+            // Everything is allowed, and the accesses to the fixture are reported, as the ones to the outputs of a pip would be
+            info.FileAccessManifest.AddScope(AbsolutePath.Invalid, FileAccessPolicy.MaskNothing, FileAccessPolicy.AllowAll);
+            info.FileAccessManifest.AddScope(AbsolutePath.Create(pathTable, workingDirectory), FileAccessPolicy.MaskNothing, FileAccessPolicy.AllowAll | FileAccessPolicy.ReportAccess);
+
+            using SandboxedProcess process = await SandboxedProcess.StartAsync(info);
+            SandboxedProcessResult result = await process.GetResultAsync();
+            XAssert.AreEqual(0, result.ExitCode, "DetoursTests.exe " + verb + " failed: " + await result.StandardError!.ReadValueAsync());
+
+            return await result.StandardOutput!.ReadValueAsync();
+        }
+
+        string ISandboxedProcessFileStorage.GetFileName(SandboxedProcessFile file)
+        {
+            Contract.Assume(!string.IsNullOrEmpty(TemporaryDirectory), "TemporaryDirectory should have been set up (GetFileName called too early)");
+            return GetFullPath(file.ToString("G"));
+        }
+    }
+}
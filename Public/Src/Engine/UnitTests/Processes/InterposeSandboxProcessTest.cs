@@ -2,8 +2,10 @@
 // Licensed under the MIT License.
 
 using System.Collections.Generic;
+using System.Globalization;
 using System.IO;
 using System.Linq;
+using System.Text.RegularExpressions;
 using BuildXL.Pips;
 using BuildXL.Pips.Operations;
 using BuildXL.Processes;
@@ -100,6 +102,97 @@ namespace Test.BuildXL.Processes
             RunTest("observer_utilities_test");
         }
 
+        /// <summary>
+        /// Runs the interposer microbenchmarks without and with the sandbox, and writes the cost of each benchmark in both modes
+        /// to the test output, one JSON object per line (so regressions can be tracked across drops).
+        /// </summary>
+        [Fact]
+        [Trait("Category", "Performance")]
+        public void RunInterposerBenchmark()
+        {
+            const string BenchmarkExeName = "interposer_benchmark";
+
+            var baselineOutput = RunWithoutSandbox(BenchmarkExeName);
+            var baseline = ParseBenchmarkResults(baselineOutput, "nsPerOp");
+            var baselineAllocations = ParseBenchmarkResults(baselineOutput, "allocsPerOp");
+            var sandboxedResult = RunTest(BenchmarkExeName);
+            var sandboxedOutput = sandboxedResult.StandardOutput!.ReadValueAsync().Result;
+            var sandboxed = ParseBenchmarkResults(sandboxedOutput, "nsPerOp");
+            var sandboxedAllocations = ParseBenchmarkResults(sandboxedOutput, "allocsPerOp");
+
+            XAssert.AreNotEqual(0, baseline.Count, "The benchmark did not produce any result");
+            XAssert.SetEqual(baseline.Keys, sandboxed.Keys);
+
+            foreach (var benchmark in baseline.Keys)
+            {
+                var baselineNs = baseline[benchmark];
+                var sandboxedNs = sandboxed[benchmark];
+                TestOutput.WriteLine(string.Format(
+                    CultureInfo.InvariantCulture,
+                    "{{\"benchmark\":\"{0}\",\"baselineNsPerOp\":{1:F1},\"sandboxedNsPerOp\":{2:F1},\"overheadNsPerOp\":{3:F1},\"ratio\":{4:F2},\"overheadAllocsPerOp\":{5:F2}}}",
+                    benchmark,
+                    baselineNs,
+                    sandboxedNs,
+                    sandboxedNs - baselineNs,
+                    baselineNs > 0 ? sandboxedNs / baselineNs : 0,
+                    sandboxedAllocations.GetValueOrDefault(benchmark) - baselineAllocations.GetValueOrDefault(benchmark)));
+            }
+        }
+
+        /// <summary>
+        /// Runs the report scaling benchmark (1 up to 64 processes reporting at once) without and with the sandbox, and writes every
+        /// round of both runs to the test output, one JSON object per line tagged with its mode.
+        /// </summary>
+        [Fact]
+        [Trait("Category", "Performance")]
+        public void RunReportScalingBenchmark()
+        {
+            const string BenchmarkExeName = "report_scaling_benchmark";
+
+            var baseline = RunWithoutSandbox(BenchmarkExeName);
+            var sandboxedResult = RunTest(BenchmarkExeName);
+            var sandboxed = sandboxedResult.StandardOutput!.ReadValueAsync().Result;
+
+            XAssert.IsTrue(sandboxed.Contains("report_scaling_saturation"), "The benchmark did not complete: " + sandboxed);
+
+            foreach (var (mode, output) in new[] { ("baseline", baseline), ("sandboxed", sandboxed) })
+            {
+                foreach (var line in output.Split('\n').Where(line => line.StartsWith("{", System.StringComparison.Ordinal)))
+                {
+                    TestOutput.WriteLine("{\"mode\":\"" + mode + "\"," + line.Substring(1));
+                }
+            }
+        }
+
+        private static Dictionary<string, double> ParseBenchmarkResults(string output, string field)
+        {
+            // Lines look like {"benchmark":"stat","iterations":20000,"nsPerOp":412.7,"minNsPerOp":398.2,"allocsPerOp":0.00}
+            var regex = new Regex($"\"benchmark\":\"(?<name>[^\"]+)\".*\"{field}\":(?<value>[0-9.]+)");
+            return output
+                .Split('\n')
+                .Select(line => regex.Match(line))
+                .Where(match => match.Success)
+                .ToDictionary(match => match.Groups["name"].Value, match => double.Parse(match.Groups["value"].Value, CultureInfo.InvariantCulture));
+        }
+
+        private string RunWithoutSandbox(string testExeName)
+        {
+            using var workingDirectoryStorage = new TempFileStorage(canGetFileNames: true);
+            var startInfo = new System.Diagnostics.ProcessStartInfo(Path.Combine(TestBinRoot, "LinuxTestProcesses", testExeName))
+            {
+                WorkingDirectory = workingDirectoryStorage.RootDirectory,
+                RedirectStandardOutput = true,
+                UseShellExecute = false,
+            };
+
+            using var process = System.Diagnostics.Process.Start(startInfo)!;
+            var output = process.StandardOutput.ReadToEnd();
+            process.WaitForExit();
+            XAssert.AreEqual(0, process.ExitCode);
+
+            return output;
+        }
+
         private SandboxedProcessResult RunTest(string testExeName, TempFileStorage? workingDirectoryStorage = null)
         {
             var testExecutable = FileArtifact.CreateSourceFile(AbsolutePath.Create(Context.PathTable, Path.Combine(TestBinRoot, "LinuxTestProcesses", testExeName)));
@@ -136,6 +136,16 @@ namespace Test.BuildXL.Processes
             AssertLogContains(GetRegex("__init__", TestProcessExe));
         }
 
+        [Fact]
+        public void CallTestposix_spawn()
+        {
+            // The spawned process is reported by the parent and reports its own start: there is no report from the child before it execs
+            var result = RunNativeTest(GetNativeTestName(MethodBase.GetCurrentMethod().Name));
+            TestForFileOperation(result, ReportedFileOperation.Process, TestProcessExe, count: 3);
+            AssertLogContains(GetRegex(GetSyscallName(MethodBase.GetCurrentMethod().Name), TestProcessExe));
+            AssertLogContains(GetRegex("__init__", TestProcessExe));
+        }
+
         [Fact]
         public void CallTest__lxstat()
         {
@@ -66,6 +66,17 @@ namespace Test.BuildXL.Processes
             [MarshalAs(UnmanagedType.LPStr)] StringBuilder buf1,
             [MarshalAs(UnmanagedType.LPStr)] StringBuilder buf2);
 
+        [DllImport(LibBxlUtils, EntryPoint = "rewrite_env_for_test")]
+        [return: MarshalAs(UnmanagedType.U1)]
+        private static extern bool RewriteEnv(string[] env,
+            [MarshalAs(UnmanagedType.LPStr)] string ldPreloadPath,
+            [MarshalAs(UnmanagedType.U1)] bool addLdPreloadPath,
+            [MarshalAs(UnmanagedType.LPStr)] string name0,
+            [MarshalAs(UnmanagedType.LPStr)] string value0,
+            [MarshalAs(UnmanagedType.LPStr)] string name1,
+            [MarshalAs(UnmanagedType.LPStr)] string value1,
+            [MarshalAs(UnmanagedType.LPStr)] StringBuilder buf);
+
         [Theory]
         // no 'valueToAdd' specified --> no change
         [InlineData("")]
@@ -253,5 +264,31 @@ namespace Test.BuildXL.Processes
             XAssert.AreEqual(expected[2], buffers[2].ToString());
             XAssert.AreEqual(shouldBeSameEnvp, sameEvnp);
         }
+
+        [Theory]
+        // everything is already in place --> no change
+        [InlineData(new[] { "HOME=/User/home", "LD_PRELOAD=/before:/my/lib", "__BUILDXL_FAM_PATH=/my/fam", "__BUILDXL_ROOT_PID=", null }, true, new[] { "HOME=/User/home", "LD_PRELOAD=/before:/my/lib", "__BUILDXL_FAM_PATH=/my/fam", "__BUILDXL_ROOT_PID=" })]
+        [InlineData(new[] { "HOME=/User/home", "LD_PRELOAD=/before", "__BUILDXL_FAM_PATH=/my/fam", "__BUILDXL_ROOT_PID=", null }, false, new[] { "HOME=/User/home", "LD_PRELOAD=/before", "__BUILDXL_FAM_PATH=/my/fam", "__BUILDXL_ROOT_PID=" })]
+        // values are updated in place and missing ones are appended
+        [InlineData(new[] { "HOME=/User/home", "LD_PRELOAD=/before", "__BUILDXL_FAM_PATH=/other", null }, true, new[] { "HOME=/User/home", "LD_PRELOAD=/before:/my/lib", "__BUILDXL_FAM_PATH=/my/fam", "__BUILDXL_ROOT_PID=" }, false)]
+        [InlineData(new[] { "HOME=/User/home", "LD_PRELOAD=/before:/my/lib", "__BUILDXL_FAM_PATH=/other", null }, false, new[] { "HOME=/User/home", "LD_PRELOAD=/before:", "__BUILDXL_FAM_PATH=/my/fam", "__BUILDXL_ROOT_PID=" }, false)]
+        [InlineData(new[] { "HOME=/User/home", "__BUILDXL_FAM_PATH_OTHER=/other", null }, true, new[] { "HOME=/User/home", "__BUILDXL_FAM_PATH_OTHER=/other", "__BUILDXL_FAM_PATH=/my/fam", "__BUILDXL_ROOT_PID=", "LD_PRELOAD=/my/lib" }, false)]
+        [InlineData(null, true, new[] { "__BUILDXL_FAM_PATH=/my/fam", "__BUILDXL_ROOT_PID=", "LD_PRELOAD=/my/lib" }, false)]
+        public void TestRewriteEnv(string[] envp, bool addLdPreloadPath, string[] expectedEnvp, bool shouldBeSameEnvp = true)
+        {
+            if (!OperatingSystemHelper.IsLinuxOS)
+            {
+                return;
+            }
+
+            // allocate large enough buffers for each env var
+            var buffer = new StringBuilder(capacity: 1000);
+
+            bool sameEvnp = RewriteEnv(envp, "/my/lib", addLdPreloadPath, "__BUILDXL_FAM_PATH", "/my/fam", "__BUILDXL_ROOT_PID", "", buffer);
+            XAssert.AreEqual(shouldBeSameEnvp, sameEvnp);
+
+            var newEnvp = buffer.ToString().Split(EnvSeparator);
+            XAssert.IsTrue(newEnvp.SequenceEqual(expectedEnvp));
+        }
     }
 }
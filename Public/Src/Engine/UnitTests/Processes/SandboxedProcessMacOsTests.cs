@@ -52,6 +52,7 @@ namespace Test.BuildXL.Processes
             public bool NotifyUsage(uint cpuUsage, uint availableRamMB) { return true; }
             public void NotifyPipReady(LoggingContext loggingContext, FileAccessManifest fam, SandboxedProcessUnix process, Task reportCompletion) {}
             public bool NotifyPipStarted(LoggingContext loggingContext, FileAccessManifest fam, SandboxedProcessUnix process) { return true; }
+            public bool NotifyPipManifestUpdated(LoggingContext loggingContext, FileAccessManifest fam, SandboxedProcessUnix process, IReadOnlyCollection<string> changedScopes) { return false; }
             public IEnumerable<(string, string)> AdditionalEnvVarsToSet(SandboxedProcessInfo info, string uniqueName) { return Enumerable.Empty<(string, string)>(); }
 
             public void NotifyPipProcessTerminated(long pipId, int processId) { ProcessTerminated?.Invoke(pipId, processId); }
@@ -150,5 +150,167 @@ namespace Test.BuildXL.Processes
             XAssert.AreEqual("*", enumeratePattern);
             XAssert.AreEqual("some args\r\n", processArgs);
         }
+
+        [Fact]
+        public void CompactFileAccessReportLineRoundtrip()
+        {
+            var parser = new CompactFileAccessReportLine();
+            var line = GetCompactReportLine(
+                "Process",
+                processId: 0xdeadbeef,
+                pathId: 0,
+                path: "C:\\foo|bar",
+                enumeratePattern: "*",
+                processArgs: "some|args",
+                usn: new Usn(0xfedcba9876543210),
+                error: uint.MaxValue);
+
+            var ok = parser.TryParse(
+                ref line,
+                out var processId,
+                out var id,
+                out var correlationId,
+                out var operation,
+                out var requestedAccess,
+                out var status,
+                out var explicitlyReported,
+                out var error,
+                out var usn,
+                out var desiredAccess,
+                out var shareMode,
+                out var creationDisposition,
+                out var flags,
+                out var openedFileOrDirectoryAttributes,
+                out var absolutePath,
+                out var path,
+                out var enumeratePattern,
+                out var processArgs,
+                out string errorMessage);
+
+            XAssert.IsTrue(ok, errorMessage);
+
+            XAssert.AreEqual(ReportedFileOperation.Process, operation);
+            XAssert.AreEqual(0xdeadbeef, processId);
+            XAssert.AreEqual(1u, id);
+            XAssert.AreEqual(2u, correlationId);
+            XAssert.AreEqual(RequestedAccess.Enumerate, requestedAccess);
+            XAssert.AreEqual(FileAccessStatus.Allowed, status);
+            XAssert.AreEqual(true, explicitlyReported);
+            XAssert.AreEqual(uint.MaxValue, error);
+            XAssert.AreEqual(new Usn(0xfedcba9876543210), usn);
+            XAssert.AreEqual(DesiredAccess.GENERIC_READ, desiredAccess);
+            XAssert.AreEqual(ShareMode.FILE_SHARE_READ, shareMode);
+            XAssert.AreEqual(CreationDisposition.OPEN_ALWAYS, creationDisposition);
+            XAssert.AreEqual(FlagsAndAttributes.FILE_ATTRIBUTE_NORMAL, flags);
+            XAssert.AreEqual(FlagsAndAttributes.FILE_ATTRIBUTE_DIRECTORY, openedFileOrDirectoryAttributes);
+            XAssert.AreEqual(AbsolutePath.Invalid, absolutePath);
+            XAssert.AreEqual("C:\\foo|bar", path);
+            XAssert.AreEqual("*", enumeratePattern);
+            XAssert.AreEqual("some|args", processArgs);
+        }
+
+        [Fact]
+        public void CompactFileAccessReportLineInternedPaths()
+        {
+            var parser = new CompactFileAccessReportLine();
+
+            // The first report of each process defines the id, the following ones only refer to it
+            XAssert.AreEqual("C:\\first", ParseCompactReportPath(parser, GetCompactReportLine("CreateFile", processId: 1, pathId: 7, path: "C:\\first")));
+            XAssert.AreEqual("C:\\second", ParseCompactReportPath(parser, GetCompactReportLine("CreateFile", processId: 2, pathId: 7, path: "C:\\second")));
+            XAssert.AreEqual("C:\\first", ParseCompactReportPath(parser, GetCompactReportLine("CreateFile", processId: 1, pathId: 7, path: null)));
+            XAssert.AreEqual("C:\\second", ParseCompactReportPath(parser, GetCompactReportLine("CreateFile", processId: 2, pathId: 7, path: null)));
+
+            // Ids are per process
+            var line = GetCompactReportLine("CreateFile", processId: 3, pathId: 7, path: null);
+            XAssert.IsFalse(parser.TryParse(ref line, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out string error));
+            XAssert.IsNotNull(error);
+        }
+
+        [Fact]
+        public void CompactFileAccessReportLineInternedDirectories()
+        {
+            var parser = new CompactFileAccessReportLine();
+
+            // The first report of a file in a directory defines the directory, the following ones only send their file name
+            XAssert.AreEqual("C:\\out\\obj\\a.obj", ParseCompactReportPath(parser, GetCompactReportLine("CreateFile", processId: 1, pathId: 0, path: "a.obj", directoryId: 3, directory: "C:\\out\\obj\\")));
+            XAssert.AreEqual("C:\\out\\obj\\b.obj", ParseCompactReportPath(parser, GetCompactReportLine("CreateFile", processId: 1, pathId: 0, path: "b.obj", directoryId: 3)));
+
+            // A path can be interned while it is sent relative to its directory
+            XAssert.AreEqual("C:\\out\\obj\\c.obj", ParseCompactReportPath(parser, GetCompactReportLine("CreateFile", processId: 1, pathId: 4, path: "c.obj", directoryId: 3)));
+            XAssert.AreEqual("C:\\out\\obj\\c.obj", ParseCompactReportPath(parser, GetCompactReportLine("CreateFile", processId: 1, pathId: 4, path: null)));
+
+            // Directory ids are per process
+            var line = GetCompactReportLine("CreateFile", processId: 2, pathId: 0, path: "a.obj", directoryId: 3);
+            XAssert.IsFalse(parser.TryParse(ref line, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out string error));
+            XAssert.IsNotNull(error);
+        }
+
+        [Fact]
+        public void CompactFileAccessReportLineWithWrongLengthFails()
+        {
+            var parser = new CompactFileAccessReportLine();
+            var line = GetCompactReportLine("CreateFile", processId: 1, pathId: 0, path: "C:\\foo");
+
+            // A truncated line (e.g. because of a broken pipe) must not parse
+            line = line.Substring(0, line.Length - 1);
+            XAssert.IsFalse(parser.TryParse(ref line, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out string error));
+            XAssert.IsNotNull(error);
+
+            line = line.Substring(0, CompactFileAccessReportLine.HeaderLength - 1);
+            XAssert.IsFalse(parser.TryParse(ref line, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out error));
+            XAssert.IsNotNull(error);
+        }
+
+        private static string ParseCompactReportPath(CompactFileAccessReportLine parser, string line)
+        {
+            var ok = parser.TryParse(ref line, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out _, out var path, out _, out _, out string error);
+            XAssert.IsTrue(ok, error);
+            return path;
+        }
+
+        /// <summary>
+        /// Returns a compact report line the way the report reader hands it over: without the report type and the line terminator
+        /// </summary>
+        private static string GetCompactReportLine(
+            string operation,
+            uint processId,
+            uint pathId,
+            string path,
+            string enumeratePattern = null,
+            string processArgs = null,
+            Usn usn = default,
+            uint error = 0,
+            uint directoryId = 0,
+            string directory = null)
+        {
+            var line = CompactFileAccessReportLine.GetReportLine(
+                operation,
+                processId,
+                id: 1,
+                correlationId: 2,
+                RequestedAccess.Enumerate,
+                FileAccessStatus.Allowed,
+                explicitlyReported: true,
+                error,
+                usn,
+                DesiredAccess.GENERIC_READ,
+                ShareMode.FILE_SHARE_READ,
+                CreationDisposition.OPEN_ALWAYS,
+                FlagsAndAttributes.FILE_ATTRIBUTE_NORMAL,
+                FlagsAndAttributes.FILE_ATTRIBUTE_DIRECTORY,
+                AbsolutePath.Invalid,
+                pathId,
+                directoryId,
+                directory,
+                path,
+                enumeratePattern,
+                processArgs);
+
+            string reportType = $"{(int)ReportType.CompactFileAccess},";
+            XAssert.IsTrue(line.StartsWith(reportType, StringComparison.Ordinal));
+            XAssert.IsTrue(line.EndsWith("\r\n", StringComparison.Ordinal));
+
+            return line.Substring(reportType.Length, line.Length - reportType.Length - 2);
+        }
     }
 }
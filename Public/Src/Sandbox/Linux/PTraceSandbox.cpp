@@ -5,37 +5,65 @@
 #include "PTraceSandbox.hpp"
 #include <linux/filter.h>
 #include <linux/seccomp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
 #include <sys/prctl.h>
 #include <sys/ptrace.h>
-#include <sys/reg.h>
+#include <sys/signalfd.h>
+#include <sys/uio.h>
+#include <sys/utsname.h>
 #include <sys/wait.h>
 
+// Older kernel headers may not define these
+#ifndef SECCOMP_USER_NOTIF_FLAG_CONTINUE
+#define SECCOMP_USER_NOTIF_FLAG_CONTINUE (1UL << 0)
+#endif
+#ifndef __NR_pidfd_open
+#define __NR_pidfd_open 434
+#endif
+#ifndef __NR_pidfd_getfd
+#define __NR_pidfd_getfd 438
+#endif
+#ifndef __NR_close_range
+#define __NR_close_range 436
+#endif
+#ifndef CLOSE_RANGE_CLOEXEC
+#define CLOSE_RANGE_CLOEXEC (1U << 2)
+#endif
+
 #define SYSCALL_NAME_TO_NUMBER(name) __NR_##name
 #define SYSCALL_NAME_STRING(name) #name
 
-// This macro fills in the seccomp_data data structure
-// The first statement checks if the current syscall matches the syscall number provided.
-// If so, then it will not modify the program counter (the 0 set in the third arg is for PC + 0)
-// If the syscall number does not match, then it will increment the program counter (PC + 1) and jump to skip over the next statement that has the SECCOMP_RET_TRACE
-// The BPF statement with SECCOMP_RET_TRACE indicates that we should invoke the tracer (ie: the parent process will be signalled by ptrace)
-#define TRACE_SYSCALL(name) \
-        BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYSCALL_NAME_TO_NUMBER(name), 0, 1), \
-        BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_TRACE)
-
-// There are "new" versions of certain syscalls (such as fstatat).
-// The name of the function does not include the "new" bit, but the name in the kernel includes this prefix
-// Use this macro to trace those syscalls
-// The other "new" variants of the macros in this file achieve the same thing
-#define TRACE_SYSCALL_NEW(name) TRACE_SYSCALL(new##name)
+enum class TracedSyscallSelector
+{
+    Always,
+    FdTable,
+    SeccompNotify,
+};
+
+// An entry of FOR_EACH_TRACED_SYSCALL
+struct TracedSyscall
+{
+    int number;
+    TracedSyscallSelector selector;
+    unsigned int skipFlags;
+};
+
+#define MAKE_TRACED_SYSCALL(syscallName, selector, skipFlags) \
+        { SYSCALL_NAME_TO_NUMBER(syscallName), TracedSyscallSelector::selector, (skipFlags) },
+
+static constexpr TracedSyscall s_tracedSyscalls[] = {
+    FOR_EACH_TRACED_SYSCALL(MAKE_TRACED_SYSCALL)
+};
+
+#undef MAKE_TRACED_SYSCALL
 
 #define HANDLER_FUNCTION(syscallName) void PTraceSandbox::MAKE_HANDLER_FN_NAME(syscallName) ()
-#define HANDLER_FUNCTION_NEW(syscallName) HANDLER_FUNCTION(new##syscallName)
 
-#define CHECK_AND_CALL_HANDLER(syscallName) \
+#define CHECK_AND_CALL_HANDLER(syscallName, selector, skipFlags) \
         case SYSCALL_NAME_TO_NUMBER(syscallName): \
             PTraceSandbox::MAKE_HANDLER_FN_NAME(syscallName) (); \
-            break
-#define CHECK_AND_CALL_HANDLER_NEW(syscallName) CHECK_AND_CALL_HANDLER(new##syscallName)
+            break;
 
 PTraceSandbox::PTraceSandbox(BxlObserver *bxl)
 {
@@ -48,80 +76,53 @@ PTraceSandbox::~PTraceSandbox()
 
 int PTraceSandbox::ExecuteWithPTraceSandbox(const char *file, char *const argv[], char *const envp[], const char *fam)
 {
-    /**
-     * NOTE: when adding new system calls to interpose here, ensure that a matching unit test for that system call
-     * is added to Public/Src/Sandbox/Linux/UnitTests/TestProcesses/TestProcess/main.cpp and Public/Src/Engine/UnitTests/Processes/LinuxSandboxProcessTests.cs
-     */
-
-    // Filter for the syscalls that BXL is interested in tracing
+    // Filter for the syscalls that BXL is interested in tracing (see FOR_EACH_TRACED_SYSCALL)
     // Only the syscalls in here will be signalled to the main process by seccomp
     // List of available syscalls to ptrace: https://github.com/torvalds/linux/blob/master/arch/x86/entry/syscalls/syscall_64.tbl
     // NOTE: The set of syscalls here are not equivalent to the set of functions that are interposed by the regular sandbox
     // This is expected because not all of the interposed functions map directly to system calls in the kernel.
     // This set should capture all of the file accesses we already observe on the interpose sandbox.
-    struct sock_filter filter[] = {
-        // This statement loads the syscall number (seccomp_data.nr) into the accumulator
-        BPF_STMT(BPF_LD+BPF_W+BPF_ABS, offsetof(struct seccomp_data, nr)),
-        // The next set of statements indicates that we should stop the tracee if one of these syscalls are detected
-        TRACE_SYSCALL(execveat),
-        TRACE_SYSCALL(execve),
-        TRACE_SYSCALL(stat),
-        TRACE_SYSCALL(lstat),
-        TRACE_SYSCALL(fstat),
-        TRACE_SYSCALL_NEW(fstatat),
-        TRACE_SYSCALL(access),
-        TRACE_SYSCALL(faccessat),
-        TRACE_SYSCALL(creat),
-        TRACE_SYSCALL(open),
-        TRACE_SYSCALL(openat),
-        TRACE_SYSCALL(write),
-        TRACE_SYSCALL(writev),
-        TRACE_SYSCALL(pwritev),
-        TRACE_SYSCALL(pwritev2),
-        TRACE_SYSCALL(pwrite64),
-        TRACE_SYSCALL(truncate),
-        TRACE_SYSCALL(ftruncate),
-        TRACE_SYSCALL(rmdir),
-        TRACE_SYSCALL(rename),
-        TRACE_SYSCALL(renameat),
-        TRACE_SYSCALL(renameat2),
-        TRACE_SYSCALL(link),
-        TRACE_SYSCALL(linkat),
-        TRACE_SYSCALL(unlink),
-        TRACE_SYSCALL(unlinkat),
-        TRACE_SYSCALL(symlink),
-        TRACE_SYSCALL(symlinkat),
-        TRACE_SYSCALL(readlink),
-        TRACE_SYSCALL(readlinkat),
-        TRACE_SYSCALL(utime),
-        TRACE_SYSCALL(utimes),
-        TRACE_SYSCALL(utimensat),
-        TRACE_SYSCALL(futimesat),
-        TRACE_SYSCALL(mkdir),
-        TRACE_SYSCALL(mkdirat),
-        TRACE_SYSCALL(mknod),
-        TRACE_SYSCALL(mknodat),
-        TRACE_SYSCALL(chmod),
-        TRACE_SYSCALL(fchmod),
-        TRACE_SYSCALL(fchmodat),
-        TRACE_SYSCALL(chown),
-        TRACE_SYSCALL(fchown),
-        TRACE_SYSCALL(lchown),
-        TRACE_SYSCALL(fchownat),
-        TRACE_SYSCALL(sendfile),
-        TRACE_SYSCALL(copy_file_range),
-        TRACE_SYSCALL(name_to_handle_at),
-        // NOTE: vfork is explicitly not traced here, see PTraceSandbox::UpdateTraceeTableForExec for more details
-        TRACE_SYSCALL(fork),
-        TRACE_SYSCALL(clone),
-        // SECCOMP_RET_ALLOW tells seccomp to allow all of the calls that were being filtered above (as opposed to killing them)
-        // This would happen if none of the syscall numbers above get matched, and therefore should not stop the tracee
-        BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW),
-    };
+    bool useSeccompNotify = ShouldUseSeccompNotify(m_bxl);
+    bool useFdTable = m_bxl->IsPTraceFdTableEnabled() && !useSeccompNotify;
+
+    // SECCOMP_RET_TRACE stops the tracee for ptrace. With seccomp notifications, the syscalls are sent to the notification listener instead.
+    unsigned int traceAction = useSeccompNotify ? SECCOMP_RET_USER_NOTIF : SECCOMP_RET_TRACE;
+
+    // This statement loads the syscall number (seccomp_data.nr) into the accumulator
+    std::vector<struct sock_filter> program { BPF_STMT(BPF_LD+BPF_W+BPF_ABS, offsetof(struct seccomp_data, nr)) };
+    for (const TracedSyscall &tracedSyscall : s_tracedSyscalls)
+    {
+        if ((tracedSyscall.selector == TracedSyscallSelector::FdTable && !useFdTable) ||
+            (tracedSyscall.selector == TracedSyscallSelector::SeccompNotify && !useSeccompNotify))
+        {
+            continue;
+        }
+
+        if (tracedSyscall.skipFlags == 0)
+        {
+            // If the syscall number matches, fall through (PC + 0) to the statement that invokes the tracer. Otherwise skip over it (PC + 1).
+            program.push_back(BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, (unsigned int)tracedSyscall.number, 0, 1));
+            program.push_back(BPF_STMT(BPF_RET+BPF_K, traceAction));
+        }
+        else
+        {
+            // Skip the whole block if the syscall number does not match. Otherwise the argument is loaded into the accumulator
+            // (which is why the whole block needs to end in a return statement) and checked against the flags.
+            program.push_back(BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, (unsigned int)tracedSyscall.number, 0, 4));
+            program.push_back(BPF_STMT(BPF_LD+BPF_W+BPF_ABS, offsetof(struct seccomp_data, args[0])));
+            program.push_back(BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, tracedSyscall.skipFlags, 0, 1));
+            program.push_back(BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW));
+            program.push_back(BPF_STMT(BPF_RET+BPF_K, traceAction));
+        }
+    }
+
+    // SECCOMP_RET_ALLOW tells seccomp to allow all of the calls that were being filtered above (as opposed to killing them)
+    // This would happen if none of the syscall numbers above get matched, and therefore should not stop the tracee
+    program.push_back(BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW));
 
     struct sock_fprog prog = {
-        .len = (unsigned short) (sizeof(filter)/sizeof(filter[0])),
-        .filter = filter,
+        .len = (unsigned short) program.size(),
+        .filter = program.data(),
     };
 
     // NOTE: sem_open must be called before we set the seccomp filter
@@ -141,13 +142,43 @@ int PTraceSandbox::ExecuteWithPTraceSandbox(const char *file, char *const argv[]
     }
     ts.tv_sec += 15; // Waiting up to 15 seconds and then assuming something went wrong with the ptrace runner
 
+    int listenerFd = -1;
+    if (useSeccompNotify)
+    {
+        // With seccomp notifications the filter is installed before the runner shows up: the runner finds the listener through /proc/<pid>/fd
+        // and takes a copy of it. From here on traced syscalls block until the runner responds to them, so only the
+        // semaphore wait (which is not traced) should happen until it does.
+        m_bxl->FlushReports();
+
+        if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1) {
+            BXL_LOG_DEBUG(m_bxl, "prctl(PR_SET_NO_NEW_PRIVS) failed %d\n", 1);
+            m_bxl->real_printf("prctl(PR_SET_NO_NEW_PRIVS) failed\n");
+            m_bxl->real__exit(-1);
+        }
+
+        listenerFd = syscall(__NR_seccomp, SECCOMP_SET_MODE_FILTER, SECCOMP_FILTER_FLAG_NEW_LISTENER, &prog);
+        if (listenerFd == -1) {
+            BXL_LOG_DEBUG(m_bxl, "SECCOMP_SET_MODE_FILTER with SECCOMP_FILTER_FLAG_NEW_LISTENER failed: '%s'\n", strerror(errno));
+            m_bxl->real_printf("SECCOMP_SET_MODE_FILTER with SECCOMP_FILTER_FLAG_NEW_LISTENER failed\n");
+            m_bxl->real__exit(-1);
+        }
+    }
+
     // Wait for the ptracerunner to post to this semaphore to indicate that it has attached successfully
     auto waitResult = sem_timedwait(semaphoreTracee, &ts);
     auto semWaitErrno = errno;
 
     // Regardless of whether we timed out or not, close/unlink the semaphore
     sem_close(semaphoreTracee);
-    sem_unlink(semaphoreName.c_str());
+    if (useSeccompNotify)
+    {
+        // The runner owns a copy of the listener by now (or it is not coming at all). It also unlinks the semaphore, since unlink is traced.
+        close(listenerFd);
+    }
+    else
+    {
+        sem_unlink(semaphoreName.c_str());
+    }
 
     if (waitResult == -1)
     {
@@ -156,29 +187,35 @@ int PTraceSandbox::ExecuteWithPTraceSandbox(const char *file, char *const argv[]
         m_bxl->real__exit(-1);
     }
 
-    // This prctl call prevents the child process from having a higher privilege than its parent
-    // It is necessary to make the next PR_SET_SECCOMP call work (or else the parent process would need to run as root)
-    if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1) {
-        BXL_LOG_DEBUG(m_bxl, "prctl(PR_SET_NO_NEW_PRIVS) failed %d\n", 1);
-        m_bxl->real_printf("prctl(PR_SET_NO_NEW_PRIVS) failed\n");
-        m_bxl->real__exit(-1);
-    }
+    if (!useSeccompNotify)
+    {
+        // Send any buffered reports now: once the seccomp filter is set, writing to the FIFO would be traced too
+        m_bxl->FlushReports();
+
+        // This prctl call prevents the child process from having a higher privilege than its parent
+        // It is necessary to make the next PR_SET_SECCOMP call work (or else the parent process would need to run as root)
+        if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1) {
+            BXL_LOG_DEBUG(m_bxl, "prctl(PR_SET_NO_NEW_PRIVS) failed %d\n", 1);
+            m_bxl->real_printf("prctl(PR_SET_NO_NEW_PRIVS) failed\n");
+            m_bxl->real__exit(-1);
+        }
 
-    // Sets the seccomp filter
-    // NOTE: Do not run anything other than execve after this statement
-    if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) == -1) {
-        BXL_LOG_DEBUG(m_bxl, "PR_SET_SECCOMP with SECCOMP_MODE_FILTER failed %d\n", 1);
-        m_bxl->real_printf("PR_SET_SECCOMP with SECCOMP_MODE_FILTER failed\n");
-        m_bxl->real__exit(-1);
+        // Sets the seccomp filter
+        // NOTE: Do not run anything other than execve after this statement
+        if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) == -1) {
+            BXL_LOG_DEBUG(m_bxl, "PR_SET_SECCOMP with SECCOMP_MODE_FILTER failed %d\n", 1);
+            m_bxl->real_printf("PR_SET_SECCOMP with SECCOMP_MODE_FILTER failed\n");
+            m_bxl->real__exit(-1);
+        }
     }
 
     // Finally perform the exec syscall, this call to exec along with the syscalls from the child process should be filtered and reported to the tracer by seccomp
     return m_bxl->real_execvpe(file, argv, envp);
 }
 
-void PTraceSandbox::AttachToProcess(pid_t traceePid, std::string exe, std::string semaphoreName)
+void PTraceSandbox::Seize(pid_t traceePid, std::string exe, std::string semaphoreName)
 {
-    BXL_LOG_DEBUG(m_bxl, "[PTrace] Starting tracer PID '%d' to trace PID '%d'", getpid(), traceePid);
+    BXL_LOG_DEBUG(m_bxl, "[PTrace] Tracer PID '%d' starts tracing PID '%d'", getpid(), traceePid);
 
     // PTRACE_O_TRACESYSGOOD: Sets bit 7 of the signal when delivering a system calls.
     // PTRACE_O_TRACESECCOMP: Enables ptrace events from seccomp on the child
@@ -186,7 +223,6 @@ void PTraceSandbox::AttachToProcess(pid_t traceePid, std::string exe, std::strin
     // PTRACE_O_TRACEEXIT: ptrace will signal before exit() returns back to the caller.
     unsigned long options = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACESECCOMP | PTRACE_O_TRACECLONE | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_TRACEEXIT;
 
-    int status;
     if (ptrace(PTRACE_SEIZE, traceePid, 0L, options) == -1)
     {
         BXL_LOG_DEBUG(m_bxl, "[PTrace] PTRACE_SEIZE failed with error: '%s'", strerror(errno));
@@ -200,12 +236,10 @@ void PTraceSandbox::AttachToProcess(pid_t traceePid, std::string exe, std::strin
         _exit(-1);
     }
 
-    m_traceePid = traceePid;
-    m_traceeTable.push_back(std::make_tuple(traceePid, exe));
-    m_bxl->disable_fd_table();
+    m_traceeTable[traceePid] = InternExePath(exe);
 
-    // Resume child
-    ptrace(PTRACE_SYSCALL, m_traceePid, 0, 0);
+    // Resume child. Tracees only stop again on seccomp-filtered syscalls and on the PTRACE_O_* events.
+    ptrace(PTRACE_CONT, traceePid, 0, 0);
 
     // Attach complete, signal the semaphore for the child to resume
     sem_t *semaphore = sem_open(semaphoreName.c_str(), O_CREAT, 0644, 0);
@@ -216,6 +250,104 @@ void PTraceSandbox::AttachToProcess(pid_t traceePid, std::string exe, std::strin
     }
     sem_post(semaphore); // Increment the semaphore to unblock the traced process
     sem_close(semaphore);
+}
+
+void PTraceSandbox::WaitForTraceeOrRequests(int signalFd, int &requestFd, std::string &pendingRequests)
+{
+    // Nothing may happen for a while, so don't keep reports waiting in the buffer
+    m_bxl->FlushReports();
+
+    struct pollfd fds[2] = { { signalFd, POLLIN, 0 }, { requestFd, POLLIN, 0 } };
+    if (poll(fds, 2, -1) == -1)
+    {
+        if (errno != EINTR)
+        {
+            std::cerr << "[PTrace] poll failed with: " << strerror(errno) << std::endl;
+            _exit(-1);
+        }
+
+        return;
+    }
+
+    if (fds[0].revents & POLLIN)
+    {
+        // Only the wakeup matters: tracees are waited for with waitpid, which also picks up coalesced notifications
+        struct signalfd_siginfo info;
+        while (read(signalFd, &info, sizeof(info)) == sizeof(info));
+    }
+
+    if (fds[1].revents & (POLLIN | POLLHUP | POLLERR))
+    {
+        char buffer[PATH_MAX];
+        ssize_t bytesRead = read(requestFd, buffer, sizeof(buffer));
+        if (bytesRead <= 0)
+        {
+            BXL_LOG_DEBUG(m_bxl, "[PTrace] No more tracees will be requested from tracer PID '%d'", getpid());
+            close(requestFd);
+            requestFd = -1;
+            return;
+        }
+
+        pendingRequests.append(buffer, bytesRead);
+
+        // CODESYNC: SandboxedProcessUnix.cs (StartPTraceRunner)
+        size_t endOfLine;
+        while ((endOfLine = pendingRequests.find('\n')) != std::string::npos)
+        {
+            std::string request = pendingRequests.substr(0, endOfLine);
+            pendingRequests.erase(0, endOfLine + 1);
+
+            size_t separator = request.find(' ');
+            pid_t traceePid = atoi(request.c_str());
+            std::string exe = separator == std::string::npos ? std::string() : request.substr(separator + 1);
+
+            // CODESYNC: ptracerunner.cpp (same semaphore as the one for the first tracee)
+            Seize(traceePid, exe, "/" + std::to_string(traceePid));
+        }
+    }
+}
+
+void PTraceSandbox::AttachToProcess(pid_t traceePid, std::string exe, std::string semaphoreName, int requestFd)
+{
+    // Tracees are resumed before their process start/exit reports are written to the FIFO
+    m_bxl->DeferLifecycleReports();
+
+    if (ShouldUseSeccompNotify(m_bxl))
+    {
+        AttachWithSeccompNotify(traceePid, exe, semaphoreName);
+        return;
+    }
+
+    // Same condition the tracee checked when installing its filter (see ExecuteWithPTraceSandbox). Not available with seccomp
+    // notifications: the tracer can't tell when a close is done there, so it could resolve an fd that is about to be closed.
+    m_useFdTable = m_bxl->IsPTraceFdTableEnabled();
+    m_handBackToInterposer = m_bxl->IsPTraceHandBackEnabled();
+
+    m_bxl->disable_fd_table();
+    // Tracees run concurrently with the tracer, so their renames/unlinks can't be reliably used to invalidate the cache
+    m_bxl->disable_resolved_path_cache();
+
+    int signalFd = -1;
+    if (requestFd != -1)
+    {
+        // Tracees that change state are signalled to the tracer with SIGCHLD. Receiving it through an fd lets the tracer wait for
+        // tracees and for requests at once. It is blocked before seizing anything so that no notification gets missed.
+        sigset_t sigchld;
+        sigemptyset(&sigchld);
+        sigaddset(&sigchld, SIGCHLD);
+        sigprocmask(SIG_BLOCK, &sigchld, NULL);
+        signalFd = signalfd(-1, &sigchld, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (signalFd == -1)
+        {
+            std::cerr << "[PTrace] signalfd failed with: " << strerror(errno) << std::endl;
+            _exit(-1);
+        }
+    }
+
+    Seize(traceePid, exe, semaphoreName);
+
+    std::string pendingRequests;
+    int status;
 
     // Main loop that handles signals from the child
     // wait should get signalled from the following:
@@ -228,7 +360,14 @@ void PTraceSandbox::AttachToProcess(pid_t traceePid, std::string exe, std::strin
         // A call to wait is equivalent to waitpid(-1, &status, 0);
         // The wait call will return the PID of the process that signalled, this should be used as the traceepid
         // NOTE: this must be done in a single thread, we cannot split this up into separate threads because only the thread that attached the tracee can issue ptrace commands
-        m_traceePid = wait(&status);
+        // While new tracees may still be requested, the tracer can't block in wait (and once there are no tracees, wait doesn't block at all)
+        m_traceePid = requestFd == -1 ? wait(&status) : waitpid(-1, &status, WNOHANG);
+
+        if (requestFd != -1 && (m_traceePid == 0 || (m_traceePid == -1 && errno == ECHILD)))
+        {
+            WaitForTraceeOrRequests(signalFd, requestFd, pendingRequests);
+            continue;
+        }
 
         if (m_traceePid == -1)
         {
@@ -240,6 +379,7 @@ void PTraceSandbox::AttachToProcess(pid_t traceePid, std::string exe, std::strin
                 _exit(-1);
             }
 
+            m_bxl->FlushReports();
             _exit(0);
         }
 
@@ -255,98 +395,600 @@ void PTraceSandbox::AttachToProcess(pid_t traceePid, std::string exe, std::strin
             break;
         }
 
-        // Handle vfork/seccomp
-        if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_VFORK << 8)))
-        {
-            // This case is explicitly skipped, and handled by PTraceSandbox::UpdateTraceeTableForExec
-            ptrace(PTRACE_SYSCALL, m_traceePid, NULL, NULL);
-        }
-        else if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_EXIT << 8)))
+        // Tracees are always resumed with PTRACE_CONT (never PTRACE_SYSCALL), so they don't stop on syscalls the filter did not select.
+        // Handlers that need the return value of the syscall step to its exit themselves (see WaitForSyscallExit).
+        int event = status >> 16;
+        int signal = 0;
+        if (event == PTRACE_EVENT_EXIT)
         {
             unsigned long traceeStatus = 0;
             ptrace(PTRACE_GETEVENTMSG, m_traceePid, NULL, &traceeStatus);
+
+            // Nothing else is needed from the tracee, so it can finish exiting while its exit is reported
+            ptrace(PTRACE_CONT, m_traceePid, NULL, 0);
+
             BXL_LOG_DEBUG(m_bxl, "[PTrace] Tracee %d exited with exit code '%d'", m_traceePid, WEXITSTATUS(traceeStatus));
+            // Every thread gets here on its own, and its id can be reused after this
+            m_threadGroups.erase(m_traceePid);
+            m_interposedTracees.erase(m_traceePid);
             RemoveFromTraceeTable();
-            ptrace(PTRACE_SYSCALL, m_traceePid, NULL, NULL);
+            continue;
         }
-        else if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_SECCOMP << 8)))
+        else if (event == PTRACE_EVENT_SECCOMP)
         {
-            long syscallNumber = ptrace(PTRACE_PEEKUSER, m_traceePid, sizeof(long) * ORIG_RAX, NULL);
-            HandleSysCallGeneric(syscallNumber);
+            // A single PTRACE_GETREGS brings the syscall number and all its arguments, handlers read them from there
+            if (FetchRegisters())
+            {
+                // Processes handed back to the interposer still stop here, but only their execs matter (see HandleExec)
+                int syscallNumber = m_registers.orig_rax;
+                if (!IsInterposedTracee() || syscallNumber == __NR_execve || syscallNumber == __NR_execveat)
+                {
+                    HandleSysCallGeneric(syscallNumber);
+                }
+            }
 
-            // We can resume the child with PTRACE_CONT here to ignore the ptrace-exit-stop for this syscall
-            ptrace(PTRACE_CONT, m_traceePid, NULL, NULL);
+            m_registersValid = false;
+
+            // Handlers that are done with the tracee before they are done with the stop resume it themselves (see ResumeTracee)
+            if (m_traceeResumed)
+            {
+                m_traceeResumed = false;
+                continue;
+            }
+        }
+        else if (event != 0)
+        {
+            // Fork/vfork/clone events of syscalls the filter did not select (e.g., new threads), and the stops new tracees start with.
+            // Children are attached automatically, and fork/vfork/clone are reported by their handlers (see HandleChildProcess and
+            // UpdateTraceeTableForExec), so there is nothing to do here.
+            // Children of processes handed back to the interposer are reported by the interposer, and they start out handed back too.
+            if ((event == PTRACE_EVENT_FORK || event == PTRACE_EVENT_VFORK || event == PTRACE_EVENT_CLONE) && IsInterposedTracee())
+            {
+                unsigned long childPid = 0;
+                if (ptrace(PTRACE_GETEVENTMSG, m_traceePid, NULL, &childPid) != -1)
+                {
+                    m_interposedTracees.insert((pid_t)childPid);
+                }
+            }
         }
-        else if (WIFSTOPPED(status) && !(WSTOPSIG(status) & 0x80))
+        else if (!(WSTOPSIG(status) & 0x80))
         {
             // This is a signal-delivery-stop, this means that the tracee stopped during signal delivery
             // We don't care about these events, but when restarting the tracee we must deliver the signal by setting the last argument to ptrace(...)
             // signal-delivery-stop can be differentiated from sys calls events by checking whether the 7th bit is set on the signal (WSTOPSIG(status) & 0x80)
-            ptrace(PTRACE_SYSCALL, m_traceePid, NULL, WSTOPSIG(status));
+            signal = WSTOPSIG(status);
         }
-        else
+
+        // Anything else is a syscall stop left over from a handler that stepped to a syscall exit, and it can be ignored
+        ptrace(PTRACE_CONT, m_traceePid, NULL, signal);
+    }
+}
+
+const char* PTraceSandbox::GetTraceeExePath()
+{
+    // A tracer may trace several process trees (see AttachToProcess), so the program it was started for is only a fallback
+    auto tracee = m_traceeTable.find(m_traceePid);
+    return tracee != m_traceeTable.end() && !tracee->second->empty() ? tracee->second->c_str() : m_bxl->GetProgramPath();
+}
+
+const std::string* PTraceSandbox::InternExePath(const std::string &exePath)
+{
+    return &*m_exePaths.insert(exePath).first;
+}
+
+bool PTraceSandbox::ShouldUseSeccompNotify(BxlObserver *bxl)
+{
+    if (!bxl->IsSeccompNotifyEnabled())
+    {
+        return false;
+    }
+
+    // SECCOMP_USER_NOTIF_FLAG_CONTINUE needs 5.5 and pidfd_getfd needs 5.6. From 5.8 on the listener reports POLLHUP once
+    // no process uses the filter anymore, which is how the runner knows it is done.
+    struct utsname name;
+    int major = 0, minor = 0;
+    if (uname(&name) == -1 || sscanf(name.release, "%d.%d", &major, &minor) != 2)
+    {
+        return false;
+    }
+
+    return major > 5 || (major == 5 && minor >= 8);
+}
+
+void PTraceSandbox::AttachWithSeccompNotify(pid_t traceePid, std::string exe, std::string semaphoreName)
+{
+    BXL_LOG_DEBUG(m_bxl, "[PTrace] Starting seccomp notification runner PID '%d' for PID '%d'", getpid(), traceePid);
+    m_useSeccompNotify = true;
+
+    // The tracee installs its filter right after asking for a runner. Give it as long as it gives the runner to show up.
+    int remoteListenerFd = FindSeccompListener(traceePid, /* timeoutMs */ 15000);
+    if (remoteListenerFd == -1)
+    {
+        BXL_LOG_DEBUG(m_bxl, "[PTrace] Could not find the seccomp listener of PID '%d'", traceePid);
+        _exit(-1);
+    }
+
+    int pidFd = syscall(__NR_pidfd_open, traceePid, 0);
+    int listenerFd = pidFd == -1 ? -1 : syscall(__NR_pidfd_getfd, pidFd, remoteListenerFd, 0);
+    if (listenerFd == -1)
+    {
+        BXL_LOG_DEBUG(m_bxl, "[PTrace] Could not get the seccomp listener of PID '%d': '%s'", traceePid, strerror(errno));
+        _exit(-1);
+    }
+    close(pidFd);
+
+    // The kernel may use bigger structures than the ones we were compiled against
+    struct seccomp_notif_sizes sizes;
+    if (syscall(__NR_seccomp, SECCOMP_GET_NOTIF_SIZES, 0, &sizes) == -1)
+    {
+        BXL_LOG_DEBUG(m_bxl, "[PTrace] SECCOMP_GET_NOTIF_SIZES failed with error: '%s'", strerror(errno));
+        _exit(-1);
+    }
+
+    size_t notificationSize = std::max<size_t>(sizes.seccomp_notif, sizeof(struct seccomp_notif));
+    size_t responseSize = std::max<size_t>(sizes.seccomp_notif_resp, sizeof(struct seccomp_notif_resp));
+    struct seccomp_notif *notification = (struct seccomp_notif *)malloc(notificationSize);
+    struct seccomp_notif_resp *response = (struct seccomp_notif_resp *)malloc(responseSize);
+
+    m_traceePid = traceePid;
+    m_traceeTable[traceePid] = InternExePath(exe);
+    m_threadGroups[traceePid] = traceePid;
+    m_bxl->disable_fd_table();
+    // Tracees run concurrently with the tracer, so their renames/unlinks can't be reliably used to invalidate the cache
+    m_bxl->disable_resolved_path_cache();
+
+    // Attach complete, signal the semaphore for the child to resume. The tracee does not unlink the semaphore in this mode.
+    sem_t *semaphore = sem_open(semaphoreName.c_str(), O_CREAT, 0644, 0);
+    if (semaphore == NULL)
+    {
+        BXL_LOG_DEBUG(m_bxl, "[PTrace] sem_open failed with: '%s'", strerror(errno));
+        _exit(-1);
+    }
+    sem_post(semaphore);
+    sem_close(semaphore);
+    sem_unlink(semaphoreName.c_str());
+
+    // Main loop that handles notifications. Tasks are blocked in their syscall until we respond, so there is always a response for a
+    // received notification, even if handling it failed
+    while (true)
+    {
+        struct pollfd pollFd = { .fd = listenerFd, .events = POLLIN, .revents = 0 };
+        if (poll(&pollFd, 1, -1) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            std::cerr << "[PTrace] poll on the seccomp listener failed: " << strerror(errno) << std::endl;
+            _exit(-1);
+        }
+
+        if (pollFd.revents & POLLIN)
+        {
+            memset(notification, 0, notificationSize);
+            if (ioctl(listenerFd, SECCOMP_IOCTL_NOTIF_RECV, notification) == -1)
+            {
+                // ENOENT: the task got killed or its syscall got interrupted before we got to it
+                if (errno == EINTR || errno == ENOENT)
+                {
+                    continue;
+                }
+
+                std::cerr << "[PTrace] SECCOMP_IOCTL_NOTIF_RECV failed: " << strerror(errno) << std::endl;
+                _exit(-1);
+            }
+
+            HandleSeccompNotification(notification);
+
+            memset(response, 0, responseSize);
+            response->id = notification->id;
+            response->flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+            // ENOENT has the same meaning as above, and there is nothing left to do for that task
+            if (ioctl(listenerFd, SECCOMP_IOCTL_NOTIF_SEND, response) == -1 && errno != ENOENT)
+            {
+                std::cerr << "[PTrace] SECCOMP_IOCTL_NOTIF_SEND failed: " << strerror(errno) << std::endl;
+                _exit(-1);
+            }
+        }
+        else if (pollFd.revents & (POLLHUP | POLLERR))
+        {
+            // No process uses the filter anymore
+            m_bxl->FlushReports();
+            _exit(0);
+        }
+    }
+}
+
+int PTraceSandbox::FindSeccompListener(pid_t pid, int timeoutMs)
+{
+    std::string fdDirectory = "/proc/" + std::to_string(pid) + "/fd";
+    char linkPath[PATH_MAX];
+    char target[PATH_MAX];
+
+    for (int elapsedMs = 0; elapsedMs < timeoutMs; elapsedMs++)
+    {
+        DIR *dir = opendir(fdDirectory.c_str());
+        if (dir == NULL)
+        {
+            // The process is gone
+            return -1;
+        }
+
+        int listenerFd = -1;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            if (entry->d_name[0] == '.')
+            {
+                continue;
+            }
+
+            snprintf(linkPath, PATH_MAX, "%s/%s", fdDirectory.c_str(), entry->d_name);
+            ssize_t length = readlink(linkPath, target, PATH_MAX - 1);
+            if (length > 0)
+            {
+                target[length] = '\0';
+                if (strcmp(target, "anon_inode:seccomp notify") == 0)
+                {
+                    listenerFd = atoi(entry->d_name);
+                    break;
+                }
+            }
+        }
+
+        closedir(dir);
+
+        if (listenerFd != -1)
+        {
+            return listenerFd;
+        }
+
+        usleep(1000);
+    }
+
+    return -1;
+}
+
+void PTraceSandbox::HandleSeccompNotification(const struct seccomp_notif *notification)
+{
+    m_currentNotification = notification;
+    m_traceePid = ResolveNotifyingProcess(notification->pid);
+    HandleSysCallGeneric(notification->data.nr);
+    m_currentNotification = nullptr;
+}
+
+// Reads the thread group id and the parent pid of the given task from /proc. They are left untouched if they can't be read.
+static void ReadTaskStatus(pid_t tid, pid_t &tgid, pid_t &ppid)
+{
+    std::string statusPath = "/proc/" + std::to_string(tid) + "/status";
+    FILE *status = fopen(statusPath.c_str(), "r");
+    if (status != NULL)
+    {
+        char line[256];
+        while (fgets(line, sizeof(line), status) != NULL)
+        {
+            sscanf(line, "Tgid: %d", &tgid);
+            sscanf(line, "PPid: %d", &ppid);
+        }
+
+        fclose(status);
+    }
+}
+
+pid_t PTraceSandbox::ResolveNotifyingProcess(pid_t tid)
+{
+    auto knownTask = m_threadGroups.find(tid);
+    if (knownTask != m_threadGroups.end())
+    {
+        return knownTask->second;
+    }
+
+    // Notifications come from tasks, so this can be a thread of a process we already know, or a new process making its first traced syscall
+    pid_t tgid = tid;
+    pid_t ppid = 0;
+    ReadTaskStatus(tid, tgid, ppid);
+
+    m_threadGroups[tid] = tgid;
+
+    if (m_traceeTable.find(tgid) == m_traceeTable.end())
+    {
+        // The notification for fork/clone comes in before the child exists, so this is the first chance to report it
+        auto parent = m_traceeTable.find(ppid);
+        const std::string *exePath = parent != m_traceeTable.end() ? parent->second : InternExePath(m_bxl->GetProgramPath());
+
+        IOEvent event(ppid, tgid, /* traceeppid */ 0, ES_EVENT_TYPE_NOTIFY_FORK, ES_ACTION_TYPE_NOTIFY, *exePath, std::string(""), *exePath, /* mode */ 0, false, /* error */ 0);
+        m_bxl->report_access("fork", event, /* checkCache */ false);
+        m_traceeTable[tgid] = exePath;
+        if (m_sharedFdTables.find(ppid) != m_sharedFdTables.end())
         {
-            // We can ignore the ptrace-exit-stop for fork/vfork/clone/exit events here
-            ptrace(PTRACE_SYSCALL, m_traceePid, NULL, NULL);
+            // Whether the clone shared the fds of the parent is not known anymore, assume it did
+            m_sharedFdTables.insert(tgid);
         }
+
+        BXL_LOG_DEBUG(m_bxl, "[PTrace] Added new tracee with PID '%d'", tgid);
+    }
+
+    return tgid;
+}
+
+int PTraceSandbox::CompleteDirectorySyscall(int dirfd, const char *pathname, bool isCreation)
+{
+    if (m_useSeccompNotify)
+    {
+        bool exists = m_bxl->get_mode(m_bxl->normalize_path_at(dirfd, pathname, /*oflags*/0, m_traceePid).c_str()) != 0;
+        return isCreation ? (exists ? EEXIST : 0) : (exists ? 0 : ENOENT);
     }
+
+    return WaitForSyscallExit() ? GetErrno() : 0;
 }
 
 void PTraceSandbox::RemoveFromTraceeTable()
 {
-    m_traceeTable.erase(std::remove_if
-    (
-        m_traceeTable.begin(),
-        m_traceeTable.end(),
-        [this](const std::tuple<pid_t, std::string>& item) { return std::get<0>(item) == m_traceePid; }
-    ), m_traceeTable.end());
+    // Threads are not added to the table (see the clone entry of FOR_EACH_TRACED_SYSCALL), and since their
+    // creation was not reported, their exit shouldn't be either
+    if (m_traceeTable.erase(m_traceePid) > 0)
+    {
+        m_fdTables.erase(m_traceePid);
+        m_sharedFdTables.erase(m_traceePid);
+        m_bxl->SendExitReport(m_traceePid);
+    }
+}
+
+pid_t PTraceSandbox::GetFdTableOwner()
+{
+    // With seccomp notifications the current tracee already is a thread group (see ResolveNotifyingProcess)
+    if (m_useSeccompNotify || m_traceeTable.find(m_traceePid) != m_traceeTable.end())
+    {
+        return m_traceePid;
+    }
+
+    // A thread (threads are not added to the tracee table), or a vforked child that did not exec yet
+    auto knownTask = m_threadGroups.find(m_traceePid);
+    if (knownTask != m_threadGroups.end())
+    {
+        return knownTask->second;
+    }
 
-    Handleexit();
+    pid_t tgid = m_traceePid;
+    pid_t ppid = 0;
+    ReadTaskStatus(m_traceePid, tgid, ppid);
+    m_threadGroups[m_traceePid] = tgid;
+
+    return tgid;
 }
 
-void *PTraceSandbox::GetArgumentAddr(int index)
+bool PTraceSandbox::IsInterposedTracee()
 {
-    long addr = sizeof(long);
+    if (m_interposedTracees.empty() || m_traceeTable.find(m_traceePid) != m_traceeTable.end())
+    {
+        return false;
+    }
 
-    // Order of first 6 arguments: %rdi, %rsi, %rdx, %rcx, %r8, and %r9
-    switch (index) {
-        case 0: // Return value
-            addr *= RAX;
-            break;
-        case 1:
-            addr *= RDI;
-            break;
-        case 2:
-            addr *= RSI;
-            break;
-        case 3:
-            addr *= RDX;
-            break;
-        case 4:
-            addr *= R10;
-            break;
-        case 5:
-            addr *= R8;
-            break;
-        case 6:
-            addr *= R9;
-            break;
-        default:
-            // Remaining arguments should be on the stack, but for what we need
-            // the above 6 should be good enough and we should never hit this case
-            addr = 0L;
+    if (m_interposedTracees.find(m_traceePid) != m_interposedTracees.end())
+    {
+        return true;
+    }
+
+    // A thread, or a child whose creation was not seen yet (its first stop may come before the fork event of its parent,
+    // and vfork/clone3 don't stop at all). A new child runs the same image as its parent until it execs.
+    pid_t tgid = m_traceePid;
+    pid_t ppid = 0;
+    auto knownTask = m_threadGroups.find(m_traceePid);
+    if (knownTask != m_threadGroups.end())
+    {
+        tgid = knownTask->second;
+    }
+    else
+    {
+        ReadTaskStatus(m_traceePid, tgid, ppid);
+        m_threadGroups[m_traceePid] = tgid;
+    }
+
+    if (m_interposedTracees.find(tgid) != m_interposedTracees.end())
+    {
+        return true;
+    }
+
+    if (tgid == m_traceePid && m_interposedTracees.find(ppid) != m_interposedTracees.end())
+    {
+        m_interposedTracees.insert(m_traceePid);
+        return true;
+    }
+
+    return false;
+}
+
+std::string PTraceSandbox::FdToPath(int fd)
+{
+    if (!m_useFdTable || fd < 0)
+    {
+        return m_bxl->fd_to_path(fd, m_traceePid);
+    }
+
+    pid_t owner = GetFdTableOwner();
+    if (m_sharedFdTables.find(owner) != m_sharedFdTables.end())
+    {
+        return m_bxl->fd_to_path(fd, m_traceePid);
+    }
+
+    auto &fds = m_fdTables[owner];
+    auto cached = fds.find(fd);
+    if (cached != fds.end())
+    {
+        return cached->second;
+    }
+
+    std::string path = m_bxl->fd_to_path(fd, m_traceePid);
+    // An fd that can't be resolved is not open (yet), so there is nothing to remember about it
+    if (!path.empty())
+    {
+        fds.emplace(fd, path);
+    }
+
+    return path;
+}
+
+void PTraceSandbox::InvalidateFds(unsigned int firstFd, unsigned int lastFd)
+{
+    if (!m_useFdTable)
+    {
+        return;
+    }
+
+    // The fds are only forgotten once they are actually closed. Until then, other threads of the tracee could still get them resolved
+    // (and remembered) with their old paths. The tracer doesn't handle any other stop while waiting here.
+    WaitForSyscallExit();
+
+    auto fds = m_fdTables.find(GetFdTableOwner());
+    if (fds == m_fdTables.end())
+    {
+        return;
+    }
+
+    if (firstFd == lastFd)
+    {
+        fds->second.erase(firstFd);
+        return;
+    }
+
+    for (auto it = fds->second.begin(); it != fds->second.end(); )
+    {
+        unsigned int fd = it->first;
+        it = fd >= firstFd && fd <= lastFd ? fds->second.erase(it) : std::next(it);
+    }
+}
+
+bool PTraceSandbox::WaitForSyscallExit()
+{
+    // At a seccomp stop the syscall has not run yet. PTRACE_SYSCALL makes the tracee stop again once it returns (the stop has bit 7 set
+    // because of PTRACE_O_TRACESYSGOOD). Fork/clone events of the syscall come in before that.
+    int status = 0;
+    int signal = 0;
+    while (true)
+    {
+        ptrace(PTRACE_SYSCALL, m_traceePid, NULL, signal);
+        if (waitpid(m_traceePid, &status, __WALL) == -1 || !WIFSTOPPED(status))
+        {
+            // The tracee is gone (e.g., it was killed while running the syscall)
+            m_registersValid = false;
+            return false;
+        }
+
+        if (WSTOPSIG(status) == (SIGTRAP | 0x80))
+        {
             break;
+        }
+
+        // Signals must still be delivered, event stops are just stepped over
+        signal = (status >> 16) == 0 ? WSTOPSIG(status) : 0;
+    }
+
+    // The registers changed when the syscall ran
+    return FetchRegisters();
+}
+
+void PTraceSandbox::ResumeTracee()
+{
+    if (!m_useSeccompNotify)
+    {
+        m_registersValid = false;
+        m_traceeResumed = true;
+        ptrace(PTRACE_CONT, m_traceePid, NULL, 0);
+    }
+}
+
+bool PTraceSandbox::FetchRegisters()
+{
+    m_registersValid = ptrace(PTRACE_GETREGS, m_traceePid, NULL, &m_registers) != -1;
+    if (!m_registersValid)
+    {
+        BXL_LOG_DEBUG(m_bxl, "[PTrace] PTRACE_GETREGS failed for PID '%d': '%s'", m_traceePid, strerror(errno));
     }
 
-    return (void *)addr;
+    return m_registersValid;
 }
 
 std::string PTraceSandbox::ReadArgumentString(char *syscall, int argumentIndex, bool nullTerminated, int length)
 {
-    void *addr = GetArgumentAddr(argumentIndex);
+    char *addrRegValue = (char *)ReadArgumentLong(argumentIndex);
+
     // We are only interested in reading paths from the arguments so PATH_MAX (+1 for null terminator) should be safe to use here
+    size_t maxLength = length > 0 ? std::min(length, PATH_MAX) : PATH_MAX;
+
+    if (m_processVmReadvSupported)
+    {
+        char argument[PATH_MAX + 1];
+        ssize_t bytesRead = ReadTraceeString(syscall, argumentIndex, addrRegValue, argument, maxLength, nullTerminated);
+        if (bytesRead != -1)
+        {
+            argument[bytesRead] = '\0';
+            return std::string(argument);
+        }
+    }
+
+    if (m_useSeccompNotify)
+    {
+        // Tracees are not ptrace-attached in this mode, so there is nothing to fall back to
+        BXL_LOG_DEBUG(m_bxl, "[PTrace] Could not read argument '%d' for syscall '%s'", argumentIndex, syscall);
+        return std::string();
+    }
+
+    return PeekArgumentString(syscall, argumentIndex, addrRegValue, nullTerminated, maxLength);
+}
+
+ssize_t PTraceSandbox::ReadTraceeString(char *syscall, int argumentIndex, const char *remoteAddr, char *buffer, size_t maxLength, bool nullTerminated)
+{
+    static const size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t totalRead = 0;
+
+    while (totalRead < maxLength)
+    {
+        // Read up to the end of the current page only: the string may end right before an unmapped page,
+        // and process_vm_readv does not do partial reads within a single remote iovec
+        uintptr_t current = (uintptr_t)remoteAddr + totalRead;
+        size_t toRead = std::min(maxLength - totalRead, pageSize - (current % pageSize));
+
+        struct iovec local = { .iov_base = buffer + totalRead, .iov_len = toRead };
+        struct iovec remote = { .iov_base = (void *)current, .iov_len = toRead };
+        ssize_t bytesRead = process_vm_readv(m_traceePid, &local, 1, &remote, 1, 0);
+
+        if (bytesRead == -1)
+        {
+            if (totalRead == 0 && (errno == ENOSYS || errno == EPERM))
+            {
+                // Not available on this kernel or not allowed (e.g., by a security module): peek from now on
+                BXL_LOG_DEBUG(m_bxl, "[PTrace] process_vm_readv is not available, falling back to PTRACE_PEEKTEXT: '%s'", strerror(errno));
+                m_processVmReadvSupported = false;
+                return -1;
+            }
+
+            BXL_LOG_DEBUG(m_bxl, "[PTrace] Error occured while executing process_vm_readv for syscall '%s' argument '%d' : '%s'", syscall, argumentIndex, strerror(errno));
+            break;
+        }
+
+        if (nullTerminated)
+        {
+            char *terminator = (char *)memchr(buffer + totalRead, '\0', bytesRead);
+            if (terminator != nullptr)
+            {
+                return terminator - buffer;
+            }
+        }
+
+        totalRead += bytesRead;
+        if (bytesRead < toRead)
+        {
+            break;
+        }
+    }
+
+    return totalRead;
+}
+
+std::string PTraceSandbox::PeekArgumentString(char *syscall, int argumentIndex, char *addrRegValue, bool nullTerminated, int length)
+{
     char argument[PATH_MAX + 1];
-    char *addrRegValue = (char *)ptrace(PTRACE_PEEKUSER, m_traceePid, addr, 0);
     int currentStringLength = 0;
 
     while (true)
@@ -369,7 +1011,7 @@ std::string PTraceSandbox::ReadArgumentString(char *syscall, int argumentIndex,
             argument[currentStringLength] = *currentArgReadChar;
             currentStringLength++;
 
-            if ((nullTerminated && *currentArgReadChar == '\0') || (length > 0 && currentStringLength == length))
+            if ((nullTerminated && *currentArgReadChar == '\0') || currentStringLength == length)
             {
                 finishedReadingArgument = true;
                 break;
@@ -390,8 +1032,60 @@ std::string PTraceSandbox::ReadArgumentString(char *syscall, int argumentIndex,
 
 unsigned long PTraceSandbox::ReadArgumentLong(int argumentIndex)
 {
-    void *addr = GetArgumentAddr(argumentIndex);
-    return ptrace(PTRACE_PEEKUSER, m_traceePid, addr, NULL);
+    if (m_currentNotification != nullptr)
+    {
+        // Notifications are sent before the syscall runs, so there is no return value yet
+        return argumentIndex >= 1 && argumentIndex <= 6 ? m_currentNotification->data.args[argumentIndex - 1] : 0;
+    }
+
+    if (!m_registersValid && !FetchRegisters())
+    {
+        return 0;
+    }
+
+    // Order of first 6 arguments: %rdi, %rsi, %rdx, %r10, %r8, and %r9
+    switch (argumentIndex)
+    {
+        case 0: // Return value
+            return m_registers.rax;
+        case 1:
+            return m_registers.rdi;
+        case 2:
+            return m_registers.rsi;
+        case 3:
+            return m_registers.rdx;
+        case 4:
+            return m_registers.r10;
+        case 5:
+            return m_registers.r8;
+        case 6:
+            return m_registers.r9;
+        default:
+            // Remaining arguments should be on the stack, but for what we need
+            // the above 6 should be good enough and we should never hit this case
+            return 0;
+    }
+}
+
+bool PTraceSandbox::WriteArgumentLong(int argumentIndex, unsigned long value)
+{
+    if (m_useSeccompNotify || (!m_registersValid && !FetchRegisters()))
+    {
+        return false;
+    }
+
+    switch (argumentIndex)
+    {
+        case 1: m_registers.rdi = value; break;
+        case 2: m_registers.rsi = value; break;
+        case 3: m_registers.rdx = value; break;
+        case 4: m_registers.r10 = value; break;
+        case 5: m_registers.r8 = value; break;
+        case 6: m_registers.r9 = value; break;
+        default: return false;
+    }
+
+    return ptrace(PTRACE_SETREGS, m_traceePid, NULL, &m_registers) != -1;
 }
 
 int PTraceSandbox::GetErrno()
@@ -405,55 +1099,7 @@ void PTraceSandbox::HandleSysCallGeneric(int syscallNumber)
 {
     switch (syscallNumber)
     {
-        CHECK_AND_CALL_HANDLER(execveat);
-        CHECK_AND_CALL_HANDLER(execve);
-        CHECK_AND_CALL_HANDLER(stat);
-        CHECK_AND_CALL_HANDLER(lstat);
-        CHECK_AND_CALL_HANDLER(fstat);
-        CHECK_AND_CALL_HANDLER_NEW(fstatat);
-        CHECK_AND_CALL_HANDLER(access);
-        CHECK_AND_CALL_HANDLER(faccessat);
-        CHECK_AND_CALL_HANDLER(creat);
-        CHECK_AND_CALL_HANDLER(open);
-        CHECK_AND_CALL_HANDLER(openat);
-        CHECK_AND_CALL_HANDLER(write);
-        CHECK_AND_CALL_HANDLER(writev);
-        CHECK_AND_CALL_HANDLER(pwritev);
-        CHECK_AND_CALL_HANDLER(pwritev2);
-        CHECK_AND_CALL_HANDLER(pwrite64);
-        CHECK_AND_CALL_HANDLER(truncate);
-        CHECK_AND_CALL_HANDLER(ftruncate);
-        CHECK_AND_CALL_HANDLER(rmdir);
-        CHECK_AND_CALL_HANDLER(rename);
-        CHECK_AND_CALL_HANDLER(renameat);
-        CHECK_AND_CALL_HANDLER(link);
-        CHECK_AND_CALL_HANDLER(linkat);
-        CHECK_AND_CALL_HANDLER(unlink);
-        CHECK_AND_CALL_HANDLER(unlinkat);
-        CHECK_AND_CALL_HANDLER(symlink);
-        CHECK_AND_CALL_HANDLER(symlinkat);
-        CHECK_AND_CALL_HANDLER(readlink);
-        CHECK_AND_CALL_HANDLER(readlinkat);
-        CHECK_AND_CALL_HANDLER(utime);
-        CHECK_AND_CALL_HANDLER(utimes);
-        CHECK_AND_CALL_HANDLER(utimensat);
-        CHECK_AND_CALL_HANDLER(futimesat);
-        CHECK_AND_CALL_HANDLER(mkdir);
-        CHECK_AND_CALL_HANDLER(mkdirat);
-        CHECK_AND_CALL_HANDLER(mknod);
-        CHECK_AND_CALL_HANDLER(mknodat);
-        CHECK_AND_CALL_HANDLER(chmod);
-        CHECK_AND_CALL_HANDLER(fchmod);
-        CHECK_AND_CALL_HANDLER(fchmodat);
-        CHECK_AND_CALL_HANDLER(chown);
-        CHECK_AND_CALL_HANDLER(fchown);
-        CHECK_AND_CALL_HANDLER(lchown);
-        CHECK_AND_CALL_HANDLER(fchownat);
-        CHECK_AND_CALL_HANDLER(sendfile);
-        CHECK_AND_CALL_HANDLER(copy_file_range);
-        CHECK_AND_CALL_HANDLER(name_to_handle_at);
-        CHECK_AND_CALL_HANDLER(fork);
-        CHECK_AND_CALL_HANDLER(clone);
+        FOR_EACH_TRACED_SYSCALL(CHECK_AND_CALL_HANDLER)
         default:
             // This should not happen in theory with filtering enabled
             // However if it does occur, we can ignore this syscall and log a message for debugging if necessary
@@ -478,7 +1124,7 @@ void PTraceSandbox::ReportOpen(std::string path, int oflag, std::string syscallN
         ES_ACTION_TYPE_NOTIFY,
         path,
         /* dest */ "",
-        m_bxl->GetProgramPath(),
+        GetTraceeExePath(),
         pathMode,
         /* modified */ false,
         /* error */ 0
@@ -497,7 +1143,7 @@ void PTraceSandbox::ReportCreate(std::string syscallName, int dirfd, const char
         ES_ACTION_TYPE_NOTIFY,
         m_bxl->normalize_path_at(dirfd, pathname, /*oflags*/0, m_traceePid),
         /* dest */ "",
-        m_bxl->GetProgramPath(),
+        GetTraceeExePath(),
         mode,
         /* modified */ false,
         /* error */ returnValue
@@ -506,22 +1152,20 @@ void PTraceSandbox::ReportCreate(std::string syscallName, int dirfd, const char
     m_bxl->report_access(syscallName.c_str(), event, checkCache);
 }
 
-std::vector<std::tuple<pid_t, std::string>>::iterator PTraceSandbox::FindProcess(pid_t pid)
+void PTraceSandbox::UpdateTraceeTableForExec(const std::string &exePath)
 {
-    return std::find_if
-    (
-        m_traceeTable.begin(),
-        m_traceeTable.end(),
-        [pid](const std::tuple<pid_t, std::string>& item) { return std::get<0>(item) == pid; }
-    );
-}
+    if (m_useFdTable)
+    {
+        // Exec closes the fds opened with O_CLOEXEC (which are not tracked), and stops sharing fds with any other process
+        pid_t owner = GetFdTableOwner();
+        m_fdTables.erase(owner);
+        m_sharedFdTables.erase(owner);
+    }
 
-void PTraceSandbox::UpdateTraceeTableForExec(std::string exePath)
-{
-    auto maybeProcess = FindProcess(m_traceePid);
+    auto maybeProcess = m_traceeTable.find(m_traceePid);
     if (maybeProcess != m_traceeTable.end())
     {
-        std::get<1>(maybeProcess[0]) = exePath;
+        maybeProcess->second = InternExePath(exePath);
     }
     else
     {
@@ -540,12 +1184,182 @@ void PTraceSandbox::UpdateTraceeTableForExec(std::string exePath)
         // which ptrace can't handle because it's blocked on the waitpid for the parent.
         IOEvent event(m_traceePid, m_traceePid, /* traceeppid */ 0, ES_EVENT_TYPE_NOTIFY_FORK, ES_ACTION_TYPE_NOTIFY, exePath, std::string(""), exePath, /* mode */ 0, false, /* error */ 0);
         m_bxl->report_access("vfork", event, /* checkCache */ false);
-        m_traceeTable.push_back(std::make_tuple(m_traceePid, exePath));
+        m_traceeTable.emplace(m_traceePid, InternExePath(exePath));
 
         BXL_LOG_DEBUG(m_bxl, "[PTrace] Added new tracee with PID '%d'", m_traceePid);
     }
 }
 
+void PTraceSandbox::HandleExec(const char *syscall, const std::string &exePath, int envpArgumentIndex)
+{
+    bool interposed = IsInterposedTracee();
+    bool takenOver = false;
+    if (m_handBackToInterposer)
+    {
+        // execve takes paths relative to the working directory of the tracee
+        std::string resolvedPath = !exePath.empty() && exePath[0] == '/' ? exePath : m_bxl->normalize_path_at(AT_FDCWD, exePath.c_str(), /* oflags */ 0, m_traceePid);
+        bool interposable = m_bxl->is_interposable(resolvedPath.c_str());
+
+        if (interposed && interposable)
+        {
+            // The interposer made sure the new image preloads it as well (see BxlObserver::ensureEnvs), and reports the exec
+            return;
+        }
+
+        unsigned long originalEnvp = 0;
+        if (interposed || (interposable && InjectInterposer(syscall, envpArgumentIndex, originalEnvp)))
+        {
+            if (!WaitForSyscallExit())
+            {
+                return;
+            }
+
+            if (GetErrno() == 0 && interposed)
+            {
+                // Nothing in the new image reports what it does, so the tracer takes over again. The interposer only reports failed execs.
+                m_interposedTracees.erase(m_traceePid);
+                m_traceeTable[m_traceePid] = InternExePath(exePath);
+                takenOver = true;
+            }
+            else if (GetErrno() == 0)
+            {
+                // Records the process in case it was never reported (see UpdateTraceeTableForExec), before the interposer takes over.
+                // The interposer reports the exec when it initializes, and the exit of the process.
+                UpdateTraceeTableForExec(exePath);
+                m_traceeTable.erase(m_traceePid);
+                m_interposedTracees.insert(m_traceePid);
+                BXL_LOG_DEBUG(m_bxl, "[PTrace] Handed tracee '%d' back to the interposer after exec'ing '%s'", m_traceePid, resolvedPath.c_str());
+                return;
+            }
+            else if (interposed)
+            {
+                return;
+            }
+            else
+            {
+                // Syscalls preserve their argument registers, so the failed exec must not leave the rewritten environment behind
+                WriteArgumentLong(envpArgumentIndex, originalEnvp);
+            }
+        }
+    }
+
+    if (!takenOver)
+    {
+        UpdateTraceeTableForExec(exePath);
+    }
+
+    char mutableExePath[exePath.length() + 1];
+    strcpy(mutableExePath, exePath.c_str());
+    m_bxl->report_exec(syscall, basename(mutableExePath), exePath.c_str(), /* error*/ 0, /* mode */ 0, m_traceePid);
+}
+
+bool PTraceSandbox::InjectInterposer(const char *syscall, int envpArgumentIndex, unsigned long &originalEnvp)
+{
+    // Only the pointers of the entries that are kept are copied, the entries themselves are referenced where they are
+    static const size_t MaxEntries = 4096;
+
+    originalEnvp = ReadArgumentLong(envpArgumentIndex);
+    if (originalEnvp == 0 || !m_processVmReadvSupported || !m_registersValid)
+    {
+        return false;
+    }
+
+    std::vector<unsigned long> entries;
+    std::string detoursPath;
+    std::string preload;
+    bool hasFamPath = false;
+
+    auto readEntry = [&](unsigned long address, char *buffer, size_t maxLength)
+    {
+        ssize_t length = ReadTraceeString((char *)syscall, envpArgumentIndex, (const char *)address, buffer, maxLength, /* nullTerminated */ true);
+        buffer[length > 0 ? length : 0] = '\0';
+        return length;
+    };
+
+    auto hasName = [](const char *entry, const char *name)
+    {
+        size_t length = strlen(name);
+        return strncmp(entry, name, length) == 0 && entry[length] == '=';
+    };
+
+    unsigned long chunk[64];
+    bool terminated = false;
+    for (unsigned long next = originalEnvp; !terminated && entries.size() < MaxEntries; next += sizeof(chunk))
+    {
+        ssize_t bytesRead = ReadTraceeString((char *)syscall, envpArgumentIndex, (const char *)next, (char *)chunk, sizeof(chunk), /* nullTerminated */ false);
+        size_t count = bytesRead > 0 ? bytesRead / sizeof(unsigned long) : 0;
+        if (count == 0)
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < count && !terminated; i++)
+        {
+            terminated = chunk[i] == 0;
+            if (terminated)
+            {
+                break;
+            }
+
+            // Names are short, so the start of an entry tells which one it is
+            char prefix[64];
+            readEntry(chunk[i], prefix, sizeof(prefix) - 1);
+
+            if (hasName(prefix, "LD_PRELOAD") || hasName(prefix, BxlEnvDetoursPath))
+            {
+                char value[PATH_MAX + 1];
+                if (readEntry(chunk[i], value, PATH_MAX) >= PATH_MAX)
+                {
+                    return false;
+                }
+
+                (hasName(prefix, "LD_PRELOAD") ? preload : detoursPath) = strchr(value, '=') + 1;
+            }
+
+            hasFamPath |= hasName(prefix, BxlEnvFamPath);
+
+            // The previous LD_PRELOAD is folded into the one added below, and the marker is added once
+            if (!hasName(prefix, "LD_PRELOAD") && !hasName(prefix, BxlPTraceInterposed))
+            {
+                entries.push_back(chunk[i]);
+            }
+        }
+    }
+
+    // Without these the interposer could not find the manifest of the pip (see BxlObserver::ensureEnvs)
+    if (!terminated || !hasFamPath || detoursPath.empty() || !m_processVmReadvSupported)
+    {
+        return false;
+    }
+
+    std::string preloadEntry = "LD_PRELOAD=" + (preload.find(detoursPath) != std::string::npos ? preload : preload.empty() ? detoursPath : detoursPath + ":" + preload);
+    std::string markerEntry = std::string(BxlPTraceInterposed) + "=1";
+
+    size_t pointersSize = (entries.size() + 3) * sizeof(unsigned long);
+    size_t size = pointersSize + preloadEntry.size() + 1 + markerEntry.size() + 1;
+
+    // Below the red zone of the stack, which is free for the taking at a syscall (signal handlers get their frames there too)
+    unsigned long address = (m_registers.rsp - 128 - size) & ~15UL;
+    entries.push_back(address + pointersSize);
+    entries.push_back(address + pointersSize + preloadEntry.size() + 1);
+    entries.push_back(0);
+
+    std::vector<char> block(size);
+    memcpy(block.data(), entries.data(), pointersSize);
+    memcpy(block.data() + pointersSize, preloadEntry.c_str(), preloadEntry.size() + 1);
+    memcpy(block.data() + pointersSize + preloadEntry.size() + 1, markerEntry.c_str(), markerEntry.size() + 1);
+
+    struct iovec local = { .iov_base = block.data(), .iov_len = size };
+    struct iovec remote = { .iov_base = (void *)address, .iov_len = size };
+    if (process_vm_writev(m_traceePid, &local, 1, &remote, 1, 0) != (ssize_t)size)
+    {
+        BXL_LOG_DEBUG(m_bxl, "[PTrace] Could not write the environment of tracee '%d' for syscall '%s': '%s'", m_traceePid, syscall, strerror(errno));
+        return false;
+    }
+
+    return WriteArgumentLong(envpArgumentIndex, address);
+}
+
 // Syscall Handlers
 HANDLER_FUNCTION(execveat)
 {
@@ -556,25 +1370,14 @@ HANDLER_FUNCTION(execveat)
 
     int oflags = (flags & AT_SYMLINK_NOFOLLOW) ? O_NOFOLLOW : 0;
     std::string exePath = m_bxl->normalize_path_at(dirfd, pathname.c_str(), oflags, m_traceePid);
-    char mutableExePath[exePath.length() + 1];
-
-    strcpy(mutableExePath, exePath.c_str());
 
-    UpdateTraceeTableForExec(exePath);
-
-    m_bxl->report_exec(SYSCALL_NAME_STRING(execveat), basename(mutableExePath), exePath.c_str(), /* error*/ 0, /* mode */ 0, m_traceePid);
+    HandleExec(SYSCALL_NAME_STRING(execveat), exePath, /* envpArgumentIndex */ 4);
 }
 
 HANDLER_FUNCTION(execve)
 {
     std::string file = ReadArgumentString(SYSCALL_NAME_STRING(execve), 1, /*nullTerminated*/ true);
-    char mutableFilePath[file.length() + 1];
-
-    strcpy(mutableFilePath, file.c_str());
-
-    UpdateTraceeTableForExec(file);
-
-    m_bxl->report_exec(SYSCALL_NAME_STRING(execve), basename(mutableFilePath), file.c_str(), /* error*/ 0, /* mode */ 0, m_traceePid);
+    HandleExec(SYSCALL_NAME_STRING(execve), file, /* envpArgumentIndex */ 3);
 }
 
 HANDLER_FUNCTION(stat)
@@ -597,7 +1400,7 @@ HANDLER_FUNCTION(fstat)
 
 // NOTE: This stat function is not interposed by the Linux sandbox normally
 // However, when calling stat, the final call to the kernel may be this one rather than stat which is why we intercept this
-HANDLER_FUNCTION_NEW(fstatat)
+HANDLER_FUNCTION(newfstatat)
 {
     auto dirfd = ReadArgumentLong(1);
     auto pathname = ReadArgumentString(SYSCALL_NAME_STRING(fstatat), 2, /*nullTerminated*/ true);
@@ -647,7 +1450,7 @@ HANDLER_FUNCTION(openat)
 
 void PTraceSandbox::HandleReportAccessFd(const char *syscall, int fd, es_event_type_t event /*ES_EVENT_TYPE_NOTIFY_WRITE*/)
 {
-    auto path = m_bxl->fd_to_path(fd, m_traceePid);
+    auto path = FdToPath(fd);
 
     // Readlink returns type:[inode] if the path is not a file (files will return absolute paths)
     if (path[0] == '/')
@@ -703,12 +1506,10 @@ HANDLER_FUNCTION(rmdir)
     auto path = ReadArgumentString(SYSCALL_NAME_STRING(rmdir), 1, /*nullTerminated*/ true);
 
     // See comment about the need to propagate the returned value under HANDLER_FUNCTION(mkdir)
-    int status = 0;
-    ptrace(PTRACE_SYSCALL, m_traceePid, NULL, NULL);
-    waitpid(m_traceePid, &status, 0);
+    int error = CompleteDirectorySyscall(AT_FDCWD, path.c_str(), /* isCreation */ false);
 
     // We don't want to use the cache since we want to distinguish between creation and deletion of directories
-    m_bxl->report_access(SYSCALL_NAME_STRING(rmdir), ES_EVENT_TYPE_NOTIFY_UNLINK, path.c_str(), m_emptyStr, /*mode*/ S_IFDIR, /* error */ GetErrno(), /*checkCache */ false, m_traceePid);
+    m_bxl->report_access(SYSCALL_NAME_STRING(rmdir), ES_EVENT_TYPE_NOTIFY_UNLINK, path.c_str(), m_emptyStr, /*mode*/ S_IFDIR, /* error */ error, /*checkCache */ false, m_traceePid);
 }
 
 HANDLER_FUNCTION(rename)
@@ -745,24 +1546,21 @@ void PTraceSandbox::HandleRenameGeneric(const char *syscall, int olddirfd, const
     string newStr = m_bxl->normalize_path_at(newdirfd, newpath, O_NOFOLLOW, m_traceePid);
 
     mode_t mode = m_bxl->get_mode(oldStr.c_str());    
-    std::vector<std::string> filesAndDirectories;
     
     if (S_ISDIR(mode))
     {
-        bool enumerateResult = m_bxl->EnumerateDirectory(oldStr, /*recursive*/ true, filesAndDirectories);
-        if (enumerateResult)
+        std::string target;
+        m_bxl->EnumerateDirectory(oldStr, /*recursive*/ true, [&](const std::string &fileOrDirectory, mode_t entryMode)
         {
-            for (auto fileOrDirectory : filesAndDirectories)
-            {
-                // Source
-                auto mode = m_bxl->get_mode(fileOrDirectory.c_str());
-                m_bxl->report_access(syscall, ES_EVENT_TYPE_NOTIFY_UNLINK, fileOrDirectory.c_str(), mode, O_NOFOLLOW, /* error */ 0, /* checkCache */ true, m_traceePid);
-
-                // Destination
-                fileOrDirectory.replace(0, oldStr.length(), newStr);
-                ReportOpen(fileOrDirectory, O_CREAT, std::string(syscall));
-            }
-        }
+            // Source (the file type comes from the enumeration, it is only missing when the entry is gone)
+            auto mode = entryMode != 0 ? entryMode : m_bxl->get_mode(fileOrDirectory.c_str());
+            m_bxl->report_access(syscall, ES_EVENT_TYPE_NOTIFY_UNLINK, fileOrDirectory.c_str(), mode, O_NOFOLLOW, /* error */ 0, /* checkCache */ true, m_traceePid);
+
+            // Destination
+            target.assign(newStr).append(fileOrDirectory, oldStr.length(), std::string::npos);
+            ReportOpen(target, O_CREAT, std::string(syscall));
+            return true;
+        });
     }
     else
     {
@@ -780,11 +1578,14 @@ HANDLER_FUNCTION(link)
     auto oldpath = ReadArgumentString(SYSCALL_NAME_STRING(link), 1, /*nullTerminated*/ true);
     auto newpath = ReadArgumentString(SYSCALL_NAME_STRING(link), 2, /*nullTerminated*/ true);
 
+    std::string source;
+    std::string destination;
+    m_bxl->normalize_link_paths(AT_FDCWD, oldpath.c_str(), AT_FDCWD, newpath.c_str(), /* flags */ 0, source, destination, m_traceePid);
     m_bxl->report_access(
         SYSCALL_NAME_STRING(link),
         ES_EVENT_TYPE_NOTIFY_LINK,
-        m_bxl->normalize_path(oldpath.c_str(), O_NOFOLLOW, m_traceePid).c_str(),
-        m_bxl->normalize_path(newpath.c_str(), O_NOFOLLOW, m_traceePid).c_str(), 
+        source.c_str(),
+        destination.c_str(),
         /* mode */ 0,
         /* error */ 0,
         /* checkCache */ true,
@@ -797,12 +1598,16 @@ HANDLER_FUNCTION(linkat)
     auto oldpath = ReadArgumentString(SYSCALL_NAME_STRING(linkat), 2, /*nullTerminated*/ true);
     auto newdirfd = ReadArgumentLong(3);
     auto newpath = ReadArgumentString(SYSCALL_NAME_STRING(linkat), 4, /*nullTerminated*/ true);
+    auto flags = ReadArgumentLong(5);
 
+    std::string source;
+    std::string destination;
+    m_bxl->normalize_link_paths(olddirfd, oldpath.c_str(), newdirfd, newpath.c_str(), flags, source, destination, m_traceePid);
     m_bxl->report_access(
         SYSCALL_NAME_STRING(linkat),
         ES_EVENT_TYPE_NOTIFY_LINK,
-        m_bxl->normalize_path_at(olddirfd, oldpath.c_str(), O_NOFOLLOW, m_traceePid).c_str(),
-        m_bxl->normalize_path_at(newdirfd, newpath.c_str(), O_NOFOLLOW, m_traceePid).c_str(),
+        source.c_str(),
+        destination.c_str(),
         /* mode */ 0,
         /* error */ 0,
         /* checkCache */ true,
@@ -846,7 +1651,7 @@ HANDLER_FUNCTION(symlink)
         ES_ACTION_TYPE_NOTIFY,
         m_bxl->normalize_path(linkPath.c_str(), O_NOFOLLOW, m_traceePid),
         /* dest */ "",
-        m_bxl->GetProgramPath(),
+        GetTraceeExePath(),
         S_IFLNK,
         /* modified */ false,
         /* error */ 0
@@ -869,7 +1674,7 @@ HANDLER_FUNCTION(symlinkat)
         ES_ACTION_TYPE_NOTIFY,
         m_bxl->normalize_path_at(dirfd, linkPath.c_str(), O_NOFOLLOW, m_traceePid),
         /* dest */ "",
-        m_bxl->GetProgramPath(),
+        GetTraceeExePath(),
         S_IFLNK,
         /* modified */ false,
         /* error */ 0
@@ -933,12 +1738,10 @@ HANDLER_FUNCTION(mkdir)
     // report since on managed side bxl needs to understand whether the directory creation succeeded.
     // This is used to determine whether a directory was created by the build, which is an input for 
     // optimizations related to computing directory fingerprints in ObserverdInputProcessor
-    int status = 0;
-    ptrace(PTRACE_SYSCALL, m_traceePid, NULL, NULL);
-    waitpid(m_traceePid, &status, 0);
+    int error = CompleteDirectorySyscall(AT_FDCWD, path.c_str(), /* isCreation */ true);
 
     // We don't want to use the cache since we want to distinguish between creation and deletion of directories
-    ReportCreate(SYSCALL_NAME_STRING(mkdir), AT_FDCWD, path.c_str(), S_IFDIR, GetErrno(), /* checkCache */ false);
+    ReportCreate(SYSCALL_NAME_STRING(mkdir), AT_FDCWD, path.c_str(), S_IFDIR, error, /* checkCache */ false);
 }
 
 HANDLER_FUNCTION(mkdirat)
@@ -947,12 +1750,10 @@ HANDLER_FUNCTION(mkdirat)
     auto path = ReadArgumentString(SYSCALL_NAME_STRING(mkdirat), 2, /*nullTerminated*/ true);
 
     // See comment about the need to propagate the returned value under HANDLER_FUNCTION(mkdir)
-    int status = 0;
-    ptrace(PTRACE_SYSCALL, m_traceePid, NULL, NULL);
-    waitpid(m_traceePid, &status, 0);
+    int error = CompleteDirectorySyscall(dirfd, path.c_str(), /* isCreation */ true);
 
     // We don't want to use the cache since we want to distinguish between creation and deletion of directories
-    ReportCreate(SYSCALL_NAME_STRING(mkdirat), dirfd, path.c_str(), S_IFDIR, GetErrno(), /* checkCache */ false);
+    ReportCreate(SYSCALL_NAME_STRING(mkdirat), dirfd, path.c_str(), S_IFDIR, error, /* checkCache */ false);
 }
 
 HANDLER_FUNCTION(mknod)
@@ -1049,40 +1850,48 @@ HANDLER_FUNCTION(name_to_handle_at)
 
 void PTraceSandbox::HandleChildProcess(const char *syscall)
 {
-    int status = 0;
-    ptrace(PTRACE_SYSCALL, m_traceePid, NULL, NULL);
-    waitpid(m_traceePid, &status, 0);
+    if (m_useSeccompNotify)
+    {
+        // The child does not exist yet when this notification comes in. It gets reported on its first notification instead (see ResolveNotifyingProcess).
+        return;
+    }
 
-    if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_CLONE << 8))
-        || status >> 8 == (SIGTRAP | (PTRACE_EVENT_FORK << 8)))
+    if (!WaitForSyscallExit())
     {
-        ptrace(PTRACE_SYSCALL, m_traceePid, NULL, NULL);
-        waitpid(m_traceePid, &status, 0);
+        return;
     }
-    
+
     long childpid = ReadArgumentLong(0);
 
+    // The rest only updates the state of the tracer and reports the new process, which the parent doesn't have to wait for
+    ResumeTracee();
+
     // Find the parent pid for this tracee
-    auto maybeParent = FindProcess(m_traceePid);
-    std::string exePath;
+    auto maybeParent = m_traceeTable.find(m_traceePid);
+    const std::string *exePath;
     
     // Best effort to get the ppid/exe of the tracee here. There's no nice way to do this from outside the process
     if (maybeParent != m_traceeTable.end())
     {
-        exePath = std::get<1>(maybeParent[0]);
+        exePath = maybeParent->second;
     }
     else
     {
         // This case isn't expected to happen as long as ptrace works properly, but in case it does, we will report 0 as the ppid.
-        exePath = m_bxl->GetProgramPath();
+        exePath = InternExePath(m_bxl->GetProgramPath());
     }
 
-    IOEvent event(m_traceePid, childpid, /* traceeppid */ 0, ES_EVENT_TYPE_NOTIFY_FORK, ES_ACTION_TYPE_NOTIFY, exePath, std::string(""), exePath, /* mode */ 0, false, /* error */ 0);
+    IOEvent event(m_traceePid, childpid, /* traceeppid */ 0, ES_EVENT_TYPE_NOTIFY_FORK, ES_ACTION_TYPE_NOTIFY, *exePath, std::string(""), *exePath, /* mode */ 0, false, /* error */ 0);
     m_bxl->report_access(syscall, event, /* checkCache */ false);
 
     // Record the new child tracee
     // When PTRACE_O_TRACEFORK/CLONE/VFORK is set, the child process is automatically ptraced as well
-    m_traceeTable.push_back(std::make_tuple(childpid, exePath));
+    m_traceeTable[childpid] = exePath;
+    if (m_sharedFdTables.find(m_traceePid) != m_sharedFdTables.end())
+    {
+        // Same as the parent, see the clone handler
+        m_sharedFdTables.insert(childpid);
+    }
 
     BXL_LOG_DEBUG(m_bxl, "[PTrace] Added new tracee with PID '%d'", childpid);
 }
@@ -1094,10 +1903,58 @@ HANDLER_FUNCTION(fork)
 
 HANDLER_FUNCTION(clone)
 {
+    if (m_useFdTable && (ReadArgumentLong(1) & CLONE_FILES))
+    {
+        // The child gets to change the fds of the parent (and vice versa). The child pid is not known with seccomp notifications, so
+        // every child of the parent from here on is assumed to share its fds (which is always safe).
+        m_sharedFdTables.insert(GetFdTableOwner());
+    }
+
     HandleChildProcess(SYSCALL_NAME_STRING(clone));
 }
 
-HANDLER_FUNCTION(exit)
+HANDLER_FUNCTION(close)
+{
+    unsigned int fd = ReadArgumentLong(1);
+    InvalidateFds(fd, fd);
+}
+
+HANDLER_FUNCTION(close_range)
 {
-    m_bxl->SendExitReport(m_traceePid);
+    unsigned int firstFd = ReadArgumentLong(1);
+    unsigned int lastFd = ReadArgumentLong(2);
+    unsigned int flags = ReadArgumentLong(3);
+
+    // With CLOSE_RANGE_CLOEXEC the fds are only closed on exec, which forgets about every fd anyway
+    if (!(flags & CLOSE_RANGE_CLOEXEC))
+    {
+        InvalidateFds(firstFd, lastFd);
+    }
+}
+
+HANDLER_FUNCTION(dup2)
+{
+    unsigned int newFd = ReadArgumentLong(2);
+    InvalidateFds(newFd, newFd);
+}
+
+HANDLER_FUNCTION(dup3)
+{
+    unsigned int newFd = ReadArgumentLong(2);
+    InvalidateFds(newFd, newFd);
+}
+
+HANDLER_FUNCTION(exit_group)
+{
+    // With ptrace, process exits are handled on PTRACE_EVENT_EXIT instead
+    if (m_useSeccompNotify)
+    {
+        RemoveFromTraceeTable();
+
+        // Forget about the threads of the process, their ids can be reused by new processes
+        for (auto it = m_threadGroups.begin(); it != m_threadGroups.end(); )
+        {
+            it = it->second == m_traceePid ? m_threadGroups.erase(it) : std::next(it);
+        }
+    }
 }
\ No newline at end of file
@@ -4,12 +4,88 @@
 #pragma once
 
 #include "bxl_observer.hpp"
+#include <sys/user.h>
 
 typedef void (*HandlerFunction)(void);
 
 #define MAKE_HANDLER_FN_NAME(syscallName) Handle##syscallName
 #define MAKE_HANDLER_FN_DEF(syscallName) void MAKE_HANDLER_FN_NAME(syscallName) ()
-#define MAKE_HANDLER_FN_DEF_NEW(syscallName) MAKE_HANDLER_FN_DEF(new##syscallName)
+
+/**
+ * Every syscall the tracer stops on: X(name, selector, skipFlags). The seccomp filter, the handler declarations and the dispatch in
+ * PTraceSandbox::HandleSysCallGeneric are all generated from this list, so a syscall can't be selected by the filter without being
+ * dispatched to its handler (the build fails to link if the handler is missing).
+ *
+ * name:      the name the kernel knows the syscall by (some only exist as "new" variants, e.g., newfstatat)
+ * selector:  Always, or FdTable for the syscalls that close or replace fds. The tracer only needs to see those to keep its fd tables
+ *            up to date (see PTraceSandbox::FdToPath). Fds that get created take a number that is not in use, so the syscalls that
+ *            create them don't need to be seen. SeccompNotify for the syscalls only the seccomp user notification sandbox needs to see.
+ * skipFlags: the tracee is let through without stopping when any of these flags is set on the (lower 32 bits of the) first argument.
+ *            Use this for cases that are known to not produce any report, so the decision is made in the kernel rather than by a round trip to the tracer.
+ *
+ * NOTE: vfork is explicitly not traced, see PTraceSandbox::UpdateTraceeTableForExec for more details.
+ * NOTE: when adding new system calls here, ensure that a matching unit test for that system call is added to
+ * Public/Src/Sandbox/Linux/UnitTests/TestProcesses/TestProcess/main.cpp and Public/Src/Engine/UnitTests/Processes/LinuxSandboxProcessTests.cs
+ */
+#define FOR_EACH_TRACED_SYSCALL(X) \
+    X(close,             FdTable, 0) \
+    X(close_range,       FdTable, 0) \
+    X(dup2,              FdTable, 0) \
+    X(dup3,              FdTable, 0) \
+    X(execveat,          Always,  0) \
+    X(execve,            Always,  0) \
+    X(stat,              Always,  0) \
+    X(lstat,             Always,  0) \
+    X(fstat,             Always,  0) \
+    X(newfstatat,        Always,  0) \
+    X(access,            Always,  0) \
+    X(faccessat,         Always,  0) \
+    X(creat,             Always,  0) \
+    X(open,              Always,  0) \
+    X(openat,            Always,  0) \
+    X(write,             Always,  0) \
+    X(writev,            Always,  0) \
+    X(pwritev,           Always,  0) \
+    X(pwritev2,          Always,  0) \
+    X(pwrite64,          Always,  0) \
+    X(truncate,          Always,  0) \
+    X(ftruncate,         Always,  0) \
+    X(rmdir,             Always,  0) \
+    X(rename,            Always,  0) \
+    X(renameat,          Always,  0) \
+    X(renameat2,         Always,  0) \
+    X(link,              Always,  0) \
+    X(linkat,            Always,  0) \
+    X(unlink,            Always,  0) \
+    X(unlinkat,          Always,  0) \
+    X(symlink,           Always,  0) \
+    X(symlinkat,         Always,  0) \
+    X(readlink,          Always,  0) \
+    X(readlinkat,        Always,  0) \
+    X(utime,             Always,  0) \
+    X(utimes,            Always,  0) \
+    X(utimensat,         Always,  0) \
+    X(futimesat,         Always,  0) \
+    X(mkdir,             Always,  0) \
+    X(mkdirat,           Always,  0) \
+    X(mknod,             Always,  0) \
+    X(mknodat,           Always,  0) \
+    X(chmod,             Always,  0) \
+    X(fchmod,            Always,  0) \
+    X(fchmodat,          Always,  0) \
+    X(chown,             Always,  0) \
+    X(fchown,            Always,  0) \
+    X(lchown,            Always,  0) \
+    X(fchownat,          Always,  0) \
+    X(sendfile,          Always,  0) \
+    X(copy_file_range,   Always,  0) \
+    X(name_to_handle_at, Always,  0) \
+    /* Process exits are observed with PTRACE_EVENT_EXIT when using ptrace, but seccomp notifications need this */ \
+    X(exit_group,        SeccompNotify, 0) \
+    X(fork,              Always,  0) \
+    /* Threads are not reported as new processes (this matches what the interposing sandbox does), so there is no need to stop on those. */ \
+    /* The new thread is still automatically traced because of PTRACE_O_TRACECLONE. */ \
+    X(clone,             Always,  CLONE_THREAD)
 
 /*
  * See the documentation section of the repository for an explanation on how this all works along with some helpful resources.
@@ -32,8 +108,12 @@ public:
     
     /**
      * Attach the tracer to the provided pid.
+     *
+     * When a request fd is given, the tracer keeps reading requests to trace further process trees of the same pip from it
+     * (one "<pid> <exe path>" line per tree), and only returns once the fd is closed and every tracee is gone. Not supported
+     * with seccomp user notifications (the request fd is ignored then).
      */
-    void AttachToProcess(pid_t traceePid, std::string exe, std::string semaphoreName);
+    void AttachToProcess(pid_t traceePid, std::string exe, std::string semaphoreName, int requestFd = -1);
 
     /*
      * @brief Executes the provided child process under the ptrace sandbox
@@ -45,7 +125,89 @@ private:
     BxlObserver *m_bxl;
     pid_t m_traceePid = 0;
     const char* const m_emptyStr = "";
-    std::vector<std::tuple<pid_t, std::string>> m_traceeTable; // tracee pid, tracee exe path
+    // Tracee pid -> tracee exe path. This is consulted on every fork/clone/exec/exit stop of every tracee, so keep lookups constant time
+    // regardless of how many processes are being traced at once.
+    // Exe paths are interned (see InternExePath): forked tracees share the path of their parent, and siblings that exec the same
+    // binary share one copy of it, so updating the table never copies strings.
+    std::unordered_map<pid_t, const std::string*> m_traceeTable;
+    // Every exe path seen by the tracer. Never shrinks, but it only grows with the number of distinct binaries of the traced pip.
+    std::unordered_set<std::string> m_exePaths;
+    // Whether the tracee memory can be read with process_vm_readv (it may not be available, or not permitted). Otherwise we need to peek word by word.
+    bool m_processVmReadvSupported = true;
+    // Whether tracees are observed through seccomp user notifications rather than ptrace stops (see AttachWithSeccompNotify)
+    bool m_useSeccompNotify = false;
+    // The notification being handled when m_useSeccompNotify is set. Syscall arguments are read from here rather than from the tracee registers.
+    const struct seccomp_notif *m_currentNotification = nullptr;
+    // Thread id -> thread group id for every task that sent a notification when m_useSeccompNotify is set. With ptrace, only
+    // for the threads whose fd table had to be looked up (see GetFdTableOwner).
+    std::unordered_map<pid_t, pid_t> m_threadGroups;
+    // Whether fds are resolved from m_fdTables rather than from /proc (see FdToPath). Tracees then also stop on the syscalls that
+    // close or replace fds, so the tables can be kept up to date.
+    bool m_useFdTable = false;
+    // Tracee -> fd -> path behind it, filled in lazily as fds get resolved
+    std::unordered_map<pid_t, std::unordered_map<int, std::string>> m_fdTables;
+    // Tracees that share their fds with another process (clone with CLONE_FILES). Their fds can change without them making a syscall, so they are always resolved from /proc.
+    std::unordered_set<pid_t> m_sharedFdTables;
+    // Registers of the current tracee at the current stop (see FetchRegisters). Only used with ptrace.
+    struct user_regs_struct m_registers;
+    bool m_registersValid = false;
+    // Whether the handler of the current stop already resumed the tracee (see ResumeTracee)
+    bool m_traceeResumed = false;
+    // Whether tracees that exec a dynamically linked image are handed back to the interposer (see HandleExec). Only with ptrace.
+    bool m_handBackToInterposer = false;
+    // Processes (and threads) handed back to the interposer. They still stop on every traced syscall, since the seccomp filter they
+    // inherited can't be removed and it needs a tracer to let them through, but the tracer only looks at their execs.
+    std::unordered_set<pid_t> m_interposedTracees;
+
+    /**
+     * Whether seccomp user notifications should (and can) be used instead of ptrace. Both the tracee and the tracer
+     * evaluate this independently, so it must only depend on the FAM and on the running kernel.
+     */
+    static bool ShouldUseSeccompNotify(BxlObserver *bxl);
+
+    /**
+     * Seizes the given process and lets it resume (it waits on the given semaphore until the tracer is attached).
+     */
+    void Seize(pid_t traceePid, std::string exe, std::string semaphoreName);
+
+    /**
+     * Waits until either a tracee changed state (which is signalled through signalFd) or requests to trace new processes came in
+     * through requestFd, and seizes the requested processes. Sets requestFd to -1 once no more requests can come in.
+     */
+    void WaitForTraceeOrRequests(int signalFd, int &requestFd, std::string &pendingRequests);
+
+    /**
+     * Executable path of the current tracee, as far as the tracer knows.
+     */
+    const char* GetTraceeExePath();
+
+    /**
+     * Counterpart of AttachToProcess when seccomp user notifications are used: grabs the notification fd installed by
+     * the tracee and services notifications until every process using the filter is gone.
+     */
+    void AttachWithSeccompNotify(pid_t traceePid, std::string exe, std::string semaphoreName);
+
+    /**
+     * Finds the fd number of the seccomp notification listener installed by the given process. Returns -1 if it did not show up within the timeout.
+     */
+    int FindSeccompListener(pid_t pid, int timeoutMs);
+
+    /**
+     * Dispatches a seccomp notification to the corresponding syscall handler
+     */
+    void HandleSeccompNotification(const struct seccomp_notif *notification);
+
+    /**
+     * Maps the task that sent a notification to its process, reporting the process creation the first time a process is seen
+     */
+    pid_t ResolveNotifyingProcess(pid_t tid);
+
+    /**
+     * Lets the current syscall (which must operate on a directory) run and returns the error to report for it.
+     * With ptrace the actual result is read once the syscall completes. Seccomp notifications can't observe the result, so it is
+     * inferred from the state of the directory before the syscall runs.
+     */
+    int CompleteDirectorySyscall(int dirfd, const char *pathname, bool isCreation);
 
     /**
      * Removes the current pid from the tracee table and reports its exit
@@ -53,16 +215,76 @@ private:
     void RemoveFromTraceeTable();
 
     /**
-     * Finds the parent process in the tracee table for a given PID.
+     * Path behind the given fd of the current tracee. Resolved through /proc, unless the fd table is enabled and already has it.
      */
-    std::vector<std::tuple<pid_t, std::string>>::iterator FindProcess(pid_t pid);
+    std::string FdToPath(int fd);
+
+    /**
+     * The tracee whose fd table the current task uses (its thread group)
+     */
+    pid_t GetFdTableOwner();
+
+    /**
+     * Forgets the paths of the fds in [firstFd, lastFd] of the current tracee, which are being closed or replaced. Lets the syscall run first.
+     */
+    void InvalidateFds(unsigned int firstFd, unsigned int lastFd);
 
     void HandleSysCallGeneric(int syscallNumber);
 
-    void *GetArgumentAddr(int index);
+    /**
+     * Whether the current tracee was handed back to the interposer (see HandleExec). Tasks not seen before are looked up by their thread group and parent.
+     */
+    bool IsInterposedTracee();
+
+    /**
+     * Handles an exec of the current tracee. Without hand-backs, this just records and reports the exec.
+     *
+     * Otherwise, a traced process that execs a dynamically linked image the interposer can be preloaded into gets LD_PRELOAD (and
+     * BxlPTraceInterposed, so the interposer doesn't ask for a tracer of its own) added to the environment it execs with, and is handed back
+     * to the interposer once the exec succeeds. The interposer reports everything from there on, including the exec itself. A process
+     * that was handed back is taken over again when it execs an image that needs ptrace.
+     */
+    void HandleExec(const char *syscall, const std::string &exePath, int envpArgumentIndex);
+
+    /**
+     * Points the environment argument of the current exec to a copy of it that preloads the interposer, written right below the stack of
+     * the tracee (which the exec discards). Returns false, having changed nothing, when the environment doesn't have what the interposer needs
+     * or can't be rewritten. Otherwise 'originalEnvp' is what the argument pointed to before.
+     */
+    bool InjectInterposer(const char *syscall, int envpArgumentIndex, unsigned long &originalEnvp);
+
+    /**
+     * Sets an argument (starting from 1) of the syscall the current tracee is stopped at
+     */
+    bool WriteArgumentLong(int argumentIndex, unsigned long value);
+
+    /**
+     * Reads the registers of the current tracee into m_registers. Syscall arguments (and return values, once the syscall completed)
+     * are read from there, so a stop costs a single ptrace call no matter how many arguments the handler needs.
+     */
+    bool FetchRegisters();
+
+    /**
+     * Lets the current syscall run and stops the tracee when it returns, so its return value can be read. Tracees are otherwise resumed with
+     * PTRACE_CONT and never stop at syscall exits, so this is how a handler declares it needs the return value: only call it when it does.
+     * Returns false if the tracee did not make it to the syscall exit.
+     */
+    bool WaitForSyscallExit();
+
+    /**
+     * Lets the current tracee go at a seccomp stop (or at the syscall exit a handler stepped to) before its handler is done with the stop.
+     * Only call it once the handler no longer needs anything from the tracee (its registers, memory or fds). No-op with seccomp notifications.
+     */
+    void ResumeTracee();
 
     // @brief Gets the offset to read an argument at a given index starting from 1 (0 is used for the return value of the function)
     std::string ReadArgumentString(char *syscall, int argumentIndex, bool nullTerminated, int length = 0);
+    /*
+     * @brief Reads up to maxLength bytes of tracee memory at the given address with process_vm_readv, never crossing into a page that is not needed
+     * @return The number of bytes read, or -1 if process_vm_readv can't be used (in which case m_processVmReadvSupported is updated accordingly)
+     */
+    ssize_t ReadTraceeString(char *syscall, int argumentIndex, const char *remoteAddr, char *buffer, size_t maxLength, bool nullTerminated);
+    std::string PeekArgumentString(char *syscall, int argumentIndex, char *remoteAddr, bool nullTerminated, int length);
     /*
      * @brief Reads an argument string at a given address with ptrace
      * @param argumentIndex Index of the argument to read starting from 1 (or 0 for the return value)
@@ -74,60 +296,13 @@ private:
     void ReportOpen(std::string path, int oflag, std::string syscallName);
     void ReportCreate(std::string syscallName, int dirfd, const char *pathname, mode_t mode, long returnValue = 0, bool checkCache = true);
     int GetErrno();
-    void UpdateTraceeTableForExec(std::string exePath);
+    void UpdateTraceeTableForExec(const std::string &exePath);
+    const std::string* InternExePath(const std::string &exePath);
 
     // Handlers
-    MAKE_HANDLER_FN_DEF(execveat);
-    MAKE_HANDLER_FN_DEF(execve);
-    MAKE_HANDLER_FN_DEF(stat);
-    MAKE_HANDLER_FN_DEF(lstat);
-    MAKE_HANDLER_FN_DEF(fstat);
-    MAKE_HANDLER_FN_DEF_NEW(fstatat);
-    MAKE_HANDLER_FN_DEF(access);
-    MAKE_HANDLER_FN_DEF(faccessat);
-    MAKE_HANDLER_FN_DEF(creat);
-    MAKE_HANDLER_FN_DEF(open);
-    MAKE_HANDLER_FN_DEF(openat);
-    MAKE_HANDLER_FN_DEF(write);
-    MAKE_HANDLER_FN_DEF(writev);
-    MAKE_HANDLER_FN_DEF(pwritev);
-    MAKE_HANDLER_FN_DEF(pwritev2);
-    MAKE_HANDLER_FN_DEF(pwrite64);
-    MAKE_HANDLER_FN_DEF(truncate);
-    MAKE_HANDLER_FN_DEF(ftruncate);
-    MAKE_HANDLER_FN_DEF(rmdir);
-    MAKE_HANDLER_FN_DEF(rename);
-    MAKE_HANDLER_FN_DEF(renameat);
-    MAKE_HANDLER_FN_DEF(renameat2);
-    MAKE_HANDLER_FN_DEF(link);
-    MAKE_HANDLER_FN_DEF(linkat);
-    MAKE_HANDLER_FN_DEF(unlink);
-    MAKE_HANDLER_FN_DEF(unlinkat);
-    MAKE_HANDLER_FN_DEF(symlink);
-    MAKE_HANDLER_FN_DEF(symlinkat);
-    MAKE_HANDLER_FN_DEF(readlink);
-    MAKE_HANDLER_FN_DEF(readlinkat);
-    MAKE_HANDLER_FN_DEF(utime);
-    MAKE_HANDLER_FN_DEF(utimes);
-    MAKE_HANDLER_FN_DEF(utimensat);
-    MAKE_HANDLER_FN_DEF(futimesat);
-    MAKE_HANDLER_FN_DEF(mkdir);
-    MAKE_HANDLER_FN_DEF(mkdirat);
-    MAKE_HANDLER_FN_DEF(mknod);
-    MAKE_HANDLER_FN_DEF(mknodat);
-    MAKE_HANDLER_FN_DEF(chmod);
-    MAKE_HANDLER_FN_DEF(fchmod);
-    MAKE_HANDLER_FN_DEF(fchmodat);
-    MAKE_HANDLER_FN_DEF(chown);
-    MAKE_HANDLER_FN_DEF(fchown);
-    MAKE_HANDLER_FN_DEF(lchown);
-    MAKE_HANDLER_FN_DEF(fchownat);
-    MAKE_HANDLER_FN_DEF(sendfile);
-    MAKE_HANDLER_FN_DEF(copy_file_range);
-    MAKE_HANDLER_FN_DEF(name_to_handle_at);
-    MAKE_HANDLER_FN_DEF(exit);
-    MAKE_HANDLER_FN_DEF(fork);
-    MAKE_HANDLER_FN_DEF(clone);
+#define DECLARE_TRACED_SYSCALL_HANDLER(syscallName, selector, skipFlags) MAKE_HANDLER_FN_DEF(syscallName);
+    FOR_EACH_TRACED_SYSCALL(DECLARE_TRACED_SYSCALL_HANDLER)
+#undef DECLARE_TRACED_SYSCALL_HANDLER
     void HandleChildProcess(const char *syscall);
     void HandleRenameGeneric(const char *syscall, int olddirfd, const char *oldpath, int newdirfd, const char *newpath);
     void HandleReportAccessFd(const char *syscall, int fd, es_event_type_t event = ES_EVENT_TYPE_NOTIFY_WRITE);
@@ -0,0 +1,230 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <chrono>
+#include <dirent.h>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/limits.h>
+#include <spawn.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "loadgenerator.hpp"
+
+extern char **environ;
+
+enum class LoadOperation { Open, Stat, Enumerate, Write, Rename, Spawn };
+
+// Files every thread cycles through
+static const int FilesPerThread = 16;
+static const size_t WriteSize = 4096;
+
+static bool ParseMix(const std::string &mix, std::vector<LoadOperation> &schedule)
+{
+    static const std::pair<const char *, LoadOperation> names[] =
+    {
+        { "open", LoadOperation::Open },
+        { "stat", LoadOperation::Stat },
+        { "enumerate", LoadOperation::Enumerate },
+        { "write", LoadOperation::Write },
+        { "rename", LoadOperation::Rename },
+        { "spawn", LoadOperation::Spawn },
+    };
+
+    size_t start = 0;
+    while (start < mix.length())
+    {
+        size_t end = mix.find(';', start);
+        std::string entry = mix.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        start = end == std::string::npos ? mix.length() : end + 1;
+
+        size_t colon = entry.find(':');
+        if (colon == std::string::npos)
+        {
+            return false;
+        }
+
+        std::string name = entry.substr(0, colon);
+        int weight = atoi(entry.c_str() + colon + 1);
+
+        bool found = false;
+        for (const auto &known : names)
+        {
+            if (name == known.first)
+            {
+                schedule.insert(schedule.end(), weight, known.second);
+                found = true;
+            }
+        }
+
+        if (!found)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static std::string FilePath(const std::string &directory, int thread, int index)
+{
+    return directory + "/lg_" + std::to_string(getpid()) + "_" + std::to_string(thread) + "_" + std::to_string(index);
+}
+
+// Spawns this program with no work to do and waits for it
+static pid_t SpawnSelf(const std::vector<std::string> &arguments)
+{
+    char exe[PATH_MAX] = { 0 };
+    if (readlink("/proc/self/exe", exe, PATH_MAX - 1) == -1)
+    {
+        return -1;
+    }
+
+    std::vector<char *> argv;
+    argv.push_back(exe);
+    for (const auto &argument : arguments)
+    {
+        argv.push_back(const_cast<char *>(argument.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    pid_t pid;
+    return posix_spawn(&pid, exe, nullptr, nullptr, argv.data(), environ) == 0 ? pid : -1;
+}
+
+static bool WaitForChild(pid_t pid)
+{
+    int status;
+    return pid != -1 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static bool RunOperation(LoadOperation operation, const std::string &directory, int thread, long i)
+{
+    std::string path = FilePath(directory, thread, i % FilesPerThread);
+    switch (operation)
+    {
+        case LoadOperation::Open:
+        {
+            int fd = open(path.c_str(), O_RDONLY);
+            return fd != -1 && close(fd) == 0;
+        }
+        case LoadOperation::Stat:
+        {
+            struct stat buf;
+            return stat(path.c_str(), &buf) == 0;
+        }
+        case LoadOperation::Enumerate:
+        {
+            DIR *dir = opendir(directory.c_str());
+            if (dir == nullptr)
+            {
+                return false;
+            }
+
+            while (readdir(dir) != nullptr) {}
+            return closedir(dir) == 0;
+        }
+        case LoadOperation::Write:
+        {
+            static const char buffer[WriteSize] = { 0 };
+            int fd = open(path.c_str(), O_WRONLY | O_TRUNC);
+            bool written = fd != -1 && write(fd, buffer, WriteSize) == (ssize_t)WriteSize;
+            return fd != -1 && close(fd) == 0 && written;
+        }
+        case LoadOperation::Rename:
+        {
+            std::string renamed = path + ".renamed";
+            return rename(path.c_str(), renamed.c_str()) == 0 && rename(renamed.c_str(), path.c_str()) == 0;
+        }
+        case LoadOperation::Spawn:
+            return WaitForChild(SpawnSelf({ "-t", "LoadGeneratorChild", directory, "0", "0", "0", "" }));
+    }
+
+    return false;
+}
+
+static bool RunThread(const std::vector<LoadOperation> &schedule, const std::string &directory, int thread, long ops)
+{
+    bool success = true;
+    for (int i = 0; i < FilesPerThread; i++)
+    {
+        int fd = open(FilePath(directory, thread, i).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        success &= fd != -1 && close(fd) == 0;
+    }
+
+    for (long i = 0; i < ops; i++)
+    {
+        success &= RunOperation(schedule[i % schedule.size()], directory, thread, i);
+    }
+
+    for (int i = 0; i < FilesPerThread; i++)
+    {
+        unlink(FilePath(directory, thread, i).c_str());
+    }
+
+    return success;
+}
+
+int LoadGenerator(int argc, char **argv, bool report)
+{
+    if (argc != 5)
+    {
+        std::cerr << "Usage: -t LoadGenerator <directory> <threads> <children> <opsPerThread> <mix>" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::string directory(argv[0]);
+    int threads = atoi(argv[1]);
+    int children = atoi(argv[2]);
+    long opsPerThread = atol(argv[3]);
+
+    std::vector<LoadOperation> schedule;
+    if (!ParseMix(argv[4], schedule) || (schedule.empty() && threads > 0 && opsPerThread > 0))
+    {
+        std::cerr << "Invalid operation mix '" << argv[4] << "'" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<pid_t> childPids;
+    for (int i = 0; i < children; i++)
+    {
+        childPids.push_back(SpawnSelf({ "-t", "LoadGeneratorChild", directory, argv[1], "0", argv[3], argv[4] }));
+    }
+
+    std::vector<std::thread> workers;
+    std::vector<char> succeeded(threads, false);
+    for (int i = 0; i < threads; i++)
+    {
+        workers.emplace_back([&, i]() { succeeded[i] = RunThread(schedule, directory, i, opsPerThread); });
+    }
+
+    bool success = true;
+    for (int i = 0; i < threads; i++)
+    {
+        workers[i].join();
+        success &= succeeded[i] != 0;
+    }
+
+    for (pid_t pid : childPids)
+    {
+        success &= WaitForChild(pid);
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    // children only do their share of the work: the parent reports for all of them
+    if (report)
+    {
+        long totalOps = (children + 1L) * threads * opsPerThread;
+        std::cout << "LoadGenerator: " << totalOps << " ops in " << elapsed.count() << "s ("
+                  << (long)(totalOps / elapsed.count()) << " ops/sec)" << std::endl;
+    }
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,24 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef LOADGENERATOR_HPP
+#define LOADGENERATOR_HPP
+
+/**
+ * Generates file system load for benchmarking the sandbox end-to-end:
+ *
+ *   LinuxTestProcess -t LoadGenerator <directory> <threads> <children> <opsPerThread> <mix>
+ *
+ * Every one of the <children> + 1 processes (the children run this same command, without children of their own) runs
+ * <threads> threads, each issuing <opsPerThread> operations on files of its own under <directory>.
+ *
+ * <mix> gives the weight of every kind of operation as semicolon separated name:weight pairs, with names among
+ * open, stat, enumerate, write, rename and spawn (e.g. "open:4;stat:4;enumerate:1;write:2;rename:1;spawn:1").
+ * Operations are issued in a fixed round-robin order honoring the weights, so runs are reproducible.
+ *
+ * Prints the number of operations issued by all the processes and the achieved number of operations per second, unless
+ * 'report' is false (which is how the children are run, as "-t LoadGeneratorChild").
+ */
+int LoadGenerator(int argc, char **argv, bool report);
+
+#endif // LOADGENERATOR_HPP
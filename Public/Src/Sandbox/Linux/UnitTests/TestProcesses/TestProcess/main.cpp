@@ -5,6 +5,7 @@
 #include <iostream>
 #include <sys/mman.h>
 #include <unistd.h>
+#include "loadgenerator.hpp"
 #include "syscalltests.hpp"
 
 int TestAnonymousFile()
@@ -53,6 +54,12 @@ int main(int argc, char **argv)
     #define IF_COMMAND(NAME)   { if (testName == #NAME) { exit(NAME()); } }
     #define IF_COMMAND_STR(NAME)   { if (testName == STR(Test##NAME)) { exit(Test##NAME()); } }
 
+    // Load generation (takes the arguments following the name of the test)
+    if (testName == "LoadGenerator" || testName == "LoadGeneratorChild")
+    {
+        exit(LoadGenerator(argc - optind - 1, argv + optind + 1, testName == "LoadGenerator"));
+    }
+
     // Function Definitions
     IF_COMMAND(TestAnonymousFile);
     IF_COMMAND_STR(fork);
@@ -66,6 +73,7 @@ int main(int argc, char **argv)
     IF_COMMAND_STR(execl);
     IF_COMMAND_STR(execlp);
     IF_COMMAND_STR(execle);
+    IF_COMMAND_STR(posix_spawn);
     IF_COMMAND(Test__lxstat);
     IF_COMMAND(Test__lxstat64);
     IF_COMMAND(Test__xstat);
@@ -268,6 +268,25 @@ GEN_TEST_FN(execle)
     return EXIT_SUCCESS;
 }
 
+GEN_TEST_FN(posix_spawn)
+{
+    // Executing the current exe without any args will cause it to fail and exit early which is good enough for this test
+    char buf[PATH_MAX] = { 0 };
+    GetCurrentExe(buf, PATH_MAX);
+
+    pid_t pid;
+    static char *argv[] = { NULL };
+    int result = posix_spawn(&pid, buf, /* file_actions */ NULL, /* attrp */ NULL, argv, environ);
+    if (result != 0)
+    {
+        errno = result;
+        perror("posix_spawn");
+        return EXIT_FAILURE;
+    }
+
+    return HandleChild(pid);
+}
+
 int Test__lxstat()
 {
 #if (__GLIBC__ == 2 && __GLIBC_MINOR__ < 33)
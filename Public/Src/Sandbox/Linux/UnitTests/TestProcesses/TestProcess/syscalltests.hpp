@@ -7,6 +7,7 @@
 #include <iostream>
 #include <libgen.h>
 #include <linux/limits.h>
+#include <spawn.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
@@ -35,6 +36,7 @@ GEN_TEST_FN(execvpe);
 GEN_TEST_FN(execl);
 GEN_TEST_FN(execlp);
 GEN_TEST_FN(execle);
+GEN_TEST_FN(posix_spawn);
 // The tests below are manually created because they are not available on all versions of glibc
 int Test__lxstat();
 int Test__lxstat64();
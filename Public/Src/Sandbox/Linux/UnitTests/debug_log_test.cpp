@@ -0,0 +1,134 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define BOOST_TEST_MODULE LinuxSandboxTest
+#define _DO_NOT_EXPORT
+
+#include <boost/test/included/unit_test.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+#include <debug_log.hpp>
+
+using namespace std;
+
+static vector<string> s_flushed;
+static vector<pid_t> s_pids;
+static size_t s_largestBatch = 0;
+
+static void Collect(const DebugLog::Message *messages, size_t count)
+{
+    s_largestBatch = count > s_largestBatch ? count : s_largestBatch;
+    for (size_t i = 0; i < count; i++)
+    {
+        s_flushed.emplace_back(messages[i].text, messages[i].length);
+        s_pids.push_back(messages[i].pid);
+    }
+}
+
+static bool Log(pid_t pid, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    bool result = DebugLog::Append(pid, Collect, fmt, args);
+    va_end(args);
+    return result;
+}
+
+static void Reset()
+{
+    DebugLog::Flush(Collect);
+    s_flushed.clear();
+    s_pids.clear();
+    s_largestBatch = 0;
+}
+
+BOOST_AUTO_TEST_SUITE(DebugLogTests)
+
+BOOST_AUTO_TEST_CASE(TestMessagesAreKeptUntilFlushed)
+{
+    Reset();
+
+    BOOST_CHECK(Log(10, "first %d", 1));
+    BOOST_CHECK(Log(11, "second %s", "message"));
+    BOOST_CHECK(s_flushed.empty());
+
+    DebugLog::Flush(Collect);
+    BOOST_CHECK_EQUAL(s_flushed.size(), 2);
+    BOOST_CHECK_EQUAL(s_flushed[0], "first 1");
+    BOOST_CHECK_EQUAL(s_flushed[1], "second message");
+    BOOST_CHECK_EQUAL(s_pids[0], 10);
+    BOOST_CHECK_EQUAL(s_pids[1], 11);
+
+    // Nothing is flushed twice
+    DebugLog::Flush(Collect);
+    BOOST_CHECK_EQUAL(s_flushed.size(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(TestLongMessagesAreTruncated)
+{
+    Reset();
+
+    string longMessage(DebugLog::MAX_MESSAGE_LENGTH + 100, 'x');
+    BOOST_CHECK(Log(1, "%s", longMessage.c_str()));
+
+    DebugLog::Flush(Collect);
+    BOOST_CHECK_EQUAL(s_flushed.size(), 1);
+    BOOST_CHECK_EQUAL(s_flushed[0], longMessage.substr(0, DebugLog::MAX_MESSAGE_LENGTH));
+}
+
+BOOST_AUTO_TEST_CASE(TestFullRingIsFlushedInOrder)
+{
+    Reset();
+
+    // Enough messages to fill the ring (and wrap around it) many times over
+    const int count = 5000;
+    for (int i = 0; i < count; i++)
+    {
+        BOOST_CHECK(Log(1, "message %d %s", i, string(i % 300, 'y').c_str()));
+    }
+
+    // Some of them were flushed when the ring filled up
+    BOOST_CHECK(!s_flushed.empty());
+    BOOST_CHECK(s_largestBatch <= DebugLog::FLUSH_BATCH_SIZE);
+
+    DebugLog::Flush(Collect);
+    BOOST_CHECK_EQUAL(s_flushed.size(), count);
+    for (int i = 0; i < count; i++)
+    {
+        BOOST_CHECK_EQUAL(s_flushed[i], "message " + to_string(i) + " " + string(i % 300, 'y'));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestRingsOfAllThreadsAreFlushed)
+{
+    Reset();
+
+    BOOST_CHECK(Log(1, "main thread"));
+    thread other([&]()
+    {
+        BOOST_CHECK(Log(2, "other thread"));
+    });
+    other.join();
+
+    // The ring of a thread that is gone is still flushed
+    DebugLog::Flush(Collect);
+    BOOST_CHECK_EQUAL(s_flushed.size(), 2);
+    BOOST_CHECK(find(s_flushed.begin(), s_flushed.end(), "main thread") != s_flushed.end());
+    BOOST_CHECK(find(s_flushed.begin(), s_flushed.end(), "other thread") != s_flushed.end());
+}
+
+BOOST_AUTO_TEST_CASE(TestDiscard)
+{
+    Reset();
+
+    BOOST_CHECK(Log(1, "discarded"));
+    DebugLog::Discard();
+    BOOST_CHECK(Log(1, "kept"));
+
+    DebugLog::Flush(Collect);
+    BOOST_CHECK_EQUAL(s_flushed.size(), 1);
+    BOOST_CHECK_EQUAL(s_flushed[0], "kept");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
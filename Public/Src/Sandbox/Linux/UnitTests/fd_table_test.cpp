@@ -0,0 +1,98 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define BOOST_TEST_MODULE LinuxSandboxTest
+#define _DO_NOT_EXPORT
+
+#include <boost/test/included/unit_test.hpp>
+#include <fd_table.hpp>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(FdTableTests)
+
+BOOST_AUTO_TEST_CASE(TestSetAndGet)
+{
+    FdTable table;
+    std::string path;
+
+    BOOST_CHECK(!table.TryGet(3, path));
+
+    table.Set(3, "/tmp/foo");
+    BOOST_CHECK(table.TryGet(3, path));
+    BOOST_CHECK_EQUAL(path, "/tmp/foo");
+
+    // Overwriting with a longer path should not keep any trace of the previous one
+    table.Set(3, "/tmp/a/much/longer/path/that/does/not/fit/in/the/first/block/of/the/entry");
+    BOOST_CHECK(table.TryGet(3, path));
+    BOOST_CHECK_EQUAL(path, "/tmp/a/much/longer/path/that/does/not/fit/in/the/first/block/of/the/entry");
+
+    table.Set(3, "/tmp/bar");
+    BOOST_CHECK(table.TryGet(3, path));
+    BOOST_CHECK_EQUAL(path, "/tmp/bar");
+}
+
+BOOST_AUTO_TEST_CASE(TestHighDescriptors)
+{
+    FdTable table;
+    std::string path;
+
+    table.Set(5000, "/tmp/high");
+    table.Set(FdTable::MAX_FD - 1, "/tmp/highest");
+    table.Set(FdTable::MAX_FD, "/tmp/out/of/range");
+    table.Set(-1, "/tmp/negative");
+
+    BOOST_CHECK(table.TryGet(5000, path));
+    BOOST_CHECK_EQUAL(path, "/tmp/high");
+    BOOST_CHECK(table.TryGet(FdTable::MAX_FD - 1, path));
+    BOOST_CHECK_EQUAL(path, "/tmp/highest");
+    BOOST_CHECK(!table.TryGet(FdTable::MAX_FD, path));
+    BOOST_CHECK(!table.TryGet(-1, path));
+
+    // Neighbours in the same page are not affected
+    BOOST_CHECK(!table.TryGet(5001, path));
+}
+
+BOOST_AUTO_TEST_CASE(TestResetAndClear)
+{
+    FdTable table;
+    std::string path;
+
+    for (int fd = 0; fd < 2048; fd++)
+    {
+        table.Set(fd, ("/tmp/file" + std::to_string(fd)).c_str());
+    }
+
+    table.Reset(42);
+    BOOST_CHECK(!table.TryGet(42, path));
+    BOOST_CHECK(table.TryGet(43, path));
+    BOOST_CHECK_EQUAL(path, "/tmp/file43");
+
+    // Released blocks are reused
+    table.Set(42, "/tmp/reused");
+    BOOST_CHECK(table.TryGet(42, path));
+    BOOST_CHECK_EQUAL(path, "/tmp/reused");
+
+    table.Clear();
+    for (int fd = 0; fd < 2048; fd++)
+    {
+        BOOST_CHECK(!table.TryGet(fd, path));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestDisable)
+{
+    FdTable table;
+    std::string path;
+
+    table.Set(3, "/tmp/foo");
+    table.Disable();
+
+    BOOST_CHECK(!table.IsEnabled());
+    BOOST_CHECK(!table.TryGet(3, path));
+
+    table.Set(4, "/tmp/bar");
+    BOOST_CHECK(!table.TryGet(4, path));
+}
+
+BOOST_AUTO_TEST_SUITE_END();
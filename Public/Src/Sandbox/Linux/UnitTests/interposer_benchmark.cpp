@@ -0,0 +1,228 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Microbenchmarks of the calls the interposer sits on. The same binary is run with and without the sandbox
+// (see InterposeSandboxProcessTest.RunInterposerBenchmark), so the difference between both runs is the cost of the
+// interposer. Every benchmark prints one JSON object per line:
+//
+//      {"benchmark":"stat","iterations":20000,"nsPerOp":412.7,"minNsPerOp":398.2,"allocsPerOp":0.00}
+//
+// where nsPerOp is the median over a few repetitions and minNsPerOp is the best one. allocsPerOp counts the heap
+// allocations made in the process (the interposer's included, its malloc calls land on the one defined here) per
+// operation, which the interposer should bring to none of its own once it is warmed up.
+//
+// Usage: interposer_benchmark [scale]
+//      scale   multiplies the number of iterations of every benchmark (default: 1)
+//
+// The fixture (files, a symlink chain and a large directory) is created under the current working directory.
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static const int REPETITIONS = 5;
+static const int LARGE_DIRECTORY_ENTRIES = 2000;
+
+static const char *FIXTURE_DIRECTORY = "interposer_benchmark";
+static const char *FILE_PATH = "interposer_benchmark/file.txt";
+static const char *FILE_NAME = "file.txt";
+// 'link2' -> 'link1' -> 'real' are directory symlinks, and 'real/link' -> 'file.txt', so every iteration
+// resolves two intermediate symlinks before reading the final one
+static const char *SYMLINK_CHAIN_PATH = "interposer_benchmark/link2/link";
+static const char *LARGE_DIRECTORY = "interposer_benchmark/large";
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+
+static atomic<uint64_t> g_allocations(0);
+
+extern "C" void *malloc(size_t size)
+{
+    g_allocations.fetch_add(1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+    g_allocations.fetch_add(1, memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    g_allocations.fetch_add(1, memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+static uint64_t NowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void Fail(const char *what)
+{
+    fprintf(stderr, "interposer_benchmark: %s failed: %s\n", what, strerror(errno));
+    exit(1);
+}
+
+static void CreateFile(const string &path)
+{
+    int fd = open(path.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd == -1 || write(fd, "contents", 8) != 8 || close(fd) != 0)
+    {
+        Fail(path.c_str());
+    }
+}
+
+static void CreateFixture()
+{
+    string root = FIXTURE_DIRECTORY;
+    mkdir(root.c_str(), 0755);
+    mkdir((root + "/real").c_str(), 0755);
+    mkdir(LARGE_DIRECTORY, 0755);
+
+    CreateFile(FILE_PATH);
+    CreateFile(root + "/real/file.txt");
+
+    unlink((root + "/real/link").c_str());
+    unlink((root + "/link1").c_str());
+    unlink((root + "/link2").c_str());
+    if (symlink("file.txt", (root + "/real/link").c_str()) != 0
+        || symlink("real", (root + "/link1").c_str()) != 0
+        || symlink("link1", (root + "/link2").c_str()) != 0)
+    {
+        Fail("symlink");
+    }
+
+    for (int i = 0; i < LARGE_DIRECTORY_ENTRIES; i++)
+    {
+        CreateFile(string(LARGE_DIRECTORY) + "/entry" + to_string(i));
+    }
+}
+
+static void Run(const char *name, int iterations, const function<void()> &operation)
+{
+    // Warm up caches (the interposer's included) before measuring
+    for (int i = 0; i < max(1, iterations / 10); i++)
+    {
+        operation();
+    }
+
+    vector<double> nsPerOp;
+    nsPerOp.reserve(REPETITIONS);
+    uint64_t allocationsBefore = g_allocations.load(memory_order_relaxed);
+    for (int repetition = 0; repetition < REPETITIONS; repetition++)
+    {
+        uint64_t start = NowNs();
+        for (int i = 0; i < iterations; i++)
+        {
+            operation();
+        }
+
+        nsPerOp.push_back((double)(NowNs() - start) / iterations);
+    }
+
+    // Taken before anything below allocates (e.g., sorting or printing)
+    double allocationsPerOp = (double)(g_allocations.load(memory_order_relaxed) - allocationsBefore) / ((uint64_t)iterations * REPETITIONS);
+
+    sort(nsPerOp.begin(), nsPerOp.end());
+    printf("{\"benchmark\":\"%s\",\"iterations\":%d,\"nsPerOp\":%.1f,\"minNsPerOp\":%.1f,\"allocsPerOp\":%.2f}\n",
+        name, iterations, nsPerOp[REPETITIONS / 2], nsPerOp[0], allocationsPerOp);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    int scale = argc > 1 ? atoi(argv[1]) : 1;
+    if (scale <= 0)
+    {
+        fprintf(stderr, "Usage: %s [scale]\n", argv[0]);
+        return 1;
+    }
+
+    CreateFixture();
+
+    int directoryFd = open(FIXTURE_DIRECTORY, O_RDONLY | O_DIRECTORY);
+    if (directoryFd == -1)
+    {
+        Fail("open fixture directory");
+    }
+
+    Run("stat", 20000 * scale, []()
+    {
+        struct stat st;
+        if (stat(FILE_PATH, &st) != 0) Fail("stat");
+    });
+
+    Run("open_close", 20000 * scale, []()
+    {
+        int fd = open(FILE_PATH, O_RDONLY);
+        if (fd == -1) Fail("open");
+        close(fd);
+    });
+
+    Run("openat_dirfd", 20000 * scale, [=]()
+    {
+        int fd = openat(directoryFd, FILE_NAME, O_RDONLY);
+        if (fd == -1) Fail("openat");
+        close(fd);
+    });
+
+    Run("readlink_symlink_chain", 20000 * scale, []()
+    {
+        char buffer[PATH_MAX];
+        if (readlink(SYMLINK_CHAIN_PATH, buffer, sizeof(buffer)) == -1) Fail("readlink");
+    });
+
+    Run("fork_exec_true", 200 * scale, []()
+    {
+        pid_t child = fork();
+        if (child == 0)
+        {
+            execl("/bin/true", "/bin/true", (char *)nullptr);
+            _exit(127);
+        }
+
+        int status;
+        if (child == -1 || waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            Fail("fork/exec /bin/true");
+        }
+    });
+
+    Run("readdir_large_directory", 200 * scale, []()
+    {
+        DIR *directory = opendir(LARGE_DIRECTORY);
+        if (directory == nullptr) Fail("opendir");
+
+        int entries = 0;
+        while (readdir(directory) != nullptr)
+        {
+            entries++;
+        }
+
+        closedir(directory);
+        if (entries < LARGE_DIRECTORY_ENTRIES) Fail("readdir");
+    });
+
+    close(directoryFd);
+    return 0;
+}
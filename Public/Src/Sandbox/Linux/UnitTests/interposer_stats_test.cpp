@@ -0,0 +1,63 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define BOOST_TEST_MODULE LinuxSandboxTest
+#define _DO_NOT_EXPORT
+
+#include <boost/test/included/unit_test.hpp>
+#include <thread>
+#include <interposer_stats.hpp>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(InterposerStatsTests)
+
+BOOST_AUTO_TEST_CASE(TestFormat)
+{
+    int open = InterposerStats::RegisterFunction("open");
+    int stat = InterposerStats::RegisterFunction("stat");
+    BOOST_CHECK(open >= 0 && stat >= 0 && open != stat);
+
+    // Nothing is recorded until enabled
+    {
+        InterposerStats::Scope scope(open);
+    }
+    InterposerStats::Increment(InterposerStats::CacheHits);
+
+    string disabled;
+    InterposerStats::Format(disabled);
+    BOOST_CHECK_EQUAL(disabled, "cacheHits=0 cacheMisses=0 resolvePathReadlinks=0 sends=0 sentBytes=0 deferredSends=0 stalledSends=0 sendStallNs=0 compressedSends=0 compressedInputBytes=0;");
+
+    InterposerStats::Enable();
+    InterposerStats::RecordCall(open, 0);
+    InterposerStats::RecordCall(open, 1500);
+    InterposerStats::Increment(InterposerStats::SentBytes, 100);
+
+    // Other threads record into their own blocks, and all of them are aggregated
+    thread other([&]()
+    {
+        InterposerStats::RecordCall(open, 1024);
+        InterposerStats::Increment(InterposerStats::SentBytes, 20);
+    });
+    other.join();
+
+    string result;
+    InterposerStats::Format(result);
+    BOOST_CHECK_EQUAL(result, "cacheHits=0 cacheMisses=0 resolvePathReadlinks=0 sends=0 sentBytes=120 deferredSends=0 stalledSends=0 sendStallNs=0 compressedSends=0 compressedInputBytes=0; open calls=3 log2ns=0:1,10:2;");
+}
+
+BOOST_AUTO_TEST_CASE(TestSlowCallsGoToLastBucket)
+{
+    int read = InterposerStats::RegisterFunction("read");
+    InterposerStats::Enable();
+    InterposerStats::RecordCall(read, ~0ULL);
+
+    string result;
+    InterposerStats::Format(result);
+
+    char expected[64];
+    snprintf(expected, sizeof(expected), " read calls=1 log2ns=%d:1;", InterposerStats::LATENCY_BUCKETS - 1);
+    BOOST_CHECK(result.find(expected) != string::npos);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
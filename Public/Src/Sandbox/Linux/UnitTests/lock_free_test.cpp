@@ -0,0 +1,213 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define BOOST_TEST_MODULE LinuxSandboxTest
+#define _DO_NOT_EXPORT
+
+#include <boost/test/included/unit_test.hpp>
+#include <set>
+#include <thread>
+#include <vector>
+#include <LockFree.h>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(LockFreeTests)
+
+BOOST_AUTO_TEST_CASE(TestHashSet)
+{
+    LockFree::HashSet<64> set;
+    BOOST_CHECK(set.Add(42) == LockFree::HashSet<64>::AddResult::Added);
+    BOOST_CHECK(set.Add(42) == LockFree::HashSet<64>::AddResult::AlreadyPresent);
+    BOOST_CHECK(set.Contains(42));
+    BOOST_CHECK(!set.Contains(43));
+
+    // Zero marks free slots
+    BOOST_CHECK(!set.Contains(0));
+    BOOST_CHECK(set.Add(0) == LockFree::HashSet<64>::AddResult::Full);
+
+    // The set reports being full before its probe sequences get too long
+    int added = 0;
+    for (uint64_t key = 1; key <= 64; key++)
+    {
+        added += set.Add(key) == LockFree::HashSet<64>::AddResult::Added ? 1 : 0;
+    }
+
+    BOOST_CHECK(added < 64);
+}
+
+BOOST_AUTO_TEST_CASE(TestHashSetConcurrentAdds)
+{
+    LockFree::HashSet<4096> set;
+    std::atomic<int> added(0);
+
+    // Every thread adds the same keys: each key is added exactly once
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; t++)
+    {
+        threads.emplace_back([&]()
+        {
+            for (uint64_t key = 1; key <= 1000; key++)
+            {
+                if (set.Add(key) == LockFree::HashSet<4096>::AddResult::Added)
+                {
+                    added++;
+                }
+            }
+        });
+    }
+
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    BOOST_CHECK_EQUAL(1000, added.load());
+    for (uint64_t key = 1; key <= 1000; key++)
+    {
+        BOOST_CHECK(set.Contains(key));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestRing)
+{
+    LockFree::Ring<int, 4> ring;
+    int item;
+    BOOST_CHECK(!ring.TryDequeue(item));
+
+    for (int i = 0; i < 4; i++)
+    {
+        BOOST_CHECK(ring.TryEnqueue(std::move(i)));
+    }
+
+    int overflow = 4;
+    BOOST_CHECK(!ring.TryEnqueue(std::move(overflow)));
+
+    for (int i = 0; i < 4; i++)
+    {
+        BOOST_CHECK(ring.TryDequeue(item));
+        BOOST_CHECK_EQUAL(i, item);
+    }
+
+    BOOST_CHECK(!ring.TryDequeue(item));
+}
+
+BOOST_AUTO_TEST_CASE(TestRingConcurrentProducersAndConsumers)
+{
+    LockFree::Ring<int, 256> ring;
+    const int producers = 4, consumers = 4, itemsPerProducer = 20000;
+    std::atomic<int> consumed(0);
+    std::vector<std::vector<int>> seen(consumers);
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++)
+    {
+        threads.emplace_back([&, p]()
+        {
+            for (int i = 0; i < itemsPerProducer; i++)
+            {
+                int item = p * itemsPerProducer + i;
+                while (!ring.TryEnqueue(std::move(item))) { std::this_thread::yield(); }
+            }
+        });
+    }
+
+    for (int c = 0; c < consumers; c++)
+    {
+        threads.emplace_back([&, c]()
+        {
+            int item;
+            while (consumed.load() < producers * itemsPerProducer)
+            {
+                if (ring.TryDequeue(item))
+                {
+                    seen[c].push_back(item);
+                    consumed++;
+                }
+            }
+        });
+    }
+
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    // Every item is dequeued exactly once
+    std::set<int> all;
+    for (const auto &items : seen)
+    {
+        all.insert(items.begin(), items.end());
+    }
+
+    BOOST_CHECK_EQUAL(producers * itemsPerProducer, consumed.load());
+    BOOST_CHECK_EQUAL((size_t)(producers * itemsPerProducer), all.size());
+}
+
+BOOST_AUTO_TEST_CASE(TestFreelist)
+{
+    LockFree::Freelist<int, 3> freelist;
+    int *a = freelist.TryTake();
+    int *b = freelist.TryTake();
+    int *c = freelist.TryTake();
+    BOOST_CHECK(a != nullptr && b != nullptr && c != nullptr);
+    BOOST_CHECK(a != b && b != c && a != c);
+    BOOST_CHECK(freelist.TryTake() == nullptr);
+
+    freelist.Return(b);
+    BOOST_CHECK(freelist.TryTake() == b);
+}
+
+BOOST_AUTO_TEST_CASE(TestFreelistConcurrentTakeAndReturn)
+{
+    LockFree::Freelist<std::atomic<int>, 16> freelist;
+    std::atomic<bool> failed(false);
+
+    // Items are default constructed, which leaves an atomic int uninitialized
+    std::vector<std::atomic<int>*> items;
+    while (std::atomic<int> *item = freelist.TryTake())
+    {
+        item->store(0);
+        items.push_back(item);
+    }
+
+    BOOST_CHECK_EQUAL((size_t)16, items.size());
+    for (auto item : items)
+    {
+        freelist.Return(item);
+    }
+
+    // An item is never handed out to two threads at once
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; t++)
+    {
+        threads.emplace_back([&]()
+        {
+            for (int i = 0; i < 100000; i++)
+            {
+                std::atomic<int> *item = freelist.TryTake();
+                if (item == nullptr)
+                {
+                    continue;
+                }
+
+                if (item->fetch_add(1) != 0)
+                {
+                    failed = true;
+                }
+
+                item->fetch_sub(1);
+                freelist.Return(item);
+            }
+        });
+    }
+
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    BOOST_CHECK(!failed.load());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
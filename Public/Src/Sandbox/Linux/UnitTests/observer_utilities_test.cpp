@@ -6,6 +6,12 @@
 
 #include <boost/test/included/unit_test.hpp>
 #include <observer_utilities.hpp>
+#include <elf.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <iterator>
+#include <vector>
 
 using namespace std;
 
@@ -20,4 +26,114 @@ BOOST_AUTO_TEST_CASE(TestEnvVarResolution)
     BOOST_CHECK_EQUAL(path.c_str(), "/usr/bin/sh");
 }
 
+BOOST_AUTO_TEST_CASE(TestEnvVarResolutionCache)
+{
+    char root[] = "/tmp/bxl_path_lookup_XXXXXX";
+    BOOST_REQUIRE(mkdtemp(root) != nullptr);
+    std::string first = std::string(root) + "/first";
+    std::string second = std::string(root) + "/second";
+    BOOST_REQUIRE(mkdir(first.c_str(), 0755) == 0);
+    BOOST_REQUIRE(mkdir(second.c_str(), 0755) == 0);
+    std::ofstream(second + "/tool").close();
+
+    const char *originalPath = getenv("PATH");
+    std::string savedPath = originalPath != nullptr ? originalPath : "";
+    setenv("PATH", (first + ":" + second).c_str(), 1);
+
+    mode_t mode = 0;
+    std::string path;
+
+    // the second lookup comes from the cache
+    BOOST_CHECK(resolve_filename_with_env("tool", mode, path));
+    BOOST_CHECK_EQUAL(path, second + "/tool");
+    BOOST_CHECK(resolve_filename_with_env("tool", mode, path));
+    BOOST_CHECK_EQUAL(path, second + "/tool");
+
+    // a file showing up earlier in the PATH takes precedence over the cached resolution
+    std::ofstream(first + "/tool").close();
+    BOOST_CHECK(resolve_filename_with_env("tool", mode, path));
+    BOOST_CHECK_EQUAL(path, first + "/tool");
+
+    // and so does one going away
+    BOOST_REQUIRE(unlink((first + "/tool").c_str()) == 0);
+    BOOST_REQUIRE(unlink((second + "/tool").c_str()) == 0);
+    BOOST_CHECK(!resolve_filename_with_env("tool", mode, path));
+
+    setenv("PATH", savedPath.c_str(), 1);
+    rmdir(first.c_str());
+    rmdir(second.c_str());
+    rmdir(root);
+}
+
+BOOST_AUTO_TEST_CASE(TestElfLinkageNotElf)
+{
+    const char script[] = "#!/bin/sh\necho hello\n";
+    BOOST_CHECK(get_elf_linkage((const unsigned char *)script, sizeof(script)) == ElfLinkage::NotElf);
+    BOOST_CHECK(get_elf_linkage(nullptr, 0) == ElfLinkage::NotElf);
+}
+
+BOOST_AUTO_TEST_CASE(TestElfLinkageStatic)
+{
+    // A minimal executable with a single loadable segment and no dynamic section
+    struct
+    {
+        Elf64_Ehdr ehdr;
+        Elf64_Phdr phdr;
+    } image = {};
+
+    memcpy(image.ehdr.e_ident, ELFMAG, SELFMAG);
+    image.ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+    image.ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    image.ehdr.e_type = ET_EXEC;
+    image.ehdr.e_phoff = sizeof(Elf64_Ehdr);
+    image.ehdr.e_phentsize = sizeof(Elf64_Phdr);
+    image.ehdr.e_phnum = 1;
+    image.phdr.p_type = PT_LOAD;
+    image.phdr.p_filesz = sizeof(image);
+
+    BOOST_CHECK(get_elf_linkage((const unsigned char *)&image, sizeof(image)) == ElfLinkage::Static);
+
+    // Truncated program headers can't be interpreted
+    BOOST_CHECK(get_elf_linkage((const unsigned char *)&image, sizeof(Elf64_Ehdr) + 8) == ElfLinkage::Unknown);
+}
+
+BOOST_AUTO_TEST_CASE(TestElfLinkageDynamic)
+{
+    // This test binary is dynamically linked against libc
+    std::ifstream self("/proc/self/exe", std::ios::binary);
+    std::vector<unsigned char> image((std::istreambuf_iterator<char>(self)), std::istreambuf_iterator<char>());
+
+    BOOST_CHECK(get_elf_linkage(image.data(), image.size()) == ElfLinkage::Dynamic);
+}
+
+BOOST_AUTO_TEST_CASE(TestPseudoFileSystemPrefixes)
+{
+    static_assert(get_pseudo_file_system("/proc/self/maps") == PseudoFileSystemProc, "Classified at compile time");
+
+    BOOST_CHECK(get_pseudo_file_system("/proc") == PseudoFileSystemProc);
+    BOOST_CHECK(get_pseudo_file_system("/proc/1234/status") == PseudoFileSystemProc);
+    BOOST_CHECK(get_pseudo_file_system("/dev/null") == PseudoFileSystemDev);
+    BOOST_CHECK(get_pseudo_file_system("/sys/devices/system/cpu/online") == PseudoFileSystemSys);
+    BOOST_CHECK(get_pseudo_file_system("pipe:[1234]") == PseudoFileSystemAnonymous);
+    BOOST_CHECK(get_pseudo_file_system("socket:[1234]") == PseudoFileSystemAnonymous);
+    BOOST_CHECK(get_pseudo_file_system("anon_inode:[eventfd]") == PseudoFileSystemAnonymous);
+    BOOST_CHECK(get_pseudo_file_system("/memfd:jit (deleted)") == PseudoFileSystemAnonymous);
+
+    // Only whole path atoms count
+    BOOST_CHECK(get_pseudo_file_system("/process/file") == PseudoFileSystemNone);
+    BOOST_CHECK(get_pseudo_file_system("/devices") == PseudoFileSystemNone);
+    BOOST_CHECK(get_pseudo_file_system("proc/self/maps") == PseudoFileSystemNone);
+
+    // Paths that may resolve to files elsewhere are left to the regular path handling
+    BOOST_CHECK(get_pseudo_file_system("/proc/../home/file") == PseudoFileSystemNone);
+    BOOST_CHECK(get_pseudo_file_system("/proc/self/fd/3") == PseudoFileSystemNone);
+    BOOST_CHECK(get_pseudo_file_system("/proc/self/task/12/fd/3") == PseudoFileSystemNone);
+    BOOST_CHECK(get_pseudo_file_system("/proc/self/cwd/file") == PseudoFileSystemNone);
+    BOOST_CHECK(get_pseudo_file_system("/proc/1234/root/etc/passwd") == PseudoFileSystemNone);
+    BOOST_CHECK(get_pseudo_file_system("/proc/self/exe") == PseudoFileSystemNone);
+    BOOST_CHECK(get_pseudo_file_system("/proc/self/map_files/400000-401000") == PseudoFileSystemNone);
+    BOOST_CHECK(get_pseudo_file_system("/dev/fd/3") == PseudoFileSystemNone);
+    BOOST_CHECK(get_pseudo_file_system("/dev/stdout") == PseudoFileSystemNone);
+}
+
 BOOST_AUTO_TEST_SUITE_END();
\ No newline at end of file
@@ -0,0 +1,387 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Microbenchmarks of the manifest policy search (Windows/DetoursServices/PolicySearch.cpp), which every sandbox runs
+// for every access it checks: the Windows detours, the macOS sandbox and the Linux interposer all compile the same
+// sources. Every search is done twice, walking the tree from the root (FindFileAccessPolicyInTreeEx) and through the
+// record index that ends the payload when FileAccessManifestExtraFlag::EnableManifestRecordIndex is set
+// (FindFileAccessPolicyInTreeWithIndex), and both must find the same record. Every benchmark prints one JSON object
+// per line, in the same format as interposer_benchmark:
+//
+//      {"benchmark":"tree_declared_file","iterations":200000,"nsPerOp":84.2,"minNsPerOp":81.9}
+//
+// where nsPerOp is the median over a few repetitions and minNsPerOp is the best one.
+//
+// Usage: policy_search_benchmark [scale]
+//      scale   multiplies the number of iterations of every benchmark (default: 1)
+//
+// The manifest tree is serialized in memory the way FileAccessManifest.cs does (CODESYNC: FileAccessManifest.cs ::
+// InternalSerialize, WriteManifestRecordIndex) and models the one of a compiler pip: a few read-only system cones,
+// a couple thousand declared inputs under a source tree, and writable output and temp cones.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "stdafx.h"
+#include "DataTypes.h"
+#include "PolicySearch.h"
+#include "StringOperations.h"
+
+using namespace std;
+
+static const int REPETITIONS = 5;
+static const int SOURCE_DIRECTORIES = 40;
+static const int SOURCE_FILES_PER_DIRECTORY = 50;
+static const size_t LOOKUPS_PER_SET = 256;
+static const size_t INDEX_ALIGNMENT = 64;
+
+typedef struct Node
+{
+    uint32_t conePolicy = 0;
+    uint32_t nodePolicy = 0;
+    uint32_t pathId = 0;
+    map<string, Node> children;
+} Node;
+
+typedef struct IndexEntry
+{
+    uint64_t prefixHash;
+    uint32_t recordOffset;
+    int parent;
+} IndexEntry;
+
+static uint64_t NowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void Fail(const char *what, const string &path)
+{
+    fprintf(stderr, "policy_search_benchmark: %s: %s\n", what, path.c_str());
+    exit(1);
+}
+
+// Splits a path into atoms the way PolicySearch tokenizes it: the leading separators stay with the first atom
+static vector<string> GetAtoms(const string &path)
+{
+    vector<string> atoms;
+    size_t start = 0;
+    while (start < path.length())
+    {
+        size_t end = start;
+        while (end < path.length() && path[end] == '/')
+        {
+            end++;
+        }
+
+        end = path.find('/', end);
+        if (end == string::npos)
+        {
+            end = path.length();
+        }
+
+        atoms.push_back(path.substr(start, end - start));
+        start = end + 1;
+    }
+
+    return atoms;
+}
+
+static void AddPath(Node &root, const string &path, uint32_t conePolicy, uint32_t nodePolicy, uint32_t pathId)
+{
+    Node *node = &root;
+    for (const string &atom : GetAtoms(path))
+    {
+        node = &node->children[atom];
+    }
+
+    node->conePolicy = conePolicy;
+    node->nodePolicy = nodePolicy;
+    node->pathId = pathId;
+}
+
+static void Write32(vector<uint8_t> &bytes, uint32_t value)
+{
+    bytes.insert(bytes.end(), (const uint8_t *)&value, (const uint8_t *)&value + sizeof(value));
+}
+
+static void Write64(vector<uint8_t> &bytes, uint64_t value)
+{
+    bytes.insert(bytes.end(), (const uint8_t *)&value, (const uint8_t *)&value + sizeof(value));
+}
+
+static void Patch32(vector<uint8_t> &bytes, size_t position, uint32_t value)
+{
+    memcpy(&bytes[position], &value, sizeof(value));
+}
+
+static uint32_t HashAtom(const string &atom, vector<uint8_t> &normalized)
+{
+    normalized.resize(atom.length() + 1);
+    return NormalizeAndHashPath(atom.c_str(), reinterpret_cast<PBYTE>(normalized.data()), (DWORD)normalized.size());
+}
+
+static void Serialize(const Node &node, const string *atom, vector<uint8_t> &bytes, vector<IndexEntry> &records, int parent, uint64_t prefixHash)
+{
+    size_t start = bytes.size();
+    int recordIndex = (int)records.size();
+    records.push_back({ prefixHash, (uint32_t)start, parent });
+
+    vector<uint8_t> normalized;
+    uint32_t hash = atom == nullptr ? 0 : HashAtom(*atom, normalized);
+
+#ifdef _DEBUG
+    Write32(bytes, 0xF00DCAFE);
+#endif
+    Write32(bytes, hash);
+    Write32(bytes, node.conePolicy);
+    Write32(bytes, node.nodePolicy);
+    Write32(bytes, node.pathId);
+    Write64(bytes, (uint64_t)-1);
+
+    uint32_t childCount = (uint32_t)node.children.size();
+    uint32_t bucketCount = childCount == 0 ? 0 : (uint32_t)(childCount / 0.7);
+    Write32(bytes, bucketCount);
+    size_t bucketsStart = bytes.size();
+    for (uint32_t i = 0; i < bucketCount; i++)
+    {
+        Write32(bytes, 0);
+    }
+
+    if (atom == nullptr)
+    {
+        Write32(bytes, 0);
+    }
+    else
+    {
+        bytes.insert(bytes.end(), normalized.begin(), normalized.end());
+        while (bytes.size() % 4 != 0)
+        {
+            bytes.push_back(0);
+        }
+    }
+
+    // The same open addressing (with collision chain bits) as the buckets written by FileAccessManifest.cs
+    vector<uint32_t> offsets(bucketCount, 0);
+    for (const auto &child : node.children)
+    {
+        vector<uint8_t> childNormalized;
+        uint32_t childHash = HashAtom(child.first, childNormalized);
+        uint32_t index = childHash % bucketCount;
+        if (offsets[index] != 0)
+        {
+            offsets[index] |= FileAccessBucketOffsetFlag::ChainStart;
+            index = (index + 1) % bucketCount;
+            while (offsets[index] != 0)
+            {
+                offsets[index] |= FileAccessBucketOffsetFlag::ChainContinuation;
+                index = (index + 1) % bucketCount;
+            }
+        }
+
+        offsets[index] = (uint32_t)(bytes.size() - start);
+        Serialize(child.second, &child.first, bytes, records, recordIndex, CombineManifestPrefixHash(prefixHash, childHash));
+    }
+
+    for (uint32_t i = 0; i < bucketCount; i++)
+    {
+        Patch32(bytes, bucketsStart + i * sizeof(uint32_t), offsets[i]);
+    }
+}
+
+static void WriteIndex(vector<uint8_t> &bytes, const vector<IndexEntry> &records)
+{
+    uint32_t slotCount = 4;
+    while (slotCount < records.size() * 2)
+    {
+        slotCount *= 2;
+    }
+
+    uint32_t mask = slotCount - 1;
+    vector<ManifestRecordIndexSlot> slots(slotCount, ManifestRecordIndexSlot { 0, 0, 0 });
+    vector<uint32_t> slotOfRecord(records.size());
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        uint32_t slot = (uint32_t)records[i].prefixHash & mask;
+        while (slots[slot].PrefixHash != 0)
+        {
+            slot = (slot + 1) & mask;
+        }
+
+        slots[slot].PrefixHash = records[i].prefixHash;
+        slots[slot].RecordOffset = records[i].recordOffset;
+        slots[slot].Parent = records[i].parent < 0 ? MANIFEST_RECORD_INDEX_NO_PARENT : slotOfRecord[records[i].parent];
+        slotOfRecord[i] = slot;
+    }
+
+    while (bytes.size() % INDEX_ALIGNMENT != 0)
+    {
+        bytes.push_back(0);
+    }
+
+    for (const ManifestRecordIndexSlot &slot : slots)
+    {
+        Write64(bytes, slot.PrefixHash);
+        Write32(bytes, slot.RecordOffset);
+        Write32(bytes, slot.Parent);
+    }
+
+    Write32(bytes, slotCount);
+    Write32(bytes, (uint32_t)records.size());
+    Write32(bytes, slotCount * sizeof(ManifestRecordIndexSlot) + sizeof(ManifestRecordIndexFooter));
+    Write32(bytes, MANIFEST_RECORD_INDEX_TAG);
+}
+
+static string SourceFile(int directory, int file)
+{
+    return "/home/user/src/module" + to_string(directory) + "/file" + to_string(file) + ".cpp";
+}
+
+static Node CreateTree()
+{
+    Node root;
+    AddPath(root, "/usr", FileAccessPolicy_AllowRead | FileAccessPolicy_AllowReadIfNonExistent, FileAccessPolicy_AllowRead | FileAccessPolicy_AllowReadIfNonExistent, 1);
+    AddPath(root, "/lib", FileAccessPolicy_AllowRead | FileAccessPolicy_AllowReadIfNonExistent, FileAccessPolicy_AllowRead | FileAccessPolicy_AllowReadIfNonExistent, 2);
+    AddPath(root, "/etc", FileAccessPolicy_AllowRead | FileAccessPolicy_AllowReadIfNonExistent, FileAccessPolicy_AllowRead | FileAccessPolicy_AllowReadIfNonExistent, 3);
+    AddPath(root, "/tmp", FileAccessPolicy_AllowAll, FileAccessPolicy_AllowAll, 4);
+    AddPath(root, "/home/user/out/obj", FileAccessPolicy_AllowAll, FileAccessPolicy_AllowAll, 5);
+
+    uint32_t pathId = 100;
+    for (int directory = 0; directory < SOURCE_DIRECTORIES; directory++)
+    {
+        for (int file = 0; file < SOURCE_FILES_PER_DIRECTORY; file++)
+        {
+            AddPath(root, SourceFile(directory, file), 0, FileAccessPolicy_AllowRead, pathId++);
+        }
+    }
+
+    return root;
+}
+
+static vector<string> CreateLookups(const function<string(size_t)> &pathAt)
+{
+    vector<string> paths;
+    for (size_t i = 0; i < LOOKUPS_PER_SET; i++)
+    {
+        paths.push_back(pathAt(i));
+    }
+
+    return paths;
+}
+
+static void Run(const char *name, int iterations, const function<void()> &operation)
+{
+    for (int i = 0; i < max(1, iterations / 10); i++)
+    {
+        operation();
+    }
+
+    vector<double> nsPerOp;
+    for (int repetition = 0; repetition < REPETITIONS; repetition++)
+    {
+        uint64_t start = NowNs();
+        for (int i = 0; i < iterations; i++)
+        {
+            operation();
+        }
+
+        nsPerOp.push_back((double)(NowNs() - start) / iterations);
+    }
+
+    sort(nsPerOp.begin(), nsPerOp.end());
+    printf("{\"benchmark\":\"%s\",\"iterations\":%d,\"nsPerOp\":%.1f,\"minNsPerOp\":%.1f}\n",
+        name, iterations, nsPerOp[REPETITIONS / 2], nsPerOp[0]);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    int scale = argc > 1 ? atoi(argv[1]) : 1;
+    if (scale <= 0)
+    {
+        fprintf(stderr, "Usage: %s [scale]\n", argv[0]);
+        return 1;
+    }
+
+    vector<uint8_t> bytes;
+    vector<IndexEntry> records;
+    Serialize(CreateTree(), nullptr, bytes, records, -1, MANIFEST_RECORD_INDEX_PREFIX_HASH_SEED);
+    WriteIndex(bytes, records);
+
+    // The index is aligned relative to the start of the tree, so the copy must start at the same alignment
+    void *payload = nullptr;
+    if (posix_memalign(&payload, INDEX_ALIGNMENT, bytes.size()) != 0)
+    {
+        Fail("posix_memalign", to_string(bytes.size()));
+    }
+
+    memcpy(payload, bytes.data(), bytes.size());
+    PCManifestRecord root = static_cast<PCManifestRecord>(payload);
+    ManifestRecordIndex index;
+    if (!index.TryLocate(root, static_cast<const BYTE *>(payload) + bytes.size()))
+    {
+        Fail("no record index", "");
+    }
+
+    struct
+    {
+        const char *treeName;
+        const char *indexName;
+        vector<string> paths;
+    } sets[] =
+    {
+        // Exact matches of declared inputs, five levels down
+        { "tree_declared_file", "index_declared_file", CreateLookups([](size_t i) { return SourceFile(i % SOURCE_DIRECTORIES, (i * 7) % SOURCE_FILES_PER_DIRECTORY); }) },
+        // Probes of absent files next to declared inputs: the search is truncated at the directory
+        { "tree_undeclared_file", "index_undeclared_file", CreateLookups([](size_t i) { return "/home/user/src/module" + to_string(i % SOURCE_DIRECTORIES) + "/file" + to_string(i) + ".h"; }) },
+        // Deep paths under a read-only cone: the search is truncated right below the root
+        { "tree_system_cone", "index_system_cone", CreateLookups([](size_t i) { return "/usr/lib/gcc/x86_64-linux-gnu/12/include/c++/bits/header" + to_string(i) + ".h"; }) },
+        // Outputs written under a writable cone
+        { "tree_output_cone", "index_output_cone", CreateLookups([](size_t i) { return "/home/user/out/obj/module" + to_string(i % SOURCE_DIRECTORIES) + "/file" + to_string(i) + ".o"; }) },
+    };
+
+    for (auto &set : sets)
+    {
+        for (const string &path : set.paths)
+        {
+            PolicySearchCursor walked = FindFileAccessPolicyInTreeEx(PolicySearchCursor(root), path.c_str(), path.length());
+            PolicySearchCursor indexed = FindFileAccessPolicyInTreeWithIndex(index, path.c_str(), path.length());
+            if (!walked.IsValid() || walked.Record != indexed.Record || walked.SearchWasTruncated != indexed.SearchWasTruncated)
+            {
+                Fail("the index and the tree walk disagree", path);
+            }
+        }
+    }
+
+    // Keeps the searches from being optimized away
+    volatile uint32_t sink = 0;
+    for (auto &set : sets)
+    {
+        const vector<string> &paths = set.paths;
+        size_t next = 0;
+
+        Run(set.treeName, 200000 * scale, [&]()
+        {
+            const string &path = paths[next++ % paths.size()];
+            sink += FindFileAccessPolicyInTreeEx(PolicySearchCursor(root), path.c_str(), path.length()).Record->PathId;
+        });
+
+        Run(set.indexName, 200000 * scale, [&]()
+        {
+            const string &path = paths[next++ % paths.size()];
+            sink += FindFileAccessPolicyInTreeWithIndex(index, path.c_str(), path.length()).Record->PathId;
+        });
+    }
+
+    free(payload);
+    return 0;
+}
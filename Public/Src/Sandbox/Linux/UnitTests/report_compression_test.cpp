@@ -0,0 +1,78 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define BOOST_TEST_MODULE LinuxSandboxTest
+#define _DO_NOT_EXPORT
+
+#include <boost/test/included/unit_test.hpp>
+
+#include <string>
+#include "report_compression.hpp"
+
+static std::string RoundTrip(const std::string &source, size_t &compressedSize)
+{
+    std::string compressed(source.size() + 64, '\0');
+    compressedSize = ReportCompression::Compress(source.data(), source.size(), &compressed[0], compressed.size());
+    BOOST_REQUIRE(compressedSize > 0);
+
+    std::string decompressed(source.size(), '\0');
+    ssize_t decompressedSize = ReportCompression::Decompress(compressed.data(), compressedSize, &decompressed[0], decompressed.size());
+    BOOST_REQUIRE_EQUAL(decompressedSize, (ssize_t)source.size());
+    return decompressed;
+}
+
+BOOST_AUTO_TEST_CASE(TestRoundTrip)
+{
+    // A batch of reports is mostly the same header fields and paths sharing long prefixes
+    std::string batch;
+    for (int i = 0; i < 40; i++)
+    {
+        std::string path = "/home/user/src/project/out/obj/module" + std::to_string(i % 7) + "/file" + std::to_string(i) + ".o";
+        uint32_t length = 28 + path.size();
+        batch.append((const char *)&length, sizeof(length));
+        batch.append("\x10\x27\0\0\x01\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\x05\0\0\0\0\0\0\0", 28);
+        batch.append(path);
+    }
+
+    size_t compressedSize;
+    BOOST_CHECK(RoundTrip(batch, compressedSize) == batch);
+    BOOST_CHECK_LT(compressedSize * 3, batch.size());
+}
+
+BOOST_AUTO_TEST_CASE(TestShortAndIncompressibleInputs)
+{
+    size_t compressedSize;
+    BOOST_CHECK(RoundTrip("", compressedSize) == "");
+    BOOST_CHECK(RoundTrip("/tmp", compressedSize) == "/tmp");
+    BOOST_CHECK(RoundTrip("aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", compressedSize) == "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa");
+
+    std::string noise;
+    for (uint32_t i = 0, x = 12345; i < 1000; i++)
+    {
+        x = x * 1103515245 + 12345;
+        noise.push_back((char)(x >> 16));
+    }
+
+    BOOST_CHECK(RoundTrip(noise, compressedSize) == noise);
+
+    // A block that doesn't fit is not produced at all
+    std::string small(noise.size() / 2, '\0');
+    BOOST_CHECK_EQUAL(ReportCompression::Compress(noise.data(), noise.size(), &small[0], small.size()), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(TestMalformedBlocks)
+{
+    char output[64];
+
+    // A match pointing before the start of the output
+    const char backReference[] = { 0x10, 'a', 0x02, 0x00 };
+    BOOST_CHECK_EQUAL(ReportCompression::Decompress(backReference, sizeof(backReference), output, sizeof(output)), -1);
+
+    // Literals running past the end of the block
+    const char truncated[] = { 0x50, 'a', 'b' };
+    BOOST_CHECK_EQUAL(ReportCompression::Decompress(truncated, sizeof(truncated), output, sizeof(output)), -1);
+
+    // More output than room for it
+    const char literals[] = { 0x30, 'a', 'b', 'c' };
+    BOOST_CHECK_EQUAL(ReportCompression::Decompress(literals, sizeof(literals), output, 2), -1);
+}
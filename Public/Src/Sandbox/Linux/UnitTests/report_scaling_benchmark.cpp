@@ -0,0 +1,220 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Scaling benchmark of the report pipeline: 1, 2, 4, ... up to N reporter processes hammer the sandbox at once, each one making
+// accesses to distinct paths so that every access ends up as a report (no cache can drop it). The interesting part is not the
+// cost of one report but what happens when many processes share the report channel and the single reader on the other side.
+// It is run with and without the sandbox (see InterposeSandboxProcessTest.RunReportScalingBenchmark), the unsandboxed run
+// being the cost of the accesses themselves. Every round prints one JSON object per line:
+//
+//      {"benchmark":"report_scaling","processes":8,"reports":16000,"reportsPerSec":812345.6,"p50Ns":4120,"p90Ns":6210,
+//       "p99Ns":18230,"p999Ns":95400,"maxNs":1203000,"stalledFraction":0.0012}
+//
+// where the percentiles are the latencies of single accesses across all the processes of the round, and stalledFraction is
+// the share of accesses that took more than STALL_FACTOR times the median of the single process round (i.e., writers that were
+// most likely blocked on the report channel). A last line tells the first round whose throughput did not grow with the
+// number of processes (0 if all of them did):
+//
+//      {"benchmark":"report_scaling_saturation","processes":16}
+//
+// Usage: report_scaling_benchmark [maxProcesses] [reportsPerProcess]
+//      maxProcesses        number of processes of the last round (default: 64)
+//      reportsPerProcess   accesses made by every process in every round (default: 2000)
+//
+// The accessed paths live (or rather, don't exist) under the current working directory.
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+static const int DEFAULT_MAX_PROCESSES = 64;
+static const int DEFAULT_REPORTS_PER_PROCESS = 2000;
+
+// A round saturated the pipeline when it did not get at least this much more throughput than the previous one
+static const double SCALING_THRESHOLD = 1.1;
+
+static const uint64_t STALL_FACTOR = 10;
+
+static const char *FIXTURE_DIRECTORY = "report_scaling_benchmark";
+
+// Written by every reporter process, read by the parent once they are all done
+struct ReporterTimes
+{
+    uint64_t startNs;
+    uint64_t endNs;
+};
+
+static uint64_t NowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void Fail(const char *what)
+{
+    fprintf(stderr, "report_scaling_benchmark: %s failed: %s\n", what, strerror(errno));
+    exit(1);
+}
+
+static void Reporter(int round, int index, int reports, int startPipe, ReporterTimes *times, uint32_t *latencies)
+{
+    // The parent closes its end of the pipe once every reporter of the round is started, so they all start together
+    char ignored;
+    if (read(startPipe, &ignored, 1) != 0)
+    {
+        Fail("waiting for the start of the round");
+    }
+
+    char path[256];
+    times->startNs = NowNs();
+    for (int i = 0; i < reports; i++)
+    {
+        // Every path is probed once across the whole run
+        snprintf(path, sizeof(path), "%s/r%d_p%d_%d", FIXTURE_DIRECTORY, round, index, i);
+
+        struct stat st;
+        uint64_t start = NowNs();
+        int result = stat(path, &st);
+        latencies[i] = (uint32_t)min<uint64_t>(NowNs() - start, UINT32_MAX);
+
+        if (result == 0 || errno != ENOENT)
+        {
+            Fail("stat");
+        }
+    }
+
+    times->endNs = NowNs();
+}
+
+// Runs one round with 'processes' reporters and returns its throughput in reports per second
+static double RunRound(int round, int processes, int reportsPerProcess, ReporterTimes *times, uint32_t *latencies, uint64_t *stallThresholdNs)
+{
+    int startPipe[2];
+    if (pipe(startPipe) != 0)
+    {
+        Fail("pipe");
+    }
+
+    vector<pid_t> children;
+    for (int i = 0; i < processes; i++)
+    {
+        pid_t child = fork();
+        if (child == -1)
+        {
+            Fail("fork");
+        }
+
+        if (child == 0)
+        {
+            close(startPipe[1]);
+            Reporter(round, i, reportsPerProcess, startPipe[0], &times[i], &latencies[(size_t)i * reportsPerProcess]);
+            _exit(0);
+        }
+
+        children.push_back(child);
+    }
+
+    close(startPipe[0]);
+    close(startPipe[1]);
+
+    for (pid_t child : children)
+    {
+        int status;
+        if (waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            fprintf(stderr, "report_scaling_benchmark: a reporter process failed\n");
+            exit(1);
+        }
+    }
+
+    uint64_t start = UINT64_MAX;
+    uint64_t end = 0;
+    for (int i = 0; i < processes; i++)
+    {
+        start = min(start, times[i].startNs);
+        end = max(end, times[i].endNs);
+    }
+
+    size_t reports = (size_t)processes * reportsPerProcess;
+    vector<uint32_t> sorted(latencies, latencies + reports);
+    sort(sorted.begin(), sorted.end());
+    auto percentile = [&](double p) { return sorted[min(reports - 1, (size_t)(p * reports))]; };
+
+    // Stalls are told apart from the latency of an uncontended report, as measured by the first round
+    if (*stallThresholdNs == 0)
+    {
+        *stallThresholdNs = max<uint64_t>(1, percentile(0.5) * STALL_FACTOR);
+    }
+
+    size_t stalled = sorted.end() - upper_bound(sorted.begin(), sorted.end(), *stallThresholdNs);
+    double reportsPerSec = (double)reports * 1e9 / (double)max<uint64_t>(1, end - start);
+
+    printf("{\"benchmark\":\"report_scaling\",\"processes\":%d,\"reports\":%zu,\"reportsPerSec\":%.1f,\"p50Ns\":%u,\"p90Ns\":%u,"
+           "\"p99Ns\":%u,\"p999Ns\":%u,\"maxNs\":%u,\"stalledFraction\":%.4f}\n",
+        processes, reports, reportsPerSec, percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999), sorted[reports - 1],
+        (double)stalled / reports);
+    fflush(stdout);
+
+    return reportsPerSec;
+}
+
+int main(int argc, char **argv)
+{
+    int maxProcesses = argc > 1 ? atoi(argv[1]) : DEFAULT_MAX_PROCESSES;
+    int reportsPerProcess = argc > 2 ? atoi(argv[2]) : DEFAULT_REPORTS_PER_PROCESS;
+    if (maxProcesses <= 0 || reportsPerProcess <= 0)
+    {
+        fprintf(stderr, "Usage: %s [maxProcesses] [reportsPerProcess]\n", argv[0]);
+        return 1;
+    }
+
+    mkdir(FIXTURE_DIRECTORY, 0755);
+
+    // Shared with the reporters, which are forked
+    size_t timesSize = sizeof(ReporterTimes) * maxProcesses;
+    size_t latenciesSize = sizeof(uint32_t) * maxProcesses * (size_t)reportsPerProcess;
+    void *shared = mmap(nullptr, timesSize + latenciesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED)
+    {
+        Fail("mmap");
+    }
+
+    ReporterTimes *times = (ReporterTimes *)shared;
+    uint32_t *latencies = (uint32_t *)((char *)shared + timesSize);
+
+    uint64_t stallThresholdNs = 0;
+    double previousReportsPerSec = 0;
+    int saturation = 0;
+    int round = 0;
+    for (int processes = 1; ; processes = min(processes * 2, maxProcesses))
+    {
+        double reportsPerSec = RunRound(round++, processes, reportsPerProcess, times, latencies, &stallThresholdNs);
+        if (saturation == 0 && previousReportsPerSec > 0 && reportsPerSec < previousReportsPerSec * SCALING_THRESHOLD)
+        {
+            saturation = processes;
+        }
+
+        previousReportsPerSec = reportsPerSec;
+        if (processes == maxProcesses)
+        {
+            break;
+        }
+    }
+
+    printf("{\"benchmark\":\"report_scaling_saturation\",\"processes\":%d}\n", saturation);
+
+    munmap(shared, timesSize + latenciesSize);
+    return 0;
+}
@@ -0,0 +1,104 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define BOOST_TEST_MODULE LinuxSandboxTest
+#define _DO_NOT_EXPORT
+
+#include <boost/test/included/unit_test.hpp>
+#include <stdlib.h>
+#include <shared_access_cache.hpp>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(SharedAccessCacheTests)
+
+BOOST_AUTO_TEST_CASE(TestCheckAndAdd)
+{
+    void *image = calloc(1, SharedAccessCache::GetImageSize());
+    SharedAccessCache cache;
+    BOOST_CHECK(cache.Attach(image, SharedAccessCache::GetImageSize(), /* initialize */ true));
+
+    BOOST_CHECK(!cache.Check(1, "/usr/bin/gcc", "/usr/include/stdio.h", /* addEntryIfMissing */ false));
+    BOOST_CHECK(!cache.Check(1, "/usr/bin/gcc", "/usr/include/stdio.h", /* addEntryIfMissing */ true));
+    BOOST_CHECK(cache.Check(1, "/usr/bin/gcc", "/usr/include/stdio.h", /* addEntryIfMissing */ false));
+
+    // Event type and executable are part of the key
+    BOOST_CHECK(!cache.Check(2, "/usr/bin/gcc", "/usr/include/stdio.h", /* addEntryIfMissing */ false));
+    BOOST_CHECK(!cache.Check(1, "/usr/bin/cc1", "/usr/include/stdio.h", /* addEntryIfMissing */ false));
+
+    // The executable and the path can't bleed into each other
+    BOOST_CHECK(!cache.Check(1, "/usr/bin/gcc/usr", "/include/stdio.h", /* addEntryIfMissing */ false));
+
+    free(image);
+}
+
+BOOST_AUTO_TEST_CASE(TestMountNamespaces)
+{
+    void *image = calloc(1, SharedAccessCache::GetImageSize());
+    SharedAccessCache root, containerized;
+    BOOST_CHECK(root.Attach(image, SharedAccessCache::GetImageSize(), /* initialize */ true));
+    BOOST_CHECK(containerized.Attach(image, SharedAccessCache::GetImageSize(), /* initialize */ false));
+
+    root.SetMountNamespace(4026531840);
+    containerized.SetMountNamespace(4026532201);
+
+    // The same path may name a different file in another mount namespace
+    BOOST_CHECK(!root.Check(1, "/bin/sh", "/etc/passwd", /* addEntryIfMissing */ true));
+    BOOST_CHECK(!containerized.Check(1, "/bin/sh", "/etc/passwd", /* addEntryIfMissing */ false));
+
+    // Processes that share the mount namespace share the entries
+    containerized.SetMountNamespace(4026531840);
+    BOOST_CHECK(containerized.Check(1, "/bin/sh", "/etc/passwd", /* addEntryIfMissing */ false));
+
+    free(image);
+}
+
+BOOST_AUTO_TEST_CASE(TestScopeGenerations)
+{
+    void *image = calloc(1, SharedAccessCache::GetImageSize());
+    SharedAccessCache cache;
+    BOOST_CHECK(cache.Attach(image, SharedAccessCache::GetImageSize(), /* initialize */ true));
+
+    BOOST_CHECK(!cache.Check(1, "/bin/sh", "/src/a.c", /* addEntryIfMissing */ true));
+    BOOST_CHECK(!cache.Check(1, "/bin/sh", "/out/a.o", /* addEntryIfMissing */ true));
+
+    // A manifest update that changed the scope of /src: its accesses are checked again, the others are still cached
+    BOOST_CHECK(!cache.Check(1, "/bin/sh", "/src/a.c", /* addEntryIfMissing */ true, /* scopeGeneration */ 1));
+    BOOST_CHECK(cache.Check(1, "/bin/sh", "/src/a.c", /* addEntryIfMissing */ false, /* scopeGeneration */ 1));
+    BOOST_CHECK(cache.Check(1, "/bin/sh", "/out/a.o", /* addEntryIfMissing */ false));
+
+    free(image);
+}
+
+BOOST_AUTO_TEST_CASE(TestSharedImage)
+{
+    void *image = calloc(1, SharedAccessCache::GetImageSize());
+
+    // A process attaching to an image nobody initialized does not use it
+    SharedAccessCache uninitialized;
+    BOOST_CHECK(!uninitialized.Attach(image, SharedAccessCache::GetImageSize(), /* initialize */ false));
+    BOOST_CHECK(!uninitialized.IsEnabled());
+    BOOST_CHECK(!uninitialized.Check(1, "/bin/sh", "/etc/passwd", /* addEntryIfMissing */ true));
+
+    SharedAccessCache root, child;
+    BOOST_CHECK(root.Attach(image, SharedAccessCache::GetImageSize(), /* initialize */ true));
+    BOOST_CHECK(child.Attach(image, SharedAccessCache::GetImageSize(), /* initialize */ false));
+    BOOST_CHECK(!child.Attach(image, SharedAccessCache::GetImageSize() - 1, /* initialize */ false));
+
+    root.Check(1, "/bin/sh", "/etc/passwd", /* addEntryIfMissing */ true);
+    BOOST_CHECK(child.Check(1, "/bin/sh", "/etc/passwd", /* addEntryIfMissing */ false));
+
+    for (int i = 0; i < 10000; i++)
+    {
+        child.Check(1, "/bin/sh", "/tmp/file" + std::to_string(i), /* addEntryIfMissing */ true);
+    }
+
+    for (int i = 0; i < 10000; i++)
+    {
+        BOOST_CHECK(root.Check(1, "/bin/sh", "/tmp/file" + std::to_string(i), /* addEntryIfMissing */ false));
+    }
+
+    free(image);
+}
+
+BOOST_AUTO_TEST_SUITE_END();
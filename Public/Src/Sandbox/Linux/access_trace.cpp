@@ -0,0 +1,234 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <new>
+#include "access_trace.hpp"
+
+bool AccessTrace::Start(int fd, Writer writer, pid_t pid, const char *fam, size_t famLength, const char *programPath)
+{
+    const std::lock_guard<std::mutex> lock(lock_);
+
+    FileHeader header =
+    {
+        .magic              = MAGIC,
+        .version            = VERSION,
+        .pid                = pid,
+        .famLength          = (uint32_t)famLength,
+        .programPathLength  = (uint32_t)strlen(programPath),
+    };
+
+    fd_ = fd;
+    writer_ = writer;
+    length_ = 0;
+    executables_.Clear();
+
+    if (!WriteAll((const char *)&header, sizeof(header)) || !WriteAll(fam, famLength) || !WriteAll(programPath, header.programPathLength))
+    {
+        fd_ = -1;
+        return false;
+    }
+
+    return true;
+}
+
+void AccessTrace::Append(Kind kind, const char *syscallName, const IOEvent &event, bool checkCache, const AccessCheckResult &result, uint64_t timestampNs, uint64_t durationNs)
+{
+    const std::lock_guard<std::mutex> lock(lock_);
+    if (fd_ == -1)
+    {
+        return;
+    }
+
+    bool executableInterned = executables_.Contains(event);
+    size_t syscallNameLength = strlen(syscallName);
+    size_t eventLength = event.RecordSize(executableInterned);
+
+    RecordHeader header =
+    {
+        .length             = (uint32_t)(syscallNameLength + eventLength),
+        .kind               = (uint16_t)kind,
+        .syscallNameLength  = (uint16_t)syscallNameLength,
+        .checkCache         = checkCache ? 1u : 0u,
+        .result             = PackResult(result),
+        .timestampNs        = timestampNs,
+        .durationNs         = durationNs,
+    };
+
+    size_t recordLength = sizeof(header) + header.length;
+    if (recordLength > BUFFER_SIZE)
+    {
+        return;
+    }
+
+    if (length_ + recordLength > BUFFER_SIZE)
+    {
+        WriteBuffer();
+    }
+
+    char *record = buffer_ + length_;
+    memcpy(record, &header, sizeof(header));
+    memcpy(record + sizeof(header), syscallName, syscallNameLength);
+    event.WriteRecord(record + sizeof(header) + syscallNameLength, executableInterned);
+    length_ += recordLength;
+
+    executables_.Record(event);
+}
+
+void AccessTrace::Flush()
+{
+    const std::lock_guard<std::mutex> lock(lock_);
+    if (fd_ != -1)
+    {
+        WriteBuffer();
+    }
+}
+
+int AccessTrace::Detach()
+{
+    // Only one thread survives a fork, so there is nobody to synchronize with
+    new (&lock_) std::mutex();
+
+    int fd = fd_.exchange(-1);
+    length_ = 0;
+    executables_.Clear();
+    return fd;
+}
+
+bool AccessTrace::Forget(int fd)
+{
+    if (fd < 0 || fd != fd_.load(std::memory_order_relaxed))
+    {
+        return false;
+    }
+
+    const std::lock_guard<std::mutex> lock(lock_);
+    if (fd != fd_)
+    {
+        return false;
+    }
+
+    // The descriptor is not ours to write to anymore, the records that were not written yet are lost
+    fd_ = -1;
+    length_ = 0;
+    return true;
+}
+
+void AccessTrace::WriteBuffer()
+{
+    if (length_ > 0 && !WriteAll(buffer_, length_))
+    {
+        // The rest of the trace would not make sense without these records
+        fd_ = -1;
+    }
+
+    length_ = 0;
+}
+
+bool AccessTrace::WriteAll(const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = writer_(fd_, data, length);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (written <= 0)
+        {
+            return false;
+        }
+
+        data += written;
+        length -= written;
+    }
+
+    return true;
+}
+
+bool AccessTraceReader::Open(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    bytes_.clear();
+    char chunk[64 * 1024];
+    ssize_t count;
+    while ((count = read(fd, chunk, sizeof(chunk))) != 0)
+    {
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (count < 0)
+        {
+            close(fd);
+            return false;
+        }
+
+        bytes_.insert(bytes_.end(), chunk, chunk + count);
+    }
+
+    close(fd);
+
+    AccessTrace::FileHeader header;
+    if (bytes_.size() < sizeof(header))
+    {
+        return false;
+    }
+
+    memcpy(&header, bytes_.data(), sizeof(header));
+    if (header.magic != AccessTrace::MAGIC
+        || header.version != AccessTrace::VERSION
+        || bytes_.size() - sizeof(header) < (size_t)header.famLength + header.programPathLength)
+    {
+        return false;
+    }
+
+    pid_ = header.pid;
+    fam_ = bytes_.data() + sizeof(header);
+    famLength_ = header.famLength;
+    programPath_.assign(fam_ + famLength_, header.programPathLength);
+    position_ = sizeof(header) + famLength_ + header.programPathLength;
+    executables_.Clear();
+    return true;
+}
+
+bool AccessTraceReader::Next(Record &record)
+{
+    AccessTrace::RecordHeader header;
+    if (bytes_.size() - position_ < sizeof(header))
+    {
+        return false;
+    }
+
+    memcpy(&header, bytes_.data() + position_, sizeof(header));
+    if (bytes_.size() - position_ - sizeof(header) < header.length || header.length < header.syscallNameLength)
+    {
+        return false;
+    }
+
+    const char *data = bytes_.data() + position_ + sizeof(header);
+    if (!IOEvent::ReadRecord(data + header.syscallNameLength, header.length - header.syscallNameLength, record.event, &executables_))
+    {
+        return false;
+    }
+
+    record.kind = (AccessTrace::Kind)header.kind;
+    record.syscallName.assign(data, header.syscallNameLength);
+    record.checkCache = header.checkCache != 0;
+    record.result = header.result;
+    record.timestampNs = header.timestampNs;
+    record.durationNs = header.durationNs;
+
+    position_ += sizeof(header) + header.length;
+    return true;
+}
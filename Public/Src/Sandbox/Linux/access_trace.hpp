@@ -0,0 +1,159 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "IOEvent.hpp"
+#include "FileAccessHelpers.h"
+
+/**
+ * Binary trace of the accesses checked by the observer of a process, recorded when BxlEnvAccessTraceDirectory is set so the
+ * load of a real pip can be replayed offline (see accesstracereplay.cpp): every call of BxlObserver::create_access that gets
+ * past path resolution is recorded with its arguments, when it happened, how long the check took and what it returned.
+ *
+ * A trace file starts with a FileHeader, followed by the FAM of the pip and the path of the program, so the trace can be
+ * replayed after the pip is gone. Records follow, each a RecordHeader followed by the name of the interposed function and the
+ * binary record of the checked event (see IOEvent::WriteRecord), whose executable is interned the same way the EventRing does.
+ *
+ * Recording is a diagnostic mode: records are appended to a process-wide buffer under a lock, and the buffer is written to the
+ * file when it fills up and whenever the reports of the process are flushed (e.g., before the process forks, execs or exits).
+ */
+class AccessTrace final
+{
+public:
+    static const uint32_t MAGIC = 0x54415842; // "BXAT"
+    static const uint32_t VERSION = 1;
+
+    // Records are written to the file this many bytes at a time (at most)
+    static const size_t BUFFER_SIZE = 64 * 1024;
+
+    enum class Kind : uint16_t
+    {
+        // A path access (see BxlObserver::create_access_internal). The event carries the associated pid (0 for the interposed
+        // process itself), the paths and the mode the access was checked with: 0 if the check did not get to resolve it, and
+        // MODE_NONEXISTENT for a path that does not exist. The executable is left empty.
+        Path = 1,
+        // An event checked as is (see BxlObserver::create_access(const char*, IOEvent&, ...)), e.g., reported by the ptrace sandbox
+        Event = 2,
+    };
+
+    typedef struct __attribute__((packed))
+    {
+        uint32_t magic;
+        uint32_t version;
+        int32_t pid;
+        uint32_t famLength;
+        uint32_t programPathLength;
+    } FileHeader;
+
+    typedef struct __attribute__((packed))
+    {
+        // Of what follows this header: the name of the function and the event record
+        uint32_t length;
+        uint16_t kind;
+        uint16_t syscallNameLength;
+        uint32_t checkCache;
+        // See PackResult
+        uint32_t result;
+        // CLOCK_MONOTONIC time at which the check started, and how long it took
+        uint64_t timestampNs;
+        uint64_t durationNs;
+    } RecordHeader;
+
+    typedef ssize_t (*Writer)(int fd, const void *buffer, size_t length);
+
+    AccessTrace() = default;
+    AccessTrace(const AccessTrace&) = delete;
+    AccessTrace& operator = (const AccessTrace&) = delete;
+
+    bool IsEnabled() const { return fd_.load(std::memory_order_relaxed) != -1; }
+
+    // Starts recording into 'fd' (which the trace takes ownership of) by writing the file header. All the writes to the file go through 'writer'.
+    bool Start(int fd, Writer writer, pid_t pid, const char *fam, size_t famLength, const char *programPath);
+
+    void Append(Kind kind, const char *syscallName, const IOEvent &event, bool checkCache, const AccessCheckResult &result, uint64_t timestampNs, uint64_t durationNs);
+
+    // Writes the buffered records to the file
+    void Flush();
+
+    // Stops recording without writing the buffered records, and returns the descriptor of the file for the caller to close (-1 if
+    // there was none). Used on the child side of a fork, where the buffer is a copy of the one in the parent process (which
+    // writes it), and where a thread of the parent may have been holding the lock at the time of the fork.
+    int Detach();
+
+    // Stops recording if 'fd' is the descriptor of the file, which the traced process just closed or reused. Returns whether it was.
+    bool Forget(int fd);
+
+    static uint32_t PackResult(const AccessCheckResult &result)
+    {
+        return (uint32_t)result.Access | ((uint32_t)result.Result << 8) | ((uint32_t)result.Level << 16) | ((uint32_t)result.Validity << 24);
+    }
+
+    static uint64_t NowNs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+private:
+    std::mutex lock_;
+    // Only written while holding lock_, read without it to tell whether recording is on
+    std::atomic<int> fd_ { -1 };
+    Writer writer_ = nullptr;
+    char buffer_[BUFFER_SIZE];
+    size_t length_ = 0;
+    IOEventExecutableTable executables_;
+
+    // Assumes lock_ is held by the caller
+    void WriteBuffer();
+    bool WriteAll(const char *data, size_t length);
+};
+
+/**
+ * Reads back a trace written by AccessTrace.
+ */
+class AccessTraceReader final
+{
+public:
+    typedef struct
+    {
+        AccessTrace::Kind kind;
+        std::string syscallName;
+        IOEvent event;
+        bool checkCache;
+        uint32_t result;
+        uint64_t timestampNs;
+        uint64_t durationNs;
+    } Record;
+
+    // Reads the whole file. Returns false if it can't be read or doesn't start with a valid header.
+    bool Open(const char *path);
+
+    pid_t GetPid() const { return pid_; }
+    const char *GetFam() const { return fam_; }
+    size_t GetFamLength() const { return famLength_; }
+    const std::string &GetProgramPath() const { return programPath_; }
+
+    // Reads the next record. Returns false at the end of the trace, or if the record is malformed or truncated (see IsAtEnd).
+    bool Next(Record &record);
+    bool IsAtEnd() const { return position_ == bytes_.size(); }
+
+private:
+    std::vector<char> bytes_;
+    size_t position_ = 0;
+    pid_t pid_ = 0;
+    const char *fam_ = nullptr;
+    size_t famLength_ = 0;
+    std::string programPath_;
+    IOEventExecutableTable executables_;
+};
@@ -0,0 +1,237 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <pthread.h>
+#include <sys/wait.h>
+#include <vector>
+#include "bxl_observer.hpp"
+
+/**
+ * Replays access traces (see access_trace.hpp) through the observer, without running the processes that made the accesses: every
+ * recorded access is checked again (policy, caches) against the FAM of the trace and its reports are sent, to a pipe that is
+ * drained by a thread of this process instead of the FIFO of the pip. This measures the throughput of the observer on the load
+ * of a real pip, and tells whether the replayed checks still come to the same results as the recorded ones.
+ *
+ * Usage: accesstracereplay [-r repetitions] trace...
+ *
+ * Every trace is replayed in a process of its own (the observer is a per-process singleton), which prints a JSON object per
+ * repetition:
+ *
+ *      {"trace":"1234-0.bxltrace","repetition":0,"records":5210,"replayNsPerRecord":812.3,"recordedNsPerRecord":1430.9,"mismatches":0,"reportBytes":391552}
+ *
+ * where recordedNsPerRecord is the average time the checks took when they were recorded, and mismatches counts the checks of
+ * the repetition that did not come to the recorded result. Repetitions after the first one run with the caches already warm.
+ *
+ * Accesses are replayed from the point where their path was resolved: path resolution and everything done on the descriptors
+ * of the traced process (e.g., the accesses settled on them, see BxlObserver::IsFdAccessSettled) are not part of the replay.
+ */
+
+typedef struct
+{
+    int fd;
+    uint64_t bytes;
+} ReportDrain;
+
+static void *DrainReports(void *arg)
+{
+    ReportDrain *drain = (ReportDrain *)arg;
+    char buffer[PIPE_BUF * 4];
+    ssize_t count;
+    while ((count = read(drain->fd, buffer, sizeof(buffer))) != 0)
+    {
+        if (count < 0 && errno != EINTR)
+        {
+            break;
+        }
+
+        drain->bytes += count > 0 ? count : 0;
+    }
+
+    return nullptr;
+}
+
+static AccessCheckResult Replay(BxlObserver *bxl, const AccessTraceReader::Record &record, AccessReportGroup &report)
+{
+    const IOEvent &recorded = record.event;
+    if (record.kind == AccessTrace::Kind::Path)
+    {
+        return bxl->create_access(record.syscallName.c_str(), recorded.GetEventType(), recorded.GetSrcPath().c_str(), recorded.GetDstPath().c_str(),
+            report, recorded.GetMode(), record.checkCache, recorded.GetPid());
+    }
+
+    IOEvent event = recorded;
+    return bxl->create_access(record.syscallName.c_str(), event, report, record.checkCache);
+}
+
+static bool WriteFam(const AccessTraceReader &reader, char *famPath)
+{
+    const char *tempDirectory = getenv("TMPDIR");
+    snprintf(famPath, PATH_MAX, "%s/bxl_replay_XXXXXX", is_null_or_empty(tempDirectory) ? "/tmp" : tempDirectory);
+
+    int fd = mkstemp(famPath);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    const char *fam = reader.GetFam();
+    size_t remaining = reader.GetFamLength();
+    while (remaining > 0)
+    {
+        ssize_t written = write(fd, fam, remaining);
+        if (written <= 0)
+        {
+            close(fd);
+            return false;
+        }
+
+        fam += written;
+        remaining -= written;
+    }
+
+    return close(fd) == 0;
+}
+
+static int ReplayTrace(const char *tracePath, int repetitions)
+{
+    AccessTraceReader reader;
+    if (!reader.Open(tracePath))
+    {
+        fprintf(stderr, "accesstracereplay: '%s' is not an access trace\n", tracePath);
+        return 1;
+    }
+
+    std::vector<AccessTraceReader::Record> records;
+    AccessTraceReader::Record record;
+    while (reader.Next(record))
+    {
+        records.push_back(record);
+    }
+
+    if (!reader.IsAtEnd())
+    {
+        // A process that was killed leaves a truncated trace behind: replay what is there
+        fprintf(stderr, "accesstracereplay: '%s' is truncated after %zu records\n", tracePath, records.size());
+    }
+
+    char famPath[PATH_MAX];
+    if (!WriteFam(reader, famPath))
+    {
+        fprintf(stderr, "accesstracereplay: could not write the FAM of '%s': %s\n", tracePath, strerror(errno));
+        return 1;
+    }
+
+    // The observer picks its configuration up from the environment, as it does in a pip (this process is the root of the pip)
+    setenv(BxlEnvFamPath, famPath, 1);
+    setenv(BxlEnvRootPid, "1", 1);
+    unsetenv(BxlEnvFamFd);
+    unsetenv(BxlEnvAccessTraceDirectory);
+    unsetenv(BxlPTraceTracedPid);
+
+    int reportPipe[2];
+    ReportDrain drain = { -1, 0 };
+    pthread_t drainer;
+    if (pipe2(reportPipe, O_CLOEXEC) != 0 || (drain.fd = reportPipe[0], pthread_create(&drainer, nullptr, DrainReports, &drain)) != 0)
+    {
+        fprintf(stderr, "accesstracereplay: could not set up the report pipe: %s\n", strerror(errno));
+        unlink(famPath);
+        return 1;
+    }
+
+    BxlObserver *bxl = BxlObserver::GetInstance();
+    bxl->PrepareReplay(reader.GetProgramPath().c_str(), reportPipe[1]);
+
+    uint64_t recordedNs = 0;
+    for (const AccessTraceReader::Record &r : records)
+    {
+        recordedNs += r.durationNs;
+    }
+
+    const char *traceName = strrchr(tracePath, '/') == nullptr ? tracePath : strrchr(tracePath, '/') + 1;
+    for (int repetition = 0; repetition < repetitions; repetition++)
+    {
+        size_t mismatches = 0;
+        uint64_t start = AccessTrace::NowNs();
+        for (const AccessTraceReader::Record &r : records)
+        {
+            AccessReportGroup report;
+            AccessCheckResult result = Replay(bxl, r, report);
+            bxl->SendReport(report);
+            mismatches += AccessTrace::PackResult(result) != r.result ? 1 : 0;
+        }
+
+        bxl->FlushReports();
+        uint64_t elapsedNs = AccessTrace::NowNs() - start;
+
+        printf("{\"trace\":\"%s\",\"repetition\":%d,\"records\":%zu,\"replayNsPerRecord\":%.1f,\"recordedNsPerRecord\":%.1f,\"mismatches\":%zu,\"reportBytes\":",
+            traceName, repetition, records.size(),
+            records.empty() ? 0.0 : (double)elapsedNs / records.size(),
+            records.empty() ? 0.0 : (double)recordedNs / records.size(),
+            mismatches);
+
+        // The reports of the last repetition are only all counted once the pipe is closed
+        if (repetition == repetitions - 1)
+        {
+            close(reportPipe[1]);
+            pthread_join(drainer, nullptr);
+            printf("%llu}\n", (unsigned long long)drain.bytes);
+        }
+        else
+        {
+            printf("null}\n");
+        }
+    }
+
+    fflush(stdout);
+
+    std::string dedupPath = std::string(famPath) + ".dedup";
+    unlink(dedupPath.c_str());
+    unlink(famPath);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int repetitions = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'r':
+                repetitions = atoi(optarg);
+                break;
+            default:
+                repetitions = 0;
+                break;
+        }
+    }
+
+    if (repetitions <= 0 || optind == argc)
+    {
+        fprintf(stderr, "Usage: %s [-r repetitions] trace...\n", argv[0]);
+        return 1;
+    }
+
+    int exitCode = 0;
+    for (int i = optind; i < argc; i++)
+    {
+        fflush(stdout);
+        pid_t child = fork();
+        if (child == 0)
+        {
+            // Skip the destructor of the observer, which would flush its reports to the closed pipe
+            int result = ReplayTrace(argv[i], repetitions);
+            fflush(stdout);
+            _exit(result);
+        }
+
+        int status;
+        if (child == -1 || waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            exitCode = 1;
+        }
+    }
+
+    return exitCode;
+}
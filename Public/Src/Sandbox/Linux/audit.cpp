@@ -37,4 +37,19 @@ unsigned int la_objopen(struct link_map *map, Lmid_t lmid, uintptr_t *cookie)
     }
 
     return 0; // disable symbol auditing; to enable, return LA_FLG_BINDTO | LA_FLG_BINDFROM;
+}
+
+/**
+ * The dynamic linker calls this function when the link map changes: with LA_ACT_ADD or LA_ACT_DELETE before objects are
+ * added or removed, and with LA_ACT_CONSISTENT once it is done (at startup, after all the dependencies of the program are
+ * loaded, and then after every dlopen/dlclose).
+ *
+ * The loads reported by la_objopen in the meantime are only queued, so they are sent here, all at once.
+ */
+void la_activity(uintptr_t *cookie, unsigned int flag)
+{
+    if (flag == LA_ACT_CONSISTENT)
+    {
+        BxlObserver::GetInstance()->flush_audit_objopen();
+    }
 }
\ No newline at end of file
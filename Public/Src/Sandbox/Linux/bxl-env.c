@@ -7,21 +7,47 @@
 #include <string.h>
 #include <unistd.h>
 
+// Usage: bxl-env [-C <dir>] [-i] [NAME=VALUE]... <program> [<args>]...
+//
+// Same as '/usr/bin/env' for the options used by SandboxedProcessUnix.cs, which are handled here rather than forwarded to it:
+// some old versions of /usr/bin/env do not support the -C option, and going through it costs every pip one more process image
+// (and, when the interposer is loaded, one more initialization of it along with a parse of the FAM).
 int main(int argc, char **argv)
 {
-    int forwardArgsStartIdx = 0;
-
-    // some old versions of /usr/bin/env do not support the -C option, so handle that here before calling /usr/bin/env
-    if (argc >= 3 && strcmp(argv[1], "-C") == 0) {
-        forwardArgsStartIdx = 2;
-        int ret = chdir(argv[2]);
-        if (ret != 0) {
-            fprintf(stderr, "%s: cannot change directory to '%s': %s\n", argv[0], argv[2], strerror(errno));
+    int argIdx = 1;
+
+    // CODESYNC: SandboxedProcessUnix.cs (-C <dir> must be the first two arguments)
+    if (argIdx + 1 < argc && strcmp(argv[argIdx], "-C") == 0) {
+        if (chdir(argv[argIdx + 1]) != 0) {
+            fprintf(stderr, "%s: cannot change directory to '%s': %s\n", argv[0], argv[argIdx + 1], strerror(errno));
             return 125;
         }
+
+        argIdx += 2;
+    }
+
+    if (argIdx < argc && strcmp(argv[argIdx], "-i") == 0) {
+        clearenv();
+        argIdx++;
     }
 
-    char *envExe = "/usr/bin/env";
-    argv[forwardArgsStartIdx] = envExe;
-    return execv(envExe, &argv[forwardArgsStartIdx]);
-}
\ No newline at end of file
+    for (; argIdx < argc && strchr(argv[argIdx], '=') != NULL; argIdx++) {
+        if (putenv(argv[argIdx]) != 0) {
+            fprintf(stderr, "%s: cannot set '%s': %s\n", argv[0], argv[argIdx], strerror(errno));
+            return 125;
+        }
+    }
+
+    if (argIdx >= argc) {
+        fprintf(stderr, "%s: no program to execute\n", argv[0]);
+        return 125;
+    }
+
+    // Like env, the program is looked up in the PATH of the environment set up above
+    execvp(argv[argIdx], &argv[argIdx]);
+
+    // Same exit codes as env when the program cannot be executed
+    int error = errno;
+    fprintf(stderr, "%s: '%s': %s\n", argv[0], argv[argIdx], strerror(error));
+    return error == ENOENT ? 127 : 126;
+}
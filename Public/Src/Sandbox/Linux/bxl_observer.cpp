@@ -2,11 +2,33 @@
 // Licensed under the MIT License.
 
 #include <algorithm>
+#include <thread>
 #include "bxl_observer.hpp"
 #include "IOHandler.hpp"
-#include <stack>
+#include "observer_utilities.hpp"
+#include "report_compression.hpp"
+#include <elf.h>
+#include <poll.h>
+#include <sys/mman.h>
 #include <sys/prctl.h>
 #include <sys/wait.h>
+#include <sys/xattr.h>
+
+#if __has_include(<linux/openat2.h>)
+#include <linux/openat2.h>
+#else
+struct open_how
+{
+    __u64 flags;
+    __u64 mode;
+    __u64 resolve;
+};
+#define RESOLVE_NO_SYMLINKS 0x04
+#endif
+
+#ifndef __NR_openat2
+#define __NR_openat2 437
+#endif
 
 static void HandleAccessReport(AccessReport report, int _)
 {
@@ -38,6 +60,7 @@ BxlObserver::BxlObserver()
     }
 
     disposed_ = false;
+    handedBackByTracer_ = !is_null_or_empty(getenv(BxlPTraceInterposed));
     const char *rootPidStr = isPTrace ? ptracePid : getenv(BxlEnvRootPid);
     rootPid_ = is_null_or_empty(rootPidStr) ? -1 : atoi(rootPidStr);
     // value of "1" -> special case, set by BuildXL for the root process
@@ -46,7 +69,24 @@ BxlObserver::BxlObserver()
     }
 
     InitFam(isPTrace ? rootPid_ : getpid());
+    InitManifestUpdates();
     InitDetoursLibPath();
+    mountNamespace_ = ReadMountNamespace();
+    InitPTraceCacheDirectory();
+    InitAccessTrace();
+
+    // The ptrace runner reports on behalf of other executables, which the shared cache keys can't tell apart
+    if (!isPTrace)
+    {
+        InitSharedAccessCache();
+        sharedAccessCache_.SetMountNamespace(mountNamespace_);
+        EnterPipCgroup();
+
+        if (CheckEnableLinuxSandboxStatistics(pip_->GetFamExtraFlags()))
+        {
+            InterposerStats::Enable();
+        }
+    }
 
     const char* const forcedprocesses = getenv(BxlPTraceForcedProcessNames);
     if (!is_null_or_empty(forcedprocesses))
@@ -84,6 +124,9 @@ BxlObserver::BxlObserver()
 
 BxlObserver::~BxlObserver()
 {
+    // Reports sent after this point go straight to the FIFO (see SendReport)
+    FlushReports();
+
     if (messageCountingSemaphore_ != nullptr)
     {
         // best effort, no need to observe the return value here
@@ -95,6 +138,97 @@ BxlObserver::~BxlObserver()
     disposed_ = true;
 }
 
+void BxlObserver::InitPTraceCacheDirectory()
+{
+    // BuildXL points this to a directory that outlives the pip, so the classifications made by previous runs (of any pip) are reused.
+    // The keys capture the identity of the executable (see get_ptrace_cache_key), so an executable that changed since then is classified again.
+    const char *classificationDirectory = getenv(BxlEnvPTraceClassificationDirectory);
+    if (!is_null_or_empty(classificationDirectory) && snprintf(ptraceCacheDirectory_, PATH_MAX, "%s", classificationDirectory) < PATH_MAX)
+    {
+        return;
+    }
+
+    // TMPDIR points to the temp directory of the pip (when it has one)
+    const char *tempDirectory = getenv("TMPDIR");
+    if (is_null_or_empty(tempDirectory) ||
+        snprintf(ptraceCacheDirectory_, PATH_MAX, "%s/.bxl_ptrace_classification", tempDirectory) >= PATH_MAX)
+    {
+        ptraceCacheDirectory_[0] = '\0';
+    }
+}
+
+void BxlObserver::InitAccessTrace()
+{
+    const char *directory = getenv(BxlEnvAccessTraceDirectory);
+    if (is_null_or_empty(directory) || snprintf(accessTraceDirectory_, PATH_MAX, "%s", directory) >= PATH_MAX)
+    {
+        accessTraceDirectory_[0] = '\0';
+        return;
+    }
+
+    StartAccessTrace();
+}
+
+void BxlObserver::StartAccessTrace()
+{
+    if (accessTraceDirectory_[0] == '\0')
+    {
+        return;
+    }
+
+    // Every image a process execs (and every trace restarted by the same image) gets a file of its own: '<pid>-<sequence>.bxltrace'
+    pid_t pid = getpid();
+    char path[PATH_MAX];
+    for (int sequence = 0; sequence < 1024; sequence++)
+    {
+        if (snprintf(path, PATH_MAX, "%s/%d-%d.bxltrace", accessTraceDirectory_, pid, sequence) >= PATH_MAX)
+        {
+            return;
+        }
+
+        int fd = real_open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd == -1 && errno == EEXIST)
+        {
+            continue;
+        }
+
+        // Failing to trace is not an error, the pip just runs without a trace
+        if (fd == -1)
+        {
+            return;
+        }
+
+        // Same as for the report FIFOs, the descriptor could be one whose close we missed
+        reset_fd_table_entry(fd);
+        if (!accessTrace_.Start(fd, real_write, pid, famPayload_, famLength_, progFullPath_))
+        {
+            real_close(fd);
+        }
+
+        return;
+    }
+}
+
+void BxlObserver::PrepareReplay(const char *programPath, int reportFd)
+{
+    int traceFd = accessTrace_.Detach();
+    if (traceFd != -1)
+    {
+        real_close(traceFd);
+    }
+
+    accessTraceDirectory_[0] = '\0';
+
+    strlcpy(progFullPath_, programPath, PATH_MAX);
+    if (process_)
+    {
+        process_->SetPath(progFullPath_);
+    }
+
+    reportFd_ = reportFd;
+    secondaryReportFd_ = reportFd;
+}
+
 void BxlObserver::InitDetoursLibPath()
 {
     const char *path = getenv(BxlEnvDetoursPath);
@@ -108,376 +242,1649 @@ void BxlObserver::InitDetoursLibPath()
     }
 }
 
-void BxlObserver::InitFam(pid_t pid)
+void BxlObserver::InitSharedAccessCache()
 {
-    // read FAM env var
-    const char *famPath = getenv(BxlEnvFamPath);
-    if (is_null_or_empty(famPath))
+    if (!CheckEnableLinuxSharedAccessCache(pip_->GetFamExtraFlags()))
     {
-        // This environment variable is set by the sandbox before calling exec
-        // We always expect to have it on initialization of the observer
-        _fatal_undefined_env(BxlEnvFamPath);
+        return;
     }
 
-    // Store the value for future uses, as the environment might be cleared by the running process
-    strlcpy(famPath_, famPath, PATH_MAX);
-
-    // read FAM
-    FILE *famFile = real_fopen(famPath_, "rb");
-    if (!famFile)
+    // CODESYNC: Public/Src/Engine/Processes/SandboxConnectionLinuxDetours.cs
+    // The table lives next to the FAM (which is unique per pip), with a '.dedup' extension
+    char cachePath[PATH_MAX];
+    if (!GetFamSiblingPath(".dedup", cachePath))
     {
-        _fatal("Could not open file '%s'; errno: %d", famPath_, errno);
+        return;
     }
 
-    fseek(famFile, 0, SEEK_END);
-    long famLength = ftell(famFile);
-    rewind(famFile);
+    // The root process creates the table before it gets to spawn anything, its descendants just map it.
+    // Failing to do any of this is not an error: accesses are then deduplicated within each process only.
+    bool isRoot = rootPid_ == getpid();
+    int fd = real_open(cachePath, isRoot ? O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC : O_RDWR | O_CLOEXEC, 0600);
+    if (fd == -1)
+    {
+        return;
+    }
 
-    char *famPayload = (char *)malloc(famLength);
-    real_fread(famPayload, famLength, 1, famFile);
-    real_fclose(famFile);
+    size_t size = SharedAccessCache::GetImageSize();
+    struct stat statbuf;
+#if (__GLIBC__ == 2 && __GLIBC_MINOR__ < 33)
+    bool sizeOk = isRoot ? real_ftruncate(fd, size) == 0 : real___fxstat(1, fd, &statbuf) == 0 && (size_t)statbuf.st_size == size;
+#else
+    bool sizeOk = isRoot ? real_ftruncate(fd, size) == 0 : real_fstat(fd, &statbuf) == 0 && (size_t)statbuf.st_size == size;
+#endif
 
-    // create SandboxedPip (which parses FAM and throws on error)
-    pip_ = shared_ptr<SandboxedPip>(new SandboxedPip(pid, famPayload, famLength));
-    free(famPayload);
+    void *image = sizeOk ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    real_close(fd);
 
-    // create sandbox
-    sandbox_ = new Sandbox(0, Configuration::DetoursLinuxSandboxType);
+    // Like the FAM, the mapping is intentionally never released
+    if (image != MAP_FAILED && !sharedAccessCache_.Attach(image, size, /* initialize */ isRoot))
+    {
+        munmap(image, size);
+    }
+}
 
-    // initialize sandbox
-    if (!sandbox_->TrackRootProcess(pip_))
+// The path of the FAM with its extension replaced by the given one
+bool BxlObserver::GetFamSiblingPath(const char *extension, char (&path)[PATH_MAX]) const
+{
+    strlcpy(path, famPath_, PATH_MAX);
+    char *dot = strrchr(path, '.');
+    if (dot == nullptr || strchr(dot, '/') != nullptr)
     {
-        _fatal("Could not track root process %s:%d", __progname, pid);
+        dot = path + strlen(path);
     }
 
-    process_ = sandbox_->FindTrackedProcess(pid);
-    process_->SetPath(progFullPath_);
-    sandbox_->SetAccessReportCallback(HandleAccessReport);
+    if (dot - path + strlen(extension) + 1 > PATH_MAX)
+    {
+        return false;
+    }
 
-    sandboxLoggingEnabled_ = CheckEnableLinuxSandboxLogging(pip_->GetFamExtraFlags());
+    strcpy(dot, extension);
+    return true;
 }
 
-void BxlObserver::Init()
+void BxlObserver::InitManifestUpdates()
 {
-    // If message counting is enabled, open the associated semaphore (this should already be created by the managed side)
-    if (CheckCheckDetoursMessageCount(pip_->GetFamFlags()))
+    if (!CheckEnableLinuxManifestUpdates(pip_->GetFamExtraFlags()))
     {
-        // Setting initializingSemaphore_ will communicate to the interpose layer to not interpose any libc functions called inside sem_open
-        initializingSemaphore_ = true;
-        messageCountingSemaphore_ = real_sem_open(pip_->GetInternalDetoursErrorNotificationFile(), O_CREAT, 0644, 0);
+        return;
+    }
 
-        if (messageCountingSemaphore_ == SEM_FAILED)
-        {
-            // we'll log a message here, but this won't fail the pip until this feature is tested more thorougly
-            real_fprintf(stdout, "BuildXL injected message: File access monitoring failed to open message counting semaphore '%s' with errno: '%d'. You should rerun this build, or contact the BuildXL team if the issue persists across multiple builds.", pip_->GetInternalDetoursErrorNotificationFile(), errno);
-        }
+    // CODESYNC: Public/Src/Engine/Processes/SandboxConnectionLinuxDetours.cs (NotifyPipManifestUpdated)
+    // The managed side creates the counter (a single 64-bit generation, initially 0) before the pip starts
+    char generationPath[PATH_MAX];
+    if (!GetFamSiblingPath(".gen", generationPath))
+    {
+        return;
+    }
 
-        initializingSemaphore_ = false;
+    int fd = real_open(generationPath, O_RDONLY | O_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        return;
+    }
+
+    struct stat statbuf;
+#if (__GLIBC__ == 2 && __GLIBC_MINOR__ < 33)
+    bool sizeOk = real___fxstat(1, fd, &statbuf) == 0 && (size_t)statbuf.st_size >= sizeof(uint64_t);
+#else
+    bool sizeOk = real_fstat(fd, &statbuf) == 0 && (size_t)statbuf.st_size >= sizeof(uint64_t);
+#endif
+
+    // Like the FAM, the mapping is intentionally never released
+    void *image = sizeOk ? mmap(nullptr, sizeof(uint64_t), PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    real_close(fd);
+    if (image == MAP_FAILED)
+    {
+        return;
     }
+
+    // The FAM this process mapped may come from a descriptor inherited before the parent applied the latest update,
+    // so a process that starts after an update always applies it again on its first check (see SyncManifest)
+    manifestGenerationImage_ = reinterpret_cast<const std::atomic<uint64_t> *>(image);
+    manifestGeneration_.store(0, std::memory_order_relaxed);
 }
 
-void BxlObserver::LogDebug(pid_t pid, const char *fmt, ...)
+// Nesting depth of the ManifestReadScopes of the current thread
+static thread_local int t_manifestReadDepth = 0;
+
+// Brackets a use of the manifest and of the lists derived from it, so that manifest updates know when the images they
+// replaced can be released (see ReclaimManifestImages)
+class ManifestReadScope
 {
-    if (LogDebugEnabled())
+public:
+    explicit ManifestReadScope(std::atomic<int> &readers) : readers_(readers)
     {
-        // Build an access report that represents the debug message
-        AccessReport debugReport = 
-        {
-            .operation          = kOpDebugMessage,
-            .pid                = pid,
-            .rootPid            = pip_->GetProcessId(),
-            .requestedAccess    = (int)RequestedAccess::Read,
-            .status             = FileAccessStatus::FileAccessStatus_Allowed,
-            .reportExplicitly   = 0,
-            .error              = 0,
-            .pipId              = pip_->GetPipId(),
-            .path               = {0},
-            .stats              = {0},
-            .isDirectory        = 0,
-            .shouldReport       = true,
-        };
+        readers_.fetch_add(1);
+        t_manifestReadDepth++;
+    }
 
-        va_list args;
-        va_start(args, fmt);
-        // We (re)use the path for the debug message in order to not change the report format just for debugging
-        // So we limit the message to MAXPATHLEN (~4k chars, which should be enough)
-        int numWritten = vsnprintf(debugReport.path, MAXPATHLEN, fmt, args);
-        va_end(args);
+    ~ManifestReadScope()
+    {
+        t_manifestReadDepth--;
+        readers_.fetch_sub(1);
+    }
 
-        // Sanitize the debug message so we don't confuse the parser on managed code:
-        // Pipes (|) are used to delimit the message parts and we expect one line (\n) per report, so
-        // replace those occurrences with something else.
-        for (int i = 0 ; i < MAXPATHLEN; i++)
-        {
-            if (debugReport.path[i] == '|')
-            {
-                debugReport.path[i] = '!';
-            }
-            
-            if (debugReport.path[i] == '\n' || debugReport.path[i] == '\r')
-            {
-                debugReport.path[i] = '.';
-            }
-        }
+    ManifestReadScope(const ManifestReadScope &) = delete;
+    ManifestReadScope& operator=(const ManifestReadScope &) = delete;
 
-        SendReport(debugReport, /* isDebugMessage */ true);
+private:
+    std::atomic<int> &readers_;
+};
+
+// Applies the latest manifest update if the managed side made one since the last check. Called before every access check,
+// so it is a single load of the shared counter when nothing changed.
+void BxlObserver::SyncManifest()
+{
+    if (manifestGenerationImage_ == nullptr ||
+        manifestGenerationImage_->load(std::memory_order_acquire) == manifestGeneration_.load(std::memory_order_acquire))
+    {
+        return;
+    }
+
+    // Threads that find another one applying the update go on with the previous manifest rather than wait
+    std::unique_lock<std::mutex> lock(manifestUpdateMtx_, std::try_to_lock);
+    if (lock.owns_lock() && manifestGenerationImage_->load(std::memory_order_acquire) != manifestGeneration_.load(std::memory_order_acquire))
+    {
+        int savedErrno = errno;
+        ApplyManifestUpdate();
+        errno = savedErrno;
     }
 }
 
-// Checks whether cache contains (event, path) pair and returns the result of this check.
-// If the pair is not in cache and addEntryIfMissing is true, attempts to add the pair to cache.
-bool BxlObserver::CheckCache(es_event_type_t event, const string &path, bool addEntryIfMissing)
+// Reads the scopes changed by manifest updates so far, and the generation of the latest update. Each line of the file
+// is '<generation>\t<scope>', after a first line with the latest generation. Returns null if the file can't be read.
+const std::vector<BxlObserver::ChangedScope>* BxlObserver::ReadChangedScopes(uint64_t &generation) const
 {
-    // coalesce some similar events
-    es_event_type_t key;
-    switch (event)
+    char scopesPath[PATH_MAX];
+    if (!GetFamSiblingPath(".scopes", scopesPath))
     {
-        case ES_EVENT_TYPE_NOTIFY_TRUNCATE:
-        case ES_EVENT_TYPE_NOTIFY_SETATTRLIST:
-        case ES_EVENT_TYPE_NOTIFY_SETEXTATTR:
-        case ES_EVENT_TYPE_NOTIFY_DELETEEXTATTR:
-        case ES_EVENT_TYPE_NOTIFY_SETFLAGS:
-        case ES_EVENT_TYPE_NOTIFY_SETOWNER:
-        case ES_EVENT_TYPE_NOTIFY_SETMODE:
-        case ES_EVENT_TYPE_NOTIFY_WRITE:
-        case ES_EVENT_TYPE_NOTIFY_UTIMES:
-        case ES_EVENT_TYPE_NOTIFY_SETTIME:
-        case ES_EVENT_TYPE_NOTIFY_SETACL:
-            key = ES_EVENT_TYPE_NOTIFY_WRITE;
+        return nullptr;
+    }
+
+    int fd = real_open(scopesPath, O_RDONLY | O_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        return nullptr;
+    }
+
+    struct stat statbuf;
+#if (__GLIBC__ == 2 && __GLIBC_MINOR__ < 33)
+    bool statOk = real___fxstat(1, fd, &statbuf) == 0;
+#else
+    bool statOk = real_fstat(fd, &statbuf) == 0;
+#endif
+    void *image = statOk && statbuf.st_size > 0 ? mmap(nullptr, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    real_close(fd);
+    if (image == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    std::string_view contents((const char *)image, statbuf.st_size);
+    auto scopes = new std::vector<ChangedScope>();
+    bool valid = false;
+    size_t start = 0;
+    while (start < contents.length())
+    {
+        size_t end = contents.find('\n', start);
+        if (end == std::string_view::npos)
+        {
+            // The file is replaced as a whole, so a missing newline means it is not the file the managed side wrote
+            valid = false;
             break;
+        }
 
-        case ES_EVENT_TYPE_NOTIFY_GETATTRLIST:
-        case ES_EVENT_TYPE_NOTIFY_GETEXTATTR:
-        case ES_EVENT_TYPE_NOTIFY_LISTEXTATTR:
-        case ES_EVENT_TYPE_NOTIFY_ACCESS:
-        case ES_EVENT_TYPE_NOTIFY_STAT:
-            key = ES_EVENT_TYPE_NOTIFY_STAT;
+        std::string line(contents.substr(start, end - start));
+        start = end + 1;
+        char *scope;
+        uint64_t lineGeneration = strtoull(line.c_str(), &scope, 10);
+        if (!valid)
+        {
+            generation = lineGeneration;
+            valid = *scope == '\0';
+            if (!valid)
+            {
+                break;
+            }
 
-        default:
-            key = event;
+            continue;
+        }
+
+        if (*scope != '\t')
+        {
+            valid = false;
             break;
+        }
+
+        // A trailing separator would keep the scope from matching its own root (see ScopeGeneration), and '/' stands
+        // for the whole manifest, like an empty scope
+        std::string_view path(scope + 1);
+        while (!path.empty() && path.back() == '/')
+        {
+            path.remove_suffix(1);
+        }
+
+        scopes->push_back({ std::string(path), lineGeneration });
     }
 
-    // This code could possibly be executing from an interrupt routine or from who knows where,
-    // so to avoid deadlocks it's essential to never block here indefinitely.
-    if (!cacheMtx_.try_lock_for(chrono::milliseconds(1)))
+    munmap(image, statbuf.st_size);
+    if (!valid)
     {
-        return false; // failed to acquire mutex -> forget about it
+        delete scopes;
+        return nullptr;
     }
 
-    // ============================== in the critical section ================================
+    return scopes;
+}
 
-    // make sure the mutex is released by the end
-    shared_ptr<timed_mutex> sp(&cacheMtx_, [](timed_mutex *mtx) { mtx->unlock(); });
+// Maps the current FAM file and makes it the manifest of the pip
+void BxlObserver::ApplyManifestUpdate()
+{
+    // The managed side replaces the FAM before the list of changed scopes, so the manifest is at least as recent as the
+    // list. Should it be more recent, the counter is still ahead of the generation of the list, and the next check applies
+    // the update again.
+    uint64_t generation = 0;
+    const std::vector<ChangedScope> *changedScopes = ReadChangedScopes(generation);
+    if (changedScopes == nullptr)
+    {
+        return;
+    }
+
+    // Not opened with O_CLOEXEC, for the same reason as in InitFam
+    int famFd = real_open(famPath_, O_RDONLY, 0);
+    if (famFd == -1)
+    {
+        delete changedScopes;
+        return;
+    }
+
+    // A handle was opened for our own internal purposes. That could have reused a fd where we missed a close.
+    reset_fd_table_entry(famFd);
 
-    unordered_map<es_event_type_t, unordered_set<string>>::iterator it = cache_.find(key);
-    if (it == cache_.end())
+    struct stat famStat;
+#if (__GLIBC__ == 2 && __GLIBC_MINOR__ < 33)
+    bool statOk = real___fxstat(1, famFd, &famStat) == 0;
+#else
+    bool statOk = real_fstat(famFd, &famStat) == 0;
+#endif
+    size_t famLength = statOk ? famStat.st_size : 0;
+    void *famPayload = famLength > 0 ? mmap(nullptr, famLength, PROT_READ, MAP_PRIVATE, famFd, 0) : MAP_FAILED;
+    if (famPayload == MAP_FAILED || !pip_->UpdateManifest((const char *)famPayload, famLength, /* copyPayload */ false))
     {
-        if (addEntryIfMissing) 
+        LOG_DEBUG("Could not apply manifest update %llu from '%s'", (unsigned long long)generation, famPath_);
+        if (famPayload != MAP_FAILED)
         {
-            unordered_set<string> set;
-            set.insert(path);
-            cache_.insert(make_pair(key, set));
+            munmap((void *)famPayload, famLength);
         }
 
-        return false;
+        real_close(famFd);
+        delete changedScopes;
+        return;
     }
 
-    if (addEntryIfMissing) 
+    // Lookups that already started finish against the previous manifest (see SandboxedPip::UpdateManifest) and may cache
+    // their result under the new keys, the same window a lookup racing with the update has anyway. The previous image is
+    // retired rather than released, since lookups may still be reading it.
+    RetiredManifestImage retired;
+    retired.generation = generation;
+    retired.famPayload = famPayload_;
+    retired.famLength = famLength_;
+    retired.changedScopes = changedScopes_.exchange(changedScopes);
+    retired.untrackedScopes = SetUntrackedScopes();
+    retired.famFdEnvValue = nullptr;
+    famPayload_ = (const char *)famPayload;
+    famLength_ = famLength;
+
+    // The accesses settled for open descriptors were checked against the previous manifest
+    for (int fd = 0; fd < SETTLED_FD_ACCESSES_SIZE; fd++)
     {
-        return !it->second.insert(path).second;
+        UnsettleFdAccesses(fd);
     }
-    else 
+
+    // Children map the new manifest from now on
+    if (famFd_ != -1)
     {
-        return (it->second.find(path) != it->second.end());
+        char famFdEnvValue[64];
+        snprintf(famFdEnvValue, sizeof(famFdEnvValue), "%d:%llu:%llu", famFd, (unsigned long long)famStat.st_dev, (unsigned long long)famStat.st_ino);
+        retired.famFdEnvValue = famFdEnvValue_.exchange(new std::string(famFdEnvValue));
+        real_close(famFd_);
+        famFd_ = famFd;
     }
-}
-
-bool BxlObserver::IsCacheHit(es_event_type_t event, const string &path, const string &secondPath)
-{
-    // (1) IMPORTANT           : never do any of this stuff after this object has been disposed!
-    //     WHY                 : because the cache date structure is invalid at that point.
-    //     HOW CAN THIS HAPPEN : we may get called from "on_exit" handlers, at which point the
-    //                           global BxlObserver singleton instance can already be disposed.
-    // (2) never cache FORK, EXEC, EXIT and events that take 2 paths
-    if (disposed_ ||
-        secondPath.length() > 0 ||
-        event == ES_EVENT_TYPE_NOTIFY_FORK ||
-        event == ES_EVENT_TYPE_NOTIFY_EXEC ||
-        event == ES_EVENT_TYPE_NOTIFY_EXIT)
+    else
     {
-        return false;
+        real_close(famFd);
     }
 
-    return CheckCache(event, path, /* addEntryIfMissing */ false);
+    retiredManifestImages_.push_back(retired);
+    manifestGeneration_.store(generation, std::memory_order_release);
+    LOG_DEBUG("Applied manifest update %llu (%zu changed scopes)", (unsigned long long)generation, changedScopes->size());
+
+    ReclaimManifestImages();
 }
 
-bool BxlObserver::Send(const char *buf, size_t bufsiz, bool useSecondaryPipe, bool countReport)
+// Releases the images replaced by manifest updates, but for the one the latest update replaced. Checks use the manifest within
+// a ManifestReadScope, and load it afresh in each one: once no scope is open, images replaced before the latest update can't be
+// reached anymore. The latest replaced image is kept for the short reads made outside of checks (e.g., of the manifest flags).
+// Called under manifestUpdateMtx_; when checks are in flight, the images wait for a later update.
+void BxlObserver::ReclaimManifestImages()
 {
-    if (!real_open)
+    if (retiredManifestImages_.size() <= 1 || t_manifestReadDepth != 0)
     {
-        _fatal("syscall 'open' not found; errno: %d", errno);
+        return;
     }
 
-    // TODO: instead of failing, implement a critical section
-    if (bufsiz > PIPE_BUF)
+    // Pairs with the increment of ManifestReadScope: a scope opened after this load sees the images published above
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (manifestReaders_.load() != 0)
     {
-        _fatal("Cannot atomically send a buffer whose size (%ld) is greater than PIPE_BUF (%d)", bufsiz, PIPE_BUF);
+        return;
     }
 
-    const char *reportsPath = useSecondaryPipe ? GetSecondaryReportsPath() : GetReportsPath();
-    int logFd = real_open(reportsPath, O_WRONLY | O_APPEND, 0);
-    if (logFd == -1)
+    size_t count = retiredManifestImages_.size() - 1;
+    pip_->ReleasePreviousManifests(/* keep */ 1);
+    for (size_t i = 0; i < count; i++)
     {
-        _fatal("Could not open file '%s'; errno: %d", reportsPath, errno);
+        const RetiredManifestImage &retired = retiredManifestImages_[i];
+        munmap((void *)retired.famPayload, retired.famLength);
+        delete retired.untrackedScopes;
+        delete retired.changedScopes;
+        delete retired.famFdEnvValue;
     }
 
-    // update message counting semaphore whenever a report is sent
-    // We update the message counting semaphore before sending the report because we could hit a race condition where
-    // the message is received by the managed side but we haven't yet incremented the counter if we do it after sending the message.
-    // If the message fails to send, the code below will write to stderr and exit with a bad exit code causing the pip to fail anyways.
-    // So it doesn't matter if we increment the counter but fail to send a message.
-    if (messageCountingSemaphore_ != nullptr && countReport)
+    retiredManifestImages_.erase(retiredManifestImages_.begin(), retiredManifestImages_.begin() + count);
+    LOG_DEBUG("Released %zu manifest images replaced before generation %llu", count, (unsigned long long)retiredManifestImages_.front().generation);
+}
+
+// The generation of the last manifest update that changed a scope the path is under, 0 if none did. Dedup keys include it,
+// so accesses under the changed scopes are checked again while the others keep hitting the caches.
+uint64_t BxlObserver::ScopeGeneration(std::string_view path) const
+{
+    const std::vector<ChangedScope> *scopes = changedScopes_.load(std::memory_order_acquire);
+    if (scopes == nullptr)
+    {
+        return 0;
+    }
+
+    uint64_t generation = 0;
+    for (const ChangedScope &changed : *scopes)
+    {
+        // An empty scope stands for the whole manifest
+        const std::string &scope = changed.scope;
+        if (changed.generation > generation &&
+            path.substr(0, scope.length()) == scope &&
+            (path.length() == scope.length() || scope.empty() || path[scope.length()] == '/'))
+        {
+            generation = changed.generation;
+        }
+    }
+
+    return generation;
+}
+
+void BxlObserver::EnterPipCgroup()
+{
+    // Only the root process moves: everything it spawns afterwards (including the ptrace runner) inherits the cgroup
+    if (!CheckEnableLinuxCgroupAccounting(pip_->GetFamExtraFlags()) || rootPid_ != getpid())
+    {
+        return;
+    }
+
+    // CODESYNC: Public/Src/Engine/Processes/SandboxedProcessUnix.cs
+    // The managed side creates the (empty) leaf for the pip and reads the usage of the pip from it once the pip completes.
+    // Failing to move is not an error: the managed side then finds no usage in the leaf and samples the processes instead.
+    const char *cgroupPath = getenv(BxlEnvCgroupPath);
+    if (is_null_or_empty(cgroupPath))
+    {
+        return;
+    }
+
+    char procsPath[PATH_MAX];
+    if (snprintf(procsPath, PATH_MAX, "%s/cgroup.procs", cgroupPath) >= PATH_MAX)
+    {
+        return;
+    }
+
+    int fd = real_open(procsPath, O_WRONLY | O_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        return;
+    }
+
+    char pid[16];
+    int length = snprintf(pid, sizeof(pid), "%d", getpid());
+    real_write(fd, pid, length);
+    real_close(fd);
+}
+
+uint64_t BxlObserver::ReadMountNamespace()
+{
+    // The link reads 'mnt:[<inode>]'. Failing to read it (e.g., /proc is not mounted in a container) leaves every key in
+    // namespace 0, which is what the caches were keyed by before: unshare and setns still invalidate them.
+    char link[64];
+    ssize_t length = real_readlink("/proc/self/ns/mnt", link, sizeof(link) - 1);
+    if (length <= 0)
+    {
+        return 0;
+    }
+
+    link[length] = '\0';
+    const char *inode = strchr(link, '[');
+    return inode == nullptr ? 0 : strtoull(inode + 1, nullptr, 10);
+}
+
+int BxlObserver::GetInheritedFamFd()
+{
+    // The parent image advertises its FAM descriptor along with the identity of the file behind it. The descriptor
+    // number alone can't be trusted: the program may have closed it before exec (e.g. with close_range) and reused it.
+    const char *famFd = getenv(BxlEnvFamFd);
+    if (is_null_or_empty(famFd))
+    {
+        return -1;
+    }
+
+    char *end;
+    long fd = strtol(famFd, &end, 10);
+    if (*end != ':' || fd < 0)
+    {
+        return -1;
+    }
+
+    unsigned long long dev = strtoull(end + 1, &end, 10);
+    if (*end != ':')
+    {
+        return -1;
+    }
+
+    unsigned long long ino = strtoull(end + 1, &end, 10);
+    if (*end != '\0')
+    {
+        return -1;
+    }
+
+    struct stat famStat;
+#if (__GLIBC__ == 2 && __GLIBC_MINOR__ < 33)
+    if (real___fxstat(1, (int)fd, &famStat) != 0)
+#else
+    if (real_fstat((int)fd, &famStat) != 0)
+#endif
+    {
+        return -1;
+    }
+
+    return famStat.st_dev == dev && famStat.st_ino == ino ? (int)fd : -1;
+}
+
+void BxlObserver::InitFam(pid_t pid)
+{
+    // read FAM env var
+    const char *famPath = getenv(BxlEnvFamPath);
+    if (is_null_or_empty(famPath))
+    {
+        // This environment variable is set by the sandbox before calling exec
+        // We always expect to have it on initialization of the observer
+        _fatal_undefined_env(BxlEnvFamPath);
+    }
+
+    // Store the value for future uses, as the environment might be cleared by the running process
+    strlcpy(famPath_, famPath, PATH_MAX);
+
+    // Map the FAM read-only instead of reading it into the heap: the manifest is parsed in place (the parser only
+    // keeps pointers into the payload), so policy lookups run directly on the mapped image. Every process of the pip
+    // maps the same file, so the pages are shared through the page cache rather than copied per process.
+    // The descriptor is not opened with O_CLOEXEC, so that the images this process execs can map the FAM from the
+    // inherited descriptor (advertised through BxlEnvFamFd) instead of opening it by path again.
+    int famFd = GetInheritedFamFd();
+    if (famFd == -1)
+    {
+        famFd = real_open(famPath_, O_RDONLY, 0);
+    }
+
+    if (famFd == -1)
+    {
+        _fatal("Could not open file '%s'; errno: %d", famPath_, errno);
+    }
+
+    struct stat famStat;
+#if (__GLIBC__ == 2 && __GLIBC_MINOR__ < 33)
+    if (real___fxstat(1, famFd, &famStat) != 0)
+#else
+    if (real_fstat(famFd, &famStat) != 0)
+#endif
+    {
+        _fatal("Could not stat file '%s'; errno: %d", famPath_, errno);
+    }
+
+    size_t famLength = famStat.st_size;
+    void *famPayload = famLength > 0
+        ? mmap(nullptr, famLength, PROT_READ, MAP_PRIVATE, famFd, 0)
+        : MAP_FAILED;
+    if (famPayload == MAP_FAILED)
+    {
+        _fatal("Could not map file '%s' (%zu bytes); errno: %d", famPath_, famLength, errno);
+    }
+
+    // create SandboxedPip (which parses FAM and throws on error). The mapping is only released if a manifest update replaces
+    // it (see ReclaimManifestImages): the pip lives for the whole lifetime of the process and policies may still be checked
+    // from exit handlers.
+    pip_ = shared_ptr<SandboxedPip>(new SandboxedPip(pid, (const char *)famPayload, famLength, /* copyPayload */ false));
+    famPayload_ = (const char *)famPayload;
+    famLength_ = famLength;
+
+    // Children that are not monitored never get the FAM propagated, so there is no point in keeping the descriptor
+    // around for them (the mapping stays valid after the descriptor is closed)
+    if (IsMonitoringChildProcesses())
+    {
+        char famFdEnvValue[64];
+        snprintf(famFdEnvValue, sizeof(famFdEnvValue), "%d:%llu:%llu", famFd, (unsigned long long)famStat.st_dev, (unsigned long long)famStat.st_ino);
+        famFdEnvValue_.store(new std::string(famFdEnvValue), std::memory_order_release);
+        famFd_ = famFd;
+    }
+    else
+    {
+        famFdEnvValue_.store(new std::string(), std::memory_order_release);
+        real_close(famFd);
+    }
+
+    // create sandbox
+    sandbox_ = new Sandbox(0, Configuration::DetoursLinuxSandboxType);
+
+    // initialize sandbox
+    if (!sandbox_->TrackRootProcess(pip_))
+    {
+        _fatal("Could not track root process %s:%d", __progname, pid);
+    }
+
+    process_ = sandbox_->FindTrackedProcess(pid);
+    process_->SetPath(progFullPath_);
+    sandbox_->SetAccessReportCallback(HandleAccessReport);
+
+    sandboxLoggingEnabled_ = CheckEnableLinuxSandboxLogging(pip_->GetFamExtraFlags());
+
+    // CODESYNC: Public/Src/Engine/Processes/SandboxConnectionLinuxDetours.cs (IsLightweightObservation)
+    // Only pips that never get an access denied qualify: denying a write or an enumeration takes looking at every call.
+    lightweightObservation_ = CheckEnableLinuxLightweightObservation(pip_->GetFamExtraFlags()) && !CheckFailUnexpectedFileAccesses(pip_->GetFamFlags());
+
+    compressReports_ = CheckEnableLinuxCompressedReports(pip_->GetFamExtraFlags());
+
+    SetUntrackedScopes();
+}
+
+// Returns the list this one replaced, null the first time
+const std::vector<std::string>* BxlObserver::SetUntrackedScopes()
+{
+    // When every access gets reported, nothing is untracked
+    auto scopes = new std::vector<std::string>();
+    if (!CheckReportAllFileAccesses(pip_->GetFamFlags()))
+    {
+        pip_->GetUntrackedScopes(*scopes);
+        std::sort(scopes->begin(), scopes->end());
+    }
+
+    const std::vector<std::string> *previous = untrackedScopes_.exchange(scopes);
+    untrackedPseudoFileSystems_.store(PseudoFileSystemAnonymous
+        | (IsUntrackedPath("/proc") ? PseudoFileSystemProc : 0)
+        | (IsUntrackedPath("/dev") ? PseudoFileSystemDev : 0)
+        | (IsUntrackedPath("/sys") ? PseudoFileSystemSys : 0), std::memory_order_relaxed);
+
+    return previous;
+}
+
+void BxlObserver::Init()
+{
+    // If message counting is enabled, open the associated semaphore (this should already be created by the managed side)
+    if (CheckCheckDetoursMessageCount(pip_->GetFamFlags()))
+    {
+        // Setting initializingSemaphore_ will communicate to the interpose layer to not interpose any libc functions called inside sem_open
+        initializingSemaphore_ = true;
+        messageCountingSemaphore_ = real_sem_open(pip_->GetInternalDetoursErrorNotificationFile(), O_CREAT, 0644, 0);
+
+        if (messageCountingSemaphore_ == SEM_FAILED)
+        {
+            // we'll log a message here, but this won't fail the pip until this feature is tested more thorougly
+            real_fprintf(stdout, "BuildXL injected message: File access monitoring failed to open message counting semaphore '%s' with errno: '%d'. You should rerun this build, or contact the BuildXL team if the issue persists across multiple builds.", pip_->GetInternalDetoursErrorNotificationFile(), errno);
+        }
+
+        initializingSemaphore_ = false;
+    }
+}
+
+AccessReport BxlObserver::CreateDebugMessageReport(pid_t pid)
+{
+    AccessReport report =
+    {
+        .operation          = kOpDebugMessage,
+        .pid                = pid,
+        .rootPid            = pip_->GetProcessId(),
+        .requestedAccess    = (int)RequestedAccess::Read,
+        .status             = FileAccessStatus::FileAccessStatus_Allowed,
+        .reportExplicitly   = 0,
+        .error              = 0,
+        .pipId              = pip_->GetPipId(),
+        .path               = {0},
+        .stats              = {0},
+        .isDirectory        = 0,
+        .shouldReport       = true,
+    };
+
+    return report;
+}
+
+void BxlObserver::LogDebug(pid_t pid, const char *fmt, ...)
+{
+    if (LogDebugEnabled())
+    {
+        // The message is only formatted into the debug log of this thread. It is sent, along with the messages logged before it,
+        // when the log of the thread fills up or before the next report that must go right away (see SendRecords and FlushReports).
+        va_list args;
+        va_start(args, fmt);
+        DebugLog::Append(pid, SendDebugMessages, fmt, args);
+        va_end(args);
+    }
+}
+
+void BxlObserver::SendDebugMessages(const DebugLog::Message *messages, size_t count)
+{
+    BxlObserver *bxl = GetInstance();
+    ReportRecord records[DebugLog::FLUSH_BATCH_SIZE];
+    for (size_t i = 0; i < count; i++)
+    {
+        bxl->PrepareDebugRecord(records[i], messages[i]);
+    }
+
+    bxl->SendRecords(records, count, /* useSecondaryPipe */ false);
+}
+
+// FNV-1a, seeded with the (coalesced) event type, the mount namespace and the scope generation
+static uint64_t HashCacheKey(uint64_t mountNamespace, uint64_t scopeGeneration, es_event_type_t event, std::string_view path)
+{
+    uint64_t hash = (14695981039346656037ULL ^ (uint64_t)event) ^ (mountNamespace * 0xC2B2AE3D27D4EB4FULL) ^ (scopeGeneration * 0x165667B19E3779F9ULL);
+    for (char c : path)
+    {
+        hash ^= (unsigned char)c;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+// Checks whether cache contains (event, path) pair and returns the result of this check.
+// If the pair is not in cache and addEntryIfMissing is true, attempts to add the pair to cache.
+bool BxlObserver::CheckCache(es_event_type_t event, std::string_view path, bool addEntryIfMissing)
+{
+    // coalesce some similar events
+    es_event_type_t key;
+    switch (event)
+    {
+        case ES_EVENT_TYPE_NOTIFY_TRUNCATE:
+        case ES_EVENT_TYPE_NOTIFY_SETATTRLIST:
+        case ES_EVENT_TYPE_NOTIFY_SETEXTATTR:
+        case ES_EVENT_TYPE_NOTIFY_DELETEEXTATTR:
+        case ES_EVENT_TYPE_NOTIFY_SETFLAGS:
+        case ES_EVENT_TYPE_NOTIFY_SETOWNER:
+        case ES_EVENT_TYPE_NOTIFY_SETMODE:
+        case ES_EVENT_TYPE_NOTIFY_WRITE:
+        case ES_EVENT_TYPE_NOTIFY_UTIMES:
+        case ES_EVENT_TYPE_NOTIFY_SETTIME:
+        case ES_EVENT_TYPE_NOTIFY_SETACL:
+            key = ES_EVENT_TYPE_NOTIFY_WRITE;
+            break;
+
+        case ES_EVENT_TYPE_NOTIFY_GETATTRLIST:
+        case ES_EVENT_TYPE_NOTIFY_GETEXTATTR:
+        case ES_EVENT_TYPE_NOTIFY_LISTEXTATTR:
+        case ES_EVENT_TYPE_NOTIFY_ACCESS:
+        case ES_EVENT_TYPE_NOTIFY_STAT:
+            key = ES_EVENT_TYPE_NOTIFY_STAT;
+
+        default:
+            key = event;
+            break;
+    }
+
+    uint64_t scopeGeneration = ScopeGeneration(path);
+    if (CheckLocalCache(key, path, addEntryIfMissing, scopeGeneration))
+    {
+        return true;
+    }
+
+    // Accesses already reported by other processes of the pip (running the same executable)
+    return sharedAccessCache_.IsEnabled() && sharedAccessCache_.Check((uint32_t)key, progFullPath_, path, addEntryIfMissing, scopeGeneration);
+}
+
+bool BxlObserver::CheckLocalCache(es_event_type_t key, std::string_view path, bool addEntryIfMissing, uint64_t scopeGeneration)
+{
+    uint64_t mountNamespace = mountNamespace_.load(std::memory_order_relaxed);
+    uint64_t hash = HashCacheKey(mountNamespace, scopeGeneration, key, path);
+    AccessCacheEntry *newEntry = nullptr;
+
+    for (size_t probe = 0; probe < ACCESS_CACHE_MAX_PROBES; probe++)
+    {
+        std::atomic<AccessCacheEntry *> &slot = accessCache_[(hash + probe) & (ACCESS_CACHE_SIZE - 1)];
+        AccessCacheEntry *entry = slot.load(std::memory_order_acquire);
+
+        if (entry == nullptr)
+        {
+            if (!addEntryIfMissing)
+            {
+                // Entries are never removed, so the pair can't be further down the probe sequence
+                return false;
+            }
+
+            if (newEntry == nullptr)
+            {
+                // This code could possibly be executing from an interrupt routine or from who knows where,
+                // so do not fail if we can't allocate: just forget about caching this pair.
+                newEntry = (AccessCacheEntry *)malloc(sizeof(AccessCacheEntry) + path.length() + 1);
+                if (newEntry == nullptr)
+                {
+                    return false;
+                }
+
+                newEntry->hash = hash;
+                newEntry->mountNamespace = mountNamespace;
+                newEntry->scopeGeneration = scopeGeneration;
+                newEntry->event = key;
+                newEntry->length = path.length();
+                char *entryPath = reinterpret_cast<char *>(newEntry + 1);
+                memcpy(entryPath, path.data(), path.length());
+                entryPath[path.length()] = '\0';
+            }
+
+            if (slot.compare_exchange_strong(entry, newEntry, std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                return false;
+            }
+
+            // Another thread published an entry in this slot in the meantime: check it below
+        }
+
+        if (entry->hash == hash &&
+            entry->mountNamespace == mountNamespace &&
+            entry->scopeGeneration == scopeGeneration &&
+            entry->event == key &&
+            entry->length == path.length() &&
+            memcmp(entry->GetPath(), path.data(), path.length()) == 0)
+        {
+            free(newEntry);
+            return true;
+        }
+    }
+
+    // The probe sequence is exhausted: the pair is not cached (and won't be)
+    free(newEntry);
+    return false;
+}
+
+bool BxlObserver::IsUntrackedPath(std::string_view path) const
+{
+    const std::vector<std::string> *scopes = untrackedScopes_.load(std::memory_order_acquire);
+    if (scopes == nullptr)
+    {
+        return false;
+    }
+
+    // Scopes are never nested, so at most one of the prefixes of the path (up to a separator) can be one
+    for (size_t separator = path.find('/', 1); ; separator = path.find('/', separator + 1))
+    {
+        std::string_view prefix = path.substr(0, separator);
+        auto scope = std::lower_bound(scopes->begin(), scopes->end(), prefix,
+            [](const std::string &scope, std::string_view prefix) { return std::string_view(scope) < prefix; });
+        if (scope != scopes->end() && *scope == prefix)
+        {
+            return true;
+        }
+
+        if (separator == std::string_view::npos)
+        {
+            return false;
+        }
+    }
+}
+
+// Whether the access needs neither to be checked nor reported, because its path(s) are under untracked scopes
+bool BxlObserver::IsUntrackedAccess(es_event_type_t event, std::string_view path, std::string_view secondPath) const
+{
+    // The scopes are gone once this object has been disposed (see IsCacheHit), and process lifetime events are always reported
+    const std::vector<std::string> *scopes = untrackedScopes_.load(std::memory_order_acquire);
+    if (disposed_ ||
+        scopes == nullptr ||
+        scopes->empty() ||
+        path.empty() ||
+        event == ES_EVENT_TYPE_NOTIFY_FORK ||
+        event == ES_EVENT_TYPE_NOTIFY_EXEC ||
+        event == ES_EVENT_TYPE_NOTIFY_EXIT)
+    {
+        return false;
+    }
+
+    return IsUntrackedPath(path) && (secondPath.empty() || IsUntrackedPath(secondPath));
+}
+
+// Whether the path is an anonymous file, or is under an untracked pseudo file system root and stays there once resolved
+bool BxlObserver::IsUntrackedPseudoFile(std::string_view path) const
+{
+    PseudoFileSystem fileSystem = get_pseudo_file_system(path);
+
+    // Same as for IsUntrackedAccess, the scopes are gone once this object has been disposed
+    return fileSystem == PseudoFileSystemAnonymous || (!disposed_ && (untrackedPseudoFileSystems_ & fileSystem) != 0);
+}
+
+bool BxlObserver::IsUntrackedPseudoFileAccess(es_event_type_t event, std::string_view path) const
+{
+    // Anonymous files are not reported whatever the event (see check_event_access), but process lifetime events are always
+    // reported otherwise
+    if (event == ES_EVENT_TYPE_NOTIFY_FORK || event == ES_EVENT_TYPE_NOTIFY_EXEC || event == ES_EVENT_TYPE_NOTIFY_EXIT)
+    {
+        return get_pseudo_file_system(path) == PseudoFileSystemAnonymous;
+    }
+
+    return IsUntrackedPseudoFile(path);
+}
+
+bool BxlObserver::IsCacheHit(es_event_type_t event, std::string_view path, std::string_view secondPath)
+{
+    // (1) IMPORTANT           : never do any of this stuff after this object has been disposed!
+    //     WHY                 : because the cache date structure is invalid at that point.
+    //     HOW CAN THIS HAPPEN : we may get called from "on_exit" handlers, at which point the
+    //                           global BxlObserver singleton instance can already be disposed.
+    // (2) never cache FORK, EXEC, EXIT and events that take 2 paths
+    if (disposed_ ||
+        secondPath.length() > 0 ||
+        event == ES_EVENT_TYPE_NOTIFY_FORK ||
+        event == ES_EVENT_TYPE_NOTIFY_EXEC ||
+        event == ES_EVENT_TYPE_NOTIFY_EXIT)
+    {
+        return false;
+    }
+
+    bool hit = CheckCache(event, path, /* addEntryIfMissing */ false);
+    InterposerStats::Increment(hit ? InterposerStats::CacheHits : InterposerStats::CacheMisses);
+    return hit;
+}
+
+// Buffers of CompressBatch, per thread so no locks are taken. A frame stays in use until Send has written it (see ReleaseFrame),
+// and a signal handler that reports in the meantime sends its batch as is.
+static thread_local char t_batch[PIPE_BUF];
+static thread_local char t_frame[PIPE_BUF];
+static thread_local bool t_frameInUse = false;
+
+bool BxlObserver::CompressBatch(const struct iovec *iov, int iovcnt, size_t bufsiz, struct iovec &frame)
+{
+    if (bufsiz < ReportCompression::MIN_BATCH_SIZE || t_frameInUse)
+    {
+        return false;
+    }
+
+    t_frameInUse = true;
+
+    size_t offset = 0;
+    for (int i = 0; i < iovcnt; i++)
+    {
+        memcpy(t_batch + offset, iov[i].iov_base, iov[i].iov_len);
+        offset += iov[i].iov_len;
+    }
+
+    // Frames must be smaller than the batch they replace, which always fits in a single atomic write
+    size_t compressedSize = ReportCompression::Compress(
+        t_batch, bufsiz, t_frame + ReportCompression::FRAME_HEADER_SIZE, bufsiz - ReportCompression::FRAME_HEADER_SIZE - 1);
+
+    if (compressedSize > 0)
+    {
+        uint32_t header[2] = { ReportCompression::COMPRESSED_FRAME_FLAG | (uint32_t)compressedSize, (uint32_t)bufsiz };
+        memcpy(t_frame, header, sizeof(header));
+        frame.iov_base = t_frame;
+        frame.iov_len = ReportCompression::FRAME_HEADER_SIZE + compressedSize;
+        return true;
+    }
+
+    t_frameInUse = false;
+    return false;
+}
+
+void BxlObserver::ReleaseFrame(const struct iovec *iov)
+{
+    if (iov->iov_base == t_frame)
+    {
+        t_frameInUse = false;
+    }
+}
+
+bool BxlObserver::Send(const struct iovec *iov, int iovcnt, bool useSecondaryPipe, int countedReports, bool mayDefer)
+{
+    if (!real_open)
+    {
+        _fatal("syscall 'open' not found; errno: %d", errno);
+    }
+
+    size_t bufsiz = 0;
+    for (int i = 0; i < iovcnt; i++)
+    {
+        bufsiz += iov[i].iov_len;
+    }
+
+    // TODO: instead of failing, implement a critical section
+    if (bufsiz > PIPE_BUF)
+    {
+        _fatal("Cannot atomically send a buffer whose size (%ld) is greater than PIPE_BUF (%d)", bufsiz, PIPE_BUF);
+    }
+
+    int logFd = GetReportFd(useSecondaryPipe);
+
+    PostCountedReports(countedReports);
+
+    struct iovec frameIov;
+    size_t uncompressedSize = bufsiz;
+    if (compressReports_ && CompressBatch(iov, iovcnt, bufsiz, frameIov))
+    {
+        iov = &frameIov;
+        iovcnt = 1;
+        bufsiz = frameIov.iov_len;
+    }
+
+    // A writev of at most PIPE_BUF bytes to a FIFO is as atomic as a write. The descriptor is non-blocking (see GetReportFd),
+    // so a full FIFO fails the whole write with EAGAIN.
+    ssize_t numWritten = real_writev(logFd, iov, iovcnt);
+    if (numWritten == -1 && errno == EAGAIN)
+    {
+        if (mayDefer)
+        {
+            ReleaseFrame(iov);
+            return false;
+        }
+
+        uint64_t stallStart = InterposerStats::IsEnabled() ? InterposerStats::NowNs() : 0;
+        do
+        {
+            struct pollfd pfd = { logFd, POLLOUT, 0 };
+            if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+            {
+                break;
+            }
+
+            numWritten = real_writev(logFd, iov, iovcnt);
+        } while (numWritten == -1 && (errno == EAGAIN || errno == EINTR));
+
+        if (stallStart != 0)
+        {
+            InterposerStats::Increment(InterposerStats::StalledSends);
+            InterposerStats::Increment(InterposerStats::SendStallNs, InterposerStats::NowNs() - stallStart);
+        }
+    }
+
+    if (numWritten < (ssize_t)bufsiz)
+    {
+        _fatal("Wrote only %ld bytes out of %ld", numWritten, bufsiz);
+    }
+
+    InterposerStats::Increment(InterposerStats::Sends);
+    InterposerStats::Increment(InterposerStats::SentBytes, bufsiz);
+    if (iov == &frameIov)
+    {
+        ReleaseFrame(iov);
+        InterposerStats::Increment(InterposerStats::CompressedSends);
+        InterposerStats::Increment(InterposerStats::CompressedInputBytes, uncompressedSize);
+    }
+
+    // After disposal the descriptor is not cached (see GetReportFd)
+    if (disposed_)
+    {
+        real_close(logFd);
+    }
+
+    return true;
+}
+
+void BxlObserver::PostCountedReports(int countedReports)
+{
+    // update message counting semaphore whenever a report is sent
+    // We update the message counting semaphore before sending the report because we could hit a race condition where
+    // the message is received by the managed side but we haven't yet incremented the counter if we do it after sending the message.
+    // If the message fails to send, the code below will write to stderr and exit with a bad exit code causing the pip to fail anyways.
+    // So it doesn't matter if we increment the counter but fail to send a message.
+    // The buffer may contain several reports, so the semaphore is posted once per counted report.
+    // The managed side counts the reports it receives in memory and only reads the semaphore once the pip is done, so nobody
+    // ever waits on it: sem_post never has a waiter to wake up and stays in user space.
+    if (messageCountingSemaphore_ != nullptr)
+    {
+        for (int i = 0; i < countedReports; i++)
+        {
+            auto result = real_sem_post(messageCountingSemaphore_);
+            if (result != 0)
+            {
+                // something went wrong with the semaphore, we shouldn't call LOG_DEBUG here because it will just come back to this function
+                // we also don't want to call _fatal because that will fail the pip.
+                // instead log the error to stdout (this could be promoted to stderr in the future when this feature is stable)
+                real_fprintf(stdout, "posting to buildxl message counting semaphore failed with errno: %d\n", errno);
+                break;
+            }
+        }
+    }
+}
+
+int BxlObserver::GetReportFd(bool useSecondaryPipe)
+{
+    std::atomic<int> &cachedFd = useSecondaryPipe ? secondaryReportFd_ : reportFd_;
+
+    int logFd = disposed_ ? -1 : cachedFd.load();
+    if (logFd != -1)
+    {
+        return logFd;
+    }
+
+    const char *reportsPath = useSecondaryPipe ? GetSecondaryReportsPath() : GetReportsPath();
+    logFd = real_open(reportsPath, O_WRONLY | O_APPEND | O_CLOEXEC, 0);
+    if (logFd == -1)
+    {
+        _fatal("Could not open file '%s'; errno: %d", reportsPath, errno);
+    }
+
+    // Writes to a full FIFO fail rather than block, so buffered reports can wait in the backlog (see Send). Opening the
+    // FIFO with O_NONBLOCK instead would fail with ENXIO whenever its reader is not there yet.
+    fcntl(logFd, F_SETFL, fcntl(logFd, F_GETFL) | O_NONBLOCK);
+
+    // A handle was opened for our own internal purposes. That
+    // could have reused a fd where we missed a close, 
+    // so reset that entry in the fd table
+    reset_fd_table_entry(logFd);
+
+    // Reports sent from on_exit handlers (after the destructor ran) just use a transient descriptor
+    if (disposed_)
+    {
+        return logFd;
+    }
+
+    // Another thread may have raced us opening the FIFO. In that case keep the winner's descriptor.
+    int expected = -1;
+    if (!cachedFd.compare_exchange_strong(expected, logFd))
+    {
+        real_close(logFd);
+        logFd = expected;
+    }
+
+    return logFd;
+}
+
+void BxlObserver::SendStatistics()
+{
+    bool sampledObservation = IsSampledObservationEnabled();
+    if ((!InterposerStats::IsEnabled() && !sampledObservation) || statisticsSent_.exchange(true))
+    {
+        return;
+    }
+
+    if (InterposerStats::IsEnabled())
+    {
+        std::string statistics;
+        InterposerStats::Format(statistics);
+        SendDebugMessageChunks("InterposerStats", statistics);
+    }
+
+    if (sampledObservation)
+    {
+        // Formatted as '<directory>=<count>;' for every directory some access was left out of the reports for
+        std::string counts;
+        {
+            std::lock_guard<std::mutex> lock(sampledOutAccessesLock_);
+            for (const auto &entry : sampledOutAccesses_)
+            {
+                counts.append(entry.first).append("=").append(std::to_string(entry.second)).append(";");
+            }
+        }
+
+        SendDebugMessageChunks("SampledOutAccesses", counts);
+    }
+}
+
+void BxlObserver::SendDebugMessageChunks(const char *kind, const std::string &payload)
+{
+    // A report can't be greater than PIPE_BUF, so long payloads are split (at ';' boundaries) in several messages
+    pid_t pid = getpid();
+    const size_t MaxChunkLength = PIPE_BUF - sizeof(uint32_t) - sizeof(ReportRecordHeader) - 128;
+    size_t start = 0;
+    while (start < payload.length())
+    {
+        size_t end = payload.length();
+        if (end - start > MaxChunkLength)
+        {
+            end = payload.rfind(';', start + MaxChunkLength);
+            end = end == std::string::npos || end < start ? start + MaxChunkLength : end + 1;
+        }
+
+        AccessReport report = CreateDebugMessageReport(pid);
+        snprintf(report.path, MAXPATHLEN, "[%s:%d] %s %.*s", __progname, pid, kind, (int)(end - start), payload.c_str() + start);
+        SendReport(report, /* isDebugMessage */ true);
+        start = end;
+    }
+}
+
+// One report out of this many is kept by the sampled observation mode
+#define SAMPLED_OBSERVATION_RATE 32
+
+bool BxlObserver::IsSampledOut(const AccessReport &report)
+{
+    // Process lifecycle reports, execs, writes and whatever was not plainly allowed are always reported
+    if (report.operation <= FileOperation::kOpProcessRequiresPtrace ||
+        report.operation == FileOperation::kOpKAuthVNodeExecute ||
+        report.operation == FileOperation::kOpDebugMessage ||
+        (report.requestedAccess & (DWORD)RequestedAccess::Write) != 0 ||
+        report.status != FileAccessStatus::FileAccessStatus_Allowed)
+    {
+        return false;
+    }
+
+    // The sample is a function of the path (FNV-1a), so the same paths are kept in every process and from run to run
+    uint32_t hash = 2166136261u;
+    for (const char *c = report.path; *c != '\0'; c++)
+    {
+        hash = (hash ^ (unsigned char)*c) * 16777619u;
+    }
+
+    if (hash % SAMPLED_OBSERVATION_RATE == 0)
+    {
+        return false;
+    }
+
+    const char *lastSlash = strrchr(report.path, '/');
+    std::string directory = lastSlash == nullptr || lastSlash == report.path
+        ? std::string("/")
+        : std::string(report.path, lastSlash - report.path);
+
+    std::lock_guard<std::mutex> lock(sampledOutAccessesLock_);
+    sampledOutAccesses_[directory]++;
+    return true;
+}
+
+bool BxlObserver::SendExitReport(pid_t pid)
+{
+    IOHandler handler(sandbox_);
+    handler.SetProcess(process_);
+    AccessReport report;
+    handler.CreateReportProcessExited(pid == 0 ? getpid() : pid, report);
+    return SendReport(report);
+}
+
+bool BxlObserver::SendReport(const AccessReportGroup &report)
+{
+    // Both reports of the group go in the same write
+    ReportRecord records[2];
+    size_t count = 0;
+    if (report.firstReport.shouldReport && PrepareRecord(records[count], report.firstReport, /* isDebugMessage */ false))
+    {
+        count++;
+    }
+
+    if (report.secondReport.shouldReport && PrepareRecord(records[count], report.secondReport, /* isDebugMessage */ false))
+    {
+        count++;
+    }
+
+    return SendRecords(records, count, /* useSecondaryPipe */ false);
+}
+
+bool BxlObserver::SendReports(const std::vector<AccessReportGroup> &reports)
+{
+    ReportRecord records[MaxRecordsPerBatch];
+    size_t count = 0;
+    bool result = true;
+    for (const AccessReportGroup &report : reports)
+    {
+        // Never split a group across batches
+        if (count + 2 > MaxRecordsPerBatch)
+        {
+            result &= SendRecords(records, count, /* useSecondaryPipe */ false);
+            count = 0;
+        }
+
+        if (report.firstReport.shouldReport && PrepareRecord(records[count], report.firstReport, /* isDebugMessage */ false))
+        {
+            count++;
+        }
+
+        if (report.secondReport.shouldReport && PrepareRecord(records[count], report.secondReport, /* isDebugMessage */ false))
+        {
+            count++;
+        }
+    }
+
+    result &= SendRecords(records, count, /* useSecondaryPipe */ false);
+    return result;
+}
+
+bool BxlObserver::SendReport(const AccessReport &report, bool isDebugMessage, bool useSecondaryPipe)
+{
+    ReportRecord record;
+    return !PrepareRecord(record, report, isDebugMessage) || SendRecords(&record, 1, useSecondaryPipe);
+}
+
+// The record of a debug message (see CreateDebugMessageReport) pointing to the text of the message, which is already short enough
+void BxlObserver::PrepareDebugRecord(ReportRecord &record, const DebugLog::Message &message)
+{
+    static_assert(DebugLog::MAX_MESSAGE_LENGTH <= PIPE_BUF - sizeof(record.header), "A debug message must fit in a single report");
+
+    ReportRecordHeader header =
+    {
+        .pid                = message.pid <= 0 ? getpid() : message.pid,
+        .requestedAccess    = (uint32_t)RequestedAccess::Read,
+        .status             = (uint32_t)FileAccessStatus::FileAccessStatus_Allowed,
+        .reportExplicitly   = 0,
+        .error              = 0,
+        .operation          = (uint32_t)FileOperation::kOpDebugMessage,
+        .isDirectory        = 0,
+    };
+
+    uint32_t recordLength = sizeof(ReportRecordHeader) + message.length;
+    memcpy(record.header, &recordLength, sizeof(recordLength));
+    memcpy(record.header + sizeof(recordLength), &header, sizeof(ReportRecordHeader));
+    record.path = message.text;
+    record.pathLength = message.length;
+    record.counted = false;
+    record.flushImmediately = false;
+    record.flushSoon = false;
+}
+
+// Returns false if the report should not be sent at all
+bool BxlObserver::PrepareRecord(ReportRecord &record, const AccessReport &report, bool isDebugMessage)
+{
+    // there is no central sendbox process here (i.e., there is an instance of this
+    // guy in every child process), so counting process tree size is not feasible
+    if (report.operation == FileOperation::kOpProcessTreeCompleted)
+    {
+        return false;
+    }
+
+    if (!isDebugMessage && IsSampledObservationEnabled() && IsSampledOut(report))
+    {
+        return false;
+    }
+
+    const size_t MaxPathLength = PIPE_BUF - sizeof(record.header);
+    size_t pathLength = strnlen(report.path, MAXPATHLEN);
+    if (pathLength > MaxPathLength)
+    {
+        // For debug messages it is fine to truncate the message, otherwise, this is a problem and we must fail
+        if (!isDebugMessage)
+        {
+            // TODO: once 'send' is capable of sending more than PIPE_BUF at once, allocate a bigger buffer and send that
+            _fatal("Message truncated to fit PIPE_BUF (%d): %s", PIPE_BUF, report.path);
+        }
+
+        pathLength = MaxPathLength;
+    }
+
+    ReportRecordHeader header =
+    {
+        .pid                = report.pid <= 0 ? getpid() : report.pid,
+        .requestedAccess    = (uint32_t)report.requestedAccess,
+        .status             = (uint32_t)report.status,
+        .reportExplicitly   = (uint32_t)report.reportExplicitly,
+        .error              = (uint32_t)report.error,
+        .operation          = (uint32_t)report.operation,
+        .isDirectory        = (uint32_t)report.isDirectory,
+    };
+
+    uint32_t recordLength = sizeof(ReportRecordHeader) + pathLength;
+    memcpy(record.header, &recordLength, sizeof(recordLength));
+    memcpy(record.header + sizeof(recordLength), &header, sizeof(ReportRecordHeader));
+    record.path = report.path;
+    record.pathLength = pathLength;
+
+    // CODESYNC: Public/Src/Engine/Processes/SandboxedProcessUnix.cs
+    record.counted =
+        report.operation != FileOperation::kOpProcessStart
+        && report.operation != FileOperation::kOpProcessExit
+        && report.operation != FileOperation::kOpProcessTreeCompleted
+        && report.operation != FileOperation::kOpDebugMessage;
+
+    // Process lifetime reports and denied accesses are sent right away: the managed side needs
+    // to see them promptly (to track active processes and to fail fast, respectively).
+    bool isLifecycleReport =
+        report.operation == FileOperation::kOpProcessStart
+        || report.operation == FileOperation::kOpProcessExit;
+    record.flushImmediately =
+        (isLifecycleReport && !deferLifecycleReports_)
+        || report.status == FileAccessStatus::FileAccessStatus_Denied;
+    record.flushSoon = isLifecycleReport && deferLifecycleReports_;
+
+    return true;
+}
+
+bool BxlObserver::SendRecords(const ReportRecord *records, size_t count, bool useSecondaryPipe)
+{
+    if (count == 0)
+    {
+        return true;
+    }
+
+    size_t totalSize = 0;
+    int countedReports = 0;
+    bool flushImmediately = false;
+    bool flushSoon = false;
+    for (size_t i = 0; i < count; i++)
+    {
+        totalSize += records[i].Size();
+        countedReports += records[i].counted ? 1 : 0;
+        flushImmediately |= records[i].flushImmediately;
+        flushSoon |= records[i].flushSoon;
+    }
+
+    // Whatever was logged before a report that goes right away (e.g., on exec or exit) is sent before it
+    if (flushImmediately && LogDebugEnabled())
+    {
+        DebugLog::Flush(SendDebugMessages);
+    }
+
+    // Reports for the secondary pipe are rare and are not buffered. Make sure whatever is pending on the primary
+    // pipe goes first, so the relative order of reports is preserved as much as possible.
+    // If the singleton was already disposed (e.g., we are sending the exit report from an on_exit handler)
+    // the buffer should not be touched anymore.
+    if (useSecondaryPipe || disposed_)
+    {
+        if (useSecondaryPipe)
+        {
+            FlushReports();
+        }
+
+        return WriteRecords(records, count, useSecondaryPipe, /* sendReportBuffer */ false);
+    }
+
+    if (!LockReportBuffer())
+    {
+        // failed to acquire mutex -> send the reports right away
+        return WriteRecords(records, count, useSecondaryPipe, /* sendReportBuffer */ false);
+    }
+
+    // ============================== in the critical section ================================
+
+    // make sure the mutex is released by the end
+    shared_ptr<timed_mutex> sp(&reportBufferMtx_, [](timed_mutex *mtx) { mtx->unlock(); });
+
+    // Records that are sent together stay together (in the same write) whenever they fit in one. The buffer is only full,
+    // nothing needs to be sent right away: when the FIFO is full too, leave the buffer in the backlog.
+    bool result = true;
+    if (reportBufferLength_ + totalSize > PIPE_BUF)
+    {
+        result = FlushReportBuffer(/* mayDefer */ true);
+    }
+
+    if (!flushImmediately && totalSize <= PIPE_BUF)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            reportBufferLength_ += CopyRecord(&reportBuffer_[reportBufferLength_], records[i]);
+        }
+
+        reportBufferCountedReports_ += countedReports;
+
+        if (flushSoon)
+        {
+            {
+                std::lock_guard<std::mutex> lock(lifecycleReportsMtx_);
+                lifecycleReportsPending_ = true;
+            }
+
+            lifecycleReportsCv_.notify_one();
+        }
+
+        return result;
+    }
+
+    // The records must go right away (or don't fit in the buffer anyway): send them right after what is pending, which
+    // takes a single writev when everything fits in PIPE_BUF
+    result &= WriteRecords(records, count, /* useSecondaryPipe */ false, /* sendReportBuffer */ true);
+    return result;
+}
+
+// Writes the given records with as few writes of at most PIPE_BUF as possible. When sendReportBuffer is set the pending
+// contents of the report buffer go first, and reportBufferMtx_ must be held by the caller.
+bool BxlObserver::WriteRecords(const ReportRecord *records, size_t count, bool useSecondaryPipe, bool sendReportBuffer)
+{
+    struct iovec iov[2 * MaxRecordsPerBatch + 1];
+    int iovcnt = 0;
+    size_t size = 0;
+    int countedReports = 0;
+    bool result = true;
+
+    // The backlog goes first, and these records must not wait behind it
+    if (sendReportBuffer)
+    {
+        DrainReportBacklog(/* mayDefer */ false);
+    }
+
+    if (sendReportBuffer && reportBufferLength_ > 0)
+    {
+        iov[iovcnt++] = { reportBuffer_, reportBufferLength_ };
+        size = reportBufferLength_;
+        countedReports = reportBufferCountedReports_;
+        reportBufferLength_ = 0;
+        reportBufferCountedReports_ = 0;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        // A single record always fits in PIPE_BUF (see PrepareRecord)
+        if (size + records[i].Size() > PIPE_BUF)
+        {
+            result &= Send(iov, iovcnt, useSecondaryPipe, countedReports);
+            iovcnt = 0;
+            size = 0;
+            countedReports = 0;
+        }
+
+        iov[iovcnt++] = { (void *)records[i].header, sizeof(records[i].header) };
+        if (records[i].pathLength > 0)
+        {
+            iov[iovcnt++] = { (void *)records[i].path, records[i].pathLength };
+        }
+
+        size += records[i].Size();
+        countedReports += records[i].counted ? 1 : 0;
+    }
+
+    if (iovcnt > 0)
+    {
+        result &= Send(iov, iovcnt, useSecondaryPipe, countedReports);
+    }
+
+    return result;
+}
+
+// This code could possibly be executing from an interrupt routine or from who knows where, so to avoid
+// deadlocks it's essential to never block here indefinitely. Callers that fail to get the lock don't touch the
+// buffer. The exception is when process lifetime reports are deferred: that only happens in the ptrace runner,
+// whose reports are not made from signal handlers, and bypassing the buffer there would let a report overtake
+// the ones the background thread is about to send.
+bool BxlObserver::LockReportBuffer()
+{
+    if (deferLifecycleReports_)
+    {
+        reportBufferMtx_.lock();
+        return true;
+    }
+
+    return reportBufferMtx_.try_lock_for(chrono::milliseconds(1));
+}
+
+// Assumes reportBufferMtx_ is held by the caller. The backlog is sent before the buffer. When mayDefer is set and the FIFO
+// is full, whatever could not be sent stays in the backlog (the buffer joins it), unless the backlog is full already.
+bool BxlObserver::FlushReportBuffer(bool mayDefer)
+{
+    mayDefer = mayDefer && reportBacklogCount_ < ReportBacklogCapacity;
+
+    bool drained = DrainReportBacklog(mayDefer);
+    if (reportBufferLength_ == 0)
+    {
+        return true;
+    }
+
+    // Nothing may overtake the backlog
+    bool sent = false;
+    if (drained)
+    {
+        sent = Send(reportBuffer_, reportBufferLength_, /* useSecondaryPipe */ false, reportBufferCountedReports_, mayDefer);
+    }
+    else
     {
-        auto result = real_sem_post(messageCountingSemaphore_);
-        if (result != 0)
-        {
-            // something went wrong with the semaphore, we shouldn't call LOG_DEBUG here because it will just come back to this function
-            // we also don't want to call _fatal because that will fail the pip.
-            // instead log the error to stdout (this could be promoted to stderr in the future when this feature is stable)
-            real_fprintf(stdout, "posting to buildxl message counting semaphore failed with errno: %d\n", errno);
-        }
+        PostCountedReports(reportBufferCountedReports_);
     }
 
-    ssize_t numWritten = real_write(logFd, buf, bufsiz);
-    if (numWritten < bufsiz)
+    if (!sent)
     {
-        _fatal("Wrote only %ld bytes out of %ld", numWritten, bufsiz);
+        ReportBacklogEntry &entry = reportBacklog_[(reportBacklogHead_ + reportBacklogCount_) % ReportBacklogCapacity];
+        memcpy(entry.buffer, reportBuffer_, reportBufferLength_);
+        entry.length = reportBufferLength_;
+        reportBacklogCount_++;
+        InterposerStats::Increment(InterposerStats::DeferredSends);
     }
 
-    // A handle was opened for our own internal purposes. That
-    // could have reused a fd where we missed a close, 
-    // so reset that entry in the fd table
-    reset_fd_table_entry(logFd);
-
-    real_close(logFd);
+    reportBufferLength_ = 0;
+    reportBufferCountedReports_ = 0;
 
     return true;
 }
 
-bool BxlObserver::SendExitReport(pid_t pid)
+// Assumes reportBufferMtx_ is held by the caller. Returns whether the backlog is empty, which it always is afterwards
+// unless mayDefer is set and the FIFO is full.
+bool BxlObserver::DrainReportBacklog(bool mayDefer)
 {
-    IOHandler handler(sandbox_);
-    handler.SetProcess(process_);
-    AccessReport report;
-    handler.CreateReportProcessExited(pid == 0 ? getpid() : pid, report);
-    return SendReport(report);
+    while (reportBacklogCount_ > 0)
+    {
+        // The message counting semaphore was posted when the entry joined the backlog
+        const ReportBacklogEntry &entry = reportBacklog_[reportBacklogHead_];
+        if (!Send(entry.buffer, entry.length, /* useSecondaryPipe */ false, /* countedReports */ 0, mayDefer))
+        {
+            return false;
+        }
+
+        reportBacklogHead_ = (reportBacklogHead_ + 1) % ReportBacklogCapacity;
+        reportBacklogCount_--;
+    }
+
+    return true;
 }
 
-bool BxlObserver::SendReport(const AccessReportGroup &report)
+void BxlObserver::FlushReports()
 {
-    bool result = report.firstReport.shouldReport 
-        ? SendReport(report.firstReport)
-        : true;
+    if (disposed_)
+    {
+        return;
+    }
 
-    result &= report.secondReport.shouldReport
-        ? SendReport(report.secondReport)
-        : true;
+    if (LogDebugEnabled())
+    {
+        DebugLog::Flush(SendDebugMessages);
+    }
 
-    return result;
-}
+    accessTrace_.Flush();
 
-bool BxlObserver::SendReport(const AccessReport &report, bool isDebugMessage, bool useSecondaryPipe)
-{
-    // there is no central sendbox process here (i.e., there is an instance of this
-    // guy in every child process), so counting process tree size is not feasible
-    if (report.operation == FileOperation::kOpProcessTreeCompleted)
+    // Same as for SendReport, never block indefinitely here. If another thread holds the lock, it
+    // will get the buffer flushed whenever it gets full or when a process lifetime event is reported.
+    if (!LockReportBuffer())
     {
-        return true;
+        return;
     }
 
-    const int PrefixLength = sizeof(uint);
-    char buffer[PIPE_BUF] = {0};
-    int maxMessageLength = PIPE_BUF - PrefixLength;
-    int reportSize = BuildReport(&buffer[PrefixLength], maxMessageLength, report, report.path);
-    // CODESYNC: Public/Src/Engine/Processes/SandboxedProcessUnix.cs
-    bool shouldCountReportType = 
-        report.operation != FileOperation::kOpProcessStart
-        && report.operation != FileOperation::kOpProcessExit
-        && report.operation != FileOperation::kOpProcessTreeCompleted
-        && report.operation != FileOperation::kOpDebugMessage;
+    shared_ptr<timed_mutex> sp(&reportBufferMtx_, [](timed_mutex *mtx) { mtx->unlock(); });
+    FlushReportBuffer();
+}
 
-    if (reportSize >= maxMessageLength)
+void BxlObserver::DeferLifecycleReports()
+{
+    deferLifecycleReports_ = true;
+
+    // Lives until the process exits, which flushes whatever is left (see FlushReports)
+    std::thread([this]()
     {
-        // For debug messages it is fine to truncate the message, otherwise, this is a problem and we must fail
-        if (!isDebugMessage)
+        while (true)
         {
-            // TODO: once 'send' is capable of sending more than PIPE_BUF at once, allocate a bigger buffer and send that
-            _fatal("Message truncated to fit PIPE_BUF (%d): %s", PIPE_BUF, buffer);
+            {
+                std::unique_lock<std::mutex> lock(lifecycleReportsMtx_);
+                lifecycleReportsCv_.wait(lock, [this]() { return lifecycleReportsPending_; });
+                lifecycleReportsPending_ = false;
+            }
+
+            FlushReports();
         }
-        else
-        {
-            // The report couldn't be fully built for a debug message. Let's crop the message (report.path) so it fits.
-            // We calculate the maximum size allowed, considering that 'path' is the last component of the
-            // message (plus the \n that ends any report, hence the -1), so it's the last thing 
-            // we tried to write when hitting the size limit.
-            int truncatedSize = strlen(report.path) - (reportSize - maxMessageLength) - 1;
-            char truncatedMessage[truncatedSize] = {0};
+    }).detach();
+}
 
-            // Let's leave an ending \0
-            strncpy(truncatedMessage, report.path, truncatedSize - 1);
+void BxlObserver::DiscardBufferedReports()
+{
+    // Only one thread survives a fork, so there is no need to take the lock here (and it may
+    // have been held by some other thread in the parent at the time of the fork).
+    reportBufferLength_ = 0;
+    reportBufferCountedReports_ = 0;
+    reportBacklogHead_ = 0;
+    reportBacklogCount_ = 0;
+    DebugLog::Discard();
 
-            reportSize = BuildReport(&buffer[PrefixLength], maxMessageLength, report, truncatedMessage);
-        }
+    // Likewise for the access trace, and the child records its accesses to a file of its own
+    int traceFd = accessTrace_.Detach();
+    if (traceFd != -1)
+    {
+        real_close(traceFd);
+        StartAccessTrace();
     }
-
-    *(uint*)(buffer) = reportSize;
-    return Send(buffer, std::min(reportSize + PrefixLength, PIPE_BUF), useSecondaryPipe, shouldCountReportType);
 }
 
 void BxlObserver::report_exec(const char *syscallName, const char *procName, const char *file, int error, mode_t mode, pid_t associatedPid)
 {
     if (IsMonitoringChildProcesses())
     {
-        // first report 'procName' as is (without trying to resolve it) to ensure that a process name is reported before anything else
-        report_access(syscallName, ES_EVENT_TYPE_NOTIFY_EXEC, procName, empty_str_, mode, error, /* checkCache */ true, associatedPid);
-        report_access(syscallName, ES_EVENT_TYPE_NOTIFY_EXEC, file, mode, /*flags*/ 0, error, /* checkCache */ true, associatedPid);
+        // first report 'procName' as is (without trying to resolve it) to ensure that a process name is reported before anything else.
+        // Both reports are sent in a single write.
+        std::vector<AccessReportGroup> reports(2);
+        create_access(syscallName, ES_EVENT_TYPE_NOTIFY_EXEC, procName, empty_str_, reports[0], mode, /* checkCache */ true, associatedPid);
+        create_access(syscallName, ES_EVENT_TYPE_NOTIFY_EXEC, file, reports[1], mode, /*flags*/ 0, /* checkCache */ true, associatedPid);
+        reports[0].SetErrno(error);
+        reports[1].SetErrno(error);
+        SendReports(reports);
     }
 }
 
-void BxlObserver::report_exec_args(pid_t pid)
+void BxlObserver::report_audit_objopen(const char *fullpath)
 {
-    if (IsReportingProcessArgs())
+    // A library already reported by this process (e.g., loaded again by dlopen) doesn't even get queued
+    if (IsCacheHit(ES_EVENT_TYPE_NOTIFY_OPEN, fullpath, empty_str_))
     {
-        char path[PATH_MAX] = { 0 };
-        int maxSize = PIPE_BUF + sizeof(uint) - 1;
-        char cmdLineBuffer[maxSize] = { 0 };
-        std::string cmdLine;
-        bool firstArg = true;
+        return;
+    }
 
-        // /proc/<pid>/cmdline has a set of arguments separated by the null terminator
-        snprintf(path, PATH_MAX, "/proc/%d/cmdline", pid);
+    pendingAuditObjopens_.emplace_back(fullpath);
+}
+
+void BxlObserver::flush_audit_objopen()
+{
+    if (pendingAuditObjopens_.empty())
+    {
+        return;
+    }
+
+    std::vector<AccessReportGroup> reports(pendingAuditObjopens_.size());
+    for (size_t i = 0; i < pendingAuditObjopens_.size(); i++)
+    {
+        IOEvent event(ES_EVENT_TYPE_NOTIFY_OPEN, ES_ACTION_TYPE_NOTIFY, pendingAuditObjopens_[i], progFullPath_, S_IFREG);
+        create_access("la_objopen", event, reports[i], /* checkCache */ true);
+    }
 
-        int fd = open(path, O_RDONLY);
-        int bytesRead = read(fd, cmdLineBuffer, maxSize);
-        char *end = cmdLineBuffer + bytesRead;
+    pendingAuditObjopens_.clear();
+    SendReports(reports);
+}
 
-        for (char *currentArg = cmdLineBuffer; currentArg < end; )
+void BxlObserver::report_exec_args(pid_t pid, int argc, char **argv)
+{
+    if (IsReportingProcessArgs())
+    {
+        std::string cmdLine;
+        for (int i = 0; i < argc && argv[i] != nullptr; i++)
         {
-            if (firstArg)
-            {
-                firstArg = false;
-            }
-            else
+            if (i > 0)
             {
                 cmdLine.append(" ");
             }
-            cmdLine.append(currentArg);
 
-            // Increment currentArg until the next null character is reached
-            while(*currentArg++);
+            cmdLine.append(argv[i]);
         }
-        close(fd);
 
         AccessReport report =
         {
@@ -495,8 +1902,29 @@ void BxlObserver::report_exec_args(pid_t pid)
             .shouldReport     = true,
         };
 
-        strlcpy(report.path, cmdLine.c_str(), sizeof(report.path));
-        SendReport(report, /* isDebugMessage */ false, /* useSecondaryPipe */ false);
+        // CODESYNC: Public/Src/Engine/Processes/SandboxedProcessReports.cs
+        // A record can't be greater than PIPE_BUF, so long command lines are sent in several chunks (which the managed
+        // side appends to each other). Chunks never split a UTF-8 sequence.
+        const size_t MaxChunkLength = PIPE_BUF - sizeof(uint32_t) - sizeof(ReportRecordHeader);
+        size_t start = 0;
+        do
+        {
+            size_t end = cmdLine.length();
+            if (end - start > MaxChunkLength)
+            {
+                end = start + MaxChunkLength;
+                while (end > start + 1 && (cmdLine[end] & 0xC0) == 0x80)
+                {
+                    end--;
+                }
+            }
+
+            report.error = end < cmdLine.length() ? E2BIG : 0;
+            memcpy(report.path, cmdLine.data() + start, end - start);
+            report.path[end - start] = '\0';
+            SendReport(report, /* isDebugMessage */ false, /* useSecondaryPipe */ false);
+            start = end;
+        } while (start < cmdLine.length());
     }
 }
 
@@ -512,6 +1940,16 @@ void BxlObserver::report_access(const char *syscallName, es_event_type_t eventTy
     report_access_internal(syscallName, eventType, reportPath, secondPath, mode, error, checkCache, associatedPid);
 }
 
+void BxlObserver::report_access(const char *syscallName, es_event_type_t eventType, const ResolvedSymlinkChain &chain, pid_t associatedPid)
+{
+    if (chain.path.empty() || IsUntrackedPseudoFileAccess(eventType, chain.path.c_str()))
+    {
+        return;
+    }
+
+    report_access_internal(syscallName, eventType, chain.path.c_str(), /* secondPath */ nullptr, /* mode */ 0, /* error */ 0, /* checkCache */ true, associatedPid);
+}
+
 void BxlObserver::report_access_internal(const char *syscallName, es_event_type_t eventType, const char *reportPath, const char *secondPath, mode_t mode, int error, bool checkCache, pid_t associatedPid)
 {
     AccessReportGroup report;
@@ -534,7 +1972,58 @@ AccessCheckResult BxlObserver::create_access(const char *syscallName, es_event_t
 AccessCheckResult BxlObserver::create_access_internal(const char *syscallName, es_event_type_t eventType, const char *reportPath, const char *secondPath, AccessReportGroup &reportGroup, mode_t mode, bool checkCache, pid_t associatedPid)
 {
     secondPath = secondPath == nullptr ? empty_str_ : secondPath;  
-    if (checkCache && IsCacheHit(eventType, std::move(std::string(reportPath)), std::move(std::string(secondPath))))
+    if (!accessTrace_.IsEnabled())
+    {
+        return check_path_access(syscallName, eventType, reportPath, secondPath, reportGroup, mode, checkCache, associatedPid);
+    }
+
+    uint64_t start = AccessTrace::NowNs();
+    mode_t checkedMode = mode;
+    AccessCheckResult result = check_path_access(syscallName, eventType, reportPath, secondPath, reportGroup, checkedMode, checkCache, associatedPid);
+    uint64_t end = AccessTrace::NowNs();
+
+    IOEvent event(associatedPid, 0, 0, eventType, ES_ACTION_TYPE_NOTIFY, std::string(reportPath), std::string(secondPath), std::string(), checkedMode, false);
+    accessTrace_.Append(AccessTrace::Kind::Path, syscallName, event, checkCache, result, start, end - start);
+    return result;
+}
+
+// The event check_path_access refills for every access of a thread. It is not a thread_local object itself: interposed calls still
+// come after the thread_local destructors ran (e.g., from atexit handlers or late destructors), so the storage has to outlive the
+// event, and t_eventState tells whether the event can still be used.
+enum class ThreadEventState : char { None, Idle, InUse, Released };
+alignas(IOEvent) static thread_local char t_eventStorage[sizeof(IOEvent)];
+static thread_local ThreadEventState t_eventState = ThreadEventState::None;
+
+// Destroys the event of a thread when the thread (or the process) exits
+struct ThreadEventReleaser
+{
+    ThreadEventReleaser() { }
+
+    ~ThreadEventReleaser()
+    {
+        // An event still in use is left to leak rather than destroyed under its user
+        if (t_eventState == ThreadEventState::Idle)
+        {
+            reinterpret_cast<IOEvent *>(t_eventStorage)->~IOEvent();
+        }
+
+        t_eventState = ThreadEventState::Released;
+    }
+};
+
+static thread_local ThreadEventReleaser t_eventReleaser;
+
+AccessCheckResult BxlObserver::check_path_access(const char *syscallName, es_event_type_t eventType, const char *reportPath, const char *secondPath, AccessReportGroup &reportGroup, mode_t &mode, bool checkCache, pid_t associatedPid)
+{
+    SyncManifest();
+    ManifestReadScope manifestReadScope(manifestReaders_);
+
+    if (IsUntrackedAccess(eventType, reportPath, secondPath))
+    {
+        return sNotChecked;
+    }
+
+    if (checkCache && IsCacheHit(eventType, reportPath, secondPath))
     {
         return sNotChecked;
     }
@@ -543,20 +2032,50 @@ AccessCheckResult BxlObserver::create_access_internal(const char *syscallName, e
     {
         // Mode hasn't been computed yet. Let's do it here.
         mode = get_mode(reportPath);
+        mode = mode == 0 ? MODE_NONEXISTENT : mode;
     }
 
+    // A path known not to exist is what a mode of 0 stands for from here on
+    mode_t existingMode = mode == MODE_NONEXISTENT ? 0 : mode;
+
     // If this file descriptor is a non-file (e.g., a pipe, or socket, etc.) then we don't care about it
-    if (is_non_file(mode))
+    if (is_non_file(existingMode))
     {
         return sNotChecked;
     }
 
-    std::string execPath = eventType == ES_EVENT_TYPE_NOTIFY_EXEC
-        ? std::string(reportPath)
-        : std::string(progFullPath_);
+    pid_t pid = associatedPid == 0 ? getpid() : associatedPid;
+    const char *execPath = eventType == ES_EVENT_TYPE_NOTIFY_EXEC ? reportPath : progFullPath_;
+
+    // The event of every access of a thread is refilled in place, so once it has held the longest paths of the thread checking an
+    // access does not allocate anymore (the reports are built in the caller's AccessReportGroup, with the paths inline). An access
+    // checked while the event is in use (e.g., from a signal handler) or once the thread is torn down gets an event of its own.
+    if (t_eventState == ThreadEventState::None)
+    {
+        // Touching the releaser registers its destructor with the exit of the thread
+        (void)&t_eventReleaser;
+        new (t_eventStorage) IOEvent();
+        t_eventState = ThreadEventState::Idle;
+    }
+
+    if (t_eventState != ThreadEventState::Idle)
+    {
+        IOEvent event(pid, 0, getppid(), eventType, ES_ACTION_TYPE_NOTIFY, reportPath, secondPath, execPath, existingMode, false);
+        return check_event_access(syscallName, event, reportGroup, /* checkCache */ false /* because already checked cache above */);
+    }
+
+    IOEvent &threadEvent = *reinterpret_cast<IOEvent *>(t_eventStorage);
+    t_eventState = ThreadEventState::InUse;
+    threadEvent.Assign(pid, getppid(), eventType, ES_ACTION_TYPE_NOTIFY, reportPath, secondPath, execPath, existingMode, false);
+    AccessCheckResult result = check_event_access(syscallName, threadEvent, reportGroup, /* checkCache */ false /* because already checked cache above */);
+
+    // The thread may have started exiting in the meantime, in which case the event stays released
+    if (t_eventState == ThreadEventState::InUse)
+    {
+        t_eventState = ThreadEventState::Idle;
+    }
 
-    IOEvent event(associatedPid == 0 ? getpid() : associatedPid, 0, getppid(), eventType, ES_ACTION_TYPE_NOTIFY, std::move(std::string(reportPath)), std::move(std::string(secondPath)), std::move(execPath), mode, false);
-    return create_access(syscallName, event, reportGroup, /* checkCache */ false /* because already checked cache above */);
+    return result;
 }
 
 void BxlObserver::report_access(const char *syscallName, IOEvent &event, bool checkCache)
@@ -568,9 +2087,27 @@ void BxlObserver::report_access(const char *syscallName, IOEvent &event, bool ch
 
 AccessCheckResult BxlObserver::create_access(const char *syscallName, IOEvent &event, AccessReportGroup &reportGroup, bool checkCache)
 {
+    if (!accessTrace_.IsEnabled())
+    {
+        return check_event_access(syscallName, event, reportGroup, checkCache);
+    }
+
+    uint64_t start = AccessTrace::NowNs();
+    AccessCheckResult result = check_event_access(syscallName, event, reportGroup, checkCache);
+    uint64_t end = AccessTrace::NowNs();
+
+    accessTrace_.Append(AccessTrace::Kind::Event, syscallName, event, checkCache, result, start, end - start);
+    return result;
+}
+
+AccessCheckResult BxlObserver::check_event_access(const char *syscallName, IOEvent &event, AccessReportGroup &reportGroup, bool checkCache)
+{
+    SyncManifest();
+    ManifestReadScope manifestReadScope(manifestReaders_);
+
     es_event_type_t eventType = event.GetEventType();
     
-    if (checkCache && IsCacheHit(eventType, event.GetSrcPath(), event.GetDstPath()))
+    if (checkCache && (IsUntrackedAccess(eventType, event.GetSrcPath(), event.GetDstPath()) || IsCacheHit(eventType, event.GetSrcPath(), event.GetDstPath())))
     {
         return sNotChecked;
     }
@@ -616,6 +2153,11 @@ void BxlObserver::report_access(const char *syscallName, es_event_type_t eventTy
         return;
     }
 
+    if (IsUntrackedPseudoFileAccess(eventType, pathname))
+    {
+        return;
+    }
+
     auto normalized = normalize_path(pathname, flags, associatedPid);
     if (normalized.length() == 0) 
     {
@@ -629,7 +2171,7 @@ void BxlObserver::report_access(const char *syscallName, es_event_type_t eventTy
 AccessCheckResult BxlObserver::create_access(const char *syscallName, es_event_type_t eventType, const char *pathname, AccessReportGroup &reportGroup, mode_t mode, int flags, bool checkCache, pid_t associatedPid)
 {
     // If the path is null or if we can't normalize it, we have no meaningful way of reporting this access
-    if (pathname == nullptr) 
+    if (pathname == nullptr || IsUntrackedPseudoFileAccess(eventType, pathname))
     {
         return sNotChecked;
     }
@@ -653,20 +2195,64 @@ void BxlObserver::report_access_fd(const char *syscallName, es_event_type_t even
 
 AccessCheckResult BxlObserver::create_access_fd(const char *syscallName, es_event_type_t eventType, int fd, AccessReportGroup &report, pid_t associatedPid)
 {   
+    SyncManifest();
+    ManifestReadScope manifestReadScope(manifestReaders_);
+
     mode_t mode = get_mode(fd);
 
     // If this file descriptor is a non-file (e.g., a pipe, or socket, etc.) then we don't care about it
     if (is_non_file(mode))
     {
+        SettleFdAccess(fd, eventType, associatedPid);
         return sNotChecked; 
     }
 
     std::string fullpath = fd_to_path(fd, associatedPid);
 
     // Only reports when fd_to_path succeeded.
-    return fullpath.length() > 0
-        ? create_access_internal(syscallName, eventType, fullpath.c_str(), /* secondPath */ nullptr, report, mode, /* checkCache */ true, associatedPid)
-        : sNotChecked;
+    if (fullpath.length() == 0)
+    {
+        return sNotChecked;
+    }
+
+    if (IsUntrackedPseudoFileAccess(eventType, fullpath) || IsUntrackedAccess(eventType, fullpath, empty_str_) || IsCacheHit(eventType, fullpath, empty_str_))
+    {
+        // Untracked, or same access on the same path as before: as long as the descriptor keeps pointing to it, there is nothing else to do
+        SettleFdAccess(fd, eventType, associatedPid);
+        return sNotChecked;
+    }
+
+    AccessCheckResult check = create_access_internal(syscallName, eventType, fullpath.c_str(), /* secondPath */ nullptr, report, mode, /* checkCache */ false /* because already checked cache above */, associatedPid);
+
+    // readdir and friends are called once per directory entry, and every call would produce the exact same report. So one enumeration of a
+    // directory is reported on its first call only (unless it is denied, in which case every call must keep failing): the remaining ones
+    // go straight to the real function until the descriptor is closed. The same goes for the writes on a descriptor (e.g., a log or the
+    // output of a linker, written in tiny chunks): the first allowed write decides for all of them, and would be a cache hit afterwards.
+    if ((eventType == ES_EVENT_TYPE_NOTIFY_READDIR || eventType == ES_EVENT_TYPE_NOTIFY_WRITE) && associatedPid == 0 && !should_deny(check))
+    {
+        SettleFdAccess(fd, eventType, associatedPid);
+    }
+
+    return check;
+}
+
+void BxlObserver::SettleFdAccess(int fd, es_event_type_t eventType, pid_t associatedPid)
+{
+    uint8_t bit = GetSettledFdAccessBit(eventType);
+
+    // The ptrace sandbox looks at descriptors of other processes, and doesn't keep track of their lifetime
+    if (bit != 0 && associatedPid == 0 && fd >= 0 && fd < SETTLED_FD_ACCESSES_SIZE && fdTable_.IsEnabled())
+    {
+        settledFdAccesses_[fd].fetch_or(bit, std::memory_order_relaxed);
+    }
+}
+
+void BxlObserver::UnsettleFdAccesses(int fd)
+{
+    if (fd >= 0 && fd < SETTLED_FD_ACCESSES_SIZE)
+    {
+        settledFdAccesses_[fd].store(0, std::memory_order_relaxed);
+    }
 }
 
 bool BxlObserver::is_non_file(const mode_t mode)
@@ -745,6 +2331,17 @@ AccessCheckResult BxlObserver::create_access_at(const char *syscallName, es_even
     }
 
     snprintf(&fullpath[len], PATH_MAX - len, "/%s", pathname);
+
+    // The path of the directory is already resolved (the kernel hands it out that way), so when the rest of the path crosses
+    // no symlink, it only needs to be normalized. Only the interposer can ask: the descriptors of a tracee are not ours.
+    if (associatedPid == 0
+        && !IsUntrackedPseudoFileAccess(eventType, fullpath)
+        && path_crosses_no_symlinks(dirfd, pathname, (flags & O_NOFOLLOW) == 0))
+    {
+        resolve_path(fullpath, (flags & O_NOFOLLOW) == 0, associatedPid, /* symlinks */ nullptr, /* noSymlinks */ true);
+        return create_access_internal(syscallName, eventType, fullpath, /* secondPath */ nullptr, report, mode, /* checkCache */ true, associatedPid);
+    }
+
     return create_access(syscallName, eventType, fullpath, report, mode, flags, /* checkCache */ true, associatedPid);
 }
 
@@ -756,8 +2353,18 @@ void BxlObserver::report_access_at(const char *syscallName, es_event_type_t even
     SendReport(report);
 }
 
+// Key of the first write checks in the shared access cache, which no event type collides with
+static const uint32_t FirstAllowWriteCheckKey = 0x80000000u | (uint32_t)kOpFirstAllowWriteCheckInProcess;
+
 void BxlObserver::report_firstAllowWriteCheck(const char *fullPath)
 {
+    // The managed side only looks at the first of these reports for a path in the whole process tree, so once any process of
+    // the pip made it (whatever its executable) the others don't even need to look at the file
+    if (sharedAccessCache_.IsEnabled() && sharedAccessCache_.Check(FirstAllowWriteCheckKey, /* executable */ std::string_view(), fullPath, /* addEntryIfMissing */ true))
+    {
+        return;
+    }
+
     mode_t mode = get_mode(fullPath);
     bool fileExists = mode != 0 && !S_ISDIR(mode);
      
@@ -808,6 +2415,13 @@ bool BxlObserver::check_and_report_process_requires_ptrace(const char *path)
         return false;
     }
 
+    if (handedBackByTracer_)
+    {
+        // This process is still traced, and the tracer takes over when it execs something that can't be interposed.
+        // There is nothing to report, nor a new tracer to allow.
+        return IsPTraceForced(path) || CheckUnconditionallyEnableLinuxPTraceSandbox(pip_->GetFamExtraFlags()) || requires_ptrace(path);
+    }
+
     if (IsPTraceForced(path) || CheckUnconditionallyEnableLinuxPTraceSandbox(pip_->GetFamExtraFlags()))
     {
         // Allow this process to be traced by the tracer process.
@@ -836,37 +2450,7 @@ bool BxlObserver::check_and_report_process_requires_ptrace(const char *path)
         return true;
     }
 
-    // Stat the path to get the last modified time of the path
-    // We need to do this because the executable file could be changed in between this stat and the previous stat
-    // If it was changed (has a different modified time), then we should run the check on it once more
-    struct stat statbuf;
-#if (__GLIBC__ == 2 && __GLIBC_MINOR__ < 33)
-        real___lxstat(1, path, &statbuf);
-#else
-        real_lstat(path, &statbuf);
-#endif
-
-    std::string key = std::to_string(statbuf.st_mtim.tv_sec);
-    key.append(":");
-    key.append(path);
-
-    auto maybeProcess = std::find_if(
-        ptraceRequiredProcessCache_.begin(),
-        ptraceRequiredProcessCache_.end(),
-        [key](const std::pair<std::string, bool>& item) { return item.first == key; }
-    );
-
-    bool requiresPtrace;
-    if (maybeProcess != ptraceRequiredProcessCache_.end())
-    {
-        // Already checked this process
-        requiresPtrace = maybeProcess->second;
-    }
-    else
-    {
-        requiresPtrace = is_statically_linked(path) || contains_capabilities(path);
-        ptraceRequiredProcessCache_.push_back(std::make_pair(key, requiresPtrace));
-    }
+    bool requiresPtrace = requires_ptrace(path);
 
     if (requiresPtrace)
     {
@@ -889,29 +2473,188 @@ bool BxlObserver::check_and_report_process_requires_ptrace(const char *path)
             .shouldReport     = true,
         };
 
-        strlcpy(report.path, path, sizeof(report.path));
+        strlcpy(report.path, path, sizeof(report.path));
+
+        SendReport(report, /* isDebugMessage */ false, /* useSecondaryPipe */ true);
+    }
+
+    return requiresPtrace;
+}
+
+void BxlObserver::set_ptrace_permissions()
+{
+    // This should happen before sending a kOpProcessRequiresPtrace report to bxl because it will signal bxl to launch the tracer.
+    if (prctl(PR_SET_PTRACER, PR_SET_PTRACER_ANY) == -1)
+    {
+        std::cerr << "[BuildXL] Failed to allow ptrace for process " << getpid() << ": " << strerror(errno) << "\n";
+        // This process is going to fail anyways when the tracer fails to attach, so we should exit here with a bad exit code.
+        // Interposed exit here is used on purpose to inform bxl this process should be removed from its process table.
+        exit(-1);
+    }
+}
+
+// FNV-1a, never 0 since the lock-free sets don't take 0 as a key
+static uint64_t hash_ptrace_cache_key(const std::string &key)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (char c : key)
+    {
+        hash = (hash ^ (unsigned char)c) * 1099511628211ULL;
+    }
+
+    return hash == 0 ? 1 : hash;
+}
+
+bool BxlObserver::requires_ptrace(const char *path)
+{
+    // The executable could be changed in between checks, so the key captures its identity and last modification.
+    // If the key cannot be computed (e.g., the file does not exist) just run the check.
+    std::string key;
+    if (!get_ptrace_cache_key(path, key))
+    {
+        return is_statically_linked(path) || contains_capabilities(path);
+    }
+
+    // Already checked this process
+    uint64_t keyHash = hash_ptrace_cache_key(key);
+    if (ptraceRequiredExecutables_.Contains(keyHash))
+    {
+        return true;
+    }
+
+    if (ptraceNotRequiredExecutables_.Contains(keyHash))
+    {
+        return false;
+    }
+
+    bool requiresPtrace;
+    if (!try_get_persisted_ptrace_classification(key, requiresPtrace))
+    {
+        requiresPtrace = is_statically_linked(path) || contains_capabilities(path);
+        persist_ptrace_classification(key, requiresPtrace);
+    }
+
+    (requiresPtrace ? ptraceRequiredExecutables_ : ptraceNotRequiredExecutables_).Add(keyHash);
+
+    return requiresPtrace;
+}
+
+// The key is based on (device, inode, mtime, ctime) of the executable (following symlinks). The change time is included because
+// capabilities are stored in extended attributes, and setting those doesn't update the modification time.
+bool BxlObserver::get_ptrace_cache_key(const char *path, std::string &key)
+{
+    struct stat statbuf;
+#if (__GLIBC__ == 2 && __GLIBC_MINOR__ < 33)
+    if (real___xstat(1, path, &statbuf) != 0)
+#else
+    if (real_stat(path, &statbuf) != 0)
+#endif
+    {
+        return false;
+    }
+
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer), "%lu-%lu-%ld.%09ld-%ld.%09ld",
+        (unsigned long)statbuf.st_dev, (unsigned long)statbuf.st_ino,
+        (long)statbuf.st_mtim.tv_sec, (long)statbuf.st_mtim.tv_nsec,
+        (long)statbuf.st_ctim.tv_sec, (long)statbuf.st_ctim.tv_nsec);
+    key = buffer;
+
+    return true;
+}
+
+// Each persisted classification is a symlink named after the key whose target is either "1" (requires ptrace) or "0".
+// Creating a symlink is atomic and reading it back takes a single readlink, so processes racing to classify the
+// same executable never see a partially written entry.
+// CODESYNC: Public/Src/Engine/Dll/Engine.cs (the directory BuildXL keeps from build to build is named after the version of this format)
+bool BxlObserver::try_get_persisted_ptrace_classification(const std::string &key, bool &requiresPtrace)
+{
+    if (ptraceCacheDirectory_[0] == '\0')
+    {
+        return false;
+    }
+
+    std::string entryPath = std::string(ptraceCacheDirectory_) + "/" + key;
+    char value[2];
+    if (real_readlink(entryPath.c_str(), value, sizeof(value)) != 1 || (value[0] != '0' && value[0] != '1'))
+    {
+        return false;
+    }
 
-        SendReport(report, /* isDebugMessage */ false, /* useSecondaryPipe */ true);
+    requiresPtrace = value[0] == '1';
+    return true;
+}
+
+void BxlObserver::persist_ptrace_classification(const std::string &key, bool requiresPtrace)
+{
+    if (ptraceCacheDirectory_[0] == '\0')
+    {
+        return;
     }
 
-    return requiresPtrace;
+    // Best effort: failing to persist the classification just means other processes will compute it again
+    int savedErrno = errno;
+    real_mkdir(ptraceCacheDirectory_, 0777);
+    std::string entryPath = std::string(ptraceCacheDirectory_) + "/" + key;
+    real_symlink(requiresPtrace ? "1" : "0", entryPath.c_str());
+    errno = savedErrno;
 }
 
-void BxlObserver::set_ptrace_permissions()
+ElfLinkage BxlObserver::read_elf_linkage(const char *path, bool &isHostImage)
 {
-    // This should happen before sending a kOpProcessRequiresPtrace report to bxl because it will signal bxl to launch the tracer.
-    if (prctl(PR_SET_PTRACER, PR_SET_PTRACER_ANY) == -1)
+    ElfLinkage linkage = ElfLinkage::Unknown;
+    isHostImage = false;
+    int fd = real_open(path, O_RDONLY | O_CLOEXEC, 0);
+    if (fd == -1)
     {
-        std::cerr << "[BuildXL] Failed to allow ptrace for process " << getpid() << ": " << strerror(errno) << "\n";
-        // This process is going to fail anyways when the tracer fails to attach, so we should exit here with a bad exit code.
-        // Interposed exit here is used on purpose to inform bxl this process should be removed from its process table.
-        exit(-1);
+        return ElfLinkage::NotElf;
+    }
+
+    // A handle was opened for our own internal purposes. That could have reused a fd where we missed a close.
+    reset_fd_table_entry(fd);
+
+    struct stat statbuf;
+#if (__GLIBC__ == 2 && __GLIBC_MINOR__ < 33)
+    if (real___fxstat(1, fd, &statbuf) == 0 && S_ISREG(statbuf.st_mode))
+#else
+    if (real_fstat(fd, &statbuf) == 0 && S_ISREG(statbuf.st_mode))
+#endif
+    {
+        void *image = statbuf.st_size > 0
+            ? mmap(nullptr, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0)
+            : MAP_FAILED;
+        if (image != MAP_FAILED)
+        {
+            linkage = get_elf_linkage((const unsigned char *)image, statbuf.st_size);
+#if defined(__x86_64__)
+            isHostImage = linkage != ElfLinkage::NotElf
+                && (size_t)statbuf.st_size >= sizeof(Elf64_Ehdr)
+                && ((const unsigned char *)image)[EI_CLASS] == ELFCLASS64
+                && ((const Elf64_Ehdr *)image)->e_machine == EM_X86_64;
+#endif
+            munmap(image, statbuf.st_size);
+        }
+        else if (statbuf.st_size == 0)
+        {
+            linkage = ElfLinkage::NotElf;
+        }
     }
+
+    real_close(fd);
+    return linkage;
 }
 
-// Executes objdump against the provided path to determine whether the binary is statically linked.
+// Determines whether the binary is statically linked by inspecting its ELF headers. Falls back to objdump if the image can't be interpreted.
 bool BxlObserver::is_statically_linked(const char *path)
 {
+    // A file that can't be opened comes back as not an ELF image: objdump wouldn't be able to read it either
+    bool isHostImage;
+    ElfLinkage linkage = read_elf_linkage(path, isHostImage);
+    if (linkage != ElfLinkage::Unknown)
+    {
+        return linkage == ElfLinkage::Static;
+    }
+
     char *args[] = {"", "-p", (char *)path, NULL};
     std::string result = execute_and_pipe_stdout(path, "/usr/bin/objdump", args);
 
@@ -924,8 +2667,61 @@ bool BxlObserver::is_statically_linked(const char *path)
     return result.find(objDumpExeFound) != std::string::npos && result.find(objDumpOutput) == std::string::npos;
 }
 
+bool BxlObserver::is_interposable(const char *path, int scriptDepth)
+{
+    if (IsPTraceForced(path) || CheckUnconditionallyEnableLinuxPTraceSandbox(pip_->GetFamExtraFlags()))
+    {
+        return false;
+    }
+
+    int fd = real_open(path, O_RDONLY | O_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    reset_fd_table_entry(fd);
+    char header[PATH_MAX];
+    ssize_t headerLength = read(fd, header, sizeof(header) - 1);
+    real_close(fd);
+
+    if (headerLength > 2 && header[0] == '#' && header[1] == '!')
+    {
+        // The kernel runs the interpreter (which doesn't get to be a script itself)
+        if (scriptDepth > 0)
+        {
+            return false;
+        }
+
+        header[headerLength] = '\0';
+        char *interpreter = header + 2;
+        interpreter += strspn(interpreter, " \t");
+        interpreter[strcspn(interpreter, " \t\n")] = '\0';
+        return interpreter[0] == '/' && is_interposable(interpreter, scriptDepth + 1);
+    }
+
+    bool isHostImage;
+    return read_elf_linkage(path, isHostImage) == ElfLinkage::Dynamic && isHostImage && !contains_capabilities(path);
+}
+
+// Determines whether the binary has file capabilities by reading the security.capability extended attribute. Falls back to getcap on unexpected errors.
 bool BxlObserver::contains_capabilities(const char *path)
 {
+    int savedErrno = errno;
+    ssize_t size = getxattr(path, "security.capability", nullptr, 0);
+    int xattrErrno = errno;
+    errno = savedErrno;
+
+    if (size >= 0)
+    {
+        return size > 0;
+    }
+
+    if (xattrErrno == ENODATA || xattrErrno == ENOTSUP || xattrErrno == ENOENT)
+    {
+        return false;
+    }
+
     char *args[] = {"", (char *)path, NULL};
     std::string result = execute_and_pipe_stdout(path, "/usr/sbin/getcap", args);
 
@@ -984,7 +2780,11 @@ std::string BxlObserver::execute_and_pipe_stdout(const char *path, const char *p
 
 void BxlObserver::disable_fd_table()
 {
-    useFdTable_ = false;
+    fdTable_.Disable();
+    for (int fd = 0; fd < SETTLED_FD_ACCESSES_SIZE; fd++)
+    {
+        UnsettleFdAccesses(fd);
+    }
 }
 
 ssize_t BxlObserver::read_path_for_fd(int fd, char *buf, size_t bufsiz, pid_t associatedPid)
@@ -1005,49 +2805,66 @@ ssize_t BxlObserver::read_path_for_fd(int fd, char *buf, size_t bufsiz, pid_t as
 
 void BxlObserver::reset_fd_table_entry(int fd)
 {
-    if (fd >= 0 && fd < MAX_FD)
+    fdTable_.Reset(fd);
+    UnsettleFdAccesses(fd);
+
+    // Same for the access trace, which goes on in a new file
+    if (accessTrace_.Forget(fd))
+    {
+        StartAccessTrace();
+    }
+
+    // The traced process is closing (or reusing) one of our report descriptors: forget about it
+    // and let the next report open the FIFO again. The descriptor itself is not ours to close anymore.
+    if (fd >= 0)
     {
-        fdTable_[fd] = empty_str_;
+        int expected = fd;
+        if (!reportFd_.compare_exchange_strong(expected, -1))
+        {
+            expected = fd;
+            secondaryReportFd_.compare_exchange_strong(expected, -1);
+        }
     }
 }
 
 void BxlObserver::reset_fd_table()
 {
-    for (int i = 0; i < MAX_FD; i++)
+    fdTable_.Clear();
+    for (int fd = 0; fd < SETTLED_FD_ACCESSES_SIZE; fd++)
     {
-        fdTable_[i] = empty_str_;
+        UnsettleFdAccesses(fd);
     }
-}
 
-std::string BxlObserver::fd_to_path(int fd, pid_t associatedPid)
-{
-    char path[PATH_MAX] = {0};
+    // Report descriptors are reopened lazily the next time a report is sent
+    int fd = reportFd_.exchange(-1);
+    if (fd != -1)
+    {
+        real_close(fd);
+    }
 
-    // ignore if fd is out of range
-    if (fd < 0 || fd >= MAX_FD)
+    fd = secondaryReportFd_.exchange(-1);
+    if (fd != -1)
     {
-        read_path_for_fd(fd, path, PATH_MAX, associatedPid);
-        return path;
+        real_close(fd);
     }
+}
 
-    if (useFdTable_)
+std::string BxlObserver::fd_to_path(int fd, pid_t associatedPid)
+{
+    // check the file descriptor table
+    std::string cachedPath;
+    if (fdTable_.TryGet(fd, cachedPath))
     {
-        // check the file descriptor table
-        if (fdTable_[fd].length() > 0)
-        {
-            return fdTable_[fd];
-        }
+        return cachedPath;
     }
 
     // read from the filesystem and update the file descriptor table
+    char path[PATH_MAX] = {0};
     ssize_t result = read_path_for_fd(fd, path, PATH_MAX, associatedPid);
     if (result != -1)
     {
         // Only cache if read_path_for_fd succeeded.
-        if (useFdTable_)
-        {
-            fdTable_[fd] = path;
-        }
+        fdTable_.Set(fd, path);
     }
 
     return path;
@@ -1061,13 +2878,44 @@ void BxlObserver::report_intermediate_symlinks(const char *pathname, pid_t assoc
         return;
     }
 
+    ResolvedSymlinkChain chain;
+    resolve_symlink_chain(pathname, /* followFinalSymlink */ true, chain, associatedPid);
+    report_symlink_chain(chain, associatedPid);
+}
+
+bool BxlObserver::resolve_symlink_chain(const char *pathname, bool followFinalSymlink, ResolvedSymlinkChain &chain, pid_t associatedPid)
+{
+    chain.path.clear();
+    chain.symlinks.clear();
+
+    if (pathname == nullptr)
+    {
+        return false;
+    }
+
+    // Left as is, like normalize_path_at does
+    if (pathname[0] == '/' && IsUntrackedPseudoFile(pathname))
+    {
+        chain.path = pathname;
+        return true;
+    }
+
     // Make it into an absolute path
     char fullPath[PATH_MAX] = {0};
     // associatedPid is irrelevant as we're using AT_FDCWD
-    relative_to_absolute(pathname, AT_FDCWD, /* associatedPid */ 0, fullPath); 
+    relative_to_absolute(pathname, AT_FDCWD, /* associatedPid */ 0, fullPath);
+
+    resolve_path(fullPath, followFinalSymlink, associatedPid, &chain.symlinks);
+    chain.path = fullPath;
+    return true;
+}
 
-    // This will report all intermediate symlinks in the path
-    resolve_path(fullPath, /* followFinalSymlink */ true, associatedPid);
+void BxlObserver::report_symlink_chain(const ResolvedSymlinkChain &chain, pid_t associatedPid)
+{
+    for (const std::string &symlink : chain.symlinks)
+    {
+        report_access_internal("_readlink", ES_EVENT_TYPE_NOTIFY_READLINK, symlink.c_str(), /* secondPath */ (const char *)nullptr, /* mode */ 0, /* error */ 0, /* checkCache */ true, associatedPid);
+    }
 }
 
 std::string BxlObserver::normalize_path_at(int dirfd, const char *pathname, int oflags, pid_t associatedPid)
@@ -1083,6 +2931,12 @@ std::string BxlObserver::normalize_path_at(int dirfd, const char *pathname, int
         return fd_to_path(dirfd, associatedPid);
     }
 
+    // Dropped by its prefix anyway (see IsUntrackedPseudoFile), and still under the same untracked scope once resolved
+    if (pathname[0] == '/' && IsUntrackedPseudoFile(pathname))
+    {
+        return pathname;
+    }
+
     char fullPath[PATH_MAX] = {0};
     relative_to_absolute(pathname, dirfd, associatedPid, fullPath);    
 
@@ -1092,6 +2946,75 @@ std::string BxlObserver::normalize_path_at(int dirfd, const char *pathname, int
     return fullPath;
 }
 
+// A name of a single component that resolve_path would leave as is once its directory is resolved
+static bool is_plain_name(const char *name)
+{
+    return name[0] != '\0' && strcmp(name, ".") != 0 && strcmp(name, "..") != 0;
+}
+
+void BxlObserver::normalize_link_paths(int olddirfd, const char *oldpath, int newdirfd, const char *newpath, int flags, std::string &source, std::string &destination, pid_t associatedPid)
+{
+    // The destination is never followed, and the source only with AT_SYMLINK_FOLLOW
+    int sourceFlags = (flags & AT_SYMLINK_FOLLOW) ? 0 : O_NOFOLLOW;
+
+    if (oldpath == nullptr || newpath == nullptr
+        || (oldpath[0] == '\0' && (flags & AT_EMPTY_PATH))
+        || (oldpath[0] == '/' && IsUntrackedPseudoFile(oldpath))
+        || (newpath[0] == '/' && IsUntrackedPseudoFile(newpath)))
+    {
+        // An empty source with AT_EMPTY_PATH is the descriptor itself
+        source = oldpath != nullptr && oldpath[0] == '\0' ? fd_to_path(olddirfd, associatedPid) : normalize_path_at(olddirfd, oldpath, sourceFlags, associatedPid);
+        destination = normalize_path_at(newdirfd, newpath, O_NOFOLLOW, associatedPid);
+        return;
+    }
+
+    char sourcePath[PATH_MAX] = {0};
+    char destinationPath[PATH_MAX] = {0};
+    relative_to_absolute(oldpath, olddirfd, associatedPid, sourcePath);
+
+    size_t baseLength = strlen(sourcePath) - strlen(oldpath);
+    if (oldpath[0] != '/' && newpath[0] != '/' && olddirfd == newdirfd && baseLength + strlen(newpath) < PATH_MAX)
+    {
+        // Relative to the same directory: no need to ask for the current directory (or the path of the descriptor) again
+        memcpy(destinationPath, sourcePath, baseLength);
+        strcpy(destinationPath + baseLength, newpath);
+    }
+    else
+    {
+        relative_to_absolute(newpath, newdirfd, associatedPid, destinationPath);
+    }
+
+    char *sourceName = strrchr(sourcePath, '/');
+    char *destinationName = strrchr(destinationPath, '/');
+    size_t directoryLength = sourceName - sourcePath;
+    bool sameDirectory = sourceFlags == O_NOFOLLOW
+        && directoryLength > 0
+        && directoryLength == (size_t)(destinationName - destinationPath)
+        && memcmp(sourcePath, destinationPath, directoryLength) == 0
+        && is_plain_name(sourceName + 1)
+        && is_plain_name(destinationName + 1);
+
+    if (!sameDirectory)
+    {
+        resolve_path(sourcePath, /* followFinalSymlink */ sourceFlags == 0, associatedPid);
+        resolve_path(destinationPath, /* followFinalSymlink */ false, associatedPid);
+        source = sourcePath;
+        destination = destinationPath;
+        return;
+    }
+
+    // Neither final component is followed, so once their directory is resolved both paths are
+    char directory[PATH_MAX] = {0};
+    memcpy(directory, sourcePath, directoryLength);
+    resolve_path(directory, /* followFinalSymlink */ true, associatedPid);
+
+    // Resolving to the root leaves "/", which already ends with the separator
+    size_t resolvedLength = strlen(directory);
+    const char *separator = resolvedLength > 0 && directory[resolvedLength - 1] == '/' ? "" : "/";
+    source.assign(directory).append(separator).append(sourceName + 1);
+    destination.assign(directory).append(separator).append(destinationName + 1);
+}
+
 void BxlObserver::relative_to_absolute(const char *pathname, int dirfd, int associatedPid, char *fullpath)
 {
     size_t len = 0;
@@ -1143,7 +3066,7 @@ static char* find_prev_slash(char *pStr)
 }
 
 // resolve any intermediate directory symlinks
-void BxlObserver::resolve_path(char *fullpath, bool followFinalSymlink, pid_t associatedPid)
+void BxlObserver::resolve_path(char *fullpath, bool followFinalSymlink, pid_t associatedPid, std::vector<std::string> *symlinks, bool noSymlinks)
 {
     if (fullpath == nullptr || fullpath[0] != '/')
     {
@@ -1153,6 +3076,10 @@ void BxlObserver::resolve_path(char *fullpath, bool followFinalSymlink, pid_t as
 
     unordered_set<string> visited;
 
+    // Ask the kernel first whether any symlink is on the way, before the cache of intermediate directories is consulted or
+    // populated: when none is, only "/../", "/./" and "//" are left to handle, and no prefix of the path takes a readlink.
+    noSymlinks = noSymlinks || path_crosses_no_symlinks(AT_FDCWD, fullpath, followFinalSymlink);
+
     char readlinkBuf[PATH_MAX];
     char *pFullpath = fullpath + 1;
     while (true)
@@ -1190,10 +3117,17 @@ void BxlObserver::resolve_path(char *fullpath, bool followFinalSymlink, pid_t as
         // call readlink for intermediate dirs and the final path if followSymlink is true
         ssize_t nReadlinkBuf = -1;
         char ch = *pFullpath;
-        if (*pFullpath == '/' || (*pFullpath == '\0' && followFinalSymlink))
+        if (!noSymlinks && (*pFullpath == '/' || (*pFullpath == '\0' && followFinalSymlink)))
         {
             *pFullpath = '\0';
-            nReadlinkBuf = real_readlink(fullpath, readlinkBuf, PATH_MAX);
+            if (ch != '/')
+            {
+                InterposerStats::Increment(InterposerStats::ResolvePathReadlinks);
+            }
+
+            nReadlinkBuf = ch == '/'
+                ? readlink_intermediate_dir(fullpath, readlinkBuf, PATH_MAX)
+                : real_readlink(fullpath, readlinkBuf, PATH_MAX);
             *pFullpath = ch;
         }
 
@@ -1218,7 +3152,14 @@ void BxlObserver::resolve_path(char *fullpath, bool followFinalSymlink, pid_t as
         *pFullpath = '\0';
         // break if the same symlink has already been visited (breaks symlink loops)
         if (!visited.insert(fullpath).second) break;
-        report_access_internal("_readlink", ES_EVENT_TYPE_NOTIFY_READLINK, fullpath, /* secondPath */ (const char *)nullptr, /* mode */ 0, /* error */ 0, /* checkCache */ true, associatedPid);
+        if (symlinks != nullptr)
+        {
+            symlinks->emplace_back(fullpath);
+        }
+        else
+        {
+            report_access_internal("_readlink", ES_EVENT_TYPE_NOTIFY_READLINK, fullpath, /* secondPath */ (const char *)nullptr, /* mode */ 0, /* error */ 0, /* checkCache */ true, associatedPid);
+        }
         *pFullpath = ch;
 
         // append the rest of the original path to the readlink target
@@ -1240,94 +3181,343 @@ void BxlObserver::resolve_path(char *fullpath, bool followFinalSymlink, pid_t as
     }
 }
 
-char** BxlObserver::ensure_env_value_with_log(char *const envp[], char const *envName, char const *envValue)
+// Same as readlink, but the result is cached when the path turns out to be either a symlink or an existing non-symlink.
+// Only meant for intermediate directories of a path: these are rarely created or replaced during the lifetime of a process,
+// and we get a chance to invalidate the cache (see invalidate_resolved_path_cache) when this process does it.
+ssize_t BxlObserver::readlink_intermediate_dir(const char *path, char *buf, size_t bufsiz)
 {
-    char **newEnvp = ensure_env_value(envp, envName, envValue);
-    if (newEnvp != envp)
+    // This code could possibly be executing from an interrupt routine or from who knows where,
+    // so to avoid deadlocks it's essential to never block here indefinitely.
+    if (!useResolvedPathCache_ || disposed_ || !resolvedPathCacheMtx_.try_lock_for(chrono::milliseconds(1)))
     {
-        LOG_DEBUG("envp has been modified with %s added to %s", envValue, envName);
+        InterposerStats::Increment(InterposerStats::ResolvePathReadlinks);
+        return real_readlink(path, buf, bufsiz);
     }
 
-    return newEnvp;
+    // ============================== in the critical section ================================
+
+    // make sure the mutex is released by the end
+    shared_ptr<timed_mutex> sp(&resolvedPathCacheMtx_, [](timed_mutex *mtx) { mtx->unlock(); });
+
+    auto it = resolvedPathCache_.find(path);
+    if (it != resolvedPathCache_.end())
+    {
+        if (it->second.empty())
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        size_t length = std::min(it->second.length(), bufsiz);
+        memcpy(buf, it->second.data(), length);
+        return length;
+    }
+
+    InterposerStats::Increment(InterposerStats::ResolvePathReadlinks);
+    ssize_t result = real_readlink(path, buf, bufsiz);
+
+    // EINVAL means the path exists but it is not a symlink. Any other error (e.g., the path does not exist) is not cached.
+    if (result != -1 || errno == EINVAL)
+    {
+        int savedErrno = errno;
+        if (resolvedPathCache_.size() >= MAX_RESOLVED_PATH_CACHE_SIZE)
+        {
+            resolvedPathCache_.clear();
+        }
+
+        resolvedPathCache_.emplace(path, result == -1 ? std::string() : std::string(buf, result));
+        errno = savedErrno;
+    }
+
+    return result;
 }
 
-// Propagate the environment needed for sandbox initialization
-char** BxlObserver::ensureEnvs(char *const envp[])
+// Whether resolving the given absolute path (the final component only if followFinalSymlink is set) positively goes
+// through no symlink: openat2 with RESOLVE_NO_SYMLINKS fails with ELOOP when it would have to follow one. A path that
+// does not exist is still settled when its parent directory is, since there is no final component to follow then.
+// Any other failure (or a kernel without openat2) leaves the question open, and the caller has to walk the path.
+bool BxlObserver::path_crosses_no_symlinks(int dirfd, const char *path, bool followFinalSymlink)
 {
-    if (!IsMonitoringChildProcesses())
+    if (!openat2Supported_)
     {
-        char **newEnvp = remove_path_from_LDPRELOAD(envp, detoursLibFullPath_);
-        newEnvp = ensure_env_value(newEnvp, BxlEnvFamPath, "");
-        newEnvp = ensure_env_value(newEnvp, BxlEnvDetoursPath, "");
-        newEnvp = ensure_env_value(newEnvp, BxlEnvRootPid, "");
-        newEnvp = ensure_env_value(newEnvp, BxlPTraceForcedProcessNames, "");
-        return newEnvp;
+        return false;
     }
-    else
+
+    int savedErrno = errno;
+    struct open_how how;
+    memset(&how, 0, sizeof(how));
+    how.flags = O_PATH | O_CLOEXEC | (followFinalSymlink ? 0 : O_NOFOLLOW);
+    how.resolve = RESOLVE_NO_SYMLINKS;
+
+    int fd = syscall(__NR_openat2, dirfd, path, &how, sizeof(how));
+    if (fd == -1 && errno == ENOENT)
+    {
+        // A relative path of a single component is in the directory itself
+        const char *lastSlash = strrchr(path, '/');
+        size_t parentLength = lastSlash == nullptr ? 0 : lastSlash == path ? 1 : lastSlash - path;
+        if (parentLength < PATH_MAX)
+        {
+            char parent[PATH_MAX];
+            memcpy(parent, path, parentLength);
+            parent[parentLength] = '\0';
+            how.flags = O_PATH | O_CLOEXEC | O_DIRECTORY;
+            fd = syscall(__NR_openat2, dirfd, parentLength == 0 ? "." : parent, &how, sizeof(how));
+        }
+    }
+
+    if (fd == -1)
     {
-        char **newEnvp = ensure_paths_included_in_env(envp, LD_PRELOAD_ENV_VAR_PREFIX, detoursLibFullPath_, NULL);
-        if (newEnvp != envp)
+        if (errno == ENOSYS)
         {
-            LOG_DEBUG("envp has been modified with %s added to %s", detoursLibFullPath_, "LD_PRELOAD");
+            openat2Supported_ = false;
         }
 
-        newEnvp = ensure_env_value_with_log(newEnvp, BxlEnvFamPath, famPath_);
-        newEnvp = ensure_env_value_with_log(newEnvp, BxlEnvDetoursPath, detoursLibFullPath_);
-        newEnvp = ensure_env_value(newEnvp, BxlEnvRootPid, "");
-        newEnvp = ensure_env_value_with_log(newEnvp, BxlPTraceForcedProcessNames, forcedPTraceProcessNamesList_);
+        errno = savedErrno;
+        return false;
+    }
+
+    real_close(fd);
+    errno = savedErrno;
+    return true;
+}
+
+void BxlObserver::invalidate_resolved_path_cache()
+{
+    if (disposed_)
+    {
+        return;
+    }
+
+    // Unlike lookups, we can't afford to skip an invalidation. If the lock can't be acquired (e.g., it was
+    // held by another thread at the time this process was forked) stop using the cache altogether.
+    int savedErrno = errno;
+    if (!resolvedPathCacheMtx_.try_lock_for(chrono::milliseconds(100)))
+    {
+        disable_resolved_path_cache();
+        errno = savedErrno;
+        return;
+    }
+
+    resolvedPathCache_.clear();
+    resolvedPathCacheMtx_.unlock();
+    errno = savedErrno;
+}
+
+void BxlObserver::disable_resolved_path_cache()
+{
+    useResolvedPathCache_ = false;
+}
+
+void BxlObserver::invalidate_mount_dependent_caches()
+{
+    invalidate_resolved_path_cache();
+
+    // Unlike reset_fd_table, the report descriptors are kept: the FIFOs may not even be reachable from the new mount table
+    fdTable_.Clear();
+    for (int fd = 0; fd < SETTLED_FD_ACCESSES_SIZE; fd++)
+    {
+        UnsettleFdAccesses(fd);
+    }
+}
+
+void BxlObserver::refresh_mount_namespace()
+{
+    int savedErrno = errno;
+    uint64_t mountNamespace = ReadMountNamespace();
+    errno = savedErrno;
+
+    // A namespace that can't be read is assumed to be a new one (see ReadMountNamespace)
+    if (mountNamespace != 0 && mountNamespace == mountNamespace_.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    // Dedup entries are never removed, the ones from the previous namespace just stop matching
+    mountNamespace_.store(mountNamespace, std::memory_order_relaxed);
+    sharedAccessCache_.SetMountNamespace(mountNamespace);
+    invalidate_mount_dependent_caches();
+}
 
-        return newEnvp;
+// Propagate the environment needed for sandbox initialization.
+// This runs on every exec, so the environment is rewritten in a single pass that only materializes the entries that change.
+char** BxlObserver::ensureEnvs(char *const envp[])
+{
+    // The FAM descriptor value is copied into the new environment before the scope ends
+    ManifestReadScope manifestReadScope(manifestReaders_);
+    const std::string *famFdEnvValue = famFdEnvValue_.load(std::memory_order_acquire);
+    bool monitorChildren = IsMonitoringChildProcesses();
+    const char *names[] = { BxlEnvFamPath, BxlEnvDetoursPath, BxlEnvRootPid, BxlPTraceForcedProcessNames, BxlEnvFamFd, BxlPTraceInterposed };
+    const char *values[] =
+    {
+        monitorChildren ? famPath_ : "",
+        monitorChildren ? detoursLibFullPath_ : "",
+        "",
+        monitorChildren ? forcedPTraceProcessNamesList_ : "",
+        monitorChildren && famFdEnvValue != nullptr ? famFdEnvValue->c_str() : "",
+        "1",
+    };
+
+    // Processes handed back by the ptrace sandbox pass the marker on, since the tracer follows their children as well
+    size_t count = sizeof(names) / sizeof(names[0]) - (handedBackByTracer_ ? 0 : 1);
+
+    char **newEnvp = rewrite_env((const char *const *)envp, detoursLibFullPath_, monitorChildren, names, values, count);
+    if (newEnvp != envp)
+    {
+        LOG_DEBUG("envp has been modified to %s %s in LD_PRELOAD and to propagate %s=%s", monitorChildren ? "include" : "exclude", detoursLibFullPath_, BxlEnvFamPath, values[0]);
+    }
+
+    return newEnvp;
+}
+
+struct linux_dirent64
+{
+    ino64_t        d_ino;
+    off64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+};
+
+// Translates the type reported by getdents64 into file type bits (0 when the file system does not report it)
+static mode_t mode_from_dirent_type(unsigned char d_type)
+{
+    switch (d_type)
+    {
+        case DT_DIR:  return S_IFDIR;
+        case DT_REG:  return S_IFREG;
+        case DT_LNK:  return S_IFLNK;
+        case DT_FIFO: return S_IFIFO;
+        case DT_SOCK: return S_IFSOCK;
+        case DT_CHR:  return S_IFCHR;
+        case DT_BLK:  return S_IFBLK;
+        default:      return 0;
     }
 }
 
-bool BxlObserver::EnumerateDirectory(std::string rootDirectory, bool recursive, std::vector<std::string>& filesAndDirectories)
+bool BxlObserver::EnumerateDirectory(const std::string &rootDirectory, bool recursive, const std::function<bool(const std::string &, mode_t)> &onEntry)
 {
-    std::stack<std::string> directoriesToEnumerate;
-    DIR *dir;
-    struct dirent *ent;
+    // One frame per directory currently being walked. Subdirectories are entered as soon as they are found (depth first),
+    // so only the directories on the current path are open, and each one keeps the unconsumed part of its last getdents64 batch.
+    struct Frame
+    {
+        int fd;
+        size_t pathLength;
+        int position;
+        int length;
+        char buffer[8192];
+    };
+
+    std::vector<std::unique_ptr<Frame>> frames;
+    size_t depth = 0;
+    bool result = true;
+    std::string path(rootDirectory);
+
+    auto enter = [&](int dirfd, const char *name) -> int
+    {
+        int fd = real_openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC, 0);
+        if (fd == -1)
+        {
+            return -1;
+        }
+
+        // A handle was opened for our own internal purposes. That could have reused a fd where we missed a close.
+        reset_fd_table_entry(fd);
+
+        if (frames.size() == depth)
+        {
+            frames.emplace_back(new Frame());
+        }
 
-    filesAndDirectories.clear();
-    directoriesToEnumerate.push(rootDirectory);
-    filesAndDirectories.push_back(rootDirectory);
+        Frame *frame = frames[depth++].get();
+        frame->fd = fd;
+        frame->pathLength = path.length();
+        frame->position = 0;
+        frame->length = 0;
+        return fd;
+    };
 
-    while (!directoriesToEnumerate.empty())
+    if (!onEntry(path, S_IFDIR))
     {
-        auto currentDirectory = directoriesToEnumerate.top();
-        directoriesToEnumerate.pop();
+        return true;
+    }
 
-        dir = real_opendir(currentDirectory.c_str());
+    if (enter(AT_FDCWD, rootDirectory.c_str()) == -1)
+    {
+        LOG_DEBUG("[BxlObserver::EnumerateDirectory] open failed on '%s' with errno %d\n", rootDirectory.c_str(), errno);
+        return false;
+    }
 
-        if (dir != NULL)
+    while (depth > 0)
+    {
+        Frame *frame = frames[depth - 1].get();
+        if (frame->position >= frame->length)
         {
-            while ((ent = real_readdir(dir)) != NULL)
+            frame->length = syscall(SYS_getdents64, frame->fd, frame->buffer, sizeof(frame->buffer));
+            frame->position = 0;
+            if (frame->length <= 0)
             {
-                std::string fileOrDirectory(ent->d_name);
-                if (fileOrDirectory == "." || fileOrDirectory == "..")
+                if (frame->length < 0)
                 {
-                    continue;
+                    LOG_DEBUG("[BxlObserver::EnumerateDirectory] getdents64 failed on '%s' with errno %d\n", path.c_str(), errno);
+                    result = false;
                 }
 
-                std::string fullPath = currentDirectory + "/" + fileOrDirectory;
+                // Done with this directory: go back to its parent
+                real_close(frame->fd);
+                depth--;
 
-                // NOTE: d_type is supported on these filesystems as of 2022 which should cover all BuildXL cases: Btrfs, ext2, ext3, and ext4
-                if (ent->d_type == DT_DIR && recursive)
+                if (!result)
                 {
-                    // DT_DIR = Directory
-                    directoriesToEnumerate.push(fullPath);
+                    break;
                 }
 
-                filesAndDirectories.push_back(fullPath);
+                continue;
             }
+        }
 
-            real_closedir(dir);
+        struct linux_dirent64 *entry = (struct linux_dirent64 *)(frame->buffer + frame->position);
+        frame->position += entry->d_reclen;
+
+        const char *name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+        {
+            continue;
         }
-        else
+
+        path.resize(frame->pathLength);
+        path.push_back('/');
+        path.append(name);
+
+        // NOTE: d_type is supported on these filesystems as of 2022 which should cover all BuildXL cases: Btrfs, ext2, ext3, and ext4
+        // When it is not, the entry is stat-ed relative to the directory being walked, which spares the callers a stat of its full path.
+        mode_t mode = mode_from_dirent_type(entry->d_type);
+        if (mode == 0)
         {
-            // Something went wrong with opendir
-            LOG_DEBUG("[BxlObserver::EnumerateDirectory] opendir failed on '%s' with errno %d\n", currentDirectory, errno);
-            return false;
+            struct stat sb;
+            if (syscall(SYS_newfstatat, frame->fd, name, &sb, AT_SYMLINK_NOFOLLOW) == 0)
+            {
+                mode = sb.st_mode & S_IFMT;
+            }
+        }
+
+        if (!onEntry(path, mode))
+        {
+            break;
+        }
+
+        if (recursive && S_ISDIR(mode) && enter(frame->fd, name) == -1)
+        {
+            LOG_DEBUG("[BxlObserver::EnumerateDirectory] open failed on '%s' with errno %d\n", path.c_str(), errno);
+            result = false;
+            break;
         }
     }
 
-    return true;
+    // Release whatever is still open if the walk was stopped early
+    while (depth > 0)
+    {
+        real_close(frames[--depth]->fd);
+    }
+
+    return result;
 }
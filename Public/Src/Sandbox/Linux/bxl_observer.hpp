@@ -14,7 +14,9 @@
 #include <unistd.h>
 #include <limits.h>
 #include <semaphore.h>
+#include <spawn.h>
 #include <stddef.h>
+#include <sys/mount.h>
 #include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
@@ -24,10 +26,13 @@
 #include <sys/vfs.h>
 #include <utime.h>
 
+#include <atomic>
 #include <ostream>
 #include <sstream>
+#include <string_view>
 #include <chrono>
 #include <mutex>
+#include <condition_variable>
 #include <unordered_set>
 #include <unordered_map>
 #include <vector>
@@ -36,6 +41,13 @@
 #include "SandboxedPip.hpp"
 #include "utils.h"
 #include "common.h"
+#include "fd_table.hpp"
+#include "shared_access_cache.hpp"
+#include "interposer_stats.hpp"
+#include "observer_utilities.hpp"
+#include "LockFree.h"
+#include "debug_log.hpp"
+#include "access_trace.hpp"
 
 /*
  * This header is compiled into two different libraries: libDetours.so and libAudit.so.
@@ -76,6 +88,11 @@ extern const char *__progname;
 static const char LD_PRELOAD_ENV_VAR_PREFIX[] = "LD_PRELOAD=";
 
 static const char GLIBC_23[] = "GLIBC_2.3";
+static const char GLIBC_215[] = "GLIBC_2.15";
+
+// Mode to create an access with when the interposed call already found out that the path does not exist.
+// Unlike 0, it keeps the access from computing the mode of the path (i.e., from stat'ing the path once more).
+static const mode_t MODE_NONEXISTENT = (mode_t)-1;
 
 #define ARRAYSIZE(arr) (sizeof(arr)/sizeof(arr[0]))
 
@@ -86,6 +103,12 @@ static const char GLIBC_23[] = "GLIBC_2.3";
  * An exact version must be passed as an argument here or else dlvsym will return NULL (this means the latest version cannot be passed all the time).
  * 
  * To check what version of a libc function a binary is using, dump it with the following command: objdump -t </path/to/binary> | grep <function_name>
+ *
+ * The real_<name> members are resolved once per process, when the observer singleton is constructed from the library constructor
+ * (_bxl_linux_sandbox_init), so interposed functions call through them without any first-use check. Each lookup is a dlsym(RTLD_NEXT)
+ * of about 150ns, some 20us for all of them. Walking the dynamic symbol table of libc ourselves would not be equivalent: RTLD_NEXT
+ * finds the definition of the first object after this library in lookup order, which can be another preloaded library or (before
+ * glibc 2.34) the cancellation wrappers of libpthread, and it also takes care of symbol versions and IFUNC resolvers.
  */
 #ifdef ENABLE_INTERPOSING
     #define GEN_FN_DEF_REAL(ret, name, ...)                                         \
@@ -106,6 +129,9 @@ static const char GLIBC_23[] = "GLIBC_2.3";
     #define INTERPOSE_SOMETIMES(ret, name, short_circuit_check, ...) \
         DLL_EXPORT ret name(__VA_ARGS__) {                           \
             short_circuit_check                                      \
+            static const int __bxl_stats_function =                  \
+                InterposerStats::RegisterFunction(#name);            \
+            InterposerStats::Scope __bxl_stats_scope(__bxl_stats_function); \
             BxlObserver *bxl = BxlObserver::GetInstance();           \
             BXL_LOG_DEBUG(bxl, "Intercepted %s", #name);             \
             MAKE_BODY
@@ -125,6 +151,15 @@ static const char GLIBC_23[] = "GLIBC_2.3";
     #define INTERPOSE(ret, name, ...) IGNORE_BODY
 #endif
 
+// To be used at the beginning of the body of an interposed function that operates on a file descriptor and gets called very often
+// on the same descriptors (e.g., write or readdir). If the access is known to need no checks (see BxlObserver::IsFdAccessSettled),
+// this goes straight to the real function: no path lookup, no cache lookup and no report.
+#define RETURN_REAL_IF_FD_ACCESS_SETTLED(fd, eventType, name, ...)  \
+    if (bxl->IsFdAccessSettled(fd, eventType))                      \
+    {                                                               \
+        return bxl->real_##name(__VA_ARGS__);                       \
+    }
+
 // Linux libraries are required to set errno only when the operation fails. 
 // In most cases, when the operation succeeds errno is set to a random value
 // (or it does not get updated at all). Therefore, only report errno when   
@@ -177,6 +212,46 @@ static const char GLIBC_23[] = "GLIBC_2.3";
         return return_value;                                                    \
     }                                                                           \
 
+/**
+ * Binary layout of a report record sent over the FIFO.
+ *
+ * Every record is prefixed by a uint32 containing the length of the rest of the record (the header below plus
+ * the path bytes). The path is not null-terminated: its length is the record length minus the size of the header.
+ * Several records may be written back to back in a single (atomic) write to the FIFO.
+ *
+ * CODESYNC: Public/Src/Engine/Processes/SandboxConnectionLinuxDetours.cs
+ */
+typedef struct __attribute__((packed))
+{
+    int32_t  pid;
+    uint32_t requestedAccess;
+    uint32_t status;
+    uint32_t reportExplicitly;
+    uint32_t error;
+    uint32_t operation;
+    uint32_t isDirectory;
+} ReportRecordHeader;
+
+/**
+ * A report ready to be sent over the FIFO: the length prefix and the header of its record, and the path that follows them.
+ * The path is not copied, so the report it was prepared from must outlive the record. Records are sent with writev,
+ * one iovec for the header and one for the path.
+ */
+typedef struct
+{
+    char header[sizeof(uint32_t) + sizeof(ReportRecordHeader)];
+    const char *path;
+    size_t pathLength;
+    // Whether the report is accounted for by the message counting semaphore
+    bool counted;
+    // Whether the managed side needs to see the report right away (see SendRecords)
+    bool flushImmediately;
+    // Whether the report is a process lifetime report that was deferred (see BxlObserver::DeferLifecycleReports)
+    bool flushSoon;
+
+    size_t Size() const { return sizeof(header) + pathLength; }
+} ReportRecord;
+
 #define _fatal(fmt, ...) do { real_fprintf(stderr, "(%s) " fmt "\n", __func__, __VA_ARGS__); _exit(1); } while (0)
 #define fatal(msg) _fatal("%s", msg)
 
@@ -229,6 +304,17 @@ public:
     }
 };
 
+/**
+ * The outcome of one pass of symlink resolution over a path (see BxlObserver::resolve_symlink_chain): the resolved path,
+ * and every symlink crossed on the way to it, in the order they were crossed. Interposers that need both the access on the
+ * resolved path and the readlinks of the symlinks (e.g., realpath) report them from here instead of walking the path twice.
+ */
+typedef struct
+{
+    std::string path;
+    std::vector<std::string> symlinks;
+} ResolvedSymlinkChain;
+
 /**
  * Singleton class responsible for reporting accesses.
  *
@@ -246,48 +332,275 @@ private:
     BxlObserver& operator = (const BxlObserver&) = delete;
 
     volatile int disposed_;
+    bool handedBackByTracer_;
     int rootPid_;
     char progFullPath_[PATH_MAX];
     char detoursLibFullPath_[PATH_MAX];
     char famPath_[PATH_MAX];
+    // "<fd>:<dev>:<ino>" of the FAM descriptor this process keeps open for its children to inherit (see InitFam),
+    // or empty when the descriptor is not kept open. Never changed in place: a manifest update publishes a new string
+    // (see ApplyManifestUpdate), so ensureEnvs never sees a torn value.
+    std::atomic<const std::string *> famFdEnvValue_ { nullptr };
     char forcedPTraceProcessNamesList_[PATH_MAX];
     char secondaryReportPath_[PATH_MAX];
+    // The mapped FAM in use (see InitFam and ApplyManifestUpdate)
+    const char *famPayload_ = nullptr;
+    size_t famLength_ = 0;
+
+    // Accesses are recorded when BxlEnvAccessTraceDirectory is set, to a file of the process under that directory (see StartAccessTrace)
+    AccessTrace accessTrace_;
+    char accessTraceDirectory_[PATH_MAX];
+
+    // Dedup cache of (event, path) pairs that were already reported (see CheckCache).
+    // This is a fixed-size, insert-only, open addressing table. Entries are immutable once published
+    // (with a single compare-and-swap on the slot) and never removed, so lookups take no locks and do
+    // no heap allocations. When a path can't be placed within ACCESS_CACHE_MAX_PROBES slots it is
+    // simply not cached, which is always safe (it just means the access gets reported again).
+    // Pairs are scoped to the mount namespace they were reported from (see mountNamespace_), and to the generation of the
+    // last manifest update that changed a scope of the path (see ScopeGeneration).
+    struct AccessCacheEntry
+    {
+        uint64_t hash;
+        uint64_t mountNamespace;
+        uint64_t scopeGeneration;
+        es_event_type_t event;
+        size_t length;
+
+        // The path is stored right after the entry (see CheckCache)
+        const char *GetPath() const { return reinterpret_cast<const char *>(this + 1); }
+    };
+
+    static const size_t ACCESS_CACHE_SIZE = 16384; // must be a power of 2
+    static const size_t ACCESS_CACHE_MAX_PROBES = 32;
+    std::atomic<AccessCacheEntry *> accessCache_[ACCESS_CACHE_SIZE] = {};
 
-    std::timed_mutex cacheMtx_;
-    std::unordered_map<es_event_type_t, std::unordered_set<std::string>> cache_;
+    // Second level of the dedup cache, shared by all the processes of the pip when enabled (see InitSharedAccessCache)
+    SharedAccessCache sharedAccessCache_;
+
+    // Inode number of the mount namespace of this process (0 if it can't be determined). The same path string can
+    // name different files in different mount namespaces (e.g., when a pip runs in a container or an overlayfs
+    // sandbox), so dedup keys include it. Refreshed by unshare and setns (see refresh_mount_namespace).
+    std::atomic<uint64_t> mountNamespace_ { 0 };
 
-    // In a typical case, a process will not have more than 1024 open file descriptors at a time.
-    // File descriptors start at 3 (1 and 2 are reserved for stdout and stderr).
     // Whenever a new file descriptor is created, the smallest available positive integer is assigned to it. 
     // Whenever a file descriptor is closed, its value is returned to the pool and will be used for new ones.
-    // Setting the size of this table to 1024 should accommodate most of the common cases.
-    // File descriptors can be greater than 1024, and if that happens we just won't cache their paths.
-    static const int MAX_FD = 1024;
-    std::string fdTable_[MAX_FD];
+    // So descriptors are typically dense and low-numbered, but tools like linkers or JVMs may hold thousands of them open.
+    // The table is sparse (see FdTable), so only the ranges actually in use take space.
+    FdTable fdTable_;
+
+    // One byte per (low-numbered) descriptor, with a bit per kind of access (see GetSettledFdAccessBit) that is known to need no further checks
+    // on that descriptor: either the descriptor is a non-file, or the access on the path behind it is already in the cache. This is what lets
+    // frequent calls like write/fwrite/readdir go straight to the real function. Entries are invalidated along with the fd table.
+    static const int SETTLED_FD_ACCESSES_SIZE = 4096;
+    std::atomic<uint8_t> settledFdAccesses_[SETTLED_FD_ACCESSES_SIZE] = {};
+
+    static inline uint8_t GetSettledFdAccessBit(es_event_type_t eventType)
+    {
+        switch (eventType)
+        {
+            case ES_EVENT_TYPE_NOTIFY_WRITE:
+                return 0x1;
+            case ES_EVENT_TYPE_NOTIFY_OPEN:
+                return 0x2;
+            case ES_EVENT_TYPE_NOTIFY_READDIR:
+                return 0x4;
+            default:
+                return 0;
+        }
+    }
+
+    void SettleFdAccess(int fd, es_event_type_t eventType, pid_t associatedPid);
+    void UnsettleFdAccesses(int fd);
+
+    std::atomic<bool> statisticsSent_ { false };
+
+    // Number of the accesses the sampled observation mode left out, per parent directory (see IsSampledOut)
+    std::mutex sampledOutAccessesLock_;
+    std::unordered_map<std::string, uint64_t> sampledOutAccesses_;
+
+    // Whether the sampled observation mode leaves this report out, in which case it is counted in 'sampledOutAccesses_' instead
+    bool IsSampledOut(const AccessReport &report);
+
+    // Sends 'payload' as debug messages tagged with 'kind', split at ';' boundaries when it doesn't fit in one report
+    void SendDebugMessageChunks(const char *kind, const std::string &payload);
+
     const char* const empty_str_ = "";
-    bool useFdTable_ = true;
     bool sandboxLoggingEnabled_ = false;
 
+    // Shared object loads waiting for flush_audit_objopen
+    std::vector<std::string> pendingAuditObjopens_;
+
+    // Set for pips that only need their accesses observed, not enforced (see InitFam): accesses through already open
+    // descriptors were observed when the descriptors were opened, so the calls on them go straight to the real functions.
+    bool lightweightObservation_ = false;
+
+    // Set for pips whose batches of reports are written to the FIFO compressed (see CompressBatch)
+    bool compressReports_ = false;
+
+    // The topmost scopes of the manifest under which every access is allowed and none is reported (see SandboxedPip::GetUntrackedScopes),
+    // sorted. Accesses under them (e.g., /usr) skip the cache and the policy lookup altogether. Empty when every access must be reported.
+    // Replaced as a whole when the manifest is updated (see ApplyManifestUpdate); the replaced lists are released with the
+    // image they were derived from (see ReclaimManifestImages).
+    std::atomic<const std::vector<std::string> *> untrackedScopes_ { nullptr };
+
+    // The pseudo file systems whose paths are dropped by their prefix alone (see IsUntrackedPseudoFile): the ones whose
+    // root is an untracked scope, and anonymous files, which are never reported
+    std::atomic<unsigned int> untrackedPseudoFileSystems_ { PseudoFileSystemAnonymous };
+
+    // Manifest updates of long-running pips (see SyncManifest). The managed side replaces the FAM file, rewrites the list of
+    // changed scopes next to it and then bumps a generation counter, which every process of the pip maps from a file next to
+    // the FAM. manifestGeneration_ is the generation this process applied last.
+    struct ChangedScope
+    {
+        std::string scope;
+        uint64_t generation;
+    };
+    const std::atomic<uint64_t> *manifestGenerationImage_ = nullptr;
+    std::atomic<uint64_t> manifestGeneration_ { 0 };
+    std::mutex manifestUpdateMtx_;
+    // The descriptor of the mapped FAM that children inherit (see famFdEnvValue_), -1 if it is not kept open
+    int famFd_ = -1;
+    // Every scope changed by a manifest update so far, with the generation of its last change. Replaced as a whole on
+    // updates, like untrackedScopes_. Null until the first update.
+    std::atomic<const std::vector<ChangedScope> *> changedScopes_ { nullptr };
+
+    // What a manifest update replaced: the FAM mapping and everything derived from it. Released once no check can be
+    // using it anymore (see ReclaimManifestImages).
+    struct RetiredManifestImage
+    {
+        // The generation of the update that replaced the image
+        uint64_t generation;
+        const char *famPayload;
+        size_t famLength;
+        const std::vector<std::string> *untrackedScopes;
+        const std::vector<ChangedScope> *changedScopes;
+        const std::string *famFdEnvValue;
+    };
+    // Oldest first. Only touched under manifestUpdateMtx_.
+    std::vector<RetiredManifestImage> retiredManifestImages_;
+    // Checks currently using the manifest (see ManifestReadScope)
+    std::atomic<int> manifestReaders_ { 0 };
+
+    // Cache of readlink results for the intermediate directories visited by resolve_path. Keys are path prefixes;
+    // an empty value means the prefix is not a symlink, otherwise the value is the symlink target.
+    // Any operation in this process that can turn a directory into a symlink or change a symlink target
+    // (symlink, rename, unlink, rmdir) clears the cache (see invalidate_resolved_path_cache).
+    static const size_t MAX_RESOLVED_PATH_CACHE_SIZE = 4096;
+    std::timed_mutex resolvedPathCacheMtx_;
+    std::unordered_map<std::string, std::string> resolvedPathCache_;
+    bool useResolvedPathCache_ = true;
+
+    // Cleared once openat2 turns out not to be available (it was added in Linux 5.6), see path_crosses_no_symlinks
+    std::atomic<bool> openat2Supported_ { true };
+
     std::shared_ptr<SandboxedPip> pip_;
     std::shared_ptr<SandboxedProcess> process_;
     Sandbox *sandbox_;
 
-    // Cache for processes requiring ptrace in the form <timestamp>:<path>
-    std::vector<std::pair<std::string, bool>> ptraceRequiredProcessCache_;
+    // Cache for processes requiring ptrace, keyed by the identity of the executable file (see get_ptrace_cache_key).
+    // Classifications are also persisted under the pip's temp directory, so other processes in the pip
+    // can reuse them, or in a directory BuildXL keeps from build to build (see ptraceCacheDirectory_).
+    // The sets hold 64-bit hashes of the keys and are lock-free, so concurrent execs never wait on each other here;
+    // once a set is full, further classifications are only found in the persisted ones.
+    static const size_t PTRACE_CLASSIFICATION_CACHE_SIZE = 1 << 10;
+    LockFree::HashSet<PTRACE_CLASSIFICATION_CACHE_SIZE> ptraceRequiredExecutables_;
+    LockFree::HashSet<PTRACE_CLASSIFICATION_CACHE_SIZE> ptraceNotRequiredExecutables_;
+    char ptraceCacheDirectory_[PATH_MAX];
     std::vector<std::string> forcedPTraceProcessNames_;
 
     // Message counting
     sem_t *messageCountingSemaphore_ = nullptr;
     bool initializingSemaphore_ = false;
 
+    // Descriptors for the report FIFOs, opened lazily on the first report and kept open (with O_CLOEXEC) for the
+    // lifetime of the process. They are closed by reset_fd_table (e.g., on the child side of a fork) and forgotten
+    // whenever the traced process closes or reuses them (see reset_fd_table_entry), so the next report reopens them.
+    std::atomic<int> reportFd_ { -1 };
+    std::atomic<int> secondaryReportFd_ { -1 };
+
+    // Reports are accumulated in this buffer and sent to the FIFO in a single write (see SendReport and FlushReports).
+    // The buffer never grows beyond PIPE_BUF, so every flush is still atomic with respect to other writers.
+    std::timed_mutex reportBufferMtx_;
+    char reportBuffer_[PIPE_BUF];
+    size_t reportBufferLength_ = 0;
+    // Number of buffered reports that are accounted for by the message counting semaphore
+    int reportBufferCountedReports_ = 0;
+
+    // Full report buffers the FIFO had no room for, oldest first (see FlushReportBuffer). They go before anything else
+    // sent through the buffer, so threads only wait for the reader of the FIFO once the backlog is full, or when the
+    // reports must be sent right away. The message counting semaphore was already posted for their reports.
+    static const size_t ReportBacklogCapacity = 16;
+    struct ReportBacklogEntry
+    {
+        char buffer[PIPE_BUF];
+        size_t length;
+    };
+    ReportBacklogEntry reportBacklog_[ReportBacklogCapacity];
+    size_t reportBacklogHead_ = 0;
+    size_t reportBacklogCount_ = 0;
+
+    // Process lifetime reports are buffered rather than sent right away, and a background thread flushes the buffer
+    // whenever one is pending (see DeferLifecycleReports)
+    bool deferLifecycleReports_ = false;
+    std::mutex lifecycleReportsMtx_;
+    std::condition_variable lifecycleReportsCv_;
+    bool lifecycleReportsPending_ = false;
+
     void InitFam(pid_t pid);
+    int GetInheritedFamFd();
     void InitDetoursLibPath();
-    bool Send(const char *buf, size_t bufsiz, bool useSecondaryPipe, bool countReport);
-    bool IsCacheHit(es_event_type_t event, const string &path, const string &secondPath);
-    bool CheckCache(es_event_type_t event, const string &path, bool addEntryIfMissing);
-    char** ensure_env_value_with_log(char *const envp[], char const *envName, const char *envValue);
+    void InitPTraceCacheDirectory();
+    void InitSharedAccessCache();
+    void InitManifestUpdates();
+    bool GetFamSiblingPath(const char *extension, char (&path)[PATH_MAX]) const;
+    void SyncManifest();
+    void ApplyManifestUpdate();
+    const std::vector<ChangedScope>* ReadChangedScopes(uint64_t &generation) const;
+    const std::vector<std::string>* SetUntrackedScopes();
+    void ReclaimManifestImages();
+    uint64_t ScopeGeneration(std::string_view path) const;
+    void EnterPipCgroup();
+    uint64_t ReadMountNamespace();
+    void InitAccessTrace();
+    void StartAccessTrace();
+    // Report groups are batched (see SendReports) this many records at a time
+    static const size_t MaxRecordsPerBatch = 16;
+
+    // Returns false when mayDefer is set and the FIFO is full, in which case nothing was written (but the message counting
+    // semaphore was posted). Otherwise waits for the reader of the FIFO to make room whenever it is full.
+    bool Send(const struct iovec *iov, int iovcnt, bool useSecondaryPipe, int countedReports, bool mayDefer = false);
+    bool Send(const char *buf, size_t bufsiz, bool useSecondaryPipe, int countedReports, bool mayDefer = false)
+    {
+        struct iovec iov = { (void *)buf, bufsiz };
+        return Send(&iov, 1, useSecondaryPipe, countedReports, mayDefer);
+    }
+    // Compresses the batch a Send is about to write into a single frame (see ReportCompression), when enabled for the pip.
+    // Returns false if the batch is better sent as is (too small, incompressible, or this thread is already compressing one).
+    bool CompressBatch(const struct iovec *iov, int iovcnt, size_t bufsiz, struct iovec &frame);
+    void ReleaseFrame(const struct iovec *iov);
+    void PostCountedReports(int countedReports);
+    bool PrepareRecord(ReportRecord &record, const AccessReport &report, bool isDebugMessage);
+    void PrepareDebugRecord(ReportRecord &record, const DebugLog::Message &message);
+    // The sink of the debug log (see LogDebug)
+    static void SendDebugMessages(const DebugLog::Message *messages, size_t count);
+    bool SendRecords(const ReportRecord *records, size_t count, bool useSecondaryPipe);
+    bool WriteRecords(const ReportRecord *records, size_t count, bool useSecondaryPipe, bool sendReportBuffer);
+    bool FlushReportBuffer(bool mayDefer = false);
+    bool DrainReportBacklog(bool mayDefer);
+    bool LockReportBuffer();
+    int GetReportFd(bool useSecondaryPipe);
+    bool IsCacheHit(es_event_type_t event, std::string_view path, std::string_view secondPath);
+    bool IsUntrackedPath(std::string_view path) const;
+    bool IsUntrackedPseudoFile(std::string_view path) const;
+    bool IsUntrackedAccess(es_event_type_t event, std::string_view path, std::string_view secondPath) const;
+    bool CheckCache(es_event_type_t event, std::string_view path, bool addEntryIfMissing);
+    bool CheckLocalCache(es_event_type_t key, std::string_view path, bool addEntryIfMissing, uint64_t scopeGeneration);
     void report_access_internal(const char *syscallName, es_event_type_t eventType, const char *reportPath, const char *secondPath = nullptr, mode_t mode = 0, int error = 0, bool checkCache = true, pid_t associatedPid = 0);
     AccessCheckResult create_access_internal(const char *syscallName, es_event_type_t eventType, const char *reportPath, const char *secondPath, AccessReportGroup &reportGroup, mode_t mode = 0, bool checkCache = true, pid_t associatedPid = 0);
+    // The checks behind create_access_internal and create_access(IOEvent&), which record them when accesses are traced.
+    // 'mode' is updated with the one the access was checked with (MODE_NONEXISTENT if it turned out not to exist).
+    AccessCheckResult check_path_access(const char *syscallName, es_event_type_t eventType, const char *reportPath, const char *secondPath, AccessReportGroup &reportGroup, mode_t &mode, bool checkCache, pid_t associatedPid);
+    AccessCheckResult check_event_access(const char *syscallName, IOEvent &event, AccessReportGroup &reportGroup, bool checkCache);
     ssize_t read_path_for_fd(int fd, char *buf, size_t bufsiz, pid_t associatedPid = 0);
 
     bool IsMonitoringChildProcesses() const { return !pip_ || CheckMonitorChildProcesses(pip_->GetFamFlags()); }
@@ -328,16 +641,18 @@ private:
     }
 
     void relative_to_absolute(const char *pathname, int dirfd, int associatedPid, char *fullPath);
-    void resolve_path(char *fullpath, bool followFinalSymlink, pid_t associatedPid);
+    // The readlinks of the symlinks crossed are reported, unless 'symlinks' is given, in which case they are appended to it instead
+    // 'noSymlinks' tells the path is already known to cross no symlink (see path_crosses_no_symlinks), so it is only normalized
+    void resolve_path(char *fullpath, bool followFinalSymlink, pid_t associatedPid, std::vector<std::string> *symlinks = nullptr, bool noSymlinks = false);
+    ssize_t readlink_intermediate_dir(const char *path, char *buf, size_t bufsiz);
+    bool path_crosses_no_symlinks(int dirfd, const char *path, bool followFinalSymlink);
     
-    // Builds the report to be sent over the FIFO in the given buffer
-    inline int BuildReport(char* buffer, int maxMessageLength, const AccessReport &report, const char *path)
+    // Copies the given record in the buffer. Returns the size of the record.
+    inline size_t CopyRecord(char *buffer, const ReportRecord &record)
     {
-        // Note: when adding new fields, always leave 'path' as the last component of this message
-        // This is for the sake of the arithmetic when truncating debug messages, where this assumption is made (see SendReport). 
-        return snprintf(
-            buffer, maxMessageLength, "%s|%d|%d|%d|%d|%d|%d|%d|%s\n",
-            __progname, report.pid <= 0 ? getpid() : report.pid, report.requestedAccess, report.status, report.reportExplicitly, report.error, report.operation, report.isDirectory, path);
+        memcpy(buffer, record.header, sizeof(record.header));
+        memcpy(buffer + sizeof(record.header), record.path, record.pathLength);
+        return record.Size();
     }
 
     static BxlObserver *sInstance;
@@ -359,27 +674,55 @@ public:
 
     bool SendReport(const AccessReport &report, bool isDebugMessage = false, bool useSecondaryPipe = false);
     bool SendReport(const AccessReportGroup &report);
+    // Sends the reports of all the given groups, with as many records as possible in every write to the FIFO.
+    bool SendReports(const std::vector<AccessReportGroup> &reports);
     // Specialization for the exit report event. 
     // We may need to send an exit report on exit handlers after destructors
     // have been called. This method avoids accessing shared structures.
     bool SendExitReport(pid_t pid = 0);
+
+    // Sends the statistics of this process (see InterposerStats), if they are enabled. Only the first call sends anything.
+    void SendStatistics();
+    // Sends all the reports buffered so far. Must be called before anything that may prevent
+    // the buffer from being flushed later (e.g., exec, _exit, fork).
+    void FlushReports();
+    // Buffers process start and exit reports like any other report instead of sending them right away, and starts a
+    // thread that flushes the buffer as soon as one of them is in it. The ptrace runner uses this so the tracees it
+    // resumes don't wait for its pipe writes. Reports still reach the FIFO in the order they were made, since they
+    // all go through the same buffer.
+    void DeferLifecycleReports();
+    // Drops the buffered reports without sending them. Used on the child side of a fork, where
+    // the buffer is a copy of the one in the parent process.
+    void DiscardBufferedReports();
     char** ensureEnvs(char *const envp[]);
 
     const char* GetProgramPath() { return progFullPath_; }
+
+    // Sets this observer up to replay an access trace offline (see accesstracereplay.cpp): accesses are checked as if they were
+    // made by 'programPath', reports are written to 'reportFd' instead of the FIFOs of the pip, and nothing gets traced.
+    void PrepareReplay(const char *programPath, int reportFd);
     const char* GetReportsPath() { int len; return IsValid() ? pip_->GetReportsPath(&len) : NULL; }
     const char* GetSecondaryReportsPath() { return secondaryReportPath_; }
     const char* GetDetoursLibPath() { return detoursLibFullPath_; }
 
     void report_exec(const char *syscallName, const char *procName, const char *file, int error, mode_t mode = 0, pid_t associatedPid = 0);
-    void report_exec_args(pid_t pid);
-    void report_audit_objopen(const char *fullpath)
-    {
-        IOEvent event(ES_EVENT_TYPE_NOTIFY_OPEN, ES_ACTION_TYPE_NOTIFY, fullpath, progFullPath_, S_IFREG);
-        report_access("la_objopen", event, /* checkCache */ true);
-    }
+    // Reports the command line of this process, given the arguments it was executed with. Command lines that do not fit
+    // in a single record are chunked across several ones: every chunk but the last one is reported with E2BIG as its error.
+    void report_exec_args(pid_t pid, int argc, char **argv);
+    // Shared objects loaded by the dynamic linker (see audit.cpp) are not reported one by one: the loads that miss the cache
+    // are queued while the linker adds objects, and sent all at once (see SendReports) when the link map is consistent again.
+    // The dynamic linker calls both of these while holding its own lock, so the queue needs no synchronization of its own.
+    void report_audit_objopen(const char *fullpath);
+    void flush_audit_objopen();
 
     void report_intermediate_symlinks(const char *pathname, pid_t associatedPid);
 
+    // Resolves 'pathname' (relative to the current directory) in a single pass, without reporting anything. Returns false if the path is null.
+    // The access on the resolved path and the readlinks of the chain are then reported with report_access and report_symlink_chain.
+    bool resolve_symlink_chain(const char *pathname, bool followFinalSymlink, ResolvedSymlinkChain &chain, pid_t associatedPid = 0);
+    // Reports a readlink on every symlink of the chain
+    void report_symlink_chain(const ResolvedSymlinkChain &chain, pid_t associatedPid);
+
     // Removes detours path from LD_PRELOAD from the given environment and returns the modified environment
     inline char** RemoveLDPreloadFromEnv(char *const envp[])
     { 
@@ -392,7 +735,7 @@ public:
     // setting errno in the report and sending out the report.
     AccessCheckResult create_access(const char *syscallName, IOEvent &event, AccessReportGroup &report, bool checkCache = true);
     // In this method (and immediately below) 'mode' is provided on a best effort basis. If 0 is passed for mode, it will be
-    // explicitly computed
+    // explicitly computed (MODE_NONEXISTENT can be passed instead when the path is known not to exist)
     // NOTE: The associatedPid value for the create_access and report_access functions below take a default value of 0 because they are only set by the ptrace sandbox.
     //       If a value of 0 is set for associatedPid, then it is safe to assume that the report is from the interpose sandbox.
     AccessCheckResult create_access(const char *syscallName, es_event_type_t eventType, const char *pathname, AccessReportGroup &report, mode_t mode = 0, int oflags = 0, bool checkCache = true, pid_t associatedPid = 0);
@@ -404,21 +747,48 @@ public:
     void report_access(const char *syscallName, IOEvent &event, bool checkCache = true);
     void report_access(const char *syscallName, es_event_type_t eventType, const char *pathname, mode_t mode = 0, int oflags = 0, int error = 0, bool checkCache = true, pid_t associatedPid = 0);
     void report_access(const char *syscallName, es_event_type_t eventType, const char *reportPath, const char *secondPath, mode_t mode = 0, int error = 0, bool checkCache = true, pid_t associatedPid = 0);
+    // Reports an access on the path of a chain already resolved by resolve_symlink_chain
+    void report_access(const char *syscallName, es_event_type_t eventType, const ResolvedSymlinkChain &chain, pid_t associatedPid = 0);
     void report_access_fd(const char *syscallName, es_event_type_t eventType, int fd, int error, pid_t associatedPid = 0);
     void report_access_at(const char *syscallName, es_event_type_t eventType, int dirfd, const char *pathname, int oflags, bool getModeWithFd = true, pid_t associatedPid = 0, int error = 0);
 
     // Send a special message to managed code if the policy to override allowed writes based on file existence is set
-    // and the write is allowed by policy
+    // and the write is allowed by policy. With the shared access cache, only the first process of the pip to write the path does.
     void report_firstAllowWriteCheck(const char *fullPath);
 
     // Checks and reports when a process that requires ptrace is about to be executed
     bool check_and_report_process_requires_ptrace(const char *path);
     bool check_and_report_process_requires_ptrace(int fd);
     bool is_statically_linked(const char *path);
+    // Whether a process running 'path' can be handed back from the ptrace sandbox to this interposer (see PTraceSandbox::HandleExec):
+    // a dynamically linked image for the architecture of the tracer, without file capabilities (scripts are judged by their interpreter)
+    bool is_interposable(const char *path, int scriptDepth = 0);
     bool contains_capabilities(const char *path);
+    bool requires_ptrace(const char *path);
+    bool get_ptrace_cache_key(const char *path, std::string &key);
+    bool try_get_persisted_ptrace_classification(const std::string &key, bool &requiresPtrace);
+    void persist_ptrace_classification(const std::string &key, bool requiresPtrace);
     std::string execute_and_pipe_stdout(const char *path, const char *process, char *const args[]);
+    // Inspects the ELF image at 'path' ('isHostImage' tells whether it is a 64-bit image for the architecture this library was built for)
+    ElfLinkage read_elf_linkage(const char *path, bool &isHostImage);
     void set_ptrace_permissions();
 
+    // Whether the given kind of access on the given descriptor is known to need no checks nor reports, in which case
+    // interposed functions can go straight to the real one
+    inline bool IsFdAccessSettled(int fd, es_event_type_t eventType) const
+    {
+        if (lightweightObservation_)
+        {
+            return true;
+        }
+
+        uint8_t bit = GetSettledFdAccessBit(eventType);
+        return bit != 0 && fd >= 0 && fd < SETTLED_FD_ACCESSES_SIZE && (settledFdAccesses_[fd].load(std::memory_order_relaxed) & bit) != 0;
+    }
+
+    // Whether accesses through already open descriptors go unobserved (see lightweightObservation_)
+    inline bool IsLightweightObservation() const { return lightweightObservation_; }
+
     // Clears the specified entry on the file descriptor table
     void reset_fd_table_entry(int fd);
     
@@ -427,6 +797,20 @@ public:
 
     // Disables the FD table. Cannot be re-enabled for the remainder of the sandbox lifetime.
     void disable_fd_table();
+
+    // Clears the cache of resolved intermediate directories used by resolve_path
+    void invalidate_resolved_path_cache();
+
+    // Disables the cache of resolved intermediate directories. Cannot be re-enabled for the remainder of the sandbox lifetime.
+    void disable_resolved_path_cache();
+
+    // Drops the cached state that depends on the mount table: resolved intermediate directories and the paths of open descriptors.
+    // Called whenever this process changes its mount table (mount, umount) or moves to another mount namespace.
+    void invalidate_mount_dependent_caches();
+
+    // Reads the mount namespace of this process again (e.g., after unshare or setns) and, if it changed, rekeys the dedup caches
+    // and invalidates the mount dependent ones
+    void refresh_mount_namespace();
     
     // Returns the path associated with the given file descriptor
     // Note: This function assumes fd is a file descriptor pointing to a regular file (that is, a file, directory or symlink, not a pipe/socket/etc). The reason for this assumption is that file descriptors
@@ -436,17 +820,43 @@ public:
     
     std::string normalize_path_at(int dirfd, const char *pathname, int oflags = 0, pid_t associatedPid = 0);
 
+    // Normalizes both sides of a link/linkat in one go ('flags' are the ones of linkat). The directory names are relative to is
+    // looked up once when they share it, and the directory they're in is resolved once when it's the same (e.g., 'ln a b').
+    void normalize_link_paths(int olddirfd, const char *oldpath, int newdirfd, const char *newpath, int flags, std::string &source, std::string &destination, pid_t associatedPid = 0);
+
+    // Whether the access needs neither to be checked nor reported, as told by the prefix of its raw path alone (see
+    // get_pseudo_file_system): no path work, cache lookup or file system call is needed to drop it
+    bool IsUntrackedPseudoFileAccess(es_event_type_t event, std::string_view path) const;
+
     // Whether the given descriptor is a non-file (e.g., a pipe, or socket, etc.)
     static bool is_non_file(const mode_t mode);
 
     // Checks whether a given path is an anonymous file (a file that lives in RAM and only exists until all references to that file are dropped)
     bool is_anonymous_file(string path);
 
-    // Enumerates a specified directory
-    bool EnumerateDirectory(std::string rootDirectory, bool recursive, std::vector<std::string>& filesAndDirectories);
+    // Enumerates a specified directory (the directory itself included), calling 'onEntry' with the full path and the file type bits
+    // of each entry as it goes. The file type comes from the enumeration itself when the file system reports it, and from a stat relative
+    // to the enumerated directory otherwise (0 if the entry is gone by then). The walk stops when 'onEntry' returns false.
+    // Returns false if part of the tree could not be enumerated.
+    bool EnumerateDirectory(const std::string &rootDirectory, bool recursive, const std::function<bool(const std::string &, mode_t)> &onEntry);
 
     const char* getFamPath() const { return famPath_; };
 
+    // Whether the ptrace sandbox should be driven by seccomp user notifications (when the kernel supports it) instead of ptrace stops
+    bool IsSeccompNotifyEnabled() const { return pip_ && CheckEnableLinuxSeccompNotifySandbox(pip_->GetFamExtraFlags()); }
+
+    // Whether the ptrace sandbox tracer keeps its own table of the paths behind the fds of its tracees (see PTraceSandbox::FdToPath)
+    bool IsPTraceFdTableEnabled() const { return pip_ && CheckEnableLinuxPTraceFdTable(pip_->GetFamExtraFlags()); }
+
+    // Whether the ptrace sandbox hands dynamically linked tracees back to the interposer when they exec
+    bool IsPTraceHandBackEnabled() const { return pip_ && CheckEnableLinuxPTraceHandBack(pip_->GetFamExtraFlags()); }
+
+    // Whether only a sample of the allowed accesses that don't write is reported, for pips run only to profile their I/O (see IsSampledOut)
+    bool IsSampledObservationEnabled() const { return pip_ && CheckEnableLinuxSampledObservation(pip_->GetFamExtraFlags()); }
+
+    // Whether this process was handed back to the interposer by the ptrace sandbox, which keeps tracing it
+    bool IsHandedBackByTracer() const { return handedBackByTracer_; }
+
     inline bool LogDebugEnabled()
     {
         if (pip_ == NULL)
@@ -460,6 +870,7 @@ public:
     }
 
     void LogDebug(pid_t pid, const char *fmt, ...);
+    AccessReport CreateDebugMessageReport(pid_t pid);
 
     mode_t get_mode(const char *path)
     {
@@ -558,6 +969,9 @@ public:
     GEN_FN_DEF(int, execl, const char *, const char *, ...);
     GEN_FN_DEF(int, execlp, const char *, const char *, ...);
     GEN_FN_DEF(int, execle, const char *, const char *, ...);
+    // The older versions of posix_spawn and posix_spawnp try to run the file with /bin/sh when it is not an executable
+    GEN_FN_DEF_VERSIONED(GLIBC_215, int, posix_spawn, pid_t *, const char *, const posix_spawn_file_actions_t *, const posix_spawnattr_t *, char *const[], char *const[]);
+    GEN_FN_DEF_VERSIONED(GLIBC_215, int, posix_spawnp, pid_t *, const char *, const posix_spawn_file_actions_t *, const posix_spawnattr_t *, char *const[], char *const[]);
 #if (__GLIBC__ == 2 && __GLIBC_MINOR__ < 33)
     GEN_FN_DEF(int, __lxstat, int, const char *, struct stat *);
     GEN_FN_DEF(int, __lxstat64, int, const char*, struct stat64*);
@@ -647,6 +1061,11 @@ public:
     GEN_FN_DEF(ssize_t, sendfile64, int out_fd, int in_fd, off_t *offset, size_t count);
     GEN_FN_DEF(ssize_t, copy_file_range, int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags);
     GEN_FN_DEF(int, name_to_handle_at, int dirfd, const char *pathname, struct file_handle *handle, int *mount_id, int flags);
+    GEN_FN_DEF(int, unshare, int flags);
+    GEN_FN_DEF(int, setns, int fd, int nstype);
+    GEN_FN_DEF(int, mount, const char *source, const char *target, const char *filesystemtype, unsigned long mountflags, const void *data);
+    GEN_FN_DEF(int, umount, const char *target);
+    GEN_FN_DEF(int, umount2, const char *target, int flags);
     GEN_FN_DEF(int, dup, int oldfd);
     GEN_FN_DEF(int, dup2, int oldfd, int newfd);
     GEN_FN_DEF(int, dup3, int oldfd, int newfd, int flags);
@@ -8,9 +8,18 @@
 #define BxlEnvFamPath "__BUILDXL_FAM_PATH"
 #define BxlEnvRootPid "__BUILDXL_ROOT_PID"
 #define BxlEnvDetoursPath "__BUILDXL_DETOURS_PATH"
+#define BxlEnvFamFd "__BUILDXL_FAM_FD"
 #define BxlPTraceRunnerPath "__BUILDXL_PTRACE_RUNNER_PATH"
 #define BxlPTraceForcedProcessNames "__BUILDXL_PTRACE_FORCED_PROCESSES"
 #define BxlPTraceTracedPid "__BUILDXL_TRACED_PID"
 #define BxlPTraceTracedPath "__BUILDXL_TRACED_PATH"
+#define BxlEnvCgroupPath "__BUILDXL_CGROUP_PATH"
+#define BxlEnvPTraceClassificationDirectory "__BUILDXL_PTRACE_CLASSIFICATION_DIRECTORY"
+
+// Not set by BuildXL: set by the ptrace runner for the processes it hands back to the interposer (see PTraceSandbox::HandleExec)
+#define BxlPTraceInterposed "__BUILDXL_PTRACE_INTERPOSED"
+
+// Not set by BuildXL: added to the environment of a pip to record the accesses of its processes (see access_trace.hpp)
+#define BxlEnvAccessTraceDirectory "__BUILDXL_ACCESS_TRACE_DIRECTORY"
 
 #endif //COMMON_H
@@ -0,0 +1,190 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "debug_log.hpp"
+
+std::atomic<DebugLog::Ring *> DebugLog::s_rings { nullptr };
+
+// The library is loaded at startup (LD_PRELOAD), so its TLS can live in the static TLS block
+static thread_local void *t_ring __attribute__((tls_model("initial-exec"))) = nullptr;
+
+// Every message is preceded by this header in the ring, and takes a multiple of 8 bytes
+typedef struct
+{
+    uint32_t length;
+    int32_t pid;
+} EntryHeader;
+
+// Marks that the end of the ring was skipped because the next message might not have fit there
+static const uint32_t WRAP_MARKER = UINT32_MAX;
+
+static constexpr size_t EntrySize(size_t length)
+{
+    return (sizeof(EntryHeader) + length + 7) & ~(size_t)7;
+}
+
+// What a message is formatted into before its length is known (vsnprintf also writes the terminating 0)
+static constexpr size_t MAX_ENTRY_SIZE = EntrySize(DebugLog::MAX_MESSAGE_LENGTH + 1);
+
+static_assert(DebugLog::RING_SIZE % 8 == 0 && DebugLog::RING_SIZE >= 2 * MAX_ENTRY_SIZE, "A ring must hold a couple of messages of any length");
+
+DebugLog::Ring *DebugLog::GetRing()
+{
+    Ring *ring = static_cast<Ring *>(t_ring);
+    if (ring != nullptr)
+    {
+        return ring;
+    }
+
+    // This code could possibly be executing from an interrupt routine or from who knows where,
+    // so do not fail if we can't allocate: the messages of this thread are just dropped.
+    ring = static_cast<Ring *>(calloc(1, sizeof(Ring)));
+    if (ring == nullptr)
+    {
+        return nullptr;
+    }
+
+    // Rings are never released: the messages of threads that are gone are still to be flushed
+    Ring *head = s_rings.load(std::memory_order_relaxed);
+    do
+    {
+        ring->next = head;
+    } while (!s_rings.compare_exchange_weak(head, ring, std::memory_order_release, std::memory_order_relaxed));
+
+    t_ring = ring;
+    return ring;
+}
+
+// Finds room for a message of any length at 'position', writing a wrap marker if that means skipping the end of the ring
+bool DebugLog::Reserve(Ring *ring, uint64_t &position)
+{
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    uint64_t tail = ring->tail.load(std::memory_order_acquire);
+
+    size_t offset = head % RING_SIZE;
+    size_t untilEnd = RING_SIZE - offset;
+    bool wrap = untilEnd < MAX_ENTRY_SIZE;
+    if (RING_SIZE - (head - tail) < (wrap ? untilEnd : 0) + MAX_ENTRY_SIZE)
+    {
+        return false;
+    }
+
+    if (wrap)
+    {
+        // Entries are 8-byte aligned, so there is always room for a header before the end
+        reinterpret_cast<EntryHeader *>(&ring->data[offset])->length = WRAP_MARKER;
+        head += untilEnd;
+    }
+
+    position = head;
+    return true;
+}
+
+bool DebugLog::Append(pid_t pid, Sink sink, const char *fmt, va_list args)
+{
+    Ring *ring = GetRing();
+    if (ring == nullptr)
+    {
+        return false;
+    }
+
+    uint64_t position;
+    if (!Reserve(ring, position))
+    {
+        FlushRing(ring, sink);
+        if (!Reserve(ring, position))
+        {
+            ring->dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    }
+
+    EntryHeader *header = reinterpret_cast<EntryHeader *>(&ring->data[position % RING_SIZE]);
+    int length = vsnprintf(reinterpret_cast<char *>(header + 1), MAX_MESSAGE_LENGTH + 1, fmt, args);
+    if (length < 0)
+    {
+        // Nothing to log, but a wrap marker may have been written already: publish it
+        ring->head.store(position, std::memory_order_release);
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    header->length = (uint32_t)((size_t)length > MAX_MESSAGE_LENGTH ? MAX_MESSAGE_LENGTH : length);
+    header->pid = pid;
+    ring->head.store(position + EntrySize(header->length), std::memory_order_release);
+    return true;
+}
+
+void DebugLog::FlushRing(Ring *ring, Sink sink)
+{
+    bool expected = false;
+    if (!ring->flushing.compare_exchange_strong(expected, true, std::memory_order_acquire, std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    Message batch[FLUSH_BATCH_SIZE];
+    size_t count = 0;
+
+    char droppedMessage[80];
+    uint64_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0)
+    {
+        int length = snprintf(droppedMessage, sizeof(droppedMessage), "[DebugLog] %llu debug messages were dropped", (unsigned long long)dropped);
+        batch[count++] = { getpid(), droppedMessage, (size_t)length };
+    }
+
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    while (tail < head)
+    {
+        const EntryHeader *header = reinterpret_cast<const EntryHeader *>(&ring->data[tail % RING_SIZE]);
+        if (header->length == WRAP_MARKER)
+        {
+            tail += RING_SIZE - tail % RING_SIZE;
+            continue;
+        }
+
+        batch[count++] = { header->pid, reinterpret_cast<const char *>(header + 1), header->length };
+        tail += EntrySize(header->length);
+
+        if (count == FLUSH_BATCH_SIZE)
+        {
+            sink(batch, count);
+            count = 0;
+            // The space of the messages handed to the sink can only be reused once it returns
+            ring->tail.store(tail, std::memory_order_release);
+        }
+    }
+
+    if (count > 0)
+    {
+        sink(batch, count);
+    }
+
+    ring->tail.store(tail, std::memory_order_release);
+    ring->flushing.store(false, std::memory_order_release);
+}
+
+void DebugLog::Flush(Sink sink)
+{
+    for (Ring *ring = s_rings.load(std::memory_order_acquire); ring != nullptr; ring = ring->next)
+    {
+        FlushRing(ring, sink);
+    }
+}
+
+void DebugLog::Discard()
+{
+    // Only one thread survives a fork, so a ring can't be appended to while this runs (and some other thread
+    // may have been flushing it in the parent at the time of the fork)
+    for (Ring *ring = s_rings.load(std::memory_order_acquire); ring != nullptr; ring = ring->next)
+    {
+        ring->tail.store(ring->head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        ring->dropped.store(0, std::memory_order_relaxed);
+        ring->flushing.store(false, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,75 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <limits.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <atomic>
+
+/**
+ * Per-thread rings holding the debug messages of the interposer (see BxlObserver::LogDebug) until they are sent, so that
+ * logging a message only takes formatting it into memory owned by the calling thread: no lock, no report and no write.
+ *
+ * Each thread appends to its own ring (allocated the first time the thread logs anything). Rings are linked in a global
+ * list, so Flush can hand the pending messages of all of them to a sink in bulk, e.g., before the process forks, execs or
+ * exits. A thread whose ring is full flushes it first; a message that still doesn't fit is dropped, and the number of
+ * dropped messages is sent along with the next flush of that ring.
+ */
+class DebugLog final
+{
+public:
+    // Messages are truncated to this length, which leaves room for the header of the report carrying them
+    static const size_t MAX_MESSAGE_LENGTH = PIPE_BUF - 64;
+
+    // Size of the ring of every thread
+    static const size_t RING_SIZE = 32 * 1024;
+
+    // Messages are handed to the sink this many at a time
+    static const size_t FLUSH_BATCH_SIZE = 16;
+
+    typedef struct
+    {
+        pid_t pid;
+        // Not 0-terminated, and only valid until the sink returns
+        const char *text;
+        size_t length;
+    } Message;
+
+    // Receives the flushed messages of a ring, in the order they were logged
+    typedef void (*Sink)(const Message *messages, size_t count);
+
+    DebugLog() = delete;
+
+    // Formats the message into the ring of the calling thread, flushing the ring into 'sink' first if it is full.
+    // Returns false if the message was dropped.
+    static bool Append(pid_t pid, Sink sink, const char *fmt, va_list args);
+
+    // Hands the pending messages of all threads to 'sink'. Rings being flushed by some other thread at the same time are skipped.
+    static void Flush(Sink sink);
+
+    // Forgets about the pending messages of all threads (e.g., on the child side of a fork, where they were sent by the parent)
+    static void Discard();
+
+private:
+    struct Ring
+    {
+        // Positions grow monotonically (their offset in 'data' is the position modulo RING_SIZE). Only the owning thread
+        // writes 'head', and only the thread that holds 'flushing' writes 'tail'.
+        std::atomic<uint64_t> head;
+        std::atomic<uint64_t> tail;
+        std::atomic<bool> flushing;
+        std::atomic<uint64_t> dropped;
+        Ring *next;
+        alignas(8) char data[RING_SIZE];
+    };
+
+    static std::atomic<Ring *> s_rings;
+
+    static Ring *GetRing();
+    static bool Reserve(Ring *ring, uint64_t &position);
+    static void FlushRing(Ring *ring, Sink sink);
+};
@@ -22,6 +22,9 @@
 #include <sys/sysmacros.h>
 #include <sys/fcntl.h>
 #include <sys/xattr.h>
+#include <linux/io_uring.h>
+
+#include <atomic>
 
 #include "bxl_observer.hpp"
 #include "observer_utilities.hpp"
@@ -37,6 +40,38 @@ static int get_errno_from_result(result_t<int> result)
     return result.get() == -1 ? result.get_errno() : 0;
 }
 
+// Returns the mode to report a stat-like call on a path with, out of the result of the call itself, so that the report
+// doesn't have to stat the path once more. 'callFollows' tells whether the call followed a trailing symlink, 'reportFollows'
+// whether the report does (i.e., whether the report is not created with O_NOFOLLOW). When the two differ and the call can't
+// tell what the reported path is, 0 is returned so that the report computes the mode itself.
+template <typename TStat>
+static mode_t get_mode_from_stat_result(result_t<int> &result, const TStat *buf, bool callFollows, bool reportFollows)
+{
+    if (result.get() == 0)
+    {
+        mode_t mode = buf->st_mode;
+        if (callFollows == reportFollows
+            // The reported path is the symlink itself, but a symlink to a file is reported the same as a file
+            || (callFollows && S_ISREG(mode))
+            // The call found the path is not a symlink, so following it leads to the same path
+            || (!callFollows && !S_ISLNK(mode)))
+        {
+            return mode;
+        }
+
+        return 0;
+    }
+
+    int error = result.get_errno();
+    if (error != ENOENT && error != ENOTDIR)
+    {
+        return 0;
+    }
+
+    // A call following a trailing symlink fails on a dangling symlink, which does exist when the report doesn't follow it
+    return callFollows && !reportFollows ? 0 : MODE_NONEXISTENT;
+}
+
 INTERPOSE(int, statx, int dirfd, const char * pathname, int flags, unsigned int mask, struct statx * statxbuf)({
     AccessReportGroup report;
     auto check = bxl->create_access_at(__func__, ES_EVENT_TYPE_NOTIFY_STAT, dirfd, pathname, report);
@@ -86,6 +121,7 @@ INTERPOSE(int, scandirat64, int dirfd, const char * dirp,
 
 INTERPOSE(struct dirent *, readdir, DIR *dirp)
 ({
+    RETURN_REAL_IF_FD_ACCESS_SETTLED(dirfd(dirp), ES_EVENT_TYPE_NOTIFY_READDIR, readdir, dirp);
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_READDIR, dirfd(dirp), report);
     return bxl->check_fwd_and_report_readdir(report, check, (struct dirent *)NULL, dirp);
@@ -93,6 +129,7 @@ INTERPOSE(struct dirent *, readdir, DIR *dirp)
 
 INTERPOSE(struct dirent64 *, readdir64, DIR *dirp)
 ({
+    RETURN_REAL_IF_FD_ACCESS_SETTLED(dirfd(dirp), ES_EVENT_TYPE_NOTIFY_READDIR, readdir64, dirp);
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_READDIR, dirfd(dirp), report);
     return bxl->check_fwd_and_report_readdir64(report, check, (struct dirent64 *)NULL, dirp);
@@ -100,6 +137,7 @@ INTERPOSE(struct dirent64 *, readdir64, DIR *dirp)
 
 INTERPOSE(int, readdir_r, DIR *dirp, struct dirent *entry, struct dirent **result)
 ({
+    RETURN_REAL_IF_FD_ACCESS_SETTLED(dirfd(dirp), ES_EVENT_TYPE_NOTIFY_READDIR, readdir_r, dirp, entry, result);
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_READDIR, dirfd(dirp), report);
     return bxl->check_fwd_and_report_readdir_r(report, check, ERROR_RETURN_VALUE, dirp, entry, result);
@@ -107,6 +145,7 @@ INTERPOSE(int, readdir_r, DIR *dirp, struct dirent *entry, struct dirent **resul
 
 INTERPOSE(int, readdir64_r, DIR *dirp, struct dirent64 *entry, struct dirent64 **result)
 ({
+    RETURN_REAL_IF_FD_ACCESS_SETTLED(dirfd(dirp), ES_EVENT_TYPE_NOTIFY_READDIR, readdir64_r, dirp, entry, result);
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_READDIR, dirfd(dirp), report);
     return bxl->check_fwd_and_report_readdir64_r(report, check, ERROR_RETURN_VALUE, dirp, entry, result);
@@ -115,13 +154,17 @@ INTERPOSE(int, readdir64_r, DIR *dirp, struct dirent64 *entry, struct dirent64 *
 INTERPOSE(void, _exit, int status)({
     char emptystr[1] = {'\0'};
     bxl->report_access("_exit", ES_EVENT_TYPE_NOTIFY_EXIT, emptystr, emptystr);
+    // _exit does not run exit handlers or destructors, so this is the last chance to send buffered reports
+    bxl->SendStatistics();
+    bxl->FlushReports();
     bxl->real__exit(status);
     _exit(status);
 })
 
-static void report_child_process(const char *syscall, BxlObserver *bxl, pid_t childPid, pid_t parentPid)
+// The child is reported with the executable of the current process, unless it is already known to run some other one
+static void report_child_process(const char *syscall, BxlObserver *bxl, pid_t childPid, pid_t parentPid, const char *childExePath = nullptr)
 {
-    string exePath(bxl->GetProgramPath());
+    string exePath(childExePath != nullptr ? childExePath : bxl->GetProgramPath());
     // Events of type ES_EVENT_TYPE_NOTIFY_FORK are expected to contain the spawned child process id in its cpid field (the parent pid 
     // is actually ignored and not sent as part of the report, we pass it here for consistency only).
     IOEvent event(parentPid, childPid, 0, ES_EVENT_TYPE_NOTIFY_FORK, ES_ACTION_TYPE_NOTIFY, exePath, std::string(""), exePath, 0, false);
@@ -144,6 +187,8 @@ static void HandleForkOrCloneReporting(const char *syscall, BxlObserver *bxl, pi
         // Clear the file descriptor table when we are in the child process
         // File descriptors are unique to a process, so this cache needs to be invalidated on the child
         bxl->reset_fd_table();
+        // Reports buffered by the parent were already sent by the parent
+        bxl->DiscardBufferedReports();
         report_child_process(syscall, bxl, getpid(), getppid());
     }
     else
@@ -161,6 +206,8 @@ static int ret_fd(int fd, BxlObserver *bxl)
 }
 
 INTERPOSE(pid_t, fork, void)({
+    // Send buffered reports before forking, so they are not duplicated (or lost) on the child side
+    bxl->FlushReports();
     result_t<pid_t> childPid = bxl->fwd_fork();
 
     HandleForkOrCloneReporting(__func__, bxl, childPid.get());
@@ -175,6 +222,9 @@ INTERPOSE(pid_t, vfork, void)({
     // including returning from the interpose callback.
     // On the other hand, vfork is almost obsolete at this point and has been removed from the POSIX.1-2008 already.
     // Modern Linux distributions should be able to call fork directly with none or minimal perf differences. 
+    // Launchers that do depend on vfork semantics for speed use posix_spawn, which keeps them (see handle_spawn).
+    // Send buffered reports before forking, so they are not duplicated (or lost) on the child side
+    bxl->FlushReports();
     result_t<pid_t> childPid = bxl->fwd_fork();
 
     HandleForkOrCloneReporting(__func__, bxl, childPid.get());
@@ -182,6 +232,66 @@ INTERPOSE(pid_t, vfork, void)({
     return childPid.restore();
 })
 
+/**
+ * posix_spawn creates the child with CLONE_VM|CLONE_VFORK, and the child only applies the file actions and attributes before it
+ * execs. The parent is suspended until then, and nothing the child does goes through interposed functions. So everything is done
+ * in the parent instead of between the fork and the exec: the environment of the child is rewritten once, before the spawn (so
+ * the child is sandboxed as well), and once the spawn returned the new process is reported along with the executable it runs, in
+ * a single report for both the fork and the exec. The child reports its own start when the sandbox initializes in it, same as
+ * after any exec. A child that fails to exec is reported as a failed exec by the parent, since that is where posix_spawn returns
+ * the error.
+ *
+ * Children that would need the ptrace sandbox (e.g., statically linked executables) are not detected here: that decision is made
+ * by the process that calls exec, and the child never runs the interposer before it execs.
+ */
+static int handle_spawn(const char *syscall, BxlObserver *bxl, bool searchPath, pid_t *pid, const char *file, const posix_spawn_file_actions_t *file_actions, const posix_spawnattr_t *attrp, char *const argv[], char *const envp[])
+{
+    char **childEnvp = bxl->ensureEnvs(envp);
+
+    pid_t childPid = 0;
+    result_t<int> result = searchPath
+        ? bxl->fwd_posix_spawnp(&childPid, file, file_actions, attrp, argv, childEnvp)
+        : bxl->fwd_posix_spawn(&childPid, file, file_actions, attrp, argv, childEnvp);
+
+    if (childEnvp != envp)
+    {
+        free(childEnvp);
+    }
+
+    // posix_spawn returns the error rather than setting errno
+    int error = result.get();
+    if (error == 0)
+    {
+        // posix_spawnp looks the file up in the PATH of the caller
+        mode_t mode = 0;
+        std::string exePath;
+        if (!searchPath || !resolve_filename_with_env(file, mode, exePath))
+        {
+            exePath = file;
+        }
+
+        report_child_process(syscall, bxl, childPid, getpid(), bxl->normalize_path(exePath.c_str()).c_str());
+        if (pid != nullptr)
+        {
+            *pid = childPid;
+        }
+    }
+    else
+    {
+        bxl->report_exec(syscall, argv != nullptr && argv[0] != nullptr ? argv[0] : file, file, error);
+    }
+
+    return result.restore();
+}
+
+INTERPOSE(int, posix_spawn, pid_t *pid, const char *path, const posix_spawn_file_actions_t *file_actions, const posix_spawnattr_t *attrp, char *const argv[], char *const envp[])({
+    return handle_spawn(__func__, bxl, /* searchPath */ false, pid, path, file_actions, attrp, argv, envp);
+})
+
+INTERPOSE(int, posix_spawnp, pid_t *pid, const char *file, const posix_spawn_file_actions_t *file_actions, const posix_spawnattr_t *attrp, char *const argv[], char *const envp[])({
+    return handle_spawn(__func__, bxl, /* searchPath */ true, pid, file, file_actions, attrp, argv, envp);
+})
+
 INTERPOSE(int, clone, int (*fn)(void *), void *child_stack, int flags, void *arg, ... /* pid_t *ptid, void *newtls, pid_t *ctid */ )({
     va_list args;
     va_start(args, arg);
@@ -190,6 +300,11 @@ INTERPOSE(int, clone, int (*fn)(void *), void *child_stack, int flags, void *arg
     pid_t *ctid = va_arg(args, pid_t*);
     va_end(args);
 
+    if (!(flags & CLONE_THREAD))
+    {
+        bxl->FlushReports();
+    }
+
     result_t<int> result = bxl->fwd_clone(fn, child_stack, flags, arg, ptid, newtls, ctid);
     
     // We don't want to report any process creation if clone was asked to create a new thread (and not a new process)
@@ -205,6 +320,7 @@ static int handle_exec_with_ptrace(const char *file, char *const argv[], char *c
 {
     // fdtable will not longer be valid because the process will be forked for ptrace
     bxl->reset_fd_table();
+    bxl->FlushReports();
     
     // Before we enable the ptrace sandbox, make sure we disable the interposed sandbox
     // This shouldn't make a difference for real builds (we are enabling the ptrace sandbox because
@@ -212,8 +328,17 @@ static int handle_exec_with_ptrace(const char *file, char *const argv[], char *c
     // we may use the ptrace sandbox even for dynamically linked processes.
     envp = bxl->RemoveLDPreloadFromEnv(envp);
 
-    PTraceSandbox ptraceSandbox(bxl);
-    auto result = ptraceSandbox.ExecuteWithPTraceSandbox(file, argv, envp, bxl->getFamPath());
+    int result;
+    if (bxl->IsHandedBackByTracer())
+    {
+        // The tracer that handed this process back is still attached, and takes over again when the exec succeeds
+        result = bxl->real_execvpe(file, argv, envp);
+    }
+    else
+    {
+        PTraceSandbox ptraceSandbox(bxl);
+        result = ptraceSandbox.ExecuteWithPTraceSandbox(file, argv, envp, bxl->getFamPath());
+    }
 
     bxl->report_exec("execve", argv[0], file, /* error */ errno);
 
@@ -235,6 +360,7 @@ INTERPOSE(int, fexecve, int fd, char *const argv[], char *const envp[])({
         return handle_exec_with_ptrace(fd, argv, bxl->ensureEnvs(envp), bxl);
     }
 
+    bxl->FlushReports();
     result_t<int> result = bxl->fwd_fexecve(fd, argv, bxl->ensureEnvs(envp));
 
     // This will only execute if exec failed
@@ -252,6 +378,7 @@ INTERPOSE(int, execv, const char *file, char *const argv[])({
         return handle_exec_with_ptrace(file, argv, bxl->ensureEnvs(environ), bxl);
     }
 
+    bxl->FlushReports();
     result_t<int> result =  bxl->fwd_execve(file, argv, bxl->ensureEnvs(environ));
 
     // This will only execute if exec failed
@@ -269,6 +396,7 @@ INTERPOSE(int, execve, const char *file, char *const argv[], char *const envp[])
         return handle_exec_with_ptrace(file, argv, bxl->ensureEnvs(envp), bxl);
     }
 
+    bxl->FlushReports();
     result_t<int> result =  bxl->fwd_execve(file, argv, bxl->ensureEnvs(envp));
 
     // This will only execute if exec failed
@@ -292,6 +420,7 @@ INTERPOSE(int, execvp, const char *file, char *const argv[])({
             return handle_exec_with_ptrace(pathname.c_str(), argv, bxl->ensureEnvs(environ), bxl);
         }
 
+        bxl->FlushReports();
         result_t<int> result = bxl->fwd_execve(pathname.c_str(), argv, bxl->ensureEnvs(environ));
         bxl->report_exec(__func__, argv[0], pathname.c_str(), /*error*/ result.get_errno(), mode);
         return result.restore();
@@ -300,6 +429,7 @@ INTERPOSE(int, execvp, const char *file, char *const argv[])({
     {
         // exec* functions don't return unless they fail (the executing image gets replaced
         // by the specified one). So we cannot actually report back the errno
+        bxl->FlushReports();
         result_t<int> result = bxl->fwd_execvpe(file, argv, bxl->ensureEnvs(environ));
         bxl->report_exec(__func__, argv[0], file,  /* error */ result.get_errno(), mode);
         return result.restore();
@@ -322,6 +452,7 @@ INTERPOSE(int, execvpe, const char *file, char *const argv[], char *const envp[]
             return handle_exec_with_ptrace(pathname.c_str(), argv, bxl->ensureEnvs(envp), bxl);
         }
 
+        bxl->FlushReports();
         result_t<int> result = bxl->fwd_execve(pathname.c_str(), argv, bxl->ensureEnvs(envp));
         // This will only execute if exec failed
         bxl->report_exec(__func__, argv[0], pathname.c_str(), /*error*/ result.get_errno(), mode);
@@ -329,6 +460,7 @@ INTERPOSE(int, execvpe, const char *file, char *const argv[], char *const envp[]
     }
     else
     {
+        bxl->FlushReports();
         result_t<int> result = bxl->fwd_execve(file, argv, bxl->ensureEnvs(envp));
         // This will only execute if exec failed
         bxl->report_exec(__func__, argv[0], file, /* error */ result.get_errno(), mode);
@@ -357,6 +489,7 @@ INTERPOSE(int, execl, const char *pathname, const char *arg, ...)({
         return handle_exec_with_ptrace(pathname, (char **)argv, bxl->ensureEnvs(environ), bxl);
     }
     
+    bxl->FlushReports();
     result_t<int> result = bxl->fwd_execve(pathname, (char **)argv, bxl->ensureEnvs(environ));
     bxl->report_exec(__func__, argv[0], pathname, /*error*/ result.get_errno(), /*mode*/ 0);
     return result.restore();
@@ -389,12 +522,14 @@ INTERPOSE(int, execlp, const char *file, const char *arg, ...)({
             return handle_exec_with_ptrace(pathname.c_str(), (char **)argv, bxl->ensureEnvs(environ), bxl);
         }
 
+        bxl->FlushReports();
         result_t<int> result = bxl->fwd_execve(pathname.c_str(), (char **)argv, bxl->ensureEnvs(environ));
         bxl->report_exec(__func__, argv[0], pathname.c_str(), /*error*/ result.get_errno(), mode);
         return result.restore();
     }
     else
     {
+        bxl->FlushReports();
         result_t<int> result = bxl->fwd_execvp(file, (char **)argv);
         bxl->report_exec(__func__, argv[0], file, /*error*/ result.get_errno(), mode);
         return result.restore();
@@ -424,6 +559,7 @@ INTERPOSE(int, execle, const char *pathname, const char *arg, ...)({
         return handle_exec_with_ptrace(pathname, (char **)argv, bxl->ensureEnvs(envp), bxl);
     }
 
+    bxl->FlushReports();
     result_t<int> result = bxl->fwd_execve(pathname, (char **)argv, bxl->ensureEnvs(envp));
 
     // This will only execute if exec failed
@@ -474,49 +610,49 @@ INTERPOSE(int, __fxstatat64, int __ver, int fd, const char *pathname, struct sta
 
 INTERPOSE(int, __xstat, int __ver, const char *pathname, struct stat *buf)({
     result_t<int> result = bxl->fwd___xstat(__ver, pathname, buf);
-    bxl->report_access(__func__, ES_EVENT_TYPE_NOTIFY_STAT, pathname, /* mode */0, get_errno_from_result(result));
+    bxl->report_access(__func__, ES_EVENT_TYPE_NOTIFY_STAT, pathname, get_mode_from_stat_result(result, buf, /* callFollows */ true, /* reportFollows */ true), get_errno_from_result(result));
     return result.restore();
 })
 
 INTERPOSE(int, __xstat64, int __ver, const char *pathname, struct stat64 *buf)({
     result_t<int> result(bxl->fwd___xstat64(__ver, pathname, buf));
-    bxl->report_access(__func__, ES_EVENT_TYPE_NOTIFY_STAT, pathname, /* mode */0, get_errno_from_result(result));
+    bxl->report_access(__func__, ES_EVENT_TYPE_NOTIFY_STAT, pathname, get_mode_from_stat_result(result, buf, /* callFollows */ true, /* reportFollows */ true), get_errno_from_result(result));
     return result.restore();
 })
 
 INTERPOSE(int, __lxstat, int __ver, const char *pathname, struct stat *buf)({
     result_t<int> result = bxl->fwd___lxstat(__ver, pathname, buf);
-    bxl->report_access(__func__, ES_EVENT_TYPE_NOTIFY_STAT, pathname, /* mode */0, O_NOFOLLOW, get_errno_from_result(result));
+    bxl->report_access(__func__, ES_EVENT_TYPE_NOTIFY_STAT, pathname, get_mode_from_stat_result(result, buf, /* callFollows */ false, /* reportFollows */ false), O_NOFOLLOW, get_errno_from_result(result));
     return result.restore();
 })
 
 INTERPOSE(int, __lxstat64, int __ver, const char *pathname, struct stat64 *buf)({
     result_t<int> result(bxl->fwd___lxstat64(__ver, pathname, buf));
-    bxl->report_access(__func__, ES_EVENT_TYPE_NOTIFY_STAT, pathname, /* mode */0, O_NOFOLLOW, get_errno_from_result(result));
+    bxl->report_access(__func__, ES_EVENT_TYPE_NOTIFY_STAT, pathname, get_mode_from_stat_result(result, buf, /* callFollows */ false, /* reportFollows */ false), O_NOFOLLOW, get_errno_from_result(result));
     return result.restore();
 })
 #else
 INTERPOSE(int, stat, const char *pathname, struct stat *statbuf)({
     result_t<int> result = bxl->fwd_stat(pathname, statbuf);
-    bxl->report_access(__func__, ES_EVENT_TYPE_NOTIFY_STAT, pathname, /* mode */0, O_NOFOLLOW, get_errno_from_result(result));
+    bxl->report_access(__func__, ES_EVENT_TYPE_NOTIFY_STAT, pathname, get_mode_from_stat_result(result, statbuf, /* callFollows */ true, /* reportFollows */ false), O_NOFOLLOW, get_errno_from_result(result));
     return result.restore();
 })
 
 INTERPOSE(int, stat64, const char *pathname, struct stat64 *statbuf)({
     result_t<int> result = bxl->fwd_stat64(pathname, statbuf);
-    bxl->report_access(__func__, ES_EVENT_TYPE_NOTIFY_STAT, pathname, /* mode */0, O_NOFOLLOW, get_errno_from_result(result));
+    bxl->report_access(__func__, ES_EVENT_TYPE_NOTIFY_STAT, pathname, get_mode_from_stat_result(result, statbuf, /* callFollows */ true, /* reportFollows */ false), O_NOFOLLOW, get_errno_from_result(result));
     return result.restore();
 })
 
 INTERPOSE(int, lstat, const char *pathname, struct stat *statbuf)({
     result_t<int> result = bxl->fwd_lstat(pathname, statbuf);
-    bxl->report_access(__func__, ES_EVENT_TYPE_NOTIFY_STAT, pathname, /* mode */0, O_NOFOLLOW, get_errno_from_result(result));
+    bxl->report_access(__func__, ES_EVENT_TYPE_NOTIFY_STAT, pathname, get_mode_from_stat_result(result, statbuf, /* callFollows */ false, /* reportFollows */ false), O_NOFOLLOW, get_errno_from_result(result));
     return result.restore();
 })
 
 INTERPOSE(int, lstat64, const char *pathname, struct stat64 *statbuf)({
     result_t<int> result = bxl->fwd_lstat64(pathname, statbuf);
-    bxl->report_access(__func__, ES_EVENT_TYPE_NOTIFY_STAT, pathname, /* mode */0, O_NOFOLLOW, get_errno_from_result(result));
+    bxl->report_access(__func__, ES_EVENT_TYPE_NOTIFY_STAT, pathname, get_mode_from_stat_result(result, statbuf, /* callFollows */ false, /* reportFollows */ false), O_NOFOLLOW, get_errno_from_result(result));
     return result.restore();
 })
 
@@ -583,42 +719,49 @@ INTERPOSE(FILE*, freopen64, const char *pathname, const char *mode, FILE *stream
 })
 
 INTERPOSE(size_t, fread, void *ptr, size_t size, size_t nmemb, FILE *stream)({
+    RETURN_REAL_IF_FD_ACCESS_SETTLED(fileno(stream), ES_EVENT_TYPE_NOTIFY_OPEN, fread, ptr, size, nmemb, stream);
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_OPEN, fileno(stream), report);
     return bxl->check_fwd_and_report_fread(report, check, (size_t)0, ptr, size, nmemb, stream);
 })
 
 INTERPOSE(size_t, fwrite, const void *ptr, size_t size, size_t nmemb, FILE *stream)({
+    RETURN_REAL_IF_FD_ACCESS_SETTLED(fileno(stream), ES_EVENT_TYPE_NOTIFY_WRITE, fwrite, ptr, size, nmemb, stream);
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fileno(stream), report);
     return bxl->check_fwd_and_report_fwrite(report, check, (size_t)0, ptr, size, nmemb, stream);
 })
 
 INTERPOSE(int, fputc, int c, FILE *stream)({
+    RETURN_REAL_IF_FD_ACCESS_SETTLED(fileno(stream), ES_EVENT_TYPE_NOTIFY_WRITE, fputc, c, stream);
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fileno(stream), report);
     return bxl->check_fwd_and_report_fputc(report, check, ERROR_RETURN_VALUE, c, stream);
 })
 
 INTERPOSE(int, fputs, const char *s, FILE *stream)({
+    RETURN_REAL_IF_FD_ACCESS_SETTLED(fileno(stream), ES_EVENT_TYPE_NOTIFY_WRITE, fputs, s, stream);
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fileno(stream), report);
     return bxl->check_fwd_and_report_fputs(report, check, ERROR_RETURN_VALUE, s, stream);
 })
 
 INTERPOSE(int, putc, int c, FILE *stream)({
+    RETURN_REAL_IF_FD_ACCESS_SETTLED(fileno(stream), ES_EVENT_TYPE_NOTIFY_WRITE, putc, c, stream);
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fileno(stream), report);
     return bxl->check_fwd_and_report_putc(report, check, ERROR_RETURN_VALUE, c, stream);
 })
 
 INTERPOSE(int, putchar, int c)({
+    RETURN_REAL_IF_FD_ACCESS_SETTLED(fileno(stdout), ES_EVENT_TYPE_NOTIFY_WRITE, putchar, c);
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fileno(stdout), report);
     return bxl->check_fwd_and_report_putchar(report, check, ERROR_RETURN_VALUE, c);
 })
 
 INTERPOSE(int, puts, const char *s)({
+    RETURN_REAL_IF_FD_ACCESS_SETTLED(fileno(stdout), ES_EVENT_TYPE_NOTIFY_WRITE, puts, s);
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fileno(stdout), report);
     return bxl->check_fwd_and_report_puts(report, check, ERROR_RETURN_VALUE, s);
@@ -639,9 +782,20 @@ INTERPOSE(int, faccessat, int dirfd, const char *pathname, int mode, int flags)(
 // report "Create" if path does not exist and O_CREAT or O_TRUNC is specified
 // report "Write" if path exists and O_CREAT or O_TRUNC is specified (because this truncates the file regardless of its content)
 // otherwise, report "Read"
-static AccessCheckResult CreateFileOpen(BxlObserver *bxl, string &pathStr, int oflag, AccessReportGroup &report)
+static AccessCheckResult CreateFileOpen(BxlObserver *bxl, string &pathStr, int oflag, AccessReportGroup &report, mode_t *mode = nullptr)
 {
+    // Neither stat the file nor build an event for what is dropped by its prefix anyway. Callers that need the mode get it themselves.
+    if (mode == nullptr && bxl->IsUntrackedPseudoFileAccess(ES_EVENT_TYPE_NOTIFY_OPEN, pathStr))
+    {
+        return AccessCheckResult::Invalid();
+    }
+
     mode_t pathMode = bxl->get_mode(pathStr.c_str());
+    if (mode != nullptr)
+    {
+        *mode = pathMode;
+    }
+
     bool pathExists = pathMode != 0;
     bool isCreate = !pathExists && (oflag & (O_CREAT|O_TRUNC));
     bool hasWriteAccess = ((oflag & O_ACCMODE) == O_WRONLY) || ((oflag & O_ACCMODE) == O_RDWR);
@@ -706,36 +860,42 @@ INTERPOSE(int, creat, const char *pathname, mode_t mode)({
 })
 
 INTERPOSE(ssize_t, write, int fd, const void *buf, size_t bufsiz)({
+    RETURN_REAL_IF_FD_ACCESS_SETTLED(fd, ES_EVENT_TYPE_NOTIFY_WRITE, write, fd, buf, bufsiz);
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fd, report);
     return bxl->check_fwd_and_report_write(report, check, (ssize_t)ERROR_RETURN_VALUE, fd, buf, bufsiz);
 })
 
 INTERPOSE(ssize_t, pwrite, int fd, const void *buf, size_t count, off_t offset)({
+    RETURN_REAL_IF_FD_ACCESS_SETTLED(fd, ES_EVENT_TYPE_NOTIFY_WRITE, pwrite, fd, buf, count, offset);
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fd, report);
     return bxl->check_fwd_and_report_pwrite(report, check, (ssize_t)ERROR_RETURN_VALUE, fd, buf, count, offset);
 })
 
 INTERPOSE(ssize_t, writev, int fd, const struct iovec *iov, int iovcnt)({
+    RETURN_REAL_IF_FD_ACCESS_SETTLED(fd, ES_EVENT_TYPE_NOTIFY_WRITE, writev, fd, iov, iovcnt);
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fd, report);
     return bxl->check_fwd_and_report_writev(report, check, (ssize_t)ERROR_RETURN_VALUE, fd, iov, iovcnt);
 })
 
 INTERPOSE(ssize_t, pwritev, int fd, const struct iovec *iov, int iovcnt, off_t offset)({
+    RETURN_REAL_IF_FD_ACCESS_SETTLED(fd, ES_EVENT_TYPE_NOTIFY_WRITE, pwritev, fd, iov, iovcnt, offset);
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fd, report);
     return bxl->check_fwd_and_report_pwritev(report, check, (ssize_t)ERROR_RETURN_VALUE, fd, iov, iovcnt, offset);
 })
 
 INTERPOSE(ssize_t, pwritev2, int fd, const struct iovec *iov, int iovcnt, off_t offset, int flags)({
+    RETURN_REAL_IF_FD_ACCESS_SETTLED(fd, ES_EVENT_TYPE_NOTIFY_WRITE, pwritev2, fd, iov, iovcnt, offset, flags);
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fd, report);
     return bxl->check_fwd_and_report_pwritev2(report, check, (ssize_t)ERROR_RETURN_VALUE, fd, iov, iovcnt, offset, flags);
 })
 
 INTERPOSE(ssize_t, pwrite64, int fd, const void *buf, size_t count, off_t offset)({
+    RETURN_REAL_IF_FD_ACCESS_SETTLED(fd, ES_EVENT_TYPE_NOTIFY_WRITE, pwrite64, fd, buf, count, offset);
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fd, report);
     return bxl->check_fwd_and_report_pwrite64(report, check, (ssize_t)ERROR_RETURN_VALUE, fd, buf, count, offset);
@@ -744,7 +904,9 @@ INTERPOSE(ssize_t, pwrite64, int fd, const void *buf, size_t count, off_t offset
 INTERPOSE(int, remove, const char *pathname)({
     AccessReportGroup report;
     auto check = bxl->create_access(__func__, ES_EVENT_TYPE_NOTIFY_UNLINK, pathname, report, /*mode*/0, O_NOFOLLOW);
-    return bxl->check_fwd_and_report_remove(report, check, ERROR_RETURN_VALUE, pathname);
+    int result = bxl->check_fwd_and_report_remove(report, check, ERROR_RETURN_VALUE, pathname);
+    bxl->invalidate_resolved_path_cache();
+    return result;
 })
 
 INTERPOSE(int, truncate, const char *path, off_t length)({
@@ -773,7 +935,9 @@ INTERPOSE(int, rmdir, const char *pathname)({
     // This is so we can track directory creation/deletion flow. Using the cache lumps all these operations into one report line
     auto check = bxl->create_access(__func__, ES_EVENT_TYPE_NOTIFY_UNLINK, pathname, report, /* mode */ 0, /* flags */ 0 , /* checkCache */ false);
 
-    return bxl->check_fwd_and_report_rmdir(report, check, ERROR_RETURN_VALUE, pathname);
+    int result = bxl->check_fwd_and_report_rmdir(report, check, ERROR_RETURN_VALUE, pathname);
+    bxl->invalidate_resolved_path_cache();
+    return result;
 })
 
 static AccessCheckResult handle_renameat(BxlObserver *bxl, int olddirfd, const char *oldpath, int newdirfd, const char *newpath, std::vector<AccessReportGroup> &accessesToReport)
@@ -783,39 +947,33 @@ static AccessCheckResult handle_renameat(BxlObserver *bxl, int olddirfd, const c
 
     mode_t mode = bxl->get_mode(oldStr.c_str());    
     AccessCheckResult check = AccessCheckResult::Invalid();
-    std::vector<std::string> filesAndDirectories;
 
     if (S_ISDIR(mode))
     {
-        bool enumerateResult = bxl->EnumerateDirectory(oldStr, /*recursive*/true, filesAndDirectories);
-        if (enumerateResult)
+        const char *syscallName = __func__;
+        std::string target;
+        bool enumerateResult = bxl->EnumerateDirectory(oldStr, /*recursive*/true, [&](const std::string &fileOrDirectory, mode_t entryMode)
         {
-            // reserve all the content for both source and destination
-            accessesToReport.reserve(filesAndDirectories.size() * 2);
-
-            for (auto fileOrDirectory : filesAndDirectories)
-            {
-                // Access check for the source file
-                AccessReportGroup sourceReport;
-                check = bxl->create_access(__func__, ES_EVENT_TYPE_NOTIFY_UNLINK, fileOrDirectory.c_str(), sourceReport, /*mode*/ 0, O_NOFOLLOW);
-                accessesToReport.emplace_back(sourceReport);
-
-                // Access check for the destination file
-                fileOrDirectory.replace(0, oldStr.length(), newStr);
-                AccessReportGroup targetReport;
-                check = AccessCheckResult::Combine(check, CreateFileOpen(bxl, fileOrDirectory, O_CREAT | O_WRONLY, targetReport));
-                accessesToReport.emplace_back(targetReport);
-
-                // If access is denied to any of the files in the enumeration, we can break the loop right away here because check_and_fwd_renameat will also fail
-                if (bxl->should_deny(check))
-                {
-                    break;
-                }
-            }
-        }
-        else
+            // Access check for the source file (its file type comes from the enumeration, so it is not stat-ed again)
+            AccessReportGroup sourceReport;
+            check = bxl->create_access(syscallName, ES_EVENT_TYPE_NOTIFY_UNLINK, fileOrDirectory.c_str(), sourceReport, entryMode, O_NOFOLLOW);
+            accessesToReport.emplace_back(sourceReport);
+
+            // Access check for the destination file
+            target.assign(newStr).append(fileOrDirectory, oldStr.length(), std::string::npos);
+            AccessReportGroup targetReport;
+            check = AccessCheckResult::Combine(check, CreateFileOpen(bxl, target, O_CREAT | O_WRONLY, targetReport));
+            accessesToReport.emplace_back(targetReport);
+
+            // If access is denied to any of the files in the enumeration, we can stop right away here because check_and_fwd_renameat will also fail
+            return !bxl->should_deny(check);
+        });
+
+        if (!enumerateResult)
         {
             // TODO: [pgunasekara] Remove this case when we're certain the enumeration logic above is solid
+            // Part of the tree could not be enumerated: drop what was collected so far and report the rename of the root instead
+            accessesToReport.clear();
             AccessReportGroup report;
             IOEvent event(ES_EVENT_TYPE_NOTIFY_RENAME, ES_ACTION_TYPE_NOTIFY, oldStr, bxl->GetProgramPath(), mode, false, newStr);
             check = bxl->create_access(__func__, event, report);
@@ -849,11 +1007,14 @@ INTERPOSE(int, renameat, int olddirfd, const char *oldpath, int newdirfd, const
     else 
     {
         result = bxl->fwd_renameat(olddirfd, oldpath, newdirfd, newpath);
-        for (auto access : accessesToReport)
+        // Directories and symlinks may have been moved around
+        bxl->invalidate_resolved_path_cache();
+        for (auto &access : accessesToReport)
         {
             access.SetErrno(get_errno_from_result(result));
-            bxl->SendReport(access);
         }
+
+        bxl->SendReports(accessesToReport);
     }
 
     return result.restore();
@@ -873,11 +1034,14 @@ INTERPOSE(int, renameat2, int olddirfd, const char *oldpath, int newdirfd, const
     else 
     {
         result = bxl->fwd_renameat2(olddirfd, oldpath, newdirfd, newpath, flags);
-        for (auto access : accessesToReport)
+        // Directories and symlinks may have been moved around
+        bxl->invalidate_resolved_path_cache();
+        for (auto &access : accessesToReport)
         {
             access.SetErrno(get_errno_from_result(result));
-            bxl->SendReport(access);
         }
+
+        bxl->SendReports(accessesToReport);
     }
 
     return result.restore();
@@ -887,25 +1051,22 @@ INTERPOSE(int, rename, const char *oldpath, const char *newpath)({
     return renameat(AT_FDCWD, oldpath, AT_FDCWD, newpath);
 })
 
+// Both sides of a link are checked and reported as a single access (see IOHandler::HandleLink), and normalized together
 INTERPOSE(int, link, const char *path1, const char *path2)({
     AccessReportGroup report;
-    auto check = bxl->create_access(
-        __func__,
-        ES_EVENT_TYPE_NOTIFY_LINK,
-        bxl->normalize_path(path1, O_NOFOLLOW).c_str(),
-        bxl->normalize_path(path2, O_NOFOLLOW).c_str(),
-        report);
+    std::string source;
+    std::string destination;
+    bxl->normalize_link_paths(AT_FDCWD, path1, AT_FDCWD, path2, /* flags */ 0, source, destination);
+    auto check = bxl->create_access(__func__, ES_EVENT_TYPE_NOTIFY_LINK, source.c_str(), destination.c_str(), report);
     return bxl->check_fwd_and_report_link(report, check, ERROR_RETURN_VALUE, path1, path2);
 })
 
 INTERPOSE(int, linkat, int fd1, const char *name1, int fd2, const char *name2, int flag)({
     AccessReportGroup report;
-    auto check = bxl->create_access(
-        __func__,
-        ES_EVENT_TYPE_NOTIFY_LINK,
-        bxl->normalize_path_at(fd1, name1, O_NOFOLLOW).c_str(),
-        bxl->normalize_path_at(fd2, name2, O_NOFOLLOW).c_str(),
-        report);
+    std::string source;
+    std::string destination;
+    bxl->normalize_link_paths(fd1, name1, fd2, name2, flag, source, destination);
+    auto check = bxl->create_access(__func__, ES_EVENT_TYPE_NOTIFY_LINK, source.c_str(), destination.c_str(), report);
     return bxl->check_fwd_and_report_linkat(report, check, ERROR_RETURN_VALUE, fd1, name1, fd2, name2, flag);
 })
 
@@ -917,7 +1078,9 @@ INTERPOSE(int, unlink, const char *path)({
     
     AccessReportGroup report;
     auto check = bxl->create_access(__func__, ES_EVENT_TYPE_NOTIFY_UNLINK, path, report, /*mode*/ 0, O_NOFOLLOW);
-    return bxl->check_fwd_and_report_unlink(report, check, ERROR_RETURN_VALUE, path);
+    int result = bxl->check_fwd_and_report_unlink(report, check, ERROR_RETURN_VALUE, path);
+    bxl->invalidate_resolved_path_cache();
+    return result;
 })
 
 INTERPOSE(int, unlinkat, int dirfd, const char *path, int flags)({
@@ -929,21 +1092,27 @@ INTERPOSE(int, unlinkat, int dirfd, const char *path, int flags)({
     AccessReportGroup report;
     int oflags = (flags & AT_REMOVEDIR) ? 0 : O_NOFOLLOW;
     auto check = bxl->create_access_at(__func__, ES_EVENT_TYPE_NOTIFY_UNLINK, dirfd, path, report, oflags);
-    return bxl->check_fwd_and_report_unlinkat(report, check, ERROR_RETURN_VALUE, dirfd, path, flags);
+    int result = bxl->check_fwd_and_report_unlinkat(report, check, ERROR_RETURN_VALUE, dirfd, path, flags);
+    bxl->invalidate_resolved_path_cache();
+    return result;
 })
 
 INTERPOSE(int, symlink, const char *target, const char *linkPath)({
     IOEvent event(ES_EVENT_TYPE_NOTIFY_CREATE, ES_ACTION_TYPE_NOTIFY, bxl->normalize_path(linkPath, O_NOFOLLOW), bxl->GetProgramPath(), S_IFLNK);
     AccessReportGroup report;
     auto check = bxl->create_access(__func__, event, report);
-    return bxl->check_fwd_and_report_symlink(report, check, ERROR_RETURN_VALUE, target, linkPath);
+    int result = bxl->check_fwd_and_report_symlink(report, check, ERROR_RETURN_VALUE, target, linkPath);
+    bxl->invalidate_resolved_path_cache();
+    return result;
 })
 
 INTERPOSE(int, symlinkat, const char *target, int dirfd, const char *linkPath)({
     IOEvent event(ES_EVENT_TYPE_NOTIFY_CREATE, ES_ACTION_TYPE_NOTIFY, bxl->normalize_path_at(dirfd, linkPath, O_NOFOLLOW), bxl->GetProgramPath(), S_IFLNK);
     AccessReportGroup report;
     auto check = bxl->create_access(__func__, event, report);
-    return bxl->check_fwd_and_report_symlinkat(report, check, ERROR_RETURN_VALUE, target, dirfd, linkPath);
+    int result = bxl->check_fwd_and_report_symlinkat(report, check, ERROR_RETURN_VALUE, target, dirfd, linkPath);
+    bxl->invalidate_resolved_path_cache();
+    return result;
 })
 
 INTERPOSE_SOMETIMES(
@@ -997,43 +1166,36 @@ INTERPOSE(char *, realpath, const char *path, char *resolved_path)({
         return result;
     }
 
+    // The path is walked once: the same resolution gives both the path to report a probe on and the intermediate symlinks
+    ResolvedSymlinkChain chain;
+    bxl->resolve_symlink_chain(path, /* followFinalSymlink */ true, chain);
+
+    // Report a readlink on every symlink that was crossed. Even when realpath failed, they could
+    // technically have been probed before the failure.
+    BXL_LOG_DEBUG(bxl, "[realpath] Reporting %zu intermediate symlinks for '%s'", chain.symlinks.size(), path);
+    bxl->report_symlink_chain(chain, getpid());
+
     // We should report a probe on the path passed to realpath:
-    // if the full path is a symlink, we will report a readlink in the logic below,
-    // but when it's not, we must count this as a probe because realpath will
+    // when it is not a symlink, we must count this as a probe because realpath will
     // indicate to the caller if this path was absent or not. 
-    bxl->report_access(__func__, ES_EVENT_TYPE_NOTIFY_STAT, path);
+    bxl->report_access(__func__, ES_EVENT_TYPE_NOTIFY_STAT, chain);
 
-    if (result == nullptr)
+    if (result != nullptr && strcmp(path, result) != 0 && chain.path != result)
     {
-        // realpath returned an error, but the original path is not null
-        // Let's try to report the intermediate symlinks anyway ourselves, because
-        // technically they could have been probed before any failure.
-        bxl->report_intermediate_symlinks(path, getpid());
-        return result;
-    }
-
-    // realpath succeeded. Let's report the intermediate symlinks if the result is
-    // different than the original path.
-    if (strcmp(path, result) != 0)
-    {
-        BXL_LOG_DEBUG(bxl, "[realpath] Resolving intermediate symlinks for '%s'", path);
-        bxl->report_intermediate_symlinks(path, getpid());
-
         // Report a probe on the returned path, as the success of this function
         // indicates to the caller that the path exists. 
         bxl->report_access(__func__, ES_EVENT_TYPE_NOTIFY_STAT, result);
     }
-    else
-    {
-        BXL_LOG_DEBUG(bxl, "[realpath] Skipping sandbox symlink resolution for path '%s'", path);
-    }
 
     return result;
 })
 
+// In the lightweight observation mode readdir isn't observed, so a directory opened for enumeration is reported enumerated right away
+#define OPENDIR_EVENT_TYPE (bxl->IsLightweightObservation() ? ES_EVENT_TYPE_NOTIFY_READDIR : ES_EVENT_TYPE_NOTIFY_STAT)
+
 INTERPOSE(DIR*, opendir, const char *name)({
     AccessReportGroup report;
-    auto check = bxl->create_access(__func__, ES_EVENT_TYPE_NOTIFY_STAT, name, report);
+    auto check = bxl->create_access(__func__, OPENDIR_EVENT_TYPE, name, report);
     DIR *d = bxl->check_fwd_and_report_opendir(report, check, (DIR*)NULL, name);
     if (d) { bxl->reset_fd_table_entry(dirfd(d)); }
     return d;
@@ -1041,7 +1203,7 @@ INTERPOSE(DIR*, opendir, const char *name)({
 
 INTERPOSE(DIR*, fdopendir, int fd)({
     AccessReportGroup report;
-    auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_STAT, fd, report);
+    auto check = bxl->create_access_fd(__func__, OPENDIR_EVENT_TYPE, fd, report);
     return bxl->check_fwd_and_report_fdopendir(report, check, (DIR*)NULL, fd);
 })
 
@@ -1108,18 +1270,21 @@ INTERPOSE(int, mknodat, int dirfd, const char *pathname, mode_t mode, dev_t dev)
 })
 
 INTERPOSE(int, vprintf, const char *fmt, va_list args)({
+    RETURN_REAL_IF_FD_ACCESS_SETTLED(1, ES_EVENT_TYPE_NOTIFY_WRITE, vprintf, fmt, args);
     AccessReportGroup report;
     bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, 1, report);
     return bxl->fwd_vprintf(fmt, args).restore();
 })
 
 INTERPOSE(int, vfprintf, FILE *f, const char *fmt, va_list args)({
+    RETURN_REAL_IF_FD_ACCESS_SETTLED(fileno(f), ES_EVENT_TYPE_NOTIFY_WRITE, vfprintf, f, fmt, args);
     AccessReportGroup report;
     bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fileno(f), report);
     return bxl->fwd_vfprintf(f, fmt, args).restore();
 })
 
 INTERPOSE(int, vdprintf, int fd, const char *fmt, va_list args)({
+    RETURN_REAL_IF_FD_ACCESS_SETTLED(fd, ES_EVENT_TYPE_NOTIFY_WRITE, vdprintf, fd, fmt, args);
     AccessReportGroup report;
     bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fd, report);
     return bxl->fwd_and_report_vdprintf(report, -1, fd, fmt, args).restore();
@@ -1222,48 +1387,21 @@ INTERPOSE(ssize_t, sendfile64, int out_fd, int in_fd, off_t *offset, size_t coun
     return sendfile(out_fd, in_fd, offset, count);
 })
 
-INTERPOSE(ssize_t, copy_file_range, int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags)({
-    AccessReportGroup report;
-    auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fd_out, report);
-    ssize_t result;
-    if (bxl->should_deny(check)) {
-        errno = EPERM;
-        result = (ssize_t)ERROR_RETURN_VALUE;
-        goto exit;
-    }
-
-    // TODO: Remove the following workaround when the kernel bug is fixed.
-    //
-    // Due to (possibly) kernel bug, copy_file_range does no longer work when the file descriptors are not mounted on the same
-    // filesystems, despite what is said in the manual https://man7.org/linux/man-pages/man2/copy_file_range.2.html.
-    // This bug breaks AnyBuild virtual filesystem (VFS) because the source file will be in the read-only (lower) layer of overlayfs, and this
-    // layer is mounted on AnyBuild FUSE, and the target file will be in the writable (upper) layer of overlayfs.
-    //
-    // In the commented code below, we try to check if the file descriptors are mounted on the same filesystem, and if so, we simply call
-    // copy_file_range. On the user space, the descriptors are mounted on the same filesystem. However, when copy_file_range is called,
-    // and the call goes into the kernel space, those descriptors are identified from different filesystems, and so the call will fail with EXDEV.
-    //
-    // ------------------------------------------------------------------------------------------
-    // struct stat st_in;
-    // if (fstat(fd_in, &st_in) == -1)
-    //     return (ssize_t)ERROR_RETURN_VALUE;
-    // struct stat st_out;
-    // if (fstat(fd_out, &st_out) == -1)
-    //     return (ssize_t)ERROR_RETURN_VALUE;
-    // errno = 0;
-    // if ((uintmax_t)major(st_in.st_dev) == (uintmax_t)major(st_out.st_dev)
-    //     && (uintmax_t)minor(st_in.st_dev) == (uintmax_t)minor(st_out.st_dev))
-    //     return bxl->fwd_copy_file_range(fd_in, off_in, fd_out, off_out, len, flags).restore();
-    // ------------------------------------------------------------------------------------------
-
-    // The code below implements copy_file_range using splice(2). The idea is the content is first
-    // copied to the pipe and then transferred to the target.
-
+/*
+ * Emulates copy_file_range with splice(2): the content is first copied to a pipe and then transferred to the target.
+ *
+ * Due to (possibly) a kernel bug, copy_file_range does not work when the file descriptors are not mounted on the same
+ * filesystems, despite what is said in the manual https://man7.org/linux/man-pages/man2/copy_file_range.2.html.
+ * This breaks AnyBuild virtual filesystem (VFS), because the source file is in the read-only (lower) layer of overlayfs, which
+ * is mounted on AnyBuild FUSE, while the target file is in the writable (upper) layer of overlayfs. On the user space the
+ * descriptors are on the same filesystem, but once the call goes into the kernel they are not, and the call fails with EXDEV.
+ */
+static ssize_t copy_file_range_with_splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags)
+{
     // Check for flags.
     if (flags != 0) {
         errno = EINVAL;
-        result = (ssize_t)ERROR_RETURN_VALUE;
-        goto exit;
+        return (ssize_t)ERROR_RETURN_VALUE;
     }
 
     // Check for overlapped range.
@@ -1275,8 +1413,7 @@ INTERPOSE(ssize_t, copy_file_range, int fd_in, loff_t *off_in, int fd_out, loff_
         if ((start_off_in <= end_off_out && end_off_in >= start_off_out)
             || (start_off_out <= end_off_in && end_off_out >= start_off_in)) {
                 errno = EINVAL;
-                result = (ssize_t)ERROR_RETURN_VALUE;
-                goto exit;
+                return (ssize_t)ERROR_RETURN_VALUE;
             }
     }
 
@@ -1284,24 +1421,97 @@ INTERPOSE(ssize_t, copy_file_range, int fd_in, loff_t *off_in, int fd_out, loff_
 
     // Creates a pipe.
     int pipefd[2];
-    result = pipe(pipefd);
+    ssize_t result = pipe(pipefd);
     if (result < 0)
-        goto exit;
+        return result;
 
     // Copy from input to pipe.
     result = splice(fd_in, off_in, pipefd[1], NULL, len, 0);
-    if (result < 0)
-        goto exit;
 
     // Copy from pipe to output.
-    result = splice(pipefd[0], NULL, fd_out, off_out, result, 0);
+    if (result > 0)
+        result = splice(pipefd[0], NULL, fd_out, off_out, result, 0);
 
-exit:
+    int old_errno = errno;
     close(pipefd[0]);
     close(pipefd[1]);
-    report.SetErrno(result == -1? errno : 0);
+    errno = old_errno;
+
+    return result;
+}
+
+// How copy_file_range is carried out between the files of two devices (see the copy_file_range interposer)
+enum class CopyStrategy : uint64_t { Unknown = 0, Kernel = 1, Splice = 2 };
+
+/*
+ * Direct-mapped table remembering the copy strategy that works for a (device in, device out) pair. Every slot holds the hash of
+ * the pair with its lowest bits replaced by the strategy, so it can be read and updated without a lock (which would not survive
+ * a fork happening while it is held). Colliding pairs evict each other: a wrong guess only costs the failed call it takes to
+ * find out again.
+ */
+static std::atomic<uint64_t> sCopyStrategies[16];
+static const uint64_t CopyStrategyMask = 3;
+
+static uint64_t copy_strategy_key(dev_t dev_in, dev_t dev_out)
+{
+    uint64_t key = (uint64_t)dev_in * 0x9E3779B97F4A7C15ULL + (uint64_t)dev_out;
+    key = (key ^ (key >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    return (key ^ (key >> 27)) & ~CopyStrategyMask;
+}
+
+static CopyStrategy get_copy_strategy(uint64_t key)
+{
+    uint64_t slot = sCopyStrategies[(key >> 2) % 16].load(std::memory_order_relaxed);
+    return (slot & ~CopyStrategyMask) == key ? (CopyStrategy)(slot & CopyStrategyMask) : CopyStrategy::Unknown;
+}
+
+static void set_copy_strategy(uint64_t key, CopyStrategy strategy)
+{
+    sCopyStrategies[(key >> 2) % 16].store(key | (uint64_t)strategy, std::memory_order_relaxed);
+}
+
+INTERPOSE(ssize_t, copy_file_range, int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags)({
+    AccessReportGroup report;
+    auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fd_out, report);
+    ssize_t result;
+    if (bxl->should_deny(check)) {
+        errno = EPERM;
+        result = (ssize_t)ERROR_RETURN_VALUE;
+    }
+    else {
+        // The kernel copy is tried first: within a filesystem it can reflink (btrfs, XFS) or copy server-side (NFS, SMB) instead
+        // of moving every byte through user space. The splice emulation is only used for the pairs of devices the kernel refuses
+        // to copy between (see copy_file_range_with_splice), which is remembered so those pairs don't pay for the failed call again.
+        struct stat st_in;
+        struct stat st_out;
+#if (__GLIBC__ == 2 && __GLIBC_MINOR__ < 33)
+        bool knownDevices = bxl->real___fxstat(1, fd_in, &st_in) == 0 && bxl->real___fxstat(1, fd_out, &st_out) == 0;
+#else
+        bool knownDevices = bxl->real_fstat(fd_in, &st_in) == 0 && bxl->real_fstat(fd_out, &st_out) == 0;
+#endif
+        uint64_t key = knownDevices ? copy_strategy_key(st_in.st_dev, st_out.st_dev) : 0;
+        CopyStrategy strategy = knownDevices ? get_copy_strategy(key) : CopyStrategy::Unknown;
+
+        bool useSplice = strategy == CopyStrategy::Splice || bxl->real_copy_file_range == nullptr;
+        if (!useSplice) {
+            errno = 0;
+            result = bxl->real_copy_file_range(fd_in, off_in, fd_out, off_out, len, flags);
+            useSplice = result == -1 && (errno == EXDEV || errno == EOPNOTSUPP || errno == ENOSYS);
+            if (knownDevices && strategy == CopyStrategy::Unknown && (result >= 0 || useSplice)) {
+                set_copy_strategy(key, useSplice ? CopyStrategy::Splice : CopyStrategy::Kernel);
+            }
+        }
+
+        if (useSplice) {
+            result = copy_file_range_with_splice(fd_in, off_in, fd_out, off_out, len, flags);
+        }
+    }
+
+    int old_errno = errno;
+    report.SetErrno(result == -1 ? errno : 0);
     bxl->SendReport(report);
-    
+    errno = old_errno;
+
     return result;
 })
 
@@ -1313,6 +1523,241 @@ INTERPOSE(int, name_to_handle_at, int dirfd, const char *pathname, struct file_h
     return ret_fd(bxl->check_fwd_and_report_name_to_handle_at(report, check, ERROR_RETURN_VALUE, dirfd, pathname, handle, mount_id, flags), bxl);
 })
 
+/*
+ * Mount namespaces and mount table changes.
+ *
+ * The same path can name different files once a process moved to another mount namespace or changed its mount table (e.g.,
+ * pips that run in containers or overlayfs sandboxes), so the caches that are keyed by paths are rekeyed or dropped here.
+ * Nothing is reported: the accesses made through the new mounts are.
+ */
+
+INTERPOSE(int, unshare, int flags)({
+    result_t<int> result = bxl->fwd_unshare(flags);
+    if (result.get() == 0 && (flags & CLONE_NEWNS))
+    {
+        bxl->refresh_mount_namespace();
+    }
+
+    return result.restore();
+})
+
+INTERPOSE(int, setns, int fd, int nstype)({
+    // nstype may be 0 (any namespace) or a set of flags when fd is a pidfd, so just look at the namespace we ended up in
+    result_t<int> result = bxl->fwd_setns(fd, nstype);
+    if (result.get() == 0)
+    {
+        bxl->refresh_mount_namespace();
+    }
+
+    return result.restore();
+})
+
+INTERPOSE(int, mount, const char *source, const char *target, const char *filesystemtype, unsigned long mountflags, const void *data)({
+    result_t<int> result = bxl->fwd_mount(source, target, filesystemtype, mountflags, data);
+    if (result.get() == 0)
+    {
+        bxl->invalidate_mount_dependent_caches();
+    }
+
+    return result.restore();
+})
+
+INTERPOSE(int, umount, const char *target)({
+    result_t<int> result = bxl->fwd_umount(target);
+    if (result.get() == 0)
+    {
+        bxl->invalidate_mount_dependent_caches();
+    }
+
+    return result.restore();
+})
+
+INTERPOSE(int, umount2, const char *target, int flags)({
+    result_t<int> result = bxl->fwd_umount2(target, flags);
+    if (result.get() == 0)
+    {
+        bxl->invalidate_mount_dependent_caches();
+    }
+
+    return result.restore();
+})
+
+/*
+ * io_uring submissions made through liburing.
+ *
+ * The operations of an io_uring never go through libc, so the path based ones are picked up from the submission queue right before
+ * liburing hands it to the kernel. The submissions still run asynchronously, so they are reported up front: whether an open or stat
+ * will find its file is decided by looking at the file system at submission time. The accesses are reported, but not denied.
+ * Operations on already open descriptors (reads, writes, fsync, ...) are covered by the report of the open that produced them.
+ *
+ * Only the exported liburing entry points that submit can be interposed: programs that link liburing statically, or that drive
+ * io_uring_enter themselves, are not observed this way.
+ */
+
+// Prefix of liburing's 'struct io_uring' (stable since liburing 0.7), so that liburing.h is not needed to build the sandbox
+typedef struct
+{
+    struct
+    {
+        unsigned *khead;
+        unsigned *ktail;
+        unsigned *kring_mask;
+        unsigned *kring_entries;
+        unsigned *kflags;
+        unsigned *kdropped;
+        unsigned *array;
+        struct io_uring_sqe *sqes;
+        // Submissions in [sqe_head, sqe_tail) were prepared by the application, and are handed to the kernel on the next submit
+        unsigned sqe_head;
+        unsigned sqe_tail;
+        size_t ring_sz;
+        void *ring_ptr;
+        unsigned pad[4];
+    } sq;
+    struct
+    {
+        unsigned *khead;
+        unsigned *ktail;
+        unsigned *kring_mask;
+        unsigned *kring_entries;
+        unsigned *kflags;
+        unsigned *koverflow;
+        struct io_uring_cqe *cqes;
+        size_t ring_sz;
+        void *ring_ptr;
+        unsigned pad[4];
+    } cq;
+    // IORING_SETUP_* flags the ring was created with
+    unsigned flags;
+} liburing_ring;
+
+extern "C"
+{
+    struct io_uring;
+    int io_uring_submit(struct io_uring *ring);
+    int io_uring_submit_and_wait(struct io_uring *ring, unsigned wait_nr);
+    int io_uring_submit_and_wait_timeout(struct io_uring *ring, struct io_uring_cqe **cqe_ptr, unsigned wait_nr, struct __kernel_timespec *ts, sigset_t *sigmask);
+    int io_uring_submit_and_get_events(struct io_uring *ring);
+    int io_uring_wait_cqes(struct io_uring *ring, struct io_uring_cqe **cqe_ptr, unsigned wait_nr, struct __kernel_timespec *ts, sigset_t *sigmask);
+}
+
+// Reports the OPENAT, OPENAT2, STATX, RENAMEAT and UNLINKAT submissions that are about to be handed to the kernel, all in one batch
+static void report_io_uring_submissions(BxlObserver *bxl, struct io_uring *ring)
+{
+    const liburing_ring *view = (const liburing_ring *)ring;
+    if (view == nullptr || view->sq.sqe_head == view->sq.sqe_tail)
+    {
+        return;
+    }
+
+    unsigned mask = *view->sq.kring_mask;
+    unsigned shift = (view->flags & IORING_SETUP_SQE128) ? 1 : 0;
+    bool movesPaths = false;
+    std::vector<AccessReportGroup> reports;
+
+    for (unsigned i = view->sq.sqe_head; i != view->sq.sqe_tail; i++)
+    {
+        const struct io_uring_sqe *sqe = &view->sq.sqes[(i & mask) << shift];
+        const char *path = (const char *)(uintptr_t)sqe->addr;
+        if (path == nullptr)
+        {
+            continue;
+        }
+
+        switch (sqe->opcode)
+        {
+            case IORING_OP_OPENAT:
+            case IORING_OP_OPENAT2:
+            {
+                // For OPENAT2, 'off' points to the struct open_how, which starts with the open flags
+                int flags = sqe->opcode == IORING_OP_OPENAT ? (int)sqe->open_flags : (int)*(const __u64 *)(uintptr_t)sqe->off;
+                std::string pathStr = bxl->normalize_path_at(sqe->fd, path);
+                mode_t mode = 0;
+                reports.emplace_back();
+                CreateFileOpen(bxl, pathStr, flags, reports.back(), &mode);
+                reports.back().SetErrno(mode == 0 && !(flags & O_CREAT) ? ENOENT : 0);
+                break;
+            }
+            case IORING_OP_STATX:
+            {
+                // An empty path (with AT_EMPTY_PATH) stats the descriptor itself
+                if (*path == '\0')
+                {
+                    break;
+                }
+
+                int oflags = (sqe->statx_flags & AT_SYMLINK_NOFOLLOW) ? O_NOFOLLOW : 0;
+                std::string pathStr = bxl->normalize_path_at(sqe->fd, path, oflags);
+                mode_t mode = bxl->get_mode(pathStr.c_str());
+                reports.emplace_back();
+                bxl->create_access("io_uring_statx", ES_EVENT_TYPE_NOTIFY_STAT, pathStr.c_str(), reports.back(), mode, oflags);
+                reports.back().SetErrno(mode == 0 ? ENOENT : 0);
+                break;
+            }
+            case IORING_OP_RENAMEAT:
+            {
+                // The new directory fd travels in 'len'
+                handle_renameat(bxl, sqe->fd, path, (int)sqe->len, (const char *)(uintptr_t)sqe->addr2, reports);
+                movesPaths = true;
+                break;
+            }
+            case IORING_OP_UNLINKAT:
+            {
+                int oflags = (sqe->unlink_flags & AT_REMOVEDIR) ? 0 : O_NOFOLLOW;
+                reports.emplace_back();
+                bxl->create_access_at("io_uring_unlinkat", ES_EVENT_TYPE_NOTIFY_UNLINK, sqe->fd, path, reports.back(), oflags);
+                movesPaths = true;
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    if (movesPaths)
+    {
+        // The renames and unlinks complete at some point after the submission, with no chance to invalidate the resolved path
+        // cache afterwards (see invalidate_resolved_path_cache)
+        bxl->disable_resolved_path_cache();
+    }
+
+    if (!reports.empty())
+    {
+        bxl->SendReports(reports);
+    }
+}
+
+// liburing is not necessarily loaded (and not linked against), so the real functions are looked up on first use
+#define RETURN_REAL_IO_URING(name, ...)                                              \
+    static const auto real = (decltype(&name))dlsym(RTLD_NEXT, #name);               \
+    return real != nullptr ? real(__VA_ARGS__) : -ENOSYS;
+
+INTERPOSE(int, io_uring_submit, struct io_uring *ring)({
+    report_io_uring_submissions(bxl, ring);
+    RETURN_REAL_IO_URING(io_uring_submit, ring);
+})
+
+INTERPOSE(int, io_uring_submit_and_wait, struct io_uring *ring, unsigned wait_nr)({
+    report_io_uring_submissions(bxl, ring);
+    RETURN_REAL_IO_URING(io_uring_submit_and_wait, ring, wait_nr);
+})
+
+INTERPOSE(int, io_uring_submit_and_wait_timeout, struct io_uring *ring, struct io_uring_cqe **cqe_ptr, unsigned wait_nr, struct __kernel_timespec *ts, sigset_t *sigmask)({
+    report_io_uring_submissions(bxl, ring);
+    RETURN_REAL_IO_URING(io_uring_submit_and_wait_timeout, ring, cqe_ptr, wait_nr, ts, sigmask);
+})
+
+INTERPOSE(int, io_uring_submit_and_get_events, struct io_uring *ring)({
+    report_io_uring_submissions(bxl, ring);
+    RETURN_REAL_IO_URING(io_uring_submit_and_get_events, ring);
+})
+
+// Submits whatever was prepared before waiting, same as the functions above
+INTERPOSE(int, io_uring_wait_cqes, struct io_uring *ring, struct io_uring_cqe **cqe_ptr, unsigned wait_nr, struct __kernel_timespec *ts, sigset_t *sigmask)({
+    report_io_uring_submissions(bxl, ring);
+    RETURN_REAL_IO_URING(io_uring_wait_cqes, ring, cqe_ptr, wait_nr, ts, sigmask);
+})
+
 INTERPOSE(int, close, int fd) ({ 
     bxl->reset_fd_table_entry(fd);
     return bxl->fwd_close(fd).restore();
@@ -1356,11 +1801,14 @@ INTERPOSE(int, dup3, int oldfd, int newfd, int flags)({
 
 static void report_exit(int exitCode, void *args)
 {
+    BxlObserver::GetInstance()->SendStatistics();
     BxlObserver::GetInstance()->SendExitReport();
 }
 
-// invoked by the loader when our shared library is dynamically loaded into a new host process
-void __attribute__ ((constructor)) _bxl_linux_sandbox_init(void)
+// invoked by the loader when our shared library is dynamically loaded into a new host process.
+// glibc passes the arguments the process was executed with to the constructors, so the command line doesn't need to
+// be read back from /proc.
+void __attribute__ ((constructor)) _bxl_linux_sandbox_init(int argc, char **argv, char **envp)
 {
     // set up an on-exit handler
     on_exit(report_exit, NULL);
@@ -1369,7 +1817,7 @@ void __attribute__ ((constructor)) _bxl_linux_sandbox_init(void)
 
     // report that a new process has been created 
     BxlObserver::GetInstance()->report_access("__init__", ES_EVENT_TYPE_NOTIFY_EXEC, BxlObserver::GetInstance()->GetProgramPath());
-    BxlObserver::GetInstance()->report_exec_args(getpid());
+    BxlObserver::GetInstance()->report_exec_args(getpid(), argc, argv);
 }
 
 // ==========================
@@ -0,0 +1,204 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "fd_table.hpp"
+
+FdTable::~FdTable()
+{
+    // Intentionally not releasing any memory: the owner of the table is a singleton, and
+    // descriptors may still be resolved from exit handlers after it has been destroyed.
+    Disable();
+}
+
+bool FdTable::TryGet(int fd, std::string &path)
+{
+    if (!enabled_ || !mtx_.try_lock_for(std::chrono::milliseconds(1)))
+    {
+        return false;
+    }
+
+    bool found = false;
+    Block **slot = GetSlot(fd, /* allocatePage */ false);
+    if (slot != nullptr && *slot != nullptr)
+    {
+        path.assign((*slot)->GetPath(), (*slot)->length);
+        found = true;
+    }
+
+    mtx_.unlock();
+    return found;
+}
+
+void FdTable::Set(int fd, const char *path)
+{
+    size_t length = strlen(path);
+    if (length == 0 || !enabled_ || !mtx_.try_lock_for(std::chrono::milliseconds(1)))
+    {
+        return;
+    }
+
+    Block **slot = GetSlot(fd, /* allocatePage */ true);
+    if (slot != nullptr)
+    {
+        Block *block = *slot;
+        // Reuse the current block when the new path fits in it
+        if (block == nullptr || (MIN_BLOCK_SIZE << block->sizeClass) < sizeof(Block) + length + 1)
+        {
+            if (block != nullptr)
+            {
+                FreeBlock(block);
+            }
+
+            block = AllocateBlock(length);
+        }
+
+        if (block != nullptr)
+        {
+            memcpy(block->GetPath(), path, length);
+            block->GetPath()[length] = '\0';
+            block->length = (uint16_t)length;
+        }
+
+        *slot = block;
+    }
+
+    mtx_.unlock();
+}
+
+void FdTable::Reset(int fd)
+{
+    if (!enabled_ || fd < 0 || fd >= MAX_FD || pages_[fd >> PAGE_SHIFT] == nullptr)
+    {
+        return;
+    }
+
+    if (!mtx_.try_lock_for(std::chrono::milliseconds(100)))
+    {
+        // A stale entry is not acceptable
+        Disable();
+        return;
+    }
+
+    Block **slot = GetSlot(fd, /* allocatePage */ false);
+    if (slot != nullptr && *slot != nullptr)
+    {
+        FreeBlock(*slot);
+        *slot = nullptr;
+    }
+
+    mtx_.unlock();
+}
+
+void FdTable::Clear()
+{
+    if (!enabled_)
+    {
+        return;
+    }
+
+    if (!mtx_.try_lock_for(std::chrono::milliseconds(100)))
+    {
+        // A stale entry is not acceptable
+        Disable();
+        return;
+    }
+
+    for (int page = 0; page < PAGE_COUNT; page++)
+    {
+        if (pages_[page] == nullptr)
+        {
+            continue;
+        }
+
+        for (int i = 0; i < PAGE_SIZE; i++)
+        {
+            if (pages_[page][i] != nullptr)
+            {
+                FreeBlock(pages_[page][i]);
+                pages_[page][i] = nullptr;
+            }
+        }
+    }
+
+    mtx_.unlock();
+}
+
+// Assumes mtx_ is held by the caller
+FdTable::Block **FdTable::GetSlot(int fd, bool allocatePage)
+{
+    if (fd < 0 || fd >= MAX_FD)
+    {
+        return nullptr;
+    }
+
+    Block **&page = pages_[fd >> PAGE_SHIFT];
+    if (page == nullptr)
+    {
+        if (!allocatePage)
+        {
+            return nullptr;
+        }
+
+        page = (Block **)calloc(PAGE_SIZE, sizeof(Block *));
+        if (page == nullptr)
+        {
+            return nullptr;
+        }
+    }
+
+    return &page[fd & (PAGE_SIZE - 1)];
+}
+
+// Assumes mtx_ is held by the caller
+FdTable::Block *FdTable::AllocateBlock(size_t length)
+{
+    size_t required = sizeof(Block) + length + 1;
+    int sizeClass = 0;
+    while (sizeClass < SIZE_CLASS_COUNT && (MIN_BLOCK_SIZE << sizeClass) < required)
+    {
+        sizeClass++;
+    }
+
+    if (sizeClass == SIZE_CLASS_COUNT)
+    {
+        return nullptr;
+    }
+
+    Block *block = freeLists_[sizeClass];
+    if (block != nullptr)
+    {
+        freeLists_[sizeClass] = block->nextFree;
+        return block;
+    }
+
+    size_t blockSize = MIN_BLOCK_SIZE << sizeClass;
+    if (arenaRemaining_ < blockSize)
+    {
+        // The tail of the previous chunk (if any) is wasted, which is at most the size of the biggest block
+        arenaCurrent_ = (char *)malloc(ARENA_CHUNK_SIZE);
+        if (arenaCurrent_ == nullptr)
+        {
+            arenaRemaining_ = 0;
+            return nullptr;
+        }
+
+        arenaRemaining_ = ARENA_CHUNK_SIZE;
+    }
+
+    block = reinterpret_cast<Block *>(arenaCurrent_);
+    block->sizeClass = (uint16_t)sizeClass;
+    arenaCurrent_ += blockSize;
+    arenaRemaining_ -= blockSize;
+
+    return block;
+}
+
+// Assumes mtx_ is held by the caller
+void FdTable::FreeBlock(Block *block)
+{
+    block->nextFree = freeLists_[block->sizeClass];
+    freeLists_[block->sizeClass] = block;
+}
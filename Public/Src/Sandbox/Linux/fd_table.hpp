@@ -0,0 +1,83 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+
+/**
+ * Sparse table mapping file descriptors to paths.
+ *
+ * Slots are grouped in pages that are only allocated the first time a descriptor in their range is set, so
+ * high-numbered descriptors can be cached without paying for the whole range upfront. Paths are stored in
+ * size-classed blocks carved out of large arena chunks, and blocks released by Set/Reset/Clear are recycled
+ * through per-size-class free lists.
+ *
+ * This code may run from an interrupt routine or from who knows where, so operations never block indefinitely:
+ * lookups and insertions are skipped if the table lock can't be acquired promptly (callers treat that as a miss).
+ * Invalidations can't be skipped, so when one fails to acquire the lock the table disables itself for good.
+ */
+class FdTable final
+{
+public:
+    FdTable() = default;
+    ~FdTable();
+    FdTable(const FdTable&) = delete;
+    FdTable& operator = (const FdTable&) = delete;
+
+    // Descriptors at or above this value are never cached
+    static const int MAX_FD = 1 << 20;
+
+    // Copies the path associated with the given descriptor into 'path'. Returns false if there is none.
+    bool TryGet(int fd, std::string &path);
+
+    // Associates the given path with the given descriptor
+    void Set(int fd, const char *path);
+
+    // Removes the path associated with the given descriptor, if any
+    void Reset(int fd);
+
+    // Removes all the entries of the table
+    void Clear();
+
+    // Disables the table. Cannot be re-enabled afterwards.
+    void Disable() { enabled_ = false; }
+
+    bool IsEnabled() const { return enabled_; }
+
+private:
+    struct Block
+    {
+        // Only meaningful while the block is in a free list
+        Block *nextFree;
+        uint16_t sizeClass;
+        uint16_t length;
+
+        char *GetPath() { return reinterpret_cast<char *>(this + 1); }
+    };
+
+    static const int PAGE_SHIFT = 9;
+    static const int PAGE_SIZE = 1 << PAGE_SHIFT;
+    static const int PAGE_COUNT = MAX_FD / PAGE_SIZE;
+
+    // Block sizes are MIN_BLOCK_SIZE << sizeClass, which covers PATH_MAX plus the block header
+    static const size_t MIN_BLOCK_SIZE = 64;
+    static const int SIZE_CLASS_COUNT = 8;
+    static const size_t ARENA_CHUNK_SIZE = 64 * 1024;
+
+    std::atomic<bool> enabled_ { true };
+    std::timed_mutex mtx_;
+
+    Block **pages_[PAGE_COUNT] = {};
+    Block *freeLists_[SIZE_CLASS_COUNT] = {};
+    char *arenaCurrent_ = nullptr;
+    size_t arenaRemaining_ = 0;
+
+    Block *AllocateBlock(size_t length);
+    void FreeBlock(Block *block);
+    Block **GetSlot(int fd, bool allocatePage);
+};
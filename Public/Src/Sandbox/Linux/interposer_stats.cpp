@@ -0,0 +1,151 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "interposer_stats.hpp"
+
+std::atomic<bool> InterposerStats::s_enabled { false };
+std::atomic<int> InterposerStats::s_functionCount { 0 };
+const char *InterposerStats::s_functionNames[InterposerStats::MAX_FUNCTIONS] = {};
+std::atomic<InterposerStats::Block *> InterposerStats::s_blocks { nullptr };
+
+// The library is loaded at startup (LD_PRELOAD), so its TLS can live in the static TLS block
+static thread_local void *t_block __attribute__((tls_model("initial-exec"))) = nullptr;
+
+static const char *s_counterNames[InterposerStats::CounterCount] =
+{
+    "cacheHits",
+    "cacheMisses",
+    "resolvePathReadlinks",
+    "sends",
+    "sentBytes",
+    "deferredSends",
+    "stalledSends",
+    "sendStallNs",
+    "compressedSends",
+    "compressedInputBytes",
+};
+
+int InterposerStats::RegisterFunction(const char *name)
+{
+    int index = s_functionCount.fetch_add(1, std::memory_order_relaxed);
+    if (index >= MAX_FUNCTIONS)
+    {
+        s_functionCount.store(MAX_FUNCTIONS, std::memory_order_relaxed);
+        return -1;
+    }
+
+    s_functionNames[index] = name;
+    return index;
+}
+
+InterposerStats::Block *InterposerStats::GetBlock()
+{
+    Block *block = static_cast<Block *>(t_block);
+    if (block != nullptr)
+    {
+        return block;
+    }
+
+    // This code could possibly be executing from an interrupt routine or from who knows where,
+    // so do not fail if we can't allocate: the calls of this thread are just not recorded.
+    block = static_cast<Block *>(calloc(1, sizeof(Block)));
+    if (block == nullptr)
+    {
+        return nullptr;
+    }
+
+    // Blocks are never released: the statistics of threads that are gone still count
+    Block *head = s_blocks.load(std::memory_order_relaxed);
+    do
+    {
+        block->next = head;
+    } while (!s_blocks.compare_exchange_weak(head, block, std::memory_order_release, std::memory_order_relaxed));
+
+    t_block = block;
+    return block;
+}
+
+void InterposerStats::RecordCall(int function, uint64_t elapsedNs)
+{
+    Block *block = function >= 0 && function < MAX_FUNCTIONS ? GetBlock() : nullptr;
+    if (block == nullptr)
+    {
+        return;
+    }
+
+    int bucket = elapsedNs == 0 ? 0 : 63 - __builtin_clzll(elapsedNs);
+    if (bucket >= LATENCY_BUCKETS)
+    {
+        bucket = LATENCY_BUCKETS - 1;
+    }
+
+    Add<uint64_t>(block->calls[function], 1);
+    Add<uint32_t>(block->latencies[function][bucket], 1);
+}
+
+void InterposerStats::Increment(Counter counter, uint64_t value)
+{
+    Block *block = IsEnabled() ? GetBlock() : nullptr;
+    if (block != nullptr)
+    {
+        Add<uint64_t>(block->counters[counter], value);
+    }
+}
+
+void InterposerStats::Format(std::string &result)
+{
+    char buffer[64];
+    Block *head = s_blocks.load(std::memory_order_acquire);
+
+    for (int counter = 0; counter < CounterCount; counter++)
+    {
+        uint64_t total = 0;
+        for (Block *block = head; block != nullptr; block = block->next)
+        {
+            total += block->counters[counter].load(std::memory_order_relaxed);
+        }
+
+        snprintf(buffer, sizeof(buffer), "%s%s=%llu", counter == 0 ? "" : " ", s_counterNames[counter], (unsigned long long)total);
+        result.append(buffer);
+    }
+
+    result.append(";");
+
+    int functionCount = s_functionCount.load(std::memory_order_relaxed);
+    for (int function = 0; function < functionCount && function < MAX_FUNCTIONS; function++)
+    {
+        uint64_t calls = 0;
+        uint64_t latencies[LATENCY_BUCKETS] = {};
+        for (Block *block = head; block != nullptr; block = block->next)
+        {
+            calls += block->calls[function].load(std::memory_order_relaxed);
+            for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+            {
+                latencies[bucket] += block->latencies[function][bucket].load(std::memory_order_relaxed);
+            }
+        }
+
+        if (calls == 0 || s_functionNames[function] == nullptr)
+        {
+            continue;
+        }
+
+        snprintf(buffer, sizeof(buffer), " %s calls=%llu log2ns=", s_functionNames[function], (unsigned long long)calls);
+        result.append(buffer);
+
+        bool first = true;
+        for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+        {
+            if (latencies[bucket] != 0)
+            {
+                snprintf(buffer, sizeof(buffer), "%s%d:%llu", first ? "" : ",", bucket, (unsigned long long)latencies[bucket]);
+                result.append(buffer);
+                first = false;
+            }
+        }
+
+        result.append(";");
+    }
+}
@@ -0,0 +1,109 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <string>
+
+/**
+ * Per-process statistics of the interposer: call counts and log2 latency histograms of every interposed function,
+ * plus a few counters of the work done on their behalf (cache lookups, readlinks while resolving paths, reports sent).
+ *
+ * Each thread records into its own block (allocated the first time the thread records anything), so recording is a
+ * couple of uncontended stores. Blocks are linked in a global list, and Format aggregates all of them; that normally
+ * happens once, when the process exits. Nothing is collected unless Enable was called.
+ */
+class InterposerStats final
+{
+public:
+    enum Counter
+    {
+        CacheHits,
+        CacheMisses,
+        ResolvePathReadlinks,
+        Sends,
+        SentBytes,
+        // Report buffers that went to the backlog because the FIFO was full (see BxlObserver::FlushReportBuffer)
+        DeferredSends,
+        // Writes that had to wait for the reader of a full FIFO, and the time they waited
+        StalledSends,
+        SendStallNs,
+        // Sends written as a compressed frame (see BxlObserver::CompressBatch), and the bytes they held before compression
+        CompressedSends,
+        CompressedInputBytes,
+        CounterCount
+    };
+
+    // Interposed functions beyond this one are not tracked
+    static const int MAX_FUNCTIONS = 192;
+
+    // Bucket i counts the calls that took [2^i, 2^(i+1)) ns, the last bucket also counts everything slower
+    static const int LATENCY_BUCKETS = 28;
+
+    InterposerStats() = delete;
+
+    static void Enable() { s_enabled.store(true, std::memory_order_relaxed); }
+    static bool IsEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+
+    // Returns a stable index for the given function name (which must be a literal), or -1 when there is no room left
+    static int RegisterFunction(const char *name);
+
+    static void RecordCall(int function, uint64_t elapsedNs);
+    static void Increment(Counter counter, uint64_t value = 1);
+
+    // Appends the aggregated statistics of all threads to 'result'. Each function that was called is formatted as
+    // '<name> calls=<count> log2ns=<bucket>:<count>,...;' after a header with the counters.
+    static void Format(std::string &result);
+
+    static uint64_t NowNs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+    // Records the call and the latency of the enclosing interposed function
+    class Scope final
+    {
+    public:
+        Scope(int function) : function_(IsEnabled() ? function : -1), start_(function_ != -1 ? NowNs() : 0) { }
+        ~Scope()
+        {
+            if (function_ != -1)
+            {
+                RecordCall(function_, NowNs() - start_);
+            }
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator = (const Scope&) = delete;
+
+    private:
+        int function_;
+        uint64_t start_;
+    };
+
+private:
+    struct Block
+    {
+        // Only the owning thread writes, other threads only read (when formatting)
+        std::atomic<uint64_t> calls[MAX_FUNCTIONS];
+        std::atomic<uint32_t> latencies[MAX_FUNCTIONS][LATENCY_BUCKETS];
+        std::atomic<uint64_t> counters[CounterCount];
+        Block *next;
+    };
+
+    static std::atomic<bool> s_enabled;
+    static std::atomic<int> s_functionCount;
+    static const char *s_functionNames[MAX_FUNCTIONS];
+    static std::atomic<Block *> s_blocks;
+
+    static Block *GetBlock();
+
+    template <typename T>
+    static void Add(std::atomic<T> &value, T delta) { value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed); }
+};
@@ -5,6 +5,74 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <elf.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// A successful resolution of a filename against a given PATH
+typedef struct
+{
+    std::string envPath;
+    size_t entryIndex;
+    std::string path;
+} PathLookup;
+
+// filename + ':' + hash of PATH -> PathLookup. The lock is only held to copy an entry in or out, and only tried: a child
+// forked while another thread held it would otherwise block forever on its first exec.
+static std::mutex s_pathLookupsLock;
+static std::unordered_map<std::string, PathLookup> s_pathLookups;
+
+// Same as the stat in check_if_path_exists, except it doesn't go through the interposed function (so nothing gets reported)
+static mode_t get_mode_unobserved(const std::string &path)
+{
+    struct stat buf;
+    return syscall(SYS_newfstatat, AT_FDCWD, path.c_str(), &buf, AT_SYMLINK_NOFOLLOW) == 0 ? buf.st_mode : 0;
+}
+
+static void split_env_path(const std::string &envPath, std::vector<std::string> &entries)
+{
+    size_t start = 0;
+    while (true)
+    {
+        size_t pos = envPath.find(':', start);
+        if (pos == std::string::npos)
+        {
+            entries.push_back(envPath.substr(start));
+            return;
+        }
+
+        entries.push_back(envPath.substr(start, pos - start));
+        start = pos + 1; /*+1 to account for the delimiter ':'*/
+    }
+}
+
+// Whether the lookup of the filename previously resolved to 'lookup' still does. The probes of the PATH entries that
+// precede the one it was found in got reported by the resolution that cached it, so they are repeated without reporting them.
+static bool try_reuse_lookup(const PathLookup &lookup, const std::vector<std::string> &entries, const char *filename, mode_t &mode, std::string &path)
+{
+    for (size_t i = 0; i < lookup.entryIndex; i++)
+    {
+        if (get_mode_unobserved(entries[i] + "/" + filename) != 0)
+        {
+            // something showed up earlier in the PATH since
+            return false;
+        }
+    }
+
+    mode = get_mode_unobserved(lookup.path);
+    if (mode == 0)
+    {
+        return false;
+    }
+
+    path = lookup.path;
+    return true;
+}
 
 bool resolve_filename_with_env(const char *filename, mode_t &mode, std::string &path)
 {
@@ -28,30 +96,48 @@ bool resolve_filename_with_env(const char *filename, mode_t &mode, std::string &
     }
 
     std::string env_path_str(env_path);
-    size_t pos = 0;
-    size_t start = 0;
-    std::string root_path;
+    std::vector<std::string> entries;
+    split_env_path(env_path_str, entries);
 
-    while (true)
+    // Processes that exec over and over (e.g., a script running sed, grep and awk) would otherwise probe every PATH entry
+    // through the interposed stat every time
+    std::string key = std::string(filename) + ":" + std::to_string(std::hash<std::string>{}(env_path_str));
+    PathLookup lookup;
+    bool found = false;
     {
-        pos = env_path_str.find(':', start);
-
-        if (pos == std::string::npos)
+        std::unique_lock<std::mutex> lock(s_pathLookupsLock, std::try_to_lock);
+        if (lock.owns_lock())
         {
-            break;
+            auto cached = s_pathLookups.find(key);
+            if (cached != s_pathLookups.end() && cached->second.envPath == env_path_str)
+            {
+                lookup = cached->second;
+                found = true;
+            }
         }
+    }
 
-        root_path = env_path_str.substr(start, pos-start);
-        start = pos + 1; /*+1 to account for the delimiter ':'*/
+    // Probed with the lock released
+    if (found && try_reuse_lookup(lookup, entries, filename, mode, path))
+    {
+        return true;
+    }
 
-        if (check_if_path_exists(root_path, filename, path, mode))
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        if (check_if_path_exists(entries[i], filename, path, mode))
         {
+            std::unique_lock<std::mutex> lock(s_pathLookupsLock, std::try_to_lock);
+            if (lock.owns_lock())
+            {
+                s_pathLookups[key] = { env_path_str, i, path };
+            }
+
             return true;
         }
     }
 
-    root_path = env_path_str.substr(start);
-    return check_if_path_exists(root_path, filename, path, mode);
+    return false;
 }
 
 bool check_if_path_exists(std::string root, std::string filename, std::string &path, mode_t &mode)
@@ -105,3 +191,136 @@ void parse_variadic_args(const char *arg, ptrdiff_t argc, va_list args, char **a
         argv[i] = va_arg(args, char *);
     }
 }
+
+template<typename Ehdr, typename Phdr, typename Dyn>
+static ElfLinkage get_elf_linkage_for_class(const unsigned char *image, size_t size)
+{
+    if (size < sizeof(Ehdr))
+    {
+        return ElfLinkage::Unknown;
+    }
+
+    const Ehdr *ehdr = reinterpret_cast<const Ehdr *>(image);
+    if (ehdr->e_phnum == 0)
+    {
+        return ElfLinkage::NotElf;
+    }
+
+    if (ehdr->e_phentsize != sizeof(Phdr) || ehdr->e_phoff > size || (size - ehdr->e_phoff) / sizeof(Phdr) < ehdr->e_phnum)
+    {
+        return ElfLinkage::Unknown;
+    }
+
+    const Phdr *phdrs = reinterpret_cast<const Phdr *>(image + ehdr->e_phoff);
+    const Phdr *dynamic = nullptr;
+    for (int i = 0; i < ehdr->e_phnum; i++)
+    {
+        if (phdrs[i].p_type == PT_DYNAMIC)
+        {
+            dynamic = &phdrs[i];
+            break;
+        }
+    }
+
+    // No dynamic section at all
+    if (dynamic == nullptr)
+    {
+        return ElfLinkage::Static;
+    }
+
+    if (dynamic->p_offset > size || size - dynamic->p_offset < dynamic->p_filesz)
+    {
+        return ElfLinkage::Unknown;
+    }
+
+    const Dyn *dyns = reinterpret_cast<const Dyn *>(image + dynamic->p_offset);
+    size_t dynCount = dynamic->p_filesz / sizeof(Dyn);
+
+    // The string table is referenced by its virtual address, which needs to be translated into a file offset
+    uint64_t strtabAddress = 0, strtabSize = 0;
+    bool hasNeeded = false;
+    for (size_t i = 0; i < dynCount && dyns[i].d_tag != DT_NULL; i++)
+    {
+        switch (dyns[i].d_tag)
+        {
+            case DT_STRTAB: strtabAddress = dyns[i].d_un.d_ptr; break;
+            case DT_STRSZ:  strtabSize = dyns[i].d_un.d_val; break;
+            case DT_NEEDED: hasNeeded = true; break;
+        }
+    }
+
+    if (!hasNeeded)
+    {
+        return ElfLinkage::Static;
+    }
+
+    uint64_t strtabOffset = 0;
+    bool strtabFound = false;
+    for (int i = 0; i < ehdr->e_phnum; i++)
+    {
+        if (phdrs[i].p_type == PT_LOAD && strtabAddress >= phdrs[i].p_vaddr && strtabAddress - phdrs[i].p_vaddr < phdrs[i].p_filesz)
+        {
+            strtabOffset = strtabAddress - phdrs[i].p_vaddr + phdrs[i].p_offset;
+            strtabFound = true;
+            break;
+        }
+    }
+
+    if (!strtabFound || strtabOffset > size || size - strtabOffset < strtabSize)
+    {
+        return ElfLinkage::Unknown;
+    }
+
+    const char *strtab = reinterpret_cast<const char *>(image + strtabOffset);
+    const char libcPrefix[] = "libc.so.";
+    for (size_t i = 0; i < dynCount && dyns[i].d_tag != DT_NULL; i++)
+    {
+        if (dyns[i].d_tag != DT_NEEDED)
+        {
+            continue;
+        }
+
+        uint64_t nameOffset = dyns[i].d_un.d_val;
+        if (nameOffset >= strtabSize)
+        {
+            return ElfLinkage::Unknown;
+        }
+
+        if (strnlen(strtab + nameOffset, strtabSize - nameOffset) >= sizeof(libcPrefix) - 1 &&
+            strncmp(strtab + nameOffset, libcPrefix, sizeof(libcPrefix) - 1) == 0)
+        {
+            return ElfLinkage::Dynamic;
+        }
+    }
+
+    return ElfLinkage::Static;
+}
+
+ElfLinkage get_elf_linkage(const unsigned char *image, size_t size)
+{
+    if (image == nullptr || size < EI_NIDENT || memcmp(image, ELFMAG, SELFMAG) != 0)
+    {
+        return ElfLinkage::NotElf;
+    }
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+    const unsigned char hostData = ELFDATA2LSB;
+#else
+    const unsigned char hostData = ELFDATA2MSB;
+#endif
+
+    if (image[EI_DATA] != hostData)
+    {
+        return ElfLinkage::Unknown;
+    }
+
+    switch (image[EI_CLASS])
+    {
+        case ELFCLASS64:
+            return get_elf_linkage_for_class<Elf64_Ehdr, Elf64_Phdr, Elf64_Dyn>(image, size);
+        case ELFCLASS32:
+            return get_elf_linkage_for_class<Elf32_Ehdr, Elf32_Phdr, Elf32_Dyn>(image, size);
+        default:
+            return ElfLinkage::Unknown;
+    }
+}
@@ -5,11 +5,14 @@
 
 #include <sys/stat.h>
 #include <string>
+#include <string_view>
 #include <stdarg.h>
 #include <cstddef>
 
 // Resolves a provided filename against the environment by checking if it exists by using stat
 // This closely follows the logic used by glibc: https://codebrowser.dev/glibc/glibc/posix/execvpe.c.html
+// Successful resolutions are cached for the lifetime of the process (per filename and PATH): a cached resolution is still
+// checked against the file system every time, but the probes that were reported already are not reported again.
 bool resolve_filename_with_env(const char *filename, mode_t &mode, std::string &path);
 
 // Appends filename to root, checks if it exists by calling stat and then sets path if it does exist
@@ -21,4 +24,76 @@ bool check_if_path_exists(std::string root, std::string filename, std::string &p
 ptrdiff_t get_variadic_argc(va_list args);
 
 // Given a va_list and an argument count, parse arguments into argv
-void parse_variadic_args(const char *arg, ptrdiff_t argc, va_list args, char **argv);
\ No newline at end of file
+void parse_variadic_args(const char *arg, ptrdiff_t argc, va_list args, char **argv);
+
+// Result of inspecting an ELF image with get_elf_linkage
+enum class ElfLinkage
+{
+    // Not an ELF file, or an ELF file without program headers (e.g., an object file)
+    NotElf,
+    // An executable ELF file that does not depend on libc.so.* (directly, through DT_NEEDED)
+    Static,
+    // An executable ELF file that depends on libc.so.*
+    Dynamic,
+    // The image could not be interpreted (e.g., it is truncated or its byte order does not match the host)
+    Unknown
+};
+
+// Determines whether the given in-memory ELF image depends on libc by inspecting its PT_DYNAMIC segment.
+// This mirrors what 'objdump -p' reports: an image with program headers and no 'NEEDED libc.so.*' entry is considered static.
+ElfLinkage get_elf_linkage(const unsigned char *image, size_t size);
+
+// What get_pseudo_file_system tells a path apart as. Values are bits, so a set of them fits in a mask.
+enum PseudoFileSystem : unsigned int
+{
+    PseudoFileSystemNone = 0,
+    PseudoFileSystemProc = 1 << 0,
+    PseudoFileSystemDev = 1 << 1,
+    PseudoFileSystemSys = 1 << 2,
+    // The paths read for descriptors that are no files: pipes, sockets, anonymous inodes and memfd files
+    PseudoFileSystemAnonymous = 1 << 3
+};
+
+// Classifies a raw path by its prefix alone, before anything resolves it or looks at the file system. A path under /proc,
+// /dev or /sys is only classified when it can't lead out of there once resolved: '..' components, the magic links of /proc
+// (the fd, cwd, root, exe and map_files of a process) and /dev/fd and /dev/std* (links into /proc/self/fd) leave it unclassified.
+constexpr PseudoFileSystem get_pseudo_file_system(std::string_view path)
+{
+    constexpr auto startsWith = [](std::string_view path, std::string_view prefix) { return path.substr(0, prefix.size()) == prefix; };
+    constexpr auto isUnder = [](std::string_view path, std::string_view root)
+    {
+        return path.substr(0, root.size()) == root && (path.size() == root.size() || path[root.size()] == '/');
+    };
+
+    if (startsWith(path, "pipe:") || startsWith(path, "socket:") || startsWith(path, "anon_inode:") || startsWith(path, "/memfd:"))
+    {
+        return PseudoFileSystemAnonymous;
+    }
+
+    PseudoFileSystem fileSystem = isUnder(path, "/proc") ? PseudoFileSystemProc
+        : isUnder(path, "/dev") ? PseudoFileSystemDev
+        : isUnder(path, "/sys") ? PseudoFileSystemSys
+        : PseudoFileSystemNone;
+
+    if (fileSystem == PseudoFileSystemNone || path.find("/..") != std::string_view::npos)
+    {
+        return PseudoFileSystemNone;
+    }
+
+    if (fileSystem == PseudoFileSystemProc)
+    {
+        for (std::string_view link : { "/fd/", "/cwd", "/root", "/exe", "/map_files/" })
+        {
+            if (path.find(link) != std::string_view::npos)
+            {
+                return PseudoFileSystemNone;
+            }
+        }
+    }
+    else if (fileSystem == PseudoFileSystemDev && (isUnder(path, "/dev/fd") || startsWith(path, "/dev/std")))
+    {
+        return PseudoFileSystemNone;
+    }
+
+    return fileSystem;
+}
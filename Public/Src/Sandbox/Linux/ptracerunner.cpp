@@ -37,9 +37,10 @@ int main(int argc, char **argv)
     pid_t traceepid;
     std::string exe;
     std::string semaphoreName = "/";
+    bool persistent = false;
     
     // Parse arguments
-    while((opt = getopt(argc, argv, "cx")) != -1)
+    while((opt = getopt(argc, argv, "cxp")) != -1)
     {
         switch (opt)
         {
@@ -51,6 +52,10 @@ int main(int argc, char **argv)
                 // -x <path to statically linked executable>
                 exe = std::string(argv[optind]);
                 break;
+            case 'p':
+                // -p: keep tracing the further process trees of the pip requested through stdin (see PTraceSandbox::AttachToProcess)
+                persistent = true;
+                break;
         }
     }
 
@@ -72,7 +77,11 @@ int main(int argc, char **argv)
 
     semaphoreName.append(std::to_string(traceepid));
 
-    sandbox.AttachToProcess(traceepid, exe, semaphoreName);
+    sandbox.AttachToProcess(traceepid, exe, semaphoreName, persistent ? STDIN_FILENO : -1);
+
+    // The tracer reports on behalf of its tracees, so it holds their counters (e.g., of the sampled observation mode)
+    bxl->SendStatistics();
+    bxl->FlushReports();
 
     _exit(0);
 }
\ No newline at end of file
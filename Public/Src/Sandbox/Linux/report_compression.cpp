@@ -0,0 +1,234 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <string.h>
+
+#include "report_compression.hpp"
+
+// LZ4 block format constants: matches are at least MIN_MATCH bytes long, the last LAST_LITERALS bytes of a block are
+// always literals, and no match starts within the last MATCH_FIND_LIMIT bytes
+static const size_t MIN_MATCH = 4;
+static const size_t LAST_LITERALS = 5;
+static const size_t MATCH_FIND_LIMIT = 12;
+
+// Batches are at most PIPE_BUF bytes, so a small table (kept on the stack) finds most matches
+static const int HASH_LOG = 10;
+
+static inline uint32_t Read32(const uint8_t *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t Hash(uint32_t sequence)
+{
+    return (sequence * 2654435761U) >> (32 - HASH_LOG);
+}
+
+// Writes the continuation bytes of a length that did not fit in its 4 bits of the token
+static inline bool WriteLength(uint8_t *&out, const uint8_t *outEnd, size_t length)
+{
+    for (; length >= 255; length -= 255)
+    {
+        if (out == outEnd)
+        {
+            return false;
+        }
+
+        *out++ = 255;
+    }
+
+    if (out == outEnd)
+    {
+        return false;
+    }
+
+    *out++ = (uint8_t)length;
+    return true;
+}
+
+// Writes a sequence: the literals, then the match (none for the last sequence of the block)
+static bool WriteSequence(uint8_t *&out, const uint8_t *outEnd, const uint8_t *literals, size_t literalLength, size_t offset, size_t matchLength)
+{
+    if (out == outEnd)
+    {
+        return false;
+    }
+
+    uint8_t *token = out++;
+    *token = (uint8_t)((literalLength >= 15 ? 15 : literalLength) << 4);
+    if (literalLength >= 15 && !WriteLength(out, outEnd, literalLength - 15))
+    {
+        return false;
+    }
+
+    if ((size_t)(outEnd - out) < literalLength)
+    {
+        return false;
+    }
+
+    memcpy(out, literals, literalLength);
+    out += literalLength;
+
+    if (matchLength == 0)
+    {
+        return true;
+    }
+
+    if (outEnd - out < 2)
+    {
+        return false;
+    }
+
+    *out++ = (uint8_t)offset;
+    *out++ = (uint8_t)(offset >> 8);
+
+    matchLength -= MIN_MATCH;
+    *token |= (uint8_t)(matchLength >= 15 ? 15 : matchLength);
+    return matchLength < 15 || WriteLength(out, outEnd, matchLength - 15);
+}
+
+size_t ReportCompression::Compress(const char *source, size_t sourceSize, char *destination, size_t capacity)
+{
+    if (sourceSize > MAX_BLOCK_SIZE)
+    {
+        return 0;
+    }
+
+    const uint8_t *src = reinterpret_cast<const uint8_t *>(source);
+    uint8_t *out = reinterpret_cast<uint8_t *>(destination);
+    const uint8_t *outEnd = out + capacity;
+
+    // Positions of the last 4-byte sequences seen, by hash. Stale or colliding entries are caught by comparing the bytes.
+    uint16_t table[1 << HASH_LOG] = {};
+
+    size_t anchor = 0;
+    size_t position = 0;
+    size_t matchStartLimit = sourceSize > MATCH_FIND_LIMIT ? sourceSize - MATCH_FIND_LIMIT : 0;
+    while (position < matchStartLimit)
+    {
+        uint32_t sequence = Read32(src + position);
+        uint32_t hash = Hash(sequence);
+        size_t candidate = table[hash];
+        table[hash] = (uint16_t)position;
+
+        if (candidate >= position || Read32(src + candidate) != sequence)
+        {
+            position++;
+            continue;
+        }
+
+        // Extend the match forwards (up to the literals that end the block) and backwards (down to the pending literals)
+        size_t matchEnd = position + MIN_MATCH;
+        size_t matchEndLimit = sourceSize - LAST_LITERALS;
+        while (matchEnd < matchEndLimit && src[matchEnd] == src[candidate + matchEnd - position])
+        {
+            matchEnd++;
+        }
+
+        while (position > anchor && candidate > 0 && src[position - 1] == src[candidate - 1])
+        {
+            position--;
+            candidate--;
+        }
+
+        if (!WriteSequence(out, outEnd, src + anchor, position - anchor, position - candidate, matchEnd - position))
+        {
+            return 0;
+        }
+
+        position = matchEnd;
+        anchor = position;
+    }
+
+    if (!WriteSequence(out, outEnd, src + anchor, sourceSize - anchor, /* offset */ 0, /* matchLength */ 0))
+    {
+        return 0;
+    }
+
+    return out - reinterpret_cast<uint8_t *>(destination);
+}
+
+ssize_t ReportCompression::Decompress(const char *source, size_t sourceSize, char *destination, size_t capacity)
+{
+    const uint8_t *in = reinterpret_cast<const uint8_t *>(source);
+    const uint8_t *inEnd = in + sourceSize;
+    uint8_t *out = reinterpret_cast<uint8_t *>(destination);
+    uint8_t *outStart = out;
+    const uint8_t *outEnd = out + capacity;
+
+    auto readLength = [&](size_t length, size_t &result)
+    {
+        result = length;
+        if (length != 15)
+        {
+            return true;
+        }
+
+        uint8_t next;
+        do
+        {
+            if (in == inEnd)
+            {
+                return false;
+            }
+
+            next = *in++;
+            result += next;
+        } while (next == 255);
+
+        return true;
+    };
+
+    while (in < inEnd)
+    {
+        uint8_t token = *in++;
+
+        size_t literalLength;
+        if (!readLength(token >> 4, literalLength) ||
+            (size_t)(inEnd - in) < literalLength ||
+            (size_t)(outEnd - out) < literalLength)
+        {
+            return -1;
+        }
+
+        memcpy(out, in, literalLength);
+        in += literalLength;
+        out += literalLength;
+
+        // The last sequence has no match
+        if (in == inEnd)
+        {
+            break;
+        }
+
+        if (inEnd - in < 2)
+        {
+            return -1;
+        }
+
+        size_t offset = in[0] | (in[1] << 8);
+        in += 2;
+
+        size_t matchLength;
+        if (offset == 0 ||
+            offset > (size_t)(out - outStart) ||
+            !readLength(token & 15, matchLength) ||
+            (size_t)(outEnd - out) < matchLength + MIN_MATCH)
+        {
+            return -1;
+        }
+
+        // Matches may overlap with what they produce, so this copies byte by byte
+        const uint8_t *match = out - offset;
+        for (size_t i = 0; i < matchLength + MIN_MATCH; i++)
+        {
+            out[i] = match[i];
+        }
+
+        out += matchLength + MIN_MATCH;
+    }
+
+    return out - outStart;
+}
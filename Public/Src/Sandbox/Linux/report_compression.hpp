@@ -0,0 +1,47 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Compression of the batches of reports written to the report FIFO, for pips whose reports cross a network hop before
+ * they reach BuildXL (e.g., under a remoting or virtualization layer).
+ *
+ * A batch is the content of a single write (at most PIPE_BUF bytes, so writes from different processes never interleave),
+ * which makes every compressed frame self-contained: the reader decompresses each one on its own and no state is carried
+ * between them. A frame is written in place of the messages it holds, with this layout:
+ *
+ *     uint32 COMPRESSED_FRAME_FLAG | compressed size
+ *     uint32 uncompressed size
+ *     byte[compressed size] the messages of the batch (each one a uint32 length and the message), as an LZ4 block
+ *
+ * The first word takes the place of the length of a message, which is never that large. Blocks follow the LZ4 block
+ * format, so any LZ4 decoder can read them.
+ *
+ * CODESYNC: Public/Src/Engine/Processes/Lz4BlockDecoder.cs, Public/Src/Engine/Processes/SandboxConnectionLinuxDetours.cs
+ */
+class ReportCompression final
+{
+public:
+    ReportCompression() = delete;
+
+    static const uint32_t COMPRESSED_FRAME_FLAG = 0x40000000;
+    static const size_t FRAME_HEADER_SIZE = 2 * sizeof(uint32_t);
+
+    // Batches smaller than this are hardly worth compressing (a single report of a short path)
+    static const size_t MIN_BATCH_SIZE = 256;
+
+    // Offsets of LZ4 matches take 16 bits
+    static const size_t MAX_BLOCK_SIZE = 65535;
+
+    // Compresses 'source' into an LZ4 block, returning its size, or 0 if it does not fit in 'capacity' bytes
+    // (or 'source' is larger than MAX_BLOCK_SIZE). Takes no locks and does no heap allocations.
+    static size_t Compress(const char *source, size_t sourceSize, char *destination, size_t capacity);
+
+    // Decompresses an LZ4 block, returning its uncompressed size, or -1 if the block is malformed or does not fit in 'capacity' bytes
+    static ssize_t Decompress(const char *source, size_t sourceSize, char *destination, size_t capacity);
+};
@@ -0,0 +1,99 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "shared_access_cache.hpp"
+
+// Two unrelated 64-bit hashes (FNV-1a and a multiplicative mix) of (event, executable, path). Neither is ever 0, which marks free slots.
+static void HashAccess(uint64_t mountNamespace, uint64_t scopeGeneration, uint32_t event, std::string_view executable, std::string_view path, uint64_t &hash, uint64_t &secondHash)
+{
+    uint64_t h1 = (14695981039346656037ULL ^ (uint64_t)event) ^ (mountNamespace * 0xC2B2AE3D27D4EB4FULL) ^ (scopeGeneration * 0x165667B19E3779F9ULL);
+    uint64_t h2 = 0x9E3779B97F4A7C15ULL * ((uint64_t)event + 1) + mountNamespace + (scopeGeneration << 32 | scopeGeneration >> 32);
+
+    auto mix = [&](std::string_view value)
+    {
+        for (char c : value)
+        {
+            h1 ^= (unsigned char)c;
+            h1 *= 1099511628211ULL;
+
+            h2 = (h2 ^ (unsigned char)c) * 0xFF51AFD7ED558CCDULL;
+            h2 ^= h2 >> 32;
+        }
+
+        // Separator, so (executable, path) pairs can't be confused with each other
+        h1 *= 1099511628211ULL;
+        h2 = (h2 + 0x9E3779B97F4A7C15ULL) * 0xC4CEB9FE1A85EC53ULL;
+    };
+
+    mix(executable);
+    mix(path);
+
+    hash = h1 | 1;
+    secondHash = h2 | 1;
+}
+
+bool SharedAccessCache::Attach(void *image, size_t size, bool initialize)
+{
+    if (image == nullptr || size < GetImageSize())
+    {
+        return false;
+    }
+
+    Header *header = reinterpret_cast<Header *>(image);
+    if (initialize)
+    {
+        // The image is expected to be zeroed (e.g., a freshly truncated file), so only the header needs to be written.
+        // The magic goes last: it is what tells other processes the table is ready.
+        header->slotCount = SLOT_COUNT;
+        header->magic.store(MAGIC, std::memory_order_release);
+    }
+    else if (header->magic.load(std::memory_order_acquire) != MAGIC || header->slotCount != SLOT_COUNT)
+    {
+        return false;
+    }
+
+    slots_ = reinterpret_cast<Slot *>(header + 1);
+    return true;
+}
+
+bool SharedAccessCache::Check(uint32_t event, std::string_view executable, std::string_view path, bool addEntryIfMissing, uint64_t scopeGeneration)
+{
+    if (slots_ == nullptr)
+    {
+        return false;
+    }
+
+    uint64_t hash, secondHash;
+    HashAccess(mountNamespace_.load(std::memory_order_relaxed), scopeGeneration, event, executable, path, hash, secondHash);
+
+    for (size_t probe = 0; probe < MAX_PROBES; probe++)
+    {
+        Slot &slot = slots_[(hash + probe) & (SLOT_COUNT - 1)];
+        uint64_t current = slot.hash.load(std::memory_order_acquire);
+
+        if (current == 0)
+        {
+            if (!addEntryIfMissing)
+            {
+                // Slots are never released, so the access can't be further down the probe sequence
+                return false;
+            }
+
+            if (slot.hash.compare_exchange_strong(current, hash, std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                slot.secondHash.store(secondHash, std::memory_order_release);
+                return false;
+            }
+
+            // Some process claimed this slot in the meantime: check it below
+        }
+
+        if (current == hash && slot.secondHash.load(std::memory_order_acquire) == secondHash)
+        {
+            return true;
+        }
+    }
+
+    // The probe sequence is exhausted: the access is not cached (and won't be)
+    return false;
+}
@@ -0,0 +1,70 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <string_view>
+
+/**
+ * Dedup table of the accesses that were already reported, shared by all the processes of a pip.
+ *
+ * The table lives in a file that every process of the pip maps: the root process creates it and its descendants map
+ * the existing one, so an access reported by a process is not reported again by the ones that come after it (even
+ * across exec). The image is mapped at a different address in each process, so slots hold no pointers: a key is a pair
+ * of independent 64-bit hashes of (mount namespace, event, executable, path, scope generation). Keys include the executable so
+ * that accesses keep being reported at least once per executable, which is what executable-based file access allowlists look at,
+ * the mount namespace because the same path can name different files in processes of the pip that run in containers, and the
+ * generation of the last manifest update that changed a scope of the path, so accesses are checked again once their policy changes.
+ *
+ * Like the in-process cache, this is an insert-only, open addressing table: slots are claimed with a compare-and-swap
+ * on the first hash and never released. A slot whose second hash is not published yet is treated as a miss, which is
+ * always safe (the access just gets reported again).
+ */
+class SharedAccessCache final
+{
+public:
+    SharedAccessCache() = default;
+    SharedAccessCache(const SharedAccessCache&) = delete;
+    SharedAccessCache& operator = (const SharedAccessCache&) = delete;
+
+    // Size of the image backing the table
+    static size_t GetImageSize() { return sizeof(Header) + SLOT_COUNT * sizeof(Slot); }
+
+    // Attaches the table to a (shared) image of GetImageSize() bytes. The process that creates the image initializes it,
+    // the others validate it. The image must outlive this object. Returns false if the image can't be used.
+    bool Attach(void *image, size_t size, bool initialize);
+
+    bool IsEnabled() const { return slots_ != nullptr; }
+
+    // Sets the mount namespace (its inode number) of the calling process, which is part of every key checked afterwards
+    void SetMountNamespace(uint64_t mountNamespace) { mountNamespace_.store(mountNamespace, std::memory_order_relaxed); }
+
+    // Checks whether the table contains the given access. If it does not and addEntryIfMissing is true, attempts to add it.
+    // scopeGeneration is the generation of the last manifest update that changed a scope of the path (0 if none did).
+    bool Check(uint32_t event, std::string_view executable, std::string_view path, bool addEntryIfMissing, uint64_t scopeGeneration = 0);
+
+private:
+    // Must change whenever the layout of the image changes
+    static const uint64_t MAGIC = 0x3165686361637862ULL; // "bxcache1"
+
+    static const size_t SLOT_COUNT = 1 << 16; // must be a power of 2
+    static const size_t MAX_PROBES = 32;
+
+    struct Header
+    {
+        std::atomic<uint64_t> magic;
+        uint64_t slotCount;
+    };
+
+    struct Slot
+    {
+        std::atomic<uint64_t> hash;
+        std::atomic<uint64_t> secondHash;
+    };
+
+    Slot *slots_ = nullptr;
+    std::atomic<uint64_t> mountNamespace_ { 0 };
+};
@@ -410,6 +410,179 @@ char** remove_path_from_LDPRELOAD(const char *const envp[], const char *path)
     return (char**)envp;
 }
 
+// Returns whether 'value' is one of the colon-separated values in 'values'
+static bool contains_value(const char *values, const char *value)
+{
+    while (*values)
+    {
+        const char *next = skip_prefix(values, value);
+        if (next && (*next == '\0' || *next == PATH_SEP_CHAR))
+        {
+            return true;
+        }
+
+        if (next == NULL) next = values;
+        while (*next != '\0' && *next != PATH_SEP_CHAR) next++;
+
+        if (*next == '\0')
+        {
+            break;
+        }
+
+        values = next + 1;
+    }
+
+    return false;
+}
+
+// Returns the value of 'kvp' if its name is exactly 'name'; otherwise returns NULL
+static const char* get_value_if_named(const char *kvp, const char *name)
+{
+    const char *value = skip_prefix(kvp, name);
+    return value && *value == '=' ? value + 1 : NULL;
+}
+
+char** rewrite_env(const char *const envp[], const char *ldPreloadPath, bool addLdPreloadPath, const char *const names[], const char *const values[], int count)
+{
+    if (count > REWRITE_ENV_MAX_VALUES)
+    {
+        return (char**)envp;
+    }
+
+    // Single pass over envp: find the entries that need to change and how much room their new values need
+    int valueIndexes[REWRITE_ENV_MAX_VALUES];
+    for (int i = 0; i < count; i++)
+    {
+        valueIndexes[i] = -1;
+    }
+
+    bool updateLdPreload = !is_null_or_empty(ldPreloadPath);
+    int ldPreloadIndex = -1;
+    int env_num = 0;
+    for (const char *const *pEnv = envp; pEnv && *pEnv; ++pEnv, ++env_num)
+    {
+        if (updateLdPreload && skip_prefix(*pEnv, LD_PRELOAD_ENV_VAR_PREFIX))
+        {
+            // The last occurrence is the one the paths are added to, the first one is the one they are removed from
+            if (addLdPreloadPath || ldPreloadIndex == -1)
+            {
+                ldPreloadIndex = env_num;
+            }
+
+            continue;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            if (get_value_if_named(*pEnv, names[i]))
+            {
+                valueIndexes[i] = env_num;
+                break;
+            }
+        }
+    }
+
+    size_t stringsSize = 0;
+    int appended = 0;
+    bool changed = false;
+    for (int i = 0; i < count; i++)
+    {
+        if (valueIndexes[i] != -1 && strcmp(get_value_if_named(envp[valueIndexes[i]], names[i]), values[i]) == 0)
+        {
+            // Already up to date: the original entry is reused
+            valueIndexes[i] = -2;
+            continue;
+        }
+
+        stringsSize += strlen(names[i]) + strlen(values[i]) + 2;
+        appended += valueIndexes[i] == -1 ? 1 : 0;
+        changed = true;
+    }
+
+    bool rewriteLdPreload = false;
+    if (updateLdPreload)
+    {
+        const char *ldPreload = ldPreloadIndex != -1 ? envp[ldPreloadIndex] + LD_PRELOAD_ENV_VAR_PREFIX_LENGTH : NULL;
+        rewriteLdPreload = addLdPreloadPath
+            ? ldPreload == NULL || !contains_value(ldPreload, ldPreloadPath)
+            : ldPreload != NULL && contains_value(ldPreload, ldPreloadPath);
+        if (rewriteLdPreload)
+        {
+            stringsSize += (ldPreloadIndex != -1 ? strlen(envp[ldPreloadIndex]) : LD_PRELOAD_ENV_VAR_PREFIX_LENGTH) + strlen(ldPreloadPath) + 2;
+            appended += ldPreloadIndex == -1 ? 1 : 0;
+            changed = true;
+        }
+    }
+
+    if (!changed)
+    {
+        return (char**)envp;
+    }
+
+    // Everything goes into a single block: the pointer array first, followed by the strings that had to change.
+    // Unchanged entries keep pointing into the original envp.
+    size_t arraySize = (env_num + appended + 1) * sizeof(char*);
+    char **newenvp = (char **)malloc(arraySize + stringsSize);
+    if (newenvp == NULL)
+    {
+        return (char**)envp;
+    }
+
+    memcpy(newenvp, envp, env_num * sizeof(char*));
+    char *arena = (char *)newenvp + arraySize;
+    int next_index = env_num;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (valueIndexes[i] == -2)
+        {
+            continue;
+        }
+
+        int nameLen = strlen(names[i]);
+        int valueLen = strlen(values[i]);
+        memcpy(arena, names[i], nameLen);
+        arena[nameLen] = '=';
+        memcpy(arena + nameLen + 1, values[i], valueLen + 1);
+
+        newenvp[valueIndexes[i] != -1 ? valueIndexes[i] : next_index++] = arena;
+        arena += nameLen + valueLen + 2;
+    }
+
+    if (rewriteLdPreload)
+    {
+        if (!addLdPreloadPath)
+        {
+            newenvp[ldPreloadIndex] = (char *)scrub_ld_preload(envp[ldPreloadIndex], ldPreloadPath, arena);
+        }
+        else
+        {
+            char *pArena = arena;
+            if (ldPreloadIndex != -1)
+            {
+                int srcLen = strlen(envp[ldPreloadIndex]);
+                memcpy(pArena, envp[ldPreloadIndex], srcLen);
+                pArena += srcLen;
+                if (*(pArena - 1) != PATH_SEP_CHAR && *(pArena - 1) != '=')
+                {
+                    *pArena++ = PATH_SEP_CHAR;
+                }
+            }
+            else
+            {
+                memcpy(pArena, LD_PRELOAD_ENV_VAR_PREFIX, LD_PRELOAD_ENV_VAR_PREFIX_LENGTH);
+                pArena += LD_PRELOAD_ENV_VAR_PREFIX_LENGTH;
+            }
+
+            strcpy(pArena, ldPreloadPath);
+            newenvp[ldPreloadIndex != -1 ? ldPreloadIndex : next_index++] = arena;
+        }
+    }
+
+    newenvp[next_index] = NULL; // Last element of envp[] should be a null pointer.
+    return newenvp;
+}
+
 // ======================= for testing ========================
 
 const bool add_value_to_env_for_test(const char *src, const char *value_to_add, const char *envPrefix, char *buf)
@@ -459,3 +632,12 @@ const void scrub_ld_preload_for_test(const char *src, const char *value_to_scrub
         strcpy(buf, src);
     }
 }
+
+const bool rewrite_env_for_test(const char *const envp[], const char *ldPreloadPath, bool addLdPreloadPath, const char *name0, const char *value0, const char *name1, const char *value1, char *buf)
+{
+    const char *names[] = { name0, name1 };
+    const char *values[] = { value0, value1 };
+    char **result = rewrite_env(envp, ldPreloadPath, addLdPreloadPath, names, values, 2);
+    copy_result_to_buf_for_test(result, buf);
+    return result == (char**)envp;
+}
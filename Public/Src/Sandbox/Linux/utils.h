@@ -85,6 +85,21 @@ DLL_EXPORT const char* scrub_ld_preload(const char *src, const char *value_to_sc
  */
 DLL_EXPORT char** remove_path_from_LDPRELOAD(const char *const envp[], const char *path);
 
+#define REWRITE_ENV_MAX_VALUES 8
+
+/**
+ * Single-pass rewriter for the environment handed to exec.
+ * 
+ * Makes sure that each "names[i]=values[i]" is in 'envp' and, when 'ldPreloadPath' is not empty, that 'ldPreloadPath'
+ * is included in (when 'addLdPreloadPath' is true) or excluded from (otherwise) the value of "LD_PRELOAD".
+ * Up to REWRITE_ENV_MAX_VALUES variables can be given.
+ * 
+ * When nothing needs to change, 'envp' is returned and nothing is allocated. Otherwise, a new array of 'char*'
+ * pointers is allocated, which reuses the unchanged entries of 'envp' and holds the (few) updated entries in the same
+ * allocation, so the result can be released with a single 'free'.
+ */
+DLL_EXPORT char** rewrite_env(const char *const envp[], const char *ldPreloadPath, bool addLdPreloadPath, const char *const names[], const char *const values[], int count);
+
 // Test wrappers to make p-invoke easier.
 
 DLL_EXPORT const bool add_value_to_env_for_test(const char *src, const char *value_to_add, const char *envPrefix, char *buf);
@@ -92,4 +107,5 @@ DLL_EXPORT const bool ensure_env_value_for_test(const char *const envp[], char c
 DLL_EXPORT const bool ensure_2_paths_included_in_env_for_test(const char *const envp[], char const *envPrefix, const char *path0, const char *path1, char *buf);
 DLL_EXPORT const bool ensure_1_path_included_in_env_for_test(const char *const envp[], char const *envPrefix, const char *path, char *buf);
 DLL_EXPORT const void scrub_ld_preload_for_test(const char *src, const char *value_to_scrub, char *buf);
-DLL_EXPORT const bool remove_path_from_LDPRELOAD_for_test(const char *const envp[], char *path, char *buf0, char *buf1, char *buf2);
\ No newline at end of file
+DLL_EXPORT const bool remove_path_from_LDPRELOAD_for_test(const char *const envp[], char *path, char *buf0, char *buf1, char *buf2);
+DLL_EXPORT const bool rewrite_env_for_test(const char *const envp[], const char *ldPreloadPath, bool addLdPreloadPath, const char *name0, const char *value0, const char *name1, const char *value1, char *buf);
\ No newline at end of file
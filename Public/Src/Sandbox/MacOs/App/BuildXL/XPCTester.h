@@ -36,10 +36,11 @@ void start_xpc_server(void)
            xpc_type_t type = xpc_get_type(message);
            if (type == XPC_TYPE_DICTIONARY)
            {
-               const char *msg = xpc_dictionary_get_string(message, "IOEvent");
-               const uint64_t msg_length = xpc_dictionary_get_uint64(message, "IOEvent::Length");
+               // Events are binary records (see IOEventRecordHeader), only their size is of interest here
+               size_t msg_length = 0;
+               xpc_dictionary_get_data(message, "IOEvent", &msg_length);
 
-               NSLog(@"%.*s\n",(int)msg_length, msg);
+               NSLog(@"Event record of %zu bytes\n", msg_length);
 
                xpc_object_t reply = xpc_dictionary_create_reply(message);
                xpc_dictionary_set_uint64(reply, "response", xpc_response_success);
@@ -6,6 +6,11 @@
 
 #include <EndpointSecurity/EndpointSecurity.h>
 #include <Foundation/Foundation.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "EventRing.hpp"
 
 class ESClient final
 {
@@ -18,12 +23,55 @@ private:
     dispatch_queue_t eventQueue_ = nullptr;
     xpc_connection_t build_host_ = nullptr;
 
+    // When greater than one, events are sent to the build host in batches of up to this many events (see AddToBatch),
+    // otherwise every event is sent on its own and AUTH events are only responded to once the build host replied. When
+    // batching, the client subscribes to the NOTIFY counterparts of the AUTH events it is given.
+    uint64_t batch_size_;
+
+    // The records of the events of the pending batch (each prefixed by its uint32 length) and the process and type of every
+    // one of them, so the process (or the event type for it) can be muted when the build host asks for it
+    std::mutex batch_lock_;
+    std::vector<char> batch_;
+    std::vector<IOEventSource> batch_sources_;
+    bool flush_scheduled_ = false;
+
+    // When batching, events go through a ring shared with the build host whenever it has room (see EventRing.hpp)
+    EventRing ring_;
+    void *ring_region_ = nullptr;
+    size_t ring_region_size_ = 0;
+
+    // The executables the build host already got, for the events sent through XPC messages and through the ring. Only
+    // used by the handler of the client, which sees one event at a time.
+    IOEventExecutableTable message_executables_;
+    IOEventExecutableTable ring_executables_;
+
+    // The subscribed events that can be muted by their target path (see MuteTargetPaths)
+    std::vector<es_event_type_t> target_path_events_;
+
+    // The events of the client and the ones it is currently subscribed to, which the build host narrows down to what its
+    // running pips need (see UnsubscribeEvents)
+    std::mutex subscriptions_lock_;
+    std::vector<es_event_type_t> events_;
+    std::vector<es_event_type_t> subscribed_events_;
+
+    void MuteProcessEvent(const IOEventSource &source);
+    void AddToBatch(const IOEventMessage &event);
+    void FlushBatch();
+    bool SetUpRing(uint32_t capacity);
+    void RingDoorbell();
+
 public:
 
-    ESClient(dispatch_queue_t event_queue, pid_t host_pid, xpc_endpoint_t endpoint, es_event_type_t *events, uint32_t event_count);
+    ESClient(dispatch_queue_t event_queue, pid_t host_pid, xpc_endpoint_t endpoint, es_event_type_t *events, uint32_t event_count, uint64_t batch_size = 1, uint32_t ring_capacity = 0);
     ~ESClient();
 
     int TearDown(xpc_object_t remote = nullptr, xpc_object_t reply = nullptr);
+
+    // Replaces the path prefixes whose events are dropped by EndpointSecurity before they reach the client
+    void MuteTargetPaths(const std::vector<std::string> &paths);
+
+    // Replaces the events of the client that are not subscribed to: the client subscribes to all the others again
+    void UnsubscribeEvents(const std::vector<es_event_type_t> &events);
 };
 
 
@@ -1,14 +1,103 @@
 // Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
+#include <algorithm>
 #include <cstdio>
+#include <sys/mman.h>
 
 #include "ESClient.hpp"
 #include "ESConstants.hpp"
 #include "IOEvent.hpp"
 #include "XPCConstants.hpp"
 
-ESClient::ESClient(dispatch_queue_t event_queue, pid_t host_pid, xpc_endpoint_t endpoint, es_event_type_t *events, uint32_t event_count)
+// A batch that is not full is sent to the build host at most this long after its first event was added
+static const int64_t kBatchLatencyNs = 2 * NSEC_PER_MSEC;
+
+// Currently the ES client allows every auth and flag based event without exception, whatever the build host replies
+static void AllowAuthEvent(es_client_t *client, const es_message_t *message)
+{
+    switch(message->event_type)
+    {
+        case ES_EVENT_TYPE_AUTH_OPEN:
+            es_respond_flags_result(client, message, 0x7fffffff, false);
+            break;
+        default:
+            es_respond_auth_result(client, message, ES_AUTH_RESULT_ALLOW, false);
+            break;
+    }
+}
+
+// The NOTIFY event reporting the same access as an AUTH event, or the event itself when there is none (or it is no AUTH event)
+static es_event_type_t NotifyEventFor(es_event_type_t type)
+{
+    switch (type)
+    {
+        case ES_EVENT_TYPE_AUTH_EXEC:           return ES_EVENT_TYPE_NOTIFY_EXEC;
+        case ES_EVENT_TYPE_AUTH_OPEN:           return ES_EVENT_TYPE_NOTIFY_OPEN;
+        case ES_EVENT_TYPE_AUTH_CREATE:         return ES_EVENT_TYPE_NOTIFY_CREATE;
+        case ES_EVENT_TYPE_AUTH_TRUNCATE:       return ES_EVENT_TYPE_NOTIFY_TRUNCATE;
+        case ES_EVENT_TYPE_AUTH_CLONE:          return ES_EVENT_TYPE_NOTIFY_CLONE;
+        case ES_EVENT_TYPE_AUTH_EXCHANGEDATA:   return ES_EVENT_TYPE_NOTIFY_EXCHANGEDATA;
+        case ES_EVENT_TYPE_AUTH_RENAME:         return ES_EVENT_TYPE_NOTIFY_RENAME;
+        case ES_EVENT_TYPE_AUTH_LINK:           return ES_EVENT_TYPE_NOTIFY_LINK;
+        case ES_EVENT_TYPE_AUTH_UNLINK:         return ES_EVENT_TYPE_NOTIFY_UNLINK;
+        case ES_EVENT_TYPE_AUTH_READLINK:       return ES_EVENT_TYPE_NOTIFY_READLINK;
+        case ES_EVENT_TYPE_AUTH_SETATTRLIST:    return ES_EVENT_TYPE_NOTIFY_SETATTRLIST;
+        case ES_EVENT_TYPE_AUTH_SETEXTATTR:     return ES_EVENT_TYPE_NOTIFY_SETEXTATTR;
+        case ES_EVENT_TYPE_AUTH_DELETEEXTATTR:  return ES_EVENT_TYPE_NOTIFY_DELETEEXTATTR;
+        case ES_EVENT_TYPE_AUTH_SETFLAGS:       return ES_EVENT_TYPE_NOTIFY_SETFLAGS;
+        case ES_EVENT_TYPE_AUTH_SETMODE:        return ES_EVENT_TYPE_NOTIFY_SETMODE;
+        case ES_EVENT_TYPE_AUTH_SETOWNER:       return ES_EVENT_TYPE_NOTIFY_SETOWNER;
+        case ES_EVENT_TYPE_AUTH_SETACL:         return ES_EVENT_TYPE_NOTIFY_SETACL;
+        case ES_EVENT_TYPE_AUTH_GETATTRLIST:    return ES_EVENT_TYPE_NOTIFY_GETATTRLIST;
+        case ES_EVENT_TYPE_AUTH_GETEXTATTR:     return ES_EVENT_TYPE_NOTIFY_GETEXTATTR;
+        case ES_EVENT_TYPE_AUTH_LISTEXTATTR:    return ES_EVENT_TYPE_NOTIFY_LISTEXTATTR;
+        default:                                return type;
+    }
+}
+
+// Events with a single target path, which is all that muting a target path prefix has to consider. Exec events are left out,
+// as the process tree has to be followed wherever its images live.
+static bool HasSingleTargetPath(es_event_type_t type)
+{
+    switch (type)
+    {
+        case ES_EVENT_TYPE_AUTH_OPEN:
+        case ES_EVENT_TYPE_AUTH_CREATE:
+        case ES_EVENT_TYPE_AUTH_TRUNCATE:
+        case ES_EVENT_TYPE_AUTH_UNLINK:
+        case ES_EVENT_TYPE_AUTH_READLINK:
+        case ES_EVENT_TYPE_AUTH_SETATTRLIST:
+        case ES_EVENT_TYPE_AUTH_SETEXTATTR:
+        case ES_EVENT_TYPE_AUTH_DELETEEXTATTR:
+        case ES_EVENT_TYPE_AUTH_SETFLAGS:
+        case ES_EVENT_TYPE_AUTH_SETMODE:
+        case ES_EVENT_TYPE_AUTH_SETOWNER:
+        case ES_EVENT_TYPE_AUTH_SETACL:
+        case ES_EVENT_TYPE_NOTIFY_OPEN:
+        case ES_EVENT_TYPE_NOTIFY_CREATE:
+        case ES_EVENT_TYPE_NOTIFY_TRUNCATE:
+        case ES_EVENT_TYPE_NOTIFY_UNLINK:
+        case ES_EVENT_TYPE_NOTIFY_READLINK:
+        case ES_EVENT_TYPE_NOTIFY_SETATTRLIST:
+        case ES_EVENT_TYPE_NOTIFY_SETEXTATTR:
+        case ES_EVENT_TYPE_NOTIFY_DELETEEXTATTR:
+        case ES_EVENT_TYPE_NOTIFY_SETFLAGS:
+        case ES_EVENT_TYPE_NOTIFY_SETMODE:
+        case ES_EVENT_TYPE_NOTIFY_SETOWNER:
+        case ES_EVENT_TYPE_NOTIFY_SETACL:
+        case ES_EVENT_TYPE_NOTIFY_ACCESS:
+        case ES_EVENT_TYPE_NOTIFY_LOOKUP:
+        case ES_EVENT_TYPE_NOTIFY_STAT:
+        case ES_EVENT_TYPE_NOTIFY_CLOSE:
+        case ES_EVENT_TYPE_NOTIFY_WRITE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+ESClient::ESClient(dispatch_queue_t event_queue, pid_t host_pid, xpc_endpoint_t endpoint, es_event_type_t *events, uint32_t event_count, uint64_t batch_size, uint32_t ring_capacity)
 {
     assert(event_queue != nullptr);
     assert(endpoint != nullptr);
@@ -16,8 +105,31 @@ ESClient::ESClient(dispatch_queue_t event_queue, pid_t host_pid, xpc_endpoint_t
 
     host_pid_ = host_pid;
     eventQueue_ = event_queue;
+    batch_size_ = batch_size;
     build_host_ = xpc_connection_create_from_endpoint(endpoint);
 
+    // Batched AUTH events are allowed before the build host sees them, so nothing is decided on them: subscribe to the NOTIFY
+    // events reporting the same accesses instead, which never hold up the tracked processes. Responding with cache=true is no
+    // alternative, a cached AUTH result keeps the event from the client altogether, for the accesses of every other pip too.
+    for (uint32_t i = 0; i < event_count; i++)
+    {
+        es_event_type_t event = batch_size_ > 1 ? NotifyEventFor(events[i]) : events[i];
+        if (std::find(events_.begin(), events_.end(), event) == events_.end())
+        {
+            events_.push_back(event);
+        }
+    }
+
+    subscribed_events_ = events_;
+
+    for (es_event_type_t event : events_)
+    {
+        if (HasSingleTargetPath(event))
+        {
+            target_path_events_.push_back(event);
+        }
+    }
+
     xpc_connection_set_event_handler(build_host_, ^(xpc_object_t message)
     {
         xpc_type_t type = xpc_get_type(message);
@@ -28,6 +140,12 @@ ESClient::ESClient(dispatch_queue_t event_queue, pid_t host_pid, xpc_endpoint_t
     });
 
     xpc_connection_resume(build_host_);
+
+    // Without a ring events are still batched (see AddToBatch)
+    if (batch_size_ > 1 && ring_capacity > 0 && !SetUpRing(ring_capacity))
+    {
+        log_error("Failed setting up an event ring of %u bytes, events are sent through XPC messages.", ring_capacity);
+    }
     
     /*
         Remark: XPC Event transfer happens within the ES callback here, this adds latency. The ES documentation mentions that an
@@ -49,37 +167,48 @@ ESClient::ESClient(dispatch_queue_t event_queue, pid_t host_pid, xpc_endpoint_t
         {
             if (message->action_type == ES_ACTION_TYPE_AUTH)
             {
-                switch(message->event_type)
-                {
-                    case ES_EVENT_TYPE_AUTH_OPEN:
-                    {
-                        // Currently the ES client allows every flag based event without exception
-                        es_respond_flags_result(client_,message, 0x7fffffff, false);
-                        break;
-                    }
-                    default:
-                    {
-                        // Currently the ES client allows every auth based event without exception
-                        es_respond_auth_result(client_, message, ES_AUTH_RESULT_ALLOW, false);
-                        break;
-                    }
-                }
+                AllowAuthEvent(client_, message);
             }
 
             es_mute_process(client_, &message->process->audit_token);
             return;
         }
 
-        IOEvent event(message);
-        size_t msg_length = IOEvent::max_size();
-        char msg[msg_length];
+        // Only valid during the callback, the reply block below only uses what the view copied (the audit token and event type)
+        IOEventMessage event(message);
+
+        if (batch_size_ > 1)
+        {
+            // The build host allows every AUTH event anyway, so there is no need to wait for its reply: respond right away and
+            // only get the mute decisions back, once per batch (only AUTH events without a NOTIFY counterpart get here)
+            if (message->action_type == ES_ACTION_TYPE_AUTH)
+            {
+                AllowAuthEvent(client_, message);
+            }
+
+            bool wake_consumer = false;
+            if (ring_.IsAttached() && ring_.TryAppend(event, ring_executables_, wake_consumer))
+            {
+                if (wake_consumer)
+                {
+                    RingDoorbell();
+                }
 
-        omemorystream oms(msg, sizeof(msg));
-        oms << event;
+                return;
+            }
+
+            // The ring is full (or there is none)
+            AddToBatch(event);
+            return;
+        }
+
+        bool executable_interned = message_executables_.Contains(event);
+        char record[IOEvent::max_record_size()];
+        event.WriteRecord(record, executable_interned);
+        message_executables_.Record(event);
 
         xpc_object_t xpc_payload = xpc_dictionary_create(NULL, NULL, 0);
-        xpc_dictionary_set_string(xpc_payload, IOEventKey, msg);
-        xpc_dictionary_set_uint64(xpc_payload, IOEventLengthKey, event.Size());
+        xpc_dictionary_set_data(xpc_payload, IOEventKey, record, event.RecordSize(executable_interned));
 
         xpc_connection_send_message_with_reply(build_host_, xpc_payload, eventQueue_, ^(xpc_object_t response)
         {
@@ -91,24 +220,21 @@ ESClient::ESClient(dispatch_queue_t event_queue, pid_t host_pid, xpc_endpoint_t
                 switch (status)
                 {
                     case xpc_response_mute_process:
+                    case xpc_response_mute_process_events:
                     case xpc_response_auth:
                     {
                         if (client_)
                         {
-                            switch(message->event_type)
-                            {
-                                case ES_EVENT_TYPE_AUTH_OPEN:
-                                    es_respond_flags_result(client_,message, 0x7fffffff, false);
-                                    break;
-                                default:
-                                    es_respond_auth_result(client_, message, ES_AUTH_RESULT_ALLOW, false);
-                                    break;
-                            }
-                            
+                            AllowAuthEvent(client_, message);
+
                             if (status == xpc_response_mute_process)
                             {
                                 es_mute_process(client_, event.GetProcessAuditToken());
                             }
+                            else if (status == xpc_response_mute_process_events)
+                            {
+                                MuteProcessEvent({ *event.GetProcessAuditToken(), event.GetEventType() });
+                            }
                             
                             break;
                         }
@@ -155,14 +281,255 @@ ESClient::ESClient(dispatch_queue_t event_queue, pid_t host_pid, xpc_endpoint_t
         exit(EXIT_FAILURE);
     }
 
-    es_return_t subscribe_result = es_subscribe(client_, (es_event_type_t *)events, event_count);
+    es_return_t subscribe_result = es_subscribe(client_, events_.data(), (uint32_t)events_.size());
     if (subscribe_result != ES_RETURN_SUCCESS)
     {
         log_error("Failed subscribing to the EndpointSecurity backend: %d", subscribe_result);
         exit(EXIT_FAILURE);
     }
 
-    log_debug("Successfully initialized an EndpointSecurity client, tracking: %d event(s).", event_count);
+    log_debug("Successfully initialized an EndpointSecurity client, tracking: %lu event(s).", events_.size());
+}
+
+// Muting single event types of a process takes macOS 13, before that the process keeps sending them
+void ESClient::MuteProcessEvent(const IOEventSource &source)
+{
+    if (@available(macOS 13.0, *))
+    {
+        es_return_t result = es_mute_process_events(client_, &source.auditToken, &source.eventType, 1);
+        if (result != ES_RETURN_SUCCESS)
+        {
+            log_error("Failed muting event type %d for PID(%d)", source.eventType, audit_token_to_pid(source.auditToken));
+        }
+    }
+}
+
+void ESClient::AddToBatch(const IOEventMessage &event)
+{
+    bool executable_interned = message_executables_.Contains(event);
+    uint32_t length = (uint32_t)event.RecordSize(executable_interned);
+
+    std::lock_guard<std::mutex> lock(batch_lock_);
+
+    // The record is written in place, right after its length
+    size_t offset = batch_.size();
+    batch_.resize(offset + sizeof(length) + length);
+    memcpy(batch_.data() + offset, &length, sizeof(length));
+    event.WriteRecord(batch_.data() + offset + sizeof(length), executable_interned);
+    message_executables_.Record(event);
+    batch_sources_.push_back({ *event.GetProcessAuditToken(), event.GetEventType() });
+
+    if (batch_sources_.size() >= batch_size_)
+    {
+        FlushBatch();
+    }
+    else if (!flush_scheduled_ && eventQueue_ != nullptr)
+    {
+        flush_scheduled_ = true;
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, kBatchLatencyNs), eventQueue_, ^()
+        {
+            std::lock_guard<std::mutex> lock(batch_lock_);
+            flush_scheduled_ = false;
+            FlushBatch();
+        });
+    }
+}
+
+// Assumes batch_lock_ is held by the caller
+void ESClient::FlushBatch()
+{
+    if (batch_sources_.empty() || eventQueue_ == nullptr)
+    {
+        return;
+    }
+
+    xpc_object_t xpc_payload = xpc_dictionary_create(NULL, NULL, 0);
+    xpc_dictionary_set_data(xpc_payload, IOEventBatchKey, batch_.data(), batch_.size());
+
+    // The reply comes back asynchronously, the sources of the batch are released once it has been handled
+    std::vector<IOEventSource> *sources = new std::vector<IOEventSource>();
+    sources->swap(batch_sources_);
+    batch_.clear();
+
+    xpc_connection_send_message_with_reply(build_host_, xpc_payload, eventQueue_, ^(xpc_object_t response)
+    {
+        xpc_type_t xpc_type = xpc_get_type(response);
+        if (xpc_type == XPC_TYPE_DICTIONARY)
+        {
+            uint64_t status = xpc_dictionary_get_uint64(response, "response");
+            if (status != xpc_response_success)
+            {
+                log_error("%s", "XPC event processing error - sandboxing is no longer reliable!\n");
+                // If we can't guarantee conistent event reporting, we forcefully exit and abort the build.
+                exit(EXIT_FAILURE);
+            }
+
+            // One response per event of the batch
+            size_t responses_length = 0;
+            const uint8_t *responses = (const uint8_t *)xpc_dictionary_get_data(response, IOEventBatchResponsesKey, &responses_length);
+            for (size_t i = 0; client_ && responses != nullptr && i < responses_length && i < sources->size(); i++)
+            {
+                if (responses[i] == xpc_response_mute_process)
+                {
+                    es_mute_process(client_, &(*sources)[i].auditToken);
+                }
+                else if (responses[i] == xpc_response_mute_process_events)
+                {
+                    MuteProcessEvent((*sources)[i]);
+                }
+            }
+        }
+        else
+        {
+            // Ignore cases when BuildXL quits and invalidates / interrupts the XPC connection.
+            if (response != XPC_ERROR_CONNECTION_INTERRUPTED && response != XPC_ERROR_CONNECTION_INVALID)
+            {
+                const char *desc = xpc_copy_description(response);
+                log_error("Non-recoverable error in ES client message parsing queue: %{public}s", desc);
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        delete sources;
+    });
+}
+
+bool ESClient::SetUpRing(uint32_t capacity)
+{
+    size_t size = EventRing::RegionSize(capacity);
+    void *region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_SHARED, -1, 0);
+    if (region == MAP_FAILED)
+    {
+        return false;
+    }
+
+    ring_.Initialize(region, capacity);
+
+    xpc_object_t xpc_payload = xpc_dictionary_create(NULL, NULL, 0);
+    xpc_dictionary_set_value(xpc_payload, IOEventRingKey, xpc_shmem_create(region, size));
+
+    xpc_object_t response = xpc_connection_send_message_with_reply_sync(build_host_, xpc_payload);
+    if (xpc_get_type(response) != XPC_TYPE_DICTIONARY || xpc_dictionary_get_uint64(response, "response") != xpc_response_success)
+    {
+        ring_.Detach();
+        munmap(region, size);
+        return false;
+    }
+
+    ring_region_ = region;
+    ring_region_size_ = size;
+    return true;
+}
+
+// Tells the build host that the ring is not empty anymore. The reply comes once the build host drained the ring again,
+// with the processes it asks to mute.
+void ESClient::RingDoorbell()
+{
+    xpc_object_t xpc_payload = xpc_dictionary_create(NULL, NULL, 0);
+    xpc_dictionary_set_bool(xpc_payload, IOEventRingDoorbellKey, true);
+
+    xpc_connection_send_message_with_reply(build_host_, xpc_payload, eventQueue_, ^(xpc_object_t response)
+    {
+        xpc_type_t xpc_type = xpc_get_type(response);
+        if (xpc_type == XPC_TYPE_DICTIONARY)
+        {
+            if (xpc_dictionary_get_uint64(response, "response") != xpc_response_success)
+            {
+                log_error("%s", "XPC event processing error - sandboxing is no longer reliable!\n");
+                exit(EXIT_FAILURE);
+            }
+
+            size_t muted_length = 0;
+            const audit_token_t *muted = (const audit_token_t *)xpc_dictionary_get_data(response, IOEventMutedProcessesKey, &muted_length);
+            for (size_t i = 0; client_ && muted != nullptr && i < muted_length / sizeof(audit_token_t); i++)
+            {
+                es_mute_process(client_, &muted[i]);
+            }
+
+            size_t muted_events_length = 0;
+            const IOEventSource *muted_events = (const IOEventSource *)xpc_dictionary_get_data(response, IOEventMutedProcessEventsKey, &muted_events_length);
+            for (size_t i = 0; client_ && muted_events != nullptr && i < muted_events_length / sizeof(IOEventSource); i++)
+            {
+                MuteProcessEvent(muted_events[i]);
+            }
+        }
+        else if (response != XPC_ERROR_CONNECTION_INTERRUPTED && response != XPC_ERROR_CONNECTION_INVALID)
+        {
+            const char *desc = xpc_copy_description(response);
+            log_error("Non-recoverable error in ES client message parsing queue: %{public}s", desc);
+            exit(EXIT_FAILURE);
+        }
+    });
+}
+
+void ESClient::MuteTargetPaths(const std::vector<std::string> &paths)
+{
+    if (client_ == nullptr || target_path_events_.empty())
+    {
+        return;
+    }
+
+    if (@available(macOS 13.0, *))
+    {
+        // Nothing else mutes target paths on this client
+        es_unmute_all_target_paths(client_);
+
+        for (const std::string &path : paths)
+        {
+            es_return_t result = es_mute_path_events(client_, path.c_str(), ES_MUTE_PATH_TYPE_TARGET_PREFIX,
+                                                     target_path_events_.data(), target_path_events_.size());
+            if (result != ES_RETURN_SUCCESS)
+            {
+                log_error("Failed muting the target path prefix %{public}s", path.c_str());
+            }
+        }
+
+        log_debug("Muted %lu target path prefix(es) for %lu event type(s).", paths.size(), target_path_events_.size());
+    }
+}
+
+void ESClient::UnsubscribeEvents(const std::vector<es_event_type_t> &events)
+{
+    std::lock_guard<std::mutex> lock(subscriptions_lock_);
+    if (client_ == nullptr)
+    {
+        return;
+    }
+
+    std::vector<es_event_type_t> subscribed;
+    std::vector<es_event_type_t> added;
+    std::vector<es_event_type_t> removed;
+    for (es_event_type_t event : events_)
+    {
+        bool was_subscribed = std::find(subscribed_events_.begin(), subscribed_events_.end(), event) != subscribed_events_.end();
+        if (std::find(events.begin(), events.end(), event) == events.end())
+        {
+            subscribed.push_back(event);
+            if (!was_subscribed)
+            {
+                added.push_back(event);
+            }
+        }
+        else if (was_subscribed)
+        {
+            removed.push_back(event);
+        }
+    }
+
+    if (!added.empty() && es_subscribe(client_, added.data(), (uint32_t)added.size()) != ES_RETURN_SUCCESS)
+    {
+        log_error("Failed subscribing to %lu EndpointSecurity event(s)", added.size());
+        return;
+    }
+
+    if (!removed.empty() && es_unsubscribe(client_, removed.data(), (uint32_t)removed.size()) != ES_RETURN_SUCCESS)
+    {
+        log_error("Failed unsubscribing from %lu EndpointSecurity event(s)", removed.size());
+        subscribed.insert(subscribed.end(), removed.begin(), removed.end());
+    }
+
+    subscribed_events_ = subscribed;
+    log_debug("Subscribed to %lu of %lu event(s).", subscribed_events_.size(), events_.size());
 }
 
 int ESClient::TearDown(xpc_object_t remote, xpc_object_t reply)
@@ -170,6 +537,13 @@ int ESClient::TearDown(xpc_object_t remote, xpc_object_t reply)
     if (client_ != nullptr)
     {
         es_return_t result = es_unsubscribe_all(client_);
+
+        // No events come after unsubscribing: send what is still pending
+        {
+            std::lock_guard<std::mutex> lock(batch_lock_);
+            FlushBatch();
+        }
+
         if (result != ES_RETURN_SUCCESS)
         {
             log_error("%s", "Failed unsubscribing from all EndpointSecurity events on client tear-down!");
@@ -185,6 +559,14 @@ int ESClient::TearDown(xpc_object_t remote, xpc_object_t reply)
 
         client_ = nullptr;
 
+        // The build host keeps its own mapping of the ring until the connection goes away
+        if (ring_region_ != nullptr)
+        {
+            ring_.Detach();
+            munmap(ring_region_, ring_region_size_);
+            ring_region_ = nullptr;
+        }
+
         if (remote && reply)
         {
             dispatch_async(eventQueue_, ^()
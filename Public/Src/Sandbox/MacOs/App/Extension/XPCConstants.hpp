@@ -11,6 +11,8 @@ enum XPCCommands : unsigned int
     xpc_response_failure,
     xpc_response_mute_process,
     xpc_response_auth,
+    // Responses travel as bytes in the replies to batches (see IOEventBatchResponsesKey), so they must stay below 0x100
+    xpc_response_mute_process_events,
 
     xpc_get_detours_connection,
     xpc_set_detours_connection,
@@ -19,6 +21,8 @@ enum XPCCommands : unsigned int
     xpc_get_es_connection,
     xpc_set_es_connection,
     xpc_kill_es_connection,
+    xpc_set_es_muted_paths,
+    xpc_set_es_unsubscribed_events,
 };
 
 #endif /* XPCConstants_h */
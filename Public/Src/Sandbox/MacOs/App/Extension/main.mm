@@ -24,12 +24,18 @@ ESClient *spammy_client = nullptr;
 
 #define INIT(client, queue, events) {\
     int count = sizeof(events) / sizeof(events[0]); \
-    client = count > 0 ? new ESClient(queue, (pid_t)host_pid, es_endpoint, (es_event_type_t *)events, count) : nullptr; \
+    client = count > 0 ? new ESClient(queue, (pid_t)host_pid, es_endpoint, (es_event_type_t *)events, count, batch_size, (uint32_t)ring_capacity) : nullptr; \
 }
 
 #define TEAR_DOWN(client) \
     if (client != nullptr) client->TearDown(peer, reply);
 
+#define MUTE_TARGET_PATHS(client, paths) \
+    if (client != nullptr) client->MuteTargetPaths(paths);
+
+#define UNSUBSCRIBE_EVENTS(client, events) \
+    if (client != nullptr) client->UnsubscribeEvents(events);
+
 int main(void)
 {
     // One consumer queue per event bucket and client
@@ -83,6 +89,9 @@ int main(void)
                                 {
                                     es_endpoint = xpc_dictionary_get_value(message, "connection");
                                     uint64_t host_pid = xpc_dictionary_get_uint64(message, "host_pid");
+                                    // Hosts that don't batch events don't send a batch size (so it reads as 0)
+                                    uint64_t batch_size = xpc_dictionary_get_uint64(message, "batch_size");
+                                    uint64_t ring_capacity = xpc_dictionary_get_uint64(message, "ring_capacity");
 
                                     INIT(lifetime_client, es_lifetime_event_queue, es_lifetime_events_)
                                     INIT(exit_client, es_exit_event_queue, es_exit_events_)
@@ -131,6 +140,61 @@ int main(void)
                                 es_endpoint = nullptr;
                                 break;
                             }
+                            case xpc_set_es_muted_paths:
+                            {
+                                // Path prefixes the build host does not track for any of its pips, so their events never need to leave the kernel
+                                __block std::vector<std::string> paths;
+                                xpc_object_t muted_paths = xpc_dictionary_get_value(message, "paths");
+                                if (muted_paths != nullptr && xpc_get_type(muted_paths) == XPC_TYPE_ARRAY)
+                                {
+                                    xpc_array_apply(muted_paths, ^bool(size_t index, xpc_object_t value)
+                                    {
+                                        const char *path = xpc_string_get_string_ptr(value);
+                                        if (path != nullptr)
+                                        {
+                                            paths.push_back(path);
+                                        }
+
+                                        return true;
+                                    });
+                                }
+
+                                MUTE_TARGET_PATHS(lifetime_client, paths)
+                                MUTE_TARGET_PATHS(exit_client, paths)
+                                MUTE_TARGET_PATHS(write_client, paths)
+                                MUTE_TARGET_PATHS(read_client, paths)
+
+                                xpc_object_t reply = xpc_dictionary_create_reply(message);
+                                xpc_dictionary_set_uint64(reply, "response", xpc_response_success);
+                                xpc_connection_send_message(peer, reply);
+
+                                break;
+                            }
+                            case xpc_set_es_unsubscribed_events:
+                            {
+                                // Event types none of the running pips of the build host needs, every client subscribes to the rest of its events
+                                __block std::vector<es_event_type_t> events;
+                                xpc_object_t unsubscribed_events = xpc_dictionary_get_value(message, "events");
+                                if (unsubscribed_events != nullptr && xpc_get_type(unsubscribed_events) == XPC_TYPE_ARRAY)
+                                {
+                                    xpc_array_apply(unsubscribed_events, ^bool(size_t index, xpc_object_t value)
+                                    {
+                                        events.push_back((es_event_type_t)xpc_uint64_get_value(value));
+                                        return true;
+                                    });
+                                }
+
+                                UNSUBSCRIBE_EVENTS(lifetime_client, events)
+                                UNSUBSCRIBE_EVENTS(exit_client, events)
+                                UNSUBSCRIBE_EVENTS(write_client, events)
+                                UNSUBSCRIBE_EVENTS(read_client, events)
+
+                                xpc_object_t reply = xpc_dictionary_create_reply(message);
+                                xpc_dictionary_set_uint64(reply, "response", xpc_response_success);
+                                xpc_connection_send_message(peer, reply);
+
+                                break;
+                            }
                         }
                     }
                 }
@@ -1,8 +1,10 @@
 // Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
+#include <vector>
+
 #include "Detours.hpp"
-#include "MemoryStreams.hpp"
+#include "DetoursPolicy.hpp"
 #include "PathCacheEntry.hpp"
 #include "Trie.hpp"
 #include "XPCConstants.hpp"
@@ -14,8 +16,30 @@ static std::once_flag InitializeWritePathCache;
 static std::once_flag InitializeXPC;
 
 static xpc_connection_t bxl_connection = nullptr;
+static dispatch_queue_t bxl_queue = nullptr;
+
+// The executables the build host already got on bxl_connection (see IOEventExecutableTable). Events are recorded as they
+// are sent while holding batch_lock, so the host always gets an executable before any record that leaves it out.
+static std::mutex sent_executables_lock;
+static IOEventExecutableTable sent_executables;
 static thread_local bool bxl_realpath_execution = false;
 
+// Set while a copyfile that clones is running, the accesses it makes on its own are covered by the clone it's reported as
+static thread_local bool bxl_clone_execution = false;
+
+// The manifest of the pip, when the build host saved one for the interposed processes (see DetoursPolicy), along with the
+// environment entry that passes it down to children spawned with an environment of their own
+static DetoursPolicy *policy = nullptr;
+static char fam_env_entry[PATH_MAX + sizeof(BXL_FAM_PATH_ENV "=")] = { '\0' };
+
+// Reportable accesses evaluated by 'policy', which are sent in batches without waiting for the build host (see send_batched)
+static std::mutex batch_lock;
+static std::vector<char> batch;
+static size_t batch_count = 0;
+static bool batch_flush_scheduled = false;
+static const size_t kBatchSize = 64;
+static const int64_t kBatchLatencyNs = 2 * NSEC_PER_MSEC;
+
 #pragma mark Utility Functions
 
 char *bxl_realpath(const char* file_name, char* buffer)
@@ -34,6 +58,7 @@ int setup_xpc()
      dispatch_queue_t xpc_queue = dispatch_queue_create(queue_name, dispatch_queue_attr_make_with_qos_class(
         DISPATCH_QUEUE_SERIAL, QOS_CLASS_USER_INTERACTIVE, -1
     ));
+    bxl_queue = xpc_queue;
 
     xpc_connection_t xpc_connection = xpc_connection_create_mach_service("com.microsoft.buildxl.sandbox", NULL, 0);
     xpc_connection_set_event_handler(xpc_connection, ^(xpc_object_t message)
@@ -63,6 +88,11 @@ int setup_xpc()
         {
             xpc_endpoint_t endpoint = (xpc_endpoint_t) xpc_dictionary_get_value(response, "connection");
             bxl_connection = xpc_connection_create_from_endpoint(endpoint);
+            {
+                // A new connection is a new peer for the build host, which knows no executable yet
+                std::lock_guard<std::mutex> lock(sent_executables_lock);
+                sent_executables.Clear();
+            }
             xpc_connection_set_event_handler(bxl_connection, ^(xpc_object_t message)
             {
                 xpc_type_t type = xpc_get_type(message);
@@ -109,9 +139,119 @@ inline mode_t get_mode(const char *path)
     return stat(path, &s) == 0 ? s.st_mode : 0;    
 }
 
+inline void check_response(xpc_object_t response)
+{
+    uint64_t status = xpc_get_type(response) == XPC_TYPE_DICTIONARY ? xpc_dictionary_get_uint64(response, "response") : xpc_response_error;
+    xpc_release(response);
+
+    if (status != xpc_response_success)
+    {
+        fprintf(stderr, "Connecting to XPC bridge service failed, aborting because conistent sandboxing can't be guaranteed - status(%lld)\n", status);
+        abort();
+    }
+}
+
+// Only the events the build host must have processed before the process goes on are waited for: a fork has to be known before
+// the events of the child show up, and nothing sent before an exec or an exit may get lost along with the process image. There
+// is nothing to wait for otherwise, as interposed accesses have happened already and the build host can't deny them anymore.
+inline bool requires_reply(const IOEvent &event)
+{
+    switch (event.GetEventType())
+    {
+        case ES_EVENT_TYPE_NOTIFY_FORK:
+        case ES_EVENT_TYPE_NOTIFY_EXEC:
+        case ES_EVENT_TYPE_NOTIFY_EXIT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Writes the record of 'event' to 'buffer', leaving out the executable when the build host will have it once it gets the record.
+// Assumes batch_lock is held by the caller (nothing is sent out of order while it's held).
+static size_t write_record(const IOEvent &event, char *buffer)
+{
+    std::lock_guard<std::mutex> lock(sent_executables_lock);
+    bool executable_interned = sent_executables.Contains(event);
+    event.WriteRecord(buffer, executable_interned);
+
+    // The host processes the messages of a connection in order, so later events can leave the executable out already
+    sent_executables.Record(event);
+    return event.RecordSize(executable_interned);
+}
+
+// Assumes batch_lock is held by the caller
+static void flush_batch()
+{
+    if (batch_count == 0 || bxl_connection == nullptr)
+    {
+        return;
+    }
+
+    xpc_object_t xpc_payload = xpc_dictionary_create(NULL, NULL, 0);
+    xpc_dictionary_set_data(xpc_payload, IOEventBatchKey, batch.data(), batch.size());
+    batch.clear();
+    batch_count = 0;
+
+    // One-way, a failure to process the batch is answered to the next event that waits for a reply
+    xpc_connection_send_message(bxl_connection, xpc_payload);
+    xpc_release(xpc_payload);
+}
+
+inline void flush_pending_events()
+{
+    std::lock_guard<std::mutex> lock(batch_lock);
+    flush_batch();
+}
+
+// Waits until the build host has processed everything sent so far
+inline void send_flush()
+{
+    if (bxl_connection == nullptr)
+    {
+        return;
+    }
+
+    flush_pending_events();
+
+    xpc_object_t xpc_payload = xpc_dictionary_create(NULL, NULL, 0);
+    xpc_dictionary_set_bool(xpc_payload, IOEventFlushKey, true);
+    check_response(xpc_connection_send_message_with_reply_sync(bxl_connection, xpc_payload));
+    xpc_release(xpc_payload);
+}
+
+inline void send_batched(const IOEvent &event)
+{
+    std::lock_guard<std::mutex> lock(batch_lock);
+
+    char record[IOEvent::max_record_size()];
+    uint32_t length = (uint32_t)write_record(event, record);
+
+    size_t offset = batch.size();
+    batch.resize(offset + sizeof(length) + length);
+    memcpy(batch.data() + offset, &length, sizeof(length));
+    memcpy(batch.data() + offset + sizeof(length), record, length);
+    batch_count++;
+
+    if (batch_count >= kBatchSize)
+    {
+        flush_batch();
+    }
+    else if (!batch_flush_scheduled)
+    {
+        batch_flush_scheduled = true;
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, kBatchLatencyNs), bxl_queue, ^()
+        {
+            std::lock_guard<std::mutex> lock(batch_lock);
+            batch_flush_scheduled = false;
+            flush_batch();
+        });
+    }
+}
+
 inline void send_to_sandbox(IOEvent &event, es_event_type_t type = ES_EVENT_TYPE_LAST, bool force_xpc_init = false, bool resolve_paths = true)
 {
-    if (event.IsPlistEvent() || event.IsDirectorySpecialCharacterEvent())
+    if (bxl_clone_execution || event.IsPlistEvent() || event.IsDirectorySpecialCharacterEvent())
     {
         return;
     }
@@ -121,9 +261,10 @@ inline void send_to_sandbox(IOEvent &event, es_event_type_t type = ES_EVENT_TYPE
         handle_xpc_setup();
     });
 
-    // Some interposed syscalls invalidate XPC sessions, re-initialize when required
+    // Some interposed syscalls invalidate XPC sessions, re-initialize when required (after everything sent on the old one got there)
     if (force_xpc_init)
     {
+        send_flush();
         handle_xpc_setup();
     }
 
@@ -138,32 +279,39 @@ inline void send_to_sandbox(IOEvent &event, es_event_type_t type = ES_EVENT_TYPE
         event.SetEventPath(dst_resolved, DST_PATH);
     }
 
-    size_t msg_length = IOEvent::max_size();
-    char msg[msg_length];
+    // Read-only accesses are checked against the manifest right here: the ones the sandbox would not report never leave the
+    // process, and the others don't have to wait for the build host since there's nothing it could deny
+    if (policy != nullptr && DetoursPolicy::IsEvaluatedLocally(event))
+    {
+        if (policy->ShouldSend(event))
+        {
+            send_batched(event);
+        }
 
-    omemorystream oms(msg, sizeof(msg));
-    oms << event;
+        return;
+    }
 
+    char record[IOEvent::max_record_size()];
     xpc_object_t xpc_payload = xpc_dictionary_create(NULL, NULL, 0);
-    xpc_dictionary_set_string(xpc_payload, IOEventKey, msg);
-    xpc_dictionary_set_uint64(xpc_payload, IOEventLengthKey, event.Size());
-
-    xpc_object_t response = xpc_connection_send_message_with_reply_sync(bxl_connection, xpc_payload);
-    xpc_type_t xpc_type = xpc_get_type(response);
-
-    uint64_t status = xpc_response_error;
-    if (xpc_type == XPC_TYPE_DICTIONARY)
+    bool wait_for_reply = requires_reply(event);
     {
-        status = xpc_dictionary_get_uint64(response, "response");
-    }
+        // Everything batched so far has to reach the build host before this event does
+        std::lock_guard<std::mutex> lock(batch_lock);
+        flush_batch();
 
-    xpc_release(response);
+        xpc_dictionary_set_data(xpc_payload, IOEventKey, record, write_record(event, record));
+        if (!wait_for_reply)
+        {
+            xpc_connection_send_message(bxl_connection, xpc_payload);
+        }
+    }
 
-    if (status != xpc_response_success)
+    if (wait_for_reply)
     {
-        fprintf(stderr, "Connecting to XPC bridge service failed, aborting because conistent sandboxing can't be guaranteed - status(%lld)\n", status);
-        abort();
+        check_response(xpc_connection_send_message_with_reply_sync(bxl_connection, xpc_payload));
     }
+
+    xpc_release(xpc_payload);
 }
 
 #pragma mark Interposing Notes
@@ -219,9 +367,14 @@ char** extend_env_with_interposing_lib(char *const *env, char* interpose)
     if (interpose == nullptr) return (char **)env;
 
     uint count = 0;
-    while (env[count]) count++;
+    bool has_fam = false;
+    while (env[count])
+    {
+        has_fam |= strncmp(env[count], BXL_FAM_PATH_ENV "=", strlen(BXL_FAM_PATH_ENV "=")) == 0;
+        count++;
+    }
 
-    char **new_env = (char **) malloc(sizeof(char *) * (count + 2));
+    char **new_env = (char **) malloc(sizeof(char *) * (count + 3));
 
     count = 0;
     while (env[count])
@@ -233,6 +386,10 @@ char** extend_env_with_interposing_lib(char *const *env, char* interpose)
 
     new_env[count] = (char *) calloc(strlen(interpose) + 1, sizeof(char));
     memcpy(new_env[count], interpose, strlen(interpose));
+    if (!has_fam && fam_env_entry[0] != '\0')
+    {
+        new_env[++count] = strdup(fam_env_entry);
+    }
     new_env[++count] = NULL;
     free(interpose);
 
@@ -283,13 +440,21 @@ DYLD_INTERPOSE(bxl_posix_spawnp, posix_spawnp)
 
 pid_t blx_fork(void)
 {
+    // The child gets a copy of the batched events otherwise, and its parent's flush is never going to happen in the child
+    flush_pending_events();
     pid_t result = fork();
+    if (result == 0)
+    {
+        batch_flush_scheduled = false;
+    }
+
     FORK_EVENT_CONSTRUCTOR(result, &result, getpid(), getppid(), >)
 }
 DYLD_INTERPOSE(blx_fork, fork)
 
 pid_t blx_vfork(void)
 {
+    flush_pending_events();
     pid_t result = vfork();
     FORK_EVENT_CONSTRUCTOR(result, &result, getpid(), getppid(), >)
 }
@@ -334,6 +499,14 @@ DYLD_INTERPOSE(bxl__Exit, _Exit)
 
 void __attribute__ ((constructor)) _bxl_linux_sandbox_init(void)
 {
+    // The process may clear its environment later on, so the manifest is loaded right away
+    const char *fam_path = getenv(BXL_FAM_PATH_ENV);
+    policy = DetoursPolicy::Load(fam_path);
+    if (policy != nullptr)
+    {
+        snprintf(fam_env_entry, sizeof(fam_env_entry), "%s=%s", BXL_FAM_PATH_ENV, fam_path);
+    }
+
     atexit_b(^()
     {
         EXIT_EVENT_CONSTRUCTOR()
@@ -529,13 +702,70 @@ int bxl_exchangedata(const char * path1, const char * path2, unsigned int option
 }
 DYLD_INTERPOSE(bxl_exchangedata, exchangedata)
 
+// Resolves 'path' against 'fd' the way the *at functions do, relative paths against the current directory are left to realpath
+static const char* path_at(int fd, const char *path, char *buffer)
+{
+    if (fd == AT_FDCWD || path == nullptr || path[0] == '/')
+    {
+        return path;
+    }
+
+    char directory[PATH_MAX] = { '\0' };
+    if (fcntl(fd, F_GETPATH, directory) == -1)
+    {
+        return path;
+    }
+
+    snprintf(buffer, PATH_MAX, "%s/%s", directory, path);
+    return buffer;
+}
+
 int bxl_clonefile(const char *src, const char *dst, int flags)
 {
     int result = clonefile(src, dst, flags);
-    DEFAULT_EVENT_CONSTRUCTOR(ES_EVENT_TYPE_NOTIFY_CLONE, src, dst, false)
+    CLONE_EVENT_CONSTRUCTOR(src, dst)
 }
 DYLD_INTERPOSE(bxl_clonefile, clonefile)
 
+int bxl_clonefileat(int src_dirfd, const char *src, int dst_dirfd, const char *dst, uint32_t flags)
+{
+    int result = clonefileat(src_dirfd, src, dst_dirfd, dst, flags);
+
+    char src_path[PATH_MAX] = { '\0' };
+    char dst_path[PATH_MAX] = { '\0' };
+    CLONE_EVENT_CONSTRUCTOR(path_at(src_dirfd, src, src_path), path_at(dst_dirfd, dst, dst_path))
+}
+DYLD_INTERPOSE(bxl_clonefileat, clonefileat)
+
+int bxl_fclonefileat(int srcfd, int dst_dirfd, const char *dst, uint32_t flags)
+{
+    int result = fclonefileat(srcfd, dst_dirfd, dst, flags);
+
+    char src_path[PATH_MAX] = { '\0' };
+    char dst_path[PATH_MAX] = { '\0' };
+    fcntl(srcfd, F_GETPATH, src_path);
+    CLONE_EVENT_CONSTRUCTOR(src_path, path_at(dst_dirfd, dst, dst_path))
+}
+DYLD_INTERPOSE(bxl_fclonefileat, fclonefileat)
+
+// A copyfile asked to clone either clones or, if the volume can't, falls back to copying the data. The opens, reads and writes
+// of that fallback are not reported on their own: the clone it is reported as covers all of them.
+int bxl_copyfile(const char *from, const char *to, copyfile_state_t state, copyfile_flags_t flags)
+{
+    bool clones = (flags & (COPYFILE_CLONE | COPYFILE_CLONE_FORCE)) != 0 && (flags & COPYFILE_RECURSIVE) == 0;
+    if (!clones || bxl_clone_execution)
+    {
+        return copyfile(from, to, state, flags);
+    }
+
+    bxl_clone_execution = true;
+    int result = copyfile(from, to, state, flags);
+    bxl_clone_execution = false;
+
+    CLONE_EVENT_CONSTRUCTOR(from, to)
+}
+DYLD_INTERPOSE(bxl_copyfile, copyfile)
+
 int bxl_truncate(const char *path, off_t length)
 {
     int result = truncate(path, length);
@@ -5,6 +5,7 @@
 #define Detours_hpp
 
 #include <assert.h>
+#include <copyfile.h>
 #include <libproc.h>
 #include <os/log.h>
 #include <spawn.h>
@@ -20,6 +21,9 @@
 
 #define DETOURS_BUNDLE_IDENTIFIER "com.microsoft.buildxl.detours"
 
+// CODESYNC: Public/Src/Engine/Processes/SandboxConnectionLinuxDetours.cs (BuildXLFamPathEnvVarName)
+#define BXL_FAM_PATH_ENV "__BUILDXL_FAM_PATH"
+
 #define DYLD_INTERPOSE(_replacment,_replacee) \
     __attribute__ ((used)) static struct{ const void* replacment; const void* replacee; } _interpose_##_replacee \
     __attribute__ ((section ("__DATA,__interpose"))) = { (const void*)(unsigned long)&_replacment, (const void*)(unsigned long)&_replacee };
@@ -70,7 +74,7 @@
     if (success == 0) { \
         bool reported = trackedPaths_->get(path) != nullptr; \
         if (!reported) { \
-            std::shared_ptr<PathCacheEntry> entry(new PathCacheEntry(fildes)); \
+            std::shared_ptr<PathCacheEntry> entry(new PathCacheEntry(path, strlen(path))); \
             trackedPaths_->insert(path, entry); \
             IOEvent event(getpid(), 0, getppid(), ES_EVENT_TYPE_NOTIFY_WRITE, ES_ACTION_TYPE_NOTIFY, path, dst, get_executable_path(getpid()), get_mode(path)); \
             send_to_sandbox(event, ES_EVENT_TYPE_NOTIFY_WRITE); \
@@ -79,4 +83,13 @@
     errno = old_errno; \
     return result;
 
+// Every flavor of clone is one operation for the sandbox: a read of the source and a write of the destination, checked and
+// reported together (see IOHandler::HandleClone). The mode is the one of the clone, which is a directory if the source was one.
+#define CLONE_EVENT_CONSTRUCTOR(src, dst) \
+    int old_errno = errno; \
+    IOEvent event(getpid(), 0, getppid(), ES_EVENT_TYPE_NOTIFY_CLONE, ES_ACTION_TYPE_NOTIFY, src, dst, get_executable_path(getpid()), result == 0 ? get_mode(dst) : 0); \
+    send_to_sandbox(event, ES_EVENT_TYPE_NOTIFY_CLONE); \
+    errno = old_errno; \
+    return result;
+
 #endif /* Detours_hpp */
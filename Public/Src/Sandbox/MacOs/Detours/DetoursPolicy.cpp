@@ -0,0 +1,162 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "DetoursPolicy.hpp"
+
+// CODESYNC: AccessHandler::IgnoreDataPartitionPrefix
+static const char *kDataPartitionPrefix = "/System/Volumes/Data/";
+static const size_t kAdjustedPrefixLength = strlen("/System/Volumes/Data");
+
+static const char* IgnoreDataPartitionPrefix(const char *path)
+{
+    return strncmp(path, kDataPartitionPrefix, strlen(kDataPartitionPrefix)) == 0 ? path + kAdjustedPrefixLength : path;
+}
+
+DetoursPolicy::~DetoursPolicy()
+{
+    if (pathCache_ != nullptr)
+    {
+        delete pathCache_;
+        pathCache_ = nullptr;
+    }
+}
+
+DetoursPolicy* DetoursPolicy::Load(const char *famPath)
+{
+    if (famPath == nullptr || famPath[0] == '\0')
+    {
+        return nullptr;
+    }
+
+    int fd = open(famPath, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return nullptr;
+    }
+
+    struct stat famStat;
+    size_t famLength = fstat(fd, &famStat) == 0 ? famStat.st_size : 0;
+    void *famPayload = famLength > 0 ? mmap(nullptr, famLength, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+
+    if (famPayload == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    DetoursPolicy *policy = new DetoursPolicy();
+    policy->pathCache_ = Trie<AccessCacheRecord>::createPathTrie();
+    if (policy->pathCache_ == nullptr || !policy->fam_.init((const BYTE *)famPayload, famLength) || policy->fam_.HasErrors())
+    {
+        delete policy;
+        munmap(famPayload, famLength);
+        return nullptr;
+    }
+
+    return policy;
+}
+
+bool DetoursPolicy::IsEvaluatedLocally(const IOEvent &event)
+{
+    switch (event.GetEventType())
+    {
+        case ES_EVENT_TYPE_NOTIFY_OPEN:
+        case ES_EVENT_TYPE_NOTIFY_READLINK:
+        case ES_EVENT_TYPE_NOTIFY_CHDIR:
+        case ES_EVENT_TYPE_NOTIFY_FSGETPATH:
+        case ES_EVENT_TYPE_NOTIFY_GETATTRLIST:
+        case ES_EVENT_TYPE_NOTIFY_GETEXTATTR:
+        case ES_EVENT_TYPE_NOTIFY_LISTEXTATTR:
+        case ES_EVENT_TYPE_NOTIFY_ACCESS:
+            return event.GetEventPath(SRC_PATH)[0] == '/';
+        default:
+            return false;
+    }
+}
+
+void DetoursPolicy::GetCheck(const IOEvent &event, CheckFunc *checker, bool *isDir)
+{
+    bool exists = event.EventPathExists();
+    *isDir = exists && S_ISDIR(event.GetMode());
+
+    switch (event.GetEventType())
+    {
+        case ES_EVENT_TYPE_NOTIFY_OPEN:
+        {
+            if (!exists)
+            {
+                // Same as IOHandler::HandleOpen, directories opened for their descriptor come with no mode
+                struct stat sb;
+                exists = lstat(event.GetEventPath(SRC_PATH), &sb) == 0;
+                *isDir = exists && S_ISDIR(sb.st_mode);
+            }
+
+            *checker = !exists ? Checkers::CheckLookup : *isDir ? Checkers::CheckEnumerateDir : Checkers::CheckRead;
+            break;
+        }
+        case ES_EVENT_TYPE_NOTIFY_READLINK:
+            *isDir = false;
+            *checker = Checkers::CheckRead;
+            break;
+
+        case ES_EVENT_TYPE_NOTIFY_CHDIR:
+        case ES_EVENT_TYPE_NOTIFY_FSGETPATH:
+            *checker = exists ? Checkers::CheckRead : Checkers::CheckLookup;
+            break;
+
+        default:
+            *checker = exists ? Checkers::CheckProbe : Checkers::CheckLookup;
+            break;
+    }
+}
+
+PolicyResult DetoursPolicy::PolicyForPath(const char *absolutePath) const
+{
+    const char *pathWithoutRootSentinel = absolutePath + 1;
+    PolicySearchCursor cursor = FindFileAccessPolicyInTreeEx(fam_.GetUnixRootNode(), pathWithoutRootSentinel, strlen(pathWithoutRootSentinel));
+    return PolicyResult(fam_.GetFamFlags(), fam_.GetFamExtraFlags(), absolutePath, cursor);
+}
+
+bool DetoursPolicy::ShouldSend(const IOEvent &event)
+{
+    if (!IsEvaluatedLocally(event))
+    {
+        return true;
+    }
+
+    CheckFunc checker;
+    bool isDir;
+    GetCheck(event, &checker, &isDir);
+
+    const char *path = IgnoreDataPartitionPrefix(event.GetEventPath(SRC_PATH));
+    std::shared_ptr<AccessCacheRecord> record = pathCache_->get(path);
+    if (record == nullptr)
+    {
+        // Yields nullptr for paths the trie can't hold (i.e., non-ascii), those are just not cached
+        record = pathCache_->getOrAdd(path, std::make_shared<AccessCacheRecord>());
+    }
+
+    AccessCheckResult result = AccessCheckResult::Invalid();
+    if (record == nullptr || !record->TryGetDecision(checker, isDir, &result))
+    {
+        checker(PolicyForPath(path), isDir, &result);
+        if (record != nullptr)
+        {
+            record->AddDecision(checker, isDir, result);
+        }
+    }
+
+    if (!result.ShouldReport())
+    {
+        return false;
+    }
+
+    return record == nullptr || !record->CheckAndUpdate(result);
+}
@@ -0,0 +1,61 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef DetoursPolicy_hpp
+#define DetoursPolicy_hpp
+
+#include "AccessCacheRecord.hpp"
+#include "Checkers.hpp"
+#include "FileAccessManifestParser.hpp"
+#include "IOEvent.hpp"
+#include "Trie.hpp"
+
+/*!
+ * The file access manifest of the pip, evaluated by an interposed process itself.
+ *
+ * The build host saves the manifest of a pip next to its other files and passes its path down to the interposed processes
+ * (see __BUILDXL_FAM_PATH), which is how read-only accesses the sandbox would not report anyway never leave the process.
+ * The decisions are the same ones IOHandler makes (which still evaluates every event it gets), for the events handled here.
+ */
+class DetoursPolicy final
+{
+private:
+
+    FileAccessManifestParseResult fam_;
+
+    /*! The accesses checked and reported by this process so far, per path */
+    Trie<AccessCacheRecord> *pathCache_ = nullptr;
+
+    DetoursPolicy() {}
+
+    // CODESYNC: IOHandler::CheckAccessAndBuildReport (only for the events IsEvaluatedLocally accepts)
+    static void GetCheck(const IOEvent &event, CheckFunc *checker, bool *isDir);
+
+    PolicyResult PolicyForPath(const char *absolutePath) const;
+
+public:
+
+    DetoursPolicy(const DetoursPolicy&) = delete;
+    DetoursPolicy& operator = (const DetoursPolicy&) = delete;
+    ~DetoursPolicy();
+
+    /*!
+     * Maps the manifest saved at 'famPath' (which stays mapped for the lifetime of the process, the manifest is parsed in place).
+     * Returns nullptr if there is no such manifest, in which case every event has to be sent to the sandbox.
+     */
+    static DetoursPolicy* Load(const char *famPath);
+
+    /*!
+     * Whether 'event' is a read-only access evaluated here. Those don't change the file system, so the build host doesn't
+     * have to be waited for before they are let through.
+     */
+    static bool IsEvaluatedLocally(const IOEvent &event);
+
+    /*!
+     * Returns false if the sandbox would drop 'event', i.e., it's not reported by the manifest or the same access (or a stronger
+     * one) was already reported by this process. Always true for the events that are not evaluated locally.
+     */
+    bool ShouldSend(const IOEvent &event);
+};
+
+#endif /* DetoursPolicy_hpp */
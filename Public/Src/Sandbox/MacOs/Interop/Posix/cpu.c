@@ -1,6 +1,10 @@
 // Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/sysctl.h>
+
 #include "cpu.h"
 
 int GetCpuLoadInfo(CpuLoadInfo *buffer, long bufferSize)
@@ -33,9 +37,143 @@ int GetCpuLoadInfo(CpuLoadInfo *buffer, long bufferSize)
         totalIdleTime += cpuInfo[(CPU_STATE_MAX * i) + CPU_STATE_IDLE];
     }
     
+    vm_deallocate(mach_task_self(), (vm_address_t)cpuInfo, cpuInfoCount * sizeof(integer_t));
+
     buffer->systemTime = totalSystemTime;
     buffer->userTime = totalUserTime;
     buffer->idleTime = totalIdleTime;
     
     return KERN_SUCCESS;
 }
+
+struct CpuSampler
+{
+    pthread_mutex_t lock;
+    natural_t coreCount;
+    uint32_t efficiencyCoreCount;
+
+    // Busy and total ticks of every core at the previous sample. The kernel counters are 32 bits wide and wrap around,
+    // which the (unsigned) differences taken against them account for.
+    uint32_t *previousBusyTicks;
+    uint32_t *previousTotalTicks;
+};
+
+// On hosts with more than one kind of core (Apple Silicon), perflevel1 is the efficiency cores, which come first in the
+// numbering of the logical cores
+static uint32_t GetEfficiencyCoreCount(void)
+{
+    int levels = 0;
+    size_t length = sizeof(levels);
+    if (sysctlbyname("hw.nperflevels", &levels, &length, NULL, 0) != 0 || levels < 2)
+    {
+        return 0;
+    }
+
+    int count = 0;
+    length = sizeof(count);
+    return sysctlbyname("hw.perflevel1.logicalcpu", &count, &length, NULL, 0) == 0 && count > 0 ? (uint32_t)count : 0;
+}
+
+static inline uint32_t ToBasisPoints(uint64_t busy, uint64_t total)
+{
+    return total == 0 ? 0 : (uint32_t)((busy * 10000) / total);
+}
+
+CpuSampler* CreateCpuSampler(void)
+{
+    CpuSampler *sampler = calloc(1, sizeof(CpuSampler));
+    if (sampler == NULL)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_init(&sampler->lock, NULL);
+    sampler->efficiencyCoreCount = GetEfficiencyCoreCount();
+    return sampler;
+}
+
+void DestroyCpuSampler(CpuSampler *sampler)
+{
+    if (sampler != NULL)
+    {
+        pthread_mutex_destroy(&sampler->lock);
+        free(sampler->previousBusyTicks);
+        free(sampler->previousTotalTicks);
+        free(sampler);
+    }
+}
+
+int SampleCpuLoad(CpuSampler *sampler, CpuLoadDelta *buffer, long bufferSize, uint32_t *coreUsages, int coreUsagesCount)
+{
+    if (sizeof(CpuLoadDelta) != bufferSize)
+    {
+        printf("ERROR: Wrong size of CpuLoadDelta buffer; expected %ld, received %ld\n", sizeof(CpuLoadDelta), bufferSize);
+        return KERN_MEMORY_ERROR;
+    }
+
+    mach_msg_type_number_t cpuInfoCount;
+    processor_info_array_t cpuInfo;
+    natural_t numberOfLogicalCores = 0U;
+
+    kern_return_t error = host_processor_info(mach_host_self(), PROCESSOR_CPU_LOAD_INFO, &numberOfLogicalCores, &cpuInfo, &cpuInfoCount);
+    if (error != KERN_SUCCESS)
+    {
+        return error;
+    }
+
+    pthread_mutex_lock(&sampler->lock);
+
+    // The previous sample is useless if the number of cores changed
+    if (sampler->coreCount != numberOfLogicalCores)
+    {
+        free(sampler->previousBusyTicks);
+        free(sampler->previousTotalTicks);
+        sampler->previousBusyTicks = calloc(numberOfLogicalCores, sizeof(uint32_t));
+        sampler->previousTotalTicks = calloc(numberOfLogicalCores, sizeof(uint32_t));
+        sampler->coreCount = numberOfLogicalCores;
+        if (sampler->previousBusyTicks == NULL || sampler->previousTotalTicks == NULL)
+        {
+            sampler->coreCount = 0;
+            error = KERN_MEMORY_ERROR;
+        }
+    }
+
+    if (error == KERN_SUCCESS)
+    {
+        uint32_t efficiencyCores = sampler->efficiencyCoreCount < numberOfLogicalCores ? sampler->efficiencyCoreCount : 0;
+        uint64_t busy[2] = { 0, 0 }, total[2] = { 0, 0 }; // [0]: efficiency cores, [1]: performance cores
+
+        for (natural_t i = 0; i < numberOfLogicalCores; ++i)
+        {
+            uint32_t coreBusyTicks = (uint32_t)cpuInfo[(CPU_STATE_MAX * i) + CPU_STATE_USER]
+                                   + (uint32_t)cpuInfo[(CPU_STATE_MAX * i) + CPU_STATE_NICE]
+                                   + (uint32_t)cpuInfo[(CPU_STATE_MAX * i) + CPU_STATE_SYSTEM];
+            uint32_t coreTotalTicks = coreBusyTicks + (uint32_t)cpuInfo[(CPU_STATE_MAX * i) + CPU_STATE_IDLE];
+
+            uint32_t busyDelta = coreBusyTicks - sampler->previousBusyTicks[i];
+            uint32_t totalDelta = coreTotalTicks - sampler->previousTotalTicks[i];
+            sampler->previousBusyTicks[i] = coreBusyTicks;
+            sampler->previousTotalTicks[i] = coreTotalTicks;
+
+            int kind = i < efficiencyCores ? 0 : 1;
+            busy[kind] += busyDelta;
+            total[kind] += totalDelta;
+
+            if (coreUsages != NULL && (int)i < coreUsagesCount)
+            {
+                coreUsages[i] = ToBasisPoints(busyDelta, totalDelta);
+            }
+        }
+
+        buffer->usage = ToBasisPoints(busy[0] + busy[1], total[0] + total[1]);
+        buffer->performanceCoresUsage = ToBasisPoints(busy[1], total[1]);
+        buffer->efficiencyCoresUsage = ToBasisPoints(busy[0], total[0]);
+        buffer->coreCount = numberOfLogicalCores;
+        buffer->efficiencyCoreCount = efficiencyCores;
+    }
+
+    pthread_mutex_unlock(&sampler->lock);
+
+    vm_deallocate(mach_task_self(), (vm_address_t)cpuInfo, cpuInfoCount * sizeof(integer_t));
+    return error;
+}
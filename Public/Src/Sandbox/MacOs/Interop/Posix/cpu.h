@@ -15,4 +15,33 @@ typedef struct {
 
 int GetCpuLoadInfo(CpuLoadInfo *buffer, long bufferSize);
 
+// CPU utilization since the previous sample of a 'CpuSampler' (unit: basis points, 10000 meaning fully busy)
+typedef struct {
+    uint32_t usage;                     /* All the logical cores */
+    uint32_t performanceCoresUsage;     /* The performance cores, i.e., all of them if the host has a single kind of core */
+    uint32_t efficiencyCoresUsage;      /* The efficiency cores (0 if the host has none) */
+    uint32_t coreCount;                 /* Number of logical cores */
+    uint32_t efficiencyCoreCount;       /* Number of logical efficiency cores */
+} CpuLoadDelta;
+
+/*!
+ * Computes CPU utilization from the tick counters of every logical core, keeping the counters of the previous sample around so
+ * the caller doesn't have to diff them. Every sampler has its own previous sample, so independent callers don't interfere.
+ */
+typedef struct CpuSampler CpuSampler;
+
+CpuSampler* CreateCpuSampler(void);
+void DestroyCpuSampler(CpuSampler *sampler);
+
+/*!
+ * Samples the load of the CPU since the previous call with the same sampler (or since boot for the first call).
+ * @param sampler Sampler created by 'CreateCpuSampler'
+ * @param buffer Buffer where the aggregated utilization is stored
+ * @param bufferSize Allocated size of the 'buffer' struct
+ * @param coreUsages Buffer where the utilization of every logical core is stored (efficiency cores first), may be NULL
+ * @param coreUsagesCount Number of entries 'coreUsages' has room for; the utilization of the cores past it is not stored
+ * @result KERN_SUCCESS on success, error code otherwise.
+ */
+int SampleCpuLoad(CpuSampler *sampler, CpuLoadDelta *buffer, long bufferSize, uint32_t *coreUsages, int coreUsagesCount);
+
 #endif /* cpu_h */
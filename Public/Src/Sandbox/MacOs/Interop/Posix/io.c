@@ -2,10 +2,16 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/attr.h>
 #include <sys/errno.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
+#include <sys/vnode.h>
 #include <unistd.h>
 
 #include "io.h"
@@ -88,6 +94,186 @@ int StatFileDescriptor(intptr_t fd, StatBuffer *statBuffer, long bufferSize)
     return result;
 }
 
+// Attributes requested from getattrlistbulk for every directory entry. With FSOPT_PACK_INVAL_ATTRS every one of them is
+// packed (zero filled if the file system doesn't have it), so the records always have the layout read by 'ReadBulkEntry'.
+#define BULK_COMMON_ATTRS (ATTR_CMN_RETURNED_ATTRS | ATTR_CMN_NAME | ATTR_CMN_ERROR | ATTR_CMN_DEVID | ATTR_CMN_OBJTYPE | \
+                           ATTR_CMN_CRTIME | ATTR_CMN_MODTIME | ATTR_CMN_CHGTIME | ATTR_CMN_ACCTIME | \
+                           ATTR_CMN_OWNERID | ATTR_CMN_GRPID | ATTR_CMN_ACCESSMASK | ATTR_CMN_FILEID)
+#define BULK_DIR_ATTRS    (ATTR_DIR_LINKCOUNT)
+#define BULK_FILE_ATTRS   (ATTR_FILE_LINKCOUNT | ATTR_FILE_DATALENGTH)
+
+// Smallest record getattrlistbulk can return: the record length followed by the attributes above and a 1 character name.
+// Every attribute is padded to 4 bytes, which all of their sizes already are.
+#define BULK_MIN_ENTRY_SIZE (sizeof(uint32_t) + sizeof(attribute_set_t) + sizeof(uint32_t) + sizeof(attrreference_t) + \
+                             sizeof(dev_t) + sizeof(fsobj_type_t) + 4 * sizeof(struct timespec) + \
+                             sizeof(uid_t) + sizeof(gid_t) + sizeof(uint32_t) + sizeof(uint64_t) + \
+                             sizeof(uint32_t) + sizeof(uint32_t) + sizeof(off_t) + 4)
+
+// A record with the longest name a directory entry can have (NAME_MAX UTF-8 characters)
+#define BULK_MAX_ENTRY_SIZE (BULK_MIN_ENTRY_SIZE + 3 * NAME_MAX + 1)
+
+static inline const char *ReadAttr(const char *cursor, void *value, size_t size)
+{
+    memcpy(value, cursor, size);
+    return cursor + size;
+}
+
+static mode_t ObjectTypeToMode(fsobj_type_t type)
+{
+    switch (type)
+    {
+        case VREG:  return S_IFREG;
+        case VDIR:  return S_IFDIR;
+        case VLNK:  return S_IFLNK;
+        case VBLK:  return S_IFBLK;
+        case VCHR:  return S_IFCHR;
+        case VFIFO: return S_IFIFO;
+        case VSOCK: return S_IFSOCK;
+        default:    return 0;
+    }
+}
+
+/*!
+ * Converts a getattrlistbulk record into a 'StatBuffer' and points 'name' to the entry name inside the record.
+ * Returns the error getattrlistbulk reported for the entry (0 if none), in which case only 'name' is valid.
+ */
+static uint32_t ReadBulkEntry(const char *entry, StatBuffer *statBuffer, const char **name)
+{
+    const char *cursor = entry + sizeof(uint32_t);
+
+    attribute_set_t returned;
+    cursor = ReadAttr(cursor, &returned, sizeof(returned));
+
+    uint32_t error;
+    cursor = ReadAttr(cursor, &error, sizeof(error));
+
+    // The offset of the name is relative to the reference itself
+    attrreference_t nameRef;
+    const char *nameRefStart = cursor;
+    cursor = ReadAttr(cursor, &nameRef, sizeof(nameRef));
+    *name = nameRefStart + nameRef.attr_dataoffset;
+
+    if (error != 0)
+    {
+        return error;
+    }
+
+    dev_t dev;
+    fsobj_type_t type;
+    struct timespec crTime, modTime, chgTime, accTime;
+    uid_t uid;
+    gid_t gid;
+    uint32_t accessMask;
+    uint64_t fileId;
+    uint32_t dirLinkCount, fileLinkCount;
+    off_t dataLength;
+
+    cursor = ReadAttr(cursor, &dev, sizeof(dev));
+    cursor = ReadAttr(cursor, &type, sizeof(type));
+    cursor = ReadAttr(cursor, &crTime, sizeof(crTime));
+    cursor = ReadAttr(cursor, &modTime, sizeof(modTime));
+    cursor = ReadAttr(cursor, &chgTime, sizeof(chgTime));
+    cursor = ReadAttr(cursor, &accTime, sizeof(accTime));
+    cursor = ReadAttr(cursor, &uid, sizeof(uid));
+    cursor = ReadAttr(cursor, &gid, sizeof(gid));
+    cursor = ReadAttr(cursor, &accessMask, sizeof(accessMask));
+    cursor = ReadAttr(cursor, &fileId, sizeof(fileId));
+    cursor = ReadAttr(cursor, &dirLinkCount, sizeof(dirLinkCount));
+    cursor = ReadAttr(cursor, &fileLinkCount, sizeof(fileLinkCount));
+    cursor = ReadAttr(cursor, &dataLength, sizeof(dataLength));
+
+    bool isDirectory = type == VDIR;
+
+    statBuffer->st_dev                = dev;
+    statBuffer->st_ino                = fileId;
+    statBuffer->st_mode               = ObjectTypeToMode(type) | (accessMask & ~S_IFMT);
+    statBuffer->st_nlink              = isDirectory ? dirLinkCount : fileLinkCount;
+    statBuffer->st_uid                = uid;
+    statBuffer->st_gid                = gid;
+    statBuffer->st_size               = isDirectory ? 0 : dataLength;
+    statBuffer->st_atimespec          = accTime.tv_sec;
+    statBuffer->st_atimespec_nsec     = accTime.tv_nsec;
+    statBuffer->st_mtimespec          = modTime.tv_sec;
+    statBuffer->st_mtimespec_nsec     = modTime.tv_nsec;
+    statBuffer->st_ctimespec          = chgTime.tv_sec;
+    statBuffer->st_ctimespec_nsec     = chgTime.tv_nsec;
+    statBuffer->st_birthtimespec      = crTime.tv_sec;
+    statBuffer->st_birthtimespec_nsec = crTime.tv_nsec;
+
+    return 0;
+}
+
+int StatDirectoryEntries(intptr_t fd, StatBuffer *statBuffers, int statBuffersCount, long bufferSize, char *namesBuffer, long namesBufferSize)
+{
+    if (sizeof(StatBuffer) != bufferSize)
+    {
+        printf("ERROR: Wrong size of StatBuffer buffer; expected %ld, received %ld\n", sizeof(StatBuffer), bufferSize);
+        return RUNTIME_ERROR;
+    }
+
+    // Entries handed out by getattrlistbulk can't be given back, so it is only given as much room as the output buffers
+    // can hold for sure: every record holds its name, and is at least BULK_MIN_ENTRY_SIZE bytes long.
+    size_t attrBufferSize = (size_t)statBuffersCount * BULK_MIN_ENTRY_SIZE;
+    if (attrBufferSize > (size_t)namesBufferSize)
+    {
+        attrBufferSize = (size_t)namesBufferSize;
+    }
+
+    if (statBuffersCount <= 0 || attrBufferSize < BULK_MAX_ENTRY_SIZE)
+    {
+        errno = EINVAL;
+        return RUNTIME_ERROR;
+    }
+
+    char *attrBuffer = malloc(attrBufferSize);
+    if (attrBuffer == NULL)
+    {
+        errno = ENOMEM;
+        return RUNTIME_ERROR;
+    }
+
+    struct attrlist attributes = {0};
+    attributes.bitmapcount = ATTR_BIT_MAP_COUNT;
+    attributes.commonattr = BULK_COMMON_ATTRS;
+    attributes.dirattr = BULK_DIR_ATTRS;
+    attributes.fileattr = BULK_FILE_ATTRS;
+
+    int dirfd = ToFileDescriptorUnchecked(fd);
+    int count;
+    while ((count = getattrlistbulk(dirfd, &attributes, attrBuffer, attrBufferSize, FSOPT_PACK_INVAL_ATTRS)) < 0 && errno == EINTR);
+
+    char *nextName = namesBuffer;
+    const char *entry = attrBuffer;
+    for (int i = 0; i < count; i++)
+    {
+        const char *name;
+        if (ReadBulkEntry(entry, &statBuffers[i], &name) != 0)
+        {
+            // The file system couldn't produce the attributes of this one entry, so it is stat-ed on its own
+            struct stat fileStat;
+            if (fstatat(dirfd, name, &fileStat, AT_SYMLINK_NOFOLLOW) == 0)
+            {
+                ConvertStatToStatBuffer(&fileStat, &statBuffers[i]);
+            }
+            else
+            {
+                memset(&statBuffers[i], 0, sizeof(StatBuffer));
+            }
+        }
+
+        size_t nameLength = strlen(name) + 1;
+        memcpy(nextName, name, nameLength);
+        nextName += nameLength;
+
+        uint32_t entryLength;
+        ReadAttr(entry, &entryLength, sizeof(entryLength));
+        entry += entryLength;
+    }
+
+    free(attrBuffer);
+    return count;
+}
+
 intptr_t Open(const char *path, int32_t flags, int32_t mode)
 {
     int result;
@@ -160,6 +346,151 @@ int SetFilePermissionsForFilePath(const char *path, mode_t permissions, bool fol
     return followSymlink ? chmod(path, permissions) : fchmodat(AT_FDCWD, path, permissions, AT_SYMLINK_NOFOLLOW);
 }
 
+// Upper bound of the threads SetFileAttributes spreads the updates over: these calls are bound by the file system, which
+// stops scaling well before the number of cores does
+#define MAX_ATTRIBUTE_UPDATE_THREADS 8
+
+// Attributes ATTRIBUTE_UPDATE_TIMESTAMPS sets with a single setattrlistat call. The values are packed in the order of
+// their bits, which is the order of the fields below.
+#define ATTRIBUTE_UPDATE_TIME_ATTRS (ATTR_CMN_CRTIME | ATTR_CMN_MODTIME | ATTR_CMN_CHGTIME | ATTR_CMN_ACCTIME)
+
+typedef struct {
+    struct timespec crTime;
+    struct timespec modTime;
+    struct timespec chgTime;
+    struct timespec accTime;
+} AttributeUpdateTimes;
+
+typedef struct {
+    int dirfd;
+    FileAttributeUpdate *updates;
+    int updatesCount;
+    const char *paths;
+    long pathsSize;
+    atomic_int nextUpdate;
+    atomic_int failedCount;
+} AttributeUpdateBatch;
+
+static int ApplyAttributeUpdate(int dirfd, const FileAttributeUpdate *update, const char *path)
+{
+    bool followSymlink = (update->flags & ATTRIBUTE_UPDATE_FOLLOW_SYMLINK) != 0;
+
+    if ((update->flags & ATTRIBUTE_UPDATE_MODE) != 0 &&
+        fchmodat(dirfd, path, (mode_t)update->mode, followSymlink ? 0 : AT_SYMLINK_NOFOLLOW) != 0)
+    {
+        return errno;
+    }
+
+    // Changing the mode updates the change time, so the timestamps go last
+    if ((update->flags & ATTRIBUTE_UPDATE_TIMESTAMPS) != 0)
+    {
+        AttributeUpdateTimes times;
+        times.crTime.tv_sec   = update->st_birthtimespec;
+        times.crTime.tv_nsec  = update->st_birthtimespec_nsec;
+        times.modTime.tv_sec  = update->st_mtimespec;
+        times.modTime.tv_nsec = update->st_mtimespec_nsec;
+        times.chgTime.tv_sec  = update->st_ctimespec;
+        times.chgTime.tv_nsec = update->st_ctimespec_nsec;
+        times.accTime.tv_sec  = update->st_atimespec;
+        times.accTime.tv_nsec = update->st_atimespec_nsec;
+
+        struct attrlist attributes = {0};
+        attributes.bitmapcount = ATTR_BIT_MAP_COUNT;
+        attributes.commonattr = ATTRIBUTE_UPDATE_TIME_ATTRS;
+
+        if (setattrlistat(dirfd, path, &attributes, &times, sizeof(times), followSymlink ? 0 : FSOPT_NOFOLLOW) != 0)
+        {
+            return errno;
+        }
+    }
+
+    return 0;
+}
+
+static void *ApplyAttributeUpdates(void *arg)
+{
+    AttributeUpdateBatch *batch = (AttributeUpdateBatch *)arg;
+
+    int index;
+    while ((index = atomic_fetch_add(&batch->nextUpdate, 1)) < batch->updatesCount)
+    {
+        FileAttributeUpdate *update = &batch->updates[index];
+
+        // Every path must be null-terminated within the paths buffer
+        long offset = update->pathOffset;
+        if (offset < 0 || offset >= batch->pathsSize || memchr(batch->paths + offset, '\0', batch->pathsSize - offset) == NULL)
+        {
+            update->status = EINVAL;
+        }
+        else
+        {
+            update->status = ApplyAttributeUpdate(batch->dirfd, update, batch->paths + offset);
+        }
+
+        if (update->status != 0)
+        {
+            atomic_fetch_add(&batch->failedCount, 1);
+        }
+    }
+
+    return NULL;
+}
+
+int SetFileAttributes(intptr_t dirfd, FileAttributeUpdate *updates, int updatesCount, long updateSize, const char *paths, long pathsSize, int threadCount)
+{
+    if (sizeof(FileAttributeUpdate) != updateSize)
+    {
+        printf("ERROR: Wrong size of FileAttributeUpdate buffer; expected %ld, received %ld\n", sizeof(FileAttributeUpdate), updateSize);
+        return RUNTIME_ERROR;
+    }
+
+    if (updatesCount < 0 || (updatesCount > 0 && (updates == NULL || paths == NULL)))
+    {
+        errno = EINVAL;
+        return RUNTIME_ERROR;
+    }
+
+    AttributeUpdateBatch batch;
+    batch.dirfd = dirfd < 0 ? AT_FDCWD : ToFileDescriptorUnchecked(dirfd);
+    batch.updates = updates;
+    batch.updatesCount = updatesCount;
+    batch.paths = paths;
+    batch.pathsSize = pathsSize;
+    atomic_init(&batch.nextUpdate, 0);
+    atomic_init(&batch.failedCount, 0);
+
+    // The calling thread takes its share of the updates along with the workers. A worker that can't be started just leaves
+    // its share to the others.
+    if (threadCount > MAX_ATTRIBUTE_UPDATE_THREADS)
+    {
+        threadCount = MAX_ATTRIBUTE_UPDATE_THREADS;
+    }
+
+    if (threadCount > updatesCount)
+    {
+        threadCount = updatesCount;
+    }
+
+    pthread_t workers[MAX_ATTRIBUTE_UPDATE_THREADS];
+    int workerCount = 0;
+    for (int i = 1; i < threadCount; i++)
+    {
+        if (pthread_create(&workers[workerCount], NULL, ApplyAttributeUpdates, &batch) == 0)
+        {
+            workerCount++;
+        }
+    }
+
+    ApplyAttributeUpdates(&batch);
+
+    for (int i = 0; i < workerCount; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+
+    return atomic_load(&batch.failedCount);
+}
+
 int GetFilePermissionsForFilePath(const char *path, bool followSymlink)
 {
     if (path == NULL)
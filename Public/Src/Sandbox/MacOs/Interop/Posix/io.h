@@ -47,6 +47,20 @@ int StatFile(const char *path, bool followSymlink, StatBuffer *statBuffer, long
 */
 int StatFileDescriptor(intptr_t fd, StatBuffer *statBuffer, long bufferSize);
 
+/*!
+ * Returns information about the next entries of the directory specified by the given file descriptor, using the
+ * bulk 'getattrlistbulk' call instead of one call per entry (symlinks are not followed, as with 'lstat', and the
+ * size of a directory is reported as 0). Enumeration resumes where the previous call on the same descriptor stopped.
+ * @param fd File descriptor of an open directory
+ * @param statBuffers Buffer where the information of the entries is stored, one 'StatBuffer' per entry
+ * @param statBuffersCount Number of 'StatBuffer' structs 'statBuffers' has room for
+ * @param bufferSize Allocated size of one 'StatBuffer' struct
+ * @param namesBuffer Buffer where the names of the entries are stored, null-terminated and back to back, in the same order
+ * @param namesBufferSize Allocated size of 'namesBuffer', big enough for at least one entry with the longest possible name
+ * @result Number of entries stored, 0 when there are no more entries, error code otherwise.
+*/
+int StatDirectoryEntries(intptr_t fd, StatBuffer *statBuffers, int statBuffersCount, long bufferSize, char *namesBuffer, long namesBufferSize);
+
 /*!
  * Opens file specified by path.
  * @param path Given path to open
@@ -63,6 +77,39 @@ int SetTimeStampsForFilePath(const char *path, bool followSymlink, StatBuffer bu
 int GetFilePermissionsForFilePath(const char *path, bool followSymlink);
 int SetFilePermissionsForFilePath(const char *path, mode_t permissions, bool followSymlink);
 
+#define ATTRIBUTE_UPDATE_TIMESTAMPS     0x1 /* Set the timestamps, as SetTimeStampsForFilePath does */
+#define ATTRIBUTE_UPDATE_MODE           0x2 /* Set the permission bits, as SetFilePermissionsForFilePath does */
+#define ATTRIBUTE_UPDATE_FOLLOW_SYMLINK 0x4 /* Apply the changes to the target of a symlink rather than to the symlink itself */
+
+typedef struct {
+    int32_t pathOffset;              /* Offset of the null-terminated path of the file in the paths buffer */
+    int32_t flags;                   /* Changes to apply, a combination of the ATTRIBUTE_UPDATE_* flags */
+    int32_t mode;                    /* Permission bits, with ATTRIBUTE_UPDATE_MODE */
+    int32_t status;                  /* Set to 0 when every change was applied, to the error of the first one that failed otherwise */
+    int64_t st_atimespec;            /* Timestamps, with ATTRIBUTE_UPDATE_TIMESTAMPS */
+    int64_t st_atimespec_nsec;
+    int64_t st_mtimespec;
+    int64_t st_mtimespec_nsec;
+    int64_t st_ctimespec;
+    int64_t st_ctimespec_nsec;
+    int64_t st_birthtimespec;
+    int64_t st_birthtimespec_nsec;
+} FileAttributeUpdate;
+
+/*!
+ * Applies timestamp and permission changes to a batch of files in a single call, setting the 'status' of every one of them.
+ * @param dirfd File descriptor of the directory the paths are relative to, or a negative value for paths that are absolute
+ *              (or relative to the current directory)
+ * @param updates Changes to apply, one 'FileAttributeUpdate' per file
+ * @param updatesCount Number of 'FileAttributeUpdate' structs in 'updates'
+ * @param updateSize Allocated size of one 'FileAttributeUpdate' struct
+ * @param paths Buffer holding the null-terminated paths the 'pathOffset' of the updates point into
+ * @param pathsSize Allocated size of 'paths'
+ * @param threadCount Number of threads the updates are spread over, the calling thread does them all when it is 1 or less
+ * @result Number of files for which some change failed, error code when the arguments are not valid.
+*/
+int SetFileAttributes(intptr_t dirfd, FileAttributeUpdate *updates, int updatesCount, long updateSize, const char *paths, long pathsSize, int threadCount);
+
 int GetFileSystemType(intptr_t fd, char *fsTypeNameBuffer, size_t bufferSize);
 
 #endif /* io_h */
@@ -1,6 +1,8 @@
 // Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
+#include <stdatomic.h>
+
 #include "memory.h"
 
 int GetRamUsageInfo(RamUsageInfo *buffer, long bufferSize)
@@ -42,8 +44,73 @@ int GetRamUsageInfo(RamUsageInfo *buffer, long bufferSize)
     return KERN_SUCCESS;
 }
 
+static dispatch_source_t s_memoryPressureSource = NULL;
+
+// Last level delivered by the memory pressure source (0 while notifications are off)
+static _Atomic int s_memoryPressureLevel = 0;
+
 int GetMemoryPressureLevel(int *level)
 {
+    int lastLevel = atomic_load(&s_memoryPressureLevel);
+    if (lastLevel != 0)
+    {
+        *level = lastLevel;
+        return KERN_SUCCESS;
+    }
+
     size_t length = sizeof(int);
     return sysctlbyname("kern.memorystatus_vm_pressure_level", level, &length, NULL, 0);
 }
+
+bool StartMemoryPressureNotifications(memory_pressure_callback callback)
+{
+    if (s_memoryPressureSource != NULL || callback == NULL)
+    {
+        return false;
+    }
+
+    // The source only fires on transitions, so it starts off with the current level
+    int level;
+    size_t length = sizeof(int);
+    if (sysctlbyname("kern.memorystatus_vm_pressure_level", &level, &length, NULL, 0) != 0)
+    {
+        return false;
+    }
+
+    dispatch_source_t source = dispatch_source_create(
+        DISPATCH_SOURCE_TYPE_MEMORYPRESSURE,
+        0,
+        DISPATCH_MEMORYPRESSURE_NORMAL | DISPATCH_MEMORYPRESSURE_WARN | DISPATCH_MEMORYPRESSURE_CRITICAL,
+        dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0));
+    if (source == NULL)
+    {
+        return false;
+    }
+
+    atomic_store(&s_memoryPressureLevel, level);
+    dispatch_source_set_event_handler(source, ^()
+    {
+        int newLevel = (int)dispatch_source_get_data(source);
+        if (atomic_exchange(&s_memoryPressureLevel, newLevel) != newLevel)
+        {
+            callback(newLevel);
+        }
+    });
+
+    s_memoryPressureSource = source;
+    dispatch_resume(source);
+    return true;
+}
+
+void StopMemoryPressureNotifications(void)
+{
+    if (s_memoryPressureSource == NULL)
+    {
+        return;
+    }
+
+    dispatch_source_cancel(s_memoryPressureSource);
+    dispatch_release(s_memoryPressureSource);
+    s_memoryPressureSource = NULL;
+    atomic_store(&s_memoryPressureLevel, 0);
+}
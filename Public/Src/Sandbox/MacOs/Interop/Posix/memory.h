@@ -4,6 +4,7 @@
 #ifndef memory_h
 #define memory_h
 
+#include <dispatch/dispatch.h>
 #include <sys/sysctl.h>
 #include "Dependencies.h"
 
@@ -26,4 +27,15 @@ typedef struct {
 int GetRamUsageInfo(RamUsageInfo *buffer, long bufferSize);
 int GetMemoryPressureLevel(int *level);
 
+// Receives the new memory pressure level (one of the DISPATCH_MEMORYPRESSURE_* flags) whenever it changes
+typedef void (*memory_pressure_callback)(int level);
+
+/*!
+ * Starts delivering memory pressure level transitions to 'callback' as the OS signals them, instead of having to poll
+ * 'GetMemoryPressureLevel' (which, while notifications are on, just returns the last level that was delivered).
+ * Returns false if notifications are already started or can't be set up.
+ */
+bool StartMemoryPressureNotifications(memory_pressure_callback callback);
+void StopMemoryPressureNotifications(void);
+
 #endif /* memory_h */
@@ -14,52 +14,127 @@
 
 void DumpThreadState(void);
 
+// Scratch space for walking process trees, reused across samples instead of being allocated on every call (every
+// sampling thread gets its own, so concurrent samples don't need any locking)
+static __thread pid_t *s_treePids = NULL;
+static __thread int s_treePidsCapacity = 0;
+
+static bool EnsureTreePidsCapacity(int capacity)
+{
+    if (capacity <= s_treePidsCapacity)
+    {
+        return true;
+    }
+
+    int newCapacity = s_treePidsCapacity == 0 ? 256 : s_treePidsCapacity;
+    while (newCapacity < capacity)
+    {
+        newCapacity *= 2;
+    }
+
+    pid_t *pids = realloc(s_treePids, newCapacity * sizeof(pid_t));
+    if (pids == NULL)
+    {
+        return false;
+    }
+
+    s_treePids = pids;
+    s_treePidsCapacity = newCapacity;
+    return true;
+}
+
 static int ProcessTreeResourceUsage(pid_t pid, const rlim_t max_proc_count, ProcessResourceUsage *buffer, bool includeChildren)
 {
-    rusage_info_current rusage;
-    if (proc_pid_rusage(pid, RUSAGE_INFO_CURRENT, (void **)&rusage) != 0)
+    if (!EnsureTreePidsCapacity(1))
     {
         return GET_RUSAGE_ERROR;
     }
-    
-    buffer->systemTime += rusage.ri_system_time;
-    buffer->userTime += rusage.ri_user_time;
-    
-    buffer->diskio_bytesRead += rusage.ri_diskio_bytesread;
-    buffer->diskio_bytesWritten += rusage.ri_diskio_byteswritten;
-    
-    buffer->rss += rusage.ri_resident_size;
-    
+
+    // Breadth first: s_treePids holds every process of the tree found so far, the ones from 'next' on are yet to be sampled
+    s_treePids[0] = pid;
+    int count = 1;
     bool success = true;
-    if (includeChildren)
+    for (int next = 0; next < count; next++)
     {
-        pid_t child_pids[max_proc_count];
-        int child_count = proc_listchildpids(pid, child_pids, (int) max_proc_count);
-        
-        for (int i = 0; i < child_count; i++)
+        rusage_info_current rusage;
+        if (proc_pid_rusage(s_treePids[next], RUSAGE_INFO_CURRENT, (void **)&rusage) != 0)
         {
-            int child_pid = child_pids[i];
-            success &= (ProcessTreeResourceUsage(child_pid, max_proc_count, buffer, includeChildren) == 0);
+            // The root has to be sampled, a child may just have exited in the meantime (along with its own children)
+            if (next == 0)
+            {
+                return GET_RUSAGE_ERROR;
+            }
+
+            success = false;
+            continue;
+        }
+
+        buffer->systemTime += rusage.ri_system_time;
+        buffer->userTime += rusage.ri_user_time;
+
+        buffer->diskio_bytesRead += rusage.ri_diskio_bytesread;
+        buffer->diskio_bytesWritten += rusage.ri_diskio_byteswritten;
+
+        buffer->rss += rusage.ri_resident_size;
+
+        if (!includeChildren)
+        {
+            break;
+        }
+
+        // proc_listchildpids takes the size of the buffer in bytes and returns the number of pids it filled in. When the
+        // remaining space was filled up completely there might be more children, so the list is retried with more room.
+        int childCount;
+        while (true)
+        {
+            int available = s_treePidsCapacity - count;
+            childCount = proc_listchildpids(s_treePids[next], s_treePids + count, available * (int)sizeof(pid_t));
+            if (childCount < available || !EnsureTreePidsCapacity(s_treePidsCapacity + 1))
+            {
+                break;
+            }
+        }
+
+        if (childCount > 0)
+        {
+            count += childCount;
+        }
+
+        // A process tree can't be bigger than the number of processes the user is allowed to run, so if it is, pids
+        // got recycled while walking it
+        if ((rlim_t)count > max_proc_count)
+        {
+            success = false;
+            break;
         }
     }
-    
+
     return success ? KERN_SUCCESS : GET_RUSAGE_ERROR;
 }
 
-int GetProcessResourceUsageSnapshot(pid_t pid, ProcessResourceUsage *buffer, long bufferSize, bool includeChildProcesses)
+static int ProcessResourceUsageSnapshot(pid_t pid, const rlim_t max_proc_count, double factor, ProcessResourceUsage *buffer, bool includeChildProcesses)
 {
-    if (sizeof(ProcessResourceUsage) != bufferSize)
+    rusage_info_current rusage;
+    if (proc_pid_rusage(pid, RUSAGE_INFO_CURRENT, (void **)&rusage) != 0)
     {
-        printf("ERROR: Wrong size of ProcessResourceUsage buffer; expected %ld, received %ld\n", sizeof(ProcessResourceUsage), bufferSize);
         return GET_RUSAGE_ERROR;
     }
 
-    struct rlimit rl;
-    if (getrlimit(RLIMIT_NPROC, &rl) != 0)
-    {
-        return GET_RUSAGE_ERROR;
-    }
-    
+    uint64_t absoluteTime = mach_absolute_time();
+
+    buffer->startTime = ((long)rusage.ri_proc_start_abstime - (long)absoluteTime) * factor;
+    buffer->exitTime = rusage.ri_proc_exit_abstime != 0
+        ? (((long)rusage.ri_proc_exit_abstime - (long)absoluteTime) * factor)
+        : 0;
+
+    buffer->peak_rss = 0; // Not supported on macOS
+
+    return ProcessTreeResourceUsage(pid, max_proc_count, buffer, includeChildProcesses);
+}
+
+// Returns the factor that turns mach absolute time units into seconds
+static double MachTimeToSecondsFactor()
+{
     mach_timebase_info_data_t timebase;
     kern_return_t ret = mach_timebase_info(&timebase);
     uint32_t numer = 1, denom = 1;
@@ -70,23 +145,41 @@ int GetProcessResourceUsageSnapshot(pid_t pid, ProcessResourceUsage *buffer, lon
         denom = timebase.denom;
     }
 
-    rusage_info_current rusage;
-    if (proc_pid_rusage(pid, RUSAGE_INFO_CURRENT, (void **)&rusage) != 0)
+    return (((double) numer) / denom) / NSEC_PER_SEC;
+}
+
+int GetProcessResourceUsageSnapshot(pid_t pid, ProcessResourceUsage *buffer, long bufferSize, bool includeChildProcesses)
+{
+    return GetProcessResourceUsageSnapshots(&pid, 1, buffer, bufferSize, includeChildProcesses);
+}
+
+int GetProcessResourceUsageSnapshots(const pid_t *pids, int count, ProcessResourceUsage *buffers, long bufferSize, bool includeChildProcesses)
+{
+    if (sizeof(ProcessResourceUsage) != bufferSize)
     {
+        printf("ERROR: Wrong size of ProcessResourceUsage buffer; expected %ld, received %ld\n", sizeof(ProcessResourceUsage), bufferSize);
         return GET_RUSAGE_ERROR;
     }
 
-    uint64_t absoluteTime = mach_absolute_time();
-    double factor = (((double) numer) / denom) / NSEC_PER_SEC;
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NPROC, &rl) != 0)
+    {
+        return GET_RUSAGE_ERROR;
+    }
 
-    buffer->startTime = ((long)rusage.ri_proc_start_abstime - (long)absoluteTime) * factor;
-    buffer->exitTime = rusage.ri_proc_exit_abstime != 0
-        ? (((long)rusage.ri_proc_exit_abstime - (long)absoluteTime) * factor)
-        : 0;
-    
-    buffer->peak_rss = 0; // Not supported on macOS
-    
-    return ProcessTreeResourceUsage(pid, rl.rlim_cur, buffer, includeChildProcesses);
+    double factor = MachTimeToSecondsFactor();
+
+    // Every tree is sampled even if some other one fails (e.g. because its pip is done)
+    int result = KERN_SUCCESS;
+    for (int i = 0; i < count; i++)
+    {
+        if (ProcessResourceUsageSnapshot(pids[i], rl.rlim_cur, factor, &buffers[i], includeChildProcesses) != KERN_SUCCESS)
+        {
+            result = GET_RUSAGE_ERROR;
+        }
+    }
+
+    return result;
 }
 
 static CoreDumpConfiguration *dump_config = NULL;
@@ -24,6 +24,9 @@ typedef struct {
 
 int GetProcessResourceUsageSnapshot(pid_t pid, ProcessResourceUsage *buffer, long bufferSize, bool includeChildProcesses);
 
+// Samples 'count' process trees at once, filling in one buffer per tree. Returns GET_RUSAGE_ERROR if any of them failed.
+int GetProcessResourceUsageSnapshots(const pid_t *pids, int count, ProcessResourceUsage *buffers, long bufferSize, bool includeChildProcesses);
+
 typedef struct {
     char *outputPath;
 } CoreDumpConfiguration;
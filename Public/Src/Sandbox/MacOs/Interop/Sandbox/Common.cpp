@@ -50,6 +50,23 @@ extern "C"
 
         return false;
     }
+
+    bool SendPipsStarted(const pid_t *processIds, const pipid_t *pipIds, const char *const *famBytes, const int *famBytesLengths,
+                         int count, bool *started, ConnectionType type, void *connection)
+    {
+        switch (type)
+        {
+            case Kext:
+            {
+                KextConnectionInfo *context = (KextConnectionInfo *) connection;
+                return KEXT_SendPipsStarted(processIds, pipIds, famBytes, famBytesLengths, count, started, *context);
+            }
+            case GenericSandbox:
+                return Sandbox_SendPipsStarted(processIds, pipIds, famBytes, famBytesLengths, count, started);
+        }
+
+        return false;
+    }
 #endif
 
 #pragma mark Exported interop functions
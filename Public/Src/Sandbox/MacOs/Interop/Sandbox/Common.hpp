@@ -31,8 +31,19 @@ extern "C"
 
     typedef void (__cdecl *AccessReportCallback)(AccessReport, int);
 
+    // 'reports' holds 'count' reports (at most 'kAccessReportBatchSize'), which are only valid for the duration of the call
+    typedef void (__cdecl *AccessReportBatchCallback)(const AccessReport *reports, int count, int error);
+    static const size_t kAccessReportBatchSize = 64;
+
     bool SendPipStarted(const pid_t processId, pipid_t pipId, const char *const famBytes, int famBytesLength, ConnectionType type, void *connection);
     bool SendPipProcessTerminated(pipid_t pipId, pid_t processId, ConnectionType type, void *connection);
+
+    /*!
+     * Same as calling 'SendPipStarted' for every pip (the i-th pip being given by the i-th element of every array), in as
+     * few calls as possible.  Whether each pip could be started is stored in 'started'.
+     */
+    bool SendPipsStarted(const pid_t *processIds, const pipid_t *pipIds, const char *const *famBytes, const int *famBytesLengths,
+                         int count, bool *started, ConnectionType type, void *connection);
 };
 
 #endif /* Common_hpp */
@@ -0,0 +1,137 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef AccessCacheRecord_hpp
+#define AccessCacheRecord_hpp
+
+#include <mutex>
+#include <vector>
+
+#include "FileAccessHelpers.h"
+
+// Same as in Checkers.hpp, which can't be included here: on Linux, PolicyResult.h depends on the pips
+class PolicyResult;
+typedef void (*CheckFunc)(PolicyResult policy, bool isDirectory, AccessCheckResult *result);
+
+/*!
+ * Keeps track of the accesses already checked and reported for a given path of a pip (the counterpart of the kext's
+ * 'CacheRecord' for the EndpointSecurity and interposing sandboxes).
+ *
+ * The policy of a path never changes for the lifetime of a pip, so the outcome of applying a checker to it is only
+ * computed once. A report is only sent if no access at least as strong has been reported for the path already.
+ */
+class AccessCacheRecord final
+{
+
+private:
+
+    typedef struct
+    {
+        CheckFunc checker;
+        bool isDir;
+        AccessCheckResult result;
+    } Decision;
+
+    std::mutex lock_;
+
+    /*! The checks applied to the path so far (only a handful of checkers exist, so this stays tiny) */
+    std::vector<Decision> decisions_;
+
+    /*! A bitwise disjunction of reported accesses (along with the accesses they imply) */
+    RequestedAccess requestedAccess_ = RequestedAccess::None;
+
+    // CODESYNC: Sandbox/Src/CacheRecord.cpp (the kext keeps the same implications)
+    static inline RequestedAccess Implies(RequestedAccess access)
+    {
+        RequestedAccess result = RequestedAccess::None;
+
+        // Probe implies Lookup
+        if ((access & RequestedAccess::Probe) == RequestedAccess::Probe)
+        {
+            result |= RequestedAccess::Lookup;
+        }
+
+        // Read implies Probe (and, transitively, Lookup)
+        if ((access & RequestedAccess::Read) == RequestedAccess::Read)
+        {
+            result |= RequestedAccess::Lookup | RequestedAccess::Probe;
+        }
+
+        // Write implies Read (and, transitively, Probe and Lookup)
+        if ((access & RequestedAccess::Write) == RequestedAccess::Write)
+        {
+            result |= RequestedAccess::Lookup | RequestedAccess::Probe | RequestedAccess::Read;
+        }
+
+        return result;
+    }
+
+    // CODESYNC: keep this the inverse of 'Implies'
+    static inline RequestedAccess ImpliedBy(RequestedAccess access)
+    {
+        switch (access)
+        {
+            case RequestedAccess::Lookup:   return RequestedAccess::Probe | RequestedAccess::Read | RequestedAccess::Write;
+            case RequestedAccess::Probe:    return RequestedAccess::Read | RequestedAccess::Write;
+            case RequestedAccess::Read:     return RequestedAccess::Write;
+            default:                        return RequestedAccess::None;
+        }
+    }
+
+    // Assumes lock_ is held by the caller
+    bool HasStrongerRequestedAccess(RequestedAccess access) const
+    {
+        RequestedAccess accessesThatImplyGivenAccess = ImpliedBy(access);
+        return accessesThatImplyGivenAccess != RequestedAccess::None &&
+               (requestedAccess_ & accessesThatImplyGivenAccess) != RequestedAccess::None;
+    }
+
+public:
+
+    AccessCacheRecord() {}
+
+    /*!
+     * Returns true (and the result of the check in 'result') if 'checker' has already been applied to the path.
+     */
+    bool TryGetDecision(CheckFunc checker, bool isDir, AccessCheckResult *result)
+    {
+        const std::lock_guard<std::mutex> lock(lock_);
+        for (const Decision &decision : decisions_)
+        {
+            if (decision.checker == checker && decision.isDir == isDir)
+            {
+                *result = decision.result;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void AddDecision(CheckFunc checker, bool isDir, const AccessCheckResult &result)
+    {
+        const std::lock_guard<std::mutex> lock(lock_);
+        decisions_.push_back({ checker, isDir, result });
+    }
+
+    /*!
+     * Atomically:
+     *   (1) determines if the access of 'result' has already been reported (or a stronger one has), and
+     *   (2) if not, updates this record so that subsequently, the same access becomes a cache hit.
+     *
+     * @return Whether 'result' was a cache hit.
+     */
+    bool CheckAndUpdate(const AccessCheckResult &result)
+    {
+        const std::lock_guard<std::mutex> lock(lock_);
+        if ((requestedAccess_ & result.Access) == result.Access || HasStrongerRequestedAccess(result.Access))
+        {
+            return true;
+        }
+
+        requestedAccess_ |= result.Access | Implies(result.Access);
+        return false;
+    }
+};
+
+#endif /* AccessCacheRecord_hpp */
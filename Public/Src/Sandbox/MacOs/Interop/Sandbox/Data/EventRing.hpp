@@ -0,0 +1,197 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef EventRing_hpp
+#define EventRing_hpp
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+
+#include "IOEvent.hpp"
+
+/**
+ * Single-producer, single-consumer ring of IOEvent records in a memory region shared by an EndpointSecurity client of the
+ * system extension (the producer) and the build host (the consumer). Every client that connects to a build host gets its own.
+ *
+ *  - The producer copies a record (a uint32 length followed by the binary record of the event, see IOEventRecordHeader,
+ *    padded to 8 bytes) and then publishes it by advancing the write position. A record never wraps around the end of
+ *    the buffer: when it doesn't fit before the end, a padding marker is left there and the record goes to the start.
+ *  - The consumer processes the records in order and then advances the read position.
+ *  - Once the consumer drained the ring, it raises the 'consumer waiting' flag and checks the ring once more before going
+ *    idle (see PrepareToWait). A producer that publishes a record and finds the flag raised clears it and rings the doorbell
+ *    (an XPC message), so while the consumer is busy appending an event costs no message at all.
+ *
+ * Positions only grow, and are mapped into the buffer modulo its capacity.
+ */
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t capacity;                      // Size of the buffer that follows the header (a power of 2)
+    char padding1[56];
+    std::atomic<uint64_t> writePosition;    // Written by the producer
+    char padding2[56];
+    std::atomic<uint64_t> readPosition;     // Written by the consumer
+    char padding3[56];
+    std::atomic<uint32_t> consumerWaiting;  // Raised by the consumer, cleared by whoever sees it first
+    char padding4[60];
+} EventRingHeader;
+
+// The header is shared by two processes, its atomics can't rely on a lock
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free, "The ring needs lock-free atomics");
+
+class EventRing final
+{
+private:
+
+    static const uint32_t kMagic = 0x474E4952; // 'RING'
+    static const uint32_t kPaddingMarker = UINT32_MAX;
+    static const uint32_t kRecordAlignment = 8;
+
+    EventRingHeader *header_ = nullptr;
+    char *buffer_ = nullptr;
+
+    static inline uint64_t Align(uint64_t size) { return (size + kRecordAlignment - 1) & ~(uint64_t)(kRecordAlignment - 1); }
+
+public:
+
+    static inline size_t RegionSize(uint32_t capacity) { return sizeof(EventRingHeader) + capacity; }
+
+    inline bool IsAttached() const { return header_ != nullptr; }
+
+    // Sets up an empty ring in the given region, whose size must be RegionSize(capacity). The capacity must be a power of 2.
+    void Initialize(void *region, uint32_t capacity)
+    {
+        header_ = static_cast<EventRingHeader *>(region);
+        buffer_ = static_cast<char *>(region) + sizeof(EventRingHeader);
+
+        header_->capacity = capacity;
+        header_->writePosition.store(0, std::memory_order_relaxed);
+        header_->readPosition.store(0, std::memory_order_relaxed);
+        // The consumer is idle until the first doorbell
+        header_->consumerWaiting.store(1, std::memory_order_relaxed);
+        header_->magic = kMagic;
+    }
+
+    // Attaches to a ring set up (by the other side) in the given region. Returns false if the region does not hold a ring.
+    bool Attach(void *region, size_t size)
+    {
+        EventRingHeader *header = static_cast<EventRingHeader *>(region);
+        if (size < sizeof(EventRingHeader) ||
+            header->magic != kMagic ||
+            header->capacity == 0 ||
+            (header->capacity & (header->capacity - 1)) != 0 ||
+            RegionSize(header->capacity) > size)
+        {
+            return false;
+        }
+
+        header_ = header;
+        buffer_ = static_cast<char *>(region) + sizeof(EventRingHeader);
+        return true;
+    }
+
+    void Detach()
+    {
+        header_ = nullptr;
+        buffer_ = nullptr;
+    }
+
+    // Producer side. Returns false if the ring is full (or the record would never fit), in which case the event has to be
+    // sent some other way. When wakeConsumer is set on return, the producer must ring the doorbell. The executables are
+    // the ones of the ring (see IOEventExecutableTable), an event only gets recorded there once it has been appended.
+    // TEvent is an IOEvent, or an IOEventMessage.
+    template <typename TEvent>
+    bool TryAppend(const TEvent &event, IOEventExecutableTable &executables, bool &wakeConsumer)
+    {
+        wakeConsumer = false;
+
+        const uint32_t capacity = header_->capacity;
+        const bool executableInterned = executables.Contains(event);
+        const uint32_t length = (uint32_t)event.RecordSize(executableInterned);
+        const uint64_t size = Align(sizeof(uint32_t) + length);
+
+        uint64_t write = header_->writePosition.load(std::memory_order_relaxed);
+        const uint64_t read = header_->readPosition.load(std::memory_order_acquire);
+        uint64_t offset = write & (capacity - 1);
+        const uint64_t padding = offset + size > capacity ? capacity - offset : 0;
+
+        if (write + padding + size - read > capacity)
+        {
+            return false;
+        }
+
+        if (padding > 0)
+        {
+            memcpy(buffer_ + offset, &kPaddingMarker, sizeof(kPaddingMarker));
+            write += padding;
+            offset = 0;
+        }
+
+        memcpy(buffer_ + offset, &length, sizeof(length));
+        event.WriteRecord(buffer_ + offset + sizeof(length), executableInterned);
+        executables.Record(event);
+
+        // Publishing the record and checking the flag must not be reordered (see PrepareToWait)
+        header_->writePosition.store(write + size, std::memory_order_seq_cst);
+        wakeConsumer = header_->consumerWaiting.load(std::memory_order_seq_cst) != 0 && header_->consumerWaiting.exchange(0) != 0;
+
+        return true;
+    }
+
+    // Consumer side. Calls callback(record, length) for every published record, in order (the callback has to read them
+    // with the executables of the ring). Returns false if the ring holds
+    // a malformed record, in which case it can't be trusted anymore.
+    template <typename TCallback>
+    bool Drain(TCallback callback)
+    {
+        const uint32_t capacity = header_->capacity;
+        uint64_t read = header_->readPosition.load(std::memory_order_relaxed);
+        const uint64_t write = header_->writePosition.load(std::memory_order_acquire);
+        bool result = true;
+
+        while (read < write)
+        {
+            const uint64_t offset = read & (capacity - 1);
+            uint32_t length;
+            memcpy(&length, buffer_ + offset, sizeof(length));
+
+            if (length == kPaddingMarker)
+            {
+                read += capacity - offset;
+                continue;
+            }
+
+            if (offset + sizeof(length) + length > capacity)
+            {
+                result = false;
+                read = write;
+                break;
+            }
+
+            callback(buffer_ + offset + sizeof(length), (size_t)length);
+            read += Align(sizeof(length) + length);
+        }
+
+        header_->readPosition.store(read, std::memory_order_release);
+        return result;
+    }
+
+    // Consumer side. Announces that the consumer is about to go idle. Returns false if records were published in the
+    // meantime, in which case the consumer has to drain the ring again instead of waiting for the doorbell.
+    bool PrepareToWait()
+    {
+        header_->consumerWaiting.store(1, std::memory_order_seq_cst);
+        if (header_->writePosition.load(std::memory_order_seq_cst) == header_->readPosition.load(std::memory_order_relaxed))
+        {
+            return true;
+        }
+
+        // A producer may have seen the flag and rung the doorbell already: that just results in an extra (empty) drain
+        header_->consumerWaiting.store(0, std::memory_order_seq_cst);
+        return false;
+    }
+};
+
+#endif /* EventRing_hpp */
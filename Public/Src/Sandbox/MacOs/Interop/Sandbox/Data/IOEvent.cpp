@@ -5,17 +5,15 @@
 #include "BuildXLException.hpp"
 
 #if __APPLE__
-IOEvent::IOEvent(const es_message_t *msg)
+IOEventMessage::IOEventMessage(const es_message_t *msg)
 {
     pid_ = audit_token_to_pid(msg->process->audit_token);
-    cpid_ = 0;
     ppid_ = msg->process->ppid;
     oppid_ = msg->process->original_ppid;
     eventType_ = msg->event_type;
     actionType_ = msg->action_type;
-    modified_ = false;
 
-    executable_ = PathExtractor(msg->process->executable).Path();
+    executable_ = msg->process->executable->path;
     auditToken_ = msg->process->audit_token;
 
     switch (eventType_)
@@ -33,7 +31,7 @@ IOEvent::IOEvent(const es_message_t *msg)
         case ES_EVENT_TYPE_NOTIFY_FORK:
         {
             es_event_fork_t fork = msg->event.fork;
-            executable_ = PathExtractor(fork.child->executable).Path();
+            executable_ = fork.child->executable->path;
             cpid_ = audit_token_to_pid(fork.child->audit_token);
             break;
         }
@@ -51,12 +49,12 @@ IOEvent::IOEvent(const es_message_t *msg)
 
             if (existingFile)
             {
-                src_path_ = PathExtractor(create.destination.existing_file).Path();
+                paths_[SRC_PATH] = SinglePath(create.destination.existing_file);
                 mode_ = create.destination.existing_file->stat.st_mode;
             }
             else
             {
-                src_path_ = PathExtractor(create.destination.new_path.dir, create.destination.new_path.filename).Path();
+                paths_[SRC_PATH] = JoinedPath(create.destination.new_path.dir, create.destination.new_path.filename);
                 mode_ = create.destination.new_path.mode;
             }
 
@@ -65,8 +63,8 @@ IOEvent::IOEvent(const es_message_t *msg)
         case ES_EVENT_TYPE_AUTH_EXCHANGEDATA:
         case ES_EVENT_TYPE_NOTIFY_EXCHANGEDATA: {
             es_event_exchangedata_t exchange = msg->event.exchangedata;
-            src_path_ = PathExtractor(exchange.file1).Path();
-            dst_path_ = PathExtractor(exchange.file2).Path();
+            paths_[SRC_PATH] = SinglePath(exchange.file1);
+            paths_[DST_PATH] = SinglePath(exchange.file2);
             break;
         }
         case ES_EVENT_TYPE_NOTIFY_EXIT:
@@ -78,25 +76,25 @@ IOEvent::IOEvent(const es_message_t *msg)
         case ES_EVENT_TYPE_NOTIFY_LINK:
         {
             es_event_link_t link = msg->event.link;
-            src_path_ = PathExtractor(link.source).Path();
-            dst_path_ = PathExtractor(link.target_dir, link.target_filename).Path();
+            paths_[SRC_PATH] = SinglePath(link.source);
+            paths_[DST_PATH] = JoinedPath(link.target_dir, link.target_filename);
             break;
         }
         case ES_EVENT_TYPE_AUTH_RENAME:
         case ES_EVENT_TYPE_NOTIFY_RENAME:
         {
             es_event_rename_t rename = msg->event.rename;
-            src_path_ = PathExtractor(rename.source).Path();
+            paths_[SRC_PATH] = SinglePath(rename.source);
 
             bool existingFile = rename.destination_type == ES_DESTINATION_TYPE_EXISTING_FILE;
             if (existingFile)
             {
-                dst_path_ = PathExtractor(rename.destination.existing_file).Path();
+                paths_[DST_PATH] = SinglePath(rename.destination.existing_file);
                 mode_ = rename.destination.existing_file->stat.st_mode;
             }
             else
             {
-                dst_path_ = PathExtractor(rename.destination.new_path.dir, rename.destination.new_path.filename).Path();
+                paths_[DST_PATH] = JoinedPath(rename.destination.new_path.dir, rename.destination.new_path.filename);
                 mode_ = 0;
             }
 
@@ -148,7 +146,7 @@ IOEvent::IOEvent(const es_message_t *msg)
         case ES_EVENT_TYPE_NOTIFY_LOOKUP:
         {
             es_event_lookup_t lookup = msg->event.lookup;
-            src_path_ = PathExtractor(lookup.source_dir, lookup.relative_target).Path();
+            paths_[SRC_PATH] = JoinedPath(lookup.source_dir, lookup.relative_target);
             mode_ = lookup.source_dir->stat.st_mode;
             break;
         }
@@ -177,8 +175,9 @@ IOEvent::IOEvent(const es_message_t *msg)
         case ES_EVENT_TYPE_NOTIFY_CLONE:
         {
             es_event_clone_t clone = msg->event.clone;
-            src_path_ = PathExtractor(clone.source).Path();
-            dst_path_ = PathExtractor(clone.target_dir, clone.target_name).Path();
+            paths_[SRC_PATH] = SinglePath(clone.source);
+            paths_[DST_PATH] = JoinedPath(clone.target_dir, clone.target_name);
+            mode_ = clone.source->stat.st_mode;
             break;
         }
         case ES_EVENT_TYPE_NOTIFY_FCNTL:
@@ -222,6 +221,87 @@ IOEvent::IOEvent(const es_message_t *msg)
         }
     }
 }
+
+    assert(GetPathLength(SRC_PATH) < PATH_MAX && GetPathLength(DST_PATH) < PATH_MAX);
+}
+
+void IOEventMessage::CopyPath(int index, char *buffer) const
+{
+    const Path &path = paths_[index];
+    if (path.directory.length == 0)
+    {
+        return;
+    }
+
+    memcpy(buffer, path.directory.data, path.directory.length);
+    buffer += path.directory.length;
+    if (path.hasName)
+    {
+        if (!IsRootDirectory(path))
+        {
+            *buffer++ = '/';
+        }
+
+        memcpy(buffer, path.name.data, path.name.length);
+    }
+}
+
+void IOEventMessage::WriteRecord(char *buffer, bool executableInterned) const
+{
+    size_t srcPathLength = GetPathLength(SRC_PATH);
+    size_t dstPathLength = GetPathLength(DST_PATH);
+
+    IOEventRecordHeader header =
+    {
+        .pid                = pid_,
+        .cpid               = cpid_,
+        .ppid               = ppid_,
+        .oppid              = oppid_,
+        .eventType          = (uint32_t)eventType_,
+        .actionType         = (uint32_t)actionType_,
+        .mode               = (uint32_t)mode_,
+        .modified           = modified_ ? 1u : 0u,
+        .error              = 0,
+        .auditToken         = auditToken_,
+        .executableLength   = executableInterned ? kInternedExecutable : (uint32_t)executable_.length,
+        .srcPathLength      = (uint32_t)srcPathLength,
+        .dstPathLength      = (uint32_t)dstPathLength,
+    };
+
+    memcpy(buffer, &header, sizeof(header));
+    buffer += sizeof(header);
+    if (!executableInterned)
+    {
+        memcpy(buffer, executable_.data, executable_.length);
+        buffer += executable_.length;
+    }
+    CopyPath(SRC_PATH, buffer);
+    CopyPath(DST_PATH, buffer + srcPathLength);
+}
+
+IOEvent::IOEvent(const es_message_t *msg) : IOEvent(IOEventMessage(msg))
+{
+}
+
+IOEvent::IOEvent(const IOEventMessage &message)
+{
+    pid_ = message.GetPid();
+    cpid_ = message.GetChildPid();
+    ppid_ = message.GetParentPid();
+    oppid_ = message.GetOriginalParentPid();
+    eventType_ = message.GetEventType();
+    actionType_ = message.GetActionType();
+    mode_ = message.GetMode();
+    modified_ = message.FSEntryModified();
+    error_ = 0;
+    auditToken_ = *message.GetProcessAuditToken();
+
+    executable_.assign(message.GetExecutablePath(), message.GetExecutableLength());
+    src_path_.resize(message.GetPathLength(SRC_PATH));
+    message.CopyPath(SRC_PATH, &src_path_[0]);
+    dst_path_.resize(message.GetPathLength(DST_PATH));
+    message.CopyPath(DST_PATH, &dst_path_[0]);
+}
 #endif
 
 // When inserting the detours library dynamically, interposed executables automatically search for the default Info.plist
@@ -250,85 +330,148 @@ const bool IOEvent::IsDirectorySpecialCharacterEvent() const
     return src_path_.compare(".") == 0 || src_path_.compare("..") == 0;
 }
 
-const size_t IOEvent::Size() const
+IOEvent::IOEvent(const IOEventRecordView &record)
 {
-    return
-        std::to_string(pid_).length() +
-        std::to_string(cpid_).length() +
-        std::to_string(ppid_).length() +
-        std::to_string(eventType_).length() +
-        std::to_string(actionType_).length() +
-        std::to_string(mode_).length() +
-        std::to_string(modified_).length() +
-        executable_.length() + (executable_.length() > 0 ? 1 : 0) +
-        src_path_.length() + (src_path_.length() > 0 ? 1 : 0) +
-        dst_path_.length() + (dst_path_.length() > 0 ? 1 : 0) +
-        std::to_string(error_).length() +
-        8; // 8 delimiters + 1 per string (if string is present)
+    const IOEventRecordHeader &header = record.header;
+
+    pid_ = header.pid;
+    cpid_ = header.cpid;
+    ppid_ = header.ppid;
+    oppid_ = header.oppid;
+    eventType_ = (es_event_type_t)header.eventType;
+    actionType_ = (es_action_type_t)header.actionType;
+    mode_ = (mode_t)header.mode;
+    modified_ = header.modified != 0;
+    error_ = header.error;
+    auditToken_ = header.auditToken;
+
+    executable_.assign(record.executable, record.executableLength);
+    src_path_.assign(record.srcPath, header.srcPathLength);
+    dst_path_.assign(record.dstPath, header.dstPathLength);
 }
 
-omemorystream& operator<<(omemorystream &os, const IOEvent &event)
+const size_t IOEvent::RecordSize(bool executableInterned) const
 {
-    os
-    << event.pid_                   << "|"
-    << event.cpid_                  << "|"
-    << event.ppid_                  << "|"
-    << event.eventType_             << "|"
-    << event.actionType_            << "|"
-    << event.mode_                  << "|"
-    << event.modified_              << "|"
-    << event.error_                 << "|"
-    ;
-
-    if (event.executable_.size() > 0)
+    return sizeof(IOEventRecordHeader) + (executableInterned ? 0 : executable_.length()) + src_path_.length() + dst_path_.length();
+}
+
+void IOEvent::WriteRecord(char *buffer, bool executableInterned) const
+{
+    IOEventRecordHeader header =
+    {
+        .pid                = pid_,
+        .cpid               = cpid_,
+        .ppid               = ppid_,
+        .oppid              = oppid_,
+        .eventType          = (uint32_t)eventType_,
+        .actionType         = (uint32_t)actionType_,
+        .mode               = (uint32_t)mode_,
+        .modified           = modified_ ? 1u : 0u,
+        .error              = error_,
+        .auditToken         = auditToken_,
+        .executableLength   = executableInterned ? kInternedExecutable : (uint32_t)executable_.length(),
+        .srcPathLength      = (uint32_t)src_path_.length(),
+        .dstPathLength      = (uint32_t)dst_path_.length(),
+    };
+
+    memcpy(buffer, &header, sizeof(header));
+    buffer += sizeof(header);
+    if (!executableInterned)
+    {
+        memcpy(buffer, executable_.data(), executable_.length());
+        buffer += executable_.length();
+    }
+    memcpy(buffer, src_path_.data(), src_path_.length());
+    buffer += src_path_.length();
+    memcpy(buffer, dst_path_.data(), dst_path_.length());
+}
+
+bool IOEvent::ReadRecord(const char *record, size_t length, IOEventRecordView &view, const IOEventExecutableTable *executables)
+{
+    if (length < sizeof(IOEventRecordHeader))
+    {
+        return false;
+    }
+
+    memcpy(&view.header, record, sizeof(view.header));
+    record += sizeof(view.header);
+
+    size_t carriedLength = (size_t)view.header.srcPathLength + view.header.dstPathLength;
+    if (view.header.executableLength == kInternedExecutable)
+    {
+        // The record refers to the executable of the previous record of its process
+        const std::string *executable = executables != nullptr ? executables->Find(view.header.pid) : nullptr;
+        if (executable == nullptr)
+        {
+            return false;
+        }
+
+        view.executable = executable->data();
+        view.executableLength = executable->length();
+    }
+    else
     {
-        os << event.executable_ << "|";
+        view.executable = record;
+        view.executableLength = view.header.executableLength;
+        record += view.executableLength;
+        carriedLength += view.executableLength;
     }
 
-    if (event.src_path_.size() > 0)
+    if (carriedLength != length - sizeof(IOEventRecordHeader))
     {
-        os << event.src_path_ << "|";
+        return false;
     }
 
-    if (event.dst_path_.size() > 0)
+    view.srcPath = record;
+    view.dstPath = record + view.header.srcPathLength;
+    return true;
+}
+
+bool IOEvent::ReadRecord(const char *record, size_t length, IOEvent &event, IOEventExecutableTable *executables)
+{
+    IOEventRecordView view;
+    if (!ReadRecord(record, length, view, executables))
     {
-        os << event.dst_path_ << "|";
+        return false;
     }
 
-    return os;
+    event = IOEvent(view);
+    if (executables != nullptr)
+    {
+        executables->Record(event);
+    }
+
+    return true;
 }
 
-std::istream& operator>>(std::istream &is, es_event_type_t &t)
+const std::string *IOEventExecutableTable::Find(pid_t pid) const
 {
-    unsigned int value = 0;
-    is >> value;
-    t = (es_event_type_t) value;
-    return is;
+    auto it = executables_.find(pid);
+    return it != executables_.end() ? &it->second : nullptr;
 }
 
-std::istream& operator>>(std::istream &is, es_action_type_t &t)
+bool IOEventExecutableTable::Contains(pid_t pid, const char *executable, size_t length) const
 {
-    unsigned int value = 0;
-    is >> value;
-    t = (es_action_type_t) value;
-    return is;
+    const std::string *recorded = Find(pid);
+    return recorded != nullptr && recorded->compare(0, std::string::npos, executable, length) == 0;
 }
 
-imemorystream& operator>>(imemorystream &is, IOEvent &event)
+void IOEventExecutableTable::Record(pid_t pid, const char *executable, size_t length)
 {
-    is
-    >> event.pid_
-    >> event.cpid_
-    >> event.ppid_
-    >> event.eventType_
-    >> event.actionType_
-    >> event.mode_
-    >> event.modified_
-    >> event.error_
-    >> event.executable_
-    >> event.src_path_
-    >> event.dst_path_
-    ;
-
-    return is;
+    // Exits are not taken into account: with several senders on a channel, an event of a process can still be on its way
+    // when its exit arrives. A reused pid gets its executable sent again anyway, unless it runs the same one.
+    auto it = executables_.find(pid);
+    if (it != executables_.end())
+    {
+        it->second.assign(executable, length);
+        return;
+    }
+
+    // Start over rather than letting the executables of processes that are long gone pile up
+    if (executables_.size() >= kMaxEntries)
+    {
+        executables_.clear();
+    }
+
+    executables_.emplace(pid, std::string(executable, length));
 }
@@ -8,6 +8,8 @@
 
 #include <iostream>
 #include <istream>
+#include <string>
+#include <unordered_map>
 
 #include <sys/types.h>
 #include <unistd.h>
@@ -16,8 +18,6 @@
 #include <bsm/libbsm.h>
 #endif
 
-#include "MemoryStreams.hpp"
-
 #define SRC_PATH 0
 #define DST_PATH 1
 
@@ -30,7 +30,7 @@
 
 #define ES_EVENT_CONSTRUCTOR(type, dir, file, mode, do_break) \
     es_event_##type##_t event = msg->event.type; \
-    src_path_ = PathExtractor(event.file).Path(); \
+    paths_[SRC_PATH] = SinglePath(event.file); \
     if (mode) {mode_ = event.file->stat.st_mode; } \
     if (do_break) break;
 
@@ -45,17 +45,149 @@ enum class ProcessCallbackResult
 {
     Done = 0,
     MuteSource,
-    Auth
+    Auth,
+    // Only events of this type are muted for the source process, its pip does not need them (see IsMetadataWriteEvent)
+    MuteEventType
 };
 
+// A single event, as its binary record (see IOEventRecordHeader)
 #define IOEventKey "IOEvent"
-#define IOEventLengthKey "IOEvent::Length"
 
-struct IOEvent final
+// Batches of events sent by the EndpointSecurity clients and the interposed processes: the records of the events, each prefixed
+// by its uint32 length, and the responses of the build host (one XPCCommands value per event, as a byte, for the EndpointSecurity
+// clients only)
+#define IOEventBatchKey "IOEventBatch"
+#define IOEventBatchResponsesKey "IOEventBatch::Responses"
+
+// Sent by the interposed processes before they re-initialize their connection: the reply only comes once the build host processed
+// everything sent before it (most of which doesn't get a reply of its own)
+#define IOEventFlushKey "IOEvent::Flush"
+
+// Rings of events shared by the EndpointSecurity clients and the build host (see EventRing.hpp): the shared memory region
+// of a ring, the doorbell rung by a client when the build host went idle, and the audit tokens of the processes the build
+// host asks to mute (in the reply to a doorbell)
+#define IOEventRingKey "IOEventRing"
+#define IOEventRingDoorbellKey "IOEventRing::Doorbell"
+#define IOEventMutedProcessesKey "IOEvent::MutedProcesses"
+
+// The event types muted for a process, in the reply to a doorbell as well: an array of IOEventSource, one per event type
+// and process (see xpc_response_mute_process_events)
+#define IOEventMutedProcessEventsKey "IOEvent::MutedProcessEvents"
+
+typedef struct
 {
-    friend omemorystream& operator<<(omemorystream &os, const IOEvent &event);
-    friend imemorystream& operator>>(imemorystream &is, IOEvent &event);
+    audit_token_t auditToken;
+    es_event_type_t eventType;
+} IOEventSource;
+
+// Events that only change the metadata of a file. Only pips that are told about the accesses they were not expected to make
+// (or about all of them) need to see them: the writes that produced the files of the other pips are reported through the
+// events that created, opened or truncated them. The EndpointSecurity clients unsubscribe from the ones no running pip needs.
+static const es_event_type_t kMetadataWriteEvents[] =
+{
+    ES_EVENT_TYPE_AUTH_SETATTRLIST,
+    ES_EVENT_TYPE_NOTIFY_SETATTRLIST,
+    ES_EVENT_TYPE_AUTH_SETEXTATTR,
+    ES_EVENT_TYPE_NOTIFY_SETEXTATTR,
+    ES_EVENT_TYPE_AUTH_DELETEEXTATTR,
+    ES_EVENT_TYPE_NOTIFY_DELETEEXTATTR,
+    ES_EVENT_TYPE_AUTH_SETFLAGS,
+    ES_EVENT_TYPE_NOTIFY_SETFLAGS,
+    ES_EVENT_TYPE_AUTH_SETMODE,
+    ES_EVENT_TYPE_NOTIFY_SETMODE,
+    ES_EVENT_TYPE_AUTH_SETOWNER,
+    ES_EVENT_TYPE_NOTIFY_SETOWNER,
+    ES_EVENT_TYPE_AUTH_SETACL,
+    ES_EVENT_TYPE_NOTIFY_SETACL,
+};
 
+inline bool IsMetadataWriteEvent(es_event_type_t type)
+{
+    for (es_event_type_t event : kMetadataWriteEvents)
+    {
+        if (event == type)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Fixed binary layout of an IOEvent (see IOEvent::WriteRecord), followed by the executable, source and destination paths
+ * (not null-terminated). This is how events travel between the sandbox clients and the build host, whatever the channel.
+ *
+ * The executable is left out when it is the one of the previous record of the same process on the channel, which is marked
+ * by an executableLength of kInternedExecutable (see IOEventExecutableTable).
+ */
+typedef struct __attribute__((packed))
+{
+    int32_t  pid;
+    int32_t  cpid;
+    int32_t  ppid;
+    int32_t  oppid;
+    uint32_t eventType;
+    uint32_t actionType;
+    uint32_t mode;
+    uint32_t modified;
+    uint32_t error;
+    audit_token_t auditToken;
+    uint32_t executableLength;
+    uint32_t srcPathLength;
+    uint32_t dstPathLength;
+} IOEventRecordHeader;
+
+static const uint32_t kInternedExecutable = UINT32_MAX;
+
+/**
+ * A record read in place (see IOEvent::ReadRecord): the paths point into the buffer the record was read from, or into the
+ * IOEventExecutableTable of the channel for an interned executable, and are not null-terminated.
+ */
+typedef struct
+{
+    IOEventRecordHeader header;
+    const char *executable;
+    size_t executableLength;
+    const char *srcPath;
+    const char *dstPath;
+} IOEventRecordView;
+
+struct IOEvent;
+#if __APPLE__
+class IOEventMessage;
+#endif
+
+/**
+ * The executable of every process whose records went through a channel (an XPC connection, or an EventRing). The sender and
+ * the receiver of a channel each keep one and call Record for every event of the channel, in the same order, so a sender
+ * can leave out the executable whenever Contains holds for its event.
+ */
+class IOEventExecutableTable final
+{
+private:
+
+    static const size_t kMaxEntries = 4096;
+
+    std::unordered_map<pid_t, std::string> executables_;
+
+public:
+
+    const std::string *Find(pid_t pid) const;
+    bool Contains(pid_t pid, const char *executable, size_t length) const;
+
+    void Record(pid_t pid, const char *executable, size_t length);
+    inline void Clear() { executables_.clear(); }
+
+    // For an IOEvent, or an IOEventMessage
+    template <typename TEvent>
+    inline bool Contains(const TEvent &event) const { return Contains(event.GetPid(), event.GetExecutablePath(), event.GetExecutableLength()); }
+    template <typename TEvent>
+    inline void Record(const TEvent &event) { Record(event.GetPid(), event.GetExecutablePath(), event.GetExecutableLength()); }
+};
+
+struct IOEvent final
+{
 private:
 
     pid_t pid_;
@@ -83,8 +215,11 @@ public:
 
 #if __APPLE__
     IOEvent(const es_message_t *msg);
+    IOEvent(const IOEventMessage &message);
 #endif
 
+    IOEvent(const IOEventRecordView &record);
+
     IOEvent(pid_t pid,
             pid_t cpid,
             pid_t ppid,
@@ -92,11 +227,11 @@ public:
             es_action_type_t action,
             std::string src,
             std::string dst,
-            const std::string exec,
+            std::string exec,
             mode_t mode,
             bool modified = false,
             uint error = 0)
-    : pid_(pid), cpid_(cpid), ppid_(ppid), oppid_(ppid), eventType_(type), actionType_(action), src_path_(src), dst_path_(dst), executable_(exec), 
+    : pid_(pid), cpid_(cpid), ppid_(ppid), oppid_(ppid), eventType_(type), actionType_(action), src_path_(std::move(src)), dst_path_(std::move(dst)), executable_(std::move(exec)), 
         mode_(mode), modified_(modified), error_(error)
     {
     }
@@ -104,13 +239,42 @@ public:
     IOEvent(es_event_type_t type,
             es_action_type_t action,
             std::string src,
-            const std::string exec,
+            std::string exec,
             mode_t mode,
             bool modified = false,
             std::string dest = "",
             uint error = 0)
-    : IOEvent(getpid(), 0, getppid(), type, action, src, dest, exec, mode, modified, error)
+    : IOEvent(getpid(), 0, getppid(), type, action, std::move(src), std::move(dest), std::move(exec), mode, modified, error)
+    {
+    }
+
+    /*!
+     * Refills this event in place. The paths are copied into the buffers the event already has, so an event that is reused for
+     * every access (see BxlObserver::check_path_access) stops allocating once it has seen its longest paths.
+     */
+    inline void Assign(pid_t pid,
+                       pid_t ppid,
+                       es_event_type_t type,
+                       es_action_type_t action,
+                       const char *src,
+                       const char *dst,
+                       const char *exec,
+                       mode_t mode,
+                       bool modified = false,
+                       uint error = 0)
     {
+        pid_ = pid;
+        cpid_ = 0;
+        ppid_ = ppid;
+        oppid_ = ppid;
+        eventType_ = type;
+        actionType_ = action;
+        src_path_.assign(src);
+        dst_path_.assign(dst);
+        executable_.assign(exec);
+        mode_ = mode;
+        modified_ = modified;
+        error_ = error;
     }
 
     inline const pid_t GetPid() const { return pid_; }
@@ -118,6 +282,7 @@ public:
     inline const pid_t GetChildPid() const { return cpid_; }
     inline const pid_t GetOriginalParentPid() const { return oppid_; }
     inline const char* GetExecutablePath() const { return executable_.c_str(); }
+    inline const size_t GetExecutableLength() const { return executable_.length(); }
 
     inline const audit_token_t* GetProcessAuditToken() const { return &auditToken_; }
     inline const es_event_type_t GetEventType() const { return eventType_; }
@@ -148,20 +313,104 @@ public:
     const bool IsPlistEvent() const;
     const bool IsDirectorySpecialCharacterEvent() const;
 
-    const size_t Size() const;
+    // Size of the binary record of this event (see IOEventRecordHeader), left without its executable when interned
+    const size_t RecordSize(bool executableInterned = false) const;
+    // Writes the binary record of this event to the given buffer, which must be at least RecordSize() bytes long
+    void WriteRecord(char *buffer, bool executableInterned = false) const;
+
+    // Reads a record in place. An interned executable is looked up in the given table. Returns false if the record is malformed.
+    static bool ReadRecord(const char *record, size_t length, IOEventRecordView &view, const IOEventExecutableTable *executables = nullptr);
+    // Reads an event back from its binary record and records it in the given table. Returns false if the record is malformed.
+    static bool ReadRecord(const char *record, size_t length, IOEvent &event, IOEventExecutableTable *executables = nullptr);
+
+    static inline const size_t max_record_size()
+    {
+        return sizeof(IOEventRecordHeader) + (3 * PATH_MAX);
+    }
+};
+
+#if __APPLE__
+/**
+ * An EndpointSecurity message seen as an IOEvent, without copying anything out of it: the executable and the paths point
+ * into the message, so an IOEventMessage must not outlive the callback the message was handed to. It is written straight
+ * into the batches and rings of the EndpointSecurity clients (the record is the same as the one of the equivalent IOEvent).
+ *
+ * A path made of a directory and a name (e.g., the destination of a create) is kept as both, and only joined when written.
+ */
+class IOEventMessage final
+{
+private:
 
-    static inline const size_t max_size()
+    typedef struct
     {
-        // IMPORTANT: Keep this in sync with the de- and serialization logic in the implementation file (IOEvent.cpp), especially Size()!
-        return (3 * std::to_string(PID_MAX).length()) +   // Pids
-               (3 * std::to_string(USHRT_MAX).length()) + // Type + Action + Mode
-               std::to_string(true).length() +            // Modified
-               std::to_string(UINT_MAX).length() +        // error
-               (3 * PATH_MAX) +                           // Executable, src and dst paths
-               10;                                        // Delimiters
+        es_string_token_t directory;
+        // Only used when hasName is set
+        es_string_token_t name;
+        bool hasName;
+    } Path;
+
+    pid_t pid_;
+    pid_t cpid_ = 0;
+    pid_t ppid_;
+    pid_t oppid_;
+    es_event_type_t eventType_;
+    es_action_type_t actionType_;
+    mode_t mode_ = 0;
+    bool modified_ = false;
+    audit_token_t auditToken_;
+
+    es_string_token_t executable_;
+    Path paths_[2] = {};
+
+    static inline Path SinglePath(const es_file_t *file) { return { file->path, { 0, nullptr }, false }; }
+    static inline Path JoinedPath(const es_file_t *directory, es_string_token_t name) { return { directory->path, name, true }; }
+
+    // Whether no separator goes between the directory and the name of the path (the directory is the root)
+    static inline bool IsRootDirectory(const Path &path) { return path.directory.length == 1 && path.directory.data[0] == '/'; }
+
+public:
+
+    IOEventMessage() = delete;
+    IOEventMessage(const es_message_t *msg);
+
+    inline const pid_t GetPid() const { return pid_; }
+    inline const pid_t GetChildPid() const { return cpid_; }
+    inline const pid_t GetParentPid() const { return ppid_; }
+    inline const pid_t GetOriginalParentPid() const { return oppid_; }
+    inline const audit_token_t* GetProcessAuditToken() const { return &auditToken_; }
+    inline const es_event_type_t GetEventType() const { return eventType_; }
+    inline const es_action_type_t GetActionType() const { return actionType_; }
+    inline const mode_t GetMode() const { return mode_; }
+    inline const bool FSEntryModified() const { return modified_; }
+
+    // Not null-terminated
+    inline const char* GetExecutablePath() const { return executable_.data; }
+    inline const size_t GetExecutableLength() const { return executable_.length; }
+
+    inline const size_t GetPathLength(int index) const
+    {
+        const Path &path = paths_[index];
+        return path.directory.length + (path.hasName ? (IsRootDirectory(path) ? 0 : 1) + path.name.length : 0);
+    }
+
+    // Copies the path to the given buffer, which must be at least GetPathLength(index) bytes long (no null terminator is written)
+    void CopyPath(int index, char *buffer) const;
+
+    // See IOEvent::RecordSize and IOEvent::WriteRecord
+    inline const size_t RecordSize(bool executableInterned = false) const
+    {
+        return sizeof(IOEventRecordHeader) + (executableInterned ? 0 : executable_.length) + GetPathLength(SRC_PATH) + GetPathLength(DST_PATH);
     }
+
+    void WriteRecord(char *buffer, bool executableInterned = false) const;
 };
+#endif
+
+typedef ProcessCallbackResult (*process_callback)(void *sandbox, const IOEvent &event, pid_t host, IOEventBacking backing);
 
-typedef ProcessCallbackResult (*process_callback)(void *sandbox, const IOEvent event, pid_t host, IOEventBacking backing);
+#if __APPLE__
+// Returns the serial queue the given event has to be processed on, the same one for every event of a pip
+typedef dispatch_queue_t (*event_queue_callback)(void *sandbox, const IOEvent &event);
+#endif
 
 #endif /* IOEvent_hpp */
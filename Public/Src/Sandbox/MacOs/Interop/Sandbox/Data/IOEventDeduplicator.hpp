@@ -0,0 +1,122 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef IOEventDeduplicator_hpp
+#define IOEventDeduplicator_hpp
+
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+
+#include "IOEvent.hpp"
+
+/**
+ * When running hybrid, the EndpointSecurity clients and the interposed processes observe the same processes, so most file
+ * accesses show up twice. This remembers the recent events delivered by the interposer, so the EndpointSecurity copies of
+ * them can be dropped before they get policy-checked and reported a second time.
+ *
+ * Events are identified by the hash of their process id, type and paths. The table is direct-mapped and lock-free: a slot
+ * holds a single word made of the upper bits of the hash of an event and the (wrapping) time in milliseconds it was seen
+ * at. Colliding events just evict each other, which at worst lets a duplicate through.
+ *
+ * Process lifecycle events (fork, exec, exit) and authorization events are never deduplicated: the event processor treats
+ * the ones of each source differently, and authorizations need a response.
+ */
+class IOEventDeduplicator final
+{
+private:
+
+    static const uint32_t kSlotCount = 4096;
+    static const uint32_t kTimeBits = 24;
+    static const uint64_t kTimeMask = (1ULL << kTimeBits) - 1;
+
+    const uint64_t windowMs_;
+    std::atomic<uint64_t> slots_[kSlotCount];
+
+    static inline uint64_t Hash(uint64_t hash, const void *bytes, size_t length)
+    {
+        // FNV-1a
+        for (size_t i = 0; i < length; i++)
+        {
+            hash = (hash ^ ((const uint8_t *)bytes)[i]) * 0x100000001b3ULL;
+        }
+
+        return hash;
+    }
+
+    static uint64_t Hash(const IOEvent &event)
+    {
+        pid_t pid = event.GetPid();
+        uint32_t type = (uint32_t)event.GetEventType();
+
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        hash = Hash(hash, &pid, sizeof(pid));
+        hash = Hash(hash, &type, sizeof(type));
+        hash = Hash(hash, event.GetSrcPath().data(), event.GetSrcPath().length() + 1);
+        hash = Hash(hash, event.GetDstPath().data(), event.GetDstPath().length());
+        return hash;
+    }
+
+    static inline uint64_t NowMs()
+    {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static inline bool IsDeduplicated(const IOEvent &event)
+    {
+        if (event.GetActionType() == ES_ACTION_TYPE_AUTH)
+        {
+            return false;
+        }
+
+        switch (event.GetEventType())
+        {
+            case ES_EVENT_TYPE_NOTIFY_FORK:
+            case ES_EVENT_TYPE_NOTIFY_EXEC:
+            case ES_EVENT_TYPE_NOTIFY_EXIT:
+                return false;
+            default:
+                return true;
+        }
+    }
+
+public:
+
+    IOEventDeduplicator() = delete;
+
+    /*! Events from EndpointSecurity are dropped if the interposer delivered the same event at most 'windowMs' earlier */
+    explicit IOEventDeduplicator(uint32_t windowMs) : windowMs_(windowMs)
+    {
+        for (uint32_t i = 0; i < kSlotCount; i++)
+        {
+            slots_[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    /*! Remembers an event delivered by the interposer */
+    void RecordInterposedEvent(const IOEvent &event)
+    {
+        if (IsDeduplicated(event))
+        {
+            uint64_t hash = Hash(event);
+            slots_[hash % kSlotCount].store((hash & ~kTimeMask) | (NowMs() & kTimeMask), std::memory_order_relaxed);
+        }
+    }
+
+    /*! Whether an event delivered by EndpointSecurity was delivered by the interposer already (within the window) */
+    bool IsInterposedDuplicate(const IOEvent &event) const
+    {
+        if (!IsDeduplicated(event))
+        {
+            return false;
+        }
+
+        uint64_t hash = Hash(event);
+        uint64_t slot = slots_[hash % kSlotCount].load(std::memory_order_relaxed);
+        return slot != 0
+            && (slot & ~kTimeMask) == (hash & ~kTimeMask)
+            && ((NowMs() - slot) & kTimeMask) <= windowMs_;
+    }
+};
+
+#endif /* IOEventDeduplicator_hpp */
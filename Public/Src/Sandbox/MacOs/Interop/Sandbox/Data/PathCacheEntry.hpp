@@ -4,45 +4,234 @@
 #ifndef PathCacheEntry_h
 #define PathCacheEntry_h
 
+#include <assert.h>
+#include <atomic>
+#include <cstddef>
 #include <fcntl.h>
 #include <libproc.h>
+#include <mutex>
+#include <new>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
 
-typedef struct _buf {
-    char data[PATH_MAX] = { '\0' };
-    size_t length;
-} Buffer;
+/**
+ * Process-wide table of the long paths held by path cache entries. Every distinct path is stored once and shared by all
+ * the entries referring to it; a path is dropped from the table once the last entry referring to it is destroyed.
+ */
+class PathInterner final
+{
+public:
+
+    typedef struct _node {
+        std::atomic<uint32_t> refCount;
+        uint32_t hash;
+        size_t length;
+        struct _node *next;
+        char data[1];
+    } Node;
+
+    /** Returns the (retained) node holding the given path, creating it if the path is not interned yet */
+    static Node* Intern(const char *path, size_t length)
+    {
+        return GetInstance().InternPath(path, length);
+    }
+
+    static void Retain(Node *node)
+    {
+        node->refCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static void Release(Node *node)
+    {
+        GetInstance().ReleaseNode(node);
+    }
+
+private:
+
+    static const size_t kInitialBucketCount = 1024;
+
+    std::mutex lock_;
+    std::vector<Node *> buckets_;
+    size_t count_ = 0;
+
+    PathInterner() : buckets_(kInitialBucketCount, nullptr) {}
+
+    static PathInterner& GetInstance()
+    {
+        // Intentionally leaked: entries can still be released by static tries torn down after this would be destroyed
+        static PathInterner *instance = new PathInterner();
+        return *instance;
+    }
 
+    static inline uint32_t Hash(const char *path, size_t length)
+    {
+        // FNV-1a
+        uint32_t hash = 0x811c9dc5;
+        for (size_t i = 0; i < length; i++)
+        {
+            hash = (hash ^ (uint8_t)path[i]) * 0x01000193;
+        }
+        return hash;
+    }
+
+    // Assumes lock_ is held by the caller
+    void Grow()
+    {
+        std::vector<Node *> buckets(buckets_.size() * 2, nullptr);
+        for (Node *head : buckets_)
+        {
+            while (head != nullptr)
+            {
+                Node *next = head->next;
+                size_t index = head->hash & (buckets.size() - 1);
+                head->next = buckets[index];
+                buckets[index] = head;
+                head = next;
+            }
+        }
+        buckets_.swap(buckets);
+    }
+
+    Node* InternPath(const char *path, size_t length)
+    {
+        uint32_t hash = Hash(path, length);
+
+        const std::lock_guard<std::mutex> lock(lock_);
+        Node **bucket = &buckets_[hash & (buckets_.size() - 1)];
+        for (Node *node = *bucket; node != nullptr; node = node->next)
+        {
+            if (node->hash == hash && node->length == length && memcmp(node->data, path, length) == 0)
+            {
+                Retain(node);
+                return node;
+            }
+        }
+
+        Node *node = (Node *)malloc(offsetof(Node, data) + length + 1);
+        if (node == nullptr)
+        {
+            return nullptr;
+        }
+
+        new (&node->refCount) std::atomic<uint32_t>(1);
+        node->hash   = hash;
+        node->length = length;
+        memcpy(node->data, path, length);
+        node->data[length] = '\0';
+
+        node->next = *bucket;
+        *bucket = node;
+        if (++count_ > buckets_.size() * 2)
+        {
+            Grow();
+        }
+
+        return node;
+    }
+
+    void ReleaseNode(Node *node)
+    {
+        // Only the last reference is dropped while holding lock_, so 'InternPath' can never hand out a node being freed
+        uint32_t refCount = node->refCount.load(std::memory_order_relaxed);
+        while (refCount > 1)
+        {
+            if (node->refCount.compare_exchange_weak(refCount, refCount - 1, std::memory_order_release, std::memory_order_relaxed))
+            {
+                return;
+            }
+        }
+
+        const std::lock_guard<std::mutex> lock(lock_);
+        if (node->refCount.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        {
+            return;
+        }
+
+        Node **link = &buckets_[node->hash & (buckets_.size() - 1)];
+        while (*link != node)
+        {
+            link = &(*link)->next;
+        }
+        *link = node->next;
+        count_--;
+
+        node->refCount.~atomic();
+        free(node);
+    }
+};
+
+/**
+ * A path stored by the path caches of the interposed processes. Paths short enough to fit the entry are kept inline, the
+ * longer ones are stored in the 'PathInterner' and shared by every entry of the process holding the same path.
+ */
 struct PathCacheEntry final
 {
 private:
-    Buffer buffer_;
+
+    // Keeps an entry within a single cache line
+    static const size_t kInlineCapacity = 48;
+
+    size_t length_;
+    union {
+        char inline_[kInlineCapacity];
+        PathInterner::Node *interned_;
+    };
+
+    inline bool IsInline() const { return length_ < kInlineCapacity; }
+
+    void Init(const char *path, size_t length)
+    {
+        length_ = length;
+        if (IsInline())
+        {
+            memcpy(inline_, path, length);
+            inline_[length] = '\0';
+            return;
+        }
+
+        interned_ = PathInterner::Intern(path, length);
+        if (interned_ == nullptr)
+        {
+            length_ = 0;
+            inline_[0] = '\0';
+        }
+    }
+
 public:
+
     PathCacheEntry(const char *path, size_t length)
     {
-        memcpy(buffer_.data, path, length);
-        buffer_.length = length;
+        Init(path, length);
     }
 
     PathCacheEntry(int identifier, bool isPid = false)
     {
         assert(identifier > 0);
 
-        if (!isPid)
-        {
-            assert(fcntl(identifier, F_GETPATH, buffer_.data) != -1);
-        }
-        else
-        {
-            assert(proc_pidpath(identifier, (void *)buffer_.data, PATH_MAX) > 0);
-        }
+        char path[PATH_MAX] = { '\0' };
+        bool resolved = isPid
+            ? proc_pidpath(identifier, (void *)path, PATH_MAX) > 0
+            : fcntl(identifier, F_GETPATH, path) != -1;
+        assert(resolved);
 
-        buffer_.length = strlen(buffer_.data);
+        Init(path, resolved ? strlen(path) : 0);
     }
 
-    ~PathCacheEntry() = default;
+    PathCacheEntry(const PathCacheEntry &other) = delete;
+    PathCacheEntry& operator=(const PathCacheEntry &other) = delete;
+
+    ~PathCacheEntry()
+    {
+        if (!IsInline())
+        {
+            PathInterner::Release(interned_);
+        }
+    }
 
-    inline const char* GetPath() const { return buffer_.data; }
-    inline const size_t GetPathLength() const { return buffer_.length; }
+    inline const char* GetPath() const { return IsInline() ? inline_ : interned_->data; }
+    inline const size_t GetPathLength() const { return length_; }
 };
 
 #endif /* PathCacheEntry_h */
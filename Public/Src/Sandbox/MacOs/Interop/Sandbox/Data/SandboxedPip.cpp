@@ -7,30 +7,223 @@
 #pragma mark SandboxedPip Implementation
 
 SandboxedPip::SandboxedPip(pid_t pid, const char *payload, size_t length)
+    : SandboxedPip(pid, payload, length, /* copyPayload */ true)
+{
+}
+
+SandboxedPip::SandboxedPip(pid_t pid, const char *payload, size_t length, bool copyPayload)
 {
     log_debug("Initializing with pid (%d) from: %{public}s", pid, __FUNCTION__);
 
-    payload_ = (char *) malloc(length);
-    if (payload == NULL)
+    const char *parseError = nullptr;
+    Manifest *manifest = ParseManifest(payload, length, copyPayload, &parseError);
+    if (manifest == nullptr)
     {
-        throw BuildXLException("Could not allocate memory for FAM payload storage!");
+        std::string error= "FileAccessManifest parsing exception, error: ";
+        throw BuildXLException(error.append(parseError));
     }
 
-    memcpy(payload_, payload, length);
-    fam_.init((BYTE*)payload_, length);
+    manifest_ = manifest;
+    processId_ = pid;
+    processTreeCount_ = 1;
 
-    if (fam_.HasErrors())
+    pathCache_ = Trie<AccessCacheRecord>::createPathTrie();
+    if (pathCache_ == nullptr)
     {
-        std::string error= "FileAccessManifest parsing exception, error: ";
-        throw BuildXLException(error.append(fam_.Error()));
+        throw BuildXLException("Could not create Trie for the path cache!");
     }
+}
 
-    processId_ = pid;
-    processTreeCount_ = 1;
+// Whether 'node' or any record below it has (one of) the 'policy' bits in its node or cone policy
+static bool HasPolicyInCone(PCManifestRecord node, FileAccessPolicy policy)
+{
+    if ((node->GetConePolicy() & policy) != 0 || (node->GetNodePolicy() & policy) != 0)
+    {
+        return true;
+    }
+
+    for (int i = 0; i < node->BucketCount; i++)
+    {
+        PCManifestRecord child = node->GetChildRecord(i);
+        if (child != nullptr && HasPolicyInCone(child, policy))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+SandboxedPip::Manifest* SandboxedPip::ParseManifest(const char *payload, size_t length, bool copyPayload, const char **error)
+{
+    Manifest *manifest = new Manifest();
+    manifest->ownsPayload = copyPayload;
+    manifest->previous = nullptr;
+    if (copyPayload)
+    {
+        manifest->payload = (char *) malloc(length);
+        if (manifest->payload == NULL)
+        {
+            delete manifest;
+            *error = "Could not allocate memory for FAM payload storage!";
+            return nullptr;
+        }
+
+        memcpy(manifest->payload, payload, length);
+    }
+    else
+    {
+        manifest->payload = (char *) payload;
+    }
+
+    manifest->fam.init((BYTE*)manifest->payload, length);
+    if (manifest->fam.HasErrors())
+    {
+        *error = manifest->fam.Error();
+        if (copyPayload)
+        {
+            free(manifest->payload);
+        }
+
+        delete manifest;
+        return nullptr;
+    }
+
+    manifest->reportsDirectoryEnumerations = HasPolicyInCone(manifest->fam.GetUnixRootNode(), FileAccessPolicy_ReportDirectoryEnumerationAccess);
+    return manifest;
+}
+
+bool SandboxedPip::UpdateManifest(const char *payload, size_t length, bool copyPayload)
+{
+    const char *error = nullptr;
+    Manifest *manifest = ParseManifest(payload, length, copyPayload, &error);
+    if (manifest == nullptr)
+    {
+        log_error("Could not update the manifest of pip (%#llX): %{public}s", GetPipId(), error);
+        return false;
+    }
+
+    // A manifest meant for another pip is a bug on the sending side, the current one is better left alone
+    if (manifest->fam.GetPipId()->PipId != GetPipId())
+    {
+        log_error("Could not update the manifest of pip (%#llX): the new manifest is for pip (%#llX)", GetPipId(), manifest->fam.GetPipId()->PipId);
+        if (copyPayload)
+        {
+            free(manifest->payload);
+        }
+
+        delete manifest;
+        return false;
+    }
+
+    manifest->previous = manifest_.load(std::memory_order_relaxed);
+    manifest_.store(manifest, std::memory_order_release);
+    return true;
+}
+
+void SandboxedPip::ReleasePreviousManifests(size_t keep)
+{
+    Manifest *last = manifest_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < keep && last != nullptr; i++)
+    {
+        last = last->previous;
+    }
+
+    if (last == nullptr)
+    {
+        return;
+    }
+
+    Manifest *manifest = last->previous;
+    last->previous = nullptr;
+    while (manifest != nullptr)
+    {
+        Manifest *previous = manifest->previous;
+        if (manifest->ownsPayload)
+        {
+            free(manifest->payload);
+        }
+
+        delete manifest;
+        manifest = previous;
+    }
+}
+
+static inline bool IsUntrackedPolicy(FileAccessPolicy policy)
+{
+    // Overriding allowed writes for existing files takes looking at the first write to every path
+    return (policy & FileAccessPolicy_AllowAll) == FileAccessPolicy_AllowAll &&
+           (policy & (FileAccessPolicy_ReportAccess | FileAccessPolicy_ReportDirectoryEnumerationAccess | FileAccessPolicy_OverrideAllowWriteForExistingFiles)) == 0;
+}
+
+// A scope is only untracked if no record below it asks for anything else
+static bool IsUntrackedCone(PCManifestRecord node)
+{
+    if (!IsUntrackedPolicy(node->GetConePolicy()) || !IsUntrackedPolicy(node->GetNodePolicy()))
+    {
+        return false;
+    }
+
+    for (int i = 0; i < node->BucketCount; i++)
+    {
+        PCManifestRecord child = node->GetChildRecord(i);
+        if (child != nullptr && !IsUntrackedCone(child))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void CollectUntrackedScopes(PCManifestRecord node, std::string &path, std::vector<std::string> &scopes)
+{
+    for (int i = 0; i < node->BucketCount; i++)
+    {
+        PCManifestRecord child = node->GetChildRecord(i);
+        if (child == nullptr)
+        {
+            continue;
+        }
+
+        size_t length = path.length();
+        path.append("/").append(child->GetPartialPath());
+
+        if (IsUntrackedCone(child))
+        {
+            scopes.push_back(path);
+        }
+        else
+        {
+            CollectUntrackedScopes(child, path, scopes);
+        }
+
+        path.resize(length);
+    }
+}
+
+void SandboxedPip::GetUntrackedScopes(std::vector<std::string> &scopes) const
+{
+    // The root itself is never reported as a scope: that would leave nothing to observe
+    std::string path;
+    CollectUntrackedScopes(GetManifestRecord(), path, scopes);
 }
 
 SandboxedPip::~SandboxedPip()
 {
     log_debug("Releasing pip object (%#llX) - freed from %{public}s", GetPipId(),  __FUNCTION__);
-    free(payload_);
+    Manifest *manifest = manifest_.load(std::memory_order_relaxed);
+    while (manifest != nullptr)
+    {
+        Manifest *previous = manifest->previous;
+        if (manifest->ownsPayload)
+        {
+            free(manifest->payload);
+        }
+
+        delete manifest;
+        manifest = previous;
+    }
+
+    delete pathCache_;
 }
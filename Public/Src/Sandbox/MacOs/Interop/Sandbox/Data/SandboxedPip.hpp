@@ -4,8 +4,14 @@
 #ifndef SandboxedPip_hpp
 #define SandboxedPip_hpp
 
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "AccessCacheRecord.hpp"
 #include "BuildXLSandboxShared.hpp"
 #include "FileAccessManifestParser.hpp"
+#include "Trie.hpp"
 
 /*!
  * Represents the root of the process tree being tracked.
@@ -26,50 +32,120 @@ private:
     /*! Process id of the root process of this pip. */
     pid_t processId_;
 
-    /*! File access manifest payload bytes */
-    char *payload_;
+    /*! A file access manifest along with the payload bytes it was parsed from */
+    struct Manifest
+    {
+        /*! File access manifest payload bytes */
+        char *payload;
+
+        /*! Whether 'payload' is a private copy that must be freed when this object is released */
+        bool ownsPayload;
+
+        /*! File access manifest (contains pointers into the 'payload' byte array */
+        FileAccessManifestParseResult fam;
+
+        /*! Whether any record of 'fam' asks for directory enumerations to be reported (see ReportsDirectoryEnumerations) */
+        bool reportsDirectoryEnumerations;
+
+        /*!
+         * The manifest this one replaced (see 'UpdateManifest'). Policy lookups running concurrently with an update may
+         * still be walking it, so it is only released along with this object or by 'ReleasePreviousManifests'.
+         */
+        Manifest *previous;
+    };
+
+    /*! The current file access manifest */
+    std::atomic<Manifest *> manifest_;
+
+    inline const FileAccessManifestParseResult& Fam() const            { return manifest_.load(std::memory_order_acquire)->fam; }
 
-    /*! File access manifest (contains pointers into the 'payload_' byte array */
-    FileAccessManifestParseResult fam_;
+    /*! Parses the manifest in 'payload', returns nullptr (and the parse error in 'error') if it is not valid */
+    static Manifest* ParseManifest(const char *payload, size_t length, bool copyPayload, const char **error);
 
     /*! Number of processses in this pip's process tree */
     std::atomic<int> processTreeCount_;
 
+    /*! Accesses checked (and reported) so far, per path */
+    Trie<AccessCacheRecord> *pathCache_;
+
 public:
 
     SandboxedPip() = delete;
     SandboxedPip(pid_t pid, const char *payload, size_t length);
+
+    /*!
+     * When 'copyPayload' is false, the manifest is parsed directly on 'payload' (e.g., a read-only mapping of the
+     * manifest file), which must then outlive this object.
+     */
+    SandboxedPip(pid_t pid, const char *payload, size_t length, bool copyPayload);
     ~SandboxedPip();
 
+    /*!
+     * Atomically replaces the file access manifest of this pip (e.g., when the allowed scopes of a service pip change
+     * between work items), returning false if 'payload' is not a valid manifest for this pip. Lookups that already
+     * started finish against the previous manifest. 'copyPayload' has the same meaning as for the constructor.
+     * Not safe to call concurrently with itself; the path cache is left to the caller, which knows what changed.
+     */
+    bool UpdateManifest(const char *payload, size_t length, bool copyPayload);
+
+    /*!
+     * Releases the manifests replaced by 'UpdateManifest', but for the 'keep' most recently replaced ones. Only safe once no
+     * lookup can still be walking them. Payloads this object does not own are left to the caller.
+     * Not safe to call concurrently with 'UpdateManifest'.
+     */
+    void ReleasePreviousManifests(size_t keep);
+
     /*! Process id of the root process of this pip. */
     inline const pid_t GetProcessId() const                            { return processId_; }
 
     /*! A unique identifier of this pip. */
-    inline const pipid_t GetPipId() const                              { return fam_.GetPipId()->PipId; }
+    inline const pipid_t GetPipId() const                              { return Fam().GetPipId()->PipId; }
 
     /*! File access manifest record for this pip (to be used for checking file accesses) */
-    inline const PCManifestRecord GetManifestRecord() const            { return fam_.GetUnixRootNode(); }
+    inline const PCManifestRecord GetManifestRecord() const            { return Fam().GetUnixRootNode(); }
 
     /*! File access manifest flags */
-    inline const FileAccessManifestFlag GetFamFlags() const            { return fam_.GetFamFlags(); }
+    inline const FileAccessManifestFlag GetFamFlags() const            { return Fam().GetFamFlags(); }
 
     /*! File access manifest extra flags */
-    inline const FileAccessManifestExtraFlag GetFamExtraFlags() const  { return fam_.GetFamExtraFlags(); }
+    inline const FileAccessManifestExtraFlag GetFamExtraFlags() const  { return Fam().GetFamExtraFlags(); }
 
     /*!
      * Returns the full path of the root process of this pip.
      * The lenght of the path is stored in the 'length' argument because the path is not necessarily 0-terminated.
      */
-    inline const char* GetProcessPath(int *length) const               { return fam_.GetProcessPath(length); }
-    inline const char* GetReportsPath(int *length) const               { return fam_.GetReportsPath(length); }
+    inline const char* GetProcessPath(int *length) const               { return Fam().GetProcessPath(length); }
+    inline const char* GetReportsPath(int *length) const               { return Fam().GetReportsPath(length); }
 
     /*! Number of currently active processes in this pip's process tree */
     inline const int GetTreeSize() const                               { return processTreeCount_; }
 
     /*! When this returns true, child processes should not be tracked. */
-    bool AllowChildProcessesToBreakAway() const                        { return fam_.AllowChildProcessesToBreakAway(); }
+    bool AllowChildProcessesToBreakAway() const                        { return Fam().AllowChildProcessesToBreakAway(); }
+
+    /*!
+     * Whether any scope of the manifest reports directory enumerations. When none does, every enumeration is allowed and
+     * ignored whatever its path, so it does not need a policy lookup.
+     */
+    bool ReportsDirectoryEnumerations() const                          { return manifest_.load(std::memory_order_acquire)->reportsDirectoryEnumerations; }
+
+    /*! Whether the events that only change the metadata of a file matter to this pip (see IsMetadataWriteEvent) */
+    bool ObservesMetadataWrites() const
+    {
+        FileAccessManifestFlag flags = GetFamFlags();
+        return CheckReportAllFileAccesses(flags) || CheckReportAllFileUnexpectedAccesses(flags) || CheckFailUnexpectedFileAccesses(flags);
+    }
+
+    inline const char* GetInternalDetoursErrorNotificationFile() const { return Fam().GetInternalDetoursErrorNotificationFile(); }
 
-    inline const char* GetInternalDetoursErrorNotificationFile() const { return fam_.GetInternalDetoursErrorNotificationFile(); }
+    /*! Cache of the accesses checked for this pip, keyed by path (see AccessCacheRecord) */
+    inline Trie<AccessCacheRecord>* GetPathCache() const               { return pathCache_; }
+
+    /*!
+     * Appends the topmost scopes of the manifest under which every access is allowed and none is reported, so the sandbox
+     * does not need to see their accesses at all.
+     */
+    void GetUntrackedScopes(std::vector<std::string> &scopes) const;
 
 
 #pragma mark Process Tree Tracking
@@ -1,10 +1,125 @@
 // Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
+#include <cstddef>
+#include <mutex>
+#include <new>
+
 #include "SandboxedProcess.hpp"
 
+#pragma mark Process Block Pool
+
+/*!
+ * Fixed-size blocks for the process objects created by 'SandboxedProcess::Create'.  The blocks are carved out of chunks
+ * allocated a whole chunk at a time and, once released, are kept in a free list for the next process instead of being
+ * given back to the heap.  Requests of any other size (there shouldn't be any) just go to the heap.
+ */
+class ProcessBlockPool final
+{
+private:
+
+    static const size_t kBlocksPerChunk = 64;
+
+    std::mutex lock_;
+
+    /*! Released blocks, each one pointing to the next in its first word */
+    void *freeList_ = nullptr;
+
+    /*! The size of the blocks requested so far, and that size rounded up to keep the blocks of a chunk aligned */
+    size_t requestSize_ = 0;
+    size_t blockSize_ = 0;
+
+    // Assumes lock_ is held by the caller
+    void Grow()
+    {
+        char *chunk = (char *)::operator new(blockSize_ * kBlocksPerChunk, std::nothrow);
+        if (chunk == nullptr)
+        {
+            return;
+        }
+
+        for (size_t i = 0; i < kBlocksPerChunk; i++)
+        {
+            void *block = chunk + i * blockSize_;
+            *(void **)block = freeList_;
+            freeList_ = block;
+        }
+    }
+
+public:
+
+    void* Allocate(size_t size)
+    {
+        {
+            const std::lock_guard<std::mutex> lock(lock_);
+            if (requestSize_ == 0)
+            {
+                requestSize_ = size;
+                blockSize_ = (size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+            }
+
+            if (size == requestSize_)
+            {
+                if (freeList_ == nullptr)
+                {
+                    Grow();
+                }
+
+                if (freeList_ != nullptr)
+                {
+                    void *block = freeList_;
+                    freeList_ = *(void **)block;
+                    return block;
+                }
+            }
+        }
+
+        return ::operator new(size);
+    }
+
+    void Free(void *block, size_t size)
+    {
+        if (size != requestSize_)
+        {
+            ::operator delete(block);
+            return;
+        }
+
+        const std::lock_guard<std::mutex> lock(lock_);
+        *(void **)block = freeList_;
+        freeList_ = block;
+    }
+
+    /*! Never destroyed: process objects may still be released from exit handlers */
+    static ProcessBlockPool* GetInstance()
+    {
+        static ProcessBlockPool *s_pool = new ProcessBlockPool();
+        return s_pool;
+    }
+};
+
+template <typename U>
+struct PooledProcessAllocator
+{
+    typedef U value_type;
+
+    PooledProcessAllocator() = default;
+    template <typename V> PooledProcessAllocator(const PooledProcessAllocator<V>&) {}
+
+    U* allocate(size_t n)               { return (U *)ProcessBlockPool::GetInstance()->Allocate(n * sizeof(U)); }
+    void deallocate(U *block, size_t n) { ProcessBlockPool::GetInstance()->Free(block, n * sizeof(U)); }
+
+    template <typename V> bool operator==(const PooledProcessAllocator<V>&) const { return true; }
+    template <typename V> bool operator!=(const PooledProcessAllocator<V>&) const { return false; }
+};
+
 #pragma mark SandboxedProcess Implementation
 
+std::shared_ptr<SandboxedProcess> SandboxedProcess::Create(pid_t processId, std::shared_ptr<SandboxedPip> pip)
+{
+    return std::allocate_shared<SandboxedProcess>(PooledProcessAllocator<SandboxedProcess>(), processId, pip);
+}
+
 SandboxedProcess::SandboxedProcess(pid_t processId, std::shared_ptr<SandboxedPip> pip)
 {
     assert(pip != nullptr);
@@ -12,7 +127,8 @@ SandboxedProcess::SandboxedProcess(pid_t processId, std::shared_ptr<SandboxedPip
 
     pip_ = pip;
     id_  = processId;
-    bzero(path_, sizeof(path_));
+    // The path is always read as a 0-terminated string, so there is no need to clear all of it
+    path_[0] = '\0';
     pathLength_ = 0;
 }
 
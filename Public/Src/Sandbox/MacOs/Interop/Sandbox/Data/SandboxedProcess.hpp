@@ -39,6 +39,12 @@ public:
     SandboxedProcess(pid_t processId, std::shared_ptr<SandboxedPip> pip);
     ~SandboxedProcess();
 
+    /*!
+     * Creates a process object whose memory (along with that of its reference count) comes from a pool of recycled blocks,
+     * so that tracking bursts of short-lived processes (e.g., 'make -j') doesn't go to the heap for every fork.
+     */
+    static std::shared_ptr<SandboxedProcess> Create(pid_t processId, std::shared_ptr<SandboxedPip> pip);
+
     /*! The pip this process belongs to */
     inline const std::shared_ptr<SandboxedPip> GetPip() const    { return pip_; }
 
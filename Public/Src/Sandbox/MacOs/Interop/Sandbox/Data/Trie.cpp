@@ -4,6 +4,9 @@
 #include "BuildXLException.hpp"
 #include "Trie.hpp"
 
+#include <new>
+#include <string.h>
+
 template <typename T>
 std::atomic<uint> Node<T>::s_numUintNodes(0);
 
@@ -11,42 +14,47 @@ template <typename T>
 std::atomic<uint> Node<T>::s_numPathNodes(0);
 
 template <typename T>
-Node<T>::Node(uint numChildren)
-{
-    if (numChildren == s_uintNodeChildrenCount) ++s_numUintNodes;
-    else if (numChildren == s_pathNodeChildrenCount) ++s_numPathNodes;
+std::atomic<uint64_t> Node<T>::s_numUintNodeBytes(0);
 
-    record_ = nullptr;
-    childrenLength_ = numChildren;
+template <typename T>
+std::atomic<uint64_t> Node<T>::s_numPathNodeBytes(0);
 
-    children_ = (Node **) malloc(numChildren * sizeof(Node *));
-    if (children_)
-    {
-        for (int i = 0; i < childrenLength_; i++)
-        {
-            children_[i] = nullptr;
-        }
-    }
+template <typename T>
+Node<T>::~Node()
+{
+    free(prefix_.load(std::memory_order_relaxed));
+    free(children_.load(std::memory_order_relaxed));
+    prefix_ = nullptr;
+    children_ = nullptr;
+
+    if (record_ != nullptr) record_.reset();
 }
 
 template <typename T>
-Node<T>::~Node()
+std::atomic<Node<T>*>* Node<T>::findSlot(uint8_t idx) const
 {
-    if (children_)
+    Children *children = children_.load(std::memory_order_acquire);
+    if (children == nullptr)
     {
-        for (int i = 0; i < childrenLength_; i++)
-        {
-            children_[i] = nullptr;
-        }
+        return nullptr;
+    }
 
-        free(children_);
-        children_ = nullptr;
+    if (children->direct)
+    {
+        return idx < children->capacity ? &slots(children)[idx] : nullptr;
     }
 
-    if (record_ != nullptr) record_.reset();
+    uint count = children->count.load(std::memory_order_acquire);
+    const uint8_t *childKeys = keys(children);
+    for (uint i = 0; i < count; i++)
+    {
+        if (childKeys[i] == idx)
+        {
+            return &slots(children)[i];
+        }
+    }
 
-    if (length() == s_uintNodeChildrenCount) --s_numUintNodes;
-    else if (length() == s_pathNodeChildrenCount) --s_numPathNodes;
+    return nullptr;
 }
 
 // ================================== class Trie ==================================
@@ -55,8 +63,12 @@ template <typename T>
 Trie<T>::Trie(TrieKind kind)
 {
     kind_ = kind;
-    root_ = createNode();
-    if (root_->children_ == nullptr)
+    size_ = 0;
+    version_ = 0;
+    onChangeCallback_ = nullptr;
+    onChangeData_ = nullptr;
+    root_ = createNode(nullptr, 0);
+    if (root_ == nullptr)
     {
         throw BuildXLException("Trie creation failed as no root node could be allocated!");
     }
@@ -65,73 +77,242 @@ Trie<T>::Trie(TrieKind kind)
 template <typename T>
 Trie<T>::~Trie()
 {
-    traverse(/*computeKey*/ false, /*callbackArgs*/ nullptr, [](Trie<T>*, void*, uint64_t, Node<T> *node)
+    traverse(/*computeKey*/ false, /*callbackArgs*/ nullptr, [](Trie<T> *me, void*, uint64_t, Node<T> *node)
     {
-        delete node;
+        me->deleteNode(node);
     });
 
+    for (const auto &block : retired_)
+    {
+        free(block.first);
+        countAllocation(0, -(ssize_t)block.second);
+    }
+
+    retired_.clear();
     root_ = nullptr;
     size_ = 0;
 }
 
 template <typename T>
-bool Trie<T>::findChildNode(Node<T> *node, int idx, bool createIfMissing)
+void Trie<T>::countAllocation(ssize_t nodes, ssize_t bytes) const
 {
-    if (idx < 0 || idx >= node->length())
+    if (kind_ == kUintTrie)
     {
-        return false;
+        Node<T>::s_numUintNodes += nodes;
+        Node<T>::s_numUintNodeBytes += bytes;
+    }
+    else
+    {
+        Node<T>::s_numPathNodes += nodes;
+        Node<T>::s_numPathNodeBytes += bytes;
     }
+}
 
-    bool childNodeExists = node->children()[idx] != nullptr;
+template <typename T>
+typename Trie<T>::Prefix* Trie<T>::createPrefix(const uint8_t *indices, uint length)
+{
+    if (length == 0)
+    {
+        return nullptr;
+    }
 
-    if (childNodeExists)
+    Prefix *prefix = (Prefix *) malloc(Node<T>::prefixSize(length));
+    if (prefix != nullptr)
     {
-        return true;
+        prefix->length = length;
+        memcpy((uint8_t *)Node<T>::prefixIndices(prefix), indices, length);
+        countAllocation(0, Node<T>::prefixSize(length));
     }
 
-    // child is missing
-    if (!createIfMissing)
+    return prefix;
+}
+
+template <typename T>
+typename Trie<T>::Children* Trie<T>::createChildren(uint capacity)
+{
+    uint alphabetSize = kind_ == kUintTrie ? Node<T>::s_uintNodeChildrenCount : Node<T>::s_pathNodeChildrenCount;
+    bool direct = capacity >= alphabetSize;
+    if (direct)
     {
-        return false;
+        capacity = alphabetSize;
+    }
+
+    size_t size = Node<T>::childrenSize(capacity, direct);
+    Children *children = (Children *) malloc(size);
+    if (children != nullptr)
+    {
+        children->capacity = capacity;
+        children->direct = direct;
+        new (&children->count) std::atomic<uint>(0);
+        for (uint i = 0; i < capacity; i++)
+        {
+            new (&Node<T>::slots(children)[i]) std::atomic<Node<T>*>(nullptr);
+        }
+
+        countAllocation(0, size);
+    }
+
+    return children;
+}
+
+template <typename T>
+Node<T>* Trie<T>::createNode(const uint8_t *indices, uint length)
+{
+    Node<T> *node = new (std::nothrow) Node<T>();
+    if (node == nullptr)
+    {
+        return nullptr;
+    }
+
+    if (length > 0)
+    {
+        Prefix *prefix = createPrefix(indices, length);
+        if (prefix == nullptr)
+        {
+            delete node;
+            return nullptr;
+        }
+
+        node->prefix_.store(prefix, std::memory_order_relaxed);
+    }
+
+    countAllocation(1, sizeof(Node<T>));
+    return node;
+}
+
+template <typename T>
+void Trie<T>::deleteNode(Node<T> *node)
+{
+    Prefix *prefix = node->prefix_.load(std::memory_order_relaxed);
+    Children *children = node->children_.load(std::memory_order_relaxed);
+
+    ssize_t bytes = sizeof(Node<T>);
+    if (prefix != nullptr)   bytes += Node<T>::prefixSize(prefix->length);
+    if (children != nullptr) bytes += Node<T>::childrenSize(children->capacity, children->direct);
+
+    delete node;
+    countAllocation(-1, -bytes);
+}
+
+template <typename T>
+void Trie<T>::retire(void *block, size_t size)
+{
+    if (block != nullptr)
+    {
+        retired_.push_back(std::make_pair(block, size));
     }
+}
 
-    Node<T>* newNode = createNode();
+template <typename T>
+bool Trie<T>::addChild(Node<T> *node, uint8_t idx, Node<T> *child)
+{
+    Children *children = node->children_.load(std::memory_order_relaxed);
+    if (children != nullptr && children->direct)
+    {
+        Node<T>::slots(children)[idx].store(child, std::memory_order_release);
+        return true;
+    }
 
-    // This should never happen except if we run out of memory.
-    if (newNode == nullptr)
+    uint count = children != nullptr ? children->count.load(std::memory_order_relaxed) : 0;
+    if (children != nullptr && count < children->capacity)
+    {
+        Node<T>::keys(children)[count] = idx;
+        Node<T>::slots(children)[count].store(child, std::memory_order_relaxed);
+        children->count.store(count + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Grow into a new block: readers still walking the current one simply don't see the new child yet
+    uint capacity = children == nullptr                           ? Node<T>::s_smallChildrenCapacity :
+                    children->capacity < Node<T>::s_mediumChildrenCapacity ? Node<T>::s_mediumChildrenCapacity :
+                                                                  UINT_MAX;
+    Children *grown = createChildren(capacity);
+    if (grown == nullptr)
     {
         return false;
     }
 
-    // TODO: Make thread safe!
-    node->children()[idx] = newNode;
+    // Moves the existing children over, along with the new one
+    for (uint i = 0; i <= count; i++)
+    {
+        uint8_t key = i < count ? Node<T>::keys(children)[i] : idx;
+        Node<T> *value = i < count ? Node<T>::slots(children)[i].load(std::memory_order_relaxed) : child;
+        if (grown->direct)
+        {
+            Node<T>::slots(grown)[key].store(value, std::memory_order_relaxed);
+        }
+        else
+        {
+            Node<T>::keys(grown)[i] = key;
+            Node<T>::slots(grown)[i].store(value, std::memory_order_relaxed);
+        }
+    }
+
+    grown->count.store(count + 1, std::memory_order_relaxed);
+    node->children_.store(grown, std::memory_order_release);
+
+    if (children != nullptr)
+    {
+        retire(children, Node<T>::childrenSize(children->capacity, children->direct));
+    }
 
     return true;
 }
 
 template <typename T>
-TrieResult Trie<T>::makeSentinel(Node<T> *node, std::shared_ptr<T> record)
+Node<T>* Trie<T>::splitPrefix(std::atomic<Node<T>*> *slot, Node<T> *node, uint matched)
 {
-    // if this is a sentinel node --> nothing to do
-    if (node->record_ != nullptr)
+    Prefix *prefix = node->prefix_.load(std::memory_order_relaxed);
+    const uint8_t *indices = Node<T>::prefixIndices(prefix);
+
+    Node<T> *parent = createNode(indices, matched);
+    if (parent == nullptr)
     {
-        return kTrieResultAlreadyExists;
+        return nullptr;
     }
 
-    std::shared_ptr<T> newRecord = record;
-    if (newRecord == nullptr)
+    Prefix *rest = createPrefix(indices + matched + 1, prefix->length - matched - 1);
+    if ((rest == nullptr && prefix->length - matched - 1 > 0) || !addChild(parent, indices[matched], node))
+    {
+        if (rest != nullptr)
+        {
+            countAllocation(0, -(ssize_t)Node<T>::prefixSize(rest->length));
+            free(rest);
+        }
+
+        deleteNode(parent);
+        return nullptr;
+    }
+
+    // A reader may have reached 'node' from 'slot' already, the new prefix would then mislead it (see findNode)
+    version_.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    // (released, a reader that follows them before validating must still find initialized blocks)
+    node->prefix_.store(rest, std::memory_order_release);
+    slot->store(parent, std::memory_order_release);
+
+    version_.fetch_add(1, std::memory_order_release);
+
+    retire(prefix, Node<T>::prefixSize(prefix->length));
+    return parent;
+}
+
+template <typename T>
+TrieResult Trie<T>::makeSentinel(Node<T> *node, std::shared_ptr<T> record)
+{
+    // if this is a sentinel node --> nothing to do
+    if (std::atomic_load(&node->record_) != nullptr)
     {
         return kTrieResultAlreadyExists;
     }
 
-    if (node->record_ != nullptr)
+    if (record == nullptr)
     {
-        newRecord.reset();
         return kTrieResultAlreadyExists;
     }
 
-    // TODO: Make thread safe!
-    node->record_ = newRecord;
+    std::atomic_store(&node->record_, record);
     int oldCount = (++size_);
     triggerOnChange(oldCount, oldCount + 1);
 
@@ -141,7 +322,7 @@ TrieResult Trie<T>::makeSentinel(Node<T> *node, std::shared_ptr<T> record)
 template <typename T>
 std::shared_ptr<T> Trie<T>::get(Node<T> *node)
 {
-    return node != nullptr ? node->record_ : nullptr;
+    return node != nullptr ? std::atomic_load(&node->record_) : nullptr;
 }
 
 template <typename T>
@@ -151,7 +332,7 @@ std::shared_ptr<T> Trie<T>::getOrAdd(Node<T> *node, std::shared_ptr<T> record, T
     auto sentinelResult = makeSentinel(node, record);
     if (result) *result = sentinelResult;
 
-    return node->record_;
+    return std::atomic_load(&node->record_);
 }
 
 template <typename T>
@@ -162,19 +343,16 @@ TrieResult Trie<T>::replace(Node<T> *node, const std::shared_ptr<T> value)
         return kTrieResultFailure;
     }
 
-    std::shared_ptr<T> previousValue = node->record_;
+    std::shared_ptr<T> previousValue = std::atomic_exchange(&node->record_, value);
 
     if (previousValue != nullptr)
     {
-        node->record_ = value;
         previousValue.reset();
 
         return kTrieResultReplaced;
     }
     else
     {
-        node->record_ = value;
-
         int oldCount = (++size_);
         triggerOnChange(oldCount, oldCount + 1);
 
@@ -190,9 +368,9 @@ TrieResult Trie<T>::insert(Node<T> *node, const std::shared_ptr<T> value)
         return kTrieResultFailure;
     }
 
-    if (node->record_ != nullptr) return kTrieResultAlreadyExists;
+    if (std::atomic_load(&node->record_) != nullptr) return kTrieResultAlreadyExists;
 
-    node->record_ = value;
+    std::atomic_store(&node->record_, value);
     int oldCount = (++size_);
     triggerOnChange(oldCount, oldCount + 1);
 
@@ -202,23 +380,17 @@ TrieResult Trie<T>::insert(Node<T> *node, const std::shared_ptr<T> value)
 template <typename T>
 TrieResult Trie<T>::remove(Node<T> *node)
 {
-    if (node == nullptr || node->record_ == nullptr)
+    if (node == nullptr || std::atomic_load(&node->record_) == nullptr)
     {
         return kTrieResultAlreadyEmpty;
     }
 
+    std::atomic_store(&node->record_, std::shared_ptr<T>(nullptr));
 
-    if (node->record_ != nullptr)
-    {
-        node->record_.reset();
-
-        int oldCount = (--size_);
-        triggerOnChange(oldCount, oldCount - 1);
-
-        return kTrieResultRemoved;
-    }
+    int oldCount = (--size_);
+    triggerOnChange(oldCount, oldCount - 1);
 
-    return kTrieResultFailure;
+    return kTrieResultRemoved;
 }
 
 /*
@@ -234,8 +406,7 @@ TrieResult Trie<T>::remove(Node<T> *node)
  }
  printf("};\n");
  */
-template <typename T>
-static int s_char2idx[256] =
+static const int s_char2idx[256] =
 {
     -1, // '' (\0)
     -1, // '' (\1)
@@ -528,51 +699,164 @@ static uint64_t pow10(int exp)
     return result;
 }
 
-template <typename T>
-Node<T>* Trie<T>::findPathNode(const char *path, bool createIfMissing)
+TrieKey::TrieKey(uint64_t key)
+{
+    // Least significant digit first
+    length_ = 0;
+    do
+    {
+        buffer_[length_++] = key % 10;
+        key = key / 10;
+    } while (key > 0);
+
+    indices_ = buffer_;
+    valid_ = true;
+}
+
+TrieKey::TrieKey(const char *path)
 {
-    Node<T> *currNode = root_;
-    unsigned char ch;
-    while ((ch = *path++) != '\0')
+    length_ = (uint)strlen(path);
+    if (length_ > sizeof(buffer_))
     {
-        int idx = s_char2idx<T>[ch];
-        if (!findChildNode(currNode, idx, createIfMissing))
+        longBuffer_.reset(new uint8_t[length_]);
+    }
+
+    uint8_t *indices = longBuffer_ != nullptr ? longBuffer_.get() : buffer_;
+    valid_ = true;
+    for (uint i = 0; i < length_; i++)
+    {
+        int idx = s_char2idx[(unsigned char)path[i]];
+        if (idx < 0)
         {
-            return nullptr;
+            valid_ = false;
+            break;
         }
-        currNode = currNode->children()[idx];
+
+        indices[i] = (uint8_t)idx;
     }
 
-    return currNode;
+    indices_ = indices;
 }
 
 template <typename T>
-Node<T>* Trie<T>::findUintNode(uint64_t key, bool createIfMissing)
+Node<T>* Trie<T>::findNode(const TrieKey &key)
 {
-    Node<T> *currNode = root_;
+    if (!key.isValid())
+    {
+        return nullptr;
+    }
+
+    const uint8_t *indices = key.indices();
+    const uint length = key.length();
 
     while (true)
     {
-        assert(currNode->length() == 10);
+        uint64_t version = version_.load(std::memory_order_acquire);
+        if ((version & 1) != 0)
+        {
+            // An edge is being split
+            continue;
+        }
+
+        Node<T> *currNode = root_.load(std::memory_order_acquire);
+        uint i = 0;
+        while (currNode != nullptr)
+        {
+            const Prefix *prefix = currNode->prefix_.load(std::memory_order_acquire);
+            if (prefix != nullptr)
+            {
+                if (length - i < prefix->length || memcmp(indices + i, Node<T>::prefixIndices(prefix), prefix->length) != 0)
+                {
+                    currNode = nullptr;
+                    break;
+                }
+
+                i += prefix->length;
+            }
+
+            if (i == length)
+            {
+                break;
+            }
+
+            std::atomic<Node<T>*> *slot = currNode->findSlot(indices[i++]);
+            currNode = slot != nullptr ? slot->load(std::memory_order_acquire) : nullptr;
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (version_.load(std::memory_order_relaxed) == version)
+        {
+            return currNode;
+        }
+    }
+}
+
+template <typename T>
+Node<T>* Trie<T>::findOrCreateNode(const TrieKey &key)
+{
+    if (!key.isValid())
+    {
+        return nullptr;
+    }
 
-        int lsd = key % 10;
+    const uint8_t *indices = key.indices();
+    const uint length = key.length();
 
-        if (!findChildNode(currNode, lsd, createIfMissing))
+    std::atomic<Node<T>*> *slot = &root_;
+    Node<T> *currNode = root_.load(std::memory_order_relaxed);
+    uint i = 0;
+    while (true)
+    {
+        const Prefix *prefix = currNode->prefix_.load(std::memory_order_relaxed);
+        if (prefix != nullptr)
         {
-            return nullptr;
+            const uint8_t *prefixIndices = Node<T>::prefixIndices(prefix);
+            uint matched = 0;
+            while (matched < prefix->length && i < length && indices[i] == prefixIndices[matched])
+            {
+                matched++;
+                i++;
+            }
+
+            if (matched < prefix->length)
+            {
+                currNode = splitPrefix(slot, currNode, matched);
+                if (currNode == nullptr)
+                {
+                    return nullptr;
+                }
+            }
         }
 
-        currNode = currNode->children()[lsd];
+        if (i == length)
+        {
+            return currNode;
+        }
 
-        if (key < 10)
+        uint8_t idx = indices[i++];
+        std::atomic<Node<T>*> *childSlot = currNode->findSlot(idx);
+        Node<T> *child = childSlot != nullptr ? childSlot->load(std::memory_order_relaxed) : nullptr;
+        if (child == nullptr)
         {
-            break;
+            // The rest of the key becomes the prefix of a new leaf
+            child = createNode(indices + i, length - i);
+            if (child == nullptr)
+            {
+                return nullptr;
+            }
+
+            if (!addChild(currNode, idx, child))
+            {
+                deleteNode(child);
+                return nullptr;
+            }
+
+            return child;
         }
 
-        key = key / 10;
+        slot = childSlot;
+        currNode = child;
     }
-
-    return currNode;
 }
 
 template <typename T>
@@ -604,7 +888,7 @@ void Trie<T>::forEach(void *callbackArgs, for_each_fn callback)
     traverse(/*computeKey*/ kind_ == kUintTrie, /*callbackArgs*/ &state, [](Trie<T> *me, void *s, uint64_t key, Node<T> *node)
     {
         State *state = (State*)s;
-        std::shared_ptr<T> record = node->record_;
+        std::shared_ptr<T> record = std::atomic_load(&node->record_);
         if (record)
         {
             state->callback(state->args, key, record);
@@ -617,10 +901,11 @@ void Trie<T>::removeMatching(void *filterArgs, filter_fn filter)
 {
     typedef struct { filter_fn filter; void *args; } State;
     State state = { .filter = filter, .args = filterArgs };
+    std::lock_guard<std::mutex> lock(writeLock_);
     traverse(/*computeKey*/ false, /*callbackArgs*/ &state, [](Trie<T> *me, void *s, uint64_t, Node<T> *node)
     {
         State *state = (State*)s;
-        std::shared_ptr<T> record = node->record_;
+        std::shared_ptr<T> record = std::atomic_load(&node->record_);
         if (record)
         {
             if (state->filter(state->args, record))
@@ -667,16 +952,33 @@ template <typename T>
 void Trie<T>::traverse(bool computeKey, void *callbackArgs, traverse_fn callback)
 {
     Stack<T> *stack = nullptr;
-    push(&stack, root_, /*key*/ 0, /*depth*/ 0);
+    push(&stack, root_.load(std::memory_order_acquire), /*key*/ 0, /*depth*/ 0);
     while (stack != nullptr)
     {
         uint64_t key = stack->key;
         uint32_t depth = stack->depth;
 
         Node<T> *curr = pop(&stack);
-        for (int i = 0; i < curr->length(); ++i)
+
+        // the key of a node ends with the indices of its prefix
+        const Prefix *prefix = curr->prefix_.load(std::memory_order_acquire);
+        if (prefix != nullptr)
+        {
+            for (uint i = 0; computeKey && i < prefix->length; i++)
+            {
+                key += Node<T>::prefixIndices(prefix)[i] * pow10<T>(depth + i);
+            }
+
+            depth += prefix->length;
+        }
+
+        Children *children = curr->children_.load(std::memory_order_acquire);
+        uint count = children == nullptr ? 0 : children->direct ? children->capacity : children->count.load(std::memory_order_acquire);
+        for (uint i = 0; i < count; ++i)
         {
-            push(&stack, curr->children()[i], computeKey ? (i * pow10<T>(depth) + key) : 0, depth + 1);
+            uint idx = children->direct ? i : Node<T>::keys(children)[i];
+            Node<T> *child = Node<T>::slots(children)[i].load(std::memory_order_acquire);
+            push(&stack, child, computeKey ? (idx * pow10<T>(depth) + key) : 0, depth + 1);
         }
 
         // the callback may deallocate 'curr' node, hence this must be the last statement in this loop
@@ -689,7 +991,10 @@ void Trie<T>::traverse(bool computeKey, void *callbackArgs, traverse_fn callback
 #ifndef MAC_DETOURS
     #include "SandboxedProcess.hpp"
     template class Trie<SandboxedProcess>;
+    template class Trie<AccessCacheRecord>;
 #else
+    #include "AccessCacheRecord.hpp"
     #include "PathCacheEntry.hpp"
     template class Trie<PathCacheEntry>;
+    template class Trie<AccessCacheRecord>;
 #endif
@@ -8,14 +8,51 @@
 
 #include <atomic>
 #include <memory>
+#include <mutex>
+#include <vector>
 #include <limits.h>
 #include <sys/types.h>
 
 template <typename T> class Trie;
 
+/*!
+ * The sequence of child indices a key maps to: the digits of an unsigned integer (least significant first), or the
+ * (case-insensitive) characters of an ascii path.
+ */
+class TrieKey final
+{
+private:
+
+    uint8_t buffer_[PATH_MAX];
+    std::unique_ptr<uint8_t[]> longBuffer_;
+
+    const uint8_t *indices_;
+    uint length_;
+    bool valid_;
+
+public:
+
+    TrieKey() = delete;
+    explicit TrieKey(uint64_t key);
+
+    /*! A path with a character that doesn't map to a child index (e.g., non-ascii) results in an invalid key */
+    explicit TrieKey(const char *path);
+
+    inline bool isValid()            const { return valid_; }
+    inline uint length()             const { return length_; }
+    inline const uint8_t* indices()  const { return indices_; }
+};
+
 /*!
  * A node in a Trie.
  * Only accessible to its friend class Trie.
+ *
+ * Edges are path-compressed: a node reached from child index 'i' of its parent stands for the key of its parent,
+ * followed by 'i' and by the indices of its 'prefix_'. Children are kept in small (key, child) arrays that grow as
+ * needed, and are indexed directly by key once they outgrow them.
+ *
+ * Readers access the fields of a node without locking (see Trie): 'prefix_' and 'children_' are immutable blocks
+ * that writers only ever replace, and a replaced block is not freed before the trie is.
  */
 template <typename T>
 class Node final
@@ -27,10 +64,12 @@ private:
     static std::atomic<uint> s_numUintNodes;
     static std::atomic<uint> s_numPathNodes;
 
+    static std::atomic<uint64_t> s_numUintNodeBytes;
+    static std::atomic<uint64_t> s_numPathNodeBytes;
+
     /*!
      * The value 65 is chosen so that all ASCII characters between 32 (' ') and 122 ('z')
-     * get a unique entry in the 'children_' array.  The formula for mapping a character
-     * ch to an array index is:
+     * get a unique child index.  The formula for mapping a character ch to an index is:
      *
      *   toupper(ch) - 32
      */
@@ -39,25 +78,55 @@ private:
     /*! For 10 digits */
     static const uint s_uintNodeChildrenCount = 10;
 
-    /*! Arbitrary value */
-    std::shared_ptr<T> record_;
+    /*! Capacities of the (key, child) arrays a node goes through as children get added */
+    static const uint s_smallChildrenCapacity = 4;
+    static const uint s_mediumChildrenCapacity = 16;
 
-    /*! The length of the 'children_' array (i.e., the the number of allocated nodes) */
-    uint childrenLength_;
+    /*! The child indices of a path-compressed edge, followed by 'length' bytes */
+    typedef struct
+    {
+        uint length;
+    } Prefix;
 
-    /*! Pre-allocated pointers to all possible children nodes. */
-    Node **children_;
+    /*!
+     * The children of a node, followed by 'capacity' child slots and (unless the slots are indexed directly by key)
+     * 'capacity' keys.  A keyed child is written before 'count' is advanced to publish it.
+     */
+    typedef struct alignas(void *)
+    {
+        uint capacity;
+        bool direct;
+        std::atomic<uint> count;
+    } Children;
+
+    static inline const uint8_t* prefixIndices(const Prefix *prefix) { return (const uint8_t *)(prefix + 1); }
+    static inline size_t prefixSize(uint length)                     { return sizeof(Prefix) + length; }
+
+    static inline std::atomic<Node*>* slots(Children *children)      { return (std::atomic<Node*> *)(children + 1); }
+    static inline uint8_t* keys(Children *children)                  { return (uint8_t *)(slots(children) + children->capacity); }
+    static inline size_t childrenSize(uint capacity, bool direct)
+    {
+        return sizeof(Children) + capacity * sizeof(std::atomic<Node*>) + (direct ? 0 : capacity);
+    }
+
+    /*! Arbitrary value (loaded and stored with the std::atomic_* functions, readers don't take the trie's lock) */
+    std::shared_ptr<T> record_;
 
-    uint length()     const { return childrenLength_; }
-    Node** children() const { return children_; }
+    /*! The rest of the edge leading to this node (nullptr when empty) */
+    std::atomic<Prefix*> prefix_;
 
-    static Node* createUintNode() { return new Node(s_uintNodeChildrenCount); }
-    static Node* createPathNode() { return new Node(s_pathNodeChildrenCount); }
+    /*! nullptr until this node gets its first child */
+    std::atomic<Children*> children_;
+
+    /*!
+     * Returns the slot of the child with key 'idx', or nullptr if there is none.  The slot of a directly indexed
+     * child is returned even if it's empty.
+     */
+    std::atomic<Node*>* findSlot(uint8_t idx) const;
 
 public:
 
-    Node() = delete;
-    Node(uint numChildren);
+    Node() : prefix_(nullptr), children_(nullptr) {}
     ~Node();
 };
 
@@ -74,7 +143,7 @@ typedef enum {
 } TrieResult;
 
 /*!
- * A thread-safe, lock-free, dictionary implementation.
+ * A thread-safe dictionary implementation.
  *
  * Only 2 types of keys are allowed: (1) an unsigned integer, and (2) an ascii path.
  *
@@ -85,7 +154,9 @@ typedef enum {
  * Paths are considered case-insensitive.  Attempting to add a path with a non-ascii
  * character will fail gracefully by returning 'kTrieResultFailure'.
  *
- * Thread-safe.  Non-blocking.
+ * Lookups are lock-free.  Writers are serialized by a lock, and the only change that can mislead a concurrent
+ * reader (splitting a path-compressed edge) is made under a sequence counter that the reader validates its
+ * walk against, retrying it when the counter moved.  Nodes are never freed before the trie is.
  */
 template <typename T>
 class Trie final
@@ -98,29 +169,31 @@ public:
 
     static void getUintNodeCounts(uint *count, double *sizeMB)
     {
-        getNodeCounts(Node<T>::s_numUintNodes, Node<T>::s_uintNodeChildrenCount, count, sizeMB);
+        getNodeCounts(Node<T>::s_numUintNodes, Node<T>::s_numUintNodeBytes, count, sizeMB);
     }
 
     static void getPathNodeCounts(uint *count, double *sizeMB)
     {
-        getNodeCounts(Node<T>::s_numPathNodes, Node<T>::s_pathNodeChildrenCount, count, sizeMB);
+        getNodeCounts(Node<T>::s_numPathNodes, Node<T>::s_numPathNodeBytes, count, sizeMB);
     }
 
 private:
 
     static const uint BytesInAMegabyte = 1 << 20;
 
-    inline static void getNodeCounts(uint count, uint numChildren, uint *outCount, double *outSizeMB)
+    inline static void getNodeCounts(uint count, uint64_t bytes, uint *outCount, double *outSizeMB)
     {
         *outCount = count;
-        *outSizeMB = (1.0 * count * (sizeof(Node<T>) + numChildren * sizeof(Node<T>*))) / BytesInAMegabyte;
+        *outSizeMB = (1.0 * bytes) / BytesInAMegabyte;
     }
 
     typedef enum { kUintTrie, kPathTrie } TrieKind;
     typedef void (*traverse_fn)(Trie*, void*, uint64_t key, Node<T>*);
+    typedef typename Node<T>::Prefix Prefix;
+    typedef typename Node<T>::Children Children;
 
-    /*! The root of the tree. */
-    Node<T> *root_;
+    /*! The root of the tree (it never has a prefix). */
+    std::atomic<Node<T>*> root_;
 
     /*! The kind of keys this tree accepts */
     TrieKind kind_;
@@ -134,20 +207,46 @@ private:
     /*! Payload for the 'onChangeCallback_' function */
     void *onChangeData_;
 
+    /*! Serializes all the changes to this trie */
+    std::mutex writeLock_;
+
+    /*! Odd while an edge is being split (see findNode) */
+    std::atomic<uint64_t> version_;
+
+    /*! Prefix and children blocks replaced by writers, freed with the trie since readers may still be using them */
+    std::vector<std::pair<void*, size_t>> retired_;
+
     /*! Invokes the 'onChangeCallback_' if it's set and 'newCount' is different from 'oldCount' */
     void triggerOnChange(int oldCount, int newCount) const;
 
+    /*! Keeps track of the memory used by the nodes of this kind of trie */
+    void countAllocation(ssize_t nodes, ssize_t bytes) const;
+
+    /*! Creates a node whose prefix holds the given 'length' indices */
+    Node<T>* createNode(const uint8_t *indices, uint length);
+
+    /*! Frees 'node' along with the blocks it currently points to */
+    void deleteNode(Node<T> *node);
+
+    Prefix* createPrefix(const uint8_t *indices, uint length);
+    Children* createChildren(uint capacity);
+
+    /*! Frees 'block' once the trie is released */
+    void retire(void *block, size_t size);
+
+    /*!
+     * Adds 'child' under key 'idx' of 'node', growing the children of 'node' if necessary.
+     * Must be called while holding 'writeLock_'.
+     */
+    bool addChild(Node<T> *node, uint8_t idx, Node<T> *child);
+
     /*!
-     * Checks if a child node of 'node' exists at position 'idx'.
-     * If no such child node exists and 'createIfMissing' is true,
-     * a new child node is created and saved at position 'idx'.
+     * Splits the edge leading to 'node' (whose parent slot is 'slot') after its first 'matched' prefix indices,
+     * by inserting a new parent node there.  Must be called while holding 'writeLock_'.
      *
-     * @param node The parent node.  Must not be null.
-     * @param idx Must be between 0 (inclusive) and 'node.length()' (exclusive); otherwise this method returns false.
-     * @param createIfMissing When true, this method creates a new child node at position 'idx' if one doesn't already exist.
-     * @result True IFF 'node' contains a child node at position 'idx' after this method returns.
+     * @result The new parent node, or NULL if out of memory.
      */
-    bool findChildNode(Node<T> *node, int idx, bool createIfMissing);
+    Node<T>* splitPrefix(std::atomic<Node<T>*> *slot, Node<T> *node, uint matched);
 
     /*!
      * Ensures that 'node' has its 'record_' field set to a non-null value.
@@ -226,41 +325,46 @@ private:
     void traverse(bool computeKey, void *callbackArgs, traverse_fn callback);
 
     /*!
-     * When 'createIfMissing' is true:
-     *   traverses the trie until it gets to the node corresponding to the given 'key', creating new nodes as necessary
-     * else:
-     *   returns the node corresponding to the given 'key' IFF such node already exists, or NULL otherwise.
+     * Returns the node corresponding to the given 'key' IFF such node already exists, or NULL otherwise.
+     * Does not take 'writeLock_'.
      */
-    Node<T>* findUintNode(uint64_t key, bool createIfMissing);
-
-    /*! Calls 'findUintNode' with 'createIfMissing' set to true. */
-    inline Node<T>* findOrCreateNodeForUint(uint64_t key) { return findUintNode(key, true); }
-
-    /*! Calls 'findUintNode' with 'createIfMissing' set to false. */
-    inline Node<T>* findExistingNodeForUint(uint64_t key) { return findUintNode(key, false); }
+    Node<T>* findNode(const TrieKey &key);
 
     /*!
-     * When 'createIfMissing' is true:
-     *   traverses the trie until it gets to the node corresponding to the given 'key', creating new nodes as necessary
-     * else:
-     *   returns the node corresponding to the given 'key' IFF such node already exists, or NULL otherwise.
+     * Traverses the trie until it gets to the node corresponding to the given 'key', creating new nodes as necessary.
+     * Must be called while holding 'writeLock_'.
      *
-     * NULL is also returned when the key is invalid (contains non-ascii characters) or the system is out of memory.
+     * NULL is returned when the key is invalid (contains non-ascii characters) or the system is out of memory.
      */
-    Node<T>* findPathNode(const char *key, bool createIfMissing);
+    Node<T>* findOrCreateNode(const TrieKey &key);
 
-    /*! Calls 'findPathNode' with 'createIfMissing' set to true. */
-    inline Node<T>* findOrCreateNodeForPath(const char *key) { return findPathNode(key, true); }
+    std::shared_ptr<T> get(const TrieKey &key)
+    {
+        return key.isValid() ? get(findNode(key)) : nullptr;
+    }
 
-    /*! Calls 'findPathNode' with 'createIfMissing' set to false. */
-    inline Node<T>* findExistingNodeForPath(const char *key) { return findPathNode(key, false); }
+    std::shared_ptr<T> getOrAdd(const TrieKey &key, std::shared_ptr<T> record, TrieResult *result)
+    {
+        std::lock_guard<std::mutex> lock(writeLock_);
+        return getOrAdd(findOrCreateNode(key), record, result);
+    }
+
+    TrieResult replace(const TrieKey &key, const std::shared_ptr<T> value)
+    {
+        std::lock_guard<std::mutex> lock(writeLock_);
+        return replace(findOrCreateNode(key), value);
+    }
+
+    TrieResult insert(const TrieKey &key, const std::shared_ptr<T> value)
+    {
+        std::lock_guard<std::mutex> lock(writeLock_);
+        return insert(findOrCreateNode(key), value);
+    }
 
-    /*! Creates either a Uint or a Path node, based on the kind of this trie. */
-    inline Node<T>* createNode()
+    TrieResult remove(const TrieKey &key)
     {
-        return kind_ == kUintTrie ? Node<T>::createUintNode() :
-               kind_ == kPathTrie ? Node<T>::createPathNode() :
-               nullptr;
+        std::lock_guard<std::mutex> lock(writeLock_);
+        return remove(key.isValid() ? findNode(key) : nullptr);
     }
 
 public:
@@ -280,7 +384,8 @@ public:
     bool onChange(void *callbackArgs, on_change_fn callback);
 
     /*!
-     * Invokes a given callback for every entry in this dictionary.
+     * Invokes a given callback for every entry in this dictionary.  Entries added or removed concurrently may or may
+     * not be visited.
      *
      * @param callbackArgs Arbitrary pointer passed to 'callback'
      * @param callback Callback function to call for each entry in this dictionary
@@ -297,7 +402,7 @@ public:
     std::shared_ptr<T> get(const char *path)
     {
         if (kind_ != kPathTrie) return nullptr;
-        return get(findExistingNodeForPath(path));
+        return get(TrieKey(path));
     }
 
     /*!
@@ -313,25 +418,25 @@ public:
     std::shared_ptr<T> getOrAdd(const char *path, std::shared_ptr<T> record, TrieResult *result = nullptr)
     {
         if (kind_ != kPathTrie) return nullptr;
-        return getOrAdd(findOrCreateNodeForPath(path), record, result);
+        return getOrAdd(TrieKey(path), record, result);
     }
 
     TrieResult replace(const char *path, const std::shared_ptr<T> value)
     {
         if (kind_ != kPathTrie) return kTrieResultFailure;
-        return replace(findOrCreateNodeForPath(path), value);
+        return replace(TrieKey(path), value);
     }
 
     TrieResult insert(const char *path, const std::shared_ptr<T> value)
     {
         if (kind_ != kPathTrie) return kTrieResultFailure;
-        return insert(findOrCreateNodeForPath(path), value);
+        return insert(TrieKey(path), value);
     }
 
     TrieResult remove(const char *key)
     {
         if (kind_ != kPathTrie) return kTrieResultFailure;
-        return remove(findExistingNodeForPath(key));
+        return remove(TrieKey(key));
     }
 
 #pragma mark Methods for 'uint' keys
@@ -339,31 +444,31 @@ public:
     std::shared_ptr<T> get(uint64_t key)
     {
         if (kind_ != kUintTrie) return nullptr;
-        return get(findExistingNodeForUint(key));
+        return get(TrieKey(key));
     }
 
     std::shared_ptr<T> getOrAdd(uint64_t key, std::shared_ptr<T> record, TrieResult *result = nullptr)
     {
         if (kind_ != kUintTrie) return nullptr;
-        return getOrAdd(findOrCreateNodeForUint(key), record, result);
+        return getOrAdd(TrieKey(key), record, result);
     }
 
     TrieResult replace(uint64_t key, const std::shared_ptr<T> value)
     {
         if (kind_ != kUintTrie) return kTrieResultFailure;
-        return replace(findOrCreateNodeForUint(key), value);
+        return replace(TrieKey(key), value);
     }
 
     TrieResult insert(uint64_t key, const std::shared_ptr<T> value)
     {
         if (kind_ != kUintTrie) return kTrieResultFailure;
-        return insert(findOrCreateNodeForUint(key), value);
+        return insert(TrieKey(key), value);
     }
 
     TrieResult remove(uint64_t key)
     {
         if (kind_ != kUintTrie) return kTrieResultFailure;
-        return remove(findExistingNodeForUint(key));
+        return remove(TrieKey(key));
     }
 
 #pragma mark Static factory methods
@@ -27,24 +27,71 @@ DetoursSandbox::DetoursSandbox(pid_t host_pid, process_callback callback, void *
         xpc_type_t type = xpc_get_type(peer);
         if (type != XPC_TYPE_ERROR)
         {
+            // Every peer is an interposed process, whose records leave out the executable once it has been sent
+            __block IOEventExecutableTable *executables = new IOEventExecutableTable();
+
+            // Whether any message of the peer could not be processed. Most messages are one-way (see send_to_sandbox in Detours.cpp),
+            // so their failures are only answered to the next message that waits for a reply.
+            __block bool failed = false;
+
             xpc_connection_set_event_handler((xpc_connection_t) peer, ^(xpc_object_t message)
             {
                 xpc_type_t type = xpc_get_type(message);
                 if (type == XPC_TYPE_DICTIONARY)
                 {
-                    const char *msg = xpc_dictionary_get_string(message, IOEventKey);
-                    const uint64_t msg_length = xpc_dictionary_get_uint64(message, IOEventLengthKey);
+                    size_t batch_length = 0;
+                    const char *batch = (const char *)xpc_dictionary_get_data(message, IOEventBatchKey, &batch_length);
 
-                    imemorystream ims(msg, msg_length);
-                    ims.imbue(std::locale(ims.getloc(), new PipeDelimiter));
-                    IOEvent event;
-                    ims >> event;
+                    uint64_t response = xpc_response_error;
+                    if (xpc_dictionary_get_bool(message, IOEventFlushKey))
+                    {
+                        // Everything sent before has been processed by now (the messages of a peer are handled in order)
+                        response = xpc_response_success;
+                    }
+                    else if (batch != nullptr && executables != nullptr)
+                    {
+                        // Accesses the interposed process already evaluated against the manifest of its pip (see DetoursPolicy),
+                        // in the order they happened; a malformed record stops the batch
+                        response = xpc_response_success;
+                        size_t offset = 0;
+                        while (offset + sizeof(uint32_t) <= batch_length)
+                        {
+                            uint32_t msg_length;
+                            memcpy(&msg_length, batch + offset, sizeof(msg_length));
+                            offset += sizeof(msg_length);
+
+                            IOEvent event;
+                            if (offset + msg_length > batch_length || !IOEvent::ReadRecord(batch + offset, msg_length, event, executables))
+                            {
+                                response = xpc_response_error;
+                                break;
+                            }
+
+                            eventCallback_(sandbox, event, hostPid_, IOEventBacking::Interposing);
+                            offset += msg_length;
+                        }
+                    }
+                    else
+                    {
+                        size_t msg_length = 0;
+                        const char *msg = (const char *)xpc_dictionary_get_data(message, IOEventKey, &msg_length);
+
+                        IOEvent event;
+                        if (msg != nullptr && executables != nullptr && IOEvent::ReadRecord(msg, msg_length, event, executables))
+                        {
+                            eventCallback_(sandbox, event, hostPid_, IOEventBacking::Interposing);
+                            response = xpc_response_success;
+                        }
+                    }
 
-                    eventCallback_(sandbox, const_cast<const IOEvent &>(event), hostPid_, IOEventBacking::Interposing);
+                    failed |= response != xpc_response_success;
 
                     xpc_object_t reply = xpc_dictionary_create_reply(message);
-                    xpc_dictionary_set_uint64(reply, "response", xpc_response_success);
-                    xpc_connection_send_message((xpc_connection_t) peer, reply);
+                    if (reply != nullptr)
+                    {
+                        xpc_dictionary_set_uint64(reply, "response", failed ? xpc_response_error : xpc_response_success);
+                        xpc_connection_send_message((xpc_connection_t) peer, reply);
+                    }
                 }
                 else if (type == XPC_TYPE_ERROR)
                 {
@@ -56,6 +103,9 @@ DetoursSandbox::DetoursSandbox(pid_t host_pid, process_callback callback, void *
                     else if (message == XPC_ERROR_CONNECTION_INVALID)
                     {
                         log_debug("XPC connection invalid: %{public}s", desc);
+
+                        delete executables;
+                        executables = nullptr;
                     }
                 }
             });
@@ -1,18 +1,23 @@
 // Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
+#include <algorithm>
 #include <iostream>
+#include <vector>
+#include <sys/mman.h>
 
 #include "BuildXLSandboxShared.hpp"
 #include "BuildXLException.hpp"
 #include "EndpointSecuritySandbox.hpp"
+#include "EventRing.hpp"
 #include "XPCConstants.hpp"
 
-EndpointSecuritySandbox::EndpointSecuritySandbox(pid_t host_pid, process_callback callback, void *sandbox, xpc_connection_t bridge)
+EndpointSecuritySandbox::EndpointSecuritySandbox(pid_t host_pid, process_callback callback, event_queue_callback queue_callback, void *sandbox, xpc_connection_t bridge)
 {
     assert(callback != nullptr && bridge != nullptr);
 
     eventCallback_ = callback;
+    queueCallback_ = queue_callback;
     xpc_bridge_ = bridge;
     hostPid_ = host_pid;
 
@@ -29,37 +34,151 @@ EndpointSecuritySandbox::EndpointSecuritySandbox(pid_t host_pid, process_callbac
         xpc_type_t type = xpc_get_type(peer);
         if (type != XPC_TYPE_ERROR)
         {
+            // Every peer is an EndpointSecurity client, which may share a ring of events with us. The ring and the XPC messages
+            // are separate channels, each with its own executables (see IOEventExecutableTable).
+            __block EventRing *ring = nullptr;
+            __block void *ring_region = nullptr;
+            __block size_t ring_region_size = 0;
+            __block IOEventExecutableTable *ring_executables = new IOEventExecutableTable();
+            __block IOEventExecutableTable *message_executables = new IOEventExecutableTable();
+
             xpc_connection_set_event_handler((xpc_connection_t) peer, ^(xpc_object_t message)
             {
                 xpc_type_t type = xpc_get_type(message);
                 if (type == XPC_TYPE_DICTIONARY)
                 {
-                    const char *msg = xpc_dictionary_get_string(message, IOEventKey);
-                    const uint64_t msg_length = xpc_dictionary_get_uint64(message, IOEventLengthKey);
+                    xpc_object_t reply = xpc_dictionary_create_reply(message);
 
-                    imemorystream ims(msg, msg_length);
-                    ims.imbue(std::locale(ims.getloc(), new PipeDelimiter));
-                    IOEvent event;
-                    ims >> event;
+                    xpc_object_t shmem = xpc_dictionary_get_value(message, IOEventRingKey);
+                    size_t batch_length = 0;
+                    const char *batch = (const char *)xpc_dictionary_get_data(message, IOEventBatchKey, &batch_length);
+                    if (shmem != nullptr)
+                    {
+                        // The client set up a ring: map it and attach to it as its consumer
+                        void *region = nullptr;
+                        size_t size = xpc_shmem_map(shmem, &region);
+                        uint64_t response = xpc_response_failure;
+                        if (ring == nullptr && size > 0)
+                        {
+                            ring = new EventRing();
+                            if (ring->Attach(region, size))
+                            {
+                                ring_region = region;
+                                ring_region_size = size;
+                                response = xpc_response_success;
+                            }
+                            else
+                            {
+                                delete ring;
+                                ring = nullptr;
+                            }
+                        }
 
-                    ProcessCallbackResult result = eventCallback_ != nullptr ? eventCallback_(sandbox, const_cast<const IOEvent &>(event), hostPid_, IOEventBacking::EndpointSecurity) : ProcessCallbackResult::Done;
+                        if (response != xpc_response_success && size > 0)
+                        {
+                            munmap(region, size);
+                        }
 
-                    uint64_t response = xpc_response_error;
-                    switch (result)
+                        xpc_dictionary_set_uint64(reply, "response", response);
+                    }
+                    else if (xpc_dictionary_get_bool(message, IOEventRingDoorbellKey))
                     {
-                        case ProcessCallbackResult::Done:
-                            response = xpc_response_success;
-                            break;
-                        case ProcessCallbackResult::MuteSource:
-                            response = xpc_response_mute_process;
-                            break;
-                        case ProcessCallbackResult::Auth:
-                            response = xpc_response_auth;
-                            break;
+                        // Drain the ring until it stays empty, then answer the doorbell with the processes (and event types) to mute
+                        std::vector<audit_token_t> muted;
+                        std::vector<IOEventSource> muted_events;
+                        std::vector<IOEvent> events;
+                        std::vector<uint8_t> responses;
+                        uint64_t response = ring != nullptr ? xpc_response_success : xpc_response_error;
+                        while (ring != nullptr && ring_executables != nullptr)
+                        {
+                            // The records only stay in the ring until the drain returns
+                            events.clear();
+                            bool drained = ring->Drain([&](const char *record, size_t length)
+                            {
+                                events.emplace_back();
+                                if (!IOEvent::ReadRecord(record, length, events.back(), ring_executables))
+                                {
+                                    events.pop_back();
+                                    response = xpc_response_error;
+                                }
+                            });
+
+                            ProcessEvents(sandbox, events, responses);
+                            for (size_t i = 0; i < events.size(); i++)
+                            {
+                                if (responses[i] == (uint8_t)xpc_response_mute_process)
+                                {
+                                    muted.push_back(*events[i].GetProcessAuditToken());
+                                }
+                                else if (responses[i] == (uint8_t)xpc_response_mute_process_events)
+                                {
+                                    muted_events.push_back({ *events[i].GetProcessAuditToken(), events[i].GetEventType() });
+                                }
+                                else if (responses[i] == (uint8_t)xpc_response_error)
+                                {
+                                    response = xpc_response_error;
+                                }
+                            }
+
+                            if (!drained)
+                            {
+                                response = xpc_response_error;
+                                break;
+                            }
+
+                            if (ring->PrepareToWait())
+                            {
+                                break;
+                            }
+                        }
+
+                        xpc_dictionary_set_uint64(reply, "response", response);
+                        xpc_dictionary_set_data(reply, IOEventMutedProcessesKey, muted.data(), muted.size() * sizeof(audit_token_t));
+                        xpc_dictionary_set_data(reply, IOEventMutedProcessEventsKey, muted_events.data(), muted_events.size() * sizeof(IOEventSource));
+                    }
+                    else if (batch != nullptr)
+                    {
+                        // A batch of events: reply once, with the response to every event of the batch (in the order of the batch, so
+                        // the client can tell which process to mute; a malformed record stops the batch)
+                        std::vector<IOEvent> events;
+                        std::vector<uint8_t> responses;
+                        uint64_t response = xpc_response_success;
+                        size_t offset = 0;
+                        while (offset + sizeof(uint32_t) <= batch_length)
+                        {
+                            uint32_t msg_length;
+                            memcpy(&msg_length, batch + offset, sizeof(msg_length));
+                            offset += sizeof(msg_length);
+
+                            events.emplace_back();
+                            if (offset + msg_length > batch_length ||
+                                message_executables == nullptr ||
+                                !IOEvent::ReadRecord(batch + offset, msg_length, events.back(), message_executables))
+                            {
+                                events.pop_back();
+                                response = xpc_response_error;
+                                break;
+                            }
+
+                            offset += msg_length;
+                        }
+
+                        ProcessEvents(sandbox, events, responses);
+                        for (uint8_t event_response : responses)
+                        {
+                            response = event_response == (uint8_t)xpc_response_error ? xpc_response_error : response;
+                        }
+
+                        xpc_dictionary_set_uint64(reply, "response", response);
+                        xpc_dictionary_set_data(reply, IOEventBatchResponsesKey, responses.data(), responses.size());
+                    }
+                    else
+                    {
+                        size_t msg_length = 0;
+                        const char *msg = (const char *)xpc_dictionary_get_data(message, IOEventKey, &msg_length);
+                        xpc_dictionary_set_uint64(reply, "response", ProcessEvent(sandbox, msg, msg_length, message_executables));
                     }
 
-                    xpc_object_t reply = xpc_dictionary_create_reply(message);
-                    xpc_dictionary_set_uint64(reply, "response", response);
                     xpc_connection_send_message((xpc_connection_t) peer, reply);
                 }
                 else if (type == XPC_TYPE_ERROR)
@@ -72,6 +191,19 @@ EndpointSecuritySandbox::EndpointSecuritySandbox(pid_t host_pid, process_callbac
                     else if (message == XPC_ERROR_CONNECTION_INVALID)
                     {
                         log_error("Connection invalid: %{public}s", desc);
+
+                        // The client is gone, and so is its ring
+                        if (ring != nullptr)
+                        {
+                            delete ring;
+                            ring = nullptr;
+                            munmap(ring_region, ring_region_size);
+                        }
+
+                        delete ring_executables;
+                        ring_executables = nullptr;
+                        delete message_executables;
+                        message_executables = nullptr;
                     }
                 }
             });
@@ -90,6 +222,8 @@ EndpointSecuritySandbox::EndpointSecuritySandbox(pid_t host_pid, process_callbac
     xpc_object_t post = xpc_dictionary_create(NULL, NULL, 0);
     xpc_dictionary_set_uint64(post, "command", xpc_set_es_connection);
     xpc_dictionary_set_uint64(post, "host_pid", hostPid_);
+    xpc_dictionary_set_uint64(post, "batch_size", EventBatchSize);
+    xpc_dictionary_set_uint64(post, "ring_capacity", EventRingCapacity);
     xpc_dictionary_set_connection(post, "connection", es_connection_);
 
     xpc_object_t response = xpc_connection_send_message_with_reply_sync(xpc_bridge_, post);
@@ -115,6 +249,219 @@ EndpointSecuritySandbox::EndpointSecuritySandbox(pid_t host_pid, process_callbac
     }
 }
 
+uint64_t EndpointSecuritySandbox::ProcessEvent(void *sandbox, const char *record, size_t length, IOEventExecutableTable *executables)
+{
+    std::vector<IOEvent> events(1);
+    if (record == nullptr || executables == nullptr || !IOEvent::ReadRecord(record, length, events[0], executables))
+    {
+        return xpc_response_error;
+    }
+
+    std::vector<uint8_t> responses;
+    ProcessEvents(sandbox, events, responses);
+    return responses[0];
+}
+
+void EndpointSecuritySandbox::ProcessEvents(void *sandbox, const std::vector<IOEvent> &events, std::vector<uint8_t> &responses)
+{
+    responses.assign(events.size(), (uint8_t)xpc_response_success);
+    if (events.empty())
+    {
+        return;
+    }
+
+    if (queueCallback_ == nullptr)
+    {
+        for (size_t i = 0; i < events.size(); i++)
+        {
+            responses[i] = (uint8_t)ProcessEvent(sandbox, events[i]);
+        }
+
+        return;
+    }
+
+    // Every event goes to the queue of its pip (see event_queue_callback): the pips of the events are processed in parallel,
+    // and the events of a pip in order. Queues are few, a linear lookup beats hashing them.
+    std::vector<std::pair<dispatch_queue_t, std::vector<size_t>>> shards;
+    for (size_t i = 0; i < events.size(); i++)
+    {
+        dispatch_queue_t queue = queueCallback_(sandbox, events[i]);
+        auto shard = std::find_if(shards.begin(), shards.end(), [queue](const std::pair<dispatch_queue_t, std::vector<size_t>> &s) { return s.first == queue; });
+        if (shard == shards.end())
+        {
+            shards.emplace_back(queue, std::vector<size_t>());
+            shard = shards.end() - 1;
+        }
+
+        shard->second.push_back(i);
+    }
+
+    const std::vector<IOEvent> *all_events = &events;
+    uint8_t *all_responses = responses.data();
+
+    dispatch_group_t group = dispatch_group_create();
+    for (const std::pair<dispatch_queue_t, std::vector<size_t>> &shard : shards)
+    {
+        const std::vector<size_t> *indices = &shard.second;
+        dispatch_group_async(group, shard.first, ^{
+            for (size_t i : *indices)
+            {
+                all_responses[i] = (uint8_t)ProcessEvent(sandbox, (*all_events)[i]);
+            }
+        });
+    }
+
+    // The replies to the clients carry the responses, so wait for every shard
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+    dispatch_release(group);
+}
+
+uint64_t EndpointSecuritySandbox::ProcessEvent(void *sandbox, const IOEvent &event)
+{
+    ProcessCallbackResult result = eventCallback_ != nullptr ? eventCallback_(sandbox, event, hostPid_, IOEventBacking::EndpointSecurity) : ProcessCallbackResult::Done;
+
+    switch (result)
+    {
+        case ProcessCallbackResult::Done:
+            return xpc_response_success;
+        case ProcessCallbackResult::MuteSource:
+            return xpc_response_mute_process;
+        case ProcessCallbackResult::Auth:
+            return xpc_response_auth;
+        case ProcessCallbackResult::MuteEventType:
+            return xpc_response_mute_process_events;
+    }
+
+    return xpc_response_error;
+}
+
+// Whether 'path' is 'scope' or lies below it
+static bool IsWithinScope(const std::string &path, const std::string &scope)
+{
+    return path.compare(0, scope.length(), scope) == 0 && (path.length() == scope.length() || path[scope.length()] == '/');
+}
+
+void EndpointSecuritySandbox::MuteUntrackedScopes(const std::vector<std::string> &scopes)
+{
+    const std::lock_guard<std::mutex> lock(mutedPathsLock_);
+
+    std::vector<std::string> paths;
+    if (!mutedPathsInitialized_)
+    {
+        paths = scopes;
+        mutedPathsInitialized_ = true;
+    }
+    else
+    {
+        // Only what is untracked by every pip so far stays muted
+        for (const std::string &muted : mutedPaths_)
+        {
+            for (const std::string &scope : scopes)
+            {
+                if (IsWithinScope(muted, scope))
+                {
+                    paths.push_back(muted);
+                }
+                else if (IsWithinScope(scope, muted))
+                {
+                    paths.push_back(scope);
+                }
+            }
+        }
+    }
+
+    std::sort(paths.begin(), paths.end());
+    paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+
+    if (paths == mutedPaths_)
+    {
+        return;
+    }
+
+    mutedPaths_ = paths;
+
+    xpc_object_t muted_paths = xpc_array_create(NULL, 0);
+    for (const std::string &path : mutedPaths_)
+    {
+        xpc_array_set_string(muted_paths, XPC_ARRAY_APPEND, path.c_str());
+    }
+
+    xpc_object_t post = xpc_dictionary_create(NULL, NULL, 0);
+    xpc_dictionary_set_uint64(post, "command", xpc_set_es_muted_paths);
+    xpc_dictionary_set_value(post, "paths", muted_paths);
+
+    // Synchronously, so no path of the starting pip is still muted once it runs
+    xpc_object_t response = xpc_connection_send_message_with_reply_sync(xpc_bridge_, post);
+    if (xpc_get_type(response) != XPC_TYPE_DICTIONARY || xpc_dictionary_get_uint64(response, "response") != xpc_response_success)
+    {
+        log_error("Failed muting %lu untracked path prefix(es) in the EndpointSecurity clients", mutedPaths_.size());
+    }
+
+    xpc_release(response);
+    xpc_release(post);
+    xpc_release(muted_paths);
+}
+
+void EndpointSecuritySandbox::PipStarted(const SandboxedPip &pip)
+{
+    const std::lock_guard<std::mutex> lock(subscriptionsLock_);
+    if (pip.ObservesMetadataWrites())
+    {
+        metadataWritePips_++;
+    }
+
+    UpdateSubscriptions();
+}
+
+void EndpointSecuritySandbox::PipCompleted(const SandboxedPip &pip)
+{
+    const std::lock_guard<std::mutex> lock(subscriptionsLock_);
+    if (pip.ObservesMetadataWrites() && metadataWritePips_ > 0)
+    {
+        metadataWritePips_--;
+    }
+
+    UpdateSubscriptions();
+}
+
+// Assumes subscriptionsLock_ is held by the caller
+void EndpointSecuritySandbox::UpdateSubscriptions()
+{
+    bool subscribed = metadataWritePips_ > 0;
+    if (subscribed == metadataWritesSubscribed_)
+    {
+        return;
+    }
+
+    xpc_object_t unsubscribed_events = xpc_array_create(NULL, 0);
+    if (!subscribed)
+    {
+        for (es_event_type_t event : kMetadataWriteEvents)
+        {
+            xpc_array_set_uint64(unsubscribed_events, XPC_ARRAY_APPEND, event);
+        }
+    }
+
+    xpc_object_t post = xpc_dictionary_create(NULL, NULL, 0);
+    xpc_dictionary_set_uint64(post, "command", xpc_set_es_unsubscribed_events);
+    xpc_dictionary_set_value(post, "events", unsubscribed_events);
+
+    // Synchronously, so a starting pip that needs the events gets them from its first process on
+    xpc_object_t response = xpc_connection_send_message_with_reply_sync(xpc_bridge_, post);
+    if (xpc_get_type(response) == XPC_TYPE_DICTIONARY && xpc_dictionary_get_uint64(response, "response") == xpc_response_success)
+    {
+        metadataWritesSubscribed_ = subscribed;
+    }
+    else
+    {
+        log_error("Failed %s the metadata write events of the EndpointSecurity clients", subscribed ? "subscribing to" : "unsubscribing from");
+    }
+
+    xpc_release(response);
+    xpc_release(post);
+    xpc_release(unsubscribed_events);
+}
+
 EndpointSecuritySandbox::~EndpointSecuritySandbox()
 {
     xpc_object_t post = xpc_dictionary_create(NULL, NULL, 0);
@@ -4,7 +4,12 @@
 #ifndef EndpointSecuritySandbox_hpp
 #define EndpointSecuritySandbox_hpp
 
+#include <mutex>
+#include <string>
+#include <vector>
+
 #include "IOEvent.hpp"
+#include "SandboxedPip.hpp"
 
 class EndpointSecuritySandbox final
 {
@@ -14,8 +19,33 @@ private:
     pid_t hostPid_;
     dispatch_queue_t eventQueue_ = nullptr;
     process_callback eventCallback_ = nullptr;
+
+    // The EndpointSecurity clients send up to this many events per XPC message (see ESClient)
+    static const uint64_t EventBatchSize = 64;
+
+    // Size of the ring every EndpointSecurity client sets up for its events (see EventRing.hpp)
+    static const uint32_t EventRingCapacity = 1 << 20;
+
+    // Path prefixes that no pip of the build tracks, muted in the EndpointSecurity clients (see MuteUntrackedScopes)
+    std::mutex mutedPathsLock_;
+    std::vector<std::string> mutedPaths_;
+    bool mutedPathsInitialized_ = false;
+
+    // Number of running pips that observe the metadata write events (see SandboxedPip::ObservesMetadataWrites), which the
+    // EndpointSecurity clients only subscribe to while there is one. The clients start out subscribed to every event.
+    std::mutex subscriptionsLock_;
+    size_t metadataWritePips_ = 0;
+    bool metadataWritesSubscribed_ = true;
+
+    void UpdateSubscriptions();
+
+    uint64_t ProcessEvent(void *sandbox, const char *record, size_t length, IOEventExecutableTable *executables);
+    uint64_t ProcessEvent(void *sandbox, const IOEvent &event);
+    // Fills in the response to every one of the events, processed on the queues of their pips when there is a queue callback
+    void ProcessEvents(void *sandbox, const std::vector<IOEvent> &events, std::vector<uint8_t> &responses);
     
 #if __APPLE__
+    event_queue_callback queueCallback_ = nullptr;
     xpc_connection_t xpc_bridge_ = nullptr;
     xpc_connection_t es_connection_ = nullptr;
 #endif
@@ -26,8 +56,17 @@ public:
     ~EndpointSecuritySandbox();
     
 #if __APPLE__
-    EndpointSecuritySandbox(pid_t host_pid, process_callback callback, void *sandbox, xpc_connection_t bridge);
+    EndpointSecuritySandbox(pid_t host_pid, process_callback callback, event_queue_callback queue_callback, void *sandbox, xpc_connection_t bridge);
 #endif
+
+    // Narrows the muted path prefixes down to the ones untracked by the given scopes of a starting pip as well. Muted paths
+    // are never widened again: a pip can be still running, or about to start, with a manifest that tracks them.
+    void MuteUntrackedScopes(const std::vector<std::string> &scopes);
+
+    // Keep the event subscriptions of the EndpointSecurity clients down to the union of what the running pips need. A pip
+    // starting must be followed by it completing, the events it needs are subscribed to before the call returns.
+    void PipStarted(const SandboxedPip &pip);
+    void PipCompleted(const SandboxedPip &pip);
 };
 
 #endif /* EndpointSecuritySandbox_hpp */
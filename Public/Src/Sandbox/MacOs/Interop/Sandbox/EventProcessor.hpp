@@ -23,14 +23,8 @@ static ProcessCallbackResult _process_event(Sandbox *sandbox, const IOEvent &eve
 
     bool isInterposedEvent = backing == IOEventBacking::Interposing;
 
-    bool ppid_found = sandbox->GetAllowlistedPidMap().find(event.GetParentPid()) != sandbox->GetAllowlistedPidMap().end();
-    bool original_ppid_found = sandbox->GetAllowlistedPidMap().find(event.GetOriginalParentPid()) != sandbox->GetAllowlistedPidMap().end();
-
-    size_t msg_length = IOEvent::max_size();
-    char msg[msg_length];
-
-    omemorystream oms(msg, sizeof(msg));
-    oms << event;
+    bool ppid_found = sandbox->TryGetProcessPidPair(sandbox->GetAllowlistedPidMap(), event.GetParentPid());
+    bool original_ppid_found = sandbox->TryGetProcessPidPair(sandbox->GetAllowlistedPidMap(), event.GetOriginalParentPid());
 
     if (isInterposedEvent || (ppid_found || original_ppid_found))
     {
@@ -44,12 +38,12 @@ static ProcessCallbackResult _process_event(Sandbox *sandbox, const IOEvent &eve
             // the posix_spawn* call returns, we have to manually add a fork event here if the parent of the binary in question is
             // already being tracked.
 
-            if (event.GetEventType() == ES_EVENT_TYPE_NOTIFY_FORK && !sandbox->GetForceForkedPidMap().empty())
+            pid_t forced_ppid;
+            if (event.GetEventType() == ES_EVENT_TYPE_NOTIFY_FORK)
             {
-                auto it = sandbox->GetForceForkedPidMap().find(event.GetChildPid());
-                if (it != sandbox->GetForceForkedPidMap().end())
+                if (sandbox->TryGetProcessPidPair(sandbox->GetForceForkedPidMap(), event.GetChildPid(), &forced_ppid))
                 {
-                    if (it->first == event.GetChildPid() && it->second == event.GetPid())
+                    if (forced_ppid == event.GetPid())
                     {
                         sandbox->RemoveProcessPid(sandbox->GetForceForkedPidMap(), event.GetChildPid());
 
@@ -72,7 +66,7 @@ static ProcessCallbackResult _process_event(Sandbox *sandbox, const IOEvent &eve
                     log_debug("Forced fork event for child PID(%d) and PPID(%d) with path: %{public}s",
                               fork_event.GetChildPid(), fork_event.GetPid(), fork_event.GetExecutablePath());
 
-                    sandbox->GetForceForkedPidMap().emplace(fork_event.GetChildPid(), fork_event.GetPid());
+                    sandbox->SetProcessPidPair(sandbox->GetForceForkedPidMap(), fork_event.GetChildPid(), fork_event.GetPid());
                     handler.HandleEvent(fork_event);
                 }
             }
@@ -96,6 +90,13 @@ static ProcessCallbackResult _process_event(Sandbox *sandbox, const IOEvent &eve
                         sandbox->RemoveProcessPid(sandbox->GetAllowlistedPidMap(), pid);
                         break;
                 }
+
+                // Another running pip needs these events, this one doesn't: the client stops sending them for the process
+                // (the reply allows AUTH events as well)
+                if (IsMetadataWriteEvent(event.GetEventType()) && !handler.ObservesMetadataWrites())
+                {
+                    return ProcessCallbackResult::MuteEventType;
+                }
             }
 
             handler.HandleEvent(event);
@@ -105,12 +106,8 @@ static ProcessCallbackResult _process_event(Sandbox *sandbox, const IOEvent &eve
         else
         {
             // TODO: Delete
-            size_t msg_length = IOEvent::max_size();
-            char msg[msg_length];
-
-            omemorystream oms(msg, sizeof(msg));
-            oms << event;
-            log_debug("Not tracked: %{public}.*s",(int) event.Size(), msg);
+            log_debug("Not tracked: PID(%d), PPID(%d), type(%d), %{public}s -> %{public}s",
+                      event.GetPid(), event.GetParentPid(), event.GetEventType(), event.GetExecutablePath(), event.GetEventPath(SRC_PATH));
         }
 
         if (event.GetActionType() == ES_ACTION_TYPE_AUTH)
@@ -139,15 +136,28 @@ static ProcessCallbackResult _process_event(Sandbox *sandbox, const IOEvent &eve
     return ProcessCallbackResult::Done;
 }
 
-static ProcessCallbackResult process_event(void *handle, const IOEvent event, pid_t host, IOEventBacking backing)
+static ProcessCallbackResult process_event(void *handle, const IOEvent &event, pid_t host, IOEventBacking backing)
 {
     Sandbox* sandbox = (Sandbox *) handle;
 #if __APPLE__
     if (sandbox->IsRunningHybrid())
     {
-        dispatch_async(sandbox->GetHybridQueue(), ^{
+        // Drop the duplicates before they get queued, policy-checked and reported a second time
+        IOEventDeduplicator *deduplicator = sandbox->GetEventDeduplicator();
+        if (backing == IOEventBacking::Interposing)
+        {
+            deduplicator->RecordInterposedEvent(event);
+        }
+        else if (deduplicator->IsInterposedDuplicate(event))
+        {
+            return ProcessCallbackResult::Done;
+        }
+
+        // The event only lives as long as the callback, the block gets its own copy
+        const IOEvent queued_event = event;
+        dispatch_async(sandbox->GetEventQueue(event), ^{
             // TODO: We can't mute processes when merging ES and detours events asynchronously without introducing some async callback
-            _process_event(sandbox, event, host, backing);
+            _process_event(sandbox, queued_event, host, backing);
         });
 
         return ProcessCallbackResult::Done;
@@ -159,4 +169,11 @@ static ProcessCallbackResult process_event(void *handle, const IOEvent event, pi
     }
 }
 
+#if __APPLE__
+static dispatch_queue_t event_queue(void *handle, const IOEvent &event)
+{
+    return ((Sandbox *) handle)->GetEventQueue(event);
+}
+#endif
+
 #endif /* EventProcessor_h */
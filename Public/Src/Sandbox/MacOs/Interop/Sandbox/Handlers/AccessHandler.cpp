@@ -30,7 +30,7 @@ void AccessHandler::SetProcessPath(AccessReport *report)
 }
 
 ReportResult AccessHandler::CreateReportFileOpAccess(FileOperation operation,
-                                               PolicyResult policyResult,
+                                               const char *path,
                                                AccessCheckResult checkResult,
                                                pid_t processID,
                                                uint isDirectory,
@@ -50,8 +50,8 @@ ReportResult AccessHandler::CreateReportFileOpAccess(FileOperation operation,
     accessReport.shouldReport       = checkResult.ShouldReport();
     std::fill_n(accessReport.path, MAXPATHLEN, 0);
 
-    assert(strlen(policyResult.Path()) > 0);
-    strlcpy(accessReport.path, policyResult.Path(), sizeof(accessReport.path));
+    assert(strlen(path) > 0);
+    strlcpy(accessReport.path, path, sizeof(accessReport.path));
 
     return kReported;
 }
@@ -169,11 +169,45 @@ AccessCheckResult AccessHandler::CheckAndCreateReportInternal(FileOperation oper
                                                         uint error,
                                                         AccessReport &accessToReport)
 {
-    PolicyResult policy = PolicyForPath(IgnoreDataPartitionPrefix(path));
+    const char *policyPath = IgnoreDataPartitionPrefix(path);
     AccessCheckResult result = AccessCheckResult::Invalid();
-    checker(policy, isDir, &result);
 
-    CreateReportFileOpAccess(operation, policy, result, pid, (uint)isDir, error, accessToReport);
+#if __APPLE__
+    std::shared_ptr<AccessCacheRecord> record = GetCacheRecord(policyPath);
+    if (record == nullptr || !record->TryGetDecision(checker, isDir, &result))
+    {
+        checker(PolicyForPath(policyPath), isDir, &result);
+        if (record != nullptr)
+        {
+            record->AddDecision(checker, isDir, result);
+        }
+    }
+#else
+    checker(PolicyForPath(policyPath), isDir, &result);
+#endif
+
+    CreateReportFileOpAccess(operation, policyPath, result, pid, (uint)isDir, error, accessToReport);
+
+#if __APPLE__
+    // Skip the report when the same access (or a stronger one) on this path has been reported for the pip already
+    if (accessToReport.shouldReport && record != nullptr && record->CheckAndUpdate(result))
+    {
+        accessToReport.shouldReport = false;
+    }
+#endif
 
     return result;
 }
+
+std::shared_ptr<AccessCacheRecord> AccessHandler::GetCacheRecord(const char *path)
+{
+    Trie<AccessCacheRecord> *cache = GetPip()->GetPathCache();
+    std::shared_ptr<AccessCacheRecord> record = cache->get(path);
+    if (record == nullptr)
+    {
+        // Yields nullptr for paths the trie can't hold (i.e., non-ascii), those are just not cached
+        record = cache->getOrAdd(path, std::make_shared<AccessCacheRecord>());
+    }
+
+    return record;
+}
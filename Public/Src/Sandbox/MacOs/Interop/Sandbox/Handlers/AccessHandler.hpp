@@ -30,10 +30,15 @@ private:
 
     std::shared_ptr<SandboxedProcess> process_;
 
+    /*!
+     * Returns the record of the pip's path cache for 'path' (creating it if needed), or nullptr if the path can't be cached.
+     */
+    std::shared_ptr<AccessCacheRecord> GetCacheRecord(const char *path);
+
 protected:
 
     ReportResult CreateReportFileOpAccess(FileOperation operation,
-                                    PolicyResult policy,
+                                    const char *path,
                                     AccessCheckResult accessCheckResult,
                                     pid_t processID,
                                     uint isDirectory,
@@ -57,7 +62,8 @@ protected:
      * Template for checking and creating a file access report. The report is created but not sent
      * to managed BuildXL.
      *
-     * The key used for looking up if the operation was already reported is "<operation>,<path>".
+     * The outcome of the checker for the path is cached per pip, and the report is only requested (see 'shouldReport')
+     * if no access at least as strong has been reported for the path before (see AccessCacheRecord).
      *
      * @param operation Operation to be executed
      * @param path Absolute path against which the operation is to be executed
@@ -114,6 +120,7 @@ public:
     inline pipid_t GetPipId()                   const { return GetPip()->GetPipId(); }
     inline int GetProcessTreeSize()             const { return GetPip()->GetTreeSize(); }
     inline FileAccessManifestFlag GetFamFlags() const { return GetPip()->GetFamFlags(); }
+    inline bool ObservesMetadataWrites()        const { return GetPip()->ObservesMetadataWrites(); }
 
     PolicyResult PolicyForPath(const char *absolutePath);
 
@@ -140,10 +140,14 @@ AccessCheckResult IOHandler::HandleRename(const IOEvent &event, AccessReport &so
     return AccessCheckResult::Combine(sourceResult, destResult);
 }
 
+// A clone only reads its source and writes its destination, whichever way it was made (clonefile, clonefileat, fclonefileat or
+// a copyfile asked to clone), and the same goes for the kext (see Listeners::mpo_vnode_check_clone)
 AccessCheckResult IOHandler::HandleClone(const IOEvent &event, AccessReport &sourceAccessToReport, AccessReport &destinationAccessToReport)
 {
-    AccessCheckResult sourceResult = CheckAndCreateReport(kOpMacVNodeCloneSource, event.GetEventPath(SRC_PATH), Checkers::CheckReadWrite, event.GetPid(), false, event.GetError(), sourceAccessToReport);
-    AccessCheckResult destResult = CheckAndCreateReport(kOpMacVNodeCloneDest, event.GetEventPath(DST_PATH), Checkers::CheckReadWrite, event.GetPid(), false, event.GetError(), destinationAccessToReport);
+    bool isDir = S_ISDIR(event.GetMode());
+
+    AccessCheckResult sourceResult = CheckAndCreateReport(kOpMacVNodeCloneSource, event.GetEventPath(SRC_PATH), Checkers::CheckRead, event.GetPid(), isDir, event.GetError(), sourceAccessToReport);
+    AccessCheckResult destResult = CheckAndCreateReport(kOpMacVNodeCloneDest, event.GetEventPath(DST_PATH), Checkers::CheckWrite, event.GetPid(), isDir, event.GetError(), destinationAccessToReport);
 
     return AccessCheckResult::Combine(sourceResult, destResult);
 }
@@ -237,112 +241,125 @@ AccessCheckResult IOHandler::HandleEvent(const IOEvent &event)
     return result;
 }
 
+constexpr IOHandler::EventDispatchTable IOHandler::BuildDispatchTable()
+{
+    EventDispatchTable table {};
+
+    auto single = [&table](std::initializer_list<es_event_type_t> types, ReportHandler handler, EventFilter filter = EventFilter::None)
+    {
+        for (es_event_type_t type : types)
+        {
+            table[type] = { handler, nullptr, filter };
+        }
+    };
+
+    auto pair = [&table](std::initializer_list<es_event_type_t> types, ReportPairHandler handler)
+    {
+        for (es_event_type_t type : types)
+        {
+            table[type] = { nullptr, handler, EventFilter::None };
+        }
+    };
+
+    single({ ES_EVENT_TYPE_AUTH_EXEC, ES_EVENT_TYPE_NOTIFY_EXEC }, &IOHandler::HandleProcessExec);
+    single({ ES_EVENT_TYPE_NOTIFY_FORK }, &IOHandler::HandleProcessFork);
+    pair({ ES_EVENT_TYPE_NOTIFY_EXIT }, &IOHandler::HandleProcessExit);
+
+    single({ ES_EVENT_TYPE_NOTIFY_LOOKUP }, &IOHandler::HandleLookup);
+    single({ ES_EVENT_TYPE_AUTH_OPEN, ES_EVENT_TYPE_NOTIFY_OPEN }, &IOHandler::HandleOpen, EventFilter::DirectoryEnumeration);
+    single({ ES_EVENT_TYPE_NOTIFY_CLOSE }, &IOHandler::HandleClose, EventFilter::DirectoryEnumeration);
+    single({ ES_EVENT_TYPE_AUTH_CREATE, ES_EVENT_TYPE_NOTIFY_CREATE }, &IOHandler::HandleCreate);
+
+    single(
+    {
+        ES_EVENT_TYPE_AUTH_TRUNCATE, ES_EVENT_TYPE_NOTIFY_TRUNCATE,
+        ES_EVENT_TYPE_AUTH_SETATTRLIST, ES_EVENT_TYPE_NOTIFY_SETATTRLIST,
+        ES_EVENT_TYPE_AUTH_SETEXTATTR, ES_EVENT_TYPE_NOTIFY_SETEXTATTR,
+        ES_EVENT_TYPE_AUTH_DELETEEXTATTR, ES_EVENT_TYPE_NOTIFY_DELETEEXTATTR,
+        ES_EVENT_TYPE_AUTH_SETFLAGS, ES_EVENT_TYPE_NOTIFY_SETFLAGS,
+        ES_EVENT_TYPE_AUTH_SETOWNER, ES_EVENT_TYPE_NOTIFY_SETOWNER,
+        ES_EVENT_TYPE_AUTH_SETMODE, ES_EVENT_TYPE_NOTIFY_SETMODE,
+        ES_EVENT_TYPE_NOTIFY_WRITE,
+        ES_EVENT_TYPE_NOTIFY_UTIMES,
+        ES_EVENT_TYPE_NOTIFY_SETTIME,
+        ES_EVENT_TYPE_AUTH_SETACL, ES_EVENT_TYPE_NOTIFY_SETACL,
+    }, &IOHandler::HandleGenericWrite);
+
+    single(
+    {
+        ES_EVENT_TYPE_NOTIFY_CHDIR,
+        ES_EVENT_TYPE_NOTIFY_READDIR,
+        ES_EVENT_TYPE_NOTIFY_FSGETPATH,
+    }, &IOHandler::HandleGenericRead, EventFilter::DirectoryEnumeration);
+
+    single(
+    {
+        ES_EVENT_TYPE_AUTH_GETATTRLIST, ES_EVENT_TYPE_NOTIFY_GETATTRLIST,
+        ES_EVENT_TYPE_AUTH_GETEXTATTR, ES_EVENT_TYPE_NOTIFY_GETEXTATTR,
+        ES_EVENT_TYPE_AUTH_LISTEXTATTR, ES_EVENT_TYPE_NOTIFY_LISTEXTATTR,
+        ES_EVENT_TYPE_NOTIFY_ACCESS,
+        ES_EVENT_TYPE_NOTIFY_STAT,
+    }, &IOHandler::HandleGenericProbe);
+
+    pair({ ES_EVENT_TYPE_AUTH_CLONE, ES_EVENT_TYPE_NOTIFY_CLONE }, &IOHandler::HandleClone);
+    pair({ ES_EVENT_TYPE_AUTH_EXCHANGEDATA, ES_EVENT_TYPE_NOTIFY_EXCHANGEDATA }, &IOHandler::HandleExchange);
+    pair({ ES_EVENT_TYPE_AUTH_RENAME, ES_EVENT_TYPE_NOTIFY_RENAME }, &IOHandler::HandleRename);
+    single({ ES_EVENT_TYPE_AUTH_READLINK, ES_EVENT_TYPE_NOTIFY_READLINK }, &IOHandler::HandleReadlink);
+    pair({ ES_EVENT_TYPE_AUTH_LINK, ES_EVENT_TYPE_NOTIFY_LINK }, &IOHandler::HandleLink);
+    single({ ES_EVENT_TYPE_AUTH_UNLINK, ES_EVENT_TYPE_NOTIFY_UNLINK }, &IOHandler::HandleUnlink);
+
+    return table;
+}
+
+const IOHandler::EventDispatchTable IOHandler::s_dispatchTable = IOHandler::BuildDispatchTable();
+
+// What every enumeration is checked as when no scope of the manifest reports enumerations (see the Enumerate primitive in Checkers.cpp)
+static const AccessCheckResult s_ignoredEnumerationCheckResult(RequestedAccess::Enumerate, ResultAction::Allow, ReportLevel::Ignore);
+
 AccessCheckResult IOHandler::CheckAccessAndBuildReport(const IOEvent &event, AccessReportGroup &accessToReportGroup)
 {
     // The second report may not be set below, so prevently flag it as a no report one.
     accessToReportGroup.secondReport.shouldReport = false;
 
-    switch (event.GetEventType())
+    es_event_type_t eventType = event.GetEventType();
+    if (eventType == ES_EVENT_TYPE_LAST)
     {
-        case ES_EVENT_TYPE_AUTH_EXEC:
-        case ES_EVENT_TYPE_NOTIFY_EXEC:
-        {
-            return HandleProcessExec(event, accessToReportGroup.firstReport);
-        }
-        case ES_EVENT_TYPE_NOTIFY_FORK:
-            return HandleProcessFork(event, accessToReportGroup.firstReport);
+        accessToReportGroup.firstReport.shouldReport = false;
+        return AccessCheckResult::Invalid();
+    }
 
-        case ES_EVENT_TYPE_NOTIFY_EXIT:
-            return HandleProcessExit(event, accessToReportGroup.firstReport, accessToReportGroup.secondReport);
+    if ((unsigned int)eventType > ES_EVENT_TYPE_LAST)
+    {
+        std::string message("Unhandled ES event: ");
+        message.append(std::to_string(eventType));
+        throw BuildXLException(message);
+    }
 
-        case ES_EVENT_TYPE_NOTIFY_LOOKUP:
-            return HandleLookup(event, accessToReportGroup.firstReport);
+    const EventDispatch &dispatch = s_dispatchTable[eventType];
 
-        case ES_EVENT_TYPE_AUTH_OPEN:
-        case ES_EVENT_TYPE_NOTIFY_OPEN:
-        {
-            return HandleOpen(event, accessToReportGroup.firstReport);
-        }
-        case ES_EVENT_TYPE_NOTIFY_CLOSE:
-            return HandleClose(event, accessToReportGroup.firstReport);
+    // Directories the event did not modify are checked as enumerations, which are allowed and, unless some scope asks for
+    // them, never reported: no need to look up the policy of their path in that case
+    if (dispatch.filter == EventFilter::DirectoryEnumeration &&
+        event.EventPathExists() &&
+        S_ISDIR(event.GetMode()) &&
+        !event.FSEntryModified() &&
+        !GetPip()->ReportsDirectoryEnumerations())
+    {
+        accessToReportGroup.firstReport.shouldReport = false;
+        return s_ignoredEnumerationCheckResult;
+    }
 
-        case ES_EVENT_TYPE_AUTH_CREATE:
-        case ES_EVENT_TYPE_NOTIFY_CREATE:
-        {
-            return HandleCreate(event, accessToReportGroup.firstReport);
-        }
-        case ES_EVENT_TYPE_AUTH_TRUNCATE:
-        case ES_EVENT_TYPE_NOTIFY_TRUNCATE:
-        case ES_EVENT_TYPE_AUTH_SETATTRLIST:
-        case ES_EVENT_TYPE_NOTIFY_SETATTRLIST:
-        case ES_EVENT_TYPE_AUTH_SETEXTATTR:
-        case ES_EVENT_TYPE_NOTIFY_SETEXTATTR:
-        case ES_EVENT_TYPE_AUTH_DELETEEXTATTR:
-        case ES_EVENT_TYPE_NOTIFY_DELETEEXTATTR:
-        case ES_EVENT_TYPE_AUTH_SETFLAGS:
-        case ES_EVENT_TYPE_NOTIFY_SETFLAGS:
-        case ES_EVENT_TYPE_AUTH_SETOWNER:
-        case ES_EVENT_TYPE_NOTIFY_SETOWNER:
-        case ES_EVENT_TYPE_AUTH_SETMODE:
-        case ES_EVENT_TYPE_NOTIFY_SETMODE:
-        case ES_EVENT_TYPE_NOTIFY_WRITE:
-        case ES_EVENT_TYPE_NOTIFY_UTIMES:
-        case ES_EVENT_TYPE_NOTIFY_SETTIME:
-        case ES_EVENT_TYPE_AUTH_SETACL:
-        case ES_EVENT_TYPE_NOTIFY_SETACL:
-            return HandleGenericWrite(event, accessToReportGroup.firstReport);
-
-        case ES_EVENT_TYPE_NOTIFY_CHDIR:
-        case ES_EVENT_TYPE_NOTIFY_READDIR:
-        case ES_EVENT_TYPE_NOTIFY_FSGETPATH:
-            return HandleGenericRead(event, accessToReportGroup.firstReport);
-
-        case ES_EVENT_TYPE_AUTH_GETATTRLIST:
-        case ES_EVENT_TYPE_NOTIFY_GETATTRLIST:
-        case ES_EVENT_TYPE_AUTH_GETEXTATTR:
-        case ES_EVENT_TYPE_NOTIFY_GETEXTATTR:
-        case ES_EVENT_TYPE_AUTH_LISTEXTATTR:
-        case ES_EVENT_TYPE_NOTIFY_LISTEXTATTR:
-        case ES_EVENT_TYPE_NOTIFY_ACCESS:
-        case ES_EVENT_TYPE_NOTIFY_STAT:
-            return HandleGenericProbe(event, accessToReportGroup.firstReport);
-
-        case ES_EVENT_TYPE_AUTH_CLONE:
-        case ES_EVENT_TYPE_NOTIFY_CLONE:
-        {
-            return HandleClone(event, accessToReportGroup.firstReport, accessToReportGroup.secondReport);
-        }
-        case ES_EVENT_TYPE_AUTH_EXCHANGEDATA:
-        case ES_EVENT_TYPE_NOTIFY_EXCHANGEDATA:
-        {
-            return HandleExchange(event, accessToReportGroup.firstReport, accessToReportGroup.secondReport);
-        }
-        case ES_EVENT_TYPE_AUTH_RENAME:
-        case ES_EVENT_TYPE_NOTIFY_RENAME:
-        {
-            return HandleRename(event, accessToReportGroup.firstReport, accessToReportGroup.secondReport);
-        }
-        case ES_EVENT_TYPE_AUTH_READLINK:
-        case ES_EVENT_TYPE_NOTIFY_READLINK:
-        {
-            return HandleReadlink(event, accessToReportGroup.firstReport);
-        }
-        case ES_EVENT_TYPE_AUTH_LINK:
-        case ES_EVENT_TYPE_NOTIFY_LINK:
-        {
-            return HandleLink(event, accessToReportGroup.firstReport, accessToReportGroup.secondReport);
-        }
-        case ES_EVENT_TYPE_AUTH_UNLINK:
-        case ES_EVENT_TYPE_NOTIFY_UNLINK:
-        {
-            return HandleUnlink(event, accessToReportGroup.firstReport);
-        }
-        case ES_EVENT_TYPE_LAST:
-            accessToReportGroup.firstReport.shouldReport = false;
-            return AccessCheckResult::Invalid();
-        default:
-            std::string message("Unhandled ES event: ");
-            message.append(std::to_string(event.GetEventType()));
-            throw BuildXLException(message);
+    if (dispatch.handler != nullptr)
+    {
+        return (this->*dispatch.handler)(event, accessToReportGroup.firstReport);
+    }
+
+    if (dispatch.pairHandler != nullptr)
+    {
+        return (this->*dispatch.pairHandler)(event, accessToReportGroup.firstReport, accessToReportGroup.secondReport);
     }
+
+    std::string message("Unhandled ES event: ");
+    message.append(std::to_string(eventType));
+    throw BuildXLException(message);
 }
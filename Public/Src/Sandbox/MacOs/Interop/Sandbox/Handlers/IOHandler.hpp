@@ -4,6 +4,8 @@
 #ifndef IOHandler_hpp
 #define IOHandler_hpp
 
+#include <array>
+
 #include "AccessHandler.hpp"
 #include "IOEvent.hpp"
 
@@ -66,6 +68,35 @@ protected:
     AccessCheckResult HandleGenericRead(const IOEvent &event, AccessReport &accessToReport);
 
     AccessCheckResult HandleGenericProbe(const IOEvent &event, AccessReport &accessToReport);
+
+private:
+
+    // What an event can be settled by before looking up the policy of its path
+    enum class EventFilter : uint8_t
+    {
+        None,
+        // On an existing directory the event is checked as an enumeration, which is allowed and only reported when the manifest
+        // asks for enumerations somewhere (see SandboxedPip::ReportsDirectoryEnumerations)
+        DirectoryEnumeration,
+    };
+
+    typedef AccessCheckResult (IOHandler::*ReportHandler)(const IOEvent &event, AccessReport &accessToReport);
+    typedef AccessCheckResult (IOHandler::*ReportPairHandler)(const IOEvent &event, AccessReport &firstAccessToReport, AccessReport &secondAccessToReport);
+
+    // How CheckAccessAndBuildReport handles an event type: events yielding one report go to 'handler', events yielding
+    // two to 'pairHandler'. Neither is set for the event types that are not handled.
+    struct EventDispatch
+    {
+        ReportHandler handler;
+        ReportPairHandler pairHandler;
+        EventFilter filter;
+    };
+
+    typedef std::array<EventDispatch, ES_EVENT_TYPE_LAST> EventDispatchTable;
+
+    static constexpr EventDispatchTable BuildDispatchTable();
+
+    static const EventDispatchTable s_dispatchTable;
 };
 
 #endif /* IOHandler_hpp */
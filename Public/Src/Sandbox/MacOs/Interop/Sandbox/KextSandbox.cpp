@@ -2,6 +2,14 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include <IOKit/kext/KextManager.h>
+#include <algorithm>
+#include <pthread.h>
+#include <pthread/qos.h>
+#include <mutex>
+#include <set>
+#include <utility>
+#include <vector>
+#include "FileAccessManifestParser.hpp"
 #include "KextSandbox.hpp"
 
 class AutoRelease
@@ -29,6 +37,13 @@ extern "C"
 
 #pragma mark IOKit Service and Connection initialization
 
+    static void* RunNotificationLoop(void *port)
+    {
+        CFRunLoopAddSource(CFRunLoopGetCurrent(), IONotificationPortGetRunLoopSource((IONotificationPortRef)port), kCFRunLoopDefaultMode);
+        CFRunLoopRun();
+        return NULL;
+    }
+
     static kern_return_t openMacSanboxIOKitService(io_connect_t *connect)
     {
         io_iterator_t iterator;
@@ -76,13 +91,19 @@ extern "C"
         info->port = IONotificationPortCreate(kIOMasterPortDefault);
         info->error = 0;
 
-        // We need a dedicated CFRunLoop for the async notification delivery to work, thus we dispatch a block
-        // into GCD to keep checking for notification messages from the KEXT
-        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^()
+        // We need a dedicated CFRunLoop for the async notification delivery to work. It gets its own thread rather than
+        // a block on a global queue: it never returns, and must not wait behind (or hold up) other default priority work
+        pthread_attr_t attributes;
+        pthread_attr_init(&attributes);
+        pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+        pthread_attr_set_qos_class_np(&attributes, QOS_CLASS_USER_INITIATED, 0);
+
+        pthread_t thread;
+        if (pthread_create(&thread, &attributes, RunNotificationLoop, info->port) != 0)
         {
-            CFRunLoopAddSource(CFRunLoopGetCurrent(), IONotificationPortGetRunLoopSource(info->port), kCFRunLoopDefaultMode);
-            CFRunLoopRun();
-        });
+            log_error("%s", "Failed starting the kernel extension notification thread");
+        }
+        pthread_attr_destroy(&attributes);
     }
 
     void InitializeKextSharedMemory(KextSharedMemoryInfo *memoryInfo, long memoryInfoSize, KextConnectionInfo info)
@@ -331,6 +352,75 @@ extern "C"
 
 #pragma mark IOSharedDataQueue consumer code
 
+    /*!
+     * Dequeues reports from the shared data queue at 'address' until the queue gets torn down, blocking on 'port' while
+     * the queue is empty. The reports are handed to 'deliver' in batches of at most 'batchSize': a batch is delivered as
+     * soon as it is full or the queue runs dry, so reports are never held back waiting for more to arrive.
+     *
+     * 'deliver' is called with (reports, count, error); a failure is delivered (with no reports) after the reports
+     * dequeued before it.
+     */
+    template <typename Deliver>
+    static void DrainReportQueue(mach_vm_address_t address, mach_port_t port, size_t batchSize, Deliver deliver)
+    {
+        // the listening thread is dedicated to the queue, so it can be kept ahead of the pips filling it up when the
+        // machine is fully loaded
+        pthread_set_qos_class_self_np(QOS_CLASS_USER_INTERACTIVE, 0);
+
+        log_debug("Listening for data on shared queue from process: %d", getpid());
+
+        std::vector<AccessReport> batch(batchSize);
+        size_t count = 0;
+
+        IODataQueueMemory *queue = (IODataQueueMemory *)address;
+        do
+        {
+            while (IODataQueueDataAvailable(queue))
+            {
+                // the kext sends compact records (see PackAccessReport)
+                char record[sizeof(AccessReport)];
+                uint32_t recordSize = sizeof(record);
+
+                kern_return_t result = IODataQueueDequeue(queue, record, &recordSize);
+
+                if (result != kIOReturnSuccess)
+                {
+                    log_error("Received bogus access report record: size %d, Error Code: %#X", recordSize, result);
+                    deliver(batch.data(), count, REPORT_QUEUE_SUCCESS);
+                    deliver(nullptr, 0, REPORT_QUEUE_DEQUEUE_ERROR);
+                    return;
+                }
+
+                AccessReport *report = &batch[count];
+                if (!UnpackAccessReport(record, recordSize, report))
+                {
+                    log_error("AccessReport record size mismatch :: reported: %d, expected: %ld..%ld",
+                              recordSize, kAccessReportMinRecordSize, sizeof(AccessReport));
+                    deliver(batch.data(), count, REPORT_QUEUE_SUCCESS);
+                    deliver(nullptr, 0, REPORT_QUEUE_DEQUEUE_ERROR);
+                    count = 0;
+                    continue;
+                }
+
+                report->stats.dequeueTime = GetMachAbsoluteTime();
+                if (++count == batchSize)
+                {
+                    deliver(batch.data(), count, REPORT_QUEUE_SUCCESS);
+                    count = 0;
+                }
+            }
+
+            if (count > 0)
+            {
+                deliver(batch.data(), count, REPORT_QUEUE_SUCCESS);
+                count = 0;
+            }
+        }
+        while (IODataQueueWaitForAvailableData(queue, port) == kIOReturnSuccess);
+
+        log_debug("Exiting ListenForFileAccessReports for PID (%d)", getpid());
+    }
+
     /**
      * Call this function once only from a dedicated thread and pass a valid C# delegate callback, the address to
      * the shared memory region and a valid mach port.
@@ -354,39 +444,46 @@ extern "C"
             return;
         }
 
-        log_debug("Listening for data on shared queue from process: %d", getpid());
-
-        IODataQueueMemory *queue = (IODataQueueMemory *)address;
-        do
+        DrainReportQueue(address, port, /* batchSize */ 1, [callback](const AccessReport *reports, size_t count, int error)
         {
-            while (IODataQueueDataAvailable(queue))
+            if (error != REPORT_QUEUE_SUCCESS)
             {
-                AccessReport report;
-                uint32_t reportSize = sizeof(report);
-
-                kern_return_t result = IODataQueueDequeue(queue, &report, &reportSize);
+                callback(AccessReport{}, error);
+            }
 
-                if (result != kIOReturnSuccess)
-                {
-                    log_error("Received bogus access report: PID(%d) PIP(%#llX) Error Code: %#X", report.rootPid, report.pipId, result);
-                    callback(AccessReport{}, REPORT_QUEUE_DEQUEUE_ERROR);
-                    return;
-                }
+            for (size_t i = 0; i < count; i++)
+            {
+                callback(reports[i], REPORT_QUEUE_SUCCESS);
+            }
+        });
+    }
 
-                if (reportSize != sizeof(report))
-                {
-                    log_error("AccessReport size mismatch :: reported: %d, expected: %ld", reportSize, sizeof(report));
-                    callback(AccessReport{}, REPORT_QUEUE_DEQUEUE_ERROR);
-                    continue;
-                }
+    __cdecl void ListenForFileAccessReportBatches(AccessReportBatchCallback callback, long accessReportSize, mach_vm_address_t address, mach_port_t port)
+    {
+        if (sizeof(AccessReport) != accessReportSize)
+        {
+            log_error("Wrong size of the AccessReport buffer: expected %ld, received %ld",
+                      sizeof(AccessReport), accessReportSize);
+            if (callback != NULL) callback(NULL, 0, KEXT_WRONG_BUFFER_SIZE);
+            return;
+        }
 
-                report.stats.dequeueTime = GetMachAbsoluteTime();
-                callback(report, REPORT_QUEUE_SUCCESS);
+        if (callback == NULL || address == 0 || !MACH_PORT_VALID(port))
+        {
+            if (callback != NULL)
+            {
+                callback(NULL, 0, REPORT_QUEUE_CONNECTION_ERROR);
             }
+            return;
         }
-        while (IODataQueueWaitForAvailableData(queue, port) == kIOReturnSuccess);
 
-        log_debug("Exiting ListenForFileAccessReports for PID (%d)", getpid());
+        DrainReportQueue(address, port, kAccessReportBatchSize, [callback](const AccessReport *reports, size_t count, int error)
+        {
+            if (count > 0 || error != REPORT_QUEUE_SUCCESS)
+            {
+                callback(reports, (int)count, error);
+            }
+        });
     }
 
     uint64_t GetMachAbsoluteTime()
@@ -404,3 +501,110 @@ bool KEXT_SendPipProcessTerminated(pipid_t pipId, pid_t processId, KextConnectio
 {
     return SendPipStatus(processId, pipId, NULL, 0, kBuildXLSandboxActionSendPipProcessTerminated, info);
 }
+
+// Manifest trees (by hash and size) sent to the kext along with a pip already; later pips reference them instead
+static std::set<std::pair<uint64_t, mach_vm_size_t>> g_sentTrees;
+static std::mutex g_sentTreesLock;
+
+// Fills 'entry' in for a pip, referencing its manifest tree if it was sent to the kext before
+static void PreparePipStartedEntry(PipStartedEntry *entry, const pid_t processId, pipid_t pipId, const char *const famBytes, int famBytesLength)
+{
+    *entry =
+    {
+        .pipId         = pipId,
+        .processId     = processId,
+        .payload       = famBytes != NULL ? (uintptr_t) famBytes : 0,
+        .payloadLength = (uint64_t) famBytesLength,
+        .treeOffset    = 0,
+        .referenceTree = false,
+        .treeHash      = 0
+    };
+
+    FileAccessManifestParseResult fam;
+    if (famBytes == NULL || !fam.init((const BYTE *)famBytes, famBytesLength))
+    {
+        // the kext reports what is wrong with the manifest
+        return;
+    }
+
+    entry->treeOffset = fam.GetManifestTreeOffset((const BYTE *)famBytes);
+    entry->treeHash   = HashManifestTree(famBytes + entry->treeOffset, famBytesLength - entry->treeOffset);
+
+    std::lock_guard<std::mutex> lock(g_sentTreesLock);
+    entry->referenceTree = !g_sentTrees.insert({ entry->treeHash, famBytesLength - entry->treeOffset }).second;
+}
+
+// Starts the pips of 'request' in one call, resending the pips whose tree the kext no longer had along with their tree
+static bool SendPipsStartedRequest(PipsStartedRequest *request, bool *started, KextConnectionInfo info)
+{
+    PipsStartedResponse response;
+    size_t responseSize = sizeof(PipsStartedResponse);
+    kern_return_t result = IOConnectCallStructMethod(info.connection, kIpcActionPipsStarted,
+                                                     request, sizeof(PipsStartedRequest),
+                                                     &response, &responseSize);
+    if (result != KERN_SUCCESS)
+    {
+        log_error("Failed calling SendPipsStarted through IPC interface with error code: %#X", result);
+        return false;
+    }
+
+    PipsStartedRequest retry = { .clientPid = request->clientPid, .count = 0 };
+    int retryIndex[kMaxPipsPerStartRequest];
+
+    bool success = true;
+    for (uint32_t i = 0; i < request->count; i++)
+    {
+        if (response.status[i] == kPipStartTreeNotFound)
+        {
+            retry.pips[retry.count] = request->pips[i];
+            retry.pips[retry.count].referenceTree = false;
+            retryIndex[retry.count++] = i;
+            continue;
+        }
+
+        started[i] = response.status[i] == kPipStartSucceeded;
+        success &= started[i];
+    }
+
+    if (retry.count > 0)
+    {
+        bool retried[kMaxPipsPerStartRequest] = { false };
+        success &= SendPipsStartedRequest(&retry, retried, info);
+        for (uint32_t i = 0; i < retry.count; i++)
+        {
+            started[retryIndex[i]] = retried[i];
+        }
+    }
+
+    return success;
+}
+
+bool KEXT_SendPipsStarted(const pid_t *processIds, const pipid_t *pipIds, const char *const *famBytes, const int *famBytesLengths,
+                          int count, bool *started, KextConnectionInfo info)
+{
+    if (info.connection == IO_OBJECT_NULL)
+    {
+        return false;
+    }
+
+    bool success = true;
+    for (int first = 0; first < count; first += kMaxPipsPerStartRequest)
+    {
+        PipsStartedRequest request = { .clientPid = getpid(), .count = 0 };
+        for (int i = first; i < count && request.count < kMaxPipsPerStartRequest; i++)
+        {
+            PreparePipStartedEntry(&request.pips[request.count++], processIds[i], pipIds[i], famBytes[i], famBytesLengths[i]);
+        }
+
+        bool sent = SendPipsStartedRequest(&request, started + first, info);
+        if (!sent)
+        {
+            std::fill(started + first, started + first + request.count, false);
+        }
+
+        success &= sent;
+    }
+
+    log_debug("SendPipsStarted %s for %d pips", success ? "succeeded" : "failed", count);
+    return success;
+}
@@ -52,6 +52,12 @@ extern "C"
 
     __cdecl void ListenForFileAccessReports(AccessReportCallback callback, long accessReportSize, mach_vm_address_t address, mach_port_t port);
 
+    /*!
+     * Same as 'ListenForFileAccessReports', but hands the reports over in batches of up to 'kAccessReportBatchSize' (whatever
+     * could be dequeued without waiting), so that a burst of reports costs one managed transition per batch.
+     */
+    __cdecl void ListenForFileAccessReportBatches(AccessReportBatchCallback callback, long accessReportSize, mach_vm_address_t address, mach_port_t port);
+
     uint64_t GetMachAbsoluteTime(void);
     __cdecl void KextVersionString(char *version, int size);
 
@@ -61,4 +67,14 @@ extern "C"
 bool KEXT_SendPipStarted(const pid_t processId, pipid_t pipId, const char *const famBytes, int famBytesLength, KextConnectionInfo info);
 bool KEXT_SendPipProcessTerminated(pipid_t pipId, pid_t processId, KextConnectionInfo info);
 
+/*!
+ * Starts 'count' pips (the i-th pip being given by the i-th element of every array) with as few calls into the kext as
+ * possible.  A manifest tree already sent along with an earlier pip is only referenced by its hash, so the kext only
+ * copies the header of the manifest over.  Whether each pip could be started is stored in 'started'.
+ *
+ * @result Whether all the pips could be started
+ */
+bool KEXT_SendPipsStarted(const pid_t *processIds, const pipid_t *pipIds, const char *const *famBytes, const int *famBytesLengths,
+                          int count, bool *started, KextConnectionInfo info);
+
 #endif /* KextSandbox_h */
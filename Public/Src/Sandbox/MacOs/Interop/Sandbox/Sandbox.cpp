@@ -1,6 +1,8 @@
 // Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
+#include <algorithm>
+
 #include "EventProcessor.hpp"
 #include "IOHandler.hpp"
 #include "Sandbox.hpp"
@@ -69,6 +71,20 @@ bool Sandbox_SendPipStarted(const pid_t pid, pipid_t pipId, const char *const fa
     }
 }
 
+bool Sandbox_SendPipsStarted(const pid_t *pids, const pipid_t *pipIds, const char *const *famBytes, const int *famBytesLengths,
+                             int count, bool *started)
+{
+    // the sandbox runs in-process, there is no call to save by starting the pips together
+    bool success = true;
+    for (int i = 0; i < count; i++)
+    {
+        started[i] = Sandbox_SendPipStarted(pids[i], pipIds[i], famBytes[i], famBytesLengths[i]);
+        success &= started[i];
+    }
+
+    return success;
+}
+
 bool Sandbox_SendPipProcessTerminated(pipid_t pipId, pid_t pid)
 {
     log_debug("Pip with PipId = %#llX, PID = %d terminated", pipId, pid);
@@ -116,16 +132,23 @@ Sandbox::Sandbox(pid_t host_pid, Configuration config)
     });
     xpc_connection_resume(xpc_bridge_);
 
-    hybird_event_queue_ = dispatch_queue_create("com.microsoft.buildxl.interop.hybrid_events", dispatch_queue_attr_make_with_qos_class(
-        DISPATCH_QUEUE_SERIAL, QOS_CLASS_USER_INTERACTIVE, -1
-    ));
+    long queue_count = std::min(std::max(sysconf(_SC_NPROCESSORS_ONLN), 1L), 16L);
+    for (long i = 0; i < queue_count; i++)
+    {
+        char queue_name[PATH_MAX] = { '\0' };
+        sprintf(queue_name, "com.microsoft.buildxl.interop.events_%ld", i);
+
+        event_queues_.push_back(dispatch_queue_create(queue_name, dispatch_queue_attr_make_with_qos_class(
+            DISPATCH_QUEUE_SERIAL, QOS_CLASS_USER_INTERACTIVE, -1
+        )));
+    }
 #endif
 
     switch (configuration_)
     {
 #if __APPLE__
         case EndpointSecuritySandboxType: {
-            es_ = new EndpointSecuritySandbox(host_pid, &process_event, (void *)this, xpc_bridge_);
+            es_ = new EndpointSecuritySandbox(host_pid, &process_event, &event_queue, (void *)this, xpc_bridge_);
             break;
         }
         case DetoursSandboxType: {
@@ -133,7 +156,10 @@ Sandbox::Sandbox(pid_t host_pid, Configuration config)
             break;
         }
         case HybridSandboxType: {
-            es_ = new EndpointSecuritySandbox(host_pid, &process_event, (void *)this, xpc_bridge_);
+            // Hybrid events are deduplicated and queued by process_event already. The interposer and EndpointSecurity deliver the
+            // two copies of an event from different threads, in no particular order, but usually within a few milliseconds.
+            deduplicator_ = new IOEventDeduplicator(/* windowMs */ 500);
+            es_ = new EndpointSecuritySandbox(host_pid, &process_event, nullptr, (void *)this, xpc_bridge_);
             detours_ = new DetoursSandbox(host_pid, &process_event, (void *)this, xpc_bridge_);
             break;
         }
@@ -166,17 +192,80 @@ Sandbox::~Sandbox()
         delete detours_;
     }
 
+    if (deduplicator_ != nullptr)
+    {
+        delete deduplicator_;
+    }
+
     xpc_connection_cancel(xpc_bridge_);
     xpc_release(xpc_bridge_);
     xpc_bridge_ = nullptr;
 
-    if (hybird_event_queue_)
+    for (dispatch_queue_t queue : event_queues_)
     {
-        dispatch_release(hybird_event_queue_);
+        dispatch_release(queue);
     }
 #endif
 }
 
+#if __APPLE__
+dispatch_queue_t Sandbox::GetEventQueue(const IOEvent &event)
+{
+    const std::lock_guard<std::mutex> lock(event_shards_mutex_);
+
+    // A process that is not tracked yet goes where its parent goes, which is where its fork event is processed
+    pid_t pid = event.GetPid();
+    size_t shard;
+    bool known = TryGetEventShard(pid, shard) || TryGetEventShard(event.GetParentPid(), shard);
+    if (known)
+    {
+        event_shards_[pid] = shard;
+    }
+    else
+    {
+        shard = (size_t)pid % event_queues_.size();
+    }
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wswitch"
+    switch (event.GetEventType())
+    {
+        case ES_EVENT_TYPE_NOTIFY_FORK:
+            if (known)
+            {
+                event_shards_[event.GetChildPid()] = shard;
+            }
+            break;
+        case ES_EVENT_TYPE_NOTIFY_EXIT:
+            event_shards_.erase(pid);
+            break;
+    }
+#pragma clang diagnostic pop
+
+    return event_queues_[shard];
+}
+
+// Assumes event_shards_mutex_ is held by the caller
+bool Sandbox::TryGetEventShard(pid_t pid, size_t &shard)
+{
+    auto it = event_shards_.find(pid);
+    if (it != event_shards_.end())
+    {
+        shard = it->second;
+        return true;
+    }
+
+    std::shared_ptr<SandboxedProcess> process = FindTrackedProcess(pid);
+    if (process == nullptr)
+    {
+        return false;
+    }
+
+    shard = (size_t)process->GetPip()->GetProcessId() % event_queues_.size();
+    return true;
+}
+#endif
+
 std::shared_ptr<SandboxedProcess> Sandbox::FindTrackedProcess(pid_t pid)
 {
     return trackedProcesses_->get(pid);
@@ -185,7 +274,7 @@ std::shared_ptr<SandboxedProcess> Sandbox::FindTrackedProcess(pid_t pid)
 bool Sandbox::TrackRootProcess(std::shared_ptr<SandboxedPip> pip)
 {
     pid_t pid = pip->GetProcessId();
-    std::shared_ptr<SandboxedProcess> process(new SandboxedProcess(pid, pip));
+    std::shared_ptr<SandboxedProcess> process = SandboxedProcess::Create(pid, pip);
 
     if (process == nullptr)
     {
@@ -195,6 +284,16 @@ bool Sandbox::TrackRootProcess(std::shared_ptr<SandboxedPip> pip)
     int len = PATH_MAX;
     process->SetPath(pip->GetProcessPath(&len));
 
+#if __APPLE__
+    if (es_ != nullptr)
+    {
+        std::vector<std::string> scopes;
+        pip->GetUntrackedScopes(scopes);
+        es_->MuteUntrackedScopes(scopes);
+        es_->PipStarted(*pip);
+    }
+#endif
+
     log_debug("Pip with PipId = %#llX, PID = %d launching (path: %{public}s)", pip->GetPipId(), pid, process->GetPath());
 
     int numAttempts = 0;
@@ -220,10 +319,25 @@ bool Sandbox::TrackRootProcess(std::shared_ptr<SandboxedPip> pip)
             log_debug("Tracking root process PID(%d), PipId: %#llX, tree size: %d, path: %{public}s, code: %d",
                       pid, pip->GetPipId(), pip->GetTreeSize(), process->GetPath(), result);
 
+#if __APPLE__
+            // The pip never completes if it is not tracked
+            if (!insertedNew && es_ != nullptr)
+            {
+                es_->PipCompleted(*pip);
+            }
+#endif
+
             return insertedNew;
         }
     }
 
+#if __APPLE__
+    if (es_ != nullptr)
+    {
+        es_->PipCompleted(*pip);
+    }
+#endif
+
     process.reset();
     log_error("Exceeded max number of attempts in TrackRootProcess: %d - aborting!", numAttempts);
     return false;
@@ -232,7 +346,7 @@ bool Sandbox::TrackRootProcess(std::shared_ptr<SandboxedPip> pip)
 bool Sandbox::TrackChildProcess(pid_t childPid, const char *childExecutable, std::shared_ptr<SandboxedProcess> parentProcess)
 {
     std::shared_ptr<SandboxedPip> pip = parentProcess->GetPip();
-    std::shared_ptr<SandboxedProcess> childProcess (new SandboxedProcess(childPid, pip));
+    std::shared_ptr<SandboxedProcess> childProcess = SandboxedProcess::Create(childPid, pip);
 
     if (childProcess == nullptr)
     {
@@ -297,13 +411,18 @@ bool Sandbox::UntrackProcess(pid_t pid, std::shared_ptr<SandboxedProcess> proces
     // remove the mapping for 'pid'
     auto removeResult = trackedProcesses_->remove(pid);
     bool removedExisting = removeResult == TrieResult::kTrieResultRemoved;
-    if (removedExisting)
+    std::shared_ptr<SandboxedPip> pip = process->GetPip();
+    // The pip completes with the last process of its tree
+    if (removedExisting && pip->DecrementProcessTreeCount() == 0)
     {
-        process->GetPip()->DecrementProcessTreeCount();
+#if __APPLE__
+        if (es_ != nullptr)
+        {
+            es_->PipCompleted(*pip);
+        }
+#endif
     }
 
-    std::shared_ptr<SandboxedPip> pip = process->GetPip();
-
     log_debug("Untrack entry %d (%{public}s) -> %d, PipId: %#llX, New tree size: %d, Code: %d",
               pid, process->GetPath(), pip->GetProcessId(), pip->GetPipId(), pip->GetTreeSize(), removeResult);
 
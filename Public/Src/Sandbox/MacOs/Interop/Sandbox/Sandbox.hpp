@@ -9,12 +9,15 @@
 #include "DetoursSandbox.hpp"
 #include "EndpointSecuritySandbox.hpp"
 #include "IOEvent.hpp"
+#include "IOEventDeduplicator.hpp"
 #include "SandboxedPip.hpp"
 #include "SandboxedProcess.hpp"
 #include "Trie.hpp"
 
 #include <signal.h>
 #include <map>
+#include <unordered_map>
+#include <vector>
 
 #define SB_WRONG_BUFFER_SIZE    0x8
 #define SB_INSTANCE_ERROR       0x16
@@ -41,6 +44,8 @@ extern "C"
 };
 
 bool Sandbox_SendPipStarted(const pid_t pid, pipid_t pipId, const char *const famBytes, int famBytesLength);
+bool Sandbox_SendPipsStarted(const pid_t *pids, const pipid_t *pipIds, const char *const *famBytes, const int *famBytesLengths,
+                             int count, bool *started);
 bool Sandbox_SendPipProcessTerminated(pipid_t pipId, pid_t pid);
 
 class Sandbox final
@@ -51,9 +56,19 @@ private:
     pid_t hostPid_ = 0;
     
 #if __APPLE__
-    dispatch_queue_t hybird_event_queue_;
+    // Events are processed on a pool of serial queues: all the events of a pip go to the queue of its root process, so pips
+    // are processed in parallel while the events of every process keep their order (see GetEventQueue)
+    std::vector<dispatch_queue_t> event_queues_;
+    std::mutex event_shards_mutex_;
+    std::unordered_map<pid_t, size_t> event_shards_;
+
     xpc_connection_t xpc_bridge_ = nullptr;
     std::mutex access_mutex;
+
+    // Only when running hybrid: drops the EndpointSecurity copies of the events delivered by the interposer
+    IOEventDeduplicator *deduplicator_ = nullptr;
+
+    bool TryGetEventShard(pid_t pid, size_t &shard);
 #endif
     
     std::map<pid_t, pid_t> allowlistedPids_;
@@ -75,7 +90,8 @@ public:
     
 #if __APPLE__
     inline const bool IsRunningHybrid() const { return configuration_ == Configuration::HybridSandboxType; }
-    inline const dispatch_queue_t GetHybridQueue() const { return hybird_event_queue_; }
+    dispatch_queue_t GetEventQueue(const IOEvent &event);
+    inline IOEventDeduplicator* GetEventDeduplicator() const { return deduplicator_; }
 #endif
     
     inline std::map<pid_t, pid_t>& GetAllowlistedPidMap() { return allowlistedPids_; }
@@ -89,6 +105,26 @@ public:
         return map.emplace(pid, ppid).second;
     }
     
+    // Events are processed on several queues at once, lookups go through the lock as well
+    inline const bool TryGetProcessPidPair(std::map<pid_t, pid_t>& map, pid_t pid, pid_t *ppid = nullptr)
+    {
+#if __APPLE__
+        const std::lock_guard<std::mutex> lock(access_mutex);
+#endif
+        auto result = map.find(pid);
+        if (result == map.end())
+        {
+            return false;
+        }
+
+        if (ppid != nullptr)
+        {
+            *ppid = result->second;
+        }
+
+        return true;
+    }
+
     inline const bool RemoveProcessPid(std::map<pid_t, pid_t>& map, pid_t pid)
     {
 #if __APPLE__
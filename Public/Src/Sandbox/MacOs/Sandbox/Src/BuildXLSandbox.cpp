@@ -58,6 +58,18 @@ bool BuildXLSandbox::init(OSDictionary *dictionary)
         return false;
     }
 
+    trackedPidFilter_ = Alloc::New<UInt32>(kTrackedPidFilterSize / 32);
+    if (!trackedPidFilter_)
+    {
+        return false;
+    }
+
+    manifestTrees_ = ManifestTreeCache::Create();
+    if (!manifestTrees_)
+    {
+        return false;
+    }
+
     Configure(&sDefaultConfig);
     if (!InitializeTries())
     {
@@ -81,6 +93,19 @@ void BuildXLSandbox::free(void)
     OSSafeReleaseNULL(trackedProcesses_);
     OSSafeReleaseNULL(connectedClients_);
 
+    // pips still around (e.g., held by a handler) keep the cache alive until they give their trees back
+    if (manifestTrees_)
+    {
+        manifestTrees_->Release();
+        manifestTrees_ = nullptr;
+    }
+
+    if (trackedPidFilter_)
+    {
+        Alloc::Delete<UInt32>(trackedPidFilter_, kTrackedPidFilterSize / 32);
+        trackedPidFilter_ = nullptr;
+    }
+
     bxl_sysctl_unregister();
 
     super::free();
@@ -136,6 +161,9 @@ void BuildXLSandbox::InitializePolicyStructures()
         .mpo_vnode_check_readlink         = Listeners::mpo_vnode_check_readlink,
 
         .mpo_vnode_check_clone            = Listeners::mpo_vnode_check_clone,
+
+        // invalidates the cached paths of directory vnodes (see VNodePathCache)
+        .mpo_vnode_notify_rename          = Listeners::mpo_vnode_notify_rename,
     };
 
     policyConfiguration_ =
@@ -167,6 +195,9 @@ bool BuildXLSandbox::InitializeTries()
         return false;
     }
 
+    // no process is tracked by the new trie
+    bzero(trackedPidFilter_, (kTrackedPidFilterSize / 32) * sizeof(UInt32));
+
     bool callbackInstalled = trackedProcesses_->onChange(this, [](void *data, int oldCount, int newCount)
     {
         BuildXLSandbox *me = (BuildXLSandbox*)data;
@@ -354,6 +385,14 @@ IOReturn BuildXLSandbox::DeallocateClient(pid_t clientPid)
 {
     EnterMonitor
 
+    // kept alive until it is marked disconnected below
+    ClientInfo *client = GetClientInfo(clientPid);
+    if (client != nullptr)
+    {
+        client->retain();
+    }
+    AutoRelease _(client);
+
     auto removeResult = connectedClients_->remove(clientPid);
 
     if (removeResult == Trie::TrieResult::kTrieResultFailure ||
@@ -374,6 +413,12 @@ IOReturn BuildXLSandbox::DeallocateClient(pid_t clientPid)
     {
         log_debug("Deallocating client PID(%d)", clientPid);
 
+        // Pips still running keep the client alive (see 'SandboxedPip::bindClient'), but must not report to it anymore
+        if (client != nullptr)
+        {
+            client->disconnect();
+        }
+
         // Make sure to also cleanup any remaining tracked process objects as the client could have exited abnormally (crashed)
         // and we don't want those objects to stay around any longer
         trackedProcesses_->removeMatching(&clientPid, [](void *data, const OSObject *value)
@@ -417,13 +462,13 @@ bool const BuildXLSandbox::SendAccessReport(AccessReport &report, SandboxedPip *
     Stopwatch stopwatch;
 
     pid_t clientPid = pip->getClientPid();
-    ClientInfo *client = GetClientInfo(clientPid);
+    ClientInfo *client = pip->getClient();
 
     Timespan getClientInfoDuration  = stopwatch.lap();
     Counters()->getClientInfo      += getClientInfoDuration;
     pip->Counters()->getClientInfo += getClientInfoDuration;
 
-    if (client == nullptr)
+    if (client == nullptr || !client->isConnected())
     {
         log_error("No client info found for PID(%d)", clientPid);
         return false;
@@ -449,13 +494,44 @@ SandboxedProcess* BuildXLSandbox::FindTrackedProcess(pid_t pid)
 {
     // NOTE: this has to be very fast when we are not tracking any processes (i.e., trackedProcesses_ is empty)
     //       because this is called on every single file access any process makes
+    if (!MightBeTracked(pid))
+    {
+        return nullptr;
+    }
+
     return trackedProcesses_->getAs<SandboxedProcess>(pid);
 }
 
+void BuildXLSandbox::MarkTracked(pid_t pid)
+{
+    if (pid >= 0 && pid < kTrackedPidFilterSize)
+    {
+        OSBitOrAtomic(1U << (pid & 31), &trackedPidFilter_[pid >> 5]);
+    }
+}
+
+void BuildXLSandbox::UnmarkTracked(pid_t pid)
+{
+    if (pid >= 0 && pid < kTrackedPidFilterSize)
+    {
+        OSBitAndAtomic(~(1U << (pid & 31)), &trackedPidFilter_[pid >> 5]);
+
+        // The same PID may have been tracked again in the meantime: its bit is set (again) only after it was added
+        // to 'trackedProcesses_', so either that happens after the bit was cleared above, or it is visible here.
+        if (trackedProcesses_->get(pid) != nullptr)
+        {
+            MarkTracked(pid);
+        }
+    }
+}
+
 bool BuildXLSandbox::TrackRootProcess(SandboxedPip *pip)
 {
     pid_t pid = pip->getProcessId();
 
+    // Reports of the pip go straight to its client (see 'SendAccessReport')
+    pip->bindClient(GetClientInfo(pip->getClientPid()));
+
     SandboxedProcess *process = SandboxedProcess::create(pid, pip);
     AutoRelease _(process);
 
@@ -467,10 +543,15 @@ bool BuildXLSandbox::TrackRootProcess(SandboxedPip *pip)
     int len = MAXPATHLEN;
     process->setPath(pip->getProcessPath(&len), len);
 
+    // marked both before (so that the process is found as soon as it is tracked)
+    // and after inserting (see 'UnmarkTracked' for a concurrent untracking of the same PID)
+    MarkTracked(pid);
+
     int numAttempts = 0;
     while (++numAttempts <= 3)
     {
         auto result = trackedProcesses_->insert(pid, process);
+        MarkTracked(pid);
 
         if (result == Trie::TrieResult::kTrieResultAlreadyExists)
         {
@@ -500,14 +581,24 @@ bool BuildXLSandbox::TrackRootProcess(SandboxedPip *pip)
     return false;
 }
 
-static OSObject* ProcessFactory(void *data)
+typedef struct {
+    pid_t childPid;
+    SandboxedProcess *parentProcess;
+} ChildProcessFactoryArgs;
+
+static OSObject* ChildProcessFactory(void *data)
 {
-    // It is IMPORTANT to retain 'process' here.  This function is used as a factory for Trie::getOrAdd which
-    // expects it to increase the ref count of the object it returns (as a constructor would).
-    // The 'getOrAdd' method immediatelly releases this object if it ends up creating it but not using it;
-    // if it does end up using it, it releases it upon its removal from the trie.
-    SandboxedProcess *process = (SandboxedProcess*)data;
-    process->retain();
+    // Trie::getOrAdd only calls this when 'childPid' is not tracked yet, so no process object is allocated (and
+    // released right away) for a child that is already tracked.  The object is returned with the reference a
+    // constructor gives it, which the trie keeps until the process is removed from it.
+    ChildProcessFactoryArgs *args = (ChildProcessFactoryArgs*)data;
+    SandboxedProcess *process = SandboxedProcess::create(args->childPid, args->parentProcess->getPip());
+    if (process != nullptr)
+    {
+        // the child process always starts out as a fork of the parent
+        process->setPath(args->parentProcess->getPath());
+    }
+
     return process;
 }
 
@@ -515,16 +606,13 @@ bool BuildXLSandbox::TrackChildProcess(pid_t childPid, SandboxedProcess *parentP
 {
     SandboxedPip *pip = parentProcess->getPip();
 
-    SandboxedProcess *childProcess = SandboxedProcess::create(childPid, pip);
-    AutoRelease _(childProcess);
-
-    if (childProcess == nullptr)
-    {
-        return false;
-    }
+    // marked both before and after inserting (see 'TrackRootProcess')
+    MarkTracked(childPid);
 
+    ChildProcessFactoryArgs factoryArgs = { .childPid = childPid, .parentProcess = parentProcess };
     Trie::TrieResult getOrAddResult;
-    OSObject *newValue = trackedProcesses_->getOrAdd(childPid, childProcess, ProcessFactory, &getOrAddResult);
+    OSObject *newValue = trackedProcesses_->getOrAdd(childPid, &factoryArgs, ChildProcessFactory, &getOrAddResult);
+    MarkTracked(childPid);
     SandboxedProcess *existingProcess = OSDynamicCast(SandboxedProcess, newValue);
 
     // Operation getOrAdd failed:
@@ -559,12 +647,10 @@ bool BuildXLSandbox::TrackChildProcess(pid_t childPid, SandboxedProcess *parentP
         return false;
     }
 
-    // We associated 'process' with 'childPid':
+    // We associated a new process with 'childPid':
     //   -> increment process tree and return true to indicate that a new process is being tracked
     if (getOrAddResult == Trie::TrieResult::kTrieResultInserted)
     {
-        // copy the path from the parent process (because the child process always starts out as a fork of the parent)
-        childProcess->setPath(parentProcess->getPath());
         pip->incrementProcessTreeCount();
         LogVerbose("Track entry %d -> %d :: ClientId: %d, PipId: %#llX, New tree size: %d",
                    childPid, pip->getProcessId(), pip->getClientPid(),
@@ -587,6 +673,7 @@ bool BuildXLSandbox::UntrackProcess(pid_t pid, SandboxedProcess *process)
     bool removedExisting = removeResult == Trie::TrieResult::kTrieResultRemoved;
     if (removedExisting)
     {
+        UnmarkTracked(pid);
         process->getPip()->decrementProcessTreeCount();
     }
     SandboxedPip *pip = process->getPip();
@@ -620,6 +707,7 @@ IntrospectResponse BuildXLSandbox::Introspect() const
     {
         .numAttachedClients  = connectedClients_->getCount(),
         .counters            = counters_,
+        .histograms          = g_bxl_callback_histograms,
         .memory              =
         {
             .totalAllocatedBytes = Alloc::numCurrentlyAllocatedBytes(),
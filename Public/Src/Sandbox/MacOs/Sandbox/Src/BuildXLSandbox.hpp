@@ -12,6 +12,7 @@
 #include "BuildXLSandboxShared.hpp"
 #include "ConcurrentDictionary.hpp"
 #include "ClientInfo.hpp"
+#include "ManifestTreeCache.hpp"
 #include "ResourceManager.hpp"
 #include "SandboxedProcess.hpp"
 
@@ -61,6 +62,9 @@ private:
      */
     ResourceManager *resourceManager_;
 
+    /*! The manifest trees of the tracked pips, shared between the pips with the same tree */
+    ManifestTreeCache *manifestTrees_;
+
     /*! Recursive lock used for synchronization */
     BXLRecursiveLock *lock_;
 
@@ -82,6 +86,27 @@ private:
      */
     Trie *trackedProcesses_;
 
+    /*! Number of PIDs covered by 'trackedPidFilter_' (larger PIDs are always looked up in 'trackedProcesses_') */
+    static const pid_t kTrackedPidFilterSize = 1 << 17;
+
+    /*!
+     * One bit per PID, set for every PID in 'trackedProcesses_'.  A clear bit means that the PID is definitely not tracked;
+     * a set bit only means that it might be (bits of processes untracked in bulk are left set).
+     *
+     * Consulted before 'trackedProcesses_', so that for the vast majority of callbacks (coming from processes
+     * that aren't part of any build) finding out that the process isn't tracked takes a single memory read.
+     */
+    UInt32 *trackedPidFilter_;
+
+    inline bool MightBeTracked(pid_t pid) const
+    {
+        return pid < 0 || pid >= kTrackedPidFilterSize ||
+            (trackedPidFilter_[pid >> 5] & (1U << (pid & 31))) != 0;
+    }
+
+    void MarkTracked(pid_t pid);
+    void UnmarkTracked(pid_t pid);
+
     ClientInfo* GetClientInfo(pid_t clientPid);
 
     void InitializePolicyStructures();
@@ -112,6 +137,7 @@ public:
 
     AllCounters* Counters()           { return &counters_; }
     ResourceManager* ResourceManger() { return resourceManager_; }
+    ManifestTreeCache* ManifestTrees() { return manifestTrees_; }
 
     inline void ResetCounters()
     {
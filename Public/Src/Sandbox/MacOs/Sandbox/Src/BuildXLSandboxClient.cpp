@@ -188,6 +188,14 @@ IOExternalMethodDispatch BuildXLSandboxClient::ipcMethods[kSandboxMethodCount] =
         .checkScalarOutputCount   = 0,
         .checkStructureOutputSize = sizeof(IntrospectResponse)
     },
+    // kIpcActionPipsStarted
+    {
+        .function                 = (IOExternalMethodAction) &BuildXLSandboxClient::sPipsStarted,
+        .checkScalarInputCount    = 0,
+        .checkStructureInputSize  = sizeof(PipsStartedRequest),
+        .checkScalarOutputCount   = 0,
+        .checkStructureOutputSize = sizeof(PipsStartedResponse)
+    },
 };
 
 IOReturn BuildXLSandboxClient::externalMethod(uint32_t selector, IOExternalMethodArguments *arguments,
@@ -262,6 +270,11 @@ IOReturn BuildXLSandboxClient::sPipStateChanged(BuildXLSandboxClient *target, vo
     return target->PipStateChanged((PipStateChangedRequest *)arguments->structureInput);
 }
 
+IOReturn BuildXLSandboxClient::sPipsStarted(BuildXLSandboxClient *target, void *reference, IOExternalMethodArguments *arguments)
+{
+    return target->PipsStarted((PipsStartedRequest *)arguments->structureInput, (PipsStartedResponse *)arguments->structureOutput);
+}
+
 IOReturn BuildXLSandboxClient::PipStateChanged(PipStateChangedRequest *data)
 {
     if (data == nullptr)
@@ -295,20 +308,20 @@ IOReturn BuildXLSandboxClient::PipStateChanged(PipStateChangedRequest *data)
     return error;
 }
 
-IOReturn BuildXLSandboxClient::ProcessPipStarted(PipStateChangedRequest *data)
+IOReturn BuildXLSandboxClient::CopyFromClient(mach_vm_address_t clientAddr, mach_vm_size_t size, Buffer **result)
 {
-    mach_vm_address_t clientAddr = data->payload;
-    mach_vm_size_t size = data->payloadLength;
+    *result = nullptr;
 
     // Allocate buffer for storing the pip payload
     Buffer *ioBuffer = Buffer::create(size);
-    AutoRelease _b(ioBuffer);
     if (ioBuffer == nullptr)
     {
         log_error("%s", "Failed to allocate IOBuffer for storing the pip payload");
         return kIOReturnNoMemory;
     }
 
+    AutoRelease _b(ioBuffer);
+
     // Create memory descriptor
     IOMemoryDescriptor *memDesc = IOMemoryDescriptor::withAddressRange(clientAddr, size, kIODirectionOutIn, task_);
     AutoRelease _m(memDesc);
@@ -335,8 +348,35 @@ IOReturn BuildXLSandboxClient::ProcessPipStarted(PipStateChangedRequest *data)
         return kIOReturnVMError;
     }
 
+    ioBuffer->retain();
+    *result = ioBuffer;
+    return kIOReturnSuccess;
+}
+
+IOReturn BuildXLSandboxClient::TrackPip(SandboxedPip *pip)
+{
+    bool success = sandbox_->TrackRootProcess(pip);
+
+    log_error_or_debug(g_bxl_verbose_logging, !success,
+                       "Tracking root process %d for pip '%llX' and ClientPID(%d): %s",
+                       pip->getProcessId(), pip->getPipId(), pip->getClientPid(), success ? "succeeded" : "failed");
+
+    return success ? kIOReturnSuccess : kIOReturnError;
+}
+
+IOReturn BuildXLSandboxClient::ProcessPipStarted(PipStateChangedRequest *data)
+{
+    Buffer *ioBuffer;
+    IOReturn status = CopyFromClient(data->payload, data->payloadLength, &ioBuffer);
+    if (status != kIOReturnSuccess)
+    {
+        return status;
+    }
+
+    AutoRelease _b(ioBuffer);
+
     // Create a SandboxedPip
-    SandboxedPip *pip = SandboxedPip::create(data->clientPid, data->processId, ioBuffer);
+    SandboxedPip *pip = SandboxedPip::create(data->clientPid, data->processId, ioBuffer, sandbox_->ManifestTrees());
     AutoRelease _p(pip);
     if (pip == nullptr)
     {
@@ -344,13 +384,75 @@ IOReturn BuildXLSandboxClient::ProcessPipStarted(PipStateChangedRequest *data)
         return kIOReturnInvalid;
     }
 
-    bool success = sandbox_->TrackRootProcess(pip);
+    return TrackPip(pip);
+}
 
-    log_error_or_debug(g_bxl_verbose_logging, !success,
-                       "Tracking root process %d for pip '%llX' and ClientPID(%d): %s",
-                       pip->getProcessId(), pip->getPipId(), pip->getClientPid(), success ? "succeeded" : "failed");
+PipStartStatus BuildXLSandboxClient::ProcessPipStarted(pid_t clientPid, const PipStartedEntry *entry)
+{
+    if (!entry->referenceTree)
+    {
+        PipStateChangedRequest data =
+        {
+            .pipId         = entry->pipId,
+            .processId     = entry->processId,
+            .clientPid     = clientPid,
+            .payload       = entry->payload,
+            .payloadLength = entry->payloadLength,
+            .action        = kBuildXLSandboxActionSendPipStarted
+        };
+
+        return ProcessPipStarted(&data) == kIOReturnSuccess ? kPipStartSucceeded : kPipStartFailed;
+    }
 
-    return success ? kIOReturnSuccess : kIOReturnError;
+    if (entry->treeOffset >= entry->payloadLength)
+    {
+        return kPipStartFailed;
+    }
+
+    // Only the header is copied over when the tree is known already
+    ManifestTreeCache *trees = sandbox_->ManifestTrees();
+    const OSSymbol *key = nullptr;
+    Buffer *tree = trees->AcquireByHash(entry->treeHash, entry->payloadLength - entry->treeOffset, &key);
+    if (tree == nullptr)
+    {
+        return kPipStartTreeNotFound;
+    }
+
+    Buffer *header;
+    if (CopyFromClient(entry->payload, entry->treeOffset, &header) != kIOReturnSuccess)
+    {
+        trees->Relinquish(tree, key);
+        return kPipStartFailed;
+    }
+
+    AutoRelease _h(header);
+
+    SandboxedPip *pip = SandboxedPip::create(clientPid, entry->processId, header, tree, key, trees);
+    AutoRelease _p(pip);
+    if (pip == nullptr)
+    {
+        log_error("%s", "Could not create SandboxedPip (either FAM is invalid or we're out of memory)");
+        trees->Relinquish(tree, key);
+        return kPipStartFailed;
+    }
+
+    return TrackPip(pip) == kIOReturnSuccess ? kPipStartSucceeded : kPipStartFailed;
+}
+
+IOReturn BuildXLSandboxClient::PipsStarted(PipsStartedRequest *request, PipsStartedResponse *response)
+{
+    if (request == nullptr || response == nullptr || request->count > kMaxPipsPerStartRequest)
+    {
+        return kIOReturnBadArgument;
+    }
+
+    LogVerbose("Starting %d pips for ClientPID(%d)", request->count, request->clientPid);
+    for (uint32_t i = 0; i < request->count; i++)
+    {
+        response->status[i] = ProcessPipStarted(request->clientPid, &request->pips[i]);
+    }
+
+    return kIOReturnSuccess;
 }
 
 IOReturn BuildXLSandboxClient::ProcessPipTerminated(PipStateChangedRequest *data)
@@ -61,13 +61,22 @@ protected:
     static IOReturn sUpdateResourceUsage          (BuildXLSandboxClient *target, void *ref, IOExternalMethodArguments *args);
     static IOReturn sSetFailureNotificationHandler(BuildXLSandboxClient *target, void *ref, IOExternalMethodArguments *args);
     static IOReturn sIntrospectHandler            (BuildXLSandboxClient *target, void *ref, IOExternalMethodArguments *args);
+    static IOReturn sPipsStarted                  (BuildXLSandboxClient *target, void *ref, IOExternalMethodArguments *args);
 
     IOReturn PipStateChanged(PipStateChangedRequest *data);
     IOReturn ProcessPipStarted(PipStateChangedRequest *data);
+    PipStartStatus ProcessPipStarted(pid_t clientPid, const PipStartedEntry *entry);
+    IOReturn PipsStarted(PipsStartedRequest *request, PipsStartedResponse *response);
     IOReturn ProcessPipTerminated(PipStateChangedRequest *data);
     IOReturn ProcessClientLaunched(PipStateChangedRequest *data);
     IOReturn SetFailureNotificationHandler(OSAsyncReference64 ref);
 
+    /*! Copies 'size' bytes at 'clientAddr' in the client's address space into a new buffer (which the caller must release) */
+    IOReturn CopyFromClient(mach_vm_address_t clientAddr, mach_vm_size_t size, Buffer **result);
+
+    /*! Starts tracking the root process of a newly created pip */
+    IOReturn TrackPip(SandboxedPip *pip);
+
 public:
 
     IOReturn SendAsyncResult(OSAsyncReference64 ref, IOReturn result);
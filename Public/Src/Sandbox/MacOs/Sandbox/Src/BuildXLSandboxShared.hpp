@@ -17,6 +17,8 @@
 #include <mach/mach_time.h>
 #endif
 
+#include <stddef.h>
+
 #include "stdafx.h"
 #include "DataTypes.h"
 #include "Kauth/OpNames.hpp"
@@ -53,6 +55,7 @@ typedef enum {
     kIpcActionUpdateResourceUsage,
     kIpcActionSetupFailureNotificationHandler,
     kIpcActionIntrospect,
+    kIpcActionPipsStarted,
     kSandboxMethodCount
 } IpcAction;
 
@@ -104,6 +107,15 @@ public:
        if (g_bxl_enable_counters) OSDecrementAtomic(&count_);
 #else
         --count_;
+#endif
+    }
+
+    void operator+= (uint32_t value)
+    {
+#if MAC_OS_SANDBOX
+       if (g_bxl_enable_counters) OSAddAtomic(value, &count_);
+#else
+        count_ += value;
 #endif
     }
 } Counter;
@@ -137,6 +149,55 @@ private:
     }
 } DurationCounter;
 
+#define kHistogramBucketCount 16
+
+/*!
+ * Distribution of sampled values over power-of-two buckets: bucket 0 counts the samples equal to 0, bucket i (for
+ * 0 < i < kHistogramBucketCount - 1) the ones in [2^(i-1), 2^i), and the last bucket all the samples beyond that.
+ */
+typedef struct Histogram {
+    Counter buckets[kHistogramBucketCount];
+
+    static uint BucketIndex(uint64_t value)
+    {
+        uint index = value == 0 ? 0 : 64 - __builtin_clzll(value);
+        return index < kHistogramBucketCount ? index : kHistogramBucketCount - 1;
+    }
+
+    /*! Lower bound of the values counted in bucket 'index' */
+    static uint64_t BucketLowerBound(uint index)
+    {
+        return index == 0 ? 0 : 1ULL << (index - 1);
+    }
+
+    void Add(uint64_t value)
+    {
+        buckets[BucketIndex(value)]++;
+    }
+
+    void operator+= (Timespan timespan)
+    {
+        Add(timespan.micros());
+    }
+} Histogram;
+
+/*!
+ * Latencies (in microseconds) of the kext callbacks that run on the hot paths of every process, tracked or not,
+ * along with the depth of the report queue as seen by every report put on it.
+ */
+typedef struct {
+    Histogram lookup;
+    Histogram read;
+    Histogram write;
+    Histogram exec;
+    Histogram fork;
+    Histogram reportQueueDepth;
+} CallbackHistograms;
+
+#if MAC_OS_SANDBOX
+extern CallbackHistograms g_bxl_callback_histograms;
+#endif
+
 typedef struct {
     pipid_t pipId;
     pid_t processId;
@@ -146,11 +207,60 @@ typedef struct {
     SandboxAction action;
 } PipStateChangedRequest;
 
+/*! Maximum number of pips a single 'PipsStartedRequest' can start (keeps the request small enough to be passed inline) */
+const unsigned int kMaxPipsPerStartRequest = 32;
+
+/*!
+ * FNV-1a hash of the bytes of a file access manifest tree.  Together with the size of the tree, this is what identifies
+ * the tree both in the kext (see 'ManifestTreeCache') and in the requests referencing a tree the kext already has.
+ */
+inline uint64_t HashManifestTree(const char *bytes, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ (uint8_t)bytes[i]) * 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+typedef struct {
+    pipid_t pipId;
+    pid_t processId;
+    mach_vm_address_t payload;
+    mach_vm_size_t payloadLength;
+    // Where the manifest tree starts within 'payload' (i.e., the size of the manifest header)
+    mach_vm_size_t treeOffset;
+    // When set, only the header is read from 'payload' if the kext already has a tree with this hash (see 'HashManifestTree')
+    bool referenceTree;
+    uint64_t treeHash;
+} PipStartedEntry;
+
+typedef enum {
+    kPipStartSucceeded,
+    kPipStartFailed,
+    // The pip referenced a tree the kext does not have: it has to be sent again along with its tree
+    kPipStartTreeNotFound,
+} PipStartStatus;
+
+typedef struct {
+    pid_t clientPid;
+    uint32_t count;
+    PipStartedEntry pips[kMaxPipsPerStartRequest];
+} PipsStartedRequest;
+
+typedef struct {
+    PipStartStatus status[kMaxPipsPerStartRequest];
+} PipsStartedResponse;
+
 typedef struct {
     basis_points cpuUsage;
+    basis_points smoothedCpuUsage;  // what throttling decisions are based on (see ResourceManager::UpdateCpuUsage)
     uint availableRamMB;
     uint numTrackedProcesses;
     uint numBlockedProcesses;
+    DurationCounter blockedForks;   // the forks that had to wait for resources, and how long they waited
 } ResourceCounters;
 
 typedef struct {
@@ -158,7 +268,10 @@ typedef struct {
     Counter numQueued;
     Counter freeListNodeCount;
     double freeListSizeMB;
-    Counter numCoalescedReports;
+    Counter numCoalescedReports;        // all reports dropped because a stronger access to the same path was reported
+    Counter numCoalescedBeforeEnqueue;  // the ones among them that were dropped before taking up a queue element
+    Counter numCacheGenerations;
+    Counter numDroppedCacheRecords;
 } ReportCounters;
 
 typedef struct {
@@ -233,6 +346,7 @@ typedef struct {
 typedef struct {
     uint numAttachedClients;
     AllCounters counters;
+    CallbackHistograms histograms;
     MemoryCountsAndSizes memory;
     KextConfig kextConfig;
     uint numReportedPips;
@@ -311,6 +425,62 @@ struct AccessReportGroup {
     }
 };
 
+#pragma mark Compact access report records
+
+// The shared report queue of the kext carries access reports as variable-length records: the fields of an
+// AccessReport followed by only as many bytes of its 'path' as are actually used (the fields that come after
+// 'path' are stored right after those).  A typical path being a fraction of MAXPATHLEN, this is what most of
+// the capacity of the queue used to go to.
+const size_t kAccessReportPathOffset    = offsetof(AccessReport, path);
+const size_t kAccessReportTrailerOffset = offsetof(AccessReport, path) + MAXPATHLEN;
+const size_t kAccessReportTrailerSize   = sizeof(AccessReport) - kAccessReportTrailerOffset;
+const size_t kAccessReportMinRecordSize = kAccessReportPathOffset + kAccessReportTrailerSize;
+
+/*!
+ * Writes the compact record of 'report' into 'record' (which must be at least sizeof(AccessReport) bytes long).
+ * Returns the size of the record.
+ */
+inline size_t PackAccessReport(const AccessReport &report, char *record)
+{
+    // the report of a completed process tree carries the pip's stats in place of the path
+    size_t pathSize = report.operation == kOpProcessTreeCompleted
+        ? sizeof(PipCompletionStats)
+        : strnlen(report.path, MAXPATHLEN - 1) + 1;
+
+    memcpy(record, &report, kAccessReportPathOffset);
+    memcpy(record + kAccessReportPathOffset, report.path, pathSize);
+    if (pathSize > 0 && report.operation != kOpProcessTreeCompleted)
+    {
+        // the path may have been truncated
+        record[kAccessReportPathOffset + pathSize - 1] = '\0';
+    }
+
+    memcpy(record + kAccessReportPathOffset + pathSize, (const char *)&report + kAccessReportTrailerOffset, kAccessReportTrailerSize);
+    return kAccessReportPathOffset + pathSize + kAccessReportTrailerSize;
+}
+
+/*!
+ * Reads a record written by 'PackAccessReport' into 'report'.  Returns false if the record is malformed.
+ */
+inline bool UnpackAccessReport(const char *record, size_t size, AccessReport *report)
+{
+    if (size < kAccessReportMinRecordSize || size > sizeof(AccessReport))
+    {
+        return false;
+    }
+
+    size_t pathSize = size - kAccessReportMinRecordSize;
+    memcpy(report, record, kAccessReportPathOffset);
+    memcpy(report->path, record + kAccessReportPathOffset, pathSize);
+    if (pathSize < MAXPATHLEN)
+    {
+        report->path[pathSize] = '\0';
+    }
+
+    memcpy((char *)report + kAccessReportTrailerOffset, record + kAccessReportPathOffset + pathSize, kAccessReportTrailerSize);
+    return true;
+}
+
 inline bool HasAnyFlags(const int source, const int bitMask)
 {
     return (source & bitMask) != 0;
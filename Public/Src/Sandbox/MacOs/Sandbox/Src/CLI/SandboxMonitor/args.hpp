@@ -11,6 +11,7 @@
   m(stacked,     bool,   false)                \
   m(no_header,   bool,   false)                \
   m(interactive, bool,   false)                \
+  m(json,        bool,   false)                \
   m(ps_fmt,      string, "%cpu,%mem,ucomm")
 
 GEN_CONFIG_DECL(ALL_ARGS)
@@ -45,6 +46,11 @@ void ConfigureArgs() {
         ->LongName("interactive")
         ->ShortName("i")
         ->Description("Runs the monitor continuously until interrupted.");
+
+    Config::argMeta(kArg_json)
+        ->LongName("json")
+        ->ShortName("j")
+        ->Description("Print every sample as a single line of JSON (one object per refresh) instead of a table.");
     
     Config::argMeta(kArg_ps_fmt)
         ->LongName("ps-fmt")
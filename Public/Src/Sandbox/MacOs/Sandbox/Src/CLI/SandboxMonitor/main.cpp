@@ -86,6 +86,30 @@ string renderCountAndSize(CountAndSize cnt)
     return str.str();
 }
 
+/*! Lower bound of the bucket holding the given percentile of the samples of 'histogram' */
+uint64_t histogramPercentile(Histogram histogram, double percentile)
+{
+    uint64_t total = 0;
+    for (uint i = 0; i < kHistogramBucketCount; i++) total += histogram.buckets[i].count();
+    if (total == 0) return 0;
+
+    uint64_t seen = 0;
+    for (uint i = 0; i < kHistogramBucketCount; i++)
+    {
+        seen += histogram.buckets[i].count();
+        if (seen * 100.0 >= percentile * total) return Histogram::BucketLowerBound(i);
+    }
+
+    return Histogram::BucketLowerBound(kHistogramBucketCount - 1);
+}
+
+string renderPercentiles(Histogram histogram)
+{
+    stringstream str;
+    str << histogramPercentile(histogram, 50) << "/" << histogramPercentile(histogram, 99);
+    return str.str();
+}
+
 string to_string(Counter cnt)         { return to_string(cnt.count()); }
 string to_string(DurationCounter cnt) { return renderCounterMicros(cnt); }
 string to_string(string str)          { return str; }
@@ -107,6 +131,8 @@ vector<vector<HeaderColumn<Tuple>>> getStackedHeaders(const Config &cfg)
             {   8, "#C+",     to_getter(t.pip.counters.numCacheHits) },
             {   8, "#C-",     to_getter(t.pip.counters.numCacheMisses) },
             {   8, "#C",      to_getter(t.pip.cacheSize) },
+            {   8, "avg(BF)", to_getter(t.pip.counters.resourceCounters.blockedForks) },
+            {   4, "#CG",     to_getter(t.pip.counters.reportCounters.numCacheGenerations) },
             {   4, "C%",      to_getter((int)floor(PERCENT(t.pip.counters.numCacheHits.count(), t.pip.counters.numCacheMisses.count()))) },
             {   8, "avg(FP)", to_getter(t.pip.counters.findTrackedProcess) },
             {   8, "avg(SP)", to_getter(t.pip.counters.setLastLookedUpPath) },
@@ -188,6 +214,112 @@ void renderProcesses(const Config *cfg, const Renderer<Tuple> *renderer, const I
     }
 }
 
+static string jsonString(const string &str)
+{
+    stringstream result;
+    result << '"';
+    for (char c : str)
+    {
+        if (c == '"' || c == '\\')  result << '\\' << c;
+        else if (c < 0x20)          result << "\\u" << hex << setw(4) << setfill('0') << (int)c << dec;
+        else                        result << c;
+    }
+    result << '"';
+    return result.str();
+}
+
+static string jsonCounter(DurationCounter cnt)
+{
+    stringstream str;
+    str << "{\"count\":" << cnt.count() << ",\"micros\":" << cnt.duration().micros() << "}";
+    return str.str();
+}
+
+static string jsonHistogram(Histogram histogram)
+{
+    stringstream str;
+    str << "[";
+    for (uint i = 0; i < kHistogramBucketCount; i++)
+    {
+        str << (i == 0 ? "" : ",") << histogram.buckets[i].count();
+    }
+    str << "]";
+    return str.str();
+}
+
+// Renders one sample as a single line of JSON, so that it can be streamed into other tools without scraping the table
+void renderJson(const IntrospectResponse *response, stringstream *output)
+{
+    const ResourceCounters *resources = &response->counters.resourceCounters;
+    const ReportCounters *reports = &response->counters.reportCounters;
+
+    *output << "{\"timestamp\":" << time(nullptr)
+            << ",\"numClients\":" << response->numAttachedClients
+            << ",\"reports\":{"
+            <<   "\"queued\":" << reports->numQueued.count()
+            <<   ",\"sent\":" << reports->totalNumSent.count()
+            <<   ",\"coalesced\":" << reports->numCoalescedReports.count()
+            <<   ",\"coalescedBeforeEnqueue\":" << reports->numCoalescedBeforeEnqueue.count()
+            <<   ",\"freeListNodes\":" << reports->freeListNodeCount.count()
+            << "},\"resources\":{"
+            <<   "\"availableRamMB\":" << resources->availableRamMB
+            <<   ",\"cpuUsage\":" << renderDouble(resources->cpuUsage.value / 100.0)
+            <<   ",\"smoothedCpuUsage\":" << renderDouble(resources->smoothedCpuUsage.value / 100.0)
+            <<   ",\"trackedProcesses\":" << resources->numTrackedProcesses
+            <<   ",\"blockedProcesses\":" << resources->numBlockedProcesses
+            <<   ",\"blockedForks\":" << jsonCounter(resources->blockedForks)
+            << "},\"counters\":{"
+            <<   "\"findTrackedProcess\":" << jsonCounter(response->counters.findTrackedProcess)
+            <<   ",\"checkPolicy\":" << jsonCounter(response->counters.checkPolicy)
+            <<   ",\"cacheLookup\":" << jsonCounter(response->counters.cacheLookup)
+            <<   ",\"reportFileAccess\":" << jsonCounter(response->counters.reportFileAccess)
+            <<   ",\"accessHandler\":" << jsonCounter(response->counters.accessHandler)
+            << "},\"histograms\":{"
+            <<   "\"lookup\":" << jsonHistogram(response->histograms.lookup)
+            <<   ",\"read\":" << jsonHistogram(response->histograms.read)
+            <<   ",\"write\":" << jsonHistogram(response->histograms.write)
+            <<   ",\"exec\":" << jsonHistogram(response->histograms.exec)
+            <<   ",\"fork\":" << jsonHistogram(response->histograms.fork)
+            <<   ",\"reportQueueDepth\":" << jsonHistogram(response->histograms.reportQueueDepth)
+            << "},\"pips\":[";
+
+    vector<PipInfo> pips = GetPips(response);
+    for (auto iPip = pips.begin(); iPip != pips.end(); ++iPip)
+    {
+        *output << (iPip == pips.begin() ? "" : ",")
+                << "{\"pipId\":" << jsonString(renderPipId(iPip->pipId))
+                << ",\"pid\":" << iPip->pid
+                << ",\"clientPid\":" << iPip->clientPid
+                << ",\"treeSize\":" << iPip->treeSize
+                << ",\"cacheSize\":" << iPip->cacheSize
+                << ",\"cacheHits\":" << iPip->counters.numCacheHits.count()
+                << ",\"cacheMisses\":" << iPip->counters.numCacheMisses.count()
+                << ",\"blockedForks\":" << jsonCounter(iPip->counters.resourceCounters.blockedForks)
+                << ",\"processes\":[";
+
+        bool first = true;
+        for (const ProcessInfo &proc : GetPipChildren(*iPip))
+        {
+            ProcessSample sample;
+            if (!sample_process(proc.pid, &sample)) continue;
+            *output << (first ? "" : ",")
+                    << "{\"pid\":" << sample.pid
+                    << ",\"ppid\":" << sample.ppid
+                    << ",\"name\":" << jsonString(sample.name)
+                    << ",\"cpu\":" << renderDouble(sample.cpuPercent)
+                    << ",\"mem\":" << renderDouble(sample.memPercent)
+                    << ",\"rssKB\":" << sample.rssBytes / 1024
+                    << ",\"threads\":" << sample.numThreads
+                    << "}";
+            first = false;
+        }
+
+        *output << "]}";
+    }
+
+    *output << "]}" << endl;
+}
+
 void printValidPsKeywords()
 {
     cout << "Valid keywords: ";
@@ -303,7 +435,7 @@ int main(int argc, const char * argv[])
         stringstream output;
         
         // render information about interactive mode
-        if (cfg.interactive)
+        if (cfg.interactive && !cfg.json)
         {
             output << "Every " << cfg.delay << "s: ";
             for (int i = 0; i < argc; i++)
@@ -319,6 +451,13 @@ int main(int argc, const char * argv[])
             break;
         }
 
+        if (cfg.json)
+        {
+            renderJson(&response, &output);
+            cout << output.str() << flush;
+            continue;
+        }
+
         // render header
         if (!cfg.no_header)
         {
@@ -361,6 +500,17 @@ int main(int argc, const char * argv[])
                    << ", #HardLink retries: " << to_string(response.counters.numHardLinkRetries)
                    << ", #CoalescedReports: " << to_string(response.counters.reportCounters.numCoalescedReports)
                    << " (" << renderDouble(PERCENT(response.counters.reportCounters.numCoalescedReports.count(), response.counters.reportCounters.totalNumSent.count())) << "%)"
+                   << ", #CoalescedBeforeEnqueue: " << to_string(response.counters.reportCounters.numCoalescedBeforeEnqueue)
+                   << " (" << renderDouble(DIV2(response.counters.reportCounters.numCoalescedBeforeEnqueue.count() * 100, response.counters.reportCounters.numCoalescedReports.count())) << "%)"
+                   << ", p50/p99(QueueDepth): " << renderPercentiles(response.histograms.reportQueueDepth)
+                   << endl;
+            output << "Latencies  :: "
+                   << "p50/p99(Lookup/Read/Write/Exec/Fork): "
+                   << renderPercentiles(response.histograms.lookup) << "us / "
+                   << renderPercentiles(response.histograms.read) << "us / "
+                   << renderPercentiles(response.histograms.write) << "us / "
+                   << renderPercentiles(response.histograms.exec) << "us / "
+                   << renderPercentiles(response.histograms.fork) << "us"
                    << endl;
             output << "Memory     :: "
                    << "FastTrieNodes: " << renderCountAndSize(response.memory.fastNodes)
@@ -374,8 +524,10 @@ int main(int argc, const char * argv[])
                    << ", #Pips: " << response.numReportedPips
                    << ", Available RAM: " << counters->availableRamMB << " MB"
                    << ", CPU usage: " << renderDouble(counters->cpuUsage.value / 100.0) << "%"
+                   << " (smoothed: " << renderDouble(counters->smoothedCpuUsage.value / 100.0) << "%)"
                    << ", #Processes [active: " << to_string(counters->numTrackedProcesses)
                    << ", blocked: " << to_string(counters->numBlockedProcesses) << "]"
+                   << ", Blocked forks: " << renderCounter(counters->blockedForks)
                    << endl
                    << endl;
             output << renderer.RenderHeader() << endl;
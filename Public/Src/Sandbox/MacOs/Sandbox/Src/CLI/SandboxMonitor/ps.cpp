@@ -5,6 +5,11 @@
 #include <array>
 #include <sstream>
 #include <regex>
+#include <map>
+#include <libproc.h>
+#include <mach/mach_time.h>
+#include <sys/sysctl.h>
+#include <sys/time.h>
 
 set<string> ps_keywords =
 {
@@ -29,10 +34,167 @@ string exec(const char *cmd)
     return result;
 }
 
+#pragma mark Native process sampling
+
+typedef struct {
+    uint64_t cpuNanos;
+    uint64_t wallNanos;
+} CpuSample;
+
+// the last CPU time observed for every process, so that '%cpu' reflects the time elapsed since the previous refresh
+static map<pid_t, CpuSample> s_lastCpuSamples;
+
+static uint64_t MachToNanos(uint64_t machTime)
+{
+    static mach_timebase_info_data_t timebase = { 0, 0 };
+    if (timebase.denom == 0)
+    {
+        mach_timebase_info(&timebase);
+    }
+
+    return machTime * timebase.numer / timebase.denom;
+}
+
+static uint64_t NowNanos()
+{
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    return now.tv_sec * NSEC_PER_SEC + now.tv_usec * NSEC_PER_USEC;
+}
+
+static uint64_t PhysicalMemoryBytes()
+{
+    static uint64_t memsize = 0;
+    if (memsize == 0)
+    {
+        size_t len = sizeof(memsize);
+        sysctlbyname("hw.memsize", &memsize, &len, nullptr, 0);
+    }
+
+    return memsize;
+}
+
+static string FormatCpuTime(uint64_t nanos)
+{
+    char buffer[32];
+    uint64_t centis = nanos / (NSEC_PER_SEC / 100);
+    snprintf(buffer, sizeof(buffer), "%llu:%02llu.%02llu", centis / 6000, (centis / 100) % 60, centis % 100);
+    return buffer;
+}
+
+static string FormatElapsedTime(uint64_t seconds)
+{
+    char buffer[32];
+    uint64_t days = seconds / 86400, hours = (seconds / 3600) % 24, mins = (seconds / 60) % 60, secs = seconds % 60;
+    if (days > 0)
+        snprintf(buffer, sizeof(buffer), "%llu-%02llu:%02llu:%02llu", days, hours, mins, secs);
+    else if (hours > 0)
+        snprintf(buffer, sizeof(buffer), "%02llu:%02llu:%02llu", hours, mins, secs);
+    else
+        snprintf(buffer, sizeof(buffer), "%02llu:%02llu", mins, secs);
+    return buffer;
+}
+
+static string FormatPercent(double value)
+{
+    char buffer[16];
+    snprintf(buffer, sizeof(buffer), "%.1f", value);
+    return buffer;
+}
+
+bool sample_process(pid_t pid, ProcessSample *sample)
+{
+    struct proc_taskallinfo info;
+    if (proc_pidinfo(pid, PROC_PIDTASKALLINFO, 0, &info, sizeof(info)) != sizeof(info))
+    {
+        s_lastCpuSamples.erase(pid);
+        return false;
+    }
+
+    uint64_t now        = NowNanos();
+    uint64_t startTime  = info.pbsd.pbi_start_tvsec * NSEC_PER_SEC + info.pbsd.pbi_start_tvusec * NSEC_PER_USEC;
+    sample->pid         = pid;
+    sample->ppid        = info.pbsd.pbi_ppid;
+    sample->uid         = info.pbsd.pbi_uid;
+    sample->name        = info.pbsd.pbi_name[0] != '\0' ? info.pbsd.pbi_name : info.pbsd.pbi_comm;
+    sample->rssBytes    = info.ptinfo.pti_resident_size;
+    sample->vszBytes    = info.ptinfo.pti_virtual_size;
+    sample->userNanos   = MachToNanos(info.ptinfo.pti_total_user);
+    sample->systemNanos = MachToNanos(info.ptinfo.pti_total_system);
+    sample->numThreads  = info.ptinfo.pti_threadnum;
+    sample->elapsedSecs = now > startTime ? (now - startTime) / NSEC_PER_SEC : 0;
+
+    // until there's a previous sample, the CPU usage is averaged over the lifetime of the process (like 'ps' does)
+    uint64_t cpuNanos = sample->userNanos + sample->systemNanos;
+    CpuSample previous = { 0, startTime };
+    auto it = s_lastCpuSamples.find(pid);
+    if (it != s_lastCpuSamples.end() && it->second.cpuNanos <= cpuNanos)
+    {
+        previous = it->second;
+    }
+
+    uint64_t wallDelta = now > previous.wallNanos ? now - previous.wallNanos : 0;
+    sample->cpuPercent = wallDelta == 0 ? 0 : 100.0 * (cpuNanos - previous.cpuNanos) / wallDelta;
+    sample->memPercent = PhysicalMemoryBytes() == 0 ? 0 : 100.0 * sample->rssBytes / PhysicalMemoryBytes();
+    s_lastCpuSamples[pid] = { cpuNanos, now };
+    return true;
+}
+
+// Renders a keyword that can be computed from a sample, returning false for any other keyword
+static bool render_keyword(const string &keyword, pid_t pid, const ProcessSample &sample, string *value)
+{
+    if      (keyword == "pid")                          *value = to_string(sample.pid);
+    else if (keyword == "ppid")                         *value = to_string(sample.ppid);
+    else if (keyword == "uid")                          *value = to_string(sample.uid);
+    else if (keyword == "ucomm")                        *value = sample.name;
+    else if (keyword == "%cpu")                         *value = FormatPercent(sample.cpuPercent);
+    else if (keyword == "%mem")                         *value = FormatPercent(sample.memPercent);
+    else if (keyword == "rss")                          *value = to_string(sample.rssBytes / 1024);
+    else if (keyword == "vsz")                          *value = to_string(sample.vszBytes / 1024);
+    else if (keyword == "utime")                        *value = FormatCpuTime(sample.userNanos);
+    else if (keyword == "time")                         *value = FormatCpuTime(sample.userNanos + sample.systemNanos);
+    else if (keyword == "etime")                        *value = FormatElapsedTime(sample.elapsedSecs);
+    else if (keyword == "comm")
+    {
+        char path[PROC_PIDPATHINFO_MAXSIZE];
+        *value = proc_pidpath(pid, path, sizeof(path)) > 0 ? path : sample.name;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
 string ps(pid_t pid, const string &cols)
 {
-    stringstream str;
-    str << "ps -p " << pid << " -o " << cols;
-    string stdout = exec(str.str().c_str());
-    return regex_replace(stdout, regex("\\s*\n$"), "");
+    ProcessSample sample;
+    if (!sample_process(pid, &sample))
+    {
+        return "";
+    }
+
+    // 'cols' is a comma-separated list of keywords, each followed by '=' (to suppress the 'ps' header)
+    stringstream result;
+    stringstream tokens(cols);
+    string token;
+    while (getline(tokens, token, ','))
+    {
+        string keyword = token.substr(0, token.find('='));
+        string value;
+        if (!render_keyword(keyword, pid, sample, &value))
+        {
+            // only spawn 'ps' for what can't be computed natively
+            stringstream cmd;
+            cmd << "ps -p " << pid << " -o " << keyword << "=";
+            value = regex_replace(exec(cmd.str().c_str()), regex("^\\s+|\\s*\n$"), "");
+        }
+
+        if (result.tellp() > 0)
+            result << " ";
+        result << value;
+    }
+
+    return result.str();
 }
@@ -6,10 +6,31 @@
 
 #import <string>
 #import <set>
+#import <unistd.h>
 
 using namespace std;
 
+/*!
+ * Per-process stats read directly from the kernel (via 'proc_pidinfo'), without spawning 'ps'.
+ */
+typedef struct {
+    pid_t pid;
+    pid_t ppid;
+    uid_t uid;
+    string name;
+    uint64_t rssBytes;
+    uint64_t vszBytes;
+    uint64_t userNanos;
+    uint64_t systemNanos;
+    uint64_t elapsedSecs;
+    int numThreads;
+    /*! CPU usage since the previous sample of the same process (or over its lifetime, for the first sample) */
+    double cpuPercent;
+    double memPercent;
+} ProcessSample;
+
 extern set<string> ps_keywords;
+bool sample_process(pid_t pid, ProcessSample *sample);
 string exec(const char *cmd);
 string ps(pid_t pid, const string &cols);
 
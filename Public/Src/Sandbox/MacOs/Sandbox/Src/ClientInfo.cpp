@@ -36,6 +36,7 @@ bool ClientInfo::init(const InitArgs& args)
     }
 
     frozen_          = false;
+    connected_       = true;
     reportCounters_  = args.counters;
 
     queue_ = ConcurrentSharedDataQueue::create(args);
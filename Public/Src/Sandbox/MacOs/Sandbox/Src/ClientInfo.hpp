@@ -45,6 +45,12 @@ private:
      */
     bool frozen_;
 
+    /*!
+     * Cleared when the client disconnects.  Pips keep the client they were started by (see 'SandboxedPip::bindClient'),
+     * so the client may outlive its connection; reports sent to it afterwards are rejected.
+     */
+    volatile bool connected_;
+
     /*!
      * Initializes this object, following the OSObject pattern.
      *
@@ -96,6 +102,12 @@ public:
      */
     bool enqueueReport(const EnqueueArgs &args);
 
+    /*! Marks this client as disconnected (see 'connected_') */
+    void disconnect() { connected_ = false; }
+
+    /*! Whether this client is still connected */
+    bool isConnected() const { return connected_; }
+
 #pragma mark Static Methods
 
     /*! Static factory method, following the OSObject pattern */
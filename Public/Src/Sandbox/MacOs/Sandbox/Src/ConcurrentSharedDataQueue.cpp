@@ -107,6 +107,8 @@ bool ConcurrentSharedDataQueue::init(const InitArgs& args)
     }
 
     drainingDone_                 = false;
+    consumerWaiting_              = 0;
+    numPendingReportShards_       = 0;
     unrecoverableFailureOccurred_ = false;
     reportCounters_               = args.counters;
     enableBatching_               = args.enableBatching;
@@ -117,6 +119,12 @@ bool ConcurrentSharedDataQueue::init(const InitArgs& args)
         return false;
     }
 
+    drainLock_ = BXLLockAlloc();
+    if (drainLock_ == nullptr)
+    {
+        return false;
+    }
+
     queue_ = IOSharedDataQueue::withCapacity((args.entrySize + DATA_QUEUE_ENTRY_HEADER_SIZE) * args.entryCount);
     if (queue_ == nullptr)
     {
@@ -129,20 +137,24 @@ bool ConcurrentSharedDataQueue::init(const InitArgs& args)
         return false;
     }
 
-    pendingReports_  = Alloc::New<Queue>(1);
+    pendingReports_  = Alloc::New<Queue>(kNumPendingReportShards);
     if (pendingReports_ == nullptr)
     {
         return false;
     }
 
-    QueueElem *dummy = Alloc::New<QueueElem>(1); // this is dealocated in lfds711_queue_umm_cleanup()
-    if (dummy == nullptr)
+    // init lock-free queues and free list
+    for (numPendingReportShards_ = 0; numPendingReportShards_ < kNumPendingReportShards; numPendingReportShards_++)
     {
-        return false;
+        QueueElem *dummy = Alloc::New<QueueElem>(1); // this is dealocated in lfds711_queue_umm_cleanup()
+        if (dummy == nullptr)
+        {
+            return false;
+        }
+
+        lfds711_queue_umm_init_valid_on_current_logical_core(&pendingReports_[numPendingReportShards_], dummy, nullptr);
     }
 
-    // init lock-free queue and free list
-    lfds711_queue_umm_init_valid_on_current_logical_core(pendingReports_, dummy, nullptr);
     lfds711_freelist_init_valid_on_current_logical_core(freeList_, nullptr, 0, nullptr);
 
     // init consumer thread
@@ -171,22 +183,33 @@ void ConcurrentSharedDataQueue::free()
     // wait for consumer thread to finish
     if (consumerThread_ != nullptr)
     {
+        if (drainLock_ != nullptr)
+        {
+            // the consumer thread checks 'drainingDone_' while holding 'drainLock_' before going to sleep
+            BXLLockLock(drainLock_);
+            BXLLockWakeup(drainLock_, (void*)&consumerWaiting_, /*oneThread*/ true);
+            BXLLockUnlock(drainLock_);
+        }
+
         consumerThread_->join();
     }
 
     LFDS711_MISC_MAKE_VALID_ON_CURRENT_LOGICAL_CORE_INITS_COMPLETED_BEFORE_NOW_ON_ANY_OTHER_LOGICAL_CORE;
 
-    // purge any left over elements in the queue (can happen if the client exits abnormally)
+    // purge any left over elements in the queues (can happen if the client exits abnormally)
     if (pendingReports_ != nullptr)
     {
-        QueueElem *e;
-        while (lfds711_queue_umm_dequeue(pendingReports_, &e)) releaseElem(e);
-        lfds711_queue_umm_cleanup(pendingReports_, [](Queue *q, QueueElem *e, lfds711_misc_flag flag)
-                                  {
-                                      Alloc::Delete<QueueElem>(e, 1);
-                                  });
+        for (uint shard = 0; shard < numPendingReportShards_; shard++)
+        {
+            QueueElem *e;
+            while (lfds711_queue_umm_dequeue(&pendingReports_[shard], &e)) releaseElem(e);
+            lfds711_queue_umm_cleanup(&pendingReports_[shard], [](Queue *q, QueueElem *e, lfds711_misc_flag flag)
+                                      {
+                                          Alloc::Delete<QueueElem>(e, 1);
+                                      });
+        }
 
-        Alloc::Delete<Queue>(pendingReports_, 1);
+        Alloc::Delete<Queue>(pendingReports_, kNumPendingReportShards);
         pendingReports_ = nullptr;
     }
 
@@ -215,6 +238,12 @@ void ConcurrentSharedDataQueue::free()
         lock_ = nullptr;
     }
 
+    if (drainLock_ != nullptr)
+    {
+        BXLLockFree(drainLock_);
+        drainLock_ = nullptr;
+    }
+
     OSSafeReleaseNULL(consumerThread_);
     OSSafeReleaseNULL(queue_);
 
@@ -225,9 +254,15 @@ long long ConcurrentSharedDataQueue::getCount() const
 {
     LFDS711_MISC_MAKE_VALID_ON_CURRENT_LOGICAL_CORE_INITS_COMPLETED_BEFORE_NOW_ON_ANY_OTHER_LOGICAL_CORE;
 
-    long long count;
-    lfds711_queue_umm_query(pendingReports_, LFDS711_QUEUE_UMM_QUERY_SINGLETHREADED_GET_COUNT, NULL, &count);
-    return count;
+    long long total = 0;
+    for (uint shard = 0; shard < numPendingReportShards_; shard++)
+    {
+        long long count;
+        lfds711_queue_umm_query(&pendingReports_[shard], LFDS711_QUEUE_UMM_QUERY_SINGLETHREADED_GET_COUNT, NULL, &count);
+        total += count;
+    }
+
+    return total;
 }
 
 void ConcurrentSharedDataQueue::setNotificationPort(mach_port_t port)
@@ -290,7 +325,9 @@ bool ConcurrentSharedDataQueue::enqueueWithLocking(const EnqueueArgs &args)
 
 bool ConcurrentSharedDataQueue::sendReport(const AccessReport &report)
 {
-    bool sent = queue_->enqueue((void*)&report, sizeof(AccessReport));
+    char record[sizeof(AccessReport)];
+    size_t recordSize = PackAccessReport(report, record);
+    bool sent = queue_->enqueue(record, (UInt32)recordSize);
     if (!sent)
     {
         log_error("Could not send data to shared queue from TID(%lld)", thread_tid(current_thread()));
@@ -310,20 +347,70 @@ bool ConcurrentSharedDataQueue::enqueueWithBatching(const EnqueueArgs &args)
 {
     LFDS711_MISC_MAKE_VALID_ON_CURRENT_LOGICAL_CORE_INITS_COMPLETED_BEFORE_NOW_ON_ANY_OTHER_LOGICAL_CORE;
 
+    // The caller has already checked (and updated) the cache record, but a stronger access to the same path may have
+    // been recorded since (e.g., by a concurrent write): in that case this report is redundant, and dropping it here
+    // saves a queue element.  A stronger access that comes after this point is caught when the queue is drained.
+    if (isCoalesced(args.report, args.cacheRecord))
+    {
+        reportCounters_->numCoalescedBeforeEnqueue++;
+        return true;
+    }
+
     QueueElem *elem = allocateElem(args);
     if (elem == nullptr)
     {
         return false;
     }
 
-    lfds711_queue_umm_enqueue(pendingReports_, elem);
+    lfds711_queue_umm_enqueue(&pendingReports_[shardFor(args.report)], elem);
     reportCounters_->numQueued++;
+    g_bxl_callback_histograms.reportQueueDepth.Add(reportCounters_->numQueued.count());
+
+    // While the consumer thread keeps up with the reports it never goes to sleep, so this costs no wakeup at all.
+    // (OSCompareAndSwap is a full barrier, so the enqueued element is visible to the consumer thread before the
+    // flag is checked; see 'drainQueue' for the other side)
+    if (OSCompareAndSwap(1, 0, &consumerWaiting_))
+    {
+        wakeUpConsumer();
+    }
 
     return true;
 }
 
-static uint s_backoffIntervalsMs[] = {1, 2, 4, 8, 16, 32, 64};
-static uint s_backoffIntervalsLen = sizeof(s_backoffIntervalsMs) / sizeof(s_backoffIntervalsMs[0]);
+void ConcurrentSharedDataQueue::wakeUpConsumer()
+{
+    // the consumer thread holds 'drainLock_' from raising the flag until it falls asleep, so the wakeup can't be lost
+    BXLLockLock(drainLock_);
+    BXLLockWakeup(drainLock_, (void*)&consumerWaiting_, /*oneThread*/ true);
+    BXLLockUnlock(drainLock_);
+}
+
+bool ConcurrentSharedDataQueue::isCoalesced(const AccessReport &report, const CacheRecord *cacheRecord)
+{
+    if (cacheRecord != nullptr && cacheRecord->HasStrongerRequestedAccess((RequestedAccess)report.requestedAccess))
+    {
+        reportCounters_->numCoalescedReports++;
+        return true;
+    }
+
+    return false;
+}
+
+bool ConcurrentSharedDataQueue::dequeuePendingReport(uint *shard, QueueElem **elem)
+{
+    // taking one report from each queue in turn keeps a busy pip from starving the others
+    for (uint i = 0; i < kNumPendingReportShards; i++)
+    {
+        uint current = (*shard + i) % kNumPendingReportShards;
+        if (lfds711_queue_umm_dequeue(&pendingReports_[current], elem) && *elem != nullptr)
+        {
+            *shard = (current + 1) % kNumPendingReportShards;
+            return true;
+        }
+    }
+
+    return false;
+}
 
 void ConcurrentSharedDataQueue::drainQueue()
 {
@@ -334,31 +421,36 @@ void ConcurrentSharedDataQueue::drainQueue()
 
     LFDS711_MISC_MAKE_VALID_ON_CURRENT_LOGICAL_CORE_INITS_COMPLETED_BEFORE_NOW_ON_ANY_OTHER_LOGICAL_CORE;
 
-    uint backoffCounter = 0;
+    uint shard = 0;
     while (!drainingDone_)
     {
         QueueElem *elem;
-        if (!lfds711_queue_umm_dequeue(pendingReports_, &elem) || elem == nullptr)
+        if (!dequeuePendingReport(&shard, &elem))
         {
-            uint backoffIndex = backoffCounter < s_backoffIntervalsLen ? backoffCounter : s_backoffIntervalsLen - 1;
-            IOSleep(/*milliseconds*/ s_backoffIntervalsMs[backoffIndex]);
-            ++backoffCounter;
-            continue;
+            BXLLockLock(drainLock_);
+
+            // Raise the flag and check the queue once more before going to sleep: an enqueuer that
+            // came before the flag was raised won't wake us up, but its report is visible by now.
+            OSCompareAndSwap(0, 1, &consumerWaiting_);
+            bool found = dequeuePendingReport(&shard, &elem);
+            if (!found && !drainingDone_)
+            {
+                BXLLockSleep(drainLock_, (void*)&consumerWaiting_, THREAD_UNINT);
+            }
+
+            consumerWaiting_ = 0;
+            BXLLockUnlock(drainLock_);
+
+            if (!found)
+            {
+                continue;
+            }
         }
 
-        backoffCounter = 0;
         reportCounters_->numQueued--;
         ElemPayload *payload = getValue(elem);
 
-        if (payload->cacheRecord == nullptr)
-        {
-            sendReport(payload->report);
-        }
-        else if (payload->cacheRecord->HasStrongerRequestedAccess((RequestedAccess)payload->report.requestedAccess))
-        {
-            reportCounters_->numCoalescedReports++;
-        }
-        else
+        if (!isCoalesced(payload->report, payload->cacheRecord))
         {
             sendReport(payload->report);
         }
@@ -81,7 +81,7 @@ private:
     /*!
      * Whether or not batching is enabled.
      *
-     * When enabled, all reports are first added to a lock-free queue ('pendingReports_')
+     * When enabled, all reports are first added to lock-free queues ('pendingReports_')
      * and a dedicated thread is used to drain it.  Otherwise, reports are added directly
      * to a shared IO queue ('queue_') (which is done in a critical section, since the
      * shared IO queue is not thread-safe).
@@ -96,12 +96,40 @@ private:
      */
     FreeList *freeList_;
 
+    /*! Number of lock-free queues in 'pendingReports_' */
+    static const uint kNumPendingReportShards = 8;
+
     /*!
-     * A lock-free queue where reports are batched before being sent to the client.
+     * Lock-free queues where reports are batched before being sent to the client.
      * This is used only if batching is enabled (see 'enableBatching_').
+     *
+     * A single queue makes all the CPUs that are reporting at the same time contend on its tail.  Instead,
+     * every pip gets its reports queued to one of these (see 'shardFor'), so concurrently running pips
+     * mostly don't get in each other's way.  Because all the reports of a pip go through the same queue,
+     * they still reach the client in the order in which they were reported (which matters, e.g., for
+     * the report announcing that the process tree of a pip has completed, which must come last), while
+     * the reports of different pips don't need to be ordered with respect to each other.
      */
     Queue *pendingReports_;
 
+    /*! Number of queues in 'pendingReports_' that have been initialized (all of them, unless 'init' failed) */
+    uint numPendingReportShards_;
+
+    static inline uint shardFor(const AccessReport &report)
+    {
+        uint64_t pipId = (uint64_t)report.pipId;
+        return (uint)((pipId ^ (pipId >> 32) ^ (pipId >> 17)) % kNumPendingReportShards);
+    }
+
+    /*!
+     * Whether 'report' is made redundant by a stronger access to the same path recorded in 'cacheRecord'
+     * (in which case it is counted as a coalesced report and must not be sent).
+     */
+    bool isCoalesced(const AccessReport &report, const CacheRecord *cacheRecord);
+
+    /*! Dequeues a pending report, visiting the queues in 'pendingReports_' round-robin starting at 'shard'. */
+    bool dequeuePendingReport(uint *shard, QueueElem **elem);
+
     /*!
      * A dedicated thread for draining 'pendingReports_'.
      * If batching is not enabled, this thread immediately finished without doing any work.
@@ -113,8 +141,22 @@ private:
      */
     volatile bool drainingDone_;
 
+    /*!
+     * Lock on which 'consumerThread_' sleeps (on the 'consumerWaiting_' event) while 'pendingReports_' is empty.
+     */
+    BXLLock *drainLock_;
+
+    /*!
+     * Raised by 'consumerThread_' right before it goes to sleep, and cleared by whoever sees it first:
+     * an enqueuer that clears it has to wake the consumer thread up (see 'wakeUpConsumer').
+     */
+    volatile UInt32 consumerWaiting_;
+
     void drainQueue();
 
+    /*! Wakes up 'consumerThread_' (if it's currently sleeping or about to go to sleep) */
+    void wakeUpConsumer();
+
     /*!
      * Indicates if an unrecoverable error has occured. This happens when the sandbox was not able to successfully
      * enqueue an access report message. There is no logic to recover from this and mostly indicates that either a)
@@ -115,12 +115,8 @@ const char *CheckValidUnixManifestTreeRoot(PCManifestRecord node)
     return nullptr;
 }
 
-bool FileAccessManifestParseResult::init(const BYTE *payload, size_t payloadSize)
+bool FileAccessManifestParseResult::ParseHeader(const BYTE *&payloadCursor)
 {
-    if (payloadSize == 0 || payload == nullptr) return true;
-
-    const BYTE *payloadCursor = payload;
-
     do
     {
         debugFlag_ = ParseAndAdvancePointer<PCManifestDebugFlag>(payloadCursor);
@@ -187,17 +183,43 @@ bool FileAccessManifestParseResult::init(const BYTE *payload, size_t payloadSize
                 SkipOverCharArray(payloadCursor); // 'ArgumentMatch'
             }
         }
+    } while(false);
 
-        root_ = Parse<PCManifestRecord>(payloadCursor);
-        error_ = root_->CheckValid();
-        if (HasErrors()) continue;
+    return !HasErrors();
+}
 
-        error_ = CheckValidUnixManifestTreeRoot(root_);
-    } while(false);
+bool FileAccessManifestParseResult::ParseTree(const BYTE *tree)
+{
+    root_ = Parse<PCManifestRecord>(tree);
+    error_ = root_->CheckValid();
+    if (HasErrors()) return false;
 
+    error_ = CheckValidUnixManifestTreeRoot(root_);
     return !HasErrors();
 }
 
+bool FileAccessManifestParseResult::init(const BYTE *payload, size_t payloadSize)
+{
+    if (payloadSize == 0 || payload == nullptr) return true;
+
+    const BYTE *payloadCursor = payload;
+    return ParseHeader(payloadCursor) && ParseTree(payloadCursor);
+}
+
+bool FileAccessManifestParseResult::init(const BYTE *header, size_t headerSize, const BYTE *tree)
+{
+    const BYTE *headerCursor = header;
+    if (!ParseHeader(headerCursor)) return false;
+
+    if (headerCursor != header + headerSize)
+    {
+        error_ = "Manifest header does not end where the manifest tree is expected to start";
+        return false;
+    }
+
+    return ParseTree(tree);
+}
+
 // Debugging helper
 void FileAccessManifestParseResult::PrintManifestTree(PCManifestRecord node,
                                                       const int indent,
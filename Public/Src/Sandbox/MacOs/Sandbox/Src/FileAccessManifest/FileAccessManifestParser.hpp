@@ -39,16 +39,28 @@ private:
         return result;
     }
 
+    /*! Parses everything preceding the manifest tree, leaving 'payloadCursor' where the tree starts */
+    bool ParseHeader(const BYTE *&payloadCursor);
+    bool ParseTree(const BYTE *tree);
+
 public:
 
     FileAccessManifestParseResult() {}
 
     bool init(const BYTE *payload, size_t payloadSize);
 
+    /*!
+     * Same as above, except the manifest tree is taken from 'tree' instead of following the header bytes (as it does in
+     * 'payload'), so that manifests with the same tree can share one copy of it (see 'GetManifestTreeOffset').
+     */
+    bool init(const BYTE *header, size_t headerSize, const BYTE *tree);
+
     inline bool IsValid() const                                   { return error_ == nullptr; }
     inline bool HasErrors() const                                 { return !IsValid(); }
     inline const char* Error() const                              { return error_; }
     inline PCManifestRecord GetManifestRootNode() const           { return root_; }
+    /*! Offset of the manifest tree within the payload this manifest was parsed from (i.e., the size of the header) */
+    inline size_t GetManifestTreeOffset(const BYTE *payload) const { return (const BYTE *)root_ - payload; }
     inline PCManifestRecord GetUnixRootNode() const               { return root_->BucketCount > 0 ? root_->GetChildRecord(0) : root_; }
     inline PCManifestPipId GetPipId() const                       { return pipId_; }
     inline FileAccessManifestFlag GetFamFlags() const             { return static_cast<FileAccessManifestFlag>(flags_->Flags); }
@@ -166,6 +166,50 @@ PolicyResult AccessHandler::PolicyForPath(const char *absolutePath)
     return PolicyResult(GetPip()->getFamFlags(), GetPip()->getFamExtraFlags(), absolutePath, cursor);
 }
 
+PolicyResult AccessHandler::PolicyForPath(const char *absolutePath, LookedUpPath *lookup)
+{
+    size_t length = strlen(absolutePath);
+    if (!lookup->isUnderParent(absolutePath, length))
+    {
+        return PolicyForPath(absolutePath);
+    }
+
+    size_t parentLength = lookup->parentLength();
+    PolicySearchCursor parent;
+    if (!lookup->tryGetParentPolicy(&parent))
+    {
+        char parentPath[MAXPATHLEN];
+        strlcpy(parentPath, absolutePath, parentLength + 1);
+        parent = FindManifestRecord(parentPath, parentLength - 1);
+        lookup->setParentPolicy(parent);
+    }
+
+    if (!parent.IsValid())
+    {
+        return PolicyForPath(absolutePath);
+    }
+
+    // Resuming the search from the parent is equivalent to searching the whole path (see 'PolicySearchCursor')
+    const char *name = absolutePath + parentLength + 1;
+    PolicySearchCursor cursor = FindFileAccessPolicyInTreeEx(parent, name, length - parentLength - 1);
+    return PolicyResult(GetPip()->getFamFlags(), GetPip()->getFamExtraFlags(), absolutePath, cursor);
+}
+
+PolicyResult AccessHandler::PolicyForSyscallPath(const char *path)
+{
+    LookedUpPath *lastLookup = GetPip()->getLastLookedUpPath();
+    if (lastLookup == nullptr)
+    {
+        return PolicyForPath(IgnoreCatalinaDataPartitionPrefix(path));
+    }
+
+    const char *absolutePath = lastLookup->matches(path)
+        ? lastLookup->normalizedPath()
+        : IgnoreCatalinaDataPartitionPrefix(path);
+
+    return PolicyForPath(absolutePath, lastLookup);
+}
+
 #define VATTR_GET(vp, ctx, vap, attr, errno, result) \
 do {                                      \
   VATTR_INIT(vap);                        \
@@ -183,45 +227,43 @@ static int GetUniqueFileId(const vnode_t vp, const vfs_context_t ctx, uint64_t *
     return errno;
 }
 
-static bool VNodeMatchesPath(vnode_t vp, vfs_context_t ctx, const char *path)
+// The file id of the vnode 'path' leads to
+static int LookUpFileId(const char *path, vfs_context_t ctx, uint64_t *result)
 {
-    if (path == nullptr)
-    {
-        return false;
-    }
-
     vnode_t vpp = nullptr;
-    bool result = false;
-    do
+    int errno = vnode_lookup(path, 0, &vpp, ctx); // must release calling vnode_put
+    if (errno != 0)
     {
-        int errno = vnode_lookup(path, 0, &vpp, ctx); // must release calling vnode_put
-        if (errno != 0)
-        {
-            break;
-        }
+        return errno;
+    }
 
-        uint64_t vp_fileid, vpp_fileid;
-        errno = GetUniqueFileId(vp, ctx, &vp_fileid);
-        if (errno != 0)
-        {
-            break;
-        }
+    errno = GetUniqueFileId(vpp, ctx, result);
+    vnode_put(vpp);
+    return errno;
+}
 
-        errno = GetUniqueFileId(vpp, ctx, &vpp_fileid);
-        if (errno != 0)
-        {
-            break;
-        }
+// Whether the last looked up path leads to 'vp'.  The file id of the path is only looked up the first time, and again when
+// it does not match anymore (the path may have been replaced in the meantime).
+static bool VNodeMatchesLookup(vnode_t vp, vfs_context_t ctx, LookedUpPath *lookup)
+{
+    uint64_t vp_fileid, lookup_fileid;
+    if (GetUniqueFileId(vp, ctx, &vp_fileid) != 0)
+    {
+        return false;
+    }
 
-        result = vp_fileid == vpp_fileid;
-    } while (0);
+    if (lookup->tryGetFileId(&lookup_fileid) && lookup_fileid == vp_fileid)
+    {
+        return true;
+    }
 
-    if (vpp != nullptr)
+    if (LookUpFileId(lookup->path(), ctx, &lookup_fileid) != 0)
     {
-        vnode_put(vpp);
+        return false;
     }
 
-    return result;
+    lookup->setFileId(lookup_fileid);
+    return lookup_fileid == vp_fileid;
 }
 
 const char* AccessHandler::IgnoreCatalinaDataPartitionPrefix(const char* path)
@@ -250,18 +292,18 @@ bool AccessHandler::CheckAccess(vnode_t vp,
     checker(*policy, isDir, result);
 
     bool notAllowed = result->GetFileAccessStatus() != FileAccessStatus_Allowed;
-    const char *lastLookupPath;
+    LookedUpPath *lastLookup;
     // special handling for denied accesses to files with multiple hard links
     if (
-        notAllowed &&                                               // access is denied for current policy
-        (lastLookupPath = GetPip()->getLastLookedUpPath()) &&       // we remembered a path that was last looked up
-        strncmp(lastLookupPath, policy->Path(), MAXPATHLEN) != 0 && // that path is different from the policy path
-        VNodeMatchesPath(vp, ctx, lastLookupPath))                  // both paths point to the same vnode
+        notAllowed &&                                                   // access is denied for current policy
+        (lastLookup = GetPip()->getLastLookedUpPath()) &&               // we remembered a path that was last looked up
+        strncmp(lastLookup->path(), policy->Path(), MAXPATHLEN) != 0 && // that path is different from the policy path
+        VNodeMatchesLookup(vp, ctx, lastLookup))                        // both paths point to the same vnode
     {
         // update policy and check again
         sandbox_->Counters()->numHardLinkRetries++;
 
-        *policy = PolicyForPath(IgnoreCatalinaDataPartitionPrefix(lastLookupPath));
+        *policy = PolicyForPath(lastLookup->normalizedPath(), lastLookup);
         checker(*policy, isDir, result);
         return true;
     }
@@ -281,7 +323,7 @@ AccessCheckResult AccessHandler::CheckAndReportInternal(FileOperation operation,
     Stopwatch stopwatch;
 
     // 1: check operation against given policy
-    PolicyResult policy = PolicyForPath(IgnoreCatalinaDataPartitionPrefix(path));
+    PolicyResult policy = PolicyForSyscallPath(path);
     AccessCheckResult result = AccessCheckResult::Invalid();
     if (vp != nullptr && ctx != nullptr)
     {
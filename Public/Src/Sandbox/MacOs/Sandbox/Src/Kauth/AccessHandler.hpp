@@ -46,7 +46,6 @@ private:
         }
     }
 
-    const char *IgnoreCatalinaDataPartitionPrefix(const char* path);
     const char *kCatalinaDataPartitionPrefix = "/System/Volumes/Data/";
     const size_t kAdjustedCatalinaPrefixLength = strlen("/System/Volumes/Data");
 
@@ -58,6 +57,27 @@ protected:
 
     PolicySearchCursor FindManifestRecord(const char *absolutePath, size_t pathLength = -1);
 
+    const char *IgnoreCatalinaDataPartitionPrefix(const char* path);
+
+    /*!
+     * Same as 'PolicyForPath(absolutePath)', except that the policy search starts from the policy of the parent
+     * directory of 'lookup' when 'absolutePath' is in that directory.  The policy of the parent directory is
+     * searched the first time it is needed and kept in 'lookup' for the callbacks that follow.
+     *
+     * @param absolutePath Absolute path, without the data partition prefix
+     * @param lookup Path last looked up by the current thread
+     */
+    PolicyResult PolicyForPath(const char *absolutePath, LookedUpPath *lookup);
+
+    /*!
+     * Returns the policy for 'path' as reported by a MACF callback.
+     *
+     * The callbacks for one syscall (a lookup, then a read or a write) all go through the path that was last looked
+     * up by the current thread, so that path is only normalized once (see 'IgnoreCatalinaDataPartitionPrefix') and
+     * the policy of its parent directory is only searched once.
+     */
+    PolicyResult PolicyForSyscallPath(const char *path);
+
     void LogAccessDenied(const char *path, kauth_action_t action, const char *errorMessage = "");
 
     /*!
@@ -77,7 +97,8 @@ protected:
      * called from the handler for MAC_LOOKUP (because there we get paths as requested by the process).
      *
      * This method first applies a given 'checker' function against a given 'policy' object.  If the access is
-     * denied, only then the policy is updated with the last looked up path and the check is performed again.
+     * denied, only then the policy is updated with the last looked up path and the check is performed again, provided
+     * the path leads to 'vp' (by file id, which is only looked up again when it stops matching, see 'LookedUpPath').
      *
      * @param vp Vnode corresponding to the path from 'policy->Path()'
      * @param ctx Current VFS context
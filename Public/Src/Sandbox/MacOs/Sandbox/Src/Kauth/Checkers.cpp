@@ -3,91 +3,114 @@
 
 #include "Checkers.hpp"
 
-static void checkExecute(PolicyResult policy, bool isDir, AccessCheckResult *checkResult)
+// Every checker evaluates one of these against the policy of the path
+enum class CheckPrimitive
 {
-    RequestedReadAccess requestedAccess = isDir
-        ? RequestedReadAccess::Probe
-        : RequestedReadAccess::Read;
-    
-    *checkResult = policy.CheckReadAccess(requestedAccess, FileReadContext(FileExistence::Existent, isDir));
-}
+    ReadAccess,
+    Lookup,
+    Enumerate,
+    WriteAccess,
+    SymlinkCreation,
+    DirectoryCreation,
+    // Directory creation access, falling back to a probe when the creation is denied (CODESYNC: CreateDirectoryW in DetouredFunctions.cpp)
+    DirectoryCreationOrProbe,
+};
 
-static void checkProbe(PolicyResult policy, bool isDir, AccessCheckResult *checkResult)
+typedef struct
 {
-    *checkResult = policy.CheckReadAccess(RequestedReadAccess::Probe, FileReadContext(FileExistence::Existent, isDir));
-}
+    CheckPrimitive primitive;
+    // Only used by the read accesses (and the fallback of DirectoryCreationOrProbe)
+    RequestedReadAccess readAccess;
+    FileExistence existence;
+} CheckEntry;
 
-static void checkRead(PolicyResult policy, bool isDir, AccessCheckResult *checkResult)
+enum class Check
 {
-    if (isDir)
-    {
-        Checkers::CheckEnumerateDir(policy, isDir, checkResult);
-    }
-    else
-    {
-        *checkResult = policy.CheckReadAccess(RequestedReadAccess::Read, FileReadContext(FileExistence::Existent, isDir));
-    }
-}
+    Execute,
+    Read,
+    Lookup,
+    Write,
+    Probe,
+    ReadWrite,
+    EnumerateDir,
+    CreateSymlink,
+    CreateDirectory,
+    CreateDirectoryNoEnforcement,
+    Count
+};
 
-static void checkLookup(PolicyResult policy, bool isDir, AccessCheckResult *checkResult)
-{
-    *checkResult = policy.CheckReadAccess(RequestedReadAccess::Probe, FileReadContext(FileExistence::Nonexistent));
-    checkResult->Access = RequestedAccess::Lookup;
-}
+#define CHECK_ENTRY(primitive, readAccess, existence) { CheckPrimitive::primitive, RequestedReadAccess::readAccess, FileExistence::existence }
+#define NO_READ(primitive) CHECK_ENTRY(primitive, None, Existent)
 
-static void checkEnumerateDir(PolicyResult policy, bool isDir, AccessCheckResult *checkResult)
+// What every checker does, for a file (first) and for a directory. A checker is a single evaluation of its entry, which the
+// compiler folds into the checker since the table is a constant.
+static constexpr CheckEntry s_checks[(int)Check::Count][2] =
 {
-    *checkResult = AccessCheckResult(
-        RequestedAccess::Enumerate,
-        ResultAction::Allow,
-        policy.ReportDirectoryEnumeration() ? ReportLevel::ReportExplicit : ReportLevel::Ignore);
-}
+    /* Execute */                       { CHECK_ENTRY(ReadAccess, Read, Existent),  CHECK_ENTRY(ReadAccess, Probe, Existent) },
+    /* Read */                          { CHECK_ENTRY(ReadAccess, Read, Existent),  NO_READ(Enumerate) },
+    /* Lookup */                        { CHECK_ENTRY(Lookup, Probe, Nonexistent),  CHECK_ENTRY(Lookup, Probe, Nonexistent) },
+    /* Write */                         { NO_READ(WriteAccess),                     CHECK_ENTRY(ReadAccess, Probe, Existent) },
+    /* Probe */                         { CHECK_ENTRY(ReadAccess, Probe, Existent), CHECK_ENTRY(ReadAccess, Probe, Existent) },
+    // Read/write accesses have only ever been checked for their read side
+    /* ReadWrite */                     { CHECK_ENTRY(ReadAccess, Read, Existent),  NO_READ(Enumerate) },
+    /* EnumerateDir */                  { NO_READ(Enumerate),                       NO_READ(Enumerate) },
+    /* CreateSymlink */                 { NO_READ(SymlinkCreation),                 NO_READ(SymlinkCreation) },
+    /* CreateDirectory */               { NO_READ(DirectoryCreation),               NO_READ(DirectoryCreation) },
+    /* CreateDirectoryNoEnforcement */  { CHECK_ENTRY(DirectoryCreationOrProbe, Probe, Existent), CHECK_ENTRY(DirectoryCreationOrProbe, Probe, Existent) },
+};
 
-static void checkWrite(PolicyResult policy, bool isDir, AccessCheckResult *checkResult)
-{
-    *checkResult = isDir
-        ? policy.CheckReadAccess(RequestedReadAccess::Probe, FileReadContext(FileExistence::Existent, isDir))
-        : policy.CheckWriteAccess();
-}
+#undef NO_READ
+#undef CHECK_ENTRY
 
-static void checkReadWrite(PolicyResult policy, bool isDir, AccessCheckResult *checkResult)
+static inline AccessCheckResult evaluate(const CheckEntry &entry, const PolicyResult &policy, bool isDir)
 {
-    AccessCheckResult readResult = AccessCheckResult::Invalid();
-    checkRead(policy, isDir, &readResult);
-
-    AccessCheckResult writeResult = AccessCheckResult::Invalid();
-    checkRead(policy, isDir, &writeResult);
-
-    *checkResult = AccessCheckResult::Combine(readResult, writeResult);
-}
-
-static void checkCreateSymlink(PolicyResult policy, bool isDir, AccessCheckResult *checkResult)
-{
-    *checkResult = policy.CheckSymlinkCreationAccess();
-}
+    switch (entry.primitive)
+    {
+        case CheckPrimitive::ReadAccess:
+            return policy.CheckReadAccess(entry.readAccess, FileReadContext(entry.existence, isDir));
+        case CheckPrimitive::Lookup:
+        {
+            // A lookup is about a path that is not there, whatever it was looked up as
+            AccessCheckResult result = policy.CheckReadAccess(entry.readAccess, FileReadContext(entry.existence));
+            result.Access = RequestedAccess::Lookup;
+            return result;
+        }
+        case CheckPrimitive::Enumerate:
+            return AccessCheckResult(
+                RequestedAccess::Enumerate,
+                ResultAction::Allow,
+                policy.ReportDirectoryEnumeration() ? ReportLevel::ReportExplicit : ReportLevel::Ignore);
+        case CheckPrimitive::WriteAccess:
+            return policy.CheckWriteAccess();
+        case CheckPrimitive::SymlinkCreation:
+            return policy.CheckSymlinkCreationAccess();
+        case CheckPrimitive::DirectoryCreation:
+            return policy.CheckCreateDirectoryAccess();
+        case CheckPrimitive::DirectoryCreationOrProbe:
+        {
+            AccessCheckResult result = policy.CheckCreateDirectoryAccess();
+            return result.ShouldDenyAccess()
+                ? policy.CheckReadAccess(entry.readAccess, FileReadContext(entry.existence, isDir))
+                : result;
+        }
+    }
 
-static void checkCreateDirectory(PolicyResult policy, bool isDir, AccessCheckResult *checkResult)
-{
-    *checkResult = policy.CheckCreateDirectoryAccess();
+    return AccessCheckResult::Invalid();
 }
 
-static void checkCreateDirectoryNoEnforcement(PolicyResult policy, bool isDir, AccessCheckResult *checkResult)
+template <Check check>
+static void checker(PolicyResult policy, bool isDir, AccessCheckResult *checkResult)
 {
-    // CODESYNC: CreateDirectoryW in DetouredFunctions.cpp
-    *checkResult = policy.CheckCreateDirectoryAccess();
-    if (checkResult->ShouldDenyAccess())
-    {
-        checkProbe(policy, isDir, checkResult);
-    }
+    *checkResult = evaluate(s_checks[(int)check][isDir ? 1 : 0], policy, isDir);
 }
 
-CheckFunc Checkers::CheckRead            = checkRead;
-CheckFunc Checkers::CheckLookup          = checkLookup;
-CheckFunc Checkers::CheckWrite           = checkWrite;
-CheckFunc Checkers::CheckProbe           = checkProbe;
-CheckFunc Checkers::CheckExecute         = checkExecute;
-CheckFunc Checkers::CheckReadWrite       = checkReadWrite;
-CheckFunc Checkers::CheckEnumerateDir    = checkEnumerateDir;
-CheckFunc Checkers::CheckCreateSymlink   = checkCreateSymlink;
-CheckFunc Checkers::CheckCreateDirectory = checkCreateDirectory;
-CheckFunc Checkers::CheckCreateDirectoryNoEnforcement = checkCreateDirectoryNoEnforcement;
+CheckFunc Checkers::CheckRead            = checker<Check::Read>;
+CheckFunc Checkers::CheckLookup          = checker<Check::Lookup>;
+CheckFunc Checkers::CheckWrite           = checker<Check::Write>;
+CheckFunc Checkers::CheckProbe           = checker<Check::Probe>;
+CheckFunc Checkers::CheckExecute         = checker<Check::Execute>;
+CheckFunc Checkers::CheckReadWrite       = checker<Check::ReadWrite>;
+CheckFunc Checkers::CheckEnumerateDir    = checker<Check::EnumerateDir>;
+CheckFunc Checkers::CheckCreateSymlink   = checker<Check::CreateSymlink>;
+CheckFunc Checkers::CheckCreateDirectory = checker<Check::CreateDirectory>;
+CheckFunc Checkers::CheckCreateDirectoryNoEnforcement = checker<Check::CreateDirectoryNoEnforcement>;
@@ -8,7 +8,7 @@ int TrustedBsdHandler::HandleLookup(const char *path)
 {
     // set last looked up path
     Stopwatch stopwatch;
-    GetPip()->setLastLookedUpPath(path);
+    GetPip()->setLastLookedUpPath(path, IgnoreCatalinaDataPartitionPrefix(path) - path);
 
     Timespan duration = stopwatch.lap();
     GetSandbox()->Counters()->setLastLookedUpPath += duration;
@@ -105,7 +105,7 @@ void TrustedBsdHandler::HandleProcessWantsToFork(const pid_t parentProcessPid)
     // TODO: this should be configurable via FAM
     if (parentProcessPid == GetProcessId())
     {
-        GetSandbox()->ResourceManger()->WaitForCpu();
+        GetSandbox()->ResourceManger()->WaitForCpu(&GetPip()->Counters()->resourceCounters);
     }
 }
 
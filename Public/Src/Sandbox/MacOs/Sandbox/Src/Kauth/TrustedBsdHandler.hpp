@@ -13,6 +13,9 @@ public:
     TrustedBsdHandler(BuildXLSandbox *sandbox)
         : AccessHandler(sandbox) { }
 
+    /*! Absolute paths of the directory vnodes recently looked up by the processes of the tracked pip. */
+    VNodePathCache* GetVNodePathCache() const { return GetPip()->getVNodePathCache(); }
+
     int HandleLookup(const char *path);
 
     int HandleReadVnode(vnode_t vnode, FileOperation operationToReport, bool isVnodeDir);
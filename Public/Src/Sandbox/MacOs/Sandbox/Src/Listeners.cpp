@@ -4,6 +4,7 @@
 #include "Listeners.hpp"
 #include "FileOpHandler.hpp"
 #include "SandboxedPip.hpp"
+#include "Stopwatch.hpp"
 #include "TrustedBsdHandler.hpp"
 #include "VNodeHandler.hpp"
 
@@ -15,9 +16,11 @@ int RELEVANT_KAUTH_VNODE_BITS =
 #pragma mark Scope FileOperation Callbacks
 
 void *Listeners::g_dispatcher = nullptr;
+volatile SInt32 Listeners::g_dirRenameGeneration = 0;
 
-static int ComputeAbsolutePath(struct vnode *vp, const char *const relPath, size_t relPathLen, char *resultBuf, int resultBufLen)
+static int ComputeAbsolutePath(VNodePathCache *cache, struct vnode *vp, const char *const relPath, size_t relPathLen, char *resultBuf, int resultBufLen)
 {
+    assert(cache != nullptr);
     assert(vp != nullptr);
     assert(relPath != nullptr);
     assert(relPathLen >= 0);
@@ -25,11 +28,19 @@ static int ComputeAbsolutePath(struct vnode *vp, const char *const relPath, size
     assert(resultBufLen > 0);
 
     // compute full path by getting the absolute path of 'vp' and appending the relative path 'relPath'
+    // (the generation must be read before the path of 'vp' is computed, see VNodePathCache)
+    uint32_t generation = (uint32_t)Listeners::g_dirRenameGeneration;
     int len = resultBufLen;
     int err = 0;
-    if ((err = vn_getpath(vp, resultBuf, &len)) != 0)
+    if (!cache->TryGetPath(vp, generation, resultBuf, &len))
     {
-        return err;
+        len = resultBufLen;
+        if ((err = vn_getpath(vp, resultBuf, &len)) != 0)
+        {
+            return err;
+        }
+
+        cache->SetPath(vp, generation, resultBuf);
     }
 
     if (relPathLen > 0)
@@ -98,15 +109,20 @@ int Listeners::buildxl_vnode_listener(kauth_cred_t credential,
         return KAUTH_RESULT_DEFER;
     }
 
+    Stopwatch stopwatch;
+    int result = KAUTH_RESULT_DEFER;
+
     BuildXLSandbox *sandbox = OSDynamicCast(BuildXLSandbox, reinterpret_cast<OSObject *>(idata));
 
     VNodeHandler handler = VNodeHandler(sandbox);
-    if (!handler.TryInitializeWithTrackedProcess(proc_selfpid()))
+    if (handler.TryInitializeWithTrackedProcess(proc_selfpid()))
     {
-        return KAUTH_RESULT_DEFER;
+        result = handler.HandleVNodeEvent(credential, idata, action, (vfs_context_t)arg0, (vnode_t)arg1, (vnode_t)arg2, arg3);
     }
 
-    return handler.HandleVNodeEvent(credential, idata, action, (vfs_context_t)arg0, (vnode_t)arg1, (vnode_t)arg2, arg3);
+    bool isWrite = HasAnyFlags(action, KAUTH_VNODE_WRITE_DATA | KAUTH_VNODE_APPEND_DATA | KAUTH_VNODE_DELETE | KAUTH_VNODE_ADD_FILE | KAUTH_VNODE_ADD_SUBDIRECTORY);
+    (isWrite ? g_bxl_callback_histograms.write : g_bxl_callback_histograms.read) += stopwatch.lap();
+    return result;
 }
 
 #pragma mark TrustedBSD Callbacks
@@ -118,6 +134,7 @@ int Listeners::mpo_vnode_check_lookup_pre(kauth_cred_t cred,
                                           // this is supposed to be pathlen, but it appears to be wrong, so don't use
                                           size_t _)
 {
+    Stopwatch stopwatch;
     do
     {
         TrustedBsdHandler handler = TrustedBsdHandler((BuildXLSandbox*)g_dispatcher);
@@ -128,7 +145,7 @@ int Listeners::mpo_vnode_check_lookup_pre(kauth_cred_t cred,
 
         size_t pathlen = strnlen(path, MAXPATHLEN);
         char fullpath[MAXPATHLEN] = {0};
-        int errorCode = ComputeAbsolutePath(dvp, path, pathlen, fullpath, sizeof(fullpath));
+        int errorCode = ComputeAbsolutePath(handler.GetVNodePathCache(), dvp, path, pathlen, fullpath, sizeof(fullpath));
         if (errorCode != 0)
         {
             log_error("Could not get vnode path, error code: %#X", errorCode);
@@ -138,18 +155,23 @@ int Listeners::mpo_vnode_check_lookup_pre(kauth_cred_t cred,
         handler.HandleLookup(fullpath);
     } while(false);
 
+    g_bxl_callback_histograms.lookup += stopwatch.lap();
     return KERN_SUCCESS;
 }
 
 int Listeners::mpo_vnode_check_readlink(kauth_cred_t cred, struct vnode *vp, struct label *label)
 {
+    Stopwatch stopwatch;
+    int result = KERN_SUCCESS;
+
     TrustedBsdHandler handler = TrustedBsdHandler((BuildXLSandbox*)g_dispatcher);
-    if (!handler.TryInitializeWithTrackedProcess(proc_selfpid()))
+    if (handler.TryInitializeWithTrackedProcess(proc_selfpid()))
     {
-        return KERN_SUCCESS;
+        result = handler.HandleReadVnode(vp, kOpMacReadlink, /*isVnodDir*/ false);
     }
 
-    return handler.HandleReadVnode(vp, kOpMacReadlink, /*isVnodDir*/ false);
+    g_bxl_callback_histograms.read += stopwatch.lap();
+    return result;
 }
 
 /*!
@@ -158,11 +180,14 @@ int Listeners::mpo_vnode_check_readlink(kauth_cred_t cred, struct vnode *vp, str
  */
 static void handle_exec(pid_t pid, vnode_t vp)
 {
+    Stopwatch stopwatch;
     TrustedBsdHandler handler = TrustedBsdHandler((BuildXLSandbox*)Listeners::g_dispatcher);
     if (handler.TryInitializeWithTrackedProcess(pid))
     {
         handler.HandleProcessExec(vp);
     }
+
+    g_bxl_callback_histograms.exec += stopwatch.lap();
 }
 
 int Listeners::mpo_vnode_check_exec(kauth_cred_t cred,
@@ -213,6 +238,7 @@ int Listeners::mpo_cred_label_update_execve(kauth_cred_t old_cred,
 
 int Listeners::mpo_proc_check_fork(kauth_cred_t cred, struct proc *proc)
 {
+    Stopwatch stopwatch;
     pid_t pid = proc_selfpid();
     TrustedBsdHandler handler = TrustedBsdHandler((BuildXLSandbox*)g_dispatcher);
     if (handler.TryInitializeWithTrackedProcess(pid))
@@ -221,17 +247,21 @@ int Listeners::mpo_proc_check_fork(kauth_cred_t cred, struct proc *proc)
         handler.HandleProcessWantsToFork(pid);
     }
 
+    g_bxl_callback_histograms.fork += stopwatch.lap();
     return KERN_SUCCESS;
 }
 
 void Listeners::mpo_cred_label_associate_fork(kauth_cred_t cred, proc_t proc)
 {
+    Stopwatch stopwatch;
     TrustedBsdHandler handler = TrustedBsdHandler((BuildXLSandbox*)g_dispatcher);
     if (handler.TryInitializeWithTrackedProcess(proc_ppid(proc)))
     {
         // parent is tracked --> track this one too
         handler.HandleProcessFork(proc_pid(proc));
     }
+
+    g_bxl_callback_histograms.fork += stopwatch.lap();
 }
 
 int Listeners::mpo_vnode_check_create(kauth_cred_t cred,
@@ -245,7 +275,7 @@ int Listeners::mpo_vnode_check_create(kauth_cred_t cred,
     {
         // compute full path by getting the absolute path of 'dvp' and appending the component name provided by 'cnp'
         char path[MAXPATHLEN] = {0};
-        ComputeAbsolutePath(dvp, cnp->cn_nameptr, cnp->cn_namelen, path, sizeof(path));
+        ComputeAbsolutePath(handler.GetVNodePathCache(), dvp, cnp->cn_nameptr, cnp->cn_namelen, path, sizeof(path));
         bool isDir = vap->va_type == VDIR;
         bool isSymlink = vap->va_type == VLNK;
         return handler.HandleVNodeCreateEvent(path, isDir, isSymlink);
@@ -259,13 +289,17 @@ int Listeners::mpo_vnode_check_write(kauth_cred_t active_cred,
                                      struct vnode *vp,
                                      struct label *label)
 {
+    Stopwatch stopwatch;
+    int result = KERN_SUCCESS;
+
     TrustedBsdHandler handler = TrustedBsdHandler((BuildXLSandbox*)g_dispatcher);
-    if (!handler.TryInitializeWithTrackedProcess(proc_selfpid()))
+    if (handler.TryInitializeWithTrackedProcess(proc_selfpid()))
     {
-        return KERN_SUCCESS;
+        result = handler.HandleVnodeWrite(vp, kOpMacVNodeWrite);
     }
 
-    return handler.HandleVnodeWrite(vp, kOpMacVNodeWrite);
+    g_bxl_callback_histograms.write += stopwatch.lap();
+    return result;
 }
 
 
@@ -282,23 +316,15 @@ int Listeners::mpo_vnode_check_clone(kauth_cred_t cred,
         return KERN_SUCCESS;
     }
 
-    int len = MAXPATHLEN;
-    char sourcePath[MAXPATHLEN];
-    int err = vn_getpath(vp, sourcePath, &len);
-    if (err != 0)
-    {
-        log_error("Could not obtain vnode path inside vnode_check_clone; error: %d", err);
-        return KERN_SUCCESS;
-    }
-
-    int result = handler.HandleReadVnode(vp, kOpMacVNodeCloneSource, /*isVnodeDir*/ false);
+    // HandleReadVnode looks the path of the source up on its own
+    int result = handler.HandleReadVnode(vp, kOpMacVNodeCloneSource, /*isVnodeDir*/ vnode_isdir(vp));
     if (result != KERN_SUCCESS)
     {
         return result;
     }
 
     char destPath[MAXPATHLEN];
-    err = ComputeAbsolutePath(dvp, cnp->cn_nameptr, cnp->cn_namelen, destPath, MAXPATHLEN);
+    int err = ComputeAbsolutePath(handler.GetVNodePathCache(), dvp, cnp->cn_nameptr, cnp->cn_namelen, destPath, MAXPATHLEN);
     if (err != 0)
     {
         log_error("Could not compute absolute path inside vnode_check_clone; error: %d", err);
@@ -307,3 +333,17 @@ int Listeners::mpo_vnode_check_clone(kauth_cred_t cred,
 
     return handler.HandleWritePath(destPath, kOpMacVNodeCloneDest);
 }
+
+void Listeners::mpo_vnode_notify_rename(kauth_cred_t cred,
+                                        struct vnode *vp,
+                                        struct label *label,
+                                        struct vnode *dvp,
+                                        struct label *dlabel,
+                                        struct componentname *cnp)
+{
+    // renaming files (e.g., when tools "atomically" write their outputs) doesn't affect the paths of any directories
+    if (vnode_isdir(vp))
+    {
+        OSIncrementAtomic(&g_dirRenameGeneration);
+    }
+}
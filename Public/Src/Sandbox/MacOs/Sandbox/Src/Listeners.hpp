@@ -26,6 +26,10 @@ public:
     // a member function pointer poses more challenges and unreadable syntax so we go with a direct void pointer instead!
     static void *g_dispatcher;
 
+    // Incremented whenever any directory gets renamed (by any process): the paths of the vnodes under it
+    // change, so the paths cached for vnodes in earlier generations can't be trusted (see VNodePathCache).
+    static volatile SInt32 g_dirRenameGeneration;
+
     static int buildxl_file_op_listener(kauth_cred_t credential,
                                        void *idata,
                                        kauth_action_t action,
@@ -106,6 +110,13 @@ public:
                                      struct vnode *vp,
                                      struct label *label,
                                      struct componentname *cnp);
+
+    static void mpo_vnode_notify_rename(kauth_cred_t cred,
+                                        struct vnode *vp,
+                                        struct label *label,
+                                        struct vnode *dvp,
+                                        struct label *dlabel,
+                                        struct componentname *cnp);
 };
 
 #endif /* Listeners_hpp */
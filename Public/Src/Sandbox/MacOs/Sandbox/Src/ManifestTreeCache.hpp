@@ -0,0 +1,191 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef ManifestTreeCache_hpp
+#define ManifestTreeCache_hpp
+
+#include <IOKit/IOLib.h>
+#include <libkern/c++/OSDictionary.h>
+#include <libkern/c++/OSSymbol.h>
+#include "Alloc.hpp"
+#include "Buffer.hpp"
+#include "BuildXLSandboxShared.hpp"
+
+/*!
+ * Keeps a single copy of every distinct file access manifest tree used by the pips currently being tracked.
+ *
+ * Pips started by the same build mostly come with the same manifest tree (only the header preceding it, which e.g.
+ * holds the pip id and the report path, is different for every pip), so the trees are shared by content: a tree is
+ * looked up by the hash and size of its bytes, which are then compared to make sure it really is the same tree.
+ *
+ * Every tree handed out by 'Acquire' holds one reference of the cache; the cache drops a tree once the last pip
+ * using it gives it back with 'Relinquish'.  The cache itself is reference-counted too (see 'Retain' and 'Release'),
+ * so that pips outliving the sandbox that created it can still give their trees back.
+ */
+class ManifestTreeCache final
+{
+private:
+
+    /*! Maps "<hash>:<size>" of a tree to the 'Buffer' holding its bytes */
+    OSDictionary *trees_;
+
+    IOLock *lock_;
+
+    SInt32 refCount_;
+
+    ManifestTreeCache() = delete;
+
+    ~ManifestTreeCache()
+    {
+        OSSafeReleaseNULL(trees_);
+
+        if (lock_ != nullptr)
+        {
+            IOLockFree(lock_);
+            lock_ = nullptr;
+        }
+    }
+
+    static const OSSymbol* CreateKey(uint64_t hash, size_t size)
+    {
+        char key[64];
+        snprintf(key, sizeof(key), "%016llx:%lu", hash, (unsigned long)size);
+        return OSSymbol::withCString(key);
+    }
+
+public:
+
+    /*!
+     * Returns a buffer holding a copy of the given tree bytes (shared with every other pip whose tree is the same), along
+     * with the key to give it back with.  The caller owns a reference of both and must give them back with 'Relinquish'.
+     */
+    Buffer* Acquire(const char *bytes, size_t size, const OSSymbol **key)
+    {
+        *key = CreateKey(HashManifestTree(bytes, size), size);
+        if (*key == nullptr)
+        {
+            return nullptr;
+        }
+
+        IOLockLock(lock_);
+        Buffer *tree = OSDynamicCast(Buffer, trees_->getObject(*key));
+        bool shared = tree != nullptr && memcmp(tree->getBytes(), bytes, size) == 0;
+        if (shared)
+        {
+            tree->retain();
+        }
+        else
+        {
+            // a hash collision (which leaves the other tree in place) is not worth handling beyond not sharing this tree
+            bool collision = tree != nullptr;
+            tree = Buffer::create(size);
+            if (tree != nullptr)
+            {
+                memcpy(tree->getBytes(), bytes, size);
+                if (!collision)
+                {
+                    trees_->setObject(*key, tree);
+                }
+            }
+        }
+        IOLockUnlock(lock_);
+
+        if (tree == nullptr)
+        {
+            OSSafeReleaseNULL(*key);
+        }
+
+        return tree;
+    }
+
+    /*!
+     * Same as 'Acquire', for a tree that is only known by its hash and size (see 'HashManifestTree'): returns the cached
+     * tree if there is one, and null otherwise.
+     */
+    Buffer* AcquireByHash(uint64_t hash, size_t size, const OSSymbol **key)
+    {
+        *key = CreateKey(hash, size);
+        if (*key == nullptr)
+        {
+            return nullptr;
+        }
+
+        IOLockLock(lock_);
+        Buffer *tree = OSDynamicCast(Buffer, trees_->getObject(*key));
+        if (tree != nullptr)
+        {
+            tree->retain();
+        }
+        IOLockUnlock(lock_);
+
+        if (tree == nullptr)
+        {
+            OSSafeReleaseNULL(*key);
+        }
+
+        return tree;
+    }
+
+    /*! Gives back a tree obtained from 'Acquire', dropping it from the cache if no other pip is using it */
+    void Relinquish(Buffer *tree, const OSSymbol *key)
+    {
+        IOLockLock(lock_);
+        // one reference is held by the cache and one by the caller: nobody else can acquire the tree while 'lock_' is held
+        if (trees_->getObject(key) == tree && tree->getRetainCount() == 2)
+        {
+            trees_->removeObject(key);
+        }
+        IOLockUnlock(lock_);
+
+        tree->release();
+        key->release();
+    }
+
+    /*! Number of distinct trees currently cached */
+    uint getCount()
+    {
+        IOLockLock(lock_);
+        uint count = trees_->getCount();
+        IOLockUnlock(lock_);
+        return count;
+    }
+
+    void Retain()
+    {
+        OSIncrementAtomic(&refCount_);
+    }
+
+    void Release()
+    {
+        if (OSDecrementAtomic(&refCount_) == 1)
+        {
+            this->~ManifestTreeCache();
+            Alloc::Delete<ManifestTreeCache>(this, 1);
+        }
+    }
+
+#pragma mark Static Methods
+
+    /*! Factory method. The caller owns the only reference of the returned object (and gives it back with 'Release'). */
+    static ManifestTreeCache* Create()
+    {
+        ManifestTreeCache *cache = Alloc::New<ManifestTreeCache>(1);
+        if (cache == nullptr)
+        {
+            return nullptr;
+        }
+
+        cache->refCount_ = 1;
+        cache->lock_     = IOLockAlloc();
+        cache->trees_    = OSDictionary::withCapacity(16);
+        if (cache->lock_ == nullptr || cache->trees_ == nullptr)
+        {
+            cache->Release();
+            return nullptr;
+        }
+
+        return cache;
+    }
+};
+
+#endif /* ManifestTreeCache_hpp */
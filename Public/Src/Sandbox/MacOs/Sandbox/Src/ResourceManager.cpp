@@ -2,6 +2,7 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include "ResourceManager.hpp"
+#include "Stopwatch.hpp"
 
 #define super OSObject
 
@@ -36,6 +37,7 @@ bool ResourceManager::init(ResourceCounters *counters)
     };
 
     counters_ = counters;
+    admissionTokens_ = 0;
 
     procBarrier_ = BXLLockAlloc();
     if (procBarrier_ == nullptr)
@@ -77,7 +79,7 @@ inline bool ResourceManager::shouldThrottleProcesses() const
 {
     return
         counters_->availableRamMB < thresholds_.minAvailableRamMB ||
-        shouldThrottle(counters_->cpuUsage, thresholds_.cpuUsageBlock);
+        shouldThrottle(counters_->smoothedCpuUsage, thresholds_.cpuUsageBlock);
 }
 
 inline bool ResourceManager::IsProcessThrottlingEnabled() const
@@ -97,14 +99,84 @@ void ResourceManager::UpdateNumTrackedProcesses(uint newCount)
     }
 }
 
+// Weight of the previous average (out of kCpuUsageSmoothingWeight + 1) in the smoothed CPU usage
+static const int kCpuUsageSmoothingWeight = 3;
+
+// Don't assume a process takes less than this much CPU (so a nearly idle machine doesn't release everything at once)
+static const uint kMinCpuUsagePerProcess = 100;
+
 void ResourceManager::UpdateCpuUsage(basis_points cpuUsage)
 {
     basis_points oldCpuUsage = counters_->cpuUsage;
     OSCompareAndSwap(oldCpuUsage.value, cpuUsage.value, &counters_->cpuUsage.value);
-    if (isBelowThreshold(cpuUsage, thresholds_.GetCpuUsageForWakeup()))
+
+    // only ever updated from here (i.e., from the thread reporting resource usage), so no need for a CAS loop
+    basis_points oldSmoothed = counters_->smoothedCpuUsage;
+    uint newSmoothed = oldSmoothed.value == 0
+        ? cpuUsage.value
+        : (oldSmoothed.value * kCpuUsageSmoothingWeight + cpuUsage.value) / (kCpuUsageSmoothingWeight + 1);
+    OSCompareAndSwap(oldSmoothed.value, newSmoothed, &counters_->smoothedCpuUsage.value);
+
+    releaseBlockedProcesses();
+}
+
+void ResourceManager::releaseBlockedProcesses()
+{
+    uint numBlocked = counters_->numBlockedProcesses;
+    if (procBarrier_ == nullptr || numBlocked == 0 || counters_->availableRamMB < thresholds_.minAvailableRamMB)
     {
-        wakeupBlockedProcesses(/* justOne */ true);
+        return;
+    }
+
+    uint numToRelease;
+    if (!isThresholdValid(thresholds_.cpuUsageBlock))
+    {
+        // only throttling on RAM, which is fine now
+        numToRelease = numBlocked;
+    }
+    else
+    {
+        basis_points smoothed = counters_->smoothedCpuUsage;
+        percent wakeupThreshold = thresholds_.GetCpuUsageForWakeup();
+        if (!isBelowThreshold(smoothed, wakeupThreshold))
+        {
+            return;
+        }
+
+        uint headroom = wakeupThreshold.value * 100 - smoothed.value;
+        uint numTracked = counters_->numTrackedProcesses > 0 ? counters_->numTrackedProcesses : 1;
+        uint usagePerProcess = max(smoothed.value / numTracked, kMinCpuUsagePerProcess);
+        numToRelease = min(max(headroom / usagePerProcess, 1U), numBlocked);
+    }
+
+    // tokens that weren't taken since the last update no longer reflect the current headroom
+    SInt32 oldTokens;
+    do
+    {
+        oldTokens = admissionTokens_;
+    } while (!OSCompareAndSwap(oldTokens, numToRelease, &admissionTokens_));
+
+    BXLLockLock(procBarrier_);
+    for (uint i = 0; i < numToRelease; i++)
+    {
+        BXLLockWakeup(procBarrier_, this, /* oneThread */ true);
     }
+    BXLLockUnlock(procBarrier_);
+}
+
+bool ResourceManager::tryTakeAdmissionToken()
+{
+    SInt32 tokens;
+    do
+    {
+        tokens = admissionTokens_;
+        if (tokens <= 0)
+        {
+            return false;
+        }
+    } while (!OSCompareAndSwap(tokens, tokens - 1, &admissionTokens_));
+
+    return true;
 }
 
 void ResourceManager::UpdateAvailableRam(uint availableRamMB)
@@ -117,7 +189,7 @@ void ResourceManager::UpdateAvailableRam(uint availableRamMB)
     }
 }
 
-void ResourceManager::WaitForCpu()
+void ResourceManager::WaitForCpu(ResourceCounters *pipCounters)
 {
     if (!IsProcessThrottlingEnabled())
     {
@@ -126,14 +198,22 @@ void ResourceManager::WaitForCpu()
     
     if (shouldThrottleProcesses())
     {
+        Stopwatch stopwatch;
+
         BXLLockLock(procBarrier_);
-        while (shouldThrottleProcesses())
+        while (shouldThrottleProcesses() && !tryTakeAdmissionToken())
         {
             OSIncrementAtomic(&counters_->numBlockedProcesses);
+            OSIncrementAtomic(&pipCounters->numBlockedProcesses);
             BXLLockSleep(procBarrier_, this, THREAD_INTERRUPTIBLE);
+            OSDecrementAtomic(&pipCounters->numBlockedProcesses);
             OSDecrementAtomic(&counters_->numBlockedProcesses);
         }
         BXLLockUnlock(procBarrier_);
+
+        Timespan blockedDuration = stopwatch.lap();
+        counters_->blockedForks   += blockedDuration;
+        pipCounters->blockedForks += blockedDuration;
     }
 }
 
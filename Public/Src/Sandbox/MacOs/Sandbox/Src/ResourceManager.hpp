@@ -28,6 +28,12 @@ private:
     BXLLock *procBarrier_;
     ResourceThresholds thresholds_;
 
+    /*!
+     * Number of blocked processes that may proceed even though the throttling condition still holds
+     * (see 'releaseBlockedProcesses').  Only ever set from 'UpdateCpuUsage'.
+     */
+    SInt32 admissionTokens_;
+
     /*!
      * Shared counters (with all other clients) for counting the number of active/pending/blocked processes.
      *
@@ -43,10 +49,20 @@ private:
      */
     void wakeupBlockedProcesses(bool justOne);
 
+    /*!
+     * Lets as many blocked processes proceed as the current CPU headroom (the difference between the wakeup
+     * threshold and the smoothed CPU usage) can accommodate, given the average CPU usage per tracked process.
+     * This way blocked processes are released gradually instead of all at once.
+     */
+    void releaseBlockedProcesses();
+
+    /*! Takes one of the 'admissionTokens_' if there are any left */
+    bool tryTakeAdmissionToken();
+
     /*!
      * Returns whether the condition for throttling processes is met, which is:
-     *   - current CPU usage is greater or equal than the cpu usage threshold, AND
-     *   - current number of tracked processes is greater or equal than the tracked processes threshold.
+     *   - current available RAM is less than the min available RAM threshold, OR
+     *   - current (smoothed) CPU usage is greater or equal than the cpu usage threshold.
      */
     bool shouldThrottleProcesses() const;
 
@@ -79,6 +95,9 @@ public:
 
     /*!
      * Should be called at steady intervals to continuously update the current CPU usage (in basis points).
+     *
+     * Throttling decisions are based on an exponentially weighted moving average of the reported values, so that
+     * a single spike (or dip) doesn't block (or release) everything at once.
      */
     void UpdateCpuUsage(basis_points cpuUsage);
 
@@ -90,11 +109,14 @@ public:
     /*!
      * Blocks the current thread if 'IsProcessThrottlingEnabled()' and 'ShouldThrottleProcesses()' are both true.
      *
-     * The blocked thread will be awakened whenever that condition changes.
+     * The blocked thread will be awakened whenever that condition changes, or when there is enough headroom
+     * for it to proceed (see 'releaseBlockedProcesses').
+     *
+     * The time spent blocked is added to 'pipCounters' (the resource counters of the pip that wants to fork).
      *
      * NOTE: should not be called from an interrupt routine, or everything will grind to a halt.
      */
-    void WaitForCpu();
+    void WaitForCpu(ResourceCounters *pipCounters);
 
     /*!
      * Factory method.
@@ -6,6 +6,61 @@
 #define super OSObject
 
 OSDefineMetaClassAndStructors(SandboxedPip, OSObject)
+OSDefineMetaClassAndStructors(LookedUpPath, OSObject)
+
+bool LookedUpPath::init(const char *path, size_t normalizedOffset)
+{
+    if (!super::init())
+    {
+        return false;
+    }
+
+    fileId_           = 0;
+    hasFileId_        = false;
+    normalizedOffset_ = normalizedOffset;
+    parentLength_     = 0;
+    parentPolicy_     = PolicySearchCursor();
+    path_             = OSSymbol::withCString(path);
+    if (path_ == nullptr)
+    {
+        return false;
+    }
+
+    // Paths right under the root have nothing to save by starting a search from their parent
+    const char *normalized = normalizedPath();
+    const char *lastSeparator = nullptr;
+    for (const char *c = normalized; *c != '\0'; c++)
+    {
+        if (*c == '/') lastSeparator = c;
+    }
+
+    if (normalized[0] == '/' && lastSeparator != nullptr && lastSeparator - normalized < MAXPATHLEN)
+    {
+        parentLength_ = lastSeparator - normalized;
+    }
+
+    return true;
+}
+
+void LookedUpPath::free()
+{
+    OSSafeReleaseNULL(path_);
+    super::free();
+}
+
+LookedUpPath* LookedUpPath::create(const char *path, size_t normalizedOffset)
+{
+    LookedUpPath *instance = new LookedUpPath;
+    if (instance != nullptr)
+    {
+        if (!instance->init(path, normalizedOffset))
+        {
+            OSSafeReleaseNULL(instance);
+        }
+    }
+
+    return instance;
+}
 
 bool SandboxedPip::init(pid_t clientPid, pid_t processPid, Buffer *payload)
 {
@@ -15,14 +70,25 @@ bool SandboxedPip::init(pid_t clientPid, pid_t processPid, Buffer *payload)
     }
 
     clientPid_        = clientPid;
+    client_           = nullptr;
     payload_          = payload;
     processId_        = processPid;
     processTreeCount_ = 1;
     counters_         = {0};
     disableCaching_   = !g_bxl_enable_cache;
     cacheCallCnt_     = 0;
+    cacheGenerationSwap_ = 0;
 
     payload_->retain();
+    return true;
+}
+
+bool SandboxedPip::init(pid_t clientPid, pid_t processPid, Buffer *payload, ManifestTreeCache *trees)
+{
+    if (!init(clientPid, processPid, payload))
+    {
+        return false;
+    }
 
     fam_.init((BYTE*)payload_->getBytes(), payload_->getSize());
     if (fam_.HasErrors())
@@ -31,8 +97,46 @@ bool SandboxedPip::init(pid_t clientPid, pid_t processPid, Buffer *payload)
         return false;
     }
 
-    oldPathCache_ = nullptr;
-    pathCache_    = Trie::createPathTrie();
+    if (trees != nullptr && payload_->getSize() > 0)
+    {
+        ShareManifestTree(trees);
+    }
+
+    return initCaches();
+}
+
+bool SandboxedPip::init(pid_t clientPid, pid_t processPid, Buffer *header, Buffer *tree, const OSSymbol *treeKey,
+                        ManifestTreeCache *trees)
+{
+    if (!init(clientPid, processPid, header))
+    {
+        return false;
+    }
+
+    if (!fam_.init((BYTE*)payload_->getBytes(), payload_->getSize(), (BYTE*)tree->getBytes()))
+    {
+        log_error("Could not parse FileAccessManifest with a shared tree: %s", fam_.Error());
+        return false;
+    }
+
+    if (!initCaches())
+    {
+        return false;
+    }
+
+    // the tree is only taken over once nothing can fail anymore (the caller gives it back otherwise)
+    tree_    = tree;
+    treeKey_ = treeKey;
+    trees_   = trees;
+    trees_->Retain();
+    return true;
+}
+
+bool SandboxedPip::initCaches()
+{
+    oldPathCache_    = nullptr;
+    oldGenPathCache_ = nullptr;
+    pathCache_       = Trie::createPathTrie();
     if (!pathCache_)
     {
         return false;
@@ -43,10 +147,60 @@ bool SandboxedPip::init(pid_t clientPid, pid_t processPid, Buffer *payload)
     {
         return false;
     }
+
+    vnodePathCache_ = VNodePathCache::Create();
+    if (!vnodePathCache_)
+    {
+        return false;
+    }
     
     return true;
 }
 
+void SandboxedPip::ShareManifestTree(ManifestTreeCache *trees)
+{
+    const char *bytes = payload_->getBytes();
+    size_t headerSize = fam_.GetManifestTreeOffset((BYTE*)bytes);
+
+    const OSSymbol *key = nullptr;
+    Buffer *tree = trees->Acquire(bytes + headerSize, payload_->getSize() - headerSize, &key);
+    Buffer *header = tree != nullptr ? Buffer::create(headerSize) : nullptr;
+    if (header == nullptr)
+    {
+        if (tree != nullptr)
+        {
+            trees->Relinquish(tree, key);
+        }
+
+        return;
+    }
+
+    memcpy(header->getBytes(), bytes, headerSize);
+
+    // the header was parsed already, so this only fails if the manifest itself changed
+    FileAccessManifestParseResult shared;
+    if (!shared.init((BYTE*)header->getBytes(), headerSize, (BYTE*)tree->getBytes()))
+    {
+        log_error("Could not share FileAccessManifest tree: %s", shared.Error());
+        OSSafeReleaseNULL(header);
+        trees->Relinquish(tree, key);
+        return;
+    }
+
+    fam_     = shared;
+    tree_    = tree;
+    treeKey_ = key;
+    trees_   = trees;
+    trees_->Retain();
+
+    OSSafeReleaseNULL(payload_);
+    payload_ = header;
+
+    log_verbose(g_bxl_verbose_logging,
+                "Pip PID(%d) shares a manifest tree of %lu bytes :: #distinct trees = %d",
+                processId_, (unsigned long)(tree_->getSize()), trees_->getCount());
+}
+
 void SandboxedPip::free()
 {
     if (pathCache_ != nullptr && lastPathLookup_ != nullptr)
@@ -58,14 +212,29 @@ void SandboxedPip::free()
             pathCache_->getCount(), lastPathLookup_->getCount());
     }
 
+    OSSafeReleaseNULL(client_);
     OSSafeReleaseNULL(payload_);
+    if (tree_ != nullptr)
+    {
+        trees_->Relinquish(tree_, treeKey_);
+        tree_    = nullptr;
+        treeKey_ = nullptr;
+    }
+    if (trees_ != nullptr)
+    {
+        trees_->Release();
+        trees_ = nullptr;
+    }
     OSSafeReleaseNULL(lastPathLookup_);
     OSSafeReleaseNULL(pathCache_);
     OSSafeReleaseNULL(oldPathCache_);
+    OSSafeReleaseNULL(oldGenPathCache_);
+    VNodePathCache::Destroy(vnodePathCache_);
+    vnodePathCache_ = nullptr;
     super::free();
 }
 
-SandboxedPip* SandboxedPip::create(pid_t clientPid, pid_t processPid, Buffer *payload)
+SandboxedPip* SandboxedPip::create(pid_t clientPid, pid_t processPid, Buffer *payload, ManifestTreeCache *trees)
 {
     SandboxedPip *instance = new SandboxedPip;
     if (instance == nullptr)
@@ -74,7 +243,7 @@ SandboxedPip* SandboxedPip::create(pid_t clientPid, pid_t processPid, Buffer *pa
         return nullptr;
     }
     
-    bool initialized = instance->init(clientPid, processPid, payload);
+    bool initialized = instance->init(clientPid, processPid, payload, trees);
     if (!initialized)
     {
         // init already logged an error message describing what failed
@@ -85,6 +254,27 @@ SandboxedPip* SandboxedPip::create(pid_t clientPid, pid_t processPid, Buffer *pa
     return instance;
 }
 
+SandboxedPip* SandboxedPip::create(pid_t clientPid, pid_t processPid, Buffer *header, Buffer *tree, const OSSymbol *treeKey,
+                                   ManifestTreeCache *trees)
+{
+    SandboxedPip *instance = new SandboxedPip;
+    if (instance == nullptr)
+    {
+        log_error("Failed to create a new ProcessObject (PID: %d) for Client (PID: %d)", processPid, clientPid);
+        return nullptr;
+    }
+
+    bool initialized = instance->init(clientPid, processPid, header, tree, treeKey, trees);
+    if (!initialized)
+    {
+        // init already logged an error message describing what failed
+        OSSafeReleaseNULL(instance);
+        return nullptr;
+    }
+
+    return instance;
+}
+
 PipInfo SandboxedPip::introspect()
 {
     return
@@ -108,9 +298,18 @@ bool SandboxedPip::RefreshDisableCaching()
         {
             // once caching is disabled, it must stay disabled
             disableCaching_ = true;
+
+            // only one thread at a time may swap path caches; if some other thread is already
+            // doing it, or there is a dropped generation still waiting to be garbage collected,
+            // simply keep the current cache around until this pip is freed
+            if (!OSCompareAndSwap(0, 1, &cacheGenerationSwap_))
+            {
+                return disableCaching_;
+            }
+
             Trie *oldCache = pathCache_;
-            Trie *newCache = Trie::createPathTrie();
-            if (OSCompareAndSwapPtr(oldCache, newCache, &pathCache_))
+            Trie *newCache = oldPathCache_ == nullptr ? Trie::createPathTrie() : nullptr;
+            if (newCache != nullptr && OSCompareAndSwapPtr(oldCache, newCache, &pathCache_))
             {
                 // we swapped --> save oldCache for garbage collection
                 // (releasing is immediately is dangerous because it might still be in use in a concurrent thread)
@@ -118,15 +317,86 @@ bool SandboxedPip::RefreshDisableCaching()
             }
             else
             {
-                // someone else did it --> release newCache that was created for nothing
+                // nothing to do --> release newCache that was created for nothing
                 OSSafeReleaseNULL(newCache);
             }
+
+            OSCompareAndSwap(1, 0, &cacheGenerationSwap_);
         }
     }
 
     return disableCaching_;
 }
 
+OSObject* SandboxedPip::CacheRecordFactory(void *data)
+{
+    CacheRecordFactoryArgs *args = (CacheRecordFactoryArgs*)data;
+    Trie *oldGen = args->pip->oldGenPathCache_;
+    OSObject *record = oldGen != nullptr ? oldGen->get(args->path) : nullptr;
+    if (record != nullptr)
+    {
+        // the new generation takes a reference of its own (see Trie::makeSentinel)
+        record->retain();
+        return record;
+    }
+
+    return CacheRecord::create();
+}
+
+inline bool SandboxedPip::ShouldStartNewCacheGeneration()
+{
+    if (g_bxl_path_cache_max_mb <= 0)
+    {
+        return false;
+    }
+
+    // every generation gets half of the budget, so the two of them stay within it
+    uint64_t budgetBytes  = ((uint64_t)g_bxl_path_cache_max_mb << 20) / 2;
+    uint64_t currentBytes =
+        (uint64_t)pathCache_->getNodeCount() * pathCache_->getNodeSize() +
+        (uint64_t)pathCache_->getCount() * sizeof(CacheRecord);
+
+    return currentBytes > budgetBytes;
+}
+
+void SandboxedPip::StartNewCacheGeneration()
+{
+    if (!OSCompareAndSwap(0, 1, &cacheGenerationSwap_))
+    {
+        // someone else is already doing it
+        return;
+    }
+
+    // The generation being dropped can only be released once no concurrent lookup can be using it (see 'cacheLookup');
+    // until the previous dropped generation is gone, the current one is allowed to grow beyond the budget.
+    //
+    // Dropping a generation never makes a report wrong: a path whose record is gone simply gets a new record, so its
+    // accesses get reported once more (which is the same as what happens when caching is disabled).
+    Trie *newCache = oldPathCache_ == nullptr && !disableCaching_ ? Trie::createPathTrie() : nullptr;
+    if (newCache != nullptr)
+    {
+        Trie *youngGen = pathCache_;
+        Trie *droppedGen = oldGenPathCache_;
+
+        // publish the young generation as old before dropping the previous old one
+        OSCompareAndSwapPtr(droppedGen, youngGen, &oldGenPathCache_);
+        OSCompareAndSwapPtr(youngGen, newCache, &pathCache_);
+        oldPathCache_ = droppedGen;
+
+        counters_.reportCounters.numCacheGenerations++;
+        if (droppedGen != nullptr)
+        {
+            counters_.reportCounters.numDroppedCacheRecords += droppedGen->getCount();
+        }
+
+        log_verbose(g_bxl_verbose_logging,
+                    "Started new path cache generation for PID(%d) :: #records in previous generation = %d",
+                    processId_, youngGen->getCount());
+    }
+
+    OSCompareAndSwap(1, 0, &cacheGenerationSwap_);
+}
+
 # define PCT(a, b) (int)(((a) * 1.0) / ((a) + (b)) * 100)
 
 inline bool SandboxedPip::ShouldDisableCaching()
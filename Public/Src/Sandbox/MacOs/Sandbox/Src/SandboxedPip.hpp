@@ -13,13 +13,97 @@
 #include "AutoIncDec.hpp"
 #include "BuildXLSandboxShared.hpp"
 #include "CacheRecord.hpp"
+#include "ClientInfo.hpp"
 #include "FileAccessManifestParser.hpp"
 #include "Buffer.hpp"
+#include "ManifestTreeCache.hpp"
 #include "PolicyResult.h"
 #include "ThreadLocal.hpp"
 #include "Trie.hpp"
+#include "VNodePathCache.hpp"
 
 #define SandboxedPip BXL_CLASS(SandboxedPip)
+#define LookedUpPath BXL_CLASS(LookedUpPath)
+
+/*!
+ * The last path looked up by a thread (see 'SandboxedPip::setLastLookedUpPath'), along with the id of the file it leads to
+ * once a denied access needed it (see 'AccessHandler::CheckAccess').  Only the thread that looked the path up uses it.
+ *
+ * The callbacks that follow a lookup for the same syscall check the same path, or paths in the same directory, so the
+ * record also keeps the path without the data partition prefix (see 'AccessHandler::IgnoreCatalinaDataPartitionPrefix')
+ * and, once searched, the policy of its parent directory (see 'AccessHandler::FindManifestRecord').
+ */
+class LookedUpPath : public OSObject
+{
+    OSDeclareDefaultStructors(LookedUpPath);
+
+private:
+
+    const OSSymbol *path_;
+    size_t normalizedOffset_;
+    // Length of the parent directory of the normalized path, 0 if the parent policy is not worth keeping
+    size_t parentLength_;
+    PolicySearchCursor parentPolicy_;
+    uint64_t fileId_;
+    bool hasFileId_;
+
+protected:
+
+    bool init(const char *path, size_t normalizedOffset);
+    void free() override;
+
+public:
+
+    const char* path() const                { return path_->getCStringNoCopy(); }
+    bool matches(const char *path) const    { return path_->isEqualTo(path); }
+    const char* normalizedPath() const      { return path() + normalizedOffset_; }
+    size_t parentLength() const             { return parentLength_; }
+
+    /*! Whether the normalized 'absolutePath' (of length 'length') is under the parent directory of the normalized path */
+    bool isUnderParent(const char *absolutePath, size_t length) const
+    {
+        return parentLength_ > 0 &&
+            length > parentLength_ &&
+            absolutePath[parentLength_] == '/' &&
+            strncmp(absolutePath, normalizedPath(), parentLength_) == 0;
+    }
+
+    bool tryGetParentPolicy(PolicySearchCursor *cursor) const
+    {
+        *cursor = parentPolicy_;
+        return parentPolicy_.IsValid();
+    }
+
+    void setParentPolicy(const PolicySearchCursor &cursor)
+    {
+        parentPolicy_ = cursor;
+    }
+
+    /*! Takes the parent policy of 'previous' over when both paths are in the same directory */
+    void inheritParentPolicy(const LookedUpPath *previous)
+    {
+        if (previous->parentPolicy_.IsValid() &&
+            previous->parentLength_ == parentLength_ &&
+            isUnderParent(previous->normalizedPath(), strlen(previous->normalizedPath())))
+        {
+            parentPolicy_ = previous->parentPolicy_;
+        }
+    }
+
+    bool tryGetFileId(uint64_t *fileId) const
+    {
+        *fileId = fileId_;
+        return hasFileId_;
+    }
+
+    void setFileId(uint64_t fileId)
+    {
+        fileId_    = fileId;
+        hasFileId_ = true;
+    }
+
+    static LookedUpPath* create(const char *path, size_t normalizedOffset);
+};
 
 /*!
  * Represents the root of the process tree being tracked.
@@ -43,10 +127,24 @@ private:
     /*! Process id of the root process of this pip. */
     pid_t processId_;
 
-    /*! File access manifest payload bytes */
+    /*!
+     * The client tracking this process, bound when the pip starts (see 'bindClient') so that reports don't have to look it up.
+     * Retained: it stays valid after the client disconnects (see 'ClientInfo::isConnected').
+     */
+    ClientInfo *client_;
+
+    /*!
+     * File access manifest payload bytes: only the header of the manifest when its tree is shared with other pips
+     * (see 'tree_'), the whole manifest otherwise.
+     */
     Buffer *payload_;
 
-    /*! File access manifest (contains pointers into the 'payload_' byte array */
+    /*! Manifest tree shared by all the pips with the same one (null if not shared), along with where it came from */
+    Buffer *tree_;
+    const OSSymbol *treeKey_;
+    ManifestTreeCache *trees_;
+
+    /*! File access manifest (contains pointers into the 'payload_' and 'tree_' byte arrays */
     FileAccessManifestParseResult fam_;
 
     /*! Number of processses in this pip's process tree */
@@ -58,9 +156,21 @@ private:
      */
     Trie *pathCache_;
 
-    /*! Old path cache left to be garbage collected (in 'cacheLookup' method) after caching was dynamically disabled. */
+    /*!
+     * Previous generation of 'pathCache_' (see 'StartNewCacheGeneration').  Paths not found in 'pathCache_' are looked up
+     * here, and their records are moved over to 'pathCache_' so that what has been reported for them is not forgotten.
+     */
+    Trie *oldGenPathCache_;
+
+    /*!
+     * Old path cache left to be garbage collected (in 'cacheLookup' method), either after caching was dynamically
+     * disabled or after the generation it belonged to was dropped.
+     */
     Trie *oldPathCache_;
 
+    /*! Set while a thread is swapping path cache generations (only one thread at a time may do that) */
+    UInt32 cacheGenerationSwap_;
+
     /*! Counts the number of concurrent calls to 'pathCache_' */
     int cacheCallCnt_;
 
@@ -73,15 +183,28 @@ private:
     /*! A thread-local storage for remembering the last looked up path by every thread. */
     ThreadLocal *lastPathLookup_;
 
+    /*! Absolute paths of the directory vnodes recently looked up by this pip's processes. */
+    VNodePathCache *vnodePathCache_;
+
     /*! Various counters.  IMPORTANT: counters may be globally disabled so no logic may rely on their values. */
     AllCounters counters_;
 
-    static OSObject* CacheRecordFactory(void *)
+    typedef struct
     {
-        return CacheRecord::create();
-    };
+        SandboxedPip *pip;
+        const char *path;
+    } CacheRecordFactoryArgs;
+
+    /*! Moves the record of the path over from the previous cache generation if there is one, creates a new one otherwise. */
+    static OSObject* CacheRecordFactory(void *data);
 
     bool init(pid_t clientPid, pid_t processPid, Buffer *payload);
+    bool init(pid_t clientPid, pid_t processPid, Buffer *payload, ManifestTreeCache *trees);
+    bool init(pid_t clientPid, pid_t processPid, Buffer *header, Buffer *tree, const OSSymbol *treeKey, ManifestTreeCache *trees);
+    bool initCaches();
+
+    /*! Swaps the manifest tree of 'payload_' for the copy in 'trees'; a pip that can't share its tree simply keeps its own */
+    void ShareManifestTree(ManifestTreeCache *trees);
 
 protected:
 
@@ -95,6 +218,21 @@ public:
     /*! Process id of the root process of this pip. */
     pid_t getProcessId() const { return processId_; }
 
+    /*! The client tracking this process, or null if none was bound. */
+    ClientInfo* getClient() const { return client_; }
+
+    /*! Binds the client tracking this process.  Must be called before the pip is tracked, i.e., before any report is sent for it. */
+    void bindClient(ClientInfo *client)
+    {
+        if (client != nullptr)
+        {
+            client->retain();
+        }
+
+        OSSafeReleaseNULL(client_);
+        client_ = client;
+    }
+
     /*! A unique identifier of this pip. */
     pipid_t getPipId() const   { return fam_.GetPipId()->PipId; }
 
@@ -119,6 +257,9 @@ public:
     /*! Various counters. */
     AllCounters* Counters() { return &counters_; }
 
+    /*! Absolute paths of the directory vnodes recently looked up by this pip's processes. */
+    VNodePathCache* getVNodePathCache() const { return vnodePathCache_; }
+
     /*! Number of elements in the 'lastPathLookup' dictionary. */
     uint getLastPathLookupElemCount() const { return lastPathLookup_->getCount(); }
 
@@ -139,12 +280,36 @@ public:
 
     /*!
      * Uses a thread-local storage to save a given path as the last path that was looked up on the current thread.
+     *
+     * Looking the same path up again keeps its record, and with it the id of the file it leads to: tools keep going
+     * through the same paths, one syscall after the other.  Looking up another path in the same directory keeps the
+     * policy of the directory.
+     *
+     * @param path The looked up path
+     * @param normalizedOffset Where the path starts once the data partition prefix is ignored
+     * @result The record of the path (owned by the thread-local storage), or NULL if it could not be created
      */
-    void setLastLookedUpPath(const char *path)
+    LookedUpPath* setLastLookedUpPath(const char *path, size_t normalizedOffset)
     {
-        const OSSymbol *pathSym = OSSymbol::withCString(path);
-        lastPathLookup_->insert(pathSym);
-        OSSafeReleaseNULL(pathSym);
+        LookedUpPath *last = getLastLookedUpPath();
+        if (last != nullptr && last->matches(path))
+        {
+            return last;
+        }
+
+        LookedUpPath *record = LookedUpPath::create(path, normalizedOffset);
+        if (record != nullptr)
+        {
+            if (last != nullptr)
+            {
+                record->inheritParentPolicy(last);
+            }
+
+            lastPathLookup_->insert(record);
+            OSSafeReleaseNULL(record);
+        }
+
+        return getLastLookedUpPath();
     }
 
     /*!
@@ -152,10 +317,9 @@ public:
      *
      * (In practice, this is the path associated with the last MAC_LOOKUP event that happened on the current thread).
      */
-    const char* getLastLookedUpPath()
+    LookedUpPath* getLastLookedUpPath()
     {
-        OSSymbol *value = OSDynamicCast(OSSymbol, lastPathLookup_->get());
-        return value != nullptr ? value->getCStringNoCopy() : nullptr;
+        return OSDynamicCast(LookedUpPath, lastPathLookup_->get());
     }
 
     /*! Information about this pip that can be queried from user space */
@@ -187,20 +351,35 @@ public:
         if (RefreshDisableCaching())
         {
             // If caching is disabled, and no one else is using pathCache_, and we came here first:
-            //   --> safe to release old path cache left to be garbage collected
+            //   --> safe to release old path caches left to be garbage collected
             // NOTE: even if someone else comes in after we've checked `cacheCallCnt_ == 1`, 
             //       because once caching is disabled it stays disabled, they'll get to use the new path 
-            //       cache object, so it's still safe to release oldPathCache_)
-            if (cacheCallCnt_ == 1 && callCnt.ValueBeforeTheIncrement() == 0 && oldPathCache_ != nullptr)
+            //       cache object, so it's still safe to release oldPathCache_ and oldGenPathCache_)
+            if (cacheCallCnt_ == 1 && callCnt.ValueBeforeTheIncrement() == 0)
             {
                 OSSafeReleaseNULL(oldPathCache_);
+                OSSafeReleaseNULL(oldGenPathCache_);
             }
 
             return nullptr;
         }
         else
         {
-            OSObject *value = pathCache_->getOrAdd(path, nullptr, CacheRecordFactory);
+            // Same as above: a dropped generation is no longer reachable, so whoever comes in after
+            // the check can't get to it anymore
+            if (cacheCallCnt_ == 1 && callCnt.ValueBeforeTheIncrement() == 0 && oldPathCache_ != nullptr)
+            {
+                OSSafeReleaseNULL(oldPathCache_);
+            }
+
+            Trie::TrieResult result = Trie::TrieResult::kTrieResultFailure;
+            CacheRecordFactoryArgs args = { .pip = this, .path = path };
+            OSObject *value = pathCache_->getOrAdd(path, &args, CacheRecordFactory, &result);
+            if (result == Trie::TrieResult::kTrieResultInserted && ShouldStartNewCacheGeneration())
+            {
+                StartNewCacheGeneration();
+            }
+
             return OSDynamicCast(CacheRecord, value);
         }
     }
@@ -208,12 +387,23 @@ public:
 #pragma mark Static Methods
 
     /*! Factory method. The caller is responsible for releasing the returned object. */
-    static SandboxedPip* create(pid_t clientPid, pid_t processPid, Buffer *payload);
+    static SandboxedPip* create(pid_t clientPid, pid_t processPid, Buffer *payload, ManifestTreeCache *trees);
+
+    /*!
+     * Factory method for a pip whose manifest tree was already acquired from 'trees' (see 'ManifestTreeCache::AcquireByHash'),
+     * so that only the header of its manifest had to be copied over.  The returned pip takes over the caller's reference
+     * of 'tree' and 'treeKey'; when null is returned, the caller still has to give them back.
+     */
+    static SandboxedPip* create(pid_t clientPid, pid_t processPid, Buffer *header, Buffer *tree, const OSSymbol *treeKey,
+                                ManifestTreeCache *trees);
 
 private:
 
     bool RefreshDisableCaching();
     inline bool ShouldDisableCaching();
+
+    inline bool ShouldStartNewCacheGeneration();
+    void StartNewCacheGeneration();
 };
 
 #endif /* SandboxedPip_hpp */
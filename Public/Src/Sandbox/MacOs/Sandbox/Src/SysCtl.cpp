@@ -2,6 +2,7 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include "SysCtl.hpp"
+#include "BuildXLSandboxShared.hpp"
 
 #if DEBUG
 int g_bxl_verbose_logging = 1;
@@ -17,6 +18,12 @@ int g_bxl_enable_light_trie = 1;
 int g_bxl_disable_cache_min_entries = 20000;
 int g_bxl_disable_cache_max_hit_pct = 20;
 
+// every pip's path cache is kept within 64 MB (by dropping its oldest entries); 0 means unbounded
+int g_bxl_path_cache_max_mb = 64;
+
+// only updated while counters are enabled (see 'g_bxl_enable_counters')
+CallbackHistograms g_bxl_callback_histograms;
+
 SYSCTL_INT(_kern,                               // parent
            OID_AUTO,                            // oid
            bxl_enable_counters,                 // name
@@ -65,6 +72,23 @@ SYSCTL_INT(_kern,
            g_bxl_disable_cache_max_hit_pct,
            "For pip caching to be disabled, its cache hit rate must be less than this percent");
 
+SYSCTL_INT(_kern,
+           OID_AUTO,
+           bxl_path_cache_max_mb,
+           CTLFLAG_RW,
+           &g_bxl_path_cache_max_mb,
+           g_bxl_path_cache_max_mb,
+           "Memory budget of the path cache of every pip in MB (older entries are dropped beyond it, 0 means unbounded)");
+
+SYSCTL_OPAQUE(_kern,
+              OID_AUTO,
+              bxl_callback_histograms,
+              CTLFLAG_RD | CTLFLAG_LOCKED,
+              &g_bxl_callback_histograms,
+              sizeof(g_bxl_callback_histograms),
+              "S,CallbackHistograms",
+              "Latency histograms of the lookup/read/write/exec/fork callbacks and the report queue depth histogram");
+
 void bxl_sysctl_register()
 {
     sysctl_register_oid(&sysctl__kern_bxl_enable_counters);
@@ -73,6 +97,8 @@ void bxl_sysctl_register()
     sysctl_register_oid(&sysctl__kern_bxl_enable_light_trie);
     sysctl_register_oid(&sysctl__kern_bxl_disable_cache_min_entries);
     sysctl_register_oid(&sysctl__kern_bxl_disable_cache_max_hit_pct);
+    sysctl_register_oid(&sysctl__kern_bxl_path_cache_max_mb);
+    sysctl_register_oid(&sysctl__kern_bxl_callback_histograms);
 }
 
 void bxl_sysctl_unregister()
@@ -83,4 +109,6 @@ void bxl_sysctl_unregister()
     sysctl_unregister_oid(&sysctl__kern_bxl_enable_light_trie);
     sysctl_unregister_oid(&sysctl__kern_bxl_disable_cache_min_entries);
     sysctl_unregister_oid(&sysctl__kern_bxl_disable_cache_max_hit_pct);
+    sysctl_unregister_oid(&sysctl__kern_bxl_path_cache_max_mb);
+    sysctl_unregister_oid(&sysctl__kern_bxl_callback_histograms);
 }
@@ -15,6 +15,7 @@ extern int g_bxl_enable_cache;
 extern int g_bxl_enable_light_trie;
 extern int g_bxl_disable_cache_min_entries;
 extern int g_bxl_disable_cache_max_hit_pct;
+extern int g_bxl_path_cache_max_mb;
 
 void bxl_sysctl_register();
 void bxl_sysctl_unregister();
@@ -32,8 +32,11 @@ bool ThreadLocal::init()
         return false;
     }
 
-    dict_ = Trie::createUintTrie();
-    if (dict_ == nullptr)
+    bzero(slots_, sizeof(slots_));
+    overflowed_ = false;
+
+    overflow_ = Trie::createUintTrie();
+    if (overflow_ == nullptr)
     {
         return false;
     }
@@ -43,9 +46,14 @@ bool ThreadLocal::init()
 
 void ThreadLocal::free()
 {
-    if (dict_)
+    for (uint i = 0; i < kNumSlots; i++)
+    {
+        OSSafeReleaseNULL(slots_[i].value);
+    }
+
+    if (overflow_)
     {
-        OSSafeReleaseNULL(dict_);
+        OSSafeReleaseNULL(overflow_);
     }
 
     super::free();
@@ -53,21 +61,114 @@ void ThreadLocal::free()
 
 #pragma mark count/insert/remove/get methods
 
+ThreadLocal::Slot* ThreadLocal::findSlot(uint64_t tid) const
+{
+    uint index = SlotIndex(tid);
+    for (uint i = 0; i < kProbeWindow; i++)
+    {
+        const Slot *slot = &slots_[(index + i) % kNumSlots];
+        if (slot->tid == tid)
+        {
+            return const_cast<Slot*>(slot);
+        }
+    }
+
+    return nullptr;
+}
+
+uint ThreadLocal::getCount() const
+{
+    uint count = overflow_->getCount();
+    for (uint i = 0; i < kNumSlots; i++)
+    {
+        if (slots_[i].value != nullptr) count++;
+    }
+
+    return count;
+}
+
+uint ThreadLocal::getNodeCount() const
+{
+    return kNumSlots + overflow_->getNodeCount();
+}
+
 bool ThreadLocal::insert(const OSObject *value)
 {
-    auto result = dict_->replace(self_tid(), value);
-    return
-        result == Trie::TrieResult::kTrieResultInserted ||
-        result == Trie::TrieResult::kTrieResultReplaced;
+    if (value == nullptr)
+    {
+        return false;
+    }
+
+    uint64_t tid = self_tid();
+    Slot *slot = findSlot(tid);
+    if (slot == nullptr)
+    {
+        // no other thread ever claims a slot for this thread, so it is enough to claim the first free one
+        uint index = SlotIndex(tid);
+        for (uint i = 0; i < kProbeWindow && slot == nullptr; i++)
+        {
+            Slot *candidate = &slots_[(index + i) % kNumSlots];
+            if (candidate->tid == 0 && OSCompareAndSwap64(0, tid, &candidate->tid))
+            {
+                slot = candidate;
+            }
+        }
+    }
+
+    if (slot == nullptr)
+    {
+        overflowed_ = true;
+        auto result = overflow_->replace(tid, value);
+        return result == Trie::TrieResult::kTrieResultInserted;
+    }
+
+    value->retain();
+    OSObject *previousValue = slot->value;
+    slot->value = const_cast<OSObject*>(value);
+    if (previousValue != nullptr)
+    {
+        OSSafeReleaseNULL(previousValue);
+        return false;
+    }
+
+    // the thread may have had to fall back to the overflow dictionary before the slot got freed
+    if (overflowed_)
+    {
+        overflow_->remove(tid);
+    }
+
+    return true;
 }
 
 bool ThreadLocal::remove()
 {
-    auto result = dict_->remove(self_tid());
-    return result == Trie::TrieResult::kTrieResultRemoved;
+    uint64_t tid = self_tid();
+    Slot *slot = findSlot(tid);
+    if (slot == nullptr)
+    {
+        return overflowed_ && overflow_->remove(tid) == Trie::TrieResult::kTrieResultRemoved;
+    }
+
+    OSObject *previousValue = slot->value;
+    slot->value = nullptr;
+
+    // hands the slot back (after the value is gone, so whoever claims it next starts out empty)
+    OSMemoryBarrier();
+    slot->tid = 0;
+
+    bool removed = previousValue != nullptr;
+    OSSafeReleaseNULL(previousValue);
+    return removed;
 }
 
 OSObject* ThreadLocal::get() const
 {
-    return dict_->get(self_tid());
+    uint64_t tid = self_tid();
+    const Slot *slot = findSlot(tid);
+    if (slot != nullptr)
+    {
+        return slot->value;
+    }
+
+    return overflowed_ ? overflow_->get(tid) : nullptr;
 }
@@ -6,12 +6,22 @@
 
 #include <IOKit/IOService.h>
 #include <IOKit/IOLib.h>
+#include <libkern/OSAtomic.h>
 #include "Trie.hpp"
 
 #define ThreadLocal BXL_CLASS(ThreadLocal)
 
 /*!
- * A straightforward wrapper around a concurrent dictionary that uses current thread's id as the implicit key.
+ * Associates a value with each thread, keyed by the id of the current thread.
+ *
+ * Values live in a fixed-size table of slots: a thread only ever looks at the (few) slots of its probe window, and
+ * claims one of them the first time it stores a value.  Only the owner of a slot ever changes its value, so neither
+ * lookups nor updates take a lock (and 'get' can hand out the value without retaining it); claiming a free slot is
+ * a single compare-and-swap.
+ *
+ * Slots are never taken away from their threads, so once the whole probe window of a thread is taken (e.g., by the
+ * threads of the processes a long running pip already went through), its value is kept in an overflow dictionary
+ * instead, which is only ever consulted after some thread had to fall back to it.
  */
 class ThreadLocal : public OSObject
 {
@@ -19,14 +29,36 @@ class ThreadLocal : public OSObject
 
 private:
 
-    /* backing dictionary */
-    Trie *dict_;
+    static const uint kNumSlots    = 64;
+    static const uint kProbeWindow = 8;
+
+    // Padded to a cache line: every thread keeps updating its own slot
+    typedef struct {
+        volatile uint64_t tid;
+        OSObject *value;
+    } __attribute__((aligned(64))) Slot;
+
+    Slot slots_[kNumSlots];
+
+    /*! Values of the threads that found no free slot */
+    Trie *overflow_;
+
+    /*! Set (for good) once the first value is stored in 'overflow_' */
+    volatile bool overflowed_;
 
     static uint64_t self_tid()
     {
         return thread_tid(current_thread());
     }
 
+    static inline uint SlotIndex(uint64_t tid)
+    {
+        return (uint)((tid * 0x9E3779B97F4A7C15ULL) >> 32) % kNumSlots;
+    }
+
+    /*! The slot owned by the current thread, if any */
+    Slot* findSlot(uint64_t tid) const;
+
 protected:
 
     /*!
@@ -46,17 +78,17 @@ public:
     /*!
      * @return Number of entries in this collection
      */
-    uint getCount() { return dict_->getCount(); }
+    uint getCount() const;
 
     /*!
-     * @return Number of nodes in the underlying dictionary.
+     * @return Number of slots in the underlying table plus the number of nodes in the overflow dictionary.
      */
-    uint getNodeCount() { return dict_->getNodeCount(); }
+    uint getNodeCount() const;
 
     /*!
-     * @return Size in bytes of each node in the underlying dictionary.
+     * @return Size in bytes of each slot in the underlying table.
      */
-    uint getNodeSize() { return dict_->getNodeSize(); }
+    uint getNodeSize() const { return sizeof(Slot); }
 
     /*!
      * Associates 'value' with current thread.
@@ -16,7 +16,8 @@
  *
  * Additionally, two different implementations are provided: fast and light.  The former
  * is lock-free and fast but has a potentially huge memory footprint; the latter has a
- * much smaller memory footprint, is not lock-free, but still has good performance.
+ * much smaller memory footprint, is not lock-free, but still has good performance (its
+ * nodes with many children index them directly, see NodeLight).
  *
  * Each node in a tree can be assigned a record which must be a pointer to an arbitrary OSObject.
  * Once an OSObject is added to a trie, it is automatically retained by the trie; once it is removed,
@@ -200,7 +201,7 @@ private:
     /*! Creates either a Uint or a Path node, based on the kind of this trie. */
     Node* createNode(uint key)
     {
-        Node* node = isLightTrie() ? (Node*)NodeLight::create(key) :
+        Node* node = isLightTrie() ? (isUintTrie() ? (Node*)NodeLight::createUintNode(key) : (Node*)NodeLight::createPathNode(key)) :
                      isUintTrie()  ? (Node*)NodeFast::createUintNode() :
                      isPathTrie()  ? (Node*)NodeFast::createPathNode() :
                      nullptr;
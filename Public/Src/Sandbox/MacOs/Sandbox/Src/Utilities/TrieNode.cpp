@@ -70,7 +70,7 @@ static uint64_t pow10(int exp)
 
 // ============================== class NodeLight ==============================
 
-NodeLight* NodeLight::create(uint key)
+NodeLight* NodeLight::create(uint key, uint maxKey)
 {
     NodeLight *instance = new NodeLight;
     if (instance == nullptr)
@@ -78,7 +78,7 @@ NodeLight* NodeLight::create(uint key)
         goto error;
     }
 
-    if (!instance->init(key))
+    if (!instance->init(key, maxKey))
     {
         goto error;
     }
@@ -90,16 +90,19 @@ error:
     return nullptr;
 }
 
-bool NodeLight::init(uint key)
+bool NodeLight::init(uint key, uint maxKey)
 {
     if (!Node::init())
     {
         return false;
     }
 
-    key_      = key;
-    next_     = nullptr;
-    children_ = nullptr;
+    key_           = key;
+    maxKey_        = maxKey;
+    childrenCount_ = 0;
+    next_          = nullptr;
+    children_      = nullptr;
+    index_         = nullptr;
 
     return true;
 }
@@ -114,9 +117,40 @@ void NodeLight::free()
     next_ = nullptr;
     children_ = nullptr;
 
+    if (index_ != nullptr)
+    {
+        Alloc::Delete<NodeLight*>(index_, maxKey_);
+        index_ = nullptr;
+    }
+
     Node::free();
 }
 
+void NodeLight::promote()
+{
+    NodeLight **index = Alloc::New<NodeLight*>(maxKey_);
+    if (index == nullptr)
+    {
+        // out of memory --> just keep using the list
+        return;
+    }
+
+    for (int i = 0; i < maxKey_; i++)
+    {
+        index[i] = nullptr;
+    }
+
+    for (NodeLight *curr = children_; curr != nullptr; curr = curr->next_)
+    {
+        index[curr->key_] = curr;
+    }
+
+    if (!OSCompareAndSwapPtr(nullptr, index, &index_))
+    {
+        Alloc::Delete<NodeLight*>(index, maxKey_);
+    }
+}
+
 NodeLight* NodeLight::findChild(uint key,
                                 bool createIfMissing,
                                 BXLRecursiveLock *maybeNullLock,
@@ -127,12 +161,27 @@ NodeLight* NodeLight::findChild(uint key,
 
     *outNewNodeCreated = false;
 
+    if (key >= maxKey_)
+    {
+        return nullptr;
+    }
+
     NodeLight *prev = nullptr;
-    NodeLight *curr = children_;
-    while (curr != nullptr && curr->key_ != key)
+    NodeLight *curr;
+    NodeLight **index = index_;
+    if (index != nullptr)
+    {
+        // promoted node --> no need to walk the list
+        curr = index[key];
+    }
+    else
     {
-        prev = curr;
-        curr = curr->next_;
+        curr = children_;
+        while (curr != nullptr && curr->key_ != key)
+        {
+            prev = curr;
+            curr = curr->next_;
+        }
     }
 
     if (curr != nullptr)
@@ -154,9 +203,21 @@ NodeLight* NodeLight::findChild(uint key,
     else
     {
         // didn't find it and we are holding the lock -> create a new node and link it
-        NodeLight *newNode = NodeLight::create(key);
-        *outNewNodeCreated = newNode != nullptr;
-        if (prev != nullptr)
+        NodeLight *newNode = NodeLight::create(key, maxKey_);
+        if (newNode == nullptr)
+        {
+            return nullptr;
+        }
+
+        *outNewNodeCreated = true;
+        if (index != nullptr)
+        {
+            // the order of the list doesn't matter once it's indexed --> prepend instead of walking it
+            newNode->next_ = children_;
+            children_ = newNode;
+            OSCompareAndSwapPtr(nullptr, newNode, &index[key]);
+        }
+        else if (prev != nullptr)
         {
             prev->next_ = newNode;
         }
@@ -165,6 +226,12 @@ NodeLight* NodeLight::findChild(uint key,
             assert(children_ == nullptr);
             children_ = newNode;
         }
+
+        if (++childrenCount_ > s_promotionThreshold && index == nullptr)
+        {
+            promote();
+        }
+
         return newNode;
     }
 }
@@ -77,31 +77,54 @@ protected:
 
 /* =================== class NodeLight ====================== */
 
+/*!
+ * Keeps its children in a linked list.  Once a node gets more than 's_promotionThreshold' children (e.g., a directory
+ * with many entries), it is promoted: it additionally indexes its children directly by key, the way NodeFast does.
+ */
 class NodeLight : public Node
 {
     OSDeclareDefaultStructors(NodeLight);
 
 private:
+
+    /*! Number of children a node can have before it gets promoted */
+    static const uint s_promotionThreshold = 8;
+
     /*! The key by which the parent can find this node */
     uint key_;
 
+    /*! The number of possible keys of the children of this node */
+    uint maxKey_;
+
+    /*! The number of children of this node */
+    uint childrenCount_;
+
     /*! Pointer to the next sibling. */
     NodeLight *next_;
 
     /*! Pointer to the first child node */
     NodeLight *children_;
 
+    /*! Children indexed by key ('maxKey_' pointers), only allocated once this node gets promoted */
+    NodeLight **index_;
+
     NodeLight* findChild(uint key,
                          bool createIfMissing,
                          BXLRecursiveLock *maybeNulllock,
                          BXLRecursiveLock *nonNullLock,
                          bool *outNewNodeCreated);
 
-    bool init(uint key);
+    /*! Indexes the current children of this node.  Must be called while holding the lock of the trie. */
+    void promote();
+
+    bool init(uint key, uint maxKey);
+
+    static NodeLight* create(uint key, uint maxKey);
 
 public:
 
-    static NodeLight* create(uint key);
+    static NodeLight* createUintNode(uint key) { return create(key, s_uintNodeMaxKey); }
+    static NodeLight* createPathNode(uint key) { return create(key, s_pathNodeMaxKey); }
 
 protected:
 
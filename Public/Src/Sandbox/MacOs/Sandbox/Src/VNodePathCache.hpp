@@ -0,0 +1,154 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef VNodePathCache_hpp
+#define VNodePathCache_hpp
+
+#include <IOKit/IOLib.h>
+#include <libkern/c++/OSSymbol.h>
+#include <sys/vnode.h>
+#include "Alloc.hpp"
+
+/*!
+ * A small direct-mapped cache from directory vnodes to their absolute paths (as interned symbols), so that
+ * the lookups under the same directory (which come over and over during compilation) don't all have to call
+ * 'vn_getpath'.
+ *
+ * A vnode is identified by its address along with its 'vid', which changes whenever the vnode gets recycled.
+ * A vnode keeps its identity when it is renamed though, so every entry also remembers the rename generation
+ * (see 'Listeners::g_dirRenameGeneration') it was computed in and is only valid in that same generation.
+ */
+class VNodePathCache final
+{
+private:
+
+    static const uint kNumSlots = 256;
+
+    typedef struct {
+        vnode_t vnode;
+        uint32_t vid;
+        uint32_t generation;
+        const OSSymbol *path;
+    } Slot;
+
+    Slot slots_[kNumSlots];
+
+    /*! Only held for comparing and swapping the contents of a slot */
+    IOSimpleLock *lock_;
+
+    VNodePathCache() = delete;
+
+    static inline uint SlotIndex(vnode_t vp)
+    {
+        uintptr_t bits = (uintptr_t)vp;
+        return (uint)((bits >> 4) ^ (bits >> 12)) % kNumSlots;
+    }
+
+public:
+
+    ~VNodePathCache()
+    {
+        for (uint i = 0; i < kNumSlots; i++)
+        {
+            OSSafeReleaseNULL(slots_[i].path);
+        }
+
+        if (lock_ != nullptr)
+        {
+            IOSimpleLockFree(lock_);
+            lock_ = nullptr;
+        }
+    }
+
+    /*!
+     * Copies the cached path of 'vp' into 'buffer' and sets 'length' to its length including the terminating 0
+     * (same as 'vn_getpath').  Returns false if the path of 'vp' is not cached for the given rename generation,
+     * or if it doesn't fit into 'length' bytes.
+     */
+    bool TryGetPath(vnode_t vp, uint32_t generation, char *buffer, int *length)
+    {
+        uint32_t vid = vnode_vid(vp);
+        Slot &slot = slots_[SlotIndex(vp)];
+
+        const OSSymbol *path = nullptr;
+        IOSimpleLockLock(lock_);
+        if (slot.vnode == vp && slot.vid == vid && slot.generation == generation && slot.path != nullptr)
+        {
+            path = slot.path;
+            path->retain();
+        }
+        IOSimpleLockUnlock(lock_);
+
+        if (path == nullptr)
+        {
+            return false;
+        }
+
+        bool fits = path->getLength() + 1 <= *length;
+        if (fits)
+        {
+            memcpy(buffer, path->getCStringNoCopy(), path->getLength() + 1);
+            *length = path->getLength() + 1;
+        }
+
+        path->release();
+        return fits;
+    }
+
+    /*!
+     * Remembers 'path' as the path of 'vp' in the given rename generation (which must have been obtained
+     * before 'path' was computed), evicting whichever vnode occupied the same slot.
+     */
+    void SetPath(vnode_t vp, uint32_t generation, const char *path)
+    {
+        const OSSymbol *symbol = OSSymbol::withCString(path);
+        if (symbol == nullptr)
+        {
+            return;
+        }
+
+        uint32_t vid = vnode_vid(vp);
+        Slot &slot = slots_[SlotIndex(vp)];
+
+        IOSimpleLockLock(lock_);
+        const OSSymbol *evicted = slot.path;
+        slot = { .vnode = vp, .vid = vid, .generation = generation, .path = symbol };
+        IOSimpleLockUnlock(lock_);
+
+        // releasing may have to take the global symbol lock, so it's not done while holding 'lock_'
+        OSSafeReleaseNULL(evicted);
+    }
+
+#pragma mark Static Methods
+
+    /*! Factory method. The caller is responsible for destroying the returned object (with 'Destroy'). */
+    static VNodePathCache* Create()
+    {
+        VNodePathCache *cache = Alloc::New<VNodePathCache>(1);
+        if (cache == nullptr)
+        {
+            return nullptr;
+        }
+
+        bzero(cache->slots_, sizeof(cache->slots_));
+        cache->lock_ = IOSimpleLockAlloc();
+        if (cache->lock_ == nullptr)
+        {
+            Destroy(cache);
+            return nullptr;
+        }
+
+        return cache;
+    }
+
+    static void Destroy(VNodePathCache *cache)
+    {
+        if (cache != nullptr)
+        {
+            cache->~VNodePathCache();
+            Alloc::Delete<VNodePathCache>(cache, 1);
+        }
+    }
+};
+
+#endif /* VNodePathCache_hpp */
@@ -2,60 +2,168 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include "CanonicalizedPath.h"
+#include "DetouredScope.h"
+#include "buildXL_mem.h"
 
-// Applies GetFullPathnameW to 'path'. This function should not be used on \\?\ or \??\ style paths.
-static DWORD GetFullPath(__in PCWSTR path, std::wstring& fullPath)
+// Capacity of the buffers that are recycled. Longer paths get a buffer of their own size, which is freed when released.
+#define SMALL_BUFFER_CAPACITY MAX_PATH
+
+// Number of small buffers each thread keeps for reuse
+#define MAX_RECYCLED_BUFFERS 32
+
+// Small buffers released by the current thread are kept in its DetouredThreadContext, linked through NextRecycled
+
+static inline size_t GetBufferSize(size_t capacity)
+{
+    return offsetof(CanonicalizedPathBuffer, Chars) + capacity * sizeof(wchar_t);
+}
+
+CanonicalizedPathBuffer* CanonicalizedPathBuffer::Allocate(size_t length)
+{
+    CanonicalizedPathBuffer* buffer = nullptr;
+    size_t capacity = length + 1;
+    if (capacity <= SMALL_BUFFER_CAPACITY)
+    {
+        capacity = SMALL_BUFFER_CAPACITY;
+        DetouredThreadContext& context = DetouredThreadContext::Current();
+        buffer = context.RecycledPathBuffers;
+        if (buffer != nullptr)
+        {
+            context.RecycledPathBuffers = buffer->NextRecycled;
+            context.RecycledPathBufferCount--;
+        }
+    }
+
+    if (buffer == nullptr)
+    {
+        buffer = static_cast<CanonicalizedPathBuffer*>(dd_malloc(GetBufferSize(capacity)));
+        if (buffer == nullptr)
+        {
+            return nullptr;
+        }
+
+        buffer->Capacity = capacity;
+    }
+
+    buffer->RefCount = 1;
+    buffer->NextRecycled = nullptr;
+    buffer->Length = 0;
+    buffer->Chars[0] = L'\0';
+    return buffer;
+}
+
+void CanonicalizedPathBuffer::Release()
+{
+    if (InterlockedDecrement(&RefCount) != 0)
+    {
+        return;
+    }
+
+    DetouredThreadContext& context = DetouredThreadContext::Current();
+    if (Capacity == SMALL_BUFFER_CAPACITY && context.RecycledPathBufferCount < MAX_RECYCLED_BUFFERS)
+    {
+        NextRecycled = context.RecycledPathBuffers;
+        context.RecycledPathBuffers = this;
+        context.RecycledPathBufferCount++;
+        return;
+    }
+
+    dd_free(this);
+}
+
+void ReleaseCurrentThreadCanonicalizedPathBuffers()
+{
+    DetouredThreadContext& context = DetouredThreadContext::Current();
+    while (context.RecycledPathBuffers != nullptr)
+    {
+        CanonicalizedPathBuffer* buffer = context.RecycledPathBuffers;
+        context.RecycledPathBuffers = buffer->NextRecycled;
+        dd_free(buffer);
+    }
+
+    context.RecycledPathBufferCount = 0;
+}
+
+CanonicalizedPathBuffer* CanonicalizedPath::CreateBuffer(wchar_t const* value, size_t length, wchar_t const* suffix, size_t suffixLength)
 {
-    // First, we try with a fixed-sized buffer, which should be good enough for all practical cases
+    CanonicalizedPathBuffer* buffer = CanonicalizedPathBuffer::Allocate(length + suffixLength);
+    if (buffer == nullptr)
+    {
+        return nullptr;
+    }
 
-    WCHAR wszBuffer[MAX_PATH];
-    DWORD nBufferLength = sizeof(wszBuffer) / sizeof(WCHAR);
+    wmemcpy(buffer->Chars, value, length);
+    if (suffixLength > 0)
+    {
+        wmemcpy(buffer->Chars + length, suffix, suffixLength);
+    }
 
-    DWORD result = GetFullPathNameW(path, nBufferLength, wszBuffer, NULL);
+    buffer->Length = length + suffixLength;
+    buffer->Chars[buffer->Length] = L'\0';
+    return buffer;
+}
+
+// Applies GetFullPathnameW to 'path'. This function should not be used on \\?\ or \??\ style paths.
+// On failure, returns nullptr and sets the last error.
+static CanonicalizedPathBuffer* GetFullPath(__in PCWSTR path)
+{
+    // First, we try with a small buffer, which should be good enough for all practical cases (and is usually a recycled one)
+    CanonicalizedPathBuffer* buffer = CanonicalizedPathBuffer::Allocate(0);
+    if (buffer == nullptr)
+    {
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return nullptr;
+    }
+
+    DWORD nBufferLength = static_cast<DWORD>(buffer->Capacity);
+    DWORD result = GetFullPathNameW(path, nBufferLength, buffer->Chars, NULL);
 
     if (result == 0)
     {
-        return GetLastError();
+        DWORD error = GetLastError();
+        buffer->Release();
+        SetLastError(error);
+        return nullptr;
     }
 
     if (result < nBufferLength)
     {
         // The buffer was big enough. The return value indicates the length of the full path, NOT INCLUDING the terminating null character.
         // http://msdn.microsoft.com/en-us/library/windows/desktop/aa364963(v=vs.85).aspx
-        fullPath = std::wstring(wszBuffer, static_cast<size_t>(result));
+        buffer->Length = result;
+        return buffer;
     }
-    else
-    {
-        // Second, if that buffer wasn't big enough, we try again with a dynamically allocated buffer with sufficient size
 
-        // Note that in this case, the return value indicates the required buffer length, INCLUDING the terminating null character.
-        // http://msdn.microsoft.com/en-us/library/windows/desktop/aa364963(v=vs.85).aspx
-        unique_ptr<wchar_t[]> buffer(new wchar_t[result]);
-        assert(buffer.get());
+    buffer->Release();
 
-        DWORD result2 = GetFullPathNameW(path, result, buffer.get(), NULL);
+    // Second, if that buffer wasn't big enough, we try again with a dynamically allocated buffer with sufficient size
 
-        if (result2 == 0)
-        {
-            return GetLastError();
-        }
+    // Note that in this case, the return value indicates the required buffer length, INCLUDING the terminating null character.
+    // http://msdn.microsoft.com/en-us/library/windows/desktop/aa364963(v=vs.85).aspx
+    buffer = CanonicalizedPathBuffer::Allocate(result - 1);
+    if (buffer == nullptr)
+    {
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return nullptr;
+    }
 
-        if (result2 < result)
-        {
-            fullPath = std::wstring(buffer.get(), result2);
-        }
-        else
-        {
-            return ERROR_NOT_ENOUGH_MEMORY;
-        }
+    DWORD result2 = GetFullPathNameW(path, static_cast<DWORD>(buffer->Capacity), buffer->Chars, NULL);
+
+    if (result2 == 0 || result2 >= buffer->Capacity)
+    {
+        DWORD error = result2 == 0 ? GetLastError() : ERROR_NOT_ENOUGH_MEMORY;
+        buffer->Release();
+        SetLastError(error);
+        return nullptr;
     }
 
-    return ERROR_SUCCESS;
+    buffer->Length = result2;
+    return buffer;
 }
 
 CanonicalizedPath CanonicalizedPath::Canonicalize(wchar_t const* noncanonicalPath) {
     PathType pathType;
-    std::wstring fullPath;
+    CanonicalizedPathBuffer* fullPath;
     if (IsWin32NtPathName(noncanonicalPath)) {
         // Caller is using escape syntax to avoid Win32 interpretation of path.
         // That's actually really good for us.  The text after the prefix is
@@ -64,7 +172,7 @@ CanonicalizedPath CanonicalizedPath::Canonicalize(wchar_t const* noncanonicalPat
         //    IsWin32NtPathName(path) ? path : GetFullPathName(path),
         // and in fact GetFullPathName(path) and path aren't always equivalent if IsWin32NtPathName(path).
         pathType = PathType::Win32Nt;
-        fullPath = std::wstring(noncanonicalPath);
+        fullPath = CreateBuffer(noncanonicalPath, wcslen(noncanonicalPath), nullptr, 0);
     }
     else {
         // The path is not a Win32-NT pathname so it is subject to GetFullPathName canonicalization by the kernel.
@@ -74,16 +182,16 @@ CanonicalizedPath CanonicalizedPath::Canonicalize(wchar_t const* noncanonicalPat
         // Note that even non-drive-letter devices like \\.\nul, \\.\Harddisk0Partition1, etc. can safely become nul and Harddisk0Partition1 respectively; 
         // imagine the manifest tree root as implicitly \??\ (the session's DosDevices namespace).
 
-        DWORD error = GetFullPath(noncanonicalPath, fullPath);
-        if (error != ERROR_SUCCESS) {
+        fullPath = GetFullPath(noncanonicalPath);
+        if (fullPath == nullptr) {
             return CanonicalizedPath();
         }
 
         // Note that GetFullPath("nul") == "\\.\nul" (similar for other classic devices), so we check for the local device type after that step.
-        pathType = IsLocalDevicePathName(fullPath.c_str()) ? PathType::LocalDevice : PathType::Win32;
+        pathType = IsLocalDevicePathName(fullPath->Chars) ? PathType::LocalDevice : PathType::Win32;
     }
 
-    return CanonicalizedPath(pathType, std::move(fullPath));
+    return CanonicalizedPath(pathType, fullPath);
 }
 
 CanonicalizedPath CanonicalizedPath::Extend(wchar_t const* additionalComponents, size_t* extensionStartIndex) const {
@@ -93,21 +201,29 @@ CanonicalizedPath CanonicalizedPath::Extend(wchar_t const* additionalComponents,
         additionalComponents++;
     }
 
-    std::wstring extended{};
-    extended.reserve(wcslen(additionalComponents) + Length() + 1);
-    extended.append(*m_value);
+    size_t length = Length();
+    bool addSeparator = length > 0 && !IsDirectorySeparator(m_value->Chars[length - 1]);
+    size_t additionalLength = wcslen(additionalComponents);
+
+    CanonicalizedPathBuffer* extended = CanonicalizedPathBuffer::Allocate(length + (addSeparator ? 1 : 0) + additionalLength);
+    if (extended == nullptr) {
+        return CanonicalizedPath();
+    }
 
-    if (!extended.empty() && !IsDirectorySeparator(extended.back())) {
-        extended.push_back(NT_DIRECTORY_SEPARATOR);
+    wmemcpy(extended->Chars, m_value->Chars, length);
+    if (addSeparator) {
+        extended->Chars[length++] = NT_DIRECTORY_SEPARATOR;
     }
 
     if (extensionStartIndex != nullptr) {
-        *extensionStartIndex = extended.size();
+        *extensionStartIndex = length;
     }
 
-    extended.append(additionalComponents);
+    wmemcpy(extended->Chars + length, additionalComponents, additionalLength);
+    extended->Length = length + additionalLength;
+    extended->Chars[extended->Length] = L'\0';
 
-    return CanonicalizedPath(Type, std::move(extended));
+    return CanonicalizedPath(Type, extended);
 }
 
 wchar_t const* CanonicalizedPath::GetLastComponent() const {
@@ -132,6 +248,6 @@ CanonicalizedPath CanonicalizedPath::RemoveLastComponent() const {
 
     // If the last path separator is at zero-based index N, we want the preceding N characters.
     // If there are no path separators (or a path separator at index 0), we want a zero length string.
-    size_t lastSeparatorIndex = FindFinalPathSeparator(m_value->c_str());
-    return CanonicalizedPath(Type, m_value->substr(0, lastSeparatorIndex));
+    size_t lastSeparatorIndex = FindFinalPathSeparator(m_value->Chars);
+    return CanonicalizedPath(Type, CreateBuffer(m_value->Chars, lastSeparatorIndex, nullptr, 0));
 }
@@ -5,6 +5,32 @@
 
 #include "FileAccessHelpers.h"
 
+// Reference counted storage of the string of a CanonicalizedPath, allocated from the private heap.
+//
+// Buffers for paths shorter than MAX_PATH all have the same capacity, and are recycled through a small per-thread list instead of
+// being freed, so canonicalizing a path usually doesn't allocate. A buffer can be released on any thread, which then recycles it.
+struct CanonicalizedPathBuffer {
+    volatile LONG RefCount;
+
+    // Next buffer in the list of recycled buffers of a thread
+    CanonicalizedPathBuffer* NextRecycled;
+
+    // In characters, including the terminating null
+    size_t Capacity;
+    size_t Length;
+    wchar_t Chars[1];
+
+    // Returns a buffer with one reference that can hold 'length' characters (plus the terminating null), or nullptr if out of memory.
+    // Chars and Length are left for the caller to fill in.
+    static CanonicalizedPathBuffer* Allocate(size_t length);
+
+    void AddRef() { InterlockedIncrement(&RefCount); }
+    void Release();
+};
+
+// Frees the buffers recycled by the current thread, called when the thread exits.
+void ReleaseCurrentThreadCanonicalizedPathBuffers();
+
 // Immutable, typed, and canonical path string. The represented path is absolute, free of .. and . traversals, redundant path separators, etc.
 // A canonicalized path is independent of the current directory (which is mutable and process global).
 // Since the path is immutable, the underlying storage for the path string is shared among instances under copy construction and assignment.
@@ -14,17 +40,43 @@ struct CanonicalizedPath {
     { }
 
     CanonicalizedPath(PathType type, wchar_t const* value, size_t valuePrefixLength)
-        : Type(type), m_value(std::make_shared<std::wstring>(value, valuePrefixLength))
+        : CanonicalizedPath(type, CreateBuffer(value, valuePrefixLength, nullptr, 0))
     { }
 
     CanonicalizedPath(CanonicalizedPath&& other)
-        : Type(other.Type), m_value(std::move(other.m_value))
+        : Type(other.Type), m_value(other.m_value)
     {
         other.Type = PathType::Null;
+        other.m_value = nullptr;
+    }
+
+    CanonicalizedPath(const CanonicalizedPath& other)
+        : Type(other.Type), m_value(other.m_value)
+    {
+        if (m_value) {
+            m_value->AddRef();
+        }
+    }
+
+    CanonicalizedPath& operator=(const CanonicalizedPath& other) {
+        if (other.m_value) {
+            other.m_value->AddRef();
+        }
+
+        if (m_value) {
+            m_value->Release();
+        }
+
+        Type = other.Type;
+        m_value = other.m_value;
+        return *this;
     }
 
-    CanonicalizedPath(const CanonicalizedPath& other) = default;
-    CanonicalizedPath& operator=(const CanonicalizedPath&) = default;
+    ~CanonicalizedPath() {
+        if (m_value) {
+            m_value->Release();
+        }
+    }
 
     CanonicalizedPath Extend(wchar_t const* additionalComponents, size_t* extensionStartIndex = nullptr) const;
     CanonicalizedPath RemoveLastComponent() const;
@@ -32,11 +84,11 @@ struct CanonicalizedPath {
     bool IsNull() const { return Type == PathType::Null; }
 
     size_t Length() const {
-        return m_value ? m_value->length() : 0;
+        return m_value ? m_value->Length : 0;
     }
 
     wchar_t const* GetPathString() const {
-        return m_value ? m_value->c_str() : nullptr;
+        return m_value ? m_value->Chars : nullptr;
     }
 
     // Returns the path string with the type prefix (\\?\, \??\, or \\.\) omitted if present.
@@ -64,11 +116,14 @@ struct CanonicalizedPath {
     PathType Type;
 
 private:
-    // Private constructor for Canonicalize, which creates a wstring for m_value.
-    // This constructor allocates a new shared_ptr managed string but moves the contents rather than copying them.
-    CanonicalizedPath(PathType type, std::wstring&& value)
-        : Type(type), m_value(std::make_shared<std::wstring>(std::move(value)))
+    // Private constructor for Canonicalize, Extend and RemoveLastComponent, which takes over the reference of an already filled buffer.
+    // A null buffer (out of memory) results in a null path.
+    CanonicalizedPath(PathType type, CanonicalizedPathBuffer* value)
+        : Type(value ? type : PathType::Null), m_value(value)
     { }
 
-    std::shared_ptr<std::wstring> m_value;
+    // Creates a buffer with the concatenation of both strings
+    static CanonicalizedPathBuffer* CreateBuffer(wchar_t const* value, size_t length, wchar_t const* suffix, size_t suffixLength);
+
+    CanonicalizedPathBuffer* m_value;
 };
@@ -109,6 +109,25 @@ inline bool CheckReportAnyAccess(FileAccessManifestFlag flags, bool accessDenied
     m(AlwaysRemoteInjectDetoursFrom32BitProcess,        0x10) \
     m(UnconditionallyEnableLinuxPTraceSandbox,          0x20) \
     m(IgnoreDeviceIoControlGetReparsePoint,             0x40) \
+    m(EnableLinuxSeccompNotifySandbox,                  0x80) \
+    m(EnableLinuxSharedAccessCache,                     0x100) \
+    m(EnableLinuxSandboxStatistics,                     0x200) \
+    m(EnableSharedMemoryReports,                        0x400) \
+    m(EnableCompactFileAccessReports,                   0x800) \
+    m(EnableReportBatching,                             0x1000) \
+    m(EnableSharedReparsePointCache,                    0x2000) \
+    m(EnableManifestRecordIndex,                        0x4000) \
+    m(EnableSharedPayloadSection,                       0x8000) \
+    m(EnableDetoursProfile,                             0x10000) \
+    m(EnableLinuxLightweightObservation,                0x20000) \
+    m(EnableLinuxPTraceFdTable,                         0x40000) \
+    m(EnableBlockCloneCopies,                           0x80000) \
+    m(EnableReportDeduplication,                        0x100000) \
+    m(EnableLinuxCgroupAccounting,                      0x200000) \
+    m(EnableLinuxManifestUpdates,                       0x400000) \
+    m(EnableLinuxCompressedReports,                     0x800000) \
+    m(EnableLinuxPTraceHandBack,                        0x1000000) \
+    m(EnableLinuxSampledObservation,                    0x2000000) \
 
 enum class FileAccessManifestExtraFlag {
     FOR_ALL_FAM_EXTRA_FLAGS(GEN_FAM_FLAG_ENUM_NAME_VALUE)
@@ -171,6 +190,9 @@ enum FileAccessPolicy
     // If set, full reparse point tracking should be done for this path/file
     FileAccessPolicy_EnableFullReparsePointParsing = 0x1000,
 
+    // If set, neither the paths under this scope nor the path to it contain reparse points, so there is no need to look for them
+    FileAccessPolicy_ContainsNoReparsePoints = 0x2000,
+
     // If set, then we will report all attempts to access files under this scope (whether existent or not).
     // BuildXL uses this information to discover dynamic dependencies, such as #include-ed files.
     FileAccessPolicy_ReportAccess = FileAccessPolicy_ReportAccessIfNonExistent | FileAccessPolicy_ReportAccessIfExistent,
@@ -211,7 +233,8 @@ enum class ReportType
     ReportType_ProcessData = 4,
     ReportType_ProcessDetouringStatus = 5,
     ReportType_AugmentedFileAccess = 6,
-    ReportType_Max = 7,
+    ReportType_CompactFileAccess = 7,
+    ReportType_Max = 8,
 };
 
 // Keep this in sync with the C# version declared in FileAccessManifest.cs
@@ -549,6 +572,21 @@ typedef struct ManifestReport_t
 
         return size;
     }
+
+    /// GetSharedMemoryName
+    ///
+    /// When the report is a handle, the handle may be followed by the (null terminated) name of the shared memory the host
+    /// created for the pip: the report ring the reports should be sent through has that name (see ReportRing.h), and the shared
+    /// reparse point cache the name with a suffix (see SharedReparsePointCache.h). Returns nullptr if there is none.
+    const ReportPathType* GetSharedMemoryName() const noexcept
+    {
+        if (!IsReportHandle() || static_cast<size_t>(Size & ~0x1) <= sizeof(ReportHandleType32Bit))
+        {
+            return nullptr;
+        }
+
+        return reinterpret_cast<const ReportPathType*>(reinterpret_cast<const uint8_t*>(&Report.ReportHandle32Bit) + sizeof(ReportHandleType32Bit));
+    }
 } ManifestReport;
 typedef const ManifestReport * PCManifestReport;
 
@@ -728,6 +766,107 @@ typedef struct ManifestRecord_t
 } ManifestRecord;
 typedef const ManifestRecord * PCManifestRecord; // duplicated for use in scopes outside of the struct
 
+// ==========================================================================
+// == ManifestRecordIndex
+// ==========================================================================
+// CODESYNC: FileAccessManifest.cs :: WriteManifestRecordIndex
+//
+// When FileAccessManifestExtraFlag::EnableManifestRecordIndex is set, the host appends a flat table of all the records of the
+// manifest tree to the payload, keyed by the hash of their full path (see CombineManifestPrefixHash). A policy search from the
+// root can then find the deepest record matching a path with a few probes, instead of one FindChild per path atom.
+//
+// The table is an open addressing hash table with at most half of its slots in use. Slots are 16 bytes and the table starts at a
+// 64-byte boundary of the payload, so a probe rarely leaves a cache line. A footer follows the table and ends the payload, which
+// is how the table is found: the tree always ends with a null-terminated (zero padded) partial path, so the last bytes of a payload
+// without an index can't be the tag.
+#define MANIFEST_RECORD_INDEX_TAG 0xD1C7F00D
+#define MANIFEST_RECORD_INDEX_NO_PARENT 0xFFFFFFFF
+#define MANIFEST_RECORD_INDEX_PREFIX_HASH_SEED 0xCBF29CE484222325ULL
+
+typedef struct ManifestRecordIndexSlot_t
+{
+    uint64_t PrefixHash;    // 0 for an empty slot
+    uint32_t RecordOffset;  // Offset of the record from the root record
+    uint32_t Parent;        // Slot of the parent record, MANIFEST_RECORD_INDEX_NO_PARENT for the root
+} ManifestRecordIndexSlot;
+
+typedef struct ManifestRecordIndexFooter_t
+{
+    uint32_t SlotCount;     // A power of 2
+    uint32_t RecordCount;
+    uint32_t Size;          // Of the table and the footer, in bytes
+    uint32_t Tag;
+} ManifestRecordIndexFooter;
+
+// Full path hash of a record, given the one of its parent (MANIFEST_RECORD_INDEX_PREFIX_HASH_SEED for the root) and its own hash.
+inline uint64_t CombineManifestPrefixHash(uint64_t parentPrefixHash, uint32_t recordHash) noexcept
+{
+    uint64_t hash = (parentPrefixHash ^ recordHash) * 0x100000001B3ULL;
+    hash ^= hash >> 29;
+    return hash == 0 ? 1 : hash;
+}
+
+struct ManifestRecordIndex
+{
+    ManifestRecordIndex() noexcept : Root(nullptr), Slots(nullptr), SlotCount(0) { }
+
+    // Locates the index at the end of a payload whose tree starts at root. Returns false if there is none or it is not valid.
+    bool TryLocate(PCManifestRecord root, const BYTE* payloadEnd) noexcept
+    {
+        const BYTE* treeStart = reinterpret_cast<const BYTE*>(root);
+        if (payloadEnd < treeStart || static_cast<size_t>(payloadEnd - treeStart) < sizeof(ManifestRecordIndexFooter))
+        {
+            return false;
+        }
+
+        const ManifestRecordIndexFooter* footer = reinterpret_cast<const ManifestRecordIndexFooter*>(payloadEnd - sizeof(ManifestRecordIndexFooter));
+        if (footer->Tag != MANIFEST_RECORD_INDEX_TAG
+            || footer->SlotCount == 0
+            || (footer->SlotCount & (footer->SlotCount - 1)) != 0
+            || footer->Size != static_cast<size_t>(footer->SlotCount) * sizeof(ManifestRecordIndexSlot) + sizeof(ManifestRecordIndexFooter)
+            || footer->Size > static_cast<size_t>(payloadEnd - treeStart))
+        {
+            return false;
+        }
+
+        Root = root;
+        Slots = reinterpret_cast<const ManifestRecordIndexSlot*>(payloadEnd - footer->Size);
+        SlotCount = footer->SlotCount;
+        return true;
+    }
+
+    bool IsValid() const noexcept { return Slots != nullptr; }
+
+    // Returns the slot holding the given full path hash, or MANIFEST_RECORD_INDEX_NO_PARENT if there is none
+    uint32_t Find(uint64_t prefixHash) const noexcept
+    {
+        const uint32_t mask = SlotCount - 1;
+        for (uint32_t i = static_cast<uint32_t>(prefixHash) & mask, probes = 0; probes < SlotCount; i = (i + 1) & mask, probes++)
+        {
+            if (Slots[i].PrefixHash == prefixHash)
+            {
+                return i;
+            }
+
+            if (Slots[i].PrefixHash == 0)
+            {
+                break;
+            }
+        }
+
+        return MANIFEST_RECORD_INDEX_NO_PARENT;
+    }
+
+    PCManifestRecord GetRecord(uint32_t slot) const noexcept
+    {
+        return reinterpret_cast<PCManifestRecord>(reinterpret_cast<const BYTE*>(Root) + Slots[slot].RecordOffset);
+    }
+
+    PCManifestRecord Root;
+    const ManifestRecordIndexSlot* Slots;
+    uint32_t SlotCount;
+};
+
 // ==========================================================================
 // == SpecialProcessKind
 // ==========================================================================
@@ -5,13 +5,17 @@
 
 #include "DetouredFunctions.h"
 #include "DetouredScope.h"
+#include "DetoursProfile.h"
 #include "HandleOverlay.h"
 #include "MetadataOverrides.h"
 #include "ResolvedPathCache.h"
+#include "SharedReparsePointCache.h"
 #include "SendReport.h"
 #include "StringOperations.h"
 #include "SubstituteProcessExecution.h"
 #include "UnicodeConverter.h"
+#include "UniqueHandle.h"
+#include "VolumePathTable.h"
 
 #include <Pathcch.h>
 
@@ -133,15 +137,15 @@ static bool AccessReparsePointTarget(
     return !FlagsAndAttributesContainReparsePointFlag(dwFlagsAndAttributes) && IsReparsePoint(lpFileName, hFile);
 }
 
-/// <summary>
-/// Gets the final full path by handle.
-/// </summary>
-/// <remarks>
-/// This function encapsulates calls to <code>GetFinalPathNameByHandleW</code> and allocates memory as needed.
-/// </remarks>
-static DWORD DetourGetFinalPathByHandle(_In_ HANDLE hFile, _Inout_ wstring& fullPath)
+static DWORD DetourGetFinalPathByHandleUncached(_In_ HANDLE hFile, _Inout_ wstring& fullPath)
 {
-    // First, try with a fixed-sized buffer which should be good enough for all practical cases.
+    // Most handles are on a volume with a drive letter, whose DOS name doesn't need to be queried
+    if (TryGetFinalPathByHandleFromVolumePathTable(hFile, fullPath))
+    {
+        return ERROR_SUCCESS;
+    }
+
+    // Otherwise try with a fixed-sized buffer which should be good enough for all practical cases.
     wchar_t wszBuffer[MAX_PATH];
     DWORD nBufferLength = std::extent<decltype(wszBuffer)>::value;
 
@@ -186,6 +190,37 @@ static DWORD DetourGetFinalPathByHandle(_In_ HANDLE hFile, _Inout_ wstring& full
     return ERROR_SUCCESS;
 }
 
+/// <summary>
+/// Gets the final full path by handle.
+/// </summary>
+/// <remarks>
+/// This function encapsulates calls to <code>GetFinalPathNameByHandleW</code> and allocates memory as needed.
+/// The path of a handle opened by the detours is only resolved the first time: it is kept in the overlay of the handle
+/// until this process renames a file or a directory (see HandleOverlayRenameScope).
+/// </remarks>
+static DWORD DetourGetFinalPathByHandle(_In_ HANDLE hFile, _Inout_ wstring& fullPath)
+{
+    HandleOverlayRef overlay = TryLookupHandleOverlay(hFile);
+    if (overlay == nullptr)
+    {
+        return DetourGetFinalPathByHandleUncached(hFile, fullPath);
+    }
+
+    if (TryGetHandleOverlayFinalPath(overlay, fullPath))
+    {
+        return ERROR_SUCCESS;
+    }
+
+    LONG generation = GetHandleOverlayRenameGeneration();
+    DWORD result = DetourGetFinalPathByHandleUncached(hFile, fullPath);
+    if (result == ERROR_SUCCESS)
+    {
+        SetHandleOverlayFinalPath(overlay, fullPath, generation);
+    }
+
+    return result;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////// Resolved path cache /////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -197,6 +232,7 @@ static void PathCache_Invalidate(const std::wstring& path, bool isDirectory, con
     }
 
     ResolvedPathCache::Instance().Invalidate(path, isDirectory);
+    InvalidateSharedReparsePointCache(path, isDirectory);
 }
 
 static const Possible<std::pair<std::wstring, DWORD>> PathCache_GetResolvedPathAndType(const std::wstring& path, const PolicyResult& policyResult)
@@ -221,6 +257,26 @@ static bool PathCache_InsertResolvedPathWithType(const std::wstring& path, std::
     return ResolvedPathCache::Instance().InsertResolvedPathWithType(path, resolved, reparsePointType);
 }
 
+static bool PathCache_GetSharedTarget(const std::wstring& path, std::wstring& target, DWORD& reparsePointType, const PolicyResult& policyResult)
+{
+    if (IgnoreReparsePoints() || IgnoreFullReparsePointResolvingForPath(policyResult) || !IsSharedReparsePointCacheEnabled())
+    {
+        return false;
+    }
+
+    return TryGetSharedReparsePointTarget(path, target, reparsePointType);
+}
+
+static void PathCache_PublishSharedTarget(const std::wstring& path, const std::wstring& target, DWORD reparsePointType, const PolicyResult& policyResult)
+{
+    if (IgnoreReparsePoints() || IgnoreFullReparsePointResolvingForPath(policyResult) || !IsSharedReparsePointCacheEnabled())
+    {
+        return;
+    }
+
+    PublishSharedReparsePointTarget(path, target, reparsePointType);
+}
+
 static const Possible<bool> PathCache_GetResolvingCheckResult(const std::wstring& path, const PolicyResult& policyResult)
 {
     if (IgnoreReparsePoints() || IgnoreFullReparsePointResolvingForPath(policyResult))
@@ -401,6 +457,17 @@ static bool TryGetReparsePointTarget(_In_ const wstring& path, _In_ HANDLE hInpu
         goto Success;
     }
 
+    // Another process of the pip may have resolved the path already
+    if (PathCache_GetSharedTarget(path, target, reparsePointType, policyResult))
+    {
+        PathCache_InsertResolvedPathWithType(path, target, reparsePointType, policyResult);
+        if (reparsePointType == 0x0)
+        {
+            goto Epilogue;
+        }
+        goto Success;
+    }
+
     hFile = hInput != INVALID_HANDLE_VALUE
         ? hInput
         : CreateFileW(
@@ -458,6 +525,7 @@ static bool TryGetReparsePointTarget(_In_ const wstring& path, _In_ HANDLE hInpu
 
     GetTargetNameFromReparseData(pReparseDataBuffer, reparsePointType, target);
     PathCache_InsertResolvedPathWithType(path, target, reparsePointType, policyResult);
+    PathCache_PublishSharedTarget(path, target, reparsePointType, policyResult);
 
 Success:
 
@@ -468,6 +536,7 @@ Error:
 
     // Also add dummy cache entry for paths that are not reparse points, so we can avoid calling DeviceIoControl repeatedly
     PathCache_InsertResolvedPathWithType(path, target, 0x0, policyResult);
+    PathCache_PublishSharedTarget(path, target, 0x0, policyResult);
 
 Epilogue:
 
@@ -494,7 +563,8 @@ static bool ShouldResolveReparsePointsInPath(
     _In_     DWORD                    dwFlagsAndAttributes,
     _In_     const PolicyResult&      policyResult)
 {
-    if (IgnoreReparsePoints())
+    // The host told us there is nothing to resolve on the way to this path
+    if (IgnoreReparsePoints() || policyResult.ContainsNoReparsePoints())
     {
         return false;
     }
@@ -909,27 +979,6 @@ static void DetourGetFinalPaths(_In_ const CanonicalizedPath& path, _In_ HANDLE
     }
 }
 
-/// <summary>
-/// Checks if a path points to a directory.
-/// </summary>
-static bool IsPathToDirectory(_In_ LPCWSTR lpFileName, _In_ bool treatReparsePointAsFile)
-{
-    DWORD lastError = GetLastError();
-    DWORD attributes = GetFileAttributesW(lpFileName);
-    SetLastError(lastError);
-
-    if (attributes == INVALID_FILE_ATTRIBUTES)
-    {
-        return false;
-    }
-
-    bool isDirectory = (attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
-
-    return (isDirectory && treatReparsePointAsFile)
-        ? ((attributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0)
-        : isDirectory;
-}
-
 /// <summary>
 /// Checks if a a handle is a handle of a directory.
 /// </summary>
@@ -1063,6 +1112,21 @@ static bool IsHandleOrPathToDirectory(
     return IsDirectoryFromAttributes(fileOrDirectoryAttribute, treatReparsePointAsFile);
 }
 
+/// <summary>
+/// Checks if a directory symlink opened with the given access and flags must be treated as a file.
+/// </summary>
+static bool TreatReparsePointAsFile(
+    _In_     DWORD                 dwDesiredAccess,
+    _In_     DWORD                 dwFlagsAndAttributes,
+    _In_     PolicyResult*         policyResult)
+{
+    return !ProbeDirectorySymlinkAsDirectory()                             // It is set globally that directory symlink probe should not be treated as directory.
+        && WantsProbeOnlyAccess(dwDesiredAccess)                           // Probe-only access.
+        && FlagsAndAttributesContainReparsePointFlag(dwFlagsAndAttributes) // Open attribute contains reparse point flag.
+        && (policyResult == nullptr                                        // No policy is specified,
+            || !policyResult->TreatDirectorySymlinkAsDirectory());         // or policy does not mandate directory symlink to be treated as directory.
+}
+
 /// <summary>
 /// Checks if a path or handle is a directory given a set of attributes. Note that fileOrDirectoryAttribute is not affected by treatReparsePointAsFile.
 /// </summary>
@@ -1074,16 +1138,40 @@ static bool IsHandleOrPathToDirectory(
     _In_     PolicyResult*         policyResult,
     _Out_    DWORD&                fileOrDirectoryAttribute)
 {
-    bool treatReparsePointAsFile =
-        !ProbeDirectorySymlinkAsDirectory()                                // It is set globally that directory symlink probe should not be treated as directory.
-        && WantsProbeOnlyAccess(dwDesiredAccess)                           // Probe-only access.
-        && FlagsAndAttributesContainReparsePointFlag(dwFlagsAndAttributes) // Open attribute contains reparse point flag.
-        && (policyResult == nullptr                                        // No policy is specified,
-            || !policyResult->TreatDirectorySymlinkAsDirectory());         // or policy does not mandate directory symlink to be treated as directory.
-
-    return IsHandleOrPathToDirectory(hFile, lpFileName, treatReparsePointAsFile, fileOrDirectoryAttribute);
+    return IsHandleOrPathToDirectory(hFile, lpFileName, TreatReparsePointAsFile(dwDesiredAccess, dwFlagsAndAttributes, policyResult), fileOrDirectoryAttribute);
 }
 
+/// <summary>
+/// Attributes of a path, queried the first time they are needed and then reused, so that the checks a detoured operation
+/// does on the same path (is it a directory, does it exist) issue a single <code>GetFileAttributesW</code>.
+/// </summary>
+class CachedPathAttributes
+{
+public:
+    CachedPathAttributes(_In_ LPCWSTR lpFileName)
+        : m_lpFileName(lpFileName), m_queried(false), m_attributes(INVALID_FILE_ATTRIBUTES)
+    { }
+
+    DWORD Get()
+    {
+        if (!m_queried)
+        {
+            GetFileAttributesByPath(m_lpFileName, /*ref*/ m_attributes);
+            m_queried = true;
+        }
+
+        return m_attributes;
+    }
+
+private:
+    LPCWSTR m_lpFileName;
+    bool m_queried;
+    DWORD m_attributes;
+
+    CachedPathAttributes(const CachedPathAttributes&) = delete;
+    CachedPathAttributes& operator=(const CachedPathAttributes&) = delete;
+};
+
 /// <summary>
 /// Enforces allowed access for a particular path that leads to the target of a reparse point.
 /// </summary>
@@ -1101,6 +1189,7 @@ static bool EnforceReparsePointAccess(
 {
     DWORD lastError = GetLastError();
     const wchar_t* lpReparsePointPath = reparsePointPath.c_str();
+    CachedPathAttributes reparsePointPathAttributes(lpReparsePointPath);
 
     // We start with allow / ignore (no access requested) and then restrict based on read / write (maybe both, maybe neither!)
     AccessCheckResult accessCheck(RequestedAccess::None, ResultAction::Allow, ReportLevel::Ignore);
@@ -1109,7 +1198,7 @@ static bool EnforceReparsePointAccess(
     bool initPolicySuccess = policyResult.Initialize(lpReparsePointPath);
     if (!IgnoreFullReparsePointResolvingForPath(policyResult))
     {
-        bool isDir = IsPathToDirectory(lpReparsePointPath, false);
+        bool isDir = IsDirectoryFromAttributes(reparsePointPathAttributes.Get(), false);
         if (isDir && !isFullyResolvedPath)
         {
             // Always report intermediate reparse point target results (junctions and directory symbolic links only) as probes or reads, only the fully resolved path
@@ -1189,11 +1278,15 @@ static bool EnforceReparsePointAccess(
             //
             // Design Document: https://bit.ly/2XBqVWy
 
-            readContext.OpenedDirectory = IgnoreFullReparsePointResolvingForPath(policyResult)
-                ? IsHandleOrPathToDirectory(INVALID_HANDLE_VALUE, lpReparsePointPath, dwDesiredAccess, dwFlagsAndAttributes, &policyResult, /*ref*/ opContext.OpenedFileOrDirectoryAttributes)
-                : isFullyResolvedPath ? IsHandleOrPathToDirectory(INVALID_HANDLE_VALUE, lpReparsePointPath, false, /*ref*/ opContext.OpenedFileOrDirectoryAttributes) : false;
+            if (IgnoreFullReparsePointResolvingForPath(policyResult) || isFullyResolvedPath)
+            {
+                opContext.OpenedFileOrDirectoryAttributes = reparsePointPathAttributes.Get();
+                readContext.OpenedDirectory = IsDirectoryFromAttributes(
+                    opContext.OpenedFileOrDirectoryAttributes,
+                    IgnoreFullReparsePointResolvingForPath(policyResult) && TreatReparsePointAsFile(dwDesiredAccess, dwFlagsAndAttributes, &policyResult));
+            }
 
-            readContext.Existence = GetFileAttributesW(lpReparsePointPath) != INVALID_FILE_ATTRIBUTES
+            readContext.Existence = reparsePointPathAttributes.Get() != INVALID_FILE_ATTRIBUTES
                 ? FileExistence::Existent
                 : FileExistence::Nonexistent;
 
@@ -1497,7 +1590,7 @@ static bool EnforceChainOfReparsePointAccesses(
     const bool enforceAccessForResolvedPath = true,
     const bool preserveLastReparsePoint = false)
 {
-    if (IgnoreReparsePoints() || (isNtCreate && !MonitorNtCreateFile()))
+    if (IgnoreReparsePoints() || (isNtCreate && !MonitorNtCreateFile()) || policyResult.ContainsNoReparsePoints())
     {
         return true;
     }
@@ -1601,7 +1694,7 @@ static bool EnforceChainOfReparsePointAccessesForNonCreateFile(
     const bool enforceAccess = true,
     const bool isCreateDirectory = false)
 {
-    if (!IgnoreNonCreateFileReparsePoints() && !IgnoreReparsePoints())
+    if (!IgnoreNonCreateFileReparsePoints() && !IgnoreReparsePoints() && !policyResult.ContainsNoReparsePoints())
     {
         CanonicalizedPath canonicalPath = CanonicalizedPath::Canonicalize(fileOperationContext.NoncanonicalPath);
 
@@ -1700,6 +1793,13 @@ static bool AdjustOperationContextAndPolicyResultWithFullyResolvedPath(
             return accessResult;
         }
 
+        // Nothing was resolved on the way (e.g., both sides of a hard link in a directory that turned out to hold no reparse point):
+        // the path was canonicalized and its policy looked up already
+        if (AreEqualCaseInsensitively(fullyResolvedPath, path.GetPathStringWithoutTypePrefix()))
+        {
+            return true;
+        }
+
         opContext.AdjustPath(fullyResolvedPath.c_str());
 
         // Reset policy result because the fully resolved path is likely to be different.
@@ -1719,6 +1819,11 @@ static bool AdjustOperationContextAndPolicyResultWithFullyResolvedPath(
 /// <summary>
 /// Validates move directory by validating proper deletion for all source files and proper creation for all target files.
 /// </summary>
+/// <remarks>
+/// The source tree is enumerated one directory at a time, and each entry is checked as soon as it is found, so the tree is never held
+/// in memory as a whole: only the reports are (they have to wait for the outcome of the move). The policy of an entry is resumed from
+/// the one of its directory (see PolicyResult::GetPolicyForSubpath), so a subtree without policies of its own is only searched once.
+/// </remarks>
 static bool ValidateMoveDirectory(
     _In_      LPCWSTR                  sourceContext,
     _In_      LPCWSTR                  destinationContext,
@@ -1728,8 +1833,6 @@ static bool ValidateMoveDirectory(
 {
     DWORD error = GetLastError();
 
-    vector<std::pair<wstring, DWORD>> filesAndDirectories;
-
     DWORD directoryAttributes = GetFileAttributesW(lpExistingFileName);
     bool isDirectory = (directoryAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0 && (directoryAttributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0;
 
@@ -1739,114 +1842,126 @@ static bool ValidateMoveDirectory(
         return true;
     }
 
-    if (!EnumerateDirectory(lpExistingFileName, L"*", true, true, filesAndDirectories))
+    PolicyResult policyResult;
+    if (!policyResult.Initialize(lpExistingFileName))
     {
-        SetLastError(error);
+        policyResult.ReportIndeterminatePolicyAndSetLastError(FileOperationContext(sourceContext, DELETE, 0, OPEN_EXISTING, FILE_ATTRIBUTE_DIRECTORY, lpExistingFileName));
         return false;
     }
 
-    wstring sourceDirectory(lpExistingFileName);
-
-    if (sourceDirectory.back() != L'\\')
-    {
-        sourceDirectory.push_back(L'\\');
-    }
-
-    wstring targetDirectory;
-
-    if (lpNewFileName != NULL)
+    PolicyResult targetPolicyResult;
+    if (lpNewFileName != NULL && !targetPolicyResult.Initialize(lpNewFileName))
     {
-        targetDirectory.assign(lpNewFileName);
-
-        if (targetDirectory.back() != L'\\')
-        {
-            targetDirectory.push_back(L'\\');
-        }
+        targetPolicyResult.ReportIndeterminatePolicyAndSetLastError(FileOperationContext(destinationContext, GENERIC_WRITE, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_DIRECTORY, lpNewFileName));
+        return false;
     }
 
-    PolicyResult policyResult;
-    policyResult.Initialize(lpExistingFileName);
+    // Directories left to enumerate, along with the policies of their source and target paths
+    std::vector<std::pair<PolicyResult, PolicyResult>> directoriesToEnumerate;
+    directoriesToEnumerate.emplace_back(policyResult, targetPolicyResult);
 
-    for (auto entry : filesAndDirectories)
+    while (!directoriesToEnumerate.empty())
     {
-        const std::pair<wstring, DWORD>& elem = entry;
-        wstring file = elem.first;
-        const DWORD& fileAttributes = elem.second;
-
-        // Validate deletion of source.
-        wstring normalizedSourceFile = NormalizePath(file);
-        FileOperationContext sourceOpContext = FileOperationContext(
-            sourceContext,
-            DELETE,
-            0,
-            OPEN_EXISTING,
-            // We are interested in knowing whether the source path is a directory, so make sure
-            // we reflect that in the report
-            FILE_ATTRIBUTE_NORMAL | (fileAttributes & FILE_ATTRIBUTE_DIRECTORY),
-            normalizedSourceFile.c_str());
-
-        PolicyResult sourcePolicyResult;
-        if (!sourcePolicyResult.Initialize(normalizedSourceFile.c_str()))
-        {
-            sourcePolicyResult.ReportIndeterminatePolicyAndSetLastError(sourceOpContext);
-            return false;
-        }
+        const PolicyResult directoryPolicyResult = std::move(directoriesToEnumerate.back().first);
+        const PolicyResult targetDirectoryPolicyResult = std::move(directoriesToEnumerate.back().second);
+        directoriesToEnumerate.pop_back();
 
-        AccessCheckResult sourceAccessCheck = sourcePolicyResult.CheckWriteAccess();
-
-        if (sourceAccessCheck.ShouldDenyAccess())
+        // Large fetches have the file system return entries in bigger batches, so large directories take fewer round trips
+        WIN32_FIND_DATAW ffd;
+        wstring spec = PathCombine(wstring(directoryPolicyResult.GetCanonicalizedPath().GetPathString()), L"*");
+        HANDLE hFind = FindFirstFileExW(NormalizePath(spec).c_str(), FindExInfoBasic, &ffd, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+        if (hFind == INVALID_HANDLE_VALUE)
         {
-            DWORD denyError = sourceAccessCheck.DenialError();
-            ReportIfNeeded(sourceAccessCheck, sourceOpContext, sourcePolicyResult, denyError);
-            sourceAccessCheck.SetLastErrorToDenialError();
+            SetLastError(error);
             return false;
         }
 
-        PathCache_Invalidate(sourcePolicyResult.GetCanonicalizedPath().GetPathStringWithoutTypePrefix(), fileAttributes & FILE_ATTRIBUTE_DIRECTORY, policyResult);
-
-        filesAndDirectoriesToReport.push_back(ReportData(sourceAccessCheck, sourceOpContext, sourcePolicyResult));
-
-        // Validate creation of target.
-
-        if (lpNewFileName != NULL)
+        do
         {
-            file.replace(0, sourceDirectory.length(), targetDirectory);
+            if (wcscmp(ffd.cFileName, L".") == 0 || wcscmp(ffd.cFileName, L"..") == 0)
+            {
+                continue;
+            }
 
-            wstring normalizedTargetFile = NormalizePath(file);
+            const DWORD fileAttributes = ffd.dwFileAttributes;
 
-            FileOperationContext destinationOpContext = FileOperationContext(
-                destinationContext,
-                GENERIC_WRITE,
+            // Validate deletion of source.
+            PolicyResult sourcePolicyResult = directoryPolicyResult.GetPolicyForSubpath(ffd.cFileName);
+            FileOperationContext sourceOpContext = FileOperationContext(
+                sourceContext,
+                DELETE,
                 0,
-                CREATE_ALWAYS,
+                OPEN_EXISTING,
                 // We are interested in knowing whether the source path is a directory, so make sure
                 // we reflect that in the report
                 FILE_ATTRIBUTE_NORMAL | (fileAttributes & FILE_ATTRIBUTE_DIRECTORY),
-                normalizedTargetFile.c_str());
-            destinationOpContext.Correlate(sourceOpContext);
+                // The policy result outlives the context: both end up in the same report data
+                sourcePolicyResult.GetCanonicalizedPath().GetPathString());
 
-            PolicyResult destPolicyResult;
+            AccessCheckResult sourceAccessCheck = sourcePolicyResult.CheckWriteAccess();
 
-            if (!destPolicyResult.Initialize(normalizedTargetFile.c_str()))
+            if (sourceAccessCheck.ShouldDenyAccess())
             {
-                destPolicyResult.ReportIndeterminatePolicyAndSetLastError(destinationOpContext);
+                FindClose(hFind);
+                DWORD denyError = sourceAccessCheck.DenialError();
+                ReportIfNeeded(sourceAccessCheck, sourceOpContext, sourcePolicyResult, denyError);
+                sourceAccessCheck.SetLastErrorToDenialError();
                 return false;
             }
 
-            AccessCheckResult destAccessCheck = (fileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0
-                ? destPolicyResult.CheckCreateDirectoryAccess()
-                : destPolicyResult.CheckWriteAccess();
+            PathCache_Invalidate(sourcePolicyResult.GetCanonicalizedPath().GetPathStringWithoutTypePrefix(), fileAttributes & FILE_ATTRIBUTE_DIRECTORY, policyResult);
+
+            filesAndDirectoriesToReport.push_back(ReportData(sourceAccessCheck, sourceOpContext, sourcePolicyResult));
+
+            // Validate creation of target.
+            PolicyResult destPolicyResult;
 
-            if (destAccessCheck.ShouldDenyAccess())
+            if (lpNewFileName != NULL)
             {
-                // We report the destination access here since we are returning early. Otherwise it is deferred until post-read.
-                DWORD denyError = destAccessCheck.DenialError();
-                ReportIfNeeded(destAccessCheck, destinationOpContext, destPolicyResult, denyError);
-                destAccessCheck.SetLastErrorToDenialError();
-                return false;
+                destPolicyResult = targetDirectoryPolicyResult.GetPolicyForSubpath(ffd.cFileName);
+
+                FileOperationContext destinationOpContext = FileOperationContext(
+                    destinationContext,
+                    GENERIC_WRITE,
+                    0,
+                    CREATE_ALWAYS,
+                    // We are interested in knowing whether the source path is a directory, so make sure
+                    // we reflect that in the report
+                    FILE_ATTRIBUTE_NORMAL | (fileAttributes & FILE_ATTRIBUTE_DIRECTORY),
+                    destPolicyResult.GetCanonicalizedPath().GetPathString());
+                destinationOpContext.Correlate(sourceOpContext);
+
+                AccessCheckResult destAccessCheck = (fileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0
+                    ? destPolicyResult.CheckCreateDirectoryAccess()
+                    : destPolicyResult.CheckWriteAccess();
+
+                if (destAccessCheck.ShouldDenyAccess())
+                {
+                    // We report the destination access here since we are returning early. Otherwise it is deferred until post-read.
+                    FindClose(hFind);
+                    DWORD denyError = destAccessCheck.DenialError();
+                    ReportIfNeeded(destAccessCheck, destinationOpContext, destPolicyResult, denyError);
+                    destAccessCheck.SetLastErrorToDenialError();
+                    return false;
+                }
+
+                filesAndDirectoriesToReport.push_back(ReportData(destAccessCheck, destinationOpContext, destPolicyResult));
             }
 
-            filesAndDirectoriesToReport.push_back(ReportData(destAccessCheck, destinationOpContext, destPolicyResult));
+            // Directory symlinks and junctions are moved as they are, their targets are not part of the move
+            if ((fileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0 && (fileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0)
+            {
+                directoriesToEnumerate.emplace_back(std::move(sourcePolicyResult), std::move(destPolicyResult));
+            }
+        } while (FindNextFileW(hFind, &ffd) != 0);
+
+        bool enumerationCompleted = GetLastError() == ERROR_NO_MORE_FILES;
+        FindClose(hFind);
+
+        if (!enumerationCompleted)
+        {
+            SetLastError(error);
+            return false;
         }
     }
 
@@ -2685,9 +2800,18 @@ NTSTATUS NTAPI Detoured_ZwSetInformationFile(
     _In_  ULONG                  Length,
     _In_  FILE_INFORMATION_CLASS FileInformationClass)
 {
+    PROFILE_DETOUR(ZwSetInformationFile);
+
     // if this is not an enabled case that we are covering, just call the Real_Function.
     FILE_INFORMATION_CLASS_EXTRA fileInformationClassExtra = (FILE_INFORMATION_CLASS_EXTRA)FileInformationClass;
 
+    // Whether the rename is detoured or not, it may change the final path of open handles
+    HandleOverlayRenameScope renameScope(
+        fileInformationClassExtra == FILE_INFORMATION_CLASS_EXTRA::FileRenameInformation
+        || fileInformationClassExtra == FILE_INFORMATION_CLASS_EXTRA::FileRenameInformationEx
+        || fileInformationClassExtra == FILE_INFORMATION_CLASS_EXTRA::FileRenameInformationBypassAccessCheck
+        || fileInformationClassExtra == FILE_INFORMATION_CLASS_EXTRA::FileRenameInformationExBypassAccessCheck);
+
     switch (fileInformationClassExtra)
     {
         case FILE_INFORMATION_CLASS_EXTRA::FileRenameInformation:
@@ -2742,17 +2866,21 @@ NTSTATUS NTAPI Detoured_ZwSetInformationFile(
 
 static bool ShouldBreakawayFromJob(const CanonicalizedPath& fullApplicationPath, _Inout_opt_ LPWSTR lpCommandLine)
 {
-    if (g_breakawayChildProcesses->empty() || fullApplicationPath.IsNull())
+    if (!g_hasBreakawayChildProcesses || fullApplicationPath.IsNull())
     {
         return false;
     }
 
+    EnsureBreakawayChildProcessesParsed();
+
     std::wstring imageName(fullApplicationPath.GetLastComponent());
-    for (auto it = g_breakawayChildProcesses->begin(); it != g_breakawayChildProcesses->end(); ++it)
+    auto candidates = g_pBreakawayChildProcessIndex->Lookup(imageName);
+    for (auto candidate = candidates.first; candidate != candidates.second; ++candidate)
     {
-        if (AreEqualCaseInsensitively(it->ProcessName, imageName))
+        const BreakawayChildProcess* process = &(*g_breakawayChildProcesses)[candidate->second];
+        if (AreEqualCaseInsensitively(process->ProcessName, imageName))
         {
-            if (it->RequiredCommandLineArgsSubstring.empty())
+            if (process->RequiredCommandLineArgsSubstring.empty())
             {
 #if SUPER_VERBOSE
                 Dbg(L"Allowing process to breakaway from job object. Image name: '%s'", imageName.c_str());
@@ -2763,9 +2891,9 @@ static bool ShouldBreakawayFromJob(const CanonicalizedPath& fullApplicationPath,
             std::wstring command;
             std::wstring commandArgs;
             FindApplicationNameFromCommandLine(lpCommandLine, command, commandArgs);
-            if (it->CommandLineArgsSubstringContainmentIgnoreCase)
+            if (process->CommandLineArgsSubstringContainmentIgnoreCase)
             {
-                if (std::search(commandArgs.begin(), commandArgs.end(), it->RequiredCommandLineArgsSubstring.begin(), it->RequiredCommandLineArgsSubstring.end(), [](wchar_t c1, wchar_t c2) {
+                if (std::search(commandArgs.begin(), commandArgs.end(), process->RequiredCommandLineArgsSubstring.begin(), process->RequiredCommandLineArgsSubstring.end(), [](wchar_t c1, wchar_t c2) {
                     return std::towlower(c1) == std::towlower(c2);
                     }) != commandArgs.end())
                 {
@@ -2775,7 +2903,7 @@ static bool ShouldBreakawayFromJob(const CanonicalizedPath& fullApplicationPath,
                     return true;
                 }
             }
-            else if (commandArgs.find(it->RequiredCommandLineArgsSubstring) != std::wstring::npos)
+            else if (commandArgs.find(process->RequiredCommandLineArgsSubstring) != std::wstring::npos)
             {
 #if SUPER_VERBOSE
                 Dbg(L"Allowing process to breakaway from job object. Image name: '%s' | Command line args: '%s'.", imageName.c_str(), commandArgs.c_str());
@@ -2801,6 +2929,11 @@ BOOL WINAPI Detoured_CreateProcessW(
     _In_        LPSTARTUPINFOW        lpStartupInfo,
     _Out_       LPPROCESS_INFORMATION lpProcessInformation)
 {
+    PROFILE_DETOUR(CreateProcessW);
+
+    // Reports of this process, whichever thread batched them, must be received before the reports of the child
+    FlushAllReportBatches(/* processExit */ false);
+
     bool injectedShim = false;
     BOOL ret = MaybeInjectSubstituteProcessShim(
         lpApplicationName,
@@ -2983,6 +3116,8 @@ BOOL WINAPI Detoured_CreateProcessA(
     _In_        LPSTARTUPINFOA        lpStartupInfo,
     _Out_       LPPROCESS_INFORMATION lpProcessInformation)
 {
+    PROFILE_DETOUR(CreateProcessA);
+
     // Note that we only do Real_CreateProcessA
     // for the case of not doing child processes.
     // Otherwise this converts to CreateProcessW
@@ -3091,6 +3226,7 @@ HANDLE WINAPI Detoured_CreateFileW(
     _In_     DWORD                 dwFlagsAndAttributes,
     _In_opt_ HANDLE                hTemplateFile)
 {
+    PROFILE_DETOUR(CreateFileW);
     DetouredScope scope;
 
     // The are potential complication here: How to handle a call to CreateFile with the FILE_FLAG_OPEN_REPARSE_POINT?
@@ -3371,6 +3507,7 @@ HANDLE WINAPI Detoured_CreateFileW(
 IMPLEMENTED(Detoured_CloseHandle)
 BOOL WINAPI Detoured_CloseHandle(_In_ HANDLE handle)
 {
+    PROFILE_DETOUR(CloseHandle);
     DetouredScope scope;
 
     if (scope.Detoured_IsDisabled() || IsNullOrInvalidHandle(handle))
@@ -3380,7 +3517,7 @@ BOOL WINAPI Detoured_CloseHandle(_In_ HANDLE handle)
 
     // Make sure the handle is closed after the object is removed from the map.
     // This way the handle will never be assigned to a another object before removed from the table.
-    CloseHandleOverlay(handle , true);
+    CloseHandleOverlay(handle);
 
     return Real_CloseHandle(handle);
 }
@@ -3395,6 +3532,8 @@ HANDLE WINAPI Detoured_CreateFileA(
     _In_     DWORD                 dwFlagsAndAttributes,
     _In_opt_ HANDLE                hTemplateFile)
 {
+    PROFILE_DETOUR(CreateFileA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpFileName))
@@ -3436,6 +3575,8 @@ BOOL WINAPI Detoured_GetVolumePathNameW(
     _In_  DWORD   cchBufferLength
     )
 {
+    PROFILE_DETOUR(GetVolumePathNameW);
+
     // The reason for this scope check is that GetVolumePathNameW calls many other detoured APIs.
     // We do not need to have any reports for file accesses from these APIs, because thay are not what the application called.
     // (It was purely inserted by us.)
@@ -3447,6 +3588,7 @@ BOOL WINAPI Detoured_GetVolumePathNameW(
 IMPLEMENTED(Detoured_GetFileAttributesW)
 DWORD WINAPI Detoured_GetFileAttributesW(_In_  LPCWSTR lpFileName)
 {
+    PROFILE_DETOUR(GetFileAttributesW);
     DetouredScope scope;
     if (scope.Detoured_IsDisabled() || IsNullOrEmptyW(lpFileName) || IsSpecialDeviceName(lpFileName))
     {
@@ -3500,6 +3642,8 @@ DWORD WINAPI Detoured_GetFileAttributesW(_In_  LPCWSTR lpFileName)
 IMPLEMENTED(Detoured_GetFileAttributesA)
 DWORD WINAPI Detoured_GetFileAttributesA(_In_  LPCSTR lpFileName)
 {
+    PROFILE_DETOUR(GetFileAttributesA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpFileName))
@@ -3519,6 +3663,7 @@ BOOL WINAPI Detoured_GetFileAttributesExW(
     _In_  GET_FILEEX_INFO_LEVELS fInfoLevelId,
     _Out_ LPVOID                 lpFileInformation)
 {
+    PROFILE_DETOUR(GetFileAttributesExW);
     DetouredScope scope;
     if (scope.Detoured_IsDisabled() || IsNullOrEmptyW(lpFileName) || IsSpecialDeviceName(lpFileName))
     {
@@ -3594,6 +3739,8 @@ BOOL WINAPI Detoured_GetFileAttributesExA(
     _In_  GET_FILEEX_INFO_LEVELS fInfoLevelId,
     _Out_ LPVOID                 lpFileInformation)
 {
+    PROFILE_DETOUR(GetFileAttributesExA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpFileName))
@@ -3628,6 +3775,8 @@ BOOL WINAPI Detoured_CopyFileW(
     _In_ BOOL bFailIfExists
     )
 {
+    PROFILE_DETOUR(CopyFileW);
+
     // Don't duplicate complex access-policy logic between CopyFileEx and CopyFile.
     // This forwarder is identical to the internal implementation of CopyFileExW
     // so it should be safe to always forward at our level.
@@ -3646,6 +3795,8 @@ BOOL WINAPI Detoured_CopyFileA(
     _In_ LPCSTR lpNewFileName,
     _In_ BOOL   bFailIfExists)
 {
+    PROFILE_DETOUR(CopyFileA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpExistingFileName) || IsNullOrEmptyA(lpNewFileName))
@@ -3665,6 +3816,135 @@ BOOL WINAPI Detoured_CopyFileA(
         bFailIfExists);
 }
 
+// Largest range cloned by a single FSCTL_DUPLICATE_EXTENTS_TO_FILE (its byte count must be below 4GB, and a multiple of the cluster size)
+#define BLOCK_CLONE_CHUNK_SIZE (1LL << 30)
+
+// Copies a file by cloning its blocks (FSCTL_DUPLICATE_EXTENTS_TO_FILE), which only makes the destination share the clusters of the source
+// instead of writing their content again: files materialized from the cache are often copied as is by the tools of a pip.
+// Only done for the copies CopyFileExW would make of a single stream file, without any special flag, on a volume that supports block cloning
+// (e.g., ReFS). Returns false without leaving a destination behind when the file can't be cloned, for the caller to make a regular copy.
+// Assumes the caller is in a DetouredScope.
+static bool TryBlockCloneCopy(_In_ LPCWSTR lpExistingFileName, _In_ LPCWSTR lpNewFileName, DWORD dwCopyFlags)
+{
+    if ((dwCopyFlags & ~COPY_FILE_FAIL_IF_EXISTS) != 0)
+    {
+        return false;
+    }
+
+    unique_handle<> source(Real_CreateFileW(
+        lpExistingFileName,
+        GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_DELETE,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        nullptr));
+    if (!source)
+    {
+        return false;
+    }
+
+    FILE_BASIC_INFO sourceBasicInfo;
+    FILE_STANDARD_INFO sourceStandardInfo;
+    DWORD volumeSerialNumber;
+    DWORD volumeFlags;
+    if (!Real_GetFileInformationByHandleEx(source.get(), FileBasicInfo, &sourceBasicInfo, sizeof(sourceBasicInfo))
+        || !Real_GetFileInformationByHandleEx(source.get(), FileStandardInfo, &sourceStandardInfo, sizeof(sourceStandardInfo))
+        || sourceStandardInfo.Directory
+        || (sourceBasicInfo.FileAttributes & (FILE_ATTRIBUTE_ENCRYPTED | FILE_ATTRIBUTE_REPARSE_POINT)) != 0
+        || !GetVolumeInformationByHandleW(source.get(), nullptr, 0, &volumeSerialNumber, nullptr, &volumeFlags, nullptr, 0)
+        || (volumeFlags & FILE_SUPPORTS_BLOCK_REFCOUNTING) == 0)
+    {
+        return false;
+    }
+
+    // CopyFileExW copies the alternate data streams as well: leave those files to it
+    union
+    {
+        FILE_STREAM_INFO info;
+        BYTE bytes[sizeof(FILE_STREAM_INFO) + 2 * MAX_PATH * sizeof(WCHAR)];
+    } streams;
+    if (!Real_GetFileInformationByHandleEx(source.get(), FileStreamInfo, &streams, sizeof(streams)) || streams.info.NextEntryOffset != 0)
+    {
+        return false;
+    }
+
+    DWORD bytesReturned;
+    FSCTL_GET_INTEGRITY_INFORMATION_BUFFER integrity;
+    if (!Real_DeviceIoControl(source.get(), FSCTL_GET_INTEGRITY_INFORMATION, nullptr, 0, &integrity, sizeof(integrity), &bytesReturned, nullptr)
+        || integrity.ClusterSizeInBytes == 0)
+    {
+        return false;
+    }
+
+    unique_handle<> destination(Real_CreateFileW(
+        lpNewFileName,
+        GENERIC_READ | GENERIC_WRITE | DELETE,
+        0,
+        nullptr,
+        (dwCopyFlags & COPY_FILE_FAIL_IF_EXISTS) != 0 ? CREATE_NEW : CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL,
+        nullptr));
+    if (!destination)
+    {
+        return false;
+    }
+
+    DWORD destinationVolumeSerialNumber;
+    bool cloned = GetVolumeInformationByHandleW(destination.get(), nullptr, 0, &destinationVolumeSerialNumber, nullptr, nullptr, nullptr, 0)
+        && destinationVolumeSerialNumber == volumeSerialNumber;
+
+    // The clusters of a clone must have the same sparseness and integrity settings as the ones they are cloned from
+    if (cloned && (sourceBasicInfo.FileAttributes & FILE_ATTRIBUTE_SPARSE_FILE) != 0)
+    {
+        cloned = Real_DeviceIoControl(destination.get(), FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &bytesReturned, nullptr) != FALSE;
+    }
+
+    if (cloned)
+    {
+        FSCTL_SET_INTEGRITY_INFORMATION_BUFFER setIntegrity = { integrity.ChecksumAlgorithm, 0, integrity.Flags };
+        cloned = Real_DeviceIoControl(destination.get(), FSCTL_SET_INTEGRITY_INFORMATION, &setIntegrity, sizeof(setIntegrity), nullptr, 0, &bytesReturned, nullptr) != FALSE;
+    }
+
+    if (cloned)
+    {
+        FILE_END_OF_FILE_INFO endOfFile;
+        endOfFile.EndOfFile = sourceStandardInfo.EndOfFile;
+        cloned = Real_SetFileInformationByHandle(destination.get(), FileEndOfFileInfo, &endOfFile, sizeof(endOfFile)) != FALSE;
+    }
+
+    // The cloned range must end on a cluster boundary, even past the end of the file
+    LONGLONG clusterSize = integrity.ClusterSizeInBytes;
+    LONGLONG rangeEnd = (sourceStandardInfo.EndOfFile.QuadPart + clusterSize - 1) / clusterSize * clusterSize;
+    for (LONGLONG offset = 0; cloned && offset < rangeEnd; offset += BLOCK_CLONE_CHUNK_SIZE)
+    {
+        DUPLICATE_EXTENTS_DATA duplicateExtents;
+        duplicateExtents.FileHandle = source.get();
+        duplicateExtents.SourceFileOffset.QuadPart = offset;
+        duplicateExtents.TargetFileOffset.QuadPart = offset;
+        duplicateExtents.ByteCount.QuadPart = rangeEnd - offset < BLOCK_CLONE_CHUNK_SIZE ? rangeEnd - offset : BLOCK_CLONE_CHUNK_SIZE;
+        cloned = Real_DeviceIoControl(destination.get(), FSCTL_DUPLICATE_EXTENTS_TO_FILE, &duplicateExtents, sizeof(duplicateExtents), nullptr, 0, &bytesReturned, nullptr) != FALSE;
+    }
+
+    if (cloned)
+    {
+        // Like CopyFileExW, keep the last write time and the attributes of the source
+        FILE_BASIC_INFO destinationBasicInfo = {};
+        destinationBasicInfo.LastWriteTime = sourceBasicInfo.LastWriteTime;
+        destinationBasicInfo.FileAttributes = sourceBasicInfo.FileAttributes
+            & (FILE_ATTRIBUTE_READONLY | FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM | FILE_ATTRIBUTE_ARCHIVE | FILE_ATTRIBUTE_NOT_CONTENT_INDEXED);
+        cloned = Real_SetFileInformationByHandle(destination.get(), FileBasicInfo, &destinationBasicInfo, sizeof(destinationBasicInfo)) != FALSE;
+    }
+
+    if (!cloned)
+    {
+        FILE_DISPOSITION_INFO disposition = { TRUE };
+        Real_SetFileInformationByHandle(destination.get(), FileDispositionInfo, &disposition, sizeof(disposition));
+    }
+
+    return cloned;
+}
+
 IMPLEMENTED(Detoured_CopyFileExW)
 BOOL WINAPI Detoured_CopyFileExW(
     _In_     LPCWSTR            lpExistingFileName,
@@ -3674,6 +3954,7 @@ BOOL WINAPI Detoured_CopyFileExW(
     _In_opt_ LPBOOL             pbCancel,
     _In_     DWORD              dwCopyFlags)
 {
+    PROFILE_DETOUR(CopyFileExW);
     DetouredScope scope;
     if (scope.Detoured_IsDisabled() ||
         IsNullOrEmptyW(lpExistingFileName) ||
@@ -3770,14 +4051,23 @@ BOOL WINAPI Detoured_CopyFileExW(
     // Now we can safely try to copy, but note that the corresponding read of the source file may end up disallowed
     // (maybe the source file exists, as CopyFileW requires, but we only allow non-existence probes for this path).
 
+    // A cloned copy is reported the same way as a regular one. Copies with a progress routine or a cancellation flag are left to CopyFileExW.
     DWORD error = ERROR_SUCCESS;
-    BOOL result = Real_CopyFileExW(
-        lpExistingFileName,
-        lpNewFileName,
-        lpProgressRoutine,
-        lpData,
-        pbCancel,
-        dwCopyFlags);
+    BOOL result = CheckEnableBlockCloneCopies(g_fileAccessManifestExtraFlags)
+        && lpProgressRoutine == nullptr
+        && pbCancel == nullptr
+        && TryBlockCloneCopy(lpExistingFileName, lpNewFileName, dwCopyFlags);
+
+    if (!result)
+    {
+        result = Real_CopyFileExW(
+            lpExistingFileName,
+            lpNewFileName,
+            lpProgressRoutine,
+            lpData,
+            pbCancel,
+            dwCopyFlags);
+    }
 
     if (!result)
     {
@@ -3815,6 +4105,8 @@ BOOL WINAPI Detoured_CopyFileExA(
     _In_opt_ LPBOOL             pbCancel,
     _In_     DWORD              dwCopyFlags)
 {
+    PROFILE_DETOUR(CopyFileExA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpExistingFileName) || IsNullOrEmptyA(lpNewFileName))
@@ -3852,6 +4144,8 @@ BOOL WINAPI Detoured_MoveFileW(
     _In_ LPCWSTR lpExistingFileName,
     _In_ LPCWSTR lpNewFileName)
 {
+    PROFILE_DETOUR(MoveFileW);
+
     return Detoured_MoveFileWithProgressW(
         lpExistingFileName,
         lpNewFileName,
@@ -3865,6 +4159,8 @@ BOOL WINAPI Detoured_MoveFileA(
     _In_ LPCSTR lpExistingFileName,
     _In_ LPCSTR lpNewFileName)
 {
+    PROFILE_DETOUR(MoveFileA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpExistingFileName) || IsNullOrEmptyA(lpNewFileName))
@@ -3892,6 +4188,8 @@ BOOL WINAPI Detoured_MoveFileExW(
     _In_opt_ LPCWSTR lpNewFileName,
     _In_     DWORD   dwFlags)
 {
+    PROFILE_DETOUR(MoveFileExW);
+
     return Detoured_MoveFileWithProgressW(
         lpExistingFileName,
         lpNewFileName,
@@ -3906,6 +4204,8 @@ BOOL WINAPI Detoured_MoveFileExA(
     _In_opt_  LPCSTR lpNewFileName,
     _In_      DWORD  dwFlags)
 {
+    PROFILE_DETOUR(MoveFileExA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpExistingFileName) || IsNullOrEmptyA(lpNewFileName))
@@ -3947,6 +4247,8 @@ BOOL WINAPI Detoured_MoveFileWithProgressW(
     _In_opt_  LPVOID             lpData,
     _In_      DWORD              dwFlags)
 {
+    PROFILE_DETOUR(MoveFileWithProgressW);
+    HandleOverlayRenameScope renameScope(true);
     DetouredScope scope;
     if (scope.Detoured_IsDisabled()
         || IsNullOrEmptyW(lpExistingFileName)
@@ -4124,6 +4426,8 @@ BOOL WINAPI Detoured_MoveFileWithProgressA(
     _In_opt_ LPVOID             lpData,
     _In_     DWORD              dwFlags)
 {
+    PROFILE_DETOUR(MoveFileWithProgressA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpExistingFileName))
@@ -4270,6 +4574,7 @@ static AccessCheckResult DeleteFileSafeProbe(AccessCheckResult writeAccessCheck,
 IMPLEMENTED(Detoured_DeleteFileW)
 BOOL WINAPI Detoured_DeleteFileW(_In_ LPCWSTR lpFileName)
 {
+    PROFILE_DETOUR(DeleteFileW);
     DetouredScope scope;
     if (scope.Detoured_IsDisabled() ||
         IsNullOrEmptyW(lpFileName) ||
@@ -4351,6 +4656,8 @@ BOOL WINAPI Detoured_DeleteFileW(_In_ LPCWSTR lpFileName)
 IMPLEMENTED(Detoured_DeleteFileA)
 BOOL WINAPI Detoured_DeleteFileA(_In_ LPCSTR lpFileName)
 {
+    PROFILE_DETOUR(DeleteFileA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpFileName))
@@ -4369,6 +4676,7 @@ BOOL WINAPI Detoured_CreateHardLinkW(
     _In_       LPCWSTR               lpExistingFileName,
     __reserved LPSECURITY_ATTRIBUTES lpSecurityAttributes)
 {
+    PROFILE_DETOUR(CreateHardLinkW);
     DetouredScope scope;
     if (scope.Detoured_IsDisabled() ||
         IsNullOrEmptyW(lpFileName) ||
@@ -4475,6 +4783,8 @@ BOOL WINAPI Detoured_CreateHardLinkA(
     __reserved LPSECURITY_ATTRIBUTES lpSecurityAttributes
     )
 {
+    PROFILE_DETOUR(CreateHardLinkA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpFileName) || IsNullOrEmptyA(lpExistingFileName))
@@ -4500,6 +4810,7 @@ BOOLEAN WINAPI Detoured_CreateSymbolicLinkW(
     _In_ LPCWSTR lpTargetFileName,
     _In_ DWORD   dwFlags)
 {
+    PROFILE_DETOUR(CreateSymbolicLinkW);
     DetouredScope scope;
     if (scope.Detoured_IsDisabled() ||
         IgnoreReparsePoints() ||
@@ -4584,6 +4895,8 @@ BOOLEAN WINAPI Detoured_CreateSymbolicLinkA(
     _In_ LPCSTR lpTargetFileName,
     _In_ DWORD  dwFlags)
 {
+    PROFILE_DETOUR(CreateSymbolicLinkA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpSymlinkFileName) || IsNullOrEmptyA(lpTargetFileName))
@@ -4608,6 +4921,8 @@ HANDLE WINAPI Detoured_FindFirstFileW(
     _In_  LPCWSTR            lpFileName,
     _Out_ LPWIN32_FIND_DATAW lpFindFileData)
 {
+    PROFILE_DETOUR(FindFirstFileW);
+
     // FindFirstFileExW is a strict superset. This line is essentially the same as the FindFirstFileW thunk in \minkernel\kernelbase\filefind.c
     return Detoured_FindFirstFileExW(lpFileName, FindExInfoStandard, lpFindFileData, FindExSearchNameMatch, NULL, 0);
 }
@@ -4617,6 +4932,8 @@ HANDLE WINAPI Detoured_FindFirstFileA(
     _In_   LPCSTR             lpFileName,
     _Out_  LPWIN32_FIND_DATAA lpFindFileData)
 {
+    PROFILE_DETOUR(FindFirstFileA);
+
     // TODO:replace with Detoured_FindFirstFileW below
     return Real_FindFirstFileA(
         lpFileName,
@@ -4820,6 +5137,8 @@ HANDLE WINAPI Detoured_FindFirstFileExW(
     __reserved LPVOID             lpSearchFilter,
     _In_       DWORD              dwAdditionalFlags)
 {
+    PROFILE_DETOUR(FindFirstFileExW);
+
     if (ShouldUseLargeEnumerationBuffer())
     {
         dwAdditionalFlags |= FIND_FIRST_EX_LARGE_FETCH;
@@ -4848,6 +5167,8 @@ HANDLE WINAPI Detoured_FindFirstFileExA(
     __reserved LPVOID             lpSearchFilter,
     _In_       DWORD              dwAdditionalFlags)
 {
+    PROFILE_DETOUR(FindFirstFileExA);
+
     // TODO: Note that we can't simply forward to FindFirstFileW here after a unicode conversion.
     // The output value differs too - WIN32_FIND_DATA{A, W}
 
@@ -4865,11 +5186,38 @@ HANDLE WINAPI Detoured_FindFirstFileExA(
         dwAdditionalFlags);
 }
 
+// Decides whether the timestamps of the entries enumerated through a handle are overridden, and whether their enumeration probes may be
+// reported. The decisions are made once for all the entries when they inherit the policy of the enumerated directory (see
+// PolicyResult::TryGetChildrenPolicy).
+static EnumeratedTimestamps GetEnumeratedTimestamps(HandleOverlayRef const& overlay)
+{
+    if (overlay->EnumeratedEntriesTimestamps == EnumeratedTimestamps::Unknown)
+    {
+        FileAccessPolicy childrenPolicy;
+        if (!overlay->Policy.TryGetChildrenPolicy(childrenPolicy))
+        {
+            overlay->EnumeratedEntriesMayBeReported = true;
+            overlay->EnumeratedEntriesTimestamps = EnumeratedTimestamps::PerEntry;
+        }
+        else
+        {
+            // Enumeration probes of existing entries are always allowed, and only explicitly reported under ReportAccessIfExistent (see CheckReadAccess)
+            overlay->EnumeratedEntriesMayBeReported = (childrenPolicy & FileAccessPolicy_ReportAccessIfExistent) != 0 || ReportAnyAccess(false);
+            overlay->EnumeratedEntriesTimestamps = (childrenPolicy & FileAccessPolicy_AllowRealInputTimestamps) != 0
+                ? EnumeratedTimestamps::Keep
+                : EnumeratedTimestamps::Override;
+        }
+    }
+
+    return overlay->EnumeratedEntriesTimestamps;
+}
+
 IMPLEMENTED(Detoured_FindNextFileW)
 BOOL WINAPI Detoured_FindNextFileW(
     _In_  HANDLE             hFindFile,
     _Out_ LPWIN32_FIND_DATAW lpFindFileData)
 {
+    PROFILE_DETOUR(FindNextFileW);
     DetouredScope scope;
     DWORD error = ERROR_SUCCESS;
     BOOL result = Real_FindNextFileW(hFindFile, lpFindFileData);
@@ -4887,16 +5235,40 @@ BOOL WINAPI Detoured_FindNextFileW(
     }
 
     HandleOverlayRef overlay = TryLookupHandleOverlay(hFindFile);
-    if (overlay != nullptr)
+    if (overlay != nullptr
+        && overlay->EnumerationPathResolved
+        && GetEnumeratedTimestamps(overlay) != EnumeratedTimestamps::PerEntry
+        && !overlay->EnumeratedEntriesMayBeReported)
+    {
+        // The entries inherit the policy of the enumerated directory, which reports none of them: the entry only needs its metadata adjusted,
+        // without determining its policy (nor allocating its path).
+        if (overlay->EnumeratedEntriesTimestamps == EnumeratedTimestamps::Override)
+        {
+            OverrideTimestampsForInputFile(lpFindFileData);
+        }
+
+        // See usage in FindFirstFileExW
+        ScrubShortFileName(lpFindFileData);
+    }
+    else if (overlay != nullptr)
     {
         FileOperationContext fileOperationContext = FileOperationContext::CreateForRead(L"FindNextFile", overlay->Policy.GetCanonicalizedPath().GetPathString());
 
+        // The policy of the entry is resolved from the search cursor of the enumerated directory, so only the
+        // enumerated component is searched for.
         wchar_t const* enumeratedComponent = &lpFindFileData->cFileName[0];
         PolicyResult filePolicyResult = overlay->Policy.GetPolicyForSubpath(enumeratedComponent);
 
-        if (!AdjustOperationContextAndPolicyResultWithFullyResolvedPath(fileOperationContext, overlay->Policy, true))
+        // The enumerated directory is the same for every entry: once its path has been fully resolved, the overlay
+        // holds the policy of the resolved path and there is nothing left to resolve for the remaining entries.
+        if (!overlay->EnumerationPathResolved)
         {
-            return FALSE;
+            if (!AdjustOperationContextAndPolicyResultWithFullyResolvedPath(fileOperationContext, overlay->Policy, true))
+            {
+                return FALSE;
+            }
+
+            overlay->EnumerationPathResolved = true;
         }
 
         FileReadContext readContext;
@@ -4907,7 +5279,12 @@ BOOL WINAPI Detoured_FindNextFileW(
         AccessCheckResult accessCheck = filePolicyResult.CheckReadAccess(RequestedReadAccess::EnumerationProbe, readContext);
         ReportIfNeeded(accessCheck, fileOperationContext, filePolicyResult, result ? ERROR_SUCCESS : error);
 
-        if (filePolicyResult.ShouldOverrideTimestamps(accessCheck))
+        EnumeratedTimestamps enumeratedTimestamps = GetEnumeratedTimestamps(overlay);
+        bool overrideTimestamps = enumeratedTimestamps == EnumeratedTimestamps::PerEntry
+            ? filePolicyResult.ShouldOverrideTimestamps(accessCheck)
+            : enumeratedTimestamps == EnumeratedTimestamps::Override;
+
+        if (overrideTimestamps)
         {
 #if SUPER_VERBOSE
             Dbg(L"FindNextFile: Overriding timestamps for %s", filePolicyResult.GetCanonicalizedPath().GetPathString());
@@ -4937,6 +5314,8 @@ BOOL WINAPI Detoured_FindNextFileA(
     _In_  HANDLE             hFindFile,
     _Out_ LPWIN32_FIND_DATAA lpFindFileData)
 {
+    PROFILE_DETOUR(FindNextFileA);
+
     // TODO:replace with the same logic as Detoured_FindNextFileW
     // Note that we can't simply forward to FindFirstFileW here after a unicode conversion.
     // The output value differs too - WIN32_FIND_DATA{A, W}
@@ -4952,6 +5331,7 @@ BOOL WINAPI Detoured_GetFileInformationByHandleEx(
     _Out_ LPVOID                    lpFileInformation,
     _In_  DWORD                     dwBufferSize)
 {
+    PROFILE_DETOUR(GetFileInformationByHandleEx);
     DetouredScope scope;
 
     DWORD error = ERROR_SUCCESS;
@@ -4996,13 +5376,14 @@ BOOL WINAPI Detoured_GetFileInformationByHandleEx(
 IMPLEMENTED(Detoured_FindClose)
 BOOL WINAPI Detoured_FindClose(_In_ HANDLE handle)
 {
+    PROFILE_DETOUR(FindClose);
     DetouredScope scope;
 
     DWORD error = ERROR_SUCCESS;
 
     // Make sure the handle is closed after the object is removed from the map.
     // This way the handle will never be assigned to a another object before removed from the table.
-    CloseHandleOverlay(handle, true);
+    CloseHandleOverlay(handle);
 
     BOOL result = Real_FindClose(handle);
     error = GetLastError();
@@ -5021,6 +5402,7 @@ BOOL WINAPI Detoured_GetFileInformationByHandle(
     _In_  HANDLE                       hFile,
     _Out_ LPBY_HANDLE_FILE_INFORMATION lpFileInformation)
 {
+    PROFILE_DETOUR(GetFileInformationByHandle);
     DetouredScope scope;
 
     DWORD error = ERROR_SUCCESS;
@@ -5251,6 +5633,8 @@ BOOL WINAPI Detoured_SetFileInformationByHandle(
     _In_ LPVOID                    lpFileInformation,
     _In_ DWORD                     dwBufferSize)
 {
+    PROFILE_DETOUR(SetFileInformationByHandle);
+
     bool isDisposition =
         FileInformationClass == FILE_INFO_BY_HANDLE_CLASS::FileDispositionInfo
         || FileInformationClass == FILE_INFO_BY_HANDLE_CLASS::FileDispositionInfoEx;
@@ -5258,6 +5642,7 @@ BOOL WINAPI Detoured_SetFileInformationByHandle(
     bool isRename =
         FileInformationClass == FILE_INFO_BY_HANDLE_CLASS::FileRenameInfo
         || FileInformationClass == FILE_INFO_BY_HANDLE_CLASS::FileRenameInfoEx;
+    HandleOverlayRenameScope renameScope(isRename);
 
     if ((!isDisposition && !isRename) || IgnoreSetFileInformationByHandle())
     {
@@ -5503,6 +5888,7 @@ BOOL WINAPI Detoured_CreateDirectoryW(
     _In_     LPCWSTR               lpPathName,
     _In_opt_ LPSECURITY_ATTRIBUTES lpSecurityAttributes)
 {
+    PROFILE_DETOUR(CreateDirectoryW);
     DetouredScope scope;
     if (scope.Detoured_IsDisabled() ||
         IsNullOrEmptyW(lpPathName) ||
@@ -5646,6 +6032,7 @@ BOOL WINAPI Detoured_CreateDirectoryExA(
 IMPLEMENTED(Detoured_RemoveDirectoryW)
 BOOL WINAPI Detoured_RemoveDirectoryW(_In_ LPCWSTR lpPathName)
 {
+    PROFILE_DETOUR(RemoveDirectoryW);
     DetouredScope scope;
     if (scope.Detoured_IsDisabled() ||
         IsNullOrEmptyW(lpPathName) ||
@@ -5719,6 +6106,8 @@ BOOL WINAPI Detoured_RemoveDirectoryW(_In_ LPCWSTR lpPathName)
 IMPLEMENTED(Detoured_RemoveDirectoryA)
 BOOL WINAPI Detoured_RemoveDirectoryA(_In_ LPCSTR lpPathName)
 {
+    PROFILE_DETOUR(RemoveDirectoryA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpPathName))
@@ -5846,6 +6235,8 @@ DWORD WINAPI Detoured_GetFinalPathNameByHandleA(
     _In_  DWORD cchFilePath,
     _In_  DWORD dwFlags)
 {
+    PROFILE_DETOUR(GetFinalPathNameByHandleA);
+
     unique_ptr<wchar_t[]> wideFilePathBuffer(new wchar_t[cchFilePath]);
     DWORD err = Detoured_GetFinalPathNameByHandleW(hFile, wideFilePathBuffer.get(), cchFilePath, dwFlags);
 
@@ -5907,6 +6298,7 @@ DWORD WINAPI Detoured_GetFinalPathNameByHandleW(
     _In_  DWORD  cchFilePath,
     _In_  DWORD  dwFlags)
 {
+    PROFILE_DETOUR(GetFinalPathNameByHandleW);
     DetouredScope scope;
 
     if (scope.Detoured_IsDisabled() || IgnoreGetFinalPathNameByHandle())
@@ -5914,16 +6306,20 @@ DWORD WINAPI Detoured_GetFinalPathNameByHandleW(
         return Real_GetFinalPathNameByHandleW(hFile, lpszFilePath, cchFilePath, dwFlags);
     }
 
-    DWORD err = Real_GetFinalPathNameByHandleW(hFile, lpszFilePath, cchFilePath, dwFlags);
+    // The normalized DOS path (the default) of a handle on a volume with a drive letter doesn't need to query the DOS name of the volume
+    wstring finalPath;
+    bool resolvedFromVolumePathTable = dwFlags == (FILE_NAME_NORMALIZED | VOLUME_NAME_DOS) && TryGetFinalPathByHandleFromVolumePathTable(hFile, finalPath);
+
+    DWORD err = resolvedFromVolumePathTable ? (DWORD)finalPath.length() : Real_GetFinalPathNameByHandleW(hFile, lpszFilePath, cchFilePath, dwFlags);
 
     if (err == 0)
     {
         SetLastError(err);
     }
-    else if (err < cchFilePath)
+    else if (resolvedFromVolumePathTable || err < cchFilePath)
     {
         wstring normalizedPath;
-        TranslateFilePath(wstring(lpszFilePath), normalizedPath, false);
+        TranslateFilePath(resolvedFromVolumePathTable ? finalPath : wstring(lpszFilePath), normalizedPath, false);
         DWORD copyPathLength = (DWORD)normalizedPath.length() + 1; //wcscpy_s expects the destination buffer to account for the null terminator
 
         if (copyPathLength <= cchFilePath)
@@ -5942,6 +6338,32 @@ DWORD WINAPI Detoured_GetFinalPathNameByHandleW(
     return err;
 }
 
+// Overrides the timestamps and scrubs the short names of the entries NtQueryDirectoryFile returned for a directory handle, as FindNextFileW
+// does for each entry.
+static void OverrideMetadataForEnumeratedEntries(HandleOverlayRef const& overlay, FILE_INFORMATION_CLASS fileInformationClass, PVOID buffer, size_t length)
+{
+    DirectoryEntryLayout layout;
+    if (!TryGetDirectoryEntryLayout((ULONG)fileInformationClass, layout))
+    {
+        return;
+    }
+
+    EnumeratedTimestamps enumeratedTimestamps = GetEnumeratedTimestamps(overlay);
+    std::wstring entryName;
+
+    OverrideMetadataForDirectoryEntries(layout, buffer, length, [&](PCWSTR fileName, size_t fileNameLength)
+    {
+        if (enumeratedTimestamps != EnumeratedTimestamps::PerEntry)
+        {
+            return enumeratedTimestamps == EnumeratedTimestamps::Override;
+        }
+
+        // Enumeration probes are always allowed (see CheckReadAccess), so only the policy of the entry decides
+        entryName.assign(fileName, fileNameLength);
+        return !overlay->Policy.GetPolicyForSubpath(entryName.c_str()).AllowRealInputTimestamps();
+    });
+}
+
 // Detoured_NtQueryDirectoryFile
 //
 // FileHandle            - a handle for the file object that represents the directory for which information is being requested.
@@ -5981,6 +6403,7 @@ NTSTATUS NTAPI Detoured_NtQueryDirectoryFile(
     _In_opt_ PUNICODE_STRING        FileName,
     _In_     BOOLEAN                RestartScan)
 {
+    PROFILE_DETOUR(NtQueryDirectoryFile);
     DetouredScope scope;
     LPCWSTR directoryName = nullptr;
     wstring filter;
@@ -6051,6 +6474,12 @@ NTSTATUS NTAPI Detoured_NtQueryDirectoryFile(
         memcpy_s(FileInformation, Length, buffer, Length);
     }
 
+    // Unlike the enumeration report, which is sent once, the metadata of every batch of entries is overridden
+    if (!scope.Detoured_IsDisabled() && overlay != nullptr && overlay->Type == HandleType::Directory && NT_SUCCESS(result) && result != STATUS_PENDING)
+    {
+        OverrideMetadataForEnumeratedEntries(overlay, FileInformationClass, FileInformation, IoStatusBlock->Information < Length ? IoStatusBlock->Information : Length);
+    }
+
     // If we should not or cannot get info on the directory, we are done
     if (!noDetour)
     {
@@ -6127,6 +6556,7 @@ NTSTATUS NTAPI Detoured_ZwQueryDirectoryFile(
     _In_opt_ PUNICODE_STRING        FileName,
     _In_     BOOLEAN                RestartScan)
 {
+    PROFILE_DETOUR(ZwQueryDirectoryFile);
     DetouredScope scope;
     LPCWSTR directoryName = nullptr;
     wstring filter;
@@ -6197,6 +6627,12 @@ NTSTATUS NTAPI Detoured_ZwQueryDirectoryFile(
         memcpy_s(FileInformation, Length, buffer, Length);
     }
 
+    // Unlike the enumeration report, which is sent once, the metadata of every batch of entries is overridden
+    if (!scope.Detoured_IsDisabled() && overlay != nullptr && overlay->Type == HandleType::Directory && NT_SUCCESS(result) && result != STATUS_PENDING)
+    {
+        OverrideMetadataForEnumeratedEntries(overlay, FileInformationClass, FileInformation, IoStatusBlock->Information < Length ? IoStatusBlock->Information : Length);
+    }
+
     // If we should not or cannot get info on the directory, we are done
     if (!noDetour)
     {
@@ -6256,6 +6692,84 @@ NTSTATUS NTAPI Detoured_ZwQueryDirectoryFile(
     return result;
 }
 
+// ----------------------------------------------------------------------------
+// FILE ID PATH CACHE
+// ----------------------------------------------------------------------------
+//
+// Resolving the path of a file opened by id takes opening it, querying its final path and closing it, and some tools (file watchers,
+// source control) open the same files by id over and over. The paths are cached per (volume serial number, file id), tagged with the
+// rename generation of the handle overlays (see GetHandleOverlayRenameGeneration): a rename made by this process may move any file,
+// so it makes every cached path stale. As for the final paths of handles, renames made by other processes are not seen.
+
+// Beyond this many cached paths, the cache is cleared
+#define FILE_ID_PATH_CACHE_MAX_ENTRIES 4096
+
+// Volume serial number, and the low and high halves of the file id (the high half is 0 for 64-bit file ids)
+typedef std::pair<ULONGLONG, std::pair<ULONGLONG, ULONGLONG>> FileIdPathCacheKey;
+
+typedef struct
+{
+    wstring path;
+    LONG generation;
+} FileIdPathCacheEntry;
+
+static map<FileIdPathCacheKey, FileIdPathCacheEntry> s_fileIdPaths;
+static SRWLOCK s_fileIdPathsLock = SRWLOCK_INIT;
+
+// Returns false if the open can't be cached (e.g., the file id is not in a form this cache knows)
+static bool FileIdPathCache_GetKey(POBJECT_ATTRIBUTES objectAttributes, _Out_ FileIdPathCacheKey& key)
+{
+    PUNICODE_STRING fileId = objectAttributes->ObjectName;
+    if (objectAttributes->RootDirectory == nullptr || fileId == nullptr || fileId->Buffer == nullptr
+        || (fileId->Length != sizeof(ULONGLONG) && fileId->Length != 2 * sizeof(ULONGLONG)))
+    {
+        return false;
+    }
+
+    // The file id is relative to the volume of the root directory
+    FILE_ID_INFO rootIdInfo;
+    if (!Real_GetFileInformationByHandleEx(objectAttributes->RootDirectory, FileIdInfo, &rootIdInfo, sizeof(rootIdInfo)))
+    {
+        return false;
+    }
+
+    ULONGLONG fileIdHalves[2] = { 0, 0 };
+    memcpy(fileIdHalves, fileId->Buffer, fileId->Length);
+
+    key = FileIdPathCacheKey(rootIdInfo.VolumeSerialNumber, std::make_pair(fileIdHalves[0], fileIdHalves[1]));
+    return true;
+}
+
+static bool FileIdPathCache_TryGet(const FileIdPathCacheKey& key, _Out_ wstring& path)
+{
+    LONG generation = GetHandleOverlayRenameGeneration();
+
+    AcquireSRWLockShared(&s_fileIdPathsLock);
+    auto iter = s_fileIdPaths.find(key);
+    bool found = iter != s_fileIdPaths.end() && iter->second.generation == generation;
+    if (found)
+    {
+        path = iter->second.path;
+    }
+
+    ReleaseSRWLockShared(&s_fileIdPathsLock);
+    return found;
+}
+
+static void FileIdPathCache_Set(const FileIdPathCacheKey& key, const wstring& path, LONG generation)
+{
+    AcquireSRWLockExclusive(&s_fileIdPathsLock);
+    if (s_fileIdPaths.size() >= FILE_ID_PATH_CACHE_MAX_ENTRIES)
+    {
+        s_fileIdPaths.clear();
+    }
+
+    FileIdPathCacheEntry& entry = s_fileIdPaths[key];
+    entry.path = path;
+    entry.generation = generation;
+    ReleaseSRWLockExclusive(&s_fileIdPathsLock);
+}
+
 static bool PathFromObjectAttributesViaId(POBJECT_ATTRIBUTES objectAttributes, ULONG fileAttributes, CanonicalizedPath &path)
 {
     DetouredScope scope;
@@ -6265,6 +6779,20 @@ static bool PathFromObjectAttributesViaId(POBJECT_ATTRIBUTES objectAttributes, U
 
     DWORD lastError = GetLastError();
 
+    FileIdPathCacheKey key;
+    bool cacheable = FileIdPathCache_GetKey(objectAttributes, key);
+
+    wstring fullPath;
+    if (cacheable && FileIdPathCache_TryGet(key, fullPath))
+    {
+        path = CanonicalizedPath::Canonicalize(fullPath.c_str());
+        SetLastError(lastError);
+        return true;
+    }
+
+    // Read before resolving the path, so that a rename made meanwhile makes it stale
+    LONG generation = GetHandleOverlayRenameGeneration();
+
     // Tool wants to open file by id, then that file is assumed to exist.
     // Unfortunately, we need to open a handle to get the file path.
     // Try open a handle with Read access.
@@ -6290,15 +6818,20 @@ static bool PathFromObjectAttributesViaId(POBJECT_ATTRIBUTES objectAttributes, U
         return false;
     }
 
-    wstring fullPath;
+    DWORD error = DetourGetFinalPathByHandle(hFile, fullPath);
+    NtClose(hFile);
 
-    if (DetourGetFinalPathByHandle(hFile, fullPath) != ERROR_SUCCESS)
+    if (error != ERROR_SUCCESS)
     {
         SetLastError(lastError);
         return false;
     }
 
-    NtClose(hFile);
+    if (cacheable)
+    {
+        FileIdPathCache_Set(key, fullPath, generation);
+    }
+
     path = CanonicalizedPath::Canonicalize(fullPath.c_str());
 
     SetLastError(lastError);
@@ -6425,6 +6958,7 @@ NTSTATUS NTAPI Detoured_ZwCreateFile(
     _In_opt_ PVOID              EaBuffer,
     _In_     ULONG              EaLength)
 {
+    PROFILE_DETOUR(ZwCreateFile);
     DetouredScope scope;
 
     // As a performance workaround, neuter the FILE_RANDOM_ACCESS hint (even if Detoured_IsDisabled() and there's another detoured API higher on the stack).
@@ -6731,6 +7265,7 @@ NTSTATUS NTAPI Detoured_NtCreateFile(
     _In_opt_ PVOID              EaBuffer,
     _In_     ULONG              EaLength)
 {
+    PROFILE_DETOUR(NtCreateFile);
     DetouredScope scope;
 
     // As a performance workaround, neuter the FILE_RANDOM_ACCESS hint (even if Detoured_IsDisabled() and there's another detoured API higher on the stack).
@@ -7044,6 +7579,8 @@ NTSTATUS NTAPI Detoured_ZwOpenFile(
     _In_  ULONG              ShareAccess,
     _In_  ULONG              OpenOptions)
 {
+    PROFILE_DETOUR(ZwOpenFile);
+
     return Detoured_ZwCreateFile(
         FileHandle,
         DesiredAccess,
@@ -7068,6 +7605,8 @@ NTSTATUS NTAPI Detoured_NtOpenFile(
     _In_  ULONG              ShareAccess,
     _In_  ULONG              OpenOptions)
 {
+    PROFILE_DETOUR(NtOpenFile);
+
     // We don't EnterLoggingScope for NtOpenFile or NtCreateFile for two reasons:
     // - Of course these get called.
     // - It's hard to predict library loads (e.g. even by a statically linked CRT), which complicates testing of other call logging.
@@ -7104,28 +7643,19 @@ NTSTATUS NTAPI Detoured_NtClose(_In_ HANDLE handle)
     // would AV. As a workaround, we just don't check it here (there's no harm in
     // dropping a handle overlay when trying to close the handle, anyway).
     //
-    // Make sure the handle is closed after the object is marked for removal from the map.
-    // This way the handle will never be assigned to a another object before removed from the map
-    // (whenever the map is accessed, the closed handle list is drained).
+    // Make sure the overlay is removed before the handle is closed.
+    // This way the handle will never be assigned to a another object before removed from the table.
 
     if (!IsNullOrInvalidHandle(handle))
     {
         if (MonitorNtCreateFile())
         {
-            // The map is cleared only if the MonitorNtCreateFile is on.
+            // The table is cleared only if the MonitorNtCreateFile is on.
             // This is to make sure the behaviour for Windows builds is not altered.
-            // Also if the NtCreateFile is no monitored, the map should not grow significantly. The other cases where it is updated -
-            // for example CreateFileW, the map is updated by the CloseFile detoured API.
-            if (UseExtraThreadToDrainNtClose())
-            {
-                AddClosedHandle(handle);
-            }
-            else
-            {
-                // Just remove the handle from the table directly.
-                // Pass true for recursiveCall, since we don't have anything in the handle drain list and call to drain it is not needed.
-                CloseHandleOverlay(handle, true);
-            }
+            // Also if the NtCreateFile is no monitored, the table should not grow significantly. The other cases where it is updated -
+            // for example CreateFileW, the table is updated by the CloseFile detoured API.
+            // Removing the overlay takes no lock, so it is done right away.
+            CloseHandleOverlay(handle);
         }
     }
 
@@ -7139,6 +7669,8 @@ BOOL WINAPI Detoured_CreatePipe(
     _In_opt_       LPSECURITY_ATTRIBUTES lpPipeAttributes,
     _In_           DWORD                 nSize)
 {
+    PROFILE_DETOUR(CreatePipe);
+
     // The reason for this scope check is that CreatePipe calls many other detoured APIs, e.g., NtOpenFile, and we do not want to have any reports
     // for file accesses from those APIs (they are not what the application calls).
     DetouredScope scope;
@@ -7164,15 +7696,22 @@ BOOL WINAPI Detoured_DeviceIoControl(
   _Out_               LPOVERLAPPED lpOverlapped
 )
 {
+    PROFILE_DETOUR(DeviceIoControl);
+
+    // We are only interested in the FSCTL_GET_REPARSE_POINT control code. Every other one (console, pipe and volume I/O, which is most of the
+    // traffic) goes straight to the real function: the control codes do not reach any other detour, so there is no scope to enter.
+    if (dwIoControlCode != FSCTL_GET_REPARSE_POINT || IgnoreDeviceIoControlGetReparsePoint())
+    {
+        return Real_DeviceIoControl(
+            hDevice, dwIoControlCode, lpInBuffer, nInBufferSize, lpOutBuffer, nOutBufferSize, lpBytesReturned, lpOverlapped);
+    }
+
     DetouredScope scope;
 
     auto result = Real_DeviceIoControl(
         hDevice, dwIoControlCode, lpInBuffer, nInBufferSize, lpOutBuffer, nOutBufferSize, lpBytesReturned, lpOverlapped);
 
     if (scope.Detoured_IsDisabled() ||
-        IgnoreDeviceIoControlGetReparsePoint() ||
-        // We are only interested in the FSCTL_GET_REPARSE_POINT control code.
-        dwIoControlCode != FSCTL_GET_REPARSE_POINT || 
         // If the call fails, no need to translate anything
         !result)
     {
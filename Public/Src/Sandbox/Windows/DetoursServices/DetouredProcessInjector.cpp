@@ -43,6 +43,12 @@ void DetouredProcessInjector::Clear()
     _reportPipe.reset();
     _payload.reset(nullptr);
     _payloadSize = 0;
+    if (_payloadView != nullptr)
+    {
+        UnmapViewOfFile(_payloadView);
+        _payloadView = nullptr;
+    }
+    _payloadSection.reset();
     _otherHandles.clear();
     _dllX64.clear();
     _dllX86.clear();
@@ -54,6 +60,8 @@ void DetouredProcessInjector::Clear()
 // uint64_t handles - handles passed from the parent.
 //                    There must be c_minHandleCount handles there.
 // payload
+// When c_payloadInSectionFlag is set in the handle count, the payload is replaced by the handle of
+// a section holding it (uint64_t) and the size of the payload (uint32_t).
 bool DetouredProcessInjector::Init(LPCBYTE payloadWrapper, std::wstring& errorMessage, _Out_ LPCBYTE* payload, _Out_ uint32_t& payloadSize)
 {
     errorMessage = L"";
@@ -92,7 +100,8 @@ bool DetouredProcessInjector::Init(LPCBYTE payloadWrapper, std::wstring& errorMe
     size -= 2 * sizeof(uint32_t);
 
     // Copy known handles
-    uint32_t handleCount = *data;
+    uint32_t handleCount = *data & ~c_payloadInSectionFlag;
+    bool payloadInSection = (*data & c_payloadInSectionFlag) != 0;
     data++;
 
     if (!(handleCount >= c_minHandleCount && size >= handleCount * sizeof(uint64_t)))
@@ -129,8 +138,28 @@ bool DetouredProcessInjector::Init(LPCBYTE payloadWrapper, std::wstring& errorMe
         }
     }
 
+    if (payloadInSection)
+    {
+        if (size != sizeof(uint64_t) + sizeof(uint32_t))
+        {
+            errorMessage = L"Payload section has incorrect size: ";
+            errorMessage += std::to_wstring(size);
+
+            return false;
+        }
+
+        // The section is mapped in place of copying the payload, in WOW64 processes as well
+        HANDLE section = Uint64ToHandle(*handles++);
+        if (!MapPayloadSection(section, *reinterpret_cast<const uint32_t *>(handles), errorMessage))
+        {
+            return false;
+        }
+
+        *payload = _payloadView;
+        payloadSize = _payloadSize;
+    }
     // Copy payload immediately only if this process is not WOW64 process.
-    if (!s_isWow64Process)
+    else if (!s_isWow64Process)
     {
         _payloadSize = size;
 
@@ -194,7 +223,7 @@ void DetouredProcessInjector::Init(
 
 void DetouredProcessInjector::SetPayload(LPCBYTE payload, uint32_t payloadSize)
 {
-    if (_payload.get() != nullptr)
+    if (_payload.get() != nullptr || _payloadView != nullptr)
     {
         // Payload can be set only once.
         return;
@@ -258,14 +287,17 @@ DWORD DetouredProcessInjector::LocalInjectProcess(HANDLE processHandle, bool inh
         return err;
     }
 
+    // Fall back to copying the payload if it cannot be shared
+    bool payloadInSection = _sharePayloadSection && _payloadSize != 0 && EnsurePayloadSection();
+
     // Allocate space for the payload wrapper.
-    uint32_t size = WrapperSize();
+    uint32_t size = WrapperSize(payloadInSection);
     std::unique_ptr<unsigned char[]> payloadWrapper = make_unique<unsigned char[]>(size);
 
     // Write sizes
     uint32_t *sizes = reinterpret_cast<uint32_t *>(payloadWrapper.get());
     *sizes++ = size;
-    *sizes++ = static_cast<uint32_t>(c_minHandleCount + _otherHandles.size());
+    *sizes++ = static_cast<uint32_t>(c_minHandleCount + _otherHandles.size()) | (payloadInSection ? c_payloadInSectionFlag : 0);
 
     // Write handles
     uint64_t *handles = reinterpret_cast<uint64_t *>(sizes);
@@ -281,12 +313,29 @@ DWORD DetouredProcessInjector::LocalInjectProcess(HANDLE processHandle, bool inh
         }
     }
 
-    // Copy payload
-    errno_t memcpyerror = memcpy_s(handles, _payloadSize, _payload.get(), _payloadSize);
-    if (memcpyerror != 0)
+    if (payloadInSection)
     {
-        Dbg(L"DetouredProcessInjector::LocalInjectProcess: Failed to do memcpy (error code: 0x%08x)", (int)memcpyerror);
-        return ERROR_PARTIAL_COPY;
+        // The child only gets to read the section. The handle is always duplicated, since the section is not inheritable.
+        HANDLE targetSection;
+        if (!DuplicateHandle(GetCurrentProcess(), _payloadSection.get(), processHandle, &targetSection, FILE_MAP_READ, FALSE, 0))
+        {
+            DWORD err = GetLastError();
+            Dbg(L"DetouredProcessInjector::LocalInjectProcess: Failed to duplicate the payload section (error code: 0x%08x)", (int)err);
+            return err;
+        }
+
+        *handles++ = HandleToUint64(targetSection);
+        *reinterpret_cast<uint32_t *>(handles) = _payloadSize;
+    }
+    else
+    {
+        // Copy payload
+        errno_t memcpyerror = memcpy_s(handles, _payloadSize, Payload(), _payloadSize);
+        if (memcpyerror != 0)
+        {
+            Dbg(L"DetouredProcessInjector::LocalInjectProcess: Failed to do memcpy (error code: 0x%08x)", (int)memcpyerror);
+            return ERROR_PARTIAL_COPY;
+        }
     }
 
     if (!DetourCopyPayloadToProcess(processHandle, _payloadGuid, payloadWrapper.get(), size))
@@ -299,6 +348,53 @@ DWORD DetouredProcessInjector::LocalInjectProcess(HANDLE processHandle, bool inh
     return ERROR_SUCCESS;
 }
 
+bool DetouredProcessInjector::EnsurePayloadSection()
+{
+    if (_payloadSection.isValid())
+    {
+        return true;
+    }
+
+    unique_handle<nullptr> section(CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, _payloadSize, nullptr));
+    if (!section.isValid())
+    {
+        Dbg(L"DetouredProcessInjector::EnsurePayloadSection: Failed to create the payload section (error code: 0x%08x)", (int)GetLastError());
+        return false;
+    }
+
+    void *view = MapViewOfFile(section.get(), FILE_MAP_WRITE, 0, 0, _payloadSize);
+    if (view == nullptr)
+    {
+        Dbg(L"DetouredProcessInjector::EnsurePayloadSection: Failed to map the payload section (error code: 0x%08x)", (int)GetLastError());
+        return false;
+    }
+
+    memcpy_s(view, _payloadSize, Payload(), _payloadSize);
+    UnmapViewOfFile(view);
+
+    _payloadSection.reset(section.release());
+    return true;
+}
+
+bool DetouredProcessInjector::MapPayloadSection(HANDLE section, uint32_t payloadSize, std::wstring& errorMessage)
+{
+    // Keep the section (it is handed on to the children of this process) and its view for the lifetime of the process
+    _payloadSection.reset(section);
+
+    LPCBYTE view = payloadSize == 0 ? nullptr : reinterpret_cast<LPCBYTE>(MapViewOfFile(section, FILE_MAP_READ, 0, 0, payloadSize));
+    if (view == nullptr)
+    {
+        errorMessage = L"Failed to map the payload section, error code: ";
+        errorMessage += std::to_wstring(GetLastError());
+
+        return false;
+    }
+
+    _payloadView = view;
+    _payloadSize = payloadSize;
+    return true;
+}
+
 DWORD DetouredProcessInjector::RemoteInjectProcess(HANDLE processHandle, bool inheritedHandles) const
 {
     DWORD processId = GetProcessId(processHandle);
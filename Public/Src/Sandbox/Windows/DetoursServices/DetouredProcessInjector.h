@@ -34,6 +34,10 @@ private:
 
     static const uint32_t c_buildxlInjectorTag = 0xD031B09E;      // DOMIno BONE
 
+    // Set in the handle count of a payload wrapper whose payload lives in a section: the wrapper then ends with
+    // the handle of the section and the payload size instead of the payload itself.
+    static const uint32_t c_payloadInSectionFlag = 0x80000000;
+
     // We own these handles
     unique_handle<INVALID_HANDLE_VALUE> _mapDirectory;
     unique_handle<INVALID_HANDLE_VALUE> _remoteInjectorPipe;
@@ -47,6 +51,12 @@ private:
     bool _alwaysRemoteInjectFromWow64Process = false;
     bool _initialized = false;
 
+    // When the payload is shared through a section (see FileAccessManifestExtraFlag::EnableSharedPayloadSection), the
+    // section and, when the payload was received that way, its read-only view. The view stays mapped as long as the object lives.
+    bool _sharePayloadSection = false;
+    unique_handle<nullptr> _payloadSection;
+    LPCBYTE _payloadView = nullptr;
+
     CRITICAL_SECTION _injectorLock;
 
     class LockGuard
@@ -104,12 +114,19 @@ private:
 #pragma warning( pop )
 
     // Given all data, compute the size of the wrapped payload
-    uint32_t inline WrapperSize() const
+    uint32_t inline WrapperSize(bool payloadInSection) const
     {
-        // The data must contain the size, handle count, the handles, and the payload
-        return static_cast<uint32_t>(2 * sizeof(uint32_t) + (c_minHandleCount + _otherHandles.size()) * sizeof(uint64_t) + _payloadSize);
+        // The data must contain the size, handle count, the handles, and the payload (or the section holding it and the payload size)
+        return static_cast<uint32_t>(2 * sizeof(uint32_t) + (c_minHandleCount + _otherHandles.size()) * sizeof(uint64_t)
+            + (payloadInSection ? sizeof(uint64_t) + sizeof(uint32_t) : _payloadSize));
     }
 
+    // Creates the section holding a copy of the payload if it does not exist yet. Returns false if it cannot be created.
+    bool EnsurePayloadSection();
+
+    // Maps the payload section received in a payload wrapper.
+    bool MapPayloadSection(HANDLE section, uint32_t payloadSize, std::wstring& errorMessage);
+
 
     // Clear the object (free memory, etc.)
     void Clear();
@@ -126,6 +143,7 @@ public:
 
     ~DetouredProcessInjector()
     {
+        Clear();
         DeleteCriticalSection(&_injectorLock);
     }
 
@@ -149,6 +167,12 @@ public:
         _alwaysRemoteInjectFromWow64Process = alwaysRemoteInjectFromWow64Process;
     }
 
+    // When set, children get the payload by mapping a section shared by this process instead of a copy of it.
+    void inline SetSharePayloadSection(bool sharePayloadSection)
+    {
+        _sharePayloadSection = sharePayloadSection;
+    }
+
     // Set "other" handles. These are duplicated if needed.
     void SetHandles(uint32_t otherHandleCount, PHANDLE otherHandles);
 
@@ -164,7 +188,7 @@ public:
     HANDLE MapDirectory() const { return _mapDirectory.get(); }
     HANDLE RemoteInjectorPipe() const { return _remoteInjectorPipe.get(); }
     HANDLE ReportPipe() const { return _reportPipe.get(); }
-    LPCBYTE Payload() const { return _payload.get(); }
+    LPCBYTE Payload() const { return _payloadView != nullptr ? _payloadView : _payload.get(); }
     uint32_t PayloadSize() const { return _payloadSize; }
     uint32_t OtherHandleCount() const { return static_cast<uint32_t>(_otherHandles.size()); }
     const HANDLE *OtherHandles() const { return _otherHandles.data(); }
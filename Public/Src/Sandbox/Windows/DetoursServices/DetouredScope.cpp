@@ -9,4 +9,4 @@
 // GLOBALS
 // ----------------------------------------------------------------------------
 
-__declspec(thread) size_t DetouredScope::gt_DetouredCount = 0;
+__declspec(thread) DetouredThreadContext DetouredThreadContext::gt_current = {};
@@ -7,35 +7,73 @@ Implements APIs involving ignoring contexts for detouring.
 
 #pragma once
 
+struct CanonicalizedPathBuffer;
+struct PolicyResultCache;
+struct ReportBatch;
+
 // ----------------------------------------------------------------------------
 // CLASSES
 // ----------------------------------------------------------------------------
 
+// DetouredThreadContext
+//
+// The per-thread state of the detours, kept in a single thread-local block so that a detour
+// and the helpers it calls resolve the thread-local storage of the module once: the scope depth
+// and the thread caches of the policy results (PolicyResult.cpp), of the canonicalized path
+// buffers (CanonicalizedPath.cpp), of the report batch (SendReport.cpp) and of the profile
+// (DetoursProfile.cpp). Each cache is owned, allocated and released by its module.
+struct DetouredThreadContext
+{
+    size_t ScopeDepth;
+    PolicyResultCache* PolicyResults;
+    CanonicalizedPathBuffer* RecycledPathBuffers;
+    size_t RecycledPathBufferCount;
+    ReportBatch* Reports;
+    void* ProfileBlock;
+
+    static inline DetouredThreadContext& Current() noexcept { return gt_current; }
+
+private:
+    static __declspec(thread) DetouredThreadContext gt_current;
+};
+
 // DetouredScope
 //
 // Create a detouring scope.
 // The goal of the scope is not detour any Windows APIs which are called as a result
 // of already detoured APIs. There is no need to spend additional resources
 // on applying BuildXL's access policy more than once.
+//
+// Detours keep their scope alive while calling the real API, so e.g. the NtCreateFile detour
+// reached from the real CreateFileW, CopyFileExW or MoveFileWithProgressW leaves right after this
+// thread-local check, before looking at its arguments. Keep Detoured_IsDisabled() the first check
+// of every detour that evaluates policy.
+//
+// The scope looks the thread context up once: Detoured_IsDisabled() and Context() don't touch
+// thread-local storage again.
 class DetouredScope
 {
 private:
-    static __declspec(thread) size_t gt_DetouredCount;
+    DetouredThreadContext& m_context;
+    const bool m_isDisabled;
 
 public:
     DetouredScope() noexcept
+        : m_context(DetouredThreadContext::Current()), m_isDisabled(++m_context.ScopeDepth != 1)
     {
-        ++gt_DetouredCount;
     }
 
     ~DetouredScope()
     {
-        --gt_DetouredCount;
+        --m_context.ScopeDepth;
     }
 
     // This function returns false except for the top level scope.
     // NOTE: This function is not static to ensure we always declare a scope.
-    inline bool Detoured_IsDisabled() { return gt_DetouredCount != 1; }
+    inline bool Detoured_IsDisabled() { return m_isDisabled; }
+
+    // The context of the current thread, for the detour to hand down to the helpers it calls.
+    inline DetouredThreadContext& Context() { return m_context; }
 
 private:
     // make copy-safe by explicitly deleting copy constructors
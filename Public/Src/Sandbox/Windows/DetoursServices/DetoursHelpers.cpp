@@ -5,18 +5,25 @@
 
 #include "DebuggingHelpers.h"
 #include "DetoursHelpers.h"
+#include "DetoursProfile.h"
 #include "DetoursServices.h"
 #include "globals.h"
+#include "LockFree.h"
 #include "buildXL_mem.h"
 #include "SendReport.h"
 #include "StringOperations.h"
 #include "DeviceMap.h"
 #include "CanonicalizedPath.h"
 #include "PolicyResult.h"
+#include "ReportRing.h"
+#include "SharedReparsePointCache.h"
+#include "ShimProcessMatcher.h"
+#include "VolumePathTable.h"
 #include <list>
+#include <unordered_map>
+#include <unordered_set>
 #include <string>
 #include <stdio.h>
-#include <stack>
 
 using std::unique_ptr;
 using std::basic_string;
@@ -25,6 +32,184 @@ using std::basic_string;
 // FUNCTION DEFINITIONS
 // ----------------------------------------------------------------------------
 
+// FNV-1a over the lower case characters (towlower, as the comparisons of translate paths and process names do)
+static const uint32_t CaseInsensitiveHashBasis = 2166136261U;
+
+static inline uint32_t AppendToCaseInsensitiveHash(uint32_t hash, wchar_t c)
+{
+    return (hash ^ (uint32_t)std::towlower(c)) * 16777619U;
+}
+
+static uint32_t HashCaseInsensitively(const std::wstring& str)
+{
+    uint32_t hash = CaseInsensitiveHashBasis;
+    for (wchar_t c : str)
+    {
+        hash = AppendToCaseInsensitiveHash(hash, c);
+    }
+
+    return hash;
+}
+
+// The prefix filter has 4096 bits
+static const uint32_t PrefixFilterBits = 4096;
+
+TranslatePathIndex::TranslatePathIndex(const std::vector<TranslatePathTuple*>& tuples)
+    : m_prefixFilter(PrefixFilterBits / 64), m_tuples(tuples)
+{
+    for (size_t i = 0; i < tuples.size(); i++)
+    {
+        const std::wstring& fromPath = tuples[i]->GetFromPath();
+        m_fromPaths.push_back(std::make_pair(HashCaseInsensitively(fromPath), i));
+        m_lengths.push_back(fromPath.length());
+    }
+
+    std::sort(m_fromPaths.begin(), m_fromPaths.end());
+    std::sort(m_lengths.begin(), m_lengths.end());
+    m_lengths.erase(std::unique(m_lengths.begin(), m_lengths.end()), m_lengths.end());
+
+    if (m_lengths.empty())
+    {
+        return;
+    }
+
+    size_t shortestLength = m_lengths[0];
+    for (TranslatePathTuple* tuple : tuples)
+    {
+        uint32_t hash = HashCaseInsensitively(tuple->GetFromPath().substr(0, shortestLength));
+        m_prefixFilter[(hash % PrefixFilterBits) / 64] |= 1ULL << (hash % 64);
+    }
+}
+
+bool TranslatePathIndex::IsInPrefixFilter(uint32_t hash) const
+{
+    return (m_prefixFilter[(hash % PrefixFilterBits) / 64] & (1ULL << (hash % 64))) != 0;
+}
+
+bool TranslatePathIndex::MayTranslate(const std::wstring& path) const
+{
+    if (m_lengths.empty())
+    {
+        return false;
+    }
+
+    size_t shortestLength = m_lengths[0];
+    uint32_t hash = CaseInsensitiveHashBasis;
+
+    if (path.length() >= shortestLength)
+    {
+        for (size_t i = 0; i < shortestLength; i++)
+        {
+            hash = AppendToCaseInsensitiveHash(hash, path[i]);
+        }
+    }
+    else if (!path.empty() && path.length() + 1 == shortestLength && path.back() != L'\\')
+    {
+        // A directory path matches from paths with a trailing backslash
+        for (wchar_t c : path)
+        {
+            hash = AppendToCaseInsensitiveHash(hash, c);
+        }
+
+        hash = AppendToCaseInsensitiveHash(hash, L'\\');
+    }
+    else
+    {
+        return false;
+    }
+
+    return IsInPrefixFilter(hash);
+}
+
+void TranslatePathIndex::AddMatches(uint32_t hash, const std::wstring& lowCasePath, size_t length, bool directoryPath, const std::vector<bool>& usedTuples, int& bestIndex) const
+{
+    auto first = std::lower_bound(m_fromPaths.begin(), m_fromPaths.end(), std::make_pair(hash, (size_t)0));
+    for (auto it = first; it != m_fromPaths.end() && it->first == hash; ++it)
+    {
+        if (!usedTuples.empty() && usedTuples[it->second])
+        {
+            continue;
+        }
+
+        const std::wstring& fromPath = m_tuples[it->second]->GetFromPath();
+        bool matches = directoryPath
+            ? fromPath.length() == length + 1 && fromPath.back() == L'\\' && lowCasePath.compare(0, length, fromPath, 0, length) == 0
+            : fromPath.length() == length && lowCasePath.compare(0, length, fromPath) == 0;
+
+        if (matches)
+        {
+            // Entries with the same hash are sorted by index. Among tuples with the same from path, the first one is used,
+            // except for directory paths which historically used the last one.
+            bestIndex = (int)it->second;
+            if (!directoryPath)
+            {
+                return;
+            }
+        }
+    }
+}
+
+int TranslatePathIndex::FindLongestMatch(const std::wstring& lowCasePath, const std::vector<bool>& usedTuples, _Out_ size_t& matchLength) const
+{
+    int bestIndex = -1;
+    matchLength = 0;
+
+    uint32_t hash = CaseInsensitiveHashBasis;
+    size_t hashedLength = 0;
+
+    // Lengths are ascending, so the last match is the longest one
+    for (size_t length : m_lengths)
+    {
+        if (length > lowCasePath.length() + 1)
+        {
+            break;
+        }
+
+        bool directoryPath = length == lowCasePath.length() + 1;
+        size_t prefixLength = directoryPath ? lowCasePath.length() : length;
+
+        while (hashedLength < prefixLength)
+        {
+            hash = AppendToCaseInsensitiveHash(hash, lowCasePath[hashedLength++]);
+        }
+
+        if (directoryPath && (lowCasePath.empty() || lowCasePath.back() == L'\\'))
+        {
+            break;
+        }
+
+        int index = -1;
+        AddMatches(directoryPath ? AppendToCaseInsensitiveHash(hash, L'\\') : hash, lowCasePath, prefixLength, directoryPath, usedTuples, index);
+        if (index != -1)
+        {
+            bestIndex = index;
+            matchLength = prefixLength;
+        }
+    }
+
+    return bestIndex;
+}
+
+BreakawayChildProcessIndex::BreakawayChildProcessIndex(const std::vector<BreakawayChildProcess>& processes)
+{
+    for (size_t i = 0; i < processes.size(); i++)
+    {
+        m_entries.push_back(std::make_pair(HashCaseInsensitively(processes[i].ProcessName), i));
+    }
+
+    std::sort(m_entries.begin(), m_entries.end());
+}
+
+std::pair<const BreakawayChildProcessIndex::Entry*, const BreakawayChildProcessIndex::Entry*> BreakawayChildProcessIndex::Lookup(const std::wstring& imageName) const
+{
+    uint32_t hash = HashCaseInsensitively(imageName);
+    auto range = std::equal_range(m_entries.begin(), m_entries.end(), std::make_pair(hash, (size_t)0),
+        [](const Entry& a, const Entry& b) { return a.first < b.first; });
+
+    const Entry* entries = m_entries.data();
+    return std::make_pair(entries + (range.first - m_entries.begin()), entries + (range.second - m_entries.begin()));
+}
+
 /// <summary>
 /// Gets the normalized (or subst'ed) path from a full path.
 /// </summary>
@@ -72,13 +257,19 @@ void TranslateFilePath(_In_ const std::wstring& inFileName, _Out_ std::wstring&
         Dbg(L"TranslateFilePath-0: initial: '%s'", tempStr.c_str());
     }
 
-    std::list<TranslatePathTuple*> manifestTranslatePathTuples(g_pManifestTranslatePathTuples->begin(), g_pManifestTranslatePathTuples->end());
+    // Most paths are not under any from path: this takes a single probe for them
+    if (!g_pManifestTranslatePathIndex->MayTranslate(tempStr))
+    {
+        return;
+    }
+
+    // Each tuple is used at most once. Only allocated once some tuple is used.
+    std::vector<bool> usedTuples;
 
     while (needsTranslation)
     {
         needsTranslation = false;
         size_t longestPath = 0;
-        std::list<TranslatePathTuple*>::iterator replacementIt;
 
         std::wstring lowCaseFinalPath(tempStr);
         for (basic_string<wchar_t>::iterator p = lowCaseFinalPath.begin();
@@ -88,49 +279,20 @@ void TranslateFilePath(_In_ const std::wstring& inFileName, _Out_ std::wstring&
 
         // Find the longest path that can be used for translation from the g_pManifestTranslatePathTuples list.
         // Note: The g_pManifestTranslatePathTuples always comes canonicalized from the managed code.
-        for (std::list<TranslatePathTuple*>::iterator it = manifestTranslatePathTuples.begin(); it != manifestTranslatePathTuples.end(); ++it)
+        // The path to be translated can be a directory path that does not have trailing '\\'.
+        int replacementIndex = g_pManifestTranslatePathIndex->FindLongestMatch(lowCaseFinalPath, usedTuples, longestPath);
+        if (debug)
         {
-            TranslatePathTuple* tpTuple = *it;
-            const std::wstring& lowCaseTargetPath = tpTuple->GetFromPath();
-            size_t targetLen = lowCaseTargetPath.length();
-            bool mayBeDirectoryPath = false;
-
-            int comp = lowCaseFinalPath.compare(0, targetLen, lowCaseTargetPath);
-            if (debug)
-            {
-                Dbg(L"TranslateFilePath-.5: comparing: '%ws' and %ws", lowCaseFinalPath.c_str(), lowCaseTargetPath.c_str());
-            }
-
-            if (comp != 0)
-            {
-                // The path to be translated can be a directory path that does not have trailing '\\'.
-
-                if (lowCaseFinalPath.back() != L'\\'
-                    && lowCaseTargetPath.back() == L'\\'
-                    && lowCaseFinalPath.length() == (targetLen - 1))
-                {
-                    std::wstring lowCaseFinalPathWithBs = lowCaseFinalPath + L'\\';
-                    comp = lowCaseFinalPathWithBs.compare(0, targetLen, lowCaseTargetPath);
-                    mayBeDirectoryPath = true;
-                }
-            }
-
-            if (comp == 0)
-            {
-                if (longestPath < targetLen)
-                {
-                    replacementIt = it;
-                    longestPath = !mayBeDirectoryPath ? targetLen : targetLen - 1;
-                    translated = true;
-                    needsTranslation = true;
-                }
-            }
+            Dbg(L"TranslateFilePath-.5: longest match for '%ws': %d", lowCaseFinalPath.c_str(), replacementIndex);
         }
 
         // Translate using the longest translation path.
-        if (needsTranslation)
+        if (replacementIndex != -1)
         {
-            TranslatePathTuple* replacementTuple = *replacementIt;
+            translated = true;
+            needsTranslation = true;
+
+            TranslatePathTuple* replacementTuple = (*g_pManifestTranslatePathTuples)[replacementIndex];
 
             std::wstring t(replacementTuple->GetToPath());
             t.append(tempStr, longestPath);
@@ -146,7 +308,13 @@ void TranslateFilePath(_In_ const std::wstring& inFileName, _Out_ std::wstring&
             }
 
             tempStr.assign(t);
-            manifestTranslatePathTuples.erase(replacementIt);
+
+            if (usedTuples.empty())
+            {
+                usedTuples.resize(g_pManifestTranslatePathTuples->size());
+            }
+
+            usedTuples[replacementIndex] = true;
         }
     }
 
@@ -604,7 +772,75 @@ static inline void SkipWriteCharsString(const byte* payloadBytes, size_t& offset
     offset += sizeof(wchar_t) * len;
 }
 
-static SubstituteProcessExecutionPluginFunc GetSubstituteProcessExecutionPluginFunc()
+// Optional manifest sections that are only needed when the process creates child processes. ParseFileAccessManifest
+// records where they start in the payload (which lives as long as the process) and they are decoded in place,
+// without copying the strings out first, the first time they are used.
+static LPCBYTE s_breakawayChildProcessesPayload = nullptr;
+static INIT_ONCE s_breakawayChildProcessesInitOnce = INIT_ONCE_STATIC_INIT;
+static LPCBYTE s_shimProcessMatchesPayload = nullptr;
+static INIT_ONCE s_shimProcessMatcherInitOnce = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK ParseBreakawayChildProcesses(PINIT_ONCE, PVOID, PVOID*)
+{
+    size_t offset = 0;
+    for (uint32_t i = 0; i < g_manifestChildProcessesToBreakAwayFromJob->Count; i++)
+    {
+        uint32_t processNameLength = ParseUint32(s_breakawayChildProcessesPayload, offset);
+        if (processNameLength != 0)
+        {
+            const wchar_t* processName = reinterpret_cast<const wchar_t*>(&s_breakawayChildProcessesPayload[offset]);
+            offset += sizeof(wchar_t) * processNameLength;
+            uint32_t argsLength = ParseUint32(s_breakawayChildProcessesPayload, offset);
+            const wchar_t* args = reinterpret_cast<const wchar_t*>(&s_breakawayChildProcessesPayload[offset]);
+            offset += sizeof(wchar_t) * argsLength;
+            g_breakawayChildProcesses->push_back(BreakawayChildProcess(
+                std::wstring(processName, processNameLength),
+                std::wstring(args, argsLength),
+                ParseByte(s_breakawayChildProcessesPayload, offset) == 1U));
+        }
+    }
+
+    g_pBreakawayChildProcessIndex = new BreakawayChildProcessIndex(*g_breakawayChildProcesses);
+    return TRUE;
+}
+
+void EnsureBreakawayChildProcessesParsed()
+{
+    InitOnceExecuteOnce(&s_breakawayChildProcessesInitOnce, ParseBreakawayChildProcesses, nullptr, nullptr);
+}
+
+static BOOL CALLBACK CompileShimProcessMatcher(PINIT_ONCE, PVOID, PVOID*)
+{
+    size_t offset = 0;
+    uint32_t numProcessMatches = ParseUint32(s_shimProcessMatchesPayload, offset);
+    g_pShimProcessMatcher = new ShimProcessMatcher();
+    for (uint32_t i = 0; i < numProcessMatches; i++)
+    {
+        uint32_t processNameLength = ParseUint32(s_shimProcessMatchesPayload, offset);
+        const wchar_t* processName = reinterpret_cast<const wchar_t*>(&s_shimProcessMatchesPayload[offset]);
+        offset += sizeof(wchar_t) * processNameLength;
+        uint32_t argumentMatchLength = ParseUint32(s_shimProcessMatchesPayload, offset);
+        const wchar_t* argumentMatch = reinterpret_cast<const wchar_t*>(&s_shimProcessMatchesPayload[offset]);
+        offset += sizeof(wchar_t) * argumentMatchLength;
+        g_pShimProcessMatcher->AddRule(processName, processNameLength, argumentMatch, argumentMatchLength);
+    }
+
+    g_pShimProcessMatcher->Seal();
+    return TRUE;
+}
+
+const ShimProcessMatcher* GetShimProcessMatcher()
+{
+    if (s_shimProcessMatchesPayload == nullptr)
+    {
+        return nullptr;
+    }
+
+    InitOnceExecuteOnce(&s_shimProcessMatcherInitOnce, CompileShimProcessMatcher, nullptr, nullptr);
+    return g_pShimProcessMatcher;
+}
+
+static void* GetSubstituteProcessExecutionPluginProc(const char* name, size_t parameterCount)
 {
     assert(g_SubstituteProcessExecutionPluginDllHandle != nullptr);
 
@@ -621,32 +857,36 @@ static SubstituteProcessExecutionPluginFunc GetSubstituteProcessExecutionPluginF
     //     1    0 00011276 _CommandMatches@24 = @ILT + 625(_CommandMatches@24)
 
 
-    // (1) Check for CommandMatches.
-    std::string winApiProcName("CommandMatches");
-    SubstituteProcessExecutionPluginFunc substituteProcessExecutionPluginFunc = reinterpret_cast<SubstituteProcessExecutionPluginFunc>(
-        reinterpret_cast<void*>(GetProcAddress(g_SubstituteProcessExecutionPluginDllHandle, winApiProcName.c_str())));
-    if (substituteProcessExecutionPluginFunc != nullptr)
+    // (1) Check for <name>.
+    std::string winApiProcName(name);
+    void* proc = reinterpret_cast<void*>(GetProcAddress(g_SubstituteProcessExecutionPluginDllHandle, winApiProcName.c_str()));
+    if (proc != nullptr)
     {
-        return substituteProcessExecutionPluginFunc;
+        return proc;
     }
 
-    // (2) Check for CommandMatches@<param_size> based on platform.
+    // (2) Check for <name>@<param_size> based on platform.
+    winApiProcName.append("@");
 #if defined(_WIN64)
-    winApiProcName.append("@48"); // 6 64-bit parameters
+    winApiProcName.append(std::to_string(parameterCount * 8)); // 64-bit parameters
 #elif defined(_WIN32)
-    winApiProcName.append("@24"); // 6 32-bit parameters
+    winApiProcName.append(std::to_string(parameterCount * 4)); // 32-bit parameters
 #endif
-    substituteProcessExecutionPluginFunc = reinterpret_cast<SubstituteProcessExecutionPluginFunc>(
-        reinterpret_cast<void*>(GetProcAddress(g_SubstituteProcessExecutionPluginDllHandle, winApiProcName.c_str())));
-    if (substituteProcessExecutionPluginFunc != nullptr)
+    proc = reinterpret_cast<void*>(GetProcAddress(g_SubstituteProcessExecutionPluginDllHandle, winApiProcName.c_str()));
+    if (proc != nullptr)
     {
-        return substituteProcessExecutionPluginFunc;
+        return proc;
     }
 
-    // (3) Check for _CommandMatches@<param_size>.
+    // (3) Check for _<name>@<param_size>.
     winApiProcName.insert(0, 1, '_');
-    substituteProcessExecutionPluginFunc = reinterpret_cast<SubstituteProcessExecutionPluginFunc>(
-        reinterpret_cast<void*>(GetProcAddress(g_SubstituteProcessExecutionPluginDllHandle, winApiProcName.c_str())));
+    return reinterpret_cast<void*>(GetProcAddress(g_SubstituteProcessExecutionPluginDllHandle, winApiProcName.c_str()));
+}
+
+static SubstituteProcessExecutionPluginFunc GetSubstituteProcessExecutionPluginFunc()
+{
+    SubstituteProcessExecutionPluginFunc substituteProcessExecutionPluginFunc = reinterpret_cast<SubstituteProcessExecutionPluginFunc>(
+        GetSubstituteProcessExecutionPluginProc("CommandMatches", 6));
     if (substituteProcessExecutionPluginFunc != nullptr)
     {
         return substituteProcessExecutionPluginFunc;
@@ -666,9 +906,15 @@ static void LoadSubstituteProcessExecutionPluginDll()
 
     if (g_SubstituteProcessExecutionPluginDllHandle != nullptr)
     {
-        g_SubstituteProcessExecutionPluginFunc = GetSubstituteProcessExecutionPluginFunc();
+        g_SubstituteProcessExecutionCacheablePluginFunc = reinterpret_cast<SubstituteProcessExecutionCacheablePluginFunc>(
+            GetSubstituteProcessExecutionPluginProc("CommandMatchesCacheable", 7));
 
-        if (g_SubstituteProcessExecutionPluginFunc == nullptr)
+        if (g_SubstituteProcessExecutionCacheablePluginFunc == nullptr)
+        {
+            g_SubstituteProcessExecutionPluginFunc = GetSubstituteProcessExecutionPluginFunc();
+        }
+
+        if (g_SubstituteProcessExecutionPluginFunc == nullptr && g_SubstituteProcessExecutionCacheablePluginFunc == nullptr)
         {
             FreeLibrary(g_SubstituteProcessExecutionPluginDllHandle);
         }
@@ -688,7 +934,13 @@ static void LoadSubstituteProcessExecutionPluginDll()
 /// </remarks>
 static DWORD DetourGetFinalPathByHandle(_In_ HANDLE hFile, _Inout_ std::wstring& fullPath)
 {
-    // First, try with a fixed-sized buffer which should be good enough for all practical cases.
+    // Most handles are on a volume with a drive letter, whose DOS name doesn't need to be queried
+    if (TryGetFinalPathByHandleFromVolumePathTable(hFile, fullPath))
+    {
+        return ERROR_SUCCESS;
+    }
+
+    // Otherwise try with a fixed-sized buffer which should be good enough for all practical cases.
     wchar_t wszBuffer[MAX_PATH];
     DWORD nBufferLength = std::extent<decltype(wszBuffer)>::value;
 
@@ -743,7 +995,8 @@ static bool ShouldResolveReparsePointsInPath(
     bool ignoreReparsePointForPath =
         IgnoreReparsePoints() ||
         (IgnoreFullReparsePointResolving() && !policyResult.EnableFullReparsePointParsing()) ||
-        policyResult.IndicateUntracked();
+        policyResult.IndicateUntracked() ||
+        policyResult.ContainsNoReparsePoints();
     return !ignoreReparsePointForPath;
 }
 
@@ -812,15 +1065,18 @@ bool ParseFileAccessManifest(
     g_manifestChildProcessesToBreakAwayFromJob->AssertValid();
     offset += g_manifestChildProcessesToBreakAwayFromJob->GetSize();
 
+    // The breakaway processes are only needed when a child process is created: just skip over them here,
+    // they are decoded by EnsureBreakawayChildProcessesParsed.
+    s_breakawayChildProcessesPayload = &payloadBytes[offset];
     for (uint32_t i = 0; i < g_manifestChildProcessesToBreakAwayFromJob->Count; i++)
     {
-        std::wstring processName(L"");
-        AppendStringFromWriteChars(payloadBytes, offset, processName);
-        if (!processName.empty())
-        {   
-            std::wstring requiredCommandLineArgsSubstring(L"");
-            AppendStringFromWriteChars(payloadBytes, offset, requiredCommandLineArgsSubstring);
-            g_breakawayChildProcesses->push_back(BreakawayChildProcess(processName, requiredCommandLineArgsSubstring, ParseByte(payloadBytes, offset) == 1U));
+        uint32_t processNameLength = ParseUint32(payloadBytes, offset);
+        if (processNameLength != 0)
+        {
+            offset += sizeof(wchar_t) * processNameLength;
+            SkipWriteCharsString(payloadBytes, offset); // Required command line arguments substring.
+            ParseByte(payloadBytes, offset);
+            g_hasBreakawayChildProcesses = true;
         }
     }
 
@@ -867,6 +1123,8 @@ bool ParseFileAccessManifest(
         }
     }
 
+    g_pManifestTranslatePathIndex = new TranslatePathIndex(*g_pManifestTranslatePathTuples);
+
     g_manifestInternalDetoursErrorNotificationFileString = reinterpret_cast<const PManifestInternalDetoursErrorNotificationFileString>(&payloadBytes[offset]);
     g_manifestInternalDetoursErrorNotificationFileString->AssertValid();
 #ifdef _DEBUG
@@ -884,6 +1142,12 @@ bool ParseFileAccessManifest(
     extraFlags->AssertValid();
     g_fileAccessManifestExtraFlags = static_cast<FileAccessManifestExtraFlag>(extraFlags->ExtraFlags);
     g_pDetouredProcessInjector->SetAlwaysRemoteInjectFromWow64Process(CheckAlwaysRemoteInjectDetoursFrom32BitProcess(g_fileAccessManifestExtraFlags));
+    g_pDetouredProcessInjector->SetSharePayloadSection(CheckEnableSharedPayloadSection(g_fileAccessManifestExtraFlags));
+    if (CheckEnableDetoursProfile(g_fileAccessManifestExtraFlags))
+    {
+        DetoursProfile::Enable();
+    }
+
     g_pDetouredProcessInjector->SetPayload(payloadBytes, payloadSize);
     offset += extraFlags->GetSize();
 
@@ -929,6 +1193,21 @@ bool ParseFileAccessManifest(
     if (report->IsReportPresent()) {
         if (report->IsReportHandle()) {
             g_reportFileHandle = g_pDetouredProcessInjector->ReportPipe();
+
+            // NOTE: the ring and the reparse point cache are optional, if they can't be opened reports just keep going through the pipe
+            // and reparse points get resolved by each process
+            PCPathChar sharedMemoryName = report->GetSharedMemoryName();
+            if (sharedMemoryName != nullptr && CheckEnableSharedMemoryReports(g_fileAccessManifestExtraFlags))
+            {
+                OpenReportRing(sharedMemoryName);
+            }
+
+            if (sharedMemoryName != nullptr && CheckEnableSharedReparsePointCache(g_fileAccessManifestExtraFlags))
+            {
+                std::wstring cacheName(sharedMemoryName);
+                cacheName.append(SHARED_REPARSE_POINT_CACHE_SUFFIX);
+                OpenSharedReparsePointCache(cacheName.c_str());
+            }
 #ifdef _DEBUG
 #pragma warning( push )
 #pragma warning( disable: 4302 4310 4311 4826 )
@@ -997,13 +1276,13 @@ bool ParseFileAccessManifest(
         g_SubstituteProcessExecutionPluginDllPath = CreateStringFromWriteChars(payloadBytes, offset);
         SkipWriteCharsString(payloadBytes, offset);  // Skip 64-bit path.
 #endif
+        // The rules are compiled by GetShimProcessMatcher, the first time a process is created.
+        s_shimProcessMatchesPayload = &payloadBytes[offset];
         uint32_t numProcessMatches = ParseUint32(payloadBytes, offset);
-        g_pShimProcessMatches = new vector<ShimProcessMatch*>();
         for (uint32_t i = 0; i < numProcessMatches; i++)
         {
-            wchar_t *processName = CreateStringFromWriteChars(payloadBytes, offset);
-            wchar_t *argumentMatch = CreateStringFromWriteChars(payloadBytes, offset);
-            g_pShimProcessMatches->push_back(new ShimProcessMatch(processName, argumentMatch));
+            SkipWriteCharsString(payloadBytes, offset); // Process name.
+            SkipWriteCharsString(payloadBytes, offset); // Argument match.
         }
     }
 
@@ -1015,6 +1294,12 @@ bool ParseFileAccessManifest(
     g_manifestTreeRoot = reinterpret_cast<PCManifestRecord>(&payloadBytes[offset]);
     VerifyManifestRoot(g_manifestTreeRoot);
 
+    // NOTE: the index is optional, policy searches walk the tree without it
+    if (CheckEnableManifestRecordIndex(g_fileAccessManifestExtraFlags) && !g_manifestRecordIndex.TryLocate(g_manifestTreeRoot, payloadBytes + payloadSize))
+    {
+        Dbg(L"ParseFileAccessManifest: The manifest has no valid record index, policies are searched in the tree");
+    }
+
     //
     // Try to read module file and check permissions.
     //
@@ -1183,85 +1468,222 @@ void InitProcessKind()
     }
 }
 
-void ReportIfNeeded(AccessCheckResult const& checkResult, FileOperationContext const& context, PolicyResult const& policyResult, DWORD error, USN usn, wchar_t const* filter) {
-    if (!checkResult.ShouldReport()) {
-        return;
+// ----------------------------------------------------------------------------
+// IMAGE PATH CACHE
+// ----------------------------------------------------------------------------
+
+// Build scripts create the same few processes (cmd.exe, cl.exe, link.exe) over and over, and every CreateProcessW runs the search
+// order for the image again (GetImagePath): SearchPathW probes every directory in front of the one the image is in. Images that
+// were found are cached for the lifetime of the process, keyed by the token that was resolved, the current directory and PATH,
+// which (with the directory of the current image and the system directories, fixed for the lifetime of the process) determine
+// the search order. Tokens that did not resolve are not cached.
+//
+// A hit still probes the cached image, so an image that went away is searched for again. Images that show up earlier in the
+// search order are only noticed if this process writes them: any write, rename or delete of a file named as a cached token
+// (with or without .exe), and any move or delete of a directory, clears the cache (see ReportIfNeeded).
+
+// Beyond this many cached images, further resolutions are not cached
+#define IMAGE_PATH_CACHE_MAX_ENTRIES 256
+
+typedef struct
+{
+    std::wstring envPath;
+    CanonicalizedPath imagePath;
+} ImagePathCacheEntry;
+
+// token + '\n' + current directory + '\n' + hash of PATH -> ImagePathCacheEntry
+static std::unordered_map<std::wstring, ImagePathCacheEntry> s_imagePaths;
+// Case insensitive hashes of the file names the cached images depend on
+static std::unordered_set<uint32_t> s_imagePathNames;
+static SRWLOCK s_imagePathsLock = SRWLOCK_INIT;
+static volatile LONG s_imagePathCount = 0;
+
+static uint32_t HashLastComponentCaseInsensitively(const wchar_t* path, size_t length, const wchar_t* suffix)
+{
+    size_t start = length;
+    while (start > 0 && !IsDirectorySeparator(path[start - 1]))
+    {
+        start--;
     }
 
-    if (checkResult.ShouldDenyAccess()) {
-        // Although policyResult may have contained the translated path, TranslateFilePath is called again for debugging purpose.
-        std::wstring outFile;
-        TranslateFilePath(std::wstring(policyResult.GetCanonicalizedPath().GetPathString()), outFile, true);
+    uint32_t hash = CaseInsensitiveHashBasis;
+    for (size_t i = start; i < length; i++)
+    {
+        hash = AppendToCaseInsensitiveHash(hash, path[i]);
     }
 
-    ReportFileAccess(
-        context,
-        checkResult.GetFileAccessStatus(),
-        policyResult,
-        checkResult,
-        error,
-        usn,
-        filter);
+    for (; suffix != nullptr && *suffix; suffix++)
+    {
+        hash = AppendToCaseInsensitiveHash(hash, *suffix);
+    }
+
+    return hash;
 }
 
-bool EnumerateDirectory(
-    const std::wstring& directoryPath,
-    const std::wstring& filter,
-    bool recursive,
-    bool treatReparsePointAsFile,
-    _Inout_ std::vector<std::pair<std::wstring, DWORD>>& filesAndDirectories)
+// Returns false if the lookup can't be cached (e.g., the current directory is too long)
+static bool ImagePathCache_GetKey(const std::wstring& token, _Out_ std::wstring& key, _Out_ std::wstring& envPath)
 {
-    HANDLE hFind = INVALID_HANDLE_VALUE;
-    WIN32_FIND_DATA ffd;
-    std::stack<std::wstring> directoriesToEnumerate;
+    wchar_t currentDirectory[MAX_PATH];
+    DWORD currentDirectoryLength = GetCurrentDirectoryW(MAX_PATH, currentDirectory);
+    if (currentDirectoryLength == 0 || currentDirectoryLength >= MAX_PATH)
+    {
+        return false;
+    }
 
-    directoriesToEnumerate.push(directoryPath);
-    filesAndDirectories.clear();
+    envPath.clear();
+    DWORD envPathLength = GetEnvironmentVariableW(L"PATH", nullptr, 0);
+    if (envPathLength > 0)
+    {
+        envPath.resize(envPathLength);
+        envPathLength = GetEnvironmentVariableW(L"PATH", &envPath[0], envPathLength);
+        envPath.resize(envPathLength < envPath.size() ? envPathLength : 0);
+    }
 
-    while (!directoriesToEnumerate.empty()) {
-        std::wstring directoryToEnumerate = directoriesToEnumerate.top();
-        std::wstring spec = PathCombine(directoryToEnumerate, filter.c_str());
+    key.reserve(token.length() + currentDirectoryLength + 24);
+    key.assign(token);
+    key.push_back(L'\n');
+    key.append(currentDirectory, currentDirectoryLength);
+    key.push_back(L'\n');
+    key.append(std::to_wstring(std::hash<std::wstring>()(envPath)));
+    return true;
+}
 
-        directoriesToEnumerate.pop();
+static bool ImagePathCache_TryGet(const std::wstring& key, const std::wstring& envPath, _Out_ CanonicalizedPath& imagePath)
+{
+    if (s_imagePathCount == 0)
+    {
+        return false;
+    }
 
-        hFind = FindFirstFileW(NormalizePath(spec).c_str(), &ffd);
-        if (hFind == INVALID_HANDLE_VALUE) {
-            return false;
-        }
+    AcquireSRWLockShared(&s_imagePathsLock);
+    auto iter = s_imagePaths.find(key);
+    bool found = iter != s_imagePaths.end() && iter->second.envPath == envPath;
+    if (found)
+    {
+        imagePath = iter->second.imagePath;
+    }
+
+    ReleaseSRWLockShared(&s_imagePathsLock);
+
+    // One probe instead of the whole search order
+    return found && ExistsAsFile(imagePath.GetPathString());
+}
+
+static void ImagePathCache_Add(std::wstring&& key, std::wstring&& envPath, const std::wstring& token, const CanonicalizedPath& imagePath)
+{
+    if (imagePath.IsNull())
+    {
+        return;
+    }
 
-        do {
-            if (wcscmp(ffd.cFileName, L".") != 0 &&
-                wcscmp(ffd.cFileName, L"..") != 0) {
+    AcquireSRWLockExclusive(&s_imagePathsLock);
+    if (s_imagePaths.size() < IMAGE_PATH_CACHE_MAX_ENTRIES || s_imagePaths.find(key) != s_imagePaths.end())
+    {
+        s_imagePathNames.insert(HashLastComponentCaseInsensitively(token.c_str(), token.length(), nullptr));
+        s_imagePathNames.insert(HashLastComponentCaseInsensitively(token.c_str(), token.length(), L".exe"));
+        s_imagePaths[std::move(key)] = { std::move(envPath), imagePath };
+        InterlockedExchange(&s_imagePathCount, (LONG)s_imagePaths.size());
+    }
 
-                std::wstring path = PathCombine(directoryToEnumerate, ffd.cFileName);
+    ReleaseSRWLockExclusive(&s_imagePathsLock);
+}
 
-                filesAndDirectories.push_back(std::make_pair(path, ffd.dwFileAttributes));
+// Called for every access that asks for write access (including deletes and renames), whether it ends up reported or not
+static void ImagePathCache_InvalidateIfNeeded(FileOperationContext const& context, PolicyResult const& policyResult)
+{
+    if (s_imagePathCount == 0 || policyResult.GetCanonicalizedPath().IsNull())
+    {
+        return;
+    }
 
-                if (recursive) {
+    bool isDirectory = (context.FlagsAndAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0
+        || (context.OpenedFileOrDirectoryAttributes != INVALID_FILE_ATTRIBUTES && (context.OpenedFileOrDirectoryAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0);
+    bool clear = isDirectory && (context.DesiredAccess & DELETE) != 0;
+    if (!clear)
+    {
+        const wchar_t* path = policyResult.GetCanonicalizedPath().GetPathString();
+        uint32_t nameHash = HashLastComponentCaseInsensitively(path, wcslen(path), nullptr);
 
-                    bool isDirectory = (ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        AcquireSRWLockShared(&s_imagePathsLock);
+        clear = s_imagePathNames.find(nameHash) != s_imagePathNames.end();
+        ReleaseSRWLockShared(&s_imagePathsLock);
+    }
 
-                    if (isDirectory && treatReparsePointAsFile) {
-                        isDirectory = (ffd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0;
-                    }
+    if (clear)
+    {
+        AcquireSRWLockExclusive(&s_imagePathsLock);
+        s_imagePaths.clear();
+        s_imagePathNames.clear();
+        InterlockedExchange(&s_imagePathCount, 0);
+        ReleaseSRWLockExclusive(&s_imagePathsLock);
+    }
+}
 
-                    if (isDirectory) {
-                        directoriesToEnumerate.push(path);
-                    }
-                }
-            }
-        } while (FindNextFile(hFind, &ffd) != 0);
+// Keys of the file access reports sent by this process (see IsDuplicateReport). Once the set is full, reports are all sent.
+static LockFree::HashSet<1 << 14> s_sentReports;
 
-        if (GetLastError() != ERROR_NO_MORE_FILES) {
-            FindClose(hFind);
-            return false;
-        }
+static inline uint64_t AppendToReportKey(uint64_t key, uint64_t value)
+{
+    return (key ^ value) * 0x100000001b3ULL;
+}
 
-        FindClose(hFind);
-        hFind = INVALID_HANDLE_VALUE;
+// Whether a report with the same content (path, operation, access, status, error, ...) was already sent by this process, in which
+// case the managed side would only drop it. Paths are compared through their hashes, like the access cache of the Linux sandbox does.
+// Reports with a USN, or correlated with another operation, are never considered duplicates.
+static bool IsDuplicateReport(AccessCheckResult const& checkResult, FileOperationContext const& context, PolicyResult const& policyResult, DWORD error, USN usn, wchar_t const* filter)
+{
+    if (!CheckEnableReportDeduplication(g_fileAccessManifestExtraFlags)
+        || policyResult.IsIndeterminate()
+        || usn != 0
+        || context.CorrelationId != FileOperationContext::NoId)
+    {
+        return false;
     }
 
-    return true;
+    const CanonicalizedPath& path = policyResult.GetCanonicalizedPath();
+    uint64_t key = HashPath64(path.GetPathString(), path.Length());
+    key = AppendToReportKey(key, HashPath64(context.Operation, wcslen(context.Operation)));
+    key = AppendToReportKey(key, filter == nullptr || checkResult.Access != RequestedAccess::Enumerate ? 0 : HashPath64(filter, wcslen(filter)));
+    key = AppendToReportKey(key, (uint64_t)checkResult.Access);
+    key = AppendToReportKey(key, (uint64_t)checkResult.GetFileAccessStatus());
+    key = AppendToReportKey(key, (uint64_t)(checkResult.Level == ReportLevel::ReportExplicit));
+    key = AppendToReportKey(key, error);
+    key = AppendToReportKey(key, context.DesiredAccess);
+    key = AppendToReportKey(key, context.ShareMode);
+    key = AppendToReportKey(key, context.CreationDisposition);
+    key = AppendToReportKey(key, context.FlagsAndAttributes);
+    key = AppendToReportKey(key, context.OpenedFileOrDirectoryAttributes);
+
+    return s_sentReports.Add(key) == LockFree::HashSet<1 << 14>::AddResult::AlreadyPresent;
+}
+
+void ReportIfNeeded(AccessCheckResult const& checkResult, FileOperationContext const& context, PolicyResult const& policyResult, DWORD error, USN usn, wchar_t const* filter) {
+    if (WantsWriteAccess(context.DesiredAccess)) {
+        ImagePathCache_InvalidateIfNeeded(context, policyResult);
+    }
+
+    if (!checkResult.ShouldReport()) {
+        return;
+    }
+
+    if (IsDuplicateReport(checkResult, context, policyResult, error, usn, filter)) {
+        return;
+    }
+
+    if (checkResult.ShouldDenyAccess()) {
+        // Although policyResult may have contained the translated path, TranslateFilePath is called again for debugging purpose.
+        std::wstring outFile;
+        TranslateFilePath(std::wstring(policyResult.GetCanonicalizedPath().GetPathString()), outFile, true);
+    }
+
+    ReportFileAccess(
+        context,
+        checkResult.GetFileAccessStatus(),
+        policyResult,
+        checkResult,
+        error,
+        usn,
+        filter);
 }
 
 bool ExistsAsFile(_In_ PCWSTR path)
@@ -1335,7 +1757,7 @@ static bool ExistsImageFile(_In_ CanonicalizedPath& candidatePath)
     return ExistsAsFile(candidatePath.GetPathString());
 }
 
-static bool TryFindImagePath(_In_ std::wstring& candidatePath, _Out_opt_ CanonicalizedPath& imagePath)
+static bool TryFindImagePathUncached(_In_ std::wstring& candidatePath, _Out_opt_ CanonicalizedPath& imagePath)
 {
     imagePath = CanonicalizedPath::Canonicalize(candidatePath.c_str());
     if (ExistsImageFile(imagePath))
@@ -1356,6 +1778,29 @@ static bool TryFindImagePath(_In_ std::wstring& candidatePath, _Out_opt_ Canonic
     return ExistsImageFile(imagePath);
 }
 
+static bool TryFindImagePath(_In_ std::wstring& candidatePath, _Out_opt_ CanonicalizedPath& imagePath)
+{
+    std::wstring key;
+    std::wstring envPath;
+    bool cacheable = ImagePathCache_GetKey(candidatePath, key, envPath);
+    if (cacheable && ImagePathCache_TryGet(key, envPath, imagePath))
+    {
+        return true;
+    }
+
+    if (!TryFindImagePathUncached(candidatePath, imagePath))
+    {
+        return false;
+    }
+
+    if (cacheable)
+    {
+        ImagePathCache_Add(std::move(key), std::move(envPath), candidatePath, imagePath);
+    }
+
+    return true;
+}
+
 static CanonicalizedPath GetCanonicalizedApplicationPath(_In_ LPCWSTR lpApplicationName)
 {
     if (GetRootLength(lpApplicationName) > 0)
@@ -1369,10 +1814,27 @@ static CanonicalizedPath GetCanonicalizedApplicationPath(_In_ LPCWSTR lpApplicat
     // to find the full path. We cannot rely on GetFullPathNameW (as in CanonicalizedPath) because
     // GetFullPathNameW will simply prepend the file name with the current directory, which result in
     // a non-existent path for executables like "cmd.exe".
+    std::wstring token(lpApplicationName);
+    std::wstring key;
+    std::wstring envPath;
+    CanonicalizedPath imagePath;
+    bool cacheable = ImagePathCache_GetKey(token, key, envPath);
+    if (cacheable && ImagePathCache_TryGet(key, envPath, imagePath))
+    {
+        return imagePath;
+    }
+
     std::wstring applicationPath;
-    return SearchFullPath(nullptr, lpApplicationName, L".exe", applicationPath) != ERROR_SUCCESS
+    imagePath = SearchFullPath(nullptr, lpApplicationName, L".exe", applicationPath) != ERROR_SUCCESS
         ? CanonicalizedPath()
-        : CanonicalizedPath::Canonicalize(applicationPath.c_str());;
+        : CanonicalizedPath::Canonicalize(applicationPath.c_str());
+
+    if (cacheable)
+    {
+        ImagePathCache_Add(std::move(key), std::move(envPath), token, imagePath);
+    }
+
+    return imagePath;
 }
 
 CanonicalizedPath GetImagePath(_In_opt_ LPCWSTR lpApplicationName, _In_opt_ LPWSTR lpCommandLine)
@@ -106,6 +106,14 @@ bool ParseFileAccessManifest(
 
 bool LocateAndParseFileAccessManifest();
 
+// Decodes the child processes allowed to break away from the job object (g_breakawayChildProcesses and
+// g_pBreakawayChildProcessIndex) the first time it is called. Only needed if g_hasBreakawayChildProcesses.
+void EnsureBreakawayChildProcessesParsed();
+
+// Returns the compiled substitute process execution shim rules (compiled the first time it is called),
+// or nullptr if the manifest has no shim.
+const ShimProcessMatcher* GetShimProcessMatcher();
+
 void WriteToInternalErrorsFile(PCWSTR format, ...);
 
 void InitProcessKind();
@@ -120,13 +128,6 @@ void ReportIfNeeded(
     USN usn = -1,
     wchar_t const* filter = nullptr);
 
-bool EnumerateDirectory(
-    const std::wstring& directoryPath,
-    const std::wstring& filter,
-    bool recursive,
-    bool treatReparsePointAsFile,
-    _Inout_ std::vector<std::pair<std::wstring, DWORD>>& filesAndDirectories);
-
 bool ExistsAsFile(_In_ PCWSTR path);
 
 // Tries to mimic the CreateProcess logic by identifying the image path based on the application
@@ -0,0 +1,164 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include "DetouredScope.h"
+#include "DetoursProfile.h"
+#include "SendReport.h"
+#include "buildXL_mem.h"
+
+bool DetoursProfile::s_enabled = false;
+volatile LONG DetoursProfile::s_functionCount = 0;
+PCWSTR DetoursProfile::s_functionNames[DetoursProfile::MAX_FUNCTIONS] = {};
+DetoursProfile::Block* volatile DetoursProfile::s_blocks = nullptr;
+
+int DetoursProfile::RegisterFunction(PCWSTR name)
+{
+    LONG index = InterlockedIncrement(&s_functionCount) - 1;
+    if (index >= MAX_FUNCTIONS)
+    {
+        return -1;
+    }
+
+    s_functionNames[index] = name;
+    return (int)index;
+}
+
+DetoursProfile::Block* DetoursProfile::GetBlock()
+{
+    DetouredThreadContext& context = DetouredThreadContext::Current();
+    Block* block = static_cast<Block*>(context.ProfileBlock);
+    if (block != nullptr)
+    {
+        return block;
+    }
+
+    // If the allocation fails, the calls of this thread are just not recorded
+    block = static_cast<Block*>(dd_malloc(sizeof(Block)));
+    if (block == nullptr)
+    {
+        return nullptr;
+    }
+
+    block->CurrentFunction = -1;
+
+    // Blocks are never released: the profile of threads that are gone still counts
+    Block* head;
+    do
+    {
+        head = s_blocks;
+        block->Next = head;
+    } while (InterlockedCompareExchangePointer(reinterpret_cast<PVOID volatile*>(&s_blocks), block, head) != head);
+
+    context.ProfileBlock = block;
+    return block;
+}
+
+DetoursProfile::Scope::Scope(int function)
+    : m_function(-1), m_start(0)
+{
+    if (!IsEnabled() || function < 0 || function >= MAX_FUNCTIONS)
+    {
+        return;
+    }
+
+    Block* block = GetBlock();
+    if (block == nullptr || block->CurrentFunction != -1)
+    {
+        // Nested detours are accounted to the outermost one
+        return;
+    }
+
+    block->CurrentFunction = function;
+    m_function = function;
+    m_start = Now();
+}
+
+DetoursProfile::Scope::~Scope()
+{
+    if (m_function == -1)
+    {
+        return;
+    }
+
+    Block* block = static_cast<Block*>(DetouredThreadContext::Current().ProfileBlock);
+    block->Calls[m_function]++;
+    block->Ticks[m_function] += (ULONG64)(Now() - m_start);
+    block->CurrentFunction = -1;
+}
+
+DetoursProfile::PolicyScope::PolicyScope()
+    : m_timing(false), m_start(0)
+{
+    if (!IsEnabled())
+    {
+        return;
+    }
+
+    Block* block = static_cast<Block*>(DetouredThreadContext::Current().ProfileBlock);
+    if (block == nullptr || block->CurrentFunction == -1 || block->InPolicyScope)
+    {
+        return;
+    }
+
+    block->InPolicyScope = true;
+    m_timing = true;
+    m_start = Now();
+}
+
+DetoursProfile::PolicyScope::~PolicyScope()
+{
+    if (!m_timing)
+    {
+        return;
+    }
+
+    Block* block = static_cast<Block*>(DetouredThreadContext::Current().ProfileBlock);
+    block->PolicyTicks[block->CurrentFunction] += (ULONG64)(Now() - m_start);
+    block->InPolicyScope = false;
+}
+
+void DetoursProfile::Report()
+{
+    if (!IsEnabled())
+    {
+        return;
+    }
+
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+
+    LONG functionCount = s_functionCount < MAX_FUNCTIONS ? s_functionCount : MAX_FUNCTIONS;
+    for (LONG function = 0; function < functionCount; function++)
+    {
+        ULONG64 calls = 0;
+        ULONG64 ticks = 0;
+        ULONG64 policyTicks = 0;
+        for (Block* block = s_blocks; block != nullptr; block = block->Next)
+        {
+            calls += block->Calls[function];
+            ticks += block->Ticks[function];
+            policyTicks += block->PolicyTicks[function];
+        }
+
+        if (calls == 0 || s_functionNames[function] == nullptr)
+        {
+            continue;
+        }
+
+        wchar_t report[256];
+        int const constructReportResult = swprintf_s(report, _countof(report), L"%d,DetoursProfile %s calls=%I64u ticks=%I64u policyTicks=%I64u frequency=%I64d\r\n",
+            ReportType::ReportType_DebugMessage,
+            s_functionNames[function],
+            calls,
+            ticks,
+            policyTicks,
+            frequency.QuadPart);
+
+        if (constructReportResult > 0)
+        {
+            SendReportString(report);
+        }
+    }
+}
@@ -0,0 +1,101 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <windows.h>
+
+// ----------------------------------------------------------------------------
+// DETOURS PROFILE
+// ----------------------------------------------------------------------------
+//
+// When FileAccessManifestExtraFlag::EnableDetoursProfile is set, every detoured function records its call count and the
+// QueryPerformanceCounter ticks spent in it, and how many of those ticks went to evaluating policies (the PolicyResult::Initialize
+// family). Only top-level calls are recorded: a detour called by another one (e.g., NtCreateFile under CreateFileW) is part of the
+// cost of its caller.
+//
+// Each thread records into its own block (allocated the first time the thread records anything), so recording takes no lock. Blocks
+// are linked in a global list and aggregated by DetoursProfile::Report when the process exits, which sends one debug message per
+// function that was called:
+//
+//      DetoursProfile <function> calls=<count> ticks=<ticks> policyTicks=<ticks> frequency=<ticks per second>
+
+class DetoursProfile final
+{
+public:
+    // Detoured functions beyond this one are not tracked
+    static const int MAX_FUNCTIONS = 64;
+
+    DetoursProfile() = delete;
+
+    static void Enable() { s_enabled = true; }
+    static bool IsEnabled() { return s_enabled; }
+
+    // Returns a stable index for the given function name (which must be a literal), or -1 when there is no room left
+    static int RegisterFunction(PCWSTR name);
+
+    // Sends the aggregated profile of all threads. Does not allocate, as it is called while the process detaches.
+    static void Report();
+
+    // Records the call and the ticks of the enclosing detoured function
+    class Scope final
+    {
+    public:
+        Scope(int function);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator = (const Scope&) = delete;
+
+    private:
+        int m_function;
+        LONG64 m_start;
+    };
+
+    // Records the ticks of the enclosing policy evaluation against the detoured function being profiled on this thread
+    class PolicyScope final
+    {
+    public:
+        PolicyScope();
+        ~PolicyScope();
+
+        PolicyScope(const PolicyScope&) = delete;
+        PolicyScope& operator = (const PolicyScope&) = delete;
+
+    private:
+        bool m_timing;
+        LONG64 m_start;
+    };
+
+private:
+    struct Block
+    {
+        // Only the owning thread writes, the blocks are only read when the process exits
+        ULONG64 Calls[MAX_FUNCTIONS];
+        ULONG64 Ticks[MAX_FUNCTIONS];
+        ULONG64 PolicyTicks[MAX_FUNCTIONS];
+        // Function being profiled on this thread (-1 when none), and whether a policy evaluation is being timed
+        int CurrentFunction;
+        bool InPolicyScope;
+        Block* Next;
+    };
+
+    static bool s_enabled;
+    static volatile LONG s_functionCount;
+    static PCWSTR s_functionNames[MAX_FUNCTIONS];
+    static Block* volatile s_blocks;
+
+    static Block* GetBlock();
+
+    static LONG64 Now()
+    {
+        LARGE_INTEGER counter;
+        QueryPerformanceCounter(&counter);
+        return counter.QuadPart;
+    }
+};
+
+// Profiles the enclosing detoured function under the given name
+#define PROFILE_DETOUR(name) \
+    static const int s_profiledDetour = DetoursProfile::RegisterFunction(L"" #name); \
+    DetoursProfile::Scope profileScope(s_profiledDetour)
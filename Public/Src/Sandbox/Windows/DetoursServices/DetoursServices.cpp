@@ -20,6 +20,7 @@
 #include "DetouredFunctions.h"
 #include "DetouredFunctionTypes.h"
 #include "DetoursHelpers.h"
+#include "DetoursProfile.h"
 #include "DetoursServices.h"
 #include "FileAccessHelpers.h"
 #include "globals.h"
@@ -31,6 +32,7 @@
 #include "SendReport.h"
 #include <Psapi.h>
 #include "FilesCheckedForAccess.h"
+#include "VolumePathTable.h"
 #include "locale.h"
 
 #define BUILDXL_DETOURS_CREATE_PROCESS_RETRY_COUNT 5
@@ -69,12 +71,8 @@ extern "C" {
 }
 
 #if MEASURE_DETOURED_NT_CLOSE_IMPACT
-volatile LONG g_msTimeToPopulatePoolList = 0;
 volatile ULONGLONG g_pipExecutionStart = 0;
 volatile LONG g_ntCloseHandeCount = 0;
-volatile LONG g_maxClosedListCount = 0;
-volatile LONG g_msTimeInAddClosedList = 0;
-volatile LONG g_msTimeInRemoveClosedList = 0;
 #endif // #if MEASURE_DETOURED_NT_CLOSE_IMPACT
 
 #if MEASURE_REPARSEPOINT_RESOLVING_IMPACT
@@ -226,11 +224,15 @@ FileAccessManifestExtraFlag g_fileAccessManifestExtraFlags;
 uint64_t g_FileAccessManifestPipId;
 
 PCManifestRecord g_manifestTreeRoot;
+ManifestRecordIndex g_manifestRecordIndex;
 
 PManifestChildProcessesToBreakAwayFromJob g_manifestChildProcessesToBreakAwayFromJob;
 vector<BreakawayChildProcess>* g_breakawayChildProcesses = nullptr;
+BreakawayChildProcessIndex* g_pBreakawayChildProcessIndex = nullptr;
+bool g_hasBreakawayChildProcesses = false;
 PManifestTranslatePathsStrings g_manifestTranslatePathsStrings;
 vector<TranslatePathTuple*>* g_pManifestTranslatePathTuples = nullptr;
+TranslatePathIndex* g_pManifestTranslatePathIndex = nullptr;
 unordered_set<std::wstring>* g_pManifestTranslatePathLookupTable = nullptr;
 
 PManifestInternalDetoursErrorNotificationFileString g_manifestInternalDetoursErrorNotificationFileString;
@@ -255,13 +257,14 @@ volatile LONG64 g_detoursMaxAllocatedMemoryInBytes = 0;
 // Running allocated memory by Detours in its private heap.
 volatile LONG64 g_detoursHeapAllocatedMemoryInBytes = 0;
 
-// The number of entries allocated in the no-lock, concurrent list for use by NtClose.
+// The number of entries allocated in the no-lock, concurrent list that was used by NtClose. Handle overlays
+// no longer need one, so this stays 0; it is still sent with the process data for compatibility.
 volatile LONG g_detoursAllocatedNoLockConcurentPoolEntries = 0;
 
-// The max number of entries in the HandleHeapMap hash table. Allocated in private heap.
+// The max number of entries in the handle overlay table. Allocated in private heap.
 volatile LONG64 g_detoursMaxHandleHeapEntries = 0;
 
-// Currently allocated entries in the HandleHeapMap hash table. Allocated in private heap.
+// Currently allocated entries in the handle overlay table. Allocated in private heap.
 volatile LONG64 g_detoursHandleHeapEntries = 0;
 
 //
@@ -272,7 +275,8 @@ bool g_ProcessExecutionShimAllProcesses;
 wchar_t* g_SubstituteProcessExecutionPluginDllPath = nullptr;
 HMODULE g_SubstituteProcessExecutionPluginDllHandle;
 SubstituteProcessExecutionPluginFunc g_SubstituteProcessExecutionPluginFunc;
-vector<ShimProcessMatch*>* g_pShimProcessMatches = nullptr;
+SubstituteProcessExecutionCacheablePluginFunc g_SubstituteProcessExecutionCacheablePluginFunc;
+ShimProcessMatcher* g_pShimProcessMatcher = nullptr;
 
 //
 // Real Windows API function pointers
@@ -511,7 +515,7 @@ InternalCreateDetouredProcess(
     // the JOB_OBJECT_LIMIT_BREAKAWAY_OK limit. But if we reached this point
     // the process being created is not allowed to break away. So make
     // sure we don't pass CREATE_BREAKAWAY_FROM_JOB
-    if (!g_breakawayChildProcesses->empty())
+    if (g_hasBreakawayChildProcesses)
     {
         creationFlags &= ~CREATE_BREAKAWAY_FROM_JOB;
     }
@@ -969,6 +973,10 @@ static int __cdecl CrtDebugHook(int nReportType, wchar_t* szMsg, int* pnRet) {
 
 static bool DllProcessDetach()
 {
+    // Batched reports are sent before the process data, which is the last report of the process
+    FlushAllReportBatches(/* processExit */ true);
+    DetoursProfile::Report();
+
     if (ShouldLogProcessData())
     {
         FILETIME creationTime;
@@ -1003,17 +1011,17 @@ static bool DllProcessDetach()
         // report in BuildXL to reduce the time difference between the time the report
         // is generated, and handling of the report message.
         GetSystemTimeAsFileTime(&exitTime);
+        PublishCurrentThreadHeapAccounting();
         ReportProcessData(counters, creationTime, exitTime, kernelTime, userTime, exitCode, g_parentProcessId, (LONG64)g_detoursMaxAllocatedMemoryInBytes);
     }
 
+    // Reports that went through the ring since the last write to the pipe are not counted yet
+    PublishMessageCount();
+
 #if MEASURE_DETOURED_NT_CLOSE_IMPACT    
     // Do some statistical information logging for different measurements
-    Dbg(L"Populate NtClose pool list entries time: %d ms.", g_msTimeToPopulatePoolList);
     Dbg(L"Pip execution time: %d ms.", (LONG)(GetTickCount64() - g_pipExecutionStart));
     Dbg(L"NtCloseHandle call times: %d", g_ntCloseHandeCount);
-    Dbg(L"Maxinum closed list count: %d", g_maxClosedListCount);
-    Dbg(L"Time adding to closed list: %d ms.", g_msTimeInAddClosedList);
-    Dbg(L"Time removing from closed list: %d ms.", g_msTimeInRemoveClosedList);
 #endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
 
 #if MEASURE_REPARSEPOINT_RESOLVING_IMPACT
@@ -1041,11 +1049,21 @@ static bool DllProcessDetach()
         delete g_breakawayChildProcesses;
     }
 
+    if (g_pBreakawayChildProcessIndex != nullptr)
+    {
+        delete g_pBreakawayChildProcessIndex;
+    }
+
     if (g_pManifestTranslatePathTuples != nullptr)
     {
         delete g_pManifestTranslatePathTuples;
     }
 
+    if (g_pManifestTranslatePathIndex != nullptr)
+    {
+        delete g_pManifestTranslatePathIndex;
+    }
+
     if (g_pManifestTranslatePathLookupTable != nullptr)
     {
         delete g_pManifestTranslatePathLookupTable;
@@ -1056,6 +1074,8 @@ static bool DllProcessDetach()
         delete g_pDetouredProcessInjector;
     }
 
+    DestroyNodeHeaps();
+
     if (g_hPrivateHeap != nullptr)
     {
         HeapDestroy(g_hPrivateHeap);
@@ -1144,13 +1164,14 @@ static bool DllProcessAttach()
     g_invariantLocale = _wcreate_locale(LC_CTYPE, L"");
     InitProcessKind();
     InitializeHandleOverlay();
+    InitializeVolumePathTable();
 
     // If there are configured processes that will break away from the sandbox, expose
     // an environment variable with the handle pointer to the detour manifest.
     // This is the way the AugmentedManifestReporter (the API to directly talk to detours
     // internal tools can use) can actually interact with the manifest
     // Keep in sync with C# side
-    if (!g_breakawayChildProcesses->empty())
+    if (g_hasBreakawayChildProcesses)
     {
         // CODESYNC: Keep variable name in sync with the C# side
         SetEnvironmentVariable(
@@ -1167,6 +1188,18 @@ static bool DllProcessAttach()
     }
     // end #define ATTACH
 
+    // Detours are attached by category. A category whose detours would only call through to the real
+    // function under this manifest is not attached at all, which saves attach time for every process
+    // (short-lived tools pay it in full). The real function is still bound, since other detours call it.
+#define ATTACH_IF(Enabled, Name) \
+    if (Enabled) { \
+        ATTACH(Name); \
+    } \
+    else { \
+        Real_##Name = ::Name; \
+    }
+    // end #define ATTACH_IF
+
     bool failed = false;
 
     error = DetourTransactionBegin();
@@ -1195,7 +1228,9 @@ static bool DllProcessAttach()
 
             ATTACH(GetFileInformationByHandle);
             ATTACH(GetFileInformationByHandleEx);
-            ATTACH(SetFileInformationByHandle);
+
+            // Renames and deletions through SetFileInformationByHandle still reach the ZwSetInformationFile detour.
+            ATTACH_IF(!IgnoreSetFileInformationByHandle(), SetFileInformationByHandle);
 
             ATTACH(CopyFileW);
             ATTACH(CopyFileA);
@@ -1240,8 +1275,10 @@ static bool DllProcessAttach()
             ATTACH(OpenEncryptedFileRawW);
             ATTACH(OpenEncryptedFileRawA);
             ATTACH(OpenFileById);
-            ATTACH(GetFinalPathNameByHandleW);
-            ATTACH(GetFinalPathNameByHandleA);
+
+            // Only needed to translate final paths.
+            ATTACH_IF(!IgnoreGetFinalPathNameByHandle(), GetFinalPathNameByHandleW);
+            ATTACH_IF(!IgnoreGetFinalPathNameByHandle(), GetFinalPathNameByHandleA);
 
             ATTACH(NtCreateFile);
             ATTACH(NtOpenFile);
@@ -1256,7 +1293,7 @@ static bool DllProcessAttach()
             ATTACH(ZwSetInformationFile);
 
             ATTACH(CreatePipe);
-            ATTACH(DeviceIoControl);
+            ATTACH_IF(!IgnoreDeviceIoControlGetReparsePoint(), DeviceIoControl);
 #pragma warning( pop )
         }
         else {
@@ -1289,6 +1326,7 @@ static bool DllProcessAttach()
         g_BreakOnAccessDenied = true;
     }
 
+#undef ATTACH_IF
 #undef ATTACH
 
     g_isAttached = true;
@@ -1427,6 +1465,19 @@ DllMain(
 #endif // DETOURS_SERVICES_NATIVES_LIBRARY
         return FALSE;
 
+#ifdef DETOURS_SERVICES_NATIVES_LIBRARY
+    case DLL_THREAD_DETACH:
+        ReleaseCurrentThreadReportBatch();
+        ReleaseCurrentThreadPolicyResultCache();
+        ReleaseCurrentThreadCanonicalizedPathBuffers();
+        ReleaseCurrentThreadHeapCache();
+        return TRUE;
+#else
+    case DLL_THREAD_DETACH:
+        ReleaseCurrentThreadHeapCache();
+        return TRUE;
+#endif // DETOURS_SERVICES_NATIVES_LIBRARY
+
     default:
         return TRUE;
     }
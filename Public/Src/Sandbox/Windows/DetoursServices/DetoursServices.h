@@ -128,30 +128,34 @@ public:
     }
 };
 
-// CODESYNC: SubstituteProcessExecutionInfo.cs :: ShimProcessMatch class
-class ShimProcessMatch
+// Index of the translate path tuples of the manifest by the hash of their from path, built once the manifest is parsed.
+// Paths are matched against every from path length present in a single pass, and a filter on the prefixes of the shortest
+// length rejects with a single probe the (usual) paths that no from path is a prefix of.
+class TranslatePathIndex
 {
-public:
-    std::unique_ptr<wchar_t> ProcessName;
-    std::unique_ptr<wchar_t> ArgumentMatch;
+private:
+    // (hash of the from path, index of the tuple), sorted
+    std::vector<std::pair<uint32_t, size_t>> m_fromPaths;
+    // Distinct from path lengths, ascending
+    std::vector<size_t> m_lengths;
+    // Bits set for the hashes of the prefixes of every from path truncated to the shortest length
+    std::vector<uint64_t> m_prefixFilter;
+    std::vector<TranslatePathTuple*> m_tuples;
 
-    // Assumes params are heap strings and takes control of their lifetime.
-    ShimProcessMatch(wchar_t *processName, wchar_t *argMatch)
-    {
-        ProcessName = std::unique_ptr<wchar_t>(processName);
-        ArgumentMatch = std::unique_ptr<wchar_t>(argMatch);
-    }
+    bool IsInPrefixFilter(uint32_t hash) const;
+    void AddMatches(uint32_t hash, const std::wstring& lowCasePath, size_t length, bool directoryPath, const std::vector<bool>& usedTuples, int& bestIndex) const;
 
-    ShimProcessMatch(const ShimProcessMatch &other)
-        : ShimProcessMatch(other.ProcessName.get(), other.ArgumentMatch.get())
-    {}
+public:
+    // The from paths of the tuples are lower case
+    explicit TranslatePathIndex(const std::vector<TranslatePathTuple*>& tuples);
 
-    ShimProcessMatch& operator=(ShimProcessMatch& other)
-    {
-        // Implementing as a move instead of copy, just to satisfy the compiler.
-        ProcessName.reset(other.ProcessName.release());
-        ArgumentMatch.reset(other.ArgumentMatch.release());
-    }
+    // Returns false if no from path is a prefix of the path (or of the path followed by '\'), ignoring case
+    bool MayTranslate(const std::wstring& path) const;
+
+    // Returns the index of the tuple with the longest from path that is a prefix of the lower case path, or -1 when there is none.
+    // A from path that ends with '\' also matches the path without it. Tuples set in usedTuples (when not empty) are skipped.
+    // matchLength receives the length of the path that the match replaces.
+    int FindLongestMatch(const std::wstring& lowCasePath, const std::vector<bool>& usedTuples, _Out_ size_t& matchLength) const;
 };
 
 // CODESYNC: FileAccessManifest.cs :: BreakawayChildProcess record
@@ -171,4 +175,21 @@ struct BreakawayChildProcess
     BreakawayChildProcess(const BreakawayChildProcess &other)
         : BreakawayChildProcess(other.ProcessName, other.RequiredCommandLineArgsSubstring, other.CommandLineArgsSubstringContainmentIgnoreCase)
     {}
+};
+
+// Index of the breakaway child processes of the manifest by the hash of their process name, built once the manifest is parsed.
+class BreakawayChildProcessIndex
+{
+public:
+    // (hash of the process name, index of the breakaway child process), sorted
+    typedef std::pair<uint32_t, size_t> Entry;
+
+    explicit BreakawayChildProcessIndex(const std::vector<BreakawayChildProcess>& processes);
+
+    // Returns the entries whose process name has the same hash as the image name, in manifest order.
+    // Names still need to be compared, since different names can have the same hash.
+    std::pair<const Entry*, const Entry*> Lookup(const std::wstring& imageName) const;
+
+private:
+    std::vector<Entry> m_entries;
 };
\ No newline at end of file
@@ -102,9 +102,10 @@ public:
     FileOperationContext(const FileOperationContext& other) = default;
     FileOperationContext& operator=(const FileOperationContext&) = default;
 
-private:
     // CODESYNC: Public\Src\Engine\Processes\SandboxedProcessReports.cs
     static const unsigned long NoId = 0UL;
+
+private:
     static unsigned long GetNextId();
 
 #if _WIN32
@@ -5,29 +5,89 @@
 #include "string.h"
 
 FilesCheckedForAccess::FilesCheckedForAccess()
+    : m_slots(new Slot[SLOT_COUNT]())
 {
 }
 
+bool FilesCheckedForAccess::Lookup(const PathChar* path, size_t length, bool insert, bool& inserted) {
+    inserted = false;
+    uint64_t hash = HashPath64(path, length);
+
+    // 0 marks empty slots
+    hash = hash == 0 ? 1 : hash;
+
+    size_t index = (size_t)hash & (SLOT_COUNT - 1);
+    for (size_t probe = 0; probe < MAX_PROBES; probe++, index = (index + 1) & (SLOT_COUNT - 1)) {
+        Slot& slot = m_slots[index];
+        uint64_t current = slot.hash.load(std::memory_order_acquire);
+
+        if (current == 0) {
+            if (!insert) {
+                // Slots are never released, so the path can't be further away
+                return false;
+            }
+
+            if (slot.hash.compare_exchange_strong(current, hash, std::memory_order_acq_rel)) {
+                PathArena::Entry* entry = m_arena.Add(path, length);
+                if (entry == nullptr) {
+                    // This code could possibly be executing from an interrupt routine or from who knows where, so do not fail:
+                    // the slot keeps the hash but never matches, and the path is always considered not registered
+                    inserted = true;
+                    return false;
+                }
+
+                slot.path.store(entry, std::memory_order_release);
+                inserted = true;
+                return false;
+            }
+
+            // Lost the race for this slot, 'current' now holds the hash of the winner
+        }
+
+        PathArena::Entry* entry = current == hash ? slot.path.load(std::memory_order_acquire) : nullptr;
+        if (entry != nullptr && entry->Matches(path, length)) {
+            return true;
+        }
+    }
+
+    return LookupOverflow(path, length, insert, inserted);
+}
+
+bool FilesCheckedForAccess::LookupOverflow(const PathChar* path, size_t length, bool insert, bool& inserted) {
+#if _WIN32
+    std::wstring key(path, length);
+#else
+    std::string key(path, length);
+#endif
+
+    if (!insert) {
+        const std::shared_lock<std::shared_mutex> lock(m_overflowLock);
+        return m_overflowSet.find(key) != m_overflowSet.end();
+    }
+
+    const std::unique_lock<std::shared_mutex> lock(m_overflowLock);
+    inserted = m_overflowSet.insert(std::move(key)).second;
+    return !inserted;
+}
+
 bool FilesCheckedForAccess::TryRegisterPath(const CanonicalizedPathType& path) {
-    const std::unique_lock<std::shared_mutex> lock(m_lock);
+    bool inserted;
 #if _WIN32
-    auto result = m_pathSet.insert(path.GetPathString());
+    Lookup(path.GetPathString(), path.Length(), /* insert */ true, inserted);
 #else
-    auto result = m_pathSet.insert(path);
+    Lookup(path.c_str(), path.length(), /* insert */ true, inserted);
 #endif
 
-    return result.second;
+    return inserted;
 }
 
 bool FilesCheckedForAccess::IsRegistered(const CanonicalizedPathType& path) {
-    const std::shared_lock<std::shared_mutex> lock(m_lock);
+    bool inserted;
 #if _WIN32
-    auto result = m_pathSet.find(path.GetPathString());
+    return Lookup(path.GetPathString(), path.Length(), /* insert */ false, inserted);
 #else
-    auto result = m_pathSet.find(path);
+    return Lookup(path.c_str(), path.length(), /* insert */ false, inserted);
 #endif
-
-    return (result != m_pathSet.end());
 }
 
 FilesCheckedForAccess* FilesCheckedForAccess::GetInstance() {
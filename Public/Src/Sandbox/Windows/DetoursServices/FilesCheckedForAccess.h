@@ -4,6 +4,7 @@
 #pragma once
 
 #include "FileAccessHelpers.h"
+#include "PathArena.h"
 
 #if _WIN32
     #include "CanonicalizedPath.h"
@@ -12,6 +13,7 @@
     typedef std::string CanonicalizedPathType;
 #endif // _WIN32
 
+#include <atomic>
 #include <unordered_set>
 #include <cwctype>
 #include <mutex>
@@ -24,6 +26,12 @@
 
 // Keeps a set of case-insensitive paths that were checked for access 
 // All operations are thread-safe
+//
+// Paths live in an insert-only, open addressing table of 64-bit hashes of their normalized form (see HashPath64), so
+// checking a path takes no lock and allocates nothing. Slots are claimed with a compare-and-swap on the hash, and then get the
+// normalized path, copied to a PathArena, which is what tells apart paths with the same hash. A slot whose path is not published
+// yet never matches, so at worst a path is registered twice, which callers tolerate (they just check it again).
+// Paths that can't find a slot within MAX_PROBES go to a locked overflow set.
 class FilesCheckedForAccess {
 public:
     static FilesCheckedForAccess* GetInstance();
@@ -40,11 +48,27 @@ private:
     FilesCheckedForAccess(const FilesCheckedForAccess&) = delete;
     FilesCheckedForAccess& operator = (const FilesCheckedForAccess&) = delete;
 
+    static const size_t SLOT_COUNT = 1 << 13; // must be a power of 2
+    static const size_t MAX_PROBES = 64;
+
+    struct Slot {
+        std::atomic<uint64_t> hash;
+        std::atomic<PathArena::Entry*> path;
+    };
+
+    // Returns whether the path was found (in which case 'inserted' is false), or inserted when 'insert' is true
+    bool Lookup(const PathChar* path, size_t length, bool insert, bool& inserted);
+    bool LookupOverflow(const PathChar* path, size_t length, bool insert, bool& inserted);
+
+
+    Slot* m_slots;
+    PathArena m_arena;
+
 // We only want case insensitive comparisons on Windows
 #if _WIN32
-    std::unordered_set<std::wstring, CaseInsensitiveStringHasher, CaseInsensitiveStringComparer> m_pathSet;
+    std::unordered_set<std::wstring, CaseInsensitiveStringHasher, CaseInsensitiveStringComparer> m_overflowSet;
 #else
-    std::unordered_set<std::string> m_pathSet;
+    std::unordered_set<std::string> m_overflowSet;
 #endif
-    std::shared_mutex m_lock;
+    std::shared_mutex m_overflowLock;
 };
@@ -3,346 +3,209 @@
 
 #include "stdafx.h"
 #include "HandleOverlay.h"
-#include <map>
 #include "buildXL_mem.h"
 
-// A pre-allocated list with entries to be used to accumulate the closed handles by NtClose.
-// During testing there were never more than 2 entries in this list on SelfHost and Office builds.
-// Allocating 1000 should be safe we are not skipping handles. If we need more than 1000,
-// a warning will be issued and the handle will not removed from the fie handle map.
-// In such case we will behave exactly as we behave now - without this change we don't remove any handles from the map.
-// If the list is full we will not remove the handle from the map. If that happens, increase the preallocated list size.
-#define CLOSED_HANDLES_POOL_ENTRIES 2000
-#define NT_CLOSE_CLEANUP_THRESHOLD 500
-#define LARGE_LIST_MULTIPLIER 20
+// Handle values are multiples of 4 (the two low bits are tag bits ignored by the kernel), so the table is indexed by handle / 4.
+// The table has two levels: a directory of pages, allocated at initialization, and pages of slots, allocated the first time one of
+// their handles gets an overlay. With 4096 pages of 4096 slots it covers the 2^24 handles a process can have open.
+#define HANDLE_TABLE_PAGE_BITS 12
+#define HANDLE_TABLE_PAGE_SIZE (1 << HANDLE_TABLE_PAGE_BITS)
+#define HANDLE_TABLE_DIRECTORY_SIZE 4096
 
-bool g_initialized;
-CRITICAL_SECTION g_handleOverlayLock;
+// A slot holds a pointer to the overlay of its handle (which holds one reference to it), or 0.
+// The low bit of a slot is set while a thread takes a reference to its overlay or replaces it, so that an overlay cannot be freed
+// between the moment a lookup reads the pointer and the moment it increments the reference count. Nothing else is done while the
+// bit is held (in particular, no allocation), so, unlike a process-wide lock, it is safe to wait for it anywhere, including NtClose.
+#define SLOT_LOCK_BIT ((ULONG_PTR)1)
 
-class HandleOverlayMap;
-HandleOverlayMap* g_handleOverlayMap;
-PSLIST_HEADER g_pClosedHandles = nullptr;
+typedef volatile ULONG_PTR HandleTableSlot;
 
-// Used to pre-create entries for closed handles in NtClose, 
-// so we can clean them from the overlay map when it is safe to get the lock.
-PSLIST_HEADER g_pClosedHandlesPool = nullptr;
+struct HandleTablePage {
+    HandleTableSlot Slots[HANDLE_TABLE_PAGE_SIZE];
+};
+
+static HandleTablePage* volatile* g_handleTableDirectory = nullptr;
+
+// See GetHandleOverlayRenameGeneration
+static volatile LONG g_handleOverlayRenameGeneration = 0;
 
-extern volatile LONG g_detoursAllocatedNoLockConcurentPoolEntries;
 extern volatile LONG64 g_detoursMaxHandleHeapEntries;
 extern volatile LONG64 g_detoursHandleHeapEntries;
 
-static volatile LONG g_usedPoolEntries = 0;
-
-typedef struct _HANDLE_TO_CLOSE {
-    SLIST_ENTRY ItemEntry;
-    HANDLE Handle;
-} HANDLE_TO_CLOSE, *PHANDLE_TO_CLOSE;
-
-class HandleOverlayMap {
-public:
-    void MapRegisterHandleOverlay(HANDLE handle, HandleOverlayRef& newRef) {
-        
-        // Now, insert (move-assign to empty) or replace (destruct then move-assign). Note that despite perhaps
-        // holding g_handleOverlayLock, we require here that shared_ptr is thread safe for refcount changes (as documented).
-        // When destructing, we need to atomically decrement the ref-count ; some other routine may still be using another ref to the same overlay.
-        m_map[handle] = std::move(newRef);
-
-        // If we are tracking process data, track also the HandleOverlay map entries.
-        if (ShouldLogProcessData())
-        {
-            LONG64 entriesCount = InterlockedIncrement64(&g_detoursHandleHeapEntries);
-            LONG64 localMax = InterlockedAdd64(&g_detoursMaxHandleHeapEntries, 0);
-
-            // Update the global g_detoursMaxHandleHeapEntries heap only if the current allocated entries is bigger than what is recorded max.
-            while (entriesCount > localMax)
-            {
-                InterlockedCompareExchange64(&g_detoursMaxHandleHeapEntries, entriesCount, localMax);
-                localMax = InterlockedAdd64(&g_detoursMaxHandleHeapEntries, 0);
-            }
-        }
+// Returns the slot of the given handle, or nullptr if the handle can't have an overlay (see GetOrCreateSlot)
+static HandleTableSlot* TryGetSlot(HANDLE handle) {
+    ULONG_PTR value = (ULONG_PTR)handle;
+    ULONG_PTR index = value >> 2;
+    if ((value & 3) != 0 || (index >> HANDLE_TABLE_PAGE_BITS) >= HANDLE_TABLE_DIRECTORY_SIZE || g_handleTableDirectory == nullptr) {
+        return nullptr;
     }
 
-    HandleOverlayRef TryLookupHandleOverlay(HANDLE handle) {
-        auto iter = m_map.find(handle);
-        if (iter == m_map.end()) {
-            return HandleOverlayRef();
+    HandleTablePage* page = g_handleTableDirectory[index >> HANDLE_TABLE_PAGE_BITS];
+    return page == nullptr ? nullptr : &page->Slots[index & (HANDLE_TABLE_PAGE_SIZE - 1)];
+}
+
+// Same as TryGetSlot, allocating the page of the slot if needed. Pseudo-handles (such as INVALID_HANDLE_VALUE), handles with tag bits
+// and handles out of the range of the table don't get overlays.
+static HandleTableSlot* GetOrCreateSlot(HANDLE handle) {
+    ULONG_PTR value = (ULONG_PTR)handle;
+    ULONG_PTR index = value >> 2;
+    if ((value & 3) != 0 || (index >> HANDLE_TABLE_PAGE_BITS) >= HANDLE_TABLE_DIRECTORY_SIZE || g_handleTableDirectory == nullptr) {
+        return nullptr;
+    }
+
+    HandleTablePage* volatile* pageEntry = &g_handleTableDirectory[index >> HANDLE_TABLE_PAGE_BITS];
+    HandleTablePage* page = *pageEntry;
+    if (page == nullptr) {
+        // Pages are zeroed by the private heap (empty slots)
+        HandleTablePage* newPage = static_cast<HandleTablePage*>(dd_malloc(sizeof(HandleTablePage)));
+        if (newPage == nullptr) {
+            Dbg(L"Allocation of a handle overlay table page failed");
+            return nullptr;
+        }
+
+        page = static_cast<HandleTablePage*>(InterlockedCompareExchangePointer((PVOID volatile*)pageEntry, newPage, nullptr));
+        if (page == nullptr) {
+            page = newPage;
         }
         else {
-            // Create a new ref (refcount increases) via copy-construction of the existing one.
-            return HandleOverlayRef(iter->second);
+            // Another thread installed the page first
+            dd_free(newPage);
         }
     }
 
-    void CloseHandleOverlay(HANDLE handle) {
-        size_t removed = m_map.erase(handle);
-        if (removed != 0 && ShouldLogProcessData())
-        {
-            InterlockedAdd64(&g_detoursHandleHeapEntries, -((LONG64)removed));
-        }
-    }
+    return &page->Slots[index & (HANDLE_TABLE_PAGE_SIZE - 1)];
+}
 
-private:
-    std::map<HANDLE, HandleOverlayRef> m_map;
-};
+// Sets the lock bit of the slot, returning the overlay it holds
+static HandleOverlay* LockSlot(HandleTableSlot* slot) {
+    for (unsigned spins = 0;; spins++) {
+        ULONG_PTR value = *slot;
+        if ((value & SLOT_LOCK_BIT) == 0 &&
+            (ULONG_PTR)InterlockedCompareExchangePointer((PVOID volatile*)slot, (PVOID)(value | SLOT_LOCK_BIT), (PVOID)value) == value) {
+            return (HandleOverlay*)value;
+        }
 
-// Holds g_handleOverlayLock
-struct HandleOverlayLockGuard {
-    HandleOverlayLockGuard() {
-        assert(g_initialized);
-        EnterCriticalSection(&g_handleOverlayLock);
+        // The bit is only held for a few instructions, unless the holder got preempted
+        if (spins < 64) {
+            YieldProcessor();
+        }
+        else {
+            SwitchToThread();
+        }
     }
+}
 
-    ~HandleOverlayLockGuard() {
-        LeaveCriticalSection(&g_handleOverlayLock);
-    }
+// Stores an overlay in a slot locked by LockSlot, clearing its lock bit
+static void UnlockSlot(HandleTableSlot* slot, HandleOverlay* overlay) {
+    InterlockedExchangePointer((PVOID volatile*)slot, overlay);
+}
 
-    // This is a member function to make sure we always get the map inside a lock.
-    inline HandleOverlayMap* GetGlobalOverlayMap() {
-        assert(g_handleOverlayMap != nullptr);
-        return g_handleOverlayMap;
+static void UpdateHandleOverlayCount(LONG64 delta) {
+    // If we are tracking process data, track also the number of handle overlays.
+    if (!ShouldLogProcessData()) {
+        return;
     }
-};
 
-static void PopulateNtCloseListPool()
-{
-#if MEASURE_DETOURED_NT_CLOSE_IMPACT
-   ULONGLONG startTime = GetTickCount64();
-#endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
-    unsigned allocationSize = CLOSED_HANDLES_POOL_ENTRIES;
-    if (UseLargeNtClosePreallocatedList())
-    {
-        // Allocate a large list.
-        allocationSize *= LARGE_LIST_MULTIPLIER;
+    LONG64 entriesCount = InterlockedAdd64(&g_detoursHandleHeapEntries, delta);
+    LONG64 localMax = InterlockedAdd64(&g_detoursMaxHandleHeapEntries, 0);
+
+    // Update the global g_detoursMaxHandleHeapEntries only if the current number of entries is bigger than the recorded max.
+    while (entriesCount > localMax) {
+        InterlockedCompareExchange64(&g_detoursMaxHandleHeapEntries, entriesCount, localMax);
+        localMax = InterlockedAdd64(&g_detoursMaxHandleHeapEntries, 0);
     }
+}
 
-    for (unsigned i = 0; i < allocationSize; i++)
-    {
-        PHANDLE_TO_CLOSE pPoolHandleEntry = (PHANDLE_TO_CLOSE)_dd_aligned_malloc(sizeof(HANDLE_TO_CLOSE), MEMORY_ALLOCATION_ALIGNMENT);
-        if (pPoolHandleEntry == nullptr)
-        {
-            Dbg(L"Memory alloc failed for g_pClosedHandlesPool node 0x%p", g_pClosedHandlesPool);
-        }
-        else
-        {
-            pPoolHandleEntry->Handle = INVALID_HANDLE_VALUE;
+void InitializeHandleOverlay() {
+    assert(g_handleTableDirectory == nullptr);
 
-            // Populate the pool
-            InterlockedPushEntrySList(g_pClosedHandlesPool, &(pPoolHandleEntry->ItemEntry));
-            InterlockedIncrement(&g_detoursAllocatedNoLockConcurentPoolEntries);
-        }
+    // This is called from DllAttach, before any handle can get an overlay. Note that the directory is zeroed by the private heap.
+    g_handleTableDirectory = static_cast<HandleTablePage* volatile*>(dd_malloc(HANDLE_TABLE_DIRECTORY_SIZE * sizeof(HandleTablePage*)));
+    if (g_handleTableDirectory == nullptr) {
+        Dbg(L"Allocation of the handle overlay table failed");
     }
-#if MEASURE_DETOURED_NT_CLOSE_IMPACT
-    ULONGLONG endTime = GetTickCount64();
-    InterlockedExchangeAdd(&g_msTimeToPopulatePoolList, (LONG)(endTime - startTime));
-#endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
 
+    assert(g_handleTableDirectory != nullptr);
 }
 
-// This is a routine that creates a background thread to close any NtClose accumulated handles.
-// The prebuild step of Office uses Perl and tons of pipe logging, without opening a file, so the
-// NtClose list drain logic doesn't kick in, thus creating a potential problem of having invalid 
-// handles in the map (handles that have been reused, but never cleaned up).
-DWORD WINAPI CleanupNtClosedHandles(LPVOID lpParam)
-{
-    UNREFERENCED_PARAMETER(lpParam);
-    if (UseExtraThreadToDrainNtClose())
-    {
-        RemoveClosedHandles();
+void RegisterHandleOverlay(HANDLE handle, AccessCheckResult const& accessCheck, PolicyResult const& policy, HandleType type) {
+    HandleTableSlot* slot = GetOrCreateSlot(handle);
+    if (slot == nullptr) {
+        return;
     }
 
-    return 0;
-}
+    // The table holds the initial reference of the new overlay
+    HandleOverlay* newOverlay = new HandleOverlay(accessCheck, policy, type);
 
-void StartCleanupNtClosedHandlesThread()
-{
-    HANDLE threadHandle = CreateThread(
-        NULL,
-        0,
-        CleanupNtClosedHandles,
-        nullptr,
-        0,
-        nullptr);
-    
-    if (threadHandle == INVALID_HANDLE_VALUE)
-    {
-        Dbg(L"Warning: Could not create CleanupNtClosedHandlesThread.");
-    }
-    else
-    {
-        SetThreadPriority(threadHandle, THREAD_PRIORITY_HIGHEST);
+    HandleOverlay* oldOverlay = LockSlot(slot);
+    UnlockSlot(slot, newOverlay);
+
+    if (oldOverlay == nullptr) {
+        UpdateHandleOverlayCount(1);
     }
+
+    // Drops the reference the table had to the replaced overlay (if any), outside of the slot lock
+    HandleOverlayRef oldRef(oldOverlay);
 }
 
-void InitializeHandleOverlay() {
+HandleOverlayRef TryLookupHandleOverlay(HANDLE handle) {
+    HandleTableSlot* slot = TryGetSlot(handle);
 
-    assert(!g_initialized);
-    InitializeCriticalSection(&g_handleOverlayLock);
-    // Always create the OverlayMap.This is called from DllAttach, so it is inside alock already.
-    // Doing it here, we save check and creating the map inside the GetOverlayMap.
-    g_handleOverlayMap = new HandleOverlayMap();
-
-    // The NtClose(d) handles are in the g_pClosedHandles. (It is a lock free list.)
-    // Since allocation of memory is unsafe inside the NtClose execution path (there should
-    // not be locks on this path), preallocate a list of nodes to be used as a pool - g_pClosedHandlesPool.
-    g_pClosedHandles = (PSLIST_HEADER)_dd_aligned_malloc(sizeof(SLIST_HEADER), MEMORY_ALLOCATION_ALIGNMENT);
-    if (g_pClosedHandles == nullptr)
-    {
-        Dbg(L"Allocation for g_pClosedHandles failed");
+    // Most handles never had an overlay: no need to lock their slot
+    if (slot == nullptr || *slot == 0) {
+        return HandleOverlayRef();
     }
 
-    assert(g_pClosedHandles != nullptr);
-    InitializeSListHead(g_pClosedHandles);
-
-    g_pClosedHandlesPool = (PSLIST_HEADER)_dd_aligned_malloc(sizeof(SLIST_HEADER), MEMORY_ALLOCATION_ALIGNMENT);
-    if (g_pClosedHandlesPool == nullptr)
-    {
-        Dbg(L"Allocation for g_pClosedHandlesPool failed");
+    HandleOverlay* overlay = LockSlot(slot);
+    if (overlay != nullptr) {
+        InterlockedIncrement(&overlay->RefCount);
     }
 
-    assert(g_pClosedHandlesPool != nullptr);
-    InitializeSListHead(g_pClosedHandlesPool);
-    PopulateNtCloseListPool();
-
-    g_initialized = true;
+    UnlockSlot(slot, overlay);
+    return HandleOverlayRef(overlay);
 }
 
-void RegisterHandleOverlay(HANDLE handle, AccessCheckResult const& accessCheck, PolicyResult const& policy, HandleType type) {
-    if (UseExtraThreadToDrainNtClose())
-    {
-        RemoveClosedHandles();
-    }
+LONG GetHandleOverlayRenameGeneration() {
+    return InterlockedAdd(&g_handleOverlayRenameGeneration, 0);
+}
 
-    // First we create a shared_ptr for a new HandleOverlay (ref count 1).
-    // Note: This must be created outside of the HandleOverlayLockGuard lock below,
-    //       because otherwise we will get a deadlock - the HandleMap lock and the RtlAllocHeap in the OS heap allocator lock.
-    //       
-    HandleOverlayRef newRef = std::make_shared<HandleOverlay>(accessCheck, policy, type);
-
-    // Get an extra reference to the handle. This way the shared_ptr is not deleted when removed from the map.
-    //
-    // The issue of destroying the object when removing from the map is that there is a potential for a deadlock.
-    // The removal from the map happens while holding the HandleOverlayLockGuard lock 
-    // (in the MapRegisterHandleOverlay method we do std::move that can call an object destruction and RtlFreeHeap).
-    // The freeing of memory happens while a heap lock is held - so if destruction happens,
-    // the order of lock aquisition is HandleMapLock--> HeapLock.
-    // RtlFreeHeap also calls NtClose, while holding the heap lock, so it is possible to try to get the locks in 
-    // order HeapLock-->HandleMapLock.
-    // These two clearly point to a deadlock due to inverted lock aquisition.
-    HandleOverlayRef overlay = TryLookupHandleOverlay(handle, false);
-
-    {
-        HandleOverlayLockGuard lock;
-        HandleOverlayMap* map = lock.GetGlobalOverlayMap();
-        map->MapRegisterHandleOverlay(handle, newRef);
-    }
+void InvalidateHandleOverlayFinalPaths() {
+    InterlockedIncrement(&g_handleOverlayRenameGeneration);
 }
 
-HandleOverlayRef TryLookupHandleOverlay(HANDLE handle, bool drain) {
-    if (drain && UseExtraThreadToDrainNtClose())
-    {
-        RemoveClosedHandles();
+bool TryGetHandleOverlayFinalPath(HandleOverlayRef const& overlay, std::wstring& finalPath) {
+    bool found = false;
+
+    AcquireSRWLockShared(&overlay->FinalPathLock);
+    if (overlay->FinalPathGeneration != -1 && overlay->FinalPathGeneration == GetHandleOverlayRenameGeneration()) {
+        finalPath.assign(overlay->FinalPath);
+        found = true;
     }
+    ReleaseSRWLockShared(&overlay->FinalPathLock);
 
-    HandleOverlayLockGuard lock;
-    HandleOverlayMap* map = lock.GetGlobalOverlayMap();
-    return map->TryLookupHandleOverlay(handle);
+    return found;
 }
 
-void CloseHandleOverlay(HANDLE handle, bool inRecursion) {
-    if (!inRecursion)
-    {
-        // Call this from here to relieve pressure on the pre-allocated SList entry pool.
-        if (UseExtraThreadToDrainNtClose())
-        {
-            RemoveClosedHandles();
-        }
-    }
-    
-    // Get an extra reference to the handle. This way the shared_ptr is not deleted when removed from the 
-    // map.
-    // The issue of destroying the object when removing from the map is that there is a potential for a deadlock.
-    // The removal from the map happens while holding the HandleOverlayLockGuard lock (see below).
-    // If the map holds the last ref to the shared_ptr, when removing it, the destructor of the object will be called,
-    // thus triggering deletion of the object from the OS heap - RtlFreeHeap. The freeing of memory happens
-    // while a heap lock is held - so if destruction happens, the order of lock aquisition is HandleMapLock--> HeapLock.
-    // RtlAllocateHeap also calls NtClose, while holding the heap lock, so it is possible to try to get the locks in 
-    // order HeapLock-->HandleMapLock.
-    // These two clearly point to a deadlock due to inverted lock aquisition.
-    HandleOverlayRef overlay = TryLookupHandleOverlay(handle, false);
-    
-    {
-        // Extra scope here to make sure the lock is destroied before the overlay above goes out of scope
-        // and releases the last ref to the object pointer.
-        HandleOverlayLockGuard lock;
-        HandleOverlayMap* map = lock.GetGlobalOverlayMap();
-        map->CloseHandleOverlay(handle);
-    }
+void SetHandleOverlayFinalPath(HandleOverlayRef const& overlay, std::wstring const& finalPath, LONG generation) {
+    AcquireSRWLockExclusive(&overlay->FinalPathLock);
+    overlay->FinalPath.assign(finalPath);
+    overlay->FinalPathGeneration = generation;
+    ReleaseSRWLockExclusive(&overlay->FinalPathLock);
 }
 
-void AddClosedHandle(HANDLE handle) {
-    // Be safe and check all the list pointers as well since a NtClose (where this method is called from)
-    // can come very early in the execution of a process.
-#if MEASURE_DETOURED_NT_CLOSE_IMPACT
-    ULONGLONG startAdd = GetTickCount64();
-#endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
-    // Cleaup any pending NtClose handles, if the remaining unused are less than NT_CLOSE_CLEANUP_THRESHOLD
-    if ((g_detoursAllocatedNoLockConcurentPoolEntries - g_usedPoolEntries) < NT_CLOSE_CLEANUP_THRESHOLD)
-    {
-        // When below threshold start a new thread. It will be with higher priority to drain the list.
-        // The thread routine is completely thread safe and we might create multiple threads and that is just fine.
-        // The expectation is that multiple threads creation will happen very rarely.
-        StartCleanupNtClosedHandlesThread();
+void CloseHandleOverlay(HANDLE handle) {
+    HandleTableSlot* slot = TryGetSlot(handle);
+    if (slot == nullptr || *slot == 0) {
+        return;
     }
 
-    if (g_initialized && g_pClosedHandles != nullptr && g_pClosedHandlesPool != nullptr) {
-        PSLIST_ENTRY pEntry = InterlockedPopEntrySList(g_pClosedHandlesPool);
+    HandleOverlay* overlay = LockSlot(slot);
+    UnlockSlot(slot, nullptr);
 
-        if (pEntry == nullptr)
-        {
-            Dbg(L"Warning: No available entries in g_pClosedHandlesPool list.");
-        }
-        else
-        {
-            ((PHANDLE_TO_CLOSE)pEntry)->Handle = handle;
-            InterlockedPushEntrySList(g_pClosedHandles, &(((PHANDLE_TO_CLOSE)pEntry)->ItemEntry));
-            InterlockedIncrement(&g_usedPoolEntries);
-        }
+    if (overlay != nullptr) {
+        UpdateHandleOverlayCount(-1);
     }
-#if MEASURE_DETOURED_NT_CLOSE_IMPACT
-    InterlockedIncrement(&g_maxClosedListCount);
-    ULONGLONG endAdd = GetTickCount64();
-    InterlockedExchangeAdd(&g_msTimeInAddClosedList, (LONG)(endAdd - startAdd));
-#endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
-}
-
-// Note: It is potentially possible to call these method while an entry is added to the non-locking list.
-// In such case the entry will be removed from the overlay map on the next iteration.
-void RemoveClosedHandles() {
-#if MEASURE_DETOURED_NT_CLOSE_IMPACT
-    ULONGLONG startAdd = GetTickCount64();
-#endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
-    if (g_initialized && g_pClosedHandles != nullptr && g_pClosedHandlesPool != nullptr) {
-        PSLIST_ENTRY pEntry = InterlockedPopEntrySList(g_pClosedHandles);
-        while (pEntry != NULL)
-        {
-            CloseHandleOverlay(((PHANDLE_TO_CLOSE)pEntry)->Handle, true);
-            ((PHANDLE_TO_CLOSE)pEntry)->Handle = INVALID_HANDLE_VALUE;
-            InterlockedPushEntrySList(g_pClosedHandlesPool, &(((PHANDLE_TO_CLOSE)pEntry)->ItemEntry));
-            pEntry = InterlockedPopEntrySList(g_pClosedHandles);
-            InterlockedDecrement(&g_usedPoolEntries);
-#if MEASURE_DETOURED_NT_CLOSE_IMPACT
-            InterlockedDecrement(&g_maxClosedListCount);
-#endif // MEASURE_DETOURED_NT_CLOSE_IMPACT        
-        }
 
-        // Grow the list if needed.
-        if ((g_detoursAllocatedNoLockConcurentPoolEntries - g_usedPoolEntries) < NT_CLOSE_CLEANUP_THRESHOLD)
-        {
-            PopulateNtCloseListPool();
-        }
-    }
-#if MEASURE_DETOURED_NT_CLOSE_IMPACT
-    ULONGLONG endAdd = GetTickCount64();
-    InterlockedExchangeAdd(&g_msTimeInRemoveClosedList, (LONG)(endAdd - startAdd));
-#endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
+    // Drops the reference the table had, outside of the slot lock. Concurrent users that got a ref before keep the overlay alive.
+    HandleOverlayRef closedRef(overlay);
 }
@@ -9,7 +9,7 @@
 // That's only viable so long as ALL HANDLE-consuming APIs are detoured (even boring things like GetHandleInformation); otherwise
 // any missing API would reject our fake HANDLEs, or crash.
 //
-// Instead, we define a process-global HANDLE -> overlay map and return all HANDLEs unmodified.
+// Instead, we define a process-global HANDLE -> overlay table and return all HANDLEs unmodified.
 
 #include "FileAccessHelpers.h"
 #include "PolicyResult.h"
@@ -21,12 +21,24 @@ enum class HandleType {
     Find
 };
 
+// Whether the timestamps of the entries enumerated through a handle are overridden (see OverrideTimestampsForInputFile).
+enum class EnumeratedTimestamps {
+    // Not determined yet
+    Unknown,
+    // Depends on the policy of each entry
+    PerEntry,
+    // The same for all the entries, which inherit the policy of the enumerated directory
+    Override,
+    Keep
+};
+
 // Per-handle overlay data.
 struct HandleOverlay {
     // Constructs a handle overlay for a handle, wrapping the creating operation's policy / access check.
     // The policy represents what operations should be allowed via operations on this handle.
     HandleOverlay(AccessCheckResult const& accessCheck, PolicyResult const& policy, HandleType type)
-        : Policy(policy), AccessCheck(accessCheck), Type(type), EnumerationHasBeenReported(false) { }
+        : Policy(policy), AccessCheck(accessCheck), Type(type), EnumerationHasBeenReported(false), EnumerationPathResolved(false), EnumeratedEntriesTimestamps(EnumeratedTimestamps::Unknown),
+          EnumeratedEntriesMayBeReported(true), FinalPathLock(SRWLOCK_INIT), FinalPathGeneration(-1), RefCount(1) { }
 
     HandleOverlay(const HandleOverlay& other) = default;
     HandleOverlay& operator=(const HandleOverlay&) = default;
@@ -39,6 +51,25 @@ struct HandleOverlay {
     // by NtQueryDirectoryFile. It prevents multiple reports for the same directory
     // (some big enumerations require multiple calls to NtQueryDirectoryFile).
     bool EnumerationHasBeenReported;
+
+    // This flag is set once FindNextFile has fully resolved the path of the enumerated directory (and replaced
+    // Policy with the policy of the resolved path), so that the resolution is not repeated for every entry.
+    bool EnumerationPathResolved;
+
+    // Decided once for the entries of an enumeration of this handle (see PolicyResult::TryGetChildrenPolicy). Once the timestamps are
+    // decided, the flag tells whether the enumeration probes of the entries may be reported; when they can't, FindNextFile does not
+    // need the policy of the entries at all.
+    EnumeratedTimestamps EnumeratedEntriesTimestamps;
+    bool EnumeratedEntriesMayBeReported;
+
+    // The path GetFinalPathNameByHandleW returned for this handle, resolved the first time it was needed (see TryGetHandleOverlayFinalPath),
+    // and the rename generation it was resolved in (-1 if it wasn't). Guarded by FinalPathLock, as threads may share a handle.
+    SRWLOCK FinalPathLock;
+    LONG FinalPathGeneration;
+    std::wstring FinalPath;
+
+    // Number of HandleOverlayRefs to this overlay, including the one held by the handle table
+    volatile LONG RefCount;
 };
 
 // Sets up structures for recording handle overlays.
@@ -49,22 +80,86 @@ void InitializeHandleOverlay();
 // (though that may result in downstream failures), we do not assume that finding an overlay (by valid HANDLE) guarantees lifetime for the duration
 // of the calling (HANDLE-using) function. Instead, looking up a handle creates a new HandleOverlayRef (atomically), and so a HandleOverlay is not
 // deallocated until all uses of it are complete.
-typedef std::shared_ptr<HandleOverlay> HandleOverlayRef;
+//
+// Overlays are reclaimed by counting references rather than by epochs: a thread of a detoured process may be terminated in the middle of
+// a detour (TerminateThread, or the process exiting while it runs), and never gets to leave its epoch, which would stop the reclamation of
+// every overlay closed afterwards. With reference counts, such a thread only leaks the overlays it was using.
+class HandleOverlayRef {
+public:
+    HandleOverlayRef() : m_overlay(nullptr) { }
+    HandleOverlayRef(std::nullptr_t) : m_overlay(nullptr) { }
+
+    // Takes over an existing reference
+    explicit HandleOverlayRef(HandleOverlay* overlay) : m_overlay(overlay) { }
+
+    HandleOverlayRef(const HandleOverlayRef& other) : m_overlay(other.m_overlay) {
+        if (m_overlay != nullptr) {
+            InterlockedIncrement(&m_overlay->RefCount);
+        }
+    }
+
+    HandleOverlayRef(HandleOverlayRef&& other) : m_overlay(other.m_overlay) {
+        other.m_overlay = nullptr;
+    }
+
+    HandleOverlayRef& operator=(HandleOverlayRef other) {
+        std::swap(m_overlay, other.m_overlay);
+        return *this;
+    }
+
+    ~HandleOverlayRef() {
+        if (m_overlay != nullptr && InterlockedDecrement(&m_overlay->RefCount) == 0) {
+            delete m_overlay;
+        }
+    }
+
+    HandleOverlay* operator->() const { return m_overlay; }
+    bool operator==(std::nullptr_t) const { return m_overlay == nullptr; }
+    bool operator!=(std::nullptr_t) const { return m_overlay != nullptr; }
+
+private:
+    HandleOverlay* m_overlay;
+};
 
 // Creates or replaces an overlay for the given handle (intended for the time at which a handle is created).
 // The new overlays wraps the policy / access check determined for the handle so far.
 // The policy represents what operations should be allowed via operations on this handle.
 void RegisterHandleOverlay(HANDLE handle, AccessCheckResult const& accessCheck, PolicyResult const& policy, HandleType type);
 
+// A rename may change the final path of any open handle (e.g., the rename of one of its parent directories). The final paths
+// cached in the overlays are tagged with the rename generation they were resolved in, which renames made by this process bump,
+// and are not used once it changed. Renames made by other processes are not seen.
+LONG GetHandleOverlayRenameGeneration();
+void InvalidateHandleOverlayFinalPaths();
+
+// Bumps the rename generation when it goes out of scope, i.e. once the rename made in the scope (if any) is complete: a path
+// resolved while the rename was in progress was tagged with the previous generation.
+class HandleOverlayRenameScope {
+public:
+    explicit HandleOverlayRenameScope(bool isRename) : m_isRename(isRename) { }
+    ~HandleOverlayRenameScope() {
+        if (m_isRename) {
+            InvalidateHandleOverlayFinalPaths();
+        }
+    }
+
+    HandleOverlayRenameScope(const HandleOverlayRenameScope&) = delete;
+    HandleOverlayRenameScope& operator=(const HandleOverlayRenameScope&) = delete;
+
+private:
+    bool m_isRename;
+};
+
+// Gets the final path cached in the overlay, if it was resolved and no rename happened since.
+bool TryGetHandleOverlayFinalPath(HandleOverlayRef const& overlay, std::wstring& finalPath);
+
+// Caches the final path of the handle of the overlay, resolved in the given rename generation (read before resolving it).
+void SetHandleOverlayFinalPath(HandleOverlayRef const& overlay, std::wstring const& finalPath, LONG generation);
+
 // Tries to look up an existing overlay for the given handle. The returned ref may wrap nullptr in the event that there was no overlay found.
-HandleOverlayRef TryLookupHandleOverlay(HANDLE handle, bool drain = true);
+HandleOverlayRef TryLookupHandleOverlay(HANDLE handle);
 
 // If an overlay exists for the given handle, disassociates it from the handle. Future calls to TryLookupHandleOverlay for the handle will no
 // longer succeed. Concurrent users that already have a ref to the overlay may continue to use it safely.
-void CloseHandleOverlay(HANDLE handle, bool inRecursion = false);
-
-// Adds a closed handle to the closed handle list.
-void AddClosedHandle(HANDLE handle);
-
-// Remove all closed handlefrom the overlay map.
-void RemoveClosedHandles();
+// This takes no lock, so it is safe to call from NtClose.
+void CloseHandleOverlay(HANDLE handle);
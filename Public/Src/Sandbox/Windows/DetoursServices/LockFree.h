@@ -0,0 +1,245 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+
+// ----------------------------------------------------------------------------
+// Lock-free primitives shared by the user-mode sandboxes (Windows detours, the Linux observer and the macOS interop)
+// ----------------------------------------------------------------------------
+//
+// These are the user-mode counterparts of the liblfds711 structures the macOS kernel extension uses
+// (lfds711_hash_addonly, lfds711_queue_bounded_manyproducer_manyconsumer and lfds711_freelist), written against
+// std::atomic so that they build with every toolchain of the three sandboxes without liblfds711's porting layer.
+// All of them have a fixed capacity, chosen at compile time, and never allocate after construction.
+
+namespace LockFree {
+
+    // Keeps the hot fields of the structures below in cache lines of their own
+    constexpr size_t CacheLineSize = 64;
+
+    // Set of non-zero 64-bit keys (typically hashes) that only grows: keys can't be removed, the set can only be cleared
+    // by dropping it. Open addressing with linear probing, every slot being claimed with a compare-and-swap.
+    template <size_t Capacity>
+    class HashSet {
+        static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "The capacity must be a power of 2");
+
+    public:
+        enum class AddResult { Added, AlreadyPresent, Full };
+
+        HashSet() {
+            for (size_t i = 0; i < Capacity; i++) {
+                m_slots[i].store(0, std::memory_order_relaxed);
+            }
+        }
+
+        HashSet(const HashSet&) = delete;
+        HashSet& operator = (const HashSet&) = delete;
+
+        AddResult Add(uint64_t key) {
+            if (key == 0) {
+                return AddResult::Full;
+            }
+
+            // Once half of the slots are taken, probe sequences get long: report the set as full instead
+            for (size_t probe = 0, i = Mix(key) & (Capacity - 1); probe < Capacity / 2; probe++, i = (i + 1) & (Capacity - 1)) {
+                uint64_t current = m_slots[i].load(std::memory_order_acquire);
+                if (current == 0) {
+                    if (m_slots[i].compare_exchange_strong(current, key, std::memory_order_acq_rel)) {
+                        return AddResult::Added;
+                    }
+
+                    // 'current' now holds what another thread put in the slot
+                }
+
+                if (current == key) {
+                    return AddResult::AlreadyPresent;
+                }
+            }
+
+            return AddResult::Full;
+        }
+
+        bool Contains(uint64_t key) const {
+            if (key == 0) {
+                return false;
+            }
+
+            for (size_t probe = 0, i = Mix(key) & (Capacity - 1); probe < Capacity / 2; probe++, i = (i + 1) & (Capacity - 1)) {
+                const uint64_t current = m_slots[i].load(std::memory_order_acquire);
+                if (current == key) {
+                    return true;
+                }
+
+                if (current == 0) {
+                    return false;
+                }
+            }
+
+            return false;
+        }
+
+    private:
+        // Keys are often hashes already, but the low bits of e.g. pointers or ids are not evenly distributed
+        static uint64_t Mix(uint64_t key) {
+            key ^= key >> 33;
+            key *= 0xff51afd7ed558ccdULL;
+            key ^= key >> 33;
+            return key;
+        }
+
+        std::atomic<uint64_t> m_slots[Capacity];
+    };
+
+    // Bounded multiple-producer multiple-consumer FIFO queue (Vyukov's bounded queue): every cell carries a sequence number
+    // telling producers and consumers whose turn it is, so an enqueue or a dequeue takes a single compare-and-swap.
+    template <typename T, size_t Capacity>
+    class Ring {
+        static_assert(Capacity > 1 && (Capacity & (Capacity - 1)) == 0, "The capacity must be a power of 2");
+        static_assert(std::is_nothrow_move_constructible<T>::value, "Items are moved in and out of the ring");
+
+    public:
+        Ring() : m_enqueuePosition(0), m_dequeuePosition(0) {
+            for (size_t i = 0; i < Capacity; i++) {
+                m_cells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        ~Ring() {
+            T item;
+            while (TryDequeue(item)) { }
+        }
+
+        Ring(const Ring&) = delete;
+        Ring& operator = (const Ring&) = delete;
+
+        // Returns false if the ring is full
+        bool TryEnqueue(T&& item) {
+            Cell* cell;
+            size_t position = m_enqueuePosition.load(std::memory_order_relaxed);
+            for (;;) {
+                cell = &m_cells[position & (Capacity - 1)];
+                const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                const intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+                if (difference == 0) {
+                    if (m_enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                }
+                else if (difference < 0) {
+                    return false;
+                }
+                else {
+                    position = m_enqueuePosition.load(std::memory_order_relaxed);
+                }
+            }
+
+            new (cell->GetStorage()) T(std::move(item));
+            cell->sequence.store(position + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Returns false if the ring is empty
+        bool TryDequeue(T& item) {
+            Cell* cell;
+            size_t position = m_dequeuePosition.load(std::memory_order_relaxed);
+            for (;;) {
+                cell = &m_cells[position & (Capacity - 1)];
+                const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                const intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+                if (difference == 0) {
+                    if (m_dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                }
+                else if (difference < 0) {
+                    return false;
+                }
+                else {
+                    position = m_dequeuePosition.load(std::memory_order_relaxed);
+                }
+            }
+
+            T* stored = cell->GetItem();
+            item = std::move(*stored);
+            stored->~T();
+            cell->sequence.store(position + Capacity, std::memory_order_release);
+            return true;
+        }
+
+    private:
+        struct Cell {
+            std::atomic<size_t> sequence;
+            typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+
+            void* GetStorage() { return &storage; }
+            T* GetItem() { return reinterpret_cast<T*>(&storage); }
+        };
+
+        alignas(CacheLineSize) std::atomic<size_t> m_enqueuePosition;
+        alignas(CacheLineSize) std::atomic<size_t> m_dequeuePosition;
+        alignas(CacheLineSize) Cell m_cells[Capacity];
+    };
+
+    // Fixed pool of 'Capacity' default-constructed items that threads take out and give back (a Treiber stack of item
+    // indexes). The head carries a tag that changes on every update, so an item given back and taken out again between
+    // the read of the head and the compare-and-swap of another thread can't corrupt the stack (the ABA problem).
+    template <typename T, size_t Capacity>
+    class Freelist {
+        static_assert(Capacity > 0 && Capacity < UINT32_MAX, "Item indexes must fit in 32 bits");
+
+    public:
+        Freelist() : m_head(Pack(0, 0)) {
+            for (uint32_t i = 0; i < Capacity; i++) {
+                m_next[i].store(i + 1 < Capacity ? i + 1 : Empty, std::memory_order_relaxed);
+            }
+        }
+
+        Freelist(const Freelist&) = delete;
+        Freelist& operator = (const Freelist&) = delete;
+
+        // Returns nullptr if every item is taken
+        T* TryTake() {
+            uint64_t head = m_head.load(std::memory_order_acquire);
+            for (;;) {
+                const uint32_t index = IndexOf(head);
+                if (index == Empty) {
+                    return nullptr;
+                }
+
+                const uint32_t next = m_next[index].load(std::memory_order_relaxed);
+                if (m_head.compare_exchange_weak(head, Pack(next, TagOf(head) + 1), std::memory_order_acq_rel)) {
+                    return &m_items[index];
+                }
+            }
+        }
+
+        // Gives back an item obtained from TryTake
+        void Return(T* item) {
+            const uint32_t index = (uint32_t)(item - m_items);
+            uint64_t head = m_head.load(std::memory_order_relaxed);
+            for (;;) {
+                m_next[index].store(IndexOf(head), std::memory_order_relaxed);
+                if (m_head.compare_exchange_weak(head, Pack(index, TagOf(head) + 1), std::memory_order_acq_rel)) {
+                    return;
+                }
+            }
+        }
+
+    private:
+        static constexpr uint32_t Empty = UINT32_MAX;
+
+        static uint64_t Pack(uint32_t index, uint32_t tag) { return ((uint64_t)tag << 32) | index; }
+        static uint32_t IndexOf(uint64_t head) { return (uint32_t)head; }
+        static uint32_t TagOf(uint64_t head) { return (uint32_t)(head >> 32); }
+
+        alignas(CacheLineSize) std::atomic<uint64_t> m_head;
+        std::atomic<uint32_t> m_next[Capacity];
+        T m_items[Capacity];
+    };
+}
@@ -17,7 +17,9 @@ static LARGE_INTEGER GetNewInputTimestampAsLargeInteger() {
     return i;
 }
 
-void OverrideTimestampsForInputFile(FILE_BASIC_INFO* result) {
+// Works for the types with LARGE_INTEGER CreationTime, LastAccessTime, LastWriteTime and ChangeTime
+template<typename TResult>
+static void OverrideLargeIntegerTimestampsForInputFile(TResult* result) {
     LARGE_INTEGER newTimestamp = GetNewInputTimestampAsLargeInteger();
 
     if (NormalizeReadTimestamps())
@@ -48,6 +50,65 @@ void OverrideTimestampsForInputFile(FILE_BASIC_INFO* result) {
     }
 }
 
+void OverrideTimestampsForInputFile(FILE_BASIC_INFO* result) {
+    OverrideLargeIntegerTimestampsForInputFile(result);
+}
+
 void ScrubShortFileName(WIN32_FIND_DATAW* result) {
     ZeroMemory(&(result->cAlternateFileName[0]), sizeof(result->cAlternateFileName));
 }
+
+// Values of FILE_INFORMATION_CLASS (not all of them are in the SDK's winternl.h)
+#define FILE_DIRECTORY_INFORMATION_CLASS                1
+#define FILE_FULL_DIRECTORY_INFORMATION_CLASS           2
+#define FILE_BOTH_DIRECTORY_INFORMATION_CLASS           3
+#define FILE_ID_BOTH_DIRECTORY_INFORMATION_CLASS        37
+#define FILE_ID_FULL_DIRECTORY_INFORMATION_CLASS        38
+#define FILE_ID_EXTD_DIRECTORY_INFORMATION_CLASS        60
+#define FILE_ID_EXTD_BOTH_DIRECTORY_INFORMATION_CLASS   63
+
+// Size of the ShortName field (WCHAR[12]) of the *_BOTH_DIR_INFORMATION structures
+#define DIRECTORY_ENTRY_SHORT_NAME_SIZE (12 * sizeof(WCHAR))
+
+bool TryGetDirectoryEntryLayout(ULONG fileInformationClass, DirectoryEntryLayout& layout) {
+    // See the definitions of the FILE_*_DIR_INFORMATION structures in ntifs.h
+    switch (fileInformationClass)
+    {
+        case FILE_DIRECTORY_INFORMATION_CLASS:
+            layout = { 64, 0 };
+            return true;
+        case FILE_FULL_DIRECTORY_INFORMATION_CLASS:
+            layout = { 68, 0 };
+            return true;
+        case FILE_BOTH_DIRECTORY_INFORMATION_CLASS:
+            layout = { 94, 68 };
+            return true;
+        case FILE_ID_BOTH_DIRECTORY_INFORMATION_CLASS:
+            layout = { 104, 68 };
+            return true;
+        case FILE_ID_FULL_DIRECTORY_INFORMATION_CLASS:
+            layout = { 80, 0 };
+            return true;
+        case FILE_ID_EXTD_DIRECTORY_INFORMATION_CLASS:
+            layout = { 88, 0 };
+            return true;
+        case FILE_ID_EXTD_BOTH_DIRECTORY_INFORMATION_CLASS:
+            layout = { 114, 88 };
+            return true;
+        default:
+            return false;
+    }
+}
+
+void OverrideTimestampsForInputFile(PDIRECTORY_ENTRY_HEADER entry) {
+    OverrideLargeIntegerTimestampsForInputFile(entry);
+}
+
+void ScrubShortFileName(PDIRECTORY_ENTRY_HEADER entry, DirectoryEntryLayout const& layout) {
+    assert(layout.ShortNameLengthOffset != 0);
+
+    // CCHAR ShortNameLength, followed by WCHAR ShortName[12] at the next WCHAR boundary
+    char* shortNameLength = reinterpret_cast<char*>(entry) + layout.ShortNameLengthOffset;
+    *shortNameLength = 0;
+    ZeroMemory(shortNameLength + sizeof(WCHAR), DIRECTORY_ENTRY_SHORT_NAME_SIZE);
+}
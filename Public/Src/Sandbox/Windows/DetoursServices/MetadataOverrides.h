@@ -43,5 +43,62 @@ void OverrideTimestampsForInputFile(TResult* result) {
 void OverrideTimestampsForInputFile(FILE_BASIC_INFO* result);
 
 // Removes the short file name from directory-entry data (simulate short file names disabled on the volume).
-// TODO: Could scrub FILE_ID_BOTH_DIR_INFO too (https://msdn.microsoft.com/en-us/library/windows/desktop/aa364226(v=vs.85).aspx)
 void ScrubShortFileName(WIN32_FIND_DATAW* result);
+
+// The fields every FILE_*_DIR_INFORMATION structure returned by NtQueryDirectoryFile with timestamps starts with (see FILE_DIRECTORY_INFORMATION).
+typedef struct _DIRECTORY_ENTRY_HEADER {
+    ULONG NextEntryOffset;
+    ULONG FileIndex;
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    LARGE_INTEGER EndOfFile;
+    LARGE_INTEGER AllocationSize;
+    ULONG FileAttributes;
+    ULONG FileNameLength;
+} DIRECTORY_ENTRY_HEADER, *PDIRECTORY_ENTRY_HEADER;
+
+// Where the structures of an information class differ: the offset of FileName, and the one of ShortNameLength (followed by ShortName)
+// for the classes that have a short name, or 0.
+struct DirectoryEntryLayout {
+    size_t FileNameOffset;
+    size_t ShortNameLengthOffset;
+};
+
+// Gets the layout of the entries NtQueryDirectoryFile returns for an information class.
+// Returns false for the classes without timestamps (e.g., FileNamesInformation), whose entries are left as they are.
+bool TryGetDirectoryEntryLayout(ULONG fileInformationClass, DirectoryEntryLayout& layout);
+
+void OverrideTimestampsForInputFile(PDIRECTORY_ENTRY_HEADER entry);
+
+void ScrubShortFileName(PDIRECTORY_ENTRY_HEADER entry, DirectoryEntryLayout const& layout);
+
+// Overrides the timestamps of the entries of a buffer filled by NtQueryDirectoryFile and scrubs their short names, in one pass over the buffer.
+// shouldOverrideTimestamps(fileName, fileNameLength) decides for each entry; the name is not null-terminated. Entries that don't fit
+// in the first 'length' bytes are not touched.
+template<typename TShouldOverrideTimestamps>
+void OverrideMetadataForDirectoryEntries(DirectoryEntryLayout const& layout, PVOID buffer, size_t length, TShouldOverrideTimestamps shouldOverrideTimestamps) {
+    size_t offset = 0;
+    while (offset + layout.FileNameOffset <= length) {
+        PDIRECTORY_ENTRY_HEADER entry = reinterpret_cast<PDIRECTORY_ENTRY_HEADER>(reinterpret_cast<char*>(buffer) + offset);
+        if (offset + layout.FileNameOffset + entry->FileNameLength > length) {
+            break;
+        }
+
+        PCWSTR fileName = reinterpret_cast<PCWSTR>(reinterpret_cast<char*>(entry) + layout.FileNameOffset);
+        if (shouldOverrideTimestamps(fileName, entry->FileNameLength / sizeof(WCHAR))) {
+            OverrideTimestampsForInputFile(entry);
+        }
+
+        if (layout.ShortNameLengthOffset != 0) {
+            ScrubShortFileName(entry, layout);
+        }
+
+        if (entry->NextEntryOffset == 0) {
+            break;
+        }
+
+        offset += entry->NextEntryOffset;
+    }
+}
@@ -0,0 +1,105 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+
+#include "StringOperations.h"
+
+// Append-only storage for the normalized paths (see NormalizePathChar) of the lock-free path tables.
+// Entries are never freed, so they stay valid (and at the same address) for the lifetime of the arena.
+// Adding normally takes no lock, only running out of a chunk does.
+class PathArena {
+public:
+    struct Entry {
+        size_t length;
+        PathChar* GetChars() { return reinterpret_cast<PathChar*>(this + 1); }
+        const PathChar* GetChars() const { return reinterpret_cast<const PathChar*>(this + 1); }
+
+        // Whether the entry holds the given (not normalized) path
+        bool Matches(const PathChar* path, size_t pathLength) const {
+            if (length != pathLength) {
+                return false;
+            }
+
+            const PathChar* chars = GetChars();
+            for (size_t i = 0; i < length; i++) {
+                if (chars[i] != NormalizePathChar(path[i])) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+    };
+
+    PathArena() : m_chunks(nullptr) { }
+    PathArena(const PathArena&) = delete;
+    PathArena& operator = (const PathArena&) = delete;
+
+    // Chunks are deliberately leaked: the arenas live as long as the process
+    ~PathArena() = default;
+
+    // Returns a new entry with the normalized path, or nullptr if the memory can't be allocated
+    Entry* Add(const PathChar* path, size_t length) {
+        const size_t alignment = alignof(Entry);
+        const size_t size = (sizeof(Entry) + length * sizeof(PathChar) + alignment - 1) & ~(alignment - 1);
+
+        char* memory = TryAllocate(m_chunks.load(std::memory_order_acquire), size);
+        if (memory == nullptr) {
+            const std::lock_guard<std::mutex> lock(m_lock);
+
+            // Another thread may have added a chunk in the meantime
+            Chunk* chunk = m_chunks.load(std::memory_order_acquire);
+            memory = TryAllocate(chunk, size);
+            if (memory == nullptr) {
+                // Paths longer than a chunk get a chunk of their own
+                const size_t chunkSize = size > CHUNK_SIZE ? size : CHUNK_SIZE;
+                Chunk* newChunk = reinterpret_cast<Chunk*>(new char[sizeof(Chunk) + chunkSize]);
+                if (newChunk == nullptr) {
+                    return nullptr;
+                }
+
+                newChunk->next = chunk;
+                newChunk->size = chunkSize;
+                newChunk->used.store(size, std::memory_order_relaxed);
+                memory = newChunk->GetData();
+                m_chunks.store(newChunk, std::memory_order_release);
+            }
+        }
+
+        Entry* entry = reinterpret_cast<Entry*>(memory);
+        entry->length = length;
+        PathChar* chars = entry->GetChars();
+        for (size_t i = 0; i < length; i++) {
+            chars[i] = NormalizePathChar(path[i]);
+        }
+
+        return entry;
+    }
+
+private:
+    static const size_t CHUNK_SIZE = 64 * 1024; // in bytes
+
+    struct Chunk {
+        Chunk* next;
+        size_t size;
+        std::atomic<size_t> used;
+        char* GetData() { return reinterpret_cast<char*>(this + 1); }
+    };
+
+    static char* TryAllocate(Chunk* chunk, size_t size) {
+        if (chunk == nullptr) {
+            return nullptr;
+        }
+
+        // Once a chunk overflows, every later attempt fails and goes to the slow path, which adds a new chunk
+        const size_t offset = chunk->used.fetch_add(size, std::memory_order_relaxed);
+        return offset + size <= chunk->size ? chunk->GetData() + offset : nullptr;
+    }
+
+    std::atomic<Chunk*> m_chunks;
+    std::mutex m_lock;
+};
@@ -7,6 +7,7 @@
     #include "DetoursHelpers.h"
     #include "buildXL_mem.h"
 #endif
+#include <algorithm>
 #include "StringOperations.h"
 
 // When compiled for tests Dbg is not defined, so let's provide a mock for it
@@ -18,64 +19,106 @@ void Dbg(PCWSTR, ...) {}
 #pragma warning( pop )
 #endif
 
-// warning C26409: Avoid calling new and delete explicitly, use std::make_unique<T> instead (r.11).
-// warning C26400: Do not assign the result of an allocation or a function call with an owner<T> return value to a raw pointer, use owner<T> instead (i.11).
-#pragma warning( disable : 26409 26400 )
-
 PathTree::PathTree()
 {
-    m_root = new TreeNode();
     // The root is never a final path
-    m_root->intermediate = true;
+    AllocateNode(/* isIntermediate */ true);
 }
 
-#pragma warning( push )
-// warning C26447: The function is declared 'noexcept' but calls function 'RemoveAllDescendants()' which may throw exceptions (f.6).
-#pragma warning( disable : 26447 )
 PathTree::~PathTree()
 {
-    RemoveAllDescendants(m_root);
-    delete m_root;
 }
-#pragma warning( pop )
+
+PathTree::AtomId PathTree::Intern(const std::wstring& atom)
+{
+    const auto it = m_atomIds.find(atom);
+    if (it != m_atomIds.end())
+    {
+        return it->second;
+    }
+
+    const AtomId id = static_cast<AtomId>(m_atoms.size());
+    m_atoms.push_back(atom);
+    m_atomIds.emplace(atom, id);
+    return id;
+}
+
+PathTree::AtomId PathTree::FindAtom(const std::wstring& atom) const
+{
+    const auto it = m_atomIds.find(atom);
+    return it != m_atomIds.end() ? it->second : NoAtom;
+}
+
+std::vector<PathTree::Edge>::iterator PathTree::LowerBound(std::vector<Edge>& children, AtomId atom) noexcept
+{
+    return std::lower_bound(children.begin(), children.end(), atom, [](const Edge& edge, AtomId value) noexcept { return edge.atom < value; });
+}
+
+PathTree::NodeIndex PathTree::AllocateNode(bool isIntermediate)
+{
+    NodeIndex node;
+    if (!m_freeNodes.empty())
+    {
+        node = m_freeNodes.back();
+        m_freeNodes.pop_back();
+    }
+    else
+    {
+        node = static_cast<NodeIndex>(m_nodes.size());
+        m_nodes.emplace_back();
+    }
+
+    m_nodes[node].intermediate = isIntermediate;
+    return node;
+}
+
+void PathTree::FreeNode(NodeIndex node)
+{
+    // Release the memory of the children, most nodes are leaves and reused nodes rarely get as many children
+    std::vector<Edge>().swap(m_nodes[node].children);
+    m_freeNodes.push_back(node);
+}
 
 bool PathTree::TryInsert(const std::wstring& path)
 {
-    std::vector<std::wstring> elements;
-    const int err = TryDecomposePath(path, elements);
+    m_elements.clear();
+    const int err = TryDecomposePath(path, m_elements);
     if (err != 0)
     {
         Dbg(L"PathTree::TryInsert: TryDecomposePath failed, not resolving path: %d", err);
         return false;
     }
 
-    TreeNode* currentNode = m_root;
+    NodeIndex currentNode = RootIndex;
 
-    for (unsigned int i = 0; i < elements.size(); i++)
+    for (size_t i = 0; i < m_elements.size(); i++)
     {
         // Only the last element is a final node
-        const bool isIntermediate = (i != (elements.size() - 1));
-        currentNode = Append(elements[i], currentNode, isIntermediate);
+        const bool isIntermediate = (i != (m_elements.size() - 1));
+        currentNode = Append(Intern(m_elements[i]), currentNode, isIntermediate);
     }
 
     return true;
 }
 
-TreeNode* PathTree::Append(const std::wstring& atom, TreeNode* node, bool isIntermediate)
+PathTree::NodeIndex PathTree::Append(AtomId atom, NodeIndex node, bool isIntermediate)
 {
     // First check if the node is already there
-    std::pair<std::wstring, TreeNode*> search;
-    if (node->children.find(atom, search))
+    std::vector<Edge>& children = m_nodes[node].children;
+    const auto position = LowerBound(children, atom);
+    if (position != children.end() && position->atom == atom)
     {
         // If the node being appended is not an intermediate, that overrides the existing node flag
-        (search.second)->intermediate &= isIntermediate;
-        return search.second;
+        m_nodes[position->node].intermediate &= isIntermediate;
+        return position->node;
     }
 
-    // It is not there. Create it and add it as a child of the given node
-    TreeNode* newNode = new TreeNode();
-    newNode->intermediate = isIntermediate;
-    node->children.emplace(atom, newNode);
+    // It is not there. Create it and add it as a child of the given node.
+    // Observe allocating may grow m_nodes, so the position is turned into an offset first
+    const size_t offset = position - children.begin();
+    const NodeIndex newNode = AllocateNode(isIntermediate);
+    std::vector<Edge>& parentChildren = m_nodes[node].children;
+    parentChildren.insert(parentChildren.begin() + offset, Edge { atom, newNode });
 
     return newNode;
 }
@@ -83,134 +126,115 @@ TreeNode* PathTree::Append(const std::wstring& atom, TreeNode* node, bool isInte
 void PathTree::RetrieveAndRemoveAllDescendants(const std::wstring& path, std::vector<std::wstring>& descendants)
 {
     // Find the trace in the tree that matches the path
-    std::vector<std::pair<std::wstring, TreeNode*>> nodeTrace;
-    if (!TryFind(path, nodeTrace))
+    const Edge* trace;
+    size_t traceLength;
+    if (!TryFind(path, trace, traceLength))
     {
         return;
     }
 
     // Let's build the given path again based on the resulting trace so casing is preserved
     // Observe there is always at least one element (the root of the tree), which we skip
-    auto it = nodeTrace.begin();
-    it++;
-
     std::wstring normalizedPath;
-    if (it != nodeTrace.end())
+    for (size_t i = 1; i < traceLength; i++)
     {
-        normalizedPath.append(it->first);
-        it++;
-    }
+        if (i > 1)
+        {
+            normalizedPath.append(L"\\");
+        }
 
-    for (; it != nodeTrace.end(); it++)
-    {
-        normalizedPath.append(L"\\");
-        normalizedPath.append(it->first);
+        normalizedPath.append(m_atoms[trace[i].atom]);
     }
 
     // Pop all the descendants of the leaf node and build the descendant collection
-    RetrieveAndRemoveAllDescendants(normalizedPath, nodeTrace.back().second, descendants);
+    RetrieveAndRemoveAllDescendants(normalizedPath, trace[traceLength - 1].node, descendants);
 
     // Let's walk upwards, towards the root, removing all intermediates with no branching
     // The presence of these nodes won't affect future computation of descendants but it can slow
-    // down searches
-    while (!nodeTrace.empty())
+    // down searches. We don't want to delete the root, which is the first element of the trace.
+    for (size_t i = traceLength - 1; i > 0; i--)
     {
-        std::pair<std::wstring, TreeNode*> pair = nodeTrace.back();
-        TreeNode* node = pair.second;
-
-        nodeTrace.pop_back();
+        const NodeIndex node = trace[i].node;
 
-        // We don't want to delete the root. And we should only remove intermediates with no children
-        // (no children after removing the last edge)
-        if (node != m_root && node->intermediate && node->children.size() == 0)
-        {
-            TreeNode* predecesor = nodeTrace.back().second;
-            predecesor->children.erase(pair.first);
-            delete node;
-        }
-        else
+        // We should only remove intermediates with no children (no children after removing the last edge)
+        if (!m_nodes[node].intermediate || !m_nodes[node].children.empty())
         {
             break;
         }
+
+        std::vector<Edge>& predecessorChildren = m_nodes[trace[i - 1].node].children;
+        predecessorChildren.erase(LowerBound(predecessorChildren, trace[i].atom));
+        FreeNode(node);
     }
 }
 
-void PathTree::RetrieveAndRemoveAllDescendants(const std::wstring& path, TreeNode* node, std::vector<std::wstring>& descendants)
+void PathTree::RetrieveAndRemoveAllDescendants(const std::wstring& path, NodeIndex node, std::vector<std::wstring>& descendants)
 {
-    std::vector<TreeNode*> nodesToDelete;
-
-    const auto retrieve = [this, &path, node, &descendants, &nodesToDelete](std::pair<std::wstring, TreeNode*>* iter)
+    // Nodes are only freed here, never allocated, so m_nodes does not move while we walk it
+    const std::vector<Edge>& children = m_nodes[node].children;
+    for (size_t i = 0; i < children.size(); i++)
     {
+        const Edge edge = children[i];
+
         // Add the path atom to the path.
         std::wstring descendant(path);
-        if (node != m_root)
+        if (node != RootIndex)
         {
             descendant.append(L"\\");
-            descendant.append(iter->first);
+            descendant.append(m_atoms[edge.atom]);
         }
 
         // Add it to the collection only if it is a final path
-        if (!(iter->second->intermediate))
+        if (!m_nodes[edge.node].intermediate)
         {
             descendants.push_back(descendant);
         }
 
-        RetrieveAndRemoveAllDescendants(descendant, iter->second, descendants);
-
-        nodesToDelete.push_back(iter->second);
-
-    };
+        RetrieveAndRemoveAllDescendants(descendant, edge.node, descendants);
 
-    node->children.forEach(retrieve);
-    
-    for (auto iter = nodesToDelete.begin(); iter != nodesToDelete.end(); iter++)
-    {
-        delete *iter;
+        FreeNode(edge.node);
     }
 
-    node->children.clear();
+    m_nodes[node].children.clear();
 }
 
-void PathTree::RemoveAllDescendants(TreeNode* node)
+bool PathTree::TryFind(const std::wstring& path, const Edge*& trace, size_t& traceLength)
 {
-    const auto remove = [this](std::pair<std::wstring, TreeNode*>* iter)
-    {
-        RemoveAllDescendants(iter->second);
-
-        delete iter->second;
-    };
-
-    node->children.forEach(remove);
-
-    node->children.clear();
-}
-
-bool PathTree::TryFind(const std::wstring& path, std::vector<std::pair<std::wstring, TreeNode*>>& nodeTrace)
-{
-    std::vector<std::wstring> elements;
-    const int err = TryDecomposePath(path, elements);
+    m_elements.clear();
+    const int err = TryDecomposePath(path, m_elements);
     if (err != 0)
     {
         Dbg(L"PathTree::TryFind: TryDecomposePath failed, not resolving path: %d", err);
         return false;
     }
 
-    auto currentNode = m_root;
+    NodeIndex currentNode = RootIndex;
 
-    nodeTrace.push_back(std::make_pair(L"", m_root));
+    m_trace.clear();
+    m_trace.push_back(Edge { NoAtom, RootIndex });
 
-    for (unsigned int i = 0; i < elements.size(); i++)
+    for (size_t i = 0; i < m_elements.size(); i++)
     {
-        std::pair<std::wstring, TreeNode*> search;
-        if (!currentNode->children.find(elements[i], search))
+        // An atom that was never interned cannot be in the tree
+        const AtomId atom = FindAtom(m_elements[i]);
+        if (atom == NoAtom)
         {
             return false;
         }
 
-        nodeTrace.push_back(search);
-        currentNode = search.second;
+        std::vector<Edge>& children = m_nodes[currentNode].children;
+        const auto position = LowerBound(children, atom);
+        if (position == children.end() || position->atom != atom)
+        {
+            return false;
+        }
+
+        m_trace.push_back(*position);
+        currentNode = position->node;
     }
 
+    trace = m_trace.data();
+    traceLength = m_trace.size();
     return true;
 }
 
@@ -219,22 +243,15 @@ std::wstring PathTree::DumpTree()
     return ToDebugString();
 }
 
-std::wstring PathTree::ToDebugString(TreeNode* node, std::wstring indent)
+std::wstring PathTree::ToDebugString(NodeIndex node, std::wstring indent)
 {
     std::wstring result;
 
-    if (node == nullptr)
+    for (const Edge& edge : m_nodes[node].children)
     {
-        node = m_root;
+        result.append(indent + m_atoms[edge.atom] + (!m_nodes[edge.node].intermediate ? L"*" : L"") + L"\r\n");
+        result.append(ToDebugString(edge.node, indent + L"\t"));
     }
 
-    const auto append = [&result, &indent, this](std::pair<std::wstring, TreeNode*>* iter)
-    {
-        result.append(indent + iter->first + (!iter->second->intermediate ? L"*" : L"") + L"\r\n");
-        result.append(ToDebugString(iter->second, indent + L"\t"));
-    };
-
-    node->children.forEach(append);
-
     return result;
-}
\ No newline at end of file
+}
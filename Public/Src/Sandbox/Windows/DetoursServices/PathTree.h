@@ -11,10 +11,24 @@
 #define EXPORT __declspec(dllexport)
 #endif
 
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include "UtilityHelpers.h"
-#include "TreeNode.h"
+
+// warning C4625: 'PathTree': copy constructor was implicitly defined as deleted
+// warning C4626: 'PathTree': assignment operator was implicitly defined as deleted
+// warning C5026: 'PathTree': move constructor was implicitly defined as deleted
+// warning C5027: 'PathTree' : move assignment operator was implicitly defined as deleted
+#pragma warning( disable : 4625 4626 5026 5027 )
 
 // An n-ary tree where nodes are path atoms. Drive letters are at the root and traces in the tree represent paths.
+//
+// Atoms are interned once (case-insensitively, keeping the casing they were first seen with) and nodes live in a single
+// array: the children of a node are a contiguous array of (atom id, node index) pairs sorted by atom id, so finding a
+// child is a binary search over a few integers and a path that has an atom the tree never saw is rejected with a single
+// lookup. Interned atoms are kept for the lifetime of the tree, the nodes of removed paths are reused.
 // This class is not thread safe
 class PathTree {
 public:
@@ -41,21 +55,58 @@ public:
     PathTree& operator=(const PathTree&) = delete;
 
 private:
+    typedef uint32_t AtomId;
+    typedef uint32_t NodeIndex;
+
+    // An edge from a node to one of its children, with the path atom that leads to it
+    struct Edge {
+        AtomId atom;
+        NodeIndex node;
+    };
+
+    struct Node {
+        // Edges to children, sorted by atom id
+        std::vector<Edge> children;
+        // Whether the node is an intermediate node or it represents a path that was explicitly inserted
+        bool intermediate = false;
+    };
+
+    static const NodeIndex RootIndex = 0;
+    static const AtomId NoAtom = UINT32_MAX;
+
+    // Returns the id of the given atom, interning it if it is not there yet
+    AtomId Intern(const std::wstring& atom);
+
+    // Returns the id of the given atom, or NoAtom if it was never interned
+    AtomId FindAtom(const std::wstring& atom) const;
+
+    // Returns the position in the (sorted) children of the given node where an edge with the given atom is or would be
+    static std::vector<Edge>::iterator LowerBound(std::vector<Edge>& children, AtomId atom) noexcept;
+
     // Adds an edge from the given node with the provided atom
-    TreeNode* Append(const std::wstring& atom, TreeNode* node, bool isIntermediate);
+    NodeIndex Append(AtomId atom, NodeIndex node, bool isIntermediate);
+
+    // Returns an unused node, reusing removed ones first
+    NodeIndex AllocateNode(bool isIntermediate);
+
+    // Returns the given node, whose children must have been removed already, to the free list
+    void FreeNode(NodeIndex node);
 
     // Tries to find the provided path in the current tree. On success, returns the trace in the tree that leads to the
-    // path final atom
-    bool TryFind(const std::wstring& path, std::vector<std::pair<std::wstring, TreeNode*>>& nodeTrace);
+    // path final atom (whose first element is the root). The trace is only valid until the tree is modified.
+    bool TryFind(const std::wstring& path, const Edge*& trace, size_t& traceLength);
 
     // Removes all descendants from the given node and builds the descendants collection using the given path as a prefix
-    void RetrieveAndRemoveAllDescendants(const std::wstring& path, TreeNode* lastNode, std::vector<std::wstring>& descendants);
-
-    // Removes all descendants from the given node
-    void RemoveAllDescendants(TreeNode* node);
+    void RetrieveAndRemoveAllDescendants(const std::wstring& path, NodeIndex lastNode, std::vector<std::wstring>& descendants);
 
     // Debugging facility
-    std::wstring ToDebugString(TreeNode* node = nullptr, std::wstring ident = L"");
+    std::wstring ToDebugString(NodeIndex node = RootIndex, std::wstring ident = L"");
 
-    TreeNode* m_root;
-};
\ No newline at end of file
+    std::vector<std::wstring> m_atoms;
+    std::unordered_map<std::wstring, AtomId, CaseInsensitiveStringHasher, CaseInsensitiveStringComparer> m_atomIds;
+    std::vector<Node> m_nodes;
+    std::vector<NodeIndex> m_freeNodes;
+    // Scratch space for TryFind, so finding a path does not allocate once the tree is warm
+    std::vector<Edge> m_trace;
+    std::vector<std::wstring> m_elements;
+};
@@ -3,14 +3,87 @@
 
 #include "PolicyResult.h"
 #include "DetoursHelpers.h"
+#include "DetouredScope.h"
+#include "DetoursProfile.h"
 #include "SendReport.h"
 #include "FilesCheckedForAccess.h"
 
+// Number of recently evaluated paths whose policy result each thread keeps
+#define POLICY_RESULT_CACHE_ENTRIES 8
+
+// Policy results of the last paths evaluated by a thread. Detoured call sequences often evaluate the same path several times in a row
+// (e.g., CreateFileW followed by GetFileAttributesExW and GetFinalPathNameByHandleW on the same file); a hit saves the canonicalization,
+// the path translation and the manifest search.
+//
+// Only fully qualified paths are memoized: their policy result only depends on the path string, as the translations and the manifest
+// don't change during the lifetime of the process. Relative and drive-relative paths depend on the current directory, so they are not.
+struct PolicyResultCache
+{
+    struct Entry
+    {
+        // 0 when the entry is empty
+        uint64_t Hash;
+        uint64_t LastUse;
+        std::wstring Path;
+        PolicyResult Result;
+    };
+
+    uint64_t Clock;
+    Entry Entries[POLICY_RESULT_CACHE_ENTRIES];
+};
+
+static PolicyResultCache* GetCurrentThreadPolicyResultCache()
+{
+    DetouredThreadContext& context = DetouredThreadContext::Current();
+    if (context.PolicyResults == nullptr)
+    {
+        // Allocated from the private heap (see buildXL_mem.h); if that fails, this thread just doesn't memoize
+        context.PolicyResults = new PolicyResultCache();
+    }
+
+    return context.PolicyResults;
+}
+
+static inline bool IsMemoizablePath(PCPathChar path)
+{
+    // \\?\, \??\, \\.\ and UNC paths, or C:\...
+    return IsWin32NtPathName(path) || (path[0] == L'\\' && path[1] == L'\\') || IsDriveBasedAbsolutePath(path);
+}
+
+void ReleaseCurrentThreadPolicyResultCache()
+{
+    DetouredThreadContext& context = DetouredThreadContext::Current();
+    delete context.PolicyResults;
+    context.PolicyResults = nullptr;
+}
+
 bool PolicyResult::Initialize(PCPathChar path)
 {
     assert(m_isIndeterminate);
     assert(path);
 
+    DetoursProfile::PolicyScope profileScope;
+
+    PolicyResultCache* cache = IsMemoizablePath(path) ? GetCurrentThreadPolicyResultCache() : nullptr;
+    size_t pathLength = 0;
+    uint64_t hash = 0;
+    if (cache != nullptr)
+    {
+        pathLength = wcslen(path);
+        hash = HashPath64(path, pathLength);
+        hash = hash == 0 ? 1 : hash;
+
+        for (PolicyResultCache::Entry& entry : cache->Entries)
+        {
+            if (entry.Hash == hash && entry.Path.length() == pathLength && wmemcmp(entry.Path.c_str(), path, pathLength) == 0)
+            {
+                entry.LastUse = ++cache->Clock;
+                *this = entry.Result;
+                return true;
+            }
+        }
+    }
+
     CanonicalizedPathType canonicalizedPath = CanonicalizedPath::Canonicalize(path);
     if (canonicalizedPath.IsNull()) {
         // This policy remains indeterminate.
@@ -18,6 +91,25 @@ bool PolicyResult::Initialize(PCPathChar path)
     }
 
     Initialize(canonicalizedPath);
+
+    if (cache != nullptr)
+    {
+        // Replace the least recently used entry (empty entries have never been used)
+        PolicyResultCache::Entry* victim = &cache->Entries[0];
+        for (PolicyResultCache::Entry& entry : cache->Entries)
+        {
+            if (entry.LastUse < victim->LastUse)
+            {
+                victim = &entry;
+            }
+        }
+
+        victim->Hash = hash;
+        victim->LastUse = ++cache->Clock;
+        victim->Path.assign(path, pathLength);
+        victim->Result = *this;
+    }
+
     return true;
 }
 
@@ -37,6 +129,8 @@ void PolicyResult::InitializeFromCursor(CanonicalizedPathType const& canonicaliz
     assert(m_canonicalizedPath.IsNull());
     assert(!canonicalizedPath.IsNull());
 
+    DetoursProfile::PolicyScope profileScope;
+
     // The path is already canonicalized; now we are committed to set a policy, which doesn't fail.
     // We will do so via special-case rules (no policy search or cursor) or via the policy tree (which is searched, producing a cursor).
     m_canonicalizedPath = canonicalizedPath;
@@ -45,7 +139,10 @@ void PolicyResult::InitializeFromCursor(CanonicalizedPathType const& canonicaliz
     wchar_t const* translatedSearchSuffix = searchSuffix != nullptr ? searchSuffix : GetTranslatedPathWithoutTypePrefix();
     size_t searchSuffixLength = wcslen(translatedSearchSuffix);
 
-    PolicySearchCursor newCursor = FindFileAccessPolicyInTreeEx(policySearchCursor, translatedSearchSuffix, searchSuffixLength);
+    // Searches from the root can use the record index, if the host sent one
+    PolicySearchCursor newCursor = policySearchCursor.Record == g_manifestTreeRoot && policySearchCursor.Level == 0 && !policySearchCursor.SearchWasTruncated && g_manifestRecordIndex.IsValid()
+        ? FindFileAccessPolicyInTreeWithIndex(g_manifestRecordIndex, translatedSearchSuffix, searchSuffixLength)
+        : FindFileAccessPolicyInTreeEx(policySearchCursor, translatedSearchSuffix, searchSuffixLength);
     Initialize(canonicalizedPath, newCursor);
 
     if (GetSpecialCaseRulesForWindows(translatedSearchSuffix, searchSuffixLength, /*out*/ m_policy)) 
@@ -85,6 +182,32 @@ PolicyResult PolicyResult::GetPolicyForSubpath(wchar_t const* pathSuffix) const
     return subpolicy;
 }
 
+bool PolicyResult::TryGetChildrenPolicy(FileAccessPolicy& policy) const {
+    if (m_isIndeterminate || !m_policySearchCursor.IsValid()) {
+        return false;
+    }
+
+    // The special case rules of InitializeFromCursor are matched against the name of the child alone. For \\?\, \??\ and \\.\ paths,
+    // the rule for non-drive devices then replaces the policy of every child with AllowAll; only the code coverage rule comes first.
+    if (m_canonicalizedPath.Type == PathType::LocalDevice || m_canonicalizedPath.Type == PathType::Win32Nt) {
+        if (IgnoreCodeCoverage()) {
+            return false;
+        }
+
+        policy = FileAccessPolicy_AllowAll;
+        return true;
+    }
+
+    // Otherwise the rules matching a single name only add AllowAll, so apart from those bits a child gets the policy of the record its
+    // search ends on. The search ends on this record, and the child gets its cone policy, unless the record has children of its own.
+    if (!m_policySearchCursor.SearchWasTruncated && m_policySearchCursor.Record->BucketCount != 0) {
+        return false;
+    }
+
+    policy = m_policySearchCursor.Record->GetConePolicy();
+    return true;
+}
+
 void PolicyResult::ReportIndeterminatePolicyAndSetLastError(FileOperationContext const& fileOperationContext) const
 {
     assert(IsIndeterminate());
@@ -119,6 +119,11 @@ public:
                 return nullptr;
         }
     }
+
+    // Determines the policy of GetPolicyForSubpath(<name>), when that is the same for every <name> (a single path component) up to the
+    // AllowAll bits the special case rules add for some names. A directory enumeration can then classify all of its entries at once
+    // instead of determining the policy of each one. Returns false if it depends on the name.
+    bool TryGetChildrenPolicy(FileAccessPolicy& policy) const;
 #else // _WIN32
 
 private:
@@ -184,6 +189,7 @@ public:
     bool IndicateUntracked() const { return ((m_policy & FileAccessPolicy_AllowAll) == FileAccessPolicy_AllowAll) && ((m_policy & FileAccessPolicy_ReportAccess) == 0); }
     bool TreatDirectorySymlinkAsDirectory() const { return (m_policy & FileAccessPolicy_TreatDirectorySymlinkAsDirectory) != 0; }
     bool EnableFullReparsePointParsing() const { return (m_policy & FileAccessPolicy_EnableFullReparsePointParsing) != 0; }
+    bool ContainsNoReparsePoints() const { return (m_policy & FileAccessPolicy_ContainsNoReparsePoints) != 0; }
     DWORD GetPathId() const { return m_policySearchCursor.IsValid() ? m_policySearchCursor.Record->GetPathId() : 0; }
     FileAccessPolicy GetPolicy() const { return m_policy; }
     USN GetExpectedUsn() const { return m_policySearchCursor.GetExpectedUsn(); }
@@ -249,3 +255,8 @@ private:
     AccessCheckResult CreateAccessCheckResult(ResultAction result, ReportLevel reportLevel) const;
     AccessCheckResult CreateAccessCheckResult(bool isAllowed) const;
 };
+
+#if _WIN32
+// Frees the policy results the current thread memoized (see PolicyResult::Initialize), called when the thread exits.
+void ReleaseCurrentThreadPolicyResultCache();
+#endif // _WIN32
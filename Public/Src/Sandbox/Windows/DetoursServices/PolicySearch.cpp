@@ -107,6 +107,116 @@ PolicySearchCursor FindFileAccessPolicyInTreeEx(
     return FindFileAccessPolicyInTreeEx(PolicySearchCursor(childRecord, cursor.Level + 1, MakePPolicySearchCursor(cursor)), remainder, remainderLength);
 }
 
+// Paths with more atoms than this are searched by walking the tree
+#define MAX_INDEXED_SEARCH_LEVELS 64
+
+PolicySearchCursor FindFileAccessPolicyInTreeWithIndex(
+    __in  ManifestRecordIndex const& index,
+    __in  PCPathChar absolutePath,
+    __in  size_t absolutePathLength)
+{
+    assert(index.IsValid());
+    assert(absolutePath);
+    assert(absolutePathLength == pathlen(absolutePath));
+
+    // Tokenize the path the same way FindFileAccessPolicyInTreeEx does, computing the full path hash of every prefix
+    PCPathChar atoms[MAX_INDEXED_SEARCH_LEVELS];
+    size_t atomLengths[MAX_INDEXED_SEARCH_LEVELS];
+    ManifestRecord::HashType atomHashes[MAX_INDEXED_SEARCH_LEVELS];
+    uint64_t prefixHashes[MAX_INDEXED_SEARCH_LEVELS];
+
+    size_t atomCount = 0;
+    uint64_t prefixHash = MANIFEST_RECORD_INDEX_PREFIX_HASH_SEED;
+    PCPathChar current = absolutePath;
+    size_t currentLength = absolutePathLength;
+    while (current[0] != 0)
+    {
+        if (atomCount == MAX_INDEXED_SEARCH_LEVELS)
+        {
+            return FindFileAccessPolicyInTreeEx(index.Root, absolutePath, absolutePathLength);
+        }
+
+        PCPathChar remainder = NULL;
+        size_t partialPathLength = GetPartialPathAndRemainder(current, currentLength, /*out*/ remainder);
+
+        atoms[atomCount] = current;
+        atomLengths[atomCount] = partialPathLength;
+        atomHashes[atomCount] = HashPath(current, partialPathLength);
+        prefixHash = CombineManifestPrefixHash(prefixHash, atomHashes[atomCount]);
+        prefixHashes[atomCount] = prefixHash;
+        atomCount++;
+
+        currentLength -= remainder - current;
+        current = remainder;
+    }
+
+    // Find the deepest level whose prefix has a record. The prefixes that have one are exactly the first ones (the parent of a record
+    // always has its own), so the whole path is probed first, as it is often in the manifest, and then the levels are bisected.
+    size_t matchedLevel = 0;
+    uint32_t matchedSlot = atomCount == 0 ? MANIFEST_RECORD_INDEX_NO_PARENT : index.Find(prefixHashes[atomCount - 1]);
+    if (matchedSlot != MANIFEST_RECORD_INDEX_NO_PARENT)
+    {
+        matchedLevel = atomCount;
+    }
+    else
+    {
+        size_t low = 0;
+        size_t high = atomCount == 0 ? 0 : atomCount - 1;
+        while (low < high)
+        {
+            size_t middle = (low + high + 1) / 2;
+            uint32_t slot = index.Find(prefixHashes[middle - 1]);
+            if (slot != MANIFEST_RECORD_INDEX_NO_PARENT)
+            {
+                low = middle;
+                matchedSlot = slot;
+            }
+            else
+            {
+                high = middle - 1;
+            }
+        }
+
+        // matchedSlot is the slot of the last successful probe, which is the one of level 'low'
+        matchedLevel = low;
+    }
+
+    // Hashes only point to a candidate: check that the records from the candidate up to the root match the atoms, as FindChild would
+    PCManifestRecord records[MAX_INDEXED_SEARCH_LEVELS + 1];
+    records[0] = index.Root;
+    uint32_t slot = matchedSlot;
+    for (size_t level = matchedLevel; level > 0; level--)
+    {
+        if (slot == MANIFEST_RECORD_INDEX_NO_PARENT || slot >= index.SlotCount)
+        {
+            return FindFileAccessPolicyInTreeEx(index.Root, absolutePath, absolutePathLength);
+        }
+
+        PCManifestRecord record = index.GetRecord(slot);
+        if (record->Hash != atomHashes[level - 1] || !ArePathsEqual(atoms[level - 1], record->GetPartialPath(), atomLengths[level - 1]))
+        {
+            return FindFileAccessPolicyInTreeEx(index.Root, absolutePath, absolutePathLength);
+        }
+
+        records[level] = record;
+        slot = index.Slots[slot].Parent;
+    }
+
+    if (matchedLevel > 0 && (slot >= index.SlotCount || index.GetRecord(slot) != index.Root))
+    {
+        return FindFileAccessPolicyInTreeEx(index.Root, absolutePath, absolutePathLength);
+    }
+
+    // Rebuild the cursors the walk would have produced, so resuming a search from the result works the same
+    PolicySearchCursor cursor(index.Root);
+    for (size_t level = 1; level <= matchedLevel; level++)
+    {
+        cursor = PolicySearchCursor(records[level], level, MakePPolicySearchCursor(cursor));
+    }
+
+    return PolicySearchCursor(cursor.Record, cursor.Level, cursor.Parent, /*searchWasTruncated*/ matchedLevel < atomCount);
+}
+
 #ifdef BUILDXL_NATIVES_LIBRARY
 BOOL WINAPI FindFileAccessPolicyInTree(
     __in  ManifestRecord const* record,
@@ -128,6 +238,29 @@ BOOL WINAPI FindFileAccessPolicyInTree(
     pathId = newCursor.Record->GetPathId();
     return true;
 }
+
+BOOL WINAPI FindFileAccessPolicyInIndexedTree(
+    __in  ManifestRecord const* record,
+    __in  size_t recordSize,
+    __in  PCPathChar absolutePath,
+    __in  size_t absolutePathLength,
+    __out FileAccessPolicy& conePolicy,
+    __out FileAccessPolicy& nodePolicy,
+    __out DWORD& pathId,
+    __out USN& expectedUsn)
+{
+    ManifestRecordIndex index;
+    if (record == nullptr || absolutePath == nullptr || !index.TryLocate(record, reinterpret_cast<const BYTE*>(record) + recordSize)) {
+        return false;
+    }
+
+    PolicySearchCursor newCursor = FindFileAccessPolicyInTreeWithIndex(index, absolutePath, absolutePathLength);
+    conePolicy = newCursor.Record->GetConePolicy();
+    nodePolicy = newCursor.Record->GetNodePolicy();
+    expectedUsn = newCursor.GetExpectedUsn();
+    pathId = newCursor.Record->GetPathId();
+    return true;
+}
 #endif // BUILDXL_NATIVES_LIBRARY
 
 /// FindChild
@@ -87,6 +87,14 @@ PolicySearchCursor FindFileAccessPolicyInTreeEx(
     __in  PCPathChar absolutePath,
     __in  size_t absolutePathLength);
 
+// Equivalent to FindFileAccessPolicyInTreeEx from the root of the indexed tree, but finding the deepest matching record
+// with a few probes of the index rather than walking the tree one path atom at a time. Falls back to walking the tree
+// when the index can't be used for the path.
+PolicySearchCursor FindFileAccessPolicyInTreeWithIndex(
+    __in  ManifestRecordIndex const& index,
+    __in  PCPathChar absolutePath,
+    __in  size_t absolutePathLength);
+
 // This is equivalent to FindFileAccessPolicyInTreeEx, but taking just a start record
 // rather than a full cursor, and returning only the matched record details rather than a cursor.
 // This is a simplified variant for easier C#-side testing.
@@ -99,4 +107,16 @@ BOOL WINAPI FindFileAccessPolicyInTree(
     __out DWORD& pathId,
     __out USN& expectedUsn);
 
+// This is equivalent to FindFileAccessPolicyInTree, but using the record index that ends the given tree bytes
+// (see ManifestRecordIndex). For C#-side testing.
+BOOL WINAPI FindFileAccessPolicyInIndexedTree(
+    __in  PCManifestRecord record,
+    __in  size_t recordSize,
+    __in  PCPathChar absolutePath,
+    __in  size_t absolutePathLength,
+    __out FileAccessPolicy& conePolicy,
+    __out FileAccessPolicy& nodePolicy,
+    __out DWORD& pathId,
+    __out USN& expectedUsn);
+
 #endif
@@ -0,0 +1,51 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <windows.h>
+
+// ----------------------------------------------------------------------------
+// SHARED-MEMORY REPORT RING
+// ----------------------------------------------------------------------------
+//
+// CODESYNC: Public/Src/Engine/Processes/Internal/SharedMemoryReportRing.cs
+//
+// When FileAccessManifestExtraFlag::EnableSharedMemoryReports is set, the host creates a named file mapping holding a ring
+// (and a named auto-reset event, the doorbell) for the pip, and passes its name in the report block of the manifest.
+// Report lines are then appended to the ring instead of being written to the report pipe one WriteFile at a time.
+//
+// The ring is a multi-producer (every detoured thread of every process of the pip), single-consumer (the host) byte queue:
+//  - Producers reserve space by advancing WritePosition with a compare-and-swap, as long as the record fits in the space the
+//    consumer freed. They copy the line and then publish the record by writing its (non-zero) length last.
+//  - The consumer reads the records in order, clears them and then advances ReadPosition.
+//  - A producer only signals the doorbell if the ring was empty when it published its record (its record starts at ReadPosition),
+//    as the consumer may be waiting: while the ring is busy, appending a report costs no kernel transition.
+// Positions only grow, and are mapped into the buffer modulo Capacity. A record is a 32-bit length (in bytes) followed by the
+// UTF-16 line (with its \r\n terminator), padded to 8 bytes, so the length of a record never wraps around the end of the buffer.
+// When a line does not fit, it goes through the report pipe as usual.
+
+#define REPORT_RING_MAGIC 0x474E4952 // 'RING'
+#define REPORT_RING_RECORD_ALIGNMENT 8
+#define REPORT_RING_DOORBELL_SUFFIX L"_Doorbell"
+
+typedef struct ReportRingHeader_t
+{
+    UINT32 Magic;
+    UINT32 Capacity;                // Size of the buffer that follows the header (a power of 2)
+    BYTE Padding1[56];
+    volatile LONG64 WritePosition;  // Next position to reserve. Written by producers.
+    BYTE Padding2[56];
+    volatile LONG64 ReadPosition;   // Position of the oldest record not consumed yet. Written by the consumer.
+    BYTE Padding3[56];
+} ReportRingHeader;
+
+// The positions are kept in separate cache lines so producers and the consumer don't keep stealing them from each other
+static_assert(sizeof(ReportRingHeader) == 192, "The layout of the ring header must match SharedMemoryReportRing.cs");
+
+// Maps the ring with the given name and opens its doorbell. Returns false (and leaves the ring unused) if either can't be opened.
+bool OpenReportRing(_In_z_ PCWSTR ringName);
+
+// Appends a report line to the ring. Returns false if the ring is not in use or the line does not fit, in which case
+// the line must be sent through the report pipe.
+bool TryAppendToReportRing(_In_reads_bytes_(lineLengthInBytes) wchar_t const* line, size_t lineLengthInBytes);
@@ -3,12 +3,14 @@
 
 #pragma once
 
+#include <atomic>
 #include <map>
 #include <set>
 #include <memory>
 #include <shared_mutex>
 #include <vector>
 
+#include "PathArena.h"
 #include "PathTree.h"
 
 typedef std::shared_mutex ResolvedPathCacheLock;
@@ -48,36 +50,203 @@ struct CaseInsensitiveTargetCacheLessThan {
     }
 };
 
-// A note on how paths are stored in the cache: Paths coming from detoured functions may vary in casing and may or may not
-// have a trailing slash. Standard path canonicalization done as part of setting up the detours policy does not take care of these 
-// differences, but the resolved path cache should treat those as equivalent paths (e.g C:\foo, C:\FOO and C:\foo\ should be considered equivalent directories).
-// All cache related structures use a case insensitive comparer for paths. Observe this doesn't change any user-facing paths (i.e. 
-// paths reported or used for real accesses)
-class ResolvedPathCache {
+// Lock-free cache of resolving check results (see ResolvedPathCache::InsertResolvingCheckResult), which are looked up for
+// every path component whenever reparse points are resolved.
+//
+// An insert-only, open addressing table keyed by the hash of the normalized path (see HashPath64). Slots are claimed with a
+// compare-and-swap on the hash and get a copy of the path from a PathArena, which tells apart paths with the same hash.
+// Entries are never freed, so there is nothing to reclaim and readers never wait: invalidating a path clears the result in
+// its slots, and invalidating everything bumps the generation, since a result is only valid in the generation it was stored in.
+// When a path doesn't find a slot within MAX_PROBES, it is just not cached.
+class ResolvingCheckTable {
 public:
-    inline bool InsertResolvingCheckResult(const std::wstring& path, bool result)
+    ResolvingCheckTable() : m_slots(nullptr), m_generation(1) { }
+    ResolvingCheckTable(const ResolvingCheckTable&) = delete;
+    ResolvingCheckTable& operator=(const ResolvingCheckTable&) = delete;
+
+    bool Insert(PCPathChar path, size_t length, bool result)
     {
-        // Using the cache is best effort, as this is faster than waiting on locks.  It is not incorrect to not have a value in the cache, just might result in more I/O when the file is not found in the cache.
-        ResolvedPathCacheWriteLock w_lock(m_lock, std::try_to_lock);
-        if (!w_lock.owns_lock())
+        Slot* slot = FindSlot(path, length, /* claim */ true);
+        if (slot == nullptr)
         {
             return false;
         }
 
-        const std::wstring normalizedPath = Normalize(path);
-        if (!m_pathTree.TryInsert(normalizedPath))
+        slot->result.store((m_generation.load(std::memory_order_acquire) << 2) | (result ? ResultTrue : ResultFalse), std::memory_order_release);
+        return true;
+    }
+
+    const Possible<bool> Find(PCPathChar path, size_t length) const
+    {
+        Possible<bool> p;
+        p.Found = false;
+
+        Slot* slot = const_cast<ResolvingCheckTable*>(this)->FindSlot(path, length, /* claim */ false);
+        if (slot != nullptr)
         {
-            return false;
+            uint64_t result = slot->result.load(std::memory_order_acquire);
+            if ((result >> 2) == m_generation.load(std::memory_order_acquire) && (result & 3) != ResultNone)
+            {
+                p.Found = true;
+                p.Value = (result & 3) == ResultTrue;
+            }
         }
 
-        return m_resolverCache.emplace(normalizedPath, result).second;
+        return p;
+    }
+
+    void Invalidate(PCPathChar path, size_t length)
+    {
+        Slot* slots = m_slots.load(std::memory_order_acquire);
+        if (slots == nullptr)
+        {
+            return;
+        }
+
+        // Racing inserts may have given the same path more than one slot, clear all of them
+        const uint64_t hash = GetHash(path, length);
+        size_t index = (size_t)hash & (SLOT_COUNT - 1);
+        for (size_t probe = 0; probe < MAX_PROBES; probe++, index = (index + 1) & (SLOT_COUNT - 1))
+        {
+            uint64_t current = slots[index].hash.load(std::memory_order_acquire);
+            if (current == 0)
+            {
+                return;
+            }
+
+            PathArena::Entry* entry = current == hash ? slots[index].path.load(std::memory_order_acquire) : nullptr;
+            if (entry != nullptr && entry->Matches(path, length))
+            {
+                slots[index].result.store(ResultNone, std::memory_order_release);
+            }
+        }
+    }
+
+    void InvalidateAll()
+    {
+        m_generation.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+private:
+    static const size_t SLOT_COUNT = 1 << 14; // must be a power of 2
+    static const size_t MAX_PROBES = 32;
+
+    // The low 2 bits of a result, the generation is in the rest
+    static const uint64_t ResultNone = 0;
+    static const uint64_t ResultFalse = 1;
+    static const uint64_t ResultTrue = 2;
+
+    struct Slot
+    {
+        std::atomic<uint64_t> hash;
+        std::atomic<PathArena::Entry*> path;
+        std::atomic<uint64_t> result;
+    };
+
+    static uint64_t GetHash(PCPathChar path, size_t length)
+    {
+        // 0 marks empty slots
+        uint64_t hash = HashPath64(path, length);
+        return hash == 0 ? 1 : hash;
+    }
+
+    Slot* FindSlot(PCPathChar path, size_t length, bool claim)
+    {
+        Slot* slots = m_slots.load(std::memory_order_acquire);
+        if (slots == nullptr)
+        {
+            if (!claim)
+            {
+                return nullptr;
+            }
+
+            // Processes that never resolve reparse points don't pay for the table
+            Slot* newSlots = new Slot[SLOT_COUNT]();
+            if (newSlots == nullptr)
+            {
+                return nullptr;
+            }
+
+            if (m_slots.compare_exchange_strong(slots, newSlots, std::memory_order_acq_rel))
+            {
+                slots = newSlots;
+            }
+            else
+            {
+                delete[] newSlots;
+            }
+        }
+
+        const uint64_t hash = GetHash(path, length);
+        size_t index = (size_t)hash & (SLOT_COUNT - 1);
+        for (size_t probe = 0; probe < MAX_PROBES; probe++, index = (index + 1) & (SLOT_COUNT - 1))
+        {
+            Slot& slot = slots[index];
+            uint64_t current = slot.hash.load(std::memory_order_acquire);
+
+            if (current == 0)
+            {
+                if (!claim)
+                {
+                    // Slots are never released, so the path can't be further away
+                    return nullptr;
+                }
+
+                if (slot.hash.compare_exchange_strong(current, hash, std::memory_order_acq_rel))
+                {
+                    PathArena::Entry* entry = m_arena.Add(path, length);
+                    if (entry == nullptr)
+                    {
+                        return nullptr;
+                    }
+
+                    slot.path.store(entry, std::memory_order_release);
+                    return &slot;
+                }
+
+                // Lost the race for this slot, 'current' now holds the hash of the winner
+            }
+
+            // A slot whose path is not published yet never matches
+            PathArena::Entry* entry = current == hash ? slot.path.load(std::memory_order_acquire) : nullptr;
+            if (entry != nullptr && entry->Matches(path, length))
+            {
+                return &slot;
+            }
+        }
+
+        return nullptr;
+    }
+
+    std::atomic<Slot*> m_slots;
+    std::atomic<uint64_t> m_generation;
+    PathArena m_arena;
+};
+
+// A note on how paths are stored in the cache: Paths coming from detoured functions may vary in casing and may or may not
+// have a trailing slash. Standard path canonicalization done as part of setting up the detours policy does not take care of these 
+// differences, but the resolved path cache should treat those as equivalent paths (e.g C:\foo, C:\FOO and C:\foo\ should be considered equivalent directories).
+// All cache related structures use a case insensitive comparer for paths. Observe this doesn't change any user-facing paths (i.e. 
+// paths reported or used for real accesses)
+class ResolvedPathCache {
+public:
+    inline bool InsertResolvingCheckResult(const std::wstring& path, bool result)
+    {
+        // Using the cache is best effort. It is not incorrect to not have a value in the cache, just might result in more I/O when the file is not found in the cache.
+        PCPathChar normalizedPath;
+        size_t length;
+        NormalizeInPlace(path, normalizedPath, length);
+        return m_resolvingChecks.Insert(normalizedPath, length, result);
     }
 
     inline const Possible<bool> GetResolvingCheckResult(const std::wstring& path)
     {
         // The resolver cache is essentially caching GetFileAttributesW when trying to discover reparse points. This is a very frequent IO operation and a relatively cheap
-        // one, so use best effort basis.
-        return Find(m_resolverCache, Normalize(path), true);
+        // one, so the lookup takes no lock and allocates nothing.
+        PCPathChar normalizedPath;
+        size_t length;
+        NormalizeInPlace(path, normalizedPath, length);
+        return m_resolvingChecks.Find(normalizedPath, length);
     }
 
     inline bool InsertResolvedPathWithType(const std::wstring& path, std::wstring& resolved, DWORD type)
@@ -155,6 +324,18 @@ public:
 
     void Invalidate(const std::wstring& path, bool isDirectory)
     {
+        PCPathChar resolvingCheckPath;
+        size_t resolvingCheckPathLength;
+        NormalizeInPlace(path, resolvingCheckPath, resolvingCheckPathLength);
+        m_resolvingChecks.Invalidate(resolvingCheckPath, resolvingCheckPathLength);
+
+        if (isDirectory)
+        {
+            // The resolving checks of the descendants are not tracked individually, drop them all instead. Directories that
+            // change are rare compared to lookups, and these checks are cheap to redo.
+            m_resolvingChecks.InvalidateAll();
+        }
+
         ResolvedPathCacheWriteLock w_lock(m_lock);
 
         const std::wstring normalizedPath = Normalize(path);
@@ -195,7 +376,6 @@ public:
      */
     void InvalidateThisPath(const std::wstring& path)
     {
-        m_resolverCache.erase(path);
         m_targetCache.erase(path);
 
         // Erase B from (3)
@@ -309,10 +489,21 @@ private:
         return GetPathWithoutPrefix(path.c_str());
     }
 
-    ResolvedPathCacheLock m_lock;
+    // Same as Normalize (but also removing the prefix of paths with a trailing slash), without copying the path
+    inline static void NormalizeInPlace(const std::wstring& path, PCPathChar& normalizedPath, size_t& length)
+    {
+        normalizedPath = GetPathWithoutPrefix(path.c_str());
+        length = path.size() - (size_t)(normalizedPath - path.c_str());
+        if (length > 0 && IsDirectorySeparator(normalizedPath[length - 1]))
+        {
+            length--;
+        }
+    }
+
+    // Caches if base paths need to be resolved (no entry) or have previously been fully resolved. Not guarded by m_lock.
+    ResolvingCheckTable m_resolvingChecks;
 
-    // A mapping used to cache if base paths need to be resolved (no entry) or have previously been fully resolved
-    std::map<std::wstring, bool, CaseInsensitiveStringLessThan> m_resolverCache;
+    ResolvedPathCacheLock m_lock;
 
     // A mapping used to cache DeviceControl calls when querying targets of reparse points, used to avoid unnecessary I/O
     std::map<std::wstring, std::pair<std::wstring, DWORD>, CaseInsensitiveStringLessThan> m_targetCache;
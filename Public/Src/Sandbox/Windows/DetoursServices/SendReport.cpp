@@ -5,13 +5,17 @@
 
 #include <algorithm>
 #include <memory>
+#include <unordered_map>
+#include <vector>
 
 #include "DataTypes.h"
 #include "DebuggingHelpers.h"
 #include "DetoursHelpers.h"
+#include "DetouredScope.h"
 #include "FileAccessHelpers.h"
 #include "SendReport.h"
 #include "PolicyResult.h"
+#include "ReportRing.h"
 #include "buildXL_mem.h"
 
 using std::unique_ptr;
@@ -20,21 +24,135 @@ extern volatile LONG g_detoursAllocatedNoLockConcurentPoolEntries;
 extern volatile LONG64 g_detoursMaxHandleHeapEntries;
 extern volatile LONG64 g_detoursHandleHeapEntries;
 
+// Shared-memory report ring (see ReportRing.h), only set when the host created one for the pip
+static ReportRingHeader* s_reportRing = nullptr;
+static HANDLE s_reportRingDoorbell = NULL;
+
+// Reports counted since the message-count semaphore was last released (see PublishMessageCount)
+static volatile LONG s_unpublishedMessageCount = 0;
+
 // ----------------------------------------------------------------------------
 // HELPER FUNCTION DEFINITIONS
 // ----------------------------------------------------------------------------
 
-void SendReportString(_In_z_ wchar_t const* dataString)
+bool OpenReportRing(_In_z_ PCWSTR ringName)
 {
-    if (g_reportFileHandle == NULL || g_reportFileHandle == INVALID_HANDLE_VALUE) {
+    HANDLE mapping = OpenFileMappingW(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, ringName);
+    if (mapping == NULL)
+    {
+        Dbg(L"OpenReportRing: Failed to open report ring '%s' (error code: 0x%08X)", ringName, (int)GetLastError());
+        return false;
+    }
+
+    // The view keeps the section alive, so the mapping handle is not needed anymore
+    ReportRingHeader* ring = reinterpret_cast<ReportRingHeader*>(MapViewOfFile(mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, 0));
+    CloseHandle(mapping);
+
+    if (ring == nullptr)
+    {
+        Dbg(L"OpenReportRing: Failed to map report ring '%s' (error code: 0x%08X)", ringName, (int)GetLastError());
+        return false;
+    }
+
+    if (ring->Magic != REPORT_RING_MAGIC || ring->Capacity == 0 || (ring->Capacity & (ring->Capacity - 1)) != 0)
+    {
+        Dbg(L"OpenReportRing: Report ring '%s' is not valid (magic: 0x%08X, capacity: %u)", ringName, ring->Magic, ring->Capacity);
+        UnmapViewOfFile(ring);
+        return false;
+    }
+
+    std::wstring doorbellName(ringName);
+    doorbellName.append(REPORT_RING_DOORBELL_SUFFIX);
+    HANDLE doorbell = OpenEventW(EVENT_MODIFY_STATE, FALSE, doorbellName.c_str());
+    if (doorbell == NULL)
+    {
+        Dbg(L"OpenReportRing: Failed to open report ring doorbell '%s' (error code: 0x%08X)", doorbellName.c_str(), (int)GetLastError());
+        UnmapViewOfFile(ring);
+        return false;
+    }
+
+    s_reportRingDoorbell = doorbell;
+    s_reportRing = ring;
+    return true;
+}
+
+bool TryAppendToReportRing(_In_reads_bytes_(lineLengthInBytes) wchar_t const* line, size_t lineLengthInBytes)
+{
+    ReportRingHeader* ring = s_reportRing;
+    if (ring == nullptr || lineLengthInBytes == 0)
+    {
+        return false;
+    }
+
+    const LONG64 capacity = ring->Capacity;
+    const LONG64 recordSize = (LONG64)((sizeof(UINT32) + lineLengthInBytes + REPORT_RING_RECORD_ALIGNMENT - 1) & ~(size_t)(REPORT_RING_RECORD_ALIGNMENT - 1));
+
+    // Very long lines go through the pipe, so a few of them can't take the whole ring
+    if (recordSize > capacity / 4)
+    {
+        return false;
+    }
+
+    // Reserve the record. ReadPosition may be stale (it only grows), which at worst makes the ring look fuller than it is.
+    LONG64 start = ring->WritePosition;
+    while (true)
+    {
+        if (start + recordSize - ring->ReadPosition > capacity)
+        {
+            return false;
+        }
+
+        LONG64 previous = InterlockedCompareExchange64(&ring->WritePosition, start + recordSize, start);
+        if (previous == start)
+        {
+            break;
+        }
+
+        start = previous;
+    }
+
+    BYTE* buffer = reinterpret_cast<BYTE*>(ring + 1);
+    const LONG64 mask = capacity - 1;
+    const LONG64 payload = (start + (LONG64)sizeof(UINT32)) & mask;
+    const size_t firstPart = std::min<size_t>(lineLengthInBytes, (size_t)(capacity - payload));
+
+    memcpy(buffer + payload, line, firstPart);
+    if (firstPart < lineLengthInBytes)
+    {
+        memcpy(buffer, reinterpret_cast<BYTE const*>(line) + firstPart, lineLengthInBytes - firstPart);
+    }
+
+    // Publish the record. This is a full barrier: the line is visible before its length, and the length before we look at ReadPosition.
+    InterlockedExchange(reinterpret_cast<volatile LONG*>(buffer + (start & mask)), (LONG)lineLengthInBytes);
+
+    // If the consumer already got to this record, it may have found it unpublished and be waiting on the doorbell
+    if (ring->ReadPosition == start)
+    {
+        SetEvent(s_reportRingDoorbell);
+    }
+
+    return true;
+}
+
+void PublishMessageCount()
+{
+    if (g_messageCountSemaphore == INVALID_HANDLE_VALUE)
+    {
         return;
     }
 
-    // Increment the message sent counter.
-    if (g_messageCountSemaphore != INVALID_HANDLE_VALUE)
+    LONG count = InterlockedExchange(&s_unpublishedMessageCount, 0);
+    if (count > 0)
     {
-        ReleaseSemaphore(g_messageCountSemaphore, 1, nullptr);
+        ReleaseSemaphore(g_messageCountSemaphore, count, nullptr);
     }
+}
+
+// Writes zero-terminated report lines to the report pipe
+static void WriteReportToPipe(_In_z_ wchar_t const* data, size_t lengthInBytes)
+{
+    // The reports written here (and the ones that went through the ring before them) are counted before they can be received
+    PublishMessageCount();
 
     OVERLAPPED overlapped;
     ZeroMemory(&overlapped, sizeof(OVERLAPPED));
@@ -42,18 +160,265 @@ void SendReportString(_In_z_ wchar_t const* dataString)
     overlapped.Offset = 0xFFFFFFFF;
     overlapped.OffsetHigh = 0xFFFFFFFF;
 
-    size_t reportLineLength = sizeof(wchar_t) * wcslen(dataString);
     DWORD bytesWritten;
-    DWORD lastError = GetLastError();
-    if (!WriteFile(g_reportFileHandle, dataString, (DWORD)reportLineLength, &bytesWritten, &overlapped))
+    if (!WriteFile(g_reportFileHandle, data, (DWORD)lengthInBytes, &bytesWritten, &overlapped))
     {
         DWORD error = GetLastError();
-        std::wstring errorMsg = DebugStringFormat(L"SendReportString: Failed to write file access report line '%s' (error code: 0x%08X)", dataString, (int)error);
+        std::wstring errorMsg = DebugStringFormat(L"SendReportString: Failed to write file access report line '%s' (error code: 0x%08X)", data, (int)error);
         Dbg(errorMsg.c_str());
         HandleDetoursInjectionAndCommunicationErrors(DETOURS_PIPE_WRITE_ERROR_4, errorMsg.c_str(), DETOURS_WINDOWS_LOG_MESSAGE_4);
     }
+}
+
+// ----------------------------------------------------------------------------
+// REPORT BATCHES
+// ----------------------------------------------------------------------------
+
+// In characters, the largest report line that fits also fits in the default pipe buffer
+#define REPORT_BATCH_CAPACITY 16384
+
+static void CompleteInternedPath(std::wstring&& path, DWORD id);
+
+// File access reports of a thread that are not written to the pipe yet (see SendReport)
+struct ReportBatch
+{
+    ReportBatch* Next;
+
+    // Only contended when another thread flushes all batches
+    SRWLOCK Lock;
+
+    // In characters, Buffer is kept zero-terminated
+    size_t Length;
+    wchar_t Buffer[REPORT_BATCH_CAPACITY + 1];
+
+    // Paths interned by the batched reports, which only become usable once the batch is written (see CompleteInternedPath)
+    std::vector<std::pair<std::wstring, DWORD>> PendingInternedPaths;
+};
+
+// All the batches of the process, so they can be flushed from any thread
+static ReportBatch* s_reportBatches = nullptr;
+static SRWLOCK s_reportBatchesLock = SRWLOCK_INIT;
+
+static ReportBatch* GetCurrentThreadReportBatch()
+{
+    DetouredThreadContext& context = DetouredThreadContext::Current();
+    if (context.Reports != nullptr)
+    {
+        return context.Reports;
+    }
+
+    // Only this thread writes the buffer on every report, so it lives on its NUMA node (see dd_alloc_local_pages).
+    // If that fails, this thread just doesn't batch.
+    void* memory = dd_alloc_local_pages(sizeof(ReportBatch));
+    if (memory == nullptr)
+    {
+        return nullptr;
+    }
+
+    ReportBatch* batch = new (memory) ReportBatch();
+
+    InitializeSRWLock(&batch->Lock);
+    batch->Length = 0;
+    batch->Buffer[0] = L'\0';
+
+    AcquireSRWLockExclusive(&s_reportBatchesLock);
+    batch->Next = s_reportBatches;
+    s_reportBatches = batch;
+    ReleaseSRWLockExclusive(&s_reportBatchesLock);
+
+    context.Reports = batch;
+    return batch;
+}
+
+// Must hold batch->Lock
+static void FlushReportBatchLocked(ReportBatch* batch)
+{
+    if (batch->Length > 0)
+    {
+        WriteReportToPipe(batch->Buffer, batch->Length * sizeof(wchar_t));
+        batch->Length = 0;
+        batch->Buffer[0] = L'\0';
+    }
+
+    for (auto& pending : batch->PendingInternedPaths)
+    {
+        CompleteInternedPath(std::move(pending.first), pending.second);
+    }
+
+    batch->PendingInternedPaths.clear();
+}
+
+static void FlushCurrentThreadReportBatch()
+{
+    ReportBatch* batch = DetouredThreadContext::Current().Reports;
+    if (batch != nullptr)
+    {
+        AcquireSRWLockExclusive(&batch->Lock);
+        FlushReportBatchLocked(batch);
+        ReleaseSRWLockExclusive(&batch->Lock);
+    }
+}
+
+void FlushAllReportBatches(bool processExit)
+{
+    if (s_reportBatches == nullptr)
+    {
+        return;
+    }
+
+    DWORD lastError = GetLastError();
+
+    // When the process exits, the other threads are already gone and may have been terminated while holding a lock.
+    // Their batches are skipped rather than waited on forever.
+    if (processExit)
+    {
+        if (!TryAcquireSRWLockShared(&s_reportBatchesLock))
+        {
+            SetLastError(lastError);
+            return;
+        }
+    }
+    else
+    {
+        AcquireSRWLockShared(&s_reportBatchesLock);
+    }
+
+    for (ReportBatch* batch = s_reportBatches; batch != nullptr; batch = batch->Next)
+    {
+        if (processExit)
+        {
+            if (!TryAcquireSRWLockExclusive(&batch->Lock))
+            {
+                continue;
+            }
+        }
+        else
+        {
+            AcquireSRWLockExclusive(&batch->Lock);
+        }
+
+        FlushReportBatchLocked(batch);
+        ReleaseSRWLockExclusive(&batch->Lock);
+    }
+
+    ReleaseSRWLockShared(&s_reportBatchesLock);
+    SetLastError(lastError);
+}
+
+void ReleaseCurrentThreadReportBatch()
+{
+    ReportBatch* batch = DetouredThreadContext::Current().Reports;
+    if (batch == nullptr)
+    {
+        return;
+    }
+
+    DWORD lastError = GetLastError();
+
+    // Once unlinked, no other thread can get to the batch
+    AcquireSRWLockExclusive(&s_reportBatchesLock);
+    for (ReportBatch** link = &s_reportBatches; *link != nullptr; link = &(*link)->Next)
+    {
+        if (*link == batch)
+        {
+            *link = batch->Next;
+            break;
+        }
+    }
+    ReleaseSRWLockExclusive(&s_reportBatchesLock);
+
+    FlushReportBatchLocked(batch);
+    DetouredThreadContext::Current().Reports = nullptr;
+    batch->~ReportBatch();
+    dd_free_local_pages(batch, sizeof(ReportBatch));
+
+    SetLastError(lastError);
+}
+
+// Defers making an interned path usable until the batch that holds its definition is written
+static void DeferInternedPath(std::wstring&& path, DWORD id)
+{
+    ReportBatch* batch = DetouredThreadContext::Current().Reports;
+    if (batch == nullptr)
+    {
+        CompleteInternedPath(std::move(path), id);
+        return;
+    }
+
+    AcquireSRWLockExclusive(&batch->Lock);
+    batch->PendingInternedPaths.emplace_back(std::move(path), id);
+    ReleaseSRWLockExclusive(&batch->Lock);
+}
+
+/**
+ * Sends a report. When 'batch' is true and report batching is enabled, the report is appended to the batch of the
+ * current thread instead, and true is returned. Reports that are not batched first flush the batch of the current
+ * thread, so reports of a thread are always received in order.
+ *
+ * Every report is counted, batched or not: if the process goes away without flushing, the missing reports are still
+ * detected. Counting is in-process; the message-count semaphore is only released by the accumulated count, once per
+ * write to the pipe and when the process exits (see PublishMessageCount).
+ */
+static bool SendReport(_In_z_ wchar_t const* dataString, bool batch)
+{
+    if (g_reportFileHandle == NULL || g_reportFileHandle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    if (g_messageCountSemaphore != INVALID_HANDLE_VALUE)
+    {
+        InterlockedIncrement(&s_unpublishedMessageCount);
+    }
+
+    size_t reportLineLength = wcslen(dataString); // in characters
+    DWORD lastError = GetLastError();
+
+    // Appending to the shared-memory ring is already cheap, so batches are only used for the pipe
+    ReportBatch* reportBatch = batch && s_reportRing == nullptr && CheckEnableReportBatching(g_fileAccessManifestExtraFlags)
+        ? GetCurrentThreadReportBatch()
+        : nullptr;
+
+    if (reportBatch != nullptr)
+    {
+        AcquireSRWLockExclusive(&reportBatch->Lock);
+
+        if (reportBatch->Length + reportLineLength > REPORT_BATCH_CAPACITY)
+        {
+            FlushReportBatchLocked(reportBatch);
+        }
+
+        if (reportLineLength <= REPORT_BATCH_CAPACITY)
+        {
+            wmemcpy(reportBatch->Buffer + reportBatch->Length, dataString, reportLineLength);
+            reportBatch->Length += reportLineLength;
+            reportBatch->Buffer[reportBatch->Length] = L'\0';
+
+            ReleaseSRWLockExclusive(&reportBatch->Lock);
+            SetLastError(lastError);
+            return true;
+        }
+
+        // The batch is empty now, so the line can go right away
+        ReleaseSRWLockExclusive(&reportBatch->Lock);
+    }
+    else
+    {
+        FlushCurrentThreadReportBatch();
+    }
+
+    // The pipe is only used when the ring is not in use or it is full
+    if (!TryAppendToReportRing(dataString, reportLineLength * sizeof(wchar_t)))
+    {
+        WriteReportToPipe(dataString, reportLineLength * sizeof(wchar_t));
+    }
 
     SetLastError(lastError);
+    return false;
+}
+
+void SendReportString(_In_z_ wchar_t const* dataString)
+{
+    SendReport(dataString, false);
 }
 
 /**
@@ -95,6 +460,224 @@ bool EscapeFileName(PCWSTR fileName, size_t fileNameLength, std::wstring &escape
     return false;
 }
 
+// ----------------------------------------------------------------------------
+// COMPACT FILE ACCESS REPORTS
+// ----------------------------------------------------------------------------
+
+// CODESYNC: Public/Src/Engine/Processes/CompactFileAccessReportLine.cs (the layout is documented there)
+#define COMPACT_REPORT_VERSION 2
+#define COMPACT_REPORT_UNIT_BASE 0x100
+#define COMPACT_REPORT_UNIT_BITS 15
+#define COMPACT_REPORT_HEADER_LENGTH 55
+
+// Beyond this many interned paths (and directories) a process just sends the rest verbatim
+#define COMPACT_REPORT_MAX_INTERNED_PATHS (1 << 16)
+
+// Directories shorter than this (e.g., drive roots) are not worth an id
+#define COMPACT_REPORT_MIN_INTERNED_DIRECTORY_LENGTH 8
+
+// Paths and directories (which end with a separator) of this process whose defining report was already sent, with their ids
+static std::unordered_map<std::wstring, DWORD> s_internedPaths;
+static SRWLOCK s_internedPathsLock = SRWLOCK_INIT;
+static volatile LONG s_lastInternedPathId = 0;
+
+static wchar_t* AppendCompactUnits(wchar_t* cursor, ULONG64 value, int units)
+{
+    for (int i = 0; i < units; i++)
+    {
+        *cursor++ = (wchar_t)(COMPACT_REPORT_UNIT_BASE + (value & ((1 << COMPACT_REPORT_UNIT_BITS) - 1)));
+        value >>= COMPACT_REPORT_UNIT_BITS;
+    }
+
+    return cursor;
+}
+
+static wchar_t* AppendCompactString(wchar_t* cursor, PCWSTR value, size_t length)
+{
+    memcpy(cursor, value, length * sizeof(wchar_t));
+    return cursor + length;
+}
+
+/**
+ * Looks up the id of an interned path. Returns 0 when the path is not interned yet, in which case 'newId' may be set
+ * to a fresh id: the report then defines it, and the caller calls CompleteInternedPath once that report was sent.
+ */
+static DWORD LookupInternedPath(std::wstring const& path, DWORD& newId)
+{
+    newId = 0;
+
+    // Reports that go through the shared-memory ring may be received after later reports sent through the pipe,
+    // so a reference could get ahead of its definition
+    if (s_reportRing != nullptr)
+    {
+        return 0;
+    }
+
+    AcquireSRWLockShared(&s_internedPathsLock);
+    auto iter = s_internedPaths.find(path);
+    DWORD id = iter != s_internedPaths.end() ? iter->second : 0;
+    bool full = s_internedPaths.size() >= COMPACT_REPORT_MAX_INTERNED_PATHS;
+    ReleaseSRWLockShared(&s_internedPathsLock);
+
+    if (id == 0 && !full)
+    {
+        newId = (DWORD)InterlockedIncrement(&s_lastInternedPathId);
+    }
+
+    return id;
+}
+
+static void CompleteInternedPath(std::wstring&& path, DWORD id)
+{
+    // Another thread may have defined the same path concurrently, either id is fine
+    AcquireSRWLockExclusive(&s_internedPathsLock);
+    s_internedPaths.emplace(std::move(path), id);
+    ReleaseSRWLockExclusive(&s_internedPathsLock);
+}
+
+/**
+ * Sends a file access as a ReportType_CompactFileAccess report: fixed-size fields, then the operation, path, filter
+ * and command line prefixed by their lengths, so nothing needs to be formatted here nor parsed on the managed side.
+ */
+static void SendCompactFileAccessReport(
+    FileOperationContext const& fileOperationContext,
+    FileAccessStatus status,
+    PolicyResult const& policyResult,
+    AccessCheckResult const& accessCheckResult,
+    DWORD error,
+    USN usn,
+    PCWSTR fileName,
+    size_t fileNameLength,
+    PCWSTR filterStr,
+    size_t filterLength)
+{
+    // See ReportFileAccess for why the command line is only sent with the "Process" operation, and why new lines are replaced
+    std::wstring commandLine;
+    if (ReportProcessArgs() && !_wcsicmp(fileOperationContext.Operation, L"Process")) {
+        commandLine.assign(g_currentProcessCommandLine);
+        std::replace(commandLine.begin(), commandLine.end(), L'\r', L' ');
+        std::replace(commandLine.begin(), commandLine.end(), L'\n', L' ');
+    }
+
+    std::wstring internedPath;
+    DWORD newPathId = 0;
+    DWORD pathId = 0;
+    if (fileNameLength > 0)
+    {
+        internedPath.assign(fileName, fileNameLength);
+        pathId = LookupInternedPath(internedPath, newPathId);
+    }
+
+    PCWSTR path = fileName;
+    size_t pathLength = fileNameLength;
+    std::wstring internedDirectory;
+    DWORD newDirectoryId = 0;
+    DWORD directoryId = 0;
+    size_t directoryLength = 0;
+    if (pathId != 0)
+    {
+        // Only the id is sent
+        pathLength = 0;
+    }
+    else
+    {
+        pathId = newPathId;
+
+        // The path travels relative to its parent directory, which only travels with the first report of a file in it
+        size_t prefixLength = fileNameLength;
+        while (prefixLength > 0 && fileName[prefixLength - 1] != L'\\')
+        {
+            prefixLength--;
+        }
+
+        if (prefixLength >= COMPACT_REPORT_MIN_INTERNED_DIRECTORY_LENGTH && prefixLength < fileNameLength)
+        {
+            internedDirectory.assign(fileName, prefixLength);
+            directoryId = LookupInternedPath(internedDirectory, newDirectoryId);
+            if (directoryId == 0 && newDirectoryId != 0)
+            {
+                directoryId = newDirectoryId;
+                directoryLength = prefixLength;
+            }
+
+            if (directoryId != 0)
+            {
+                path = fileName + prefixLength;
+                pathLength = fileNameLength - prefixLength;
+            }
+        }
+    }
+
+    size_t operationLength = wcslen(fileOperationContext.Operation);
+    size_t reportBufferSize = 2 + COMPACT_REPORT_HEADER_LENGTH + operationLength + directoryLength + pathLength + filterLength + commandLine.length() + 3; // in characters
+
+    unique_ptr<wchar_t[]> report(new wchar_t[reportBufferSize]);
+    assert(report.get());
+
+    wchar_t* cursor = report.get();
+    *cursor++ = L'0' + (wchar_t)ReportType::ReportType_CompactFileAccess;
+    *cursor++ = L',';
+    cursor = AppendCompactUnits(cursor, COMPACT_REPORT_VERSION, 1);
+    cursor = AppendCompactUnits(cursor, g_currentProcessId, 3);
+    cursor = AppendCompactUnits(cursor, fileOperationContext.Id, 3);
+    cursor = AppendCompactUnits(cursor, fileOperationContext.CorrelationId, 3);
+    cursor = AppendCompactUnits(cursor, (ULONG64)accessCheckResult.Access, 1);
+    cursor = AppendCompactUnits(cursor, (ULONG64)status, 1);
+    cursor = AppendCompactUnits(cursor, accessCheckResult.Level == ReportLevel::ReportExplicit ? 1 : 0, 1);
+    cursor = AppendCompactUnits(cursor, error, 3);
+    cursor = AppendCompactUnits(cursor, (ULONG64)usn, 5);
+    cursor = AppendCompactUnits(cursor, fileOperationContext.DesiredAccess, 3);
+    cursor = AppendCompactUnits(cursor, fileOperationContext.ShareMode, 3);
+    cursor = AppendCompactUnits(cursor, fileOperationContext.CreationDisposition, 3);
+    cursor = AppendCompactUnits(cursor, fileOperationContext.FlagsAndAttributes, 3);
+    cursor = AppendCompactUnits(cursor, fileOperationContext.OpenedFileOrDirectoryAttributes, 3);
+    cursor = AppendCompactUnits(cursor, policyResult.IsIndeterminate() ? 0 : policyResult.GetPathId(), 3);
+    cursor = AppendCompactUnits(cursor, pathId, 3);
+    cursor = AppendCompactUnits(cursor, directoryId, 3);
+    cursor = AppendCompactUnits(cursor, operationLength, 2);
+    cursor = AppendCompactUnits(cursor, directoryLength, 2);
+    cursor = AppendCompactUnits(cursor, pathLength, 2);
+    cursor = AppendCompactUnits(cursor, filterLength, 2);
+    cursor = AppendCompactUnits(cursor, commandLine.length(), 2);
+    cursor = AppendCompactString(cursor, fileOperationContext.Operation, operationLength);
+    cursor = AppendCompactString(cursor, fileName, directoryLength);
+    cursor = AppendCompactString(cursor, path, pathLength);
+    cursor = AppendCompactString(cursor, filterStr, filterLength);
+    cursor = AppendCompactString(cursor, commandLine.c_str(), commandLine.length());
+    *cursor++ = L'\r';
+    *cursor++ = L'\n';
+    *cursor = L'\0';
+
+    assert((size_t)(cursor - report.get()) < reportBufferSize);
+
+    bool batched = SendReport(report.get(), /* batch */ true);
+
+    // Later reports may only refer to the path (and its directory) once its definition is on its way
+    if (newPathId != 0)
+    {
+        if (batched)
+        {
+            DeferInternedPath(std::move(internedPath), newPathId);
+        }
+        else
+        {
+            CompleteInternedPath(std::move(internedPath), newPathId);
+        }
+    }
+
+    if (directoryLength != 0)
+    {
+        if (batched)
+        {
+            DeferInternedPath(std::move(internedDirectory), newDirectoryId);
+        }
+        else
+        {
+            CompleteInternedPath(std::move(internedDirectory), newDirectoryId);
+        }
+    }
+}
+
 // ----------------------------------------------------------------------------
 // FUNCTION DEFINITIONS
 // ----------------------------------------------------------------------------
@@ -146,6 +729,12 @@ void ReportFileAccess(
     }
 
     size_t filterLength = wcslen(filterStr); // in characters
+
+    if (CheckEnableCompactFileAccessReports(g_fileAccessManifestExtraFlags)) {
+        SendCompactFileAccessReport(fileOperationContext, status, policyResult, accessCheckResult, error, usn, fileName, fileNameLength, filterStr, filterLength);
+        return;
+    }
+
     size_t fileProcessCommandLineLength = wcslen(g_currentProcessCommandLine); // in characters
     size_t operationLen = wcslen(fileOperationContext.Operation); // in characters
     size_t reportBufferSize = fileNameLength + filterLength + fileProcessCommandLineLength + operationLen + 116; // in characters
@@ -244,7 +833,7 @@ void ReportFileAccess(
     }
     else
     {
-        SendReportString(report.get());
+        SendReport(report.get(), /* batch */ true);
     }
 }
 
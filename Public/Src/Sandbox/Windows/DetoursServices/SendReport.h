@@ -47,3 +47,14 @@ void ReportProcessDetouringStatus(
     const BOOL detoured,
     const DWORD error,
     const CreateDetouredProcessStatus createProcessStatus);
+
+// Releases the message-count semaphore by the number of reports sent since it was last released. The host compares the final
+// count of the semaphore with the number of reports it received (see CheckDetoursMessageCount).
+void PublishMessageCount();
+
+// Writes the batched reports of every thread to the report pipe (see FileAccessManifestExtraFlag::EnableReportBatching).
+// When the process is exiting, batches whose thread was terminated while holding them are skipped.
+void FlushAllReportBatches(bool processExit);
+
+// Writes the batched reports of the current thread and frees its batch, called when the thread exits.
+void ReleaseCurrentThreadReportBatch();
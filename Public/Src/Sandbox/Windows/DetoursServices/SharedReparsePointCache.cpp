@@ -0,0 +1,285 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include "DebuggingHelpers.h"
+#include "SharedReparsePointCache.h"
+#include "StringOperations.h"
+
+// Probing stops after this many slots, the path is then not cached
+#define SHARED_REPARSE_POINT_CACHE_MAX_PROBES 32
+
+// Only set when the host created a cache for the pip
+static SharedReparsePointCacheHeader* s_sharedReparsePointCache = nullptr;
+
+static SharedReparsePointCacheSlot* GetSlots(SharedReparsePointCacheHeader* cache)
+{
+    return reinterpret_cast<SharedReparsePointCacheSlot*>(cache + 1);
+}
+
+static BYTE* GetRecords(SharedReparsePointCacheHeader* cache)
+{
+    return reinterpret_cast<BYTE*>(GetSlots(cache) + cache->SlotCount);
+}
+
+static const wchar_t* GetRecordChars(const SharedReparsePointCacheRecord* record)
+{
+    return reinterpret_cast<const wchar_t*>(record + 1);
+}
+
+// Paths are stored without their prefix and trailing separator, so all the spellings of a path share their entry
+static void NormalizeForSharedReparsePointCache(const std::wstring& path, const wchar_t*& normalizedPath, size_t& length)
+{
+    normalizedPath = GetPathWithoutPrefix(path.c_str());
+    length = path.size() - (size_t)(normalizedPath - path.c_str());
+    if (length > 0 && IsDirectorySeparator(normalizedPath[length - 1]))
+    {
+        length--;
+    }
+}
+
+static LONG64 GetPathHash(const wchar_t* path, size_t length)
+{
+    // 0 marks empty slots
+    uint64_t hash = HashPath64(path, length);
+    return hash == 0 ? 1 : (LONG64)hash;
+}
+
+// Returns the record of a slot's value, or nullptr if the value is empty, stale or invalid
+static const SharedReparsePointCacheRecord* GetRecord(SharedReparsePointCacheHeader* cache, LONG64 value)
+{
+    UINT32 index = (UINT32)(value & 0xFFFFFFFF);
+    if (index == 0 || (UINT32)((ULONG64)value >> 32) != (UINT32)cache->Generation)
+    {
+        return nullptr;
+    }
+
+    // Other processes write the image, don't trust it blindly
+    size_t offset = (size_t)(index - 1) * SHARED_REPARSE_POINT_CACHE_RECORD_ALIGNMENT;
+    if (offset + sizeof(SharedReparsePointCacheRecord) > cache->DataCapacity)
+    {
+        return nullptr;
+    }
+
+    const SharedReparsePointCacheRecord* record = reinterpret_cast<const SharedReparsePointCacheRecord*>(GetRecords(cache) + offset);
+    if (offset + sizeof(SharedReparsePointCacheRecord) + ((size_t)record->PathLength + record->TargetLength) * sizeof(wchar_t) > cache->DataCapacity)
+    {
+        return nullptr;
+    }
+
+    return record;
+}
+
+static bool RecordMatches(const SharedReparsePointCacheRecord* record, const wchar_t* path, size_t length)
+{
+    if (record->PathLength != length)
+    {
+        return false;
+    }
+
+    const wchar_t* chars = GetRecordChars(record);
+    for (size_t i = 0; i < length; i++)
+    {
+        if (NormalizePathChar(chars[i]) != NormalizePathChar(path[i]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool OpenSharedReparsePointCache(_In_z_ PCWSTR cacheName)
+{
+    HANDLE mapping = OpenFileMappingW(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, cacheName);
+    if (mapping == NULL)
+    {
+        Dbg(L"OpenSharedReparsePointCache: Failed to open reparse point cache '%s' (error code: 0x%08X)", cacheName, (int)GetLastError());
+        return false;
+    }
+
+    // The view keeps the section alive, so the mapping handle is not needed anymore
+    SharedReparsePointCacheHeader* cache = reinterpret_cast<SharedReparsePointCacheHeader*>(MapViewOfFile(mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, 0));
+    CloseHandle(mapping);
+
+    if (cache == nullptr)
+    {
+        Dbg(L"OpenSharedReparsePointCache: Failed to map reparse point cache '%s' (error code: 0x%08X)", cacheName, (int)GetLastError());
+        return false;
+    }
+
+    MEMORY_BASIC_INFORMATION info;
+    size_t viewSize = VirtualQuery(cache, &info, sizeof(info)) == sizeof(info) ? info.RegionSize : 0;
+
+    if (cache->Magic != SHARED_REPARSE_POINT_CACHE_MAGIC
+        || cache->SlotCount == 0
+        || (cache->SlotCount & (cache->SlotCount - 1)) != 0
+        || sizeof(SharedReparsePointCacheHeader) + (size_t)cache->SlotCount * sizeof(SharedReparsePointCacheSlot) + cache->DataCapacity > viewSize)
+    {
+        Dbg(L"OpenSharedReparsePointCache: Reparse point cache '%s' is not valid (magic: 0x%08X, slots: %u, data capacity: %u)",
+            cacheName, cache->Magic, cache->SlotCount, cache->DataCapacity);
+        UnmapViewOfFile(cache);
+        return false;
+    }
+
+    s_sharedReparsePointCache = cache;
+    return true;
+}
+
+bool IsSharedReparsePointCacheEnabled()
+{
+    return s_sharedReparsePointCache != nullptr;
+}
+
+bool TryGetSharedReparsePointTarget(_In_ const std::wstring& path, _Out_ std::wstring& target, _Out_ DWORD& reparsePointType)
+{
+    reparsePointType = 0;
+
+    SharedReparsePointCacheHeader* cache = s_sharedReparsePointCache;
+    if (cache == nullptr)
+    {
+        return false;
+    }
+
+    const wchar_t* normalizedPath;
+    size_t length;
+    NormalizeForSharedReparsePointCache(path, normalizedPath, length);
+
+    SharedReparsePointCacheSlot* slots = GetSlots(cache);
+    const LONG64 hash = GetPathHash(normalizedPath, length);
+    const UINT32 mask = cache->SlotCount - 1;
+    UINT32 index = (UINT32)hash & mask;
+
+    for (int probe = 0; probe < SHARED_REPARSE_POINT_CACHE_MAX_PROBES; probe++, index = (index + 1) & mask)
+    {
+        LONG64 current = slots[index].Hash;
+        if (current == 0)
+        {
+            // Slots are never released, so the path can't be further away
+            return false;
+        }
+
+        if (current != hash)
+        {
+            continue;
+        }
+
+        const SharedReparsePointCacheRecord* record = GetRecord(cache, slots[index].Value);
+        if (record != nullptr && RecordMatches(record, normalizedPath, length))
+        {
+            target.assign(GetRecordChars(record) + record->PathLength, record->TargetLength);
+            reparsePointType = record->ReparsePointType;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void PublishSharedReparsePointTarget(_In_ const std::wstring& path, _In_ const std::wstring& target, DWORD reparsePointType)
+{
+    SharedReparsePointCacheHeader* cache = s_sharedReparsePointCache;
+    if (cache == nullptr)
+    {
+        return;
+    }
+
+    const wchar_t* normalizedPath;
+    size_t length;
+    NormalizeForSharedReparsePointCache(path, normalizedPath, length);
+
+    // Read the generation before writing the record: if a directory is invalidated meanwhile, the value is stale right away
+    const LONG64 generation = cache->Generation;
+
+    // Allocate and fill the record first, it is only visible to other processes once a slot points to it
+    const size_t recordSize = (sizeof(SharedReparsePointCacheRecord) + (length + target.size()) * sizeof(wchar_t) + SHARED_REPARSE_POINT_CACHE_RECORD_ALIGNMENT - 1)
+        & ~(size_t)(SHARED_REPARSE_POINT_CACHE_RECORD_ALIGNMENT - 1);
+    if (recordSize > cache->DataCapacity)
+    {
+        return;
+    }
+
+    const LONG64 offset = InterlockedExchangeAdd64(&cache->DataPosition, (LONG64)recordSize);
+    if (offset < 0 || offset + (LONG64)recordSize > (LONG64)cache->DataCapacity)
+    {
+        // Full. DataPosition keeps growing past the capacity, which is harmless.
+        return;
+    }
+
+    SharedReparsePointCacheRecord* record = reinterpret_cast<SharedReparsePointCacheRecord*>(GetRecords(cache) + offset);
+    record->ReparsePointType = reparsePointType;
+    record->PathLength = (UINT32)length;
+    record->TargetLength = (UINT32)target.size();
+    record->Padding = 0;
+    wchar_t* chars = reinterpret_cast<wchar_t*>(record + 1);
+    memcpy(chars, normalizedPath, length * sizeof(wchar_t));
+    memcpy(chars + length, target.c_str(), target.size() * sizeof(wchar_t));
+
+    const LONG64 value = ((LONG64)(UINT32)generation << 32) | (LONG64)(offset / SHARED_REPARSE_POINT_CACHE_RECORD_ALIGNMENT + 1);
+
+    SharedReparsePointCacheSlot* slots = GetSlots(cache);
+    const LONG64 hash = GetPathHash(normalizedPath, length);
+    const UINT32 mask = cache->SlotCount - 1;
+    UINT32 index = (UINT32)hash & mask;
+
+    for (int probe = 0; probe < SHARED_REPARSE_POINT_CACHE_MAX_PROBES; probe++, index = (index + 1) & mask)
+    {
+        LONG64 current = slots[index].Hash;
+        if (current == 0)
+        {
+            current = InterlockedCompareExchange64(&slots[index].Hash, hash, 0);
+            if (current == 0)
+            {
+                current = hash;
+            }
+        }
+
+        if (current == hash)
+        {
+            // Paths with the same hash share the slot: the last one published wins, and lookups compare the path of the record.
+            // The interlocked write is a full barrier, so the record is complete before other processes can see it.
+            InterlockedExchange64(&slots[index].Value, value);
+            return;
+        }
+    }
+}
+
+void InvalidateSharedReparsePointCache(_In_ const std::wstring& path, bool isDirectory)
+{
+    SharedReparsePointCacheHeader* cache = s_sharedReparsePointCache;
+    if (cache == nullptr)
+    {
+        return;
+    }
+
+    if (isDirectory)
+    {
+        InterlockedIncrement64(&cache->Generation);
+        return;
+    }
+
+    const wchar_t* normalizedPath;
+    size_t length;
+    NormalizeForSharedReparsePointCache(path, normalizedPath, length);
+
+    SharedReparsePointCacheSlot* slots = GetSlots(cache);
+    const LONG64 hash = GetPathHash(normalizedPath, length);
+    const UINT32 mask = cache->SlotCount - 1;
+    UINT32 index = (UINT32)hash & mask;
+
+    for (int probe = 0; probe < SHARED_REPARSE_POINT_CACHE_MAX_PROBES; probe++, index = (index + 1) & mask)
+    {
+        LONG64 current = slots[index].Hash;
+        if (current == 0)
+        {
+            return;
+        }
+
+        if (current == hash)
+        {
+            // Clearing is conservative: a path sharing the hash just gets resolved again
+            InterlockedExchange64(&slots[index].Value, 0);
+        }
+    }
+}
@@ -0,0 +1,76 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <windows.h>
+#include <string>
+
+// ----------------------------------------------------------------------------
+// SHARED REPARSE POINT CACHE
+// ----------------------------------------------------------------------------
+//
+// CODESYNC: Public/Src/Engine/Processes/Internal/SharedReparsePointCache.cs
+//
+// When FileAccessManifestExtraFlag::EnableSharedReparsePointCache is set, the host creates a named file mapping for the pip
+// (named after the shared-memory name of the manifest's report block, with the SHARED_REPARSE_POINT_CACHE_SUFFIX suffix) where
+// the detoured processes of the pip publish the reparse point targets they resolve. A process consults it before querying a
+// reparse point with DeviceIoControl(FSCTL_GET_REPARSE_POINT), so a child does not resolve again what its parent or its
+// siblings already did. Paths that are not (actionable) reparse points are published too, with a reparse point type of 0.
+//
+// The image is mapped at a different address in each process, so it holds offsets rather than pointers:
+//  - A header, followed by SlotCount slots and then by DataCapacity bytes of records.
+//  - Slots form an insert-only, open addressing table keyed by the hash of the path (see HashPath64). A slot is claimed with a
+//    compare-and-swap on its hash and never released. Its value is the current generation (upper 32 bits) and the index of the
+//    record holding the path and its target (lower 32 bits, 0 means none), and it is replaced with a single interlocked write.
+//  - Records are bump-allocated at DataPosition and never reused: publishing a path again writes a new record. A record holds the
+//    path, which tells apart paths with the same hash, so only values need to be checked.
+// Invalidating a path clears the values of its slots, and invalidating a directory bumps the generation, which drops every value
+// stored so far (the descendants of a directory are not tracked). When the table or the records are full, targets are just not shared.
+
+#define SHARED_REPARSE_POINT_CACHE_MAGIC 0x48435052 // 'RPCH'
+#define SHARED_REPARSE_POINT_CACHE_RECORD_ALIGNMENT 8
+#define SHARED_REPARSE_POINT_CACHE_SUFFIX L"_ReparsePoints"
+
+typedef struct SharedReparsePointCacheHeader_t
+{
+    UINT32 Magic;
+    UINT32 SlotCount;               // A power of 2
+    UINT32 DataCapacity;            // Size in bytes of the records area that follows the slots
+    UINT32 Padding;
+    volatile LONG64 DataPosition;   // Offset of the next record to allocate
+    volatile LONG64 Generation;     // Values of other generations are stale
+} SharedReparsePointCacheHeader;
+
+typedef struct SharedReparsePointCacheSlot_t
+{
+    volatile LONG64 Hash;
+    volatile LONG64 Value;
+} SharedReparsePointCacheSlot;
+
+typedef struct SharedReparsePointCacheRecord_t
+{
+    DWORD ReparsePointType;         // 0 if the path is not an (actionable) reparse point
+    UINT32 PathLength;              // In characters, no null terminator
+    UINT32 TargetLength;            // In characters, no null terminator
+    UINT32 Padding;
+    // Followed by the path and the target
+} SharedReparsePointCacheRecord;
+
+static_assert(sizeof(SharedReparsePointCacheHeader) == 32, "The layout of the cache header must match SharedReparsePointCache.cs");
+static_assert(sizeof(SharedReparsePointCacheSlot) == 16, "The layout of the cache slots must match SharedReparsePointCache.cs");
+
+// Maps the cache with the given name. Returns false (and leaves the cache unused) if it can't be opened.
+bool OpenSharedReparsePointCache(_In_z_ PCWSTR cacheName);
+
+// Whether the cache is in use in this process
+bool IsSharedReparsePointCacheEnabled();
+
+// Looks up the path, returning its target and reparse point type (0 for a path that is not a reparse point) if some process published them
+bool TryGetSharedReparsePointTarget(_In_ const std::wstring& path, _Out_ std::wstring& target, _Out_ DWORD& reparsePointType);
+
+// Publishes the target of the path for the other processes of the pip. Best effort.
+void PublishSharedReparsePointTarget(_In_ const std::wstring& path, _In_ const std::wstring& target, DWORD reparsePointType);
+
+// Drops what is stored for the path, and for all paths if it is a directory
+void InvalidateSharedReparsePointCache(_In_ const std::wstring& path, bool isDirectory);
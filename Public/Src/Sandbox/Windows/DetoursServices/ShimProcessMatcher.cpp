@@ -0,0 +1,239 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "ShimProcessMatcher.h"
+
+// If we are building this for tests, we don't want to use the builxl private heap that only exists when running under detours
+#ifndef TEST
+    #include "stdafx.h"
+    #include "buildXL_mem.h"
+#endif
+
+#include <assert.h>
+#include <wchar.h>
+#include <algorithm>
+
+static const uint32_t EmptySlot = 0;
+
+uint32_t ShimProcessMatcher::PrependToHash(uint32_t hash, wchar_t c) noexcept
+{
+    if (c >= L'a' && c <= L'z')
+    {
+        c = (wchar_t)(c - L'a' + L'A');
+    }
+    else if (c >= 0x80)
+    {
+        c = 0x80;
+    }
+
+    return (hash ^ (uint32_t)c) * 16777619U;
+}
+
+void ShimProcessMatcher::AddRule(const wchar_t* processName, size_t processNameLength, const wchar_t* argumentMatch, size_t argumentMatchLength)
+{
+    assert(!m_sealed);
+
+    if (processName == nullptr || processNameLength == 0)
+    {
+        // An empty process name never matches a command
+        return;
+    }
+
+    auto existing = std::find_if(m_names.begin(), m_names.end(), [&](const ProcessName& name)
+    {
+        return name.Name.length() == processNameLength && _wcsnicmp(name.Name.c_str(), processName, processNameLength) == 0;
+    });
+
+    if (existing == m_names.end())
+    {
+        ProcessName name;
+        name.Name.assign(processName, processNameLength);
+        name.Hash = 2166136261U;
+        for (size_t i = processNameLength; i > 0; i--)
+        {
+            name.Hash = PrependToHash(name.Hash, processName[i - 1]);
+        }
+
+        name.MatchesAnyArguments = false;
+        name.Root = 0;
+        m_names.push_back(std::move(name));
+        existing = m_names.end() - 1;
+    }
+
+    if (argumentMatch == nullptr || argumentMatchLength == 0)
+    {
+        // wcsstr finds an empty string in any arguments
+        existing->MatchesAnyArguments = true;
+    }
+    else
+    {
+        existing->ArgumentMatches.emplace_back(argumentMatch, argumentMatchLength);
+    }
+}
+
+void ShimProcessMatcher::Seal()
+{
+    assert(!m_sealed);
+    m_sealed = true;
+
+    // Keep the table at most half full
+    size_t tableSize = 16;
+    while (tableSize < m_names.size() * 2)
+    {
+        tableSize *= 2;
+    }
+
+    m_table.assign(tableSize, EmptySlot);
+    for (size_t i = 0; i < m_names.size(); i++)
+    {
+        size_t slot = m_names[i].Hash & (tableSize - 1);
+        while (m_table[slot] != EmptySlot)
+        {
+            slot = (slot + 1) & (tableSize - 1);
+        }
+
+        m_table[slot] = (uint32_t)(i + 1);
+
+        if (!m_names[i].MatchesAnyArguments)
+        {
+            m_names[i].Root = BuildAutomaton(m_names[i].ArgumentMatches);
+        }
+    }
+}
+
+uint32_t ShimProcessMatcher::BuildAutomaton(const std::vector<std::wstring>& argumentMatches)
+{
+    uint32_t root = (uint32_t)m_nodes.size();
+    m_nodes.push_back(AutomatonNode { {}, root, false });
+
+    // Trie of the argument matches
+    for (const std::wstring& argumentMatch : argumentMatches)
+    {
+        uint32_t node = root;
+        for (wchar_t c : argumentMatch)
+        {
+            std::vector<std::pair<wchar_t, uint32_t>>& edges = m_nodes[node].Edges;
+            auto edge = std::lower_bound(edges.begin(), edges.end(), c, [](const std::pair<wchar_t, uint32_t>& e, wchar_t value) { return e.first < value; });
+            if (edge != edges.end() && edge->first == c)
+            {
+                node = edge->second;
+                continue;
+            }
+
+            uint32_t child = (uint32_t)m_nodes.size();
+            edges.insert(edge, std::make_pair(c, child));
+            m_nodes.push_back(AutomatonNode { {}, root, false });
+            node = child;
+        }
+
+        m_nodes[node].Accepts = true;
+    }
+
+    // Failure links, breadth first so the failure node of a node is always complete before the node itself
+    std::vector<uint32_t> queue;
+    for (const auto& edge : m_nodes[root].Edges)
+    {
+        queue.push_back(edge.second);
+    }
+
+    for (size_t i = 0; i < queue.size(); i++)
+    {
+        uint32_t node = queue[i];
+        for (size_t e = 0; e < m_nodes[node].Edges.size(); e++)
+        {
+            wchar_t c = m_nodes[node].Edges[e].first;
+            uint32_t child = m_nodes[node].Edges[e].second;
+
+            uint32_t failure = Next(root, m_nodes[node].Failure, c);
+            m_nodes[child].Failure = failure;
+            m_nodes[child].Accepts = m_nodes[child].Accepts || m_nodes[failure].Accepts;
+            queue.push_back(child);
+        }
+    }
+
+    return root;
+}
+
+uint32_t ShimProcessMatcher::Next(uint32_t root, uint32_t node, wchar_t c) const noexcept
+{
+    while (true)
+    {
+        const std::vector<std::pair<wchar_t, uint32_t>>& edges = m_nodes[node].Edges;
+        auto edge = std::lower_bound(edges.begin(), edges.end(), c, [](const std::pair<wchar_t, uint32_t>& e, wchar_t value) { return e.first < value; });
+        if (edge != edges.end() && edge->first == c)
+        {
+            return edge->second;
+        }
+
+        if (node == root)
+        {
+            return root;
+        }
+
+        node = m_nodes[node].Failure;
+    }
+}
+
+const ShimProcessMatcher::ProcessName* ShimProcessMatcher::Find(const wchar_t* name, size_t length, uint32_t hash) const noexcept
+{
+    size_t mask = m_table.size() - 1;
+    for (size_t slot = hash & mask; m_table[slot] != EmptySlot; slot = (slot + 1) & mask)
+    {
+        const ProcessName& candidate = m_names[m_table[slot] - 1];
+        if (candidate.Hash == hash && candidate.Name.length() == length && _wcsnicmp(candidate.Name.c_str(), name, length) == 0)
+        {
+            return &candidate;
+        }
+    }
+
+    return nullptr;
+}
+
+bool ShimProcessMatcher::ContainsArgumentMatch(const ProcessName& processName, const wchar_t* commandArgs, size_t commandArgsLength) const noexcept
+{
+    if (processName.MatchesAnyArguments)
+    {
+        return true;
+    }
+
+    uint32_t node = processName.Root;
+    for (size_t i = 0; i < commandArgsLength; i++)
+    {
+        node = Next(processName.Root, node, commandArgs[i]);
+        if (m_nodes[node].Accepts)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool ShimProcessMatcher::Matches(const wchar_t* command, size_t commandLength, const wchar_t* commandArgs, size_t commandArgsLength) const noexcept
+{
+    assert(m_sealed);
+
+    if (m_names.empty() || commandLength == 0)
+    {
+        return false;
+    }
+
+    // Every suffix that is the whole command or follows a '\' is a candidate process name. Hashing backwards gives the
+    // hash of each of them along the way.
+    uint32_t hash = 2166136261U;
+    for (size_t start = commandLength; start > 0; start--)
+    {
+        hash = PrependToHash(hash, command[start - 1]);
+
+        if (start - 1 == 0 || command[start - 2] == L'\\')
+        {
+            const ProcessName* processName = Find(command + start - 1, commandLength - start + 1, hash);
+            if (processName != nullptr && ContainsArgumentMatch(*processName, commandArgs, commandArgsLength))
+            {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
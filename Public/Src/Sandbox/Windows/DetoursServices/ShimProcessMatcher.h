@@ -0,0 +1,92 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#if defined(_DO_NOT_EXPORT)
+#define EXPORT  
+#else
+#define EXPORT __declspec(dllexport)
+#endif
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+// CODESYNC: SubstituteProcessExecutionInfo.cs :: ShimProcessMatch class
+// Compiled form of the ShimProcessMatch rules of the substitute process execution shim.
+//
+// A rule matches a command when the command is the process name of the rule, or ends with '\' followed by it
+// (case-insensitively), and, when the rule has an argument match, the arguments contain it (case-sensitively).
+// The rules are compiled once, the first time a rule is needed: process names go in a hash table, and the argument
+// matches of each process name in an Aho-Corasick automaton. Deciding whether a command matches any rule then takes
+// one pass over the command and one pass over the arguments per matching process name (usually just one), without
+// allocating.
+//
+// The matcher is immutable once sealed, so it can be used concurrently.
+class ShimProcessMatcher
+{
+public:
+    EXPORT ShimProcessMatcher() : m_sealed(false) { }
+
+    ShimProcessMatcher(const ShimProcessMatcher&) = delete;
+    ShimProcessMatcher& operator=(const ShimProcessMatcher&) = delete;
+
+    // Adds a rule. A null or empty argumentMatch matches any arguments. Rules cannot be added once the matcher is sealed.
+    EXPORT void AddRule(const wchar_t* processName, const wchar_t* argumentMatch)
+    {
+        AddRule(processName, processName == nullptr ? 0 : wcslen(processName), argumentMatch, argumentMatch == nullptr ? 0 : wcslen(argumentMatch));
+    }
+
+    // Same as above, but the strings need not be null-terminated (e.g., they can point into the manifest payload).
+    EXPORT void AddRule(const wchar_t* processName, size_t processNameLength, const wchar_t* argumentMatch, size_t argumentMatchLength);
+
+    // Builds the hash table and the automata. Must be called once all the rules are added, before calling Matches.
+    EXPORT void Seal();
+
+    EXPORT bool IsEmpty() const noexcept { return m_names.empty(); }
+
+    // Returns whether any rule matches the command (without quotes) and its arguments.
+    EXPORT bool Matches(const wchar_t* command, size_t commandLength, const wchar_t* commandArgs, size_t commandArgsLength) const noexcept;
+
+private:
+    struct ProcessName
+    {
+        std::wstring Name;
+        uint32_t Hash;
+        bool MatchesAnyArguments;
+        std::vector<std::wstring> ArgumentMatches;
+
+        // Root of the automaton of ArgumentMatches in m_nodes
+        uint32_t Root;
+    };
+
+    struct AutomatonNode
+    {
+        // Sorted by character
+        std::vector<std::pair<wchar_t, uint32_t>> Edges;
+        uint32_t Failure;
+
+        // Whether an argument match ends here, or at a node on the failure chain of this one
+        bool Accepts;
+    };
+
+    // Hash of a process name, computed from its last character backwards so that the hash of every suffix of a command
+    // is computed in a single pass. It only folds the case of ASCII characters and hashes other characters to the same
+    // value, so that names that compare equal with _wcsnicmp always have the same hash, whatever the locale.
+    static uint32_t PrependToHash(uint32_t hash, wchar_t c) noexcept;
+
+    const ProcessName* Find(const wchar_t* name, size_t length, uint32_t hash) const noexcept;
+    uint32_t BuildAutomaton(const std::vector<std::wstring>& argumentMatches);
+    uint32_t Next(uint32_t root, uint32_t node, wchar_t c) const noexcept;
+    bool ContainsArgumentMatch(const ProcessName& processName, const wchar_t* commandArgs, size_t commandArgsLength) const noexcept;
+
+    bool m_sealed;
+    std::vector<ProcessName> m_names;
+
+    // Open addressing table of indices in m_names plus one (zero marks an empty slot), with a power of two size
+    std::vector<uint32_t> m_table;
+
+    std::vector<AutomatonNode> m_nodes;
+};
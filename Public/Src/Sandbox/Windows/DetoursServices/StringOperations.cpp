@@ -14,6 +14,12 @@
 #include <pathcch.h>
 #endif
 
+// x64 always has SSE2. Paths are UTF-16 on Windows only, so that's the only place where the kernels below apply.
+#if _WIN32 && defined(_M_X64) && !defined(_M_ARM64EC)
+#include <emmintrin.h>
+#define PATH_CHARS_SIMD 1
+#endif
+
 #define _MAX_EXTENDED_DIR_LENGTH (_MAX_EXTENDED_PATH_LENGTH - _MAX_DRIVE - _MAX_FNAME - _MAX_EXT - 4)
 #define _MAX_EXTENDED_PATH_LENGTH 32768 // see https://docs.microsoft.com/en-us/cpp/c-runtime-library/path-field-limits?view=vs-2019
 
@@ -30,6 +36,8 @@
 
 constexpr DWORD Fnv1Prime32 = 16777619;
 constexpr DWORD Fnv1Basis32 = static_cast<const unsigned int>(2166136261);
+constexpr uint64_t Fnv1Prime64 = 0x100000001b3ULL;
+constexpr uint64_t Fnv1Basis64 = 0xcbf29ce484222325ULL;
 
 constexpr inline static DWORD _Fold(DWORD hash, BYTE value) noexcept
 {
@@ -41,6 +49,103 @@ constexpr inline static DWORD Fold(DWORD hash, WORD value) noexcept
     return _Fold(_Fold(hash, (BYTE)value), (BYTE)(((WORD)value) >> 8));
 }
 
+#if PATH_CHARS_SIMD
+
+// The kernels below handle blocks of 8 characters: the ones where all characters are ASCII (almost all of them in practice) are
+// normalized at once, and the other ones go through NormalizePathChar. For ASCII characters, towupper only maps a-z to A-Z
+// regardless of the locale, so both give the same result.
+constexpr size_t PathCharsPerBlock = sizeof(__m128i) / sizeof(PathChar);
+
+inline static __m128i LoadPathChars(PCPathChar chars) noexcept
+{
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(chars));
+}
+
+inline static bool IsAsciiBlock(__m128i chars) noexcept
+{
+    const __m128i nonAsciiBits = _mm_and_si128(chars, _mm_set1_epi16(static_cast<short>(0xFF80)));
+    return _mm_movemask_epi8(_mm_cmpeq_epi16(nonAsciiBits, _mm_setzero_si128())) == 0xFFFF;
+}
+
+// Applies NormalizePathChar to a block of ASCII characters
+inline static __m128i NormalizeAsciiBlock(__m128i chars) noexcept
+{
+    const __m128i isLowercase = _mm_and_si128(
+        _mm_cmpgt_epi16(chars, _mm_set1_epi16('a' - 1)),
+        _mm_cmplt_epi16(chars, _mm_set1_epi16('z' + 1)));
+    return _mm_sub_epi16(chars, _mm_and_si128(isLowercase, _mm_set1_epi16('a' - 'A')));
+}
+
+inline static bool AreBlocksEqual(__m128i chars1, __m128i chars2) noexcept
+{
+    return _mm_movemask_epi8(_mm_cmpeq_epi16(chars1, chars2)) == 0xFFFF;
+}
+
+// Loads a block and applies NormalizePathChar to it, falling back to the scalar normalization when it is not all ASCII
+inline static __m128i LoadNormalizedBlock(PCPathChar chars) noexcept
+{
+    const __m128i block = LoadPathChars(chars);
+    if (IsAsciiBlock(block)) {
+        return NormalizeAsciiBlock(block);
+    }
+
+    alignas(16) PathChar normalized[PathCharsPerBlock];
+    for (size_t i = 0; i < PathCharsPerBlock; i++) {
+        normalized[i] = NormalizePathChar(chars[i]);
+    }
+
+    return _mm_load_si128(reinterpret_cast<const __m128i*>(normalized));
+}
+
+inline static DWORD FoldBlock(DWORD hash, __m128i normalized) noexcept
+{
+    alignas(16) WORD chars[PathCharsPerBlock];
+    _mm_store_si128(reinterpret_cast<__m128i*>(chars), normalized);
+    for (size_t i = 0; i < PathCharsPerBlock; i++) {
+        hash = Fold(hash, chars[i]);
+    }
+
+    return hash;
+}
+
+// Compares 'length' characters of both strings, ignoring case for ASCII blocks and using 'areCharsEqual' for the other ones
+template <typename CharsEqual>
+static bool AreCharsEqualIgnoringCase(PCPathChar chars1, PCPathChar chars2, size_t length, CharsEqual areCharsEqual) noexcept
+{
+    size_t i = 0;
+    for (; i + PathCharsPerBlock <= length; i += PathCharsPerBlock) {
+        const __m128i block1 = LoadPathChars(chars1 + i);
+        const __m128i block2 = LoadPathChars(chars2 + i);
+        if (AreBlocksEqual(block1, block2)) {
+            continue;
+        }
+
+        if (IsAsciiBlock(block1) && IsAsciiBlock(block2)) {
+            if (!AreBlocksEqual(NormalizeAsciiBlock(block1), NormalizeAsciiBlock(block2))) {
+                return false;
+            }
+
+            continue;
+        }
+
+        for (size_t j = i; j < i + PathCharsPerBlock; j++) {
+            if (!areCharsEqual(chars1[j], chars2[j])) {
+                return false;
+            }
+        }
+    }
+
+    for (; i < length; i++) {
+        if (!areCharsEqual(chars1[i], chars2[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+#endif // PATH_CHARS_SIMD
+
 #pragma warning( push )
 #pragma warning( disable : 4100) // 'nBufferLength' : unreferenced formal parameter // in Release builds
 DWORD WINAPI NormalizeAndHashPath(
@@ -54,8 +159,17 @@ DWORD WINAPI NormalizeAndHashPath(
 
     // not the fastest hashing implementation, but gives awesome distribution
     DWORD hash = Fnv1Basis32;
-    size_t i;
-    for (i = 0; pPath[i]; i++) {
+    size_t i = 0;
+#if PATH_CHARS_SIMD
+    const size_t length = pathlen(pPath);
+    for (; i + PathCharsPerBlock <= length; i += PathCharsPerBlock) {
+        const __m128i normalized = LoadNormalizedBlock(pPath + i);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(((PPathChar)pBuffer) + i), normalized);
+        hash = FoldBlock(hash, normalized);
+    }
+#endif // PATH_CHARS_SIMD
+
+    for (; pPath[i]; i++) {
         const PathChar c = NormalizePathChar(pPath[i]);
         ((PPathChar)pBuffer)[i] = c;
         hash = Fold(hash, c);
@@ -76,8 +190,14 @@ DWORD WINAPI HashPath(
 
     // not the fastest hashing implementation, but gives awesome distribution
     DWORD hash = Fnv1Basis32;
-    size_t i;
-    for (i = 0; i < nLength; i++) {
+    size_t i = 0;
+#if PATH_CHARS_SIMD
+    for (; i + PathCharsPerBlock <= nLength; i += PathCharsPerBlock) {
+        hash = FoldBlock(hash, LoadNormalizedBlock(pPath + i));
+    }
+#endif // PATH_CHARS_SIMD
+
+    for (; i < nLength; i++) {
         const PathChar c = NormalizePathChar(pPath[i]);
         hash = Fold(hash, c);
     }
@@ -85,6 +205,34 @@ DWORD WINAPI HashPath(
     return hash;
 }
 
+uint64_t HashPath64(
+    __in_ecount(nLength)        PCPathChar pPath,
+    __in                        size_t nLength) noexcept
+{
+    assert(pPath != nullptr || nLength == 0);
+
+    // FNV-1a over whole characters
+    uint64_t hash = Fnv1Basis64;
+    size_t i = 0;
+#if PATH_CHARS_SIMD
+    for (; i + PathCharsPerBlock <= nLength; i += PathCharsPerBlock) {
+        alignas(16) WORD chars[PathCharsPerBlock];
+        _mm_store_si128(reinterpret_cast<__m128i*>(chars), LoadNormalizedBlock(pPath + i));
+        for (size_t j = 0; j < PathCharsPerBlock; j++) {
+            hash ^= (uint64_t)chars[j];
+            hash *= Fnv1Prime64;
+        }
+    }
+#endif // PATH_CHARS_SIMD
+
+    for (; i < nLength; i++) {
+        hash ^= (uint64_t)NormalizePathChar(pPath[i]);
+        hash *= Fnv1Prime64;
+    }
+
+    return hash;
+}
+
 BOOL WINAPI AreBuffersEqual(
     __in_ecount(nBufferLength)    PBYTE pBuffer1,
     __in_ecount(nBufferLength)    PBYTE pBuffer2,
@@ -101,8 +249,16 @@ BOOL WINAPI ArePathsEqual(
     assert(pPath != nullptr);
     assert(pNormalizedPath != nullptr);
 
-    size_t i;
-    for (i = 0; i < nLength; i++) {
+    size_t i = 0;
+#if PATH_CHARS_SIMD
+    for (; i + PathCharsPerBlock <= nLength; i += PathCharsPerBlock) {
+        if (!AreBlocksEqual(LoadNormalizedBlock(pPath + i), LoadPathChars(pNormalizedPath + i))) {
+            return false;
+        }
+    }
+#endif // PATH_CHARS_SIMD
+
+    for (; i < nLength; i++) {
         const PathChar c = NormalizePathChar(pPath[i]);
         if (c != pNormalizedPath[i]) {
             return false;
@@ -257,6 +413,11 @@ bool IsPathWithinTree(PCPathChar tree, PCPathChar path) noexcept
             return false;
         }
 
+#if PATH_CHARS_SIMD
+        if (!AreCharsEqualIgnoringCase(tree + treeElementStart, path + pathElementStart, treeElementLength, IsPathCharEqual)) {
+            return false;
+        }
+#else
         for (size_t i = 0; i < treeElementLength; i++) {
             const PathChar ct = tree[treeElementStart + i];
             const PathChar cp = path[pathElementStart + i];
@@ -264,6 +425,7 @@ bool IsPathWithinTree(PCPathChar tree, PCPathChar path) noexcept
                 return false;
             }
         }
+#endif // PATH_CHARS_SIMD
 
         // Path element looks the same in both.
         // Keep searching.
@@ -481,11 +643,48 @@ size_t GetRootLength(PCPathChar path) noexcept
 
 bool AreEqualCaseInsensitively(const std::wstring& s1, const std::wstring& s2)
 {
-    return s1.size() == s2.size() && std::equal(s1.begin(), s1.end(), s2.begin(),
-        [](wchar_t a, wchar_t b) {
-            return std::towlower(a) == std::towlower(b);
+    auto areCharsEqual = [](wchar_t a, wchar_t b) {
+        return std::towlower(a) == std::towlower(b);
+    };
+
+#if PATH_CHARS_SIMD
+    return s1.size() == s2.size() && AreCharsEqualIgnoringCase(s1.c_str(), s2.c_str(), s1.size(), areCharsEqual);
+#else
+    return s1.size() == s2.size() && std::equal(s1.begin(), s1.end(), s2.begin(), areCharsEqual);
+#endif // PATH_CHARS_SIMD
+}
+
+bool TryWidenAscii(const char* str, size_t length, wchar_t* buffer) noexcept
+{
+    size_t i = 0;
+
+#if PATH_CHARS_SIMD
+    // 16 bytes at a time: a block is ASCII if none of its bytes has the high bit set, and interleaving it with zeros widens it
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + sizeof(__m128i) <= length; i += sizeof(__m128i))
+    {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str + i));
+        if (_mm_movemask_epi8(bytes) != 0)
+        {
+            return false;
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(buffer + i), _mm_unpacklo_epi8(bytes, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(buffer + i + PathCharsPerBlock), _mm_unpackhi_epi8(bytes, zero));
+    }
+#endif // PATH_CHARS_SIMD
+
+    for (; i < length; i++)
+    {
+        if (static_cast<unsigned char>(str[i]) >= 0x80)
+        {
+            return false;
         }
-    );
+
+        buffer[i] = static_cast<wchar_t>(str[i]);
+    }
+
+    return true;
 }
 
 PCPathChar GetPathWithoutPrefix(PCPathChar path) noexcept
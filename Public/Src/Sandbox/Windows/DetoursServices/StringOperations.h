@@ -206,6 +206,14 @@ DWORD WINAPI HashPath(
     __in_ecount(nLength)        PCPathChar pPath,
     __in                        size_t nLength) noexcept;
 
+// HashPath64 computes a 64-bit hash code of a string after applying NormalizePathChar to all characters, for tables that store hashes in place of paths
+#if _WIN32
+__declspec(dllexport)
+#endif
+uint64_t HashPath64(
+    __in_ecount(nLength)        PCPathChar pPath,
+    __in                        size_t nLength) noexcept;
+
 // NormalizeAndHashPath applies NormalizePathChar to all characters, storing the result in a buffer, and computes a hash code of the path in the same way as HashPath
 DWORD WINAPI NormalizeAndHashPath(
     __in                            PCPathChar pPath,
@@ -261,9 +269,11 @@ bool IsPathToNamedStream(PCPathChar const path, size_t pathLength) noexcept;
 size_t GetRootLength(PCPathChar path) noexcept;
 
 #if _WIN32
+__declspec(dllexport)
 bool AreEqualCaseInsensitively(const std::wstring& s1, const std::wstring& s2);
 
 // Returns a collection of all path atoms of the given path
+__declspec(dllexport)
 int TryDecomposePath(const std::wstring& path, std::vector<std::wstring>& elements);
 
 // Combines two path fragments into a single path separated by a directory separator.
@@ -279,4 +289,9 @@ std::wstring NormalizePath(const std::wstring& path);
 // Removes NT or local device prefix from path.
 __declspec(dllexport)
 PCPathChar GetPathWithoutPrefix(PCPathChar path) noexcept;
+
+// Widens the first 'length' characters of 'str' into 'buffer', which has room for them, if they are all ASCII. Returns false
+// otherwise, leaving 'buffer' partially written. ASCII characters are the same in every ANSI code page, so for them this is
+// what MultiByteToWideChar(CP_ACP, ...) does.
+bool TryWidenAscii(const char* str, size_t length, wchar_t* buffer) noexcept;
 #endif
\ No newline at end of file
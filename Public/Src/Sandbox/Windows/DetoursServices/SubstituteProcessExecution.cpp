@@ -4,12 +4,14 @@
 #include "stdafx.h"
 
 #include <cwctype>
+#include <unordered_map>
 
 #include "DebuggingHelpers.h"
 #include "DetouredFunctions.h"
 #include "DetoursHelpers.h"
 #include "DetoursServices.h"
 #include "FileAccessHelpers.h"
+#include "ShimProcessMatcher.h"
 #include "StringOperations.h"
 #include "UnicodeConverter.h"
 #include "SubstituteProcessExecution.h"
@@ -176,15 +178,74 @@ void FindApplicationNameFromCommandLine(const wchar_t *lpCommandLine, _Out_ std:
     }
 }
 
-static bool CommandArgsContainMatch(const wchar_t *commandArgs, const wchar_t *argMatch)
+static bool HasPluginFunc()
 {
-    if (argMatch == nullptr)
+    return g_SubstituteProcessExecutionPluginFunc != nullptr || g_SubstituteProcessExecutionCacheablePluginFunc != nullptr;
+}
+
+// Beyond this many cached decisions, further decisions are not cached
+#define MAX_CACHED_PLUGIN_DECISIONS 1024
+
+// A decision of the plugin that it marked as cacheable (see SubstituteProcessExecutionCacheablePluginFunc)
+typedef struct
+{
+    wstring arguments;
+    bool matches;
+    bool hasModifiedArguments;
+    wstring modifiedArguments;
+} PluginDecision;
+
+// command + '\n' + working directory + '\n' + hash of the arguments -> PluginDecision
+static std::unordered_map<wstring, PluginDecision> s_pluginDecisions;
+static SRWLOCK s_pluginDecisionsLock = SRWLOCK_INIT;
+
+// Copies the modified arguments to the default process heap, where the plugin would have allocated them (see FreeModifiedArguments)
+static LPWSTR CopyModifiedArguments(const wstring& modifiedArguments)
+{
+    size_t size = sizeof(wchar_t) * (modifiedArguments.length() + 1);
+    LPWSTR copy = reinterpret_cast<LPWSTR>(HeapAlloc(GetProcessHeap(), 0, size));
+    if (copy != nullptr)
+    {
+        memcpy(copy, modifiedArguments.c_str(), size);
+    }
+
+    return copy;
+}
+
+static bool TryGetPluginDecision(const wstring& key, const wstring& commandArgs, bool& matches, LPWSTR* modifiedArguments)
+{
+    AcquireSRWLockShared(&s_pluginDecisionsLock);
+    auto iter = s_pluginDecisions.find(key);
+    bool found = iter != s_pluginDecisions.end() && iter->second.arguments == commandArgs;
+    if (found)
+    {
+        matches = iter->second.matches;
+        if (iter->second.hasModifiedArguments)
+        {
+            *modifiedArguments = CopyModifiedArguments(iter->second.modifiedArguments);
+            found = *modifiedArguments != nullptr;
+        }
+    }
+
+    ReleaseSRWLockShared(&s_pluginDecisionsLock);
+    return found;
+}
+
+static void AddPluginDecision(wstring&& key, const wstring& commandArgs, bool matches, LPCWSTR modifiedArguments)
+{
+    AcquireSRWLockExclusive(&s_pluginDecisionsLock);
+    if (s_pluginDecisions.size() < MAX_CACHED_PLUGIN_DECISIONS || s_pluginDecisions.find(key) != s_pluginDecisions.end())
     {
-        // No optional match, meaning always match.
-        return true;
+        s_pluginDecisions[std::move(key)] =
+        {
+            commandArgs,
+            matches,
+            modifiedArguments != nullptr,
+            modifiedArguments != nullptr ? wstring(modifiedArguments) : wstring()
+        };
     }
 
-    return wcsstr(commandArgs, argMatch) != nullptr;
+    ReleaseSRWLockExclusive(&s_pluginDecisionsLock);
 }
 
 static bool CallPluginFunc(
@@ -194,27 +255,66 @@ static bool CallPluginFunc(
     LPCWSTR lpWorkingDirectory,
     LPWSTR* modifiedArguments)
 {
-    assert(g_SubstituteProcessExecutionPluginFunc != nullptr);
+    assert(HasPluginFunc());
+
+    wchar_t curDir[MAX_PATH];
+    if (lpWorkingDirectory == nullptr)
+    {
+        GetCurrentDirectory(ARRAYSIZE(curDir), curDir);
+        lpWorkingDirectory = curDir;
+    }
+
+    // Build loops launch the same commands over and over, and the plugin is often managed code that is slow to call into
+    wstring key;
+    if (g_SubstituteProcessExecutionCacheablePluginFunc != nullptr)
+    {
+        key.reserve(command.length() + wcslen(lpWorkingDirectory) + 24);
+        key.append(command);
+        key.push_back(L'\n');
+        key.append(lpWorkingDirectory);
+        key.push_back(L'\n');
+        key.append(std::to_wstring(std::hash<wstring>()(commandArgs)));
+
+        bool matches;
+        if (TryGetPluginDecision(key, commandArgs, matches, modifiedArguments))
+        {
+            Dbg(L"Shim: Cached plugin decision command='%s', args='%s', matches=%d", command.c_str(), commandArgs.c_str(), matches);
+            return matches;
+        }
+    }
 
     if (lpEnvironment == nullptr)
     {
         lpEnvironment = GetEnvironmentStrings();
     }
 
-    wchar_t curDir[MAX_PATH];
-    if (lpWorkingDirectory == nullptr)
+    if (g_SubstituteProcessExecutionCacheablePluginFunc == nullptr)
     {
-        GetCurrentDirectory(ARRAYSIZE(curDir), curDir);
-        lpWorkingDirectory = curDir;
+        return g_SubstituteProcessExecutionPluginFunc(
+            command.c_str(),
+            commandArgs.c_str(),
+            lpEnvironment,
+            lpWorkingDirectory,
+            modifiedArguments,
+            Dbg) != 0;
     }
 
-    return g_SubstituteProcessExecutionPluginFunc(
+    BOOL cacheable = FALSE;
+    bool matches = g_SubstituteProcessExecutionCacheablePluginFunc(
         command.c_str(),
         commandArgs.c_str(),
         lpEnvironment,
         lpWorkingDirectory,
         modifiedArguments,
+        &cacheable,
         Dbg) != 0;
+
+    if (cacheable)
+    {
+        AddPluginDecision(std::move(key), commandArgs, matches, *modifiedArguments);
+    }
+
+    return matches;
 }
 
 static bool ShouldSubstituteShim(
@@ -226,10 +326,12 @@ static bool ShouldSubstituteShim(
 {
     assert(g_SubstituteProcessExecutionShimPath != nullptr);
 
+    const ShimProcessMatcher* shimProcessMatcher = GetShimProcessMatcher();
+
     // Easy cases.
-    if (g_pShimProcessMatches == nullptr || g_pShimProcessMatches->empty())
+    if (shimProcessMatcher == nullptr || shimProcessMatcher->IsEmpty())
     {
-        if (g_SubstituteProcessExecutionPluginFunc != nullptr)
+        if (HasPluginFunc())
         {
             // Filter meaning is exclusive if we're shimming all processes, inclusive otherwise.
             bool filterMatch = CallPluginFunc(command, commandArgs, lpEnvironment, lpWorkingDirectory, modifiedArguments);
@@ -245,45 +347,8 @@ static bool ShouldSubstituteShim(
         return g_ProcessExecutionShimAllProcesses;
     }
 
-    size_t commandLen = command.length();
-
-    bool foundMatch = false;
-
-    for (std::vector<ShimProcessMatch*>::iterator it = g_pShimProcessMatches->begin(); it != g_pShimProcessMatches->end(); ++it)
-    {
-        ShimProcessMatch* pMatch = *it;
-
-        const wchar_t* processName = pMatch->ProcessName.get();
-        size_t processLen = wcslen(processName);
-
-        // lpAppName is longer than e.g. "cmd.exe", see if lpAppName ends with e.g. "\cmd.exe"
-        if (processLen < commandLen)
-        {
-            if (command[commandLen - processLen - 1] == L'\\' &&
-                _wcsicmp(command.c_str() + commandLen - processLen, processName) == 0)
-            {
-                if (CommandArgsContainMatch(commandArgs.c_str(), pMatch->ArgumentMatch.get()))
-                {
-                    foundMatch = true;
-                    break;
-                }
-            }
-
-            continue;
-        }
-
-        if (processLen == commandLen)
-        {
-            if (_wcsicmp(processName, command.c_str()) == 0)
-            {
-                if (CommandArgsContainMatch(commandArgs.c_str(), pMatch->ArgumentMatch.get()))
-                {
-                    foundMatch = true;
-                    break;
-                }
-            }
-        }
-    }
+    // The command matches e.g. "cmd.exe" if it is "cmd.exe" or ends with "\cmd.exe"
+    bool foundMatch = shimProcessMatcher->Matches(command.c_str(), command.length(), commandArgs.c_str(), commandArgs.length());
 
     // Filter meaning is exclusive if we're shimming all processes, inclusive otherwise.
     bool filterMatch = !g_ProcessExecutionShimAllProcesses;
@@ -291,7 +356,7 @@ static bool ShouldSubstituteShim(
     if (foundMatch)
     {
         // Refine match by calling plugin.
-        if (g_SubstituteProcessExecutionPluginFunc != nullptr)
+        if (HasPluginFunc())
         {
             filterMatch = CallPluginFunc(command, commandArgs, lpEnvironment, lpWorkingDirectory, modifiedArguments) != 0;
         }
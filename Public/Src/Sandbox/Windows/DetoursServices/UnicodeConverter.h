@@ -5,22 +5,50 @@
 
 #include "buildXL_mem.h"
 #include "DebuggingHelpers.h"
+#include "StringOperations.h"
 
 // ----------------------------------------------------------------------------
 // CLASSES
 // ----------------------------------------------------------------------------
 
+// Converts a string in the ANSI code page to UTF-16 for the *A detours, which forward to the *W ones.
+//
+// Strings that fit in the inline buffer (paths, mostly) are converted into it, so they don't allocate: ASCII strings are widened
+// 16 characters at a time (see TryWidenAscii), anything else goes through MultiByteToWideChar, which never produces more UTF-16
+// characters than there are bytes to convert. Longer strings (e.g., command lines) are converted into a heap buffer.
 class UnicodeConverter
 {
 private:
+    static const size_t InlineCapacity = MAX_PATH;
+
     wchar_t *m_str;
+    wchar_t m_inline[InlineCapacity];
 
 public:
     UnicodeConverter(PCSTR s)
+        : m_str(NULL)
     {
         if (!s)
         {
-            m_str = NULL;
+            return;
+        }
+
+        size_t length = strlen(s);
+        if (length < InlineCapacity)
+        {
+            m_str = m_inline;
+            if (TryWidenAscii(s, length, m_inline))
+            {
+                m_inline[length] = L'\0';
+                return;
+            }
+
+            int charsConverted = MultiByteToWideChar(CP_ACP, 0, s, static_cast<int>(length + 1), m_inline, static_cast<int>(InlineCapacity));
+            if (charsConverted <= 0) {
+                PCWSTR errorMsg = L"UnicodeConverter::UnicodeConverter: Failed to convert string:1";
+                Dbg(errorMsg);
+                HandleDetoursInjectionAndCommunicationErrors(DETOURS_UNICODE_CONVERSION_18, errorMsg, DETOURS_UNICODE_LOG_MESSAGE_18);
+            }
         }
         else
         {
@@ -52,7 +80,10 @@ public:
 
     ~UnicodeConverter()
     {
-        delete[] m_str;
+        if (m_str != m_inline)
+        {
+            delete[] m_str;
+        }
     }
 
     PWSTR GetMutableString()
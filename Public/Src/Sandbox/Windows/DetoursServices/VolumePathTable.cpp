@@ -0,0 +1,134 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include "DebuggingHelpers.h"
+#include "StringOperations.h"
+#include "VolumePathTable.h"
+
+// Long enough for \Device\HarddiskVolumeN, \Device\CdRomN and the like. Devices with longer names are not in the table.
+#define MAX_VOLUME_DEVICE_NAME_LENGTH 64
+
+typedef struct VolumePrefix_t
+{
+    wchar_t DeviceName[MAX_VOLUME_DEVICE_NAME_LENGTH];
+    size_t DeviceNameLength;
+    wchar_t DriveLetter;            // 0 when several drive letters point at the device
+} VolumePrefix;
+
+static const wchar_t s_devicePrefix[] = L"\\Device\\";
+static const wchar_t s_mupDeviceName[] = L"\\Device\\Mup";
+static const size_t s_mupDeviceNameLength = _countof(s_mupDeviceName) - 1;
+
+// Written by InitializeVolumePathTable only
+static VolumePrefix s_volumePrefixes[26];
+static size_t s_volumePrefixCount = 0;
+
+// Whether the path is under the given device, i.e., starts with the device name followed by a directory separator
+static bool IsUnderDevice(PCWSTR path, size_t pathLength, PCWSTR deviceName, size_t deviceNameLength)
+{
+    return pathLength > deviceNameLength
+        && path[deviceNameLength] == L'\\'
+        && _wcsnicmp(path, deviceName, deviceNameLength) == 0;
+}
+
+void InitializeVolumePathTable()
+{
+    DWORD drives = GetLogicalDrives();
+    wchar_t drive[] = L"A:";
+    wchar_t target[MAX_PATH];
+
+    for (int i = 0; i < 26; i++)
+    {
+        if ((drives & (1 << i)) == 0)
+        {
+            continue;
+        }
+
+        // The first string of the result is the current target of the drive
+        drive[0] = (wchar_t)(L'A' + i);
+        if (QueryDosDeviceW(drive, target, _countof(target)) == 0)
+        {
+            continue;
+        }
+
+        // Subst drives (\??\C:\dir) and redirected network drives (\Device\LanmanRedirector\;Z:...\server\share) are not volumes,
+        // the path of a handle opened through them is on the volume (or the share) they point at
+        size_t length = wcslen(target);
+        if (!HasPrefix(target, s_devicePrefix)
+            || wcschr(target + _countof(s_devicePrefix) - 1, L'\\') != nullptr
+            || length >= MAX_VOLUME_DEVICE_NAME_LENGTH)
+        {
+            continue;
+        }
+
+        bool isAlias = false;
+        for (size_t j = 0; j < s_volumePrefixCount; j++)
+        {
+            if (_wcsicmp(s_volumePrefixes[j].DeviceName, target) == 0)
+            {
+                // Can't tell which of the drive letters the mount manager would answer
+                s_volumePrefixes[j].DriveLetter = 0;
+                isAlias = true;
+                break;
+            }
+        }
+
+        if (!isAlias)
+        {
+            VolumePrefix& prefix = s_volumePrefixes[s_volumePrefixCount++];
+            wcscpy_s(prefix.DeviceName, target);
+            prefix.DeviceNameLength = length;
+            prefix.DriveLetter = drive[0];
+        }
+    }
+
+    Dbg(L"InitializeVolumePathTable: %d volume(s) with a drive letter", (int)s_volumePrefixCount);
+}
+
+bool TryTranslateNtPathToDosPath(_In_ PCWSTR ntPath, size_t ntPathLength, _Out_ std::wstring& dosPath)
+{
+    if (IsUnderDevice(ntPath, ntPathLength, s_mupDeviceName, s_mupDeviceNameLength))
+    {
+        // \Device\Mup\server\share\foo is \\?\UNC\server\share\foo, unless the share is reached through a redirected drive
+        // (\Device\Mup\;Z:...), which only the mount manager knows how to name
+        if (ntPath[s_mupDeviceNameLength + 1] == L';')
+        {
+            return false;
+        }
+
+        dosPath.assign(L"\\\\?\\UNC");
+        dosPath.append(ntPath + s_mupDeviceNameLength, ntPathLength - s_mupDeviceNameLength);
+        return true;
+    }
+
+    for (size_t i = 0; i < s_volumePrefixCount; i++)
+    {
+        const VolumePrefix& prefix = s_volumePrefixes[i];
+        if (prefix.DriveLetter != 0 && IsUnderDevice(ntPath, ntPathLength, prefix.DeviceName, prefix.DeviceNameLength))
+        {
+            dosPath.assign(L"\\\\?\\");
+            dosPath.push_back(prefix.DriveLetter);
+            dosPath.push_back(L':');
+            dosPath.append(ntPath + prefix.DeviceNameLength, ntPathLength - prefix.DeviceNameLength);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool TryGetFinalPathByHandleFromVolumePathTable(_In_ HANDLE hFile, _Out_ std::wstring& fullPath)
+{
+    wchar_t buffer[MAX_PATH];
+    DWORD result = GetFinalPathNameByHandleW(hFile, buffer, _countof(buffer), FILE_NAME_NORMALIZED | VOLUME_NAME_NT);
+
+    // Failures and longer paths go through the regular query
+    if (result == 0 || result >= _countof(buffer))
+    {
+        return false;
+    }
+
+    return TryTranslateNtPathToDosPath(buffer, result, fullPath);
+}
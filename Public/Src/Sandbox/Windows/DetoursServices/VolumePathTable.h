@@ -0,0 +1,32 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <windows.h>
+#include <string>
+
+// ----------------------------------------------------------------------------
+// VOLUME PATH TABLE
+// ----------------------------------------------------------------------------
+//
+// GetFinalPathNameByHandleW(VOLUME_NAME_DOS) asks the mount manager for the DOS name of the volume of the handle on every call,
+// even though a process only ever sees a handful of volumes. The table maps the NT device names of the volumes that have a drive
+// letter in the device map of the process (\Device\HarddiskVolume3 -> C:), and the network redirector (\Device\Mup -> UNC), to
+// their DOS prefix. The DOS path of a handle is then its NT path (VOLUME_NAME_NT, which needs no mount manager query) with the
+// device replaced by that prefix.
+//
+// The table is built once when the dll attaches and never changes afterwards, so lookups take no lock. The device map of a
+// detoured process is set up before the dll attaches (see DetouredProcessInjector). A device the table does not know about
+// (a volume without a drive letter, a device with several drive letters, ...) is resolved by the regular query.
+
+// Builds the table from the drive letters of the device map of the current process
+void InitializeVolumePathTable();
+
+// Replaces the device of the given NT path (e.g., \Device\HarddiskVolume3\foo) with its DOS prefix (\\?\C:\foo), in the same form
+// GetFinalPathNameByHandleW returns with VOLUME_NAME_DOS. Returns false if the device is not in the table.
+bool TryTranslateNtPathToDosPath(_In_ PCWSTR ntPath, size_t ntPathLength, _Out_ std::wstring& dosPath);
+
+// Gets the path of the handle like GetFinalPathNameByHandleW(hFile, ..., FILE_NAME_NORMALIZED | VOLUME_NAME_DOS) does, resolving the
+// volume through the table. Returns false when the table can't resolve it, in which case the caller must query the DOS path itself.
+bool TryGetFinalPathByHandleFromVolumePathTable(_In_ HANDLE hFile, _Out_ std::wstring& fullPath);
@@ -0,0 +1,318 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+#include "buildXL_mem.h"
+
+// Every block handed out by dd_malloc is preceded by a header that records its size class, so dd_free neither needs HeapSize
+// nor a lock. Small blocks are rounded up to a size class and recycled through per-thread free lists: a block goes back to the
+// list of the thread that frees it, whichever thread allocated it. Larger blocks are allocated from and freed to the private heap.
+//
+// On NUMA machines, every node gets a heap of its own: a thread allocates from the heap of the node it ran on when it first
+// allocated, so the pages it touches on every detoured call are local to it (the heap of node 0 is g_hPrivateHeap). A block
+// records its heap, so it goes back to it whichever thread frees it.
+//
+// Heap usage (the size of the blocks owned by the pool, cached ones included) is accounted in a per-thread delta that is only
+// published to g_detoursHeapAllocatedMemoryInBytes once it exceeds HEAP_ACCOUNTING_BATCH_BYTES, so the reported maximum may be
+// off by that much per thread.
+
+// The header keeps the alignment HeapAlloc guarantees
+#define HEAP_BLOCK_HEADER_SIZE MEMORY_ALLOCATION_ALIGNMENT
+
+// Bytes each thread keeps cached per size class
+#define MAX_CACHED_BYTES_PER_SIZE_CLASS (8 * 1024)
+
+#define HEAP_ACCOUNTING_BATCH_BYTES (64 * 1024)
+
+// Block sizes (header included) of the size classes
+static const size_t s_sizeClasses[] = { 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024 };
+
+#define SIZE_CLASS_COUNT ARRAYSIZE(s_sizeClasses)
+#define LARGE_BLOCK SIZE_CLASS_COUNT
+
+typedef struct HeapBlockHeader
+{
+    // Index in s_sizeClasses, or LARGE_BLOCK
+    USHORT SizeClass;
+    // Index in s_nodeHeaps of the heap the block comes from (see GetHeap)
+    USHORT Heap;
+    // Size of the whole block, header included
+    size_t Size;
+} HeapBlockHeader;
+
+static_assert(sizeof(HeapBlockHeader) <= HEAP_BLOCK_HEADER_SIZE, "The block header must fit before the aligned payload");
+
+// Cached blocks are linked through their payload
+typedef struct CachedHeapBlock
+{
+    CachedHeapBlock* Next;
+} CachedHeapBlock;
+
+typedef struct ThreadHeapCache
+{
+    CachedHeapBlock* FreeLists[SIZE_CLASS_COUNT];
+    size_t CachedCounts[SIZE_CLASS_COUNT];
+    LONG64 PendingAllocatedBytes;
+    // NUMA node of the thread (or NUMA_NO_PREFERRED_NODE), once NodeResolved
+    DWORD Node;
+    bool NodeResolved;
+} ThreadHeapCache;
+
+static __declspec(thread) ThreadHeapCache gt_heapCache;
+
+// Nodes past this one share g_hPrivateHeap
+#define MAX_NODE_HEAPS 64
+
+// Created by the first thread of every node that allocates. Entry 0 is unused: that is g_hPrivateHeap.
+static HANDLE volatile s_nodeHeaps[MAX_NODE_HEAPS];
+
+static inline HANDLE GetHeap(USHORT heap)
+{
+    return heap == 0 ? g_hPrivateHeap : s_nodeHeaps[heap];
+}
+
+// Threads seldom leave the node of their ideal processor, so the node is only looked up once per thread
+static DWORD GetCurrentThreadNode()
+{
+    ThreadHeapCache& cache = gt_heapCache;
+    if (!cache.NodeResolved)
+    {
+        cache.Node = NUMA_NO_PREFERRED_NODE;
+
+        ULONG highestNode;
+        if (GetNumaHighestNodeNumber(&highestNode) && highestNode > 0)
+        {
+            // The processor number is relative to the processor group, which GetNumaProcessorNodeEx takes into account
+            PROCESSOR_NUMBER processor;
+            USHORT node;
+            GetCurrentProcessorNumberEx(&processor);
+            if (GetNumaProcessorNodeEx(&processor, &node) && node != MAXUSHORT)
+            {
+                cache.Node = node;
+            }
+        }
+
+        cache.NodeResolved = true;
+    }
+
+    return cache.Node;
+}
+
+// Returns the index (see GetHeap) of the heap of the node of the current thread, or 0 when that heap can't be created
+static USHORT GetCurrentThreadHeap()
+{
+    DWORD node = GetCurrentThreadNode();
+    if (node == 0 || node >= MAX_NODE_HEAPS)
+    {
+        return 0;
+    }
+
+    if (s_nodeHeaps[node] == nullptr)
+    {
+        HANDLE heap = HeapCreate(0, 40960, 0); // Same initial commit as g_hPrivateHeap
+        if (heap == nullptr)
+        {
+            return 0;
+        }
+
+        // Another thread of the node may have won the race
+        if (InterlockedCompareExchangePointer(reinterpret_cast<PVOID volatile*>(&s_nodeHeaps[node]), heap, nullptr) != nullptr)
+        {
+            HeapDestroy(heap);
+        }
+    }
+
+    return (USHORT)node;
+}
+
+static inline size_t GetSizeClass(size_t blockSize)
+{
+    for (size_t sizeClass = 0; sizeClass < SIZE_CLASS_COUNT; sizeClass++)
+    {
+        if (blockSize <= s_sizeClasses[sizeClass])
+        {
+            return sizeClass;
+        }
+    }
+
+    return LARGE_BLOCK;
+}
+
+static inline HeapBlockHeader* GetHeader(void* pMem)
+{
+    return reinterpret_cast<HeapBlockHeader*>(reinterpret_cast<BYTE*>(pMem) - HEAP_BLOCK_HEADER_SIZE);
+}
+
+static inline void* GetPayload(HeapBlockHeader* header)
+{
+    return reinterpret_cast<BYTE*>(header) + HEAP_BLOCK_HEADER_SIZE;
+}
+
+static void PublishHeapAccounting(ThreadHeapCache& cache)
+{
+    LONG64 allocatedSize = InterlockedAdd64(&g_detoursHeapAllocatedMemoryInBytes, cache.PendingAllocatedBytes);
+    cache.PendingAllocatedBytes = 0;
+
+    // Update the global MaxAllocated heap only if the current allocated heap is bigger than what is recorded.
+    LONG64 localMax = InterlockedAdd64(&g_detoursMaxAllocatedMemoryInBytes, 0);
+    while (allocatedSize > localMax)
+    {
+        InterlockedCompareExchange64(&g_detoursMaxAllocatedMemoryInBytes, allocatedSize, localMax);
+        localMax = InterlockedAdd64(&g_detoursMaxAllocatedMemoryInBytes, 0);
+    }
+}
+
+static inline void AccountHeapBytes(LONG64 delta)
+{
+    if (!ShouldLogProcessData())
+    {
+        return;
+    }
+
+    ThreadHeapCache& cache = gt_heapCache;
+    cache.PendingAllocatedBytes += delta;
+    if (cache.PendingAllocatedBytes >= HEAP_ACCOUNTING_BATCH_BYTES || cache.PendingAllocatedBytes <= -HEAP_ACCOUNTING_BATCH_BYTES)
+    {
+        PublishHeapAccounting(cache);
+    }
+}
+
+void* dd_malloc(size_t size)
+{
+    assert(g_hPrivateHeap != nullptr);
+
+    if (size > SIZE_MAX - HEAP_BLOCK_HEADER_SIZE)
+    {
+        return nullptr;
+    }
+
+    size_t blockSize = size + HEAP_BLOCK_HEADER_SIZE;
+    size_t sizeClass = GetSizeClass(blockSize);
+    if (sizeClass != LARGE_BLOCK)
+    {
+        ThreadHeapCache& cache = gt_heapCache;
+        CachedHeapBlock* cached = cache.FreeLists[sizeClass];
+        if (cached != nullptr)
+        {
+            cache.FreeLists[sizeClass] = cached->Next;
+            cache.CachedCounts[sizeClass]--;
+
+            // Callers rely on dd_malloc returning zeroed memory, as HeapAlloc does with BUILDXL_DETOURS_MEMORY_ALLOC_FLAGS
+            ZeroMemory(cached, s_sizeClasses[sizeClass] - HEAP_BLOCK_HEADER_SIZE);
+            return cached;
+        }
+
+        blockSize = s_sizeClasses[sizeClass];
+    }
+
+    USHORT heap = GetCurrentThreadHeap();
+    HeapBlockHeader* header = reinterpret_cast<HeapBlockHeader*>(HeapAlloc(GetHeap(heap), BUILDXL_DETOURS_MEMORY_ALLOC_FLAGS, blockSize));
+    if (header == nullptr)
+    {
+        return nullptr;
+    }
+
+    header->SizeClass = (USHORT)sizeClass;
+    header->Heap = heap;
+    header->Size = blockSize;
+    AccountHeapBytes((LONG64)blockSize);
+
+    return GetPayload(header);
+}
+
+void dd_free(void* pMem)
+{
+    assert(g_hPrivateHeap != nullptr);
+    if (pMem == nullptr)
+    {
+        return;
+    }
+
+    HeapBlockHeader* header = GetHeader(pMem);
+    size_t sizeClass = header->SizeClass;
+    if (sizeClass != LARGE_BLOCK)
+    {
+        ThreadHeapCache& cache = gt_heapCache;
+        if (cache.CachedCounts[sizeClass] < MAX_CACHED_BYTES_PER_SIZE_CLASS / s_sizeClasses[sizeClass])
+        {
+            CachedHeapBlock* cached = reinterpret_cast<CachedHeapBlock*>(pMem);
+            cached->Next = cache.FreeLists[sizeClass];
+            cache.FreeLists[sizeClass] = cached;
+            cache.CachedCounts[sizeClass]++;
+            return;
+        }
+    }
+
+    AccountHeapBytes(-(LONG64)header->Size);
+    HeapFree(GetHeap(header->Heap), 0, header);
+}
+
+void* dd_alloc_local_pages(size_t size)
+{
+    // Committed pages are zeroed, like the blocks of dd_malloc
+    void* pMem = VirtualAllocExNuma(GetCurrentProcess(), nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, GetCurrentThreadNode());
+    if (pMem != nullptr)
+    {
+        AccountHeapBytes((LONG64)size);
+    }
+
+    return pMem;
+}
+
+void dd_free_local_pages(void* pMem, size_t size)
+{
+    if (pMem == nullptr)
+    {
+        return;
+    }
+
+    AccountHeapBytes(-(LONG64)size);
+    VirtualFree(pMem, 0, MEM_RELEASE);
+}
+
+void ReleaseCurrentThreadHeapCache()
+{
+    if (g_hPrivateHeap == nullptr)
+    {
+        return;
+    }
+
+    ThreadHeapCache& cache = gt_heapCache;
+    for (size_t sizeClass = 0; sizeClass < SIZE_CLASS_COUNT; sizeClass++)
+    {
+        CachedHeapBlock* cached = cache.FreeLists[sizeClass];
+        while (cached != nullptr)
+        {
+            CachedHeapBlock* next = cached->Next;
+            HeapBlockHeader* header = GetHeader(cached);
+            AccountHeapBytes(-(LONG64)header->Size);
+            HeapFree(GetHeap(header->Heap), 0, header);
+            cached = next;
+        }
+
+        cache.FreeLists[sizeClass] = nullptr;
+        cache.CachedCounts[sizeClass] = 0;
+    }
+
+    PublishCurrentThreadHeapAccounting();
+}
+
+void DestroyNodeHeaps()
+{
+    for (size_t node = 1; node < MAX_NODE_HEAPS; node++)
+    {
+        if (s_nodeHeaps[node] != nullptr)
+        {
+            HeapDestroy(s_nodeHeaps[node]);
+            s_nodeHeaps[node] = nullptr;
+        }
+    }
+}
+
+void PublishCurrentThreadHeapAccounting()
+{
+    if (ShouldLogProcessData() && gt_heapCache.PendingAllocatedBytes != 0)
+    {
+        PublishHeapAccounting(gt_heapCache);
+    }
+}
@@ -14,47 +14,24 @@ extern volatile LONG64 g_detoursHeapAllocatedMemoryInBytes;
 // The general allocation APIs are stubbed out and one should call only the dd_* methods.
 // The memory allocation done from the BuildXL Detours library happens on a private heap.
 
-// malloc and free versions for this DLL.
-inline void* dd_malloc(size_t size)
-{
-    assert(g_hPrivateHeap != nullptr);
-    void* ret = HeapAlloc(g_hPrivateHeap, BUILDXL_DETOURS_MEMORY_ALLOC_FLAGS, size);
-
-     if (ret != nullptr && ShouldLogProcessData())
-     {
-         // Get the size since alignment matters and the actual allocated bytes can be a bit moe than size.
-         LONG64 allocatedSize = (LONG64)HeapSize(g_hPrivateHeap, BUILDXL_DETOURS_MEMORY_ALLOC_FLAGS, ret);
-         allocatedSize = InterlockedAdd64(&g_detoursHeapAllocatedMemoryInBytes, allocatedSize);
-         LONG64 localMax = InterlockedAdd64(&g_detoursMaxAllocatedMemoryInBytes, 0);
-       
-         // Update the global MaxAllocated heap only if the current allocated heap is bigger than what is recorded.
-         while (allocatedSize > localMax)
-         {
-             InterlockedCompareExchange64(&g_detoursMaxAllocatedMemoryInBytes, allocatedSize, localMax);
-             localMax = InterlockedAdd64(&g_detoursMaxAllocatedMemoryInBytes, 0);
-         }
-     }
-
-    return ret;
-}
+// malloc and free versions for this DLL. Blocks are zeroed, as with BUILDXL_DETOURS_MEMORY_ALLOC_FLAGS; small ones are
+// recycled through per-thread free lists, and they come from the heap of the NUMA node of the calling thread (see buildXL_mem.cpp).
+void* dd_malloc(size_t size);
+void dd_free(void* pMem);
 
-inline void dd_free(void* pMem)
-{
-    assert(g_hPrivateHeap != nullptr);
-    if (pMem == nullptr)
-    {
-        return;
-    }
+// Allocates zeroed pages on the NUMA node of the calling thread, for large buffers that one thread keeps writing to.
+// dd_free_local_pages must be given the size the pages were allocated with.
+void* dd_alloc_local_pages(size_t size);
+void dd_free_local_pages(void* pMem, size_t size);
 
-     if (ShouldLogProcessData())
-     {
-         // Get the size since alignment matters and the actual allocated bytes can be a bit moe than size.
-         LONG64 deallocatedSize = (LONG64)HeapSize(g_hPrivateHeap, BUILDXL_DETOURS_MEMORY_ALLOC_FLAGS, pMem);
-         InterlockedAdd64(&g_detoursHeapAllocatedMemoryInBytes, -(deallocatedSize));
-     }
+// Destroys the heaps of the NUMA nodes other than node 0 (whose heap is g_hPrivateHeap). Called when the DLL is unloaded.
+void DestroyNodeHeaps();
 
-    HeapFree(g_hPrivateHeap, HEAP_ZERO_MEMORY, pMem);
-}
+// Frees the blocks cached by the current thread and publishes its pending heap accounting. Called when a thread exits.
+void ReleaseCurrentThreadHeapCache();
+
+// Publishes the heap usage accounted by the current thread to g_detoursHeapAllocatedMemoryInBytes and g_detoursMaxAllocatedMemoryInBytes.
+void PublishCurrentThreadHeapAccounting();
 
 // New news and deletes operators that call the private heap.
 inline void* operator new(size_t count)
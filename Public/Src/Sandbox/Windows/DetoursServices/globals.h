@@ -23,8 +23,10 @@ using std::vector;
 // FORWARD DECLARATIONS
 // ----------------------------------------------------------------------------
 class TranslatePathTuple;
-class ShimProcessMatch;
+class TranslatePathIndex;
+class ShimProcessMatcher;
 struct BreakawayChildProcess;
+class BreakawayChildProcessIndex;
 
 // ----------------------------------------------------------------------------
 // GLOBALS
@@ -44,11 +46,15 @@ extern FileAccessManifestExtraFlag g_fileAccessManifestExtraFlags;
 extern uint64_t g_FileAccessManifestPipId;
 
 extern PCManifestRecord g_manifestTreeRoot;
+extern ManifestRecordIndex g_manifestRecordIndex;
 
 extern PManifestChildProcessesToBreakAwayFromJob g_manifestChildProcessesToBreakAwayFromJob;
 extern vector<BreakawayChildProcess>* g_breakawayChildProcesses;
+extern BreakawayChildProcessIndex* g_pBreakawayChildProcessIndex;
+extern bool g_hasBreakawayChildProcesses;
 extern PManifestTranslatePathsStrings g_manifestTranslatePathsStrings;
 extern vector<TranslatePathTuple*>* g_pManifestTranslatePathTuples;
+extern TranslatePathIndex* g_pManifestTranslatePathIndex;
 extern std::unordered_set<std::wstring>* g_pManifestTranslatePathLookupTable;
 
 extern PManifestInternalDetoursErrorNotificationFileString g_manifestInternalDetoursErrorNotificationFileString;
@@ -108,12 +114,29 @@ typedef BOOL(__stdcall* SubstituteProcessExecutionPluginFunc)(
     wchar_t** modifiedArguments,
     void (__stdcall* logFunc)(PCWSTR format, ...));
 
+// Alternative to CommandMatches that a plugin DLL can export instead, as an extern "C" __declspec(dllexport) BOOL WINAPI
+// CommandMatchesCacheable(...) function, which takes precedence when both are exported. It takes the same parameters, plus:
+//
+// cacheable: Set to TRUE by the plugin when its decision (and the modified arguments) only depend on the command, the arguments
+// and the working directory, and not on the environment or on the state of the machine. Such decisions are cached for the lifetime
+// of the calling process, so launching the same command again with the same arguments in the same working directory does not call
+// into the plugin. Initialized to FALSE.
+typedef BOOL(__stdcall* SubstituteProcessExecutionCacheablePluginFunc)(
+    const wchar_t* command,
+    const wchar_t* arguments,
+    LPVOID environmentBlock,
+    const wchar_t* workingDirectory,
+    wchar_t** modifiedArguments,
+    BOOL* cacheable,
+    void (__stdcall* logFunc)(PCWSTR format, ...));
+
 extern wchar_t* g_SubstituteProcessExecutionShimPath;
 extern bool g_ProcessExecutionShimAllProcesses;
 extern wchar_t* g_SubstituteProcessExecutionPluginDllPath;
 extern HMODULE g_SubstituteProcessExecutionPluginDllHandle;
 extern SubstituteProcessExecutionPluginFunc g_SubstituteProcessExecutionPluginFunc;
-extern vector<ShimProcessMatch*>* g_pShimProcessMatches;
+extern SubstituteProcessExecutionCacheablePluginFunc g_SubstituteProcessExecutionCacheablePluginFunc;
+extern ShimProcessMatcher* g_pShimProcessMatcher;
 
 // ----------------------------------------------------------------------------
 // Real Windows API function pointers
@@ -199,12 +222,8 @@ extern CreatePipe_t Real_CreatePipe;
 extern DeviceIoControl_t Real_DeviceIoControl;
 
 #if MEASURE_DETOURED_NT_CLOSE_IMPACT
-extern volatile LONG g_msTimeToPopulatePoolList;
 extern volatile ULONGLONG g_pipExecutionStart;
 extern volatile LONG g_ntCloseHandeCount;
-extern volatile LONG g_maxClosedListCount;
-extern volatile LONG g_msTimeInAddClosedList;
-extern volatile LONG g_msTimeInRemoveClosedList;
 #endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
 
 #if MEASURE_REPARSEPOINT_RESOLVING_IMPACT
@@ -0,0 +1,459 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Benchmark.cpp : Microbenchmarks of the file APIs Detours sits on. The same verb is run with and without the sandbox
+// (see DetoursBenchmarkTests.RunDetoursBenchmark), so the difference between both runs is the cost of Detours. Every benchmark
+// prints one JSON object per line:
+//
+//      {"benchmark":"create_file","iterations":20000,"nsPerOp":2412.7,"minNsPerOp":2398.2}
+//
+// where nsPerOp is the median over a few repetitions and minNsPerOp is the best one. The multi-threaded variants run the same
+// loop on several threads at once, and report the time per operation of each thread.
+//
+// The fixture (files, a directory symlink chain and a large directory) is created under the current directory. The symlink
+// chain needs the privilege to create symlinks (or developer mode); without it, that benchmark is skipped.
+
+#include "stdafx.h"
+
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+#define BENCHMARK_REPETITIONS 5
+#define BENCHMARK_LARGE_DIRECTORY_ENTRIES 2000
+#define BENCHMARK_CONTENTION_THREADS 8
+
+static const wchar_t* FIXTURE_DIRECTORY = L"DetoursBenchmark";
+static const wchar_t* FILE_PATH = L"DetoursBenchmark\\file.txt";
+static const wchar_t* COPY_PATH = L"DetoursBenchmark\\copy.txt";
+// 'link2' -> 'link1' -> 'real' are directory symlinks, so every iteration resolves two reparse points before reaching the file
+static const wchar_t* SYMLINK_CHAIN_PATH = L"DetoursBenchmark\\link2\\file.txt";
+static const wchar_t* LARGE_DIRECTORY = L"DetoursBenchmark\\large";
+static const wchar_t* LARGE_DIRECTORY_PATTERN = L"DetoursBenchmark\\large\\*";
+
+static LONG64 s_frequency = 0;
+
+static LONG64 Now()
+{
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart;
+}
+
+static void Fail(const char* what)
+{
+    fprintf(stderr, "Benchmark: %s failed with error %lu\n", what, GetLastError());
+    exit(1);
+}
+
+static void CreateFixtureFile(const wstring& path)
+{
+    HANDLE hFile = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    DWORD bytesWritten;
+    if (hFile == INVALID_HANDLE_VALUE || !WriteFile(hFile, "contents", 8, &bytesWritten, nullptr) || !CloseHandle(hFile))
+    {
+        Fail("creating a fixture file");
+    }
+}
+
+static bool CreateFixture()
+{
+    wstring root(FIXTURE_DIRECTORY);
+    CreateDirectoryW(root.c_str(), nullptr);
+    CreateDirectoryW((root + L"\\real").c_str(), nullptr);
+    CreateDirectoryW(LARGE_DIRECTORY, nullptr);
+
+    CreateFixtureFile(FILE_PATH);
+    CreateFixtureFile(root + L"\\real\\file.txt");
+
+    for (int i = 0; i < BENCHMARK_LARGE_DIRECTORY_ENTRIES; i++)
+    {
+        CreateFixtureFile(wstring(LARGE_DIRECTORY) + L"\\entry" + to_wstring(i));
+    }
+
+    RemoveDirectoryW((root + L"\\link1").c_str());
+    RemoveDirectoryW((root + L"\\link2").c_str());
+    DWORD flags = SYMBOLIC_LINK_FLAG_DIRECTORY | SYMBOLIC_LINK_FLAG_ALLOW_UNPRIVILEGED_CREATE;
+    bool hasSymlinkChain =
+        CreateSymbolicLinkW((root + L"\\link1").c_str(), L"real", flags) &&
+        CreateSymbolicLinkW((root + L"\\link2").c_str(), L"link1", flags);
+    if (!hasSymlinkChain)
+    {
+        fprintf(stderr, "Benchmark: could not create symlinks (error %lu), skipping the symlink chain benchmark\n", GetLastError());
+    }
+
+    return hasSymlinkChain;
+}
+
+static double NsPerOp(LONG64 ticks, int iterations)
+{
+    return (double)ticks * 1e9 / (double)s_frequency / iterations;
+}
+
+static void Report(const char* name, int iterations, vector<double>& nsPerOp)
+{
+    sort(nsPerOp.begin(), nsPerOp.end());
+    printf("{\"benchmark\":\"%s\",\"iterations\":%d,\"nsPerOp\":%.1f,\"minNsPerOp\":%.1f}\n",
+        name, iterations, nsPerOp[BENCHMARK_REPETITIONS / 2], nsPerOp[0]);
+    fflush(stdout);
+}
+
+static void Run(const char* name, int iterations, const function<void()>& operation)
+{
+    // Warm up caches (the ones of Detours included) before measuring
+    for (int i = 0; i < max(1, iterations / 10); i++)
+    {
+        operation();
+    }
+
+    vector<double> nsPerOp;
+    for (int repetition = 0; repetition < BENCHMARK_REPETITIONS; repetition++)
+    {
+        LONG64 start = Now();
+        for (int i = 0; i < iterations; i++)
+        {
+            operation();
+        }
+
+        nsPerOp.push_back(NsPerOp(Now() - start, iterations));
+    }
+
+    Report(name, iterations, nsPerOp);
+}
+
+static void RunOnThreads(const char* name, int iterations, const function<void()>& operation)
+{
+    vector<double> nsPerOp;
+    for (int repetition = 0; repetition < BENCHMARK_REPETITIONS; repetition++)
+    {
+        vector<thread> threads;
+        LONG64 start = Now();
+        for (int t = 0; t < BENCHMARK_CONTENTION_THREADS; t++)
+        {
+            threads.emplace_back([&]()
+            {
+                for (int i = 0; i < iterations; i++)
+                {
+                    operation();
+                }
+            });
+        }
+
+        for (thread& t : threads)
+        {
+            t.join();
+        }
+
+        nsPerOp.push_back(NsPerOp(Now() - start, iterations));
+    }
+
+    Report(name, iterations, nsPerOp);
+}
+
+static void OpenClose(const wchar_t* path)
+{
+    HANDLE hFile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        Fail("CreateFileW");
+    }
+
+    CloseHandle(hFile);
+}
+
+int BenchmarkNoop()
+{
+    return 0;
+}
+
+int Benchmark()
+{
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    s_frequency = frequency.QuadPart;
+
+    bool hasSymlinkChain = CreateFixture();
+
+    Run("create_file", 20000, []()
+    {
+        OpenClose(FILE_PATH);
+    });
+
+    Run("get_file_attributes_ex", 20000, []()
+    {
+        WIN32_FILE_ATTRIBUTE_DATA data;
+        if (!GetFileAttributesExW(FILE_PATH, GetFileExInfoStandard, &data)) Fail("GetFileAttributesExW");
+    });
+
+    Run("find_first_file_ex_large_directory", 100, []()
+    {
+        WIN32_FIND_DATAW findData;
+        HANDLE hFind = FindFirstFileExW(LARGE_DIRECTORY_PATTERN, FindExInfoBasic, &findData, FindExSearchNameMatch, nullptr, 0);
+        if (hFind == INVALID_HANDLE_VALUE) Fail("FindFirstFileExW");
+
+        int entries = 1;
+        while (FindNextFileW(hFind, &findData))
+        {
+            entries++;
+        }
+
+        FindClose(hFind);
+        if (entries < BENCHMARK_LARGE_DIRECTORY_ENTRIES) Fail("FindNextFileW");
+    });
+
+    if (hasSymlinkChain)
+    {
+        Run("create_file_symlink_chain", 20000, []()
+        {
+            OpenClose(SYMLINK_CHAIN_PATH);
+        });
+    }
+
+    Run("copy_file_ex", 2000, []()
+    {
+        if (!CopyFileExW(FILE_PATH, COPY_PATH, nullptr, nullptr, nullptr, 0)) Fail("CopyFileExW");
+    });
+
+    wchar_t exePath[MAX_PATH];
+    if (GetModuleFileNameW(nullptr, exePath, MAX_PATH) == 0) Fail("GetModuleFileNameW");
+    wstring commandLine = wstring(L"\"") + exePath + L"\" BenchmarkNoop";
+
+    Run("create_process", 50, [&]()
+    {
+        STARTUPINFOW startupInfo;
+        PROCESS_INFORMATION processInfo;
+        ZeroMemory(&startupInfo, sizeof(startupInfo));
+        startupInfo.cb = sizeof(startupInfo);
+
+        vector<wchar_t> mutableCommandLine(commandLine.begin(), commandLine.end());
+        mutableCommandLine.push_back(L'\0');
+        if (!CreateProcessW(nullptr, mutableCommandLine.data(), nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startupInfo, &processInfo)) Fail("CreateProcessW");
+
+        DWORD exitCode;
+        WaitForSingleObject(processInfo.hProcess, INFINITE);
+        bool succeeded = GetExitCodeProcess(processInfo.hProcess, &exitCode) && exitCode == 0;
+        CloseHandle(processInfo.hThread);
+        CloseHandle(processInfo.hProcess);
+        if (!succeeded) Fail("the child process");
+    });
+
+    RunOnThreads("create_file_contended", 5000, []()
+    {
+        OpenClose(FILE_PATH);
+    });
+
+    RunOnThreads("get_file_attributes_ex_contended", 5000, []()
+    {
+        WIN32_FILE_ATTRIBUTE_DATA data;
+        if (!GetFileAttributesExW(FILE_PATH, GetFileExInfoStandard, &data)) Fail("GetFileAttributesExW");
+    });
+
+    return 0;
+}
+
+// Report scaling: 1, 2, 4, ... up to BENCHMARK_REPORTERS_MAX reporter processes (this same executable with the BenchmarkReporter
+// verb) probe distinct absent paths at once, so that every probe is a report written to the report channel of the pip. It mirrors
+// the Linux report_scaling_benchmark, and prints the same lines:
+//
+//      {"benchmark":"report_scaling","processes":8,"reports":16000,"reportsPerSec":812345.6,"p50Ns":4120,"p90Ns":6210,
+//       "p99Ns":18230,"p999Ns":95400,"maxNs":1203000,"stalledFraction":0.0012}
+//      {"benchmark":"report_scaling_saturation","processes":16}
+//
+// The reporters write their timings to a shared memory section and start on a shared event, both named after the parent.
+
+#define BENCHMARK_REPORTERS_MAX 64
+#define BENCHMARK_REPORTS_PER_PROCESS 2000
+// A round saturated the pipeline when it did not get at least this much more throughput than the previous one
+#define BENCHMARK_SCALING_THRESHOLD 1.1
+#define BENCHMARK_STALL_FACTOR 10
+
+static const wchar_t* REPORT_SCALING_DIRECTORY = L"DetoursReportScaling";
+
+struct ReporterTimes
+{
+    LONG64 start;
+    LONG64 end;
+};
+
+static size_t ReportScalingSectionSize()
+{
+    return sizeof(ReporterTimes) * BENCHMARK_REPORTERS_MAX + sizeof(UINT32) * BENCHMARK_REPORTERS_MAX * BENCHMARK_REPORTS_PER_PROCESS;
+}
+
+static wstring ReportScalingObjectName(const wchar_t* kind, DWORD parentId, int round)
+{
+    return wstring(L"Local\\DetoursReportScaling") + kind + to_wstring(parentId) + L"_" + to_wstring(round);
+}
+
+// Usage: DetoursTests.exe BenchmarkReporter <parent process id> <round> <index>
+int BenchmarkReporter()
+{
+    if (__argc != 5)
+    {
+        fprintf(stderr, "Usage: DetoursTests.exe BenchmarkReporter <parent process id> <round> <index>\n");
+        return 1;
+    }
+
+    DWORD parentId = (DWORD)atoi(__argv[2]);
+    int round = atoi(__argv[3]);
+    int index = atoi(__argv[4]);
+
+    HANDLE hSection = OpenFileMappingW(FILE_MAP_WRITE, FALSE, ReportScalingObjectName(L"Section", parentId, 0).c_str());
+    HANDLE hStart = OpenEventW(SYNCHRONIZE, FALSE, ReportScalingObjectName(L"Start", parentId, round).c_str());
+    if (hSection == nullptr || hStart == nullptr) Fail("opening the shared benchmark objects");
+
+    char* shared = (char*)MapViewOfFile(hSection, FILE_MAP_WRITE, 0, 0, ReportScalingSectionSize());
+    if (shared == nullptr) Fail("MapViewOfFile");
+
+    ReporterTimes* times = (ReporterTimes*)shared + index;
+    UINT32* latencies = (UINT32*)(shared + sizeof(ReporterTimes) * BENCHMARK_REPORTERS_MAX) + (size_t)index * BENCHMARK_REPORTS_PER_PROCESS;
+
+    WaitForSingleObject(hStart, INFINITE);
+
+    wchar_t path[MAX_PATH];
+    times->start = Now();
+    for (int i = 0; i < BENCHMARK_REPORTS_PER_PROCESS; i++)
+    {
+        // Every path is probed once across the whole run
+        swprintf_s(path, L"%s\\r%d_p%d_%d", REPORT_SCALING_DIRECTORY, round, index, i);
+
+        LONG64 start = Now();
+        DWORD attributes = GetFileAttributesW(path);
+        LONG64 ticks = Now() - start;
+        if (attributes != INVALID_FILE_ATTRIBUTES || GetLastError() != ERROR_FILE_NOT_FOUND) Fail("GetFileAttributesW");
+
+        latencies[i] = (UINT32)min<double>(NsPerOp(ticks, 1), (double)UINT32_MAX);
+    }
+
+    times->end = Now();
+
+    UnmapViewOfFile(shared);
+    CloseHandle(hStart);
+    CloseHandle(hSection);
+    return 0;
+}
+
+// Runs one round with 'processes' reporters and returns its throughput in reports per second
+static double RunReportScalingRound(const wstring& exePath, int round, int processes, char* shared, double* stallThresholdNs)
+{
+    DWORD parentId = GetCurrentProcessId();
+    HANDLE hStart = CreateEventW(nullptr, TRUE, FALSE, ReportScalingObjectName(L"Start", parentId, round).c_str());
+    if (hStart == nullptr) Fail("CreateEventW");
+
+    vector<HANDLE> children;
+    for (int i = 0; i < processes; i++)
+    {
+        wstring commandLine = L"\"" + exePath + L"\" BenchmarkReporter " + to_wstring(parentId) + L" " + to_wstring(round) + L" " + to_wstring(i);
+        vector<wchar_t> mutableCommandLine(commandLine.begin(), commandLine.end());
+        mutableCommandLine.push_back(L'\0');
+
+        STARTUPINFOW startupInfo;
+        PROCESS_INFORMATION processInfo;
+        ZeroMemory(&startupInfo, sizeof(startupInfo));
+        startupInfo.cb = sizeof(startupInfo);
+        if (!CreateProcessW(nullptr, mutableCommandLine.data(), nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startupInfo, &processInfo)) Fail("CreateProcessW");
+
+        CloseHandle(processInfo.hThread);
+        children.push_back(processInfo.hProcess);
+    }
+
+    // Every reporter is up (or about to wait on the event): start them all together
+    SetEvent(hStart);
+
+    bool succeeded = true;
+    for (HANDLE hChild : children)
+    {
+        DWORD exitCode;
+        WaitForSingleObject(hChild, INFINITE);
+        succeeded &= GetExitCodeProcess(hChild, &exitCode) && exitCode == 0;
+        CloseHandle(hChild);
+    }
+
+    CloseHandle(hStart);
+    if (!succeeded) Fail("a reporter process");
+
+    ReporterTimes* times = (ReporterTimes*)shared;
+    UINT32* latencies = (UINT32*)(shared + sizeof(ReporterTimes) * BENCHMARK_REPORTERS_MAX);
+
+    LONG64 start = MAXLONG64;
+    LONG64 end = 0;
+    for (int i = 0; i < processes; i++)
+    {
+        start = min(start, times[i].start);
+        end = max(end, times[i].end);
+    }
+
+    size_t reports = (size_t)processes * BENCHMARK_REPORTS_PER_PROCESS;
+    vector<UINT32> sorted(latencies, latencies + reports);
+    sort(sorted.begin(), sorted.end());
+    auto percentile = [&](double p) { return sorted[min(reports - 1, (size_t)(p * reports))]; };
+
+    // Stalls are told apart from the latency of an uncontended report, as measured by the first round
+    if (*stallThresholdNs == 0)
+    {
+        *stallThresholdNs = max(1.0, (double)percentile(0.5) * BENCHMARK_STALL_FACTOR);
+    }
+
+    size_t stalled = sorted.end() - upper_bound(sorted.begin(), sorted.end(), (UINT32)*stallThresholdNs);
+    double reportsPerSec = (double)reports * 1e9 / max(1.0, NsPerOp(end - start, 1));
+
+    printf("{\"benchmark\":\"report_scaling\",\"processes\":%d,\"reports\":%zu,\"reportsPerSec\":%.1f,\"p50Ns\":%u,\"p90Ns\":%u,"
+           "\"p99Ns\":%u,\"p999Ns\":%u,\"maxNs\":%u,\"stalledFraction\":%.4f}\n",
+        processes, reports, reportsPerSec, percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999), sorted[reports - 1],
+        (double)stalled / reports);
+    fflush(stdout);
+
+    return reportsPerSec;
+}
+
+int BenchmarkReportScaling()
+{
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    s_frequency = frequency.QuadPart;
+
+    CreateDirectoryW(REPORT_SCALING_DIRECTORY, nullptr);
+
+    wchar_t exePath[MAX_PATH];
+    if (GetModuleFileNameW(nullptr, exePath, MAX_PATH) == 0) Fail("GetModuleFileNameW");
+
+    size_t sectionSize = ReportScalingSectionSize();
+    HANDLE hSection = CreateFileMappingW(
+        INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, (DWORD)((UINT64)sectionSize >> 32), (DWORD)sectionSize,
+        ReportScalingObjectName(L"Section", GetCurrentProcessId(), 0).c_str());
+    if (hSection == nullptr) Fail("CreateFileMappingW");
+
+    char* shared = (char*)MapViewOfFile(hSection, FILE_MAP_READ, 0, 0, sectionSize);
+    if (shared == nullptr) Fail("MapViewOfFile");
+
+    double stallThresholdNs = 0;
+    double previousReportsPerSec = 0;
+    int saturation = 0;
+    int round = 0;
+    for (int processes = 1; ; processes = min(processes * 2, BENCHMARK_REPORTERS_MAX))
+    {
+        double reportsPerSec = RunReportScalingRound(exePath, round++, processes, shared, &stallThresholdNs);
+        if (saturation == 0 && previousReportsPerSec > 0 && reportsPerSec < previousReportsPerSec * BENCHMARK_SCALING_THRESHOLD)
+        {
+            saturation = processes;
+        }
+
+        previousReportsPerSec = reportsPerSec;
+        if (processes == BENCHMARK_REPORTERS_MAX)
+        {
+            break;
+        }
+    }
+
+    printf("{\"benchmark\":\"report_scaling_saturation\",\"processes\":%d}\n", saturation);
+
+    UnmapViewOfFile(shared);
+    CloseHandle(hSection);
+    return 0;
+}
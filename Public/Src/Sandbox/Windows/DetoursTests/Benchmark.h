@@ -0,0 +1,9 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+int Benchmark();
+int BenchmarkNoop();
+int BenchmarkReportScaling();
+int BenchmarkReporter();
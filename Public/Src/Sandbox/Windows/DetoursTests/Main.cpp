@@ -9,6 +9,7 @@
 
 using namespace std;
 
+#include "Benchmark.h"
 #include "Logging.h"
 #include "ReadExclusive.h"
 #include "ShortNames.h"
@@ -1445,6 +1446,10 @@ int main(int argc, char **argv)
     IF_COMMAND(TimestampsNoNormalize);
     IF_COMMAND(TimestampsNormalize);
     IF_COMMAND(ShortNames);
+    IF_COMMAND(Benchmark);
+    IF_COMMAND(BenchmarkNoop);
+    IF_COMMAND(BenchmarkReportScaling);
+    IF_COMMAND(BenchmarkReporter);
 
     LoggingTests(verb);
     SymlinkTests(verb);
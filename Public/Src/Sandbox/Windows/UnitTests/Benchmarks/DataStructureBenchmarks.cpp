@@ -0,0 +1,311 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Microbenchmarks of the data structures the detours consult on every access: PathTree, ResolvedPathCache and the
+// path helpers of StringOperations. The correctness of these lives in the unit tests next to this folder; this binary
+// only measures, so data structure changes can be compared against a baseline. Every benchmark prints one JSON object
+// per line:
+//
+//      {"benchmark":"path_tree_insert_100000","iterations":100000,"nsPerOp":412.7,"minNsPerOp":398.2}
+//
+// where nsPerOp is the median over a few repetitions and minNsPerOp is the best one.
+//
+// Usage: DetoursDataStructureBenchmarks.exe [scale]
+//      scale   multiplies the number of iterations of the benchmarks that do not depend on a path count (default: 1)
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#define _DO_NOT_EXPORT
+#include "PathTree.h"
+#include "ResolvedPathCache.h"
+#include "StringOperations.h"
+
+using namespace std;
+
+static const int REPETITIONS = 5;
+static const size_t PATH_COUNTS[] = { 10000, 100000, 1000000 };
+
+// Number of entries of the single directory of the wide directory benchmarks
+static const size_t WIDE_DIRECTORY_ENTRIES = 10000;
+
+static double NowNs()
+{
+    static LARGE_INTEGER frequency = { 0 };
+    if (frequency.QuadPart == 0)
+    {
+        QueryPerformanceFrequency(&frequency);
+    }
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart * 1e9 / (double)frequency.QuadPart;
+}
+
+static void Print(const string& name, size_t iterations, vector<double>& nsPerOp)
+{
+    sort(nsPerOp.begin(), nsPerOp.end());
+    printf("{\"benchmark\":\"%s\",\"iterations\":%zu,\"nsPerOp\":%.1f,\"minNsPerOp\":%.1f}\n",
+        name.c_str(), iterations, nsPerOp[nsPerOp.size() / 2], nsPerOp[0]);
+    fflush(stdout);
+}
+
+// Runs 'operation' (which performs 'iterations' operations) after a warmup run
+static void Run(const string& name, size_t iterations, const function<void()>& operation)
+{
+    operation();
+
+    vector<double> nsPerOp;
+    for (int repetition = 0; repetition < REPETITIONS; repetition++)
+    {
+        double start = NowNs();
+        operation();
+        nsPerOp.push_back((NowNs() - start) / iterations);
+    }
+
+    Print(name, iterations, nsPerOp);
+}
+
+// Like Run, but 'setup' brings the measured state back (e.g. a fresh tree) before every run and is not measured
+static void RunWithSetup(const string& name, size_t iterations, const function<void()>& setup, const function<void()>& operation)
+{
+    vector<double> nsPerOp;
+    for (int repetition = 0; repetition <= REPETITIONS; repetition++)
+    {
+        setup();
+        double start = NowNs();
+        operation();
+        double elapsed = NowNs() - start;
+
+        // The first run is the warmup
+        if (repetition > 0)
+        {
+            nsPerOp.push_back(elapsed / iterations);
+        }
+    }
+
+    Print(name, iterations, nsPerOp);
+}
+
+// Paths shaped like the ones of a source tree: a few levels of directories with a few dozen entries each, and a
+// fixed prefix every path shares
+static vector<wstring> CreateTreePaths(size_t count)
+{
+    vector<wstring> paths;
+    paths.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        paths.push_back(
+            L"C:\\src\\BuildXL\\Public\\Src\\project" + to_wstring(i / 4096) +
+            L"\\Folder" + to_wstring((i / 64) % 64) +
+            L"\\SubFolder" + to_wstring((i / 8) % 8) +
+            L"\\SourceFile" + to_wstring(i) + L".cpp");
+    }
+
+    return paths;
+}
+
+static vector<wstring> CreateWideDirectoryPaths(size_t count)
+{
+    vector<wstring> paths;
+    paths.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        paths.push_back(L"C:\\out\\obj\\wide\\Entry" + to_wstring(i) + L".obj");
+    }
+
+    return paths;
+}
+
+// Results of the measured operations are accumulated here so they are not optimized away
+static volatile size_t s_sink;
+
+static void Fail(const char* what)
+{
+    fprintf(stderr, "DetoursDataStructureBenchmarks: %s failed\n", what);
+    exit(1);
+}
+
+static void BenchmarkPathTree(const string& suffix, const vector<wstring>& paths, const wstring& root)
+{
+    size_t count = paths.size();
+    PathTree* tree = nullptr;
+    auto freshTree = [&]()
+    {
+        delete tree;
+        tree = new PathTree();
+    };
+
+    auto fullTree = [&]()
+    {
+        freshTree();
+        for (const wstring& path : paths)
+        {
+            tree->TryInsert(path);
+        }
+    };
+
+    RunWithSetup("path_tree_insert_" + suffix, count, freshTree, [&]()
+    {
+        for (const wstring& path : paths)
+        {
+            if (!tree->TryInsert(path)) Fail("PathTree::TryInsert");
+        }
+    });
+
+    // Every path is already there: this walks the whole path and finds every atom and edge
+    RunWithSetup("path_tree_insert_existing_" + suffix, count, fullTree, [&]()
+    {
+        for (const wstring& path : paths)
+        {
+            tree->TryInsert(path);
+        }
+    });
+
+    // Removing the leaves one by one: the lookup of the whole path plus the removal of a single node
+    vector<wstring> descendants;
+    RunWithSetup("path_tree_remove_leaf_" + suffix, count, fullTree, [&]()
+    {
+        for (const wstring& path : paths)
+        {
+            descendants.clear();
+            tree->RetrieveAndRemoveAllDescendants(path, descendants);
+        }
+    });
+
+    // Enumerating a whole subtree at once
+    RunWithSetup("path_tree_remove_subtree_" + suffix, count, fullTree, [&]()
+    {
+        descendants.clear();
+        tree->RetrieveAndRemoveAllDescendants(root, descendants);
+        if (descendants.size() != count) Fail("PathTree::RetrieveAndRemoveAllDescendants");
+    });
+
+    delete tree;
+}
+
+static void BenchmarkResolvedPathCache(const string& suffix, const vector<wstring>& paths)
+{
+    size_t count = paths.size();
+    ResolvedPathCache* cache = nullptr;
+    auto freshCache = [&]()
+    {
+        delete cache;
+        cache = new ResolvedPathCache();
+    };
+
+    RunWithSetup("resolved_path_cache_insert_resolving_check_" + suffix, count, freshCache, [&]()
+    {
+        for (const wstring& path : paths)
+        {
+            cache->InsertResolvingCheckResult(path, false);
+        }
+    });
+
+    Run("resolved_path_cache_get_resolving_check_" + suffix, count, [&]()
+    {
+        for (const wstring& path : paths)
+        {
+            s_sink += cache->GetResolvingCheckResult(path).Found ? 1 : 0;
+        }
+    });
+
+    wstring resolved = L"C:\\target\\resolved";
+    RunWithSetup("resolved_path_cache_insert_resolved_path_" + suffix, count, freshCache, [&]()
+    {
+        for (const wstring& path : paths)
+        {
+            cache->InsertResolvedPathWithType(path, resolved, FILE_ATTRIBUTE_REPARSE_POINT);
+        }
+    });
+
+    Run("resolved_path_cache_get_resolved_path_" + suffix, count, [&]()
+    {
+        for (const wstring& path : paths)
+        {
+            s_sink += cache->GetResolvedPathAndType(path).Found ? 1 : 0;
+        }
+    });
+
+    delete cache;
+}
+
+static void BenchmarkStringOperations(size_t iterations)
+{
+    const wstring path = L"C:\\src\\BuildXL\\Public\\Src\\Sandbox\\Windows\\DetoursServices\\StringOperations.cpp";
+    const wstring otherCasing = L"c:\\SRC\\buildxl\\public\\src\\SANDBOX\\windows\\detoursservices\\stringoperations.CPP";
+    const wstring denormalizedPath = L"C:\\src\\BuildXL\\.\\Public\\Src\\..\\Src\\Sandbox\\Windows\\DetoursServices\\StringOperations.cpp";
+
+    Run("hash_path64", iterations, [&]()
+    {
+        for (size_t i = 0; i < iterations; i++)
+        {
+            s_sink += (size_t)HashPath64(path.c_str(), path.length());
+        }
+    });
+
+    Run("are_equal_case_insensitively", iterations, [&]()
+    {
+        for (size_t i = 0; i < iterations; i++)
+        {
+            s_sink += AreEqualCaseInsensitively(path, otherCasing) ? 1 : 0;
+        }
+    });
+
+    CaseInsensitiveStringLessThan lessThan;
+    Run("case_insensitive_less_than", iterations, [&]()
+    {
+        for (size_t i = 0; i < iterations; i++)
+        {
+            s_sink += lessThan(path, otherCasing) ? 1 : 0;
+        }
+    });
+
+    vector<wstring> elements;
+    Run("try_decompose_path", iterations, [&]()
+    {
+        for (size_t i = 0; i < iterations; i++)
+        {
+            elements.clear();
+            if (TryDecomposePath(path, elements) != 0) Fail("TryDecomposePath");
+        }
+    });
+
+    Run("normalize_path", iterations, [&]()
+    {
+        for (size_t i = 0; i < iterations; i++)
+        {
+            s_sink += NormalizePath(denormalizedPath).length();
+        }
+    });
+}
+
+int main(int argc, char** argv)
+{
+    int scale = argc > 1 ? atoi(argv[1]) : 1;
+    if (scale <= 0)
+    {
+        fprintf(stderr, "Usage: %s [scale]\n", argv[0]);
+        return 1;
+    }
+
+    for (size_t count : PATH_COUNTS)
+    {
+        vector<wstring> paths = CreateTreePaths(count);
+        BenchmarkPathTree(to_string(count), paths, L"C:\\src");
+        BenchmarkResolvedPathCache(to_string(count), paths);
+    }
+
+    // Many siblings under a single directory, so the cost of finding a child among a lot of others dominates
+    vector<wstring> widePaths = CreateWideDirectoryPaths(WIDE_DIRECTORY_ENTRIES);
+    BenchmarkPathTree("wide_directory", widePaths, L"C:\\out\\obj\\wide");
+
+    BenchmarkStringOperations(100000 * (size_t)scale);
+    return 0;
+}
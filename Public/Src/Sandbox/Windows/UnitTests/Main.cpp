@@ -16,4 +16,4 @@
 #include "PathTreeTests.h"
 #include "StringOperationsTests.h"
 #include "ResolvedPathCacheTests.h"
-#include "TreeNodeTests.h"
\ No newline at end of file
+#include "ShimProcessMatcherTests.h"
\ No newline at end of file
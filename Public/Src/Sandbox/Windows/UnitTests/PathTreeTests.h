@@ -134,6 +134,58 @@ BOOST_AUTO_TEST_CASE( CasePreservingPaths )
     BOOST_CHECK(contains(desc, L"C:\\a\\path\\to\\ELSE"));
 }
 
+BOOST_AUTO_TEST_CASE( ManySiblings )
+{
+    PathTree t;
+    for (int i = 0; i < 300; i++)
+    {
+        t.TryInsert(L"C:\\a\\dir" + std::to_wstring(i) + L"\\file");
+    }
+
+    t.TryInsert(L"C:\\b\\file");
+
+    // Children are found regardless of how many siblings they have
+    std::vector<std::wstring> desc;
+    t.RetrieveAndRemoveAllDescendants(L"C:\\A\\DIR150", desc);
+    BOOST_CHECK_EQUAL(1, desc.size());
+    BOOST_CHECK(contains(desc, L"C:\\a\\dir150\\file"));
+
+    desc.clear();
+    t.RetrieveAndRemoveAllDescendants(L"C:\\a", desc);
+    BOOST_CHECK_EQUAL(299, desc.size());
+    BOOST_CHECK(contains(desc, L"C:\\a\\dir0\\file"));
+    BOOST_CHECK(!contains(desc, L"C:\\a\\dir150\\file"));
+    BOOST_CHECK(contains(desc, L"C:\\a\\dir299\\file"));
+
+    // Atoms shared with the removed paths are still found under other parents
+    desc.clear();
+    t.RetrieveAndRemoveAllDescendants(L"C:\\b", desc);
+    BOOST_CHECK_EQUAL(1, desc.size());
+    BOOST_CHECK(contains(desc, L"C:\\b\\file"));
+}
+
+BOOST_AUTO_TEST_CASE( ReinsertAfterRemoval )
+{
+    PathTree t;
+    t.TryInsert(L"C:\\a\\path\\to\\something");
+    t.TryInsert(L"C:\\a\\other");
+
+    std::vector<std::wstring> desc;
+    t.RetrieveAndRemoveAllDescendants(L"C:\\a\\path", desc);
+    BOOST_CHECK_EQUAL(1, desc.size());
+
+    // Removed nodes are reused for new paths
+    t.TryInsert(L"C:\\a\\path\\to\\something-else");
+    t.TryInsert(L"C:\\a\\new\\path");
+
+    desc.clear();
+    t.RetrieveAndRemoveAllDescendants(L"C:\\a", desc);
+    BOOST_CHECK_EQUAL(3, desc.size());
+    BOOST_CHECK(contains(desc, L"C:\\a\\other"));
+    BOOST_CHECK(contains(desc, L"C:\\a\\path\\to\\something-else"));
+    BOOST_CHECK(contains(desc, L"C:\\a\\new\\path"));
+}
+
 bool contains(std::vector<std::wstring>& collection, const std::wstring& element) noexcept
 {
     for (auto iter = collection.begin(); iter != collection.end(); iter++)
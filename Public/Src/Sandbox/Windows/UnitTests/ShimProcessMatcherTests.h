@@ -0,0 +1,75 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <ShimProcessMatcher.h>
+#include <string>
+
+BOOST_AUTO_TEST_SUITE(ShimProcessMatcherTests)
+
+static bool MatchesCommand(const ShimProcessMatcher& matcher, const std::wstring& command, const std::wstring& commandArgs)
+{
+    return matcher.Matches(command.c_str(), command.length(), commandArgs.c_str(), commandArgs.length());
+}
+
+BOOST_AUTO_TEST_CASE( ProcessNameMatches )
+{
+    ShimProcessMatcher matcher;
+    matcher.AddRule(L"cmd.exe", nullptr);
+    matcher.Seal();
+
+    BOOST_CHECK(!matcher.IsEmpty());
+    BOOST_CHECK(MatchesCommand(matcher, L"cmd.exe", L""));
+    BOOST_CHECK(MatchesCommand(matcher, L"CMD.EXE", L"/c foo"));
+    BOOST_CHECK(MatchesCommand(matcher, L"C:\\Windows\\System32\\cmd.exe", L"/c foo"));
+
+    // The process name must be the whole command or follow a separator
+    BOOST_CHECK(!MatchesCommand(matcher, L"C:\\Windows\\System32\\xcmd.exe", L""));
+    BOOST_CHECK(!MatchesCommand(matcher, L"cmd.exe.bak", L""));
+    BOOST_CHECK(!MatchesCommand(matcher, L"md.exe", L""));
+    BOOST_CHECK(!MatchesCommand(matcher, L"", L""));
+}
+
+BOOST_AUTO_TEST_CASE( ArgumentMatches )
+{
+    ShimProcessMatcher matcher;
+    matcher.AddRule(L"cmd.exe", L"/c build");
+    matcher.AddRule(L"Cmd.exe", L"--test");
+    matcher.AddRule(L"node.exe", L"aab");
+    matcher.Seal();
+
+    BOOST_CHECK(MatchesCommand(matcher, L"C:\\Windows\\cmd.exe", L"/c build.cmd"));
+    BOOST_CHECK(MatchesCommand(matcher, L"cmd.exe", L"x --test y"));
+    BOOST_CHECK(!MatchesCommand(matcher, L"cmd.exe", L"/c test"));
+
+    // Argument matches are case-sensitive
+    BOOST_CHECK(!MatchesCommand(matcher, L"cmd.exe", L"/C BUILD"));
+
+    // Argument matches only apply to their own process name
+    BOOST_CHECK(!MatchesCommand(matcher, L"node.exe", L"--test"));
+
+    // Partial matches that overlap the actual match
+    BOOST_CHECK(MatchesCommand(matcher, L"node.exe", L"aaab"));
+    BOOST_CHECK(!MatchesCommand(matcher, L"node.exe", L"aaa"));
+}
+
+BOOST_AUTO_TEST_CASE( EmptyArgumentMatchMatchesAnyArguments )
+{
+    ShimProcessMatcher matcher;
+    matcher.AddRule(L"cmd.exe", L"/c build");
+    matcher.AddRule(L"cmd.exe", L"");
+    matcher.Seal();
+
+    BOOST_CHECK(MatchesCommand(matcher, L"cmd.exe", L"anything"));
+    BOOST_CHECK(MatchesCommand(matcher, L"cmd.exe", L""));
+}
+
+BOOST_AUTO_TEST_CASE( NoRules )
+{
+    ShimProcessMatcher matcher;
+    matcher.Seal();
+
+    BOOST_CHECK(matcher.IsEmpty());
+    BOOST_CHECK(!MatchesCommand(matcher, L"cmd.exe", L""));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
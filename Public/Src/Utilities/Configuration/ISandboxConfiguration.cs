@@ -60,11 +60,17 @@ namespace BuildXL.Utilities.Configuration
         /// <summary>
         /// Whether BuildXL will use larger NtClose prealocated list.
         /// </summary>
+        /// <remarks>
+        /// Has no effect: the Windows sandbox removes handle overlays directly in NtClose, without a closed handle list.
+        /// </remarks>
         bool UseLargeNtClosePreallocatedList { get; }
 
         /// <summary>
         /// Whether BuildXL will use extra thread to drain NtClose handle List or clean the cache directly.
         /// </summary>
+        /// <remarks>
+        /// Has no effect: the Windows sandbox removes handle overlays directly in NtClose, without a closed handle list.
+        /// </remarks>
         bool UseExtraThreadToDrainNtClose { get; }
 
         /// <summary>
@@ -109,6 +115,16 @@ namespace BuildXL.Utilities.Configuration
         /// </summary>
         AbsolutePath SurvivingPipProcessChildrenDumpDirectory { get; }
 
+        /// <summary>
+        /// On Linux, directory where the sandbox keeps whether the executables run by pips require the ptrace sandbox (i.e., are statically linked
+        /// or have file capabilities), so a pip starts with the classifications made by previous builds instead of inspecting every executable again.
+        /// </summary>
+        /// <remarks>
+        /// Classifications are keyed by the identity and change time of the executable, so they are shared by all pips and never go stale.
+        /// When not set, classifications only last for the run of a pip (they are kept in its temp directory).
+        /// </remarks>
+        AbsolutePath LinuxPTraceClassificationDirectory { get; }
+
         #endregion
 
         #region Logging options for the Sandbox
@@ -275,6 +291,12 @@ namespace BuildXL.Utilities.Configuration
         /// </summary>
         IReadOnlyList<AbsolutePath> DirectoriesToEnableFullReparsePointParsing { get; }
 
+        /// <summary>
+        /// List of directory paths known to contain no reparse points, neither under them nor on the path to them (e.g., because the volume has none).
+        /// Detours does not look for reparse points when resolving paths under them.
+        /// </summary>
+        IReadOnlyList<AbsolutePath> DirectoriesWithoutReparsePoints { get; }
+
         /// <summary>
         /// Enable explicitly reporting directory probes from detours to help avoid underbuilds caused by unreported directory probes.
         /// </summary>
@@ -325,6 +347,143 @@ namespace BuildXL.Utilities.Configuration
         /// </remarks>
         public bool UnconditionallyEnableLinuxPTraceSandbox { get; }
 
+        /// <summary>
+        /// When the PTrace sandbox is used on Linux, drive it with seccomp user notifications instead of ptrace stops
+        /// if the kernel supports it. Disabled by default.
+        /// </summary>
+        /// <remarks>
+        /// Only meaningful when <see cref="EnableLinuxPTraceSandbox"/> is on. Kernels that don't support seccomp user notifications
+        /// (see the native PTraceSandbox for the details) keep using ptrace.
+        /// </remarks>
+        public bool EnableLinuxSeccompNotifySandbox { get; }
+
+        /// <summary>
+        /// On Linux, lets all the processes of a pip share a dedup cache of the file accesses that were already reported,
+        /// so accesses repeated across processes (e.g., toolchain reads in compiler invocation chains) are reported only once. Disabled by default.
+        /// </summary>
+        /// <remarks>
+        /// Accesses are deduplicated per executable, so executable-based file access allowlists see the same accesses as without the cache.
+        /// </remarks>
+        public bool EnableLinuxSharedAccessCache { get; }
+
+        /// <summary>
+        /// On Linux, makes every process observed by the sandbox collect per-function call counts and latency histograms
+        /// (plus cache, readlink and report counters) and log them as a single debug message when it exits. Disabled by default.
+        /// </summary>
+        /// <remarks>
+        /// The statistics end up in the pip's sandbox debug log, so they are only visible when debug logging of the sandboxed process is on.
+        /// </remarks>
+        public bool EnableLinuxSandboxStatistics { get; }
+
+        /// <summary>
+        /// On Windows, makes the detoured processes of a pip send their reports through a ring in shared memory created by BuildXL,
+        /// instead of issuing a write to the report pipe for every report. The pipe is still used when the ring is full. Disabled by default.
+        /// </summary>
+        public bool EnableSharedMemoryReports { get; }
+
+        /// <summary>
+        /// On Windows, makes detoured processes send file accesses as compact reports, with fixed-size fields and the paths already sent by
+        /// the same process replaced by an id, instead of text lines that have to be parsed back. Disabled by default.
+        /// </summary>
+        public bool EnableCompactFileAccessReports { get; }
+
+        /// <summary>
+        /// On Windows, makes each detoured thread batch its file access reports instead of writing every report to the report pipe right away.
+        /// Batches are flushed when full, before creating a child process, and when the thread or the process exits. Disabled by default.
+        /// </summary>
+        public bool EnableReportBatching { get; }
+
+        /// <summary>
+        /// On Windows, makes the sandboxed processes of a pip share the reparse point targets they resolve, through a cache in shared memory created for the pip.
+        /// Reparse points resolved by a process are not queried again by its siblings and descendants. Disabled by default.
+        /// </summary>
+        public bool EnableSharedReparsePointCache { get; }
+
+        /// <summary>
+        /// On Windows, sends the sandboxed processes a flat, hash-indexed table of the file access manifest along with its tree, so looking up the policy of a path
+        /// takes a few probes instead of one lookup per path component. Disabled by default.
+        /// </summary>
+        public bool EnableManifestRecordIndex { get; }
+
+        /// <summary>
+        /// On Windows, makes the sandboxed processes of a pip share the file access manifest they pass to their child processes through a read-only section,
+        /// instead of copying it into every child. Disabled by default.
+        /// </summary>
+        public bool EnableSharedPayloadSection { get; }
+
+        /// <summary>
+        /// On Windows, makes the detoured processes of a pip profile the functions intercepted by the sandbox: call counts, time spent, and time spent evaluating policies.
+        /// The profile of each process is sent as Detours debug messages when it exits, which are logged as verbose messages of the pip.
+        /// </summary>
+        public bool EnableDetoursProfile { get; }
+
+        /// <summary>
+        /// On Linux, pips that do not fail on unexpected file accesses are only observed through the calls that name paths (e.g. open, exec, rename, stat) and
+        /// through LD_AUDIT: calls on already open descriptors (e.g. write, fwrite, putc, readdir) go straight to libc. Directory enumerations are reported when
+        /// a directory is opened. Disabled by default.
+        /// </summary>
+        public bool EnableLinuxLightweightObservation { get; }
+
+        /// <summary>
+        /// On Linux, has the ptrace sandbox keep a table of the paths behind the file descriptors of its tracees instead of resolving every
+        /// descriptor of fd-based syscalls through /proc.
+        /// </summary>
+        /// <remarks>
+        /// This makes tracees stop on close, close_range, dup2 and dup3 as well, so it only pays off for processes that issue many fd-based
+        /// writes, truncates or metadata changes per descriptor. Not used when the ptrace sandbox runs on seccomp notifications.
+        /// </remarks>
+        public bool EnableLinuxPTraceFdTable { get; }
+
+        /// <summary>
+        /// On Windows, makes the detoured processes of a pip clone the blocks of the files they copy with CopyFileExW when the source and the destination
+        /// are on the same volume and the volume supports block cloning (e.g. ReFS, Dev Drive), which makes copying files materialized from the cache
+        /// almost free. Copies that can't be cloned fall back to CopyFileExW. Disabled by default.
+        /// </summary>
+        public bool EnableBlockCloneCopies { get; }
+
+        /// <summary>
+        /// On Windows, makes the detoured processes of a pip drop the file access reports identical to one they already sent, e.g. the
+        /// probes of compilers and linkers that scan the same include and library paths many times. Disabled by default.
+        /// </summary>
+        public bool EnableReportDeduplication { get; }
+
+        /// <summary>
+        /// On Linux, places the processes of each pip in a cgroup v2 leaf of their own, and takes the CPU times, memory high-water mark and IO counters
+        /// of the pip from that cgroup when it completes, instead of sampling every process of the pip under /proc. Disabled by default.
+        /// </summary>
+        /// <remarks>
+        /// The leaves are created next to the cgroup BuildXL runs in, so its parent must be delegated to the user running the build (e.g., with
+        /// systemd's Delegate=yes) and have the memory and io controllers enabled for its children. Pips fall back to sampling when a leaf can't be created.
+        /// </remarks>
+        public bool EnableLinuxCgroupAccounting { get; }
+
+        /// <summary>
+        /// On Linux, makes the sandboxed processes of a pip compress the batches of reports they write to the report FIFO (each write is a self-contained
+        /// LZ4 block). Meant for pips whose reports are forwarded across a network hop by a remoting or virtualization layer. Disabled by default.
+        /// </summary>
+        public bool EnableLinuxCompressedReports { get; }
+
+        /// <summary>
+        /// On Linux, makes the ptrace sandbox hand the processes it traces back to the interposed sandbox when they exec a dynamically linked program,
+        /// and take them over again when they exec a statically linked one. Only the statically linked part of a process tree is then decoded by the tracer.
+        /// Disabled by default.
+        /// </summary>
+        /// <remarks>
+        /// The tracer stays attached to the processes it hands back (their seccomp filter still stops them on every syscall), so this saves the work of
+        /// the tracer but not the stops. Has no effect with the seccomp user notification sandbox.
+        /// </remarks>
+        public bool EnableLinuxPTraceHandBack { get; }
+
+        /// <summary>
+        /// On Linux, makes the sandboxed processes of a pip report only a deterministic sample (picked by a hash of the path) of the allowed accesses
+        /// that don't write, and count the rest per parent directory. Writes, execs, denied accesses and process lifecycle events are still all reported.
+        /// Meant for pips run only to profile their I/O. Disabled by default.
+        /// </summary>
+        /// <remarks>
+        /// The observed inputs of a pip are incomplete in this mode, so its results are never stored to the cache.
+        /// </remarks>
+        public bool EnableLinuxSampledObservation { get; }
+
         /// <summary>
         /// Ignores DeviceIoControl calls, in particular the case of FSCTL_GET_REPARSE_POINT
         /// </summary>
@@ -51,11 +51,30 @@ namespace BuildXL.Utilities.Configuration.Mutable
             GlobalUnsafePassthroughEnvironmentVariables = new List<string>();
             VmConcurrencyLimit = 0;
             DirectoriesToEnableFullReparsePointParsing = new List<AbsolutePath>();
+            DirectoriesWithoutReparsePoints = new List<AbsolutePath>();
             ExplicitlyReportDirectoryProbes = OperatingSystemHelper.IsLinuxOS;
             PreserveFileSharingBehaviour = false;
             EnableLinuxPTraceSandbox = true;
             AlwaysRemoteInjectDetoursFrom32BitProcess = true;
             UnconditionallyEnableLinuxPTraceSandbox = false;
+            EnableLinuxSeccompNotifySandbox = false;
+            EnableLinuxSharedAccessCache = false;
+            EnableLinuxSandboxStatistics = false;
+            EnableSharedMemoryReports = false;
+            EnableCompactFileAccessReports = false;
+            EnableReportBatching = false;
+            EnableSharedReparsePointCache = false;
+            EnableManifestRecordIndex = false;
+            EnableSharedPayloadSection = false;
+            EnableDetoursProfile = false;
+            EnableLinuxLightweightObservation = false;
+            EnableLinuxPTraceFdTable = false;
+            EnableBlockCloneCopies = false;
+            EnableReportDeduplication = false;
+            EnableLinuxCgroupAccounting = false;
+            EnableLinuxCompressedReports = false;
+            EnableLinuxPTraceHandBack = false;
+            EnableLinuxSampledObservation = false;
             // TODO: flip the default once we have verified this is not a breaking change
             IgnoreDeviceIoControlGetReparsePoint = true;
             ForceAddExecutionPermission = true;
@@ -76,6 +95,7 @@ namespace BuildXL.Utilities.Configuration.Mutable
             WarningTimeoutMultiplier = template.WarningTimeoutMultiplier;
             TimeoutDumpDirectory = pathRemapper.Remap(template.TimeoutDumpDirectory);
             SurvivingPipProcessChildrenDumpDirectory = pathRemapper.Remap(template.SurvivingPipProcessChildrenDumpDirectory);
+            LinuxPTraceClassificationDirectory = pathRemapper.Remap(template.LinuxPTraceClassificationDirectory);
             LogObservedFileAccesses = template.LogObservedFileAccesses;
             LogProcesses = template.LogProcesses;
             LogProcessData = template.LogProcessData;
@@ -108,11 +128,30 @@ namespace BuildXL.Utilities.Configuration.Mutable
             GlobalUnsafePassthroughEnvironmentVariables = new List<string>(template.GlobalUnsafePassthroughEnvironmentVariables);
             VmConcurrencyLimit = template.VmConcurrencyLimit;
             DirectoriesToEnableFullReparsePointParsing = pathRemapper.Remap(template.DirectoriesToEnableFullReparsePointParsing);
+            DirectoriesWithoutReparsePoints = pathRemapper.Remap(template.DirectoriesWithoutReparsePoints);
             ExplicitlyReportDirectoryProbes = template.ExplicitlyReportDirectoryProbes;
             PreserveFileSharingBehaviour = template.PreserveFileSharingBehaviour;
             EnableLinuxPTraceSandbox = template.EnableLinuxPTraceSandbox;
             AlwaysRemoteInjectDetoursFrom32BitProcess = template.AlwaysRemoteInjectDetoursFrom32BitProcess;
             UnconditionallyEnableLinuxPTraceSandbox = template.UnconditionallyEnableLinuxPTraceSandbox;
+            EnableLinuxSeccompNotifySandbox = template.EnableLinuxSeccompNotifySandbox;
+            EnableLinuxSharedAccessCache = template.EnableLinuxSharedAccessCache;
+            EnableLinuxSandboxStatistics = template.EnableLinuxSandboxStatistics;
+            EnableSharedMemoryReports = template.EnableSharedMemoryReports;
+            EnableCompactFileAccessReports = template.EnableCompactFileAccessReports;
+            EnableReportBatching = template.EnableReportBatching;
+            EnableSharedReparsePointCache = template.EnableSharedReparsePointCache;
+            EnableManifestRecordIndex = template.EnableManifestRecordIndex;
+            EnableSharedPayloadSection = template.EnableSharedPayloadSection;
+            EnableDetoursProfile = template.EnableDetoursProfile;
+            EnableLinuxLightweightObservation = template.EnableLinuxLightweightObservation;
+            EnableLinuxPTraceFdTable = template.EnableLinuxPTraceFdTable;
+            EnableBlockCloneCopies = template.EnableBlockCloneCopies;
+            EnableReportDeduplication = template.EnableReportDeduplication;
+            EnableLinuxCgroupAccounting = template.EnableLinuxCgroupAccounting;
+            EnableLinuxCompressedReports = template.EnableLinuxCompressedReports;
+            EnableLinuxPTraceHandBack = template.EnableLinuxPTraceHandBack;
+            EnableLinuxSampledObservation = template.EnableLinuxSampledObservation;
             IgnoreDeviceIoControlGetReparsePoint = template.IgnoreDeviceIoControlGetReparsePoint;
             ForceAddExecutionPermission = template.ForceAddExecutionPermission;
         }
@@ -181,6 +220,9 @@ namespace BuildXL.Utilities.Configuration.Mutable
         /// <inheritdoc />
         public AbsolutePath SurvivingPipProcessChildrenDumpDirectory { get; set; }
 
+        /// <inheritdoc />
+        public AbsolutePath LinuxPTraceClassificationDirectory { get; set; }
+
         /// <inheritdoc />
         public bool LogObservedFileAccesses { get; set; }
 
@@ -277,6 +319,12 @@ namespace BuildXL.Utilities.Configuration.Mutable
         /// <inheritdoc />
         IReadOnlyList<AbsolutePath> ISandboxConfiguration.DirectoriesToEnableFullReparsePointParsing => DirectoriesToEnableFullReparsePointParsing;
 
+        /// <nodoc />
+        public List<AbsolutePath> DirectoriesWithoutReparsePoints { get; set; }
+
+        /// <inheritdoc />
+        IReadOnlyList<AbsolutePath> ISandboxConfiguration.DirectoriesWithoutReparsePoints => DirectoriesWithoutReparsePoints;
+
         /// <inheritdoc />
         public bool ExplicitlyReportDirectoryProbes { get; set; }
 
@@ -292,6 +340,60 @@ namespace BuildXL.Utilities.Configuration.Mutable
         /// <inheritdoc />
         public bool UnconditionallyEnableLinuxPTraceSandbox { get; set; }
 
+        /// <inheritdoc />
+        public bool EnableLinuxSeccompNotifySandbox { get; set; }
+
+        /// <inheritdoc />
+        public bool EnableLinuxSharedAccessCache { get; set; }
+
+        /// <inheritdoc />
+        public bool EnableLinuxSandboxStatistics { get; set; }
+
+        /// <inheritdoc />
+        public bool EnableSharedMemoryReports { get; set; }
+
+        /// <inheritdoc />
+        public bool EnableCompactFileAccessReports { get; set; }
+
+        /// <inheritdoc />
+        public bool EnableReportBatching { get; set; }
+
+        /// <inheritdoc />
+        public bool EnableSharedReparsePointCache { get; set; }
+
+        /// <inheritdoc />
+        public bool EnableManifestRecordIndex { get; set; }
+
+        /// <inheritdoc />
+        public bool EnableSharedPayloadSection { get; set; }
+
+        /// <inheritdoc />
+        public bool EnableDetoursProfile { get; set; }
+
+        /// <inheritdoc />
+        public bool EnableLinuxLightweightObservation { get; set; }
+
+        /// <inheritdoc />
+        public bool EnableLinuxPTraceFdTable { get; set; }
+
+        /// <inheritdoc />
+        public bool EnableBlockCloneCopies { get; set; }
+
+        /// <inheritdoc />
+        public bool EnableReportDeduplication { get; set; }
+
+        /// <inheritdoc />
+        public bool EnableLinuxCgroupAccounting { get; set; }
+
+        /// <inheritdoc />
+        public bool EnableLinuxCompressedReports { get; set; }
+
+        /// <inheritdoc />
+        public bool EnableLinuxPTraceHandBack { get; set; }
+
+        /// <inheritdoc />
+        public bool EnableLinuxSampledObservation { get; set; }
+
         /// <inheritdoc/>
         public bool IgnoreDeviceIoControlGetReparsePoint { get; set; }
 
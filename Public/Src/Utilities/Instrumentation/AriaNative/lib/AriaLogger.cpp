@@ -20,6 +20,16 @@ AriaLogger::AriaLogger(const char* token, const char *dbPath, int teardownTimeou
 
     logger_ = LogManager::Initialize(token);
     LogManager::SetTransmitProfile(TransmitProfile_NearRealTime);
+
+    stub_.next.store(nullptr, std::memory_order_relaxed);
+    head_.store(&stub_, std::memory_order_relaxed);
+    tail_ = &stub_;
+    queuedCount_.store(0, std::memory_order_relaxed);
+    droppedCount_.store(0, std::memory_order_relaxed);
+    stopping_.store(false, std::memory_order_relaxed);
+
+    wakeUpEvent_ = CreateEventW(nullptr, /* bManualReset */ FALSE, /* bInitialState */ FALSE, nullptr);
+    flushThread_ = std::thread([this]() { FlushThread(); });
 }
 
 #pragma warning( push )
@@ -32,11 +42,140 @@ AriaLogger::~AriaLogger()
 // The function is declared 'noexcept' but calls function 'FlushAndTeardown()' which may throw exceptions
 // This destructor is not declared as noexcept, not sure why we get warning, but we can ignore it.
 #pragma warning( disable : 26447 )
+    // The flush thread drains the queue (within 'TeardownFlushDeadlineMs') before exiting
+    stopping_.store(true, std::memory_order_release);
+    if (wakeUpEvent_ != nullptr)
+    {
+        SetEvent(wakeUpEvent_);
+    }
+
+    if (flushThread_.joinable())
+    {
+        flushThread_.join();
+    }
+
+    // Whatever the flush thread could not hand over in time is dropped
+    for (QueuedEvent *event = Pop(); event != nullptr; event = Pop())
+    {
+        droppedCount_.fetch_add(1, std::memory_order_relaxed);
+        delete event;
+    }
+
+    if (wakeUpEvent_ != nullptr)
+    {
+        CloseHandle(wakeUpEvent_);
+    }
+
     LogManager::FlushAndTeardown();
 #pragma warning( pop )
 }
 #pragma warning( pop )
 
+void AriaLogger::Push(QueuedEvent *event) const noexcept
+{
+    event->next.store(nullptr, std::memory_order_relaxed);
+    QueuedEvent *previous = head_.exchange(event, std::memory_order_acq_rel);
+    previous->next.store(event, std::memory_order_release);
+}
+
+// Only called from the flush thread (or once it is gone); returns null when the queue is empty, or when a producer
+// is in the middle of pushing the next event (which is then picked up by the next drain)
+AriaLogger::QueuedEvent *AriaLogger::Pop() noexcept
+{
+    QueuedEvent *tail = tail_;
+    QueuedEvent *next = tail->next.load(std::memory_order_acquire);
+    if (tail == &stub_)
+    {
+        if (next == nullptr)
+        {
+            return nullptr;
+        }
+
+        tail_ = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+
+    if (next != nullptr)
+    {
+        tail_ = next;
+        return tail;
+    }
+
+    if (tail != head_.load(std::memory_order_acquire))
+    {
+        return nullptr;
+    }
+
+    // 'tail' is the last event: put the stub back behind it so that it can be handed out
+    Push(&stub_);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next != nullptr)
+    {
+        tail_ = next;
+        return tail;
+    }
+
+    return nullptr;
+}
+
+void AriaLogger::Drain(ULONGLONG deadline) noexcept
+{
+    for (QueuedEvent *event = Pop(); event != nullptr; event = Pop())
+    {
+        queuedCount_.fetch_sub(1, std::memory_order_relaxed);
+        if (logger_ != nullptr)
+        {
+            logger_->LogEvent(event->properties);
+        }
+
+        delete event;
+
+        if (GetTickCount64() >= deadline)
+        {
+            return;
+        }
+    }
+}
+
+void AriaLogger::FlushThread() noexcept
+{
+    while (!stopping_.load(std::memory_order_acquire))
+    {
+        // Producers only wake the thread up when the queue was empty, the interval picks up whatever raced with that
+        WaitForSingleObject(wakeUpEvent_, FlushIntervalMs);
+        Drain(MAXULONGLONG);
+    }
+
+    Drain(GetTickCount64() + TeardownFlushDeadlineMs);
+}
+
+bool AriaLogger::Enqueue(EventProperties &&properties) const
+{
+    if (stopping_.load(std::memory_order_acquire))
+    {
+        droppedCount_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    const long queued = queuedCount_.fetch_add(1, std::memory_order_relaxed);
+    if (queued >= MaxQueuedEvents)
+    {
+        queuedCount_.fetch_sub(1, std::memory_order_relaxed);
+        droppedCount_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    Push(new QueuedEvent{ {nullptr}, std::move(properties) });
+
+    if (queued == 0 && wakeUpEvent_ != nullptr)
+    {
+        SetEvent(wakeUpEvent_);
+    }
+
+    return true;
+}
+
 ILogger *AriaLogger::GetLogger() const noexcept
 {
     return logger_;
@@ -92,11 +231,8 @@ void WINAPI LogEvent(const AriaLogger *logger, const char *eventName, int eventP
             }
         }
 
-        ILogger *log = logger->GetLogger();
-        if (log != nullptr)
-        {
-            log->LogEvent(props);
-        }
+        // Handed over to Aria by the flush thread of the logger
+        logger->Enqueue(std::move(props));
     }
 }
 
@@ -10,18 +10,56 @@
 
 #include <Windows.h>
 
+#include <atomic>
+#include <thread>
+
 using namespace MAT;
 
+// Events are handed over to Aria from a background thread, so that logging never blocks the calling threads:
+// 'LogEvent' only copies the event into a lock-free multiple-producer single-consumer queue (Vyukov's intrusive
+// MPSC queue) and wakes the flush thread up if the queue was empty.
+//
+// The queue holds at most 'MaxQueuedEvents' events; events logged while it is full are dropped (and counted).
+// Upon teardown, the flush thread hands the queued events over to Aria for at most 'TeardownFlushDeadlineMs'
+// and drops whatever is left after that, before Aria itself is torn down.
 class AriaLogger
 {
 
 private:
 
+    static constexpr long MaxQueuedEvents = 16 * 1024;
+    static constexpr DWORD FlushIntervalMs = 250;
+    static constexpr ULONGLONG TeardownFlushDeadlineMs = 2000;
+
+    struct QueuedEvent
+    {
+        std::atomic<QueuedEvent*> next;
+        EventProperties properties;
+    };
+
     std::string token_;
     std::string dbPath_;
 
     ILogger *logger_;
 
+    // Queue state: 'LogEvent' takes a const logger, enqueuing does not change what the logger is
+    mutable std::atomic<QueuedEvent*> head_;    // last enqueued event (producers)
+    mutable QueuedEvent *tail_;                 // next event to dequeue (consumer), or 'stub_'
+    mutable QueuedEvent stub_;
+    mutable std::atomic<long> queuedCount_;
+    mutable std::atomic<long> droppedCount_;
+
+    std::atomic<bool> stopping_;
+    HANDLE wakeUpEvent_;
+    std::thread flushThread_;
+
+    void Push(QueuedEvent *event) const noexcept;
+    QueuedEvent *Pop() noexcept;
+
+    // Hands the queued events over to Aria until the queue is empty or 'deadline' (a GetTickCount64 value) is reached
+    void Drain(ULONGLONG deadline) noexcept;
+    void FlushThread() noexcept;
+
 public:
 
     AriaLogger() = delete;
@@ -30,6 +68,11 @@ public:
     ~AriaLogger();
 
     ILogger *GetLogger() const noexcept;
+
+    // Queues an event to be handed over to Aria by the flush thread; returns false if the event had to be dropped
+    bool Enqueue(EventProperties &&properties) const;
+
+    long GetDroppedEventCount() const noexcept { return droppedCount_.load(std::memory_order_relaxed); }
 };
 
 struct AriaEventProperty
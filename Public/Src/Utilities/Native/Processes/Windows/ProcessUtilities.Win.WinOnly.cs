@@ -343,6 +343,40 @@ namespace BuildXL.Native.Processes.Windows
             }
         }
 
+        /// <summary>
+        /// Same as <see cref="FindFileAccessPolicyInTree"/>, but the lookup goes through the record index that follows the tree in <paramref name="recordBytes"/>.
+        /// </summary>
+        public static bool FindFileAccessPolicyInIndexedTree(
+            byte[] recordBytes,
+            string absolutePath,
+            UIntPtr absolutePathLength,
+            out uint conePolicy,
+            out uint nodePolicy,
+            out uint pathId,
+            out IO.Usn expectedUsn)
+        {
+            Assert64Process();
+
+            GCHandle pinnedRecordArray = GCHandle.Alloc(recordBytes, GCHandleType.Pinned);
+            try
+            {
+                IntPtr record = pinnedRecordArray.AddrOfPinnedObject();
+                return ExternFindFileAccessPolicyInIndexedTree(
+                    record,
+                    new UIntPtr((uint)recordBytes.Length),
+                    absolutePath,
+                    absolutePathLength,
+                    out conePolicy,
+                    out nodePolicy,
+                    out pathId,
+                    out expectedUsn);
+            }
+            finally
+            {
+                pinnedRecordArray.Free();
+            }
+        }
+
         /// <nodoc />
         [DllImport("kernel32.dll")]
         public static extern IntPtr GetConsoleWindow();
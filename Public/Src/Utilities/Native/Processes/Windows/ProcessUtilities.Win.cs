@@ -405,6 +405,18 @@ namespace BuildXL.Native.Processes.Windows
             out uint pathId,
             out IO.Usn expectedUsn);
 
+        [DllImport(ExternDll.BuildXLNatives64, EntryPoint = "FindFileAccessPolicyInIndexedTree", SetLastError = true, BestFitMapping = false, ThrowOnUnmappableChar = true)]
+        [return: MarshalAs(UnmanagedType.Bool)]
+        private static extern bool ExternFindFileAccessPolicyInIndexedTree(
+            IntPtr record,
+            UIntPtr recordSize,
+            [MarshalAs(UnmanagedType.LPWStr)] string absolutePath,
+            UIntPtr absolutePathLength,
+            out uint conePolicy,
+            out uint nodePolicy,
+            out uint pathId,
+            out IO.Usn expectedUsn);
+
         [DllImport(ExternDll.Kernel32, EntryPoint = "CreateJobObject", SetLastError = true, CharSet = CharSet.Unicode)]
         private static extern IntPtr ExternCreateJobObject([In] IntPtr lpJobAttributes, string? lpName);
 
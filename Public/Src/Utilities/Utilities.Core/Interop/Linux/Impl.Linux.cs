@@ -37,6 +37,8 @@ namespace BuildXL.Interop.Unix
         private const string ProcMemInfoPath = "/meminfo";
         private const string ProcStatusPath = "/status";
         private const string ProcIoPath = "/io";
+        private const string ProcCgroupPath = "/cgroup";
+        private const string CgroupFileSystemPath = "/sys/fs/cgroup";
 
         private static long TicksPerSecond;
 
@@ -437,6 +439,111 @@ namespace BuildXL.Interop.Unix
             yield break;
         }
 
+        /// <summary>
+        /// Linux specific implementation of <see cref="Process.TryCreateCgroup"/>
+        /// </summary>
+        internal static string TryCreateCgroup(string name)
+        {
+            try
+            {
+                // The unified (v2) hierarchy is the '0::<path>' entry, and it is only mounted here when it is the one in use
+                string unified = File.ReadAllLines($"{ProcPath}/self{ProcCgroupPath}").FirstOrDefault(line => line.StartsWith("0::"));
+                if (unified == null || !File.Exists($"{CgroupFileSystemPath}/cgroup.controllers"))
+                {
+                    return null;
+                }
+
+                // Processes can't live in a cgroup that distributes resources to its children, so the cgroup of the pip can't go under our own one
+                string current = unified.Substring(3).TrimEnd('/');
+                string parent = current.Substring(0, Math.Max(current.LastIndexOf('/'), 0));
+                string path = $"{CgroupFileSystemPath}{parent}/{name}";
+
+                Directory.CreateDirectory(path);
+                return path;
+            }
+#pragma warning disable
+            catch (Exception)
+            {
+                return null;
+            }
+#pragma warning restore
+        }
+
+        /// <summary>
+        /// Linux specific implementation of <see cref="Process.GetCgroupResourceUsage"/>
+        /// </summary>
+        internal static int GetCgroupResourceUsage(string cgroupPath, ref ProcessResourceUsage buffer)
+        {
+            try
+            {
+                string[] lines = File.ReadAllLines($"{cgroupPath}/cpu.stat");
+                buffer.UserTimeMs = ExtractValueFromProcLine(lines.FirstOrDefault(line => line.StartsWith("user_usec "))) / 1000;
+                buffer.SystemTimeMs = ExtractValueFromProcLine(lines.FirstOrDefault(line => line.StartsWith("system_usec "))) / 1000;
+
+                // memory.peak was added in Linux 5.19
+                buffer.PeakWorkingSetSize = ReadCgroupValue(cgroupPath, "memory.peak");
+                buffer.WorkingSetSize = ReadCgroupValue(cgroupPath, "memory.current");
+
+                // One line per device: '<major>:<minor> rbytes=<n> wbytes=<n> rios=<n> wios=<n> dbytes=<n> dios=<n>'
+                buffer.DiskBytesRead = buffer.DiskBytesWritten = buffer.DiskReadOps = buffer.DiskWriteOps = 0;
+                if (File.Exists($"{cgroupPath}/io.stat"))
+                {
+                    foreach (var line in File.ReadAllLines($"{cgroupPath}/io.stat"))
+                    {
+                        foreach (var field in line.Split(new[] { ' ' }, StringSplitOptions.RemoveEmptyEntries).Skip(1))
+                        {
+                            int separator = field.IndexOf('=');
+                            if (separator < 0 || !ulong.TryParse(field.Substring(separator + 1), out var value))
+                            {
+                                continue;
+                            }
+
+                            switch (field.Substring(0, separator))
+                            {
+                                case "rbytes": buffer.DiskBytesRead += value; break;
+                                case "wbytes": buffer.DiskBytesWritten += value; break;
+                                case "rios": buffer.DiskReadOps += value; break;
+                                case "wios": buffer.DiskWriteOps += value; break;
+                            }
+                        }
+                    }
+                }
+
+                return 0;
+            }
+#pragma warning disable
+            catch (Exception)
+            {
+                return ERROR;
+            }
+#pragma warning restore
+        }
+
+        private static ulong ReadCgroupValue(string cgroupPath, string file)
+        {
+            string path = $"{cgroupPath}/{file}";
+            return File.Exists(path) && ulong.TryParse(File.ReadAllText(path).Trim(), out var value) ? value : 0;
+        }
+
+        /// <summary>
+        /// Linux specific implementation of <see cref="Process.TryRemoveCgroup"/>
+        /// </summary>
+        internal static bool TryRemoveCgroup(string cgroupPath)
+        {
+            try
+            {
+                // A cgroup is removed with rmdir, even though it still lists its interface files
+                Directory.Delete(cgroupPath, recursive: false);
+                return true;
+            }
+#pragma warning disable
+            catch (Exception)
+            {
+                return false;
+            }
+#pragma warning restore
+        }
+
         internal static int GetProcessMemoryUsageSnapshot(int pid, ref ProcessResourceUsage buffer, long bufferSize, bool includeChildProcesses)
         {
             var resourceUsage = GetResourceUsageForProcessTree(pid, includeChildProcesses);
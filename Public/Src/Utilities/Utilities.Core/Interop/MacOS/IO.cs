@@ -134,6 +134,38 @@ namespace BuildXL.Interop.Unix
             public DateTime ToUtcDateTime(long sec, long nsec) => new Timespec { Tv_sec = sec, Tv_nsec = nsec }.ToUtcTime();
         }
 
+        /// <summary>
+        /// Changes <see cref="SetFileAttributes(FileAttributeUpdate[], byte[], int)"/> applies to a file
+        /// </summary>
+        [Flags]
+        public enum FileAttributeUpdateFlags : int
+        {
+            None = 0,
+            Timestamps = 0x1, // Set the timestamps, as SetTimeStampsForFilePath does
+            Mode = 0x2, // Set the permission bits, as SetFilePermissionsForFilePath does
+            FollowSymlink = 0x4, // Apply the changes to the target of a symlink rather than to the symlink itself
+        }
+
+        /// <summary>
+        /// A file <see cref="SetFileAttributes(FileAttributeUpdate[], byte[], int)"/> changes, and the outcome of the changes
+        /// </summary>
+        [StructLayout(LayoutKind.Sequential)]
+        public struct FileAttributeUpdate
+        {
+            public int PathOffset; // Offset of the null-terminated UTF-8 path of the file in the paths buffer
+            public FileAttributeUpdateFlags Flags;
+            public FilePermissions Mode;
+            public int Status; // Set to 0 when every change was applied, to the error of the first one that failed otherwise
+            public long TimeLastAccess;
+            public long TimeNSecLastAccess;
+            public long TimeLastModification;
+            public long TimeNSecLastModification;
+            public long TimeLastStatusChange;
+            public long TimeNSecLastStatusChange;
+            public long TimeCreation;
+            public long TimeNSecCreation;
+        }
+
         public enum FilePermissions : int
         {
             S_ISUID = 0x0800, // Set user ID on execution
@@ -187,6 +219,22 @@ namespace BuildXL.Interop.Unix
             ? Impl_Mac.StatFileDescriptor(fd, ref statBuf)
             : Impl_Linux.StatFileDescriptor(fd, ref statBuf);
 
+        /// <summary>
+        /// Stats the next entries of the directory open as <paramref name="fd" /> with a single call, as if with 'lstat' (the size
+        /// of a directory is reported as 0). Calling it again on the same descriptor continues where the previous call stopped.
+        /// </summary>
+        /// <returns>
+        /// The number of entries stored in <paramref name="statBufs"/>, whose names are stored in <paramref name="names"/> in the same
+        /// order as null-terminated UTF-8 strings. 0 is returned once there are no more entries; -1 upon error, in which case
+        /// <see cref="Marshal.GetLastWin32Error"/> is set to indicate the error.
+        /// </returns>
+        /// <remarks>
+        /// Only implemented on macOS. <paramref name="names"/> must have room for at least one entry with the longest possible name.
+        /// </remarks>
+        public static int StatDirectoryEntries(SafeFileHandle fd, StatBuffer[] statBufs, byte[] names) => IsMacOS
+            ? Impl_Mac.StatDirectoryEntries(fd, statBufs, names)
+            : throw new NotImplementedException();
+
         /// <summary>
         /// Gets the name (e.g., "EXT4", "APFS", etc.) of the filesystem on which file <paramref name="fd" /> resides.
         /// </summary>
@@ -215,6 +263,28 @@ namespace BuildXL.Interop.Unix
             ? Impl_Mac.SetTimeStampsForFilePath(path, followSymlink, buffer)
             : Impl_Linux.SetTimeStampsForFilePath(path, followSymlink, buffer);
 
+        /// <summary>
+        /// Applies the timestamp and permission changes of a batch of files with a single call, optionally spreading them over
+        /// <paramref name="threadCount"/> threads. The paths in <paramref name="paths"/> are absolute (or relative to the current directory).
+        /// </summary>
+        /// <returns>
+        /// The number of files for which some change failed, whose <see cref="FileAttributeUpdate.Status"/> is the error of the
+        /// first failed change; -1 upon invalid arguments, in which case <see cref="Marshal.GetLastWin32Error"/> is set to indicate the error.
+        /// </returns>
+        /// <remarks>
+        /// Only implemented on macOS.
+        /// </remarks>
+        public static int SetFileAttributes(FileAttributeUpdate[] updates, byte[] paths, int threadCount = 1) => IsMacOS
+            ? Impl_Mac.SetFileAttributes(updates, paths, threadCount)
+            : throw new NotImplementedException();
+
+        /// <summary>
+        /// Same as <see cref="SetFileAttributes(FileAttributeUpdate[], byte[], int)"/>, with paths relative to the directory open as <paramref name="directory"/>.
+        /// </summary>
+        public static int SetFileAttributes(SafeFileHandle directory, FileAttributeUpdate[] updates, byte[] paths, int threadCount = 1) => IsMacOS
+            ? Impl_Mac.SetFileAttributes(directory, updates, paths, threadCount)
+            : throw new NotImplementedException();
+
         /// <summary>
         /// Deletes a directory
         /// </summary>
@@ -145,6 +145,15 @@ namespace BuildXL.Interop.Unix
         [DllImport(Libraries.BuildXLInteropLibMacOS, SetLastError = true)]
         private static extern int StatFile(string path, bool followSymlink, ref StatBuffer statBuf, long statBufferSize);
 
+        [DllImport(Libraries.BuildXLInteropLibMacOS, SetLastError = true)]
+        private static extern int StatDirectoryEntries(SafeFileHandle fd, [Out] StatBuffer[] statBufs, int statBufsCount, long statBufferSize, [Out] byte[] names, long namesSize);
+
+        [DllImport(Libraries.BuildXLInteropLibMacOS, SetLastError = true)]
+        private static extern int SetFileAttributes(SafeFileHandle dirfd, [In, Out] FileAttributeUpdate[] updates, int updatesCount, long updateSize, byte[] paths, long pathsSize, int threadCount);
+
+        [DllImport(Libraries.BuildXLInteropLibMacOS, SetLastError = true, EntryPoint = "SetFileAttributes")]
+        private static extern int SetFileAttributes(IntPtr dirfd, [In, Out] FileAttributeUpdate[] updates, int updatesCount, long updateSize, byte[] paths, long pathsSize, int threadCount);
+
         /// <summary>OSX specific implementation of <see cref="IO.GetFileSystemType"/> </summary>
         [DllImport(Libraries.BuildXLInteropLibMacOS, SetLastError = true, CharSet = CharSet.Ansi)]
         internal static extern int GetFileSystemType(SafeFileHandle fd, StringBuilder fsTypeName, long bufferSize);
@@ -157,6 +166,18 @@ namespace BuildXL.Interop.Unix
         internal unsafe static int StatFile(string path, bool followSymlink, ref StatBuffer statBuf)
             => StatFile(path, followSymlink, ref statBuf, sizeof(StatBuffer));
 
+        /// <summary>OSX specific implementation of <see cref="IO.StatDirectoryEntries"/> </summary>
+        internal unsafe static int StatDirectoryEntries(SafeFileHandle fd, StatBuffer[] statBufs, byte[] names)
+            => StatDirectoryEntries(fd, statBufs, statBufs.Length, sizeof(StatBuffer), names, names.Length);
+
+        /// <summary>OSX specific implementation of <see cref="IO.SetFileAttributes(FileAttributeUpdate[], byte[], int)"/> </summary>
+        internal unsafe static int SetFileAttributes(FileAttributeUpdate[] updates, byte[] paths, int threadCount)
+            => SetFileAttributes(new IntPtr(-1), updates, updates.Length, sizeof(FileAttributeUpdate), paths, paths.Length, threadCount);
+
+        /// <summary>OSX specific implementation of <see cref="IO.SetFileAttributes(SafeFileHandle, FileAttributeUpdate[], byte[], int)"/> </summary>
+        internal unsafe static int SetFileAttributes(SafeFileHandle directory, FileAttributeUpdate[] updates, byte[] paths, int threadCount)
+            => SetFileAttributes(directory, updates, updates.Length, sizeof(FileAttributeUpdate), paths, paths.Length, threadCount);
+
         /// <summary>OSX specific implementation of <see cref="IO.SafeReadLink"/> </summary>
         [DllImport(Libraries.BuildXLInteropLibMacOS, SetLastError = true, CharSet = CharSet.Ansi)]
         internal static extern long SafeReadLink(string link, StringBuilder buffer, long length);
@@ -195,12 +216,31 @@ namespace BuildXL.Interop.Unix
         [DllImport(Libraries.BuildXLInteropLibMacOS)]
         internal static extern int GetProcessResourceUsageSnapshot(int pid, ref ProcessResourceUsage buffer, long bufferSize, bool includeChildProcesses);
 
+        [DllImport(Libraries.BuildXLInteropLibMacOS)]
+        internal static extern int GetProcessResourceUsageSnapshots(int[] pids, int count, [In, Out] ProcessResourceUsage[] buffers, long bufferSize, bool includeChildProcesses);
+
         [DllImport(Libraries.BuildXLInteropLibMacOS)]
         internal static extern int GetMemoryPressureLevel(ref PressureLevel level);
 
+        [DllImport(Libraries.BuildXLInteropLibMacOS)]
+        [return: MarshalAs(UnmanagedType.I1)]
+        internal static extern bool StartMemoryPressureNotifications(MemoryPressureCallback callback);
+
+        [DllImport(Libraries.BuildXLInteropLibMacOS)]
+        internal static extern void StopMemoryPressureNotifications();
+
         [DllImport(Libraries.BuildXLInteropLibMacOS)]
         internal static extern int GetCpuLoadInfo(ref CpuLoadInfo buffer, long bufferSize);
 
+        [DllImport(Libraries.BuildXLInteropLibMacOS)]
+        internal static extern IntPtr CreateCpuSampler();
+
+        [DllImport(Libraries.BuildXLInteropLibMacOS)]
+        internal static extern void DestroyCpuSampler(IntPtr sampler);
+
+        [DllImport(Libraries.BuildXLInteropLibMacOS)]
+        internal static extern int SampleCpuLoad(IntPtr sampler, ref CpuLoadDelta buffer, long bufferSize, uint[] coreUsages, int coreUsagesCount);
+
         #region Sandbox
         [DllImport(Libraries.BuildXLInteropLibMacOS)]
         internal static extern unsafe int NormalizePathAndReturnHash(byte[] pPath, byte* buffer, int bufferLength);
@@ -50,5 +50,51 @@ namespace BuildXL.Interop.Unix
         public static int GetMemoryPressureLevel(ref PressureLevel level) => IsMacOS
             ? Impl_Mac.GetMemoryPressureLevel(ref level)
             : Impl_Linux.GetMemoryPressureLevel(ref level);
+
+        /// <summary>
+        /// Receives the new VM memory pressure level whenever it changes
+        /// </summary>
+        [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+        public delegate void MemoryPressureCallback(PressureLevel level);
+
+        /// <summary>
+        /// Kept alive for as long as the native side may call it
+        /// </summary>
+        private static MemoryPressureCallback s_memoryPressureCallback;
+
+        /// <summary>
+        /// Starts pushing VM memory pressure level transitions to <paramref name="callback"/> as soon as the OS signals them
+        /// (on a thread of the OS, so the callback should not block). While notifications are on, <see cref="GetMemoryPressureLevel"/>
+        /// returns the last level that was pushed without querying the OS.
+        /// </summary>
+        /// <returns>False if notifications are already started or not supported (they are only supported on macOS)</returns>
+        public static bool StartMemoryPressureNotifications(MemoryPressureCallback callback)
+        {
+            if (!IsMacOS || s_memoryPressureCallback != null)
+            {
+                return false;
+            }
+
+            s_memoryPressureCallback = callback;
+            if (!Impl_Mac.StartMemoryPressureNotifications(callback))
+            {
+                s_memoryPressureCallback = null;
+                return false;
+            }
+
+            return true;
+        }
+
+        /// <summary>
+        /// Stops the notifications started by <see cref="StartMemoryPressureNotifications"/>
+        /// </summary>
+        public static void StopMemoryPressureNotifications()
+        {
+            if (IsMacOS && s_memoryPressureCallback != null)
+            {
+                Impl_Mac.StopMemoryPressureNotifications();
+                s_memoryPressureCallback = null;
+            }
+        }
     }
 }
@@ -3,6 +3,7 @@
 
 using System;
 using System.Collections.Generic;
+using System.Diagnostics.ContractsLight;
 using System.Runtime.InteropServices;
 using System.Text;
 using System.Threading.Tasks;
@@ -101,6 +102,30 @@ namespace BuildXL.Interop.Unix
             ? Impl_Mac.GetProcessResourceUsageSnapshot(pid, ref buffer, Marshal.SizeOf(buffer), includeChildProcesses)
             : Impl_Linux.GetProcessMemoryUsageSnapshot(pid, ref buffer, Marshal.SizeOf(buffer), includeChildProcesses);
 
+        /// <summary>
+        /// Same as <see cref="GetProcessMemoryUsage(int, ref ProcessResourceUsage, bool)"/> for several processes at once, filling in
+        /// <paramref name="buffers"/>[i] for <paramref name="pids"/>[i]. On macOS all the process trees are sampled in a single call.
+        /// </summary>
+        /// <returns>The result of the first failed sample, or success if all of them succeeded</returns>
+        public static int GetProcessMemoryUsage(int[] pids, ProcessResourceUsage[] buffers, bool includeChildProcesses)
+        {
+            Contract.Requires(pids.Length == buffers.Length);
+
+            if (IsMacOS)
+            {
+                return Impl_Mac.GetProcessResourceUsageSnapshots(pids, pids.Length, buffers, Marshal.SizeOf<ProcessResourceUsage>(), includeChildProcesses);
+            }
+
+            int result = 0;
+            for (int i = 0; i < pids.Length; i++)
+            {
+                int sampleResult = Impl_Linux.GetProcessMemoryUsageSnapshot(pids[i], ref buffers[i], Marshal.SizeOf<ProcessResourceUsage>(), includeChildProcesses);
+                result = result == 0 ? sampleResult : result;
+            }
+
+            return result;
+        }
+
         /// <summary>
         /// Returns a collection of process resource usage information for a process tree rooted at the given process id, snapshotting the complete process tree at the time of the call.
         /// </summary>
@@ -116,6 +141,28 @@ namespace BuildXL.Interop.Unix
             ? throw new NotImplementedException()
             : Impl_Linux.GetChildProcesses(processId);
 
+        /// <summary>
+        /// Creates an empty cgroup v2 with the given name next to the cgroup of the calling process, and returns its path.
+        /// Returns null if the unified cgroup hierarchy is not available or the cgroup can't be created (e.g. the parent is not delegated to this user).
+        /// </summary>
+        public static string TryCreateCgroup(string name) => IsMacOS
+            ? null
+            : Impl_Linux.TryCreateCgroup(name);
+
+        /// <summary>
+        /// Populates a process resource usage information buffer with the usage accounted for by the cgroup v2 at the given path, summed over all
+        /// the processes that ever ran in it. Memory usage is only available when the memory controller is enabled for the cgroup, and IO usage when the io one is.
+        /// </summary>
+        /// <returns>Zero on success, an error otherwise</returns>
+        public static int GetCgroupResourceUsage(string cgroupPath, ref ProcessResourceUsage buffer) => IsMacOS
+            ? throw new NotImplementedException()
+            : Impl_Linux.GetCgroupResourceUsage(cgroupPath, ref buffer);
+
+        /// <summary>
+        /// Removes a cgroup created with <see cref="TryCreateCgroup(string)"/>. This fails while the cgroup still has live processes.
+        /// </summary>
+        public static bool TryRemoveCgroup(string cgroupPath) => !IsMacOS && Impl_Linux.TryRemoveCgroup(cgroupPath);
+
         /// <summary>
         /// Returns true if core dump file creation for abnormal process exits has been set up successfully, and passes out
         /// the path where the system writes core dump files.
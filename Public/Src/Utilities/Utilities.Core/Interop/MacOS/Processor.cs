@@ -1,6 +1,7 @@
 // Copyright (c) Microsoft Corporation.
 // Licensed under the MIT License.
 
+using System;
 using System.Runtime.InteropServices;
 
 using static BuildXL.Interop.Dispatch;
@@ -21,8 +22,59 @@ namespace BuildXL.Interop.Unix
             public ulong UserTime;
             public ulong IdleTime;
         }
+
+        [StructLayout(LayoutKind.Sequential)]
+        public struct CpuLoadDelta
+        {
+            public uint Usage;
+            public uint PerformanceCoresUsage;
+            public uint EfficiencyCoresUsage;
+            public uint CoreCount;
+            public uint EfficiencyCoreCount;
+        }
         #pragma warning restore CS1591 // Missing XML comment for publicly visible type or member
 
+        /// <summary>
+        /// Samples the CPU utilization (in basis points) since its previous sample, overall, per kind of core (performance vs. efficiency
+        /// cores on Apple Silicon), and per logical core. Only implemented on macOS.
+        /// </summary>
+        public sealed class CpuSampler : IDisposable
+        {
+            private IntPtr m_sampler;
+
+            /// <nodoc />
+            public CpuSampler()
+            {
+                if (!IsMacOS)
+                {
+                    throw new NotImplementedException();
+                }
+
+                m_sampler = Impl_Mac.CreateCpuSampler();
+                if (m_sampler == IntPtr.Zero)
+                {
+                    throw new OutOfMemoryException();
+                }
+            }
+
+            /// <summary>
+            /// Fills in <paramref name="buffer"/> with the utilization since the previous sample (or since boot for the first one), along
+            /// with the utilization of as many logical cores as <paramref name="coreUsages"/> (if given) has room for, efficiency cores first.
+            /// </summary>
+            public int Sample(ref CpuLoadDelta buffer, uint[] coreUsages = null)
+                => Impl_Mac.SampleCpuLoad(m_sampler, ref buffer, Marshal.SizeOf(buffer), coreUsages, coreUsages?.Length ?? 0);
+
+            /// <inheritdoc />
+            public void Dispose()
+            {
+                if (m_sampler != IntPtr.Zero)
+                {
+                    Impl_Mac.DestroyCpuSampler(m_sampler);
+                    m_sampler = IntPtr.Zero;
+                }
+            }
+        }
+
         /// <summary>
         /// Returns the current CPU load info accross all CPU cores to the caller
         /// </summary>
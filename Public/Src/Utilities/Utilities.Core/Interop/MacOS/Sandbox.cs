@@ -309,6 +309,23 @@ namespace BuildXL.Interop.Unix
             ulong address,
             uint port);
 
+        /// <summary>
+        /// Receives the reports dequeued without waiting in between, <paramref name="count"/> at a time.
+        /// Reports are only delivered with <see cref="ReportQueueSuccessCode"/>; any other error comes with no reports.
+        /// </summary>
+        [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+        public delegate void AccessReportBatchCallback(
+            [MarshalAs(UnmanagedType.LPArray, SizeParamIndex = 1)] AccessReport[] reports,
+            int count,
+            int error);
+
+        [DllImport(Libraries.BuildXLInteropLibMacOS, CallingConvention=CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
+        public static extern void ListenForFileAccessReportBatches(
+            [MarshalAs(UnmanagedType.FunctionPtr)] AccessReportBatchCallback callbackPointer,
+            long accessReportSize,
+            ulong address,
+            uint port);
+
         /// <summary>
         /// Callback the kernel extension can use to report any unrecoverable failures.
         ///